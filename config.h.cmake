@@ -7,11 +7,24 @@
 
 #cmakedefine HAVE_LCHMOD
 #cmakedefine HAVE_FDATASYNC
+#cmakedefine HAVE_COPY_FILE_RANGE
+#cmakedefine HAVE_SYNCFS
+#cmakedefine HAVE_SYNC_FILE_RANGE
+#cmakedefine HAVE_STATX
 
 #cmakedefine HAVE_DIRENT_D_TYPE
 
+#cmakedefine HAVE_LINUX_IO_URING_H
+#cmakedefine HAVE_IORING_OP_STATX
+#cmakedefine HAVE_LINUX_FSCRYPT_H
+
+#cmakedefine HAVE_ZLIB
+#cmakedefine HAVE_LIBARGON2
+
 #cmakedefine DEFAULT_CASE_INSENSITIVE
 
 /* TODO: add other thread library support. */
 #cmakedefine CMAKE_USE_PTHREADS_INIT
 
+#cmakedefine ENCFS_USDT
+
@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Counts the heap allocations of each thread for Stats, by replacing the
+// global operator new.  Linked into the encfs binary with ENABLE_ALLOC_STATS
+// and into the unit tests only, never into the library.  Memory still comes
+// from malloc, so the default operator delete would do, but it is replaced
+// as well to keep the pair together.
+
+#include <cstdlib>
+#include <new>
+
+#include "Stats.h"
+
+using encfs::Stats;
+
+namespace {
+
+void *allocate(std::size_t size) {
+  Stats::allocated();
+  void *p = malloc(size == 0 ? 1 : size);
+  while (p == nullptr) {
+    std::new_handler handler = std::set_new_handler(nullptr);
+    std::set_new_handler(handler);
+    if (handler == nullptr) {
+      return nullptr;
+    }
+    handler();
+    p = malloc(size == 0 ? 1 : size);
+  }
+  return p;
+}
+
+// before main, and before any thread but the first
+struct Hook {
+  Hook() { Stats::hookAllocations(); }
+} hook;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  void *p = allocate(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete[](void *p) noexcept { free(p); }
+
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
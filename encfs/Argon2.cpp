@@ -0,0 +1,174 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "Argon2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <openssl/opensslv.h>
+#include <thread>
+
+#include "config.h"
+
+// OpenSSL has Argon2 from 3.2 on, libargon2 (the reference implementation)
+// is used with older versions when it is installed
+#if OPENSSL_VERSION_NUMBER >= 0x30200000L
+#define ARGON2_OPENSSL
+#include <openssl/core_names.h>
+#include <openssl/kdf.h>
+#include <openssl/params.h>
+#include <openssl/thread.h>
+#elif defined(HAVE_LIBARGON2)
+#include <argon2.h>
+#endif
+
+namespace encfs {
+
+namespace Argon2 {
+
+#if defined(ARGON2_OPENSSL) || defined(HAVE_LIBARGON2)
+namespace {
+
+// the limits of RFC 9106 3.1 which encfs cares about
+bool validParams(const Params &params, size_t saltLen, size_t outLen) {
+  return params.passes >= 1 && params.lanes >= 1 &&
+         params.lanes < (1u << 24) && params.memoryKiB >= 8 * params.lanes &&
+         saltLen >= 8 && outLen >= 4;
+}
+
+// the lanes are filled in parallel, one thread each up to the number of
+// cores
+uint32_t threadsFor(const Params &params) {
+  uint32_t threads = std::thread::hardware_concurrency();
+  return std::max(1u, std::min(threads, params.lanes));
+}
+
+}  // namespace
+#endif
+
+#if defined(ARGON2_OPENSSL)
+
+bool supported() {
+  EVP_KDF *kdf = EVP_KDF_fetch(nullptr, "ARGON2ID", nullptr);
+  EVP_KDF_free(kdf);
+  return kdf != nullptr;
+}
+
+bool derive(const Params &params, const unsigned char *password,
+            size_t passwordLen, const unsigned char *salt, size_t saltLen,
+            unsigned char *out, size_t outLen, const unsigned char *secret,
+            size_t secretLen, const unsigned char *ad, size_t adLen) {
+  if (!validParams(params, saltLen, outLen)) {
+    return false;
+  }
+
+  EVP_KDF *kdf = EVP_KDF_fetch(nullptr, "ARGON2ID", nullptr);
+  if (kdf == nullptr) {
+    return false;
+  }
+  EVP_KDF_CTX *ctx = EVP_KDF_CTX_new(kdf);
+  EVP_KDF_free(kdf);
+  if (ctx == nullptr) {
+    return false;
+  }
+
+  // OpenSSL only starts threads up to its (process wide) limit
+  uint64_t threads = threadsFor(params);
+  if (OSSL_get_max_threads(nullptr) < threads &&
+      OSSL_set_max_threads(nullptr, threads) != 1) {
+    threads = 1;
+  }
+
+  uint32_t passes = params.passes;
+  uint32_t memoryKiB = params.memoryKiB;
+  uint32_t lanes = params.lanes;
+  uint32_t threads32 = (uint32_t)threads;
+  OSSL_PARAM p[9];
+  OSSL_PARAM *q = p;
+  *q++ = OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_ITER, &passes);
+  *q++ =
+      OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_ARGON2_MEMCOST, &memoryKiB);
+  *q++ = OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_ARGON2_LANES, &lanes);
+  *q++ = OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_THREADS, &threads32);
+  *q++ = OSSL_PARAM_construct_octet_string(
+      OSSL_KDF_PARAM_PASSWORD, const_cast<unsigned char *>(password),
+      passwordLen);
+  *q++ = OSSL_PARAM_construct_octet_string(
+      OSSL_KDF_PARAM_SALT, const_cast<unsigned char *>(salt), saltLen);
+  if (secretLen > 0) {
+    *q++ = OSSL_PARAM_construct_octet_string(
+        OSSL_KDF_PARAM_SECRET, const_cast<unsigned char *>(secret), secretLen);
+  }
+  if (adLen > 0) {
+    *q++ = OSSL_PARAM_construct_octet_string(
+        OSSL_KDF_PARAM_ARGON2_AD, const_cast<unsigned char *>(ad), adLen);
+  }
+  *q = OSSL_PARAM_construct_end();
+
+  bool ok = EVP_KDF_derive(ctx, out, outLen, p) == 1;
+  EVP_KDF_CTX_free(ctx);
+  return ok;
+}
+
+#elif defined(HAVE_LIBARGON2)
+
+bool supported() { return true; }
+
+bool derive(const Params &params, const unsigned char *password,
+            size_t passwordLen, const unsigned char *salt, size_t saltLen,
+            unsigned char *out, size_t outLen, const unsigned char *secret,
+            size_t secretLen, const unsigned char *ad, size_t adLen) {
+  if (!validParams(params, saltLen, outLen)) {
+    return false;
+  }
+
+  argon2_context ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.out = out;
+  ctx.outlen = (uint32_t)outLen;
+  ctx.pwd = const_cast<uint8_t *>(password);
+  ctx.pwdlen = (uint32_t)passwordLen;
+  ctx.salt = const_cast<uint8_t *>(salt);
+  ctx.saltlen = (uint32_t)saltLen;
+  ctx.secret = const_cast<uint8_t *>(secret);
+  ctx.secretlen = (uint32_t)secretLen;
+  ctx.ad = const_cast<uint8_t *>(ad);
+  ctx.adlen = (uint32_t)adLen;
+  ctx.t_cost = params.passes;
+  ctx.m_cost = params.memoryKiB;
+  ctx.lanes = params.lanes;
+  ctx.threads = threadsFor(params);
+  ctx.version = ARGON2_VERSION_13;
+  ctx.flags = ARGON2_DEFAULT_FLAGS;
+
+  return argon2_ctx(&ctx, Argon2_id) == ARGON2_OK;
+}
+
+#else
+
+bool supported() { return false; }
+
+bool derive(const Params &, const unsigned char *, size_t,
+            const unsigned char *, size_t, unsigned char *, size_t,
+            const unsigned char *, size_t, const unsigned char *, size_t) {
+  return false;
+}
+
+#endif
+
+}  // namespace Argon2
+
+}  // namespace encfs
@@ -0,0 +1,62 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _Argon2_incl_
+#define _Argon2_incl_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace encfs {
+
+/*
+    Argon2id (RFC 9106), version 0x13, used to derive the user key from the
+    password.  It is computed by OpenSSL 3.2 or later, or by libargon2 with
+    older versions; builds with neither don't support it.
+
+    The memory is split into lanes which are filled at the same time, one
+    thread per lane up to the number of cores, so a derivation which takes
+    the same CPU time and memory on an attacker's hardware completes faster
+    on a machine with many cores.  The result only depends on the
+    parameters, not on the number of threads used.
+*/
+namespace Argon2 {
+
+struct Params {
+  uint32_t passes;     // t, at least 1
+  uint32_t memoryKiB;  // m, at least 8 KiB per lane
+  uint32_t lanes;      // p, 1 to 2^24 - 1
+};
+
+// true if this build can compute Argon2id
+bool supported();
+
+// Derive outLen (at least 4) bytes into out, from a salt of at least 8
+// bytes.  Returns false if the parameters are invalid or the memory can't
+// be had.
+bool derive(const Params &params, const unsigned char *password,
+            size_t passwordLen, const unsigned char *salt, size_t saltLen,
+            unsigned char *out, size_t outLen,
+            const unsigned char *secret = nullptr, size_t secretLen = 0,
+            const unsigned char *ad = nullptr, size_t adLen = 0);
+
+}  // namespace Argon2
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,264 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AsyncLog.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <syslog.h>
+#include <time.h>
+#include <utility>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+const size_t AsyncLog::LineSize;
+
+// The logs of the process, for the fork handlers
+static pthread_once_t forkOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t logsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::set<AsyncLog *> *logs = nullptr;
+
+AsyncLog::AsyncLog(size_t slots, int maxPerSecond, Sink sink)
+    : _mask([slots]() {
+        size_t n = 1;
+        while (n < slots) {
+          n <<= 1;
+        }
+        return n - 1;
+      }()),
+      _maxPerSecond(maxPerSecond),
+      _sink(std::move(sink)),
+      _slots(new Slot[_mask + 1]),
+      _tail(0),
+      _head(0),
+      _written(0),
+      _second(0),
+      _inSecond(0),
+      _lastChannel(0),
+      _dropped(0),
+      _droppedTotal(0),
+      _running(false),
+      _sleeping(false),
+      _stop(false) {
+  for (size_t i = 0; i <= _mask; ++i) {
+    _slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+  pthread_mutex_init(&_startMutex, nullptr);
+  sem_init(&_wake, 0, 0);
+
+  pthread_once(&forkOnce, AsyncLog::registerFork);
+  Lock lock(logsMutex);
+  if (logs == nullptr) {
+    logs = new std::set<AsyncLog *>();
+  }
+  logs->insert(this);
+}
+
+AsyncLog::~AsyncLog() {
+  {
+    Lock lock(logsMutex);
+    logs->erase(this);
+  }
+
+  {
+    Lock lock(_startMutex);
+    _stop = true;
+    if (_running) {
+      sem_post(&_wake);
+      pthread_join(_thread, nullptr);
+      _running = false;
+    }
+  }
+  // left over if the thread couldn't be started
+  drain();
+  reportDropped();
+
+  sem_destroy(&_wake);
+  pthread_mutex_destroy(&_startMutex);
+  delete[] _slots;
+}
+
+bool AsyncLog::write(int channel, int priority, const char *line,
+                     size_t len) {
+  if (priority >= LOG_NOTICE && limited()) {
+    ++_dropped;
+    ++_droppedTotal;
+    return false;
+  }
+
+  uint64_t pos = _tail.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &_slots[pos & _mask];
+    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    int64_t diff = (int64_t)seq - (int64_t)pos;
+    if (diff == 0) {
+      if (_tail.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // full
+      ++_dropped;
+      ++_droppedTotal;
+      return false;
+    } else {
+      pos = _tail.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->channel = channel;
+  slot->priority = priority;
+  slot->len = (uint32_t)std::min(len, LineSize);
+  memcpy(slot->text, line, slot->len);
+  slot->seq.store(pos + 1);
+
+  if (!_running.load(std::memory_order_relaxed) && !start()) {
+    // no thread, write out here
+    Lock lock(_startMutex);
+    drain();
+    return true;
+  }
+  if (_sleeping.load()) {
+    sem_post(&_wake);
+  }
+  return true;
+}
+
+void AsyncLog::flush() {
+  uint64_t target = _tail.load();
+  if (!_running && !start()) {
+    Lock lock(_startMutex);
+    drain();
+    return;
+  }
+  while (_written.load() < target) {
+    sem_post(&_wake);
+    struct timespec delay = {0, 1000000};
+    nanosleep(&delay, nullptr);
+  }
+}
+
+bool AsyncLog::limited() {
+  if (_maxPerSecond <= 0) {
+    return false;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  int64_t second = _second.load(std::memory_order_relaxed);
+  if (second != now.tv_sec &&
+      _second.compare_exchange_strong(second, now.tv_sec)) {
+    _inSecond.store(0, std::memory_order_relaxed);
+  }
+  return _inSecond.fetch_add(1, std::memory_order_relaxed) >= _maxPerSecond;
+}
+
+bool AsyncLog::start() {
+  Lock lock(_startMutex);
+  if (_running) {
+    return true;
+  }
+  if (_stop || pthread_create(&_thread, nullptr, AsyncLog::run, this) != 0) {
+    return false;
+  }
+  _running = true;
+  return true;
+}
+
+void *AsyncLog::run(void *arg) {
+  static_cast<AsyncLog *>(arg)->loop();
+  return nullptr;
+}
+
+void AsyncLog::loop() {
+  while (true) {
+    drain();
+    reportDropped();
+    if (_stop) {
+      break;
+    }
+
+    // A write publishing its slot after this sees _sleeping and wakes us
+    _sleeping = true;
+    if (_slots[_head & _mask].seq.load() == _head + 1) {
+      _sleeping = false;
+      continue;
+    }
+    sem_wait(&_wake);
+    _sleeping = false;
+  }
+  drain();
+}
+
+void AsyncLog::drain() {
+  while (true) {
+    Slot &slot = _slots[_head & _mask];
+    if (slot.seq.load(std::memory_order_acquire) != _head + 1) {
+      break;
+    }
+    _sink(slot.channel, slot.priority, slot.text, slot.len);
+    _lastChannel = slot.channel;
+    slot.seq.store(_head + _mask + 1, std::memory_order_release);
+    ++_head;
+    _written.store(_head);
+  }
+}
+
+void AsyncLog::reportDropped() {
+  uint64_t dropped = _dropped.exchange(0);
+  if (dropped != 0) {
+    char line[64];
+    int len = snprintf(line, sizeof(line), "dropped %" PRIu64 " log lines",
+                       dropped);
+    _sink(_lastChannel, LOG_WARNING, line, (size_t)len);
+  }
+}
+
+void AsyncLog::registerFork() {
+  pthread_atfork(AsyncLog::beforeFork, AsyncLog::afterForkParent,
+                 AsyncLog::afterForkChild);
+}
+
+void AsyncLog::beforeFork() {
+  pthread_mutex_lock(&logsMutex);
+  // so that the child doesn't write the queued lines again
+  for (AsyncLog *log : *logs) {
+    if (log->_running) {
+      log->flush();
+    }
+  }
+}
+
+void AsyncLog::afterForkParent() { pthread_mutex_unlock(&logsMutex); }
+
+void AsyncLog::afterForkChild() {
+  // The threads stayed with the parent, start them again when needed
+  for (AsyncLog *log : *logs) {
+    log->_running = false;
+    log->_sleeping = false;
+    pthread_mutex_init(&log->_startMutex, nullptr);
+    sem_init(&log->_wake, 0, 0);
+  }
+  pthread_mutex_unlock(&logsMutex);
+}
+
+}  // namespace encfs
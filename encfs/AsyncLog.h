@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AsyncLog_incl_
+#define _AsyncLog_incl_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
+namespace encfs {
+
+/*
+    Log lines written on a background thread, so that logging doesn't hold
+    up the FUSE threads with writes to a terminal or syslog.
+
+    Lines are copied into a fixed ring of slots, which producers claim
+    without locks; a line longer than a slot is cut short.  A single thread
+    hands them to the sink in order.  Nothing waits for room: once the ring
+    is full, lines are dropped.  Lines of priority LOG_NOTICE and below
+    (info, debug and verbose) are also dropped beyond maxPerSecond in a
+    second.  The number dropped is reported through the sink, on the
+    channel of the last line written, once there is room again.
+
+    The thread is started on first use, and again in the child of a fork.
+*/
+class AsyncLog {
+ public:
+  // Gets each line with the channel and syslog priority it was written
+  // with, without a newline
+  typedef std::function<void(int channel, int priority, const char *line,
+                             size_t len)>
+      Sink;
+
+  // slots is rounded up to a power of two.  maxPerSecond of 0 doesn't
+  // limit the rate.
+  AsyncLog(size_t slots, int maxPerSecond, Sink sink);
+  ~AsyncLog();
+
+  AsyncLog(const AsyncLog &src) = delete;
+  AsyncLog &operator=(const AsyncLog &src) = delete;
+
+  // Queue a line, given without a newline, for the sink.  channel is up to
+  // the caller.  Returns false if the line was dropped.
+  bool write(int channel, int priority, const char *line, size_t len);
+
+  // Return once the lines queued so far have been passed to the sink
+  void flush();
+
+  // lines dropped since the log was created
+  uint64_t dropped() const { return _droppedTotal; }
+
+  // Longest line kept whole
+  static const size_t LineSize = 500;
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    int channel;
+    int priority;
+    uint32_t len;
+    char text[LineSize];
+  };
+
+  static void *run(void *arg);
+  void loop();
+  void drain();
+  void reportDropped();
+  bool start();
+  bool limited();
+
+  static void registerFork();
+  static void beforeFork();
+  static void afterForkParent();
+  static void afterForkChild();
+
+  const size_t _mask;
+  const int _maxPerSecond;
+  const Sink _sink;
+  Slot *_slots;
+
+  std::atomic<uint64_t> _tail;  // next slot to claim
+  uint64_t _head;               // next slot to write out, for the thread
+  std::atomic<uint64_t> _written;
+
+  // rate limit, per second of CLOCK_MONOTONIC_COARSE
+  std::atomic<int64_t> _second;
+  std::atomic<int> _inSecond;
+
+  int _lastChannel;
+  std::atomic<uint64_t> _dropped;  // not reported yet
+  std::atomic<uint64_t> _droppedTotal;
+
+  pthread_mutex_t _startMutex;
+  std::atomic<bool> _running;
+  std::atomic<bool> _sleeping;
+  std::atomic<bool> _stop;
+  pthread_t _thread;
+  sem_t _wake;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,168 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AttrCache.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+static void wipe(std::string &str) { str.assign(str.length(), '\0'); }
+
+static uint64_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+AttrCache::AttrCache(size_t maxEntries, int timeout)
+    : _capacity(maxEntries),
+      _timeout(timeout),
+      _limit(maxEntries),
+      _generation(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+AttrCache::~AttrCache() {
+  clear();
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t AttrCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+void AttrCache::drop(EntryList::iterator entry) {
+  auto range = _inodes.equal_range(entry->st.st_ino);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == entry) {
+      _inodes.erase(it);
+      break;
+    }
+  }
+  _index.erase(entry->path);
+  wipe(entry->path);
+  _lru.erase(entry);
+}
+
+void AttrCache::dropInode(ino_t inode) {
+  auto range = _inodes.equal_range(inode);
+  while (range.first != range.second) {
+    drop(range.first->second);
+    range = _inodes.equal_range(inode);
+  }
+}
+
+bool AttrCache::get(const std::string &path, struct stat *st) {
+  Lock lock(_mutex);
+
+  auto it = _index.find(path);
+  if (it == _index.end()) {
+    return false;
+  }
+  if (it->second->expires <= nowMs()) {
+    drop(it->second);
+    return false;
+  }
+
+  _lru.splice(_lru.begin(), _lru, it->second);
+  *st = it->second->st;
+  return true;
+}
+
+uint64_t AttrCache::generation() const {
+  Lock lock(_mutex);
+  return _generation;
+}
+
+void AttrCache::put(const std::string &path, const struct stat &st,
+                    uint64_t generation, int timeout) {
+  if (_capacity == 0) {
+    return;
+  }
+
+  Lock lock(_mutex);
+  if (generation != _generation) {
+    return;
+  }
+
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    drop(it->second);
+  }
+
+  _lru.push_front(Entry());
+  Entry &entry = _lru.front();
+  entry.path = path;
+  entry.st = st;
+  entry.expires =
+      nowMs() + (uint64_t)(timeout < 0 ? _timeout : timeout) * 1000;
+  _index[path] = _lru.begin();
+  _inodes.emplace(st.st_ino, _lru.begin());
+
+  while (_index.size() > _limit) {
+    drop(std::prev(_lru.end()));
+  }
+}
+
+void AttrCache::setLimit(size_t limit) {
+  Lock lock(_mutex);
+  _limit = limit;
+  while (_index.size() > _limit) {
+    drop(std::prev(_lru.end()));
+  }
+}
+
+void AttrCache::invalidate(const std::string &path, bool subtree) {
+  Lock lock(_mutex);
+  ++_generation;
+
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    dropInode(it->second->st.st_ino);
+  }
+  if (!subtree) {
+    return;
+  }
+
+  std::string prefix = path;
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/') {
+    prefix += '/';
+  }
+
+  // descendants sort right after the prefix
+  for (it = _index.lower_bound(prefix);
+       it != _index.end() && it->first.compare(0, prefix.length(), prefix) == 0;) {
+    drop((it++)->second);
+  }
+  wipe(prefix);
+}
+
+void AttrCache::clear() {
+  Lock lock(_mutex);
+  ++_generation;
+  while (!_lru.empty()) {
+    drop(_lru.begin());
+  }
+}
+
+}  // namespace encfs
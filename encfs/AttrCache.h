@@ -0,0 +1,99 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AttrCache_incl_
+#define _AttrCache_incl_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+
+namespace encfs {
+
+/*
+    Bounded LRU cache of the attributes of plaintext paths, as returned by
+    getattr (sizes already decoded), used by DirNode so that repeated
+    getattr calls don't reach the backing filesystem.
+
+    Entries expire after the same time the kernel keeps attributes, and are
+    dropped when the file is changed through the mount.  Invalidating a path
+    drops every cached path with the same inode, so that hard links see the
+    change too, and everything below it.  Like NegativeCache, put() only
+    stores attributes if nothing was invalidated since generation() was read
+    before the lookup.
+*/
+class AttrCache {
+ public:
+  // Timeout, in seconds, the default attr_timeout of FUSE.
+  static const int Timeout = 1;
+
+  // entries expire after timeout seconds
+  explicit AttrCache(size_t maxEntries, int timeout = Timeout);
+  ~AttrCache();
+
+  AttrCache(const AttrCache &src) = delete;
+  AttrCache &operator=(const AttrCache &src) = delete;
+
+  bool get(const std::string &path, struct stat *st);
+
+  uint64_t generation() const;
+  // the entry expires after timeout seconds, if not negative, instead of
+  // those of the cache
+  void put(const std::string &path, const struct stat &st,
+           uint64_t generation, int timeout = -1);
+
+  // with subtree, also drop everything below path
+  void invalidate(const std::string &path, bool subtree = true);
+  void clear();
+
+  // Hold at most limit paths from now on, dropping the oldest ones.  The
+  // capacity stays what the cache was made with (see DirNode::tune).
+  void setLimit(size_t limit);
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string path;
+    struct stat st;
+    uint64_t expires;  // monotonic ms
+  };
+  using EntryList = std::list<Entry>;
+  using PathMap = std::map<std::string, EntryList::iterator>;
+
+  void drop(EntryList::iterator entry);
+  void dropInode(ino_t inode);
+
+  const size_t _capacity;
+  const int _timeout;
+
+  mutable pthread_mutex_t _mutex;
+  size_t _limit;
+  uint64_t _generation;
+  EntryList _lru;  // most recently used first
+  PathMap _index;
+  std::unordered_multimap<ino_t, EntryList::iterator> _inodes;
+};
+
+}  // namespace encfs
+
+#endif
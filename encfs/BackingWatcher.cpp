@@ -0,0 +1,171 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BackingWatcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Error.h"
+
+namespace encfs {
+
+// IN_MODIFY is needed as well as IN_CLOSE_WRITE, for writers which keep
+// their files open
+static const uint32_t WatchMask =
+    IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+BackingWatcher::BackingWatcher(const std::string &rootDir, Callback changed)
+    : _root(rootDir), _changed(std::move(changed)), _complete(true) {
+  _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (_fd < 0) {
+    int eno = errno;
+    RLOG(ERROR) << "inotify_init1 failed: " << strerror(eno);
+    throw Error("unable to watch the backing directory");
+  }
+  if (pipe2(_stop, O_CLOEXEC) != 0) {
+    close(_fd);
+    throw Error("unable to watch the backing directory");
+  }
+
+  watchTree(std::string());
+
+  int res = pthread_create(&_thread, nullptr, BackingWatcher::run, this);
+  if (res != 0) {
+    RLOG(ERROR) << "error starting watcher thread, res = " << res;
+    close(_stop[0]);
+    close(_stop[1]);
+    close(_fd);
+    throw Error("unable to watch the backing directory");
+  }
+}
+
+BackingWatcher::~BackingWatcher() {
+  char c = 0;
+  while (write(_stop[1], &c, 1) < 0 && errno == EINTR) {
+  }
+  pthread_join(_thread, nullptr);
+  close(_stop[0]);
+  close(_stop[1]);
+  close(_fd);
+}
+
+bool BackingWatcher::complete() const { return _complete; }
+
+void *BackingWatcher::run(void *arg) {
+  static_cast<BackingWatcher *>(arg)->loop();
+  return nullptr;
+}
+
+void BackingWatcher::loop() {
+  // big enough for many events, and aligned for struct inotify_event
+  alignas(struct inotify_event) char buf[64 * 1024];
+  struct pollfd fds[2];
+  fds[0].fd = _fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = _stop[0];
+  fds[1].events = POLLIN;
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      RLOG(ERROR) << "watcher poll failed: " << strerror(errno);
+      return;
+    }
+    if (fds[1].revents != 0) return;
+
+    ssize_t len;
+    while ((len = read(_fd, buf, sizeof(buf))) > 0) {
+      handle(buf, len);
+    }
+  }
+}
+
+void BackingWatcher::handle(const char *buf, ssize_t len) {
+  for (const char *p = buf; p < buf + len;) {
+    const struct inotify_event *ev =
+        reinterpret_cast<const struct inotify_event *>(p);
+    p += sizeof(struct inotify_event) + ev->len;
+
+    if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+      _changed(std::string());
+      continue;
+    }
+    auto it = _dirs.find(ev->wd);
+    if (it == _dirs.end()) continue;
+    if ((ev->mask & IN_IGNORED) != 0) {
+      // the watch is gone with its directory
+      _dirs.erase(it);
+      continue;
+    }
+
+    std::string path = it->second;
+    if (ev->len > 0 && ev->name[0] != '\0') {
+      if (!path.empty()) path += '/';
+      path += ev->name;
+    }
+    // A directory moved within the tree keeps its watch descriptors, this
+    // brings their paths up to date.  Entries made in a new directory before
+    // its watch was added are covered by the report of the directory.
+    if ((ev->mask & IN_ISDIR) != 0 &&
+        (ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+      watchTree(path);
+    }
+    _changed(path);
+  }
+}
+
+void BackingWatcher::watchTree(const std::string &path) {
+  std::string full = _root + path;
+  int wd = inotify_add_watch(_fd, full.c_str(), WatchMask);
+  if (wd < 0) {
+    if (errno == ENOSPC && _complete.exchange(false)) {
+      RLOG(WARNING) << "out of inotify watches, changes in part of the "
+                       "backing directory won't be seen (see "
+                       "fs.inotify.max_user_watches)";
+    }
+    return;
+  }
+  _dirs[wd] = path;
+
+  DIR *dir = opendir(full.c_str());
+  if (dir == nullptr) return;
+  struct dirent *de;
+  while ((de = readdir(dir)) != nullptr) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    std::string child = path.empty() ? de->d_name : path + '/' + de->d_name;
+    bool isDir = de->d_type == DT_DIR;
+    if (de->d_type == DT_UNKNOWN) {
+      struct stat st;
+      isDir = lstat((_root + child).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if (isDir) watchTree(child);
+  }
+  closedir(dir);
+}
+
+}  // namespace encfs
@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BackingWatcher_incl_
+#define _BackingWatcher_incl_
+
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+
+namespace encfs {
+
+/*
+    Watches a backing directory tree with inotify (--watch), so that caches
+    of it can follow changes which don't go through the mount: the source
+    tree of a reverse mount, or a cipher directory shared with other mounts
+    or tools.
+
+    Every directory in the tree gets a watch, including the ones created
+    later.  A change is reported by the path of the entry which changed,
+    relative to the root and without a leading '/'; for a new directory, the
+    report stands for everything in it.  An empty path means anything may
+    have changed, when the kernel's queue overflowed.  The callback runs on
+    the watcher's thread.
+
+    inotify watches are limited per user (fs.inotify.max_user_watches).  If
+    the tree has more directories than that, complete() is false and changes
+    in the directories left out go unseen.
+*/
+class BackingWatcher {
+ public:
+  using Callback = std::function<void(const std::string &path)>;
+
+  // rootDir ends with a '/'.  Throws if inotify isn't available.
+  BackingWatcher(const std::string &rootDir, Callback changed);
+  ~BackingWatcher();
+
+  BackingWatcher(const BackingWatcher &src) = delete;
+  BackingWatcher &operator=(const BackingWatcher &src) = delete;
+
+  // false if some directories have no watch
+  bool complete() const;
+
+ private:
+  static void *run(void *arg);
+  void loop();
+  void handle(const char *buf, ssize_t len);
+  void watchTree(const std::string &path);
+
+  const std::string _root;
+  Callback _changed;
+  int _fd;       // inotify
+  int _stop[2];  // pipe, written to stop the thread
+  pthread_t _thread;
+
+  std::atomic<bool> _complete;
+  // relative path of each watched directory, by watch descriptor.  Only
+  // touched by the thread after the constructor.
+  std::unordered_map<int, std::string> _dirs;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,170 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BlockArena.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "easylogging++.h"
+
+#include "Error.h"
+
+namespace encfs {
+
+static const size_t HugePageSize = 2 << 20;
+static const size_t SlotAlign = 64;
+
+static size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+BlockArena::BlockArena(size_t capacity, bool lock)
+    : _base(nullptr), _size(0), _used(0), _huge(false), _locked(false) {
+  // slack for the slot rounding, pages are only backed once touched
+  _size = roundUp(capacity + capacity / 8 + SlotAlign, HugePageSize);
+
+  void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  _huge = mem != MAP_FAILED;
+#endif
+  if (mem == MAP_FAILED) {
+    // over-allocate to align the start to a huge page
+    size_t span = _size + HugePageSize;
+    mem = mmap(nullptr, span, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      RLOG(WARNING) << "block cache mapping failed, using the heap: "
+                    << strerror(errno);
+      _size = 0;
+      return;
+    }
+    auto *start = (unsigned char *)mem;
+    auto *aligned = (unsigned char *)roundUp((size_t)start, HugePageSize);
+    if (aligned > start) {
+      munmap(start, aligned - start);
+    }
+    size_t tail = span - (aligned - start) - _size;
+    if (tail > 0) {
+      munmap(aligned + _size, tail);
+    }
+    mem = aligned;
+#ifdef MADV_HUGEPAGE
+    _huge = madvise(mem, _size, MADV_HUGEPAGE) == 0;
+#endif
+  }
+  _base = (unsigned char *)mem;
+
+#ifdef MADV_DONTDUMP
+  madvise(_base, _size, MADV_DONTDUMP);
+#endif
+  if (lock) {
+    _locked = mlock(_base, _size) == 0;
+    if (!_locked) {
+      RLOG(WARNING) << "can't lock the block cache in memory: "
+                    << strerror(errno);
+    }
+  }
+  VLOG(1) << "block cache arena of " << (_size >> 20) << " MiB"
+          << (_huge ? ", huge pages" : "") << (_locked ? ", locked" : "");
+}
+
+BlockArena::~BlockArena() {
+  if (_base != nullptr) {
+    // released slots are zero already, the rest of what was used may not be
+    memset(_base, 0, _used);
+    if (_locked) {
+      munlock(_base, _size);
+    }
+    munmap(_base, _size);
+  }
+}
+
+size_t BlockArena::slotSize(size_t len) { return roundUp(len, SlotAlign); }
+
+bool BlockArena::inMapping(const unsigned char *data) const {
+  return _base != nullptr && data >= _base && data < _base + _size;
+}
+
+unsigned char *BlockArena::allocate(size_t len) {
+  size_t slot = slotSize(len);
+  auto it = _free.find(slot);
+  if (it != _free.end() && !it->second.empty()) {
+    unsigned char *data = it->second.back();
+    it->second.pop_back();
+    return data;
+  }
+  if (_base != nullptr && _used + slot <= _size) {
+    unsigned char *data = _base + _used;
+    _used += slot;
+    return data;
+  }
+  return new unsigned char[len];
+}
+
+void BlockArena::release(unsigned char *data, size_t len) {
+  memset(data, 0, len);
+  if (inMapping(data)) {
+    _free[slotSize(len)].push_back(data);
+  } else {
+    delete[] data;
+  }
+}
+
+void BlockArena::trim() {
+  if (_base == nullptr || _locked) {
+    return;
+  }
+
+  // runs of adjacent free slots, of which the whole pages can go
+  std::vector<std::pair<unsigned char *, size_t>> slots;
+  size_t freeBytes = 0;
+  for (const auto &sized : _free) {
+    for (unsigned char *data : sized.second) {
+      slots.emplace_back(data, sized.first);
+      freeBytes += sized.first;
+    }
+  }
+  if (freeBytes == _used) {
+    // nothing is in use, start over from the beginning of the mapping
+    madvise(_base, roundUp(_used, HugePageSize), MADV_DONTNEED);
+    _free.clear();
+    _used = 0;
+    return;
+  }
+
+  std::sort(slots.begin(), slots.end());
+  const size_t page = sysconf(_SC_PAGESIZE);
+  size_t i = 0;
+  while (i < slots.size()) {
+    unsigned char *start = slots[i].first;
+    unsigned char *end = start + slots[i].second;
+    for (++i; i < slots.size() && slots[i].first == end; ++i) {
+      end += slots[i].second;
+    }
+    auto *first = (unsigned char *)roundUp((size_t)start, page);
+    auto *last = (unsigned char *)((size_t)end / page * page);
+    if (first < last) {
+      madvise(first, last - first, MADV_DONTNEED);
+    }
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,84 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BlockArena_incl_
+#define _BlockArena_incl_
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Memory for the blocks of the BlockCache, from one anonymous mapping
+    instead of many small heap allocations.
+
+    The mapping is aligned to 2 MiB and asks for huge pages, explicit ones
+    (MAP_HUGETLB) if the system has them reserved, transparent ones
+    (MADV_HUGEPAGE) otherwise, so that copying and decoding a cache full of
+    small blocks doesn't keep missing the TLB.  It is excluded from core
+    dumps, and with lock set it is mlock'ed so that the plaintext never
+    reaches swap; if that fails (RLIMIT_MEMLOCK), a warning is logged and
+    the cache works unlocked.
+
+    Blocks are carved from the mapping in slots rounded up to 64 bytes, and
+    freed slots are reused for blocks of the same slot size, which is all a
+    mount needs as its blocks come in one or two sizes.  Should the mapping
+    still run out, blocks come from the heap.  Not thread safe, BlockCache
+    holds its lock.
+*/
+class BlockArena {
+ public:
+  // room for capacity bytes of blocks
+  BlockArena(size_t capacity, bool lock);
+  ~BlockArena();
+
+  BlockArena(const BlockArena &src) = delete;
+  BlockArena &operator=(const BlockArena &src) = delete;
+
+  unsigned char *allocate(size_t len);
+  // zeroes the block
+  void release(unsigned char *data, size_t len);
+
+  // Give the pages of free slots back to the system.  They read as zeroes
+  // when used again.  Does nothing for a locked mapping.
+  void trim();
+
+  bool hugePages() const { return _huge; }
+  bool locked() const { return _locked; }
+
+  // bytes taken from the mapping so far
+  size_t mapped() const { return _used; }
+
+ private:
+  static size_t slotSize(size_t len);
+  bool inMapping(const unsigned char *data) const;
+
+  unsigned char *_base;
+  size_t _size;
+  size_t _used;
+  bool _huge;
+  bool _locked;
+
+  // free slots by slot size
+  std::unordered_map<size_t, std::vector<unsigned char *>> _free;
+};
+
+}  // namespace encfs
+
+#endif
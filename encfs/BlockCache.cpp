@@ -0,0 +1,384 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BlockCache.h"
+
+#include <algorithm>
+#include <cstring>  // for memcpy, memset
+
+#include "Mutex.h"
+#include "Stats.h"
+
+namespace encfs {
+
+bool BlockCache::policyByName(const std::string &name, Policy *policy) {
+  if (name == "lru") {
+    *policy = Lru;
+  } else if (name == "2q") {
+    *policy = TwoQueue;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+BlockCache::BlockCache(size_t capacity, bool lock, Policy policy)
+    : _capacity(capacity),
+      _policy(policy),
+      _nextOwner(1),
+      _arena(capacity, lock),
+      _limit(capacity),
+      _size(0),
+      _probationSize(0),
+      _pinnedSize(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_cond_init(&_loaded, nullptr);
+}
+
+BlockCache::~BlockCache() {
+  for (auto &entry : _lru) {
+    _arena.release(entry.data, entry.len);
+  }
+  for (auto &entry : _probation) {
+    _arena.release(entry.data, entry.len);
+  }
+  for (auto &entry : _pinned) {
+    _arena.release(entry.data, entry.len);
+  }
+  pthread_cond_destroy(&_loaded);
+  pthread_mutex_destroy(&_mutex);
+}
+
+// replace the data of entry, caller holds _mutex
+void BlockCache::setData(Entry &entry, const unsigned char *data,
+                         size_t len) {
+  if (entry.data != nullptr && entry.len != len) {
+    _arena.release(entry.data, entry.len);
+    entry.data = nullptr;
+  }
+  if (entry.data == nullptr) {
+    entry.data = _arena.allocate(len);
+  }
+  memcpy(entry.data, data, len);
+  entry.len = len;
+}
+
+uint64_t BlockCache::newOwner() { return _nextOwner++; }
+
+size_t BlockCache::size() const {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  return _size;
+}
+
+size_t BlockCache::pinnedSize() const {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  return _pinnedSize;
+}
+
+// the list entry is on, caller holds _mutex
+BlockCache::EntryList &BlockCache::listOf(const Entry &entry) {
+  if (entry.pinned) {
+    return _pinned;
+  }
+  return entry.probation ? _probation : _lru;
+}
+
+void BlockCache::drop(EntryList::iterator it) {
+  if (it->readAhead) {
+    Stats::add(Stats::ReadAheadWasted);
+  }
+  _size -= it->len;
+  _arena.release(it->data, it->len);
+  if (it->pinned) {
+    _pinnedSize -= it->len;
+  } else if (it->probation) {
+    _probationSize -= it->len;
+  }
+  listOf(*it).erase(it);
+}
+
+// Evict one block, caller holds _mutex.  Probation goes first while it
+// holds more than its share, so streams can't push out the main list.
+// Pinned blocks only go while they hold more than half of the cache.
+void BlockCache::evict() {
+  bool fromPinned =
+      !_pinned.empty() &&
+      ((_lru.empty() && _probation.empty()) || _pinnedSize > _limit / 2);
+  bool fromProbation =
+      !fromPinned && !_probation.empty() &&
+      (_lru.empty() ||
+       (_probationSize > _limit / 4 && _probation.size() > 1));
+  EntryList &list =
+      fromPinned ? _pinned : (fromProbation ? _probation : _lru);
+  auto victim = std::prev(list.end());
+  if (fromProbation && !victim->streaming) {
+    remember(Key(victim->owner, victim->block));
+  }
+  auto vit = _index.find(victim->owner);
+  vit->second.erase(victim->block);
+  if (vit->second.empty()) {
+    _index.erase(vit);
+  }
+  drop(victim);
+  Stats::add(Stats::CacheEvictions);
+}
+
+// remember a block evicted from probation, caller holds _mutex.  As many
+// are kept as half the number of cached blocks.
+void BlockCache::remember(const Key &key) {
+  if (_ghostIndex.count(key) == 0) {
+    _ghosts.push_back(key);
+    _ghostIndex[key] = std::prev(_ghosts.end());
+  }
+  size_t limit = (_lru.size() + _probation.size()) / 2 + 1;
+  while (_ghosts.size() > limit) {
+    _ghostIndex.erase(_ghosts.front());
+    _ghosts.pop_front();
+  }
+}
+
+ssize_t BlockCache::get(uint64_t owner, off_t block, unsigned char *out,
+                        size_t outLen) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  return lookup(owner, block, out, outLen);
+}
+
+ssize_t BlockCache::getOrClaim(uint64_t owner, off_t block,
+                               unsigned char *out, size_t outLen,
+                               bool *claimed) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  auto key = std::make_pair(owner, block);
+  bool waited = false;
+  for (;;) {
+    ssize_t len = lookup(owner, block, out, outLen);
+    if (len >= 0) {
+      if (waited) {
+        Stats::add(Stats::CacheSharedMisses);
+      }
+      *claimed = false;
+      return len;
+    }
+    // if the loader couldn't keep the block, the next one loads it
+    if (_loading.insert(key).second) {
+      *claimed = true;
+      return -1;
+    }
+    waited = true;
+    pthread_cond_wait(&_loaded, &_mutex);
+  }
+}
+
+void BlockCache::loaded(uint64_t owner, off_t block) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  _loading.erase(std::make_pair(owner, block));
+  pthread_cond_broadcast(&_loaded);
+}
+
+// caller holds _mutex
+ssize_t BlockCache::lookup(uint64_t owner, off_t block, unsigned char *out,
+                           size_t outLen) {
+  auto oit = _index.find(owner);
+  if (oit == _index.end()) {
+    return -1;
+  }
+  auto bit = oit->second.find(block);
+  if (bit == oit->second.end()) {
+    return -1;
+  }
+
+  EntryList::iterator it = bit->second;
+  // the first read of a streamed block is likely the stream itself
+  bool reused = !it->streaming || it->seen;
+  it->seen = true;
+  if (it->readAhead) {
+    it->readAhead = false;
+    Stats::add(Stats::ReadAheadUsed);
+  }
+  if (it->probation && reused) {
+    _probationSize -= it->len;
+    it->probation = false;
+    it->streaming = false;
+    _lru.splice(_lru.begin(), _probation, it);
+  } else {
+    EntryList &list = listOf(*it);
+    list.splice(list.begin(), list, it);
+  }
+
+  size_t len = it->len;
+  memcpy(out, it->data, len < outLen ? len : outLen);
+  return len;
+}
+
+void BlockCache::put(uint64_t owner, off_t block, const unsigned char *data,
+                     size_t len, bool readAhead, bool streaming) {
+  if (len == 0 || len > _capacity) {
+    invalidate(owner, block);
+    return;
+  }
+
+  Lock lock(_mutex, Stats::BlockCacheLock);
+
+  BlockMap &blocks = _index[owner];
+  auto bit = blocks.find(block);
+  if (bit != blocks.end()) {
+    EntryList::iterator it = bit->second;
+    if (it->readAhead && !readAhead) {
+      Stats::add(Stats::ReadAheadWasted);
+    }
+    _size -= it->len;
+    if (it->pinned) {
+      _pinnedSize += len - it->len;
+    } else if (it->probation) {
+      _probationSize += len - it->len;
+    }
+    setData(*it, data, len);
+    it->readAhead = readAhead;
+    it->streaming = it->streaming && (readAhead || streaming);
+    it->seen = it->seen && !readAhead;
+    _size += len;
+    EntryList &list = listOf(*it);
+    list.splice(list.begin(), list, it);
+  } else {
+    // under 2Q, new blocks start on probation, unless they were evicted from
+    // it a short while ago or their owner is pinned
+    bool pinned = _pinnedOwners.count(owner) != 0;
+    bool probation = _policy == TwoQueue && !pinned;
+    if (probation && !readAhead && !streaming) {
+      auto git = _ghostIndex.find(Key(owner, block));
+      if (git != _ghostIndex.end()) {
+        _ghosts.erase(git->second);
+        _ghostIndex.erase(git);
+        probation = false;
+      }
+    }
+    EntryList &list = pinned ? _pinned : (probation ? _probation : _lru);
+    list.push_front(Entry());
+    Entry &entry = list.front();
+    entry.owner = owner;
+    entry.block = block;
+    entry.data = nullptr;
+    setData(entry, data, len);
+    entry.readAhead = readAhead;
+    entry.streaming = readAhead || streaming;
+    entry.seen = false;
+    entry.probation = probation;
+    entry.pinned = pinned;
+    _size += len;
+    if (pinned) {
+      _pinnedSize += len;
+    } else if (probation) {
+      _probationSize += len;
+    }
+    blocks[block] = list.begin();
+  }
+
+  while (_size > _limit) {
+    evict();
+  }
+}
+
+void BlockCache::setLimit(size_t limit) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  size_t before = _limit;
+  _limit = limit;
+  while (_size > _limit) {
+    evict();
+  }
+  if (_limit < before) {
+    _arena.trim();
+  }
+}
+
+void BlockCache::invalidate(uint64_t owner, off_t block) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+
+  auto oit = _index.find(owner);
+  if (oit == _index.end()) {
+    return;
+  }
+  auto bit = oit->second.find(block);
+  if (bit != oit->second.end()) {
+    drop(bit->second);
+    oit->second.erase(bit);
+    Stats::add(Stats::CacheInvalidations);
+  }
+  if (oit->second.empty()) {
+    _index.erase(oit);
+  }
+}
+
+size_t BlockCache::dropFrom(uint64_t owner, off_t firstBlock) {
+  auto oit = _index.find(owner);
+  if (oit == _index.end()) {
+    return 0;
+  }
+  size_t dropped = 0;
+  BlockMap &blocks = oit->second;
+  for (auto bit = blocks.lower_bound(firstBlock); bit != blocks.end();) {
+    drop(bit->second);
+    bit = blocks.erase(bit);
+    ++dropped;
+  }
+  if (blocks.empty()) {
+    _index.erase(oit);
+  }
+  return dropped;
+}
+
+void BlockCache::invalidateFrom(uint64_t owner, off_t firstBlock) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  size_t dropped = dropFrom(owner, firstBlock);
+  if (dropped > 0) {
+    Stats::add(Stats::CacheInvalidations, dropped);
+  }
+}
+
+void BlockCache::invalidateOwner(uint64_t owner) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  dropFrom(owner, 0);
+}
+
+void BlockCache::pin(uint64_t owner, bool pinned) {
+  Lock lock(_mutex, Stats::BlockCacheLock);
+  if (pinned ? !_pinnedOwners.insert(owner).second
+             : _pinnedOwners.erase(owner) == 0) {
+    return;
+  }
+  auto oit = _index.find(owner);
+  if (oit == _index.end()) {
+    return;
+  }
+  // unpinned blocks were in use, they go to the main list
+  for (auto &bit : oit->second) {
+    EntryList::iterator it = bit.second;
+    EntryList &from = listOf(*it);
+    if (it->probation) {
+      _probationSize -= it->len;
+      it->probation = false;
+    }
+    it->pinned = pinned;
+    if (pinned) {
+      _pinnedSize += it->len;
+      _pinned.splice(_pinned.begin(), from, it);
+    } else {
+      _pinnedSize -= it->len;
+      _lru.splice(_lru.begin(), from, it);
+    }
+  }
+}
+
+}  // namespace encfs
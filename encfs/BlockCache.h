@@ -0,0 +1,181 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BlockCache_incl_
+#define _BlockCache_incl_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+#include "BlockArena.h"
+
+namespace encfs {
+
+/*
+    Size-bounded LRU cache of decoded (plaintext) blocks, shared by all open
+    files of a mount.
+
+    Entries are keyed by (owner, block number).  Every BlockFileIO instance
+    gets its own owner id from newOwner(), so different layers of one IO stack
+    (which use different block sizes) never see each other's entries.  Owners
+    are expected to keep the cache coherent: write-through on every block
+    write, and invalidation on truncate and destruction.
+
+    Block data lives in a BlockArena (huge pages, optionally locked in
+    memory) and is zeroed before it is freed or overwritten.
+
+    Readers which miss with getOrClaim() load each block once: the first
+    one is told to load it, and the others wait until it is done, instead
+    of reading and decoding the same block again.
+
+    Which blocks are evicted depends on the policy.  Lru evicts the least
+    recently used block.  TwoQueue (2Q) keeps a block on probation until it
+    is read again, and the probation list is held to a quarter of the
+    capacity, so that reading a lot of data once (a backup, or any other
+    stream) only evicts other blocks on probation, never the blocks which
+    are in use.  Blocks evicted from probation are remembered for a while,
+    and go straight to the main list if they are put again soon.  Blocks put
+    by streams (see put()) are not remembered, and as their first read from
+    the cache is likely the stream itself, they only leave probation when
+    read a second time.
+
+    The blocks of a pinned owner (see pin(), for files a program said it
+    keeps using) are kept on a list of their own, which is only evicted
+    from while it holds more than half of the cache, or nothing else is
+    left.
+*/
+class BlockCache {
+ public:
+  enum Policy { Lru, TwoQueue };
+
+  // policy by name ("lru" or "2q"), false for an unknown name
+  static bool policyByName(const std::string &name, Policy *policy);
+
+  // capacity is the maximum number of bytes of block data held.  With
+  // lock, the blocks are kept out of swap.
+  explicit BlockCache(size_t capacity, bool lock = false,
+                      Policy policy = Lru);
+  ~BlockCache();
+
+  BlockCache(const BlockCache &src) = delete;
+  BlockCache &operator=(const BlockCache &src) = delete;
+
+  uint64_t newOwner();
+
+  // Copy a cached block into out, at most outLen bytes.  Returns the length
+  // of the cached block, or -1 if the block is not cached.
+  ssize_t get(uint64_t owner, off_t block, unsigned char *out,
+              size_t outLen);
+
+  // get() for a reader which loads the block on a miss.  If another reader
+  // is loading it already, waits for that first.  Returns -1 with *claimed
+  // set if the caller has to load the block, and then call loaded(),
+  // whether or not it could put() it.
+  ssize_t getOrClaim(uint64_t owner, off_t block, unsigned char *out,
+                     size_t outLen, bool *claimed);
+  void loaded(uint64_t owner, off_t block);
+
+  // insert or replace a block.  Blocks put by read ahead are counted as
+  // used or wasted when they are read or dropped (see Stats).  streaming
+  // tells that the block was read by a sequential reader, which is not
+  // likely to read it again; read ahead blocks always are.
+  void put(uint64_t owner, off_t block, const unsigned char *data,
+           size_t len, bool readAhead = false, bool streaming = false);
+
+  // drop blocks because the file changed
+  void invalidate(uint64_t owner, off_t block);
+  // drop all blocks of owner with a block number >= firstBlock
+  void invalidateFrom(uint64_t owner, off_t firstBlock);
+  // drop all blocks of an owner which goes away
+  void invalidateOwner(uint64_t owner);
+
+  // Keep the blocks of owner, those cached and those put from now on, over
+  // those of others, or stop doing so.  Owners unpin before they go away.
+  void pin(uint64_t owner, bool pinned);
+
+  // Hold at most limit bytes from now on, evicting blocks and giving their
+  // memory back to the system.  The capacity stays what the cache was made
+  // with, and sizes its arena; blocks beyond it come from the heap (see
+  // DirNode::tune).
+  void setLimit(size_t limit);
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const;
+  Policy policy() const { return _policy; }
+  // bytes of pinned blocks
+  size_t pinnedSize() const;
+
+ private:
+  struct Entry {
+    uint64_t owner;
+    off_t block;
+    unsigned char *data;  // from _arena
+    size_t len;
+    bool readAhead;  // put by read ahead, and not read yet
+    bool streaming;  // put by a stream
+    bool seen;       // read from the cache since it was put
+    bool probation;  // on _probation rather than _lru
+    bool pinned;     // on _pinned
+  };
+  using EntryList = std::list<Entry>;
+  using BlockMap = std::map<off_t, EntryList::iterator>;
+  using Key = std::pair<uint64_t, off_t>;
+
+  ssize_t lookup(uint64_t owner, off_t block, unsigned char *out,
+                 size_t outLen);
+  EntryList &listOf(const Entry &entry);
+  void drop(EntryList::iterator it);
+  void evict();
+  void remember(const Key &key);
+  void setData(Entry &entry, const unsigned char *data, size_t len);
+  size_t dropFrom(uint64_t owner, off_t firstBlock);
+
+  const size_t _capacity;
+  const Policy _policy;
+  std::atomic<uint64_t> _nextOwner;
+
+  mutable pthread_mutex_t _mutex;
+  BlockArena _arena;
+  size_t _limit;
+  size_t _size;
+  EntryList _lru;  // most recently used first
+  std::unordered_map<uint64_t, BlockMap> _index;
+  // TwoQueue only: blocks read once, newest first, and recently evicted
+  // ones (oldest first, with their position in the list)
+  EntryList _probation;
+  size_t _probationSize;
+  std::list<Key> _ghosts;
+  std::map<Key, std::list<Key>::iterator> _ghostIndex;
+  // blocks of pinned owners, most recently used first
+  EntryList _pinned;
+  size_t _pinnedSize;
+  std::set<uint64_t> _pinnedOwners;
+  // blocks claimed by a reader, and signalled when one is loaded
+  std::set<Key> _loading;
+  pthread_cond_t _loaded;
+};
+
+}  // namespace encfs
+
+#endif
@@ -20,13 +20,22 @@
 
 #include "BlockFileIO.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>  // for memset, memcpy, NULL
 
+#include "BlockCache.h"
+#include "BufferBudget.h"
 #include "Error.h"
 #include "FSConfig.h"    // for FSConfigPtr
 #include "FileIO.h"      // for IORequest, FileIO
 #include "FileUtils.h"   // for EncFS_Opts
+#include "IOScheduler.h"
 #include "MemoryPool.h"  // for MemBlock, release, allocation
+#include "Mutex.h"       // for Lock
+#include "Stats.h"
+#include "Trace.h"
+#include "WorkerPool.h"
 
 namespace encfs {
 
@@ -35,21 +44,452 @@ inline Type min(Type A, Type B) {
   return (B < A) ? B : A;
 }
 
+// limit on the data handed to writeBlocks at once, as the layers below may
+// need a staging buffer of that size
+static const size_t MaxWriteBatch = 1024 * 1024;
+
+// initial read ahead window, in blocks
+static const off_t MinReadAhead = 4;
+
+// amount of data per job when encoding or decoding in parallel
+static const size_t ParallelChunk = 64 * 1024;
+
+// amount of data per stage of a pipelined run of blocks
+static const size_t PipelineChunk = 256 * 1024;
+
 static void clearCache(IORequest &req, unsigned int blockSize) {
-  memset(req.data, 0, blockSize);
+  if (req.data != nullptr) {
+    memset(req.data, 0, blockSize);
+  }
   req.dataLen = 0;
 }
 
 BlockFileIO::BlockFileIO(unsigned int blockSize, const FSConfigPtr &cfg)
-    : _blockSize(blockSize), _allowHoles(cfg->config->allowHoles) {
+    : _blockSize(blockSize),
+      _allowHoles(cfg->config->allowHoles),
+      _randomAccess(false),
+      _raEnabled(false),
+      _raMaxBlocks(0),
+      _raLastOffset(0),
+      _raLastEnd(0),
+      _raWindow(0),
+      _raNext(0),
+      _raPending(0),
+      _raStopped(false),
+      _raPolicy(Normal),
+      _raStreaming(false),
+      _changing(0),
+      _changeGen(0) {
   CHECK(_blockSize > 1);
-  _cache.data = new unsigned char[_blockSize];
+  // allocated by the first block kept, as blocks may be large
+  _cache.data = nullptr;
   _noCache = cfg->opts->noCache;
+  pthread_mutex_init(&_cacheMutex, nullptr);
+  pthread_mutex_init(&_raMutex, nullptr);
+  pthread_cond_init(&_raDone, nullptr);
+
+  _blockCache = _noCache ? nullptr : cfg->blockCache.get();
+  _cacheOwner = (_blockCache != nullptr) ? _blockCache->newOwner() : 0;
+  _workers = cfg->workers;
+  _budget = cfg->bufferBudget;
 }
 
 BlockFileIO::~BlockFileIO() {
+  stopReadAhead();
+  pthread_cond_destroy(&_raDone);
+  pthread_mutex_destroy(&_raMutex);
+
+  if (_blockCache != nullptr) {
+    _blockCache->pin(_cacheOwner, false);
+    _blockCache->invalidateOwner(_cacheOwner);
+  }
+  freeBuffer();
+  pthread_mutex_destroy(&_cacheMutex);
+}
+
+/**
+ * Remember a decoded block in the last-block cache and the shared block
+ * cache.
+ */
+void BlockFileIO::storeCache(off_t offset, const unsigned char *data,
+                             size_t len) const {
+  if (_noCache) {
+    return;
+  }
+  {
+    Lock lock(_cacheMutex);
+    keepBlock(offset, data, len);
+  }
+  if (_blockCache != nullptr) {
+    _blockCache->put(_cacheOwner, offset / _blockSize, data, len);
+  }
+}
+
+/**
+ * Like storeCache, for a block read from below.  It is only kept if the file
+ * didn't change since gen was taken, as it might be outdated otherwise.
+ * Without keep, it only goes to the shared block cache.
+ */
+void BlockFileIO::storeReadCache(off_t offset, const unsigned char *data,
+                                 size_t len, uint64_t gen, bool keep) const {
+  if (_noCache) {
+    return;
+  }
+  Lock lock(_cacheMutex);
+  if (_changeGen != gen || _changing != 0) {
+    return;
+  }
+  if (keep) {
+    keepBlock(offset, data, len);
+  }
+  if (_blockCache != nullptr) {
+    _blockCache->put(_cacheOwner, offset / _blockSize, data, len, false,
+                     _raStreaming);
+  }
+}
+
+// caller holds _cacheMutex
+void BlockFileIO::keepBlock(off_t offset, const unsigned char *data,
+                            size_t len) const {
+  if (_cache.data == nullptr) {
+    if (_budget && !_budget->reserve(_blockSize)) {
+      return;  // the block cache may still have it
+    }
+    _cache.data = new unsigned char[_blockSize];
+  }
+  memcpy(_cache.data, data, len);
+  _cache.offset = offset;
+  _cache.dataLen = len;
+}
+
+void BlockFileIO::dropCache(off_t offset) const {
+  {
+    Lock lock(_cacheMutex);
+    if (_cache.dataLen > 0 && _cache.offset == offset) {
+      clearCache(_cache, _blockSize);
+    }
+  }
+  if (_blockCache != nullptr) {
+    _blockCache->invalidate(_cacheOwner, offset / _blockSize);
+  }
+}
+
+// caller holds _cacheMutex, or is the destructor
+void BlockFileIO::freeBuffer() const {
+  if (_cache.data == nullptr) {
+    return;
+  }
   clearCache(_cache, _blockSize);
   delete[] _cache.data;
+  _cache.data = nullptr;
+  if (_budget) {
+    _budget->release(_blockSize);
+  }
+}
+
+void BlockFileIO::releaseBuffers() {
+  Lock lock(_cacheMutex);
+  freeBuffer();
+}
+
+void BlockFileIO::invalidateCache() const {
+  ChangeScope change(this);
+  Lock lock(_cacheMutex);
+  clearCache(_cache, _blockSize);
+  if (_blockCache != nullptr) {
+    _blockCache->invalidateOwner(_cacheOwner);
+  }
+}
+
+void BlockFileIO::enableReadAhead(const FSConfigPtr &cfg) {
+  if (_blockCache == nullptr || !_workers) {
+    return;
+  }
+  _raEnabled = true;
+  setReadAhead(cfg->opts->readAheadSize);
+}
+
+void BlockFileIO::setReadAhead(int kib) {
+  if (!_raEnabled) {
+    return;
+  }
+  Lock lock(_raMutex);
+  _raMaxBlocks = ((off_t)std::max(kib, 0) << 10) / _blockSize;
+  if (kib > 0 && _raMaxBlocks < MinReadAhead) {
+    _raMaxBlocks = MinReadAhead;
+  }
+}
+
+void BlockFileIO::setBlockSize(unsigned int blockSize) {
+  if (blockSize == _blockSize) {
+    return;
+  }
+  invalidateCache();
+  {
+    Lock lock(_cacheMutex);
+    freeBuffer();
+  }
+  Lock lock(_raMutex);
+  if (_raMaxBlocks != 0) {
+    _raMaxBlocks = _raMaxBlocks * _blockSize / blockSize;
+    if (_raMaxBlocks < MinReadAhead) {
+      _raMaxBlocks = MinReadAhead;
+    }
+  }
+  _raWindow = 0;
+  _raNext = 0;
+  _blockSize = blockSize;
+}
+
+/**
+ * Wait for a pending prefetch, and don't start any more.
+ */
+void BlockFileIO::stopReadAhead() {
+  Lock lock(_raMutex);
+  _raStopped = true;
+  while (_raPending > 0) {
+    pthread_cond_wait(&_raDone, &_raMutex);
+  }
+}
+
+int BlockFileIO::advise(Advice advice, off_t offset, off_t length) {
+  switch (advice) {
+    case Normal:
+    case Sequential:
+    case Random:
+    case Once: {
+      Lock lock(_raMutex);
+      _raPolicy = advice;
+      _raWindow = 0;
+      _raNext = 0;
+      return 0;
+    }
+    case WillNeed:
+      return willNeed(offset, length);
+    case Pin:
+    case Unpin:
+      if (_blockCache == nullptr) {
+        return -EOPNOTSUPP;
+      }
+      _blockCache->pin(_cacheOwner, advice == Pin);
+      return 0;
+  }
+  return -EINVAL;
+}
+
+/**
+ * Sequential access detection, called for every read.  Each read which starts
+ * within or right at the end of the previous one continues the stream.  Once
+ * the reader has consumed half of the window, the blocks up to a full window
+ * past the read are queued for prefetch, and the window grows for the next
+ * round.  Only one prefetch per file is in flight at any time.
+ *
+ * Also runs without read ahead, as the caches treat blocks read by a stream
+ * differently (see BlockCache::put and cacheReadOneBlock).
+ *
+ * The policy set by advise() overrides the detection: Sequential takes every
+ * read for part of a stream and starts with the full window, Random none,
+ * and Once treats all blocks read as streamed.
+ */
+void BlockFileIO::readAhead(const IORequest &req) const {
+  off_t end = req.offset + req.dataLen;
+
+  Lock lock(_raMutex);
+  bool sequential = _raLastEnd > 0 && req.offset >= _raLastOffset &&
+                    req.offset <= _raLastEnd;
+  if (_raPolicy == Sequential) {
+    sequential = true;
+  } else if (_raPolicy == Random) {
+    sequential = false;
+  }
+  _raLastOffset = req.offset;
+  _raLastEnd = end;
+  _raStreaming = sequential || _raPolicy == Once;
+  if (_raMaxBlocks == 0 || _raStopped || !sequential) {
+    _raWindow = 0;
+    _raNext = 0;
+    return;
+  }
+
+  off_t endBlock = (end + _blockSize - 1) / _blockSize;
+  if (_raWindow == 0) {
+    _raWindow = _raPolicy == Sequential ? _raMaxBlocks : MinReadAhead;
+  }
+  if (_raNext < endBlock) {
+    _raNext = endBlock;  // the reader caught up with us
+  }
+  if (_raPending > 0 || _raNext - endBlock > _raWindow / 2) {
+    return;
+  }
+
+  off_t first = _raNext;
+  off_t count = endBlock + _raWindow - first;
+  auto task = [this, first, count]() { prefetch(first, count); };
+  if (!_workers->trySubmit(task)) {
+    return;  // the pool is busy, try again on the next read
+  }
+  ++_raPending;
+  _raNext = first + count;
+  _raWindow = min(_raWindow * 2, _raMaxBlocks);
+}
+
+/**
+ * Queue the blocks of a range for prefetch, for a program which said it
+ * will need them.  Goes in runs of the read ahead size, as far as the pool
+ * takes them, and no further than half of the block cache or the end of
+ * the file.  The hint is only that, so a busy pool isn't an error.
+ */
+int BlockFileIO::willNeed(off_t offset, off_t length) const {
+  if (_blockCache == nullptr || !_workers) {
+    return -EOPNOTSUPP;
+  }
+  if (offset < 0 || length < 0) {
+    return -EINVAL;
+  }
+  off_t size = getSize();
+  if (size < 0) {
+    return (int)size;
+  }
+  off_t end = (length == 0 || length > size - offset) ? size : offset + length;
+  off_t first = offset / _blockSize;
+  off_t last = (end + _blockSize - 1) / _blockSize;
+  last = min(last, first + (off_t)(_blockCache->capacity() / 2 / _blockSize));
+  off_t run = _raMaxBlocks > MinReadAhead ? _raMaxBlocks : MinReadAhead;
+
+  Lock lock(_raMutex);
+  for (off_t block = first; block < last && !_raStopped; block += run) {
+    off_t count = min(run, last - block);
+    auto task = [this, block, count]() { prefetch(block, count); };
+    if (!_workers->trySubmit(task)) {
+      break;
+    }
+    ++_raPending;
+  }
+  return 0;
+}
+
+/**
+ * Runs on a worker thread.  Reads and decodes count blocks into the block
+ * cache, unless the file was changed while they were read.  Layers which
+ * read asynchronously give the worker back right away, and the prefetch
+ * completes on the thread which sees the blocks arrive.
+ */
+void BlockFileIO::prefetch(off_t firstBlock, off_t count) const {
+  uint64_t gen = _changeGen;
+  bool stopped;
+  {
+    Lock lock(_raMutex);
+    stopped = _raStopped;
+  }
+
+  if (stopped || _changing != 0) {
+    Lock lock(_raMutex);
+    --_raPending;
+    pthread_cond_broadcast(&_raDone);
+    return;
+  }
+
+  // nobody waits for read ahead, so readers go first
+  IOScheduler::BackgroundScope background;
+  size_t len = count * _blockSize;
+  MemBlock mb = MemoryPool::allocate(len);
+  IORequest req;
+  req.offset = firstBlock * _blockSize;
+  req.data = mb.data;
+  req.dataLen = len;
+  readBlocksAsync(req, [this, req, mb, gen](ssize_t readSize) {
+    prefetched(req, readSize, gen);
+    MemoryPool::release(mb);
+
+    // nothing of this may be used once the file can go away
+    Lock lock(_raMutex);
+    --_raPending;
+    pthread_cond_broadcast(&_raDone);
+  });
+}
+
+/**
+ * The blocks of a prefetch have been read into req.
+ */
+void BlockFileIO::prefetched(const IORequest &req, ssize_t readSize,
+                             uint64_t gen) const {
+  if (readSize > 0) {
+    // a change which started after this check writes its blocks to the
+    // cache after us, as storeCache needs _cacheMutex first
+    Lock lock(_cacheMutex);
+    off_t blocks = (readSize + _blockSize - 1) / _blockSize;
+    Stats::add(Stats::ReadAheadBlocks, blocks);
+    if (_changeGen == gen && _changing == 0) {
+      for (ssize_t done = 0; done < readSize; done += _blockSize) {
+        size_t blockLen = min(readSize - done, (ssize_t)_blockSize);
+        _blockCache->put(_cacheOwner, (req.offset + done) / _blockSize,
+                         req.data + done, blockLen, true);
+      }
+    } else {
+      Stats::add(Stats::ReadAheadWasted, blocks);
+    }
+  } else if (readSize < 0) {
+    VLOG(1) << "read ahead of block " << req.offset / _blockSize
+            << " failed: " << readSize;
+  }
+}
+
+bool BlockFileIO::forBlocks(
+    size_t count, const std::function<bool(size_t, size_t)> &fn) const {
+  size_t chunk = ParallelChunk / _blockSize;
+  if (chunk == 0) {
+    chunk = 1;
+  }
+  if (!_workers || count < 2 * chunk) {
+    return fn(0, count);
+  }
+
+  size_t jobs = (count + chunk - 1) / chunk;
+  std::atomic<bool> ok(true);
+  _workers->parallelFor(jobs, [&](size_t job) {
+    size_t first = job * chunk;
+    if (!fn(first, min(chunk, count - first))) {
+      ok = false;
+    }
+  });
+  return ok;
+}
+
+/**
+ * Two stage pipeline over count blocks, in chunks of PipelineChunk: while
+ * the second stage works on one chunk, the first stage of the next one runs
+ * on another thread.  The second stages run in order, and a stage which
+ * returns false ends the run once the stages in flight are done.
+ */
+bool BlockFileIO::pipeline(
+    size_t count, const std::function<bool(size_t, size_t)> &first,
+    const std::function<bool(size_t, size_t)> &second) const {
+  size_t chunk = PipelineChunk / _blockSize;
+  if (chunk == 0) {
+    chunk = 1;
+  }
+  if (!_workers || count < 2 * chunk) {
+    return first(0, count) && second(0, count);
+  }
+
+  if (!first(0, chunk)) {
+    return false;
+  }
+  for (size_t start = 0; start < count; start += chunk) {
+    size_t next = start + chunk;
+    bool ok[2] = {true, true};
+    _workers->parallelFor(next < count ? 2 : 1, [&](size_t stage) {
+      if (stage == 0) {
+        ok[0] = second(start, min(chunk, count - start));
+      } else {
+        ok[1] = first(next, min(chunk, count - next));
+      }
+    });
+    if (!ok[0] || !ok[1]) {
+      return false;
+    }
+  }
+  return true;
 }
 
 /**
@@ -58,6 +498,25 @@ BlockFileIO::~BlockFileIO() {
  * Always requests full blocks form the lower layer, truncates the
  * returned data as neccessary.
  */
+namespace {
+// releases a block claimed with BlockCache::getOrClaim, also on exceptions
+class LoadClaim {
+ public:
+  LoadClaim(BlockCache *cache, uint64_t owner, off_t block)
+      : _cache(cache), _owner(owner), _block(block) {}
+  ~LoadClaim() {
+    if (_cache != nullptr) {
+      _cache->loaded(_owner, _block);
+    }
+  }
+
+ private:
+  BlockCache *_cache;
+  uint64_t _owner;
+  off_t _block;
+};
+}  // namespace
+
 ssize_t BlockFileIO::cacheReadOneBlock(const IORequest &req) const {
   CHECK(req.dataLen <= _blockSize);
   CHECK(req.offset % _blockSize == 0);
@@ -65,59 +524,341 @@ ssize_t BlockFileIO::cacheReadOneBlock(const IORequest &req) const {
   /* we can satisfy the request even if _cache.dataLen is too short, because
    * we always request a full block during reads. This just means we are
    * in the last block of a file, which may be smaller than the blocksize.
-   * For reverse encryption, the cache must not be used at all, because
-   * the lower file may have changed behind our back. */
-  if ((!_noCache) && (req.offset == _cache.offset) && (_cache.dataLen != 0)) {
-    // satisfy request from cache
-    size_t len = req.dataLen;
-    if (_cache.dataLen < len) {
-      len = _cache.dataLen;  // Don't read past EOF
+   * For reverse encryption, the layer above drops the cache whenever the
+   * lower file changed behind our back (see invalidateCache). */
+  if (!_noCache) {
+    Lock lock(_cacheMutex);
+    if ((req.offset == _cache.offset) && (_cache.dataLen != 0)) {
+      // satisfy request from cache
+      size_t len = req.dataLen;
+      if (_cache.dataLen < len) {
+        len = _cache.dataLen;  // Don't read past EOF
+      }
+      memcpy(req.data, _cache.data, len);
+      ENCFS_TRACE1(cache__hit, req.offset);
+      Stats::add(Stats::CacheHits);
+      return len;
     }
-    memcpy(req.data, _cache.data, len);
-    return len;
   }
-  if (_cache.dataLen > 0) {
-    clearCache(_cache, _blockSize);
+
+  // issue reads for full blocks, into a temporary if the caller asked for
+  // less
+  MemBlock mb;
+  unsigned char *buf = req.data;
+  if (req.dataLen < _blockSize) {
+    mb = MemoryPool::allocate(_blockSize);
+    buf = mb.data;
+  }
+
+  // A stream which gets the whole block decoded into its own buffer moves
+  // on to the next one, copying it into the last-block buffer as well would
+  // only double the work.  The block cache policy still sees it.
+  bool keep = buf != req.data || !_raStreaming;
+
+  off_t blockNum = req.offset / _blockSize;
+  ssize_t result = -1;
+  // concurrent misses of the same block wait for the first to load it
+  bool claimed = false;
+  if (_blockCache != nullptr) {
+    result = _blockCache->getOrClaim(_cacheOwner, blockNum, buf, _blockSize,
+                                     &claimed);
+  }
+
+  if (result < 0) {
+    ENCFS_TRACE1(cache__miss, req.offset);
+    Stats::add(Stats::CacheMisses);
+    LoadClaim claim(claimed ? _blockCache : nullptr, _cacheOwner, blockNum);
+    IORequest tmp;
+    tmp.offset = req.offset;
+    tmp.data = buf;
+    tmp.dataLen = _blockSize;
+    uint64_t gen = _changeGen;
+    result = readOneBlock(tmp);
+    if (result > 0) {
+      storeReadCache(req.offset, buf, result, gen, keep);
+    }
+  } else if (result > 0 && !_noCache) {
+    ENCFS_TRACE1(cache__hit, req.offset);
+    Stats::add(Stats::CacheHits);
+    if (keep) {
+      Lock lock(_cacheMutex);
+      keepBlock(req.offset, buf, result);
+    }
   }
 
-  // cache results of read -- issue reads for full blocks
-  IORequest tmp;
-  tmp.offset = req.offset;
-  tmp.data = _cache.data;
-  tmp.dataLen = _blockSize;
-  ssize_t result = readOneBlock(tmp);
   if (result > 0) {
-    _cache.offset = req.offset;
-    _cache.dataLen = result;  // the amount we really have
     if ((size_t)result > req.dataLen) {
       result = req.dataLen;  // only as much as requested
     }
-    memcpy(req.data, _cache.data, result);
+    if (buf != req.data) {
+      memcpy(req.data, buf, result);
+    }
+  }
+
+  if (mb.data != nullptr) {
+    MemoryPool::release(mb);
   }
   return result;
 }
 
-ssize_t BlockFileIO::cacheWriteOneBlock(const IORequest &req) {
+ssize_t BlockFileIO::cacheWriteOneBlock(const IORequest &req, bool inPlace) {
+  // a block of zeros is left as a hole, which reads back the same
+  if (_allowHoles && req.dataLen == _blockSize &&
+      isZeroBlock(req.data, req.dataLen) && punchBlocks(req.offset, 1) == 0) {
+    storeCache(req.offset, req.data, req.dataLen);
+    return req.dataLen;
+  }
+
+  if (inPlace) {
+    // the caller doesn't need the plaintext any more, so cache it first and
+    // then let the encoding clobber it
+    storeCache(req.offset, req.data, req.dataLen);
+    ssize_t res = writeOneBlock(req);
+    if (res < 0) {
+      dropCache(req.offset);
+    }
+    return res;
+  }
+
   // Let's point request buffer to our own buffer, as it may be modified by
   // encryption : originating process may not like to have its buffer modified
-  memcpy(_cache.data, req.data, req.dataLen);
+  MemBlock mb = MemoryPool::allocate(_blockSize);
+  memcpy(mb.data, req.data, req.dataLen);
   IORequest tmp;
   tmp.offset = req.offset;
-  tmp.data = _cache.data;
+  tmp.data = mb.data;
   tmp.dataLen = req.dataLen;
   ssize_t res = writeOneBlock(tmp);
+  MemoryPool::release(mb);
+
   if (res < 0) {
-    clearCache(_cache, _blockSize);
-  }
-  else {
+    dropCache(req.offset);
+  } else {
     // And now we can cache the write buffer from the request
-    memcpy(_cache.data, req.data, req.dataLen);
-    _cache.offset = req.offset;
-    _cache.dataLen = req.dataLen;
+    storeCache(req.offset, req.data, req.dataLen);
   }
   return res;
 }
 
+/**
+ * Default multi-block write, one block at a time.
+ * Returns the number of bytes written, or -errno in case of failure.
+ */
+ssize_t BlockFileIO::writeBlocks(const IORequest &req, bool inPlace) {
+  CHECK(req.offset % _blockSize == 0);
+  CHECK(req.dataLen % _blockSize == 0);
+
+  MemBlock mb;
+  if (!inPlace) {
+    mb = MemoryPool::allocate(_blockSize);
+  }
+  IORequest tmp;
+  tmp.dataLen = _blockSize;
+
+  ssize_t res = req.dataLen;
+  for (size_t done = 0; done < req.dataLen; done += _blockSize) {
+    if (inPlace) {
+      tmp.data = req.data + done;
+    } else {
+      // copy, as writeOneBlock encodes in place
+      memcpy(mb.data, req.data + done, _blockSize);
+      tmp.data = mb.data;
+    }
+    tmp.offset = req.offset + done;
+    ssize_t writeSize = writeOneBlock(tmp);
+    if (writeSize < 0) {
+      res = writeSize;
+      break;
+    }
+  }
+
+  if (mb.data != nullptr) {
+    MemoryPool::release(mb);
+  }
+  return res;
+}
+
+ssize_t BlockFileIO::cacheWriteBlocks(const IORequest &req, bool inPlace) {
+  off_t firstBlock = req.offset / _blockSize;
+  size_t count = req.dataLen / _blockSize;
+
+  if (_allowHoles && isZeroBlock(req.data, req.dataLen) &&
+      punchBlocks(req.offset, count) == 0) {
+    for (size_t i = 0; i < count; ++i) {
+      storeCache((firstBlock + i) * _blockSize, req.data + i * _blockSize,
+                 _blockSize);
+    }
+    return req.dataLen;
+  }
+
+  // the last block ends up in the last-block cache, as the next write is
+  // likely to continue there.  In place, the plaintext is gone afterwards.
+  if (inPlace) {
+    for (size_t i = 0; i < count; ++i) {
+      storeCache((firstBlock + i) * _blockSize, req.data + i * _blockSize,
+                 _blockSize);
+    }
+  }
+
+  ssize_t res = writeBlocks(req, inPlace);
+  if (res < 0) {
+    for (size_t i = 0; i < count; ++i) {
+      dropCache((firstBlock + i) * _blockSize);
+    }
+    return res;
+  }
+
+  if (!inPlace) {
+    for (size_t i = 0; i < count; ++i) {
+      storeCache((firstBlock + i) * _blockSize, req.data + i * _blockSize,
+                 _blockSize);
+    }
+  }
+  return res;
+}
+
+int BlockFileIO::punchBlocks(off_t offset, size_t count) {
+  (void)offset;
+  (void)count;
+  return -EOPNOTSUPP;
+}
+
+int BlockFileIO::allocateBlocks(off_t offset, size_t count) {
+  (void)offset;
+  (void)count;
+  return -EOPNOTSUPP;
+}
+
+ssize_t BlockFileIO::readPartial(const IORequest &req) const {
+  (void)req;
+  return -EOPNOTSUPP;
+}
+
+ssize_t BlockFileIO::writePartial(const IORequest &req) {
+  (void)req;
+  return -EOPNOTSUPP;
+}
+
+/**
+ * Serve a read within a single block from the caches, or else read only the
+ * requested part.  Partial reads aren't cached, as they don't have the
+ * whole block.
+ */
+ssize_t BlockFileIO::cacheReadPartial(const IORequest &req) const {
+  off_t blockNum = req.offset / _blockSize;
+  size_t inBlock = req.offset % _blockSize;
+  CHECK(inBlock + req.dataLen <= _blockSize);
+
+  if (!_noCache) {
+    Lock lock(_cacheMutex);
+    if (_cache.dataLen != 0 && _cache.offset == blockNum * _blockSize) {
+      size_t len = 0;
+      if (_cache.dataLen > inBlock) {
+        len = min(req.dataLen, _cache.dataLen - inBlock);
+        memcpy(req.data, _cache.data + inBlock, len);
+      }
+      Stats::add(Stats::CacheHits);
+      return len;
+    }
+  }
+
+  if (_blockCache != nullptr) {
+    MemBlock mb = MemoryPool::allocate(_blockSize);
+    ssize_t len = _blockCache->get(_cacheOwner, blockNum, mb.data, _blockSize);
+    if (len >= 0) {
+      size_t avail = (size_t)len > inBlock ? len - inBlock : 0;
+      len = min(avail, req.dataLen);
+      memcpy(req.data, mb.data + inBlock, len);
+      MemoryPool::release(mb);
+      Stats::add(Stats::CacheHits);
+      return len;
+    }
+    MemoryPool::release(mb);
+  }
+
+  Stats::add(Stats::CacheMisses);
+  return readPartial(req);
+}
+
+/**
+ * Write part of a single block.  The last-block cache is patched if it holds
+ * the block, the shared cache forgets it.
+ */
+ssize_t BlockFileIO::cacheWritePartial(const IORequest &req, bool inPlace) {
+  off_t blockOffset = req.offset - req.offset % _blockSize;
+  size_t inBlock = req.offset - blockOffset;
+
+  if (!_noCache) {
+    Lock lock(_cacheMutex);
+    if (_cache.dataLen != 0 && _cache.offset == blockOffset) {
+      if (inBlock <= _cache.dataLen) {
+        memcpy(_cache.data + inBlock, req.data, req.dataLen);
+        if (_cache.dataLen < inBlock + req.dataLen) {
+          _cache.dataLen = inBlock + req.dataLen;
+        }
+      } else {
+        clearCache(_cache, _blockSize);
+      }
+    }
+  }
+  if (_blockCache != nullptr) {
+    _blockCache->invalidate(_cacheOwner, blockOffset / _blockSize);
+  }
+
+  ssize_t res;
+  if (inPlace) {
+    res = writePartial(req);
+  } else {
+    // writePartial encodes in place
+    MemBlock mb = MemoryPool::allocate(req.dataLen);
+    memcpy(mb.data, req.data, req.dataLen);
+    IORequest tmp;
+    tmp.offset = req.offset;
+    tmp.data = mb.data;
+    tmp.dataLen = req.dataLen;
+    res = writePartial(tmp);
+    MemoryPool::release(mb);
+  }
+
+  if (res < 0) {
+    dropCache(blockOffset);
+  }
+  return res;
+}
+
+/**
+ * Default multi-block read, one cached block at a time.
+ * Returns the number of bytes read, or -errno in case of failure.
+ */
+ssize_t BlockFileIO::readBlocks(const IORequest &req) const {
+  CHECK(req.offset % _blockSize == 0);
+  CHECK(req.dataLen % _blockSize == 0);
+
+  IORequest blockReq;
+  blockReq.offset = req.offset;
+  blockReq.data = req.data;
+  blockReq.dataLen = _blockSize;
+
+  ssize_t result = 0;
+  while ((size_t)result < req.dataLen) {
+    ssize_t readSize = cacheReadOneBlock(blockReq);
+    if (readSize < 0) {
+      return readSize;
+    }
+    result += readSize;
+    if ((size_t)readSize < _blockSize) {
+      break;
+    }
+    blockReq.offset += _blockSize;
+    blockReq.data += _blockSize;
+  }
+  return result;
+}
+
+void BlockFileIO::readBlocksAsync(const IORequest &req, IODone done) const {
+  done(readBlocks(req));
+}
+
 /**
  * Serve a read request of arbitrary size at an arbitrary offset.
  * Stitches together multiple blocks to serve large requests, drops
@@ -127,14 +868,25 @@ ssize_t BlockFileIO::cacheWriteOneBlock(const IORequest &req) {
  * Returns the number of bytes read, or -errno in case of failure.
  */
 ssize_t BlockFileIO::read(const IORequest &req) const {
+  ENCFS_TRACE2(blockio__read__entry, req.offset, req.dataLen);
+  ssize_t res = readImpl(req);
+  ENCFS_TRACE1(blockio__read__return, res);
+  return res;
+}
+
+ssize_t BlockFileIO::readImpl(const IORequest &req) const {
   CHECK(_blockSize != 0);
 
+  readAhead(req);
+
   int partialOffset =
       req.offset % _blockSize;  // can be int as _blockSize is int
   off_t blockNum = req.offset / _blockSize;
   ssize_t result = 0;
 
-  if (partialOffset == 0 && req.dataLen <= _blockSize) {
+  if (partialOffset == 0 &&
+      (req.dataLen == _blockSize ||
+       (req.dataLen < _blockSize && !_randomAccess))) {
     // read completely within a single block -- can be handled as-is by
     // readOneBlock().
     return cacheReadOneBlock(req);
@@ -152,6 +904,73 @@ ssize_t BlockFileIO::read(const IORequest &req) const {
   while (size != 0u) {
     blockReq.offset = blockNum * _blockSize;
 
+    // a run of several full blocks is handed to the lower layer in one go,
+    // straight into the result buffer
+    if (partialOffset == 0 && size >= 2 * (size_t)_blockSize) {
+      // blocks read ahead are used first
+      if (_raMaxBlocks > 0) {
+        ssize_t readSize =
+            _blockCache->get(_cacheOwner, blockNum, out, _blockSize);
+        if (readSize >= 0) {
+          Stats::add(Stats::CacheHits);
+          result += readSize;
+          size -= readSize;
+          out += readSize;
+          ++blockNum;
+          if ((size_t)readSize < _blockSize) {
+            break;
+          }
+          continue;
+        }
+      }
+
+      size_t count = size / _blockSize;
+      blockReq.data = out;
+      blockReq.dataLen = count * _blockSize;
+
+      Stats::add(Stats::CacheMisses, count);
+      ssize_t readSize = readBlocks(blockReq);
+      blockReq.dataLen = _blockSize;
+      if (readSize < 0) {
+        result = readSize;
+        break;
+      }
+
+      result += readSize;
+      size -= readSize;
+      out += readSize;
+      blockNum += count;
+
+      if ((size_t)readSize < count * _blockSize) {
+        break;
+      }
+      continue;
+    }
+
+    // with random access, only the requested part of a block is read
+    if (_randomAccess && (partialOffset != 0 || size < _blockSize)) {
+      blockReq.offset += partialOffset;
+      blockReq.data = out;
+      blockReq.dataLen = min((size_t)_blockSize - (size_t)partialOffset, size);
+      ssize_t readSize = cacheReadPartial(blockReq);
+      if (readSize < 0) {
+        result = readSize;
+        break;
+      }
+
+      result += readSize;
+      size -= readSize;
+      out += readSize;
+      ++blockNum;
+      partialOffset = 0;
+
+      if ((size_t)readSize < blockReq.dataLen) {
+        break;
+      }
+      blockReq.dataLen = _blockSize;
+      continue;
+    }
+
     // if we're reading a full block, then read directly into the
     // result buffer instead of using a temporary
     if (partialOffset == 0 && size >= _blockSize) {
@@ -202,7 +1021,26 @@ ssize_t BlockFileIO::read(const IORequest &req) const {
  * Returns the number of bytes written, or -errno in case of failure.
  */
 ssize_t BlockFileIO::write(const IORequest &req) {
+  ENCFS_TRACE2(blockio__write__entry, req.offset, req.dataLen);
+  ssize_t res = writeImpl(req, false);
+  ENCFS_TRACE1(blockio__write__return, res);
+  return res;
+}
+
+ssize_t BlockFileIO::writeInPlace(const IORequest &req) {
+  ENCFS_TRACE2(blockio__write__entry, req.offset, req.dataLen);
+  ssize_t res = writeImpl(req, true);
+  ENCFS_TRACE1(blockio__write__return, res);
+  return res;
+}
+
+/**
+ * If inPlace is set, req.data is scratch space of the caller, which may be
+ * encoded in place instead of being copied first.
+ */
+ssize_t BlockFileIO::writeImpl(const IORequest &req, bool inPlace) {
   CHECK(_blockSize != 0);
+  ChangeScope change(this);
 
   off_t fileSize = getSize();
   if (fileSize < 0) {
@@ -237,13 +1075,13 @@ ssize_t BlockFileIO::write(const IORequest &req) {
   if (partialOffset == 0 && req.dataLen <= _blockSize) {
     // if writing a full block.. pretty safe..
     if (req.dataLen == _blockSize) {
-      return cacheWriteOneBlock(req);
+      return cacheWriteOneBlock(req, inPlace);
     }
 
     // if writing a partial block, but at least as much as what is
     // already there..
     if (blockNum == lastFileBlock && req.dataLen >= lastBlockSize) {
-      return cacheWriteOneBlock(req);
+      return cacheWriteOneBlock(req, inPlace);
     }
   }
 
@@ -259,8 +1097,46 @@ ssize_t BlockFileIO::write(const IORequest &req) {
   unsigned char *inPtr = req.data;
   while (size != 0u) {
     blockReq.offset = blockNum * _blockSize;
+
+    // runs of full blocks are encoded and passed down in one piece
+    if (partialOffset == 0 && size >= 2 * (size_t)_blockSize) {
+      size_t count = min(size, MaxWriteBatch) / _blockSize;
+      blockReq.data = inPtr;
+      blockReq.dataLen = count * _blockSize;
+
+      res = cacheWriteBlocks(blockReq, inPlace);
+      blockReq.dataLen = _blockSize;
+      if (res < 0) {
+        break;
+      }
+
+      size -= count * _blockSize;
+      inPtr += count * _blockSize;
+      blockNum += count;
+      continue;
+    }
     size_t toCopy = min((size_t)_blockSize - (size_t)partialOffset, size);
 
+    // with random access, only the changed part of a block is written, as
+    // long as the data before it exists
+    if (_randomAccess && toCopy < _blockSize &&
+        blockReq.offset + partialOffset <= fileSize) {
+      blockReq.offset += partialOffset;
+      blockReq.data = inPtr;
+      blockReq.dataLen = toCopy;
+      res = cacheWritePartial(blockReq, inPlace);
+      blockReq.dataLen = _blockSize;
+      if (res < 0) {
+        break;
+      }
+
+      size -= toCopy;
+      inPtr += toCopy;
+      ++blockNum;
+      partialOffset = 0;
+      continue;
+    }
+
     // if writing an entire block, or writing a partial block that requires
     // no merging with existing data..
     if ((toCopy == _blockSize) ||
@@ -282,6 +1158,7 @@ ssize_t BlockFileIO::write(const IORequest &req) {
         blockReq.dataLen = partialOffset + toCopy;
       } else {
         // have to merge with existing block data..
+        Stats::add(Stats::MergedBlocks);
         blockReq.dataLen = _blockSize;
         ssize_t readSize = cacheReadOneBlock(blockReq);
         if (readSize < 0) {
@@ -299,8 +1176,9 @@ ssize_t BlockFileIO::write(const IORequest &req) {
       memcpy(blockReq.data + partialOffset, inPtr, toCopy);
     }
 
-    // Finally, write the damn thing!
-    res = cacheWriteOneBlock(blockReq);
+    // Finally, write the damn thing!  Our own merge buffer is refilled for
+    // every block, so it can always be encoded in place.
+    res = cacheWriteOneBlock(blockReq, inPlace || blockReq.data == mb.data);
     if (res < 0) {
       break;
     }
@@ -324,6 +1202,31 @@ ssize_t BlockFileIO::write(const IORequest &req) {
 
 unsigned int BlockFileIO::blockSize() const { return _blockSize; }
 
+/**
+ * Returns 0 in case of success, or -errno in case of failure.
+ */
+int BlockFileIO::punchHole(off_t offset, off_t length) {
+  if (!_allowHoles || offset % _blockSize != 0 || length % _blockSize != 0) {
+    return -EOPNOTSUPP;
+  }
+  ChangeScope change(this);
+
+  off_t count = length / _blockSize;
+  for (off_t i = 0; i < count; ++i) {
+    dropCache(offset + i * _blockSize);
+  }
+  return punchBlocks(offset, count);
+}
+
+int BlockFileIO::allocate(off_t offset, off_t length) {
+  if (length <= 0) {
+    return -EINVAL;
+  }
+  off_t first = offset / _blockSize;
+  off_t last = (offset + length - 1) / _blockSize;
+  return allocateBlocks(first * _blockSize, last - first + 1);
+}
+
 /**
  * Returns 0 in case of success, or -errno in case of failure.
  */
@@ -352,7 +1255,8 @@ int BlockFileIO::padFile(off_t oldSize, off_t newSize, bool forceWrite) {
         memset(mb.data, 0, outSize);
         if ((res = cacheReadOneBlock(req)) >= 0) {
           req.dataLen = outSize;
-          res = cacheWriteOneBlock(req);
+          res = cacheWriteOneBlock(req, true);
+          Stats::add(Stats::PaddedBlocks);
         }
       }
     } else
@@ -374,20 +1278,36 @@ int BlockFileIO::padFile(off_t oldSize, off_t newSize, bool forceWrite) {
       memset(mb.data, 0, _blockSize);
       if ((res = cacheReadOneBlock(req)) >= 0) {
         req.dataLen = _blockSize;  // expand to full block size
-        res = cacheWriteOneBlock(req);
+        res = cacheWriteOneBlock(req, true);
+        Stats::add(Stats::PaddedBlocks);
       }
       ++oldLastBlock;
     }
 
-    // 2, pad zero blocks unless holes are allowed
-    if (!_allowHoles) {
-      for (; (res >= 0) && (oldLastBlock != newLastBlock); ++oldLastBlock) {
-        VLOG(1) << "padding block " << oldLastBlock;
-        req.offset = oldLastBlock * _blockSize;
-        req.dataLen = _blockSize;
-        memset(mb.data, 0, req.dataLen);
-        res = cacheWriteOneBlock(req);
+    // 2, pad zero blocks unless holes are allowed, a batch at a time so
+    // that the layer below can encode them together
+    if (!_allowHoles && (res >= 0) && (oldLastBlock != newLastBlock)) {
+      size_t batch = min((size_t)(newLastBlock - oldLastBlock),
+                         MaxWriteBatch / _blockSize);
+      if (batch == 0) {
+        batch = 1;
+      }
+      MemBlock zeros = MemoryPool::allocate(batch * _blockSize);
+      IORequest zeroReq;
+      zeroReq.data = zeros.data;
+      while ((res >= 0) && (oldLastBlock != newLastBlock)) {
+        size_t count = min((size_t)(newLastBlock - oldLastBlock), batch);
+        VLOG(1) << "padding blocks " << oldLastBlock << " to "
+                << oldLastBlock + count - 1;
+        zeroReq.offset = oldLastBlock * _blockSize;
+        zeroReq.dataLen = count * _blockSize;
+        // encoded in place, so zeroed again for each batch
+        memset(zeros.data, 0, zeroReq.dataLen);
+        res = cacheWriteBlocks(zeroReq, true);
+        Stats::add(Stats::PaddedBlocks, count);
+        oldLastBlock += count;
       }
+      MemoryPool::release(zeros);
     }
 
     // 3. only necessary if write is forced and block is non 0 length
@@ -395,7 +1315,8 @@ int BlockFileIO::padFile(off_t oldSize, off_t newSize, bool forceWrite) {
       req.offset = newLastBlock * _blockSize;
       req.dataLen = newBlockSize;
       memset(mb.data, 0, req.dataLen);
-      res = cacheWriteOneBlock(req);
+      res = cacheWriteOneBlock(req, true);
+      Stats::add(Stats::PaddedBlocks);
     }
   }
 
@@ -413,11 +1334,27 @@ int BlockFileIO::padFile(off_t oldSize, off_t newSize, bool forceWrite) {
  * Returns 0 in case of success, or -errno in case of failure.
  */
 int BlockFileIO::truncateBase(off_t size, FileIO *base) {
+  ChangeScope change(this);
   int partialBlock = size % _blockSize;  // can be int as _blockSize is int
   int res = 0;
 
   off_t oldSize = getSize();
 
+  if (size < oldSize) {
+    // drop cached blocks past the new end of file.  A partial last block is
+    // re-read from the lower layer below and cached again on write back.
+    {
+      Lock lock(_cacheMutex);
+      if (_cache.dataLen > 0 &&
+          _cache.offset + (off_t)_cache.dataLen > size) {
+        clearCache(_cache, _blockSize);
+      }
+    }
+    if (_blockCache != nullptr) {
+      _blockCache->invalidateFrom(_cacheOwner, size / _blockSize);
+    }
+  }
+
   if (size > oldSize) {
     // truncate can be used to extend a file as well.  truncate man page
     // states that it will pad with 0's.
@@ -458,7 +1395,7 @@ int BlockFileIO::truncateBase(off_t size, FileIO *base) {
     // write back out partial block
     req.dataLen = partialBlock;
     if (res == 0) {
-      ssize_t writeSize = cacheWriteOneBlock(req);
+      ssize_t writeSize = cacheWriteOneBlock(req, true);
       if (writeSize < 0) {
         res = writeSize;
       }
@@ -21,6 +21,11 @@
 #ifndef _BlockFileIO_incl_
 #define _BlockFileIO_incl_
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <pthread.h>
 #include <sys/types.h>
 
 #include "FSConfig.h"
@@ -28,13 +33,30 @@
 
 namespace encfs {
 
+class BlockCache;
+class BufferBudget;
+class WorkerPool;
+
 /*
     Implements block scatter / gather interface.  Requires derived classes to
     implement readOneBlock() / writeOneBlock() at a minimum.
 
     When a partial block write is requested it will be turned into a read of
     the existing block, merge with the write request, and a write of the full
-    block.
+    block.  Layers which set _randomAccess code parts of a block on their own
+    instead (readPartial / writePartial), so partial writes within the file
+    only write what changed, and partial reads only read what was asked for.
+
+    Besides the last block touched (other than whole blocks read by a
+    stream, which are decoded straight into the reader's buffer), decoded
+    blocks are kept in the mount-wide BlockCache if one was configured (see
+    --blockcache).
+
+    Layers which enable it read ahead of sequential readers: once a read
+    continues where the previous one ended, the following blocks are read and
+    decoded into the BlockCache by a WorkerPool thread.  The window starts
+    small and doubles with every refill while the stream goes on, up to
+    --readahead, and collapses again on the first random access.
 */
 class BlockFileIO : public FileIO {
  public:
@@ -44,10 +66,73 @@ class BlockFileIO : public FileIO {
   // implemented in terms of blocks.
   virtual ssize_t read(const IORequest &req) const;
   virtual ssize_t write(const IORequest &req);
+  virtual ssize_t writeInPlace(const IORequest &req);
 
   virtual unsigned int blockSize() const;
 
+  // Only whole blocks of a volume which allows holes can be punched.
+  virtual int punchHole(off_t offset, off_t length);
+
+  // Reserves the blocks covering the range.
+  virtual int allocate(off_t offset, off_t length);
+
+  // Frees the last-block buffer; layers with a base pass the call on.
+  virtual void releaseBuffers();
+
+  // For this layer, if it enabled read ahead; layers with a base pass the
+  // call on.
+  virtual void setReadAhead(int kib);
+
+  // Read ahead policies, prefetches and pins of the blocks this layer
+  // caches.  Layers below keep detecting the reads of this one.
+  virtual int advise(Advice advice, off_t offset, off_t length);
+
  protected:
+  // Marks a change of the file contents, for the duration of its scope.
+  // Read ahead blocks are only cached if no change overlapped their read.
+  class ChangeScope {
+   public:
+    explicit ChangeScope(const BlockFileIO *io) : _io(io) {
+      ++_io->_changing;
+      ++_io->_changeGen;
+    }
+    ~ChangeScope() {
+      ++_io->_changeGen;
+      --_io->_changing;
+    }
+
+   private:
+    const BlockFileIO *_io;
+  };
+
+  // Read ahead needs the block cache and the mount's worker pool, it stays
+  // off if either is missing.  A layer which enables it has to call
+  // stopReadAhead() first thing in its destructor, as the pending prefetch
+  // goes through its readBlocks().
+  void enableReadAhead(const FSConfigPtr &cfg);
+  void stopReadAhead();
+
+  // Change the block size of a file which has no data yet (see
+  // CipherFileIO), dropping what is cached of it.  The caller keeps other
+  // threads off the file meanwhile.
+  void setBlockSize(unsigned int blockSize);
+
+  // Process count independent blocks through fn(first, n), in runs of
+  // several blocks spread over the worker pool if count is large enough.
+  // Returns false if any call of fn did.
+  bool forBlocks(size_t count,
+                 const std::function<bool(size_t first, size_t n)> &fn) const;
+
+  // Process count blocks through first(first, n) and then second(first, n),
+  // in runs of several blocks, where the first stage of a run overlaps with
+  // the second stage of the run before it if count is large enough (say,
+  // reading the next run from below while decoding this one).  Returns
+  // false if any stage did, which ends the pipeline.
+  bool pipeline(size_t count,
+                const std::function<bool(size_t first, size_t n)> &first,
+                const std::function<bool(size_t first, size_t n)> &second)
+      const;
+
   int truncateBase(off_t size, FileIO *base);
   int padFile(off_t oldSize, off_t newSize, bool forceWrite);
 
@@ -56,15 +141,108 @@ class BlockFileIO : public FileIO {
   virtual ssize_t readOneBlock(const IORequest &req) const = 0;
   virtual ssize_t writeOneBlock(const IORequest &req) = 0;
 
+  // Read count consecutive full blocks, starting at the block aligned
+  // req.offset, where req.dataLen == count * blockSize().  Only the last block
+  // may come back short (end of file).  The default goes through
+  // cacheReadOneBlock for each block; layers which can fetch and decode a
+  // whole run at once override it.
+  virtual ssize_t readBlocks(const IORequest &req) const;
+
+  // readBlocks() which calls done with its result instead of returning it,
+  // as FileIO::readAsync.  The default calls readBlocks() right away.
+  virtual void readBlocksAsync(const IORequest &req, IODone done) const;
+
+  // Write count consecutive full blocks, starting at the block aligned
+  // req.offset, where req.dataLen == count * blockSize().  req.data may only
+  // be modified (encoded in place) if inPlace is set.  The default writes one
+  // block at a time.
+  virtual ssize_t writeBlocks(const IORequest &req, bool inPlace);
+
+  // Turn count consecutive blocks, starting at the block aligned offset, into
+  // a hole in the lower file.  Only called if holes are allowed, as zero
+  // blocks then read back as zeros.  The default returns -EOPNOTSUPP, and the
+  // blocks are written as usual.
+  virtual int punchBlocks(off_t offset, size_t count);
+
+  // Reserve space in the lower file for count consecutive blocks, starting at
+  // the block aligned offset, including their headers.  The default returns
+  // -EOPNOTSUPP.
+  virtual int allocateBlocks(off_t offset, size_t count);
+
+  // Read or write part of a single block, without the rest of it.
+  // req.offset needn't be block aligned, but the request ends within the
+  // block.  writePartial may encode req.data in place, and is only called if
+  // the data before req.offset exists.  Only used if _randomAccess is set,
+  // the defaults return -EOPNOTSUPP.
+  virtual ssize_t readPartial(const IORequest &req) const;
+  virtual ssize_t writePartial(const IORequest &req);
+
+  void storeCache(off_t offset, const unsigned char *data, size_t len) const;
+  void storeReadCache(off_t offset, const unsigned char *data, size_t len,
+                      uint64_t gen, bool keep) const;
+  // put a block in the last-block cache, _cacheMutex held
+  void keepBlock(off_t offset, const unsigned char *data, size_t len) const;
+  void dropCache(off_t offset) const;
+  // give the last-block buffer back to the budget, _cacheMutex held
+  void freeBuffer() const;
+  // Forget all cached blocks of the file, which changed below us.  Reads
+  // which are still running don't cache what they read either.
+  void invalidateCache() const;
+
   ssize_t cacheReadOneBlock(const IORequest &req) const;
-  ssize_t cacheWriteOneBlock(const IORequest &req);
+  ssize_t cacheWriteOneBlock(const IORequest &req, bool inPlace = false);
+  ssize_t cacheWriteBlocks(const IORequest &req, bool inPlace = false);
+  ssize_t cacheReadPartial(const IORequest &req) const;
+  ssize_t cacheWritePartial(const IORequest &req, bool inPlace);
+  ssize_t readImpl(const IORequest &req) const;
+  ssize_t writeImpl(const IORequest &req, bool inPlace);
+
+  void readAhead(const IORequest &req) const;
+  int willNeed(off_t offset, off_t length) const;
+  void prefetch(off_t firstBlock, off_t count) const;
+  void prefetched(const IORequest &req, ssize_t readSize, uint64_t gen) const;
 
   unsigned int _blockSize;
   bool _allowHoles;
   bool _noCache;
+  // set by layers which implement readPartial / writePartial
+  bool _randomAccess;
 
-  // cache last block for speed...
+  // cache last block for speed, allocated from the mount's BufferBudget
+  // (if any) when the first block is kept
   mutable IORequest _cache;
+  // protects _cache, so that the blocks of a file may be read and written
+  // from several threads at once
+  mutable pthread_mutex_t _cacheMutex;
+
+  // shared cache of decoded blocks, may be null
+  BlockCache *_blockCache;
+  uint64_t _cacheOwner;
+
+  // bounds _cache over all open files, may be null
+  std::shared_ptr<BufferBudget> _budget;
+
+  // shared worker threads, may be null
+  std::shared_ptr<WorkerPool> _workers;
+
+  // read ahead state, _raMaxBlocks is 0 if disabled
+  bool _raEnabled;  // by enableReadAhead
+  off_t _raMaxBlocks;
+  mutable pthread_mutex_t _raMutex;
+  mutable pthread_cond_t _raDone;
+  mutable off_t _raLastOffset;  // previous read
+  mutable off_t _raLastEnd;
+  mutable off_t _raWindow;  // in blocks
+  mutable off_t _raNext;    // first block not yet prefetched
+  mutable int _raPending;   // prefetches in flight
+  mutable bool _raStopped;
+  Advice _raPolicy;         // from advise()
+  // the last read continued a stream, read without _raMutex
+  mutable std::atomic<bool> _raStreaming;
+
+  // see ChangeScope
+  mutable std::atomic<int> _changing;
+  mutable std::atomic<uint64_t> _changeGen;
 };
 
 }  // namespace encfs
@@ -203,7 +203,7 @@ int BlockNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
     throw Error("Filename too small to decode");
   }
 
-  BUFFER_INIT(tmpBuf, 32, (unsigned int)length);
+  BUFFER_INIT(tmpBuf, 256, (unsigned int)length);
 
   // decode into tmpBuf,
   if (_caseInsensitive) {
@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BufferBudget.h"
+
+#include "Stats.h"
+
+namespace encfs {
+
+BufferBudget::BufferBudget(size_t limit) : _limit(limit), _used(0) {}
+
+BufferBudget::~BufferBudget() {
+  Stats::adjust(Stats::BufferBytes, -(int64_t)_used.load());
+}
+
+bool BufferBudget::reserve(size_t bytes) {
+  size_t used = _used.load(std::memory_order_relaxed);
+  do {
+    if (_limit != 0 && used + bytes > _limit) {
+      return false;
+    }
+  } while (!_used.compare_exchange_weak(used, used + bytes,
+                                        std::memory_order_relaxed));
+  Stats::adjust(Stats::BufferBytes, (int64_t)bytes);
+  return true;
+}
+
+void BufferBudget::release(size_t bytes) {
+  _used.fetch_sub(bytes, std::memory_order_relaxed);
+  Stats::adjust(Stats::BufferBytes, -(int64_t)bytes);
+}
+
+}  // namespace encfs
@@ -0,0 +1,60 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BufferBudget_incl_
+#define _BufferBudget_incl_
+
+#include <atomic>
+#include <cstddef>
+
+namespace encfs {
+
+/*
+    Bounds the memory which the open files of a mount keep for themselves,
+    the last-block buffers of the BlockFileIO layers (see --buffermem).
+
+    A layer reserves its buffer when it first keeps a block and gives it
+    back when it drops the buffer, on close or when the file is parked.  If
+    the budget is spent the block just isn't kept, and reads of it go to
+    the BlockCache or the backing file.  With hundreds of thousands of open
+    files only the busy ones then hold a buffer.  Reservations take no lock,
+    and what is in use is reported through Stats.
+*/
+class BufferBudget {
+ public:
+  // limit in bytes, 0 for no limit
+  explicit BufferBudget(size_t limit);
+  ~BufferBudget();
+
+  BufferBudget(const BufferBudget &src) = delete;
+  BufferBudget &operator=(const BufferBudget &src) = delete;
+
+  // Returns false if bytes more would exceed the limit
+  bool reserve(size_t bytes);
+  void release(size_t bytes);
+
+  size_t used() const { return _used.load(std::memory_order_relaxed); }
+  size_t limit() const { return _limit; }
+
+ private:
+  const size_t _limit;
+  std::atomic<size_t> _used;
+};
+
+}  // namespace encfs
+
+#endif
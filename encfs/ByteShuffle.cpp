@@ -0,0 +1,236 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ByteShuffle.h"
+
+#include <algorithm>  // for reverse
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENCFS_SHUFFLE_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define ENCFS_SHUFFLE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace encfs {
+
+static const int FlipChunk = 64;
+
+void shuffleBytesScalar(unsigned char *buf, int size) {
+  for (int i = 0; i < size - 1; ++i) {
+    buf[i + 1] ^= buf[i];
+  }
+}
+
+void unshuffleBytesScalar(unsigned char *buf, int size) {
+  for (int i = size - 1; i > 0; --i) {
+    buf[i] ^= buf[i - 1];
+  }
+}
+
+// Reversed in place, so that no copy of the data is left behind in a scratch
+// buffer.
+void flipBytesScalar(unsigned char *buf, int size) {
+  for (int i = 0; i < size; i += FlipChunk) {
+    std::reverse(buf + i, buf + std::min(i + FlipChunk, size));
+  }
+}
+
+/*
+    A vector of 16 bytes is prefix XORed in four steps, by XORing it with
+    itself shifted by 1, 2, 4 and 8 bytes, and then with the last byte of the
+    previous vector.  unshuffleBytes goes from the back, so that the
+    unaligned load of the bytes before a vector still sees them unchanged.
+*/
+#if defined(ENCFS_SHUFFLE_X86)
+
+static void shuffleBytesSSE2(unsigned char *buf, int size) {
+  unsigned char carry = 0;
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    x = _mm_xor_si128(x, _mm_slli_si128(x, 1));
+    x = _mm_xor_si128(x, _mm_slli_si128(x, 2));
+    x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+    x = _mm_xor_si128(x, _mm_slli_si128(x, 8));
+    x = _mm_xor_si128(x, _mm_set1_epi8((char)carry));
+    _mm_storeu_si128((__m128i *)(buf + i), x);
+    carry = buf[i + 15];
+  }
+  if (i == 0) {
+    shuffleBytesScalar(buf, size);
+  } else {
+    shuffleBytesScalar(buf + i - 1, size - i + 1);
+  }
+}
+
+static void unshuffleBytesSSE2(unsigned char *buf, int size) {
+  int i = size - 16;
+  for (; i >= 1; i -= 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i prev = _mm_loadu_si128((const __m128i *)(buf + i - 1));
+    _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(x, prev));
+  }
+  unshuffleBytesScalar(buf, std::min(i + 16, size));
+}
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+SSSE3 static inline __m128i reverse16(__m128i x) {
+  return _mm_shuffle_epi8(
+      x, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+SSSE3 static void flipBytesSSSE3(unsigned char *buf, int size) {
+  int i = 0;
+  for (; i + FlipChunk <= size; i += FlipChunk) {
+    __m128i *p = (__m128i *)(buf + i);
+    __m128i a = _mm_loadu_si128(p);
+    __m128i b = _mm_loadu_si128(p + 1);
+    __m128i c = _mm_loadu_si128(p + 2);
+    __m128i d = _mm_loadu_si128(p + 3);
+    _mm_storeu_si128(p, reverse16(d));
+    _mm_storeu_si128(p + 1, reverse16(c));
+    _mm_storeu_si128(p + 2, reverse16(b));
+    _mm_storeu_si128(p + 3, reverse16(a));
+  }
+  flipBytesScalar(buf + i, size - i);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+// pshufb only works within 128 bit lanes, so the lanes are swapped after
+AVX2 static inline __m256i reverse32(__m256i x) {
+  const __m256i mask =
+      _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                       15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(x, mask), 0x4e);
+}
+
+AVX2 static void flipBytesAVX2(unsigned char *buf, int size) {
+  int i = 0;
+  for (; i + FlipChunk <= size; i += FlipChunk) {
+    __m256i *p = (__m256i *)(buf + i);
+    __m256i a = _mm256_loadu_si256(p);
+    __m256i b = _mm256_loadu_si256(p + 1);
+    _mm256_storeu_si256(p, reverse32(b));
+    _mm256_storeu_si256(p + 1, reverse32(a));
+  }
+  flipBytesScalar(buf + i, size - i);
+}
+
+#elif defined(ENCFS_SHUFFLE_NEON)
+
+// result[k] = x[k - n], with zeros shifted in
+#define SHIFT_UP(x, n) vextq_u8(vdupq_n_u8(0), (x), 16 - (n))
+
+static void shuffleBytesNEON(unsigned char *buf, int size) {
+  unsigned char carry = 0;
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t x = vld1q_u8(buf + i);
+    x = veorq_u8(x, SHIFT_UP(x, 1));
+    x = veorq_u8(x, SHIFT_UP(x, 2));
+    x = veorq_u8(x, SHIFT_UP(x, 4));
+    x = veorq_u8(x, SHIFT_UP(x, 8));
+    x = veorq_u8(x, vdupq_n_u8(carry));
+    vst1q_u8(buf + i, x);
+    carry = buf[i + 15];
+  }
+  if (i == 0) {
+    shuffleBytesScalar(buf, size);
+  } else {
+    shuffleBytesScalar(buf + i - 1, size - i + 1);
+  }
+}
+
+#undef SHIFT_UP
+
+static void unshuffleBytesNEON(unsigned char *buf, int size) {
+  int i = size - 16;
+  for (; i >= 1; i -= 16) {
+    vst1q_u8(buf + i, veorq_u8(vld1q_u8(buf + i), vld1q_u8(buf + i - 1)));
+  }
+  unshuffleBytesScalar(buf, std::min(i + 16, size));
+}
+
+static inline uint8x16_t reverse16(uint8x16_t x) {
+  x = vrev64q_u8(x);
+  return vcombine_u8(vget_high_u8(x), vget_low_u8(x));
+}
+
+static void flipBytesNEON(unsigned char *buf, int size) {
+  int i = 0;
+  for (; i + FlipChunk <= size; i += FlipChunk) {
+    unsigned char *p = buf + i;
+    uint8x16_t a = vld1q_u8(p);
+    uint8x16_t b = vld1q_u8(p + 16);
+    uint8x16_t c = vld1q_u8(p + 32);
+    uint8x16_t d = vld1q_u8(p + 48);
+    vst1q_u8(p, reverse16(d));
+    vst1q_u8(p + 16, reverse16(c));
+    vst1q_u8(p + 32, reverse16(b));
+    vst1q_u8(p + 48, reverse16(a));
+  }
+  flipBytesScalar(buf + i, size - i);
+}
+
+#endif
+
+namespace {
+
+struct Kernels {
+  void (*shuffle)(unsigned char *buf, int size);
+  void (*unshuffle)(unsigned char *buf, int size);
+  void (*flip)(unsigned char *buf, int size);
+};
+
+// picked once, from what the CPU supports
+const Kernels &kernels() {
+  static const Kernels best = []() -> Kernels {
+#if defined(ENCFS_SHUFFLE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return {shuffleBytesSSE2, unshuffleBytesSSE2, flipBytesAVX2};
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+      return {shuffleBytesSSE2, unshuffleBytesSSE2, flipBytesSSSE3};
+    }
+    return {shuffleBytesSSE2, unshuffleBytesSSE2, flipBytesScalar};
+#elif defined(ENCFS_SHUFFLE_NEON)
+    return {shuffleBytesNEON, unshuffleBytesNEON, flipBytesNEON};
+#else
+    return {shuffleBytesScalar, unshuffleBytesScalar, flipBytesScalar};
+#endif
+  }();
+  return best;
+}
+
+}  // namespace
+
+void shuffleBytes(unsigned char *buf, int size) {
+  kernels().shuffle(buf, size);
+}
+
+void unshuffleBytes(unsigned char *buf, int size) {
+  kernels().unshuffle(buf, size);
+}
+
+void flipBytes(unsigned char *buf, int size) { kernels().flip(buf, size); }
+
+}  // namespace encfs
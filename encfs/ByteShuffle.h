@@ -0,0 +1,43 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ByteShuffle_incl_
+#define _ByteShuffle_incl_
+
+namespace encfs {
+
+/*
+    The byte mixing steps of the stream cipher (SSL_Cipher::streamEncode),
+    which make every byte of a partial block depend on the others.
+*/
+
+// buf[i] ^= buf[i - 1], running from the front: a prefix XOR
+void shuffleBytes(unsigned char *buf, int size);
+// undoes shuffleBytes
+void unshuffleBytes(unsigned char *buf, int size);
+// reverses each 64 byte chunk of buf, and the shorter one at the end
+void flipBytes(unsigned char *buf, int size);
+
+// Portable versions of the above.  The others use vector instructions when
+// the CPU has them, and must give the same results.
+void shuffleBytesScalar(unsigned char *buf, int size);
+void unshuffleBytesScalar(unsigned char *buf, int size);
+void flipBytesScalar(unsigned char *buf, int size);
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,225 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "CachedFileIO.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sys/stat.h>
+#include <utility>
+#include <vector>
+
+namespace encfs {
+
+static Interface CachedFileIO_iface("FileIO/Cached", 1, 0, 0);
+
+static const off_t Chunk = DiskCache::ChunkSize;
+
+CachedFileIO::CachedFileIO(std::shared_ptr<FileIO> base_,
+                           std::shared_ptr<DiskCache> cache_)
+    : base(std::move(base_)),
+      cache(std::move(cache_)),
+      haveKey(false),
+      cached(false),
+      written(false),
+      knownSize(0) {
+  key.dev = key.ino = 0;
+}
+
+CachedFileIO::~CachedFileIO() {
+  // the stamp the chunks kept are valid for
+  struct stat st;
+  if (written && haveKey && base->getAttr(&st) == 0 &&
+      (uint64_t)st.st_ino == key.ino) {
+    cache->update(key, st);
+  }
+}
+
+Interface CachedFileIO::interface() const { return CachedFileIO_iface; }
+
+unsigned int CachedFileIO::blockSize() const { return base->blockSize(); }
+
+void CachedFileIO::setFileName(const char *fileName) {
+  base->setFileName(fileName);
+}
+
+const char *CachedFileIO::getFileName() const { return base->getFileName(); }
+
+bool CachedFileIO::setIV(uint64_t iv) { return base->setIV(iv); }
+
+void CachedFileIO::check() {
+  struct stat st;
+  if (base->getAttr(&st) != 0 || !S_ISREG(st.st_mode)) {
+    cached = false;
+    return;
+  }
+  DiskCache::Key found;
+  found.dev = st.st_dev;
+  found.ino = st.st_ino;
+  if (written && haveKey && found == key) {
+    // our own changes, whose chunks are dropped already
+    cache->update(key, st);
+    written = false;
+  }
+  key = found;
+  haveKey = true;
+  knownSize = st.st_size;
+  cached = cache->validate(key, st);
+}
+
+int CachedFileIO::open(int flags) {
+  int res = base->open(flags);
+  if (res >= 0) {
+    check();
+  }
+  return res;
+}
+
+int CachedFileIO::create(mode_t mode) {
+  int res = base->create(mode);
+  if (res >= 0) {
+    check();
+  }
+  return res;
+}
+
+int CachedFileIO::getAttr(struct stat *stbuf) const {
+  return base->getAttr(stbuf);
+}
+
+off_t CachedFileIO::getSize() const { return base->getSize(); }
+
+ssize_t CachedFileIO::read(const IORequest &req) const {
+  if (!cached || req.dataLen == 0) {
+    return base->read(req);
+  }
+
+  std::vector<unsigned char> buf;
+  size_t done = 0;
+  while (done < req.dataLen) {
+    off_t offset = req.offset + done;
+    uint64_t index = offset / Chunk;
+    size_t within = offset % Chunk;
+    size_t len = std::min(req.dataLen - done, (size_t)Chunk - within);
+
+    ssize_t res = cache->get(key, index, within, req.data + done, len);
+    if (res < 0) {
+      // read the whole chunk for the cache
+      uint64_t generation = cache->generation(key);
+      buf.resize(Chunk);
+      IORequest chunkReq;
+      chunkReq.offset = index * Chunk;
+      chunkReq.dataLen = Chunk;
+      chunkReq.data = buf.data();
+      ssize_t got = base->read(chunkReq);
+      if (got < 0) {
+        return done > 0 ? (ssize_t)done : got;
+      }
+      cache->put(key, index, buf.data(), got, generation);
+      res = std::max((ssize_t)0, std::min((ssize_t)len, got - (ssize_t)within));
+      memcpy(req.data + done, buf.data() + within, res);
+    }
+    done += res;
+    if ((size_t)res < len) {
+      break;  // end of file
+    }
+  }
+  return done;
+}
+
+void CachedFileIO::readAsync(const IORequest &req, IODone done) const {
+  if (!cached) {
+    base->readAsync(req, std::move(done));
+  } else {
+    done(read(req));
+  }
+}
+
+void CachedFileIO::changed(off_t offset, off_t length) {
+  written = true;
+  if (!haveKey) {
+    return;
+  }
+  // a chunk which ended the file before ends before the new data now
+  off_t size = knownSize;
+  off_t end = offset + length;
+  off_t first = std::min(offset, size);
+  cache->drop(key, first / Chunk, (std::max(end, first + 1) - 1) / Chunk);
+  while (end > size && !knownSize.compare_exchange_weak(size, end)) {
+  }
+}
+
+ssize_t CachedFileIO::write(const IORequest &req) {
+  ssize_t res = base->write(req);
+  changed(req.offset, req.dataLen);
+  return res;
+}
+
+ssize_t CachedFileIO::writeInPlace(const IORequest &req) {
+  ssize_t res = base->writeInPlace(req);
+  changed(req.offset, req.dataLen);
+  return res;
+}
+
+int CachedFileIO::truncate(off_t size) {
+  int res = base->truncate(size);
+  written = true;
+  if (haveKey) {
+    cache->drop(key, std::min(size, (off_t)knownSize) / Chunk, UINT64_MAX);
+    knownSize = size;
+  }
+  return res;
+}
+
+int CachedFileIO::punchHole(off_t offset, off_t length) {
+  int res = base->punchHole(offset, length);
+  if (res == 0) {
+    changed(offset, length);
+  }
+  return res;
+}
+
+int CachedFileIO::allocate(off_t offset, off_t length) {
+  return base->allocate(offset, length);
+}
+
+off_t CachedFileIO::nextData(off_t offset) const {
+  return base->nextData(offset);
+}
+
+off_t CachedFileIO::nextHole(off_t offset) const {
+  return base->nextHole(offset);
+}
+
+bool CachedFileIO::isWritable() const { return base->isWritable(); }
+
+void CachedFileIO::invalidate() {
+  base->invalidate();
+  if (haveKey) {
+    // changed by others as well, the stamp tells whether the chunks are
+    written = false;
+    check();
+  }
+}
+
+void CachedFileIO::releaseBuffers() { base->releaseBuffers(); }
+
+void CachedFileIO::setReadAhead(int kib) { base->setReadAhead(kib); }
+
+}  // namespace encfs
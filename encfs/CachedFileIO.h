@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _CachedFileIO_incl_
+#define _CachedFileIO_incl_
+
+#include <atomic>
+#include <memory>
+#include <sys/types.h>
+
+#include "DiskCache.h"
+#include "FileIO.h"
+#include "Interface.h"
+
+namespace encfs {
+
+/*
+    FileIO between CipherFileIO and the backing file, which keeps the
+    ciphertext read in a DiskCache (--diskcache) and serves it from there
+    again.
+
+    Reads go by chunk: a chunk kept in the cache is read from the local
+    disk, any other is read whole from the backing file and handed to the
+    cache.  Writes, truncates and holes go to the backing file right away
+    and drop the chunks they touch; nothing is kept only in the cache.
+*/
+class CachedFileIO : public FileIO {
+ public:
+  CachedFileIO(std::shared_ptr<FileIO> base,
+               std::shared_ptr<DiskCache> cache);
+  virtual ~CachedFileIO();
+
+  virtual Interface interface() const;
+  virtual unsigned int blockSize() const;
+
+  virtual void setFileName(const char *fileName);
+  virtual const char *getFileName() const;
+  virtual bool setIV(uint64_t iv);
+
+  virtual int open(int flags);
+  virtual int create(mode_t mode);
+
+  virtual int getAttr(struct stat *stbuf) const;
+  virtual off_t getSize() const;
+
+  virtual ssize_t read(const IORequest &req) const;
+  virtual ssize_t write(const IORequest &req);
+  virtual void readAsync(const IORequest &req, IODone done) const;
+  virtual ssize_t writeInPlace(const IORequest &req);
+
+  virtual int truncate(off_t size);
+  virtual int punchHole(off_t offset, off_t length);
+  virtual int allocate(off_t offset, off_t length);
+  virtual off_t nextData(off_t offset) const;
+  virtual off_t nextHole(off_t offset) const;
+
+  virtual bool isWritable() const;
+  virtual void invalidate();
+  virtual void releaseBuffers();
+  virtual void setReadAhead(int kib);
+
+ private:
+  // looks up the backing file after it was opened
+  void check();
+  // bytes from offset changed through us
+  void changed(off_t offset, off_t length);
+
+  std::shared_ptr<FileIO> base;
+  std::shared_ptr<DiskCache> cache;
+
+  DiskCache::Key key;
+  std::atomic<bool> haveKey;
+  std::atomic<bool> cached;       // the chunks may be used
+  std::atomic<bool> written;      // changed through us since check()
+  std::atomic<off_t> knownSize;  // of the backing file
+};
+
+}  // namespace encfs
+
+#endif
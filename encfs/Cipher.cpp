@@ -129,6 +129,20 @@ std::shared_ptr<Cipher> Cipher::New(const string &name, int keyLen) {
 
   return result;
 }
+std::shared_ptr<Cipher> Cipher::New(const string &name, const Interface &iface,
+                                    int keyLen) {
+  std::shared_ptr<Cipher> result;
+
+  if (gCipherMap != nullptr) {
+    CipherMap_t::const_iterator it = gCipherMap->find(name);
+    if (it != gCipherMap->end() && it->second.iface.implements(iface)) {
+      result = (*it->second.constructor)(iface, keyLen);
+    }
+  }
+
+  return result;
+}
+
 std::shared_ptr<Cipher> Cipher::New(const Interface &iface, int keyLen) {
   std::shared_ptr<Cipher> result;
   if (gCipherMap != nullptr) {
@@ -175,6 +189,65 @@ unsigned int Cipher::MAC_16(const unsigned char *src, int len,
   return mac16;
 }
 
+bool Cipher::exportKey(const CipherKey &, const char *, unsigned char *,
+                       int) const {
+  return false;
+}
+
+uint64_t Cipher::blockMAC_64(const unsigned char *src, int len,
+                             const CipherKey &key) const {
+  return MAC_64(src, len, key);
+}
+
+bool Cipher::blockEncodeMany(unsigned char *buf, int size,
+                             const uint64_t *ivs, int count,
+                             const CipherKey &key) const {
+  for (int i = 0; i < count; ++i) {
+    if (!blockEncode(buf + (size_t)i * size, size, ivs[i], key)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Cipher::randomAccess() const { return false; }
+
+bool Cipher::rangeEncode(unsigned char *, int, uint64_t, int,
+                         const CipherKey &) const {
+  return false;
+}
+
+bool Cipher::rangeDecode(unsigned char *, int, uint64_t, int,
+                         const CipherKey &) const {
+  return false;
+}
+
+const int Cipher::SealTagBytes;
+const int Cipher::SealNonceBytes;
+const int Cipher::SealBytes;
+
+bool Cipher::sealedBlocks() const { return false; }
+
+bool Cipher::sealEncode(unsigned char *, int, uint64_t,
+                        const CipherKey &) const {
+  return false;
+}
+
+bool Cipher::sealDecode(unsigned char *, int, uint64_t,
+                        const CipherKey &) const {
+  return false;
+}
+
+Interface Cipher::volumeInterface(int blockSize) const {
+  (void)blockSize;
+  return interface();
+}
+
+CipherKey Cipher::newKey(const char *, int, Argon2::Params &, long,
+                         const unsigned char *, int) {
+  return CipherKey();
+}
+
 bool Cipher::nameEncode(unsigned char *data, int len, uint64_t iv64,
                         const CipherKey &key) const {
   return streamEncode(data, len, iv64, key);
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <string>
 
+#include "Argon2.h"
 #include "CipherKey.h"
 #include "Interface.h"
 #include "Range.h"
@@ -61,6 +62,10 @@ class Cipher {
   static std::shared_ptr<Cipher> New(const Interface &iface, int keyLen = -1);
   static std::shared_ptr<Cipher> New(const std::string &cipherName,
                                      int keyLen = -1);
+  // the named implementation, for a volume of interface iface, if it
+  // implements that
+  static std::shared_ptr<Cipher> New(const std::string &cipherName,
+                                     const Interface &iface, int keyLen);
 
   static bool Register(const char *cipherName, const char *description,
                        const Interface &iface, CipherConstructor constructor,
@@ -74,6 +79,10 @@ class Cipher {
   virtual ~Cipher();
 
   virtual Interface interface() const = 0;
+  // The interface recorded for a new volume with the given block size.  A
+  // cipher may name an older version when it supports the block size, so
+  // that older releases can mount the volume.
+  virtual Interface volumeInterface(int blockSize) const;
 
   // create a new key based on a password
   // if iterationCount == 0, then iteration count will be determined
@@ -83,6 +92,14 @@ class Cipher {
   virtual CipherKey newKey(const char *password, int passwdLength,
                            int &iterationCount, long desiredFunctionDuration,
                            const unsigned char *salt, int saltLen) = 0;
+  // create a new key based on a password, with Argon2id
+  // if params.passes == 0, then the number of passes will be determined
+  // by newKey function and filled in, as for iterationCount above.
+  // Returns an empty key if the cipher doesn't support it.
+  virtual CipherKey newKey(const char *password, int passwdLength,
+                           Argon2::Params &params,
+                           long desiredFunctionDuration,
+                           const unsigned char *salt, int saltLen);
   // deprecated - for backward compatibility
   virtual CipherKey newKey(const char *password, int passwdLength) = 0;
   // create a new random key
@@ -122,6 +139,14 @@ class Cipher {
                       uint64_t *chainedIV = 0) const;
   unsigned int MAC_16(const unsigned char *src, int len, const CipherKey &key,
                       uint64_t *chainedIV = 0) const;
+  // len bytes (at most 64) of key material for a use outside of encfs,
+  // named by label, derived from key.  The default fails.
+  virtual bool exportKey(const CipherKey &key, const char *label,
+                         unsigned char *out, int len) const;
+  // 64 bit MAC of a file block for MACFileIO 3, with a keyed hash which is
+  // much cheaper than MAC_64.  Defaults to MAC_64.
+  virtual uint64_t blockMAC_64(const unsigned char *src, int len,
+                               const CipherKey &key) const;
 
   // functional interfaces
   /*
@@ -151,6 +176,50 @@ class Cipher {
                            const CipherKey &key) const = 0;
   virtual bool blockDecode(unsigned char *buf, int size, uint64_t iv64,
                            const CipherKey &key) const = 0;
+
+  /*
+      Block encoding of count blocks of size bytes which follow each other
+      in buf, block i with ivs[i], the same as blockEncode on each.  The
+      default does just that, a cipher may encode several at once.
+  */
+  virtual bool blockEncodeMany(unsigned char *buf, int size,
+                               const uint64_t *ivs, int count,
+                               const CipherKey &key) const;
+
+  /*
+      Random access coding of file data, for ciphers which code file blocks
+      in a counter mode, where every byte only depends on its position.
+      offset is the position of data within its block, and iv64 that of the
+      block.  Whole and partial file blocks are then coded with offset 0
+      (instead of blockEncode and streamEncode), and any part of a block can
+      be read or rewritten without the rest of it.  Only supported if
+      randomAccess() is true, the defaults fail.
+  */
+  virtual bool randomAccess() const;
+  virtual bool rangeEncode(unsigned char *data, int len, uint64_t iv64,
+                           int offset, const CipherKey &key) const;
+  virtual bool rangeDecode(unsigned char *data, int len, uint64_t iv64,
+                           int offset, const CipherKey &key) const;
+
+  /*
+      Authenticated coding of file data, for ciphers which seal file blocks
+      with an AEAD.  A sealed block starts with SealTagBytes of tag and
+      SealNonceBytes of nonce, as the MAC header of MACFileIO version 4.  The
+      nonce is filled in by the caller, with fresh random bytes for every
+      write, sealEncode codes the data after the header and stores its tag,
+      which also covers iv64, so that a block only opens at its own place.
+      sealDecode fails if the tag doesn't match (the data is decoded anyway).
+      Only supported if sealedBlocks() is true, the defaults fail.
+  */
+  static const int SealTagBytes = 16;
+  static const int SealNonceBytes = 12;
+  static const int SealBytes = SealTagBytes + SealNonceBytes;
+
+  virtual bool sealedBlocks() const;
+  virtual bool sealEncode(unsigned char *data, int len, uint64_t iv64,
+                          const CipherKey &key) const;
+  virtual bool sealDecode(unsigned char *data, int len, uint64_t iv64,
+                          const CipherKey &key) const;
 };
 
 }  // namespace encfs
@@ -0,0 +1,289 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CipherBench.h"
+
+#include "easylogging++.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "BlockNameIO.h"
+#include "Error.h"
+#include "CipherKey.h"
+#include "NameIO.h"
+
+namespace encfs {
+
+const int BenchBlockSizes[] = {1024, 2048, 4096, 8192};
+const int BenchBlockSizeCount = sizeof(BenchBlockSizes) / sizeof(int);
+
+static const double MiB = 1024.0 * 1024.0;
+
+// block sizes fastestConfig chooses from, larger ones hurt small requests
+static const int MaxAutoBlockSize = 4096;
+
+static double nowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+    Runs op until durationMs have passed, and returns how many times it ran
+    per second, or -1 if it failed.
+*/
+template <typename Op>
+static double rate(int durationMs, const Op &op) {
+  if (!op()) {  // warm up
+    return -1;
+  }
+  double start = nowSeconds();
+  double end = start + durationMs / 1000.0;
+  long count = 0;
+  double now;
+  do {
+    for (int i = 0; i < 16; ++i) {
+      if (!op()) {
+        return -1;
+      }
+    }
+    count += 16;
+    now = nowSeconds();
+  } while (now < end);
+  return count / (now - start);
+}
+
+bool benchCipher(const std::shared_ptr<Cipher> &cipher, int blockSize,
+                 int durationMs, CipherSpeed *speed) {
+  CipherKey key = cipher->newRandomKey();
+  std::vector<unsigned char> buf(blockSize);
+  cipher->randomize(buf.data(), blockSize, false);
+
+  // file data of random access ciphers is coded with rangeEncode, that of
+  // sealing ciphers with sealEncode
+  const bool ranged = cipher->randomAccess();
+  const bool sealed = cipher->sealedBlocks();
+  uint64_t iv = 0;
+  double encode = rate(durationMs, [&]() {
+    if (sealed) {
+      return cipher->sealEncode(buf.data(), blockSize, ++iv, key);
+    }
+    return ranged ? cipher->rangeEncode(buf.data(), blockSize, ++iv, 0, key)
+                  : cipher->blockEncode(buf.data(), blockSize, ++iv, key);
+  });
+  // a sealed block only opens once, so every round opens a copy of it
+  std::vector<unsigned char> sealedBuf(buf);
+  if (sealed && !cipher->sealEncode(sealedBuf.data(), blockSize, 0, key)) {
+    return false;
+  }
+  double decode = rate(durationMs, [&]() {
+    if (sealed) {
+      buf = sealedBuf;
+      return cipher->sealDecode(buf.data(), blockSize, 0, key);
+    }
+    return ranged ? cipher->rangeDecode(buf.data(), blockSize, ++iv, 0, key)
+                  : cipher->blockDecode(buf.data(), blockSize, ++iv, key);
+  });
+  double mac = rate(durationMs, [&]() {
+    cipher->MAC_64(buf.data(), blockSize, key);
+    return true;
+  });
+  if (encode < 0 || decode < 0) {
+    return false;
+  }
+
+  speed->keySize = cipher->keySize() * 8;
+  speed->blockSize = blockSize;
+  speed->encode = encode * blockSize / MiB;
+  speed->decode = decode * blockSize / MiB;
+  speed->mac = mac * blockSize / MiB;
+  return true;
+}
+
+bool benchNames(const std::shared_ptr<Cipher> &cipher, int durationMs,
+                NameSpeed *speed) {
+  CipherKey key = cipher->newRandomKey();
+  std::shared_ptr<NameIO> nameIO =
+      NameIO::New(BlockNameIO::CurrentInterface(), cipher, key);
+  if (!nameIO) {
+    return false;
+  }
+
+  // a typical name, of a typical length
+  const std::string plain = "IMG_20240101_123456.jpg";
+  const std::string encoded = nameIO->encodeName(plain.data(), plain.size());
+  double encode = rate(durationMs, [&]() {
+    return !nameIO->encodeName(plain.data(), plain.size()).empty();
+  });
+  double decode = rate(durationMs, [&]() {
+    return nameIO->decodeName(encoded.data(), encoded.size()) == plain;
+  });
+  if (encode < 0 || decode < 0) {
+    return false;
+  }
+
+  speed->keySize = cipher->keySize() * 8;
+  speed->encode = encode;
+  speed->decode = decode;
+  return true;
+}
+
+int benchBackingIO(const std::string &dir, int blockSize, int sizeMiB,
+                   IOSpeed *speed) {
+  std::string path = dir;
+  if (path.empty() || path[path.size() - 1] != '/') {
+    path += '/';
+  }
+  path += ".encfs-bench.XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+
+  int fd = mkstemp(name.data());
+  if (fd < 0) {
+    return -errno;
+  }
+  unlink(name.data());
+
+  std::vector<char> buf(blockSize, 'x');
+  const off_t size = (off_t)sizeMiB * 1024 * 1024;
+  int res = 0;
+
+  double start = nowSeconds();
+  for (off_t offset = 0; offset < size && res == 0; offset += blockSize) {
+    if (pwrite(fd, buf.data(), blockSize, offset) != blockSize) {
+      res = -errno;
+    }
+  }
+  if (res == 0 && fdatasync(fd) != 0) {
+    res = -errno;
+  }
+  double written = nowSeconds();
+
+  // read from the disk rather than the page cache, where it lets us
+  posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED);
+  double readStart = nowSeconds();
+  for (off_t offset = 0; offset < size && res == 0; offset += blockSize) {
+    if (pread(fd, buf.data(), blockSize, offset) != blockSize) {
+      res = -errno;
+    }
+  }
+  double read = nowSeconds();
+  close(fd);
+
+  if (res != 0) {
+    return res;
+  }
+  speed->blockSize = blockSize;
+  speed->write = sizeMiB / (written - start);
+  speed->read = sizeMiB / (read - readStart);
+  return 0;
+}
+
+// seconds to write and read back a MiB, from the speeds of its parts
+static double costOf(const CipherSpeed &cs, const IOSpeed *io, bool mac) {
+  double cost = 1 / cs.encode + 1 / cs.decode;
+  if (mac) {
+    cost += 2 / cs.mac;
+  }
+  if (io != nullptr) {
+    cost += 1 / io->write + 1 / io->read;
+  }
+  return cost;
+}
+
+bool fastestConfig(const BenchProfile &profile, const std::string &dir,
+                   int durationMs, BenchChoice *choice) {
+  std::vector<int> blockSizes;
+  for (int i = 0; i < BenchBlockSizeCount; ++i) {
+    if (BenchBlockSizes[i] <= MaxAutoBlockSize) {
+      blockSizes.push_back(BenchBlockSizes[i]);
+    }
+  }
+
+  std::vector<IOSpeed> io;
+  for (size_t i = 0; i < blockSizes.size() && !dir.empty(); ++i) {
+    IOSpeed speed;
+    int res = benchBackingIO(dir, blockSizes[i], 16, &speed);
+    if (res != 0) {
+      RLOG(WARNING) << "unable to measure " << dir << ": " << strerror(-res);
+      io.clear();
+      break;
+    }
+    io.push_back(speed);
+  }
+
+  // the cheapest cipher for every block size
+  std::vector<BenchChoice> best(blockSizes.size());
+  std::vector<double> bestCost(blockSizes.size(), 0);
+
+  for (const Cipher::CipherAlgorithm &alg : Cipher::GetAlgorithmList()) {
+    int keySize = alg.keyLength.min();
+    while (keySize < profile.minKeySize && keySize < alg.keyLength.max()) {
+      keySize += alg.keyLength.inc();
+    }
+    if (keySize < profile.minKeySize) {
+      continue;
+    }
+
+    std::shared_ptr<Cipher> cipher = Cipher::New(alg.name, keySize);
+    if (!cipher || cipher->cipherBlockSize() != 16 ||
+        cipher->randomAccess() || cipher->sealedBlocks()) {
+      VLOG(1) << "not considering cipher " << alg.name;
+      continue;
+    }
+
+    for (size_t i = 0; i < blockSizes.size(); ++i) {
+      CipherSpeed speed;
+      if (!alg.blockSize.allowed(blockSizes[i]) ||
+          !benchCipher(cipher, blockSizes[i], durationMs, &speed)) {
+        continue;
+      }
+      double cost =
+          costOf(speed, io.empty() ? nullptr : &io[i], profile.blockMAC);
+      VLOG(1) << alg.name << " " << keySize << " bit key, " << blockSizes[i]
+              << " byte blocks: " << 1 / cost << " MiB/s";
+      if (bestCost[i] == 0 || cost < bestCost[i]) {
+        bestCost[i] = cost;
+        best[i].alg = alg;
+        best[i].keySize = keySize;
+        best[i].blockSize = blockSizes[i];
+        best[i].speed = 1 / cost;
+      }
+    }
+  }
+
+  int chosen = -1;
+  for (size_t i = 0; i < blockSizes.size(); ++i) {
+    if (bestCost[i] == 0) {
+      continue;
+    }
+    if (chosen < 0 || bestCost[i] < bestCost[chosen] * 0.9) {
+      chosen = i;
+    }
+  }
+  if (chosen < 0) {
+    return false;
+  }
+  *choice = best[chosen];
+  return true;
+}
+
+}  // namespace encfs
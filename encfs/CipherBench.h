@@ -0,0 +1,107 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CipherBench_incl_
+#define _CipherBench_incl_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Cipher.h"
+
+namespace encfs {
+
+/*
+    Speed of the ciphers on this machine, for encfsctl bench and for picking
+    the configuration of a new volume with --auto.
+
+    Every figure is measured by running the operation over and over for
+    about durationMs milliseconds.  Speeds are in MiB per second, name
+    coding in names per second.
+*/
+
+// file data coding and MACs of one cipher, key size and block size
+struct CipherSpeed {
+  int keySize;
+  int blockSize;
+  double encode;
+  double decode;
+  double mac;
+};
+
+// name coding of one cipher and key size, with block name coding
+struct NameSpeed {
+  int keySize;
+  double encode;
+  double decode;
+};
+
+// reads and writes of the backing file system, in blockSize requests
+struct IOSpeed {
+  int blockSize;
+  double write;
+  double read;
+};
+
+// The block sizes measured, where the cipher supports them
+extern const int BenchBlockSizes[];
+extern const int BenchBlockSizeCount;
+
+// Returns false if the cipher fails to code a block
+bool benchCipher(const std::shared_ptr<Cipher> &cipher, int blockSize,
+                 int durationMs, CipherSpeed *speed);
+bool benchNames(const std::shared_ptr<Cipher> &cipher, int durationMs,
+                NameSpeed *speed);
+
+// Writes (and syncs) a scratch file of sizeMiB in dir, then reads it back.
+// Returns 0 or -errno.
+int benchBackingIO(const std::string &dir, int blockSize, int sizeMiB,
+                   IOSpeed *speed);
+
+// What a new volume must have
+struct BenchProfile {
+  int minKeySize;  // bits
+  bool blockMAC;   // blocks carry MACs, which cost as much as coding them
+};
+
+struct BenchChoice {
+  Cipher::CipherAlgorithm alg;
+  int keySize;
+  int blockSize;
+  double speed;  // MiB/s of a write and a read back, MACs and I/O included
+};
+
+/*
+    The fastest cipher, key size and block size for profile.  Only ciphers
+    with 16 byte blocks which code whole blocks are considered, as the
+    volumes --standard and --paranoia create do: 64 bit blocks wear out
+    after a few GiB under one key, random access ciphers reuse their key
+    stream when a block is rewritten, and sealing ciphers need block headers
+    of their own.  The key is the smallest one allowed
+    of at least profile.minKeySize bits.  If dir isn't empty, the backing
+    file system is measured too, as block sizes which suit the ciphers may
+    not suit it.  A larger block size is only chosen if it is at least 10%
+    faster, as reads and writes smaller than a block cost a whole one.
+    Returns false if no cipher qualifies.
+*/
+bool fastestConfig(const BenchProfile &profile, const std::string &dir,
+                   int durationMs, BenchChoice *choice);
+
+}  // namespace encfs
+
+#endif
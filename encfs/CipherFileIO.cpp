@@ -21,20 +21,28 @@
 #include "CipherFileIO.h"
 
 #include "easylogging++.h"
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
+#include <ctime>
 #include <fcntl.h>
 #include <memory>
 #include <openssl/sha.h>
 #include <sys/stat.h>
 #include <utility>
+#include <vector>
 
 #include "BlockFileIO.h"
 #include "Cipher.h"
 #include "CipherKey.h"
 #include "Error.h"
 #include "FileIO.h"
+#include "FileIVCache.h"
+#include "IVJournal.h"
+#include "MemoryPool.h"
+#include "Mutex.h"
+#include "Stats.h"
 
 namespace encfs {
 
@@ -47,24 +55,53 @@ namespace encfs {
 static Interface CipherFileIO_iface("FileIO/Cipher", 2, 0, 1);
 
 const int HEADER_SIZE = 8;  // 64 bit initialization vector..
+// space the header takes with alignedBlocks
+const int ALIGNED_HEADER_SIZE = 4096;
+// padding after the header with alignedBlocks
+const unsigned char HeaderPadding[ALIGNED_HEADER_SIZE - HEADER_SIZE] = {};
+// file IV bit of files with large blocks
+const uint64_t LARGE_BLOCK_IV = 1ULL << 63;
 
 CipherFileIO::CipherFileIO(std::shared_ptr<FileIO> _base,
                            const FSConfigPtr &cfg)
     : BlockFileIO(cfg->config->blockSize, cfg),
       base(std::move(_base)),
       haveHeader(cfg->config->uniqueIV),
+      headerSpace(!cfg->config->uniqueIV ? 0
+                  : cfg->config->alignedBlocks ? ALIGNED_HEADER_SIZE
+                                               : HEADER_SIZE),
       externalIV(0),
       fileIV(0),
-      lastFlags(0) {
+      lastFlags(0),
+      reverseIno(0),
+      reverseHeaderIV(0),
+      sourceIno(0),
+      sourceMtime(0),
+      sourceCtime(0),
+      sourceSize(0) {
   fsConfig = cfg;
   cipher = cfg->cipher;
   key = cfg->key;
+  rangeCoding = cipher->randomAccess();
+  sealed = cipher->sealedBlocks();
+  _randomAccess = rangeCoding && !_allowHoles && !fsConfig->reverseEncryption;
+  largeBlockSize = (haveHeader && !cfg->reverseEncryption)
+                       ? (unsigned int)cfg->config->largeBlockSize
+                       : 0;
 
   CHECK_EQ(fsConfig->config->blockSize % fsConfig->cipher->cipherBlockSize(), 0)
       << "FS block size must be multiple of cipher block size";
+  pthread_mutex_init(&headerMutex, nullptr);
+
+  // in reverse mode the plaintext may change behind our back, checkSource
+  // drops what was read ahead then
+  enableReadAhead(cfg);
 }
 
-CipherFileIO::~CipherFileIO() = default;
+CipherFileIO::~CipherFileIO() {
+  stopReadAhead();
+  pthread_mutex_destroy(&headerMutex);
+}
 
 Interface CipherFileIO::interface() const { return CipherFileIO_iface; }
 
@@ -73,11 +110,33 @@ int CipherFileIO::open(int flags) {
 
   if (res >= 0) {
     lastFlags = flags;
+    // the block size of a file with data is in its header
+    if (largeBlockSize != 0 && fileIV == 0 &&
+        base->getSize() >= HEADER_SIZE) {
+      int hdr = ensureHeader();
+      if (hdr < 0) {
+        return hdr;
+      }
+    }
   }
 
   return res;
 }
 
+/*
+    A new file gets no header here: an empty backing file has none, and the
+    first write stores it together with the first block (see
+    headerForWrite), so that a small file costs one write to the backing
+    storage rather than two.
+*/
+int CipherFileIO::create(mode_t mode) {
+  int res = base->create(mode);
+  if (res >= 0) {
+    lastFlags = O_RDWR;
+  }
+  return res;
+}
+
 void CipherFileIO::setFileName(const char *fileName) {
   base->setFileName(fileName);
 }
@@ -96,6 +155,11 @@ bool CipherFileIO::setIV(uint64_t iv) {
                     << ", " << externalIV;
     }
   } else if (haveHeader) {
+    IVJournal *journal = fsConfig->ivJournal.get();
+    if (journal != nullptr && journal->deferring() && deferIV(journal, iv)) {
+      return base->setIV(iv);
+    }
+
     // we have an old IV, and now a new IV, so we need to update the fileIV
     // on disk.
     // ensure the file is open for read/write..
@@ -122,11 +186,53 @@ bool CipherFileIO::setIV(uint64_t iv) {
       externalIV = oldIV;
       return false;
     }
+    if (journal != nullptr && !journal->empty()) {
+      forgetPendingIV(journal);
+    }
   }
 
   return base->setIV(iv);
 }
 
+/**
+ * Leave the header as it is and note in the journal which IV it is
+ * encrypted with.  Returns false if the journal can't take it, the header
+ * has to be rewritten now then.
+ */
+bool CipherFileIO::deferIV(IVJournal *journal, uint64_t iv) {
+  struct stat st;
+  if (base->getAttr(&st) < 0) {
+    return false;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    // no header
+    externalIV = iv;
+    return true;
+  }
+
+  Lock lock(journal->mutex());
+  if (st.st_size < HEADER_SIZE) {
+    // no header yet, initHeader will create it with the new IV
+    journal->remove(st);
+  } else {
+    uint64_t headerIV = externalIV;
+    journal->find(st, &headerIV);
+    if (!journal->record(st, headerIV, iv, getFileName())) {
+      return false;
+    }
+  }
+  externalIV = iv;
+  return true;
+}
+
+void CipherFileIO::forgetPendingIV(IVJournal *journal) {
+  struct stat st;
+  if (base->getAttr(&st) == 0) {
+    Lock lock(journal->mutex());
+    journal->remove(st);
+  }
+}
+
 /**
  * Get file attributes (FUSE-speak for "stat()") for an upper file
  * Upper file   = file we present to the user via FUSE
@@ -138,18 +244,8 @@ int CipherFileIO::getAttr(struct stat *stbuf) const {
   int res = base->getAttr(stbuf);
 
   // adjust size if we have a file header
-  if ((res == 0) && haveHeader && S_ISREG(stbuf->st_mode) &&
-      (stbuf->st_size > 0)) {
-    if (!fsConfig->reverseEncryption) {
-      /* In normal mode, the upper file (plaintext) is smaller
-       * than the backing ciphertext file */
-      rAssert(stbuf->st_size >= HEADER_SIZE);
-      stbuf->st_size -= HEADER_SIZE;
-    } else {
-      /* In reverse mode, the upper file (ciphertext) is larger than
-       * the backing plaintext file */
-      stbuf->st_size += HEADER_SIZE;
-    }
+  if ((res == 0) && S_ISREG(stbuf->st_mode)) {
+    stbuf->st_size = upperSize(fsConfig, stbuf->st_size);
   }
 
   return res;
@@ -160,73 +256,100 @@ int CipherFileIO::getAttr(struct stat *stbuf) const {
  * See getAttr() for an explaination of the reverse handling
  */
 off_t CipherFileIO::getSize() const {
-  off_t size = base->getSize();
   // No check on S_ISREG here -- don't call getSize over getAttr unless this
   // is a normal file!
-  if (haveHeader && size > 0) {
-    if (!fsConfig->reverseEncryption) {
-      rAssert(size >= HEADER_SIZE);
-      size -= HEADER_SIZE;
-    } else {
-      size += HEADER_SIZE;
-    }
+  return upperSize(fsConfig, base->getSize());
+}
+
+off_t CipherFileIO::upperSize(const FSConfigPtr &cfg, off_t size) {
+  if (!cfg->config->uniqueIV || size <= 0) {
+    return size;
+  }
+  if (cfg->reverseEncryption) {
+    /* In reverse mode, the upper file (ciphertext) is larger than
+     * the backing plaintext file */
+    return size + HEADER_SIZE;
   }
-  return size;
+  /* In normal mode, the upper file (plaintext) is smaller
+   * than the backing ciphertext file */
+  rAssert(size >= HEADER_SIZE);
+  // a header with no data yet isn't padded
+  off_t space = cfg->config->alignedBlocks ? ALIGNED_HEADER_SIZE : HEADER_SIZE;
+  return std::max(size - space, (off_t)0);
 }
 
 int CipherFileIO::initHeader() {
   // check if the file has a header, and read it if it does..  Otherwise,
   // create one.
-  off_t rawSize = base->getSize();
+  FileIVCache *ivCache = fsConfig->fileIVCache.get();
+  struct stat cst;
+  off_t rawSize;
+  if (ivCache != nullptr) {
+    // the same lstat gives the size and what the cache is checked against
+    int res = base->getAttr(&cst);
+    if (res < 0) {
+      return res;
+    }
+    rawSize = cst.st_size;
+  } else {
+    rawSize = base->getSize();
+  }
   if (rawSize >= HEADER_SIZE) {
     VLOG(1) << "reading existing header, rawSize = " << rawSize;
     // has a header.. read it
-    unsigned char buf[8] = {0};
-
-    IORequest req;
-    req.offset = 0;
-    req.data = buf;
-    req.dataLen = 8;
-    ssize_t readSize = base->read(req);
-    if (readSize < 0) {
-      return readSize;
+    IVJournal *journal = fsConfig->ivJournal.get();
+    if (journal == nullptr || journal->empty()) {
+      uint64_t iv = 0;
+      if (ivCache != nullptr && ivCache->get(cst, &iv)) {
+        fileIV = iv;
+        adoptBlockSize();
+        VLOG(1) << "cached header, fileIV = " << fileIV;
+        return 0;
+      }
+      int res = readHeader(externalIV);
+      if (res == 0 && ivCache != nullptr) {
+        ivCache->put(cst, fileIV);
+      }
+      return res;
     }
 
-    if (!cipher->streamDecode(buf, sizeof(buf), externalIV, key)) {
-      return -EBADMSG;
+    // the header may still be encrypted with an IV from before a rename
+    struct stat st;
+    int res = 0;
+    if (ivCache != nullptr) {
+      st = cst;
+    } else {
+      res = base->getAttr(&st);
     }
-
-    fileIV = 0;
-    for (int i = 0; i < 8; ++i) {
-      fileIV = (fileIV << 8) | (uint64_t)buf[i];
+    if (res < 0) {
+      return res;
+    }
+    Lock lock(journal->mutex());
+    uint64_t headerIV = externalIV;
+    if (!journal->find(st, &headerIV)) {
+      return readHeader(externalIV);
+    }
+    res = readHeader(headerIV);
+    if (res < 0) {
+      return res;
+    }
+    if (base->isWritable()) {
+      VLOG(1) << "rewriting header left by a rename";
+      if (writeHeader()) {
+        journal->remove(st);
+      }
     }
-
-    rAssert(fileIV != 0);  // 0 is never used..
   } else {
     VLOG(1) << "creating new file IV header";
 
     unsigned char buf[8] = {0};
-    do {
-      if (!cipher->randomize(buf, 8, false)) {
-        RLOG(ERROR) << "Unable to generate a random file IV";
-        return -EBADMSG;
-      }
-
-      fileIV = 0;
-      for (int i = 0; i < 8; ++i) {
-        fileIV = (fileIV << 8) | (uint64_t)buf[i];
-      }
-
-      if (fileIV == 0) {
-        RLOG(WARNING) << "Unexpected result: randomize returned 8 null bytes!";
-      }
-    } while (fileIV == 0);  // don't accept 0 as an option..
+    uint64_t iv = 0;
+    int res = newHeader(&iv, buf);
+    if (res < 0) {
+      return res;
+    }
 
     if (base->isWritable()) {
-      if (!cipher->streamEncode(buf, sizeof(buf), externalIV, key)) {
-        return -EBADMSG;
-      }
-
       IORequest req;
       req.offset = 0;
       req.data = buf;
@@ -236,14 +359,324 @@ int CipherFileIO::initHeader() {
       if (writeSize < 0) {
         return writeSize;
       }
+      Stats::add(Stats::HeaderWrites);
+      IVJournal *journal = fsConfig->ivJournal.get();
+      if (journal != nullptr && !journal->empty()) {
+        forgetPendingIV(journal);
+      }
     } else {
       VLOG(1) << "base not writable, IV not written..";
     }
+    // only publish the IV once it is on disk, so that concurrent readers
+    // never use an IV which doesn't match the header
+    fileIV = iv;
+    adoptBlockSize();
   }
   VLOG(1) << "initHeader finished, fileIV = " << fileIV;
   return 0;
 }
 
+// pick a new random fileIV, and code it into the header bytes in buf
+int CipherFileIO::newHeader(uint64_t *newIV, unsigned char *buf) const {
+  uint64_t iv = 0;
+  do {
+    if (!cipher->randomize(buf, HEADER_SIZE, false)) {
+      RLOG(ERROR) << "Unable to generate a random file IV";
+      return -EBADMSG;
+    }
+    if (largeBlockSize != 0) {
+      buf[0] &= 0x7f;  // small blocks, see sizeHint
+    }
+
+    for (int i = 0; i < HEADER_SIZE; ++i) {
+      iv = (iv << 8) | (uint64_t)buf[i];
+    }
+
+    if (iv == 0) {
+      RLOG(WARNING) << "Unexpected result: randomize returned 8 null bytes!";
+    }
+  } while (iv == 0);  // don't accept 0 as an option..
+
+  if (!cipher->streamEncode(buf, HEADER_SIZE, externalIV, key)) {
+    return -EBADMSG;
+  }
+  *newIV = iv;
+  return 0;
+}
+
+// read fileIV from an existing header encrypted with headerIV
+int CipherFileIO::readHeader(uint64_t headerIV) {
+  unsigned char buf[8] = {0};
+
+  IORequest req;
+  req.offset = 0;
+  req.data = buf;
+  req.dataLen = 8;
+  ssize_t readSize = base->read(req);
+  if (readSize < 0) {
+    return readSize;
+  }
+  Stats::add(Stats::HeaderReads);
+  return decodeHeader(buf, headerIV);
+}
+
+// take fileIV from the HEADER_SIZE bytes of a header encrypted with headerIV
+int CipherFileIO::decodeHeader(unsigned char *buf, uint64_t headerIV) {
+  if (!cipher->streamDecode(buf, HEADER_SIZE, headerIV, key)) {
+    return -EBADMSG;
+  }
+
+  uint64_t iv = 0;
+  for (int i = 0; i < 8; ++i) {
+    iv = (iv << 8) | (uint64_t)buf[i];
+  }
+
+  rAssert(iv != 0);  // 0 is never used..
+  fileIV = iv;
+  adoptBlockSize();
+  VLOG(1) << "read header, fileIV = " << fileIV;
+  return 0;
+}
+
+/**
+ * Whether a read at offset fetches the header along with the data (see
+ * readWithHeader): the first read of a file from its start, where the
+ * header needs nothing but its bytes to be decoded.  With a FileIVCache the
+ * header is looked up by the attributes of the file instead.
+ */
+bool CipherFileIO::readsHeader(off_t offset) const {
+  if (!haveHeader || fileIV != 0 || offset != 0 || largeBlockSize != 0 ||
+      fsConfig->reverseEncryption || fsConfig->fileIVCache) {
+    return false;
+  }
+  IVJournal *journal = fsConfig->ivJournal.get();
+  return journal == nullptr || journal->empty();
+}
+
+/**
+ * Read the header and the blocks of req from the backing file at once,
+ * rather than the blocks first and the header by itself when they are
+ * decoded (see ensureHeader), and set fileIV from the header.  Returns what
+ * a read of the blocks alone would have, still encoded.
+ */
+ssize_t CipherFileIO::readWithHeader(const IORequest &req) const {
+  MemBlock mb = MemoryPool::allocate(headerSpace + req.dataLen);
+  IORequest tmpReq;
+  tmpReq.offset = 0;
+  tmpReq.data = mb.data;
+  tmpReq.dataLen = headerSpace + req.dataLen;
+  ssize_t readSize = base->read(tmpReq);
+
+  if (readSize >= HEADER_SIZE) {
+    Stats::add(Stats::HeaderReads);
+    Lock lock(headerMutex);
+    if (fileIV == 0) {
+      int res = const_cast<CipherFileIO *>(this)->decodeHeader(mb.data,
+                                                               externalIV);
+      if (res < 0) {
+        readSize = res;
+      }
+    }
+  }
+  if (readSize > headerSpace) {
+    readSize -= headerSpace;
+    memcpy(req.data, mb.data + headerSpace, readSize);
+  } else if (readSize > 0) {
+    readSize = 0;
+  }
+  MemoryPool::release(mb);
+  return readSize;
+}
+
+/**
+ * Make sure fileIV is known before a block is coded.  Blocks of one file
+ * may be coded from several threads at once, so the header is read (or
+ * created) only by the first one to get here.
+ */
+int CipherFileIO::ensureHeader() const {
+  if (!haveHeader || fileIV != 0) {
+    return 0;
+  }
+  Lock lock(headerMutex);
+  if (fileIV != 0) {
+    return 0;
+  }
+  return const_cast<CipherFileIO *>(this)->initHeader();
+}
+
+/**
+ * Make sure fileIV is known before the block at offset is written.  An
+ * empty file has no header yet: if the block is its first one, the header
+ * is left to the caller, to be written together with the block by
+ * writeWithHeader.  header then gets its bytes and 1 is returned, else 0,
+ * or -errno.  The IV is in use from here on, which is fine as no data can
+ * be read before the write, and the caller holds the whole file while it
+ * grows.
+ */
+int CipherFileIO::headerForWrite(off_t offset, unsigned char *header) {
+  if (!haveHeader || fileIV != 0) {
+    return 0;
+  }
+  if (offset != 0) {
+    return ensureHeader();
+  }
+  Lock lock(headerMutex);
+  if (fileIV != 0) {
+    return 0;
+  }
+  if (!base->isWritable() || base->getSize() >= HEADER_SIZE) {
+    return initHeader();
+  }
+  uint64_t iv = 0;
+  int res = newHeader(&iv, header);
+  if (res < 0) {
+    return res;
+  }
+  fileIV = iv;
+  return 1;
+}
+
+// called with the outcome of the write which was to store a new header
+void CipherFileIO::headerWritten(bool ok) {
+  if (ok) {
+    Stats::add(Stats::HeaderWrites);
+    IVJournal *journal = fsConfig->ivJournal.get();
+    if (journal != nullptr && !journal->empty()) {
+      forgetPendingIV(journal);
+    }
+  } else {
+    Lock lock(headerMutex);
+    fileIV = 0;
+  }
+}
+
+/**
+ * Write the header and the len bytes of the first blocks, already coded, to
+ * the backing file in one gather write, without copying them together.
+ * Returns -errno on failure.
+ */
+ssize_t CipherFileIO::storeWithHeader(const unsigned char *header,
+                                      const unsigned char *data, size_t len) {
+  struct iovec iov[3];
+  int count = 0;
+  iov[count].iov_base = const_cast<unsigned char *>(header);
+  iov[count++].iov_len = HEADER_SIZE;
+  if (headerSpace > HEADER_SIZE) {
+    iov[count].iov_base = const_cast<unsigned char *>(HeaderPadding);
+    iov[count++].iov_len = headerSpace - HEADER_SIZE;
+  }
+  iov[count].iov_base = const_cast<unsigned char *>(data);
+  iov[count++].iov_len = len;
+  return base->writeGather(0, iov, count);
+}
+
+/**
+ * storeWithHeader for a header from headerForWrite.  Returns len, or
+ * -errno.
+ */
+ssize_t CipherFileIO::writeWithHeader(const unsigned char *header,
+                                      const unsigned char *data, size_t len) {
+  ssize_t res = storeWithHeader(header, data, len);
+  headerWritten(res >= 0);
+  return res < 0 ? res : (ssize_t)len;
+}
+
+void CipherFileIO::adoptBlockSize() {
+  if (largeBlockSize != 0) {
+    setBlockSize((fileIV & LARGE_BLOCK_IV) != 0 ? largeBlockSize
+                                                : fsConfig->config->blockSize);
+  }
+}
+
+/**
+ * A file which has no data yet takes large blocks if it is about to be
+ * size bytes long, with a new IV which says so.  The caller holds the whole
+ * file, as for any change of its size.
+ */
+void CipherFileIO::sizeHint(off_t size) {
+  if (largeBlockSize == 0 || size < (off_t)largeBlockSize ||
+      blockSize() == largeBlockSize || getSize() != 0 ||
+      !base->isWritable()) {
+    return;
+  }
+  unsigned char buf[8];
+  if (!cipher->randomize(buf, sizeof(buf), false)) {
+    return;  // the file keeps small blocks
+  }
+  uint64_t iv = 0;
+  for (unsigned char c : buf) {
+    iv = (iv << 8) | c;
+  }
+
+  Lock lock(headerMutex);
+  uint64_t oldIV = fileIV;
+  fileIV = iv | LARGE_BLOCK_IV;
+  if (!writeHeader()) {
+    fileIV = oldIV;
+    return;
+  }
+  IVJournal *journal = fsConfig->ivJournal.get();
+  if (journal != nullptr && !journal->empty()) {
+    forgetPendingIV(journal);
+  }
+  VLOG(1) << "large blocks for " << getFileName();
+  adoptBlockSize();
+}
+
+ssize_t CipherFileIO::write(const IORequest &req) {
+  sizeHint(req.offset + (off_t)req.dataLen);
+  return BlockFileIO::write(req);
+}
+
+ssize_t CipherFileIO::writeInPlace(const IORequest &req) {
+  sizeHint(req.offset + (off_t)req.dataLen);
+  return BlockFileIO::writeInPlace(req);
+}
+
+int CipherFileIO::allocate(off_t offset, off_t length) {
+  sizeHint(offset + length);
+  return BlockFileIO::allocate(offset, length);
+}
+
+/*
+    Holes of the lower file past the header, rounded to whole blocks.  Only
+    volumes which allow holes read them back as zero blocks, and a file
+    which may take large blocks only knows its block size once the header
+    was read.
+*/
+off_t CipherFileIO::nextData(off_t offset) const {
+  if (!_allowHoles || fsConfig->reverseEncryption ||
+      (largeBlockSize != 0 && fileIV == 0)) {
+    return offset;
+  }
+  off_t bs = blockSize();
+  off_t start = offset - offset % bs;
+  off_t data = base->nextData(start + headerSpace);
+  if (data <= start + headerSpace) {
+    return data < 0 ? data : offset;
+  }
+  off_t size = getSize();
+  if (size < 0) {
+    return size;
+  }
+  // the block the data starts in is read as usual
+  off_t next = (data - headerSpace) / bs * bs;
+  return std::max(offset, std::min(next, size));
+}
+
+off_t CipherFileIO::nextHole(off_t offset) const {
+  off_t size = getSize();
+  if (size < 0) {
+    return size;
+  }
+  if (!_allowHoles || fsConfig->reverseEncryption ||
+      (largeBlockSize != 0 && fileIV == 0)) {
+    return std::max(offset, size);
+  }
+  off_t bs = blockSize();
+  return nextHoleBlock(base.get(), offset, size, bs, bs, headerSpace);
+}
+
 bool CipherFileIO::writeHeader() {
   if (fileIV == 0) {
     RLOG(ERROR) << "Internal error: fileIV == 0 in writeHeader!!!";
@@ -251,9 +684,10 @@ bool CipherFileIO::writeHeader() {
   VLOG(1) << "writing fileIV " << fileIV;
 
   unsigned char buf[8] = {0};
+  uint64_t iv = fileIV;
   for (int i = 0; i < 8; ++i) {
-    buf[sizeof(buf) - 1 - i] = (unsigned char)(fileIV & 0xff);
-    fileIV >>= 8;
+    buf[sizeof(buf) - 1 - i] = (unsigned char)(iv & 0xff);
+    iv >>= 8;
   }
 
   if (!cipher->streamEncode(buf, sizeof(buf), externalIV, key)) {
@@ -265,7 +699,11 @@ bool CipherFileIO::writeHeader() {
   req.data = buf;
   req.dataLen = 8;
 
-  return (base->write(req) >= 0);
+  if (base->write(req) < 0) {
+    return false;
+  }
+  Stats::add(Stats::HeaderWrites);
+  return true;
 }
 
 /**
@@ -288,7 +726,15 @@ int CipherFileIO::generateReverseHeader(unsigned char *headerBuf) {
   ino_t ino = stbuf.st_ino;
   rAssert(ino != 0);
 
+  // the header only changes with the inode, or the IV of a rename
+  Lock lock(headerMutex);
+  if (ino == reverseIno && externalIV == reverseHeaderIV) {
+    memcpy(headerBuf, reverseHeader, HEADER_SIZE);
+    return 0;
+  }
+
   VLOG(1) << "generating reverse file IV header from ino=" << ino;
+  reverseIno = ino;
 
   // Serialize the inode number into inoBuf
   unsigned char inoBuf[sizeof(ino_t)];
@@ -306,17 +752,23 @@ int CipherFileIO::generateReverseHeader(unsigned char *headerBuf) {
   memcpy(headerBuf, md, HEADER_SIZE);
 
   // Save the IV in fileIV for internal use
-  fileIV = 0;
+  uint64_t iv = 0;
   for (int i = 0; i < HEADER_SIZE; ++i) {
-    fileIV = (fileIV << 8) | (uint64_t)headerBuf[i];
+    iv = (iv << 8) | (uint64_t)headerBuf[i];
   }
+  fileIV = iv;
 
   VLOG(1) << "fileIV=" << fileIV;
 
   // Encrypt externally-visible header
-  if (!cipher->streamEncode(headerBuf, HEADER_SIZE, externalIV, key)) {
+  uint64_t headerIV = externalIV;
+  if (!cipher->streamEncode(headerBuf, HEADER_SIZE, headerIV, key)) {
+    reverseIno = 0;
     return -EBADMSG;
   }
+  rAssert(HEADER_SIZE == sizeof(reverseHeader));
+  memcpy(reverseHeader, headerBuf, HEADER_SIZE);
+  reverseHeaderIV = headerIV;
   return 0;
 }
 
@@ -333,17 +785,16 @@ ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
 
   // adjust offset if we have a file header
   if (haveHeader && !fsConfig->reverseEncryption) {
-    tmpReq.offset += HEADER_SIZE;
+    tmpReq.offset += headerSpace;
   }
-  ssize_t readSize = base->read(tmpReq);
+  ssize_t readSize =
+      readsHeader(req.offset) ? readWithHeader(req) : base->read(tmpReq);
 
   bool ok;
   if (readSize > 0) {
-    if (haveHeader && fileIV == 0) {
-      int res = const_cast<CipherFileIO *>(this)->initHeader();
-      if (res < 0) {
-        return res;
-      }
+    int res = ensureHeader();
+    if (res < 0) {
+      return res;
     }
 
     if (readSize != bs) {
@@ -361,6 +812,8 @@ ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
       VLOG(1) << "decodeBlock failed for block " << blockNum << ", size "
               << readSize;
       readSize = -EBADMSG;
+    } else {
+      Stats::add(Stats::BytesDecoded, readSize);
     }
   } else if (readSize == 0) {
     VLOG(1) << "readSize zero for offset " << req.offset;
@@ -369,6 +822,193 @@ ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
   return readSize;
 }
 
+/**
+ * Decode the readSize bytes read from the backing file into req, as the
+ * result of readBlocks.
+ */
+ssize_t CipherFileIO::decodeBlocks(const IORequest &req,
+                                   ssize_t readSize) const {
+  if (readSize <= 0) {
+    return readSize;
+  }
+
+  int res = ensureHeader();
+  if (res < 0) {
+    return res;
+  }
+
+  // full blocks are decoded on the worker threads, like in writeBlocks
+  int bs = blockSize();
+  off_t blockNum = req.offset / bs;
+  uint64_t iv = fileIV;
+  auto decode = [&](size_t first, size_t n) {
+    for (size_t i = first; i < first + n; ++i) {
+      if (!blockRead(req.data + i * bs, bs, (blockNum + i) ^ iv)) {
+        VLOG(1) << "decodeBlock failed for block " << blockNum + i
+                << ", size " << bs;
+        return false;
+      }
+    }
+    return true;
+  };
+
+  size_t fullBlocks = readSize / bs;
+  if (!forBlocks(fullBlocks, decode)) {
+    return -EBADMSG;
+  }
+
+  int tail = readSize % bs;
+  if (tail != 0) {
+    off_t tailBlock = blockNum + fullBlocks;
+    if (!streamRead(req.data + fullBlocks * bs, tail, tailBlock ^ iv)) {
+      VLOG(1) << "decodeBlock failed for block " << tailBlock << ", size "
+              << tail;
+      return -EBADMSG;
+    }
+  }
+
+  Stats::add(Stats::BytesDecoded, readSize);
+  return readSize;
+}
+
+/**
+ * Read a run of blocks from the backing file, then decode them in place.
+ * Large runs are read in parts, and each part is decoded while the next one
+ * is read.  Reverse mode keeps going through readOneBlock.
+ */
+ssize_t CipherFileIO::readBlocks(const IORequest &req) const {
+  if (fsConfig->reverseEncryption) {
+    return BlockFileIO::readBlocks(req);
+  }
+
+  int bs = blockSize();
+  size_t count = req.dataLen / bs;
+  auto part = [&](size_t first, size_t n) {
+    IORequest partReq;
+    partReq.offset = req.offset + first * bs;
+    partReq.data = req.data + first * bs;
+    partReq.dataLen = n * bs;
+    return partReq;
+  };
+
+  // what the read of the part starting at each block got
+  std::vector<ssize_t> got(count);
+  auto fetch = [&](size_t first, size_t n) {
+    IORequest tmpReq = part(first, n);
+    if (readsHeader(tmpReq.offset)) {
+      got[first] = readWithHeader(tmpReq);
+      return true;
+    }
+    if (haveHeader) {
+      tmpReq.offset += headerSpace;
+    }
+    got[first] = base->read(tmpReq);
+    return true;
+  };
+
+  ssize_t result = 0;
+  auto decodePart = [&](size_t first, size_t n) {
+    ssize_t res = decodeBlocks(part(first, n), got[first]);
+    if (res <= 0) {
+      if (res < 0) {
+        result = res;
+      }
+      return false;
+    }
+    result += res;
+    return (size_t)res == n * bs;  // the end of the file
+  };
+
+  pipeline(count, fetch, decodePart);
+  return result;
+}
+
+/**
+ * readBlocks() in one piece, decoded on the thread which gets the data.
+ */
+void CipherFileIO::readBlocksAsync(const IORequest &req, IODone done) const {
+  if (fsConfig->reverseEncryption) {
+    BlockFileIO::readBlocksAsync(req, std::move(done));
+    return;
+  }
+
+  if (readsHeader(req.offset)) {
+    done(decodeBlocks(req, readWithHeader(req)));
+    return;
+  }
+  IORequest tmpReq = req;
+  if (haveHeader) {
+    tmpReq.offset += headerSpace;
+  }
+  base->readAsync(tmpReq, [this, req, done](ssize_t readSize) {
+    done(decodeBlocks(req, readSize));
+  });
+}
+
+/**
+ * Read and decode part of a block, which a random access cipher codes on its
+ * own.
+ */
+ssize_t CipherFileIO::readPartial(const IORequest &req) const {
+  int bs = blockSize();
+  off_t blockNum = req.offset / bs;
+
+  IORequest tmpReq = req;
+  if (haveHeader) {
+    tmpReq.offset += headerSpace;
+  }
+  ssize_t readSize =
+      readsHeader(req.offset) ? readWithHeader(req) : base->read(tmpReq);
+  if (readSize <= 0) {
+    return readSize;
+  }
+
+  int res = ensureHeader();
+  if (res < 0) {
+    return res;
+  }
+
+  if (!cipher->rangeDecode(req.data, (int)readSize, blockNum ^ fileIV,
+                           (int)(req.offset % bs), key)) {
+    VLOG(1) << "rangeDecode failed at offset " << req.offset << ", size "
+            << readSize;
+    return -EBADMSG;
+  }
+  Stats::add(Stats::BytesDecoded, readSize);
+  return readSize;
+}
+
+ssize_t CipherFileIO::writePartial(const IORequest &req) {
+  int bs = blockSize();
+  off_t blockNum = req.offset / bs;
+
+  unsigned char header[HEADER_SIZE];
+  int hdr = headerForWrite(req.offset, header);
+  if (hdr < 0) {
+    return hdr;
+  }
+
+  if (!cipher->rangeEncode(req.data, (int)req.dataLen, blockNum ^ fileIV,
+                           (int)(req.offset % bs), key)) {
+    VLOG(1) << "rangeEncode failed at offset " << req.offset << ", size "
+            << req.dataLen;
+    if (hdr == 1) {
+      headerWritten(false);
+    }
+    return -EBADMSG;
+  }
+  Stats::add(Stats::BytesEncoded, req.dataLen);
+  if (hdr == 1) {
+    return writeWithHeader(header, req.data, req.dataLen);
+  }
+
+  IORequest tmpReq = req;
+  if (haveHeader) {
+    tmpReq.offset += headerSpace;
+  }
+  return base->write(tmpReq);
+}
+
 ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
 
   if (haveHeader && fsConfig->reverseEncryption) {
@@ -380,11 +1020,10 @@ ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
   unsigned int bs = blockSize();
   off_t blockNum = req.offset / bs;
 
-  if (haveHeader && fileIV == 0) {
-    int res = initHeader();
-    if (res < 0) {
-      return res;
-    }
+  unsigned char header[HEADER_SIZE];
+  int hdr = headerForWrite(req.offset, header);
+  if (hdr < 0) {
+    return hdr;
   }
 
   bool ok;
@@ -399,10 +1038,12 @@ ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
   }
 
   ssize_t res = 0;
-  if (ok) {
+  if (ok && hdr == 1) {
+    res = writeWithHeader(header, req.data, req.dataLen);
+  } else if (ok) {
     if (haveHeader) {
       IORequest tmpReq = req;
-      tmpReq.offset += HEADER_SIZE;
+      tmpReq.offset += headerSpace;
       res = base->write(tmpReq);
     } else {
       res = base->write(req);
@@ -410,56 +1051,247 @@ ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
   } else {
     VLOG(1) << "encodeBlock failed for block " << blockNum << ", size "
             << req.dataLen;
+    if (hdr == 1) {
+      headerWritten(false);
+    }
     res = -EBADMSG;
   }
   return res;
 }
 
+int CipherFileIO::punchBlocks(off_t offset, size_t count) {
+  if (fsConfig->reverseEncryption) {
+    return -EOPNOTSUPP;
+  }
+
+  // the header has to exist before the data, as for any other write
+  int hdr = ensureHeader();
+  if (hdr < 0) {
+    return hdr;
+  }
+
+  return base->punchHole(offset + headerSpace, (off_t)count * blockSize());
+}
+
+int CipherFileIO::allocateBlocks(off_t offset, size_t count) {
+  if (fsConfig->reverseEncryption) {
+    return -EOPNOTSUPP;
+  }
+
+  // the zeros allocated mustn't be taken for the header of an empty file
+  int hdr = ensureHeader();
+  if (hdr < 0) {
+    return hdr;
+  }
+
+  // the first block brings the space of the header with it
+  off_t start = offset == 0 ? 0 : offset + headerSpace;
+  return base->allocate(start, offset + headerSpace +
+                                   (off_t)count * blockSize() - start);
+}
+
+/**
+ * Encode a run of full blocks into a staging buffer and write them to the
+ * backing file.  Large runs are written in parts, each one while the next
+ * is encoded.
+ */
+ssize_t CipherFileIO::writeBlocks(const IORequest &req, bool inPlace) {
+  if (haveHeader && fsConfig->reverseEncryption) {
+    VLOG(1)
+        << "writing to a reverse mount with per-file IVs is not implemented";
+    return -EPERM;
+  }
+
+  unsigned char header[HEADER_SIZE];
+  int hdr = headerForWrite(req.offset, header);
+  if (hdr < 0) {
+    return hdr;
+  }
+
+  int bs = blockSize();
+  off_t blockNum = req.offset / bs;
+
+  // encode in a staging buffer, unless the caller lets us clobber its data
+  MemBlock mb;
+  unsigned char *buf = req.data;
+  if (!inPlace) {
+    mb = MemoryPool::allocate(req.dataLen);
+    buf = mb.data;
+    memcpy(buf, req.data, req.dataLen);
+  }
+
+  // every block is encoded with its own IV, so large writes are spread over
+  // the worker threads
+  uint64_t iv = fileIV;
+  auto encode = [&](size_t first, size_t n) {
+    return blockWriteMany(buf + first * bs, bs, blockNum + first, n, iv);
+  };
+
+  // the stages run on different threads, each keeps its own result
+  bool encoded = true;
+  ssize_t written = 0;
+  auto encodePart = [&](size_t first, size_t n) {
+    encoded = forBlocks(n, [&](size_t from, size_t len) {
+      return encode(first + from, len);
+    });
+    return encoded;
+  };
+  auto store = [&](size_t first, size_t n) {
+    // a new header goes out with the first blocks
+    if (first == 0 && hdr == 1) {
+      written = storeWithHeader(header, buf, n * bs);
+      return written >= 0;
+    }
+    IORequest tmpReq;
+    tmpReq.offset = req.offset + first * bs;
+    if (haveHeader) {
+      tmpReq.offset += headerSpace;
+    }
+    tmpReq.data = buf + first * bs;
+    tmpReq.dataLen = n * bs;
+    written = base->write(tmpReq);
+    return written >= 0;
+  };
+  pipeline(req.dataLen / bs, encodePart, store);
+
+  ssize_t res = req.dataLen;
+  if (written < 0) {
+    res = written;
+  } else if (!encoded) {
+    res = -EBADMSG;
+  }
+  if (hdr == 1) {
+    headerWritten(res >= 0);
+  }
+
+  if (mb.data != nullptr) {
+    MemoryPool::release(mb);
+  }
+  return res;
+}
+
 bool CipherFileIO::blockWrite(unsigned char *buf, int size,
                               uint64_t _iv64) const {
   VLOG(1) << "Called blockWrite";
-  if (!fsConfig->reverseEncryption) {
-    return cipher->blockEncode(buf, size, _iv64, key);
+  bool ok;
+  // the counter mode is its own inverse, so reverse mode codes the same way
+  if (rangeCoding) {
+    ok = cipher->rangeEncode(buf, size, _iv64, 0, key);
+  } else if (sealed) {
+    ok = cipher->sealEncode(buf, size, _iv64, key);
+  } else if (!fsConfig->reverseEncryption) {
+    ok = cipher->blockEncode(buf, size, _iv64, key);
+  } else {
+    ok = cipher->blockDecode(buf, size, _iv64, key);
   }
-  return cipher->blockDecode(buf, size, _iv64, key);
+  if (ok) {
+    Stats::add(Stats::BytesEncoded, size);
+  }
+  return ok;
+}
+
+// count whole blocks from blockNum on, of a file with the IV iv, which the
+// cipher may encode several at a time (see Cipher::blockEncodeMany)
+bool CipherFileIO::blockWriteMany(unsigned char *buf, int size,
+                                  off_t blockNum, size_t count,
+                                  uint64_t iv) const {
+  if (rangeCoding || sealed || fsConfig->reverseEncryption) {
+    for (size_t i = 0; i < count; ++i) {
+      if (!blockWrite(buf + i * size, size, (blockNum + i) ^ iv)) {
+        VLOG(1) << "encodeBlock failed for block " << blockNum + i
+                << ", size " << size;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const size_t Chunk = 16;
+  uint64_t ivs[Chunk];
+  for (size_t first = 0; first < count; first += Chunk) {
+    size_t n = std::min(count - first, Chunk);
+    for (size_t i = 0; i < n; ++i) {
+      ivs[i] = (blockNum + first + i) ^ iv;
+    }
+    if (!cipher->blockEncodeMany(buf + first * size, size, ivs, (int)n,
+                                 key)) {
+      VLOG(1) << "encodeBlock failed for blocks " << blockNum + first
+              << " to " << blockNum + first + n - 1 << ", size " << size;
+      return false;
+    }
+    Stats::add(Stats::BytesEncoded, n * size);
+  }
+  return true;
 }
 
 bool CipherFileIO::streamWrite(unsigned char *buf, int size,
                                uint64_t _iv64) const {
   VLOG(1) << "Called streamWrite";
-  if (!fsConfig->reverseEncryption) {
-    return cipher->streamEncode(buf, size, _iv64, key);
+  bool ok;
+  if (rangeCoding) {
+    ok = cipher->rangeEncode(buf, size, _iv64, 0, key);
+  } else if (sealed) {
+    ok = cipher->sealEncode(buf, size, _iv64, key);
+  } else if (!fsConfig->reverseEncryption) {
+    ok = cipher->streamEncode(buf, size, _iv64, key);
+  } else {
+    ok = cipher->streamDecode(buf, size, _iv64, key);
   }
-  return cipher->streamDecode(buf, size, _iv64, key);
+  if (ok) {
+    Stats::add(Stats::BytesEncoded, size);
+  }
+  return ok;
 }
 
 bool CipherFileIO::blockRead(unsigned char *buf, int size,
                              uint64_t _iv64) const {
   if (fsConfig->reverseEncryption) {
+    if (rangeCoding) {
+      return cipher->rangeEncode(buf, size, _iv64, 0, key);
+    }
     return cipher->blockEncode(buf, size, _iv64, key);
   }
-  if (_allowHoles) {
+  if (_allowHoles && isZeroBlock(buf, size)) {
     // special case - leave all 0's alone
-    for (int i = 0; i < size; ++i) {
-      if (buf[i] != 0) {
-        return cipher->blockDecode(buf, size, _iv64, key);
-      }
-    }
-
     return true;
   }
+  if (rangeCoding) {
+    return cipher->rangeDecode(buf, size, _iv64, 0, key);
+  }
+  if (sealed) {
+    return openSealed(buf, size, _iv64);
+  }
   return cipher->blockDecode(buf, size, _iv64, key);
 }
 
 bool CipherFileIO::streamRead(unsigned char *buf, int size,
                               uint64_t _iv64) const {
+  if (rangeCoding) {
+    return cipher->rangeDecode(buf, size, _iv64, 0, key);
+  }
+  if (sealed) {
+    return openSealed(buf, size, _iv64);
+  }
   if (fsConfig->reverseEncryption) {
     return cipher->streamEncode(buf, size, _iv64, key);
   }
   return cipher->streamDecode(buf, size, _iv64, key);
 }
 
+// a sealed block whose tag doesn't match is an error, as a MAC failure is,
+// unless forced to decode
+bool CipherFileIO::openSealed(unsigned char *buf, int size,
+                              uint64_t _iv64) const {
+  if (cipher->sealDecode(buf, size, _iv64, key)) {
+    return true;
+  }
+  RLOG(WARNING) << "tag mismatch in sealed block, size " << size;
+  return fsConfig->opts->forceDecode;
+}
+
 int CipherFileIO::truncate(off_t size) {
+  // the lower file only reaches its new size after truncateBase
+  ChangeScope change(this);
   int res = 0;
   int reopen = 0;
   // well, we will truncate, so we need a write access to the file
@@ -473,9 +1305,12 @@ int CipherFileIO::truncate(off_t size) {
     }
     reopen = 1;
   }
-  if (!haveHeader) {
+  if (size == 0 && !fsConfig->reverseEncryption) {
+    res = truncateToZero();
+  } else if (!haveHeader) {
     res = BlockFileIO::truncateBase(size, base.get());
   } else {
+    sizeHint(size);
     if (0 == fileIV) {
       // empty file.. create the header..
       res = initHeader();
@@ -486,7 +1321,7 @@ int CipherFileIO::truncate(off_t size) {
       res = BlockFileIO::truncateBase(size, nullptr);
     }
     if (res == 0) {
-      res = base->truncate(size + HEADER_SIZE);
+      res = base->truncate(size + headerSpace);
     }
   }
   if (reopen == 1) {
@@ -498,11 +1333,81 @@ int CipherFileIO::truncate(off_t size) {
   return res;
 }
 
+/*
+    Truncating to 0, as open(O_TRUNC) does before a file is rewritten,
+    needs neither the file IV nor the old last block: the cached blocks are
+    dropped and the backing file is cut after its header.  A header which
+    exists is kept, as another node of the file (a hard link) may know its
+    IV.  Without one, none is made here -- the first write creates it.
+*/
+int CipherFileIO::truncateToZero() {
+  off_t keep = 0;
+  if (haveHeader) {
+    off_t rawSize = base->getSize();
+    if (rawSize < 0) {
+      return (int)rawSize;
+    }
+    if (rawSize >= HEADER_SIZE) {
+      keep = std::min(rawSize, headerSpace);
+    }
+  }
+  invalidateCache();
+  int res = base->truncate(keep);
+  if (res == 0 && keep == 0 && haveHeader) {
+    Lock lock(headerMutex);
+    fileIV = 0;
+    adoptBlockSize();
+  }
+  return res;
+}
+
+/**
+ * Reverse mode: drop the cached blocks if the plaintext file changed since
+ * they were read, going by its inode, mtime, ctime and size.  A file changed
+ * within the current second isn't cached at all, as another change in the
+ * same second wouldn't show.
+ * Returns 0, or -errno in case of failure.
+ */
+int CipherFileIO::checkSource() const {
+  struct stat stbuf;
+  int res = base->getAttr(&stbuf);
+  if (res < 0) {
+    return res;
+  }
+  time_t now = time(nullptr);
+  bool recent = stbuf.st_mtime >= now || stbuf.st_ctime >= now;
+
+  Lock lock(headerMutex);
+  if (!recent && sourceIno == stbuf.st_ino &&
+      sourceMtime == stbuf.st_mtime && sourceCtime == stbuf.st_ctime &&
+      sourceSize == stbuf.st_size) {
+    return 0;
+  }
+
+  if (sourceIno != 0 || recent) {
+    VLOG(1) << "plaintext changed, dropping cached blocks of "
+            << getFileName();
+    invalidateCache();
+  }
+  sourceIno = recent ? 0 : stbuf.st_ino;
+  sourceMtime = stbuf.st_mtime;
+  sourceCtime = stbuf.st_ctime;
+  sourceSize = stbuf.st_size;
+  return 0;
+}
+
 /**
  * Handle reads for reverse mode with uniqueIV
  */
 ssize_t CipherFileIO::read(const IORequest &origReq) const {
 
+  if (fsConfig->reverseEncryption) {
+    int res = checkSource();
+    if (res < 0) {
+      return res;
+    }
+  }
+
   /* if reverse mode is not active with uniqueIV,
    * the read request is handled by the base class */
   if (!(fsConfig->reverseEncryption && haveHeader)) {
@@ -515,11 +1420,16 @@ ssize_t CipherFileIO::read(const IORequest &origReq) const {
           << ", dataLen=" << origReq.dataLen;
 
   // generate the file IV header
-  // this is needed in any case - without IV the file cannot be decoded
+  // this is needed in any case - without IV the file cannot be decoded.
+  // Reads past the header use the fileIV of the first one, later ones
+  // check the inode again.
   unsigned char headerBuf[HEADER_SIZE];
-  int res = const_cast<CipherFileIO *>(this)->generateReverseHeader(headerBuf);
-  if (res < 0) {
-    return res;
+  if (fileIV == 0 || origReq.offset < HEADER_SIZE) {
+    int res =
+        const_cast<CipherFileIO *>(this)->generateReverseHeader(headerBuf);
+    if (res < 0) {
+      return res;
+    }
   }
 
   // Copy the request so we can modify it without affecting the caller
@@ -573,4 +1483,19 @@ ssize_t CipherFileIO::read(const IORequest &origReq) const {
 
 bool CipherFileIO::isWritable() const { return base->isWritable(); }
 
+void CipherFileIO::invalidate() {
+  invalidateCache();
+  base->invalidate();
+}
+
+void CipherFileIO::releaseBuffers() {
+  BlockFileIO::releaseBuffers();
+  base->releaseBuffers();
+}
+
+void CipherFileIO::setReadAhead(int kib) {
+  BlockFileIO::setReadAhead(kib);
+  base->setReadAhead(kib);
+}
+
 }  // namespace encfs
@@ -21,8 +21,10 @@
 #ifndef _CipherFileIO_incl_
 #define _CipherFileIO_incl_
 
+#include <atomic>
 #include <inttypes.h>
 #include <memory>
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -36,18 +38,34 @@ namespace encfs {
 
 class Cipher;
 class FileIO;
+class IVJournal;
 struct IORequest;
 
 /*
     Implement the FileIO interface encrypting data in blocks.
 
     Uses BlockFileIO to handle the block scatter / gather issues.
+
+    With a random access cipher, parts of blocks are read and written on
+    their own, except on volumes which allow holes (a partially written
+    hole wouldn't read back as zeros) and in reverse mode.
+
+    On volumes with a largeBlockSize, the top bit of the file IV tells
+    which block size a file uses.  A file takes the large blocks while it
+    is still empty, if its first write, allocation or truncate is at least
+    one large block long, and keeps them.  The header of a file which has
+    data is read on open, so that its block size is known before the first
+    block.  File sizes don't depend on the block size, as there are no MAC
+    headers on such volumes.
 */
-class CipherFileIO : public BlockFileIO {
+class CipherFileIO final : public BlockFileIO {
  public:
   CipherFileIO(std::shared_ptr<FileIO> base, const FSConfigPtr &cfg);
   virtual ~CipherFileIO();
 
+  // size of the upper file over a backing file of size bytes
+  static off_t upperSize(const FSConfigPtr &cfg, off_t size);
+
   virtual Interface interface() const;
 
   virtual void setFileName(const char *fileName);
@@ -55,27 +73,66 @@ class CipherFileIO : public BlockFileIO {
   virtual bool setIV(uint64_t iv);
 
   virtual int open(int flags);
+  virtual int create(mode_t mode);
 
   virtual int getAttr(struct stat *stbuf) const;
   virtual off_t getSize() const;
 
   virtual int truncate(off_t size);
 
+  virtual ssize_t write(const IORequest &req);
+  virtual ssize_t writeInPlace(const IORequest &req);
+  virtual int allocate(off_t offset, off_t length);
+  virtual off_t nextData(off_t offset) const;
+  virtual off_t nextHole(off_t offset) const;
+
   virtual bool isWritable() const;
+  virtual void invalidate();
+  virtual void releaseBuffers();
+  virtual void setReadAhead(int kib);
 
  private:
   virtual ssize_t readOneBlock(const IORequest &req) const;
+  virtual ssize_t readBlocks(const IORequest &req) const;
+  virtual void readBlocksAsync(const IORequest &req, IODone done) const;
+  ssize_t decodeBlocks(const IORequest &req, ssize_t readSize) const;
+  bool readsHeader(off_t offset) const;
+  ssize_t readWithHeader(const IORequest &req) const;
   virtual ssize_t writeOneBlock(const IORequest &req);
+  virtual int punchBlocks(off_t offset, size_t count);
+  virtual int allocateBlocks(off_t offset, size_t count);
+  virtual ssize_t writeBlocks(const IORequest &req, bool inPlace);
+  virtual ssize_t readPartial(const IORequest &req) const;
+  virtual ssize_t writePartial(const IORequest &req);
   virtual int generateReverseHeader(unsigned char *data);
 
   int initHeader();
+  int truncateToZero();
+  int readHeader(uint64_t headerIV);
+  int decodeHeader(unsigned char *buf, uint64_t headerIV);
+  bool deferIV(IVJournal *journal, uint64_t iv);
+  void forgetPendingIV(IVJournal *journal);
+  int ensureHeader() const;
+  int newHeader(uint64_t *newIV, unsigned char *buf) const;
+  int headerForWrite(off_t offset, unsigned char *header);
+  void headerWritten(bool ok);
+  ssize_t storeWithHeader(const unsigned char *header,
+                          const unsigned char *data, size_t len);
+  ssize_t writeWithHeader(const unsigned char *header,
+                          const unsigned char *data, size_t len);
   bool writeHeader();
+  void adoptBlockSize();
+  void sizeHint(off_t size);
   bool blockRead(unsigned char *buf, int size, uint64_t iv64) const;
   bool streamRead(unsigned char *buf, int size, uint64_t iv64) const;
+  bool openSealed(unsigned char *buf, int size, uint64_t iv64) const;
   bool blockWrite(unsigned char *buf, int size, uint64_t iv64) const;
+  bool blockWriteMany(unsigned char *buf, int size, off_t blockNum,
+                      size_t count, uint64_t iv) const;
   bool streamWrite(unsigned char *buf, int size, uint64_t iv64) const;
 
   ssize_t read(const IORequest &req) const;
+  int checkSource() const;
 
   std::shared_ptr<FileIO> base;
 
@@ -84,12 +141,33 @@ class CipherFileIO : public BlockFileIO {
   // if haveHeader is true, then we have a transparent file header which
   // contains a 64 bit initialization vector.
   bool haveHeader;
+  // bytes before the first block: the header, padded with alignedBlocks
+  off_t headerSpace;
   uint64_t externalIV;
-  uint64_t fileIV;
+  std::atomic<uint64_t> fileIV;
   int lastFlags;
+  // serializes initHeader() between threads coding blocks of this file
+  mutable pthread_mutex_t headerMutex;
+  // reverse mode: the header last generated, for inode reverseIno and
+  // externalIV reverseHeaderIV.  Guarded by headerMutex.
+  ino_t reverseIno;
+  uint64_t reverseHeaderIV;
+  unsigned char reverseHeader[8];
+  // reverse mode: the plaintext file the cached blocks were read from, ino 0
+  // if none.  Guarded by headerMutex.
+  mutable ino_t sourceIno;
+  mutable time_t sourceMtime;
+  mutable time_t sourceCtime;
+  mutable off_t sourceSize;
 
   std::shared_ptr<Cipher> cipher;
   CipherKey key;
+  // the cipher codes file data with rangeEncode
+  bool rangeCoding;
+  // the cipher seals file data with sealEncode, see MACFileIO version 4
+  bool sealed;
+  // block size of files whose IV has the top bit set, 0 if off
+  unsigned int largeBlockSize;
 };
 
 }  // namespace encfs
@@ -0,0 +1,607 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CompressFileIO.h"
+
+#include "easylogging++.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <utility>
+
+#include "Error.h"
+#include "FileIO.h"
+#include "MemoryPool.h"
+#include "Mutex.h"
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+namespace encfs {
+
+static Interface CompressFileIO_iface("FileIO/Compress", 1, 0, 0);
+
+const unsigned int CompressFileIO::ExtentSize;
+const unsigned int CompressFileIO::GroupExtents;
+const uint32_t CompressFileIO::RawFlag;
+
+static const off_t ExtentSize = CompressFileIO::ExtentSize;
+static const off_t GroupExtents = CompressFileIO::GroupExtents;
+static const off_t IndexSize = GroupExtents * 4;
+static const off_t GroupSize = IndexSize + GroupExtents * ExtentSize;
+
+// location of the index of the group holding extent
+static off_t indexStart(off_t extent) {
+  return (extent / GroupExtents) * GroupSize;
+}
+
+static off_t slotStart(off_t extent) {
+  return indexStart(extent) + IndexSize + (extent % GroupExtents) * ExtentSize;
+}
+
+// the stored size of a file of size plain bytes
+static off_t storedSize(off_t size) {
+  if (size <= 0) {
+    return 0;
+  }
+  off_t last = (size - 1) / ExtentSize;
+  return slotStart(last) + (size - last * ExtentSize);
+}
+
+// the plain size of a file with stored size bytes, the inverse of storedSize
+static off_t plainSize(off_t size) {
+  if (size <= 0) {
+    return size;
+  }
+  off_t group = (size - 1) / GroupSize;
+  off_t pos = (size - 1) % GroupSize;
+  if (pos < IndexSize) {
+    // cut off within an index, there is no data in the group
+    return group * GroupExtents * ExtentSize;
+  }
+  pos -= IndexSize;
+  return group * GroupExtents * ExtentSize + pos + 1;
+}
+
+#ifdef HAVE_ZLIB
+// zlib streams are reset for every extent instead of set up again, which
+// would allocate and clear their state each time
+struct Deflater {
+  z_stream z;
+  bool ok;
+  Deflater() {
+    memset(&z, 0, sizeof(z));
+    // raw deflate, the index knows the lengths
+    ok = deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+                      Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+  ~Deflater() {
+    if (ok) {
+      deflateEnd(&z);
+    }
+  }
+};
+
+struct Inflater {
+  z_stream z;
+  bool ok;
+  Inflater() {
+    memset(&z, 0, sizeof(z));
+    ok = inflateInit2(&z, -15) == Z_OK;
+  }
+  ~Inflater() {
+    if (ok) {
+      inflateEnd(&z);
+    }
+  }
+};
+#endif
+
+// Compress len bytes into at most outLen bytes of out.  Returns the
+// compressed length, or 0 if it didn't fit.
+static size_t compress(int codec, const unsigned char *in, size_t len,
+                       unsigned char *out, size_t outLen) {
+#ifdef HAVE_ZLIB
+  if (codec == CompressFileIO::ZlibCompression && outLen > 0) {
+    static thread_local Deflater d;
+    if (!d.ok || deflateReset(&d.z) != Z_OK) {
+      return 0;
+    }
+    d.z.next_in = const_cast<unsigned char *>(in);
+    d.z.avail_in = len;
+    d.z.next_out = out;
+    d.z.avail_out = outLen;
+    if (deflate(&d.z, Z_FINISH) == Z_STREAM_END) {
+      return outLen - d.z.avail_out;
+    }
+  }
+#else
+  (void)in;
+  (void)len;
+  (void)out;
+  (void)outLen;
+#endif
+  (void)codec;
+  return 0;
+}
+
+// Expand len compressed bytes into at most outLen bytes of out.  Returns the
+// expanded length, or -1 if the data is damaged.
+static ssize_t expand(int codec, const unsigned char *in, size_t len,
+                      unsigned char *out, size_t outLen) {
+#ifdef HAVE_ZLIB
+  if (codec == CompressFileIO::ZlibCompression) {
+    static thread_local Inflater d;
+    if (!d.ok || inflateReset(&d.z) != Z_OK) {
+      return -1;
+    }
+    d.z.next_in = const_cast<unsigned char *>(in);
+    d.z.avail_in = len;
+    d.z.next_out = out;
+    d.z.avail_out = outLen;
+    int res = inflate(&d.z, Z_FINISH);
+    // a shorter read stops at the end of out
+    if (res == Z_STREAM_END || d.z.avail_out == 0) {
+      return outLen - d.z.avail_out;
+    }
+  }
+#else
+  (void)in;
+  (void)len;
+  (void)out;
+  (void)outLen;
+#endif
+  (void)codec;
+  return -1;
+}
+
+bool CompressFileIO::supported(int codec) {
+#ifdef HAVE_ZLIB
+  return codec == ZlibCompression;
+#else
+  (void)codec;
+  return false;
+#endif
+}
+
+CompressFileIO::CompressFileIO(std::shared_ptr<FileIO> _base,
+                               const FSConfigPtr &cfg)
+    : BlockFileIO(ExtentSize, cfg),
+      base(std::move(_base)),
+      codec(cfg->config->compression) {
+  pthread_mutex_init(&_mutex, nullptr);
+  VLOG(1) << "compression codec " << codec;
+  enableReadAhead(cfg);
+}
+
+CompressFileIO::~CompressFileIO() {
+  stopReadAhead();
+  pthread_mutex_destroy(&_mutex);
+}
+
+Interface CompressFileIO::interface() const { return CompressFileIO_iface; }
+
+int CompressFileIO::open(int flags) { return base->open(flags); }
+
+int CompressFileIO::create(mode_t mode) { return base->create(mode); }
+
+void CompressFileIO::setFileName(const char *fileName) {
+  base->setFileName(fileName);
+}
+
+const char *CompressFileIO::getFileName() const { return base->getFileName(); }
+
+bool CompressFileIO::setIV(uint64_t iv) { return base->setIV(iv); }
+
+int CompressFileIO::getAttr(struct stat *stbuf) const {
+  int res = base->getAttr(stbuf);
+
+  // st_blocks is left alone, it shows what the file takes compressed
+  if (res == 0 && S_ISREG(stbuf->st_mode)) {
+    stbuf->st_size = plainSize(stbuf->st_size);
+  }
+
+  return res;
+}
+
+off_t CompressFileIO::getSize() const { return plainSize(base->getSize()); }
+
+off_t CompressFileIO::upperSize(off_t size) { return plainSize(size); }
+
+int64_t CompressFileIO::entry(off_t extent) const {
+  off_t group = extent / GroupExtents;
+  auto it = _index.find(group);
+  if (it == _index.end()) {
+    unsigned char buf[IndexSize];
+    IORequest req;
+    req.offset = group * GroupSize;
+    req.data = buf;
+    req.dataLen = IndexSize;
+    ssize_t res = base->read(req);
+    if (res < 0) {
+      return res;
+    }
+    // past the end of the stored stream, or in a hole, entries are 0
+    memset(buf + res, 0, IndexSize - res);
+
+    std::vector<uint32_t> entries(GroupExtents);
+    for (off_t i = 0; i < GroupExtents; ++i) {
+      const unsigned char *p = buf + i * 4;
+      entries[i] = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    it = _index.emplace(group, std::move(entries)).first;
+  }
+  return it->second[extent % GroupExtents];
+}
+
+int CompressFileIO::setEntry(off_t extent, uint32_t value) {
+  int64_t old = entry(extent);
+  if (old < 0) {
+    return (int)old;
+  }
+  if (old == value) {
+    return 0;
+  }
+
+  unsigned char buf[4];
+  for (int i = 0; i < 4; ++i) {
+    buf[i] = (value >> (8 * i)) & 0xff;
+  }
+  IORequest req;
+  req.offset = indexStart(extent) + (extent % GroupExtents) * 4;
+  req.data = buf;
+  req.dataLen = sizeof(buf);
+  ssize_t res = base->writeInPlace(req);
+  if (res < 0) {
+    // what was written is unknown now
+    _index.erase(extent / GroupExtents);
+    return (int)res;
+  }
+  _index[extent / GroupExtents][extent % GroupExtents] = value;
+  return 0;
+}
+
+uint32_t CompressFileIO::pack(const unsigned char *data, size_t len,
+                              unsigned char *buf) const {
+  if (isZeroBlock(data, len)) {
+    return 0;
+  }
+  // only worth it if it saves something
+  size_t stored = compress(codec, data, len, buf, len - 1);
+  return stored > 0 ? (uint32_t)stored : RawFlag | (uint32_t)len;
+}
+
+ssize_t CompressFileIO::store(off_t extent, const unsigned char *data,
+                              size_t len, uint32_t value,
+                              unsigned char *buf) {
+  Lock lock(_mutex);
+
+  off_t size = getSize();
+  if (size < 0) {
+    return size;
+  }
+  int64_t oldEntry = entry(extent);
+  if (oldEntry < 0) {
+    return oldEntry;
+  }
+
+  // the data goes first, an entry never points to bytes not written yet
+  size_t stored = value & ~RawFlag;
+  if (stored > 0) {
+    IORequest req;
+    req.offset = slotStart(extent);
+    req.dataLen = stored;
+    ssize_t res;
+    if ((value & RawFlag) != 0) {
+      req.data = const_cast<unsigned char *>(data);
+      res = base->write(req);
+    } else {
+      req.data = buf;
+      res = base->writeInPlace(req);
+    }
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  int res = setEntry(extent, value);
+  if (res < 0) {
+    return res;
+  }
+
+  // the stored stream reaches as far past the last slot as the plain data
+  off_t end = extent * ExtentSize + len;
+  if (end > size) {
+    off_t want = storedSize(end);
+    off_t have = base->getSize();
+    if (have < 0) {
+      return have;
+    }
+    if (have < want) {
+      res = base->truncate(want);
+      if (res < 0) {
+        return res;
+      }
+    }
+  }
+
+  // Give back the space in the slot past the data, which a longer version
+  // of the extent took, or the padding of the end of the file as it grew.
+  // Otherwise it would stay taken, as nothing else writes there.
+  off_t tail = oldEntry & ~RawFlag;
+  if (size > 0 && extent == (size - 1) / ExtentSize) {
+    tail = max(tail, size - extent * ExtentSize);
+  }
+  if (tail > (off_t)stored) {
+    off_t bs = base->blockSize();
+    off_t have = base->getSize();
+    off_t from = (slotStart(extent) + stored + bs - 1) / bs * bs;
+    // whole blocks of the slot, short of the end of the file
+    off_t to = min((slotStart(extent) + tail + bs - 1) / bs * bs,
+                   min(slotStart(extent) + ExtentSize, have) / bs * bs);
+    if (from < to) {
+      // only a matter of space, so failures are ignored
+      base->punchHole(from, to - from);
+    }
+  }
+
+  return len;
+}
+
+ssize_t CompressFileIO::unpack(off_t extent, uint32_t value,
+                               unsigned char *out, size_t len) const {
+  size_t stored = value & ~RawFlag;
+  ssize_t res = 0;
+
+  IORequest req;
+  req.offset = slotStart(extent);
+  if (stored == 0) {
+    // all zero
+  } else if ((value & RawFlag) != 0) {
+    req.data = out;
+    req.dataLen = min(stored, len);
+    res = base->read(req);
+  } else {
+    MemBlock mb = MemoryPool::allocate(stored);
+    req.data = mb.data;
+    req.dataLen = stored;
+    res = base->read(req);
+    if (res >= 0) {
+      res = res == (ssize_t)stored ? expand(codec, mb.data, stored, out, len)
+                                   : -1;
+      if (res < 0) {
+        RLOG(WARNING) << "damaged compressed extent " << extent;
+        res = -EBADMSG;
+      }
+    }
+    MemoryPool::release(mb);
+  }
+
+  if (res < 0) {
+    return res;
+  }
+  // an extent written when the file was shorter reads on with zeros
+  memset(out + res, 0, len - res);
+  return len;
+}
+
+ssize_t CompressFileIO::readOneBlock(const IORequest &req) const {
+  off_t size = getSize();
+  if (size <= req.offset) {
+    return size < 0 ? size : 0;
+  }
+  size_t len = min((off_t)req.dataLen, size - req.offset);
+
+  off_t extent = req.offset / ExtentSize;
+  int64_t value;
+  {
+    Lock lock(_mutex);
+    value = entry(extent);
+  }
+  if (value < 0) {
+    return value;
+  }
+
+  return unpack(extent, (uint32_t)value, req.data, len);
+}
+
+/**
+ * The extents of a run are read and expanded on the worker threads.
+ */
+ssize_t CompressFileIO::readBlocks(const IORequest &req) const {
+  size_t count = req.dataLen / ExtentSize;
+
+  // bytes of each extent, the run ends at the first short one
+  std::vector<ssize_t> sizes(count, 0);
+
+  auto readChunk = [&](size_t first, size_t n) {
+    for (size_t i = first; i < first + n; ++i) {
+      IORequest tmp;
+      tmp.offset = req.offset + i * ExtentSize;
+      tmp.data = req.data + i * ExtentSize;
+      tmp.dataLen = ExtentSize;
+      sizes[i] = readOneBlock(tmp);
+      if (sizes[i] < ExtentSize) {
+        return sizes[i] >= 0;
+      }
+    }
+    return true;
+  };
+
+  // a failed chunk left its error in sizes
+  forBlocks(count, readChunk);
+
+  ssize_t result = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (sizes[i] < 0) {
+      return sizes[i];
+    }
+    result += sizes[i];
+    if (sizes[i] < ExtentSize) {
+      break;
+    }
+  }
+  return result;
+}
+
+ssize_t CompressFileIO::writeOneBlock(const IORequest &req) {
+  MemBlock mb = MemoryPool::allocate(ExtentSize);
+
+  uint32_t value = pack(req.data, req.dataLen, mb.data);
+  ssize_t res =
+      store(req.offset / ExtentSize, req.data, req.dataLen, value, mb.data);
+
+  MemoryPool::release(mb);
+  return res;
+}
+
+/**
+ * The extents of a run are compressed on the worker threads, and then
+ * stored one after the other.
+ */
+ssize_t CompressFileIO::writeBlocks(const IORequest &req, bool inPlace) {
+  size_t count = req.dataLen / ExtentSize;
+  if (count < 2) {
+    return BlockFileIO::writeBlocks(req, inPlace);
+  }
+
+  MemBlock mb = MemoryPool::allocate(count * ExtentSize);
+  std::vector<uint32_t> entries(count);
+
+  forBlocks(count, [&](size_t first, size_t n) {
+    for (size_t i = first; i < first + n; ++i) {
+      entries[i] = pack(req.data + i * ExtentSize, ExtentSize,
+                        mb.data + i * ExtentSize);
+    }
+    return true;
+  });
+
+  ssize_t res = req.dataLen;
+  off_t firstExtent = req.offset / ExtentSize;
+  for (size_t i = 0; i < count; ++i) {
+    ssize_t writeSize =
+        store(firstExtent + i, req.data + i * ExtentSize, ExtentSize,
+              entries[i], mb.data + i * ExtentSize);
+    if (writeSize < 0) {
+      res = writeSize;
+      break;
+    }
+  }
+
+  MemoryPool::release(mb);
+  return res;
+}
+
+int CompressFileIO::punchBlocks(off_t offset, size_t count) {
+  Lock lock(_mutex);
+
+  off_t first = offset / ExtentSize;
+  off_t end = first + count;
+  for (off_t extent = first; extent < end; ++extent) {
+    int res = setEntry(extent, 0);
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  // free the slots, a group at a time as the indexes lie in between.  This
+  // also extends the stored stream if the run ends the file.
+  for (off_t extent = first; extent < end;) {
+    off_t groupEnd = min(end, (extent / GroupExtents + 1) * GroupExtents);
+    int res = base->punchHole(slotStart(extent),
+                              (groupEnd - extent) * ExtentSize);
+    if (res < 0) {
+      return res;
+    }
+    extent = groupEnd;
+  }
+  return 0;
+}
+
+int CompressFileIO::truncate(off_t size) {
+  off_t oldSize = getSize();
+  if (oldSize < 0) {
+    return (int)oldSize;
+  }
+
+  // rewrites a partial last extent, and pads the file when extending it
+  int res = BlockFileIO::truncateBase(size, nullptr);
+  if (res < 0) {
+    return res;
+  }
+
+  Lock lock(_mutex);
+  if (size < oldSize) {
+    // clear the entries past the new end in its group, the later groups
+    // are cut off
+    off_t extent = (size + ExtentSize - 1) / ExtentSize;
+    off_t lastExtent = (oldSize - 1) / ExtentSize;
+    if (indexStart(extent) < storedSize(size)) {
+      off_t groupEnd = (extent / GroupExtents + 1) * GroupExtents;
+      for (; res == 0 && extent < groupEnd && extent <= lastExtent; ++extent) {
+        res = setEntry(extent, 0);
+      }
+    }
+    for (auto it = _index.begin(); it != _index.end();) {
+      if (it->first * GroupSize >= storedSize(size)) {
+        it = _index.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  if (res == 0) {
+    off_t want = storedSize(size);
+    off_t have = base->getSize();
+    if (have < 0) {
+      res = (int)have;
+    } else if (have != want) {
+      res = base->truncate(want);
+    }
+  }
+  return res;
+}
+
+bool CompressFileIO::isWritable() const { return base->isWritable(); }
+
+void CompressFileIO::invalidate() {
+  invalidateCache();
+  {
+    Lock lock(_mutex);
+    _index.clear();
+  }
+  base->invalidate();
+}
+
+void CompressFileIO::releaseBuffers() {
+  BlockFileIO::releaseBuffers();
+  base->releaseBuffers();
+}
+
+void CompressFileIO::setReadAhead(int kib) {
+  BlockFileIO::setReadAhead(kib);
+  base->setReadAhead(kib);
+}
+
+}  // namespace encfs
@@ -0,0 +1,128 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CompressFileIO_incl_
+#define _CompressFileIO_incl_
+
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include "BlockFileIO.h"
+#include "FSConfig.h"
+#include "Interface.h"
+
+namespace encfs {
+
+class FileIO;
+struct IORequest;
+
+/*
+    Compresses the file contents ahead of the cipher (config compression).
+
+    The plain file is cut into extents of ExtentSize bytes, which are
+    compressed one by one, so that any extent can be read without the ones
+    before it.  The stream stored below is made of groups: an index of
+    GroupExtents entries, followed by a fixed slot of ExtentSize bytes for
+    each extent of the group.  An extent is written to the start of its
+    slot, and the rest of the slot is left as a hole, so only the compressed
+    bytes go to disk (which needs allowHoles).  Finding an extent takes a
+    look at its index entry, which is cached per group, and one read of
+    exactly its compressed bytes.
+
+    An index entry holds the stored length of its extent, with RawFlag set if
+    the extent didn't compress and is stored as it is, or 0 for an all zero
+    extent.  As the stored bytes never outnumber the plain ones, the stored
+    stream is kept extended to the plain length of the last extent past its
+    slot, and the plain size of a file follows from the size of its stored
+    stream alone.
+*/
+class CompressFileIO final : public BlockFileIO {
+ public:
+  // values of EncFSConfig::compression
+  enum Codec { NoCompression = 0, ZlibCompression = 1 };
+
+  static const unsigned int ExtentSize = 64 * 1024;
+  static const unsigned int GroupExtents = 256;
+
+  // whether this build can read and write volumes using codec
+  static bool supported(int codec);
+
+  // size of the file over a lower file of size bytes
+  static off_t upperSize(off_t size);
+
+  CompressFileIO(std::shared_ptr<FileIO> base, const FSConfigPtr &cfg);
+  virtual ~CompressFileIO();
+
+  virtual Interface interface() const;
+
+  virtual void setFileName(const char *fileName);
+  virtual const char *getFileName() const;
+  virtual bool setIV(uint64_t iv);
+
+  virtual int open(int flags);
+  virtual int create(mode_t mode);
+  virtual int getAttr(struct stat *stbuf) const;
+  virtual off_t getSize() const;
+
+  virtual int truncate(off_t size);
+
+  virtual bool isWritable() const;
+  virtual void invalidate();
+  virtual void releaseBuffers();
+  virtual void setReadAhead(int kib);
+
+ private:
+  static const uint32_t RawFlag = 0x80000000u;
+
+  virtual ssize_t readOneBlock(const IORequest &req) const;
+  virtual ssize_t readBlocks(const IORequest &req) const;
+  virtual ssize_t writeOneBlock(const IORequest &req);
+  virtual ssize_t writeBlocks(const IORequest &req, bool inPlace);
+  virtual int punchBlocks(off_t offset, size_t count);
+
+  // compress len bytes of an extent into buf (ExtentSize bytes), and return
+  // its index entry
+  uint32_t pack(const unsigned char *data, size_t len,
+                unsigned char *buf) const;
+  // store an extent packed into the index entry value, its bytes are buf
+  // unless it was stored raw
+  ssize_t store(off_t extent, const unsigned char *data, size_t len,
+                uint32_t value, unsigned char *buf);
+  // read len bytes of an extent with the index entry value into out
+  ssize_t unpack(off_t extent, uint32_t value, unsigned char *out,
+                 size_t len) const;
+
+  // index entry of an extent, or -errno.  _mutex held.
+  int64_t entry(off_t extent) const;
+  int setEntry(off_t extent, uint32_t value);
+
+  std::shared_ptr<FileIO> base;
+  int codec;
+
+  // the cached index of each group read so far, and serializes the writes
+  // to the stored stream, as extents don't line up with its blocks
+  mutable pthread_mutex_t _mutex;
+  mutable std::unordered_map<off_t, std::vector<uint32_t>> _index;
+};
+
+}  // namespace encfs
+
+#endif
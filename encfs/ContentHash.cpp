@@ -0,0 +1,253 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ContentHash.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <openssl/evp.h>
+
+#include "config.h"
+
+#if defined(HAVE_SYS_XATTR_H)
+#include <sys/xattr.h>
+#elif defined(HAVE_ATTR_XATTR_H)
+#include <attr/xattr.h>
+#endif
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
+
+#include "Cipher.h"
+#include "MemoryPool.h"
+#include "SSL_Compat.h"
+#include "WorkerPool.h"
+
+namespace encfs {
+
+const char ContentHash::AttrName[] = "user.encfs.sha256";
+const char ContentHash::StoreName[] = "user.encfs.hash";
+const size_t ContentHash::HexSize;
+
+/*
+    The stored value is a random nonce (8 bytes), then the stream encoding,
+    with the nonce as IV, of a MAC of the body (8 bytes) and the body: the
+    inode (8), size (8) and mtime in nanoseconds (8) of the backing file,
+    and the hash (32).  Numbers are big endian.
+*/
+static const size_t NonceSize = 8;
+static const size_t MacSize = 8;
+static const size_t HashSize = 32;
+static const size_t BodySize = 24 + HashSize;
+static const size_t ValueSize = NonceSize + MacSize + BodySize;
+
+// plaintext read and hashed at a time
+static const size_t ChunkSize = 1 << 20;
+
+static void putNumber(unsigned char *out, uint64_t value) {
+  for (int i = 7; i >= 0; --i) {
+    *out++ = (unsigned char)((value >> (8 * i)) & 0xff);
+  }
+}
+
+static uint64_t getNumber(const unsigned char *in) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+static int64_t mtimeOf(const struct stat &st) {
+#ifdef __APPLE__
+  return st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+  return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
+static bool sameStamp(const struct stat &a, const struct stat &b) {
+  return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+         mtimeOf(a) == mtimeOf(b);
+}
+
+// false if the file may still change without a change of its mtime
+static bool settled(const struct stat &st) {
+  return mtimeOf(st) % 1000000000LL != 0 || st.st_mtime < time(nullptr);
+}
+
+static ssize_t loadValue(const char *path, unsigned char *buf, size_t size) {
+#if defined(HAVE_SYS_XATTR_H) || defined(HAVE_ATTR_XATTR_H)
+#ifdef XATTR_ADD_OPT
+  return ::getxattr(path, ContentHash::StoreName, buf, size, 0,
+                    XATTR_NOFOLLOW);
+#else
+  return ::lgetxattr(path, ContentHash::StoreName, buf, size);
+#endif
+#else
+  (void)path;
+  (void)buf;
+  (void)size;
+  return -1;
+#endif
+}
+
+static void storeValue(const char *path, const std::string &value) {
+#if defined(HAVE_SYS_XATTR_H) || defined(HAVE_ATTR_XATTR_H)
+#ifdef XATTR_ADD_OPT
+  ::setxattr(path, ContentHash::StoreName, value.data(), value.size(), 0,
+             XATTR_NOFOLLOW);
+#else
+  ::lsetxattr(path, ContentHash::StoreName, value.data(), value.size(), 0);
+#endif
+#else
+  (void)path;
+  (void)value;
+#endif
+}
+
+ContentHash::ContentHash(const std::shared_ptr<Cipher> &cipher,
+                         const CipherKey &key, WorkerPool *workers)
+    : _cipher(cipher), _key(key), _workers(workers) {}
+
+int ContentHash::get(const char *cipherPath, const Reader &read, bool store,
+                     std::string *hex) const {
+  struct stat before;
+  if (::lstat(cipherPath, &before) != 0) {
+    return -errno;
+  }
+  if (!S_ISREG(before.st_mode)) {
+    return -ENOATTR;
+  }
+
+  unsigned char hash[HashSize];
+  unsigned char stored[ValueSize + 1];
+  ssize_t len = loadValue(cipherPath, stored, sizeof(stored));
+  if (len != (ssize_t)ValueSize ||
+      !unseal(std::string((char *)stored, len), before, hash)) {
+    int res = compute(read, hash);
+    if (res < 0) {
+      return res;
+    }
+    struct stat after;
+    if (store && settled(before) && ::lstat(cipherPath, &after) == 0 &&
+        sameStamp(before, after)) {
+      std::string value = seal(before, hash);
+      if (!value.empty()) {
+        storeValue(cipherPath, value);
+      }
+    }
+  }
+
+  static const char digits[] = "0123456789abcdef";
+  hex->resize(HexSize);
+  for (size_t i = 0; i < HashSize; ++i) {
+    (*hex)[2 * i] = digits[hash[i] >> 4];
+    (*hex)[2 * i + 1] = digits[hash[i] & 0xf];
+  }
+  return 0;
+}
+
+// Hash the part read last while the next one is read
+int ContentHash::compute(const Reader &read, unsigned char *hash) const {
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  if (ctx == nullptr || EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) {
+    EVP_MD_CTX_free(ctx);
+    return -ENOMEM;
+  }
+
+  MemBlock bufs[2] = {MemoryPool::allocate(ChunkSize),
+                      MemoryPool::allocate(ChunkSize)};
+  off_t offset = 0;
+  ssize_t last = read(offset, bufs[0].data, ChunkSize);
+  int current = 0;
+  bool hashed = true;
+  while (last > 0 && hashed) {
+    offset += last;
+    ssize_t next = 0;
+    auto step = [&](size_t i) {
+      if (i == 0) {
+        hashed = EVP_DigestUpdate(ctx, bufs[current].data, last) == 1;
+      } else {
+        next = read(offset, bufs[1 - current].data, ChunkSize);
+      }
+    };
+    if (_workers != nullptr) {
+      _workers->parallelFor(2, step);
+    } else {
+      step(0);
+      step(1);
+    }
+    last = next;
+    current = 1 - current;
+  }
+
+  unsigned int size = 0;
+  int res = 0;
+  if (last < 0) {
+    res = (int)last;
+  } else if (!hashed || EVP_DigestFinal_ex(ctx, hash, &size) != 1 ||
+             size != HashSize) {
+    res = -EIO;
+  }
+  MemoryPool::release(bufs[0]);
+  MemoryPool::release(bufs[1]);
+  EVP_MD_CTX_free(ctx);
+  return res;
+}
+
+std::string ContentHash::seal(const struct stat &st,
+                              const unsigned char *hash) const {
+  std::string value(ValueSize, '\0');
+  unsigned char *data = (unsigned char *)&value[0];
+  if (!_cipher->randomize(data, NonceSize, false)) {
+    return std::string();
+  }
+  unsigned char *body = data + NonceSize + MacSize;
+  putNumber(body, st.st_ino);
+  putNumber(body + 8, st.st_size);
+  putNumber(body + 16, mtimeOf(st));
+  memcpy(body + 24, hash, HashSize);
+  putNumber(data + NonceSize, _cipher->MAC_64(body, BodySize, _key));
+  if (!_cipher->streamEncode(data + NonceSize, MacSize + BodySize,
+                             getNumber(data), _key)) {
+    return std::string();
+  }
+  return value;
+}
+
+bool ContentHash::unseal(const std::string &value, const struct stat &st,
+                         unsigned char *hash) const {
+  std::string copy = value;
+  unsigned char *data = (unsigned char *)&copy[0];
+  if (!_cipher->streamDecode(data + NonceSize, MacSize + BodySize,
+                             getNumber(data), _key)) {
+    return false;
+  }
+  unsigned char *body = data + NonceSize + MacSize;
+  if (getNumber(data + NonceSize) != _cipher->MAC_64(body, BodySize, _key) ||
+      getNumber(body) != (uint64_t)st.st_ino ||
+      getNumber(body + 8) != (uint64_t)st.st_size ||
+      getNumber(body + 16) != (uint64_t)mtimeOf(st)) {
+    return false;
+  }
+  memcpy(hash, body + 24, HashSize);
+  return true;
+}
+
+}  // namespace encfs
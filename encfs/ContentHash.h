@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ContentHash_incl_
+#define _ContentHash_incl_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "CipherKey.h"
+
+namespace encfs {
+
+class Cipher;
+class WorkerPool;
+
+/*
+    The SHA-256 of a file's plaintext, served as the virtual extended
+    attribute user.encfs.sha256, so that backup checks and rsync --checksum
+    can compare files without reading and decoding them.
+
+    Hashing a file reads all of it, so the result is kept in an extended
+    attribute of the backing file, encrypted and with a MAC, together with
+    the inode, size and mtime of the backing file it was taken from.  Any
+    write or truncate changes the mtime, through the mount or not, and the
+    stored hash is only used while all three match.  As for DirIndex, an
+    mtime of the current second isn't trusted on file systems which keep
+    whole seconds, and such a hash isn't stored.
+
+    While a file is hashed, the next part of it is read on the worker
+    threads.  Reads of large parts are decoded on them as well.
+*/
+class ContentHash {
+ public:
+  // the virtual attribute, and where its value is kept on the backing file
+  static const char AttrName[];
+  static const char StoreName[];
+  // hex digits of a hash
+  static const size_t HexSize = 64;
+
+  // Read up to len bytes of the plaintext at offset into buf.  Returns the
+  // count, 0 at the end of the file, or -errno.
+  using Reader =
+      std::function<ssize_t(off_t offset, unsigned char *buf, size_t len)>;
+
+  // workers may be null
+  ContentHash(const std::shared_ptr<Cipher> &cipher, const CipherKey &key,
+              WorkerPool *workers);
+
+  /*
+      The hash, in hex, of the plaintext of the backing file at cipherPath,
+      which read gives.  Taken from the stored attribute if that is current,
+      else computed, and then stored if store is set and the file didn't
+      change meanwhile.  Returns 0 or -errno.
+  */
+  int get(const char *cipherPath, const Reader &read, bool store,
+          std::string *hex) const;
+
+ private:
+  int compute(const Reader &read, unsigned char *hash) const;
+  std::string seal(const struct stat &st, const unsigned char *hash) const;
+  bool unseal(const std::string &value, const struct stat &st,
+              unsigned char *hash) const;
+
+  std::shared_ptr<Cipher> _cipher;
+  CipherKey _key;
+  WorkerPool *_workers;
+};
+
+}  // namespace encfs
+
+#endif
@@ -19,33 +19,81 @@
  */
 
 #include "easylogging++.h"
+#include <cerrno>
+#include <ctime>
+#include <functional>
 #include <utility>
 
 #include "Context.h"
 #include "DirNode.h"
 #include "Error.h"
 #include "Mutex.h"
+#include "StatfsCache.h"
 
 namespace encfs {
 
-EncFS_Context::EncFS_Context() {
-  pthread_cond_init(&wakeupCond, nullptr);
-  pthread_mutex_init(&wakeupMutex, nullptr);
+// The coarse clock is cheap enough for every filesystem call.  It lags the
+// monotonic clock by a few milliseconds at most, so an idle check which is
+// due by the monotonic clock never finds the filesystem used too recently.
+static int64_t monotonicSeconds(bool coarse) {
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+  clock_gettime(coarse ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC, &ts);
+#else
+  (void)coarse;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return ts.tv_sec;
+}
+
+// nodes waiting to be torn down after their last release
+static const size_t MaxRetiring = 1024;
+
+EncFS_Context::EncFS_Context() : reaper(MaxRetiring) {
   pthread_mutex_init(&contextMutex, nullptr);
+  pthread_rwlock_init(&rootLock, nullptr);
+  pthread_mutex_init(&unlockMutex, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&unlocked, &attr);
+  pthread_condattr_destroy(&attr);
+  for (auto &shard : shards) {
+    pthread_rwlock_init(&shard.lock, nullptr);
+  }
 
-  usageCount = 0;
-  idleCount = -1;
+  openPaths = 0;
+  lastUsed = monotonicSeconds(true);
   isUnmounting = false;
+  unlockState = UnlockNone;
+  unlockTimeout = 0;
   currentFuseFh = 1;
 }
 
 EncFS_Context::~EncFS_Context() {
+  // release all entries from map
+  for (auto &shard : shards) {
+    shard.openFiles.clear();
+    pthread_rwlock_destroy(&shard.lock);
+  }
+
+  pthread_cond_destroy(&unlocked);
+  pthread_mutex_destroy(&unlockMutex);
+  pthread_rwlock_destroy(&rootLock);
   pthread_mutex_destroy(&contextMutex);
-  pthread_mutex_destroy(&wakeupMutex);
-  pthread_cond_destroy(&wakeupCond);
+}
 
-  // release all entries from map
-  openFiles.clear();
+EncFS_Context::Shard &EncFS_Context::pathShard(const std::string &path) {
+  return shards[std::hash<std::string>()(path) % ShardCount];
+}
+
+size_t EncFS_Context::openFileCount() {
+  size_t count = 0;
+  for (auto &shard : shards) {
+    ReadLock lock(shard.lock);
+    count += shard.openFiles.size();
+  }
+  return count;
 }
 
 std::shared_ptr<DirNode> EncFS_Context::getRoot(int *errCode) {
@@ -56,21 +104,21 @@ std::shared_ptr<DirNode> EncFS_Context::getRoot(int *errCode, bool skipUsageCoun
   std::shared_ptr<DirNode> ret = nullptr;
   do {
     {
-      Lock lock(contextMutex);
+      ReadLock lock(rootLock);
       if (isUnmounting) {
         *errCode = -EBUSY;
-        break;      	
+        break;
       }
       ret = root;
-      // On some system, stat of "/" is allowed even if the calling user is
-      // not allowed to list / to go deeper. Do not then count this call.
-      if (!skipUsageCount) {
-        ++usageCount;
-      }
+    }
+    // On some system, stat of "/" is allowed even if the calling user is
+    // not allowed to list / to go deeper. Do not then count this call.
+    if (!skipUsageCount) {
+      markUsed();
     }
 
     if (!ret) {
-      int res = remountFS(this);
+      int res = unlockState != UnlockNone ? waitUnlocked() : remountFS(this);
       if (res != 0) {
         *errCode = res;
         break;
@@ -81,143 +129,299 @@ std::shared_ptr<DirNode> EncFS_Context::getRoot(int *errCode, bool skipUsageCoun
   return ret;
 }
 
-void EncFS_Context::setRoot(const std::shared_ptr<DirNode> &r) {
-  Lock lock(contextMutex);
+void EncFS_Context::beginUnlock(int timeout) {
+  Lock lock(unlockMutex);
+  unlockTimeout = timeout;
+  unlockState = UnlockPending;
+}
 
-  root = r;
-  if (r) {
-    rootCipherDir = r->rootDirectory();
-  }
+void EncFS_Context::endUnlock(int err) {
+  Lock lock(unlockMutex);
+  unlockState = err == 0 ? UnlockNone : UnlockFailed;
+  pthread_cond_broadcast(&unlocked);
 }
 
-// This function is called periodically by the idle monitoring thread.
-// It checks for inactivity and unmount the FS after enough inactive cycles have passed.
-// Returns true if FS has really been unmounted, false otherwise.
-bool EncFS_Context::usageAndUnmount(int timeoutCycles) {
-  Lock lock(contextMutex);
+bool EncFS_Context::unlocking() const { return unlockState == UnlockPending; }
+
+int EncFS_Context::waitUnlocked() {
+  Lock lock(unlockMutex);
+  if (unlockState == UnlockPending) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += unlockTimeout;
+    while (unlockState == UnlockPending) {
+      if (pthread_cond_timedwait(&unlocked, &unlockMutex, &deadline) ==
+          ETIMEDOUT) {
+        return -EAGAIN;
+      }
+    }
+  }
+  return unlockState == UnlockFailed ? -EACCES : 0;
+}
 
-  if (root != nullptr) {
+void EncFS_Context::markUsed() {
+  int64_t now = monotonicSeconds(true);
+  if (lastUsed.load(std::memory_order_relaxed) != now) {
+    lastUsed.store(now, std::memory_order_relaxed);
+  }
+}
 
-    if (usageCount == 0) {
-      ++idleCount;
+void EncFS_Context::setRoot(const std::shared_ptr<DirNode> &r) {
+  // the released nodes of the old root go first
+  reaper.drain();
+
+  std::shared_ptr<DirNode> old;
+  {
+    WriteLock lock(rootLock);
+    old = root;  // released outside of the lock
+    root = r;
+    if (r) {
+      rootCipherDirs = r->backingRoots();
     }
-    else {
-      idleCount = 0;
+  }
+}
+
+// This function is called by the idle monitor when the filesystem may have
+// become idle.  It unmounts the FS once it was idle for timeout seconds.
+int64_t EncFS_Context::unmountIfIdle(int timeout) {
+  int64_t now = monotonicSeconds(false);
+  {
+    ReadLock lock(rootLock);
+    if (root == nullptr) {
+      return now + timeout;
     }
-    VLOG(1) << "idle cycle count: " << idleCount << ", timeout at "
-            << timeoutCycles;
+  }
 
-    usageCount = 0;
+  int64_t idleSince = lastUsed.load(std::memory_order_relaxed);
+  VLOG(1) << "idle for " << now - idleSince << "s, timeout at " << timeout;
+  if (now - idleSince < timeout) {
+    return idleSince + timeout;
+  }
 
-    if (idleCount < timeoutCycles) {
-      return false;
-    }
+  size_t openCount = openFileCount();
+  if (openCount != 0) {
+    RLOG(WARNING) << "Filesystem inactive, but " << openCount
+                  << " files opened: " << this->opts->unmountPoint;
+    return now + timeout;
+  }
 
-    if (!openFiles.empty()) {
-      if (idleCount % timeoutCycles == 0) {
-        RLOG(WARNING) << "Filesystem inactive, but " << openFiles.size()
-                      << " files opened: " << this->opts->unmountPoint;
-      }
-      return false;
-    }
-    if (!this->opts->mountOnDemand) {
-      isUnmounting = true;
-    }
-    lock.~Lock();
-    return unmountFS(this);
+  if (!this->opts->mountOnDemand) {
+    WriteLock lock(rootLock);
+    isUnmounting = true;
+  }
+  if (unmountFS(this)) {
+    return -1;
+  }
+  return now + timeout;
+}
 
+int EncFS_Context::statfs(struct statvfs *st) {
+  std::vector<std::string> dirs;
+  {
+    ReadLock lock(rootLock);
+    dirs = rootCipherDirs;
   }
-  return false;
+  if (dirs.empty()) {
+    dirs.emplace_back();
+  }
+
+  std::shared_ptr<StatfsCache> cache;
+  if (!dirs[0].empty() && opts && opts->statfsTimeout > 0) {
+    Lock lock(contextMutex, Stats::ContextLock);
+    if (!statfsCache) {
+      statfsCache = std::make_shared<StatfsCache>(dirs, opts->statfsTimeout);
+    }
+    cache = statfsCache;
+  }
+
+  return cache ? cache->get(st) : StatfsCache::query(dirs, st);
 }
 
 std::shared_ptr<FileNode> EncFS_Context::lookupNode(const char *path) {
-  Lock lock(contextMutex);
-
-  auto it = openFiles.find(std::string(path));
-  if (it != openFiles.end()) {
-    // every entry in the list is fine... so just use the
-    // first
-    return it->second.front();
+  if (openPaths == 0) {
+    return std::shared_ptr<FileNode>();
+  }
+  std::string key(path);
+  Shard &shard = pathShard(key);
+  ReadLock lock(shard.lock, Stats::ContextLock);
+
+  auto it = shard.openFiles.find(key);
+  if (it != shard.openFiles.end()) {
+    // every node registered under the path is fine... so just use the
+    // last one opened
+    return it->second.front().node;
   }
   return std::shared_ptr<FileNode>();
 }
 
+std::vector<std::shared_ptr<FileNode>> EncFS_Context::openNodes() {
+  std::vector<std::shared_ptr<FileNode>> nodes;
+  for (Shard &shard : shards) {
+    ReadLock lock(shard.lock, Stats::ContextLock);
+    for (const auto &it : shard.openFiles) {
+      nodes.push_back(it.second.front().node);
+    }
+  }
+  return nodes;
+}
+
 void EncFS_Context::renameNode(const char *from, const char *to) {
-  Lock lock(contextMutex);
+  std::string fromKey(from), toKey(to);
+  Shard &src = pathShard(fromKey);
+  Shard &dst = pathShard(toKey);
+
+  // always lock the lower shard first
+  Shard *first = &src < &dst ? &src : &dst;
+  Shard *second = &src < &dst ? &dst : &src;
+  WriteLock lock1(first->lock, Stats::ContextLock);
+  std::unique_ptr<WriteLock> lock2;
+  if (second != first) {
+    lock2.reset(new WriteLock(second->lock, Stats::ContextLock));
+  }
 
-  auto it = openFiles.find(std::string(from));
-  if (it != openFiles.end()) {
-    auto val = it->second;
-    openFiles.erase(it);
-    openFiles[std::string(to)] = val;
+  auto it = src.openFiles.find(fromKey);
+  if (it != src.openFiles.end()) {
+    auto val = std::move(it->second);
+    src.openFiles.erase(it);
+    if (dst.openFiles.count(toKey) != 0) {
+      --openPaths;  // replaced
+    }
+    dst.openFiles[toKey] = std::move(val);
   }
 }
 
 // putNode stores "node" under key "path" in the "openFiles" map. It
-// increments the reference count if the key already exists.
+// increments the reference count if the node is already registered there.
+// The first open of a node gives it its FUSE file handle.
 void EncFS_Context::putNode(const char *path,
                             const std::shared_ptr<FileNode> &node) {
-  Lock lock(contextMutex);
-  auto &list = openFiles[std::string(path)];
-  // The length of "list" serves as the reference count.
-  list.push_front(node);
-  fuseFhMap[node->fuseFh] = node;
+  std::string key(path);
+  Shard &shard = pathShard(key);
+  WriteLock lock(shard.lock, Stats::ContextLock);
+  auto &entries = shard.openFiles[key];
+  if (entries.empty()) {
+    ++openPaths;
+  }
+  for (OpenFile &entry : entries) {
+    if (entry.node == node) {
+      ++entry.count;
+      return;
+    }
+  }
+  // 0 if the table is full, the operations then go by path
+  node->fuseFh = fuseFhs.insert(node);
+  // the node opened last is the one lookupNode returns
+  entries.insert(entries.begin(), OpenFile{node, 1});
 }
 
 // eraseNode is called by encfs_release in response to the RELEASE
 // FUSE-command we get from the kernel.
-void EncFS_Context::eraseNode(const char *path,
+bool EncFS_Context::eraseNode(const char *path,
                               const std::shared_ptr<FileNode> &fnode) {
-  Lock lock(contextMutex);
+  std::string key(path);
+  Shard &shard = pathShard(key);
+  WriteLock lock(shard.lock, Stats::ContextLock);
 
-  auto it = openFiles.find(std::string(path));
+  auto it = shard.openFiles.find(key);
 #ifdef __CYGWIN__
   // When renaming a file, Windows first opens it, renames it and then closes it
   // Filenode may have then been renamed too
-  if (it == openFiles.end()) {
+  if (it == shard.openFiles.end()) {
     RLOG(WARNING) << "Filenode to erase not found, file has certainly be renamed: "
                   << path;
-    return;
+    return false;
   }
 #endif
-  rAssert(it != openFiles.end());
-  auto &list = it->second;
-
-  // Find "fnode" in the list of FileNodes registered under this path.
-  auto findIter = std::find(list.begin(), list.end(), fnode);
-  rAssert(findIter != list.end());
-  list.erase(findIter);
-
-  // If no reference to "fnode" remains, drop the entry from fuseFhMap
-  // and overwrite the canary.
-  findIter = std::find(list.begin(), list.end(), fnode);
-  if (findIter == list.end()) {
-    fuseFhMap.erase(fnode->fuseFh);
+  rAssert(it != shard.openFiles.end());
+  auto &entries = it->second;
+
+  // Find "fnode" among the FileNodes registered under this path.  There is
+  // almost always just the one.
+  auto entry = entries.begin();
+  while (entry != entries.end() && entry->node != fnode) {
+    ++entry;
+  }
+  rAssert(entry != entries.end());
+
+  // If no reference to "fnode" remains, drop its file handle and overwrite
+  // the canary.
+  bool last = --entry->count == 0;
+  if (last) {
+    fuseFhs.erase(fnode->fuseFh);
     fnode->canary = CANARY_RELEASED;
+    entries.erase(entry);
   }
 
   // If no FileNode is registered at this path anymore, drop the entry
   // from openFiles.
-  if (list.empty()) {
-    openFiles.erase(it);
+  if (entries.empty()) {
+    shard.openFiles.erase(it);
+    --openPaths;
+  }
+  return last;
+}
+
+void EncFS_Context::retireNode(const char *path,
+                               std::shared_ptr<FileNode> &fnode) {
+  reaper.put(path, fnode);
+}
+
+void EncFS_Context::waitRetired(const char *path) {
+  if (reaper.pending() != 0) {
+    reaper.wait(path);
   }
 }
 
 // nextFuseFh returns the next unused uint64 to serve as the FUSE file
-// handle for the kernel.
+// handle of a directory listing.  Files get theirs from putNode.
 uint64_t EncFS_Context::nextFuseFh() {
   // This is thread-safe because currentFuseFh is declared as std::atomic
   return currentFuseFh++;
 }
 
-// lookupFuseFh finds "n" in "fuseFhMap" and returns the FileNode.
+// lookupFuseFh finds the FileNode for handle "n", without taking a lock.
 std::shared_ptr<FileNode> EncFS_Context::lookupFuseFh(uint64_t n) {
-  Lock lock(contextMutex);
-  auto it = fuseFhMap.find(n);
-  if (it == fuseFhMap.end()) {
+  return fuseFhs.lookup(n);
+}
+
+FileNode *EncFS_Context::borrowFuseFh(uint64_t n) { return fuseFhs.borrow(n); }
+
+uint64_t EncFS_Context::putDirListing(
+    const std::shared_ptr<const DirListing> &listing) {
+  uint64_t fh = nextFuseFh();
+  Lock lock(contextMutex, Stats::ContextLock);
+  OpenDir &dir = openDirs[fh];
+  dir.listing = listing;
+  dir.read = false;
+  return fh;
+}
+
+std::shared_ptr<const DirListing> EncFS_Context::lookupDirListing(
+    uint64_t fh, bool *unread) {
+  Lock lock(contextMutex, Stats::ContextLock);
+  auto it = openDirs.find(fh);
+  if (it == openDirs.end()) {
+    *unread = false;
     return nullptr;
   }
-  return it->second;
+  *unread = !it->second.read;
+  it->second.read = true;
+  return it->second.listing;
+}
+
+void EncFS_Context::replaceDirListing(
+    uint64_t fh, const std::shared_ptr<const DirListing> &listing) {
+  Lock lock(contextMutex, Stats::ContextLock);
+  auto it = openDirs.find(fh);
+  if (it != openDirs.end()) {
+    it->second.listing = listing;
+    it->second.read = true;
+  }
+}
+
+void EncFS_Context::eraseDirListing(uint64_t fh) {
+  Lock lock(contextMutex, Stats::ContextLock);
+  openDirs.erase(fh);
 }
 
 }  // namespace encfs
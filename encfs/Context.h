@@ -23,19 +23,28 @@
 
 #include <algorithm>
 #include <atomic>
-#include <list>
 #include <memory>
 #include <pthread.h>
 #include <set>
 #include <string>
+#include <sys/statvfs.h>
 #include <unordered_map>
+#include <vector>
 
+#include "DirCache.h"
+#include "FileHandleTable.h"
+#include "FileReaper.h"
 #include "encfs.h"
 
 namespace encfs {
 
 class DirNode;
+class FairScheduler;
 class FileNode;
+class HotFiles;
+class KeepCache;
+class OpRecorder;
+class StatfsCache;
 struct EncFS_Args;
 struct EncFS_Opts;
 
@@ -45,12 +54,24 @@ class EncFS_Context {
   ~EncFS_Context();
 
   std::shared_ptr<FileNode> lookupNode(const char *path);
+  // one node of every open file
+  std::vector<std::shared_ptr<FileNode>> openNodes();
 
-  bool usageAndUnmount(int timeoutCycles);
+  // Unmount the filesystem if it has not been used for timeout seconds and
+  // no files are open.  Returns when to check again (in seconds of the
+  // monotonic clock), or -1 once the filesystem is unmounted.
+  int64_t unmountIfIdle(int timeout);
 
   void putNode(const char *path, const std::shared_ptr<FileNode> &node);
 
-  void eraseNode(const char *path, const std::shared_ptr<FileNode> &fnode);
+  // Returns true if this was the last reference to fnode
+  bool eraseNode(const char *path, const std::shared_ptr<FileNode> &fnode);
+
+  // Tear down fnode, released for the last time at path, in the background
+  // (see FileReaper).  fnode is left alone if the queue is full.
+  void retireNode(const char *path, std::shared_ptr<FileNode> &fnode);
+  // Return once no node released at path is still being torn down
+  void waitRetired(const char *path);
 
   void renameNode(const char *oldName, const char *newName);
 
@@ -58,46 +79,129 @@ class EncFS_Context {
   std::shared_ptr<DirNode> getRoot(int *err);
   std::shared_ptr<DirNode> getRoot(int *err, bool skipUsageCount);
 
+  // --asyncunlock: the root is made by a thread of its own while the
+  // filesystem is already mounted.  Until then getRoot() waits up to
+  // timeout seconds for it and fails with EAGAIN, and once the unlock
+  // failed with EACCES.  endUnlock() follows setRoot() with 0, or reports
+  // the failure with -errno.
+  void beginUnlock(int timeout);
+  void endUnlock(int err);
+  bool unlocking() const;
+
   std::shared_ptr<EncFS_Args> args;
   std::shared_ptr<EncFS_Opts> opts;
   bool publicFilesystem;
 
-  // root path to cipher dir
-  std::string rootCipherDir;
+  // root path to cipher dir, and the other backing directories of a
+  // striped volume
+  std::vector<std::string> rootCipherDirs;
+
+  // shares reads and writes between users, null unless --fairshare
+  std::shared_ptr<FairScheduler> scheduler;
 
-  // for idle monitor
-  bool running;
-  pthread_t monitorThread;
-  pthread_cond_t wakeupCond;
-  pthread_mutex_t wakeupMutex;
+  // whether open() lets the kernel keep a file's pages, null if disabled
+  std::shared_ptr<KeepCache> keepCache;
+
+  // the busiest backing files and users, null unless --hotfiles
+  std::shared_ptr<HotFiles> hotFiles;
+  std::shared_ptr<HotFiles> hotUsers;
+
+  // the trace the calls are recorded in, null unless --optrace
+  std::shared_ptr<OpRecorder> recorder;
 
   uint64_t nextFuseFh();
   std::shared_ptr<FileNode> lookupFuseFh(uint64_t);
+  // The node of a handle, for the duration of a request carrying it
+  FileNode *borrowFuseFh(uint64_t);
+
+  // Record a filesystem call for the idle monitor, as getRoot() does.  A
+  // call on an open file needs nothing else: the root can't be unmounted
+  // while files are open.
+  void markUsed();
+
+  // directory listings held from opendir() until releasedir(), so that
+  // readdir() can resume at an offset
+  uint64_t putDirListing(const std::shared_ptr<const DirListing> &listing);
+  // unread is set if this is the first lookup since the listing was stored
+  std::shared_ptr<const DirListing> lookupDirListing(uint64_t fh,
+                                                     bool *unread);
+  void replaceDirListing(uint64_t fh,
+                         const std::shared_ptr<const DirListing> &listing);
+  void eraseDirListing(uint64_t fh);
+
+  // statvfs of the cipher dir, for statfs, which works even if the
+  // filesystem is detached.  Returns 0 or -errno.
+  int statfs(struct statvfs *st);
 
  private:
-  /* This placeholder is what is referenced in FUSE context (passed to
-   * callbacks).
+  /* This is what is referenced in FUSE context (passed to callbacks).
    *
    * A FileNode may be opened many times, but only one FileNode instance per
-   * file is kept.  Rather then doing reference counting in FileNode, we
-   * store a unique Placeholder for each open() until the corresponding
-   * release() is called.  std::shared_ptr then does our reference counting for
-   * us.
+   * file is kept.  Each path maps to the nodes registered under it, each
+   * with the number of open()s not yet matched by a release(), so that a
+   * release finds its entry without walking one element per open.  More
+   * than one node per path only happens when opens race with a rename.
    */
-
-  using FileMap =
-      std::unordered_map<std::string, std::list<std::shared_ptr<FileNode>>>;
-
+  struct OpenFile {
+    std::shared_ptr<FileNode> node;
+    size_t count;
+  };
+  using FileMap = std::unordered_map<std::string, std::vector<OpenFile>>;
+
+  // The open files are split over shards by a hash of the path, so that
+  // FUSE threads working on different files rarely meet on a lock.  Lookups
+  // only take the shard's lock shared.
+  static const int ShardCount = 16;
+  struct Shard {
+    pthread_rwlock_t lock;
+    FileMap openFiles;
+  };
+  Shard &pathShard(const std::string &path);
+  size_t openFileCount();
+  // 0 once the unlock is done, -errno if it failed or took too long
+  int waitUnlocked();
+
+  Shard shards[ShardCount];
+  // paths in openFiles over all shards, so that lookups while nothing is
+  // open take no lock
+  std::atomic<size_t> openPaths;
+
+  // handles of the open FileNodes, looked up without a lock
+  FileHandleTable fuseFhs;
+
+  // protects openDirs and statfsCache
   mutable pthread_mutex_t contextMutex;
-  FileMap openFiles;
 
-  int usageCount;
-  int idleCount;
+  // protects root and isUnmounting, taken shared by getRoot()
+  mutable pthread_rwlock_t rootLock;
+
+  // seconds of the coarse monotonic clock at the last filesystem call.
+  // Only written when the second changes, with relaxed ordering, so that
+  // calls don't all write one cache line.
+  std::atomic<int64_t> lastUsed;
   bool isUnmounting;
   std::shared_ptr<DirNode> root;
 
+  enum UnlockState { UnlockNone, UnlockPending, UnlockFailed };
+  // read without the lock by getRoot() while the root is missing; changes
+  // under unlockMutex and signals unlocked
+  std::atomic<int> unlockState;
+  int unlockTimeout;
+  pthread_mutex_t unlockMutex;
+  pthread_cond_t unlocked;
+
   std::atomic<std::uint64_t> currentFuseFh;
-  std::unordered_map<uint64_t, std::shared_ptr<FileNode>> fuseFhMap;
+  struct OpenDir {
+    std::shared_ptr<const DirListing> listing;
+    bool read;
+  };
+  std::unordered_map<uint64_t, OpenDir> openDirs;
+
+  // set up by the first statfs, unless disabled (--statfscache)
+  std::shared_ptr<StatfsCache> statfsCache;
+
+  // after root, so that queued nodes are torn down before it goes
+  FileReaper reaper;
 };
 
 int remountFS(EncFS_Context *ctx);
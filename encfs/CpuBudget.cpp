@@ -0,0 +1,141 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CpuBudget.h"
+
+#include <algorithm>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Mutex.h"
+#include "Stats.h"
+
+namespace encfs {
+
+std::atomic<bool> CpuBudget::_enabled(false);
+
+namespace {
+
+// FUSE calls are only taken to be slowing down if they also take this much
+// longer, in ns
+const uint64_t MinRise = 100000;
+
+pthread_mutex_t budgetMutex = PTHREAD_MUTEX_INITIALIZER;
+double cores = 0;
+int64_t balance = 0;    // cpu ns left
+uint64_t refilled = 0;  // when the balance was last refilled
+
+// FUSE call latency, over the last few calls and over many
+std::atomic<uint64_t> recentLatency(0);
+std::atomic<uint64_t> usualLatency(0);
+
+// with budgetMutex held
+void refill() {
+  uint64_t now = Stats::now();
+  int64_t most = (int64_t)(CpuBudget::Burst * cores);
+  balance = std::min(most, balance + (int64_t)((now - refilled) * cores));
+  refilled = now;
+}
+
+}  // namespace
+
+void CpuBudget::setLimit(double limit) {
+  Lock lock(budgetMutex);
+  cores = std::max(limit, 0.0);
+  balance = (int64_t)(Burst * cores);
+  refilled = Stats::now();
+  recentLatency = 0;
+  usualLatency = 0;
+  _enabled = cores > 0;
+}
+
+double CpuBudget::limit() {
+  Lock lock(budgetMutex);
+  return cores;
+}
+
+bool CpuBudget::admit(bool counted) {
+  if (!enabled()) {
+    return true;
+  }
+  bool ok = !congested();
+  if (ok) {
+    Lock lock(budgetMutex);
+    refill();
+    ok = balance > 0;
+  }
+  if (!ok && counted) {
+    Stats::add(Stats::BackgroundDropped);
+  }
+  return ok;
+}
+
+bool CpuBudget::waitTurn(const std::atomic<bool> &stop) {
+  for (bool waited = false; !admit(false); waited = true) {
+    if (!waited) {
+      Stats::add(Stats::BackgroundDeferred);
+    }
+    if (stop) {
+      return false;
+    }
+    usleep(1000);
+  }
+  return !stop;
+}
+
+void CpuBudget::charge(uint64_t ns) {
+  if (!enabled()) {
+    return;
+  }
+  Stats::add(Stats::BackgroundCpuMicros, ns / 1000);
+  Lock lock(budgetMutex);
+  refill();
+  balance -= (int64_t)ns;
+}
+
+void CpuBudget::foreground(uint64_t ns) {
+  // races between calls lose a sample at most
+  uint64_t recent = recentLatency.load(std::memory_order_relaxed);
+  recentLatency.store(recent == 0 ? ns : recent - recent / 8 + ns / 8,
+                      std::memory_order_relaxed);
+  uint64_t usual = usualLatency.load(std::memory_order_relaxed);
+  usualLatency.store(usual == 0 ? ns : usual - usual / 1024 + ns / 1024,
+                     std::memory_order_relaxed);
+}
+
+bool CpuBudget::congested() {
+  uint64_t usual = usualLatency.load(std::memory_order_relaxed);
+  return usual != 0 &&
+         recentLatency.load(std::memory_order_relaxed) > 2 * usual + MinRise;
+}
+
+uint64_t CpuBudget::threadCpu() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+CpuBudget::Work::Work() : _start(enabled() ? threadCpu() : 0) {}
+
+CpuBudget::Work::~Work() {
+  if (_start != 0) {
+    charge(threadCpu() - _start);
+  }
+}
+
+}  // namespace encfs
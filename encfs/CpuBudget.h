@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CpuBudget_incl_
+#define _CpuBudget_incl_
+
+#include <atomic>
+#include <cstdint>
+
+namespace encfs {
+
+/*
+    The CPU time background work may take (--bgcpu), so that reading ahead,
+    walking ahead of a tree walk, compacting the IV journal and warming the
+    caches don't take it from the application using the mount.
+
+    Background work is charged the CPU time of the thread which does it
+    against a budget of a number of cores, refilled as time passes and
+    holding at most Burst of wall time at that rate.  Work is only started
+    while the budget isn't spent and the FUSE calls aren't slowing down:
+    while their recent latency is more than twice what it usually is, the
+    work backs off.  Optional work is dropped then (see
+    WorkerPool::trySubmit), and work which has to be done waits.
+
+    Process wide, like Stats.  Without a limit, nothing is charged or
+    timed.
+*/
+class CpuBudget {
+ public:
+  // wall time of the budget which may be saved up, in ns
+  static const uint64_t Burst = 100000000;
+
+  // Background work may take cores CPUs from now on, 0 for no limit
+  static void setLimit(double cores);
+  static double limit();
+  static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+  // Whether background work may start now.  If not and counted, the work
+  // counts as dropped.
+  static bool admit(bool counted = true);
+  // Wait for admit() unless stop is set meanwhile, which returns false.
+  // Counts as deferred if it waited.
+  static bool waitTurn(const std::atomic<bool> &stop);
+
+  // cpu ns taken by background work
+  static void charge(uint64_t ns);
+  // the latency of a FUSE call, in ns
+  static void foreground(uint64_t ns);
+  // whether FUSE calls are slower than they usually are
+  static bool congested();
+
+  // charges the CPU time of the thread while it exists
+  class Work {
+   public:
+    Work();
+    ~Work();
+
+    Work(const Work &src) = delete;
+    Work &operator=(const Work &src) = delete;
+
+   private:
+    uint64_t _start;
+  };
+
+  // the thread's CPU time, in ns
+  static uint64_t threadCpu();
+
+ private:
+  static std::atomic<bool> _enabled;
+};
+
+}  // namespace encfs
+
+#endif
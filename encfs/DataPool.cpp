@@ -0,0 +1,85 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "DataPool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// opcodes of the FUSE protocol
+static const uint32_t FuseRead = 15;
+static const uint32_t FuseWrite = 16;
+static const uint32_t FuseFsync = 20;
+static const uint32_t FuseFlush = 25;
+static const uint32_t FuseFallocate = 43;
+
+DataPool::DataPool(int threads) : _threads(std::max(threads, 1)), _running(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+DataPool::~DataPool() { pthread_mutex_destroy(&_mutex); }
+
+bool DataPool::isData(uint32_t opcode) {
+  return opcode == FuseRead || opcode == FuseWrite || opcode == FuseFsync ||
+         opcode == FuseFlush || opcode == FuseFallocate;
+}
+
+bool DataPool::enter(Request *req) {
+  Lock lock(_mutex);
+  if (_running < _threads) {
+    ++_running;
+    return true;
+  }
+
+  std::vector<char> spare;
+  if (!_spare.empty()) {
+    spare.swap(_spare.back());
+    _spare.pop_back();
+  }
+  _queue.push_back(std::move(*req));
+  req->buf.swap(spare);
+  return false;
+}
+
+bool DataPool::next(Request *req) {
+  Lock lock(_mutex);
+  if (_queue.empty()) {
+    --_running;
+    return false;
+  }
+
+  // the buffer just run is kept for the next request to be queued
+  _spare.push_back(std::move(req->buf));
+  *req = std::move(_queue.front());
+  _queue.pop_front();
+  return true;
+}
+
+int DataPool::running() const {
+  Lock lock(_mutex);
+  return _running;
+}
+
+size_t DataPool::queued() const {
+  Lock lock(_mutex);
+  return _queue.size();
+}
+
+}  // namespace encfs
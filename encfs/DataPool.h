@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _DataPool_incl_
+#define _DataPool_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <pthread.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    The share of the FUSE threads of --datathreads which runs reads and
+    writes.
+
+    With one set of threads for every request, a burst of large reads and
+    writes which wait on the lower file system and the cipher can take all
+    of them, and the getattr and lookup calls of an ls queue up behind.  The
+    FUSE loop then runs N more threads, and no more than N of its threads
+    are on data requests at once: a thread which reads a data request from
+    the device while N are busy queues it here and goes back to the device,
+    and a thread done with one runs the next queued one before it goes back.
+    The other threads are left to metadata, however much data is waiting,
+    and data requests run in the order they came in.
+
+    Requests are raw FUSE requests, as read from the device, with the
+    channel to answer on.  Buffers of queued requests are passed around
+    rather than copied, and recycled.
+*/
+class DataPool {
+ public:
+  struct Request {
+    std::vector<char> buf;
+    size_t size;
+    void *channel;
+  };
+
+  explicit DataPool(int threads);
+  ~DataPool();
+
+  DataPool(const DataPool &src) = delete;
+  DataPool &operator=(const DataPool &src) = delete;
+
+  // true for the opcodes which move file data (read, write, flush, fsync
+  // and fallocate)
+  static bool isData(uint32_t opcode);
+
+  // With the data request req: true if the calling thread is to run it
+  // now.  Otherwise req was queued, and req->buf holds a spare buffer,
+  // possibly empty.
+  bool enter(Request *req);
+
+  // After running a data request: true if req now holds the next one to
+  // run, false if the thread is done with data requests
+  bool next(Request *req);
+
+  // threads on data requests, and requests waiting for one
+  int running() const;
+  size_t queued() const;
+
+ private:
+  const int _threads;
+
+  mutable pthread_mutex_t _mutex;
+  int _running;
+  std::deque<Request> _queue;
+  std::vector<std::vector<char>> _spare;
+};
+
+}  // namespace encfs
+
+#endif
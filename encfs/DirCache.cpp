@@ -0,0 +1,129 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DirCache.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+DirCache::DirCache(size_t maxDirs) : _capacity(maxDirs), _limit(maxDirs) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+DirCache::~DirCache() {
+  while (!_index.empty()) {
+    drop(_index.begin());
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t DirCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+void DirCache::drop(DirMap::iterator it) {
+  EntryList::iterator entry = it->second;
+  _index.erase(it);
+  entry->dir.assign(entry->dir.length(), '\0');
+  _lru.erase(entry);
+}
+
+std::shared_ptr<const DirListing> DirCache::get(const std::string &dir,
+                                                const struct stat &st) {
+  Lock lock(_mutex);
+
+  auto it = _index.find(dir);
+  if (it == _index.end()) {
+    return std::shared_ptr<const DirListing>();
+  }
+
+  EntryList::iterator entry = it->second;
+  if (entry->ino != st.st_ino || entry->mtime != st.st_mtime ||
+      entry->ctime != st.st_ctime) {
+    drop(it);
+    return std::shared_ptr<const DirListing>();
+  }
+
+  _lru.splice(_lru.begin(), _lru, entry);
+  return entry->listing;
+}
+
+void DirCache::put(const std::string &dir, const struct stat &st,
+                   const std::shared_ptr<const DirListing> &listing) {
+  if (_capacity == 0) {
+    return;
+  }
+  // a change later in this second would leave the times unchanged
+  time_t now = time(nullptr);
+  if (st.st_mtime >= now || st.st_ctime >= now) {
+    return;
+  }
+
+  Lock lock(_mutex);
+
+  auto it = _index.find(dir);
+  if (it != _index.end()) {
+    drop(it);
+  }
+
+  _lru.push_front(Entry());
+  Entry &entry = _lru.front();
+  entry.dir = dir;
+  entry.ino = st.st_ino;
+  entry.mtime = st.st_mtime;
+  entry.ctime = st.st_ctime;
+  entry.listing = listing;
+  _index[dir] = _lru.begin();
+
+  while (_index.size() > _limit) {
+    drop(_index.find(std::prev(_lru.end())->dir));
+  }
+}
+
+void DirCache::setLimit(size_t limit) {
+  Lock lock(_mutex);
+  _limit = limit;
+  while (_index.size() > _limit) {
+    drop(_index.find(std::prev(_lru.end())->dir));
+  }
+}
+
+void DirCache::invalidate(const std::string &path) {
+  Lock lock(_mutex);
+
+  std::string prefix = path;
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/') {
+    prefix += '/';
+  }
+
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    drop(it);
+  }
+  for (it = _index.lower_bound(prefix);
+       it != _index.end() && it->first.compare(0, prefix.length(), prefix) == 0;) {
+    drop(it++);
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,110 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DirCache_incl_
+#define _DirCache_incl_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace encfs {
+
+// one decoded directory entry
+struct DirEntry {
+  DirEntry() : fileType(0), inode(0), iv(0) {}
+  DirEntry(const DirEntry &src) = default;
+  DirEntry &operator=(const DirEntry &src) = default;
+  ~DirEntry() {
+    name.assign(name.length(), '\0');
+    coded.assign(coded.length(), '\0');
+  }
+
+  std::string name;  // plaintext name
+  int fileType;      // d_type, or 0 if unknown
+  ino_t inode;
+  // only kept if asked for: the backing name, and the chained IV below it
+  std::string coded;
+  uint64_t iv;
+};
+using DirListing = std::vector<DirEntry>;
+
+/*
+    Bounded LRU cache of decoded directory listings, keyed by plaintext
+    directory path.
+
+    Each listing remembers the inode, mtime and ctime of the backing
+    directory when it was read, and is only returned while they still match.
+    Times have a resolution of one second, so listings of directories which
+    changed during the current second are not accepted by put().
+*/
+class DirCache {
+ public:
+  // maxDirs is the maximum number of listings held
+  explicit DirCache(size_t maxDirs);
+  ~DirCache();
+
+  DirCache(const DirCache &src) = delete;
+  DirCache &operator=(const DirCache &src) = delete;
+
+  // st is the current stat of the backing directory
+  std::shared_ptr<const DirListing> get(const std::string &dir,
+                                        const struct stat &st);
+
+  // st is the stat of the backing directory taken before it was read
+  void put(const std::string &dir, const struct stat &st,
+           const std::shared_ptr<const DirListing> &listing);
+
+  // drop the listing of path and of all directories below it
+  void invalidate(const std::string &path);
+
+  // Hold at most limit listings from now on, dropping the oldest ones.  The
+  // capacity stays what the cache was made with (see DirNode::tune).
+  void setLimit(size_t limit);
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string dir;
+    ino_t ino;
+    time_t mtime;
+    time_t ctime;
+    std::shared_ptr<const DirListing> listing;
+  };
+  using EntryList = std::list<Entry>;
+  using DirMap = std::map<std::string, EntryList::iterator>;
+
+  void drop(DirMap::iterator it);
+
+  const size_t _capacity;
+  size_t _limit;
+
+  mutable pthread_mutex_t _mutex;
+  EntryList _lru;  // most recently used first
+  DirMap _index;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,165 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DirFdCache.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Mutex.h"
+#include "config.h"
+
+#ifdef HAVE_STATX
+#include <sys/sysmacros.h>
+#endif
+
+#ifndef O_PATH
+#define O_PATH O_RDONLY
+#endif
+
+namespace encfs {
+
+DirFdCache::Dir::~Dir() { ::close(_fd); }
+
+DirFdCache::DirFdCache(size_t maxDirs) : _capacity(maxDirs), _generation(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+DirFdCache::~DirFdCache() { pthread_mutex_destroy(&_mutex); }
+
+size_t DirFdCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+std::shared_ptr<const DirFdCache::Dir> DirFdCache::get(
+    const std::string &dirPath) {
+  uint64_t generation;
+  {
+    Lock lock(_mutex);
+    auto it = _index.find(dirPath);
+    if (it != _index.end()) {
+      _lru.splice(_lru.begin(), _lru, it->second);
+      return it->second->dir;
+    }
+    generation = _generation;
+  }
+
+  int fd = ::open(dirPath.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::shared_ptr<const Dir> dir = std::make_shared<Dir>(fd);
+
+  Lock lock(_mutex);
+  if (generation != _generation) {
+    return dir;  // may be stale already, good for this call only
+  }
+  auto it = _index.find(dirPath);
+  if (it != _index.end()) {
+    return it->second->dir;  // opened by another thread meanwhile
+  }
+  _lru.push_front(Entry{dirPath, dir});
+  _index[dirPath] = _lru.begin();
+  while (_index.size() > _capacity) {
+    _index.erase(_lru.back().path);
+    _lru.pop_back();
+  }
+  return dir;
+}
+
+void DirFdCache::invalidate(const std::string &path) {
+  Lock lock(_mutex);
+  ++_generation;
+
+  auto it = _index.lower_bound(path);
+  while (it != _index.end() && it->first.compare(0, path.size(), path) == 0) {
+    // only path itself, and paths below it
+    if (it->first.size() == path.size() || it->first[path.size()] == '/') {
+      _lru.erase(it->second);
+      it = _index.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void DirFdCache::clear() {
+  Lock lock(_mutex);
+  ++_generation;
+  _index.clear();
+  _lru.clear();
+}
+
+AtPath::AtPath(DirFdCache *cache, const std::string &path)
+    : _dir(AT_FDCWD), _name(path.c_str()) {
+  if (cache == nullptr) {
+    return;
+  }
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash == 0 || slash + 1 == path.size()) {
+    return;
+  }
+  _hold = cache->get(path.substr(0, slash));
+  if (_hold) {
+    _dir = _hold->fd();
+    _name = path.c_str() + slash + 1;
+  }
+}
+
+#if defined(HAVE_STATX)
+void statFromStatx(const struct statx &stx, struct stat *st) {
+  memset(st, 0, sizeof(*st));
+  st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  st->st_ino = stx.stx_ino;
+  st->st_mode = stx.stx_mode;
+  st->st_nlink = stx.stx_nlink;
+  st->st_uid = stx.stx_uid;
+  st->st_gid = stx.stx_gid;
+  st->st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+  st->st_size = (off_t)stx.stx_size;
+  st->st_blksize = (blksize_t)stx.stx_blksize;
+  st->st_blocks = (blkcnt_t)stx.stx_blocks;
+  st->st_atim.tv_sec = stx.stx_atime.tv_sec;
+  st->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+  st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+}
+#endif
+
+int statAt(const AtPath &at, struct stat *st, bool relaxed, bool sizeOnly) {
+#if defined(HAVE_STATX) && defined(AT_STATX_DONT_SYNC)
+  if (relaxed) {
+    struct statx stx;
+    if (::statx(at.dir(), at.name(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                sizeOnly ? STATX_SIZE : STATX_BASIC_STATS, &stx) != 0) {
+      return -1;
+    }
+    statFromStatx(stx, st);
+    return 0;
+  }
+#else
+  (void)relaxed;
+  (void)sizeOnly;
+#endif
+  return ::fstatat(at.dir(), at.name(), st, AT_SYMLINK_NOFOLLOW);
+}
+
+}  // namespace encfs
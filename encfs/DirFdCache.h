@@ -0,0 +1,131 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DirFdCache_incl_
+#define _DirFdCache_incl_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+
+struct statx;
+
+namespace encfs {
+
+/*
+    Bounded LRU cache of open descriptors of backing directories, keyed by
+    their cipher path (see --dirfds).
+
+    Calls on a backing path make the kernel walk every component of it from
+    the root again, which adds up for deep trees and on network filesystems.
+    With a descriptor of the parent directory, the *at() calls only look up
+    the last component.  The descriptors are opened with O_PATH, and stay
+    open while a caller holds them, even if they were dropped in between.
+
+    A descriptor follows its directory when it is renamed, so renames and
+    removals of directories through the mount drop the cached descriptors of
+    the path and everything below it.  As with the other caches of backing
+    paths, changes made to the backing tree behind the mount's back aren't
+    seen.  Like AttrCache, a descriptor opened while something was dropped
+    isn't kept.
+*/
+class DirFdCache {
+ public:
+  // An open directory descriptor, closed when the last user lets go
+  class Dir {
+   public:
+    explicit Dir(int fd) : _fd(fd) {}
+    ~Dir();
+    Dir(const Dir &src) = delete;
+    Dir &operator=(const Dir &src) = delete;
+
+    int fd() const { return _fd; }
+
+   private:
+    int _fd;
+  };
+
+  explicit DirFdCache(size_t maxDirs);
+  ~DirFdCache();
+
+  DirFdCache(const DirFdCache &src) = delete;
+  DirFdCache &operator=(const DirFdCache &src) = delete;
+
+  // The directory at dirPath, or null if it can't be opened
+  std::shared_ptr<const Dir> get(const std::string &dirPath);
+
+  // path was renamed or removed, drop it and everything below it
+  void invalidate(const std::string &path);
+  void clear();
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string path;
+    std::shared_ptr<const Dir> dir;
+  };
+  using EntryList = std::list<Entry>;
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  uint64_t _generation;  // counts invalidations
+  EntryList _lru;        // most recently used first
+  std::map<std::string, EntryList::iterator> _index;
+};
+
+/*
+    Where a backing path is, for the *at() calls: relative to the cached
+    descriptor of its directory, or the path as it is (AT_FDCWD) if there is
+    no cache or the directory couldn't be opened.  path has to outlive it.
+*/
+class AtPath {
+ public:
+  AtPath(DirFdCache *cache, const std::string &path);
+
+  int dir() const { return _dir; }
+  const char *name() const { return _name; }
+
+ private:
+  std::shared_ptr<const DirFdCache::Dir> _hold;
+  int _dir;
+  const char *_name;
+};
+
+/*
+    fstatat(AT_SYMLINK_NOFOLLOW) of at, returning 0 or -1 with errno.
+
+    relaxed is for network filesystems (--netfs): where there is statx(),
+    they may answer from the attributes they have cached instead of asking
+    the server, and with sizeOnly only the size is asked for, the other
+    fields may then be left zero.
+*/
+int statAt(const AtPath &at, struct stat *st, bool relaxed,
+           bool sizeOnly = false);
+
+// the fields of a statx() result which struct stat has, where there is
+// statx()
+void statFromStatx(const struct statx &stx, struct stat *st);
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,500 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DirIndex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <unistd.h>
+#include <utility>
+
+#include "Cipher.h"
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+const char DirIndex::DirName[] = ".encfs6.index";
+
+/*
+    An index file is a magic string and a random nonce, followed by records.
+    Each record is its length (4 bytes), then the stream encoding, with IV
+    nonce ^ the record's offset, of a MAC of the body (8 bytes) and the body.
+    All numbers are big endian.  Bodies are
+      'S' stamp count(4) entry...            snapshot, always the first
+      'C' stamp count(4) name... flag(1) [entry]   changed()
+    where stamp is inode(8) mtime(8) ctime(8), an entry is fileType(1)
+    inode(8) name, and a name is its length (2) and bytes.  A record cut
+    short by a crash ends the file, which then doesn't match the directory.
+*/
+static const char IndexMagic[] = "EncFSDI1";
+static const size_t MagicSize = sizeof(IndexMagic) - 1;
+static const size_t PrefixSize = MagicSize + 8;  // magic and nonce
+static const size_t MacSize = 8;
+
+// changes appended before the snapshot is written again
+static const size_t MinChanges = 64;
+
+static void putNumber(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static void putString(std::string &out, const std::string &value) {
+  putNumber(out, value.size(), 2);
+  out.append(value);
+}
+
+static bool getNumber(const std::string &in, size_t &pos, uint64_t *value,
+                      int bytes) {
+  if (in.size() - pos < (size_t)bytes) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i) {
+    v = (v << 8) | (unsigned char)in[pos++];
+  }
+  *value = v;
+  return true;
+}
+
+static bool getString(const std::string &in, size_t &pos, std::string *value) {
+  uint64_t len = 0;
+  if (!getNumber(in, pos, &len, 2) || in.size() - pos < len) {
+    return false;
+  }
+  value->assign(in, pos, len);
+  pos += len;
+  return true;
+}
+
+static void putEntry(std::string &out, const DirEntry &entry) {
+  putNumber(out, entry.fileType, 1);
+  putNumber(out, entry.inode, 8);
+  putString(out, entry.name);
+}
+
+static bool getEntry(const std::string &in, size_t &pos, DirEntry *entry) {
+  uint64_t type = 0;
+  uint64_t inode = 0;
+  if (!getNumber(in, pos, &type, 1) || !getNumber(in, pos, &inode, 8) ||
+      !getString(in, pos, &entry->name)) {
+    return false;
+  }
+  entry->fileType = (int)type;
+  entry->inode = (ino_t)inode;
+  return true;
+}
+
+static bool writeAll(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t res = ::write(fd, data, len);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += res;
+    len -= res;
+  }
+  return true;
+}
+
+static void wipe(std::string &str) { str.assign(str.length(), '\0'); }
+
+DirIndex::DirIndex(const std::string &rootDir,
+                   const std::shared_ptr<Cipher> &cipher, const CipherKey &key,
+                   size_t minEntries)
+    : _dir(rootDir + DirName + '/'),
+      _cipher(cipher),
+      _key(key),
+      _minEntries(minEntries),
+      _haveDir(false) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+DirIndex::~DirIndex() { pthread_mutex_destroy(&_mutex); }
+
+DirIndex::Stamp DirIndex::stampOf(const struct stat &st) {
+  Stamp stamp;
+  stamp.inode = st.st_ino;
+#ifdef __APPLE__
+  stamp.mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+  stamp.ctime = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+  stamp.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  stamp.ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+  return stamp;
+}
+
+/*
+    Times with a fraction of a second come from a file system which keeps
+    them, and change with every change of the directory.  Whole seconds may
+    be all there is, and then a stamp of the current second can still be
+    changed without being told apart.
+*/
+bool DirIndex::settled(const struct stat &st) {
+  Stamp stamp = stampOf(st);
+  if (stamp.mtime % 1000000000LL != 0 || stamp.ctime % 1000000000LL != 0) {
+    return true;
+  }
+  time_t now = time(nullptr);
+  return st.st_mtime < now && st.st_ctime < now;
+}
+
+std::string DirIndex::pathOf(uint64_t inode) const {
+  unsigned char data[8];
+  for (int i = 0; i < 8; ++i) {
+    data[i] = (unsigned char)(inode >> (8 * i));
+  }
+  char name[17];
+  snprintf(name, sizeof(name), "%016llx",
+           (unsigned long long)_cipher->MAC_64(data, sizeof(data), _key));
+  return _dir + name;
+}
+
+std::string DirIndex::seal(const std::string &body, uint64_t iv) const {
+  std::string record;
+  putNumber(record, MacSize + body.size(), 4);
+  putNumber(record,
+            _cipher->MAC_64((const unsigned char *)body.data(),
+                            (int)body.size(), _key),
+            MacSize);
+  record.append(body);
+  if (!_cipher->streamEncode((unsigned char *)&record[4],
+                             (int)(record.size() - 4), iv, _key)) {
+    wipe(record);
+    return std::string();
+  }
+  return record;
+}
+
+// record is the encoded MAC and body, replaced by the body
+bool DirIndex::unseal(std::string *record, uint64_t iv) const {
+  if (record->size() < MacSize ||
+      !_cipher->streamDecode((unsigned char *)&(*record)[0],
+                             (int)record->size(), iv, _key)) {
+    return false;
+  }
+  size_t pos = 0;
+  uint64_t mac = 0;
+  getNumber(*record, pos, &mac, MacSize);
+  record->erase(0, MacSize);
+  return mac == _cipher->MAC_64((const unsigned char *)record->data(),
+                                (int)record->size(), _key);
+}
+
+bool DirIndex::sameStamp(const Stamp &a, const Stamp &b) {
+  return a.inode == b.inode && a.mtime == b.mtime && a.ctime == b.ctime;
+}
+
+/*
+    Replays the index file of inode into listing, sorted by name.  Returns
+    false if there is none, or it is damaged.
+*/
+bool DirIndex::load(uint64_t inode, DirListing *listing, Known *known) const {
+  int fd = ::open(pathOf(inode).c_str(), O_RDONLY | O_NOFOLLOW);
+  if (fd < 0) {
+    return false;
+  }
+  std::string data;
+  char buf[65536];
+  ssize_t res;
+  while ((res = ::pread(fd, buf, sizeof(buf), data.size())) > 0) {
+    data.append(buf, res);
+  }
+  ::close(fd);
+
+  size_t pos = 0;
+  uint64_t nonce = 0;
+  if (data.size() < PrefixSize ||
+      data.compare(0, MagicSize, IndexMagic) != 0) {
+    return false;
+  }
+  pos = MagicSize;
+  getNumber(data, pos, &nonce, 8);
+
+  std::map<std::string, DirEntry> entries;
+  bool haveSnapshot = false;
+  size_t changes = 0;
+  Stamp stamp = {0, 0, 0};
+  while (pos < data.size()) {
+    size_t start = pos;
+    uint64_t len = 0;
+    if (!getNumber(data, pos, &len, 4) || data.size() - pos < len) {
+      pos = start;  // cut short, appends go here
+      break;
+    }
+    std::string body = data.substr(pos, len);
+    pos += len;
+    if (!unseal(&body, nonce ^ start) || body.empty()) {
+      RLOG(WARNING) << "damaged directory index " << pathOf(inode);
+      wipe(body);
+      return false;
+    }
+
+    size_t bpos = 1;
+    uint64_t count = 0;
+    bool ok = getNumber(body, bpos, &stamp.inode, 8) &&
+              getNumber(body, bpos, (uint64_t *)&stamp.mtime, 8) &&
+              getNumber(body, bpos, (uint64_t *)&stamp.ctime, 8) &&
+              getNumber(body, bpos, &count, 4);
+    DirEntry entry;
+    if (ok && body[0] == 'S' && !haveSnapshot) {
+      haveSnapshot = true;
+      auto hint = entries.end();
+      for (uint64_t i = 0; ok && i < count; ++i) {
+        ok = getEntry(body, bpos, &entry);
+        if (ok) {
+          hint = entries.emplace_hint(hint, entry.name, entry);
+        }
+      }
+    } else if (ok && body[0] == 'C' && haveSnapshot) {
+      ++changes;
+      std::string name;
+      for (uint64_t i = 0; ok && i < count; ++i) {
+        ok = getString(body, bpos, &name);
+        if (ok) {
+          entries.erase(name);
+        }
+      }
+      wipe(name);
+      uint64_t added = 0;
+      ok = ok && getNumber(body, bpos, &added, 1);
+      if (ok && added != 0) {
+        ok = getEntry(body, bpos, &entry);
+        if (ok) {
+          entries[entry.name] = entry;
+        }
+      }
+    } else {
+      ok = false;
+    }
+    wipe(body);
+    if (!ok) {
+      RLOG(WARNING) << "damaged directory index " << pathOf(inode);
+      return false;
+    }
+  }
+  if (!haveSnapshot || stamp.inode != inode) {
+    return false;
+  }
+
+  listing->reserve(entries.size());
+  for (auto &it : entries) {
+    listing->push_back(it.second);
+  }
+  known->stamp = stamp;
+  known->nonce = nonce;
+  known->size = pos;
+  known->entries = entries.size();
+  known->changes = changes;
+  return true;
+}
+
+std::shared_ptr<const DirListing> DirIndex::get(const struct stat &st) {
+  Lock lock(_mutex);
+
+  std::shared_ptr<DirListing> listing = std::make_shared<DirListing>();
+  Known known;
+  if (!load(st.st_ino, listing.get(), &known)) {
+    _known.erase(st.st_ino);
+    return std::shared_ptr<const DirListing>();
+  }
+  if (!sameStamp(known.stamp, stampOf(st))) {
+    VLOG(1) << "directory index of inode " << st.st_ino << " is stale";
+    drop(st.st_ino);
+    return std::shared_ptr<const DirListing>();
+  }
+  _known[st.st_ino] = known;
+
+  if (known.changes > std::max(MinChanges, known.entries / 4)) {
+    writeSnapshot(known.stamp, *listing);
+  }
+  return listing;
+}
+
+void DirIndex::put(const struct stat &st, const DirListing &listing) {
+  Lock lock(_mutex);
+
+  if (listing.size() < _minEntries) {
+    if (_known.count(st.st_ino) != 0) {
+      drop(st.st_ino);
+    }
+    return;
+  }
+  if (!settled(st)) {
+    return;
+  }
+
+  // sorted by name, as load() returns them
+  std::vector<const DirEntry *> sorted;
+  sorted.reserve(listing.size());
+  for (const DirEntry &entry : listing) {
+    sorted.push_back(&entry);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const DirEntry *a, const DirEntry *b) {
+              return a->name < b->name;
+            });
+  DirListing ordered;
+  ordered.reserve(sorted.size());
+  for (const DirEntry *entry : sorted) {
+    ordered.push_back(*entry);
+  }
+  writeSnapshot(stampOf(st), ordered);
+}
+
+// a new file, renamed over the old one
+bool DirIndex::writeSnapshot(const Stamp &stamp, const DirListing &listing) {
+  if (!_haveDir) {
+    std::string dir = _dir.substr(0, _dir.length() - 1);
+    if (::mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+      RLOG(WARNING) << "unable to create " << dir << ": " << strerror(errno);
+      return false;
+    }
+    _haveDir = true;
+  }
+
+  Known known;
+  unsigned char nonce[8];
+  if (!_cipher->randomize(nonce, sizeof(nonce), false)) {
+    return false;
+  }
+  known.nonce = 0;
+  for (unsigned char byte : nonce) {
+    known.nonce = (known.nonce << 8) | byte;
+  }
+  known.stamp = stamp;
+  known.entries = listing.size();
+  known.changes = 0;
+
+  std::string body("S");
+  putNumber(body, stamp.inode, 8);
+  putNumber(body, stamp.mtime, 8);
+  putNumber(body, stamp.ctime, 8);
+  putNumber(body, listing.size(), 4);
+  for (const DirEntry &entry : listing) {
+    putEntry(body, entry);
+  }
+
+  std::string data(IndexMagic, MagicSize);
+  putNumber(data, known.nonce, 8);
+  std::string record = seal(body, known.nonce ^ data.size());
+  wipe(body);
+  if (record.empty()) {
+    return false;
+  }
+  data.append(record);
+  known.size = data.size();
+
+  std::string path = pathOf(stamp.inode);
+  std::string tmpPath = path + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+                  S_IRUSR | S_IWUSR);
+  bool ok = fd >= 0 && writeAll(fd, data.data(), data.size());
+  if (fd >= 0) {
+    ok = (::close(fd) == 0) && ok;
+  }
+  ok = ok && ::rename(tmpPath.c_str(), path.c_str()) == 0;
+  if (!ok) {
+    RLOG(WARNING) << "unable to write directory index " << path << ": "
+                  << strerror(errno);
+    ::unlink(tmpPath.c_str());
+    _known.erase(stamp.inode);
+    return false;
+  }
+  VLOG(1) << "indexed " << listing.size() << " entries of inode "
+          << stamp.inode;
+  _known[stamp.inode] = known;
+  return true;
+}
+
+bool DirIndex::known(const struct stat &st) const {
+  Lock lock(_mutex);
+  return _known.count(st.st_ino) != 0;
+}
+
+void DirIndex::changed(const struct stat &before, const struct stat &after,
+                       const std::vector<std::string> &removed,
+                       const DirEntry *added) {
+  Lock lock(_mutex);
+
+  auto it = _known.find(before.st_ino);
+  if (it == _known.end()) {
+    return;
+  }
+  Known &known = it->second;
+  if (after.st_ino != before.st_ino ||
+      !sameStamp(known.stamp, stampOf(before)) || !settled(after)) {
+    drop(before.st_ino);
+    return;
+  }
+
+  Stamp stamp = stampOf(after);
+  std::string body("C");
+  putNumber(body, stamp.inode, 8);
+  putNumber(body, stamp.mtime, 8);
+  putNumber(body, stamp.ctime, 8);
+  putNumber(body, removed.size(), 4);
+  for (const std::string &name : removed) {
+    putString(body, name);
+  }
+  putNumber(body, added != nullptr ? 1 : 0, 1);
+  if (added != nullptr) {
+    putEntry(body, *added);
+  }
+  std::string record = seal(body, known.nonce ^ (uint64_t)known.size);
+  wipe(body);
+
+  std::string path = pathOf(before.st_ino);
+  int fd = ::open(path.c_str(), O_WRONLY | O_NOFOLLOW);
+  // a failed append leaves a stamp behind which no longer matches
+  bool ok = !record.empty() && fd >= 0 &&
+            ::lseek(fd, known.size, SEEK_SET) == known.size &&
+            writeAll(fd, record.data(), record.size());
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  if (!ok) {
+    drop(before.st_ino);
+    return;
+  }
+  known.stamp = stamp;
+  known.size += record.size();
+  ++known.changes;
+}
+
+void DirIndex::erase(ino_t inode) {
+  Lock lock(_mutex);
+  drop(inode);
+}
+
+void DirIndex::drop(uint64_t inode) {
+  _known.erase(inode);
+  ::unlink(pathOf(inode).c_str());
+}
+
+}  // namespace encfs
@@ -0,0 +1,132 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DirIndex_incl_
+#define _DirIndex_incl_
+
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include "CipherKey.h"
+#include "DirCache.h"
+
+namespace encfs {
+
+class Cipher;
+
+/*
+    Decoded listings of large directories, kept on disk (--dirindex).
+
+    Decoding a directory of a million names takes seconds, and DirCache
+    starts out empty on every mount.  The listing of each directory with at
+    least minEntries entries is written to an index file, encrypted with the
+    volume key, so that it can be served after a remount without decoding a
+    single name.
+
+    The index files live in a directory next to the config file and are
+    named after a MAC of the directory's inode, so they follow renames and
+    reveal nothing about the names.  A file starts with a snapshot of the
+    listing, followed by the changes made through the mount since, each
+    appended as it happens.  Every record carries the stamp (inode, mtime
+    and ctime) of the directory just after it, and an index is only used
+    while its last stamp matches the directory.  A change is only appended
+    if the index was current just before it, otherwise the index is dropped
+    and written again by the next listing.  On file systems which keep times
+    in whole seconds, stamps of the current second aren't trusted, as for
+    DirCache.
+*/
+class DirIndex {
+ public:
+  // name of the directory of index files, next to the config file
+  static const char DirName[];
+
+  // rootDir ends with a '/'
+  DirIndex(const std::string &rootDir, const std::shared_ptr<Cipher> &cipher,
+           const CipherKey &key, size_t minEntries);
+  ~DirIndex();
+
+  DirIndex(const DirIndex &src) = delete;
+  DirIndex &operator=(const DirIndex &src) = delete;
+
+  size_t minEntries() const { return _minEntries; }
+
+  // The listing of the directory with stat st, if its index is current
+  std::shared_ptr<const DirListing> get(const struct stat &st);
+
+  // Store the listing read from the directory, if it is large enough.  st
+  // was taken before the directory was read.
+  void put(const struct stat &st, const DirListing &listing);
+
+  // True if the directory with stat st may have an index, which is worth
+  // keeping up to date with changed()
+  bool known(const struct stat &st) const;
+
+  // The names in removed were taken out of the directory, and then added (if
+  // not null) was put in.  before is the stat of the directory just before
+  // the change, after the one just after it.
+  void changed(const struct stat &before, const struct stat &after,
+               const std::vector<std::string> &removed,
+               const DirEntry *added);
+
+  // the directory is gone
+  void erase(ino_t inode);
+
+ private:
+  struct Stamp {
+    uint64_t inode;
+    int64_t mtime;  // nanoseconds
+    int64_t ctime;
+  };
+  // what is known of an index file, by directory inode
+  struct Known {
+    Stamp stamp;
+    uint64_t nonce;   // IVs of the records are nonce ^ their offset
+    off_t size;       // of the file
+    size_t entries;   // in the listing
+    size_t changes;   // appended since the snapshot
+  };
+
+  static Stamp stampOf(const struct stat &st);
+  static bool sameStamp(const Stamp &a, const Stamp &b);
+  static bool settled(const struct stat &st);
+
+  std::string pathOf(uint64_t inode) const;
+  std::string seal(const std::string &body, uint64_t iv) const;
+  bool unseal(std::string *record, uint64_t iv) const;
+  bool load(uint64_t inode, DirListing *listing, Known *known) const;
+  bool writeSnapshot(const Stamp &stamp, const DirListing &listing);
+  void drop(uint64_t inode);
+
+  const std::string _dir;
+  std::shared_ptr<Cipher> _cipher;
+  CipherKey _key;
+  const size_t _minEntries;
+
+  mutable pthread_mutex_t _mutex;
+  bool _haveDir;
+  std::unordered_map<uint64_t, Known> _known;
+};
+
+}  // namespace encfs
+
+#endif
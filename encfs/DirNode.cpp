@@ -20,26 +20,48 @@
 
 #include "DirNode.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <climits>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #ifdef __linux__
+#include <linux/fs.h>
 #include <sys/fsuid.h>
+#include <sys/ioctl.h>
 #endif
+#include <fcntl.h>
+#include <iterator>
 #include <pthread.h>
+#include <sched.h>
+#include <sstream>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <utility>
 #include <utime.h>
 
 #include "Context.h"
+#include "CpuBudget.h"
+#include "DirFdCache.h"
 #include "Error.h"
 #include "FSConfig.h"
 #include "FileNode.h"
 #include "FileUtils.h"
+#include "HotFiles.h"
+#include "IVJournal.h"
+#include "IntentLog.h"
+#include "MemoryPressure.h"
 #include "Mutex.h"
 #include "NameIO.h"
+#include "Policies.h"
+#include "StatBatch.h"
+#include "Stripes.h"
+#include "WorkerPool.h"
+#include "config.h"
 #include "easylogging++.h"
 
 using namespace std;
@@ -53,22 +75,59 @@ class DirDeleter {
 
 DirTraverse::DirTraverse(std::shared_ptr<DIR> _dirPtr, uint64_t _iv,
                          std::shared_ptr<NameIO> _naming, bool _root)
-    : dir(std::move(_dirPtr)), iv(_iv), naming(std::move(_naming)), root(_root) {}
+    : dir(std::move(_dirPtr)),
+      iv(_iv),
+      naming(std::move(_naming)),
+      root(_root),
+      inStripe(false) {}
+
+void DirTraverse::addStripe(std::shared_ptr<DIR> stripe) {
+  stripes.push_back(std::move(stripe));
+}
+
+DirTraverse::DirTraverse(const DirTraverse &src) = default;
 
 DirTraverse &DirTraverse::operator=(const DirTraverse &src) = default;
 
 DirTraverse::~DirTraverse() {
   dir.reset();
+  stripes.clear();
   iv = 0;
   naming.reset();
   root = false;
 }
 
-static bool _nextName(struct dirent *&de, const std::shared_ptr<DIR> &dir,
-                      int *fileType, ino_t *inode) {
-  de = ::readdir(dir.get());
+bool DirTraverse::nextName(struct dirent *&de, int *fileType, ino_t *inode) {
+  for (;;) {
+    de = ::readdir(dir.get());
+    if (de == nullptr) {
+      if (stripes.empty()) {
+        break;
+      }
+      dir = stripes.front();
+      stripes.erase(stripes.begin());
+      inStripe = true;
+      continue;
+    }
+
+    int type = 0;
+#if defined(HAVE_DIRENT_D_TYPE)
+    type = de->d_type;
+#endif
+    if (inStripe) {
+      // directories are the same in all copies, . and .. included
+      struct stat st;
+      if (type == 0 || type == DT_UNKNOWN) {
+        if (fstatat(dirfd(dir.get()), de->d_name, &st,
+                    AT_SYMLINK_NOFOLLOW) == 0) {
+          type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+      }
+      if (type == DT_DIR) {
+        continue;
+      }
+    }
 
-  if (de != nullptr) {
     if (fileType != nullptr) {
 #if defined(HAVE_DIRENT_D_TYPE)
       *fileType = de->d_type;
@@ -88,10 +147,25 @@ static bool _nextName(struct dirent *&de, const std::shared_ptr<DIR> &dir,
   return false;
 }
 
+// files of our own in the root of the backing directory
+// the last component of a path
+static string baseName(const char *path) {
+  const char *name = strrchr(path, '/');
+  return (name != nullptr) ? name + 1 : path;
+}
+
+static bool isReservedName(const char *name) {
+  return strcmp(".encfs6.xml", name) == 0 ||
+         strcmp(IVJournal::FileName, name) == 0 ||
+         strcmp(DirIndex::DirName, name) == 0 ||
+         strcmp(WarmCache::FileName, name) == 0 ||
+         strcmp(Stripes::FileName, name) == 0;
+}
+
 std::string DirTraverse::nextPlaintextName(int *fileType, ino_t *inode) {
   struct dirent *de = nullptr;
-  while (_nextName(de, dir, fileType, inode)) {
-    if (root && (strcmp(".encfs6.xml", de->d_name) == 0)) {
+  while (nextName(de, fileType, inode)) {
+    if (root && isReservedName(de->d_name)) {
       VLOG(1) << "skipping filename: " << de->d_name;
       continue;
     }
@@ -107,11 +181,78 @@ std::string DirTraverse::nextPlaintextName(int *fileType, ino_t *inode) {
   return string();
 }
 
+// names decoded per parallelFor index
+static const size_t DecodeGroup = 64;
+
+size_t DirTraverse::nextPlaintextNames(DirListing *listing,
+                                       WorkerPool *workers, bool keepCoded) {
+  // read the whole batch first, the names are decoded in place
+  DirListing batch;
+  batch.reserve(BatchSize);
+  struct dirent *de = nullptr;
+  DirEntry entry;
+  while (batch.size() < BatchSize &&
+         nextName(de, &entry.fileType, &entry.inode)) {
+    if (root && isReservedName(de->d_name)) {
+      VLOG(1) << "skipping filename: " << de->d_name;
+      continue;
+    }
+    entry.name = de->d_name;
+    batch.push_back(entry);
+  }
+  if (batch.empty()) {
+    return 0;
+  }
+
+  std::vector<char> decoded(batch.size(), 0);
+  auto decodeGroup = [&](size_t group) {
+    size_t end = std::min(batch.size(), (group + 1) * DecodeGroup);
+    char plain[PATH_MAX];
+    for (size_t i = group * DecodeGroup; i < end; ++i) {
+      try {
+        uint64_t localIv = iv;
+        int len = naming->decodePathInto(batch[i].name.c_str(), plain,
+                                         sizeof(plain), &localIv);
+        if (len >= 0) {
+          if (keepCoded) {
+            batch[i].coded = batch[i].name;
+            batch[i].iv = localIv;
+          }
+          batch[i].name.assign(plain, len);
+          decoded[i] = 1;
+        }
+      } catch (encfs::Error &ex) {
+        // left undecoded, logged below
+      }
+    }
+    memset(plain, 0, sizeof(plain));
+  };
+
+  size_t groups = (batch.size() + DecodeGroup - 1) / DecodeGroup;
+  if (workers != nullptr && groups > 1) {
+    workers->parallelFor(groups, decodeGroup);
+  } else {
+    for (size_t group = 0; group < groups; ++group) {
+      decodeGroup(group);
+    }
+  }
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (decoded[i] != 0) {
+      listing->push_back(batch[i]);
+    } else {
+      // .. .problem decoding, ignore it and continue on to next name..
+      VLOG(1) << "error decoding filename: " << batch[i].name;
+    }
+  }
+  return batch.size();
+}
+
 std::string DirTraverse::nextInvalid() {
   struct dirent *de = nullptr;
   // find the first name which produces a decoding error...
-  while (_nextName(de, dir, (int *)nullptr, (ino_t *)nullptr)) {
-    if (root && (strcmp(".encfs6.xml", de->d_name) == 0)) {
+  while (nextName(de, (int *)nullptr, (ino_t *)nullptr)) {
+    if (root && isReservedName(de->d_name)) {
       VLOG(1) << "skipping filename: " << de->d_name;
       continue;
     }
@@ -137,19 +278,45 @@ struct RenameEl {
   string newPName;
 
   bool isDirectory;
+  bool stripeCopy;  // a copy of a striped directory, which has no node
 };
 
+// a backing file or directory was renamed, tell the IV journal
+static void journalMoved(const FSConfigPtr &cfg, const string &from,
+                         const string &to) {
+  if (cfg->ivJournal) {
+    cfg->ivJournal->moved(from, to);
+  }
+}
+
+// the backing file st is gone, its header no longer needs rewriting
+static void journalForget(const FSConfigPtr &cfg, const struct stat &st) {
+  IVJournal *journal = cfg->ivJournal.get();
+  if (journal != nullptr && !journal->empty() && S_ISREG(st.st_mode) &&
+      st.st_nlink <= 1) {
+    Lock lock(journal->mutex());
+    journal->remove(st);
+  }
+}
+
 class RenameOp {
  private:
   DirNode *dn;
-  std::shared_ptr<list<RenameEl> > renameList;
-  list<RenameEl>::const_iterator last;
+  // deepest level first, see DirNode::genRenameList
+  std::shared_ptr<vector<RenameEl> > renameList;
+  vector<size_t> levels;
+  // entries renamed so far, undo() puts them back
+  vector<char> applied;
+
+  bool applyOne(const RenameEl &ren);
 
  public:
-  RenameOp(DirNode *_dn, std::shared_ptr<list<RenameEl> > _renameList)
-      : dn(_dn), renameList(std::move(_renameList)) {
-    last = renameList->begin();
-  }
+  RenameOp(DirNode *_dn, std::shared_ptr<vector<RenameEl> > _renameList,
+           vector<size_t> _levels)
+      : dn(_dn),
+        renameList(std::move(_renameList)),
+        levels(std::move(_levels)),
+        applied(renameList->size(), 0) {}
 
   // destructor
   ~RenameOp();
@@ -161,105 +328,853 @@ class RenameOp {
 
   explicit operator bool() const { return renameList != nullptr; }
 
-  bool apply();
+  // Renames one level at a time, the entries of a level in parallel on
+  // workers (if not null).  Doesn't need DirNode::mutex, as long as the
+  // subtrees are reserved in DirNode::renaming.
+  bool apply(WorkerPool *workers);
+  // must hold DirNode::mutex
   void undo();
 };
 
+// renames between progress reports
+static const size_t RenameProgress = 10000;
+
 RenameOp::~RenameOp() {
   if (renameList) {
     // got a bunch of decoded filenames sitting in memory..  do a little
     // cleanup before leaving..
-    list<RenameEl>::iterator it;
-    for (it = renameList->begin(); it != renameList->end(); ++it) {
-      it->oldPName.assign(it->oldPName.size(), ' ');
-      it->newPName.assign(it->newPName.size(), ' ');
+    for (RenameEl &ren : *renameList) {
+      ren.oldPName.assign(ren.oldPName.size(), ' ');
+      ren.newPName.assign(ren.newPName.size(), ' ');
     }
   }
 }
 
-bool RenameOp::apply() {
-  try {
-    while (last != renameList->end()) {
-      // backing store rename.
-      VLOG(1) << "renaming " << last->oldCName << " -> " << last->newCName;
+bool RenameOp::applyOne(const RenameEl &ren) {
+  // backing store rename.
+  VLOG(1) << "renaming " << ren.oldCName << " -> " << ren.newCName;
 
-      struct stat st;
-      bool preserve_mtime = ::stat(last->oldCName.c_str(), &st) == 0;
+  struct stat st;
+  bool preserve_mtime = ::stat(ren.oldCName.c_str(), &st) == 0;
 
-      // internal node rename..
-      dn->renameNode(last->oldPName.c_str(), last->newPName.c_str());
+  DirFdCache *dirFds = dn->fsConfig->dirFds.get();
+  if (ren.stripeCopy) {
+    if (::rename(ren.oldCName.c_str(), ren.newCName.c_str()) == -1) {
+      int eno = errno;
+      RLOG(WARNING) << "Error renaming " << ren.oldCName << ": "
+                    << strerror(eno);
+      return false;
+    }
+    journalMoved(dn->fsConfig, ren.oldCName, ren.newCName);
+    if (dirFds != nullptr) {
+      dirFds->invalidate(ren.oldCName);
+    }
+    return true;
+  }
 
-      // rename on disk..
-      if (::rename(last->oldCName.c_str(), last->newCName.c_str()) == -1) {
-        int eno = errno;
-        RLOG(WARNING) << "Error renaming " << last->oldCName << ": "
-                      << strerror(eno);
-        dn->renameNode(last->newPName.c_str(), last->oldPName.c_str(), false);
-        return false;
-      }
+  // internal node rename..  Only the lookup needs the lock, nobody else
+  // gets at nodes in the reserved subtrees.
+  std::shared_ptr<FileNode> node;
+  {
+    Lock _lock(dn->mutex, Stats::DirNodeLock);
+    node = dn->findOrCreate(ren.oldPName.c_str());
+  }
+  dn->renameFileNode(node, ren.oldPName.c_str(), ren.newPName.c_str(), true);
 
-      if (preserve_mtime) {
-        struct utimbuf ut;
-        ut.actime = st.st_atime;
-        ut.modtime = st.st_mtime;
-        ::utime(last->newCName.c_str(), &ut);
-      }
+  // rename on disk..
+  AtPath from(dirFds, ren.oldCName);
+  AtPath to(dirFds, ren.newCName);
+  if (::renameat(from.dir(), from.name(), to.dir(), to.name()) == -1) {
+    int eno = errno;
+    RLOG(WARNING) << "Error renaming " << ren.oldCName << ": "
+                  << strerror(eno);
+    dn->renameFileNode(node, ren.newPName.c_str(), ren.oldPName.c_str(),
+                       false);
+    return false;
+  }
 
-      ++last;
+  journalMoved(dn->fsConfig, ren.oldCName, ren.newCName);
+  if (dirFds != nullptr) {
+    dirFds->invalidate(ren.oldCName);
+  }
+  dn->invalidatePath(ren.oldPName.c_str());
+
+  if (preserve_mtime) {
+    struct utimbuf ut;
+    ut.actime = st.st_atime;
+    ut.modtime = st.st_mtime;
+    ::utime(ren.newCName.c_str(), &ut);
+  }
+  return true;
+}
+
+bool RenameOp::apply(WorkerPool *workers) {
+  std::atomic<bool> failed(false);
+  std::atomic<size_t> done(0);
+  size_t total = renameList->size();
+
+  auto renameOne = [&](size_t i) {
+    if (failed) {
+      return;
+    }
+    try {
+      if (applyOne((*renameList)[i])) {
+        applied[i] = 1;
+      } else {
+        failed = true;
+      }
+    } catch (encfs::Error &err) {
+      RLOG(WARNING) << err.what();
+      failed = true;
     }
+    size_t count = ++done;
+    if (count % RenameProgress == 0) {
+      RLOG(INFO) << "recursive rename: " << count << " of " << total
+                 << " entries renamed";
+    }
+  };
 
-    return true;
-  } catch (encfs::Error &err) {
-    RLOG(WARNING) << err.what();
-    return false;
+  // the entries of a level are in different directories, or have
+  // different names in the same one, so any order works within a level
+  for (size_t level = 0; level + 1 < levels.size(); ++level) {
+    size_t begin = levels[level];
+    size_t count = levels[level + 1] - begin;
+    if (workers != nullptr && count > 1) {
+      workers->parallelFor(count, [&](size_t i) { renameOne(begin + i); });
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        renameOne(begin + i);
+      }
+    }
+    if (failed) {
+      return false;
+    }
   }
+  return true;
 }
 
 void RenameOp::undo() {
   VLOG(1) << "in undoRename";
 
-  if (last == renameList->begin()) {
-    VLOG(1) << "nothing to undo";
-    return;  // nothing to undo
-  }
-
   // list has to be processed backwards, otherwise we may rename
   // directories and directory contents in the wrong order!
   int undoCount = 0;
-  auto it = last;
-
-  while (it != renameList->begin()) {
-    --it;
+  for (size_t i = renameList->size(); i-- > 0;) {
+    if (applied[i] == 0) {
+      continue;
+    }
+    const RenameEl &ren = (*renameList)[i];
 
-    VLOG(1) << "undo: renaming " << it->newCName << " -> " << it->oldCName;
+    VLOG(1) << "undo: renaming " << ren.newCName << " -> " << ren.oldCName;
 
-    ::rename(it->newCName.c_str(), it->oldCName.c_str());
+    if (::rename(ren.newCName.c_str(), ren.oldCName.c_str()) == 0) {
+      journalMoved(dn->fsConfig, ren.newCName, ren.oldCName);
+    }
+    if (dn->fsConfig->dirFds) {
+      dn->fsConfig->dirFds->invalidate(ren.newCName);
+    }
+    if (ren.stripeCopy) {
+      applied[i] = 0;
+      continue;
+    }
+    dn->invalidatePath(ren.newPName.c_str());
     try {
-      dn->renameNode(it->newPName.c_str(), it->oldPName.c_str(), false);
+      dn->renameNode(ren.newPName.c_str(), ren.oldPName.c_str(), false);
     } catch (encfs::Error &err) {
       RLOG(WARNING) << err.what();
       // continue on anyway...
     }
+    applied[i] = 0;
     ++undoCount;
   };
 
+  if (undoCount == 0) {
+    VLOG(1) << "nothing to undo";
+    return;  // nothing to undo
+  }
   RLOG(WARNING) << "Undo rename count: " << undoCount;
 }
 
+// released files kept open for the next open, each holds a descriptor
+static const size_t MaxClosedNodes = 64;
+static const int KeepClosedMs = 5000;
+
 DirNode::DirNode(EncFS_Context *_ctx, const string &sourceDir,
                  const FSConfigPtr &_config) {
   pthread_mutex_init(&mutex, nullptr);
+  pthread_cond_init(&renameDone, nullptr);
+  pthread_mutex_init(&tuneMutex, nullptr);
+  renameEpoch = 0;
+  renamesActive = 0;
+  unlockedOps = 0;
 
-  Lock _lock(mutex);
+  Lock _lock(mutex, Stats::DirNodeLock);
 
   ctx = _ctx;
   rootDir = sourceDir;  // .. and fsConfig->opts->mountPoint have trailing slash
   fsConfig = _config;
+  stripes = fsConfig->stripes;
+  relaxedStat = fsConfig->opts && fsConfig->opts->netfsTimeout > 0;
 
   naming = fsConfig->nameCoding;
+
+  int cacheSize = fsConfig->opts ? fsConfig->opts->pathCacheSize : 0;
+  if (cacheSize > 0) {
+    // names stored as they are cost less to copy than to look up
+    if (!naming || !naming->identity()) {
+      cipherCache.reset(new PathCache(cacheSize));
+      plainCache.reset(new PathCache(cacheSize));
+    }
+    if (!fsConfig->opts->noCache) {
+      linkCache.reset(new LinkCache(cacheSize));
+    }
+  }
+
+  // listings are kept by the times of the directory, which a striped volume
+  // has several copies of
+  cacheSize = fsConfig->opts ? fsConfig->opts->dirCacheSize : 0;
+  if (cacheSize > 0 && !fsConfig->opts->noCache && !stripes) {
+    dirCache.reset(new DirCache(cacheSize));
+  }
+
+  // in reverse mode the backing directory is the plaintext
+  cacheSize = fsConfig->opts ? fsConfig->opts->dirIndexSize : 0;
+  if (cacheSize > 0 && !fsConfig->opts->noCache &&
+      !fsConfig->reverseEncryption && !stripes) {
+    dirIndex.reset(
+        new DirIndex(rootDir, fsConfig->cipher, fsConfig->key, cacheSize));
+  }
+
+  // in reverse mode the backing files are changed behind our back, unless
+  // the watcher tells us (--watch)
+  bool followed = fsConfig->opts && !fsConfig->opts->noCache &&
+                  (!fsConfig->reverseEncryption || fsConfig->opts->watchBacking);
+  cacheSize = fsConfig->opts ? fsConfig->opts->negativeCacheSize : 0;
+  if (cacheSize > 0 && followed) {
+    missingCache.reset(new NegativeCache(cacheSize));
+  }
+
+  cacheSize = fsConfig->opts ? fsConfig->opts->attrCacheSize : 0;
+  if (cacheSize > 0 && followed) {
+    // a network rootDir is trusted for as long as the kernel keeps them
+    attrCache.reset(new AttrCache(
+        cacheSize, relaxedStat ? fsConfig->opts->netfsTimeout
+                               : AttrCache::Timeout));
+  }
+
+  cacheSize = fsConfig->opts ? fsConfig->opts->xattrCacheSize : 0;
+  if (cacheSize > 0 && followed) {
+    xattrCache.reset(new XattrCache(cacheSize));
+  }
+
+  if (followed) {
+    closedNodes.reset(new FileNodePool(MaxClosedNodes, KeepClosedMs));
+  }
+
+  // in reverse mode the backing paths are the plaintext
+  if (cipherCache && fsConfig->opts->warmCache &&
+      !fsConfig->reverseEncryption) {
+    warmCache.reset(new WarmCache(rootDir, fsConfig->cipher, fsConfig->key));
+  }
+
+  // listing ahead is only of use with listings to keep
+  cacheSize = fsConfig->opts ? fsConfig->opts->walkAhead : 0;
+  if (cacheSize > 0 && dirCache && fsConfig->workers) {
+    treeWalk.reset(new TreeWalk(cacheSize));
+  }
+
+  pathCacheSize = cipherCache ? cipherCache->capacity() : 0;
+  dirCacheSize = dirCache ? dirCache->capacity() : 0;
+  attrCacheSize = attrCache ? attrCache->capacity() : 0;
+  blockCacheSize = fsConfig->blockCache ? fsConfig->blockCache->capacity() : 0;
+  cacheShare = 1.0;
+
+  if (fsConfig->memoryPressure) {
+    pressureWatch = fsConfig->memoryPressure->watch(
+        [this](double share) { shrinkCaches(share); });
+  }
+}
+
+DirNode::~DirNode() {
+  // listings ahead run on the workers, through this node
+  if (treeWalk) {
+    treeWalk->stop();
+  }
+  // the last checkpoint flushes through this node
+  if (fsConfig->intentLog) {
+    fsConfig->intentLog->stop();
+  }
+  if (warmCache) {
+    warmCache->stop();
+    if (!fsConfig->opts->readOnly) {
+      warmCache->save(cipherCache->recentCoded(pathCacheSize));
+    }
+  }
+  // its callback uses the mutex
+  watcher.reset();
+  pressureWatch.reset();
+  pthread_mutex_destroy(&tuneMutex);
+  pthread_cond_destroy(&renameDone);
+  pthread_mutex_destroy(&mutex);
+}
+
+void DirNode::shrinkCaches(double share) {
+  Lock lock(tuneMutex);
+  cacheShare = share;
+  resizeCaches();
+}
+
+void DirNode::resizeCaches() {
+  double share = cacheShare;
+  auto limit = [share](size_t size) {
+    return std::max((size_t)(size * share), (size_t)1);
+  };
+  if (cipherCache) {
+    cipherCache->setLimit(limit(pathCacheSize));
+    plainCache->setLimit(limit(pathCacheSize));
+  }
+  if (dirCache) {
+    dirCache->setLimit(limit(dirCacheSize));
+  }
+  if (attrCache) {
+    attrCache->setLimit(limit(attrCacheSize));
+  }
+  // shared by the volumes of encfs --serve, which all set the same limit
+  if (fsConfig->blockCache) {
+    fsConfig->blockCache->setLimit(limit(blockCacheSize));
+  }
+}
+
+int DirNode::tune(const string &name, long value) {
+  if (value < 0) {
+    return -EINVAL;
+  }
+  Lock lock(tuneMutex);
+  size_t *size = nullptr;
+  bool enabled = true;
+  if (name == "pathcache") {
+    size = &pathCacheSize;
+    enabled = (bool)cipherCache;
+  } else if (name == "dircache") {
+    size = &dirCacheSize;
+    enabled = (bool)dirCache;
+  } else if (name == "attrcache") {
+    size = &attrCacheSize;
+    enabled = (bool)attrCache;
+  } else if (name == "blockcache") {
+    if (!fsConfig->blockCache) {
+      return -ENOENT;
+    }
+    if (value < 1 || value > (1L << 20)) {
+      return -EINVAL;
+    }
+    blockCacheSize = (size_t)value << 20;
+  } else if (name == "readahead") {
+    if (!fsConfig->opts) {
+      return -ENOENT;
+    }
+    if (value > (1L << 20)) {
+      return -EINVAL;
+    }
+    fsConfig->opts->readAheadSize = (int)value;
+    return 0;
+  } else if (name == "threads") {
+    if (!fsConfig->workers) {
+      return -ENOENT;
+    }
+    if (value < 1 || value > 1024) {
+      return -EINVAL;
+    }
+    fsConfig->workers->setThreads((int)value);
+    return 0;
+  } else if (name == "bgcpu") {
+    // in hundredths of a CPU, 0 for no limit
+    if (value > 100000) {
+      return -EINVAL;
+    }
+    CpuBudget::setLimit(value / 100.0);
+    return 0;
+  } else {
+    return -EINVAL;
+  }
+
+  if (size != nullptr) {
+    if (!enabled) {
+      return -ENOENT;
+    }
+    if (value < 1 || value > (1L << 24)) {
+      return -EINVAL;
+    }
+    *size = (size_t)value;
+  }
+  resizeCaches();
+  return 0;
+}
+
+string DirNode::tunables() {
+  Lock lock(tuneMutex);
+  std::ostringstream out;
+  if (cipherCache) {
+    out << "pathcache " << pathCacheSize << "\n";
+  }
+  if (dirCache) {
+    out << "dircache " << dirCacheSize << "\n";
+  }
+  if (attrCache) {
+    out << "attrcache " << attrCacheSize << "\n";
+  }
+  if (fsConfig->blockCache) {
+    out << "blockcache " << (blockCacheSize >> 20) << "\n";
+  }
+  if (fsConfig->opts) {
+    out << "readahead " << fsConfig->opts->readAheadSize << "\n";
+  }
+  if (fsConfig->workers) {
+    out << "threads " << fsConfig->workers->threads() << "\n";
+  }
+  out << "bgcpu " << std::lround(CpuBudget::limit() * 100) << "\n";
+  return out.str();
+}
+
+string DirNode::encodePath(const char *plaintextPath, uint64_t *iv) {
+  string cipher;
+  uint64_t localIV = 0;
+  if (cipherCache && cipherCache->get(plaintextPath, &cipher, &localIV)) {
+    if (iv != nullptr) {
+      *iv = localIV;
+    }
+    return cipher;
+  }
+
+  // With the cache, only the last component needs encoding: the parent
+  // directory is usually cached already, and its IV is where the chain
+  // continues.  "." and ".." (and trailing slashes) take the slow path.
+  const char *name = strrchr(plaintextPath, '/');
+  if (cipherCache && plaintextPath[0] == '/' && name[1] != '\0' &&
+      strcmp(name, "/.") != 0 && strcmp(name, "/..") != 0) {
+    string parentCipher;
+    if (name != plaintextPath) {
+      string parent(plaintextPath, name - plaintextPath);
+      parentCipher = encodePath(parent.c_str(), &localIV);
+      parent.assign(parent.length(), '\0');
+    }
+    cipher = naming->encodePath(name + 1, &localIV);
+    if (!parentCipher.empty()) {
+      cipher = parentCipher + '/' + cipher;
+    }
+    // the way back, as decodePath would find it
+    plainCache->put(cipher, plaintextPath + 1, localIV);
+  } else {
+    cipher = naming->encodePath(plaintextPath, &localIV);
+  }
+
+  if (cipherCache) {
+    cipherCache->put(plaintextPath, cipher, localIV);
+  }
+  if (iv != nullptr) {
+    *iv = localIV;
+  }
+  return cipher;
+}
+
+string DirNode::decodePath(const char *cipherPath_, uint64_t *iv) {
+  string plain;
+  uint64_t localIV = 0;
+  if (plainCache && plainCache->get(cipherPath_, &plain, &localIV)) {
+    if (iv != nullptr) {
+      *iv = localIV;
+    }
+    return plain;
+  }
+
+  // As in encodePath, the parent's IV is cached along with its decoded
+  // path, so only the last component is decoded.  Decoded paths have no
+  // leading '/'.
+  const char *name = strrchr(cipherPath_, '/');
+  if (plainCache && name != nullptr && name != cipherPath_ &&
+      name[1] != '\0' && strcmp(name, "/.") != 0 &&
+      strcmp(name, "/..") != 0) {
+    string parent(cipherPath_, name - cipherPath_);
+    plain = decodePath(parent.c_str(), &localIV);
+    plain += '/';
+    plain += naming->decodePath(name + 1, &localIV);
+  } else {
+    plain = naming->decodePath(cipherPath_, &localIV);
+  }
+
+  if (plainCache) {
+    plainCache->put(cipherPath_, plain, localIV);
+  }
+  if (iv != nullptr) {
+    *iv = localIV;
+  }
+  return plain;
+}
+
+bool DirNode::knownMissing(const char *plaintextPath) {
+  return missingCache && missingCache->contains(plaintextPath);
+}
+
+uint64_t DirNode::missingGeneration() {
+  return missingCache ? missingCache->generation() : 0;
+}
+
+void DirNode::noteMissing(const char *plaintextPath, uint64_t generation) {
+  if (missingCache) {
+    missingCache->put(plaintextPath, generation);
+  }
+}
+
+bool DirNode::parentStamp(const char *plaintextPath, struct stat *st) {
+  if (!dirIndex) {
+    return false;
+  }
+  string parent = parentDirectory(plaintextPath);
+  string cyName = rootDir + encodePath(parent.empty() ? "/" : parent.c_str());
+  return ::stat(cyName.c_str(), st) == 0 && dirIndex->known(*st);
+}
+
+void DirNode::created(const char *plaintextPath,
+                      const struct stat *parentBefore) {
+  if (parentBefore != nullptr) {
+    indexChange(plaintextPath, *parentBefore, {}, true);
+  }
+  listingChanged(plaintextPath);
+}
+
+void DirNode::indexChange(const char *plaintextPath, const struct stat &before,
+                          const std::vector<string> &removed, bool add) {
+  string parent = parentDirectory(plaintextPath);
+  string cyParent = rootDir + encodePath(parent.empty() ? "/" : parent.c_str());
+  struct stat after;
+  if (::stat(cyParent.c_str(), &after) != 0) {
+    dirIndex->erase(before.st_ino);
+    return;
+  }
+  if (!add) {
+    dirIndex->changed(before, after, removed, nullptr);
+    return;
+  }
+
+  DirEntry entry;
+  entry.name = baseName(plaintextPath);
+  struct stat st;
+  string cyName = rootDir + encodePath(plaintextPath);
+  AtPath at(fsConfig->dirFds.get(), cyName);
+  if (statAt(at, &st, relaxedStat) != 0) {
+    dirIndex->erase(before.st_ino);
+    return;
+  }
+  entry.inode = st.st_ino;
+  entry.fileType = IFTODT(st.st_mode);
+  // a name which was there already is replaced
+  std::vector<string> gone(removed);
+  gone.push_back(entry.name);
+  dirIndex->changed(before, after, gone, &entry);
+}
+
+bool DirNode::cachedAttr(const char *plaintextPath, struct stat *st) {
+  return attrCache && attrCache->get(plaintextPath, st);
+}
+
+uint64_t DirNode::attrGeneration() {
+  return attrCache ? attrCache->generation() : 0;
+}
+
+void DirNode::storeAttr(const char *plaintextPath, const struct stat &st,
+                        uint64_t generation) {
+  if (attrCache) {
+    attrCache->put(plaintextPath, st, generation, attrTimeout(plaintextPath));
+  }
+}
+
+int DirNode::attrTimeout(const char *plaintextPath) const {
+  if (!fsConfig->policies) {
+    return -1;
+  }
+  return fsConfig->policies->lookup(plaintextPath, *fsConfig->opts)
+      .attrTimeout;
+}
+
+int DirNode::reloadPolicies() {
+  if (!fsConfig->policies) {
+    return -ENOENT;
+  }
+  int res = fsConfig->policies->load();
+  if (res == 0) {
+    RLOG(INFO) << "policies reloaded from " << fsConfig->policies->file()
+               << ", " << fsConfig->policies->size() << " subtrees";
+  }
+  return res;
+}
+
+void DirNode::attrChanged(const char *plaintextPath) {
+  flights.changed();
+  if (attrCache) {
+    attrCache->invalidate(plaintextPath, false);
+  }
+}
+
+bool DirNode::knownNoXattr(const char *plaintextPath, const char *name) {
+  return xattrCache && xattrCache->missing(plaintextPath, name);
+}
+
+uint64_t DirNode::xattrGeneration() {
+  return xattrCache ? xattrCache->generation() : 0;
+}
+
+void DirNode::noteNoXattr(const char *plaintextPath, const char *name,
+                          uint64_t generation) {
+  if (xattrCache) {
+    xattrCache->put(plaintextPath, name, generation);
+  }
+}
+
+// hard links of the file share its attributes, under paths we don't know
+void DirNode::xattrChanged() {
+  if (xattrCache) {
+    xattrCache->clear();
+  }
+}
+
+void DirNode::listingChanged(const char *plaintextPath) {
+  flights.changed();
+  if (missingCache) {
+    missingCache->invalidate(plaintextPath);
+  }
+  if (xattrCache) {
+    xattrCache->invalidate(plaintextPath);
+  }
+  if (!dirCache && !attrCache) {
+    return;
+  }
+  string parent = parentDirectory(plaintextPath);
+  if (parent.empty()) {
+    parent = "/";
+  }
+  if (attrCache) {
+    attrCache->invalidate(plaintextPath);
+    attrCache->invalidate(parent, false);
+  }
+  if (dirCache) {
+    dirCache->invalidate(plaintextPath);
+    dirCache->invalidate(parent);
+  }
+}
+
+bool DirNode::watchBacking() {
+  if (watcher) {
+    return true;
+  }
+  try {
+    watcher.reset(new BackingWatcher(
+        rootDir, [this](const string &path) { backingChanged(path); }));
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "can't watch " << rootDir << ": " << err.what();
+    return false;
+  }
+  if (!watcher->complete()) {
+    RLOG(WARNING) << "not all of " << rootDir << " is watched";
+  }
+  return true;
 }
 
-DirNode::~DirNode() = default;
+void DirNode::warmUp() {
+  if (warmCache) {
+    warmCache->start([this](const string &path) { warmPath(path); });
+  }
+}
+
+/*
+    Decoding the path fills both path caches, and its attributes go to the
+    attribute cache.  A directory is listed, which caches the listing and
+    the paths and attributes of its entries.
+*/
+void DirNode::warmPath(const string &cipherPath) {
+  string plain;
+  try {
+    plain = "/" + decodePath(cipherPath.c_str());
+  } catch (encfs::Error &err) {
+    return;  // not ours, or the key changed
+  }
+  mode_t mode;
+  if (warmEntry(plain, &mode) && S_ISDIR(mode)) {
+    readListing(plain.c_str());
+  }
+}
+
+/*
+    The attributes of the path go to the attribute cache.  For a file, its
+    header is read by reading its first byte, which caches the file IV.
+    Returns true, with its mode, for a path which isn't open and could be
+    looked at.
+*/
+bool DirNode::warmEntry(const string &plain, mode_t *mode) {
+  // open files are already warm, and their attributes aren't cached
+  struct stat st;
+  uint64_t generation = attrGeneration();
+  if ((ctx != nullptr && ctx->lookupNode(plain.c_str())) ||
+      getAttr(plain.c_str(), &st) != 0) {
+    return false;
+  }
+  storeAttr(plain.c_str(), st, generation);
+  *mode = st.st_mode;
+  if (S_ISREG(st.st_mode) && st.st_size > 0 && fsConfig->fileIVCache) {
+    int res = 0;
+    std::shared_ptr<FileNode> node =
+        openNode(plain.c_str(), "warmcache", O_RDONLY, &res);
+    if (node) {
+      unsigned char byte;
+      node->read(0, &byte, 1);
+    }
+  }
+  return true;
+}
+
+/*
+    Breadth first, like genRenameList: the directories of a level are
+    listed over the worker pool, and then their entries are looked at over
+    it.  Subdirectories make up the next level.
+*/
+size_t DirNode::warmTree(const vector<string> &paths, size_t blockBytes) {
+  WorkerPool *workers = fsConfig->workers.get();
+  auto each = [workers](size_t count, const std::function<void(size_t)> &fn) {
+    if (workers != nullptr && count > 1) {
+      workers->parallelFor(count, fn);
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        fn(i);
+      }
+    }
+  };
+
+  std::atomic<size_t> warmed(0);
+  vector<string> dirs;
+  for (const string &path : paths) {
+    mode_t mode;
+    if (warmEntry(path, &mode)) {
+      ++warmed;
+      if (S_ISDIR(mode)) {
+        dirs.push_back(path);
+      }
+    }
+  }
+  while (!dirs.empty()) {
+    vector<vector<string>> found(dirs.size());
+    each(dirs.size(), [&](size_t i) {
+      try {
+        std::shared_ptr<const DirListing> listing =
+            readListing(dirs[i].c_str());
+        if (!listing) {
+          return;
+        }
+        string prefix = dirs[i] == "/" ? dirs[i] : dirs[i] + "/";
+        for (const DirEntry &entry : *listing) {
+          if (entry.name != "." && entry.name != "..") {
+            found[i].push_back(prefix + entry.name);
+          }
+        }
+      } catch (encfs::Error &err) {
+        RLOG(WARNING) << err.what();
+      }
+    });
+
+    vector<string> level;
+    for (auto &names : found) {
+      std::move(names.begin(), names.end(), std::back_inserter(level));
+    }
+    vector<char> isDir(level.size(), 0);
+    each(level.size(), [&](size_t i) {
+      try {
+        mode_t mode;
+        if (warmEntry(level[i], &mode)) {
+          isDir[i] = S_ISDIR(mode) ? 1 : 0;
+          ++warmed;
+        }
+      } catch (encfs::Error &err) {
+        RLOG(WARNING) << err.what();
+      }
+    });
+    dirs.clear();
+    for (size_t i = 0; i < level.size(); ++i) {
+      if (isDir[i] != 0) {
+        dirs.push_back(std::move(level[i]));
+      }
+    }
+  }
+
+  // the busiest open files, by the cipher names --hotfiles tracks
+  if (blockBytes > 0 && ctx != nullptr && ctx->hotFiles &&
+      fsConfig->blockCache) {
+    std::unordered_map<string, std::shared_ptr<FileNode>> open;
+    for (auto &node : ctx->openNodes()) {
+      open[node->cipherName()] = node;
+    }
+    for (const HotFiles::Entry &hot : ctx->hotFiles->top()) {
+      auto it = open.find(hot.key);
+      if (it == open.end()) {
+        continue;
+      }
+      off_t size = it->second->getSize();
+      if (size <= 0) {
+        continue;
+      }
+      off_t length = std::min(size, (off_t)blockBytes);
+      if (it->second->advise(FileIO::WillNeed, 0, length) == 0) {
+        blockBytes -= length;
+      }
+      if (blockBytes == 0) {
+        break;
+      }
+    }
+  }
+  return warmed;
+}
+
+void DirNode::backingChanged(const string &backingPath) {
+  string plain = "/";
+  if (!backingPath.empty()) {
+    try {
+      plain += decodePath(backingPath.c_str());
+    } catch (encfs::Error &err) {
+      // not a name of ours, such as the config file
+      return;
+    }
+  }
+  VLOG(1) << "backing change of " << plain;
+
+  listingChanged(plain.c_str());
+  if (closedNodes) {
+    closedNodes->drop(plain);
+  }
+  if (ctx == nullptr) {
+    return;
+  }
+  std::vector<std::shared_ptr<FileNode>> open;
+  if (backingPath.empty()) {
+    open = ctx->openNodes();
+  } else if (auto node = ctx->lookupNode(plain.c_str())) {
+    open.push_back(node);
+  }
+  for (auto &node : open) {
+    node->backingChanged();
+  }
+}
+
+void DirNode::invalidatePath(const char *plaintextPath) {
+  listingChanged(plaintextPath);
+  if (closedNodes) {
+    closedNodes->drop(plaintextPath);
+  }
+  if (!cipherCache) {
+    return;
+  }
+  string cipher;
+  if (cipherCache->get(plaintextPath, &cipher, nullptr)) {
+    plainCache->invalidate(cipher);
+  }
+  cipherCache->invalidate(plaintextPath);
+}
 
 bool DirNode::hasDirectoryNameDependency() const {
   return naming ? naming->getChainedNameIV() : false;
@@ -272,6 +1187,128 @@ string DirNode::rootDirectory() {
   return string(rootDir, 0, rootDir.length() - 1);
 }
 
+void DirNode::startIntentLog() {
+  if (fsConfig->intentLog) {
+    fsConfig->intentLog->start([this]() { return flushAll(); });
+  }
+}
+
+bool DirNode::flushAll() {
+  bool ok = true;
+  if (ctx != nullptr) {
+    for (const auto &node : ctx->openNodes()) {
+      if (node->flush() < 0) {
+        ok = false;
+      }
+    }
+  }
+  // files written out since, and closed, are only on disk after this
+  for (const string &root : backingRoots()) {
+    int fd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+      ok = false;
+      continue;
+    }
+#ifdef HAVE_SYNCFS
+    if (::syncfs(fd) != 0) {
+      ok = false;
+    }
+#else
+    ::sync();
+#endif
+    ::close(fd);
+  }
+  return ok;
+}
+
+std::vector<std::string> DirNode::backingRoots() const {
+  std::vector<std::string> roots;
+  size_t count = stripes ? stripes->count() : 1;
+  for (size_t i = 0; i < count; ++i) {
+    const string &root = stripes ? stripes->root(i) : rootDir;
+    roots.push_back(root.substr(0, root.length() - 1));
+  }
+  return roots;
+}
+
+string DirNode::backingPath(const string &relative) const {
+  return stripes ? stripes->locate(relative) : rootDir + relative;
+}
+
+string DirNode::stripePath(const string &cyName, size_t index) const {
+  return stripes->root(index) +
+         cyName.substr(stripes->root(stripes->rootOf(cyName)).length());
+}
+
+int DirNode::mkdirStripes(const string &cyName, mode_t mode) {
+  size_t home = stripes->rootOf(cyName);
+  for (size_t i = 0; i < stripes->count(); ++i) {
+    if (i == home) {
+      continue;
+    }
+    string path = stripePath(cyName, i);
+    if (::mkdir(path.c_str(), mode) != 0 && errno != EEXIST) {
+      int res = -errno;
+      RLOG(WARNING) << "mkdir error on " << path << ": " << strerror(-res);
+      while (i-- > 0) {
+        if (i != home) {
+          ::rmdir(stripePath(cyName, i).c_str());
+        }
+      }
+      return res;
+    }
+  }
+  return 0;
+}
+
+int DirNode::renameStripes(const string &fromCName, const string &toCName) {
+  size_t home = stripes->rootOf(fromCName);
+  for (size_t i = 0; i < stripes->count(); ++i) {
+    if (i == home) {
+      continue;
+    }
+    string from = stripePath(fromCName, i);
+    string to = stripePath(toCName, i);
+    if (::rename(from.c_str(), to.c_str()) != 0 && errno != ENOENT) {
+      int res = -errno;
+      RLOG(WARNING) << "rename error on " << from << ": " << strerror(-res);
+      while (i-- > 0) {
+        if (i != home) {
+          ::rename(stripePath(toCName, i).c_str(),
+                   stripePath(fromCName, i).c_str());
+        }
+      }
+      return res;
+    }
+    if (fsConfig->dirFds) {
+      fsConfig->dirFds->invalidate(from);
+      fsConfig->dirFds->invalidate(to);
+    }
+  }
+  return 0;
+}
+
+int DirNode::rmdirStripes(const string &cyName, mode_t mode) {
+  size_t home = stripes->rootOf(cyName);
+  for (size_t i = 0; i < stripes->count(); ++i) {
+    if (i == home) {
+      continue;
+    }
+    string path = stripePath(cyName, i);
+    if (::rmdir(path.c_str()) != 0 && errno != ENOENT) {
+      // not empty here, or not at all
+      int res = -errno;
+      while (i-- > 0) {
+        if (i != home) {
+          ::mkdir(stripePath(cyName, i).c_str(), mode);
+        }
+      }
+      return res;
+    }
+  }
+  return 0;
+}
+
 bool DirNode::touchesMountpoint(const char *realPath) const {
   const string &mountPoint = fsConfig->opts->mountPoint;
   // compare mountPoint up to the leading slash.
@@ -304,14 +1341,49 @@ bool DirNode::touchesMountpoint(const char *realPath) const {
  * cipherPath: /foobar encoded to cipher/NKAKsn2APtmquuKPoF4QRPxS
  */
 string DirNode::cipherPath(const char *plaintextPath) {
-  return rootDir + naming->encodePath(plaintextPath);
+  return backingPath(encodePath(plaintextPath));
+}
+
+int DirNode::cipherPathInto(const char *plaintextPath, char *out, size_t cap) {
+  if (stripes) {
+    string path = cipherPath(plaintextPath);
+    if (path.length() >= cap) {
+      return -ENAMETOOLONG;
+    }
+    memcpy(out, path.c_str(), path.length() + 1);
+    return (int)path.length();
+  }
+  size_t rootLen = rootDir.length();
+  if (rootLen >= cap) {
+    return -ENAMETOOLONG;
+  }
+  memcpy(out, rootDir.data(), rootLen);
+  char *relative = out + rootLen;
+  size_t relativeCap = cap - rootLen;
+
+  int len;
+  if (!cipherCache) {
+    len = naming->encodePathInto(plaintextPath, relative, relativeCap);
+  } else {
+    len = cipherCache->get(plaintextPath, relative, relativeCap, nullptr);
+    if (len < 0) {
+      // fill the cache, one component at a time
+      string cipher = encodePath(plaintextPath);
+      if (cipher.length() >= relativeCap) {
+        return -ENAMETOOLONG;
+      }
+      memcpy(relative, cipher.c_str(), cipher.length() + 1);
+      len = (int)cipher.length();
+    }
+  }
+  return len < 0 ? len : (int)rootLen + len;
 }
 
 /**
  * Same as cipherPath(), but does not prefix the ciphertext root directory
  */
 string DirNode::cipherPathWithoutRoot(const char *plaintextPath) {
-  return naming->encodePath(plaintextPath);
+  return encodePath(plaintextPath);
 }
 
 /**
@@ -333,76 +1405,344 @@ string DirNode::plainPath(const char *cipherPath_) {
              naming->decodeName(cipherPath_ + 1, strlen(cipherPath_ + 1));
     }
 
-    // Default.
-    return naming->decodePath(cipherPath_);
-  } catch (encfs::Error &err) {
-    RLOG(ERROR) << "decode err: " << err.what();
-    return string();
+    // Default.
+    return decodePath(cipherPath_);
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "decode err: " << err.what();
+    return string();
+  }
+}
+
+int DirNode::readLink(const char *cipherPath_, const struct stat &st,
+                      std::string *target) {
+  if (linkCache && linkCache->get(st, target)) {
+    return 0;
+  }
+
+  // the target may have grown since the lstat, so leave room to notice.
+  // Only targets longer than PATH_MAX need the heap.
+  char stackBuf[PATH_MAX];
+  std::vector<char> heapBuf;
+  char *buf = stackBuf;
+  size_t bufSize = sizeof(stackBuf);
+  if ((size_t)st.st_size + 2 > bufSize) {
+    heapBuf.resize(st.st_size + 2);
+    buf = heapBuf.data();
+    bufSize = heapBuf.size();
+  }
+  ssize_t len = ::readlink(cipherPath_, buf, bufSize - 1);
+  if (len < 0) {
+    return -errno;
+  }
+  buf[len] = '\0';  // readlink doesn't terminate
+
+  *target = plainPath(buf);
+  if (linkCache && !target->empty() && len == st.st_size) {
+    linkCache->put(st, *target);
+  }
+  return 0;
+}
+
+string DirNode::relativeCipherPath(const char *plaintextPath) {
+  try {
+    // use '+' prefix to indicate special decoding.
+    char mark = fsConfig->reverseEncryption ? '+' : '/';
+    if (plaintextPath[0] == mark) {
+      return string(fsConfig->reverseEncryption ? "/" : "+") +
+             naming->encodeName(plaintextPath + 1, strlen(plaintextPath + 1));
+    }
+
+    return encodePath(plaintextPath);
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "encode err: " << err.what();
+    return string();
+  }
+}
+
+DirTraverse DirNode::openDir(const char *plaintextPath) {
+  string relative = encodePath(plaintextPath);
+  string cyName = rootDir + relative;
+
+  DIR *dir = ::opendir(cyName.c_str());
+  if (dir == nullptr) {
+    int eno = errno;
+    VLOG(1) << "opendir error " << strerror(eno);
+    return DirTraverse(shared_ptr<DIR>(), 0, std::shared_ptr<NameIO>(), false);
+  }
+  std::shared_ptr<DIR> dp(dir, DirDeleter());
+  std::vector<std::shared_ptr<DIR>> more;
+  for (size_t i = 1; stripes && i < stripes->count(); ++i) {
+    DIR *stripe = ::opendir((stripes->root(i) + relative).c_str());
+    if (stripe != nullptr) {
+      more.emplace_back(stripe, DirDeleter());
+    }
+  }
+
+  uint64_t iv = 0;
+  // if we're using chained IV mode, then compute the IV at this
+  // directory level..
+  try {
+    if (naming->getChainedNameIV()) {
+      encodePath(plaintextPath, &iv);
+    }
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "encode err: " << err.what();
+  }
+  DirTraverse dt(dp, iv, naming, (strlen(plaintextPath) == 1));
+  for (auto &stripe : more) {
+    dt.addStripe(stripe);
+  }
+  return dt;
+}
+
+/**
+ * In reverse mode, backup tools look up every entry of a listing next.  Name
+ * coding is a function of the name and the directory's IV only, so the coded
+ * paths found while listing are right for as long as the names exist.  Large
+ * listings are left out, rather than flushing the rest of the cache.
+ */
+void DirNode::primePaths(const char *plaintextPath, const DirListing &listing) {
+  size_t len = strlen(plaintextPath);
+  if (listing.size() > cipherCache->capacity() / 2 || len == 0 ||
+      (len > 1 && plaintextPath[len - 1] == '/')) {
+    return;
+  }
+
+  // children of the root have no parent in their coded path
+  string dir = (len == 1) ? string() : string(plaintextPath);
+  string cipherDir = dir.empty() ? string() : encodePath(plaintextPath) + '/';
+  string path;
+  string cipher;
+  for (const DirEntry &entry : listing) {
+    if (entry.coded.empty() || entry.name == "." || entry.name == "..") {
+      continue;
+    }
+    path = dir + '/' + entry.name;
+    cipher = cipherDir + entry.coded;
+    cipherCache->put(path, cipher, entry.iv);
+    // and the way back, as encodePath leaves it
+    plainCache->put(cipher, path.c_str() + 1, entry.iv);
+  }
+  path.assign(path.length(), '\0');
+  cipher.assign(cipher.length(), '\0');
+}
+
+/**
+ * ls -l, find and rsync ask for the attributes of every entry of a listing
+ * next, which FUSE 2 can't return with the names.  They are found here
+ * instead, by the coded names just read, so that each of those getattr
+ * calls is answered from the cache without coding the path and asking the
+ * backing filesystem again.  Open files are left out, as by getattr, and so
+ * are listings which wouldn't fit in the cache.
+ */
+void DirNode::primeAttrs(const char *plaintextPath, const DirListing &listing) {
+  size_t len = strlen(plaintextPath);
+  if (listing.size() > attrCache->capacity() || len == 0 ||
+      (len > 1 && plaintextPath[len - 1] == '/')) {
+    return;
+  }
+
+  string dir = (len == 1) ? string() : string(plaintextPath);
+  string cipherDir = rootDir + (dir.empty() ? string()
+                                            : encodePath(plaintextPath) + '/');
+  int dirFd = ::open(cipherDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirFd < 0) {
+    return;
+  }
+
+  // the entries are stat'ed as one batch (see StatBatch)
+  uint64_t generation = attrCache->generation();
+  vector<const DirEntry *> entries;
+  entries.reserve(listing.size());
+  string path;
+  for (const DirEntry &entry : listing) {
+    if (entry.coded.empty() || entry.name == "." || entry.name == "..") {
+      continue;
+    }
+    path = dir + '/' + entry.name;
+    if (ctx == nullptr || !ctx->lookupNode(path.c_str())) {
+      entries.push_back(&entry);
+    }
+  }
+  vector<struct stat> stats(entries.size());
+  vector<int> results(entries.size());
+  StatBatch batch(fsConfig->uring);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    batch.stat(dirFd, entries[i]->coded.c_str(), &stats[i], &results[i],
+               relaxedStat);
+  }
+  batch.run();
+  ::close(dirFd);
+
+  string cipher;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    cipher = cipherDir + entries[i]->coded;
+    if (results[i] == 0 && upperAttr(cipher, &stats[i]) == 0) {
+      path = dir + '/' + entries[i]->name;
+      attrCache->put(path, stats[i], generation, attrTimeout(path.c_str()));
+    }
+  }
+  path.assign(path.length(), '\0');
+  cipher.assign(cipher.length(), '\0');
+}
+
+std::shared_ptr<const DirListing> DirNode::listDir(const char *plaintextPath,
+                                                  int *result) {
+  InFlight::Result listed;
+  int res = flights.run(InFlight::Listing, plaintextPath, &listed,
+                        [this, plaintextPath](InFlight::Result *out) {
+                          out->res = -EACCES;
+                          out->listing = readListing(plaintextPath, &out->res);
+                          if (out->listing) {
+                            out->res = 0;
+                            if (treeWalk) {
+                              walkAhead(plaintextPath, *out->listing);
+                            }
+                          }
+                        });
+  if (!listed.listing && result != nullptr) {
+    *result = res;
   }
+  return listed.listing;
 }
 
-string DirNode::relativeCipherPath(const char *plaintextPath) {
-  try {
-    // use '+' prefix to indicate special decoding.
-    char mark = fsConfig->reverseEncryption ? '+' : '/';
-    if (plaintextPath[0] == mark) {
-      return string(fsConfig->reverseEncryption ? "/" : "+") +
-             naming->encodeName(plaintextPath + 1, strlen(plaintextPath + 1));
+/*
+    The directories a tree walk goes to next are listed on the workers, so
+    that their listings, and the attributes of their entries, are in the
+    caches when the walker gets there.  Entries of unknown type aren't
+    followed.
+*/
+void DirNode::walkAhead(const char *plaintextPath, const DirListing &listing) {
+  vector<string> subdirs;
+  for (const DirEntry &entry : listing) {
+    if (entry.fileType == DT_DIR && entry.name != "." && entry.name != "..") {
+      subdirs.push_back(entry.name);
+    }
+  }
+  TreeWalk *walk = treeWalk.get();
+  for (const string &dir : walk->listed(plaintextPath, subdirs)) {
+    bool queued = fsConfig->workers->trySubmit([this, walk, dir]() {
+      try {
+        readListing(dir.c_str());
+      } catch (encfs::Error &err) {
+        VLOG(1) << "listing ahead failed: " << err.what();
+      }
+      walk->done(dir);
+    });
+    if (!queued) {
+      walk->done(dir);
     }
-
-    return naming->encodePath(plaintextPath);
-  } catch (encfs::Error &err) {
-    RLOG(ERROR) << "encode err: " << err.what();
-    return string();
   }
 }
 
-DirTraverse DirNode::openDir(const char *plaintextPath) {
-  string cyName = rootDir + naming->encodePath(plaintextPath);
+std::shared_ptr<const DirListing> DirNode::readListing(
+    const char *plaintextPath, int *result) {
+  // the getattr or open of each entry which usually follows a listing
+  // finds its coded path in the path cache, without coding the name again
+  const bool prime = (bool)cipherCache;
+  // the entries of a striped volume are in any of its backing directories
+  const bool primeAttr = attrCache && !stripes;
+  struct stat st;
+  bool haveStat = false;
+  if (dirCache || dirIndex) {
+    string cyName = rootDir + encodePath(plaintextPath);
+    haveStat = (::stat(cyName.c_str(), &st) == 0);
+    if (!haveStat) {
+      if (result != nullptr) {
+        *result = -errno;
+      }
+      return std::shared_ptr<const DirListing>();
+    }
 
-  DIR *dir = ::opendir(cyName.c_str());
-  if (dir == nullptr) {
-    int eno = errno;
-    VLOG(1) << "opendir error " << strerror(eno);
-    return DirTraverse(shared_ptr<DIR>(), 0, std::shared_ptr<NameIO>(), false);
+    std::shared_ptr<const DirListing> listing;
+    if (dirCache) {
+      listing = dirCache->get(plaintextPath, st);
+    }
+    if (listing) {
+      VLOG(1) << "listing of " << cyName << " served from cache";
+      if (prime) {
+        primePaths(plaintextPath, *listing);
+      }
+      if (primeAttr) {
+        primeAttrs(plaintextPath, *listing);
+      }
+      return listing;
+    }
+    if (dirIndex && (listing = dirIndex->get(st))) {
+      VLOG(1) << "listing of " << cyName << " served from index";
+      if (dirCache) {
+        dirCache->put(plaintextPath, st, listing);
+      }
+      return listing;
+    }
   }
-  std::shared_ptr<DIR> dp(dir, DirDeleter());
 
-  uint64_t iv = 0;
-  // if we're using chained IV mode, then compute the IV at this
-  // directory level..
-  try {
-    if (naming->getChainedNameIV()) {
-      naming->encodePath(plaintextPath, &iv);
+  DirTraverse dt = openDir(plaintextPath);
+  if (!dt.valid()) {
+    if (result != nullptr) {
+      // openDir logged, and may have clobbered, the real error
+      *result = -EACCES;
     }
-  } catch (encfs::Error &err) {
-    RLOG(ERROR) << "encode err: " << err.what();
+    return std::shared_ptr<const DirListing>();
+  }
+
+  std::shared_ptr<DirListing> listing = std::make_shared<DirListing>();
+  while (dt.nextPlaintextNames(listing.get(), fsConfig->workers.get(),
+                                prime || primeAttr) > 0) {
+  }
+
+  if (prime) {
+    primePaths(plaintextPath, *listing);
+  }
+  if (primeAttr) {
+    primeAttrs(plaintextPath, *listing);
   }
-  return DirTraverse(dp, iv, naming, (strlen(plaintextPath) == 1));
+  if (haveStat && dirCache) {
+    dirCache->put(plaintextPath, st, listing);
+  }
+  if (haveStat && dirIndex) {
+    dirIndex->put(st, *listing);
+  }
+  return listing;
 }
 
-bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
-                            const char *toP) {
+bool DirNode::scanRenameDir(const char *fromP, const char *toP,
+                            vector<RenameEl> &found) {
   uint64_t fromIV = 0, toIV = 0;
 
   // compute the IV for both paths
-  string fromCPart = naming->encodePath(fromP, &fromIV);
-  string toCPart = naming->encodePath(toP, &toIV);
-
-  // where the files live before the rename..
-  string sourcePath = rootDir + fromCPart;
+  string fromCPart = encodePath(fromP, &fromIV);
+  string toCPart = encodePath(toP, &toIV);
 
   // ok..... we wish it was so simple.. should almost never happen
   if (fromIV == toIV) {
     return true;
   }
 
+  // each copy of a striped directory
+  size_t count = stripes ? stripes->count() : 1;
+  for (size_t index = 0; index < count; ++index) {
+    if (!scanRenameCopy(fromP, toP, fromCPart, fromIV, toIV, index, found)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DirNode::scanRenameCopy(const char *fromP, const char *toP,
+                             string fromCPart, uint64_t fromIV, uint64_t toIV,
+                             size_t index, vector<RenameEl> &found) {
+  // where the files live before the rename..
+  string sourcePath =
+      (index == 0 ? rootDir : stripes->root(index)) + fromCPart;
+
   // generate the real destination path, where we expect to find the files..
   VLOG(1) << "opendir " << sourcePath;
   std::shared_ptr<DIR> dir =
       std::shared_ptr<DIR>(opendir(sourcePath.c_str()), DirDeleter());
   if (!dir) {
-    return false;
+    // a copy which went missing holds nothing
+    return index > 0 && errno == ENOENT;
   }
 
   struct dirent *de = nullptr;
@@ -452,19 +1792,12 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
       }
 
       ren.isDirectory = isDir;
-
-      if (isDir) {
-        // recurse..  We want to add subdirectory elements before the
-        // parent, as that is the logical rename order..
-        if (!genRenameList(renameList, ren.oldPName.c_str(),
-                           ren.newPName.c_str())) {
-          return false;
-        }
-      }
+      // only the first copy of a directory is gone into
+      ren.stripeCopy = isDir && index > 0;
 
       VLOG(1) << "adding file " << oldFull << " to rename list";
 
-      renameList.push_back(ren);
+      found.push_back(ren);
     } catch (encfs::Error &err) {
       // We can't convert this name, because we don't have a valid IV for
       // it (or perhaps a valid key).. It will be inaccessible..
@@ -481,6 +1814,66 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
   return true;
 }
 
+bool DirNode::genRenameList(vector<RenameEl> &renameList,
+                            vector<size_t> &levels, const char *fromP,
+                            const char *toP) {
+  WorkerPool *workers = fsConfig->workers.get();
+
+  // breadth first, shallowest level first
+  vector<vector<RenameEl> > tree;
+  vector<std::pair<string, string> > dirs(1, std::make_pair(fromP, toP));
+  while (!dirs.empty()) {
+    vector<vector<RenameEl> > found(dirs.size());
+    vector<char> ok(dirs.size(), 0);
+    auto scan = [&](size_t i) {
+      try {
+        ok[i] = scanRenameDir(dirs[i].first.c_str(), dirs[i].second.c_str(),
+                              found[i])
+                    ? 1
+                    : 0;
+      } catch (encfs::Error &err) {
+        RLOG(WARNING) << err.what();
+      }
+    };
+    if (workers != nullptr && dirs.size() > 1) {
+      workers->parallelFor(dirs.size(), scan);
+    } else {
+      for (size_t i = 0; i < dirs.size(); ++i) {
+        scan(i);
+      }
+    }
+
+    vector<RenameEl> level;
+    vector<std::pair<string, string> > subdirs;
+    for (size_t i = 0; i < dirs.size(); ++i) {
+      if (ok[i] == 0) {
+        return false;
+      }
+      for (RenameEl &ren : found[i]) {
+        if (ren.isDirectory && !ren.stripeCopy) {
+          subdirs.emplace_back(ren.oldPName, ren.newPName);
+        }
+        level.push_back(std::move(ren));
+      }
+    }
+    if (!level.empty()) {
+      tree.push_back(std::move(level));
+    }
+    dirs.swap(subdirs);
+  }
+
+  // We want to rename subdirectory elements before the parent, as that is
+  // the logical rename order..
+  for (auto level = tree.rbegin(); level != tree.rend(); ++level) {
+    levels.push_back(renameList.size());
+    for (RenameEl &ren : *level) {
+      renameList.push_back(std::move(ren));
+    }
+  }
+  levels.push_back(renameList.size());
+  return true;
+}
+
 /*
     A bit of a pain.. If a directory is renamed in a filesystem with
     directory initialization vector chaining, then we have to recursively
@@ -493,17 +1886,20 @@ std::shared_ptr<RenameOp> DirNode::newRenameOp(const char *fromP,
                                                const char *toP) {
   // Do the rename in two stages to avoid chasing our tail
   // Undo everything if we encounter an error!
-  std::shared_ptr<list<RenameEl> > renameList(new list<RenameEl>);
-  if (!genRenameList(*renameList.get(), fromP, toP)) {
+  std::shared_ptr<vector<RenameEl> > renameList(new vector<RenameEl>);
+  vector<size_t> levels;
+  if (!genRenameList(*renameList.get(), levels, fromP, toP)) {
     RLOG(WARNING) << "Error during generation of recursive rename list";
     return std::shared_ptr<RenameOp>();
   }
-  return std::make_shared<RenameOp>(this, renameList);
+  VLOG(1) << "rename list of " << renameList->size() << " entries in "
+          << (levels.size() - 1) << " levels";
+  return std::make_shared<RenameOp>(this, renameList, levels);
 }
 
 int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
                    gid_t gid) {
-  string cyName = rootDir + naming->encodePath(plaintextPath);
+  string cyName = cipherPath(plaintextPath);
   rAssert(!cyName.empty());
 
   VLOG(1) << "mkdir on " << cyName;
@@ -528,13 +1924,20 @@ int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
     }
   }
 
-  int res = ::mkdir(cyName.c_str(), mode);
+  struct stat parent;
+  bool indexed = parentStamp(plaintextPath, &parent);
+  AtPath at(fsConfig->dirFds.get(), cyName);
+  int res = ::mkdirat(at.dir(), at.name(), mode);
 
   if (res == -1) {
     int eno = errno;
     RLOG(WARNING) << "mkdir error on " << cyName << " mode " << mode << ": "
                   << strerror(eno);
     res = -eno;
+  } else if (stripes && (res = mkdirStripes(cyName, mode)) != 0) {
+    ::unlinkat(at.dir(), at.name(), AT_REMOVEDIR);
+  } else {
+    created(plaintextPath, indexed ? &parent : nullptr);
   }
 
   if (olduid >= 0) {
@@ -555,14 +1958,89 @@ int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
   return res;
 }
 
+namespace {
+// Marks a rename as running for lookups without the lock, for its
+// lifetime.  It only starts once the removals which went ahead without the
+// lock are done.
+class RenameMark {
+ public:
+  RenameMark(std::atomic<uint64_t> &epoch, std::atomic<int> &active,
+             const std::atomic<int> &unlocked)
+      : _epoch(epoch), _active(active) {
+    ++_active;
+    ++_epoch;
+    while (unlocked != 0) {
+      sched_yield();
+    }
+  }
+  ~RenameMark() {
+    ++_epoch;
+    --_active;
+  }
+
+ private:
+  std::atomic<uint64_t> &_epoch;
+  std::atomic<int> &_active;
+};
+
+// Reserves the subtrees of a rename in DirNode::renaming, for its
+// lifetime.  Made and destroyed with the DirNode's lock held, which also
+// wakes up the lookups waiting for the subtrees.
+class RenameReservation {
+ public:
+  RenameReservation(std::vector<string> &renaming, pthread_cond_t &done,
+                    const char *from, const char *to)
+      : _renaming(renaming), _done(done), _from(from), _to(to) {
+    _renaming.push_back(_from);
+    _renaming.push_back(_to);
+  }
+  ~RenameReservation() {
+    _renaming.erase(std::find(_renaming.begin(), _renaming.end(), _from));
+    _renaming.erase(std::find(_renaming.begin(), _renaming.end(), _to));
+    pthread_cond_broadcast(&_done);
+  }
+
+ private:
+  RenameReservation(const RenameReservation &src);             // not allowed
+  RenameReservation &operator=(const RenameReservation &src);  // not allowed
+
+  std::vector<string> &_renaming;
+  pthread_cond_t &_done;
+  string _from;
+  string _to;
+};
+}  // namespace
+
 int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
-  Lock _lock(mutex);
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(fromPlaintext, true);
+  waitForRename(toPlaintext, true);
+  RenameMark mark(renameEpoch, renamesActive, unlockedOps);
 
-  string fromCName = rootDir + naming->encodePath(fromPlaintext);
-  string toCName = rootDir + naming->encodePath(toPlaintext);
+  string fromCName = cipherPath(fromPlaintext);
+  string toCName = rootDir + encodePath(toPlaintext);
   rAssert(!fromCName.empty());
   rAssert(!toCName.empty());
 
+  // a striped volume renames in the backing directory the entry is in, and
+  // directories in all of them
+  bool stripedDir = false;
+  string toElsewhere;
+  if (stripes) {
+    toCName = stripePath(toCName, stripes->rootOf(fromCName));
+    stripedDir = isDirectory(fromCName.c_str());
+    struct stat other;
+    if (!stripedDir) {
+      toElsewhere = cipherPath(toPlaintext);
+      if (toElsewhere == toCName ||
+          ::lstat(toElsewhere.c_str(), &other) != 0) {
+        toElsewhere.clear();
+      } else if (S_ISDIR(other.st_mode)) {
+        return -EISDIR;
+      }
+    }
+  }
+
   VLOG(1) << "rename " << fromCName << " -> " << toCName;
 
   std::shared_ptr<FileNode> toNode = findOrCreate(toPlaintext);
@@ -570,13 +2048,23 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
   std::shared_ptr<RenameOp> renameOp;
   if (hasDirectoryNameDependency() && isDirectory(fromCName.c_str())) {
     VLOG(1) << "recursive rename begin";
-    renameOp = newRenameOp(fromPlaintext, toPlaintext);
-
-    if (!renameOp || !renameOp->apply()) {
-      if (renameOp) {
+    // Renaming the contents can take long.  Reserve both subtrees, so that
+    // only lookups in them wait, and let go of the lock meanwhile.
+    bool ok = false;
+    {
+      RenameReservation reserved(renaming, renameDone, fromPlaintext,
+                                 toPlaintext);
+      {
+        Unlock unlocked(mutex);
+        renameOp = newRenameOp(fromPlaintext, toPlaintext);
+        ok = renameOp && renameOp->apply(fsConfig->workers.get());
+      }
+      if (!ok && renameOp) {
         renameOp->undo();
       }
+    }
 
+    if (!ok) {
       RLOG(WARNING) << "rename aborted";
       return -EACCES;
     }
@@ -587,9 +2075,42 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
   try {
     struct stat st;
     bool preserve_mtime = ::stat(fromCName.c_str(), &st) == 0;
+    // a file renamed over is gone afterwards
+    AtPath from(fsConfig->dirFds.get(), fromCName);
+    AtPath to(fsConfig->dirFds.get(), toCName);
+    struct stat toSt;
+    bool replacing =
+        ::fstatat(to.dir(), to.name(), &toSt, AT_SYMLINK_NOFOLLOW) == 0 &&
+                     (!preserve_mtime || toSt.st_ino != st.st_ino);
+
+    struct stat fromParent;
+    struct stat toParent;
+    bool fromIndexed = parentStamp(fromPlaintext, &fromParent);
+    bool toIndexed = parentStamp(toPlaintext, &toParent);
 
     renameNode(fromPlaintext, toPlaintext);
-    res = ::rename(fromCName.c_str(), toCName.c_str());
+    if (fsConfig->ivJournal && !fsConfig->ivJournal->empty()) {
+      // the pending headers have to be known before their paths change
+      fsConfig->ivJournal->sync();
+    }
+    res = ::renameat(from.dir(), from.name(), to.dir(), to.name());
+    if (res == 0 && stripedDir) {
+      res = renameStripes(fromCName, toCName);
+      if (res != 0) {
+        ::renameat(to.dir(), to.name(), from.dir(), from.name());
+        errno = -res;
+        res = -1;
+      }
+    }
+    if (res == 0 && !toElsewhere.empty()) {
+      // the entry renamed over, in another backing directory
+      ::unlink(toElsewhere.c_str());
+    }
+    if (res == 0 && fsConfig->dirFds) {
+      // a directory moved, or one renamed over is gone
+      fsConfig->dirFds->invalidate(fromCName);
+      fsConfig->dirFds->invalidate(toCName);
+    }
 
     if (res == -1) {
       // undo
@@ -619,6 +2140,24 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
         ut.modtime = st.st_mtime;
         ::utime(toCName.c_str(), &ut);
       }
+      if (replacing) {
+        journalForget(fsConfig, toSt);
+      }
+      journalMoved(fsConfig, fromCName, toCName);
+      IVJournal::compactLater(fsConfig->ivJournal, fsConfig->workers.get());
+      if (fromIndexed && toIndexed && fromParent.st_ino == toParent.st_ino) {
+        indexChange(toPlaintext, toParent, {baseName(fromPlaintext)}, true);
+      } else {
+        if (fromIndexed) {
+          indexChange(fromPlaintext, fromParent, {baseName(fromPlaintext)},
+                      false);
+        }
+        if (toIndexed) {
+          indexChange(toPlaintext, toParent, {}, true);
+        }
+      }
+      invalidatePath(fromPlaintext);
+      invalidatePath(toPlaintext);
     }
   } catch (encfs::Error &err) {
     // exception from renameNode, just show the error and continue..
@@ -634,24 +2173,42 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
 }
 
 int DirNode::link(const char *to, const char *from) {
-  Lock _lock(mutex);
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(to);
+  waitForRename(from);
 
-  string toCName = rootDir + naming->encodePath(to);
-  string fromCName = rootDir + naming->encodePath(from);
+  string toCName = cipherPath(to);
+  string fromCName = rootDir + encodePath(from);
 
   rAssert(!toCName.empty());
   rAssert(!fromCName.empty());
 
+  // a link has to be in the backing directory of its target
+  if (stripes) {
+    string existing = cipherPath(from);
+    struct stat st;
+    if (::lstat(existing.c_str(), &st) == 0) {
+      return -EEXIST;
+    }
+    fromCName = stripePath(fromCName, stripes->rootOf(toCName));
+  }
+
   VLOG(1) << "link " << fromCName << " -> " << toCName;
 
   int res = -EPERM;
   if (fsConfig->config->externalIVChaining) {
     VLOG(1) << "hard links not supported with external IV chaining!";
   } else {
-    res = ::link(toCName.c_str(), fromCName.c_str());
+    struct stat parent;
+    bool indexed = parentStamp(from, &parent);
+    AtPath target(fsConfig->dirFds.get(), toCName);
+    AtPath at(fsConfig->dirFds.get(), fromCName);
+    res = ::linkat(target.dir(), target.name(), at.dir(), at.name(), 0);
     if (res == -1) {
       res = -errno;
     } else {
+      created(from, indexed ? &parent : nullptr);
+      attrChanged(to);  // link count
       res = 0;
     }
   }
@@ -659,6 +2216,114 @@ int DirNode::link(const char *to, const char *from) {
   return res;
 }
 
+// Copy the contents of fd in to out, in the kernel where possible.
+static int copyContents(int in, int out) {
+#ifdef FICLONE
+  if (ioctl(out, FICLONE, in) == 0) {
+    return 0;
+  }
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+  for (;;) {
+    ssize_t res = ::copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+    if (res == 0) {
+      return 0;
+    }
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // not between these file systems: copy it by hand, from where it got to
+      if (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+          errno != EOPNOTSUPP) {
+        return -errno;
+      }
+      break;
+    }
+  }
+#endif
+  char buf[64 * 1024];
+  for (;;) {
+    ssize_t res = ::read(in, buf, sizeof(buf));
+    if (res == 0) {
+      return 0;
+    }
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    char *p = buf;
+    while (res > 0) {
+      ssize_t written = ::write(out, p, res);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -errno;
+      }
+      p += written;
+      res -= written;
+    }
+  }
+}
+
+int DirNode::copyFile(const char *from, const char *to) {
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(from);
+  waitForRename(to);
+
+  string fromCName = cipherPath(from);
+  string toCName = cipherPath(to);
+
+  rAssert(!fromCName.empty());
+  rAssert(!toCName.empty());
+
+  VLOG(1) << "copy " << fromCName << " -> " << toCName;
+
+  if (fsConfig->config->externalIVChaining) {
+    VLOG(1) << "encrypted copy not possible with external IV chaining";
+    return -EXDEV;
+  }
+
+  int in = ::open(fromCName.c_str(), O_RDONLY);
+  if (in < 0) {
+    return -errno;
+  }
+  struct stat st;
+  int res = fstat(in, &st) != 0 ? -errno : 0;
+  if (res == 0 && !S_ISREG(st.st_mode)) {
+    res = -EINVAL;
+  }
+  if (res != 0) {
+    ::close(in);
+    return res;
+  }
+
+  struct stat parent;
+  bool indexed = parentStamp(to, &parent);
+  int out = ::open(toCName.c_str(), O_WRONLY | O_CREAT | O_EXCL,
+                   st.st_mode & 07777);
+  if (out < 0) {
+    int res = -errno;
+    ::close(in);
+    return res;
+  }
+
+  res = copyContents(in, out);
+  ::close(in);
+  if (::close(out) != 0 && res == 0) {
+    res = -errno;
+  }
+  if (res == 0) {
+    created(to, indexed ? &parent : nullptr);
+  } else {
+    ::unlink(toCName.c_str());
+  }
+  return res;
+}
+
 /*
     The node is keyed by filename, so a rename means the internal node names
     must be changed.
@@ -671,10 +2336,20 @@ std::shared_ptr<FileNode> DirNode::renameNode(const char *from,
 std::shared_ptr<FileNode> DirNode::renameNode(const char *from, const char *to,
                                               bool forwardMode) {
   std::shared_ptr<FileNode> node = findOrCreate(from);
+  renameFileNode(node, from, to, forwardMode);
+  return node;
+}
 
+void DirNode::renameFileNode(const std::shared_ptr<FileNode> &node,
+                             const char *from, const char *to,
+                             bool forwardMode) {
   if (node) {
     uint64_t newIV = 0;
-    string cname = rootDir + naming->encodePath(to, &newIV);
+    string cname = rootDir + encodePath(to, &newIV);
+    if (stripes) {
+      // files stay in their backing directory
+      cname = stripePath(cname, stripes->rootOf(node->cipherName()));
+    }
 
     VLOG(1) << "renaming internal node " << node->cipherName() << " -> "
             << cname;
@@ -689,8 +2364,28 @@ std::shared_ptr<FileNode> DirNode::renameNode(const char *from, const char *to,
       throw Error("Internal node name change failed!");
     }
   }
+}
 
-  return node;
+// true if path is root or below it
+static bool isSubPath(const string &path, const string &root) {
+  return path.compare(0, root.length(), root) == 0 &&
+         (path.length() == root.length() || path[root.length()] == '/');
+}
+
+bool DirNode::inRenamedTree(const char *plaintextPath, bool ancestors) const {
+  string path = plaintextPath;
+  for (const string &root : renaming) {
+    if (isSubPath(path, root) || (ancestors && isSubPath(root, path))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DirNode::waitForRename(const char *plaintextPath, bool ancestors) {
+  while (!renaming.empty() && inRenamedTree(plaintextPath, ancestors)) {
+    pthread_cond_wait(&renameDone, &mutex);
+  }
 }
 
 // findOrCreate checks if we already have a FileNode for "plainName" and
@@ -705,10 +2400,10 @@ std::shared_ptr<FileNode> DirNode::findOrCreate(const char *plainName) {
     // If we don't, create a new one.
     if (!node) {
       uint64_t iv = 0;
-      string cipherName = naming->encodePath(plainName, &iv);
-      uint64_t fuseFh = ctx->nextFuseFh();
+      string cipherName = encodePath(plainName, &iv);
+      // the handle is assigned by the first open
       node.reset(new FileNode(this, fsConfig, plainName,
-                              (rootDir + cipherName).c_str(), fuseFh));
+                              backingPath(cipherName).c_str(), 0));
 
       if (fsConfig->config->externalIVChaining) {
         node->setName(nullptr, nullptr, iv);
@@ -721,12 +2416,93 @@ std::shared_ptr<FileNode> DirNode::findOrCreate(const char *plainName) {
   return node;
 }
 
+bool DirNode::lookupStart(uint64_t *epoch) const {
+  *epoch = renameEpoch;
+  return renamesActive == 0;
+}
+
+bool DirNode::lookupValid(uint64_t epoch) const {
+  return renameEpoch == epoch;
+}
+
+bool DirNode::unlockedStart() {
+  ++unlockedOps;
+  if (renamesActive == 0) {
+    return true;
+  }
+  --unlockedOps;
+  return false;
+}
+
+void DirNode::unlockedEnd() { --unlockedOps; }
+
 shared_ptr<FileNode> DirNode::lookupNode(const char *plainName,
                                          const char * /* requestor */) {
-  Lock _lock(mutex);
+  uint64_t epoch;
+  if (lookupStart(&epoch)) {
+    std::shared_ptr<FileNode> node = findOrCreate(plainName);
+    if (lookupValid(epoch)) {
+      return node;
+    }
+  }
+
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(plainName);
   return findOrCreate(plainName);
 }
 
+int DirNode::getAttr(const char *plaintextPath, struct stat *st) {
+  InFlight::Result result;
+  int res = flights.run(InFlight::Attr, plaintextPath, &result,
+                        [this, plaintextPath](InFlight::Result *out) {
+                          out->res = lookupAttr(plaintextPath, &out->st);
+                        });
+  if (res == 0) {
+    *st = result.st;
+  }
+  return res;
+}
+
+int DirNode::lookupAttr(const char *plaintextPath, struct stat *st) {
+  string cyName;
+  uint64_t epoch;
+  if (lookupStart(&epoch)) {
+    cyName = cipherPath(plaintextPath);
+  }
+  if (cyName.empty() || !lookupValid(epoch)) {
+    Lock _lock(mutex, Stats::DirNodeLock);
+    waitForRename(plaintextPath);
+    cyName = cipherPath(plaintextPath);
+  }
+  if (touchesMountpoint(cyName.c_str())) {
+    VLOG(1) << "getattr error: tried to touch mountpoint: '" << cyName << "'";
+    return -EIO;
+  }
+  return backingAttr(cyName, st);
+}
+
+int DirNode::backingAttr(const string &cipherPath, struct stat *st) {
+  AtPath at(fsConfig->dirFds.get(), cipherPath);
+  if (statAt(at, st, relaxedStat) != 0) {
+    return -errno;
+  }
+  return upperAttr(cipherPath, st);
+}
+
+int DirNode::upperAttr(const string &cipherPath, struct stat *st) {
+  FileNode::upperAttr(fsConfig, st);
+  if (S_ISLNK(st->st_mode)) {
+    // the plaintext link size, which readLink caches
+    string target;
+    int res = readLink(cipherPath.c_str(), *st, &target);
+    if (res != 0) {
+      return res;
+    }
+    st->st_size = target.length();
+  }
+  return 0;
+}
+
 /*
     Similar to lookupNode, except that we also call open() and only return a
     node on sucess.  This is done in one step to avoid any race conditions
@@ -738,21 +2514,89 @@ std::shared_ptr<FileNode> DirNode::openNode(const char *plainName,
                                             int *result) {
   (void)requestor;
   rAssert(result != nullptr);
-  Lock _lock(mutex);
 
-  std::shared_ptr<FileNode> node = findOrCreate(plainName);
+  // With external IV chaining, opens may write headers which a recursive
+  // rename rewrites, so they can't overlap
+  uint64_t epoch;
+  if (!fsConfig->config->externalIVChaining && lookupStart(&epoch)) {
+    std::shared_ptr<FileNode> node = reuseOrCreate(plainName);
+    bool opened = node && (*result = node->open(flags)) >= 0;
+    if (lookupValid(epoch)) {
+      return opened ? node : std::shared_ptr<FileNode>();
+    }
+    // the node may have been renamed, start over
+  }
 
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(plainName);
+
+  std::shared_ptr<FileNode> node = reuseOrCreate(plainName);
   if (node && (*result = node->open(flags)) >= 0) {
     return node;
   }
   return std::shared_ptr<FileNode>();
 }
 
+std::shared_ptr<FileNode> DirNode::reuseOrCreate(const char *plainName) {
+  std::shared_ptr<FileNode> node;
+  if (closedNodes && !(ctx != nullptr && ctx->lookupNode(plainName))) {
+    node = closedNodes->take(plainName);
+    if (node && strcmp(node->plaintextName(), plainName) != 0) {
+      node.reset();  // renamed meanwhile
+    }
+  }
+  if (!node) {
+    node = findOrCreate(plainName);
+  }
+  return node;
+}
+
+void DirNode::released(const char *plainName,
+                       const std::shared_ptr<FileNode> &node) {
+  if (closedNodes && node) {
+    closedNodes->put(plainName, node);
+  }
+}
+
+std::shared_ptr<FileNode> DirNode::createNode(const char *plainName,
+                                              mode_t mode, uid_t uid,
+                                              gid_t gid, int *result) {
+  rAssert(result != nullptr);
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(plainName);
+
+  std::shared_ptr<FileNode> node = findOrCreate(plainName);
+
+  if (node && (*result = node->create(mode, uid, gid)) >= 0) {
+    return node;
+  }
+  return std::shared_ptr<FileNode>();
+}
+
+/*
+    Removals run without mutex while no rename does (unlockedStart), which
+    is what a recursive delete needs: the kernel already keeps changes to
+    one directory apart, and without renames the coded path can't change
+    under us.  Otherwise they wait for the renames of their path.
+*/
 int DirNode::unlink(const char *plaintextName) {
-  string cyName = naming->encodePath(plaintextName);
-  VLOG(1) << "unlink " << cyName;
+  if (unlockedStart()) {
+    int res = removeFile(plaintextName);
+    unlockedEnd();
+    return res;
+  }
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(plaintextName);
+  return removeFile(plaintextName);
+}
 
-  Lock _lock(mutex);
+int DirNode::removeFile(const char *plaintextName) {
+  char path[PATH_MAX];
+  int len = cipherPathInto(plaintextName, path, sizeof(path));
+  if (len < 0) {
+    return len;
+  }
+  VLOG(1) << "unlink " << path;
 
 // Windows does not allow deleting opened files, so no need to check
 // There is this "issue" however : https://github.com/billziss-gh/winfsp/issues/157
@@ -761,7 +2605,7 @@ int DirNode::unlink(const char *plaintextName) {
     // If FUSE is running with "hard_remove" option where it doesn't
     // hide open files for us, then we can't allow an unlink of an open
     // file..
-    RLOG(WARNING) << "Refusing to unlink open file: " << cyName
+    RLOG(WARNING) << "Refusing to unlink open file: " << path
                   << ", hard_remove option "
                      "is probably in effect";
     return -EBUSY;
@@ -769,11 +2613,85 @@ int DirNode::unlink(const char *plaintextName) {
 #endif
 
   int res = 0;
-  string fullName = rootDir + cyName;
-  res = ::unlink(fullName.c_str());
+  string fullName(path, len);
+  AtPath at(fsConfig->dirFds.get(), fullName);
+  struct stat st;
+  bool known =
+      fsConfig->ivJournal &&
+      ::fstatat(at.dir(), at.name(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+  struct stat parent;
+  bool indexed = parentStamp(plaintextName, &parent);
+  res = ::unlinkat(at.dir(), at.name(), 0);
   if (res == -1) {
     res = -errno;
     VLOG(1) << "unlink error: " << strerror(-res);
+  } else {
+    if (known) {
+      journalForget(fsConfig, st);
+    }
+    if (indexed) {
+      indexChange(plaintextName, parent, {baseName(plaintextName)}, false);
+    }
+    invalidatePath(plaintextName);
+  }
+
+  return res;
+}
+
+int DirNode::rmdir(const char *plaintextPath) {
+  if (unlockedStart()) {
+    int res = removeDir(plaintextPath);
+    unlockedEnd();
+    return res;
+  }
+  Lock _lock(mutex, Stats::DirNodeLock);
+  waitForRename(plaintextPath);
+  return removeDir(plaintextPath);
+}
+
+int DirNode::removeDir(const char *plaintextPath) {
+  char path[PATH_MAX];
+  int len = cipherPathInto(plaintextPath, path, sizeof(path));
+  if (len < 0) {
+    return len;
+  }
+  string cyName(path, len);
+  VLOG(1) << "rmdir " << cyName;
+
+  struct stat parent;
+  bool indexed = parentStamp(plaintextPath, &parent);
+  AtPath at(fsConfig->dirFds.get(), cyName);
+  struct stat st;
+  bool haveStat =
+      (dirIndex || stripes) &&
+      ::fstatat(at.dir(), at.name(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+  int res = 0;
+  if (stripes) {
+    // the other copies first, which may hold files
+    res = haveStat ? rmdirStripes(cyName, st.st_mode & 07777) : -errno;
+  }
+  if (res == 0) {
+    res = ::unlinkat(at.dir(), at.name(), AT_REMOVEDIR);
+    if (res == -1) {
+      res = -errno;
+      if (stripes) {
+        mkdirStripes(cyName, st.st_mode & 07777);
+      }
+    }
+  }
+  if (res < 0) {
+    VLOG(1) << "rmdir error: " << strerror(-res);
+  } else {
+    if (fsConfig->dirFds) {
+      fsConfig->dirFds->invalidate(cyName);
+    }
+    if (haveStat && dirIndex) {
+      dirIndex->erase(st.st_ino);
+    }
+    if (indexed) {
+      indexChange(plaintextPath, parent, {baseName(plaintextPath)}, false);
+    }
+    invalidatePath(plaintextPath);
   }
 
   return res;
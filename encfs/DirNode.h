@@ -21,6 +21,7 @@
 #ifndef _DirNode_incl_
 #define _DirNode_incl_
 
+#include <atomic>
 #include <dirent.h>
 #include <inttypes.h>
 #include <list>
@@ -32,10 +33,22 @@
 #include <sys/types.h>
 #include <vector>
 
+#include "AttrCache.h"
+#include "BackingWatcher.h"
 #include "CipherKey.h"
+#include "DirCache.h"
+#include "DirIndex.h"
 #include "FSConfig.h"
 #include "FileNode.h"
+#include "FileNodePool.h"
+#include "InFlight.h"
+#include "LinkCache.h"
 #include "NameIO.h"
+#include "NegativeCache.h"
+#include "PathCache.h"
+#include "TreeWalk.h"
+#include "WarmCache.h"
+#include "XattrCache.h"
 
 namespace encfs {
 
@@ -44,12 +57,15 @@ class EncFS_Context;
 class FileNode;
 class NameIO;
 class RenameOp;
+class Stripes;
+class WorkerPool;
 struct RenameEl;
 
 class DirTraverse {
  public:
   DirTraverse(std::shared_ptr<DIR> dirPtr, uint64_t iv,
               std::shared_ptr<NameIO> naming, bool root);
+  DirTraverse(const DirTraverse &src);
   ~DirTraverse();
 
   DirTraverse &operator=(const DirTraverse &src);
@@ -63,18 +79,37 @@ class DirTraverse {
   // unknown)
   std::string nextPlaintextName(int *fileType = 0, ino_t *inode = 0);
 
+  /*
+      Read up to BatchSize entries and append the ones which decode to
+      listing, skipping undecodable names like nextPlaintextName().  With
+      workers, large batches are decoded on several threads.  keepCoded
+      fills in DirEntry::coded and iv.  Returns the number of entries read, 0
+      once the directory is exhausted.
+  */
+  static const size_t BatchSize = 512;
+  size_t nextPlaintextNames(DirListing *listing, WorkerPool *workers,
+                            bool keepCoded = false);
+
   /* Return cipher name of next undecodable filename..
      The opposite of nextPlaintextName(), as that skips undecodable names..
   */
   std::string nextInvalid();
 
+  // Also list the copy of the directory in another backing directory of a
+  // striped volume, after this one, leaving out its directories.
+  void addStripe(std::shared_ptr<DIR> stripe);
+
  private:
+  bool nextName(struct dirent *&de, int *fileType, ino_t *inode);
+
   std::shared_ptr<DIR> dir;  // struct DIR
+  std::vector<std::shared_ptr<DIR>> stripes;  // read once dir is done
   // initialization vector to use.  Not very general purpose, but makes it
   // more efficient to support filename IV chaining..
   uint64_t iv;
   std::shared_ptr<NameIO> naming;
   bool root;
+  bool inStripe;  // dir is one of the stripes
 };
 inline bool DirTraverse::valid() const { return dir.get() != 0; }
 
@@ -88,6 +123,12 @@ class DirNode {
   // return the path to the root directory
   std::string rootDirectory();
 
+  // all backing directories, more than the root directory if striped
+  std::vector<std::string> backingRoots() const;
+
+  // the configuration and key the volume was opened with
+  const FSConfigPtr &config() const { return fsConfig; }
+
   // recursive lookup check
   bool touchesMountpoint(const char *realPath) const;
 
@@ -95,6 +136,15 @@ class DirNode {
   std::shared_ptr<FileNode> lookupNode(const char *plaintextName,
                                        const char *requestor);
 
+  /*
+      Attributes of a path which isn't open, as the getAttr of its FileNode
+      would return them, but found from the lstat of the backing file
+      without building one.  Open files have to be asked through their
+      FileNode, which knows of writes not yet on disk.  Returns 0 or a
+      negative errno.  Concurrent calls for a path share one lstat.
+  */
+  int getAttr(const char *plaintextPath, struct stat *st);
+
   /*
       Combined lookupNode + node->open() call.  If the open fails, then the
       node is not retained.  If the open succeeds, then the node is returned.
@@ -103,10 +153,34 @@ class DirNode {
                                      const char *requestor, int flags,
                                      int *openResult);
 
+  // The last handle of node was released, it may be kept for the next
+  // openNode of the same path
+  void released(const char *plaintextName,
+                const std::shared_ptr<FileNode> &node);
+
+  /*
+      Combined lookupNode + node->create() call, for a new regular file.  As
+      for openNode, the node is only returned if the create succeeds.
+  */
+  std::shared_ptr<FileNode> createNode(const char *plaintextName, mode_t mode,
+                                       uid_t uid, gid_t gid, int *result);
+
   std::string cipherPath(const char *plaintextPath);
+  // cipherPath() written into out, which holds cap bytes, without
+  // allocating for paths in the path cache.  Returns the length of the
+  // result or -ENAMETOOLONG.
+  int cipherPathInto(const char *plaintextPath, char *out, size_t cap);
   std::string cipherPathWithoutRoot(const char *plaintextPath);
   std::string plainPath(const char *cipherPath);
 
+  /*
+      Decoded target of the symlink at cipherPath (a full cipherPath()),
+      whose lstat is st.  The target is empty if it can't be decoded.
+      Returns 0 or a negative errno.
+  */
+  int readLink(const char *cipherPath, const struct stat &st,
+               std::string *target);
+
   // relative cipherPath is the same as cipherPath except that it doesn't
   // prepent the mount point.  That it, it doesn't return a fully qualified
   // name, just a relative path within the encrypted filesystem.
@@ -122,9 +196,21 @@ class DirNode {
   // unlink the specified file
   int unlink(const char *plaintextName);
 
+  // remove the specified (empty) directory
+  int rmdir(const char *plaintextPath);
+
   // traverse directory
   DirTraverse openDir(const char *plainDirName);
 
+  /*
+      All decodable entries of a directory, from the listing cache if the
+      backing directory hasn't changed since it was last read.  Returns null
+      if the directory can't be opened, and sets result (if not null) to a
+      negative errno.  Concurrent calls for a directory share one reading.
+  */
+  std::shared_ptr<const DirListing> listDir(const char *plainDirName,
+                                            int *result = nullptr);
+
   // uid and gid are used as the directory owner, only if not zero
   int mkdir(const char *plaintextPath, mode_t mode, uid_t uid = 0,
             gid_t gid = 0);
@@ -133,9 +219,113 @@ class DirNode {
 
   int link(const char *to, const char *from);
 
+  /*
+      Copy the file from to the new file to, without decoding it.  The
+      encrypted file is cloned where the file system allows it, so the copy
+      shares its blocks, and is otherwise copied in the kernel.  Returns
+      -EXDEV if the contents depend on the name (external IV chaining), in
+      which case the file has to be decoded and written again.
+  */
+  int copyFile(const char *from, const char *to);
+
+  /*
+      Paths recently found not to exist (see --negcache).  A lookup which
+      fails with ENOENT is recorded by noteMissing, with the generation read
+      before the lookup started.  created() is for things made at a path
+      outside of DirNode, it drops the path from the caches.  parentStamp()
+      is called before making it, and its result passed to created(), to
+      keep the parent's index (see --dirindex) current.  It returns false if
+      the parent isn't indexed.
+  */
+  bool knownMissing(const char *plaintextPath);
+  uint64_t missingGeneration();
+  void noteMissing(const char *plaintextPath, uint64_t generation);
+  bool parentStamp(const char *plaintextPath, struct stat *st);
+  void created(const char *plaintextPath,
+               const struct stat *parentBefore = nullptr);
+
+  /*
+      Attributes of recently looked up paths (see --attrcache), like the
+      missing paths above.  attrChanged() is for changes made outside of
+      DirNode.  Files which are open aren't cached, their release counts as
+      a change.
+  */
+  bool cachedAttr(const char *plaintextPath, struct stat *st);
+  uint64_t attrGeneration();
+  void storeAttr(const char *plaintextPath, const struct stat &st,
+                 uint64_t generation);
+  void attrChanged(const char *plaintextPath);
+
+  // metadata calls running, which calls on the same path join
+  InFlight &inFlight() { return flights; }
+
+  /*
+      Extended attributes which paths were found not to have (see
+      --xattrcache), like the missing paths above.  xattrChanged() is for
+      an attribute set or removed through the mount.
+  */
+  bool knownNoXattr(const char *plaintextPath, const char *name);
+  uint64_t xattrGeneration();
+  void noteNoXattr(const char *plaintextPath, const char *name,
+                   uint64_t generation);
+  void xattrChanged();
+
+  /*
+      Follow changes made to the backing directory by others (--watch):
+      watchBacking() starts a BackingWatcher, which calls backingChanged()
+      with the path, relative to rootDir, of each backing entry which
+      changed.  An empty path stands for everything.  watchBacking()
+      returns false, having logged why, if the directory can't be watched.
+  */
+  bool watchBacking();
+  void backingChanged(const std::string &backingPath);
+
+  /*
+      Fill the caches in the background with the paths which were in use
+      when the volume was last unmounted (--warmcache), which are saved
+      again when the DirNode goes away.  Like watchBacking(), called once
+      the process won't fork any more.
+  */
+  void warmUp();
+
+  /*
+      Fill the caches with the trees under the given plaintext paths, for
+      encfsctl warm (see --control): listings, paths, attributes and the
+      header IVs of files.  Up to blockBytes of the busiest open files
+      (--hotfiles) are read into the block cache as well.  Returns how many
+      paths were looked at.
+  */
+  size_t warmTree(const std::vector<std::string> &paths, size_t blockBytes);
+
+  /*
+      Checkpoint the intent log (--intentlog) in the background, with
+      flushAll(), and once more when the DirNode goes away.  Like
+      watchBacking(), called once the process won't fork any more.
+  */
+  void startIntentLog();
+  // Write out the write-back buffers of the open files and sync the backing
+  // file systems.  Returns false if anything failed.
+  bool flushAll();
+
   // returns idle time of filesystem in seconds
   int idleSeconds();
 
+  /*
+      Settings which can be changed while mounted (see --control): the
+      entries of the path, listing and attribute caches (pathcache,
+      dircache, attrcache), the MiB of the block cache (blockcache), the KiB
+      read ahead of a sequential reader (readahead, for the files opened
+      afterwards) and the worker threads (threads).  tune() returns 0,
+      -EINVAL for an unknown name or a value out of range, or -ENOENT if the
+      feature is disabled.  tunables() lists the current values, one
+      "name value" line each.
+  */
+  int tune(const std::string &name, long value);
+  std::string tunables();
+
+  // Reads the policy file again (see Policies::load), -ENOENT without one
+  int reloadPolicies();
+
  protected:
   /*
       notify that a file is being renamed.
@@ -146,6 +336,9 @@ class DirNode {
   std::shared_ptr<FileNode> renameNode(const char *from, const char *to);
   std::shared_ptr<FileNode> renameNode(const char *from, const char *to,
                                        bool forwardMode);
+  // the part of renameNode which runs once the node has been found
+  void renameFileNode(const std::shared_ptr<FileNode> &node, const char *from,
+                      const char *to, bool forwardMode);
 
   /*
       when directory IV chaining is enabled, a directory can't be renamed
@@ -158,20 +351,176 @@ class DirNode {
  private:
   friend class RenameOp;
 
-  bool genRenameList(std::list<RenameEl> &list, const char *fromP,
-                     const char *toP);
+  /*
+      Rename plan for the descendants of fromP, deepest level first, so
+      that every directory comes after its contents.  levels receives the
+      index where each level starts, and the end of the list.  Directories
+      of a level are scanned in parallel.
+  */
+  bool genRenameList(std::vector<RenameEl> &list, std::vector<size_t> &levels,
+                     const char *fromP, const char *toP);
+  // the direct children of fromP which change name
+  bool scanRenameDir(const char *fromP, const char *toP,
+                     std::vector<RenameEl> &found);
+  // the same, in the copy of fromP in backing directory index
+  bool scanRenameCopy(const char *fromP, const char *toP,
+                      std::string fromCPart, uint64_t fromIV, uint64_t toIV,
+                      size_t index, std::vector<RenameEl> &found);
+
+  // Must hold mutex.  True if plaintextPath is in a subtree whose contents
+  // are being renamed, or with ancestors, if such a subtree is under it.
+  bool inRenamedTree(const char *plaintextPath, bool ancestors = false) const;
+  // Must hold mutex, waits until plaintextPath is not inRenamedTree
+  void waitForRename(const char *plaintextPath, bool ancestors = false);
+
+  // decode one path saved by WarmCache and look at what it leads to
+  void warmPath(const std::string &cipherPath);
+  // cache what warming one plaintext path does, see warmPath
+  bool warmEntry(const std::string &plain, mode_t *mode);
+
+  // let each cache use share of its tuned size, see MemoryPressure
+  void shrinkCaches(double share);
+  // apply the tuned sizes and share, must hold tuneMutex
+  void resizeCaches();
+
+  // Lookups run without mutex while no rename does.  lookupStart returns
+  // false if one is running, and otherwise the epoch for lookupValid, which
+  // is false if a rename started since.  Lookups which fail either redo
+  // the work holding mutex.
+  bool lookupStart(uint64_t *epoch) const;
+  bool lookupValid(uint64_t epoch) const;
+  // Changes which run without mutex while no rename does.  unlockedStart
+  // returns false if one is running, and otherwise holds off renames until
+  // unlockedEnd.
+  bool unlockedStart();
+  void unlockedEnd();
+  // unlink and rmdir, once they may go ahead
+  int removeFile(const char *plaintextName);
+  int removeDir(const char *plaintextPath);
+  // findOrCreate, or the released node of plainName from closedNodes
+  std::shared_ptr<FileNode> reuseOrCreate(const char *plainName);
 
   std::shared_ptr<FileNode> findOrCreate(const char *plainName);
 
+  // naming->encodePath / decodePath, through the path caches.  iv, if not
+  // null, must be zero on entry and receives the IV of the last component.
+  std::string encodePath(const char *plaintextPath, uint64_t *iv = nullptr);
+  std::string decodePath(const char *cipherPath, uint64_t *iv = nullptr);
+
+  // listDir without looking for a tree walk
+  std::shared_ptr<const DirListing> readListing(const char *plainDirName,
+                                                int *result = nullptr);
+  // list ahead of a tree walk, see TreeWalk
+  void walkAhead(const char *plainDirName, const DirListing &listing);
+
+  // put the coded paths of a listing's entries into the path caches, both
+  // ways
+  void primePaths(const char *plainDirName, const DirListing &listing);
+  // seconds the policy of a path keeps its attributes, -1 for the default
+  int attrTimeout(const char *plaintextPath) const;
+  // put the attributes of a listing's entries into the attribute cache
+  void primeAttrs(const char *plainDirName, const DirListing &listing);
+  // getAttr, without joining a call running
+  int lookupAttr(const char *plaintextPath, struct stat *st);
+  // the attributes of the closed file at cipherPath, see getAttr
+  int backingAttr(const std::string &cipherPath, struct stat *st);
+  // the same from st, the lstat of the file
+  int upperAttr(const std::string &cipherPath, struct stat *st);
+
+  // the full path of relative, a cipher path below the root directory, in
+  // the backing directory it is in (see Stripes::locate)
+  std::string backingPath(const std::string &relative) const;
+  // the directory cyName, in the backing directory index
+  std::string stripePath(const std::string &cyName, size_t index) const;
+  // make or remove the copies of directory cyName in the other backing
+  // directories.  Returns 0 or -errno, having put back those done then.
+  int mkdirStripes(const std::string &cyName, mode_t mode);
+  int rmdirStripes(const std::string &cyName, mode_t mode);
+  int renameStripes(const std::string &fromCName, const std::string &toCName);
+
+  // forget a path which was removed or renamed, and everything under it
+  void invalidatePath(const char *plaintextPath);
+  // drop the cached listings and attributes of a path and of its parent
+  // directory, and the path and everything below it from the missing paths
+  void listingChanged(const char *plaintextPath);
+  // Record in the index of the parent of plaintextPath, which had the stat
+  // before, that the names in removed are gone and, with add, that
+  // plaintextPath is there now.
+  void indexChange(const char *plaintextPath, const struct stat &before,
+                   const std::vector<std::string> &removed, bool add);
+
   pthread_mutex_t mutex;
+  // from and to paths of the recursive renames in progress, which run
+  // without holding mutex
+  std::vector<std::string> renaming;
+  pthread_cond_t renameDone;
+  // changed, holding mutex, when a rename starts and when it ends
+  std::atomic<uint64_t> renameEpoch;
+  // renames running, including those which let go of mutex meanwhile
+  std::atomic<int> renamesActive;
+  // removals running without mutex, which renames wait for
+  std::atomic<int> unlockedOps;
 
   EncFS_Context *ctx;
 
   // passed in as configuration
   std::string rootDir;
   FSConfigPtr fsConfig;
+  // the backing directories of a striped volume, null if not striped
+  std::shared_ptr<Stripes> stripes;
+  // backing attributes may be cached ones (--netfs)
+  bool relaxedStat;
 
   std::shared_ptr<NameIO> naming;
+
+  // plaintext -> ciphertext and ciphertext -> plaintext paths, relative to
+  // rootDir.  Null if disabled.
+  std::unique_ptr<PathCache> cipherCache;
+  std::unique_ptr<PathCache> plainCache;
+
+  // decoded directory listings, null if disabled
+  std::unique_ptr<DirCache> dirCache;
+
+  // listings of large directories kept on disk, null if disabled
+  std::unique_ptr<DirIndex> dirIndex;
+
+  // decoded symlink targets, null if disabled
+  std::unique_ptr<LinkCache> linkCache;
+
+  // paths which don't exist, null if disabled
+  std::unique_ptr<NegativeCache> missingCache;
+
+  // attributes of existing paths, null if disabled
+  std::unique_ptr<AttrCache> attrCache;
+
+  // extended attributes paths don't have, null if disabled
+  std::unique_ptr<XattrCache> xattrCache;
+
+  // getattr, readlink and listing calls running
+  InFlight flights;
+
+  // recently released files, null if disabled
+  std::unique_ptr<FileNodePool> closedNodes;
+
+  // cache sizes set by tune(), of which memory pressure leaves cacheShare
+  pthread_mutex_t tuneMutex;
+  size_t pathCacheSize;
+  size_t dirCacheSize;
+  size_t attrCacheSize;
+  size_t blockCacheSize;
+  double cacheShare;
+
+  // shrinks the caches under memory pressure, null if disabled
+  std::shared_ptr<void> pressureWatch;
+
+  // paths in use at the last unmount, null if disabled
+  std::unique_ptr<WarmCache> warmCache;
+
+  // spots tree walks to list ahead of, null if disabled
+  std::unique_ptr<TreeWalk> treeWalk;
+
+  // last, so that its thread stops before the caches it clears go away
+  std::unique_ptr<BackingWatcher> watcher;
 };
 
 }  // namespace encfs
@@ -0,0 +1,461 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "DiskCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+const size_t DiskCache::ChunkSize;
+
+/*
+    Chunk files are named dev-ino-index, stamp files dev-ino.stamp, all in
+    hex.  A chunk is written to a temporary file first and renamed once
+    complete.  Chunks whose size doesn't fit the stamp, e.g. cut short by a
+    crash, are dropped when the cache is loaded.
+*/
+static const char StampSuffix[] = ".stamp";
+static const char TempSuffix[] = ".tmp";
+
+static std::atomic<uint64_t> tempCount(0);
+
+static bool writeWhole(const std::string &path, const unsigned char *data,
+                       size_t len) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0600);
+  if (fd < 0) {
+    return false;
+  }
+  size_t done = 0;
+  while (done < len) {
+    ssize_t res = ::write(fd, data + done, len - done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      break;
+    }
+    done += res;
+  }
+  bool ok = ::close(fd) == 0 && done == len;
+  if (!ok) {
+    unlink(path.c_str());
+  }
+  return ok;
+}
+
+std::shared_ptr<DiskCache> DiskCache::open(const std::string &dir,
+                                           size_t maxBytes) {
+  static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+  static std::map<std::string, std::weak_ptr<DiskCache>> registry;
+
+  std::string path = dir;
+  if (path.empty() || path[path.length() - 1] != '/') {
+    path.append("/");
+  }
+
+  Lock lock(registryMutex);
+  std::shared_ptr<DiskCache> cache = registry[path].lock();
+  if (!cache) {
+    cache = std::make_shared<DiskCache>(path, maxBytes);
+    if (cache->_lockFd < 0) {
+      return std::shared_ptr<DiskCache>();
+    }
+    registry[path] = cache;
+  }
+  return cache;
+}
+
+DiskCache::DiskCache(const std::string &dir, size_t maxBytes)
+    : _dir(dir), _maxBytes(maxBytes), _lockFd(-1), _bytes(0), _generation(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+  if (lockDir()) {
+    load();
+  }
+}
+
+DiskCache::~DiskCache() {
+  if (_lockFd >= 0) {
+    ::close(_lockFd);
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+bool DiskCache::lockDir() {
+  if (mkdir(_dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    RLOG(WARNING) << "disk cache " << _dir << " unusable: " << strerror(errno);
+    return false;
+  }
+  std::string path = _dir + "lock";
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    RLOG(WARNING) << "disk cache " << _dir << " unusable: " << strerror(errno);
+    return false;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    RLOG(WARNING) << "disk cache " << _dir << " is used by another process";
+    ::close(fd);
+    return false;
+  }
+  _lockFd = fd;
+  return true;
+}
+
+DiskCache::Stamp DiskCache::stampOf(const struct stat &st) {
+  Stamp stamp;
+  stamp.size = st.st_size;
+#ifdef __APPLE__
+  stamp.mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+  stamp.ctime = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+  stamp.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  stamp.ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+  return stamp;
+}
+
+// As for DirIndex: whole second times of the current second may still be
+// those of the next change.
+bool DiskCache::settled(const struct stat &st) {
+  Stamp stamp = stampOf(st);
+  if (stamp.mtime % 1000000000LL != 0 || stamp.ctime % 1000000000LL != 0) {
+    return true;
+  }
+  time_t now = time(nullptr);
+  return st.st_mtime < now && st.st_ctime < now;
+}
+
+std::string DiskCache::chunkPath(const Key &key, uint64_t index) const {
+  char name[64];
+  snprintf(name, sizeof(name), "%" PRIx64 "-%" PRIx64 "-%" PRIx64, key.dev,
+           key.ino, index);
+  return _dir + name;
+}
+
+std::string DiskCache::stampPath(const Key &key) const {
+  char name[64];
+  snprintf(name, sizeof(name), "%" PRIx64 "-%" PRIx64 "%s", key.dev, key.ino,
+           StampSuffix);
+  return _dir + name;
+}
+
+bool DiskCache::storeStamp(const Key &key, const Stamp &stamp) {
+  char text[80];
+  int len = snprintf(text, sizeof(text), "%" PRId64 " %" PRId64 " %" PRId64 "\n",
+                     stamp.size, stamp.mtime, stamp.ctime);
+  std::string path = stampPath(key);
+  std::string temp = path + TempSuffix + std::to_string(++tempCount);
+  if (!writeWhole(temp, (const unsigned char *)text, len)) {
+    return false;
+  }
+  if (rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+void DiskCache::load() {
+  DIR *dir = opendir(_dir.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+
+  struct Found {
+    time_t used;
+    Key key;
+    uint64_t index;
+    size_t bytes;
+  };
+  std::vector<Found> found;
+  std::vector<std::string> junk;
+  struct dirent *de;
+  while ((de = readdir(dir)) != nullptr) {
+    std::string name = de->d_name;
+    if (name == "." || name == ".." || name == "lock") {
+      continue;
+    }
+    Key key;
+    uint64_t index;
+    int end = 0;
+    if (name.find(TempSuffix) != std::string::npos) {
+      junk.push_back(name);
+    } else if (sscanf(name.c_str(), "%" SCNx64 "-%" SCNx64 "-%" SCNx64 "%n",
+                      &key.dev, &key.ino, &index, &end) == 3 &&
+               (size_t)end == name.length()) {
+      struct stat st;
+      if (stat((_dir + name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        found.push_back(Found{st.st_mtime, key, index, (size_t)st.st_size});
+      }
+    } else if (sscanf(name.c_str(), "%" SCNx64 "-%" SCNx64 "%n", &key.dev,
+                      &key.ino, &end) == 2 &&
+               name.compare(end, std::string::npos, StampSuffix) == 0) {
+      File &file = fileOf(key);
+      FILE *in = fopen((_dir + name).c_str(), "r");
+      long long size, mtime, ctime;
+      if (in != nullptr &&
+          fscanf(in, "%lld %lld %lld", &size, &mtime, &ctime) == 3) {
+        file.haveStamp = true;
+        file.stampStored = true;
+        file.stamp = Stamp{size, mtime, ctime};
+      }
+      if (in != nullptr) {
+        fclose(in);
+      }
+    }
+  }
+  closedir(dir);
+
+  for (const std::string &name : junk) {
+    unlink((_dir + name).c_str());
+  }
+
+  // oldest first, each in front of the ones before
+  std::sort(found.begin(), found.end(),
+            [](const Found &a, const Found &b) { return a.used < b.used; });
+  for (const Found &chunk : found) {
+    auto file = _files.find(chunk.key);
+    int64_t start = chunk.index * ChunkSize;
+    bool fits = file != _files.end() && file->second.haveStamp &&
+                file->second.stamp.size > start &&
+                (int64_t)chunk.bytes ==
+                    std::min((int64_t)ChunkSize,
+                             file->second.stamp.size - start);
+    if (!fits) {
+      unlink(chunkPath(chunk.key, chunk.index).c_str());
+      continue;
+    }
+    _lru.push_front(std::make_pair(chunk.key, chunk.index));
+    file->second.chunks[chunk.index] = Chunk{chunk.bytes, _lru.begin()};
+    _bytes += chunk.bytes;
+  }
+
+  for (auto it = _files.begin(); it != _files.end();) {
+    auto next = std::next(it);
+    if (it->second.chunks.empty()) {
+      forget(it);
+    }
+    it = next;
+  }
+  evict();
+  VLOG(1) << "disk cache " << _dir << " holds " << _bytes << " bytes";
+}
+
+DiskCache::File &DiskCache::fileOf(const Key &key) {
+  auto it = _files.find(key);
+  if (it == _files.end()) {
+    File file;
+    file.haveStamp = false;
+    file.stampStored = false;
+    file.stamp = Stamp{0, 0, 0};
+    file.generation = _generation;
+    it = _files.insert(std::make_pair(key, std::move(file))).first;
+  }
+  return it->second;
+}
+
+void DiskCache::dropChunk(FileMap::iterator file,
+                          std::map<uint64_t, Chunk>::iterator chunk) {
+  unlink(chunkPath(file->first, chunk->first).c_str());
+  _lru.erase(chunk->second.lru);
+  _bytes -= chunk->second.bytes;
+  file->second.chunks.erase(chunk);
+}
+
+void DiskCache::dropAll(FileMap::iterator file) {
+  while (!file->second.chunks.empty()) {
+    dropChunk(file, file->second.chunks.begin());
+  }
+  if (file->second.stampStored) {
+    unlink(stampPath(file->first).c_str());
+    file->second.stampStored = false;
+  }
+  file->second.generation = ++_generation;
+}
+
+void DiskCache::forget(FileMap::iterator file) {
+  dropAll(file);
+  _files.erase(file);
+}
+
+void DiskCache::evict() {
+  while (_bytes > _maxBytes && !_lru.empty()) {
+    auto file = _files.find(_lru.back().first);
+    rAssert(file != _files.end());
+    dropChunk(file, file->second.chunks.find(_lru.back().second));
+    if (file->second.chunks.empty()) {
+      forget(file);
+    }
+  }
+}
+
+bool DiskCache::validate(const Key &key, const struct stat &st) {
+  Lock lock(_mutex);
+  fileOf(key);
+  auto file = _files.find(key);
+  if (!settled(st)) {
+    dropAll(file);
+    file->second.haveStamp = false;
+    return false;
+  }
+
+  Stamp stamp = stampOf(st);
+  const Stamp &known = file->second.stamp;
+  if (file->second.haveStamp && known.size == stamp.size &&
+      known.mtime == stamp.mtime && known.ctime == stamp.ctime) {
+    return true;
+  }
+  dropAll(file);
+  file->second.haveStamp = true;
+  file->second.stamp = stamp;
+  return true;
+}
+
+void DiskCache::update(const Key &key, const struct stat &st) {
+  Lock lock(_mutex);
+  auto file = _files.find(key);
+  if (file == _files.end()) {
+    return;
+  }
+  if (!settled(st)) {
+    dropAll(file);
+    file->second.haveStamp = false;
+    return;
+  }
+  file->second.haveStamp = true;
+  file->second.stamp = stampOf(st);
+  if (file->second.stampStored && !storeStamp(key, file->second.stamp)) {
+    dropAll(file);
+  }
+}
+
+uint64_t DiskCache::generation(const Key &key) {
+  Lock lock(_mutex);
+  auto file = _files.find(key);
+  return file == _files.end() ? _generation : file->second.generation;
+}
+
+ssize_t DiskCache::get(const Key &key, uint64_t index, size_t offset,
+                       unsigned char *buf, size_t len) {
+  std::string path;
+  size_t count;
+  {
+    Lock lock(_mutex);
+    auto file = _files.find(key);
+    if (file == _files.end() || !file->second.haveStamp) {
+      return -1;
+    }
+    auto chunk = file->second.chunks.find(index);
+    if (chunk == file->second.chunks.end()) {
+      return -1;
+    }
+    if (offset >= chunk->second.bytes) {
+      return 0;
+    }
+    count = std::min(len, chunk->second.bytes - offset);
+    _lru.splice(_lru.begin(), _lru, chunk->second.lru);
+    path = chunkPath(key, index);
+  }
+
+  // dropped meanwhile if it's gone, the backing file is read instead
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  ssize_t res = pread(fd, buf, count, offset);
+  ::close(fd);
+  return res == (ssize_t)count ? res : -1;
+}
+
+void DiskCache::put(const Key &key, uint64_t index, const unsigned char *data,
+                    size_t len, uint64_t generation) {
+  if (len == 0 || len > ChunkSize) {
+    return;
+  }
+  auto current = [&](FileMap::iterator file) {
+    return file != _files.end() && file->second.haveStamp &&
+           file->second.generation == generation &&
+           file->second.chunks.count(index) == 0;
+  };
+  {
+    Lock lock(_mutex);
+    if (!current(_files.find(key))) {
+      return;
+    }
+  }
+
+  std::string path = chunkPath(key, index);
+  std::string temp = path + TempSuffix + std::to_string(++tempCount);
+  if (!writeWhole(temp, data, len)) {
+    VLOG(1) << "disk cache write failed: " << strerror(errno);
+    return;
+  }
+
+  Lock lock(_mutex);
+  auto file = _files.find(key);
+  bool stored = current(file);
+  if (stored && !file->second.stampStored) {
+    stored = storeStamp(key, file->second.stamp);
+    file->second.stampStored = stored;
+  }
+  if (!stored || rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+    return;
+  }
+  _lru.push_front(std::make_pair(key, index));
+  file->second.chunks[index] = Chunk{len, _lru.begin()};
+  _bytes += len;
+  evict();
+}
+
+void DiskCache::drop(const Key &key, uint64_t first, uint64_t last) {
+  Lock lock(_mutex);
+  ++_generation;
+  auto file = _files.find(key);
+  if (file == _files.end()) {
+    return;
+  }
+  file->second.generation = _generation;
+  auto &chunks = file->second.chunks;
+  auto chunk = chunks.lower_bound(first);
+  while (chunk != chunks.end() && chunk->first <= last) {
+    dropChunk(file, chunk++);
+  }
+}
+
+size_t DiskCache::size() const {
+  Lock lock(_mutex);
+  return _bytes;
+}
+
+}  // namespace encfs
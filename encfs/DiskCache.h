@@ -0,0 +1,161 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _DiskCache_incl_
+#define _DiskCache_incl_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <utility>
+
+namespace encfs {
+
+/*
+    Encrypted data of backing files, kept on a local disk (--diskcache).
+
+    Meant for volumes whose backing directory is on a network file system:
+    the ciphertext read from the backing files is written to a directory on
+    a local SSD as well, in chunks of ChunkSize bytes, so that reading it
+    again costs a local read instead of a round trip to the server, also
+    after a remount.  Only ciphertext is kept, so the cache reveals no more
+    than the backing files themselves.
+
+    Chunks are files named after the device and inode of the backing file
+    and the chunk's index.  With them, a stamp file keeps the size, mtime
+    and ctime of the backing file the chunks were read from.  The chunks are
+    only used while the backing file, as found on open, still has that
+    stamp, which is the consistency network file systems give between an
+    open and the last close anyway.  Changes made through the mount drop the
+    chunks they touch, and record the new stamp once the file is closed.
+    Reads filling the cache while a chunk is dropped don't store it.  The
+    least recently used chunks go once the cache outgrows maxBytes.
+*/
+class DiskCache {
+ public:
+  // bytes of the backing file each chunk holds
+  static const size_t ChunkSize = 128 << 10;
+
+  struct Key {
+    uint64_t dev;
+    uint64_t ino;
+
+    bool operator==(const Key &other) const {
+      return dev == other.dev && ino == other.ino;
+    }
+  };
+
+  // The cache in directory dir, which is created if missing.  Volumes of
+  // the process using the same directory share it.  Null if the directory
+  // can't be used, or is used by another process.
+  static std::shared_ptr<DiskCache> open(const std::string &dir,
+                                         size_t maxBytes);
+
+  DiskCache(const std::string &dir, size_t maxBytes);
+  ~DiskCache();
+
+  DiskCache(const DiskCache &src) = delete;
+  DiskCache &operator=(const DiskCache &src) = delete;
+
+  // The backing file with stat st was opened: drop what is kept of an
+  // older version of it.  False if its chunks can't be used now, because
+  // its stamp might still change without changing its times.
+  bool validate(const Key &key, const struct stat &st);
+
+  // The backing file was changed through the mount, and has stat st now.
+  void update(const Key &key, const struct stat &st);
+
+  // To be taken before reading the backing file for put()
+  uint64_t generation(const Key &key);
+
+  // Read len bytes at offset (in the chunk) of chunk index into buf.
+  // Returns the number of bytes read, fewer at the end of the file, or -1
+  // if the chunk isn't kept.
+  ssize_t get(const Key &key, uint64_t index, size_t offset,
+              unsigned char *buf, size_t len);
+
+  // Keep len bytes of chunk index, read from the backing file, unless
+  // something was dropped since generation.
+  void put(const Key &key, uint64_t index, const unsigned char *data,
+           size_t len, uint64_t generation);
+
+  // Chunks first to last (inclusive) of the backing file changed
+  void drop(const Key &key, uint64_t first, uint64_t last);
+
+  // bytes kept
+  size_t size() const;
+
+ private:
+  struct Stamp {
+    int64_t size;
+    int64_t mtime;  // nanoseconds
+    int64_t ctime;
+  };
+  struct Chunk {
+    size_t bytes;
+    std::list<std::pair<Key, uint64_t>>::iterator lru;
+  };
+  struct File {
+    bool haveStamp;
+    bool stampStored;  // written to the stamp file
+    Stamp stamp;
+    uint64_t generation;
+    std::map<uint64_t, Chunk> chunks;
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return std::hash<uint64_t>()(key.ino * 31 + key.dev);
+    }
+  };
+  using FileMap = std::unordered_map<Key, File, KeyHash>;
+
+  static Stamp stampOf(const struct stat &st);
+  static bool settled(const struct stat &st);
+
+  std::string chunkPath(const Key &key, uint64_t index) const;
+  std::string stampPath(const Key &key) const;
+  bool lockDir();
+  void load();
+  bool storeStamp(const Key &key, const Stamp &stamp);
+  File &fileOf(const Key &key);
+  void dropChunk(FileMap::iterator file,
+                 std::map<uint64_t, Chunk>::iterator chunk);
+  void dropAll(FileMap::iterator file);
+  void forget(FileMap::iterator file);
+  void evict();
+
+  const std::string _dir;  // ends with a '/'
+  const size_t _maxBytes;
+  int _lockFd;
+
+  mutable pthread_mutex_t _mutex;
+  FileMap _files;
+  std::list<std::pair<Key, uint64_t>> _lru;  // most recently used first
+  size_t _bytes;
+  uint64_t _generation;  // bumped by every drop
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,129 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "EntryTimeouts.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace encfs {
+
+const int EntryTimeouts::AgeDivisor;
+
+// opcodes of the FUSE protocol
+static const uint32_t FuseLookup = 1;
+static const uint32_t FuseGetattr = 3;
+static const uint32_t FuseSetattr = 4;
+static const uint32_t FuseSymlink = 6;
+static const uint32_t FuseMknod = 8;
+static const uint32_t FuseMkdir = 9;
+static const uint32_t FuseLink = 13;
+static const uint32_t FuseCreate = 35;
+
+// offsets in fuse_entry_out and fuse_attr_out, and in their fuse_attr
+static const size_t EntryNodeId = 0;
+static const size_t EntryValid = 16;
+static const size_t EntryAttrValid = 24;
+static const size_t EntryValidNsec = 32;
+static const size_t EntryAttrValidNsec = 36;
+static const size_t EntryAttr = 40;
+static const size_t AttrValid = 0;
+static const size_t AttrValidNsec = 8;
+static const size_t AttrAttr = 16;
+static const size_t AttrMtime = 32;
+static const size_t AttrCtime = 40;
+static const size_t AttrMtimeNsec = 52;
+static const size_t AttrCtimeNsec = 56;
+
+static const uint64_t NsPerSec = 1000000000;
+
+template <typename T>
+static T load(const char *p) {
+  T v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+template <typename T>
+static void store(char *p, T v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+// the time in ns, of the pair of fields at sec and nsec
+static uint64_t loadTime(const char *sec, const char *nsec) {
+  return load<uint64_t>(sec) * NsPerSec + load<uint32_t>(nsec);
+}
+
+static void storeTime(char *sec, char *nsec, uint64_t ns) {
+  store<uint64_t>(sec, ns / NsPerSec);
+  store<uint32_t>(nsec, (uint32_t)(ns % NsPerSec));
+}
+
+// when the attributes at attr last changed
+static uint64_t changedAt(const char *attr) {
+  return std::max(loadTime(attr + AttrMtime, attr + AttrMtimeNsec),
+                  loadTime(attr + AttrCtime, attr + AttrCtimeNsec));
+}
+
+EntryTimeouts::EntryTimeouts(int maxSeconds)
+    : _max((uint64_t)std::max(maxSeconds, 0) * NsPerSec) {}
+
+bool EntryTimeouts::answersEntry(uint32_t opcode) {
+  return opcode == FuseLookup || opcode == FuseSymlink ||
+         opcode == FuseMknod || opcode == FuseMkdir || opcode == FuseLink ||
+         opcode == FuseCreate;
+}
+
+bool EntryTimeouts::answersAttr(uint32_t opcode) {
+  return opcode == FuseGetattr || opcode == FuseSetattr;
+}
+
+uint64_t EntryTimeouts::timeout(uint64_t changed, uint64_t now,
+                                uint64_t given) const {
+  uint64_t age = now > changed ? now - changed : 0;
+  return std::max(given, std::min(age / AgeDivisor, _max));
+}
+
+void EntryTimeouts::adjust(uint32_t opcode, char *out, size_t len,
+                           uint64_t now) const {
+  if (answersEntry(opcode)) {
+    // a name known to be missing has a timeout of its own
+    if (len < EntryAttr + AttrCtimeNsec + 4 ||
+        load<uint64_t>(out + EntryNodeId) == 0) {
+      return;
+    }
+    uint64_t changed = changedAt(out + EntryAttr);
+    char *valid = out + EntryValid;
+    char *validNsec = out + EntryValidNsec;
+    storeTime(valid, validNsec,
+              timeout(changed, now, loadTime(valid, validNsec)));
+    valid = out + EntryAttrValid;
+    validNsec = out + EntryAttrValidNsec;
+    storeTime(valid, validNsec,
+              timeout(changed, now, loadTime(valid, validNsec)));
+  } else if (answersAttr(opcode)) {
+    if (len < AttrAttr + AttrCtimeNsec + 4) {
+      return;
+    }
+    uint64_t changed = changedAt(out + AttrAttr);
+    char *valid = out + AttrValid;
+    char *validNsec = out + AttrValidNsec;
+    storeTime(valid, validNsec,
+              timeout(changed, now, loadTime(valid, validNsec)));
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,67 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _EntryTimeouts_incl_
+#define _EntryTimeouts_incl_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace encfs {
+
+/*
+    Timeouts of the kernel's names and attributes by entry (--adaptivettl).
+
+    libfuse 2 answers every lookup and getattr with the timeouts of
+    entry_timeout and attr_timeout, the same for a tree nobody has touched
+    in a year as for a directory a build writes to.  The FUSE loop instead
+    gives each answer a tenth of the time since the entry last changed (its
+    modification or change time, whichever is later), as NFS clients do
+    for their attribute cache: what was stable for a long time is likely to
+    stay so.  The timeout isn't less than the one libfuse gave, nor more
+    than the maximum, so entries changed just now keep the mount's
+    timeouts.
+
+    Answers are rewritten in place as they go out on the device, where
+    they are raw fuse_entry_out and fuse_attr_out structures.
+*/
+class EntryTimeouts {
+ public:
+  // entries age tenfold into their timeout
+  static const int AgeDivisor = 10;
+
+  explicit EntryTimeouts(int maxSeconds);
+
+  // true for the opcodes answered with fuse_entry_out (lookup, mknod,
+  // mkdir, symlink, link, create) or fuse_attr_out (getattr, setattr)
+  static bool answersEntry(uint32_t opcode);
+  static bool answersAttr(uint32_t opcode);
+
+  // the timeout in ns of an entry changed at changed, given the mount's
+  // timeout given, all in ns
+  uint64_t timeout(uint64_t changed, uint64_t now, uint64_t given) const;
+
+  // Rewrite the timeouts of the answer to a request of opcode, the len
+  // bytes of out which follow the header, at time now (ns since the epoch)
+  void adjust(uint32_t opcode, char *out, size_t len, uint64_t now) const;
+
+ private:
+  const uint64_t _max;
+};
+
+}  // namespace encfs
+
+#endif
@@ -1,10 +1,87 @@
 #include "Error.h"
 
+#include <cstdlib>
+#include <string>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "AsyncLog.h"
+
 INITIALIZE_EASYLOGGINGPP
 
 namespace encfs {
 
 el::base::DispatchAction rlogAction = el::base::DispatchAction::NormalLog;
+int logVerbosity = 0;
+bool logDebug = true;
+
+// channels of the log lines
+static const int StandardError = 0;
+static const int SysLog = 1;
+
+static AsyncLog *asyncLog = nullptr;
+
+static int sysLogPriority(el::Level level) {
+  switch (level) {
+    case el::Level::Fatal:
+      return LOG_EMERG;
+    case el::Level::Error:
+      return LOG_ERR;
+    case el::Level::Warning:
+      return LOG_WARNING;
+    case el::Level::Info:
+      return LOG_INFO;
+    case el::Level::Debug:
+      return LOG_DEBUG;
+    default:
+      // verbose lines are rate limited too
+      return LOG_DEBUG;
+  }
+}
+
+static void writeLogLine(int channel, int priority, const char *line,
+                         size_t len) {
+  if (channel == SysLog) {
+    syslog(priority, "%.*s", (int)len, line);
+    return;
+  }
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char *>(line);
+  iov[0].iov_len = len;
+  iov[1].iov_base = const_cast<char *>("\n");
+  iov[1].iov_len = 1;
+  ssize_t res = writev(STDERR_FILENO, iov, 2);
+  (void)res;
+}
+
+// Formats the lines on the caller's thread, as the default dispatch does,
+// and queues them for the log thread.
+class AsyncLogDispatch : public el::LogDispatchCallback {
+ protected:
+  void handle(const el::LogDispatchData *data) override {
+    const el::LogMessage *msg = data->logMessage();
+    el::Logger *logger = msg->logger();
+    int channel;
+    if (data->dispatchAction() == el::base::DispatchAction::SysLog) {
+      channel = SysLog;
+    } else if (data->dispatchAction() ==
+                   el::base::DispatchAction::NormalLog &&
+               logger->typedConfigurations()->toStandardOutput(msg->level())) {
+      channel = StandardError;
+    } else {
+      return;
+    }
+
+    std::string line = logger->logBuilder()->build(msg, false);
+    if (channel == StandardError &&
+        el::Loggers::hasFlag(el::LoggingFlag::ColoredTerminalOutput)) {
+      logger->logBuilder()->convertToColoredOutput(&line, msg->level());
+    }
+    asyncLog->write(channel, sysLogPriority(msg->level()), line.data(),
+                    line.size());
+  }
+};
 
 Error::Error(const char *msg) : runtime_error(msg) {}
 
@@ -24,12 +101,37 @@ void initLogging(bool enable_debug, bool is_daemon) {
   if (!enable_debug) {
     suffix = "";
     defaultConf.set(el::Level::Debug, el::ConfigurationType::Enabled, "false");
+    logDebug = false;
   } else {
     el::Loggers::setVerboseLevel(1);
+    logVerbosity = 1;
+    logDebug = true;
   }
   defaultConf.setGlobally(el::ConfigurationType::Format,
                           prefix + std::string("%level %msg") + suffix);
   el::Loggers::reconfigureLogger("default", defaultConf);
 }
 
+void startAsyncLogging(int maxPerSecond) {
+  if (asyncLog == nullptr) {
+    // kept to the end, as other threads may still log during exit
+    asyncLog = new AsyncLog(4096, maxPerSecond, writeLogLine);
+    atexit(stopAsyncLogging);
+  }
+  el::Helpers::installLogDispatchCallback<AsyncLogDispatch>("AsyncLogDispatch");
+  el::Helpers::uninstallLogDispatchCallback<
+      el::base::DefaultLogDispatchCallback>("DefaultLogDispatchCallback");
+}
+
+void stopAsyncLogging() {
+  if (asyncLog == nullptr) {
+    return;
+  }
+  el::Helpers::installLogDispatchCallback<
+      el::base::DefaultLogDispatchCallback>("DefaultLogDispatchCallback");
+  el::Helpers::uninstallLogDispatchCallback<AsyncLogDispatch>(
+      "AsyncLogDispatch");
+  asyncLog->flush();
+}
+
 }  // namespace encfs
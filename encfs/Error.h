@@ -32,12 +32,40 @@ class Error : public std::runtime_error {
 
 void initLogging(bool enable_debug = false, bool is_daemon = false);
 
+// Write log lines on a background thread from now on, and drop lines below
+// warnings beyond maxPerSecond a second (0 for no limit).  The lines queued
+// are written out at exit.
+void startAsyncLogging(int maxPerSecond);
+
+// Write out the lines queued, and log synchronously again
+void stopAsyncLogging();
+
 // This can be changed to change log action between normal and syslog logging.
 // Not thread-safe, so any change must occur outside of threading context.
 extern el::base::DispatchAction rlogAction;
 
-#define RLOG(LEVEL, ...) \
-  C##LEVEL(el::base::Writer, rlogAction, ELPP_CURR_FILE_LOGGER_ID)
+// The verbose level, and whether debug messages are enabled, as set by
+// initLogging.  A disabled VLOG or RLOG(DEBUG) costs a branch on these,
+// rather than a lookup in easylogging's registry, and its stream is never
+// built.
+extern int logVerbosity;
+extern bool logDebug;
+
+#define ENCFS_RLOG_ON_DEBUG encfs::logDebug
+#define ENCFS_RLOG_ON_INFO true
+#define ENCFS_RLOG_ON_WARNING true
+#define ENCFS_RLOG_ON_ERROR true
+
+#define RLOG(LEVEL, ...)        \
+  if (!ENCFS_RLOG_ON_##LEVEL) { \
+  } else                        \
+    C##LEVEL(el::base::Writer, rlogAction, ELPP_CURR_FILE_LOGGER_ID)
+
+#undef VLOG
+#define VLOG(vlevel)                      \
+  if (encfs::logVerbosity < (vlevel)) {   \
+  } else                                  \
+    CVLOG(vlevel, ELPP_CURR_FILE_LOGGER_ID)
 
 }  // namespace encfs
 
@@ -41,6 +41,20 @@ enum ConfigType {
 };
 
 struct EncFS_Opts;
+class BlockCache;
+class FileIVCache;
+class BufferBudget;
+class DirFdCache;
+class DiskCache;
+class Fscrypt;
+class IVJournal;
+class IntentLog;
+class IOScheduler;
+class MemoryPressure;
+class Policies;
+class Stripes;
+class SyncBatcher;
+class WorkerPool;
 class Cipher;
 class NameIO;
 
@@ -64,19 +78,27 @@ struct EncFSConfig {
   std::vector<unsigned char> keyData;
   std::vector<unsigned char> salt;
 
-  int kdfIterations;
+  int kdfIterations;  // PBKDF2 iterations, or Argon2id passes
   long desiredKDFDuration;
+  int kdfMemory;  // Argon2id memory in KiB, 0 when PBKDF2 is used
+  int kdfLanes;   // Argon2id lanes
 
   bool plainData;         // do not encrypt file content
 
   int blockMACBytes;      // MAC headers on blocks..
   int blockMACRandBytes;  // number of random bytes in the block header
+  int blockMACVersion;    // MACFileIO version, 3 for SipHash MACs
+  bool blockMACExtents;   // MACs kept in tag extents, not block headers
 
   bool uniqueIV;            // per-file Initialization Vector
   bool externalIVChaining;  // IV seeding by filename IV chaining
 
   bool chainedNameIV;  // filename IV chaining
   bool allowHoles;     // allow holes in files (implicit zero blocks)
+  bool alignedBlocks;  // file header padded, so blocks are 4 KiB aligned
+  int compression;     // CompressFileIO codec, 0 for none
+  int largeBlockSize;  // block size of files marked large, 0 if off
+  bool kernelContent;  // file content encrypted by fscrypt, see Fscrypt
 
   EncFSConfig() : keyData(), salt() {
     cfgType = Config_None;
@@ -84,19 +106,33 @@ struct EncFSConfig {
     plainData = false;
     blockMACBytes = 0;
     blockMACRandBytes = 0;
+    blockMACVersion = 2;
+    blockMACExtents = false;
     uniqueIV = false;
     externalIVChaining = false;
     chainedNameIV = false;
     allowHoles = false;
+    alignedBlocks = false;
+    compression = 0;
+    largeBlockSize = 0;
+    kernelContent = false;
 
     kdfIterations = 0;
     desiredKDFDuration = 500;
+    kdfMemory = 0;
+    kdfLanes = 0;
   }
 
   CipherKey getUserKey(bool useStdin);
   CipherKey getUserKey(const std::string &passwordProgram,
                        const std::string &rootDir);
   CipherKey getNewUserKey();
+  // the user key of a password the caller has, null if it is empty
+  CipherKey keyFromPassword(const std::string &password);
+
+  // Derive the next user key with Argon2id rather than PBKDF2, or back.  A
+  // new salt and cost are chosen when the key is made.
+  void selectKDF(bool argon2);
 
   std::shared_ptr<Cipher> getCipher() const;
 
@@ -124,13 +160,54 @@ struct FSConfig {
   CipherKey key;
   std::shared_ptr<NameIO> nameCoding;
 
+  // decoded block cache shared by all files, null if disabled
+  std::shared_ptr<BlockCache> blockCache;
+  // background threads for read ahead, null if disabled
+  std::shared_ptr<WorkerPool> workers;
+  // headers waiting for their new external IV, null unless
+  // externalIVChaining with --ivjournal (or a log left behind by it)
+  std::shared_ptr<IVJournal> ivJournal;
+  // writes held in write-back buffers, null unless --intentlog
+  std::shared_ptr<IntentLog> intentLog;
+  // decoded file IVs of recently opened files, null if disabled
+  std::shared_ptr<FileIVCache> fileIVCache;
+  // bounds the block buffers of open files, always set by initFS
+  std::shared_ptr<BufferBudget> bufferBudget;
+  // descriptors of backing directories, null if disabled
+  std::shared_ptr<DirFdCache> dirFds;
+  // ciphertext of backing files on a local disk, null unless --diskcache
+  std::shared_ptr<DiskCache> diskCache;
+  // the backing directories of a striped volume, null unless --stripe
+  std::shared_ptr<Stripes> stripes;
+  // bounds and merges reads and writes of backing files, null unless
+  // --iodepth
+  std::shared_ptr<IOScheduler> ioScheduler;
+  // batches concurrent fsyncs, null unless --groupsync
+  std::shared_ptr<SyncBatcher> syncBatcher;
+  // shrinks the caches under memory pressure, null if disabled
+  std::shared_ptr<MemoryPressure> memoryPressure;
+  // the fscrypt key added for the files, null unless kernelContent
+  std::shared_ptr<Fscrypt> kernelKey;
+  // settings of subtrees, null unless --policy
+  std::shared_ptr<Policies> policies;
+
   bool forceDecode;        // force decode on MAC block failures
   bool reverseEncryption;  // reverse encryption operation
 
   bool idleTracking;  // turn on idle monitoring of filesystem
 
+  bool uring;  // backing files are read and written through io_uring
+
+  // the backing filesystem writes back on close (NFS and the like), so a
+  // close of a written file is passed on to it
+  bool closeFlush;
+
   FSConfig()
-      : forceDecode(false), reverseEncryption(false), idleTracking(false) {}
+      : forceDecode(false),
+        reverseEncryption(false),
+        idleTracking(false),
+        uring(false),
+        closeFlush(true) {}
 };
 
 using FSConfigPtr = std::shared_ptr<FSConfig>;
@@ -0,0 +1,98 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FairScheduler.h"
+
+#include <algorithm>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+const size_t FairScheduler::MinCost;
+
+FairScheduler::FairScheduler(int slots, const Weights &weights)
+    : _slots(std::max(slots, 1)),
+      _weights(weights),
+      _running(0),
+      _virtualTime(0),
+      _arrivals(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+FairScheduler::~FairScheduler() { pthread_mutex_destroy(&_mutex); }
+
+int FairScheduler::running() const {
+  Lock lock(_mutex);
+  return _running;
+}
+
+size_t FairScheduler::waiting() const {
+  Lock lock(_mutex);
+  return _queue.size();
+}
+
+void FairScheduler::acquire(uid_t uid, size_t bytes) {
+  unsigned int weight = 1;
+  auto it = _weights.find(uid);
+  if (it != _weights.end() && it->second > 0) {
+    weight = it->second;
+  }
+  uint64_t cost = std::max(bytes, MinCost) / weight;
+
+  Lock lock(_mutex);
+  uint64_t &finish = _finish[uid];
+  uint64_t start = std::max(_virtualTime, finish);
+  finish = start + cost;
+
+  if (_running < _slots && _queue.empty()) {
+    _running += 1;
+    _virtualTime = start;
+    return;
+  }
+
+  Waiter waiter;
+  pthread_cond_init(&waiter.cond, nullptr);
+  waiter.admitted = false;
+  _queue[Tag(start, _arrivals++)] = &waiter;
+  while (!waiter.admitted) {
+    pthread_cond_wait(&waiter.cond, &_mutex);
+  }
+  pthread_cond_destroy(&waiter.cond);
+}
+
+void FairScheduler::release() {
+  Lock lock(_mutex);
+  _running -= 1;
+  if (_queue.empty()) {
+    // nobody is behind: forget the users, their clocks all start over
+    if (_running == 0) {
+      _finish.clear();
+      _virtualTime = 0;
+    }
+    return;
+  }
+
+  auto next = _queue.begin();
+  _virtualTime = next->first.first;
+  next->second->admitted = true;
+  pthread_cond_signal(&next->second->cond);
+  _queue.erase(next);
+  _running += 1;
+}
+
+}  // namespace encfs
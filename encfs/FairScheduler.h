@@ -0,0 +1,114 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FairScheduler_incl_
+#define _FairScheduler_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <pthread.h>
+#include <sys/types.h>
+#include <utility>
+
+namespace encfs {
+
+/*
+    Weighted fair sharing of the data path between users (see --fairshare).
+
+    On a --public mount one process serves every user, and a single user
+    streaming a large file can keep all FUSE threads busy encrypting while
+    everybody else's ls waits.  Reads and writes take one of a fixed number
+    of slots for as long as they run; metadata operations never wait here,
+    so they keep priority over bulk data as long as there are more FUSE
+    threads than slots.
+
+    When all slots are taken, requests queue up and are let in by start-time
+    fair queuing: each user has a virtual clock which advances by the bytes
+    of each request divided by the user's weight, starting from the tag of
+    the request last let in if the user was idle.  The request with the
+    smallest start tag goes next, so over time each busy user gets a share
+    of the slots in proportion to its weight, whatever the number and size
+    of its requests.
+*/
+class FairScheduler {
+ public:
+  using Weights = std::map<uid_t, unsigned int>;
+
+  // requests smaller than this are charged as this
+  static const size_t MinCost = 4096;
+
+  // slots is the number of reads and writes let in at once.  Users not in
+  // weights have weight 1.
+  FairScheduler(int slots, const Weights &weights);
+  ~FairScheduler();
+
+  FairScheduler(const FairScheduler &src) = delete;
+  FairScheduler &operator=(const FairScheduler &src) = delete;
+
+  // Wait for a slot for a request of uid of bytes size, and give it back
+  // when done
+  void acquire(uid_t uid, size_t bytes);
+  void release();
+
+  // Holds a slot for its lifetime, nothing if scheduler is null
+  class Slot {
+   public:
+    Slot(FairScheduler *scheduler, uid_t uid, size_t bytes)
+        : _scheduler(scheduler) {
+      if (_scheduler != nullptr) {
+        _scheduler->acquire(uid, bytes);
+      }
+    }
+    ~Slot() {
+      if (_scheduler != nullptr) {
+        _scheduler->release();
+      }
+    }
+    Slot(const Slot &src) = delete;
+    Slot &operator=(const Slot &src) = delete;
+
+   private:
+    FairScheduler *_scheduler;
+  };
+
+  // requests running and waiting
+  int running() const;
+  size_t waiting() const;
+
+ private:
+  struct Waiter {
+    pthread_cond_t cond;
+    bool admitted;
+  };
+  // start tag and arrival order
+  using Tag = std::pair<uint64_t, uint64_t>;
+
+  const int _slots;
+  const Weights _weights;
+
+  mutable pthread_mutex_t _mutex;
+  int _running;
+  uint64_t _virtualTime;  // start tag of the request last let in
+  uint64_t _arrivals;
+  std::map<uid_t, uint64_t> _finish;  // virtual clock of each user
+  std::map<Tag, Waiter *> _queue;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileHandleTable.h"
+
+#include "easylogging++.h"
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+FileHandleTable::FileHandleTable() : _allocated(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+  for (auto &page : _pages) {
+    page = nullptr;
+  }
+}
+
+FileHandleTable::~FileHandleTable() {
+  for (auto &page : _pages) {
+    delete[] page.load();
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+FileHandleTable::Slot *FileHandleTable::slot(uint32_t index) const {
+  if (index >= MaxPages * PageSize) {
+    return nullptr;
+  }
+  Slot *page = _pages[index >> PageBits].load(std::memory_order_acquire);
+  if (page == nullptr) {
+    return nullptr;
+  }
+  return &page[index & (PageSize - 1)];
+}
+
+uint64_t FileHandleTable::insert(const std::shared_ptr<FileNode> &node) {
+  Lock lock(_mutex);
+
+  if (_free.empty()) {
+    if (_allocated == MaxPages * PageSize) {
+      RLOG(WARNING) << "file handle table is full";
+      return 0;
+    }
+    Slot *page = new Slot[PageSize];
+    for (uint32_t i = 0; i < PageSize; ++i) {
+      page[i].generation = 0;
+    }
+    _pages[_allocated >> PageBits].store(page, std::memory_order_release);
+    for (uint32_t i = PageSize; i > 0; --i) {
+      _free.push_back(_allocated + i - 1);
+    }
+    _allocated += PageSize;
+  }
+
+  uint32_t index = _free.back();
+  _free.pop_back();
+
+  Slot *s = slot(index);
+  uint32_t generation = s->generation.load(std::memory_order_relaxed) + 1;
+  s->node = node;
+  s->generation.store(generation, std::memory_order_release);
+
+  return ((uint64_t)generation << 32) | (index + 1);
+}
+
+FileHandleTable::Slot *FileHandleTable::live(uint64_t fh) const {
+  uint32_t index = (uint32_t)fh - 1;
+  uint32_t generation = fh >> 32;
+
+  Slot *s = slot(index);
+  if (s == nullptr || (generation & 1) == 0 ||
+      s->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  return s;
+}
+
+std::shared_ptr<FileNode> FileHandleTable::lookup(uint64_t fh) const {
+  Slot *s = live(fh);
+  return s != nullptr ? s->node : nullptr;
+}
+
+FileNode *FileHandleTable::borrow(uint64_t fh) const {
+  Slot *s = live(fh);
+  return s != nullptr ? s->node.get() : nullptr;
+}
+
+void FileHandleTable::erase(uint64_t fh) {
+  uint32_t index = (uint32_t)fh - 1;
+  uint32_t generation = fh >> 32;
+
+  std::shared_ptr<FileNode> node;  // released outside of the lock
+  Lock lock(_mutex);
+
+  Slot *s = slot(index);
+  if (s == nullptr || (generation & 1) == 0 ||
+      s->generation.load(std::memory_order_relaxed) != generation) {
+    return;
+  }
+  s->generation.store(generation + 1, std::memory_order_release);
+  node.swap(s->node);
+  _free.push_back(index);
+}
+
+size_t FileHandleTable::size() const {
+  Lock lock(_mutex);
+  return _allocated - _free.size();
+}
+
+}  // namespace encfs
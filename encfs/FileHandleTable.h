@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FileHandleTable_incl_
+#define _FileHandleTable_incl_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <vector>
+
+namespace encfs {
+
+class FileNode;
+
+/*
+    Maps the FUSE file handles of open files to their FileNode.
+
+    A handle is a slot index in the low 32 bits, off by one so that no handle
+    is 0, and the generation of the slot in the high bits.  Slots live in
+    pages which are allocated as needed and never move, so lookup() is an
+    array index and a generation check without any lock.  Inserting and
+    erasing take a mutex for the free list.
+
+    A slot is only emptied by erase() for the last release of its handle, and
+    the kernel sends no more requests with a handle once it released it, so a
+    lookup with a live handle never meets the erase of its slot.  Stale
+    handles fail the generation check once the slot is reused.
+*/
+class FileHandleTable {
+ public:
+  FileHandleTable();
+  ~FileHandleTable();
+
+  // Returns the new handle, or 0 if the table is full.
+  uint64_t insert(const std::shared_ptr<FileNode> &node);
+  std::shared_ptr<FileNode> lookup(uint64_t fh) const;
+  // As lookup(), without touching the reference count.  The node stays
+  // valid until the handle is erased, which is enough for a request that
+  // carries the handle.
+  FileNode *borrow(uint64_t fh) const;
+  void erase(uint64_t fh);
+
+  // number of handles in use
+  size_t size() const;
+
+ private:
+  FileHandleTable(const FileHandleTable &src);             // not allowed
+  FileHandleTable &operator=(const FileHandleTable &src);  // not allowed
+
+  static const int PageBits = 10;
+  static const uint32_t PageSize = 1u << PageBits;
+  static const uint32_t MaxPages = 4096;
+
+  struct Slot {
+    // odd while the slot holds a node
+    std::atomic<uint32_t> generation;
+    std::shared_ptr<FileNode> node;
+  };
+
+  Slot *slot(uint32_t index) const;
+  // the slot of handle fh, if it is in use
+  Slot *live(uint64_t fh) const;
+
+  std::atomic<Slot *> _pages[MaxPages];
+
+  mutable pthread_mutex_t _mutex;
+  uint32_t _allocated;  // slots in allocated pages
+  std::vector<uint32_t> _free;
+};
+
+}  // namespace encfs
+
+#endif
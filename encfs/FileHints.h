@@ -0,0 +1,53 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FileHints_incl_
+#define _FileHints_incl_
+
+/*
+    ioctls a program can issue on a file open in an EncFS mount, to tell
+    how it is going to use the file (see encfs_ioctl and FileNode::advise).
+    Plain C, so that programs can copy this header.
+
+    ENCFS_IOC_PIN keeps the decoded blocks of the file in the block cache
+    (--blockcache) over those of other files, up to half of the cache, and
+    ENCFS_IOC_UNPIN ends that.  ENCFS_IOC_READAHEAD sets the read ahead
+    policy to one of ENCFS_READAHEAD_*.  ENCFS_IOC_PREFETCH reads a range,
+    length 0 for the rest of the file, into the block cache in the
+    background.  Hints last as long as some handle keeps the file open.
+    Other file systems reject the ioctls with ENOTTY.
+*/
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#define ENCFS_READAHEAD_NORMAL 0      // detect streams
+#define ENCFS_READAHEAD_SEQUENTIAL 1  // read ahead of every read, at once
+#define ENCFS_READAHEAD_RANDOM 2      // no read ahead
+#define ENCFS_READAHEAD_ONCE 3        // streamed once, don't keep the blocks
+
+struct encfs_range {
+  uint64_t offset;
+  uint64_t length;
+};
+
+#define ENCFS_IOC_PIN _IO('E', 0x40)
+#define ENCFS_IOC_UNPIN _IO('E', 0x41)
+#define ENCFS_IOC_READAHEAD _IOW('E', 0x42, uint32_t)
+#define ENCFS_IOC_PREFETCH _IOW('E', 0x43, struct encfs_range)
+
+#endif
@@ -20,14 +20,168 @@
 
 #include "FileIO.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>  // for memcpy
+
+#include "MemoryPool.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENCFS_ZERO_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define ENCFS_ZERO_NEON
+#include <arm_neon.h>
+#endif
+
 namespace encfs {
 
+/*
+    Checked for every block read from a volume which allows holes, so it goes
+    through 64 bytes at a time, and returns at the first of them with a non
+    zero byte.  Encrypted blocks rarely get past the first.  SSE2 is always
+    present on x86-64.
+*/
+bool isZeroBlock(const unsigned char *data, size_t len) {
+  size_t i = 0;
+#if defined(ENCFS_ZERO_SSE2)
+  for (; i + 64 <= len; i += 64) {
+    const __m128i *p = (const __m128i *)(data + i);
+    __m128i acc = _mm_or_si128(
+        _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+        _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) !=
+        0xffff) {
+      return false;
+    }
+  }
+#elif defined(ENCFS_ZERO_NEON)
+  for (; i + 64 <= len; i += 64) {
+    uint8x16_t acc =
+        vorrq_u8(vorrq_u8(vld1q_u8(data + i), vld1q_u8(data + i + 16)),
+                 vorrq_u8(vld1q_u8(data + i + 32), vld1q_u8(data + i + 48)));
+    if (vmaxvq_u8(acc) != 0) {
+      return false;
+    }
+  }
+#endif
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    if (word != 0) {
+      return false;
+    }
+  }
+  for (; i < len; ++i) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
 FileIO::FileIO() = default;
 
 FileIO::~FileIO() = default;
 
 unsigned int FileIO::blockSize() const { return 1; }
 
+ssize_t FileIO::writeInPlace(const IORequest &req) { return write(req); }
+
+ssize_t FileIO::writeGather(off_t offset, const struct iovec *iov,
+                            int count) {
+  size_t len = 0;
+  for (int i = 0; i < count; ++i) {
+    len += iov[i].iov_len;
+  }
+  MemBlock mb = MemoryPool::allocate(len);
+  unsigned char *p = mb.data;
+  for (int i = 0; i < count; ++i) {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+
+  IORequest req;
+  req.offset = offset;
+  req.data = mb.data;
+  req.dataLen = len;
+  ssize_t res = writeInPlace(req);
+  MemoryPool::release(mb);
+  return res;
+}
+
+void FileIO::readAsync(const IORequest &req, IODone done) const {
+  done(read(req));
+}
+
+void FileIO::invalidate() {}
+
+void FileIO::releaseBuffers() {}
+
+void FileIO::setReadAhead(int kib) { (void)kib; }
+
+int FileIO::advise(Advice advice, off_t offset, off_t length) {
+  (void)advice;
+  (void)offset;
+  (void)length;
+  return -EOPNOTSUPP;
+}
+
+int FileIO::create(mode_t mode) {
+  (void)mode;
+  return -EOPNOTSUPP;
+}
+
+int FileIO::punchHole(off_t offset, off_t length) {
+  (void)offset;
+  (void)length;
+  return -EOPNOTSUPP;
+}
+
+int FileIO::allocate(off_t offset, off_t length) {
+  (void)offset;
+  (void)length;
+  return -EOPNOTSUPP;
+}
+
+off_t FileIO::nextData(off_t offset) const { return offset; }
+
+off_t FileIO::nextHole(off_t offset) const {
+  off_t size = getSize();
+  return size < 0 ? size : std::max(offset, size);
+}
+
+off_t nextHoleBlock(const FileIO *base, off_t offset, off_t size, off_t bs,
+                    off_t lowerBs, off_t lowerStart) {
+  off_t lowerSize = base->getSize();
+  if (lowerSize < 0) {
+    return lowerSize;
+  }
+  off_t block = offset / bs;
+  while (block * bs < size) {
+    off_t hole = base->nextHole(lowerStart + block * lowerBs);
+    if (hole < 0) {
+      return hole;
+    }
+    // the first block starting in the hole
+    block = (std::max(hole - lowerStart, (off_t)0) + lowerBs - 1) / lowerBs;
+    if (block * bs >= size) {
+      break;
+    }
+    off_t start = lowerStart + block * lowerBs;
+    off_t data = base->nextData(start);
+    if (data < 0) {
+      return data;
+    }
+    if (data >= std::min(start + lowerBs, lowerSize)) {
+      return std::max(offset, block * bs);
+    }
+    // on past the block the data starts in
+    block = (data - lowerStart) / lowerBs + 1;
+  }
+  return std::max(offset, size);
+}
+
 bool FileIO::setIV(uint64_t iv) {
   (void)iv;
   return true;
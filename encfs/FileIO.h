@@ -21,9 +21,11 @@
 #ifndef _FileIO_incl_
 #define _FileIO_incl_
 
+#include <functional>
 #include <inttypes.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "Interface.h"
 #include "encfs.h"
@@ -42,8 +44,37 @@ struct IORequest {
 
 inline IORequest::IORequest() : offset(0), dataLen(0), data(0) {}
 
+// Whether all len bytes of data are zero, as blocks in a hole read back.
+bool isZeroBlock(const unsigned char *data, size_t len);
+
+class FileIO;
+
+// For layers which keep block n of bs bytes at lowerStart + n * lowerBs of
+// base, and read blocks which lie in a hole of base back as zeros: where
+// the first such block at or after offset starts, or size if there is
+// none.  Returns -errno on failure.
+off_t nextHoleBlock(const FileIO *base, off_t offset, off_t size, off_t bs,
+                    off_t lowerBs, off_t lowerStart);
+
+// Called with the result of an asynchronous request: the number of bytes, or
+// -errno.
+using IODone = std::function<void(ssize_t result)>;
+
 class FileIO {
  public:
+  // What a program expects of its use of the file (see advise()).  The
+  // first four are read ahead policies, and have the values of the
+  // ENCFS_READAHEAD_* constants of FileHints.h.
+  enum Advice {
+    Normal,      // read ahead of reads which follow each other
+    Sequential,  // read ahead at full size from the first read
+    Random,      // no read ahead, blocks read are kept
+    Once,        // read ahead, blocks read are treated as streamed
+    WillNeed,    // read a range into the cache, in the background
+    Pin,         // keep the cached blocks of the file over others
+    Unpin
+  };
+
   FileIO();
   virtual ~FileIO();
 
@@ -63,6 +94,10 @@ class FileIO {
   // file is open until the FileIO interface is destroyed.
   virtual int open(int flags) = 0;
 
+  // Create the file, which must not exist yet, and open it for writing, in
+  // one go.  Returns < 0 on error (-errno).  The default returns -EOPNOTSUPP.
+  virtual int create(mode_t mode);
+
   // get filesystem attributes for a file
   virtual int getAttr(struct stat *stbuf) const = 0;
   virtual off_t getSize() const = 0;
@@ -70,10 +105,66 @@ class FileIO {
   virtual ssize_t read(const IORequest &req) const = 0;
   virtual ssize_t write(const IORequest &req) = 0;
 
+  // Start a read, and call done with what read() would have returned once
+  // it completes -- on another thread, or before readAsync returns.
+  // req.data, and this FileIO, have to stay around until then.  The default
+  // calls read() right away; layers which can wait for the lower file
+  // without holding up a thread override it.
+  virtual void readAsync(const IORequest &req, IODone done) const;
+
+  // Same as write(), but req.data is scratch space which may be modified,
+  // e.g. encoded in place.  The default simply calls write().
+  virtual ssize_t writeInPlace(const IORequest &req);
+
+  // Write the count buffers of iov one after the other, starting at offset,
+  // as a single write.  Returns the number of bytes, or -errno.  The default
+  // copies them into one buffer for writeInPlace(); RawFileIO hands them to
+  // pwritev.
+  virtual ssize_t writeGather(off_t offset, const struct iovec *iov,
+                              int count);
+
   virtual int truncate(off_t size) = 0;
 
+  // Deallocate the given range, which reads back as zeros afterwards, and
+  // extend the file if the range reaches past its end.  Returns 0, or -errno.
+  // The default returns -EOPNOTSUPP, callers then write the zeros instead.
+  virtual int punchHole(off_t offset, off_t length);
+
+  // Reserve space for the given range in the lower file, without changing
+  // the file size or contents.  Returns 0, or -errno.  The default returns
+  // -EOPNOTSUPP.
+  virtual int allocate(off_t offset, off_t length);
+
+  // Where the first data at or after offset lies: the range up to it is a
+  // hole and reads as zeros.  Returns the file size if only a hole follows,
+  // or -errno.  The default knows of no holes and returns offset.
+  virtual off_t nextData(off_t offset) const;
+
+  // Where the first hole at or after offset starts, or the file size.
+  // Returns -errno on failure.  The default knows of no holes and returns
+  // the file size.
+  virtual off_t nextHole(off_t offset) const;
+
   virtual bool isWritable() const = 0;
 
+  // The file may have been changed by others while we kept it open: forget
+  // what is known of its size and contents.  The default does nothing.
+  virtual void invalidate();
+
+  // The file is idle: give back memory kept only to speed up the next
+  // request (see BufferBudget).  The default does nothing.
+  virtual void releaseBuffers();
+
+  // Read ahead up to kib KiB of the file, 0 for none, where the mount reads
+  // ahead at all; called before the file is used.  The default does
+  // nothing.
+  virtual void setReadAhead(int kib);
+
+  // Take a hint from the program using the file, offset and length give
+  // the range of WillNeed.  Returns 0, or -errno.  The default returns
+  // -EOPNOTSUPP.
+  virtual int advise(Advice advice, off_t offset, off_t length);
+
  private:
   // not implemented..
   FileIO(const FileIO &);
@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileIVCache.h"
+
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+FileIVCache::FileIVCache(size_t maxFiles) : _capacity(maxFiles) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+FileIVCache::~FileIVCache() {
+  while (!_lru.empty()) {
+    drop(_lru.begin());
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t FileIVCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+void FileIVCache::drop(EntryList::iterator it) {
+  _index.erase(it->ino);
+  it->fileIV = 0;
+  _lru.erase(it);
+}
+
+bool FileIVCache::get(const struct stat &st, uint64_t *fileIV) {
+  Lock lock(_mutex);
+
+  auto it = _index.find(st.st_ino);
+  if (it == _index.end()) {
+    return false;
+  }
+
+  EntryList::iterator entry = it->second;
+  if (entry->dev != st.st_dev || entry->ctime.tv_sec != st.st_ctim.tv_sec ||
+      entry->ctime.tv_nsec != st.st_ctim.tv_nsec) {
+    drop(entry);
+    return false;
+  }
+
+  _lru.splice(_lru.begin(), _lru, entry);
+  *fileIV = entry->fileIV;
+  return true;
+}
+
+void FileIVCache::put(const struct stat &st, uint64_t fileIV) {
+  if (_capacity == 0 || fileIV == 0) {
+    return;
+  }
+  if (st.st_ctime >= time(nullptr)) {
+    return;
+  }
+
+  Lock lock(_mutex);
+
+  auto it = _index.find(st.st_ino);
+  if (it != _index.end()) {
+    drop(it->second);
+  }
+
+  _lru.push_front(Entry());
+  Entry &entry = _lru.front();
+  entry.ino = st.st_ino;
+  entry.dev = st.st_dev;
+  entry.ctime = st.st_ctim;
+  entry.fileIV = fileIV;
+  _index[st.st_ino] = _lru.begin();
+
+  while (_index.size() > _capacity) {
+    drop(std::prev(_lru.end()));
+  }
+}
+
+}  // namespace encfs
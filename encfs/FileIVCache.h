@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FileIVCache_incl_
+#define _FileIVCache_incl_
+
+#include <cstdint>
+#include <list>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace encfs {
+
+/*
+    Bounded LRU cache of decoded file IVs (the uniqueIV header), keyed by
+    the backing file's inode, so that a file which is opened again doesn't
+    read and decode its header each time.
+
+    An entry is only returned while the backing file's device and ctime
+    still match.  Rewriting the header, as a rename with external IV
+    chaining does, changes the ctime, and the file IV itself stays the same
+    anyway.  As with LinkCache, files changed during the current second are
+    not accepted by put().
+*/
+class FileIVCache {
+ public:
+  explicit FileIVCache(size_t maxFiles);
+  ~FileIVCache();
+
+  FileIVCache(const FileIVCache &src) = delete;
+  FileIVCache &operator=(const FileIVCache &src) = delete;
+
+  // st is the current lstat of the backing file
+  bool get(const struct stat &st, uint64_t *fileIV);
+  void put(const struct stat &st, uint64_t fileIV);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    ino_t ino;
+    dev_t dev;
+    struct timespec ctime;
+    uint64_t fileIV;
+  };
+  using EntryList = std::list<Entry>;
+
+  void drop(EntryList::iterator it);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  EntryList _lru;  // most recently used first
+  std::unordered_map<ino_t, EntryList::iterator> _index;
+};
+
+}  // namespace encfs
+
+#endif
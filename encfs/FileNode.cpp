@@ -20,9 +20,12 @@
 
 #include "FileNode.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
+#include <ctime>
 #include <fcntl.h>
 #ifdef __linux__
 #include <sys/fsuid.h>
@@ -30,66 +33,154 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <utility>
 
+#include "CachedFileIO.h"
 #include "CipherFileIO.h"
+#include "CompressFileIO.h"
+#include "DirFdCache.h"
+#include "DirNode.h"
 #include "Error.h"
 #include "FileIO.h"
 #include "FileUtils.h"
+#include "IOScheduler.h"
+#include "IntentLog.h"
 #include "MACFileIO.h"
-#include "Mutex.h"
+#include "RangeLock.h"
 #include "RawFileIO.h"
+#include "SyncBatcher.h"
+#include "UringFileIO.h"
 
 using namespace std;
 
 namespace encfs {
 
 /*
-   TODO: locking at the FileNode level is inefficient, since this precludes
-   multiple IO operations from going on concurrently within the same file.
-
-   There is no reason why simultainous reads cannot be satisfied, or why one
-   read has to wait for the decoding of the previous read before it can be
-   sent to the IO subsystem!
+   Locking is done on ranges of blocks (in units of io->blockSize()):
+
+   - reads take a shared lock on the blocks they cover,
+   - writes which stay within the current file size take an exclusive lock
+     on the blocks they cover.  The file is not empty, so with uniqueIV the
+     header already exists and is only read (CipherFileIO serializes that),
+   - everything which may change the file size or re-open the file (writes
+     past the end, truncate, open, sync, mknod) locks the whole file
+     exclusively, which also keeps the size stable for the ranged operations
+     above.
+
+   With --writeback, writes smaller than the buffer are collected in a
+   contiguous plaintext extent instead, so that a run of small appends costs
+   one encoding of each block rather than a read-modify-write per call.  All
+   writes then lock the whole file exclusively.  Full blocks are written out
+   when the extent would outgrow the buffer, the rest on flush(), sync(),
+   truncate(), reads reaching into the extent, or when the buffers of the
+   whole mount hold more than MaxDirtyFactor times the per-file size.
+   With --intentlog, the buffered writes are logged as well, and return
+   once the log is on disk (see IntentLog).
+
+   On read-only mounts every open is a read-only one, and nothing writes,
+   truncates or re-opens a file while it is open, so reads and getAttr skip
+   the range locks.  Only --watch and --shared may still drop cached data
+   of an open file behind a read, so they keep them.
 */
 
+static const size_t MaxDirtyFactor = 32;
+
+static uint64_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// buffered bytes of all files
+static std::atomic<size_t> totalDirty(0);
+
+// Marks the file written when the call changing it returns, after its lock
+// is released, so that a closeFlushNeeded() meanwhile doesn't hide it.
+struct MarkWritten {
+  std::atomic<bool> &flag;
+  ~MarkWritten() { flag = true; }
+};
+
 FileNode::FileNode(DirNode *parent_, const FSConfigPtr &cfg,
                    const char *plaintextName_, const char *cipherName_,
                    uint64_t fuseFh) {
 
-  pthread_mutex_init(&mutex, nullptr);
-
-  Lock _lock(mutex);
-
   this->canary = CANARY_OK;
 
   this->_pname = plaintextName_;
-  this->_cname = cipherName_;
   this->parent = parent_;
+  setCipherName(cipherName_);
 
   this->fsConfig = cfg;
 
   this->fuseFh = fuseFh;
 
+  this->writeBackSize = 0;
+  this->dirtyOffset = 0;
+  this->written = false;
+  this->sharedMs = (uint64_t)std::max(cfg->opts->sharedTimeout, 0) * 1000;
+  this->checkedAt = 0;
+  memset(&checkedStat, 0, sizeof(checkedStat));
+  this->unlockedReads = cfg->opts->readOnly && !cfg->opts->watchBacking &&
+                        sharedMs == 0;
+
+  _policy = Policies::of(cfg->policies.get(), plaintextName_, *cfg->opts);
+
   // chain RawFileIO & CipherFileIO
-  std::shared_ptr<FileIO> rawIO(new RawFileIO(_cname));
-  io = std::shared_ptr<FileIO>(new CipherFileIO(rawIO, fsConfig));
+  std::shared_ptr<RawFileIO> rawIO;
+  if (cfg->uring) {
+    rawIO.reset(new UringFileIO(_cname, _policy.directIO, cfg->dirFds));
+  } else {
+    rawIO.reset(new RawFileIO(_cname, _policy.directIO, cfg->dirFds));
+  }
+  rawIO->setDropBehind(_policy.dropBehind);
+  rawIO->setWriteBehind((off_t)std::max(_policy.writeBehind, 0) << 20);
+  rawIO->setRelaxedStat(cfg->opts->netfsTimeout > 0);
+  rawIO->setScheduler(cfg->ioScheduler);
+  io = rawIO;
+  if (cfg->diskCache) {
+    io = std::shared_ptr<FileIO>(new CachedFileIO(io, cfg->diskCache));
+  }
+  // with kernelContent, the lower file system encrypts the data, and
+  // plainData without IV headers stores it as it is: either way there's
+  // nothing to code, so reads and writes go to the file unblocked
+  const EncFSConfig *config = cfg->config.get();
+  if (!config->kernelContent && !(config->plainData && !config->uniqueIV)) {
+    io = std::shared_ptr<FileIO>(new CipherFileIO(io, fsConfig));
+  }
 
   if ((cfg->config->blockMACBytes != 0) ||
       (cfg->config->blockMACRandBytes != 0)) {
     io = std::shared_ptr<FileIO>(new MACFileIO(io, fsConfig));
   }
+
+  if (cfg->config->compression != 0) {
+    io = std::shared_ptr<FileIO>(new CompressFileIO(io, fsConfig));
+  }
+
+  if (_policy.readAhead != cfg->opts->readAheadSize) {
+    io->setReadAhead(_policy.readAhead);
+  }
+
+  if (_policy.writeBack > 0 && !cfg->reverseEncryption) {
+    writeBackSize = std::max((size_t)_policy.writeBack << 10,
+                             2 * (size_t)io->blockSize());
+  }
 }
 
 FileNode::~FileNode() {
-  // FileNode mutex should be locked before the destructor is called
-  // pthread_mutex_lock( &mutex );
-
+  if (!dirty.empty()) {
+    // normally flushed on release already
+    int res = flushLocked();
+    if (res < 0) {
+      RLOG(ERROR) << "lost buffered writes of " << _cname << ": "
+                  << strerror(-res);
+    }
+  }
   canary = CANARY_DESTROYED;
   _pname.assign(_pname.length(), '\0');
   _cname.assign(_cname.length(), '\0');
   io.reset();
-
-  pthread_mutex_destroy(&mutex);
 }
 
 const char *FileNode::cipherName() const { return _cname.c_str(); }
@@ -98,6 +189,11 @@ const char *FileNode::plaintextName() const { return _pname.c_str(); }
 
 string FileNode::plaintextParent() const { return parentDirectory(_pname); }
 
+void FileNode::setCipherName(const char *cipherName_) {
+  _cname = cipherName_;
+  _touchesMount = parent != nullptr && parent->touchesMountpoint(cipherName_);
+}
+
 static bool setIV(const std::shared_ptr<FileIO> &io, uint64_t iv) {
   struct stat stbuf;
   if ((io->getAttr(&stbuf) < 0) || S_ISREG(stbuf.st_mode)) {
@@ -108,7 +204,7 @@ static bool setIV(const std::shared_ptr<FileIO> &io, uint64_t iv) {
 
 bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
                        uint64_t iv, bool setIVFirst) {
-  // Lock _lock( mutex );
+  // RangeLock _lock(ranges, true);
   if (cipherName_ != nullptr) {
     VLOG(1) << "calling setIV on " << cipherName_;
   }
@@ -123,7 +219,7 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
       this->_pname = plaintextName_;
     }
     if (cipherName_ != nullptr) {
-      this->_cname = cipherName_;
+      setCipherName(cipherName_);
       io->setFileName(cipherName_);
     }
   } else {
@@ -134,13 +230,13 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
       this->_pname = plaintextName_;
     }
     if (cipherName_ != nullptr) {
-      this->_cname = cipherName_;
+      setCipherName(cipherName_);
       io->setFileName(cipherName_);
     }
 
     if (fsConfig->config->externalIVChaining && !setIV(io, iv)) {
       _pname = oldPName;
-      _cname = oldCName;
+      setCipherName(oldCName.c_str());
       return false;
     }
   }
@@ -148,10 +244,11 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
   return true;
 }
 
-int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
-  Lock _lock(mutex);
-
-  int res;
+/*
+    Run fn with the file system uid and gid set to those given, where not 0.
+*/
+template <typename F>
+static int asOwner(uid_t uid, gid_t gid, const F &fn) {
   int olduid = -1;
   int oldgid = -1;
   if (gid != 0) {
@@ -171,27 +268,7 @@ int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
     }
   }
 
-  /*
-   * cf. xmp_mknod() in fusexmp.c
-   * The regular file stuff could be stripped off if there
-   * were a create method (advised to have)
-   */
-  if (S_ISREG(mode)) {
-    res = ::open(_cname.c_str(), O_CREAT | O_EXCL | O_WRONLY, mode);
-    if (res >= 0) {
-      res = ::close(res);
-    }
-  } else if (S_ISFIFO(mode)) {
-    res = ::mkfifo(_cname.c_str(), mode);
-  } else {
-    res = ::mknod(_cname.c_str(), mode, rdev);
-  }
-
-  if (res == -1) {
-    int eno = errno;
-    VLOG(1) << "mknod error: " << strerror(eno);
-    res = -eno;
-  }
+  int res = fn();
 
   if (olduid >= 0) {
     if(setfsuid(olduid) == -1) {
@@ -211,49 +288,202 @@ int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
   return res;
 }
 
+int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
+  RangeLock _lock(ranges, true);
+
+  return asOwner(uid, gid, [&]() -> int {
+    AtPath at(fsConfig->dirFds.get(), _cname);
+    int res;
+    /*
+     * cf. xmp_mknod() in fusexmp.c
+     * The regular file stuff could be stripped off if there
+     * were a create method (advised to have)
+     */
+    if (S_ISREG(mode)) {
+      res = ::openat(at.dir(), at.name(), O_CREAT | O_EXCL | O_WRONLY, mode);
+      if (res >= 0) {
+        res = ::close(res);
+      }
+    } else if (S_ISFIFO(mode)) {
+      res = ::mkfifoat(at.dir(), at.name(), mode);
+    } else {
+      res = ::mknodat(at.dir(), at.name(), mode, rdev);
+    }
+
+    if (res == -1) {
+      int eno = errno;
+      VLOG(1) << "mknod error: " << strerror(eno);
+      res = -eno;
+    }
+    return res;
+  });
+}
+
+int FileNode::create(mode_t mode, uid_t uid, gid_t gid) {
+  RangeLock _lock(ranges, true);
+
+  return asOwner(uid, gid, [&]() -> int {
+    int res = io->create(mode & 07777);
+    if (res < 0) {
+      VLOG(1) << "create error: " << strerror(-res);
+    }
+    return res;
+  });
+}
+
 int FileNode::open(int flags) const {
-  Lock _lock(mutex);
+  RangeLock _lock(ranges, true);
 
   int res = io->open(flags);
   return res;
 }
 
 int FileNode::getAttr(struct stat *stbuf) const {
-  Lock _lock(mutex);
+  if (unlockedReads) {
+    return io->getAttr(stbuf);
+  }
+  RangeLock _lock(ranges, false);
 
   int res = io->getAttr(stbuf);
+  if (res == 0 && !dirty.empty()) {
+    stbuf->st_size =
+        std::max(stbuf->st_size, dirtyOffset + (off_t)dirty.size());
+  }
   return res;
 }
 
+void FileNode::upperAttr(const FSConfigPtr &cfg, struct stat *stbuf) {
+  if (!S_ISREG(stbuf->st_mode)) {
+    return;
+  }
+  // the layers of the constructor, bottom up
+  off_t size = CipherFileIO::upperSize(cfg, stbuf->st_size);
+  if ((cfg->config->blockMACBytes != 0) ||
+      (cfg->config->blockMACRandBytes != 0)) {
+    size = MACFileIO::upperSize(cfg, size);
+  }
+  if (cfg->config->compression != 0) {
+    size = CompressFileIO::upperSize(size);
+  }
+  stbuf->st_size = size;
+}
+
 off_t FileNode::getSize() const {
-  Lock _lock(mutex);
+  RangeLock _lock(ranges, false);
 
   off_t res = io->getSize();
+  if (res >= 0 && !dirty.empty()) {
+    res = std::max(res, dirtyOffset + (off_t)dirty.size());
+  }
   return res;
 }
 
+unsigned int FileNode::blockSize() const { return io->blockSize(); }
+
 ssize_t FileNode::read(off_t offset, unsigned char *data, size_t size) const {
   IORequest req;
   req.offset = offset;
   req.dataLen = size;
   req.data = data;
 
-  Lock _lock(mutex);
+  if (unlockedReads) {
+    return io->read(req);
+  }
+  if (sharedMs > 0) {
+    revalidate();
+  }
+
+  {
+    unsigned int bs = io->blockSize();
+    off_t lastByte = (size > 0) ? offset + (off_t)size - 1 : offset;
+    RangeLock _lock(ranges, offset / bs, lastByte / bs, false);
+
+    if (dirty.empty() || offset + (off_t)size <= dirtyOffset) {
+      return io->read(req);
+    }
+  }
 
+  // the read needs buffered data, or lies beyond the end of the file as io
+  // sees it
+  RangeLock _lock(ranges, true);
+  int res = flushLocked();
+  if (res < 0) {
+    return res;
+  }
   return io->read(req);
 }
 
-ssize_t FileNode::write(off_t offset, unsigned char *data, size_t size) {
+off_t FileNode::nextData(off_t offset) const {
+  return seekHoles(offset, false);
+}
+
+off_t FileNode::nextHole(off_t offset) const {
+  return seekHoles(offset, true);
+}
+
+off_t FileNode::seekHoles(off_t offset, bool hole) const {
+  if (unlockedReads) {
+    return hole ? io->nextHole(offset) : io->nextData(offset);
+  }
+  if (sharedMs > 0) {
+    revalidate();
+  }
+
+  {
+    RangeLock _lock(ranges, false);
+    if (dirty.empty()) {
+      return hole ? io->nextHole(offset) : io->nextData(offset);
+    }
+  }
+
+  // buffered data may fill a hole of the file as io sees it
+  RangeLock _lock(ranges, true);
+  int res = flushLocked();
+  if (res < 0) {
+    return res;
+  }
+  return hole ? io->nextHole(offset) : io->nextData(offset);
+}
+
+ssize_t FileNode::write(off_t offset, unsigned char *data, size_t size,
+                        bool inPlace) {
   VLOG(1) << "FileNode::write offset " << offset << ", data size " << size;
+  MarkWritten mark{written};
+
+  if (sharedMs > 0) {
+    revalidate();
+  }
+
+  if (writeBackSize > 0) {
+    return bufferedWrite(offset, data, size, inPlace);
+  }
 
   IORequest req;
   req.offset = offset;
   req.dataLen = size;
   req.data = data;
 
-  Lock _lock(mutex);
+  ssize_t res = 0;
+  bool ranged = false;
+  {
+    unsigned int bs = io->blockSize();
+    off_t lastByte = (size > 0) ? offset + (off_t)size - 1 : offset;
+    RangeLock _lock(ranges, offset / bs, lastByte / bs, true);
+
+    // the size can't change while we hold any range
+    off_t fileSize = io->getSize();
+    if (fileSize > 0 && offset + (off_t)size <= fileSize) {
+      ranged = true;
+      res = inPlace ? io->writeInPlace(req) : io->write(req);
+    }
+  }
+
+  if (!ranged) {
+    // may extend the file
+    RangeLock _lock(ranges, true);
+    res = inPlace ? io->writeInPlace(req) : io->write(req);
+  }
 
-  ssize_t res = io->write(req);
   // Of course due to encryption we genrally write more than requested
   if (res < 0) {
     return res;
@@ -261,36 +491,432 @@ ssize_t FileNode::write(off_t offset, unsigned char *data, size_t size) {
   return size;
 }
 
+ssize_t FileNode::bufferedWrite(off_t offset, unsigned char *data,
+                                size_t size, bool inPlace) {
+  IntentLog *log = fsConfig->intentLog.get();
+  uint64_t logged = 0;
+  ssize_t res;
+  {
+    RangeLock _lock(ranges, true);
+    // logged under the lock, so a checkpoint which doesn't see the record
+    // finds the data in the buffer
+    if (log != nullptr && size < writeBackSize) {
+      logged = log->append(_pname, offset, data, size);
+      if (logged == 0) {
+        return -EIO;
+      }
+    }
+    res = writeBack(offset, data, size, inPlace);
+  }
+  // other writers may go on meanwhile, and share the sync
+  if (res >= 0 && logged != 0) {
+    int cres = log->commit(logged);
+    if (cres < 0) {
+      return cres;
+    }
+  }
+  return res;
+}
+
+// caller holds the whole file exclusively
+ssize_t FileNode::writeBack(off_t offset, unsigned char *data, size_t size,
+                            bool inPlace) {
+  int res = 0;
+  if (size < writeBackSize) {
+    res = absorb(offset, data, size);
+    if (res < 0) {
+      return res;
+    }
+    if (res > 0) {
+      return size;
+    }
+  }
+
+  // too large to buffer: keep the order of writes, then write through
+  res = flushLocked();
+  if (res < 0) {
+    return res;
+  }
+
+  IORequest req;
+  req.offset = offset;
+  req.dataLen = size;
+  req.data = data;
+  ssize_t wres = inPlace ? io->writeInPlace(req) : io->write(req);
+  if (wres < 0) {
+    return wres;
+  }
+  return size;
+}
+
+/**
+ * Add a write to the buffer.  Returns 1 if the data was taken, 0 if it has to
+ * be written through, or -errno if writing out buffered data failed.
+ */
+int FileNode::absorb(off_t offset, const unsigned char *data, size_t size) {
+  int res;
+  if (!dirty.empty() && (offset < dirtyOffset ||
+                         offset > dirtyOffset + (off_t)dirty.size())) {
+    // not contiguous with the extent
+    if ((res = flushLocked()) < 0) {
+      return res;
+    }
+  }
+  if (dirty.empty()) {
+    dirtyOffset = offset;
+  }
+
+  size_t len = std::max(dirty.size(), (size_t)(offset + size - dirtyOffset));
+  if (len > writeBackSize) {
+    if ((res = flushBlocks()) < 0) {
+      return res;
+    }
+    len = std::max(dirty.size(), (size_t)(offset + size - dirtyOffset));
+    if (len > writeBackSize) {
+      return 0;
+    }
+  }
+
+  size_t growth = len - dirty.size();
+  if (totalDirty + growth > MaxDirtyFactor * writeBackSize) {
+    return 0;  // memory pressure
+  }
+  dirty.resize(len);
+  memcpy(&dirty[offset - dirtyOffset], data, size);
+  totalDirty += growth;
+  return 1;
+}
+
+// the tail of the extent which doesn't fill a whole block stays buffered
+int FileNode::flushBlocks() {
+  off_t bs = io->blockSize();
+  off_t cut = (dirtyOffset + (off_t)dirty.size()) / bs * bs;
+  if (cut <= dirtyOffset) {
+    return 0;
+  }
+
+  // the buffer is ours, so the encoding may happen in place.  The writer
+  // only waits for this to make room, so it goes behind synchronous reads.
+  IORequest req;
+  req.offset = dirtyOffset;
+  req.dataLen = cut - dirtyOffset;
+  req.data = dirty.data();
+  IOScheduler::BackgroundScope background;
+  ssize_t res = io->writeInPlace(req);
+  if (res < 0) {
+    dropDirty(dirty.size());
+    return res;
+  }
+  dropDirty(req.dataLen);
+  return 0;
+}
+
+// caller holds the whole file exclusively
+int FileNode::flushLocked() const {
+  if (dirty.empty()) {
+    return 0;
+  }
+
+  IORequest req;
+  req.offset = dirtyOffset;
+  req.dataLen = dirty.size();
+  req.data = dirty.data();
+  ssize_t res = io->writeInPlace(req);
+  // on failure the data is dropped as well, the error is reported once
+  dropDirty(dirty.size());
+  if (res < 0) {
+    VLOG(1) << "write back of " << req.dataLen << " bytes failed: " << res;
+    return res;
+  }
+  return 0;
+}
+
+// forget the first len buffered bytes
+void FileNode::dropDirty(size_t len) const {
+  memset(dirty.data(), 0, len);
+  dirty.erase(dirty.begin(), dirty.begin() + len);
+  dirtyOffset += len;
+  totalDirty -= len;
+  if (dirty.empty()) {
+    // give the memory back, rather than keep the largest buffer ever used
+    std::vector<unsigned char>().swap(dirty);
+  }
+}
+
+bool FileNode::closeFlushNeeded() {
+  return fsConfig->closeFlush && written.exchange(false);
+}
+
+int FileNode::flush() {
+  if (writeBackSize == 0) {
+    return 0;
+  }
+  RangeLock _lock(ranges, true);
+  return flushLocked();
+}
+
+bool FileNode::park() {
+  RangeLock _lock(ranges, true);
+
+  if (!dirty.empty()) {
+    return false;
+  }
+  int fd = io->open(O_RDONLY);
+  if (fd < 0 || fstat(fd, &parkedStat) != 0) {
+    return false;
+  }
+  // an idle node keeps no buffers from the mount's budget
+  io->releaseBuffers();
+  return true;
+}
+
+static bool sameTime(const struct timespec &a, const struct timespec &b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+bool FileNode::unpark() {
+  RangeLock _lock(ranges, true);
+
+  int fd = io->open(O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_nlink == 0) {
+    return false;
+  }
+  // as for DirCache, times of the current second may still change
+  time_t now = time(nullptr);
+  if (st.st_mtime >= now || st.st_ctime >= now ||
+      st.st_size != parkedStat.st_size ||
+      !sameTime(st.st_mtim, parkedStat.st_mtim) ||
+      !sameTime(st.st_ctim, parkedStat.st_ctim)) {
+    VLOG(1) << "dropping cached data of changed file " << _cname;
+    io->invalidate();
+  }
+  canary = CANARY_OK;
+  return true;
+}
+
+void FileNode::backingChanged() {
+  RangeLock _lock(ranges, true);
+  io->invalidate();
+}
+
+// the layers keep their own locks, hints don't wait for requests
+int FileNode::advise(FileIO::Advice advice, off_t offset, off_t length) {
+  return io->advise(advice, offset, length);
+}
+
+// Our own writes change the stamp as well, which costs one needless
+// invalidation per window.
+void FileNode::revalidate() const {
+  uint64_t now = nowMs();
+  if (now < checkedAt + sharedMs) {
+    return;
+  }
+  RangeLock _lock(ranges, true);
+  if (now < checkedAt + sharedMs) {
+    return;  // checked meanwhile
+  }
+  checkedAt = now;
+
+  int fd = io->open(O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    return;
+  }
+  bool known = checkedStat.st_ino != 0;
+  if (known && (st.st_size != checkedStat.st_size ||
+                !sameTime(st.st_mtim, checkedStat.st_mtim) ||
+                !sameTime(st.st_ctim, checkedStat.st_ctim))) {
+    VLOG(1) << "dropping cached data of " << _cname << ", changed by others";
+    io->invalidate();
+  }
+  checkedStat = st;
+}
+
+int FileNode::plainFd(off_t *dataOffset) const {
+  const EncFSConfig *config = fsConfig->config.get();
+  // Splicing from an O_DIRECT descriptor would need aligned requests.  In
+  // reverse mode the backing file is the plain file, which is served as it
+  // is unless a file IV header is generated in front of it.
+  if (!(config->plainData || config->kernelContent) ||
+      config->blockMACBytes != 0 ||
+      config->blockMACRandBytes != 0 || config->compression != 0 ||
+      fsConfig->opts->directIO ||
+      (fsConfig->reverseEncryption && config->uniqueIV)) {
+    return -1;
+  }
+
+  RangeLock _lock(ranges, false);
+  if (!dirty.empty()) {
+    return -1;  // the backing file isn't up to date
+  }
+  int fd = io->open(O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  // the (unencrypted) file IV header comes first
+  *dataOffset = config->uniqueIV ? 8 : 0;
+  return fd;
+}
+
 int FileNode::truncate(off_t size) {
-  Lock _lock(mutex);
+  MarkWritten mark{written};
+  RangeLock _lock(ranges, true);
 
+  if (size == 0 && !dirty.empty()) {
+    // nothing buffered survives, no need to write it first
+    dropDirty(dirty.size());
+  }
+  int res = flushLocked();
+  if (res < 0) {
+    return res;
+  }
   return io->truncate(size);
 }
 
+/*
+    The range is reserved in the lower file, block headers included, without
+    writing to it.  With holes allowed, space which reads back as zeros is a
+    hole to the layers above, so an extended file needs no encrypted zeros.
+    Otherwise the extension is padded with them, as by truncate, which is
+    also what happens if the lower file system can't allocate.
+*/
+int FileNode::allocate(int mode, off_t offset, off_t length) {
+  if (offset < 0 || length <= 0) {
+    return -EINVAL;
+  }
+  MarkWritten mark{written};
+  RangeLock _lock(ranges, true);
+
+  int res = flushLocked();
+  if (res < 0) {
+    return res;
+  }
+
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+  if (mode == (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE)) {
+    return punchRange(offset, length);
+  }
+  bool keepSize = (mode == FALLOC_FL_KEEP_SIZE);
+  if (mode != 0 && !keepSize) {
+    return -EOPNOTSUPP;
+  }
+#else
+  bool keepSize = false;
+  if (mode != 0) {
+    return -EOPNOTSUPP;
+  }
+#endif
+
+  res = io->allocate(offset, length);
+  if (res < 0 && (res != -EOPNOTSUPP || keepSize ||
+                  fsConfig->config->allowHoles)) {
+    return res;
+  }
+
+  off_t size = io->getSize();
+  if (size < 0) {
+    return (int)size;
+  }
+  if (!keepSize && offset + length > size) {
+    res = io->truncate(offset + length);
+  }
+  return res < 0 ? res : 0;
+}
+
+/*
+    Whole blocks are punched out of the lower file, the partial blocks at
+    either end of the range are written as zeros.  Needs holes, as the zeros
+    of a punched block are only decoded as such with them.  The file size
+    stays the same.
+*/
+int FileNode::punchRange(off_t offset, off_t length) {
+  if (!fsConfig->config->allowHoles) {
+    return -EOPNOTSUPP;
+  }
+
+  off_t size = io->getSize();
+  if (size < 0) {
+    return (int)size;
+  }
+  off_t end = std::min(offset + length, size);
+  if (offset >= end) {
+    return 0;
+  }
+
+  off_t bs = io->blockSize();
+  off_t holeStart = std::min((offset + bs - 1) / bs * bs, end);
+  off_t holeEnd = std::max(end / bs * bs, holeStart);
+
+  std::vector<unsigned char> zeros(bs, 0);
+  IORequest req;
+  req.data = zeros.data();
+  for (auto part : {std::make_pair(offset, holeStart),
+                    std::make_pair(holeEnd, end)}) {
+    if (part.first < part.second) {
+      req.offset = part.first;
+      req.dataLen = part.second - part.first;
+      ssize_t res = io->write(req);
+      if (res < 0) {
+        return (int)res;
+      }
+    }
+  }
+
+  if (holeStart < holeEnd) {
+    return io->punchHole(holeStart, holeEnd - holeStart);
+  }
+  return 0;
+}
+
+/*
+    Only the write out of buffered data and the open of the backing file
+    hold the file, the sync itself runs unlocked: what was written before
+    the call is in the backing file by then, and reads and writes of others
+    needn't wait for the device.
+*/
 int FileNode::sync(bool datasync) {
-  Lock _lock(mutex);
+  int fd;
+  {
+    RangeLock _lock(ranges, true);
+
+    int res = flushLocked();
+    if (res < 0) {
+      return res;
+    }
+
+    int fh = io->open(O_RDONLY);
+    if (fh < 0) {
+      return fh;
+    }
+    // an open for writing may replace fh once the lock is released
+    fd = dup(fh);
+    if (fd < 0) {
+      return -errno;
+    }
+  }
 
-  int fh = io->open(O_RDONLY);
-  if (fh >= 0) {
-    int res = -EIO;
+  int res;
+  if (fsConfig->syncBatcher) {
+    res = fsConfig->syncBatcher->sync(fd, datasync);
+  } else {
 #if defined(HAVE_FDATASYNC)
     if (datasync) {
-      res = fdatasync(fh);
+      res = fdatasync(fd);
     } else {
-      res = fsync(fh);
+      res = fsync(fd);
     }
 #else
     (void)datasync;
-    res = fsync(fh);
+    res = fsync(fd);
 #endif
-
     if (res == -1) {
       res = -errno;
     }
-
-    return res;
   }
-  return fh;
+
+  close(fd);
+  return res;
 }
 
 }  // namespace encfs
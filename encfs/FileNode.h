@@ -28,10 +28,14 @@
 #include <stdint.h>
 #include <string>
 #include <sys/types.h>
+#include <vector>
 
 #include "CipherKey.h"
 #include "FSConfig.h"
+#include "FileIO.h"
 #include "FileUtils.h"
+#include "Policies.h"
+#include "RangeLock.h"
 #include "encfs.h"
 
 #define CANARY_OK 0x46040975
@@ -54,7 +58,8 @@ class FileNode {
   // locks.
   std::atomic<std::uint32_t> canary;
 
-  // FUSE file handle that is passed to the kernel
+  // FUSE file handle that is passed to the kernel, set by
+  // EncFS_Context::putNode on the first open
   uint64_t fuseFh;
 
   const char *plaintextName() const;
@@ -63,6 +68,13 @@ class FileNode {
   // directory portion of plaintextName
   std::string plaintextParent() const;
 
+  // the settings of the file when it was opened (see Policies)
+  const Policies::Policy &policy() const { return _policy; }
+
+  // true if cipherName refers to the mount point itself (see
+  // DirNode::touchesMountpoint), kept up to date by setName
+  bool touchesMountpoint() const { return _touchesMount; }
+
   // if setIVFirst is true, then the IV is changed before the name is changed
   // (default).  The reverse is also supported for special cases..
   bool setName(const char *plaintextName, const char *cipherName, uint64_t iv,
@@ -75,34 +87,127 @@ class FileNode {
   // Returns < 0 on error (-errno), file descriptor on success.
   int open(int flags) const;
 
+  // Create the regular file and open it, as mknod followed by open(O_RDWR)
+  // would.  The file header is written right away.
+  int create(mode_t mode, uid_t uid = 0, gid_t gid = 0);
+
   // getAttr returns 0 on success, -errno on failure
   int getAttr(struct stat *stbuf) const;
+  // Adjust stbuf, the lstat of a backing file, as getAttr of a FileNode
+  // which isn't open would, without building one
+  static void upperAttr(const FSConfigPtr &cfg, struct stat *stbuf);
   off_t getSize() const;
 
+  // size of the plaintext blocks the file is encoded in
+  unsigned int blockSize() const;
+
   ssize_t read(off_t offset, unsigned char *data, size_t size) const;
-  ssize_t write(off_t offset, unsigned char *data, size_t size);
+  // if inPlace is set, data is scratch space and may be encoded in place
+  ssize_t write(off_t offset, unsigned char *data, size_t size,
+                bool inPlace = false);
+
+  /*
+      For volumes which store file data as-is (plainData or kernelContent,
+      no block MACs), returns the backing file descriptor and sets
+      dataOffset to where the file data starts in it, so that reads can be
+      spliced straight from the backing file.  Returns -1 for all other
+      volumes.
+   */
+  int plainFd(off_t *dataOffset) const;
+
+  // Where the first data at or after offset lies, the range up to it reads
+  // as zeros (see FileIO::nextData).  Returns -errno on failure.
+  off_t nextData(off_t offset) const;
+  // Where the first hole at or after offset starts, or the file size.
+  off_t nextHole(off_t offset) const;
 
   // truncate the file to a particular size
   int truncate(off_t size);
 
+  // fallocate(2) on the plaintext range, for mode 0, FALLOC_FL_KEEP_SIZE
+  // and FALLOC_FL_PUNCH_HOLE
+  int allocate(int mode, off_t offset, off_t length);
+
   // datasync or full sync
   int sync(bool dataSync);
 
+  // write out data held in the write-back buffer (see --writeback).
+  // Returns 0 on success, -errno on failure
+  int flush();
+
+  // Whether the close of a handle has to be passed on to the backing file:
+  // only where it writes back on close (see FSConfig::closeFlush), and only
+  // once for what was written since the last time.
+  bool closeFlushNeeded();
+
+  // Keep the released node for the next open (see FileNodePool): park()
+  // notes the state of the backing file, and returns false if the node
+  // can't be kept.  unpark() returns false if the node can't be used again,
+  // and drops what it cached if the file changed meanwhile.
+  bool park();
+  bool unpark();
+
+  // the backing file was changed by someone else (see --watch): drop what
+  // is cached of it
+  void backingChanged();
+
+  // A hint of a program on how it uses the file (see FileIO::advise and
+  // FileHints.h).  It holds for all handles of the node, as long as the
+  // node exists.
+  int advise(FileIO::Advice advice, off_t offset, off_t length);
+
  private:
-  // doing locking at the FileNode level isn't as efficient as at the
-  // lowest level of RawFileIO, since that means locks are held longer
-  // (held during CPU intensive crypto operations!).  However it makes it
-  // easier to avoid any race conditions with operations such as
-  // truncate() which may result in multiple calls down to the FileIO
-  // level.
-  mutable pthread_mutex_t mutex;
+  ssize_t bufferedWrite(off_t offset, unsigned char *data, size_t size,
+                        bool inPlace);
+  ssize_t writeBack(off_t offset, unsigned char *data, size_t size,
+                    bool inPlace);
+  int absorb(off_t offset, const unsigned char *data, size_t size);
+  int punchRange(off_t offset, off_t length);
+  int flushBlocks();
+  int flushLocked() const;
+  // nextData() or nextHole(), after writing back what is buffered
+  off_t seekHoles(off_t offset, bool hole) const;
+  void dropDirty(size_t len) const;
+
+  // Block range locks, see FileNode.cpp.  The IO stack below is safe for
+  // concurrent use on disjoint blocks, and for concurrent reads of the same
+  // blocks.
+  mutable RangeLockManager ranges;
+  // set on read-only mounts, where nothing changes the file while it is
+  // open: reads then take no range locks at all
+  bool unlockedReads;
+
+  // --shared: other clients may change the backing file while it is open.
+  // revalidate() drops what io caches of it if its stamp changed, at most
+  // once every sharedMs.
+  void revalidate() const;
+  uint64_t sharedMs;  // 0 if off
+  mutable std::atomic<uint64_t> checkedAt;
+  mutable struct stat checkedStat;
+
+  // Write-back buffer, see FileNode.cpp.  Plaintext of the file range
+  // [dirtyOffset, dirtyOffset + dirty.size()), not yet handed to io.  Only
+  // changed while holding the whole file exclusively.
+  size_t writeBackSize;  // 0 if disabled
+  mutable off_t dirtyOffset;
+  mutable std::vector<unsigned char> dirty;
+
+  // written, truncated or allocated since the last closeFlushNeeded()
+  std::atomic<bool> written;
 
   FSConfigPtr fsConfig;
+  Policies::Policy _policy;
+
+  // the backing file as park() left it
+  struct stat parkedStat;
 
   std::shared_ptr<FileIO> io;
   std::string _pname;  // plaintext name
   std::string _cname;  // encrypted name
   DirNode *parent;
+  std::atomic<bool> _touchesMount;
+
+  void setCipherName(const char *cipherName);
 
  private:
   FileNode(const FileNode &src);
@@ -0,0 +1,123 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileNodePool.h"
+
+#include <ctime>
+#include <iterator>
+
+#include "FileNode.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+static uint64_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+FileNodePool::FileNodePool(size_t maxNodes, int keepMs)
+    : _capacity(maxNodes), _keepMs(keepMs) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+FileNodePool::~FileNodePool() {
+  _nodes.clear();
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t FileNodePool::size() const {
+  Lock lock(_mutex);
+  return _nodes.size();
+}
+
+void FileNodePool::expire(uint64_t now, EntryList *out) {
+  // the oldest are at the back
+  auto it = _nodes.end();
+  while (it != _nodes.begin() && std::prev(it)->expires <= now) {
+    --it;
+  }
+  out->splice(out->end(), _nodes, it, _nodes.end());
+}
+
+void FileNodePool::put(const std::string &plaintextPath,
+                       const std::shared_ptr<FileNode> &node) {
+  if (_capacity == 0 || !node->park()) {
+    return;
+  }
+
+  EntryList gone;  // destroyed after the lock is released, closing files
+  Lock lock(_mutex);
+  uint64_t now = nowMs();
+  expire(now, &gone);
+  for (auto it = _nodes.begin(); it != _nodes.end(); ++it) {
+    if (it->path == plaintextPath) {
+      gone.splice(gone.end(), _nodes, it);
+      break;
+    }
+  }
+
+  _nodes.push_front(Entry());
+  Entry &entry = _nodes.front();
+  entry.path = plaintextPath;
+  entry.node = node;
+  entry.expires = now + _keepMs;
+
+  while (_nodes.size() > _capacity) {
+    gone.splice(gone.end(), _nodes, std::prev(_nodes.end()));
+  }
+}
+
+std::shared_ptr<FileNode> FileNodePool::take(const std::string &plaintextPath) {
+  EntryList gone;
+  EntryList found;
+  {
+    Lock lock(_mutex);
+    expire(nowMs(), &gone);
+    for (auto it = _nodes.begin(); it != _nodes.end(); ++it) {
+      if (it->path == plaintextPath) {
+        found.splice(found.end(), _nodes, it);
+        break;
+      }
+    }
+  }
+
+  if (!found.empty() && found.front().node->unpark()) {
+    return found.front().node;
+  }
+  return std::shared_ptr<FileNode>();
+}
+
+void FileNodePool::drop(const std::string &plaintextPath) {
+  EntryList gone;
+  Lock lock(_mutex);
+  for (auto it = _nodes.begin(); it != _nodes.end();) {
+    const std::string &path = it->path;
+    bool below = path.size() > plaintextPath.size() &&
+                 path.compare(0, plaintextPath.size(), plaintextPath) == 0 &&
+                 (path[plaintextPath.size()] == '/' ||
+                  plaintextPath.back() == '/');
+    auto next = std::next(it);
+    if (path == plaintextPath || below) {
+      gone.splice(gone.end(), _nodes, it);
+    }
+    it = next;
+  }
+}
+
+}  // namespace encfs
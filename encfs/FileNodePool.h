@@ -0,0 +1,83 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FileNodePool_incl_
+#define _FileNodePool_incl_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <pthread.h>
+#include <string>
+
+namespace encfs {
+
+class FileNode;
+
+/*
+    FileNodes whose last handle was released a moment ago, kept with their
+    IO stack and backing file descriptor for the next open of the same path.
+    A program which opens and closes a file over and over then doesn't build
+    the stack, open the backing file and read its header each time.
+
+    Nodes are kept for up to keepMs milliseconds, and at most maxNodes of
+    them, as each holds a descriptor.  A node is checked with
+    FileNode::unpark() before it is handed out again, which drops its cached
+    data if the file changed meanwhile.  DirNode drops the nodes of paths
+    which are removed or renamed.
+*/
+class FileNodePool {
+ public:
+  FileNodePool(size_t maxNodes, int keepMs);
+  ~FileNodePool();
+
+  FileNodePool(const FileNodePool &src) = delete;
+  FileNodePool &operator=(const FileNodePool &src) = delete;
+
+  // the last handle of node, open at plaintextPath, was released
+  void put(const std::string &plaintextPath,
+           const std::shared_ptr<FileNode> &node);
+
+  // the node kept for the path, if any, taken out of the pool
+  std::shared_ptr<FileNode> take(const std::string &plaintextPath);
+
+  // forget the node of the path, and those of everything below it
+  void drop(const std::string &plaintextPath);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string path;
+    std::shared_ptr<FileNode> node;
+    uint64_t expires;  // monotonic ms
+  };
+  using EntryList = std::list<Entry>;
+
+  // moves expired entries to out, to be destroyed without the lock
+  void expire(uint64_t now, EntryList *out);
+
+  const size_t _capacity;
+  const int _keepMs;
+
+  mutable pthread_mutex_t _mutex;
+  EntryList _nodes;  // most recently released first
+};
+
+}  // namespace encfs
+
+#endif
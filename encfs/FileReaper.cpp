@@ -0,0 +1,131 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileReaper.h"
+
+#include "easylogging++.h"
+#include <unistd.h>
+#include <utility>
+
+#include "Error.h"
+#include "FileNode.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+FileReaper::FileReaper(size_t maxQueued)
+    : _capacity(maxQueued), _pid(0), _stop(false), _pending(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_cond_init(&_wake, nullptr);
+  pthread_cond_init(&_done, nullptr);
+}
+
+FileReaper::~FileReaper() {
+  {
+    Lock lock(_mutex);
+    _stop = true;
+    pthread_cond_signal(&_wake);
+  }
+  if (_pid == getpid()) {
+    pthread_join(_thread, nullptr);
+  }
+  // left over if the thread couldn't be started, or belongs to the parent
+  _queue.clear();
+
+  pthread_cond_destroy(&_done);
+  pthread_cond_destroy(&_wake);
+  pthread_mutex_destroy(&_mutex);
+}
+
+bool FileReaper::put(const std::string &plaintextPath,
+                     std::shared_ptr<FileNode> &node) {
+  Lock lock(_mutex);
+  if (_stop || _queue.size() >= _capacity) {
+    return false;
+  }
+  if (_pid != getpid()) {
+    if (pthread_create(&_thread, nullptr, FileReaper::run, this) != 0) {
+      RLOG(WARNING) << "unable to start the file reaper, closing inline";
+      return false;
+    }
+    _pid = getpid();
+  }
+
+  _queue.push_back(Entry{plaintextPath, std::move(node)});
+  ++_paths[plaintextPath];
+  ++_pending;
+  pthread_cond_signal(&_wake);
+  return true;
+}
+
+void FileReaper::wait(const std::string &plaintextPath) {
+  if (_pending == 0) {
+    return;
+  }
+  Lock lock(_mutex);
+  while (_paths.count(plaintextPath) != 0) {
+    pthread_cond_wait(&_done, &_mutex);
+  }
+}
+
+void FileReaper::drain() {
+  if (_pending == 0) {
+    return;
+  }
+  Lock lock(_mutex);
+  while (_pending != 0) {
+    pthread_cond_wait(&_done, &_mutex);
+  }
+}
+
+void *FileReaper::run(void *arg) {
+  static_cast<FileReaper *>(arg)->loop();
+  return nullptr;
+}
+
+void FileReaper::loop() {
+  pthread_mutex_lock(&_mutex);
+  while (true) {
+    while (_queue.empty() && !_stop) {
+      pthread_cond_wait(&_wake, &_mutex);
+    }
+    if (_queue.empty()) {
+      break;
+    }
+    Entry entry = std::move(_queue.front());
+    _queue.pop_front();
+
+    pthread_mutex_unlock(&_mutex);
+    entry.node.reset();
+    pthread_mutex_lock(&_mutex);
+
+    finished(entry.path);
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+// called with _mutex held
+void FileReaper::finished(const std::string &path) {
+  auto it = _paths.find(path);
+  if (--it->second == 0) {
+    _paths.erase(it);
+  }
+  --_pending;
+  pthread_cond_broadcast(&_done);
+}
+
+}  // namespace encfs
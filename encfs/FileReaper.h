@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FileReaper_incl_
+#define _FileReaper_incl_
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace encfs {
+
+class FileNode;
+
+/*
+    Tears down the FileNodes whose last handle was released on a background
+    thread, so that release doesn't hold up the application's close().
+
+    Destroying a node closes the backing file, which on network file systems
+    writes back and can take tens of milliseconds, and frees its IO stack.
+    The data was already written through by flush, so nothing visible is
+    left to the teardown but the close itself.  An open of a path whose
+    node is still queued waits for it with wait(), so that the backing file
+    is never closed behind a newer open of it.
+
+    The queue is bounded: once full, put() refuses the node and the caller
+    destroys it as before.  The thread is started on first use, and again
+    if the process was forked since.  Nodes still queued when the reaper is
+    destroyed are torn down then.
+*/
+class FileReaper {
+ public:
+  explicit FileReaper(size_t maxQueued);
+  ~FileReaper();
+
+  FileReaper(const FileReaper &src) = delete;
+  FileReaper &operator=(const FileReaper &src) = delete;
+
+  // Take node, whose last handle at plaintextPath was released, to destroy
+  // in the background.  Returns false, leaving node alone, if the queue is
+  // full.
+  bool put(const std::string &plaintextPath, std::shared_ptr<FileNode> &node);
+
+  // Return once no node of the path is queued or being torn down
+  void wait(const std::string &plaintextPath);
+
+  // Return once the queue is empty
+  void drain();
+
+  size_t pending() const { return _pending; }
+
+ private:
+  struct Entry {
+    std::string path;
+    std::shared_ptr<FileNode> node;
+  };
+
+  static void *run(void *arg);
+  void loop();
+  void finished(const std::string &path);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  pthread_cond_t _wake;  // for the thread
+  pthread_cond_t _done;  // for wait() and drain()
+  pid_t _pid;            // process which started the thread, or 0
+  pthread_t _thread;
+  bool _stop;
+  std::deque<Entry> _queue;
+  // queued or being torn down, by path
+  std::unordered_map<std::string, int> _paths;
+  std::atomic<size_t> _pending;
+};
+
+}  // namespace encfs
+
+#endif
@@ -26,6 +26,7 @@
 #define _DEFAULT_SOURCE  // Replaces _BSD_SOURCE
 
 #include "easylogging++.h"
+#include <algorithm>
 #include <cctype>
 #include <cerrno>
 #include <cstdio>
@@ -35,30 +36,55 @@
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <map>
 #ifdef __APPLE__
 #include <sys/mount.h>
 #include <sys/param.h>
 #endif
 #include <sys/socket.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#endif
 #include <sys/wait.h>
+#include <thread>
 #include <tinyxml2.h>
 #include <unistd.h>
 #include <vector>
 
+#include "BlockCache.h"
+#include "BufferBudget.h"
 #include "BlockNameIO.h"
 #include "Cipher.h"
+#include "CipherBench.h"
 #include "CipherKey.h"
+#include "CompressFileIO.h"
 #include "ConfigReader.h"
 #include "ConfigVar.h"
 #include "Context.h"
+#include "DirFdCache.h"
+#include "DiskCache.h"
 #include "DirNode.h"
 #include "Error.h"
 #include "FSConfig.h"
+#include "FileIVCache.h"
+#include "FileNode.h"
 #include "FileUtils.h"
+#include "Fscrypt.h"
 #include "Interface.h"
+#include "IOScheduler.h"
+#include "IVJournal.h"
+#include "IntentLog.h"
+#include "KeyRing.h"
+#include "MemoryPressure.h"
 #include "NameIO.h"
+#include "Policies.h"
 #include "Range.h"
+#include "Stats.h"
+#include "Stripes.h"
+#include "SyncBatcher.h"
+#include "UringFileIO.h"
+#include "WorkerPool.h"
 #include "XmlReader.h"
 #include "autosprintf.h"
 #include "base64.h"
@@ -73,12 +99,19 @@ using gnu::autosprintf;
 namespace encfs {
 
 static const int DefaultBlockSize = 1024;
+// block size of large files, see selectLargeBlocks()
+static const int LargeBlockSize = 65536;
+// how long --auto measures every cipher and block size for
+static const int AutoConfigDurationMs = 20;
 // The maximum length of text passwords.  If longer are needed,
 // use the extpass option, as extpass can return arbitrary length binary data.
 static const int MaxPassBuf = 512;
 
 static const int NormalKDFDuration = 500;     // 1/2 a second
 static const int ParanoiaKDFDuration = 3000;  // 3 seconds
+static const int NormalArgon2Memory = 64 * 1024;     // KiB
+static const int ParanoiaArgon2Memory = 256 * 1024;  // KiB
+static const int MaxArgon2Lanes = 64;
 
 // environment variable names for values encfs stores in the environment when
 // calling an external password program.
@@ -99,7 +132,14 @@ static int V5SubVersionDefault = 0;
  * numbering scheme does not work any longer.
  * boost-versioning.h implements a workaround that sets the version to
  * 20 for boost 1.42+. */
-const int V6SubVersion = 20100713;  // add version field for boost 1.42+
+// const int V6SubVersion = 20100713; // add version field for boost 1.42+
+// const int V6SubVersion = 20261014;  // add alignedBlocks option
+// const int V6SubVersion = 20261015;  // add Argon2id key derivation
+// const int V6SubVersion = 20261016;  // add blockMACVersion
+// const int V6SubVersion = 20261017;  // add compression
+// const int V6SubVersion = 20261018;  // add largeBlockSize
+// const int V6SubVersion = 20261019;  // add kernelContent
+const int V6SubVersion = 20261020;  // add blockMACExtents
 
 struct ConfigInfo {
   const char *fileName;
@@ -227,6 +267,7 @@ ConfigType readConfig_load(ConfigInfo *nm, const char *path,
  * Tries the most recent format first, then looks for older versions
  */
 ConfigType readConfig(const string &rootDir, EncFSConfig *config, const string &cmdConfig) {
+  Stats::PhaseTimer timer(Stats::ReadConfig);
   ConfigInfo *nm = ConfigFileMapping;
   while (nm->fileName != nullptr) {
    // allow command line argument to override default config path 
@@ -311,6 +352,12 @@ bool readV6Config(const char *configFile, EncFSConfig *cfg, ConfigInfo *info) {
     cfg->subVersion = version;
   }
   VLOG(1) << "subVersion = " << cfg->subVersion;
+  if (cfg->subVersion > V6SubVersion) {
+    RLOG(ERROR) << "Config subversion " << cfg->subVersion
+                << " found, which is newer than supported version "
+                << V6SubVersion;
+    return false;
+  }
 
   config->read("creator", &cfg->creator);
   config->read("cipherAlg", &cfg->cipherIface);
@@ -326,6 +373,59 @@ bool readV6Config(const char *configFile, EncFSConfig *cfg, ConfigInfo *info) {
   config->read("blockMACBytes", &cfg->blockMACBytes);
   config->read("blockMACRandBytes", &cfg->blockMACRandBytes);
   config->read("allowHoles", &cfg->allowHoles);
+  if (cfg->subVersion >= 20261014) {
+    config->read("alignedBlocks", &cfg->alignedBlocks);
+  }
+  if (cfg->subVersion >= 20261016) {
+    config->read("blockMACVersion", &cfg->blockMACVersion);
+    // version 4 headers are the tags and nonces of a sealing cipher
+    if (cfg->blockMACVersion < 2 || cfg->blockMACVersion > 4 ||
+        (cfg->blockMACVersion == 4 &&
+         (cfg->blockMACBytes != Cipher::SealTagBytes ||
+          cfg->blockMACRandBytes != Cipher::SealNonceBytes))) {
+      RLOG(ERROR) << "Unsupported block MAC version " << cfg->blockMACVersion;
+      return false;
+    }
+  }
+  if (cfg->subVersion >= 20261017) {
+    config->read("compression", &cfg->compression);
+    if (cfg->compression != 0 &&
+        !CompressFileIO::supported(cfg->compression)) {
+      RLOG(ERROR) << "Unsupported compression " << cfg->compression;
+      return false;
+    }
+  }
+  if (cfg->subVersion >= 20261018) {
+    config->read("largeBlockSize", &cfg->largeBlockSize);
+    if (cfg->largeBlockSize != 0 &&
+        (!cfg->uniqueIV || cfg->blockMACBytes != 0 ||
+         cfg->blockMACRandBytes != 0 || cfg->compression != 0 ||
+         cfg->blockSize <= 0 || cfg->largeBlockSize <= cfg->blockSize ||
+         cfg->largeBlockSize % cfg->blockSize != 0)) {
+      RLOG(ERROR) << "Unsupported large block size " << cfg->largeBlockSize;
+      return false;
+    }
+  }
+  if (cfg->subVersion >= 20261019) {
+    config->read("kernelContent", &cfg->kernelContent);
+    // the files are stored as they are, fscrypt does the rest
+    if (cfg->kernelContent &&
+        (cfg->plainData || cfg->uniqueIV || cfg->blockMACBytes != 0 ||
+         cfg->blockMACRandBytes != 0 || cfg->compression != 0 ||
+         cfg->largeBlockSize != 0)) {
+      RLOG(ERROR) << "Unsupported options with kernelContent";
+      return false;
+    }
+  }
+  if (cfg->subVersion >= 20261020) {
+    config->read("blockMACExtents", &cfg->blockMACExtents);
+    // the tags have room for the MAC only
+    if (cfg->blockMACExtents &&
+        (cfg->blockMACBytes == 0 || cfg->blockMACRandBytes != 0)) {
+      RLOG(ERROR) << "Unsupported block MAC extents";
+      return false;
+    }
+  }
 
   int encodedSize;
   config->read("encodedKeySize", &encodedSize);
@@ -344,6 +444,14 @@ bool readV6Config(const char *configFile, EncFSConfig *cfg, ConfigInfo *info) {
 
     config->read("kdfIterations", &cfg->kdfIterations);
     config->read("desiredKDFDuration", &cfg->desiredKDFDuration);
+    if (cfg->subVersion >= 20261015) {
+      config->read("kdfMemory", &cfg->kdfMemory);
+      config->read("kdfLanes", &cfg->kdfLanes);
+      if (cfg->kdfMemory > 0 && !Argon2::supported()) {
+        RLOG(ERROR) << "Argon2id key derivation isn't supported by this build";
+        return false;
+      }
+    }
   } else {
     cfg->kdfIterations = 16;
     cfg->desiredKDFDuration = NormalKDFDuration;
@@ -554,13 +662,21 @@ bool writeV6Config(const char *configFile, const EncFSConfig *cfg) {
   addEl(doc, config, "externalIVChaining", (int)cfg->externalIVChaining);
   addEl(doc, config, "blockMACBytes", cfg->blockMACBytes);
   addEl(doc, config, "blockMACRandBytes", cfg->blockMACRandBytes);
+  addEl(doc, config, "blockMACVersion", cfg->blockMACVersion);
+  addEl(doc, config, "blockMACExtents", (int)cfg->blockMACExtents);
   addEl(doc, config, "allowHoles", (int)cfg->allowHoles);
+  addEl(doc, config, "alignedBlocks", (int)cfg->alignedBlocks);
+  addEl(doc, config, "compression", cfg->compression);
+  addEl(doc, config, "largeBlockSize", cfg->largeBlockSize);
+  addEl(doc, config, "kernelContent", (int)cfg->kernelContent);
   addEl(doc, config, "encodedKeySize", (int)cfg->keyData.size());
   addEl(doc, config, "encodedKeyData", cfg->keyData);
   addEl(doc, config, "saltLen", (int)cfg->salt.size());
   addEl(doc, config, "saltData", cfg->salt);
   addEl(doc, config, "kdfIterations", cfg->kdfIterations);
   addEl(doc, config, "desiredKDFDuration", (int)cfg->desiredKDFDuration);
+  addEl(doc, config, "kdfMemory", cfg->kdfMemory);
+  addEl(doc, config, "kdfLanes", cfg->kdfLanes);
 
   auto err = doc.SaveFile(configFile, false);
   return err == tinyxml2::XML_SUCCESS;
@@ -891,10 +1007,25 @@ static bool selectPlainData(bool insecure) {
   return plainData;
 }
 
+/**
+ * Ask the user whether to leave file content encryption to fscrypt, where
+ * the file system of the root directory supports it
+ */
+static bool selectKernelContent() {
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("The file system of the root directory can encrypt file contents\n"
+        "itself (fscrypt), with inline encryption hardware where it is\n"
+        "mounted with inlinecrypt.  File names are still encrypted by\n"
+        "encfs, and the files are kept in a \"fscrypt\" subdirectory.\n"
+        "Leave the encryption of file contents to the kernel?"));
+}
+
 /**
  * Ask the user whether to enable block MAC and random header bytes
  */
-static void selectBlockMAC(int *macBytes, int *macRandBytes, bool forceMac) {
+static void selectBlockMAC(int *macBytes, int *macRandBytes, int *macVersion,
+                           bool *macExtents, bool forceMac) {
   bool addMAC = false;
   if (!forceMac) {
     // xgroup(setup)
@@ -914,8 +1045,32 @@ static void selectBlockMAC(int *macBytes, int *macRandBytes, bool forceMac) {
 
   if (addMAC) {
     *macBytes = 8;
+    // xgroup(setup)
+    *macVersion = boolDefaultYes(
+                      _("Compute the block authentication codes with "
+                        "SipHash?\n"
+                        "SipHash is several times faster than the HMAC used "
+                        "otherwise.\n"
+                        "Older versions of EncFS don't know it and can't "
+                        "read the files."))
+                      ? 3
+                      : 2;
+    // xgroup(setup)
+    *macExtents = boolDefaultNo(
+        _("Keep the authentication codes in extents of their own, instead\n"
+          "of a header on every block?  The blocks then hold a whole block\n"
+          "of data and stay aligned, and the codes of a large read come\n"
+          "from one small read.  There are no random header bytes then.\n"
+          "Older versions of EncFS don't know this option and would\n"
+          "misread the files."));
   } else {
     *macBytes = 0;
+    *macExtents = false;
+  }
+
+  if (*macExtents) {
+    *macRandBytes = 0;
+    return;
   }
 
   // xgroup(setup)
@@ -957,6 +1112,60 @@ static bool selectUniqueIV(bool default_answer) {
       default_answer);
 }
 
+/**
+ * Ask the user if the file header should be padded to keep blocks aligned
+ */
+static bool selectAlignedBlocks() {
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("Align encrypted blocks to 4 KiB on disk?\n"
+        "This pads the per-file header to 4096 bytes, so that blocks don't\n"
+        "straddle pages of the underlying filesystem, which helps random\n"
+        "reads and --directio.  Use a block size which divides 4096 or is a\n"
+        "multiple of it.  Older versions of EncFS don't know this option\n"
+        "and would misread the files."));
+}
+
+/**
+ * Ask the user if the file contents should be compressed
+ */
+static bool selectCompression() {
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("Compress file contents before encryption?\n"
+        "Files are compressed in extents of 64 KiB, which saves disk space\n"
+        "and I/O for data like text and logs.  Changing a few bytes rewrites\n"
+        "the whole extent, and the size of the encrypted files reveals how\n"
+        "well their contents compress.  Older versions of EncFS don't know\n"
+        "this option and would misread the files."));
+}
+
+/**
+ * Ask the user if large files should get large blocks
+ */
+static bool selectLargeBlocks() {
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("Use 64 KiB blocks for large files?\n"
+        "A file gets large blocks if its first write or allocation is at\n"
+        "least 64 KiB, which makes streaming it cheaper, while small files\n"
+        "keep the block size chosen above for cheap random writes.  Older\n"
+        "versions of EncFS don't know this option and would misread the\n"
+        "files."));
+}
+
+/**
+ * Ask the user if the password should be hashed with Argon2id
+ */
+static bool selectArgon2() {
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("Derive the key from the password with Argon2id?\n"
+        "Argon2id needs a lot of memory, which makes guessing the password\n"
+        "on special hardware expensive, and uses all cores when unlocking,\n"
+        "so more work fits in the same wait.  The default is PBKDF2."));
+}
+
 /**
  * Ask the user if the filename IV should depend on the complete path
  */
@@ -992,6 +1201,359 @@ static bool selectZeroBlockPassThrough() {
         "This avoids writing encrypted blocks when file holes are created."));
 }
 
+/**
+ * Create the shared decoded block cache requested by --blockcache, or use
+ * the one of the process under --serve.  --nocache forces it off.  In
+ * reverse mode, where the backing files may change behind our back,
+ * CipherFileIO drops the blocks of a file when it does.
+ */
+std::shared_ptr<BlockCache> newBlockCache(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->noCache) {
+    return std::shared_ptr<BlockCache>();
+  }
+  if (opts->sharedBlockCache) {
+    return opts->sharedBlockCache;
+  }
+  if (opts->blockCacheSize <= 0) {
+    return std::shared_ptr<BlockCache>();
+  }
+  VLOG(1) << "using a " << opts->blockCacheSize << " MiB block cache";
+  return std::make_shared<BlockCache>((size_t)opts->blockCacheSize << 20,
+                                      opts->lockBlockCache,
+                                      opts->blockCachePolicy);
+}
+
+// bounds for the default number of worker threads, which encode and decode
+// large requests and read ahead
+static const int MinWorkers = 2;
+static const int MaxWorkers = 16;
+static const size_t WorkerQueue = 64;
+
+/**
+ * Create the worker threads shared by all files, as many as --threads asks
+ * for, or one per core, split over the NUMA nodes.  Under --serve, all volumes use the process' pool.
+ */
+std::shared_ptr<WorkerPool> newWorkerPool(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->sharedWorkers) {
+    return opts->sharedWorkers;
+  }
+  int threads = opts->workerThreads;
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+    threads = std::min(std::max(threads, MinWorkers), MaxWorkers);
+  }
+  auto pool = std::make_shared<WorkerPool>(threads, WorkerQueue);
+  VLOG(1) << "using " << threads << " worker threads on " << pool->nodes()
+          << " NUMA node(s)";
+  return pool;
+}
+
+/**
+ * The intent log of --intentlog, with the writes a crash left in it written
+ * to the files of root again.  Returns false if they couldn't be, so that
+ * the volume isn't mounted without them.
+ */
+static bool newIntentLog(const FSConfigPtr &cfg,
+                         const std::shared_ptr<DirNode> &root) {
+  const std::string &path = cfg->opts->intentLogPath;
+  if (path.empty()) {
+    return true;
+  }
+  struct stat st;
+  if (cfg->opts->readOnly) {
+    if (lstat(path.c_str(), &st) == 0) {
+      RLOG(WARNING) << "read-only mount, writes in " << path << " not applied";
+    }
+    return true;
+  }
+
+  auto log = std::make_shared<IntentLog>(path, cfg->cipher, cfg->key);
+  std::map<std::string, std::shared_ptr<FileNode>> nodes;
+  int records = log->replay([&](const std::string &file, off_t offset,
+                                const unsigned char *data, size_t size) {
+    auto it = nodes.find(file);
+    if (it == nodes.end()) {
+      int res = -EIO;
+      std::shared_ptr<FileNode> node =
+          root->openNode(file.c_str(), "intentlog", O_RDWR, &res);
+      if (!node && res == -ENOENT) {
+        // removed by someone else, ours wait for a checkpoint
+        VLOG(1) << "intent log names a missing file";
+        return true;
+      }
+      if (!node) {
+        return false;
+      }
+      it = nodes.emplace(file, node).first;
+    }
+    std::vector<unsigned char> buf(data, data + size);
+    return it->second->write(offset, buf.data(), size, true) == (ssize_t)size;
+  });
+  bool ok = records >= 0;
+  for (auto &it : nodes) {
+    if (it.second->sync(true) < 0) {
+      ok = false;
+    }
+  }
+  if (!ok || !log->clear()) {
+    cerr << autosprintf(_("Unable to apply the writes in %s\n"), path.c_str());
+    return false;
+  }
+  cfg->intentLog = log;
+  return true;
+}
+
+/**
+ * Open the journal of pending header IVs when --ivjournal asks for one, or
+ * when an earlier mount left one behind.  Only externalIVChaining rewrites
+ * headers on rename.
+ */
+static std::shared_ptr<IVJournal> newIVJournal(const FSConfigPtr &cfg) {
+  if (!cfg->config->externalIVChaining || !cfg->config->uniqueIV ||
+      cfg->reverseEncryption) {
+    return std::shared_ptr<IVJournal>();
+  }
+  struct stat st;
+  std::string logPath = cfg->opts->rootDir + IVJournal::FileName;
+  if (!cfg->opts->ivJournal && lstat(logPath.c_str(), &st) != 0) {
+    return std::shared_ptr<IVJournal>();
+  }
+  VLOG(1) << "using IV journal " << logPath;
+  return std::make_shared<IVJournal>(cfg->opts->rootDir, cfg->cipher, cfg->key,
+                                     cfg->opts->ivJournal);
+}
+
+/**
+ * The memory open files may keep for their last block (see --buffermem).
+ */
+static std::shared_ptr<BufferBudget> newBufferBudget(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  size_t limit = opts->bufferMemSize > 0 ? (size_t)opts->bufferMemSize << 20
+                                         : 0;
+  return std::make_shared<BufferBudget>(limit);
+}
+
+/**
+ * Headers are only read in forward mode.  Sized and disabled like the
+ * symlink target cache (see --pathcache).
+ */
+static std::shared_ptr<FileIVCache> newFileIVCache(const FSConfigPtr &cfg) {
+  if (!cfg->config->uniqueIV || cfg->reverseEncryption ||
+      cfg->opts->noCache || cfg->opts->pathCacheSize <= 0) {
+    return std::shared_ptr<FileIVCache>();
+  }
+  return std::make_shared<FileIVCache>(cfg->opts->pathCacheSize);
+}
+
+/**
+ * Like the other caches of backing paths, only used in forward mode.
+ */
+static std::shared_ptr<DirFdCache> newDirFdCache(const FSConfigPtr &cfg) {
+  if (cfg->reverseEncryption || cfg->opts->noCache ||
+      cfg->opts->dirFdCacheSize <= 0) {
+    return std::shared_ptr<DirFdCache>();
+  }
+  return std::make_shared<DirFdCache>(cfg->opts->dirFdCacheSize);
+}
+
+/**
+ * Backing files in reverse mode hold the plaintext, which has no business on
+ * another disk.
+ */
+static std::shared_ptr<DiskCache> newDiskCache(const FSConfigPtr &cfg) {
+  if (cfg->opts->diskCacheDir.empty() || cfg->opts->diskCacheSize <= 0) {
+    return std::shared_ptr<DiskCache>();
+  }
+  if (cfg->reverseEncryption) {
+    RLOG(WARNING) << "--diskcache is ignored in reverse mode";
+    return std::shared_ptr<DiskCache>();
+  }
+  // the kernel would hand it the plaintext
+  if (cfg->config->kernelContent) {
+    RLOG(WARNING) << "--diskcache is ignored for files encrypted by fscrypt";
+    return std::shared_ptr<DiskCache>();
+  }
+  return DiskCache::open(cfg->opts->diskCacheDir,
+                         (size_t)cfg->opts->diskCacheSize << 20);
+}
+
+/**
+ * The backing directories of a striped volume.  A volume which was striped
+ * can't be mounted without its other directories, it would miss files.
+ */
+/**
+ * The settings of subtrees, from --policy.  A file which can't be read
+ * stops the mount, having said why.
+ */
+static bool newPolicies(const FSConfigPtr &cfg) {
+  const std::string &file = cfg->opts->policyFile;
+  if (file.empty()) {
+    return true;
+  }
+  auto policies = std::make_shared<Policies>(file);
+  if (policies->load() != 0) {
+    cout << autosprintf(_("Unable to load the policies from %s"),
+                        file.c_str())
+         << "\n";
+    return false;
+  }
+  cfg->policies = policies;
+  return true;
+}
+
+static bool newStripes(const FSConfigPtr &cfg, const std::string &rootDir) {
+  const std::vector<std::string> &dirs = cfg->opts->stripeDirs;
+  if (dirs.empty()) {
+    size_t count = Stripes::countOf(rootDir);
+    if (count > 1) {
+      cout << autosprintf(_("%s is striped over %i directories, "
+                            "name the others with --stripe"),
+                          rootDir.c_str(), (int)count)
+           << "\n";
+      return false;
+    }
+    return true;
+  }
+  if (cfg->reverseEncryption) {
+    cout << _("--stripe is not supported in reverse mode") << "\n";
+    return false;
+  }
+  if (cfg->config->kernelContent) {
+    cout << _("--stripe is not supported for files encrypted by fscrypt")
+         << "\n";
+    return false;
+  }
+
+  std::vector<std::string> roots(1, rootDir);
+  roots.insert(roots.end(), dirs.begin(), dirs.end());
+  std::string error;
+  cfg->stripes = Stripes::open(roots, &error);
+  if (!cfg->stripes) {
+    cout << error << "\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * One monitor for the whole process, its thread is started by encfs_init.
+ */
+static std::shared_ptr<MemoryPressure> newMemoryPressure(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (!opts->watchPressure || opts->noCache) {
+    return std::shared_ptr<MemoryPressure>();
+  }
+  return MemoryPressure::shared();
+}
+
+static std::shared_ptr<IOScheduler> newIOScheduler(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->ioDepth <= 0) {
+    return std::shared_ptr<IOScheduler>();
+  }
+  return std::make_shared<IOScheduler>(opts->ioDepth, opts->deviceIODepth);
+}
+
+static std::shared_ptr<SyncBatcher> newSyncBatcher(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->groupSyncWindow < 0) {
+    return std::shared_ptr<SyncBatcher>();
+  }
+  return std::make_shared<SyncBatcher>(opts->groupSyncWindow);
+}
+
+/**
+ * Whether rootDir is on a filesystem which writes back on close, as NFS
+ * does: with --netfs, or where the kind of filesystem says so.  Where it
+ * can't be told, it is assumed to.
+ */
+static bool flushesOnClose(const std::shared_ptr<EncFS_Opts> &opts,
+                           const std::string &rootDir) {
+  if (opts->netfsTimeout > 0) {
+    return true;
+  }
+#if defined(__linux__)
+  struct statfs st;
+  if (statfs(rootDir.c_str(), &st) != 0) {
+    return true;
+  }
+  switch ((unsigned long)st.f_type) {
+    case 0x6969:      // NFS
+    case 0x517B:      // SMB
+    case 0xFE534D42:  // SMB2
+    case 0xFF534D42:  // CIFS
+    case 0x01021997:  // 9P
+    case 0x00C36400:  // Ceph
+    case 0x5346414F:  // AFS
+    case 0x73757245:  // Coda
+    case 0x65735546:  // FUSE, sshfs among others
+      return true;
+    default:
+      VLOG(1) << "no flush on close for " << rootDir;
+      return false;
+  }
+#else
+  (void)rootDir;
+  return true;
+#endif
+}
+
+/**
+ * Whether to use io_uring for the backing files, as --uring asks for if the
+ * kernel supports it.
+ */
+static bool useUring(const std::shared_ptr<EncFS_Opts> &opts) {
+  if (!opts->uring) {
+    return false;
+  }
+  if (!UringFileIO::supported()) {
+    RLOG(WARNING) << "io_uring is not available, using pread and pwrite";
+    return false;
+  }
+  VLOG(1) << "using io_uring";
+  return true;
+}
+
+/**
+ * Adds the fscrypt key of a kernelContent volume, derived from its volume
+ * key, and returns the directory its files are kept in (see Fscrypt), or an
+ * empty string if that fails.  create makes the directory and encrypts it.
+ */
+static std::string unlockKernelContent(const std::shared_ptr<Cipher> &cipher,
+                                       const CipherKey &volumeKey,
+                                       const std::string &rootDir,
+                                       bool create,
+                                       std::shared_ptr<Fscrypt> *kernelKey) {
+  unsigned char key[Fscrypt::KeySize];
+  int res = -ENOTSUP;
+  if (cipher->exportKey(volumeKey, "encfs fscrypt key", key, sizeof(key))) {
+    *kernelKey = Fscrypt::unlock(rootDir, key, &res);
+    if (*kernelKey) {
+      res = 0;
+    }
+  }
+  memset(key, 0, sizeof(key));
+
+  std::string dataDir = rootDir + Fscrypt::DataDir;
+  if (res == 0 && create) {
+    if (::mkdir(dataDir.c_str(), S_IRWXU) != 0) {
+      res = -errno;
+    } else if ((res = (*kernelKey)->protect(dataDir)) != 0) {
+      ::rmdir(dataDir.c_str());
+    }
+  }
+  if (res != 0) {
+    cout << autosprintf(_("Unable to encrypt %s with fscrypt: %s"),
+                        dataDir.c_str(), strerror(-res))
+         << "\n";
+    kernelKey->reset();
+    return std::string();
+  }
+  return dataDir + '/';
+}
+
 RootPtr createV6Config(EncFS_Context *ctx,
                        const std::shared_ptr<EncFS_Opts> &opts) {
   const std::string rootDir = opts->rootDir;
@@ -1003,6 +1565,11 @@ RootPtr createV6Config(EncFS_Context *ctx,
   ConfigMode configMode = opts->configMode;
   bool annotate = opts->annotate;
 
+  // --auto picks among the configurations of a profile
+  if (opts->autoConfig && configMode == Config_Prompt) {
+    configMode = Config_Standard;
+  }
+
   RootPtr rootInfo;
 
   // creating new volume key.. should check that is what the user is
@@ -1036,11 +1603,18 @@ RootPtr createV6Config(EncFS_Context *ctx,
   Interface nameIOIface;        // selectNameCoding()
   int blockMACBytes = 0;        // selectBlockMAC()
   int blockMACRandBytes = 0;    // selectBlockMAC()
+  int blockMACVersion = 2;      // selectBlockMAC()
+  bool blockMACExtents = false;  // selectBlockMAC()
   bool plainData = false;       // selectPlainData()
+  bool kernelContent = false;   // selectKernelContent()
   bool uniqueIV = true;         // selectUniqueIV()
   bool chainedIV = true;        // selectChainedIV()
   bool externalIV = false;      // selectExternalChainedIV()
   bool allowHoles = true;       // selectZeroBlockPassThrough()
+  bool alignedBlocks = false;   // selectAlignedBlocks()
+  int compression = 0;          // selectCompression()
+  int largeBlockSize = 0;       // selectLargeBlocks()
+  bool argon2 = false;          // selectArgon2()
   long desiredKDFDuration = NormalKDFDuration;
 
   if (reverseEncryption) {
@@ -1100,6 +1674,28 @@ RootPtr createV6Config(EncFS_Context *ctx,
     }
   }
 
+  if (opts->autoConfig && !alg.name.empty()) {
+    BenchProfile profile;
+    profile.minKeySize = keySize;
+    profile.blockMAC = blockMACBytes > 0;
+    BenchChoice choice;
+    // xgroup(setup)
+    cout << _("Measuring the ciphers and the filesystem...") << endl;
+    // reverse volumes only read their files, which are the user's own
+    const std::string measured = reverseEncryption ? std::string() : rootDir;
+    if (fastestConfig(profile, measured, AutoConfigDurationMs, &choice)) {
+      alg = choice.alg;
+      keySize = choice.keySize;
+      blockSize = choice.blockSize;
+      cout << autosprintf(
+                  // xgroup(setup)
+                  _("Using %s with a %i bit key and %i byte blocks (%.0f "
+                    "MiB/s)"),
+                  alg.name.c_str(), keySize, blockSize, choice.speed)
+           << "\n";
+    }
+  }
+
   if (answer[0] == 'x' || alg.name.empty()) {
     if (answer[0] != 'x') {
       // xgroup(setup)
@@ -1118,6 +1714,9 @@ RootPtr createV6Config(EncFS_Context *ctx,
     keySize = selectKeySize(alg);
     blockSize = selectBlockSize(alg);
     plainData = selectPlainData(opts->insecure);
+    if (!plainData && !reverseEncryption && Fscrypt::supported(rootDir)) {
+      kernelContent = selectKernelContent();
+    }
     nameIOIface = selectNameCoding();
     if (plainData) {
       cout << _("plain data - IV, MAC and file-hole disabled") << "\n";
@@ -1128,6 +1727,18 @@ RootPtr createV6Config(EncFS_Context *ctx,
       blockMACBytes = 0;
       blockMACRandBytes = 0;
     }
+    else if (kernelContent) {
+      // xgroup(setup)
+      cout << _("kernel content encryption - file IV, MAC and file-hole "
+                "disabled")
+           << "\n";
+      chainedIV = selectChainedIV();
+      allowHoles = false;
+      externalIV = false;
+      uniqueIV = false;
+      blockMACBytes = 0;
+      blockMACRandBytes = 0;
+    }
     else {
       if (reverseEncryption) {
         cout << _("reverse encryption - chained IV and MAC disabled") << "\n";
@@ -1150,10 +1761,26 @@ RootPtr createV6Config(EncFS_Context *ctx,
                << "\n";
           externalIV = false;
         }
-        selectBlockMAC(&blockMACBytes, &blockMACRandBytes, opts->requireMac);
+        selectBlockMAC(&blockMACBytes, &blockMACRandBytes, &blockMACVersion,
+                       &blockMACExtents, opts->requireMac);
         allowHoles = selectZeroBlockPassThrough();
+        if (uniqueIV) {
+          alignedBlocks = selectAlignedBlocks();
+        }
+        if (CompressFileIO::supported(CompressFileIO::ZlibCompression) &&
+            selectCompression()) {
+          compression = CompressFileIO::ZlibCompression;
+        }
+        // the file sizes would depend on the block size with MAC headers
+        if (uniqueIV && blockMACBytes == 0 && blockMACRandBytes == 0 &&
+            compression == 0 && blockSize < LargeBlockSize &&
+            LargeBlockSize % blockSize == 0 &&
+            selectLargeBlocks()) {
+          largeBlockSize = LargeBlockSize;
+        }
       }
     }
+    argon2 = Argon2::supported() && selectArgon2();
   }
 
   std::shared_ptr<Cipher> cipher = Cipher::New(alg.name, keySize);
@@ -1166,10 +1793,70 @@ RootPtr createV6Config(EncFS_Context *ctx,
   VLOG(1) << "Using cipher " << alg.name << ", key size " << keySize
           << ", block size " << blockSize;
 
+  // compressed extents leave the rest of their slots as holes, which a
+  // random access cipher can't have
+  if (compression != 0 && cipher->randomAccess()) {
+    // xgroup(setup)
+    cout << _("random access cipher - compression disabled") << "\n";
+    compression = 0;
+  } else if (compression != 0 && !allowHoles) {
+    // xgroup(setup)
+    cout << _("compression - file-hole pass-through enabled") << "\n";
+    allowHoles = true;
+  }
+
+  // a random access cipher codes every write of a block with the same key
+  // stream, and flipped ciphertext bits flip the same plaintext bits, so
+  // its data needs the MAC headers
+  if (cipher->randomAccess() && !plainData && !kernelContent &&
+      blockMACBytes == 0) {
+    if (reverseEncryption) {
+      // xgroup(setup)
+      cout << _("random access cipher - not available with --reverse, as "
+                "it needs block MAC headers")
+           << "\n";
+      return rootInfo;
+    }
+    // xgroup(setup)
+    cout << _("random access cipher - block MAC headers enabled") << "\n";
+    blockMACBytes = 8;
+    blockMACVersion = 3;
+    largeBlockSize = 0;
+  }
+
+  // the tags and nonces of a sealing cipher take the place of the MAC
+  // headers, and its data can't be read without them
+  if (cipher->sealedBlocks() && !plainData && !kernelContent) {
+    if (reverseEncryption) {
+      // xgroup(setup)
+      cout << _("sealing cipher - not available with --reverse, as it "
+                "needs block headers")
+           << "\n";
+      return rootInfo;
+    }
+    // xgroup(setup)
+    cout << _("sealing cipher - block MAC headers replaced by its tags")
+         << "\n";
+    blockMACBytes = Cipher::SealTagBytes;
+    blockMACRandBytes = Cipher::SealNonceBytes;
+    blockMACVersion = 4;
+    blockMACExtents = false;
+    largeBlockSize = 0;
+  }
+
+  // parts of the blocks of a random access cipher are written on their own,
+  // which would leave a partly written hole reading back as garbage
+  if (cipher->randomAccess() && allowHoles) {
+    // xgroup(setup)
+    cout << _("random access cipher - file-hole pass-through disabled")
+         << "\n";
+    allowHoles = false;
+  }
+
   std::shared_ptr<EncFSConfig> config(new EncFSConfig);
 
   config->cfgType = Config_V6;
-  config->cipherIface = cipher->interface();
+  config->cipherIface = cipher->volumeInterface(blockSize);
   config->keySize = keySize;
   config->blockSize = blockSize;
   config->plainData = plainData;
@@ -1178,14 +1865,21 @@ RootPtr createV6Config(EncFS_Context *ctx,
   config->subVersion = V6SubVersion;
   config->blockMACBytes = blockMACBytes;
   config->blockMACRandBytes = blockMACRandBytes;
+  config->blockMACVersion = blockMACVersion;
+  config->blockMACExtents = blockMACExtents;
   config->uniqueIV = uniqueIV;
   config->chainedNameIV = chainedIV;
   config->externalIVChaining = externalIV;
   config->allowHoles = allowHoles;
+  config->alignedBlocks = alignedBlocks;
+  config->compression = compression;
+  config->largeBlockSize = largeBlockSize;
+  config->kernelContent = kernelContent;
 
   config->salt.clear();
   config->kdfIterations = 0;  // filled in by keying function
   config->desiredKDFDuration = desiredKDFDuration;
+  config->selectKDF(argon2);
 
   cout << "\n";
   // xgroup(setup)
@@ -1246,6 +1940,17 @@ RootPtr createV6Config(EncFS_Context *ctx,
     return rootInfo;
   }
 
+  // encrypted before the config is saved, a volume is complete or not there
+  std::string dataRoot = rootDir;
+  std::shared_ptr<Fscrypt> kernelKey;
+  if (kernelContent) {
+    dataRoot =
+        unlockKernelContent(cipher, volumeKey, rootDir, true, &kernelKey);
+    if (dataRoot.empty()) {
+      return rootInfo;
+    }
+  }
+
   if (!saveConfig(Config_V6, rootDir, config.get(), opts->config)) {
     return rootInfo;
   }
@@ -1278,11 +1983,31 @@ RootPtr createV6Config(EncFS_Context *ctx,
   fsConfig->reverseEncryption = reverseEncryption;
   fsConfig->idleTracking = enableIdleTracking;
   fsConfig->opts = opts;
+  fsConfig->blockCache = newBlockCache(opts);
+  fsConfig->workers = newWorkerPool(opts);
+  fsConfig->ivJournal = newIVJournal(fsConfig);
+  fsConfig->fileIVCache = newFileIVCache(fsConfig);
+  fsConfig->bufferBudget = newBufferBudget(opts);
+  fsConfig->dirFds = newDirFdCache(fsConfig);
+  fsConfig->diskCache = newDiskCache(fsConfig);
+  fsConfig->ioScheduler = newIOScheduler(opts);
+  fsConfig->syncBatcher = newSyncBatcher(opts);
+  fsConfig->memoryPressure = newMemoryPressure(opts);
+  fsConfig->uring = useUring(opts);
+  fsConfig->closeFlush = flushesOnClose(opts, rootDir);
+  fsConfig->kernelKey = kernelKey;
+  if (!newStripes(fsConfig, rootDir) || !newPolicies(fsConfig)) {
+    return rootInfo;
+  }
 
   rootInfo = std::make_shared<encfs::EncFS_Root>();
   rootInfo->cipher = cipher;
   rootInfo->volumeKey = volumeKey;
-  rootInfo->root = std::make_shared<DirNode>(ctx, rootDir, fsConfig);
+  rootInfo->root = std::make_shared<DirNode>(ctx, dataRoot, fsConfig);
+  rootInfo->workers = fsConfig->workers;
+  if (!newIntentLog(fsConfig, rootInfo->root)) {
+    rootInfo.reset();
+  }
 
   return rootInfo;
 }
@@ -1345,13 +2070,28 @@ void showFSInfo(const EncFSConfig *config) {
     }
   }
   if (config->kdfIterations > 0 && !config->salt.empty()) {
-    cout << autosprintf(_("Using PBKDF2, with %i iterations"),
-                        config->kdfIterations)
-         << "\n";
+    if (config->kdfMemory > 0) {
+      cout << autosprintf(
+                  _("Using Argon2id, with %i passes over %i KiB in %i lanes"),
+                  config->kdfIterations, config->kdfMemory, config->kdfLanes)
+           << "\n";
+    } else {
+      cout << autosprintf(_("Using PBKDF2, with %i iterations"),
+                          config->kdfIterations)
+           << "\n";
+    }
     cout << autosprintf(_("Salt Size: %i bits"), (int)(8 * config->salt.size()))
          << "\n";
   }
-  if ((config->blockMACBytes != 0) || (config->blockMACRandBytes != 0)) {
+  if (config->blockMACExtents) {
+    cout << autosprintf(
+                // xgroup(diag)
+                _("Block Size: %i bytes, with %i byte MACs kept in extents "
+                  "of their own"),
+                config->blockSize, config->blockMACBytes)
+         << endl;
+  } else if ((config->blockMACBytes != 0) ||
+             (config->blockMACRandBytes != 0)) {
     if (config->subVersion < 20040813) {
       cout << autosprintf(
                   // xgroup(diag)
@@ -1374,7 +2114,20 @@ void showFSInfo(const EncFSConfig *config) {
     cout << "\n";
   }
 
-  if (config->uniqueIV) {
+  if (config->blockMACBytes != 0 && config->blockMACVersion == 3) {
+    // xgroup(diag)
+    cout << _("Block authentication codes are computed with SipHash.\n");
+  } else if (config->blockMACBytes != 0 && config->blockMACVersion >= 4) {
+    // xgroup(diag)
+    cout << _("Blocks are sealed by the cipher, with a tag and a random "
+              "nonce in their headers.\n");
+  }
+
+  if (config->uniqueIV && config->alignedBlocks) {
+    // xgroup(diag)
+    cout << _("Each file contains 8 byte header with unique IV data,\n"
+              "padded to 4096 bytes to keep blocks aligned.\n");
+  } else if (config->uniqueIV) {
     // xgroup(diag)
     cout << _("Each file contains 8 byte header with unique IV data.\n");
   }
@@ -1390,6 +2143,19 @@ void showFSInfo(const EncFSConfig *config) {
     // xgroup(diag)
     cout << _("File holes passed through to ciphertext.\n");
   }
+  if (config->compression == CompressFileIO::ZlibCompression) {
+    // xgroup(diag)
+    cout << _("File contents compressed with zlib.\n");
+  }
+  if (config->largeBlockSize != 0) {
+    // xgroup(diag)
+    cout << autosprintf(_("Large files use blocks of %i bytes.\n"),
+                        config->largeBlockSize);
+  }
+  if (config->kernelContent) {
+    // xgroup(diag)
+    cout << _("File contents encrypted by the kernel (fscrypt).\n");
+  }
   cout << "\n";
 }
 std::shared_ptr<Cipher> EncFSConfig::getCipher() const {
@@ -1416,6 +2182,20 @@ unsigned char *EncFSConfig::getSaltData() const {
   return const_cast<unsigned char *>(&salt.front());
 }
 
+void EncFSConfig::selectKDF(bool argon2) {
+  kdfIterations = 0;
+  kdfMemory = 0;
+  kdfLanes = 0;
+  if (argon2) {
+    // lanes are filled in parallel, so unlocking is quicker with more cores,
+    // while the work for an attacker stays the same
+    kdfLanes = std::min<int>(
+        std::max<int>(std::thread::hardware_concurrency(), 1), MaxArgon2Lanes);
+    kdfMemory = desiredKDFDuration > NormalKDFDuration ? ParanoiaArgon2Memory
+                                                       : NormalArgon2Memory;
+  }
+}
+
 CipherKey EncFSConfig::makeKey(const char *password, int passwdLen) {
   CipherKey userKey;
   std::shared_ptr<Cipher> cipher = getCipher();
@@ -1425,6 +2205,8 @@ CipherKey EncFSConfig::makeKey(const char *password, int passwdLen) {
     exit(1);
   }
 
+  Stats::PhaseTimer timer(Stats::DeriveKey);
+
   // if no salt is set and we're creating a new password for a new
   // FS type, then initialize salt..
   if (salt.empty() && kdfIterations == 0 && cfgType >= Config_V6) {
@@ -1441,8 +2223,16 @@ CipherKey EncFSConfig::makeKey(const char *password, int passwdLen) {
       return userKey;
     }
 
-    userKey = cipher->newKey(password, passwdLen, kdfIterations,
-                             desiredKDFDuration, getSaltData(), salt.size());
+    if (kdfMemory > 0) {
+      Argon2::Params params = {(uint32_t)kdfIterations, (uint32_t)kdfMemory,
+                               (uint32_t)kdfLanes};
+      userKey = cipher->newKey(password, passwdLen, params, desiredKDFDuration,
+                               getSaltData(), salt.size());
+      kdfIterations = params.passes;
+    } else {
+      userKey = cipher->newKey(password, passwdLen, kdfIterations,
+                               desiredKDFDuration, getSaltData(), salt.size());
+    }
   } else {
     userKey = cipher->newKey(password, passwdLen);
   }
@@ -1479,6 +2269,13 @@ CipherKey EncFSConfig::getUserKey(bool useStdin) {
   return userKey;
 }
 
+CipherKey EncFSConfig::keyFromPassword(const std::string &password) {
+  if (password.empty()) {
+    return CipherKey();
+  }
+  return makeKey(password.data(), (int)password.size());
+}
+
 std::string readPassword(int FD) {
   char buffer[1024];
   string result;
@@ -1608,7 +2405,55 @@ CipherKey EncFSConfig::getNewUserKey() {
   return userKey;
 }
 
-RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts) {
+/**
+ * --keyring: the volume key is kept in the kernel keyring over an idle
+ * unmount.  It is stored encoded with a key derived from the encoded key in
+ * the config, which ties it to the volume and its password; the keyring's
+ * permissions are what protect it.
+ */
+static std::string keptKeyName(const std::shared_ptr<EncFS_Opts> &opts) {
+  return "encfs:" + opts->rootDir;
+}
+
+static CipherKey keptKeyWrapper(const std::shared_ptr<Cipher> &cipher,
+                                const EncFSConfig *config) {
+  return cipher->newKey((const char *)config->getKeyData(),
+                        (int)config->keyData.size());
+}
+
+static void keepKey(const std::shared_ptr<EncFS_Opts> &opts,
+                    const FSConfigPtr &fsConfig) {
+  // fsConfig->cipher is the null cipher for plainData volumes
+  std::shared_ptr<Cipher> cipher = fsConfig->config->getCipher();
+  if (!cipher || !fsConfig->key) {
+    return;
+  }
+  std::vector<unsigned char> data(cipher->encodedKeySize());
+  cipher->writeKey(fsConfig->key, data.data(),
+                   keptKeyWrapper(cipher, fsConfig->config.get()));
+  if (KeyRing::store(keptKeyName(opts), data, opts->keyringTimeout)) {
+    VLOG(1) << "volume key kept for " << opts->keyringTimeout << " seconds";
+  }
+  std::fill(data.begin(), data.end(), 0);
+}
+
+static CipherKey takeKeptKey(const std::shared_ptr<EncFS_Opts> &opts,
+                             const EncFSConfig *config,
+                             const std::shared_ptr<Cipher> &cipher) {
+  CipherKey key;
+  std::vector<unsigned char> data;
+  if (KeyRing::take(keptKeyName(opts), &data)) {
+    if (data.size() == (size_t)cipher->encodedKeySize()) {
+      key = cipher->readKey(data.data(), keptKeyWrapper(cipher, config), true);
+    }
+    std::fill(data.begin(), data.end(), 0);
+    VLOG(1) << (key ? "using" : "ignoring") << " the kept volume key";
+  }
+  return key;
+}
+
+RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts,
+               const std::string *password) {
   RootPtr rootInfo;
   std::shared_ptr<EncFSConfig> config(new EncFSConfig);
 
@@ -1621,7 +2466,8 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts) {
 
     if (opts->reverseEncryption) {
       if (config->blockMACBytes != 0 || config->blockMACRandBytes != 0 ||
-          config->externalIVChaining || config->chainedNameIV) {
+          config->externalIVChaining || config->chainedNameIV ||
+          config->alignedBlocks) {
         cout << _(
             "The configuration loaded is not compatible with --reverse\n");
         return rootInfo;
@@ -1635,7 +2481,16 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts) {
     }
 
     // first, instanciate the cipher.
-    std::shared_ptr<Cipher> cipher = config->getCipher();
+    std::shared_ptr<Cipher> cipher;
+    if (opts->kernelCrypto) {
+      cipher = Cipher::New("AES-AFALG", config->cipherIface, config->keySize);
+      if (!cipher) {
+        RLOG(WARNING) << "--kernelcrypto only supports AES (CBC) volumes";
+      }
+    }
+    if (!cipher) {
+      cipher = config->getCipher();
+    }
     if (!cipher) {
       cerr << autosprintf(
           _("Unable to find cipher %s, version %i:%i:%i"),
@@ -1646,6 +2501,23 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts) {
       return rootInfo;
     }
 
+    // see createV6Config, the data of a random access cipher needs MACs
+    if (cipher->randomAccess() && !config->plainData &&
+        !config->kernelContent && config->blockMACBytes == 0) {
+      cout << _("The configuration uses a random access cipher without "
+                "block MAC headers, which isn't supported\n");
+      return rootInfo;
+    }
+
+    // a sealing cipher needs the version 4 headers, which nothing else
+    // checks
+    if (!config->plainData && !config->kernelContent &&
+        cipher->sealedBlocks() != (config->blockMACVersion >= 4)) {
+      cout << _("The block headers of the configuration don't match its "
+                "cipher, which isn't supported\n");
+      return rootInfo;
+    }
+
     if (opts->delayMount) {
       rootInfo = std::make_shared<encfs::EncFS_Root>();
       rootInfo->cipher = cipher;
@@ -1653,35 +2525,52 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts) {
       return rootInfo;
     }
 
-    // get user key
-    CipherKey userKey;
+    // a key kept over an idle unmount saves the password and its derivation
+    CipherKey volumeKey;
+    if (opts->keyringTimeout > 0) {
+      Stats::PhaseTimer timer(Stats::DecodeKey);
+      volumeKey = takeKeptKey(opts, config.get(), cipher);
+    }
 
-    if (opts->passwordProgram.empty()) {
-      VLOG(1) << "useStdin: " << opts->useStdin;
-      if (opts->annotate) {
-        cerr << "$PROMPT$ passwd" << endl;
+    if (!volumeKey) {
+      // get user key, the key derivation timed apart
+      CipherKey userKey;
+      Stats::PhaseTimer passwordTimer(Stats::Password);
+
+      if (password != nullptr) {
+        userKey = config->keyFromPassword(*password);
+      } else if (opts->passwordProgram.empty()) {
+        VLOG(1) << "useStdin: " << opts->useStdin;
+        if (opts->annotate) {
+          cerr << "$PROMPT$ passwd" << endl;
+        }
+        userKey = config->getUserKey(opts->useStdin);
+      } else {
+        userKey = config->getUserKey(opts->passwordProgram, opts->rootDir);
       }
-      userKey = config->getUserKey(opts->useStdin);
-    } else {
-      userKey = config->getUserKey(opts->passwordProgram, opts->rootDir);
-    }
 
-    if (!userKey) {
-      return rootInfo;
-    }
+      if (!userKey) {
+        return rootInfo;
+      }
 
-    VLOG(1) << "cipher key size = " << cipher->encodedKeySize();
-    // decode volume key..
-    CipherKey volumeKey =
-        cipher->readKey(config->getKeyData(), userKey, opts->checkKey);
-    userKey.reset();
+      VLOG(1) << "cipher key size = " << cipher->encodedKeySize();
+      // decode volume key..
+      {
+        Stats::PhaseTimer timer(Stats::DecodeKey);
+        volumeKey =
+            cipher->readKey(config->getKeyData(), userKey, opts->checkKey);
+      }
+      userKey.reset();
 
-    if (!volumeKey) {
-      // xgroup(diag)
-      cout << _("Error decoding volume key, password incorrect\n");
-      return rootInfo;
+      if (!volumeKey) {
+        // xgroup(diag)
+        cout << _("Error decoding volume key, password incorrect\n");
+        return rootInfo;
+      }
     }
 
+    std::unique_ptr<Stats::PhaseTimer> volumeTimer(
+        new Stats::PhaseTimer(Stats::Volume));
     std::shared_ptr<NameIO> nameCoder =
         NameIO::New(config->nameIface, cipher, volumeKey);
     if (!nameCoder) {
@@ -1717,11 +2606,42 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts) {
     fsConfig->forceDecode = opts->forceDecode;
     fsConfig->reverseEncryption = opts->reverseEncryption;
     fsConfig->opts = opts;
+    fsConfig->blockCache = newBlockCache(opts);
+    fsConfig->workers = newWorkerPool(opts);
+    fsConfig->ivJournal = newIVJournal(fsConfig);
+    fsConfig->fileIVCache = newFileIVCache(fsConfig);
+    fsConfig->bufferBudget = newBufferBudget(opts);
+    fsConfig->dirFds = newDirFdCache(fsConfig);
+    fsConfig->diskCache = newDiskCache(fsConfig);
+    fsConfig->ioScheduler = newIOScheduler(opts);
+    fsConfig->syncBatcher = newSyncBatcher(opts);
+    fsConfig->memoryPressure = newMemoryPressure(opts);
+    fsConfig->uring = useUring(opts);
+    fsConfig->closeFlush = flushesOnClose(opts, opts->rootDir);
+    if (!newStripes(fsConfig, opts->rootDir) || !newPolicies(fsConfig)) {
+      return rootInfo;
+    }
+    IVJournal::compactLater(fsConfig->ivJournal, fsConfig->workers.get());
+
+    std::string dataRoot = opts->rootDir;
+    if (config->kernelContent) {
+      dataRoot = unlockKernelContent(cipher, volumeKey, opts->rootDir, false,
+                                     &fsConfig->kernelKey);
+      if (dataRoot.empty()) {
+        return rootInfo;
+      }
+    }
+    volumeTimer.reset();
 
+    Stats::PhaseTimer rootTimer(Stats::RootDir);
     rootInfo = std::make_shared<encfs::EncFS_Root>();
     rootInfo->cipher = cipher;
     rootInfo->volumeKey = volumeKey;
-    rootInfo->root = std::make_shared<DirNode>(ctx, opts->rootDir, fsConfig);
+    rootInfo->root = std::make_shared<DirNode>(ctx, dataRoot, fsConfig);
+    rootInfo->workers = fsConfig->workers;
+    if (!newIntentLog(fsConfig, rootInfo->root)) {
+      rootInfo.reset();
+    }
   } else {
     if (opts->createIfNotFound) {
       // creating a new encrypted filesystem
@@ -1765,6 +2685,11 @@ int remountFS(EncFS_Context *ctx) {
 
   RootPtr rootInfo = initFS(ctx, ctx->opts);
   if (rootInfo) {
+    if (ctx->opts->watchBacking) {
+      rootInfo->root->watchBacking();
+    }
+    rootInfo->root->warmUp();
+    rootInfo->root->startIntentLog();
     ctx->setRoot(rootInfo->root);
     return 0;
   }
@@ -1777,6 +2702,13 @@ bool unmountFS(EncFS_Context *ctx) {
     VLOG(1) << "Detaching filesystem due to inactivity: "
             << ctx->opts->unmountPoint;
 
+    if (ctx->opts->keyringTimeout > 0) {
+      int err = 0;
+      std::shared_ptr<DirNode> root = ctx->getRoot(&err, true);
+      if (root) {
+        keepKey(ctx->opts, root->config());
+      }
+    }
     ctx->setRoot(std::shared_ptr<DirNode>());
     return false;
   }
@@ -21,11 +21,15 @@
 #ifndef _FileUtils_incl_
 #define _FileUtils_incl_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <sys/types.h>
+#include <vector>
 
+#include "BlockCache.h"
 #include "CipherKey.h"
+#include "FairScheduler.h"
 #include "FSConfig.h"
 #include "Interface.h"
 #include "encfs.h"
@@ -55,6 +59,8 @@ struct EncFS_Root {
   std::shared_ptr<Cipher> cipher;
   CipherKey volumeKey;
   std::shared_ptr<DirNode> root;
+  // the worker threads of the volume's files, for tools which process many
+  std::shared_ptr<WorkerPool> workers;
 
   EncFS_Root();
   ~EncFS_Root();
@@ -96,13 +102,108 @@ struct EncFS_Opts {
                  * behind the back of EncFS (for example, in reverse mode).
                  * See main.cpp for a longer explaination. */
 
+  int blockCacheSize;  // MiB of decoded blocks to cache, 0 == disabled
+
+  bool lockBlockCache;  // mlock the block cache
+  BlockCache::Policy blockCachePolicy;
+  bool kernelCrypto;    // code blocks with the kernel crypto API
+
+  // max KiB to read ahead of sequential reads, 0 == off.  Tunable while
+  // mounted, for the files opened afterwards.
+  std::atomic<int> readAheadSize;
+
+  int writeBackSize;  // KiB of small writes to buffer per file, 0 == off
+  std::string intentLogPath;  // local log of the buffered writes, or empty
+
+  int bufferMemSize;  // MiB of block buffers for open files, 0 == no limit
+
+  int workerThreads;  // threads for encoding and read ahead, 0 == per core
+
+  int pathCacheSize;  // number of coded paths to cache, 0 == disabled
+
+  int dirCacheSize;  // number of directory listings to cache, 0 == disabled
+
+  int dirIndexSize;  // entries for a listing to be kept on disk, 0 == off
+
+  int walkAhead;  // directories to list ahead of a tree walk, 0 == off
+
+  int keyringTimeout;  // seconds the key is kept over an idle unmount
+  // mount before the key is derived, calls wait this many seconds for it;
+  // 0 == off
+  int unlockTimeout;
+
+  int negativeCacheSize;  // number of missing paths to cache, 0 == disabled
+
+  int attrCacheSize;  // number of path attributes to cache, 0 == disabled
+
+  int keepCacheSize;  // files whose kernel pages are kept, 0 == disabled
+
+  int xattrCacheSize;  // paths of which missing xattrs are cached, 0 == off
+
+  int statfsTimeout;  // milliseconds a statfs result is served, 0 == disabled
+
+  int dirFdCacheSize;  // number of directory descriptors to keep, 0 == off
+
+  int groupSyncWindow;  // microseconds fsyncs wait to be batched, -1 == off
+
+  bool watchPressure;  // shrink the caches under memory pressure
+
+  int fairShareSlots;  // reads and writes let in at once, 0 == unlimited
+  int ioDepth;  // backing file reads and writes at once, 0 == unlimited
+  int deviceIODepth;  // of those, on one device, 0 == ioDepth
+  double bgCpu;  // CPUs background work may take, 0 == unlimited
+  FairScheduler::Weights fairWeights;  // shares of the users (--fairweight)
+
+  bool watchBacking;  // follow changes made to rootDir by others (--watch)
+
+  int sharedTimeout;  // seconds changes by other clients may go unseen, 0 == off
+
+  int netfsTimeout;  // seconds attributes of a network rootDir are kept, 0 == off
+
+  bool ivJournal;  // defer header rewrites of renamed files to a journal
+
+  bool stats;  // keep latency histograms, served in /.encfs-stats
+
+  int slowLogMs;  // FUSE calls at least this slow are logged, 0 == off
+
+  int hotFilesSize;  // busiest files kept for encfsctl top, 0 == off
+
+  std::string opTracePath;  // calls recorded for encfsctl replay, or empty
+
+  bool control;  // settings can be changed through /.encfs-control
+
+  bool warmCache;  // refill the caches with the paths in use at unmount
+
+  bool uring;  // read and write backing files through io_uring
+
+  bool directIO;  // open backing files with O_DIRECT
+
+  bool dropBehind;  // page cache hints for streamed backing files
+  // MiB behind the writes of a file to start writing it back, 0 == off
+  int writeBehind;
+
+  int streamSize;  // MiB from which files bypass FUSE's page cache, -1 == off
+
+  std::string diskCacheDir;  // ciphertext cached on a local disk, "" == off
+  int diskCacheSize;         // MiB the --diskcache directory may hold
+
+  std::vector<std::string> stripeDirs;  // other backing directories (--stripe)
+
+  std::string policyFile;  // settings of subtrees (--policy), or empty
+
   bool readOnly;  // Mount read-only
 
   bool insecure; // Allow to use plain data / to disable data encoding
 
   bool requireMac;  // Throw an error if MAC is disabled
 
+  // set by encfs --serve, so that all volumes of the process share one
+  // block cache budget and one set of worker threads
+  std::shared_ptr<BlockCache> sharedBlockCache;
+  std::shared_ptr<WorkerPool> sharedWorkers;
+
   ConfigMode configMode;
+  bool autoConfig;  // measure which cipher and block size is fastest (--auto)
   std::string config;  // path to configuration file (or empty)
 
   EncFS_Opts() {
@@ -118,7 +219,49 @@ struct EncFS_Opts {
     ownerCreate = false;
     reverseEncryption = false;
     configMode = Config_Prompt;
+    autoConfig = false;
     noCache = false;
+    blockCacheSize = 0;
+    lockBlockCache = false;
+    blockCachePolicy = BlockCache::Lru;
+    kernelCrypto = false;
+    readAheadSize = 1024;
+    writeBackSize = 0;
+    bufferMemSize = 64;
+    workerThreads = 0;
+    pathCacheSize = 1024;
+    dirCacheSize = 256;
+    dirIndexSize = 0;
+    walkAhead = 8;
+    keyringTimeout = 0;
+    unlockTimeout = 0;
+    negativeCacheSize = 1024;
+    attrCacheSize = 1024;
+    keepCacheSize = 4096;
+    xattrCacheSize = 1024;
+    statfsTimeout = 1000;
+    dirFdCacheSize = 64;
+    groupSyncWindow = -1;
+    watchPressure = true;
+    fairShareSlots = 0;
+    ioDepth = 0;
+    deviceIODepth = 0;
+    bgCpu = 0;
+    watchBacking = false;
+    sharedTimeout = 0;
+    netfsTimeout = 0;
+    ivJournal = false;
+    stats = false;
+    slowLogMs = 0;
+    hotFilesSize = 0;
+    control = false;
+    warmCache = false;
+    uring = false;
+    directIO = false;
+    dropBehind = false;
+    writeBehind = 0;
+    streamSize = -1;
+    diskCacheSize = 1024;
     readOnly = false;
     insecure = false;
     requireMac = false;
@@ -139,7 +282,15 @@ bool saveConfig(ConfigType type, const std::string &rootdir,
 
 class EncFS_Context;
 
-RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts);
+// password, if not null, is used instead of asking for one
+RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts,
+               const std::string *password = nullptr);
+
+// the block cache and worker threads initFS gives a volume with these opts
+std::shared_ptr<BlockCache> newBlockCache(
+    const std::shared_ptr<EncFS_Opts> &opts);
+std::shared_ptr<WorkerPool> newWorkerPool(
+    const std::shared_ptr<EncFS_Opts> &opts);
 
 void unmountFS(const char *mountPoint);
 
@@ -0,0 +1,172 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Fscrypt.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#ifdef HAVE_LINUX_FSCRYPT_H
+#include <linux/fscrypt.h>
+#endif
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+const char Fscrypt::DataDir[] = "fscrypt";
+const int Fscrypt::KeySize;
+
+#ifdef HAVE_LINUX_FSCRYPT_H
+
+// the keys held in this process, by root
+static pthread_mutex_t keysMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::weak_ptr<Fscrypt>> keys;
+
+static int openDir(const std::string &dir) {
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  return fd < 0 ? -errno : fd;
+}
+
+bool Fscrypt::supported(const std::string &dir) {
+  int fd = openDir(dir);
+  if (fd < 0) {
+    return false;
+  }
+  struct fscrypt_get_policy_ex_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.policy_size = sizeof(arg.policy);
+  // a directory without a policy says so, others don't know the call
+  bool res = ioctl(fd, FS_IOC_GET_ENCRYPTION_POLICY_EX, &arg) == 0 ||
+             errno == ENODATA;
+  ::close(fd);
+  return res;
+}
+
+std::shared_ptr<Fscrypt> Fscrypt::unlock(const std::string &rootDir,
+                                         const unsigned char *key,
+                                         int *result) {
+  Lock lock(keysMutex);
+  std::shared_ptr<Fscrypt> held = keys[rootDir].lock();
+  if (held) {
+    return held;
+  }
+
+  int fd = openDir(rootDir);
+  if (fd < 0) {
+    *result = fd;
+    return nullptr;
+  }
+  std::vector<unsigned char> buf(sizeof(struct fscrypt_add_key_arg) +
+                                 KeySize);
+  auto *arg = (struct fscrypt_add_key_arg *)buf.data();
+  arg->key_spec.type = FSCRYPT_KEY_SPEC_TYPE_IDENTIFIER;
+  arg->raw_size = KeySize;
+  memcpy(arg->raw, key, KeySize);
+  int res = ioctl(fd, FS_IOC_ADD_ENCRYPTION_KEY, arg);
+  int eno = errno;
+  ::close(fd);
+  memset(arg->raw, 0, KeySize);
+  if (res != 0) {
+    RLOG(ERROR) << "unable to add the fscrypt key for " << rootDir << ": "
+                << strerror(eno);
+    *result = -eno;
+    return nullptr;
+  }
+
+  held.reset(new Fscrypt(rootDir, arg->key_spec.u.identifier));
+  keys[rootDir] = held;
+  return held;
+}
+
+Fscrypt::~Fscrypt() {
+  Lock lock(keysMutex);
+  auto it = keys.find(_rootDir);
+  if (it != keys.end()) {
+    if (!it->second.expired()) {
+      // added again since this one was let go, and still needed
+      return;
+    }
+    keys.erase(it);
+  }
+
+  int fd = openDir(_rootDir);
+  if (fd < 0) {
+    return;
+  }
+  struct fscrypt_remove_key_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.key_spec.type = FSCRYPT_KEY_SPEC_TYPE_IDENTIFIER;
+  memcpy(arg.key_spec.u.identifier, _identifier, sizeof(_identifier));
+  if (ioctl(fd, FS_IOC_REMOVE_ENCRYPTION_KEY, &arg) != 0) {
+    RLOG(WARNING) << "unable to remove the fscrypt key of " << _rootDir
+                  << ": " << strerror(errno);
+  } else if ((arg.removal_status_flags &
+              FSCRYPT_KEY_REMOVAL_STATUS_FLAG_FILES_BUSY) != 0) {
+    RLOG(WARNING) << "files of " << _rootDir
+                  << " still in use, they stay readable until closed";
+  }
+  ::close(fd);
+}
+
+int Fscrypt::protect(const std::string &dir) const {
+  int fd = openDir(dir);
+  if (fd < 0) {
+    return fd;
+  }
+  struct fscrypt_policy_v2 policy;
+  memset(&policy, 0, sizeof(policy));
+  policy.version = FSCRYPT_POLICY_V2;
+  policy.contents_encryption_mode = FSCRYPT_MODE_AES_256_XTS;
+  policy.filenames_encryption_mode = FSCRYPT_MODE_AES_256_CTS;
+  policy.flags = FSCRYPT_POLICY_FLAGS_PAD_32;
+  memcpy(policy.master_key_identifier, _identifier, sizeof(_identifier));
+  int res = ioctl(fd, FS_IOC_SET_ENCRYPTION_POLICY, &policy) == 0 ? 0 : -errno;
+  ::close(fd);
+  return res;
+}
+
+#else
+
+bool Fscrypt::supported(const std::string &) { return false; }
+
+std::shared_ptr<Fscrypt> Fscrypt::unlock(const std::string &,
+                                         const unsigned char *, int *result) {
+  *result = -ENOTSUP;
+  return nullptr;
+}
+
+Fscrypt::~Fscrypt() {}
+
+int Fscrypt::protect(const std::string &) const { return -ENOTSUP; }
+
+#endif
+
+Fscrypt::Fscrypt(const std::string &rootDir, const unsigned char *identifier)
+    : _rootDir(rootDir) {
+  memcpy(_identifier, identifier, sizeof(_identifier));
+}
+
+}  // namespace encfs
@@ -0,0 +1,72 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _Fscrypt_incl_
+#define _Fscrypt_incl_
+
+#include <memory>
+#include <string>
+
+namespace encfs {
+
+/*
+    The content encryption of volumes which leave it to the kernel
+    (kernelContent): the files are kept in DataDir under the root, a
+    directory with an fscrypt v2 policy (AES-256-XTS contents), so the
+    lower file system encrypts them, with inline encryption hardware where
+    it is mounted with inlinecrypt.  The names still go through NameIO, and
+    the config stays outside of DataDir, readable before the key is there.
+
+    The master key is derived from the volume key and added to the file
+    system of the root while an Fscrypt holds it.  One is shared by the
+    mounts of a root in a process, so that a remount doesn't remove the key
+    from under the mount it replaces; the key is removed when the last one
+    goes, which locks the files again.
+*/
+class Fscrypt {
+ public:
+  // where the files of the volume are kept, under its root
+  static const char DataDir[];
+  // bytes of the master key
+  static const int KeySize = 64;
+
+  // Whether the file system of dir can encrypt directories
+  static bool supported(const std::string &dir);
+
+  // Adds key to the file system of rootDir, if it isn't there for rootDir
+  // already.  nullptr on failure, with result set to -errno.
+  static std::shared_ptr<Fscrypt> unlock(const std::string &rootDir,
+                                         const unsigned char *key,
+                                         int *result);
+  ~Fscrypt();
+
+  Fscrypt(const Fscrypt &src) = delete;
+  Fscrypt &operator=(const Fscrypt &src) = delete;
+
+  // Encrypts the empty directory dir with the key.  Returns 0 or -errno.
+  int protect(const std::string &dir) const;
+
+ private:
+  Fscrypt(const std::string &rootDir, const unsigned char *identifier);
+
+  std::string _rootDir;
+  unsigned char _identifier[16];
+};
+
+}  // namespace encfs
+
+#endif
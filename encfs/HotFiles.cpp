@@ -0,0 +1,147 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "HotFiles.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// bytes which weigh as much as a call
+static const uint64_t BytesPerCall = 64 << 10;
+
+HotFiles::HotFiles(size_t maxEntries) : _capacity(maxEntries) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+HotFiles::~HotFiles() { pthread_mutex_destroy(&_mutex); }
+
+void HotFiles::record(const std::string &key, uint64_t calls,
+                      uint64_t bytesRead, uint64_t bytesWritten,
+                      uint64_t cryptoNs, uint64_t backingRead,
+                      uint64_t backingWritten) {
+  if (_capacity == 0) {
+    return;
+  }
+  uint64_t weight =
+      calls + (bytesRead + bytesWritten) / BytesPerCall * calls;
+
+  Lock lock(_mutex);
+  Entry *entry;
+  auto it = _index.find(key);
+  if (it != _index.end()) {
+    entry = &_entries[it->second];
+  } else if (_entries.size() < _capacity) {
+    _index[key] = _entries.size();
+    _entries.push_back(Entry{key, 0, 0, 0, 0, 0, 0, 0, 0});
+    entry = &_entries.back();
+  } else {
+    // the lightest entry gives way, its weight is the newcomer's error
+    size_t lightest = 0;
+    for (size_t i = 1; i < _entries.size(); ++i) {
+      if (_entries[i].weight < _entries[lightest].weight) {
+        lightest = i;
+      }
+    }
+    entry = &_entries[lightest];
+    _index.erase(entry->key);
+    _index[key] = lightest;
+    *entry = Entry{key, entry->weight, entry->weight, 0, 0, 0, 0, 0, 0};
+  }
+  entry->weight += weight;
+  entry->ops += calls;
+  entry->bytesRead += bytesRead * calls;
+  entry->bytesWritten += bytesWritten * calls;
+  entry->cryptoNs += cryptoNs * calls;
+  entry->backingRead += backingRead * calls;
+  entry->backingWritten += backingWritten * calls;
+}
+
+std::vector<HotFiles::Entry> HotFiles::top() const {
+  std::vector<Entry> entries;
+  {
+    Lock lock(_mutex);
+    entries = _entries;
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.weight > b.weight; });
+  return entries;
+}
+
+std::string HotFiles::report(const char *prefix, const char *label) const {
+  std::vector<Entry> entries = top();
+  struct Gauge {
+    const char *name;
+    const char *help;
+  } gauges[] = {
+      {"ops", "Calls, estimated from a sample."},
+      {"read_bytes", "Bytes read, estimated from a sample."},
+      {"written_bytes", "Bytes written, estimated from a sample."},
+      {"crypto_seconds", "Time spent coding, estimated from a sample."},
+      {"backing_read_bytes",
+       "Bytes read from the backing file, estimated from a sample."},
+      {"backing_written_bytes",
+       "Bytes written to the backing file, estimated from a sample."},
+  };
+
+  std::string out;
+  char line[512];
+  for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); ++g) {
+    snprintf(line, sizeof(line), "# HELP %s_%s %s\n# TYPE %s_%s gauge\n",
+             prefix, gauges[g].name, gauges[g].help, prefix, gauges[g].name);
+    out += line;
+    for (const Entry &entry : entries) {
+      snprintf(line, sizeof(line), "%s_%s{%s=\"", prefix, gauges[g].name,
+               label);
+      out += line;
+      out += entry.key;
+      switch (g) {
+        case 0:
+          snprintf(line, sizeof(line), "\"} %llu\n",
+                   (unsigned long long)entry.ops);
+          break;
+        case 1:
+          snprintf(line, sizeof(line), "\"} %llu\n",
+                   (unsigned long long)entry.bytesRead);
+          break;
+        case 2:
+          snprintf(line, sizeof(line), "\"} %llu\n",
+                   (unsigned long long)entry.bytesWritten);
+          break;
+        case 3:
+          snprintf(line, sizeof(line), "\"} %.9f\n", entry.cryptoNs / 1e9);
+          break;
+        case 4:
+          snprintf(line, sizeof(line), "\"} %llu\n",
+                   (unsigned long long)entry.backingRead);
+          break;
+        default:
+          snprintf(line, sizeof(line), "\"} %llu\n",
+                   (unsigned long long)entry.backingWritten);
+          break;
+      }
+      out += line;
+    }
+  }
+  return out;
+}
+
+}  // namespace encfs
@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _HotFiles_incl_
+#define _HotFiles_incl_
+
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace encfs {
+
+/*
+    The busiest backing files, or users, of a mount (--hotfiles), served in
+    /.encfs-stats for encfsctl top.
+
+    A Space-Saving sketch of K entries: a key which isn't in the table takes
+    over the entry with the least weight once all are in use, and carries
+    on from that weight, which is kept as the entry's error.  Any key with
+    more than 1/K of the total weight is in the table, with its weight
+    overstated by at most its error.  A call weighs one, plus one for each
+    64 KiB it read or wrote.  The callers sample the calls they record,
+    one in Every, and record each Every times.
+*/
+class HotFiles {
+ public:
+  static const int Every = 16;
+
+  struct Entry {
+    std::string key;
+    uint64_t weight;
+    uint64_t error;  // of weight
+    uint64_t ops;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t cryptoNs;  // spent coding blocks and MACs
+    uint64_t backingRead;  // bytes read from the backing file to serve them
+    uint64_t backingWritten;
+  };
+
+  explicit HotFiles(size_t maxEntries);
+  ~HotFiles();
+
+  HotFiles(const HotFiles &src) = delete;
+  HotFiles &operator=(const HotFiles &src) = delete;
+
+  // count calls calls on key, which moved the given bytes, and the given
+  // backing bytes below them
+  void record(const std::string &key, uint64_t calls, uint64_t bytesRead,
+              uint64_t bytesWritten, uint64_t cryptoNs,
+              uint64_t backingRead = 0, uint64_t backingWritten = 0);
+
+  // the entries, heaviest first
+  std::vector<Entry> top() const;
+
+  // The entries as Prometheus gauges, named prefix + "_ops" and so on, with
+  // the key as the value of label
+  std::string report(const char *prefix, const char *label) const;
+
+  size_t capacity() const { return _capacity; }
+
+ private:
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  std::vector<Entry> _entries;
+  std::unordered_map<std::string, size_t> _index;  // into _entries
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,293 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "IOScheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "Mutex.h"
+#include "Stats.h"
+
+namespace encfs {
+
+const size_t IOScheduler::MaxMerge;
+const size_t IOScheduler::MaxMergeCount;
+
+// of the requests of the thread
+static thread_local IOScheduler::Priority tPriority = IOScheduler::Sync;
+
+struct IOScheduler::Waiter {
+  bool write;
+  int fd;
+  dev_t dev;
+  char *buf;
+  size_t len;
+  off_t offset;
+  Priority priority;
+
+  enum State { Waiting, Lead, Done };
+  State state;
+  pthread_cond_t cond;
+
+  ssize_t result;
+  int err;
+  // the requests merged with this one, by offset, this one included
+  std::vector<Waiter *> run;
+};
+
+IOScheduler::BackgroundScope::BackgroundScope() : _saved(tPriority) {
+  tPriority = Background;
+}
+
+IOScheduler::BackgroundScope::~BackgroundScope() { tPriority = _saved; }
+
+IOScheduler::IOScheduler(int depth, int deviceDepth)
+    : _depth(std::max(depth, 1)),
+      _deviceDepth(deviceDepth > 0 ? deviceDepth : std::max(depth, 1)),
+      _running(0),
+      _merged(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+IOScheduler::~IOScheduler() { pthread_mutex_destroy(&_mutex); }
+
+ssize_t IOScheduler::read(int fd, dev_t dev, void *buf, size_t len,
+                          off_t offset) {
+  Waiter w;
+  w.write = false;
+  w.fd = fd;
+  w.dev = dev;
+  w.buf = (char *)buf;
+  w.len = len;
+  w.offset = offset;
+  return submit(&w);
+}
+
+ssize_t IOScheduler::write(int fd, dev_t dev, const void *buf, size_t len,
+                           off_t offset) {
+  Waiter w;
+  w.write = true;
+  w.fd = fd;
+  w.dev = dev;
+  w.buf = (char *)buf;
+  w.len = len;
+  w.offset = offset;
+  return submit(&w);
+}
+
+bool IOScheduler::fits(dev_t dev) const {
+  if (_running >= _depth) {
+    return false;
+  }
+  auto it = _deviceRunning.find(dev);
+  return it == _deviceRunning.end() || it->second < _deviceDepth;
+}
+
+ssize_t IOScheduler::submit(Waiter *w) {
+  w->priority = tPriority;
+  {
+    Lock lock(_mutex);
+    if (fits(w->dev)) {
+      ++_running;
+      ++_deviceRunning[w->dev];
+    } else {
+      Stats::add(Stats::LowerQueued);
+      pthread_cond_init(&w->cond, nullptr);
+      w->state = Waiter::Waiting;
+      _queue[w->priority].push_back(w);
+      while (w->state == Waiter::Waiting) {
+        pthread_cond_wait(&w->cond, &_mutex);
+      }
+      pthread_cond_destroy(&w->cond);
+      if (w->state == Waiter::Done) {
+        // done by the thread of the request it was merged into
+        errno = w->err;
+        return w->result;
+      }
+    }
+  }
+
+  perform(w);
+
+  {
+    Lock lock(_mutex);
+    --_running;
+    --_deviceRunning[w->dev];
+    for (Waiter *other : w->run) {
+      if (other != w) {
+        other->state = Waiter::Done;
+        pthread_cond_signal(&other->cond);
+      }
+    }
+    dispatch();
+  }
+  errno = w->err;
+  return w->result;
+}
+
+void IOScheduler::dispatch() {
+  while (_running < _depth) {
+    Waiter *next = nullptr;
+    for (int p = 0; p < PriorityCount && next == nullptr; ++p) {
+      std::deque<Waiter *> &queue = _queue[p];
+      for (auto it = queue.begin(); it != queue.end(); ++it) {
+        if (fits((*it)->dev)) {
+          next = *it;
+          queue.erase(it);
+          break;
+        }
+      }
+    }
+    if (next == nullptr) {
+      return;
+    }
+
+    ++_running;
+    ++_deviceRunning[next->dev];
+    gather(next);
+    next->state = Waiter::Lead;
+    pthread_cond_signal(&next->cond);
+  }
+}
+
+void IOScheduler::gather(Waiter *lead) {
+  std::vector<Waiter *> &run = lead->run;
+  off_t start = lead->offset;
+  off_t end = lead->offset + (off_t)lead->len;
+  size_t total = lead->len;
+
+  // each request taken may be continued by one passed over before
+  for (bool found = true; found;) {
+    found = false;
+    for (std::deque<Waiter *> &queue : _queue) {
+      for (auto it = queue.begin(); it != queue.end();) {
+        Waiter *w = *it;
+        bool after = w->offset == end;
+        bool before = w->offset + (off_t)w->len == start;
+        size_t count = run.empty() ? 1 : run.size();
+        if (w->fd != lead->fd || w->write != lead->write ||
+            !(after || before) || total + w->len > MaxMerge ||
+            count >= MaxMergeCount) {
+          ++it;
+          continue;
+        }
+        if (run.empty()) {
+          run.push_back(lead);
+        }
+        run.push_back(w);
+        if (after) {
+          end += (off_t)w->len;
+        } else {
+          start = w->offset;
+        }
+        total += w->len;
+        found = true;
+        it = queue.erase(it);
+      }
+    }
+  }
+
+  if (!run.empty()) {
+    std::sort(run.begin(), run.end(), [](const Waiter *a, const Waiter *b) {
+      return a->offset < b->offset;
+    });
+    _merged += run.size() - 1;
+    Stats::add(Stats::LowerMerged, run.size() - 1);
+  }
+}
+
+void IOScheduler::perform(Waiter *lead) {
+  if (lead->run.empty()) {
+    ssize_t res = lead->write
+                      ? ::pwrite(lead->fd, lead->buf, lead->len, lead->offset)
+                      : ::pread(lead->fd, lead->buf, lead->len, lead->offset);
+    lead->result = res;
+    lead->err = res < 0 ? errno : 0;
+    return;
+  }
+
+  // all of the run, as far as it goes: a short transfer is continued, so
+  // that the requests after it aren't taken for the end of the file
+  const std::vector<Waiter *> &run = lead->run;
+  off_t start = run.front()->offset;
+  size_t total = 0;
+  for (const Waiter *w : run) {
+    total += w->len;
+  }
+  iovec iov[MaxMergeCount];
+  size_t done = 0;
+  int err = 0;
+  while (done < total) {
+    int count = 0;
+    size_t pos = 0;
+    for (const Waiter *w : run) {
+      if (pos + w->len > done) {
+        size_t skip = done > pos ? done - pos : 0;
+        iov[count].iov_base = w->buf + skip;
+        iov[count].iov_len = w->len - skip;
+        ++count;
+      }
+      pos += w->len;
+    }
+    ssize_t res = lead->write
+                      ? ::pwritev(lead->fd, iov, count, start + (off_t)done)
+                      : ::preadv(lead->fd, iov, count, start + (off_t)done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res < 0) {
+      err = errno;
+      break;
+    }
+    if (res == 0) {
+      break;
+    }
+    done += res;
+  }
+
+  size_t pos = 0;
+  for (Waiter *w : run) {
+    size_t got = done > pos ? std::min(w->len, done - pos) : 0;
+    if (got == 0 && err != 0) {
+      w->result = -1;
+      w->err = err;
+    } else {
+      w->result = (ssize_t)got;
+      w->err = 0;
+    }
+    pos += w->len;
+  }
+}
+
+int IOScheduler::running() const {
+  Lock lock(_mutex);
+  return _running;
+}
+
+size_t IOScheduler::queued() const {
+  Lock lock(_mutex);
+  return _queue[Sync].size() + _queue[Background].size();
+}
+
+uint64_t IOScheduler::merged() const {
+  Lock lock(_mutex);
+  return _merged;
+}
+
+}  // namespace encfs
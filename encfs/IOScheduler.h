@@ -0,0 +1,110 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _IOScheduler_incl_
+#define _IOScheduler_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Schedules the reads and writes of backing files (--iodepth).
+
+    Without it each FUSE and worker thread calls pread and pwrite as it
+    goes, and a burst of requests reaches the lower file system all at
+    once: an NFS server sees thousands of small operations, and a reader
+    waits behind read ahead.  Here no more than depth requests of the mount
+    run at once, and no more than deviceDepth on any one backing device.
+
+    Requests beyond that queue up.  When one finishes, the next to run is
+    the oldest synchronous request whose device has room, or failing that
+    the oldest background one (read ahead, and write back of buffered
+    writes, see Background).  Queued requests for the same descriptor which
+    continue it, before or after, go along with it, up to MaxMerge bytes:
+    they become a single preadv or pwritev into the buffers of their
+    callers, which the thread of the first makes for all of them.  Nothing
+    waits to be merged, so requests only merge when the device is busy
+    anyway.
+
+    Calls return what pread and pwrite would, with errno set on failure.
+*/
+class IOScheduler {
+ public:
+  enum Priority { Sync, Background, PriorityCount };
+
+  // largest merged request, and most requests merged into one
+  static const size_t MaxMerge = 1 << 20;
+  static const size_t MaxMergeCount = 64;
+
+  IOScheduler(int depth, int deviceDepth);
+  ~IOScheduler();
+
+  IOScheduler(const IOScheduler &src) = delete;
+  IOScheduler &operator=(const IOScheduler &src) = delete;
+
+  // dev is the device of the file open as fd
+  ssize_t read(int fd, dev_t dev, void *buf, size_t len, off_t offset);
+  ssize_t write(int fd, dev_t dev, const void *buf, size_t len,
+                off_t offset);
+
+  // Requests of the calling thread are background ones for its lifetime
+  class BackgroundScope {
+   public:
+    BackgroundScope();
+    ~BackgroundScope();
+    BackgroundScope(const BackgroundScope &src) = delete;
+    BackgroundScope &operator=(const BackgroundScope &src) = delete;
+
+   private:
+    Priority _saved;
+  };
+
+  // requests running and waiting, and requests merged into others so far
+  int running() const;
+  size_t queued() const;
+  uint64_t merged() const;
+
+ private:
+  struct Waiter;
+
+  ssize_t submit(Waiter *w);
+  // Start queued requests while there is room, with _mutex held
+  void dispatch();
+  bool fits(dev_t dev) const;
+  // the queued requests which continue the run of lead
+  void gather(Waiter *lead);
+  static void perform(Waiter *lead);
+
+  const int _depth;
+  const int _deviceDepth;
+
+  mutable pthread_mutex_t _mutex;
+  int _running;
+  std::map<dev_t, int> _deviceRunning;
+  std::deque<Waiter *> _queue[PriorityCount];
+  uint64_t _merged;
+};
+
+}  // namespace encfs
+
+#endif
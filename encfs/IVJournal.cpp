@@ -0,0 +1,532 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IVJournal.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "Cipher.h"
+#include "Error.h"
+#include "Mutex.h"
+#include "WorkerPool.h"
+
+namespace encfs {
+
+const char IVJournal::FileName[] = ".encfs6.ivlog";
+
+/*
+    The log is a magic string followed by records, all numbers big endian:
+      'R' dev(8) inode(8) headerIV(8) iv(8) pathLen(2) path   record()
+      'D' dev(8) inode(8)                                     remove()
+      'M' fromLen(2) from toLen(2) to                         moved()
+    A record cut short by a crash is ignored.  Logs of the first version
+    have no dev in their records.
+*/
+static const char LogMagic[] = "EncFSIV2";
+static const char LogMagicV1[] = "EncFSIV1";
+static const size_t MagicSize = sizeof(LogMagic) - 1;
+
+static const int HeaderSize = 8;
+
+// rewrite the log once it is mostly obsolete records
+static const size_t LogSlack = 1024;
+
+static void putNumber(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static void putString(std::string &out, const std::string &value) {
+  putNumber(out, value.size(), 2);
+  out.append(value);
+}
+
+static bool getNumber(const std::string &in, size_t &pos, uint64_t *value,
+                      int bytes) {
+  if (in.size() - pos < (size_t)bytes) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i) {
+    v = (v << 8) | (unsigned char)in[pos++];
+  }
+  *value = v;
+  return true;
+}
+
+static bool getString(const std::string &in, size_t &pos, std::string *value) {
+  uint64_t len = 0;
+  if (!getNumber(in, pos, &len, 2) || in.size() - pos < len) {
+    return false;
+  }
+  value->assign(in, pos, len);
+  pos += len;
+  return true;
+}
+
+static bool writeAll(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t res = ::write(fd, data, len);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += res;
+    len -= res;
+  }
+  return true;
+}
+
+// path is from or below it
+static bool isBelow(const std::string &path, const std::string &from) {
+  return path.compare(0, from.length(), from) == 0 &&
+         (path.length() == from.length() || path[from.length()] == '/');
+}
+
+IVJournal::IVJournal(const std::string &rootDir,
+                     const std::shared_ptr<Cipher> &cipher,
+                     const CipherKey &key, bool defer)
+    : _rootDir(rootDir),
+      _logPath(rootDir + FileName),
+      _cipher(cipher),
+      _key(key),
+      _defer(defer),
+      _fd(-1),
+      _dirty(false),
+      _logRecords(0),
+      _pending(0),
+      _queued(false) {
+  pthread_mutex_init(&_mutex, nullptr);
+  Lock lock(_mutex);
+  replay();
+}
+
+IVJournal::~IVJournal() {
+  if (_fd < 0) {
+    // not ours, or unreadable: leave it alone
+  } else if (compact() == 0) {
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+    ::unlink(_logPath.c_str());
+  } else {
+    RLOG(WARNING) << _pending << " file headers left in " << _logPath;
+    sync();
+    ::close(_fd);
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+void IVJournal::replay() {
+  _fd = ::open(_logPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_NOFOLLOW,
+               S_IRUSR | S_IWUSR);
+  int fd = _fd;
+  if (fd < 0) {
+    // read-only, the pending IVs are still needed to read the headers
+    fd = ::open(_logPath.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+      int eno = errno;
+      if (eno != ENOENT) {
+        RLOG(ERROR) << "unable to open " << _logPath << ": " << strerror(eno);
+      }
+      return;
+    }
+  }
+
+  std::string log;
+  char buf[4096];
+  ssize_t res;
+  while ((res = ::pread(fd, buf, sizeof(buf), log.size())) > 0) {
+    log.append(buf, res);
+  }
+  if (fd != _fd) {
+    ::close(fd);
+  }
+
+  if (log.size() < MagicSize) {
+    // new (or never written) log
+    if (_fd >= 0 && ::ftruncate(_fd, 0) == 0 &&
+        writeAll(_fd, LogMagic, MagicSize)) {
+      _dirty = true;
+    }
+    return;
+  }
+  bool v1 = log.compare(0, MagicSize, LogMagicV1) == 0;
+  if (!v1 && log.compare(0, MagicSize, LogMagic) != 0) {
+    RLOG(ERROR) << "unrecognized IV journal " << _logPath << ", ignored";
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+    return;
+  }
+
+  size_t pos = MagicSize;
+  size_t good = pos;
+  while (pos < log.size()) {
+    char type = log[pos++];
+    FileId id = {UnknownDevice, 0};
+    bool ok = false;
+    if (type == 'R') {
+      Entry entry;
+      ok = (v1 || getNumber(log, pos, &id.dev, 8)) &&
+           getNumber(log, pos, &id.ino, 8) &&
+           getNumber(log, pos, &entry.headerIV, 8) &&
+           getNumber(log, pos, &entry.iv, 8) &&
+           getString(log, pos, &entry.path);
+      if (ok) {
+        set(id, entry);
+      }
+    } else if (type == 'D') {
+      ok = (v1 || getNumber(log, pos, &id.dev, 8)) &&
+           getNumber(log, pos, &id.ino, 8);
+      if (ok) {
+        drop(id);
+      }
+    } else if (type == 'M') {
+      std::string from, to;
+      ok = getString(log, pos, &from) && getString(log, pos, &to);
+      if (ok) {
+        move(from, to);
+      }
+    }
+    if (!ok) {
+      break;
+    }
+    good = pos;
+    ++_logRecords;
+  }
+
+  if (good < log.size() && _fd >= 0) {
+    RLOG(WARNING) << "ignoring " << log.size() - good
+                  << " trailing bytes in " << _logPath;
+    if (::ftruncate(_fd, good) != 0) {
+      RLOG(WARNING) << "unable to truncate " << _logPath;
+    }
+  }
+  if ((resolve() || v1) && _fd >= 0) {
+    rewriteLog();
+  }
+  VLOG(1) << "IV journal has " << _entries.size() << " pending headers";
+}
+
+/*
+    Check the replayed entries against the files at their paths, which is
+    where the headers are.  An entry stays with the file at its path if
+    that is the same file, or if the backing directory is on another device
+    now (copied or restored, with new inode numbers).  Entries for files
+    which are gone, or were replaced, are dropped: their numbers may belong
+    to an unrelated file by now.  Returns true if anything changed.
+*/
+bool IVJournal::resolve() {
+  std::unordered_map<FileId, Entry, FileIdHash> entries;
+  std::map<std::string, FileId> paths;
+  bool changed = false;
+  for (auto &it : _entries) {
+    const FileId &id = it.first;
+    std::string path = _rootDir + it.second.path;
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      VLOG(1) << "IV journal: " << path << " is gone";
+      changed = true;
+      continue;
+    }
+    FileId found = idOf(st);
+    bool sameFile = id.dev == UnknownDevice ? found.ino == id.ino
+                                            : found == id;
+    if (!sameFile && (id.dev == UnknownDevice || id.dev == found.dev)) {
+      VLOG(1) << "IV journal: " << path << " is another file now";
+      changed = true;
+      continue;
+    }
+    changed = changed || !(found == id);
+    entries[found] = it.second;
+    paths[it.second.path] = found;
+  }
+  _entries.swap(entries);
+  _paths.swap(paths);
+  _pending = _entries.size();
+  return changed;
+}
+
+IVJournal::FileId IVJournal::idOf(const struct stat &st) {
+  FileId id = {(uint64_t)st.st_dev, (uint64_t)st.st_ino};
+  return id;
+}
+
+std::string IVJournal::relative(const std::string &cipherPath) const {
+  if (cipherPath.compare(0, _rootDir.length(), _rootDir) == 0) {
+    return cipherPath.substr(_rootDir.length());
+  }
+  return cipherPath;
+}
+
+void IVJournal::append(const std::string &record) {
+  if (_fd < 0) {
+    return;
+  }
+  if (!writeAll(_fd, record.data(), record.size())) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to write " << _logPath << ": " << strerror(eno);
+    return;
+  }
+  _dirty = true;
+  ++_logRecords;
+}
+
+void IVJournal::set(const FileId &id, const Entry &entry) {
+  auto it = _entries.find(id);
+  if (it != _entries.end()) {
+    _paths.erase(it->second.path);
+    it->second = entry;
+  } else {
+    _entries.emplace(id, entry);
+  }
+  _paths[entry.path] = id;
+  _pending = _entries.size();
+}
+
+void IVJournal::drop(const FileId &id) {
+  auto it = _entries.find(id);
+  if (it == _entries.end()) {
+    return;
+  }
+  auto pit = _paths.find(it->second.path);
+  if (pit != _paths.end() && pit->second == id) {
+    _paths.erase(pit);
+  }
+  _entries.erase(it);
+  _pending = _entries.size();
+}
+
+void IVJournal::move(const std::string &from, const std::string &to) {
+  std::vector<std::pair<std::string, FileId>> moved;
+  for (auto it = _paths.lower_bound(from);
+       it != _paths.end() && it->first.compare(0, from.length(), from) == 0;) {
+    if (isBelow(it->first, from)) {
+      moved.emplace_back(to + it->first.substr(from.length()), it->second);
+      it = _paths.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto &m : moved) {
+    _entries[m.second].path = m.first;
+    _paths[m.first] = m.second;
+  }
+}
+
+bool IVJournal::find(const struct stat &st, uint64_t *headerIV) const {
+  auto it = _entries.find(idOf(st));
+  if (it == _entries.end()) {
+    return false;
+  }
+  *headerIV = it->second.headerIV;
+  return true;
+}
+
+bool IVJournal::record(const struct stat &st, uint64_t headerIV, uint64_t iv,
+                       const std::string &cipherPath) {
+  if (_fd < 0) {
+    return false;
+  }
+  if (headerIV == iv) {
+    // back where it started, e.g. a rename being undone
+    remove(st);
+    return true;
+  }
+  FileId id = idOf(st);
+  Entry entry;
+  entry.headerIV = headerIV;
+  entry.iv = iv;
+  entry.path = relative(cipherPath);
+
+  std::string rec(1, 'R');
+  putNumber(rec, id.dev, 8);
+  putNumber(rec, id.ino, 8);
+  putNumber(rec, headerIV, 8);
+  putNumber(rec, iv, 8);
+  putString(rec, entry.path);
+  append(rec);
+
+  set(id, entry);
+  return true;
+}
+
+void IVJournal::remove(const struct stat &st) {
+  removeId(idOf(st));
+}
+
+void IVJournal::removeId(const FileId &id) {
+  if (_entries.count(id) == 0) {
+    return;
+  }
+  std::string rec(1, 'D');
+  putNumber(rec, id.dev, 8);
+  putNumber(rec, id.ino, 8);
+  append(rec);
+  drop(id);
+}
+
+void IVJournal::moved(const std::string &from, const std::string &to) {
+  if (empty()) {
+    return;
+  }
+  Lock lock(_mutex);
+  std::string rfrom = relative(from);
+  auto it = _paths.lower_bound(rfrom);
+  if (it == _paths.end() ||
+      it->first.compare(0, rfrom.length(), rfrom) != 0) {
+    return;  // nothing pending in there
+  }
+  std::string rto = relative(to);
+  std::string rec(1, 'M');
+  putString(rec, rfrom);
+  putString(rec, rto);
+  append(rec);
+  move(rfrom, rto);
+}
+
+bool IVJournal::sync() {
+  Lock lock(_mutex);
+  if (_fd < 0 || !_dirty) {
+    return _fd >= 0;
+  }
+  if (::fdatasync(_fd) != 0) {
+    return false;
+  }
+  _dirty = false;
+  return true;
+}
+
+bool IVJournal::rewriteHeader(const FileId &id, const Entry &entry) {
+  std::string path = _rootDir + entry.path;
+  int fd = ::open(path.c_str(), O_RDWR | O_NOFOLLOW);
+  if (fd < 0) {
+    VLOG(1) << "unable to open " << path << " to rewrite its header";
+    return false;
+  }
+
+  bool ok = false;
+  struct stat st;
+  unsigned char buf[HeaderSize];
+  if (::fstat(fd, &st) == 0 && idOf(st) == id && S_ISREG(st.st_mode)) {
+    if (st.st_size < HeaderSize) {
+      ok = true;  // truncated since, the next open makes a new header
+    } else if (::pread(fd, buf, sizeof(buf), 0) == HeaderSize &&
+               _cipher->streamDecode(buf, sizeof(buf), entry.headerIV,
+                                     _key) &&
+               _cipher->streamEncode(buf, sizeof(buf), entry.iv, _key) &&
+               ::pwrite(fd, buf, sizeof(buf), 0) == HeaderSize) {
+      ok = true;
+    }
+  } else {
+    VLOG(1) << path << " is no longer inode " << id.ino;
+  }
+  ::close(fd);
+  return ok;
+}
+
+void IVJournal::rewriteLog() {
+  std::string log(LogMagic, MagicSize);
+  for (auto &it : _entries) {
+    log.push_back('R');
+    putNumber(log, it.first.dev, 8);
+    putNumber(log, it.first.ino, 8);
+    putNumber(log, it.second.headerIV, 8);
+    putNumber(log, it.second.iv, 8);
+    putString(log, it.second.path);
+  }
+
+  std::string tmpPath = _logPath + ".tmp";
+  int fd = ::open(tmpPath.c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_NOFOLLOW,
+                  S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return;
+  }
+  if (!writeAll(fd, log.data(), log.size()) || ::fdatasync(fd) != 0 ||
+      ::rename(tmpPath.c_str(), _logPath.c_str()) != 0) {
+    RLOG(WARNING) << "unable to rewrite " << _logPath;
+    ::close(fd);
+    ::unlink(tmpPath.c_str());
+    return;
+  }
+  ::close(_fd);
+  _fd = fd;
+  _dirty = false;
+  _logRecords = _entries.size();
+}
+
+size_t IVJournal::compact() {
+  _queued = false;
+  if (empty()) {
+    return 0;
+  }
+
+  std::vector<FileId> ids;
+  {
+    Lock lock(_mutex);
+    ids.reserve(_entries.size());
+    for (auto &it : _entries) {
+      ids.push_back(it.first);
+    }
+  }
+
+  // one entry at a time, so that opens and renames don't wait for all
+  size_t rewritten = 0;
+  for (const FileId &id : ids) {
+    Lock lock(_mutex);
+    auto it = _entries.find(id);
+    if (it != _entries.end() && rewriteHeader(id, it->second)) {
+      removeId(id);
+      ++rewritten;
+    }
+  }
+
+  Lock lock(_mutex);
+  if (_logRecords > 2 * _entries.size() + LogSlack) {
+    rewriteLog();
+  }
+  VLOG(1) << "IV journal: rewrote " << rewritten << " headers, "
+          << _entries.size() << " pending";
+  return _entries.size();
+}
+
+void IVJournal::compactLater(const std::shared_ptr<IVJournal> &journal,
+                             WorkerPool *workers) {
+  if (!journal || journal->empty() || workers == nullptr ||
+      journal->_queued.exchange(true)) {
+    return;
+  }
+  std::shared_ptr<IVJournal> self = journal;
+  if (!workers->trySubmit([self]() { self->compact(); })) {
+    journal->_queued = false;
+  }
+}
+
+}  // namespace encfs
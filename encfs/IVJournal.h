@@ -0,0 +1,167 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IVJournal_incl_
+#define _IVJournal_incl_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+#include "CipherKey.h"
+
+namespace encfs {
+
+class Cipher;
+class WorkerPool;
+
+/*
+    Journal of file headers which are still encrypted with an old external
+    IV, for externalIVChaining file systems.
+
+    The external IV of a file follows from its path, so every rename has to
+    re-encrypt the headers of all the files it moves.  In deferred mode
+    (--ivjournal) CipherFileIO::setIV records the change here instead: the
+    IV the header on disk is encrypted with, and the IV it should have.
+    Headers are brought up to date when the file is next opened writable,
+    by compact() on a worker thread after renames, and when the journal is
+    destroyed.
+
+    Entries are keyed by device and inode, which renames keep, and also
+    remember the cipher path so that compact() can find the file.  DirNode
+    reports the renames of the backing files (moved()) to keep those paths
+    current.  The journal is a log in the root of the backing directory,
+    replayed when the file system is opened, and must be sync()ed before the
+    renames it describes are done.
+
+    Inode numbers don't survive a copy of the backing directory, and are
+    reused once a file is gone, so replay() looks up every entry by its
+    path: it is kept if the same file is still there, moves to the file's
+    new numbers if the backing directory is on another device now, and is
+    dropped otherwise.
+*/
+class IVJournal {
+ public:
+  // name of the log, next to the config file
+  static const char FileName[];
+
+  // Opens (and replays) the log in rootDir, which ends with a '/'.  With
+  // defer, headers are not rewritten on rename.
+  IVJournal(const std::string &rootDir, const std::shared_ptr<Cipher> &cipher,
+            const CipherKey &key, bool defer);
+  // compacts, and removes the log once no headers are pending
+  ~IVJournal();
+
+  IVJournal(const IVJournal &src) = delete;
+  IVJournal &operator=(const IVJournal &src) = delete;
+
+  bool deferring() const { return _defer; }
+  // lock free, so that files can be opened without looking further
+  bool empty() const { return _pending == 0; }
+  size_t size() const { return _pending; }
+
+  // Held by whoever reads or writes a header while consulting the journal,
+  // so that compact() doesn't rewrite it meanwhile.
+  pthread_mutex_t &mutex() { return _mutex; }
+
+  // The following must hold mutex().
+
+  // Files are identified by st_dev and st_ino of their stat.
+
+  // IV the header of the file is encrypted with, if it is pending
+  bool find(const struct stat &st, uint64_t *headerIV) const;
+  // The header of the file, at cipherPath, is encrypted with headerIV and
+  // should be encrypted with iv.  Forgets the file if they are the same.
+  bool record(const struct stat &st, uint64_t headerIV, uint64_t iv,
+              const std::string &cipherPath);
+  // the header was rewritten, or the file is gone
+  void remove(const struct stat &st);
+
+  // The backing file or directory at from was renamed to to
+  void moved(const std::string &from, const std::string &to);
+
+  // write the log to disk
+  bool sync();
+
+  // Rewrite the pending headers.  Returns the number still pending, files
+  // which couldn't be found or opened for writing stay in the journal.
+  size_t compact();
+  // compact() on one of workers, unless one is queued already
+  static void compactLater(const std::shared_ptr<IVJournal> &journal,
+                           WorkerPool *workers);
+
+ private:
+  struct FileId {
+    uint64_t dev;
+    uint64_t ino;
+
+    bool operator==(const FileId &other) const {
+      return dev == other.dev && ino == other.ino;
+    }
+  };
+  struct FileIdHash {
+    size_t operator()(const FileId &id) const {
+      return std::hash<uint64_t>()(id.ino ^ (id.dev << 32 | id.dev >> 32));
+    }
+  };
+  // the device of records from logs which didn't store it
+  static const uint64_t UnknownDevice = ~(uint64_t)0;
+
+  struct Entry {
+    uint64_t headerIV;
+    uint64_t iv;
+    std::string path;  // relative to _rootDir
+  };
+
+  static FileId idOf(const struct stat &st);
+  std::string relative(const std::string &cipherPath) const;
+  void replay();
+  bool resolve();
+  void append(const std::string &record);
+  void set(const FileId &id, const Entry &entry);
+  void drop(const FileId &id);
+  void removeId(const FileId &id);
+  void move(const std::string &from, const std::string &to);
+  bool rewriteHeader(const FileId &id, const Entry &entry);
+  void rewriteLog();
+
+  const std::string _rootDir;
+  const std::string _logPath;
+  std::shared_ptr<Cipher> _cipher;
+  CipherKey _key;
+  const bool _defer;
+
+  mutable pthread_mutex_t _mutex;
+  int _fd;       // log, -1 if it couldn't be opened
+  bool _dirty;   // appended to since the last sync
+  size_t _logRecords;
+  std::unordered_map<FileId, Entry, FileIdHash> _entries;
+  std::map<std::string, FileId> _paths;
+  std::atomic<size_t> _pending;
+  std::atomic<bool> _queued;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IdleMonitor.h"
+
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <utility>
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+IdleMonitor::IdleMonitor() : _pid(0), _stop(false), _busy(nullptr) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_wake, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&_checked, nullptr);
+}
+
+IdleMonitor::~IdleMonitor() {
+  {
+    Lock lock(_mutex);
+    _stop = true;
+    pthread_cond_broadcast(&_wake);
+  }
+  if (_pid == getpid()) {
+    pthread_join(_thread, nullptr);
+  }
+
+  pthread_cond_destroy(&_checked);
+  pthread_cond_destroy(&_wake);
+  pthread_mutex_destroy(&_mutex);
+}
+
+int64_t IdleMonitor::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// called with _mutex held
+void IdleMonitor::start() {
+  // the thread of a parent process doesn't exist in a forked child
+  _pid = getpid();
+  int res = pthread_create(&_thread, nullptr, IdleMonitor::run, this);
+  if (res != 0) {
+    RLOG(ERROR) << "error starting idle monitor thread, res = " << res;
+    _pid = 0;
+  }
+}
+
+void IdleMonitor::add(const void *owner, Check check) {
+  Lock lock(_mutex);
+  Entry &entry = _entries[owner];
+  entry.check = std::move(check);
+  entry.due = now();
+  if (_pid != getpid()) {
+    start();
+  }
+  pthread_cond_signal(&_wake);
+}
+
+bool IdleMonitor::remove(const void *owner) {
+  Lock lock(_mutex);
+  while (_busy == owner) {
+    pthread_cond_wait(&_checked, &_mutex);
+  }
+  return _entries.erase(owner) != 0;
+}
+
+size_t IdleMonitor::size() const {
+  Lock lock(_mutex);
+  return _entries.size();
+}
+
+void *IdleMonitor::run(void *arg) {
+  static_cast<IdleMonitor *>(arg)->loop();
+  return nullptr;
+}
+
+void IdleMonitor::loop() {
+  Lock lock(_mutex);
+  while (!_stop) {
+    const void *owner = nullptr;
+    int64_t due = 0;
+    for (const auto &it : _entries) {
+      if (owner == nullptr || it.second.due < due) {
+        owner = it.first;
+        due = it.second.due;
+      }
+    }
+
+    if (owner == nullptr) {
+      pthread_cond_wait(&_wake, &_mutex);
+      continue;
+    }
+    if (due > now()) {
+      // woken early by add() or the destructor, the deadlines are looked at
+      // again in any case
+      struct timespec wakeup;
+      wakeup.tv_sec = due / 1000;
+      wakeup.tv_nsec = (due % 1000) * 1000000;
+      pthread_cond_timedwait(&_wake, &_mutex, &wakeup);
+      continue;
+    }
+
+    Check check = _entries[owner].check;
+    _busy = owner;
+    pthread_mutex_unlock(&_mutex);
+    int64_t next = check();
+    pthread_mutex_lock(&_mutex);
+    _busy = nullptr;
+    pthread_cond_broadcast(&_checked);
+
+    auto it = _entries.find(owner);
+    if (it != _entries.end()) {
+      if (next < 0) {
+        _entries.erase(it);
+      } else {
+        it->second.due = next;
+      }
+    }
+  }
+}
+
+}  // namespace encfs
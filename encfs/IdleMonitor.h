@@ -0,0 +1,90 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IdleMonitor_incl_
+#define _IdleMonitor_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <pthread.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace encfs {
+
+/*
+    One thread which unmounts idle mounts (--idle), however many mounts the
+    process serves (see encfs --serve).
+
+    Nothing is polled: every check returns the time at which it wants to run
+    again, usually when its mount will have been idle long enough if nothing
+    happens until then, and the thread sleeps until the earliest of these
+    deadlines.  A check returns a negative time once its mount is gone, and
+    is then dropped.  Checks run on the monitor thread, one after another.
+    Times are in milliseconds of now().
+
+    The thread is only started by the first add(), and again if the process
+    was forked since.
+*/
+class IdleMonitor {
+ public:
+  // the check returns the time of its next run, or < 0 when done
+  using Check = std::function<int64_t()>;
+
+  IdleMonitor();
+  ~IdleMonitor();
+
+  IdleMonitor(const IdleMonitor &src) = delete;
+  IdleMonitor &operator=(const IdleMonitor &src) = delete;
+
+  // monotonic clock, in milliseconds
+  static int64_t now();
+
+  // the check first runs at once
+  void add(const void *owner, Check check);
+
+  // Stop checking for owner, waiting for a check which is running.  Returns
+  // false if the check was already done.  Must not be called from a check.
+  bool remove(const void *owner);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    Check check;
+    int64_t due;
+  };
+
+  static void *run(void *arg);
+  void loop();
+  void start();
+
+  pid_t _pid;  // process which started _thread
+  pthread_t _thread;
+
+  mutable pthread_mutex_t _mutex;
+  pthread_cond_t _wake;  // waits on the monotonic clock
+  pthread_cond_t _checked;
+  bool _stop;
+  const void *_busy;  // owner of the running check
+  std::unordered_map<const void *, Entry> _entries;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,117 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "InFlight.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "Mutex.h"
+#include "Stats.h"
+
+namespace encfs {
+
+// FNV-1a of kind and path
+static size_t hashOf(InFlight::Kind kind, const char *path) {
+  uint64_t hash = 14695981039346656037ULL ^ (uint64_t)kind;
+  for (const char *p = path; *p != '\0'; ++p) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+  return (size_t)hash;
+}
+
+InFlight::InFlight() : _generation(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_cond_init(&_landed, nullptr);
+  pthread_cond_init(&_taken, nullptr);
+  _flights.reserve(64);
+}
+
+InFlight::~InFlight() {
+  pthread_cond_destroy(&_taken);
+  pthread_cond_destroy(&_landed);
+  pthread_mutex_destroy(&_mutex);
+}
+
+int InFlight::run(Kind kind, const char *path, Result *out,
+                  const std::function<void(Result *)> &fn) {
+  Flight flight;
+  flight.kind = kind;
+  flight.path = path;
+  flight.hash = hashOf(kind, path);
+  flight.waiters = 0;
+  flight.landed = false;
+  {
+    Lock lock(_mutex);
+    for (Flight *running : _flights) {
+      if (running->hash != flight.hash || running->kind != kind ||
+          running->generation != _generation ||
+          strcmp(running->path, path) != 0) {
+        continue;
+      }
+      ++running->waiters;
+      Stats::add(Stats::CollapsedCalls);
+      while (!running->landed) {
+        pthread_cond_wait(&_landed, &_mutex);
+      }
+      *out = running->result;
+      if (--running->waiters == 0) {
+        pthread_cond_broadcast(&_taken);
+      }
+      return out->res;
+    }
+    // one from before a change is left to finish on its own
+    flight.generation = _generation;
+    _flights.push_back(&flight);
+  }
+
+  try {
+    fn(out);
+  } catch (...) {
+    Result failed;
+    failed.res = -EIO;
+    land(&flight, failed);
+    throw;
+  }
+  land(&flight, *out);
+  return out->res;
+}
+
+void InFlight::land(Flight *flight, const Result &result) {
+  Lock lock(_mutex);
+  auto it = std::find(_flights.begin(), _flights.end(), flight);
+  *it = _flights.back();
+  _flights.pop_back();
+  if (flight->waiters == 0) {
+    return;
+  }
+  flight->result = result;
+  flight->landed = true;
+  pthread_cond_broadcast(&_landed);
+  // the flight is on our stack
+  while (flight->waiters > 0) {
+    pthread_cond_wait(&_taken, &_mutex);
+  }
+}
+
+void InFlight::changed() {
+  Lock lock(_mutex);
+  ++_generation;
+}
+
+}  // namespace encfs
@@ -0,0 +1,98 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _InFlight_incl_
+#define _InFlight_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "DirCache.h"
+
+namespace encfs {
+
+/*
+    Collapses concurrent metadata calls of the same kind on the same
+    plaintext path, as made when a build has hundreds of threads stat the
+    same headers: the first call does the work, and calls arriving while it
+    runs wait for it and take its result instead of encoding the path and
+    asking the backing filesystem again.
+
+    A call is only joined by those arriving before the next changed(),
+    which DirNode calls when something is changed through the mount, so a
+    call never answers with what was there before a change which had
+    already returned.  A call nobody joins allocates nothing: the running
+    calls are kept on their callers' stacks.
+*/
+class InFlight {
+ public:
+  enum Kind { Attr, Link, Listing };
+
+  // what a call answers, by kind
+  struct Result {
+    Result() : res(0) {}
+
+    int res;  // 0 or -errno
+    struct stat st;
+    std::string target;
+    std::shared_ptr<const DirListing> listing;
+  };
+
+  InFlight();
+  ~InFlight();
+
+  InFlight(const InFlight &src) = delete;
+  InFlight &operator=(const InFlight &src) = delete;
+
+  // Sets *out by fn, or to the result of the call of fn for the same kind
+  // and path already running.  Returns out->res.  If fn throws, callers
+  // waiting for it get -EIO.
+  int run(Kind kind, const char *path, Result *out,
+          const std::function<void(Result *)> &fn);
+
+  // calls running now aren't joined any more
+  void changed();
+
+ private:
+  struct Flight {
+    Kind kind;
+    const char *path;
+    size_t hash;
+    uint64_t generation;
+    int waiters;  // still to take the result
+    bool landed;
+    Result result;
+  };
+
+  void land(Flight *flight, const Result &result);
+
+  pthread_mutex_t _mutex;
+  pthread_cond_t _landed;  // a call finished
+  pthread_cond_t _taken;   // a waiter took the result of one
+  uint64_t _generation;
+  std::vector<Flight *> _flights;
+};
+
+}  // namespace encfs
+
+#endif
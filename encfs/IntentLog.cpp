@@ -0,0 +1,449 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IntentLog.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Cipher.h"
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+const int IntentLog::FlushInterval;
+const size_t IntentLog::MaxBytes;
+
+/*
+    A log is a magic string and the nonce of the log, followed by records,
+    all numbers big endian:
+      bodyLen(4) seq(8) mac(8) body
+    The body is encrypted with the IV nonce + seq, and the MAC is that of
+    the plain body chained with seq:
+      pathLen(2) path offset(8) data
+*/
+static const char LogMagic[] = "EncFSIL1";
+static const size_t MagicSize = sizeof(LogMagic) - 1;
+static const size_t LogHeaderSize = MagicSize + 8;
+static const size_t RecordHeaderSize = 4 + 8 + 8;
+
+static void putNumber(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static uint64_t getNumber(const unsigned char *in, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i) {
+    v = (v << 8) | in[i];
+  }
+  return v;
+}
+
+static bool writeAll(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t res = ::write(fd, data, len);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += res;
+    len -= res;
+  }
+  return true;
+}
+
+IntentLog::IntentLog(const std::string &path,
+                     const std::shared_ptr<Cipher> &cipher,
+                     const CipherKey &key, size_t maxBytes)
+    : _path(path),
+      _oldPath(path + ".old"),
+      _cipher(cipher),
+      _key(key),
+      _maxBytes(maxBytes),
+      _fd(-1),
+      _nonce(0),
+      _seq(0),
+      _synced(0),
+      _pending(0),
+      _bytes(0),
+      _oldLog(false),
+      _running(false),
+      _stop(false) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_mutex_init(&_syncMutex, nullptr);
+  pthread_mutex_init(&_checkpointMutex, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_wake, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+IntentLog::~IntentLog() {
+  stop();
+  if (_fd >= 0) {
+    ::close(_fd);
+    if (_pending == 0 && !_oldLog) {
+      ::unlink(_path.c_str());
+    } else {
+      RLOG(WARNING) << "writes left in " << _path << ", replayed on mount";
+    }
+  }
+  pthread_cond_destroy(&_wake);
+  pthread_mutex_destroy(&_checkpointMutex);
+  pthread_mutex_destroy(&_syncMutex);
+  pthread_mutex_destroy(&_mutex);
+}
+
+// a new, empty log at _path, with a nonce of its own
+int IntentLog::openLog() {
+  unsigned char nonce[8];
+  if (!_cipher->randomize(nonce, sizeof(nonce), false)) {
+    RLOG(ERROR) << "unable to make a nonce for " << _path;
+    return -1;
+  }
+  int fd = ::open(_path.c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_NOFOLLOW,
+                  S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to open " << _path << ": " << strerror(eno);
+    return -1;
+  }
+  std::string header(LogMagic, MagicSize);
+  header.append((const char *)nonce, sizeof(nonce));
+  if (!writeAll(fd, header.data(), header.size()) || ::fdatasync(fd) != 0) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to write " << _path << ": " << strerror(eno);
+    ::close(fd);
+    return -1;
+  }
+  _nonce = getNumber(nonce, 8);
+  syncDir();
+  return fd;
+}
+
+void IntentLog::syncDir() {
+  size_t slash = _path.rfind('/');
+  std::string dir = slash == std::string::npos ? std::string(".")
+                    : slash == 0               ? std::string("/")
+                                               : _path.substr(0, slash);
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+int IntentLog::replay(const Apply &apply) {
+  int records = 0;
+  if (!readLog(_oldPath, apply, &records) ||
+      !readLog(_path, apply, &records)) {
+    return -1;
+  }
+  if (records > 0) {
+    RLOG(INFO) << "replayed " << records << " writes from " << _path;
+  }
+  return records;
+}
+
+bool IntentLog::readLog(const std::string &path, const Apply &apply,
+                        int *records) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+  if (fd < 0) {
+    int eno = errno;
+    if (eno != ENOENT) {
+      RLOG(ERROR) << "unable to open " << path << ": " << strerror(eno);
+      return false;
+    }
+    return true;
+  }
+  std::string log;
+  char buf[65536];
+  ssize_t res;
+  while ((res = ::pread(fd, buf, sizeof(buf), log.size())) > 0) {
+    log.append(buf, res);
+  }
+  ::close(fd);
+
+  if (log.size() < LogHeaderSize) {
+    return true;  // never written to
+  }
+  if (log.compare(0, MagicSize, LogMagic) != 0) {
+    RLOG(ERROR) << "unrecognized intent log " << path;
+    return false;
+  }
+  const unsigned char *data = (const unsigned char *)log.data();
+  uint64_t nonce = getNumber(data + MagicSize, 8);
+
+  size_t pos = LogHeaderSize;
+  std::string body;
+  while (log.size() - pos >= RecordHeaderSize) {
+    const unsigned char *rec = data + pos;
+    size_t len = getNumber(rec, 4);
+    uint64_t seq = getNumber(rec + 4, 8);
+    uint64_t mac = getNumber(rec + 12, 8);
+    if (len < 2 + 8 || log.size() - pos - RecordHeaderSize < len) {
+      break;
+    }
+    body.assign(log, pos + RecordHeaderSize, len);
+    unsigned char *plain = (unsigned char *)&body[0];
+    uint64_t chain = seq;
+    if (!_cipher->streamDecode(plain, (int)len, nonce + seq, _key) ||
+        _cipher->MAC_64(plain, (int)len, _key, &chain) != mac) {
+      break;
+    }
+    size_t pathLen = getNumber(plain, 2);
+    if (2 + pathLen + 8 > len) {
+      break;
+    }
+    std::string file(body, 2, pathLen);
+    off_t offset = (off_t)getNumber(plain + 2 + pathLen, 8);
+    size_t head = 2 + pathLen + 8;
+    if (!apply(file, offset, plain + head, len - head)) {
+      RLOG(ERROR) << "unable to replay a write to " << file << " from "
+                  << path;
+      return false;
+    }
+    ++*records;
+    pos += RecordHeaderSize + len;
+  }
+  if (pos < log.size()) {
+    RLOG(WARNING) << "ignoring " << log.size() - pos << " trailing bytes in "
+                  << path;
+  }
+  return true;
+}
+
+bool IntentLog::clear() {
+  Lock checkpointLock(_checkpointMutex);
+  Lock syncLock(_syncMutex);
+  Lock lock(_mutex);
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  ::unlink(_oldPath.c_str());
+  _oldLog = false;
+  _fd = openLog();
+  _synced = _seq;
+  _pending = 0;
+  _bytes = 0;
+  return _fd >= 0;
+}
+
+uint64_t IntentLog::append(const std::string &path, off_t offset,
+                           const unsigned char *data, size_t size) {
+  std::string body;
+  body.reserve(2 + path.size() + 8 + size);
+  putNumber(body, path.size(), 2);
+  body.append(path);
+  putNumber(body, (uint64_t)offset, 8);
+  body.append((const char *)data, size);
+  unsigned char *plain = (unsigned char *)&body[0];
+
+  Lock lock(_mutex);
+  if (_fd < 0) {
+    return 0;
+  }
+  uint64_t seq = _seq + 1;
+  uint64_t chain = seq;
+  uint64_t mac = _cipher->MAC_64(plain, (int)body.size(), _key, &chain);
+  if (!_cipher->streamEncode(plain, (int)body.size(), _nonce + seq, _key)) {
+    return 0;
+  }
+  std::string rec;
+  rec.reserve(RecordHeaderSize + body.size());
+  putNumber(rec, body.size(), 4);
+  putNumber(rec, seq, 8);
+  putNumber(rec, mac, 8);
+  rec.append(body);
+  if (!writeAll(_fd, rec.data(), rec.size())) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to write " << _path << ": " << strerror(eno);
+    return 0;
+  }
+  _seq = seq;
+  ++_pending;
+  _bytes += rec.size();
+  if (_bytes >= _maxBytes && _running) {
+    pthread_cond_signal(&_wake);
+  }
+  return seq;
+}
+
+int IntentLog::commit(uint64_t seq) {
+  Lock syncLock(_syncMutex);
+  if (_synced >= seq) {
+    return 0;  // by the fdatasync of another writer
+  }
+  int fd;
+  uint64_t last;
+  {
+    Lock lock(_mutex);
+    fd = _fd;
+    last = _seq;
+  }
+  if (fd < 0) {
+    return -EIO;
+  }
+  if (::fdatasync(fd) != 0) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to sync " << _path << ": " << strerror(eno);
+    return -eno;
+  }
+  _synced = last;
+  return 0;
+}
+
+// the current log becomes the old one, waiting writers are let go
+bool IntentLog::rotate() {
+  Lock syncLock(_syncMutex);
+  Lock lock(_mutex);
+  if (_fd < 0) {
+    return false;
+  }
+  if (::fdatasync(_fd) != 0) {
+    return false;
+  }
+  _synced = _seq;
+  if (::rename(_path.c_str(), _oldPath.c_str()) != 0) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to rename " << _path << ": " << strerror(eno);
+    return false;
+  }
+  ::close(_fd);
+  _oldLog = true;
+  _pending = 0;
+  _bytes = 0;
+  _fd = openLog();
+  return true;
+}
+
+// the old log is covered by a flush, drop it
+bool IntentLog::retire() {
+  if (!_flush || !_flush()) {
+    return false;
+  }
+  ::unlink(_oldPath.c_str());
+  syncDir();
+  Lock lock(_mutex);
+  _oldLog = false;
+  return true;
+}
+
+bool IntentLog::checkpoint() {
+  Lock checkpointLock(_checkpointMutex);
+  // records of a failed checkpoint first, the current log may depend on them
+  if (_oldLog && !retire()) {
+    return false;
+  }
+  if (_pending == 0) {
+    return true;
+  }
+  if (!rotate()) {
+    return false;
+  }
+  return retire();
+}
+
+bool IntentLog::settle() {
+  if (empty() && !_oldLog) {
+    return true;
+  }
+  return checkpoint();
+}
+
+void IntentLog::start(Flush flush) {
+  Lock lock(_mutex);
+  if (_running) {
+    return;
+  }
+  _flush = std::move(flush);
+  _stop = false;
+  int res = pthread_create(&_thread, nullptr, IntentLog::run, this);
+  if (res != 0) {
+    RLOG(ERROR) << "error starting intent log thread, res = " << res;
+    return;
+  }
+  _running = true;
+}
+
+void IntentLog::stop() {
+  {
+    Lock lock(_mutex);
+    if (!_running) {
+      return;
+    }
+    _stop = true;
+    pthread_cond_signal(&_wake);
+  }
+  pthread_join(_thread, nullptr);
+  {
+    Lock lock(_mutex);
+    _running = false;
+  }
+  if (!checkpoint()) {
+    RLOG(WARNING) << "unable to write out the writes in " << _path;
+  }
+}
+
+void *IntentLog::run(void *arg) {
+  static_cast<IntentLog *>(arg)->loop();
+  return nullptr;
+}
+
+void IntentLog::loop() {
+  Lock lock(_mutex);
+  bool failed = false;
+  while (!_stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += FlushInterval / 1000;
+    deadline.tv_nsec += (FlushInterval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000;
+    }
+    // a full log is flushed at once, unless that just failed
+    int res = 0;
+    while (!_stop && res != ETIMEDOUT && (failed || _bytes < _maxBytes)) {
+      res = pthread_cond_timedwait(&_wake, &_mutex, &deadline);
+    }
+    if (_stop || (_pending == 0 && !_oldLog)) {
+      continue;
+    }
+
+    pthread_mutex_unlock(&_mutex);
+    failed = !checkpoint();
+    if (failed) {
+      RLOG(WARNING) << "intent log checkpoint failed, retrying";
+    }
+    pthread_mutex_lock(&_mutex);
+  }
+}
+
+}  // namespace encfs
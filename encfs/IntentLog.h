@@ -0,0 +1,153 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IntentLog_incl_
+#define _IntentLog_incl_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+
+#include "CipherKey.h"
+
+namespace encfs {
+
+class Cipher;
+
+/*
+    Local log of the writes held in write-back buffers (--intentlog), so
+    that they survive a crash once acknowledged.
+
+    FileNode appends each write it buffers, by plaintext path, and the
+    write returns once its record is on disk.  Records are encrypted and
+    MACed with the volume key, and concurrent writers share one fdatasync.
+    Small random writes so become appends to one local file, while the
+    buffers go to the cipher files in whole blocks later.
+
+    A checkpoint starts a new log and keeps the old one, next to it with
+    ".old" appended, until the flush callback has written out the buffers
+    of all files and synced the backing file systems.  The flusher thread
+    checkpoints every FlushInterval ms while there are records, and as soon
+    as the log grows past maxBytes.  Since records name files by path,
+    renames, unlinks, truncates and hole punches wait for a checkpoint
+    (settle()) first.
+
+    When the volume is opened, replay() hands the records left by a crash,
+    those of the old log first, to a callback which writes them again.  A
+    record cut short or failing its MAC ends the log it is in.  Writes too
+    large for the write-back buffer go to the cipher files directly, and
+    are only durable after an fsync, as without the log.
+*/
+class IntentLog {
+ public:
+  // ms between checkpoints while there are records
+  static const int FlushInterval = 5000;
+  // log size at which a checkpoint is due at once
+  static const size_t MaxBytes = 64 << 20;
+
+  // Writes a logged write on replay, false if it couldn't
+  using Apply = std::function<bool(const std::string &path, off_t offset,
+                                   const unsigned char *data, size_t size)>;
+  // Writes out what the logged writes are buffered in and makes the backing
+  // files durable, false on failure
+  using Flush = std::function<bool()>;
+
+  IntentLog(const std::string &path, const std::shared_ptr<Cipher> &cipher,
+            const CipherKey &key, size_t maxBytes = MaxBytes);
+  // stop()s, the log is only removed by a successful checkpoint
+  ~IntentLog();
+
+  IntentLog(const IntentLog &src) = delete;
+  IntentLog &operator=(const IntentLog &src) = delete;
+
+  // whether the log could be opened for appending
+  bool valid() const { return _fd >= 0; }
+
+  // Apply the records left behind, returning how many, or -1 if apply
+  // failed, in which case the logs are kept.
+  int replay(const Apply &apply);
+  // forget all records, once what replay() wrote is durable
+  bool clear();
+
+  // Returns the sequence number of the record of the write, 0 if it
+  // couldn't be written.
+  uint64_t append(const std::string &path, off_t offset,
+                  const unsigned char *data, size_t size);
+  // Returns 0 once record seq is durable, or -errno
+  int commit(uint64_t seq);
+
+  // no records since the last checkpoint
+  bool empty() const { return _pending == 0; }
+  // bytes of records since the last checkpoint
+  size_t bytes() const { return _bytes; }
+
+  // Checkpoint with flush from the flusher thread, started once the
+  // process won't fork any more.
+  void start(Flush flush);
+  // ends the thread after a last checkpoint
+  void stop();
+
+  // Start a new log, flush, and drop the old log.  Returns false if the
+  // flush failed, the old log is then kept for the next checkpoint.
+  bool checkpoint();
+  // checkpoint() if there are records
+  bool settle();
+
+ private:
+  int openLog();
+  bool readLog(const std::string &path, const Apply &apply, int *records);
+  bool rotate();
+  bool retire();
+  void syncDir();
+
+  static void *run(void *arg);
+  void loop();
+
+  const std::string _path;
+  const std::string _oldPath;
+  std::shared_ptr<Cipher> _cipher;
+  CipherKey _key;
+  const size_t _maxBytes;
+
+  // appends, and the descriptor
+  mutable pthread_mutex_t _mutex;
+  // one fdatasync at a time, taken before _mutex
+  pthread_mutex_t _syncMutex;
+  // one checkpoint at a time, taken before both
+  pthread_mutex_t _checkpointMutex;
+  int _fd;
+  uint64_t _nonce;  // of the current log
+  uint64_t _seq;    // last record appended
+  std::atomic<uint64_t> _synced;
+  std::atomic<uint64_t> _pending;  // records since the last checkpoint
+  std::atomic<size_t> _bytes;
+  std::atomic<bool> _oldLog;  // the old log still waits for its flush
+
+  Flush _flush;
+  pthread_t _thread;
+  pthread_cond_t _wake;  // waits on the monotonic clock
+  bool _running;
+  bool _stop;
+};
+
+}  // namespace encfs
+
+#endif
@@ -38,6 +38,8 @@ Interface::Interface(std::string name_, int Current, int Revision, int Age)
 
 Interface::Interface() : _current(0), _revision(0), _age(0) {}
 
+Interface::Interface(const Interface &src) = default;
+
 Interface &Interface::operator=(const Interface &src) = default;
 
 const std::string &Interface::name() const { return _name; }
@@ -39,6 +39,7 @@ class Interface {
   Interface(const char *name, int Current, int Revision, int Age);
   Interface(std::string name, int Current, int Revision, int Age);
   Interface();
+  Interface(const Interface &src);
 
   // check if we implement the interface described by B.
   // Note that A.implements(B) is not the same as B.implements(A)
@@ -0,0 +1,96 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "KeepCache.h"
+
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+KeepCache::KeepCache(size_t maxFiles) : _capacity(maxFiles) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+KeepCache::~KeepCache() { pthread_mutex_destroy(&_mutex); }
+
+size_t KeepCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+bool KeepCache::same(const Entry &entry, const struct stat &st) {
+  return entry.ino == st.st_ino && entry.dev == st.st_dev &&
+         entry.size == st.st_size &&
+         entry.mtime.tv_sec == st.st_mtim.tv_sec &&
+         entry.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+         entry.ctime.tv_sec == st.st_ctim.tv_sec &&
+         entry.ctime.tv_nsec == st.st_ctim.tv_nsec;
+}
+
+bool KeepCache::opened(const std::string &plaintextPath,
+                       const struct stat &st) {
+  Lock lock(_mutex);
+  auto it = _index.find(plaintextPath);
+  bool keep = it != _index.end() && same(*it->second, st);
+  if (keep) {
+    _lru.splice(_lru.begin(), _lru, it->second);
+  } else {
+    record(plaintextPath, st);
+  }
+  return keep;
+}
+
+void KeepCache::written(const std::string &plaintextPath,
+                        const struct stat &st) {
+  Lock lock(_mutex);
+  record(plaintextPath, st);
+}
+
+// called with _mutex held
+void KeepCache::record(const std::string &path, const struct stat &st) {
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    _lru.erase(it->second);
+    _index.erase(it);
+  }
+
+  // a change later in the same second might not show in the times
+  time_t now = time(nullptr);
+  if (_capacity == 0 || st.st_mtime >= now || st.st_ctime >= now) {
+    return;
+  }
+
+  Entry entry;
+  entry.path = path;
+  entry.ino = st.st_ino;
+  entry.dev = st.st_dev;
+  entry.size = st.st_size;
+  entry.mtime = st.st_mtim;
+  entry.ctime = st.st_ctim;
+  _lru.push_front(entry);
+  _index[path] = _lru.begin();
+
+  while (_index.size() > _capacity) {
+    _index.erase(_lru.back().path);
+    _lru.pop_back();
+  }
+}
+
+}  // namespace encfs
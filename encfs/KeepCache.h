@@ -0,0 +1,87 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KeepCache_incl_
+#define _KeepCache_incl_
+
+#include <list>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace encfs {
+
+/*
+    Decides whether the kernel may keep its cached pages of a file when it
+    is opened again (FUSE keep_cache, see --keepcache).
+
+    FUSE drops the pages of a file on every open unless told otherwise, so
+    a file which is opened often is read and decoded again each time.  This
+    remembers the stamp (inode, size, mtime and ctime) of the backing file
+    of each path as it was last opened, and the pages are kept if the file
+    is unchanged since.  Writes through the mount update the kernel's pages
+    as well, so the stamp is taken again when a writer releases the file.
+
+    Entries are by plaintext path, as the kernel's pages are: a write through
+    another hard link of the file leaves the stamp of this path behind, and
+    the pages are dropped.  As with LinkCache, stamps of the current second
+    are not trusted.  Bounded LRU of maxFiles paths.
+*/
+class KeepCache {
+ public:
+  explicit KeepCache(size_t maxFiles);
+  ~KeepCache();
+
+  KeepCache(const KeepCache &src) = delete;
+  KeepCache &operator=(const KeepCache &src) = delete;
+
+  // st is the lstat of the backing file of the path, as it is opened.
+  // Returns true if the file is as it was recorded, the kernel's pages of
+  // it are still good then.  st is recorded for the next open either way.
+  bool opened(const std::string &plaintextPath, const struct stat &st);
+
+  // The file was written through the mount, st is its lstat now
+  void written(const std::string &plaintextPath, const struct stat &st);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string path;
+    ino_t ino;
+    dev_t dev;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+  };
+  using EntryList = std::list<Entry>;
+
+  static bool same(const Entry &entry, const struct stat &st);
+  void record(const std::string &path, const struct stat &st);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  EntryList _lru;  // most recently used first
+  std::unordered_map<std::string, EntryList::iterator> _index;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,182 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "KernelCipher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/if_alg.h>
+#endif
+
+#include "easylogging++.h"
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+// bytes per request, well below the default socket buffer limit
+static const int ChunkSize = 64 * 1024;
+
+#ifdef __linux__
+
+std::unique_ptr<KernelCipher> KernelCipher::open(const char *algorithm,
+                                                 const unsigned char *key,
+                                                 int keyLen, int ivLen) {
+  int fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    VLOG(1) << "no AF_ALG sockets: " << strerror(errno);
+    return nullptr;
+  }
+
+  struct sockaddr_alg sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.salg_family = AF_ALG;
+  strncpy((char *)sa.salg_type, "skcipher", sizeof(sa.salg_type) - 1);
+  strncpy((char *)sa.salg_name, algorithm, sizeof(sa.salg_name) - 1);
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      setsockopt(fd, SOL_ALG, ALG_SET_KEY, key, keyLen) < 0) {
+    VLOG(1) << "kernel cipher " << algorithm
+            << " not available: " << strerror(errno);
+    ::close(fd);
+    return nullptr;
+  }
+
+  return std::unique_ptr<KernelCipher>(new KernelCipher(fd, ivLen));
+}
+
+bool KernelCipher::crypt(unsigned char *buf, int len, const unsigned char *iv,
+                         bool encrypt) {
+  int op = acquire();
+  if (op < 0) {
+    return false;
+  }
+
+  unsigned char chain[32];
+  rAssert(_ivLen <= (int)sizeof(chain));
+  memcpy(chain, iv, _ivLen);
+
+  bool ok = true;
+  for (int done = 0; ok && done < len;) {
+    int n = std::min(ChunkSize, len - done);
+    unsigned char *data = buf + done;
+
+    // the IV of the next chunk is the last ciphertext block of this one
+    unsigned char next[sizeof(chain)];
+    if (!encrypt) {
+      memcpy(next, data + n - _ivLen, _ivLen);
+    }
+
+    char control[CMSG_SPACE(sizeof(uint32_t)) +
+                 CMSG_SPACE(sizeof(struct af_alg_iv) + sizeof(chain))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {data, (size_t)n};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(uint32_t)) +
+                         CMSG_SPACE(sizeof(struct af_alg_iv) + _ivLen);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_OP;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    uint32_t type = encrypt ? ALG_OP_ENCRYPT : ALG_OP_DECRYPT;
+    memcpy(CMSG_DATA(cmsg), &type, sizeof(type));
+
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_IV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + _ivLen);
+    auto *algIV = (struct af_alg_iv *)CMSG_DATA(cmsg);
+    algIV->ivlen = _ivLen;
+    memcpy(algIV->iv, chain, _ivLen);
+
+    ok = sendmsg(op, &msg, 0) == n && read(op, data, n) == n;
+    if (ok) {
+      memcpy(chain, encrypt ? data + n - _ivLen : next, _ivLen);
+      done += n;
+    } else {
+      RLOG(WARNING) << "kernel cipher failed: " << strerror(errno);
+    }
+  }
+
+  if (ok) {
+    release(op);
+  } else {
+    // may hold a half finished request
+    ::close(op);
+  }
+  return ok;
+}
+
+int KernelCipher::acquire() {
+  {
+    Lock lock(_mutex);
+    if (!_idle.empty()) {
+      int op = _idle.back();
+      _idle.pop_back();
+      return op;
+    }
+  }
+  int op = accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (op < 0) {
+    RLOG(WARNING) << "kernel cipher accept failed: " << strerror(errno);
+  }
+  return op;
+}
+
+#else
+
+std::unique_ptr<KernelCipher> KernelCipher::open(const char *, const unsigned char *,
+                                                 int, int) {
+  return nullptr;
+}
+
+bool KernelCipher::crypt(unsigned char *, int, const unsigned char *, bool) {
+  return false;
+}
+
+int KernelCipher::acquire() { return -1; }
+
+#endif
+
+KernelCipher::KernelCipher(int fd, int ivLen) : _fd(fd), _ivLen(ivLen) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+KernelCipher::~KernelCipher() {
+  for (int op : _idle) {
+    ::close(op);
+  }
+  ::close(_fd);
+  pthread_mutex_destroy(&_mutex);
+}
+
+void KernelCipher::release(int op) {
+  Lock lock(_mutex);
+  _idle.push_back(op);
+}
+
+}  // namespace encfs
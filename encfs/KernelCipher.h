@@ -0,0 +1,76 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KernelCipher_incl_
+#define _KernelCipher_incl_
+
+#include <memory>
+#include <pthread.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    A block cipher mode of the Linux kernel crypto API, used through an
+    AF_ALG socket, such as "cbc(aes)".  The kernel picks the fastest driver
+    it has for the algorithm, which may be an offload engine such as Intel
+    QAT, so bulk encryption can leave the CPU.
+
+    The key is set once on the bound socket.  Each operation uses a request
+    socket accept()ed from it, kept in a pool between operations, so
+    threads work in parallel.  Data is sent in chunks, chaining the CBC IV
+    from one to the next, which gives the same result as one request.
+*/
+class KernelCipher {
+ public:
+  // nullptr if the kernel doesn't have AF_ALG or the algorithm, or refuses
+  // the key
+  static std::unique_ptr<KernelCipher> open(const char *algorithm,
+                                            const unsigned char *key,
+                                            int keyLen, int ivLen);
+  ~KernelCipher();
+
+  KernelCipher(const KernelCipher &src) = delete;
+  KernelCipher &operator=(const KernelCipher &src) = delete;
+
+  // In place, len a multiple of the cipher's block size.  CBC chaining
+  // between chunks assumes the IV is one cipher block.
+  bool encrypt(unsigned char *buf, int len, const unsigned char *iv) {
+    return crypt(buf, len, iv, true);
+  }
+  bool decrypt(unsigned char *buf, int len, const unsigned char *iv) {
+    return crypt(buf, len, iv, false);
+  }
+
+ private:
+  KernelCipher(int fd, int ivLen);
+
+  bool crypt(unsigned char *buf, int len, const unsigned char *iv,
+             bool encrypt);
+  int acquire();
+  void release(int op);
+
+  const int _fd;  // bound and keyed
+  const int _ivLen;
+
+  pthread_mutex_t _mutex;
+  std::vector<int> _idle;  // request sockets
+};
+
+}  // namespace encfs
+
+#endif
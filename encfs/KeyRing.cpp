@@ -0,0 +1,109 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "KeyRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Error.h"
+
+namespace encfs {
+
+#ifdef __linux__
+
+// glibc has no wrappers for the key management calls, and libkeyutils isn't
+// worth a dependency for three of them
+static const char KeyType[] = "user";
+
+// permissions, from keyutils.h
+static const uint32_t PossessorAll = 0x3f000000;
+static const uint32_t UserView = 0x00010000;
+static const uint32_t UserRead = 0x00020000;
+static const uint32_t UserSearch = 0x00080000;
+
+static long findKey(const std::string &description) {
+  return syscall(SYS_keyctl, KEYCTL_SEARCH, KEY_SPEC_USER_KEYRING, KeyType,
+                 description.c_str(), 0);
+}
+
+bool KeyRing::store(const std::string &description,
+                    const std::vector<unsigned char> &data,
+                    unsigned int timeout) {
+  long id = syscall(SYS_add_key, KeyType, description.c_str(), data.data(),
+                    data.size(), KEY_SPEC_USER_KEYRING);
+  if (id < 0) {
+    RLOG(WARNING) << "unable to add key to the keyring: " << strerror(errno);
+    return false;
+  }
+  // readable by whoever can reach the user keyring, and by nobody else
+  syscall(SYS_keyctl, KEYCTL_SETPERM, id,
+          PossessorAll | UserView | UserRead | UserSearch);
+  if (syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, timeout) != 0) {
+    RLOG(WARNING) << "unable to set key timeout: " << strerror(errno);
+    syscall(SYS_keyctl, KEYCTL_REVOKE, id);
+    return false;
+  }
+  return true;
+}
+
+bool KeyRing::take(const std::string &description,
+                   std::vector<unsigned char> *data) {
+  long id = findKey(description);
+  if (id < 0) {
+    return false;
+  }
+
+  // the size may change between calls, until the buffer was large enough
+  long len = syscall(SYS_keyctl, KEYCTL_READ, id, nullptr, 0);
+  while (len >= 0 && (size_t)len != data->size()) {
+    data->assign(len, 0);
+    len = syscall(SYS_keyctl, KEYCTL_READ, id, data->data(), data->size());
+  }
+  syscall(SYS_keyctl, KEYCTL_REVOKE, id);
+  syscall(SYS_keyctl, KEYCTL_UNLINK, id, KEY_SPEC_USER_KEYRING);
+  if (len < 0) {
+    std::fill(data->begin(), data->end(), 0);
+    data->clear();
+    return false;
+  }
+  return true;
+}
+
+#else
+
+bool KeyRing::store(const std::string &, const std::vector<unsigned char> &,
+                    unsigned int) {
+  return false;
+}
+
+bool KeyRing::take(const std::string &, std::vector<unsigned char> *) {
+  return false;
+}
+
+#endif
+
+}  // namespace encfs
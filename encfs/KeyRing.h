@@ -0,0 +1,49 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _KeyRing_incl_
+#define _KeyRing_incl_
+
+#include <string>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Secrets kept in the user's kernel keyring (Linux only), so that they
+    survive outside of the process memory for a limited time and are wiped
+    by the kernel when that runs out.  Used by --keyring to keep the volume
+    key over an idle unmount.
+
+    Keys are of type "user", only readable by processes of the same user.
+    Elsewhere nothing is stored and nothing is found.
+*/
+namespace KeyRing {
+// Store data under description, replacing any earlier key of that
+// description.  It expires after timeout seconds.
+bool store(const std::string &description,
+           const std::vector<unsigned char> &data, unsigned int timeout);
+
+// Fetch the data stored under description, and revoke the key, so that a
+// secret is only ever used once.  Returns false if there is none.
+bool take(const std::string &description, std::vector<unsigned char> *data);
+}  // namespace KeyRing
+
+}  // namespace encfs
+
+#endif
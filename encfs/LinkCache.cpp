@@ -0,0 +1,100 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LinkCache.h"
+
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+LinkCache::LinkCache(size_t maxLinks) : _capacity(maxLinks) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+LinkCache::~LinkCache() {
+  while (!_lru.empty()) {
+    drop(_lru.begin());
+  }
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t LinkCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+void LinkCache::drop(EntryList::iterator it) {
+  _index.erase(it->ino);
+  it->target.assign(it->target.length(), '\0');
+  _lru.erase(it);
+}
+
+bool LinkCache::get(const struct stat &st, std::string *target) {
+  Lock lock(_mutex);
+
+  auto it = _index.find(st.st_ino);
+  if (it == _index.end()) {
+    return false;
+  }
+
+  EntryList::iterator entry = it->second;
+  if (entry->dev != st.st_dev || entry->mtime != st.st_mtime ||
+      entry->ctime != st.st_ctime || entry->size != st.st_size) {
+    drop(entry);
+    return false;
+  }
+
+  _lru.splice(_lru.begin(), _lru, entry);
+  *target = entry->target;
+  return true;
+}
+
+void LinkCache::put(const struct stat &st, const std::string &target) {
+  if (_capacity == 0) {
+    return;
+  }
+  time_t now = time(nullptr);
+  if (st.st_mtime >= now || st.st_ctime >= now) {
+    return;
+  }
+
+  Lock lock(_mutex);
+
+  auto it = _index.find(st.st_ino);
+  if (it != _index.end()) {
+    drop(it->second);
+  }
+
+  _lru.push_front(Entry());
+  Entry &entry = _lru.front();
+  entry.ino = st.st_ino;
+  entry.dev = st.st_dev;
+  entry.mtime = st.st_mtime;
+  entry.ctime = st.st_ctime;
+  entry.size = st.st_size;
+  entry.target = target;
+  _index[st.st_ino] = _lru.begin();
+
+  while (_index.size() > _capacity) {
+    drop(std::prev(_lru.end()));
+  }
+}
+
+}  // namespace encfs
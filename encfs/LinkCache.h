@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LinkCache_incl_
+#define _LinkCache_incl_
+
+#include <list>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace encfs {
+
+/*
+    Bounded LRU cache of decoded symlink targets, keyed by the backing
+    link's inode.
+
+    An entry is only returned while the backing link's mtime, ctime and size
+    still match, so a link which was replaced (even with the same inode
+    number) is read again.  As with DirCache, links changed during the
+    current second are not accepted by put().
+*/
+class LinkCache {
+ public:
+  explicit LinkCache(size_t maxLinks);
+  ~LinkCache();
+
+  LinkCache(const LinkCache &src) = delete;
+  LinkCache &operator=(const LinkCache &src) = delete;
+
+  // st is the current lstat of the backing link
+  bool get(const struct stat &st, std::string *target);
+  void put(const struct stat &st, const std::string &target);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    ino_t ino;
+    dev_t dev;
+    time_t mtime;
+    time_t ctime;
+    off_t size;
+    std::string target;
+  };
+  using EntryList = std::list<Entry>;
+
+  void drop(EntryList::iterator it);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  EntryList _lru;  // most recently used first
+  std::unordered_map<ino_t, EntryList::iterator> _index;
+};
+
+}  // namespace encfs
+
+#endif
@@ -21,10 +21,12 @@
 #include "MACFileIO.h"
 
 #include "easylogging++.h"
+#include <algorithm>
 #include <cinttypes>
 #include <cstring>
 #include <sys/stat.h>
 #include <utility>
+#include <vector>
 
 #include "BlockFileIO.h"
 #include "Cipher.h"
@@ -32,6 +34,8 @@
 #include "FileIO.h"
 #include "FileUtils.h"
 #include "MemoryPool.h"
+#include "Mutex.h"
+#include "Trace.h"
 #include "i18n.h"
 
 using namespace std;
@@ -50,13 +54,39 @@ namespace encfs {
 // compatible, except at a high level by checking a revision number for the
 // filesystem...
 //
-static Interface MACFileIO_iface("FileIO/MAC", 2, 1, 0);
+// Version 3 computes the MACs with Cipher::blockMAC_64 (SipHash) instead of
+// MAC_64, and is chosen by blockMACVersion in the configuration.
+//
+// Version 4 is for ciphers which seal blocks (Cipher::sealEncode).  The
+// header is the tag and the nonce of the seal: this layer only fills the
+// nonce with random bytes, the cipher below codes the block and checks the
+// tag as it decodes it.
+//
+// With blockMACExtents (in the configuration too) blocks are [blockSize] of
+// user data, and their MACs are kept in tag extents between groups of them.
+//
+static Interface MACFileIO_iface("FileIO/MAC", 3, 1, 1);
+
+// data covered by the tags of one extent, at least, so that the tags of a
+// read of this size come from one or two small reads
+static const int TagGroupBytes = 1 << 20;
 
 int dataBlockSize(const FSConfigPtr &cfg) {
+  if (cfg->config->blockMACExtents) {
+    return cfg->config->blockSize;
+  }
   return cfg->config->blockSize - cfg->config->blockMACBytes -
          cfg->config->blockMACRandBytes;
 }
 
+// blocks of tags, and of the data they are for, in a group of a file with
+// tag extents.  The tags fill their extent.
+static void tagLayout(int blockSize, int macBytes, int *extent, int *group) {
+  int blocks = std::max(TagGroupBytes / blockSize, 1);
+  *extent = (blocks * macBytes + blockSize - 1) / blockSize;
+  *group = *extent * blockSize / macBytes;
+}
+
 MACFileIO::MACFileIO(std::shared_ptr<FileIO> _base, const FSConfigPtr &cfg)
     : BlockFileIO(dataBlockSize(cfg), cfg),
       base(std::move(_base)),
@@ -64,20 +94,44 @@ MACFileIO::MACFileIO(std::shared_ptr<FileIO> _base, const FSConfigPtr &cfg)
       key(cfg->key),
       macBytes(cfg->config->blockMACBytes),
       randBytes(cfg->config->blockMACRandBytes),
-      warnOnly(cfg->opts->forceDecode) {
-  rAssert(macBytes >= 0 && macBytes <= 8);
-  rAssert(randBytes >= 0);
+      version(cfg->config->blockMACVersion),
+      warnOnly(cfg->opts->forceDecode),
+      tagExtent(0),
+      tagGroup(0) {
+  if (version >= 4) {
+    rAssert(macBytes == Cipher::SealTagBytes &&
+            randBytes == Cipher::SealNonceBytes);
+    rAssert(cfg->cipher->sealedBlocks());
+  } else {
+    rAssert(macBytes >= 0 && macBytes <= 8);
+    rAssert(randBytes >= 0);
+  }
+  if (cfg->config->blockMACExtents) {
+    rAssert(macBytes > 0 && randBytes == 0);
+    tagLayout(blockSize(), macBytes, &tagExtent, &tagGroup);
+  }
+  pthread_mutex_init(&tagMutex, nullptr);
   VLOG(1) << "fs block size = " << cfg->config->blockSize
           << ", macBytes = " << cfg->config->blockMACBytes
-          << ", randBytes = " << cfg->config->blockMACRandBytes;
+          << ", randBytes = " << cfg->config->blockMACRandBytes
+          << ", version = " << version << ", tag extent = " << tagExtent;
 }
 
-MACFileIO::~MACFileIO() = default;
+MACFileIO::~MACFileIO() { pthread_mutex_destroy(&tagMutex); }
+
+Interface MACFileIO::interface() const {
+  return version >= 3 ? MACFileIO_iface : Interface("FileIO/MAC", 2, 1, 0);
+}
 
-Interface MACFileIO::interface() const { return MACFileIO_iface; }
+uint64_t MACFileIO::mac(const unsigned char *data, int len) const {
+  return version >= 3 ? cipher->blockMAC_64(data, len, key)
+                      : cipher->MAC_64(data, len, key);
+}
 
 int MACFileIO::open(int flags) { return base->open(flags); }
 
+int MACFileIO::create(mode_t mode) { return base->create(mode); }
+
 void MACFileIO::setFileName(const char *fileName) {
   base->setFileName(fileName);
 }
@@ -118,14 +172,67 @@ static off_t locWithoutHeader(off_t offset, int blockSize, int headerSize) {
   return offset - blockNum * headerSize;
 }
 
+// the size without the headers of a lower file of size bytes
+static off_t sizeWithoutHeaders(off_t size, int blockSize, int headerSize) {
+  return size > 0 ? locWithoutHeader(size, blockSize, headerSize) : size;
+}
+
+// the size without the tag extents of a lower file of size bytes.  A
+// location inside a tag extent maps to the start of the data of its group.
+static off_t sizeWithoutTags(off_t size, int blockSize, int extent,
+                             int group) {
+  if (size <= 0) {
+    return size;
+  }
+  off_t groupSize = (off_t)(extent + group) * blockSize;
+  off_t rest = size % groupSize;
+  return size / groupSize * group * blockSize +
+         std::max(rest - (off_t)extent * blockSize, (off_t)0);
+}
+
+off_t MACFileIO::lowerSize(off_t size) const {
+  if (tagExtent == 0) {
+    int headerSize = macBytes + randBytes;
+    return locWithHeader(size, blockSize() + headerSize, headerSize);
+  }
+  if (size <= 0) {
+    return size;
+  }
+  off_t last = size - 1;
+  return dataLoc(last / blockSize()) + last % blockSize() + 1;
+}
+
+off_t MACFileIO::sizeOver(off_t lowerSize) const {
+  if (tagExtent == 0) {
+    int headerSize = macBytes + randBytes;
+    return sizeWithoutHeaders(lowerSize, blockSize() + headerSize,
+                              headerSize);
+  }
+  return sizeWithoutTags(lowerSize, blockSize(), tagExtent, tagGroup);
+}
+
+off_t MACFileIO::dataLoc(off_t block) const {
+  off_t bs = blockSize();
+  return block / tagGroup * (tagExtent + tagGroup) * bs +
+         (tagExtent + block % tagGroup) * bs;
+}
+
+off_t MACFileIO::tagLoc(off_t block) const {
+  off_t bs = blockSize();
+  return block / tagGroup * (tagExtent + tagGroup) * bs +
+         block % tagGroup * macBytes;
+}
+
+size_t MACFileIO::groupRun(off_t block, size_t count) const {
+  return std::min(count, (size_t)(tagGroup - block % tagGroup));
+}
+
 int MACFileIO::getAttr(struct stat *stbuf) const {
   int res = base->getAttr(stbuf);
 
   if (res == 0 && S_ISREG(stbuf->st_mode)) {
     // have to adjust size field..
-    int headerSize = macBytes + randBytes;
-    int bs = blockSize() + headerSize;
-    stbuf->st_size = locWithoutHeader(stbuf->st_size, bs, headerSize);
+    stbuf->st_size = sizeOver(stbuf->st_size);
   }
 
   return res;
@@ -133,18 +240,147 @@ int MACFileIO::getAttr(struct stat *stbuf) const {
 
 off_t MACFileIO::getSize() const {
   // adjust the size to hide the header overhead we tack on..
+  return sizeOver(base->getSize());
+}
+
+off_t MACFileIO::upperSize(const FSConfigPtr &cfg, off_t size) {
+  if (cfg->config->blockMACExtents) {
+    int extent, group;
+    tagLayout(cfg->config->blockSize, cfg->config->blockMACBytes, &extent,
+              &group);
+    return sizeWithoutTags(size, cfg->config->blockSize, extent, group);
+  }
+  int headerSize = cfg->config->blockMACBytes + cfg->config->blockMACRandBytes;
+  return sizeWithoutHeaders(size, cfg->config->blockSize, headerSize);
+}
+
+/**
+ * Check the header of a block of readSize bytes, as decoded by the lower layer,
+ * which starts at the user-data offset.  Returns the number of user bytes in
+ * the block, or -errno.
+ */
+ssize_t MACFileIO::checkBlock(const unsigned char *data, ssize_t readSize,
+                              off_t offset) const {
   int headerSize = macBytes + randBytes;
-  int bs = blockSize() + headerSize;
 
-  off_t size = base->getSize();
-  if (size > 0) {
-    size = locWithoutHeader(size, bs, headerSize);
+  int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
+
+  if (readSize <= headerSize) {
+    VLOG(1) << "readSize " << readSize << " at offset " << offset;
+    return readSize > 0 ? 0 : readSize;
   }
 
-  return size;
+  // don't store zeros if configured for zero-block pass-through
+  bool skipBlock = true;
+  if (_allowHoles) {
+    skipBlock = isZeroBlock(data, readSize);
+  } else if (macBytes > 0) {
+    skipBlock = false;
+  }
+
+  // sealed blocks were checked by the cipher as it decoded them
+  if (!skipBlock && version < 4) {
+    // At this point the data has been decoded.  So, compute the MAC of
+    // the block and check against the checksum stored in the header..
+    uint64_t mac = this->mac(data + macBytes, readSize - macBytes);
+    int res = verify(mac, data, offset / bs);
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  return readSize - headerSize;
+}
+
+int MACFileIO::verify(uint64_t mac, const unsigned char *stored,
+                      off_t blockNum) const {
+  // Constant time comparision to prevent timing attacks
+  unsigned char fail = 0;
+  for (int i = 0; i < macBytes; ++i, mac >>= 8) {
+    int test = mac & 0xff;
+
+    fail |= (test ^ stored[i]);
+  }
+
+  if (fail > 0) {
+    // uh oh..
+    RLOG(WARNING) << "MAC comparison failure in block " << blockNum;
+    ENCFS_TRACE1(mac__fail, (long)blockNum);
+    if (!warnOnly) {
+      return -EBADMSG;
+    }
+  }
+  return 0;
+}
+
+void MACFileIO::tagOf(const unsigned char *data, int len,
+                      unsigned char *tag) const {
+  uint64_t mac = this->mac(data, len);
+  for (int i = 0; i < macBytes; ++i) {
+    tag[i] = mac & 0xff;
+    mac >>= 8;
+  }
+}
+
+/**
+ * Check a block of readSize bytes against its tag.  Returns readSize, or
+ * -errno.
+ */
+ssize_t MACFileIO::checkTag(const unsigned char *data, ssize_t readSize,
+                            const unsigned char *tag, off_t block) const {
+  // zero blocks are holes, whatever the tag says
+  if (readSize <= 0 || (_allowHoles && isZeroBlock(data, readSize))) {
+    return readSize;
+  }
+  int res = verify(mac(data, (int)readSize), tag, block);
+  return res < 0 ? res : readSize;
+}
+
+int MACFileIO::readTags(off_t block, size_t count,
+                        unsigned char *tags) const {
+  Lock lock(tagMutex);
+  while (count > 0) {
+    size_t n = groupRun(block, count);
+    IORequest req;
+    req.offset = tagLoc(block);
+    req.data = tags;
+    req.dataLen = n * macBytes;
+    ssize_t res = base->read(req);
+    if (res < 0) {
+      return (int)res;
+    }
+    memset(tags + res, 0, req.dataLen - res);
+    block += n;
+    count -= n;
+    tags += req.dataLen;
+  }
+  return 0;
+}
+
+int MACFileIO::writeTags(off_t block, size_t count,
+                         const unsigned char *tags) {
+  Lock lock(tagMutex);
+  while (count > 0) {
+    size_t n = groupRun(block, count);
+    IORequest req;
+    req.offset = tagLoc(block);
+    req.data = const_cast<unsigned char *>(tags);
+    req.dataLen = n * macBytes;
+    ssize_t res = base->write(req);
+    if (res < 0) {
+      return (int)res;
+    }
+    block += n;
+    count -= n;
+    tags += req.dataLen;
+  }
+  return 0;
 }
 
 ssize_t MACFileIO::readOneBlock(const IORequest &req) const {
+  if (tagExtent > 0) {
+    return readTagged(req);
+  }
   int headerSize = macBytes + randBytes;
 
   int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
@@ -157,64 +393,171 @@ ssize_t MACFileIO::readOneBlock(const IORequest &req) const {
   tmp.dataLen = headerSize + req.dataLen;
 
   // get the data from the base FileIO layer
-  ssize_t readSize = base->read(tmp);
+  ssize_t readSize = checkBlock(tmp.data, base->read(tmp), req.offset);
 
-  // don't store zeros if configured for zero-block pass-through
-  bool skipBlock = true;
-  if (_allowHoles) {
-    for (int i = 0; i < readSize; ++i) {
-      if (tmp.data[i] != 0) {
-        skipBlock = false;
+  // now copy the data to the output buffer
+  if (readSize > 0) {
+    memcpy(req.data, tmp.data + headerSize, readSize);
+  }
+
+  MemoryPool::release(mb);
+
+  return readSize;
+}
+
+/**
+ * A run of blocks is read from the lower layer in chunks, and each chunk is
+ * checked and copied out right after it was decoded, while it is still in
+ * the cache.  The chunks are spread over the worker threads.
+ */
+ssize_t MACFileIO::readBlocks(const IORequest &req) const {
+  if (tagExtent > 0) {
+    return readTagged(req);
+  }
+  int headerSize = macBytes + randBytes;
+  if (headerSize == 0) {
+    return BlockFileIO::readBlocks(req);
+  }
+
+  int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
+  size_t count = req.dataLen / blockSize();
+
+  // bytes of user data in each block, the run ends at the first short one
+  std::vector<ssize_t> sizes(count, 0);
+
+  auto readChunk = [&](size_t first, size_t n) {
+    MemBlock mb = MemoryPool::allocate(n * bs);
+
+    IORequest tmp;
+    tmp.offset = locWithHeader(req.offset + first * blockSize(), bs, headerSize);
+    tmp.data = mb.data;
+    tmp.dataLen = n * bs;
+
+    ssize_t readSize = base->read(tmp);
+    bool ok = true;
+    for (size_t i = 0; i < n; ++i) {
+      ssize_t len = readSize < 0 ? readSize : min(readSize, (ssize_t)bs);
+      off_t offset = req.offset + (first + i) * blockSize();
+      ssize_t res = checkBlock(tmp.data + i * bs, len, offset);
+      sizes[first + i] = res;
+      if (res < 0) {
+        ok = false;
+        break;
+      }
+      if (res > 0) {
+        memcpy(req.data + (first + i) * blockSize(),
+               tmp.data + i * bs + headerSize, res);
+      }
+      if (res < (ssize_t)blockSize()) {
         break;
       }
+      readSize -= bs;
     }
-  } else if (macBytes > 0) {
-    skipBlock = false;
-  }
 
-  if (readSize > headerSize) {
-    if (!skipBlock) {
-      // At this point the data has been decoded.  So, compute the MAC of
-      // the block and check against the checksum stored in the header..
-      uint64_t mac =
-          cipher->MAC_64(tmp.data + macBytes, readSize - macBytes, key);
+    MemoryPool::release(mb);
+    return ok;
+  };
 
-      // Constant time comparision to prevent timing attacks
-      unsigned char fail = 0;
-      for (int i = 0; i < macBytes; ++i, mac >>= 8) {
-        int test = mac & 0xff;
-        int stored = tmp.data[i];
+  // a failed chunk left its error in sizes
+  forBlocks(count, readChunk);
 
-        fail |= (test ^ stored);
-      }
+  ssize_t result = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (sizes[i] < 0) {
+      return sizes[i];
+    }
+    result += sizes[i];
+    if (sizes[i] < (ssize_t)blockSize()) {
+      break;
+    }
+  }
+  return result;
+}
 
-      if (fail > 0) {
-        // uh oh..
-        long blockNum = req.offset / bs;
-        RLOG(WARNING) << "MAC comparison failure in block " << blockNum;
-        if (!warnOnly) {
-          MemoryPool::release(mb);
-          return -EBADMSG;
+/**
+ * With tag extents, the tags of the whole run are read first, and the data
+ * goes straight into the caller's buffer, in chunks spread over the worker
+ * threads like above.  A run of one (short) block is fine too.
+ */
+ssize_t MACFileIO::readTagged(const IORequest &req) const {
+  off_t bs = blockSize();
+  off_t first = req.offset / bs;
+  size_t count = std::max(roundUpDivide(req.dataLen, bs), (off_t)1);
+
+  std::vector<unsigned char> tags(count * macBytes);
+  int res = readTags(first, count, tags.data());
+  if (res < 0) {
+    return res;
+  }
+
+  std::vector<ssize_t> sizes(count, 0);
+  auto readChunk = [&](size_t begin, size_t n) {
+    for (size_t i = begin; i < begin + n;) {
+      size_t run = groupRun(first + i, begin + n - i);
+      IORequest tmp;
+      tmp.offset = dataLoc(first + i);
+      tmp.data = req.data + i * bs;
+      tmp.dataLen = std::min((off_t)run * bs, (off_t)req.dataLen - (off_t)i * bs);
+
+      ssize_t readSize = base->read(tmp);
+      for (size_t j = i; j < i + run; ++j) {
+        ssize_t len = readSize < 0 ? readSize : min(readSize, (ssize_t)bs);
+        ssize_t res = checkTag(req.data + j * bs, len, &tags[j * macBytes],
+                               first + j);
+        sizes[j] = res;
+        if (res < bs) {
+          return res >= 0;
         }
+        readSize -= bs;
       }
+      i += run;
     }
+    return true;
+  };
 
-    // now copy the data to the output buffer
-    readSize -= headerSize;
-    memcpy(req.data, tmp.data + headerSize, readSize);
-  } else {
-    VLOG(1) << "readSize " << readSize << " at offset " << req.offset;
-    if (readSize > 0) {
-      readSize = 0;
+  // a failed chunk left its error in sizes
+  forBlocks(count, readChunk);
+
+  ssize_t result = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (sizes[i] < 0) {
+      return sizes[i];
+    }
+    result += sizes[i];
+    if (sizes[i] < bs) {
+      break;
     }
   }
+  return result;
+}
 
-  MemoryPool::release(mb);
+bool MACFileIO::sealBlock(unsigned char *out, const unsigned char *data,
+                          int len) const {
+  int headerSize = macBytes + randBytes;
+  memset(out, 0, headerSize);
+  memcpy(out + headerSize, data, len);
+  if (randBytes > 0) {
+    if (!cipher->randomize(out + macBytes, randBytes, false)) {
+      return false;
+    }
+  }
 
-  return readSize;
+  if (macBytes > 0 && version < 4) {
+    // compute the mac (which includes the random data) and fill it in
+    uint64_t mac = this->mac(out + macBytes, len + randBytes);
+
+    for (int i = 0; i < macBytes; ++i) {
+      out[i] = mac & 0xff;
+      mac >>= 8;
+    }
+  }
+  return true;
 }
 
 ssize_t MACFileIO::writeOneBlock(const IORequest &req) {
+  if (tagExtent > 0) {
+    return writeTagged(req, false);
+  }
   int headerSize = macBytes + randBytes;
 
   int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
@@ -227,41 +570,189 @@ ssize_t MACFileIO::writeOneBlock(const IORequest &req) {
   newReq.data = mb.data;
   newReq.dataLen = headerSize + req.dataLen;
 
-  memset(newReq.data, 0, headerSize);
-  memcpy(newReq.data + headerSize, req.data, req.dataLen);
-  if (randBytes > 0) {
-    if (!cipher->randomize(newReq.data + macBytes, randBytes, false)) {
-      return -EBADMSG;
-    }
+  if (!sealBlock(newReq.data, req.data, req.dataLen)) {
+    MemoryPool::release(mb);
+    return -EBADMSG;
   }
 
-  if (macBytes > 0) {
-    // compute the mac (which includes the random data) and fill it in
-    uint64_t mac =
-        cipher->MAC_64(newReq.data + macBytes, req.dataLen + randBytes, key);
+  // now, we can let the next level have it..  newReq is our own copy, so
+  // it may be encoded in place.
+  ssize_t writeSize = base->writeInPlace(newReq);
 
-    for (int i = 0; i < macBytes; ++i) {
-      newReq.data[i] = mac & 0xff;
-      mac >>= 8;
+  MemoryPool::release(mb);
+
+  return writeSize;
+}
+
+/*
+    Whole blocks are sealed side by side in one buffer, which goes down as a
+    single write, instead of a write for each block.
+*/
+ssize_t MACFileIO::writeBlocks(const IORequest &req, bool inPlace) {
+  if (tagExtent > 0) {
+    return writeTagged(req, inPlace);
+  }
+  int headerSize = macBytes + randBytes;
+  if (headerSize == 0) {
+    return BlockFileIO::writeBlocks(req, inPlace);
+  }
+
+  int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
+  size_t count = req.dataLen / blockSize();
+
+  MemBlock mb = MemoryPool::allocate(count * bs);
+  bool sealed = forBlocks(count, [&](size_t first, size_t n) {
+    for (size_t i = first; i < first + n; ++i) {
+      if (!sealBlock(mb.data + i * bs, req.data + i * blockSize(),
+                     blockSize())) {
+        return false;
+      }
     }
+    return true;
+  });
+  if (!sealed) {
+    MemoryPool::release(mb);
+    return -EBADMSG;
   }
 
-  // now, we can let the next level have it..
-  ssize_t writeSize = base->write(newReq);
+  IORequest newReq;
+  newReq.offset = locWithHeader(req.offset, bs, headerSize);
+  newReq.data = mb.data;
+  newReq.dataLen = count * bs;
+  ssize_t writeSize = base->writeInPlace(newReq);
 
   MemoryPool::release(mb);
 
-  return writeSize;
+  return writeSize < 0 ? writeSize : (ssize_t)req.dataLen;
 }
 
-int MACFileIO::truncate(off_t size) {
+/*
+    The data goes down a group at a time, and then the tags, so that a tag
+    never gets ahead of its data.  The tags are computed before the data
+    may be encoded in place.
+*/
+ssize_t MACFileIO::writeTagged(const IORequest &req, bool inPlace) {
+  off_t bs = blockSize();
+  off_t first = req.offset / bs;
+  size_t count = std::max(roundUpDivide(req.dataLen, bs), (off_t)1);
+
+  std::vector<unsigned char> tags(count * macBytes);
+  forBlocks(count, [&](size_t begin, size_t n) {
+    for (size_t i = begin; i < begin + n; ++i) {
+      int len = (int)std::min(bs, (off_t)req.dataLen - (off_t)i * bs);
+      tagOf(req.data + i * bs, len, &tags[i * macBytes]);
+    }
+    return true;
+  });
+
+  for (size_t i = 0; i < count;) {
+    size_t run = groupRun(first + i, count - i);
+    IORequest tmp;
+    tmp.offset = dataLoc(first + i);
+    tmp.data = req.data + i * bs;
+    tmp.dataLen = std::min((off_t)run * bs, (off_t)req.dataLen - (off_t)i * bs);
+    ssize_t res = inPlace ? base->writeInPlace(tmp) : base->write(tmp);
+    if (res < 0) {
+      return res;
+    }
+    i += run;
+  }
+
+  int res = writeTags(first, count, tags.data());
+  return res < 0 ? res : (ssize_t)req.dataLen;
+}
+
+int MACFileIO::punchBlocks(off_t offset, size_t count) {
+  if (tagExtent > 0) {
+    // the tags stay, a zero block passes with holes allowed
+    off_t block = offset / blockSize();
+    while (count > 0) {
+      size_t n = groupRun(block, count);
+      int res = base->punchHole(dataLoc(block), (off_t)n * blockSize());
+      if (res < 0) {
+        return res;
+      }
+      block += n;
+      count -= n;
+    }
+    return 0;
+  }
+  int headerSize = macBytes + randBytes;
+  int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
+
+  // an all zero block, header included, passes the MAC check with holes
+  // allowed
+  return base->punchHole(locWithHeader(offset, bs, headerSize),
+                         (off_t)count * bs);
+}
+
+int MACFileIO::allocateBlocks(off_t offset, size_t count) {
+  if (tagExtent > 0) {
+    off_t block = offset / blockSize();
+    while (count > 0) {
+      size_t n = groupRun(block, count);
+      int res = base->allocate(tagLoc(block), (off_t)n * macBytes);
+      if (res == 0) {
+        res = base->allocate(dataLoc(block), (off_t)n * blockSize());
+      }
+      if (res < 0) {
+        return res;
+      }
+      block += n;
+      count -= n;
+    }
+    return 0;
+  }
   int headerSize = macBytes + randBytes;
   int bs = blockSize() + headerSize;  // ok, should clearly fit into an int
 
+  return base->allocate(locWithHeader(offset, bs, headerSize),
+                        (off_t)count * bs);
+}
+
+// holes of the lower file, as whole blocks with their headers
+off_t MACFileIO::nextData(off_t offset) const {
+  if (!_allowHoles) {
+    return offset;
+  }
+  int headerSize = macBytes + randBytes;
+  off_t userBs = blockSize();
+  off_t bs = userBs + headerSize;
+
+  off_t start = tagExtent > 0 ? dataLoc(offset / userBs) : offset / userBs * bs;
+  off_t data = base->nextData(start);
+  if (data <= start) {
+    return data < 0 ? data : offset;
+  }
+  off_t size = getSize();
+  if (size < 0) {
+    return size;
+  }
+  off_t upper = tagExtent > 0 ? sizeOver(data) / userBs * userBs
+                              : data / bs * userBs;
+  return std::max(offset, std::min(upper, size));
+}
+
+// Blocks of a file with tag extents aren't evenly spaced, such files are
+// taken to have no holes
+off_t MACFileIO::nextHole(off_t offset) const {
+  off_t size = getSize();
+  if (size < 0) {
+    return size;
+  }
+  if (!_allowHoles || tagExtent > 0) {
+    return std::max(offset, size);
+  }
+  off_t userBs = blockSize();
+  return nextHoleBlock(base.get(), offset, size, userBs,
+                       userBs + macBytes + randBytes, 0);
+}
+
+int MACFileIO::truncate(off_t size) {
   int res = BlockFileIO::truncateBase(size, nullptr);
 
   if (res == 0) {
-    res = base->truncate(locWithHeader(size, bs, headerSize));
+    res = base->truncate(lowerSize(size));
   }
 
   return res;
@@ -269,4 +760,19 @@ int MACFileIO::truncate(off_t size) {
 
 bool MACFileIO::isWritable() const { return base->isWritable(); }
 
+void MACFileIO::invalidate() {
+  invalidateCache();
+  base->invalidate();
+}
+
+void MACFileIO::releaseBuffers() {
+  BlockFileIO::releaseBuffers();
+  base->releaseBuffers();
+}
+
+void MACFileIO::setReadAhead(int kib) {
+  BlockFileIO::setReadAhead(kib);
+  base->setReadAhead(kib);
+}
+
 }  // namespace encfs
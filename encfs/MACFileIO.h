@@ -22,6 +22,7 @@
 #define _MACFileIO_incl_
 
 #include <memory>
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -37,7 +38,17 @@ class Cipher;
 class FileIO;
 struct IORequest;
 
-class MACFileIO : public BlockFileIO {
+/*
+    Checks a MAC of every block.  By default the MAC (and any random bytes)
+    lead each block, so a lower block holds a little less than the block
+    size of user data.  With blockMACExtents the MACs are kept apart, as
+    tags in extents of their own: the lower file is made of groups of a tag
+    extent followed by the data blocks whose tags it holds, about 1 MiB of
+    them, so the data blocks are whole and aligned, and the tags of a large
+    read come from one small read.  The tag blocks go through the lower
+    layer like any other, and are encrypted and cached with the data.
+*/
+class MACFileIO final : public BlockFileIO {
  public:
   /*
       If warnOnlyMode is enabled, then a MAC comparison failure will only
@@ -48,6 +59,9 @@ class MACFileIO : public BlockFileIO {
   MACFileIO();
   virtual ~MACFileIO();
 
+  // size of the file over a lower file of size bytes
+  static off_t upperSize(const FSConfigPtr &cfg, off_t size);
+
   virtual Interface interface() const;
 
   virtual void setFileName(const char *fileName);
@@ -55,23 +69,68 @@ class MACFileIO : public BlockFileIO {
   virtual bool setIV(uint64_t iv);
 
   virtual int open(int flags);
+  virtual int create(mode_t mode);
   virtual int getAttr(struct stat *stbuf) const;
   virtual off_t getSize() const;
 
   virtual int truncate(off_t size);
 
+  virtual off_t nextData(off_t offset) const;
+  virtual off_t nextHole(off_t offset) const;
+
   virtual bool isWritable() const;
+  virtual void invalidate();
+  virtual void releaseBuffers();
+  virtual void setReadAhead(int kib);
 
  private:
   virtual ssize_t readOneBlock(const IORequest &req) const;
+  virtual ssize_t readBlocks(const IORequest &req) const;
   virtual ssize_t writeOneBlock(const IORequest &req);
+  virtual ssize_t writeBlocks(const IORequest &req, bool inPlace);
+  virtual int punchBlocks(off_t offset, size_t count);
+  virtual int allocateBlocks(off_t offset, size_t count);
+
+  // MAC of a block, by the method of the volume's MAC version
+  uint64_t mac(const unsigned char *data, int len) const;
+  // the header and len bytes of data, as stored, into out
+  bool sealBlock(unsigned char *out, const unsigned char *data, int len) const;
+  ssize_t checkBlock(const unsigned char *data, ssize_t readSize,
+                     off_t offset) const;
+  // 0 if the MAC matches the stored one, else -EBADMSG unless warnOnly
+  int verify(uint64_t mac, const unsigned char *stored, off_t blockNum) const;
+
+  // the lower size of a file of size bytes, and back
+  off_t lowerSize(off_t size) const;
+  off_t sizeOver(off_t lowerSize) const;
+
+  // with tag extents: where the data and the tag of a block are kept
+  off_t dataLoc(off_t block) const;
+  off_t tagLoc(off_t block) const;
+  // blocks from block on in the same group, at most count
+  size_t groupRun(off_t block, size_t count) const;
+  void tagOf(const unsigned char *data, int len, unsigned char *tag) const;
+  ssize_t checkTag(const unsigned char *data, ssize_t readSize,
+                   const unsigned char *tag, off_t block) const;
+  // tags of count blocks from block on, those past the end as zeros
+  int readTags(off_t block, size_t count, unsigned char *tags) const;
+  int writeTags(off_t block, size_t count, const unsigned char *tags);
+  ssize_t readTagged(const IORequest &req) const;
+  ssize_t writeTagged(const IORequest &req, bool inPlace);
 
   std::shared_ptr<FileIO> base;
   std::shared_ptr<Cipher> cipher;
   CipherKey key;
   int macBytes;
   int randBytes;
+  int version;  // 2: MAC_64, 3: blockMAC_64, 4: sealed by the cipher
   bool warnOnly;
+  int tagExtent;  // blocks of tags in a group, 0 with MAC headers
+  int tagGroup;   // blocks of data in a group
+
+  // tag blocks are shared by the blocks of a group, which are written
+  // under separate range locks
+  mutable pthread_mutex_t tagMutex;
 };
 
 }  // namespace encfs
@@ -0,0 +1,229 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemFileIO.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+static Interface MemFileIO_iface("FileIO/Mem", 1, 0, 0);
+
+const size_t MemFileIO::ChunkSize;
+
+MemFileIO::Contents::Contents() : size(0), mode(S_IFREG | 0644) {
+  pthread_rwlock_init(&lock, nullptr);
+}
+
+MemFileIO::Contents::~Contents() { pthread_rwlock_destroy(&lock); }
+
+std::vector<unsigned char> &MemFileIO::Contents::chunk(off_t index) {
+  std::vector<unsigned char> &c = chunks[index];
+  if (c.empty()) {
+    c.resize(ChunkSize, 0);
+  }
+  return c;
+}
+
+void MemFileIO::Contents::zero(off_t offset, off_t len) {
+  off_t end = offset + len;
+  while (offset < end) {
+    off_t index = offset / ChunkSize;
+    off_t start = offset - index * ChunkSize;
+    off_t n = std::min<off_t>(ChunkSize - start, end - offset);
+    auto it = chunks.find(index);
+    if (it != chunks.end()) {
+      if (n == (off_t)ChunkSize) {
+        chunks.erase(it);
+      } else {
+        memset(it->second.data() + start, 0, n);
+      }
+    }
+    offset += n;
+  }
+}
+
+MemFileIO::MemFileIO(const std::string &fileName)
+    : MemFileIO(fileName, std::make_shared<Contents>()) {}
+
+MemFileIO::MemFileIO(const std::string &fileName,
+                     const std::shared_ptr<Contents> &contents)
+    : _name(fileName), _contents(contents), _open(false), _canWrite(false) {}
+
+MemFileIO::~MemFileIO() = default;
+
+Interface MemFileIO::interface() const { return MemFileIO_iface; }
+
+void MemFileIO::setFileName(const char *fileName) { _name = fileName; }
+
+const char *MemFileIO::getFileName() const { return _name.c_str(); }
+
+int MemFileIO::open(int flags) {
+  bool requestWrite = (((flags & O_RDWR) != 0) || ((flags & O_WRONLY) != 0));
+  _open = true;
+  _canWrite = _canWrite || requestWrite;
+  return 0;
+}
+
+int MemFileIO::create(mode_t mode) {
+  WriteLock lock(_contents->lock);
+  _contents->mode = S_IFREG | (mode & 07777);
+  _contents->size = 0;
+  _contents->chunks.clear();
+  _open = true;
+  _canWrite = true;
+  return 0;
+}
+
+int MemFileIO::getAttr(struct stat *stbuf) const {
+  ReadLock lock(_contents->lock);
+  memset(stbuf, 0, sizeof(*stbuf));
+  stbuf->st_mode = _contents->mode;
+  stbuf->st_nlink = 1;
+  stbuf->st_size = _contents->size;
+  stbuf->st_blksize = 4096;
+  stbuf->st_blocks = _contents->chunks.size() * (ChunkSize / 512);
+  return 0;
+}
+
+off_t MemFileIO::getSize() const {
+  ReadLock lock(_contents->lock);
+  return _contents->size;
+}
+
+ssize_t MemFileIO::read(const IORequest &req) const {
+  if (!_open) {
+    return -EBADF;
+  }
+  ReadLock lock(_contents->lock);
+  if (req.offset >= _contents->size) {
+    return 0;
+  }
+  size_t len = std::min<off_t>(req.dataLen, _contents->size - req.offset);
+
+  size_t done = 0;
+  while (done < len) {
+    off_t offset = req.offset + done;
+    off_t index = offset / ChunkSize;
+    size_t start = offset - index * ChunkSize;
+    size_t n = std::min(ChunkSize - start, len - done);
+    auto it = _contents->chunks.find(index);
+    if (it == _contents->chunks.end()) {
+      memset(req.data + done, 0, n);
+    } else {
+      memcpy(req.data + done, it->second.data() + start, n);
+    }
+    done += n;
+  }
+  return len;
+}
+
+ssize_t MemFileIO::write(const IORequest &req) {
+  if (!_open || !_canWrite) {
+    return -EBADF;
+  }
+  WriteLock lock(_contents->lock);
+  size_t done = 0;
+  while (done < req.dataLen) {
+    off_t offset = req.offset + done;
+    off_t index = offset / ChunkSize;
+    size_t start = offset - index * ChunkSize;
+    size_t n = std::min(ChunkSize - start, req.dataLen - done);
+    memcpy(_contents->chunk(index).data() + start, req.data + done, n);
+    done += n;
+  }
+  _contents->size =
+      std::max<off_t>(_contents->size, req.offset + req.dataLen);
+  return req.dataLen;
+}
+
+int MemFileIO::truncate(off_t size) {
+  if (size < 0) {
+    return -EINVAL;
+  }
+  WriteLock lock(_contents->lock);
+  if (size < _contents->size) {
+    // the tail of the last chunk has to read back as zeros if extended again
+    off_t end = ((_contents->size + ChunkSize - 1) / ChunkSize) * ChunkSize;
+    _contents->zero(size, end - size);
+  }
+  _contents->size = size;
+  return 0;
+}
+
+int MemFileIO::punchHole(off_t offset, off_t length) {
+  if (!_open || !_canWrite) {
+    return -EBADF;
+  }
+  WriteLock lock(_contents->lock);
+  _contents->zero(offset, length);
+  _contents->size = std::max(_contents->size, offset + length);
+  return 0;
+}
+
+int MemFileIO::allocate(off_t offset, off_t length) {
+  if (!_open || !_canWrite) {
+    return -EBADF;
+  }
+  WriteLock lock(_contents->lock);
+  for (off_t index = offset / ChunkSize;
+       index * (off_t)ChunkSize < offset + length; ++index) {
+    _contents->chunk(index);
+  }
+  return 0;
+}
+
+off_t MemFileIO::nextData(off_t offset) const {
+  if (!_open) {
+    return -EBADF;
+  }
+  ReadLock lock(_contents->lock);
+  auto it = _contents->chunks.lower_bound(offset / ChunkSize);
+  if (it == _contents->chunks.end()) {
+    return std::max(offset, _contents->size);
+  }
+  return std::max(offset, std::min(it->first * (off_t)ChunkSize,
+                                   _contents->size));
+}
+
+off_t MemFileIO::nextHole(off_t offset) const {
+  if (!_open) {
+    return -EBADF;
+  }
+  ReadLock lock(_contents->lock);
+  off_t chunk = offset / ChunkSize;
+  for (auto it = _contents->chunks.lower_bound(chunk);
+       it != _contents->chunks.end() && it->first == chunk; ++it) {
+    ++chunk;
+  }
+  return std::max(offset, std::min(chunk * (off_t)ChunkSize, _contents->size));
+}
+
+bool MemFileIO::isWritable() const { return _canWrite; }
+
+size_t MemFileIO::allocated() const {
+  ReadLock lock(_contents->lock);
+  return _contents->chunks.size() * ChunkSize;
+}
+
+}  // namespace encfs
@@ -0,0 +1,106 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MemFileIO_incl_
+#define _MemFileIO_incl_
+
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "FileIO.h"
+#include "Interface.h"
+
+namespace encfs {
+
+/*
+    A file held in memory, as the base of a FileIO stack in place of
+    RawFileIO, so that benchmarks and tests of the layers above measure the
+    layers and not the page cache or the disk.
+
+    The contents are kept in chunks of ChunkSize bytes, and chunks which were
+    never written (or were punched out) aren't kept at all and read back as
+    zeros, so files may be large and sparse.  Contents may be shared with
+    another MemFileIO, which then sees the same file, as a reopened RawFileIO
+    would.  Safe to use from several threads, as a file is.
+*/
+class MemFileIO : public FileIO {
+ public:
+  static const size_t ChunkSize = 4096;
+
+  struct Contents;
+
+  explicit MemFileIO(const std::string &fileName = std::string());
+  MemFileIO(const std::string &fileName,
+            const std::shared_ptr<Contents> &contents);
+  virtual ~MemFileIO();
+
+  virtual Interface interface() const;
+
+  virtual void setFileName(const char *fileName);
+  virtual const char *getFileName() const;
+
+  virtual int open(int flags);
+  virtual int create(mode_t mode);
+
+  virtual int getAttr(struct stat *stbuf) const;
+  virtual off_t getSize() const;
+
+  virtual ssize_t read(const IORequest &req) const;
+  virtual ssize_t write(const IORequest &req);
+
+  virtual int truncate(off_t size);
+  virtual int punchHole(off_t offset, off_t length);
+  virtual int allocate(off_t offset, off_t length);
+  virtual off_t nextData(off_t offset) const;
+  virtual off_t nextHole(off_t offset) const;
+
+  virtual bool isWritable() const;
+
+  std::shared_ptr<Contents> contents() const { return _contents; }
+
+  // bytes held in chunks, as st_blocks would count them
+  size_t allocated() const;
+
+ private:
+  std::string _name;
+  std::shared_ptr<Contents> _contents;
+  bool _open;
+  bool _canWrite;
+};
+
+struct MemFileIO::Contents {
+  Contents();
+  ~Contents();
+
+  mutable pthread_rwlock_t lock;
+  off_t size;
+  mode_t mode;
+  std::map<off_t, std::vector<unsigned char>> chunks;  // by index
+
+  // the chunk at index, created (zeroed) if missing.  Needs the write lock.
+  std::vector<unsigned char> &chunk(off_t index);
+  // zero len bytes from offset, dropping chunks which are all covered
+  void zero(off_t offset, off_t len);
+};
+
+}  // namespace encfs
+
+#endif
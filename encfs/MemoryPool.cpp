@@ -20,9 +20,11 @@
 
 #include "MemoryPool.h"
 
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
-#include <openssl/ossl_typ.h>
-#include <pthread.h>
+#include <new>
 
 #ifdef HAVE_VALGRIND_MEMCHECK_H
 #include <valgrind/memcheck.h>
@@ -31,66 +33,153 @@
 #define VALGRIND_MAKE_MEM_UNDEFINED(a, b)
 #endif
 
-#include <openssl/buffer.h>
-
-#define BLOCKDATA(BLOCK) (unsigned char *)(BLOCK)->data->data
-
 namespace encfs {
 
-struct BlockList {
-  BlockList *next;
-  int size;
-  BUF_MEM *data;
+/*
+    Blocks are grouped in power-of-two size classes.  Released blocks are
+    zeroed and then kept in a small per-thread cache for their class.  When a
+    thread's cache overflows, blocks go to a global lock-free stack for the
+    class, which other threads refill from.
+
+    The global stacks are only ever pushed to (one block or a chain) or
+    emptied as a whole with an atomic exchange, which keeps them free of the
+    ABA problem without needing tagged pointers.
+
+    Requests larger than the biggest class are not pooled.  The biggest
+    class holds a 1 MiB cipher block plus its MAC header or alignment slack;
+    fewer of those are cached per thread.  Only the bytes handed out are
+    zeroed on release, not the whole class.
+*/
+
+static const int MinClassShift = 8;  // smallest class is 256 bytes
+static const int NumClasses = 14;    // largest class is 2 MiB
+static const int ThreadCacheDepth = 8;
+static const int LargeCacheDepth = 2;  // for the largest class
+
+static inline int cacheDepth(int cls) {
+  return cls == NumClasses - 1 ? LargeCacheDepth : ThreadCacheDepth;
+}
+
+struct alignas(16) BlockHeader {
+  BlockHeader *next;
+  int sizeClass;  // -1 for unpooled blocks
+  int size;       // usable bytes following the header
+  int used;       // bytes asked for by the current or last allocation
 };
 
-static BlockList *allocBlock(int size) {
-  auto *block = new BlockList;
+static inline unsigned char *blockData(BlockHeader *block) {
+  return reinterpret_cast<unsigned char *>(block + 1);
+}
+
+static int sizeClass(int size) {
+  int cls = 0;
+  while ((1 << (cls + MinClassShift)) < size) {
+    if (++cls == NumClasses) {
+      return -1;
+    }
+  }
+  return cls;
+}
+
+static BlockHeader *allocBlock(int size, int cls) {
+  auto *block = (BlockHeader *)malloc(sizeof(BlockHeader) + size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  block->next = nullptr;
+  block->sizeClass = cls;
   block->size = size;
-  block->data = BUF_MEM_new();
-  BUF_MEM_grow(block->data, size);
-  VALGRIND_MAKE_MEM_NOACCESS(block->data->data, block->data->max);
+  block->used = size;
+  VALGRIND_MAKE_MEM_NOACCESS(blockData(block), size);
 
   return block;
 }
 
-static void freeBlock(BlockList *el) {
-  VALGRIND_MAKE_MEM_UNDEFINED(el->data->data, el->data->max);
-  BUF_MEM_free(el->data);
+static void freeBlock(BlockHeader *block) {
+  VALGRIND_MAKE_MEM_UNDEFINED(blockData(block), block->size);
+  free(block);
+}
 
-  delete el;
+static std::atomic<BlockHeader *> gOverflow[NumClasses];
+
+// push a chain of blocks, linked through next, onto the global stack
+static void pushChain(int cls, BlockHeader *first, BlockHeader *last) {
+  BlockHeader *head = gOverflow[cls].load(std::memory_order_relaxed);
+  do {
+    last->next = head;
+  } while (!gOverflow[cls].compare_exchange_weak(
+      head, first, std::memory_order_release, std::memory_order_relaxed));
 }
 
-static pthread_mutex_t gMPoolMutex = PTHREAD_MUTEX_INITIALIZER;
-static BlockList *gMemPool = nullptr;
+struct ThreadCache {
+  BlockHeader *blocks[NumClasses][ThreadCacheDepth];
+  int count[NumClasses];
 
-MemBlock MemoryPool::allocate(int size) {
-  pthread_mutex_lock(&gMPoolMutex);
-
-  BlockList *parent = nullptr;
-  BlockList *block = gMemPool;
-  // check if we already have a large enough block available..
-  while (block != nullptr && block->size < size) {
-    parent = block;
-    block = block->next;
-  }
+  ThreadCache() : count() {}
+  ~ThreadCache();
 
-  // unlink block from list
-  if (block != nullptr) {
-    if (parent == nullptr) {
-      gMemPool = block->next;
-    } else {
-      parent->next = block->next;
+  // hand all cached blocks over to the global stacks
+  void flush();
+};
+
+// set once the thread cache of this thread has been destroyed, so late
+// releases during thread exit go straight to the global stacks
+static thread_local bool tCacheGone = false;
+static thread_local ThreadCache tCache;
+
+void ThreadCache::flush() {
+  for (int cls = 0; cls < NumClasses; ++cls) {
+    for (int i = 0; i < count[cls]; ++i) {
+      BlockHeader *block = blocks[cls][i];
+      pushChain(cls, block, block);
     }
+    count[cls] = 0;
   }
-  pthread_mutex_unlock(&gMPoolMutex);
+}
 
-  if (block == nullptr) {
-    block = allocBlock(size);
+ThreadCache::~ThreadCache() {
+  flush();
+  tCacheGone = true;
+}
+
+MemBlock MemoryPool::allocate(int size) {
+  int cls = sizeClass(size);
+
+  BlockHeader *block = nullptr;
+  if (cls < 0) {
+    block = allocBlock(size, cls);
+  } else if (!tCacheGone && tCache.count[cls] > 0) {
+    block = tCache.blocks[cls][--tCache.count[cls]];
+  } else {
+    // take the whole global stack, keep what fits in our cache and give the
+    // rest back
+    BlockHeader *chain =
+        gOverflow[cls].exchange(nullptr, std::memory_order_acquire);
+    if (chain != nullptr) {
+      block = chain;
+      chain = chain->next;
+      if (!tCacheGone) {
+        while (chain != nullptr && tCache.count[cls] < cacheDepth(cls)) {
+          tCache.blocks[cls][tCache.count[cls]++] = chain;
+          chain = chain->next;
+        }
+      }
+      if (chain != nullptr) {
+        BlockHeader *last = chain;
+        while (last->next != nullptr) {
+          last = last->next;
+        }
+        pushChain(cls, chain, last);
+      }
+    } else {
+      block = allocBlock(1 << (cls + MinClassShift), cls);
+    }
   }
   block->next = nullptr;
+  block->used = size;
 
   MemBlock result;
-  result.data = BLOCKDATA(block);
+  result.data = blockData(block);
   result.internalData = block;
 
   VALGRIND_MAKE_MEM_UNDEFINED(result.data, size);
@@ -98,35 +187,45 @@ MemBlock MemoryPool::allocate(int size) {
   return result;
 }
 
-void MemoryPool::release(const MemBlock &mb) {
-  pthread_mutex_lock(&gMPoolMutex);
+MemBlock MemoryPool::allocateAligned(int size, int alignment) {
+  MemBlock result = allocate(size + alignment - 1);
+  uintptr_t data = (uintptr_t)result.data;
+  data = (data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  result.data = (unsigned char *)data;
+  return result;
+}
 
-  auto *block = (BlockList *)mb.internalData;
+void MemoryPool::release(const MemBlock &mb) {
+  auto *block = (BlockHeader *)mb.internalData;
 
   // just to be sure there's nothing important left in buffers..
-  VALGRIND_MAKE_MEM_UNDEFINED(block->data->data, block->size);
-  memset(BLOCKDATA(block), 0, block->size);
-  VALGRIND_MAKE_MEM_NOACCESS(block->data->data, block->data->max);
-
-  block->next = gMemPool;
-  gMemPool = block;
+  VALGRIND_MAKE_MEM_UNDEFINED(blockData(block), block->used);
+  memset(blockData(block), 0, block->used);
+  VALGRIND_MAKE_MEM_NOACCESS(blockData(block), block->size);
 
-  pthread_mutex_unlock(&gMPoolMutex);
+  int cls = block->sizeClass;
+  if (cls < 0) {
+    freeBlock(block);
+  } else if (!tCacheGone && tCache.count[cls] < cacheDepth(cls)) {
+    tCache.blocks[cls][tCache.count[cls]++] = block;
+  } else {
+    pushChain(cls, block, block);
+  }
 }
 
 void MemoryPool::destroyAll() {
-  pthread_mutex_lock(&gMPoolMutex);
-
-  BlockList *block = gMemPool;
-  gMemPool = nullptr;
-
-  pthread_mutex_unlock(&gMPoolMutex);
-
-  while (block != nullptr) {
-    BlockList *next = block->next;
+  if (!tCacheGone) {
+    tCache.flush();
+  }
 
-    freeBlock(block);
-    block = next;
+  for (int cls = 0; cls < NumClasses; ++cls) {
+    BlockHeader *block =
+        gOverflow[cls].exchange(nullptr, std::memory_order_acquire);
+    while (block != nullptr) {
+      BlockHeader *next = block->next;
+      freeBlock(block);
+      block = next;
+    }
   }
 }
 
@@ -36,6 +36,13 @@ inline MemBlock::MemBlock() : data(0), internalData(0) {}
 /*
     Memory Pool for fixed sized objects.
 
+    Blocks are zeroed on release.  allocate() and release() take no locks;
+    blocks are cached per thread and shared through lock-free stacks.
+    destroyAll() frees what is pooled globally and in the calling thread's
+    cache; blocks cached by other running threads are kept.  It is safe to
+    call at any time, and is called whenever memory runs short (see
+    MemoryPressure).
+
     Usage:
     MemBlock mb = MemoryPool::allocate( size );
     // do things with storage in   mb.data
@@ -44,6 +51,8 @@ inline MemBlock::MemBlock() : data(0), internalData(0) {}
 */
 namespace MemoryPool {
 MemBlock allocate(int size);
+// data aligned to alignment, a power of two, e.g. for O_DIRECT
+MemBlock allocateAligned(int size, int alignment);
 void release(const MemBlock &el);
 void destroyAll();
 }
@@ -0,0 +1,265 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryPressure.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "Error.h"
+#include "IdleMonitor.h"
+#include "MemoryPool.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+const double MemoryPressure::MinShare = 1.0 / 16;
+
+// a trigger on tasks stalled for memory 150 ms out of 2 s; unprivileged
+// processes may only ask for windows of whole multiples of 2 s
+static const char TriggerSpec[] = "some 150000 2000000";
+// without a trigger, the file is read this often, and an average share of
+// stalled time above this many percent counts as pressure
+static const int PollMs = 2000;
+static const double AvgLimit = 10.0;
+
+static pthread_mutex_t sharedMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::weak_ptr<MemoryPressure> sharedMonitor;
+
+std::shared_ptr<MemoryPressure> MemoryPressure::shared() {
+  Lock lock(sharedMutex);
+  std::shared_ptr<MemoryPressure> monitor = sharedMonitor.lock();
+  if (!monitor) {
+    monitor = std::make_shared<MemoryPressure>();
+    sharedMonitor = monitor;
+  }
+  return monitor;
+}
+
+// the pressure file of our cgroup under cgroup v2, else the system's
+static std::string pressureFile() {
+  std::ifstream in("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 3, "0::") == 0) {
+      std::string path = "/sys/fs/cgroup" + line.substr(3);
+      if (path.back() != '/') {
+        path += '/';
+      }
+      path += "memory.pressure";
+      if (access(path.c_str(), R_OK) == 0) {
+        return path;
+      }
+    }
+  }
+  return "/proc/pressure/memory";
+}
+
+// the "some avg10" of a pressure file, -1 if it can't be read
+static double stalledPercent(int fd) {
+  char buf[256];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return -1;
+  }
+  buf[len] = '\0';
+  const char *avg = strstr(buf, "avg10=");
+  return avg == nullptr ? -1 : strtod(avg + 6, nullptr);
+}
+
+MemoryPressure::MemoryPressure()
+    : _pid(0), _fd(-1), _trigger(false), _share(1), _nextId(1) {
+  _wake[0] = _wake[1] = -1;
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+MemoryPressure::~MemoryPressure() {
+  stop();
+  pthread_mutex_destroy(&_mutex);
+}
+
+// stop the thread if it runs in this process, and close what it used
+void MemoryPressure::stop() {
+  if (_pid == getpid()) {
+    char c = 0;
+    if (write(_wake[1], &c, 1) == 1) {
+      pthread_join(_thread, nullptr);
+    }
+  }
+  if (_pid != 0) {
+    close(_fd);
+    close(_wake[0]);
+    close(_wake[1]);
+    _pid = 0;
+  }
+}
+
+bool MemoryPressure::start() {
+  // not _mutex, which the thread takes and stop() waits for
+  Lock lock(sharedMutex);
+  if (_pid == getpid()) {
+    return true;
+  }
+  // the thread of a parent process doesn't exist in a forked child
+  stop();
+
+  std::string path = pressureFile();
+  int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  bool trigger =
+      fd >= 0 && write(fd, TriggerSpec, sizeof(TriggerSpec)) > 0;
+  if (!trigger) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+  if (fd < 0 || (!trigger && stalledPercent(fd) < 0)) {
+    VLOG(1) << "no memory pressure information in " << path;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  if (pipe2(_wake, O_CLOEXEC) != 0) {
+    close(fd);
+    return false;
+  }
+
+  _fd = fd;
+  _trigger = trigger;
+  _pid = getpid();
+  int res = pthread_create(&_thread, nullptr, MemoryPressure::run, this);
+  if (res != 0) {
+    RLOG(ERROR) << "error starting memory pressure thread, res = " << res;
+    close(_fd);
+    close(_wake[0]);
+    close(_wake[1]);
+    _pid = 0;
+    return false;
+  }
+  VLOG(1) << "watching memory pressure in " << path
+          << (trigger ? "" : " (polled)");
+  return true;
+}
+
+void *MemoryPressure::run(void *arg) {
+  static_cast<MemoryPressure *>(arg)->loop();
+  return nullptr;
+}
+
+void MemoryPressure::loop() {
+  int64_t lastStall = IdleMonitor::now();
+  for (;;) {
+    struct pollfd fds[2];
+    fds[0].fd = _wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = _fd;
+    fds[1].events = _trigger ? POLLPRI : 0;
+    fds[0].revents = fds[1].revents = 0;
+
+    int res = poll(fds, 2, _trigger ? RelaxMs : PollMs);
+    if (res < 0 && errno != EINTR) {
+      RLOG(WARNING) << "memory pressure poll failed: " << strerror(errno);
+      return;
+    }
+    if (fds[0].revents != 0) {
+      return;
+    }
+
+    bool stalled;
+    if (_trigger) {
+      if ((fds[1].revents & POLLERR) != 0) {
+        // the cgroup went away
+        return;
+      }
+      stalled = (fds[1].revents & POLLPRI) != 0;
+    } else {
+      stalled = stalledPercent(_fd) > AvgLimit;
+    }
+
+    int64_t now = IdleMonitor::now();
+    if (stalled) {
+      lastStall = now;
+      pressure();
+    } else if (now - lastStall >= RelaxMs && share() < 1) {
+      lastStall = now;
+      relax();
+    }
+  }
+}
+
+double MemoryPressure::share() const {
+  Lock lock(_mutex);
+  return _share;
+}
+
+void MemoryPressure::pressure() {
+  {
+    Lock lock(_mutex);
+    setShare(std::max(_share / 2, MinShare));
+  }
+  // give back what is pooled, and what the heap holds unused
+  MemoryPool::destroyAll();
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+void MemoryPressure::relax() {
+  Lock lock(_mutex);
+  setShare(std::min(_share * 2, 1.0));
+}
+
+// caller holds _mutex
+void MemoryPressure::setShare(double share) {
+  if (share == _share) {
+    return;
+  }
+  VLOG(1) << "memory pressure: caches may use " << share * 100
+          << "% of their capacity";
+  _share = share;
+  for (auto &watcher : _watchers) {
+    watcher.second(share);
+  }
+}
+
+std::shared_ptr<void> MemoryPressure::watch(Watcher watcher) {
+  Lock lock(_mutex);
+  uint64_t id = _nextId++;
+  if (_share < 1) {
+    watcher(_share);
+  }
+  _watchers[id] = std::move(watcher);
+  return std::shared_ptr<void>(nullptr,
+                               [this, id](void *) { unwatch(id); });
+}
+
+void MemoryPressure::unwatch(uint64_t id) {
+  Lock lock(_mutex);
+  _watchers.erase(id);
+}
+
+}  // namespace encfs
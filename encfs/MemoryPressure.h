@@ -0,0 +1,103 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MemoryPressure_incl_
+#define _MemoryPressure_incl_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+
+namespace encfs {
+
+/*
+    Shrinks the caches while the system, or the cgroup encfs runs in, is
+    short of memory, and lets them grow back once it isn't.
+
+    The monitor thread watches the memory pressure stall information (PSI)
+    of the cgroup, if it has any (cgroup v2, which also counts the stalls
+    of throttling at memory.high), or of the whole system otherwise.  It
+    asks the kernel for a trigger on stalls, and polls the ten second
+    average if it can't have one.  Every time pressure is seen, the share
+    of their capacity the caches may use is halved, down to MinShare, and
+    the pooled buffers of MemoryPool are freed.  After RelaxMs without
+    pressure the share doubles again, up to the whole capacity.
+
+    Caches watch() the share; their callbacks run on the monitor thread,
+    one after another, and a watch is only gone once no callback of it is
+    running any more.  One monitor serves the whole process (shared()), and
+    its thread is only started by start(), again if the process was forked
+    since, as encfs sets up the file system before fuse daemonizes.
+*/
+class MemoryPressure {
+ public:
+  using Watcher = std::function<void(double share)>;
+
+  static const double MinShare;
+  static const int RelaxMs = 10000;
+
+  // the monitor of the process
+  static std::shared_ptr<MemoryPressure> shared();
+
+  MemoryPressure();
+  ~MemoryPressure();
+
+  MemoryPressure(const MemoryPressure &src) = delete;
+  MemoryPressure &operator=(const MemoryPressure &src) = delete;
+
+  // Start watching, unless already watching in this process.  Returns
+  // false if the kernel has no pressure information.
+  bool start();
+
+  // watcher is called with the share whenever it changes, until the
+  // returned handle is let go
+  std::shared_ptr<void> watch(Watcher watcher);
+
+  // share of their capacity the caches may use now, (0, 1]
+  double share() const;
+
+  // what the monitor thread does when it sees pressure, or none for
+  // RelaxMs
+  void pressure();
+  void relax();
+
+ private:
+  static void *run(void *arg);
+  void loop();
+  void stop();
+  void setShare(double share);
+  void unwatch(uint64_t id);
+
+  pid_t _pid;  // process which started _thread
+  pthread_t _thread;
+  int _fd;       // the pressure file
+  bool _trigger;  // _fd has a trigger, rather than being polled
+  int _wake[2];  // pipe to stop the thread
+
+  mutable pthread_mutex_t _mutex;
+  double _share;
+  uint64_t _nextId;
+  std::map<uint64_t, Watcher> _watchers;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,163 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MultiCBC.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENCFS_MULTICBC_X86
+#include <immintrin.h>
+#endif
+
+namespace encfs {
+
+const int MultiCBC::Lanes;
+
+#if defined(ENCFS_MULTICBC_X86)
+
+#define AESNI __attribute__((target("aes")))
+
+// SubWord(w) and SubWord(RotWord(w)), from the S-box of the AES unit
+AESNI static void subWord(uint32_t w, uint32_t *sub, uint32_t *subRot) {
+  __m128i x = _mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, (int)w, 0), 0);
+  *sub = (uint32_t)_mm_cvtsi128_si32(x);
+  *subRot = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x, 4));
+}
+
+// the key expansion of FIPS-197, words kept in memory order
+AESNI static void expandKey(const unsigned char *key, int keyLen,
+                            unsigned char *roundKeys, int rounds) {
+  const int nk = keyLen / 4;
+  const int words = 4 * (rounds + 1);
+  uint32_t w[4 * 15];
+  memcpy(w, key, keyLen);
+  uint32_t rcon = 1;
+  for (int i = nk; i < words; ++i) {
+    uint32_t t = w[i - 1];
+    uint32_t sub, subRot;
+    if (i % nk == 0) {
+      subWord(t, &sub, &subRot);
+      t = subRot ^ rcon;
+      rcon = (rcon << 1) ^ ((rcon & 0x80) != 0 ? 0x11b : 0);
+    } else if (nk > 6 && i % nk == 4) {
+      subWord(t, &sub, &subRot);
+      t = sub;
+    }
+    w[i] = w[i - nk] ^ t;
+  }
+  memcpy(roundKeys, w, words * 4);
+  memset(w, 0, sizeof(w));
+}
+
+// each step takes the next 16 bytes of all N chains through every round
+template <int N>
+AESNI static void encryptLanes(const unsigned char *roundKeys, int rounds,
+                               unsigned char *buf, int size,
+                               const unsigned char (*ivs)[16]) {
+  const __m128i *rk = (const __m128i *)roundKeys;
+  __m128i c[N];
+  for (int l = 0; l < N; ++l) {
+    c[l] = _mm_loadu_si128((const __m128i *)ivs[l]);
+  }
+  for (int off = 0; off < size; off += 16) {
+    __m128i k = _mm_load_si128(rk);
+    for (int l = 0; l < N; ++l) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(buf + l * size + off));
+      c[l] = _mm_xor_si128(_mm_xor_si128(c[l], p), k);
+    }
+    for (int r = 1; r < rounds; ++r) {
+      k = _mm_load_si128(rk + r);
+      for (int l = 0; l < N; ++l) {
+        c[l] = _mm_aesenc_si128(c[l], k);
+      }
+    }
+    k = _mm_load_si128(rk + rounds);
+    for (int l = 0; l < N; ++l) {
+      c[l] = _mm_aesenclast_si128(c[l], k);
+      _mm_storeu_si128((__m128i *)(buf + l * size + off), c[l]);
+    }
+  }
+}
+
+#endif
+
+std::unique_ptr<MultiCBC> MultiCBC::create(const unsigned char *key,
+                                           int keyLen) {
+#if defined(ENCFS_MULTICBC_X86)
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("aes") ||
+      (keyLen != 16 && keyLen != 24 && keyLen != 32)) {
+    return nullptr;
+  }
+  std::unique_ptr<MultiCBC> cbc(new MultiCBC());
+  cbc->_rounds = keyLen / 4 + 6;
+  expandKey(key, keyLen, cbc->_roundKeys, cbc->_rounds);
+  return cbc;
+#else
+  (void)key;
+  (void)keyLen;
+  return nullptr;
+#endif
+}
+
+MultiCBC::~MultiCBC() {
+  volatile unsigned char *p = _roundKeys;
+  for (size_t i = 0; i < sizeof(_roundKeys); ++i) {
+    p[i] = 0;
+  }
+}
+
+void MultiCBC::encrypt(unsigned char *buf, int size,
+                       const unsigned char (*ivs)[16], int count) const {
+#if defined(ENCFS_MULTICBC_X86)
+  switch (count) {
+    case 1:
+      encryptLanes<1>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    case 2:
+      encryptLanes<2>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    case 3:
+      encryptLanes<3>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    case 4:
+      encryptLanes<4>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    case 5:
+      encryptLanes<5>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    case 6:
+      encryptLanes<6>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    case 7:
+      encryptLanes<7>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+    default:
+      encryptLanes<8>(_roundKeys, _rounds, buf, size, ivs);
+      break;
+  }
+#else
+  (void)buf;
+  (void)size;
+  (void)ivs;
+  (void)count;
+#endif
+}
+
+}  // namespace encfs
@@ -0,0 +1,64 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MultiCBC_incl_
+#define _MultiCBC_incl_
+
+#include <memory>
+
+namespace encfs {
+
+/*
+    AES-CBC encryption of several independent chains at once.
+
+    Within a chain, CBC encryption can't start on a block before the one
+    ahead of it is done, so a single chain keeps the AES unit of the CPU
+    waiting for most of each instruction's latency.  File blocks each have
+    their own IV, so up to Lanes of them are encrypted in lockstep, one AES
+    round of every chain after the other, which fills the pipeline.  The
+    result is the same as that of OpenSSL's CBC mode on each block.
+
+    Only on x86-64 CPUs with the AES instructions; create() returns nullptr
+    elsewhere.
+*/
+class MultiCBC {
+ public:
+  static const int Lanes = 8;
+
+  // keyLen is 16, 24 or 32 bytes
+  static std::unique_ptr<MultiCBC> create(const unsigned char *key,
+                                          int keyLen);
+  ~MultiCBC();
+
+  MultiCBC(const MultiCBC &src) = delete;
+  MultiCBC &operator=(const MultiCBC &src) = delete;
+
+  // Encrypts count (at most Lanes) chains of size bytes, a multiple of 16,
+  // which follow each other in buf, chain i with ivs[i], in place.
+  void encrypt(unsigned char *buf, int size, const unsigned char (*ivs)[16],
+               int count) const;
+
+ private:
+  MultiCBC() = default;
+
+  int _rounds;
+  alignas(16) unsigned char _roundKeys[15 * 16];
+};
+
+}  // namespace encfs
+
+#endif
@@ -23,11 +23,21 @@
 
 #include <pthread.h>
 
+#include "Stats.h"
+
 namespace encfs {
 
+/*
+    RAII holds of pthread locks.  Given a lock site (a Stats::Op from
+    FileNodeLock on), the time spent waiting is counted if the lock was
+    held by somebody else, and with --stats the time from acquisition to
+    release in the site's hold histogram (see Stats::holdOf).  With stats
+    off a site costs an uncontended trylock and a flag test.
+*/
 class Lock {
  public:
   Lock(pthread_mutex_t &mutex);
+  Lock(pthread_mutex_t &mutex, Stats::Op site);
   ~Lock();
 
   // leave the lock as it is.  When the Lock wrapper is destroyed, it
@@ -39,18 +49,116 @@ class Lock {
   Lock &operator=(const Lock &src);  // not allowed
 
   pthread_mutex_t *_mutex;
+  Stats::Op _site;
+  uint64_t _held;  // when it was taken, if it is timed
 };
 
-inline Lock::Lock(pthread_mutex_t &mutex) : _mutex(&mutex) {
+// start of a timed hold, or 0
+inline uint64_t lockTaken() { return Stats::enabled() ? Stats::now() : 0; }
+
+inline void lockReleased(Stats::Op site, uint64_t held) {
+  if (held != 0) {
+    Stats::record(Stats::holdOf(site), Stats::now() - held);
+  }
+}
+
+inline Lock::Lock(pthread_mutex_t &mutex)
+    : _mutex(&mutex), _site(Stats::OpCount), _held(0) {
   pthread_mutex_lock(_mutex);
 }
 
+inline Lock::Lock(pthread_mutex_t &mutex, Stats::Op site)
+    : _mutex(&mutex), _site(site) {
+  if (pthread_mutex_trylock(_mutex) != 0) {
+    Stats::Timer wait(site);
+    pthread_mutex_lock(_mutex);
+  }
+  _held = lockTaken();
+}
+
 inline Lock::~Lock() {
-  if (_mutex) pthread_mutex_unlock(_mutex);
+  if (_mutex) {
+    lockReleased(_site, _held);
+    pthread_mutex_unlock(_mutex);
+  }
 }
 
 inline void Lock::leave() { _mutex = 0; }
 
+// Lets go of a mutex the caller holds, for the lifetime of the Unlock.  It
+// is taken back on the way out, also when an exception leaves the scope,
+// so that the Lock holding it can release it as usual.
+class Unlock {
+ public:
+  explicit Unlock(pthread_mutex_t &mutex) : _mutex(&mutex) {
+    pthread_mutex_unlock(_mutex);
+  }
+  ~Unlock() { pthread_mutex_lock(_mutex); }
+
+ private:
+  Unlock(const Unlock &src);             // not allowed
+  Unlock &operator=(const Unlock &src);  // not allowed
+
+  pthread_mutex_t *_mutex;
+};
+
+// shared and exclusive holds of a pthread rwlock
+class ReadLock {
+ public:
+  ReadLock(pthread_rwlock_t &lock)
+      : _lock(&lock), _site(Stats::OpCount), _held(0) {
+    pthread_rwlock_rdlock(_lock);
+  }
+  ReadLock(pthread_rwlock_t &lock, Stats::Op site)
+      : _lock(&lock), _site(site) {
+    if (pthread_rwlock_tryrdlock(_lock) != 0) {
+      Stats::Timer wait(site);
+      pthread_rwlock_rdlock(_lock);
+    }
+    _held = lockTaken();
+  }
+  ~ReadLock() {
+    lockReleased(_site, _held);
+    pthread_rwlock_unlock(_lock);
+  }
+
+ private:
+  ReadLock(const ReadLock &src);             // not allowed
+  ReadLock &operator=(const ReadLock &src);  // not allowed
+
+  pthread_rwlock_t *_lock;
+  Stats::Op _site;
+  uint64_t _held;
+};
+
+class WriteLock {
+ public:
+  WriteLock(pthread_rwlock_t &lock)
+      : _lock(&lock), _site(Stats::OpCount), _held(0) {
+    pthread_rwlock_wrlock(_lock);
+  }
+  WriteLock(pthread_rwlock_t &lock, Stats::Op site)
+      : _lock(&lock), _site(site) {
+    if (pthread_rwlock_trywrlock(_lock) != 0) {
+      Stats::Timer wait(site);
+      pthread_rwlock_wrlock(_lock);
+    }
+    _held = lockTaken();
+  }
+  ~WriteLock() {
+    lockReleased(_site, _held);
+    pthread_rwlock_unlock(_lock);
+  }
+
+ private:
+  WriteLock(const WriteLock &src);             // not allowed
+  WriteLock &operator=(const WriteLock &src);  // not allowed
+
+  pthread_rwlock_t *_lock;
+  Stats::Op _site;
+  uint64_t _held;
+};
+
 }  // namespace encfs
 
 #endif
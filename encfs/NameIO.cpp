@@ -21,18 +21,22 @@
 #include "NameIO.h"
 
 #include "easylogging++.h"
+#include <cerrno>
+#include <climits>
 #include <cstring>
 // for static build.  Need to reference the modules which are registered at
 // run-time, to ensure that the linker doesn't optimize them away.
 #include <iostream>
 #include <map>
 #include <utility>
+#include <vector>
 
 #include "BlockNameIO.h"
 #include "CipherKey.h"
 #include "Error.h"
 #include "Interface.h"
 #include "NullNameIO.h"
+#include "Stats.h"
 #include "StreamNameIO.h"
 
 using namespace std;
@@ -139,16 +143,31 @@ void NameIO::setReverseEncryption(bool enable) { reverseEncryption = enable; }
 
 bool NameIO::getReverseEncryption() const { return reverseEncryption; }
 
-std::string NameIO::recodePath(
-    const char *path, int (NameIO::*_length)(int) const,
+int NameIO::recodePath(
+    const char *path, char *out, size_t cap, int (NameIO::*_length)(int) const,
     int (NameIO::*_code)(const char *, int, uint64_t *, char *, int) const,
     uint64_t *iv) const {
-  string output;
+  size_t outLen = 0;
+
+  if (identity()) {
+    while (*path == '/') {
+      ++path;
+    }
+    outLen = strlen(path);
+    if (outLen >= cap) {
+      return -ENAMETOOLONG;
+    }
+    memcpy(out, path, outLen + 1);
+    return (int)outLen;
+  }
 
   while (*path != 0) {
     if (*path == '/') {
-      if (!output.empty()) {  // don't start the string with '/'
-        output += '/';
+      if (outLen > 0) {  // don't start the string with '/'
+        if (outLen + 1 >= cap) {
+          return -ENAMETOOLONG;
+        }
+        out[outLen++] = '/';
       }
       ++path;
     } else {
@@ -158,7 +177,11 @@ std::string NameIO::recodePath(
 
       // at this point we know that len > 0
       if (isDotFile && (path[len - 1] == '.') && (len <= 2)) {
-        output.append(len, '.');  // append [len] copies of '.'
+        if (outLen + len >= cap) {
+          return -ENAMETOOLONG;
+        }
+        memset(out + outLen, '.', len);
+        outLen += len;
         path += len;
         continue;
       }
@@ -168,24 +191,52 @@ std::string NameIO::recodePath(
       if (approxLen <= 0) {
         throw Error("Filename too small to decode");
       }
-      int bufSize = 0;
-
-      BUFFER_INIT_S(codeBuf, 32, (unsigned int)approxLen + 1, bufSize)
+      if (outLen + approxLen >= cap) {
+        return -ENAMETOOLONG;
+      }
 
-      // code the name
-      int codedLen = (this->*_code)(path, len, iv, codeBuf, bufSize);
+      // code the name directly into the output
+      int codedLen =
+          (this->*_code)(path, len, iv, out + outLen, (int)(cap - outLen));
       rAssert(codedLen <= approxLen);
-      rAssert(codeBuf[codedLen] == '\0');
+      outLen += codedLen;
       path += len;
+    }
+  }
 
-      // append result to string
-      output += (char *)codeBuf;
+  out[outLen] = '\0';
+  return (int)outLen;
+}
 
-      BUFFER_RESET(codeBuf)
+std::string NameIO::recodePath(
+    const char *path, int (NameIO::*_length)(int) const,
+    int (NameIO::*_code)(const char *, int, uint64_t *, char *, int) const,
+    uint64_t *iv) const {
+  if (identity()) {
+    while (*path == '/') {
+      ++path;
     }
+    return std::string(path);
+  }
+
+  char buf[PATH_MAX];
+  uint64_t startIV = iv != nullptr ? *iv : 0;
+  int len = recodePath(path, buf, sizeof(buf), _length, _code, iv);
+  if (len >= 0) {
+    return std::string(buf, len);
   }
 
-  return output;
+  // longer than any path the system accepts, but the name may still be
+  // used as a component of some other path
+  std::vector<char> longBuf(sizeof(buf));
+  do {
+    longBuf.resize(longBuf.size() * 2);
+    if (iv != nullptr) {
+      *iv = startIV;
+    }
+    len = recodePath(path, longBuf.data(), longBuf.size(), _length, _code, iv);
+  } while (len < 0);
+  return std::string(longBuf.data(), len);
 }
 
 std::string NameIO::encodePath(const char *plaintextPath) const {
@@ -216,11 +267,53 @@ std::string NameIO::_decodePath(const char *cipherPath, uint64_t *iv) const {
                     iv);
 }
 
+int NameIO::_encodePathInto(const char *plaintextPath, char *out, size_t cap,
+                            uint64_t *iv) const {
+  if (!chainedNameIV) {
+    iv = nullptr;
+  }
+  return recodePath(plaintextPath, out, cap, &NameIO::maxEncodedNameLen,
+                    &NameIO::encodeName, iv);
+}
+
+int NameIO::_decodePathInto(const char *cipherPath, char *out, size_t cap,
+                            uint64_t *iv) const {
+  if (!chainedNameIV) {
+    iv = nullptr;
+  }
+  return recodePath(cipherPath, out, cap, &NameIO::maxDecodedNameLen,
+                    &NameIO::decodeName, iv);
+}
+
+int NameIO::encodePathInto(const char *path, char *out, size_t cap,
+                           uint64_t *iv) const {
+  Stats::Timer timer(Stats::NameEncode);
+  uint64_t localIV = 0;
+  if (iv == nullptr) {
+    iv = &localIV;
+  }
+  return getReverseEncryption() ? _decodePathInto(path, out, cap, iv)
+                                : _encodePathInto(path, out, cap, iv);
+}
+
+int NameIO::decodePathInto(const char *path, char *out, size_t cap,
+                           uint64_t *iv) const {
+  Stats::Timer timer(Stats::NameDecode);
+  uint64_t localIV = 0;
+  if (iv == nullptr) {
+    iv = &localIV;
+  }
+  return getReverseEncryption() ? _encodePathInto(path, out, cap, iv)
+                                : _decodePathInto(path, out, cap, iv);
+}
+
 std::string NameIO::encodePath(const char *path, uint64_t *iv) const {
+  Stats::Timer timer(Stats::NameEncode);
   return getReverseEncryption() ? _decodePath(path, iv) : _encodePath(path, iv);
 }
 
 std::string NameIO::decodePath(const char *path, uint64_t *iv) const {
+  Stats::Timer timer(Stats::NameDecode);
   return getReverseEncryption() ? _encodePath(path, iv) : _decodePath(path, iv);
 }
 
@@ -238,7 +331,7 @@ std::string NameIO::_encodeName(const char *plaintextName, int length) const {
   int approxLen = maxEncodedNameLen(length);
   int bufSize = 0;
 
-  BUFFER_INIT_S(codeBuf, 32, (unsigned int)approxLen + 1, bufSize)
+  BUFFER_INIT_S(codeBuf, NAME_MAX + 1, (unsigned int)approxLen + 1, bufSize)
 
   // code the name
   int codedLen = encodeName(plaintextName, length, nullptr, codeBuf, bufSize);
@@ -257,7 +350,7 @@ std::string NameIO::_decodeName(const char *encodedName, int length) const {
   int approxLen = maxDecodedNameLen(length);
   int bufSize = 0;
 
-  BUFFER_INIT_S(codeBuf, 32, (unsigned int)approxLen + 1, bufSize)
+  BUFFER_INIT_S(codeBuf, NAME_MAX + 1, (unsigned int)approxLen + 1, bufSize)
 
   // code the name
   int codedLen = decodeName(encodedName, length, nullptr, codeBuf, bufSize);
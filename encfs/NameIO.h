@@ -77,6 +77,20 @@ class NameIO {
   std::string encodePath(const char *plaintextPath, uint64_t *iv) const;
   std::string decodePath(const char *encodedPath, uint64_t *iv) const;
 
+  /*
+      Same as encodePath / decodePath, but code the path into out, which
+      holds cap bytes (usually PATH_MAX), without allocating.  Returns the
+      length of the result, or -ENAMETOOLONG if it doesn't fit.
+  */
+  int encodePathInto(const char *plaintextPath, char *out, size_t cap,
+                     uint64_t *iv = nullptr) const;
+  int decodePathInto(const char *encodedPath, char *out, size_t cap,
+                     uint64_t *iv = nullptr) const;
+
+  // true if names are stored as they are, so coding a path only drops its
+  // leading slashes
+  virtual bool identity() const { return false; }
+
   virtual int maxEncodedNameLen(int plaintextNameLen) const = 0;
   virtual int maxDecodedNameLen(int encodedNameLen) const = 0;
 
@@ -100,9 +114,18 @@ class NameIO {
                                                    uint64_t *, char *, int)
                              const,
                          uint64_t *iv) const;
+  int recodePath(const char *path, char *out, size_t cap,
+                 int (NameIO::*codingLen)(int) const,
+                 int (NameIO::*codingFunc)(const char *, int, uint64_t *,
+                                           char *, int) const,
+                 uint64_t *iv) const;
 
   std::string _encodePath(const char *plaintextPath, uint64_t *iv) const;
   std::string _decodePath(const char *encodedPath, uint64_t *iv) const;
+  int _encodePathInto(const char *plaintextPath, char *out, size_t cap,
+                      uint64_t *iv) const;
+  int _decodePathInto(const char *encodedPath, char *out, size_t cap,
+                      uint64_t *iv) const;
   std::string _encodeName(const char *plaintextName, int length) const;
   std::string _decodeName(const char *encodedName, int length) const;
 
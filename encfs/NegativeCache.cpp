@@ -0,0 +1,136 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NegativeCache.h"
+
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+static void wipe(std::string &str) { str.assign(str.length(), '\0'); }
+
+static uint64_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+NegativeCache::NegativeCache(size_t maxEntries)
+    : _capacity(maxEntries), _generation(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+NegativeCache::~NegativeCache() {
+  clear();
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t NegativeCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+void NegativeCache::drop(PathMap::iterator it) {
+  EntryList::iterator entry = it->second;
+  _index.erase(it);
+  wipe(entry->path);
+  _lru.erase(entry);
+}
+
+bool NegativeCache::contains(const std::string &path) {
+  Lock lock(_mutex);
+
+  auto it = _index.find(path);
+  if (it == _index.end()) {
+    return false;
+  }
+  if (it->second->expires <= nowMs()) {
+    drop(it);
+    return false;
+  }
+
+  _lru.splice(_lru.begin(), _lru, it->second);
+  return true;
+}
+
+uint64_t NegativeCache::generation() const {
+  Lock lock(_mutex);
+  return _generation;
+}
+
+void NegativeCache::put(const std::string &path, uint64_t generation) {
+  if (_capacity == 0) {
+    return;
+  }
+
+  Lock lock(_mutex);
+  if (generation != _generation) {
+    return;
+  }
+
+  uint64_t expires = nowMs() + Timeout * 1000;
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    it->second->expires = expires;
+    _lru.splice(_lru.begin(), _lru, it->second);
+    return;
+  }
+
+  _lru.push_front(Entry());
+  Entry &entry = _lru.front();
+  entry.path = path;
+  entry.expires = expires;
+  _index[path] = _lru.begin();
+
+  while (_index.size() > _capacity) {
+    drop(_index.find(std::prev(_lru.end())->path));
+  }
+}
+
+void NegativeCache::invalidate(const std::string &path) {
+  Lock lock(_mutex);
+  ++_generation;
+
+  std::string prefix = path;
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/') {
+    prefix += '/';
+  }
+
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    drop(it);
+  }
+  // descendants sort right after the prefix
+  for (it = _index.lower_bound(prefix);
+       it != _index.end() && it->first.compare(0, prefix.length(), prefix) == 0;) {
+    drop(it++);
+  }
+  wipe(prefix);
+}
+
+void NegativeCache::clear() {
+  Lock lock(_mutex);
+  ++_generation;
+  while (!_index.empty()) {
+    drop(_index.begin());
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,83 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NegativeCache_incl_
+#define _NegativeCache_incl_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <string>
+
+namespace encfs {
+
+/*
+    Bounded LRU set of plaintext paths which were recently found not to
+    exist, used by DirNode to answer repeated lookups of missing files
+    without encoding the path and calling lstat.
+
+    Entries are dropped when something is created or renamed at or above
+    their path through the mount, and expire after a timeout in case the
+    backing directory is changed underneath.  A miss is only recorded if
+    nothing was invalidated since the caller read generation() before its
+    lookup, so that a concurrent create can't be shadowed.
+*/
+class NegativeCache {
+ public:
+  // Timeout, in seconds, also given to the kernel as negative_timeout.
+  static const int Timeout = 1;
+
+  explicit NegativeCache(size_t maxEntries);
+  ~NegativeCache();
+
+  NegativeCache(const NegativeCache &src) = delete;
+  NegativeCache &operator=(const NegativeCache &src) = delete;
+
+  bool contains(const std::string &path);
+
+  uint64_t generation() const;
+  void put(const std::string &path, uint64_t generation);
+
+  // drop path and everything below it
+  void invalidate(const std::string &path);
+  void clear();
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string path;
+    uint64_t expires;  // monotonic ms
+  };
+  using EntryList = std::list<Entry>;
+  using PathMap = std::map<std::string, EntryList::iterator>;
+
+  void drop(PathMap::iterator it);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  uint64_t _generation;
+  EntryList _lru;  // most recently used first
+  PathMap _index;
+};
+
+}  // namespace encfs
+
+#endif
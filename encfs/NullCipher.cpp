@@ -91,6 +91,11 @@ CipherKey NullCipher::newKey(const char *, int, int &, long,
   return gNullKey;
 }
 
+CipherKey NullCipher::newKey(const char *, int, Argon2::Params &, long,
+                             const unsigned char *, int) {
+  return gNullKey;
+}
+
 CipherKey NullCipher::newKey(const char *, int) { return gNullKey; }
 
 CipherKey NullCipher::newRandomKey() { return gNullKey; }
@@ -46,6 +46,9 @@ class NullCipher : public Cipher {
   virtual CipherKey newKey(const char *password, int passwdLength,
                            int &iterationCount, long desiredDuration,
                            const unsigned char *salt, int saltLen);
+  virtual CipherKey newKey(const char *password, int passwdLength,
+                           Argon2::Params &params, long desiredDuration,
+                           const unsigned char *salt, int saltLen);
   virtual CipherKey newKey(const char *password, int passwdLength);
   // create a new random key
   virtual CipherKey newRandomKey();
@@ -38,6 +38,8 @@ class NullNameIO : public NameIO {
 
   virtual Interface interface() const;
 
+  virtual bool identity() const { return true; }
+
   virtual int maxEncodedNameLen(int plaintextNameLen) const;
   virtual int maxDecodedNameLen(int encodedNameLen) const;
 
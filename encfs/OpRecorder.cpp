@@ -0,0 +1,219 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OpRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <openssl/rand.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Error.h"
+#include "Mutex.h"
+#include "SipHash.h"
+#include "Stats.h"
+
+namespace encfs {
+
+static_assert(sizeof(OpRecorder::Record) == 48,
+              "trace records have a fixed size");
+
+// magic, record size, and 4 bytes for later use
+static const char TraceMagic[] = "EncFSOT1";
+static const size_t MagicSize = sizeof(TraceMagic) - 1;
+static const size_t TraceHeaderSize = MagicSize + 8;
+
+const size_t OpRecorder::BufferRecords;
+
+static const char *const OpNames[] = {
+    "?",         "getattr",   "readlink",    "mknod",      "mkdir",
+    "unlink",    "rmdir",     "symlink",     "rename",     "link",
+    "chmod",     "chown",     "truncate",    "utime",      "open",
+    "read",      "write",     "statfs",      "flush",      "release",
+    "fsync",     "setxattr",  "getxattr",    "listxattr",  "removexattr",
+    "opendir",   "readdir",   "releasedir",  "create",     "fallocate",
+    "ioctl"};
+static_assert(sizeof(OpNames) / sizeof(OpNames[0]) == OpRecorder::OpCount,
+              "every op has a name");
+
+// FUSE threads are numbered in the order they first make a call
+static std::atomic<uint16_t> lastThread(0);
+static thread_local uint16_t threadNumber = 0;
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = ::write(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+OpRecorder::OpRecorder(const std::string &path)
+    : _fd(-1), _begin(Stats::now()), _failed(false) {
+  pthread_mutex_init(&_mutex, nullptr);
+  _buffer.reserve(BufferRecords);
+  if (RAND_bytes(_key, sizeof(_key)) != 1) {
+    RLOG(ERROR) << "unable to make a key for " << path;
+    return;
+  }
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+                  S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to open " << path << ": " << strerror(eno);
+    return;
+  }
+  unsigned char header[TraceHeaderSize] = {0};
+  memcpy(header, TraceMagic, MagicSize);
+  uint32_t recordSize = sizeof(Record);
+  memcpy(header + MagicSize, &recordSize, sizeof(recordSize));
+  if (!writeAll(fd, header, sizeof(header))) {
+    RLOG(ERROR) << "unable to write " << path;
+    ::close(fd);
+    return;
+  }
+  _fd = fd;
+}
+
+OpRecorder::~OpRecorder() {
+  close();
+  memset(_key, 0, sizeof(_key));
+  pthread_mutex_destroy(&_mutex);
+}
+
+uint64_t OpRecorder::hash(const char *path, size_t len) const {
+  return SipHash24(_key, (const unsigned char *)path, len);
+}
+
+void OpRecorder::record(Op op, const char *path, const char *path2,
+                        uint64_t offset, uint64_t size, int result,
+                        uint64_t startNs) {
+  uint64_t end = Stats::now();
+  if (threadNumber == 0) {
+    threadNumber = ++lastThread;
+  }
+
+  Record rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.start = startNs > _begin ? startNs - _begin : 0;
+  rec.micros = (uint32_t)std::min<uint64_t>((end - startNs) / 1000, UINT32_MAX);
+  rec.size = (uint32_t)std::min<uint64_t>(size, UINT32_MAX);
+  rec.result = result;
+  rec.thread = threadNumber;
+  rec.op = op;
+  rec.offset = offset;
+
+  // the directory is that of the path the call leaves behind
+  const char *dirOf = path2 != nullptr ? path2 : path;
+  if (path != nullptr) {
+    rec.name = hash(path, strlen(path));
+  }
+  if (path2 != nullptr) {
+    rec.offset = hash(path2, strlen(path2));
+  }
+  if (dirOf != nullptr) {
+    const char *slash = strrchr(dirOf, '/');
+    size_t len = slash == nullptr ? 0 : std::max<size_t>(slash - dirOf, 1);
+    rec.parent = hash(dirOf, len);
+  }
+
+  Lock lock(_mutex);
+  if (_fd < 0 || _failed) {
+    return;
+  }
+  _buffer.push_back(rec);
+  if (_buffer.size() >= BufferRecords) {
+    flushLocked();
+  }
+}
+
+bool OpRecorder::flushLocked() {
+  if (!_buffer.empty() && !_failed &&
+      !writeAll(_fd, _buffer.data(), _buffer.size() * sizeof(Record))) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to write the trace, no more calls are recorded: "
+                << strerror(eno);
+    _failed = true;
+  }
+  _buffer.clear();
+  return !_failed;
+}
+
+bool OpRecorder::close() {
+  Lock lock(_mutex);
+  if (_fd < 0) {
+    return !_failed;
+  }
+  flushLocked();
+  if (::close(_fd) != 0) {
+    _failed = true;
+  }
+  _fd = -1;
+  return !_failed;
+}
+
+const char *OpRecorder::opName(int op) {
+  return op > 0 && op < OpCount ? OpNames[op] : OpNames[0];
+}
+
+bool OpRecorder::read(const std::string &path, std::vector<Record> *records) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<char> data;
+  char buf[65536];
+  ssize_t n;
+  while ((n = ::read(fd, buf, sizeof(buf))) > 0 ||
+         (n < 0 && errno == EINTR)) {
+    if (n > 0) {
+      data.insert(data.end(), buf, buf + n);
+    }
+  }
+  ::close(fd);
+  if (n < 0 || data.size() < TraceHeaderSize ||
+      memcmp(data.data(), TraceMagic, MagicSize) != 0) {
+    return false;
+  }
+  uint32_t recordSize;
+  memcpy(&recordSize, data.data() + MagicSize, sizeof(recordSize));
+  if (recordSize != sizeof(Record)) {
+    return false;
+  }
+
+  size_t count = (data.size() - TraceHeaderSize) / sizeof(Record);
+  records->resize(count);
+  if (count > 0) {
+    memcpy(records->data(), data.data() + TraceHeaderSize,
+           count * sizeof(Record));
+  }
+  return true;
+}
+
+}  // namespace encfs
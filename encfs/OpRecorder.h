@@ -0,0 +1,141 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OpRecorder_incl_
+#define _OpRecorder_incl_
+
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Binary trace of the FUSE calls a mount serves (--optrace), which
+    encfsctl replay plays back against a volume or a mount, so that a
+    workload can be measured away from where it ran.
+
+    A trace is a header followed by one fixed size record per call, in the
+    order the calls returned.  Paths are kept only as SipHash values under
+    a random key which is never written out, so that a trace shows the
+    shape of a workload -- which calls, on how many files in how many
+    directories, at which offsets -- but no names and no data.  Records are
+    buffered and written 64 KiB at a time, so a trace cut short by a crash
+    loses its last records only.  Records are in the byte order of the
+    machine which wrote them.
+*/
+class OpRecorder {
+ public:
+  enum Op : uint8_t {
+    GetAttr = 1,
+    ReadLink,
+    MkNod,
+    MkDir,
+    Unlink,
+    RmDir,
+    SymLink,
+    Rename,
+    Link,
+    Chmod,
+    Chown,
+    Truncate,
+    Utime,
+    Open,
+    Read,
+    Write,
+    StatFs,
+    Flush,
+    Release,
+    Fsync,
+    SetXattr,
+    GetXattr,
+    ListXattr,
+    RemoveXattr,
+    OpenDir,
+    ReadDir,
+    ReleaseDir,
+    Create,
+    Fallocate,
+    Ioctl,
+    OpCount
+  };
+
+  struct Record {
+    uint64_t start;   // ns from the start of the trace to the call
+    uint64_t name;    // hash of the path
+    uint64_t parent;  // hash of the directory of the path
+    // the offset of reads, writes and fallocate, the new size of truncate;
+    // for rename and link the hash of the new path, whose directory is
+    // then in parent
+    uint64_t offset;
+    uint32_t size;    // bytes asked for
+    int32_t result;   // what the call returned
+    uint32_t micros;  // how long it took
+    uint16_t thread;  // which FUSE thread served it, numbered from 1
+    uint8_t op;
+    uint8_t reserved;
+  };
+
+  // records kept in memory before they are written
+  static const size_t BufferRecords = 65536 / sizeof(Record);
+
+  // Creates (or truncates) the trace at path, see valid()
+  explicit OpRecorder(const std::string &path);
+  // close()s
+  ~OpRecorder();
+
+  OpRecorder(const OpRecorder &src) = delete;
+  OpRecorder &operator=(const OpRecorder &src) = delete;
+
+  bool valid() const { return _fd >= 0; }
+
+  /*
+      Adds a call, which started at startNs on the clock of Stats::now().
+      path2 is the second path of rename and link, or null.  A record which
+      can't be written is dropped, and so are all after it.
+  */
+  void record(Op op, const char *path, const char *path2, uint64_t offset,
+              uint64_t size, int result, uint64_t startNs);
+
+  // Writes out the buffered records and ends the trace.  Returns false if
+  // any record was lost.
+  bool close();
+
+  // name of an op, as encfsctl replay shows it
+  static const char *opName(int op);
+
+  // All records of the trace at path, false if it can't be read or isn't
+  // a trace.  A partial last record is ignored.
+  static bool read(const std::string &path, std::vector<Record> *records);
+
+ private:
+  uint64_t hash(const char *path, size_t len) const;
+  bool flushLocked();
+
+  int _fd;
+  unsigned char _key[16];
+  uint64_t _begin;
+
+  pthread_mutex_t _mutex;
+  std::vector<Record> _buffer;
+  bool _failed;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,537 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OpReplay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+#include "DirNode.h"
+#include "FileNode.h"
+#include "Mutex.h"
+#include "Stats.h"
+
+namespace encfs {
+
+using Record = OpRecorder::Record;
+
+namespace {
+
+// the files of a directory, through system calls
+class DirectoryTarget : public ReplayTarget {
+ public:
+  explicit DirectoryTarget(const std::string &dir) : _dir(dir) {
+    while (_dir.size() > 1 && _dir.back() == '/') {
+      _dir.pop_back();
+    }
+  }
+
+  class FdFile : public File {
+   public:
+    explicit FdFile(int fd) : _fd(fd) {}
+    ~FdFile() override { ::close(_fd); }
+    ssize_t read(off_t offset, unsigned char *buf, size_t size) override {
+      ssize_t res = ::pread(_fd, buf, size, offset);
+      return res < 0 ? -errno : res;
+    }
+    ssize_t write(off_t offset, const unsigned char *buf,
+                  size_t size) override {
+      ssize_t res = ::pwrite(_fd, buf, size, offset);
+      return res < 0 ? -errno : res;
+    }
+    int allocate(off_t offset, off_t length) override {
+      return -::posix_fallocate(_fd, offset, length);
+    }
+    int flush() override { return 0; }
+    int sync() override { return ::fsync(_fd) < 0 ? -errno : 0; }
+
+   private:
+    int _fd;
+  };
+
+  int getattr(const std::string &path) override {
+    struct stat st;
+    return check(::lstat(full(path).c_str(), &st));
+  }
+  int list(const std::string &path) override {
+    DIR *dir = ::opendir(full(path).c_str());
+    if (dir == nullptr) {
+      return -errno;
+    }
+    while (::readdir(dir) != nullptr) {
+    }
+    ::closedir(dir);
+    return 0;
+  }
+  int mkdir(const std::string &path) override {
+    return check(::mkdir(full(path).c_str(), 0755));
+  }
+  int rmdir(const std::string &path) override {
+    return check(::rmdir(full(path).c_str()));
+  }
+  int unlink(const std::string &path) override {
+    return check(::unlink(full(path).c_str()));
+  }
+  int rename(const std::string &from, const std::string &to) override {
+    return check(::rename(full(from).c_str(), full(to).c_str()));
+  }
+  int link(const std::string &existing, const std::string &path) override {
+    return check(::link(full(existing).c_str(), full(path).c_str()));
+  }
+  int truncate(const std::string &path, off_t size) override {
+    return check(::truncate(full(path).c_str(), size));
+  }
+  std::unique_ptr<File> open(const std::string &path, bool create,
+                             int *result) override {
+    int fd = ::open(full(path).c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+    *result = fd < 0 ? -errno : 0;
+    return std::unique_ptr<File>(fd < 0 ? nullptr : new FdFile(fd));
+  }
+
+ private:
+  std::string full(const std::string &path) const { return _dir + path; }
+  static int check(int res) { return res < 0 ? -errno : 0; }
+
+  std::string _dir;
+};
+
+// the files of a volume, through DirNode and FileNode
+class VolumeTarget : public ReplayTarget {
+ public:
+  explicit VolumeTarget(const std::shared_ptr<DirNode> &root) : _root(root) {}
+
+  class NodeFile : public File {
+   public:
+    explicit NodeFile(const std::shared_ptr<FileNode> &node) : _node(node) {}
+    ~NodeFile() override { _node->flush(); }
+    ssize_t read(off_t offset, unsigned char *buf, size_t size) override {
+      return _node->read(offset, buf, size);
+    }
+    ssize_t write(off_t offset, const unsigned char *buf,
+                  size_t size) override {
+      return _node->write(offset, const_cast<unsigned char *>(buf), size);
+    }
+    int allocate(off_t offset, off_t length) override {
+      return _node->allocate(0, offset, length);
+    }
+    int flush() override { return _node->flush(); }
+    int sync() override { return _node->sync(false); }
+
+   private:
+    std::shared_ptr<FileNode> _node;
+  };
+
+  int getattr(const std::string &path) override {
+    struct stat st;
+    return _root->getAttr(path.c_str(), &st);
+  }
+  int list(const std::string &path) override {
+    int res = 0;
+    _root->listDir(path.c_str(), &res);
+    return res;
+  }
+  int mkdir(const std::string &path) override {
+    return _root->mkdir(path.c_str(), 0755);
+  }
+  int rmdir(const std::string &path) override {
+    return _root->rmdir(path.c_str());
+  }
+  int unlink(const std::string &path) override {
+    return _root->unlink(path.c_str());
+  }
+  int rename(const std::string &from, const std::string &to) override {
+    return _root->rename(from.c_str(), to.c_str());
+  }
+  int link(const std::string &existing, const std::string &path) override {
+    return _root->link(existing.c_str(), path.c_str());
+  }
+  int truncate(const std::string &path, off_t size) override {
+    return _root->lookupNode(path.c_str(), "replay")->truncate(size);
+  }
+  std::unique_ptr<File> open(const std::string &path, bool create,
+                             int *result) override {
+    std::shared_ptr<FileNode> node =
+        create ? _root->createNode(path.c_str(), S_IFREG | 0644, 0, 0, result)
+               : _root->openNode(path.c_str(), "replay", O_RDWR, result);
+    if (!node) {
+      *result = std::min(*result, -EIO);
+      return nullptr;
+    }
+    if (create) {
+      _root->created(path.c_str());
+    }
+    *result = 0;
+    return std::unique_ptr<File>(new NodeFile(node));
+  }
+
+ private:
+  std::shared_ptr<DirNode> _root;
+};
+
+bool isDirOp(int op) {
+  return op == OpRecorder::MkDir || op == OpRecorder::RmDir ||
+         op == OpRecorder::OpenDir || op == OpRecorder::ReadDir ||
+         op == OpRecorder::ReleaseDir;
+}
+
+// calls after which the path exists, though it didn't before
+bool makes(int op) {
+  return op == OpRecorder::MkDir || op == OpRecorder::MkNod ||
+         op == OpRecorder::Create || op == OpRecorder::SymLink;
+}
+
+// second path of rename and link, in offset
+bool hasTarget(int op) {
+  return op == OpRecorder::Rename || op == OpRecorder::Link;
+}
+
+std::string hashName(char kind, uint64_t hash) {
+  char buf[20];
+  snprintf(buf, sizeof(buf), "%c%016llx", kind, (unsigned long long)hash);
+  return buf;
+}
+
+}  // namespace
+
+std::unique_ptr<ReplayTarget> ReplayTarget::directory(const std::string &dir) {
+  return std::unique_ptr<ReplayTarget>(new DirectoryTarget(dir));
+}
+
+std::unique_ptr<ReplayTarget> ReplayTarget::volume(
+    const std::shared_ptr<DirNode> &root) {
+  return std::unique_ptr<ReplayTarget>(new VolumeTarget(root));
+}
+
+OpReplay::OpReplay(const std::vector<Record> &records, ReplayTarget *target)
+    : _target(target), _stats(OpRecorder::OpCount) {
+  pthread_mutex_init(&_mutex, nullptr);
+  memset(_stats.data(), 0, _stats.size() * sizeof(OpStats));
+
+  std::vector<Record> ordered(records);
+  std::stable_sort(ordered.begin(), ordered.end(),
+                   [](const Record &a, const Record &b) {
+                     return a.start < b.start;
+                   });
+
+  // which names are directories: those with files in them, those of
+  // directory calls, and the new names of renamed directories
+  for (const Record &rec : ordered) {
+    _dirs.insert(rec.parent);
+    if (isDirOp(rec.op)) {
+      _dirs.insert(rec.name);
+    }
+  }
+  for (const Record &rec : ordered) {
+    if (hasTarget(rec.op) && _dirs.count(rec.name) != 0) {
+      _dirs.insert(rec.offset);
+    }
+  }
+
+  // Files stay where they were first seen.  A file seen first as the old
+  // name of a rename was in an unknown directory, it is put with the new
+  // name.  Whatever is used before the trace makes it was there already.
+  std::unordered_set<uint64_t> seen;
+  std::map<uint16_t, size_t> threadIndex;
+  for (const Record &rec : ordered) {
+    if (seen.insert(rec.parent).second) {
+      _initialDirs.push_back(rec.parent);
+    }
+    if (seen.insert(rec.name).second) {
+      if (_dirs.count(rec.name) == 0) {
+        _paths[rec.name] =
+            pathOf(rec.parent, 0) + "/" + hashName('f', rec.name);
+      }
+      if (!makes(rec.op) && rec.result >= 0) {
+        if (_dirs.count(rec.name) != 0) {
+          _initialDirs.push_back(rec.name);
+        } else {
+          _initialFiles[rec.name] = 0;
+        }
+      }
+    }
+    if (hasTarget(rec.op) && seen.insert(rec.offset).second &&
+        _dirs.count(rec.offset) == 0) {
+      _paths[rec.offset] =
+          pathOf(rec.parent, 0) + "/" + hashName('f', rec.offset);
+    }
+    if (rec.op == OpRecorder::Read && rec.result > 0) {
+      auto it = _initialFiles.find(rec.name);
+      if (it != _initialFiles.end()) {
+        it->second = std::max<off_t>(it->second, rec.offset + rec.result);
+      }
+    }
+
+    auto index = threadIndex.emplace(rec.thread, threadIndex.size());
+    if (index.second) {
+      _threads.emplace_back();
+    }
+    _threads[index.first->second].push_back(rec);
+  }
+}
+
+OpReplay::~OpReplay() { pthread_mutex_destroy(&_mutex); }
+
+std::string OpReplay::pathOf(uint64_t name, uint64_t parent) const {
+  if (_dirs.count(name) != 0) {
+    return "/" + hashName('d', name);
+  }
+  auto it = _paths.find(name);
+  if (it != _paths.end()) {
+    return it->second;
+  }
+  return pathOf(parent, 0) + "/" + hashName('f', name);
+}
+
+int OpReplay::fill(const std::string &path, off_t size) {
+  int res = 0;
+  std::unique_ptr<ReplayTarget::File> file = _target->open(path, true, &res);
+  if (!file) {
+    return res;
+  }
+  std::vector<unsigned char> buf(64 * 1024);
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = (unsigned char)(i * 131 + 7);
+  }
+  for (off_t offset = 0; offset < size && res >= 0;) {
+    size_t len = (size_t)std::min<off_t>(buf.size(), size - offset);
+    res = file->write(offset, buf.data(), len);
+    offset += len;
+  }
+  if (res >= 0) {
+    res = file->flush();
+  }
+  return res < 0 ? res : 0;
+}
+
+int OpReplay::prepare() {
+  for (uint64_t dir : _initialDirs) {
+    int res = _target->mkdir(pathOf(dir, 0));
+    if (res < 0 && res != -EEXIST) {
+      return res;
+    }
+  }
+  for (const auto &file : _initialFiles) {
+    int res = fill(pathOf(file.first, 0), file.second);
+    if (res < 0) {
+      return res;
+    }
+  }
+  return 0;
+}
+
+std::shared_ptr<ReplayTarget::File> OpReplay::fileOf(uint64_t name,
+                                                     int *result) {
+  {
+    Lock lock(_mutex);
+    auto it = _open.find(name);
+    if (it != _open.end()) {
+      return it->second.file;
+    }
+  }
+  // in use before the trace began, kept open until the end
+  std::shared_ptr<ReplayTarget::File> file =
+      _target->open(pathOf(name, 0), false, result);
+  if (file) {
+    Lock lock(_mutex);
+    auto it = _open.emplace(name, OpenFile{file, 0}).first;
+    return it->second.file;
+  }
+  return file;
+}
+
+int OpReplay::acquire(uint64_t name, bool create) {
+  {
+    Lock lock(_mutex);
+    auto it = _open.find(name);
+    if (it != _open.end()) {
+      ++it->second.count;
+      return 0;
+    }
+  }
+  int res = 0;
+  std::shared_ptr<ReplayTarget::File> file =
+      _target->open(pathOf(name, 0), create, &res);
+  if (file) {
+    Lock lock(_mutex);
+    ++_open.emplace(name, OpenFile{file, 0}).first->second.count;
+  }
+  return res;
+}
+
+void OpReplay::release(uint64_t name) {
+  // declared first, so that the file is closed after the lock is released
+  std::shared_ptr<ReplayTarget::File> last;
+  Lock lock(_mutex);
+  auto it = _open.find(name);
+  if (it != _open.end() && --it->second.count <= 0) {
+    last = std::move(it->second.file);
+    _open.erase(it);
+  }
+}
+
+int OpReplay::play(const Record &rec, std::vector<unsigned char> *buf) {
+  std::string path = pathOf(rec.name, rec.parent);
+  int res = 0;
+  switch (rec.op) {
+    case OpRecorder::GetAttr:
+    case OpRecorder::ReadLink:
+    case OpRecorder::Chmod:
+    case OpRecorder::Chown:
+    case OpRecorder::Utime:
+    case OpRecorder::SetXattr:
+    case OpRecorder::GetXattr:
+    case OpRecorder::ListXattr:
+    case OpRecorder::RemoveXattr:
+      return _target->getattr(path);
+    case OpRecorder::MkNod:
+    case OpRecorder::SymLink: {
+      std::unique_ptr<ReplayTarget::File> file =
+          _target->open(path, true, &res);
+      return res;
+    }
+    case OpRecorder::MkDir:
+      return _target->mkdir(path);
+    case OpRecorder::RmDir:
+      return _target->rmdir(path);
+    case OpRecorder::Unlink:
+      return _target->unlink(path);
+    case OpRecorder::Rename: {
+      res = _target->rename(path, pathOf(rec.offset, rec.parent));
+      Lock lock(_mutex);
+      auto it = _open.find(rec.name);
+      if (res == 0 && it != _open.end()) {
+        OpenFile moved = std::move(it->second);
+        _open.erase(it);
+        _open[rec.offset] = std::move(moved);
+      }
+      return res;
+    }
+    case OpRecorder::Link:
+      return _target->link(path, pathOf(rec.offset, rec.parent));
+    case OpRecorder::Truncate:
+      return _target->truncate(path, rec.offset);
+    case OpRecorder::Open:
+    case OpRecorder::Create:
+      return acquire(rec.name, rec.op == OpRecorder::Create);
+    case OpRecorder::Release:
+      release(rec.name);
+      return 0;
+    case OpRecorder::ReadDir:
+      return _target->list(path);
+    case OpRecorder::Read:
+    case OpRecorder::Write:
+    case OpRecorder::Flush:
+    case OpRecorder::Fsync:
+    case OpRecorder::Fallocate:
+      break;
+    default:
+      return 0;
+  }
+
+  std::shared_ptr<ReplayTarget::File> file = fileOf(rec.name, &res);
+  if (!file) {
+    return res;
+  }
+  if (buf->size() < rec.size) {
+    buf->resize(rec.size, 0x5a);
+  }
+  switch (rec.op) {
+    case OpRecorder::Read:
+      return (int)file->read(rec.offset, buf->data(), rec.size);
+    case OpRecorder::Write:
+      return (int)file->write(rec.offset, buf->data(), rec.size);
+    case OpRecorder::Flush:
+      return file->flush();
+    case OpRecorder::Fsync:
+      return file->sync();
+    default:
+      return file->allocate(rec.offset, rec.size);
+  }
+}
+
+uint64_t OpReplay::run(bool fast) {
+  std::vector<std::vector<OpStats>> threadStats(
+      _threads.size(), std::vector<OpStats>(OpRecorder::OpCount, OpStats()));
+  uint64_t begin = Stats::now();
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < _threads.size(); ++t) {
+    threads.emplace_back([this, t, fast, begin, &threadStats]() {
+      std::vector<unsigned char> buf;
+      std::vector<OpStats> &stats = threadStats[t];
+      for (const Record &rec : _threads[t]) {
+        if (rec.op == OpRecorder::StatFs || rec.op == OpRecorder::Ioctl ||
+            rec.op == OpRecorder::OpenDir ||
+            rec.op == OpRecorder::ReleaseDir ||
+            rec.op >= OpRecorder::OpCount) {
+          continue;
+        }
+        if (!fast) {
+          uint64_t now = Stats::now();
+          if (begin + rec.start > now) {
+            std::this_thread::sleep_for(
+                std::chrono::nanoseconds(begin + rec.start - now));
+          }
+        }
+        uint64_t start = Stats::now();
+        int res = play(rec, &buf);
+        uint64_t micros = (Stats::now() - start) / 1000;
+
+        OpStats &s = stats[rec.op];
+        ++s.calls;
+        if (res < 0 && rec.result >= 0) {
+          ++s.failed;
+        }
+        s.recordedMicros += rec.micros;
+        s.micros += micros;
+        s.maxMicros = std::max(s.maxMicros, micros);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  uint64_t elapsed = Stats::now() - begin;
+
+  {
+    Lock lock(_mutex);
+    _open.clear();
+  }
+  for (const std::vector<OpStats> &stats : threadStats) {
+    for (int op = 0; op < OpRecorder::OpCount; ++op) {
+      _stats[op].calls += stats[op].calls;
+      _stats[op].failed += stats[op].failed;
+      _stats[op].recordedMicros += stats[op].recordedMicros;
+      _stats[op].micros += stats[op].micros;
+      _stats[op].maxMicros =
+          std::max(_stats[op].maxMicros, stats[op].maxMicros);
+    }
+  }
+  return elapsed;
+}
+
+}  // namespace encfs
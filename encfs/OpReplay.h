@@ -0,0 +1,154 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OpReplay_incl_
+#define _OpReplay_incl_
+
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "OpRecorder.h"
+
+namespace encfs {
+
+class DirNode;
+
+/*
+    What a trace is played back against: a directory, which may be the
+    mount point of a volume, or a volume opened through DirNode.  Paths are
+    absolute within the target.  Calls return 0, or the bytes moved, or
+    -errno.
+*/
+class ReplayTarget {
+ public:
+  // a regular file open for reading and writing
+  class File {
+   public:
+    virtual ~File() {}
+    virtual ssize_t read(off_t offset, unsigned char *buf, size_t size) = 0;
+    virtual ssize_t write(off_t offset, const unsigned char *buf,
+                          size_t size) = 0;
+    virtual int allocate(off_t offset, off_t length) = 0;
+    virtual int flush() = 0;
+    virtual int sync() = 0;
+  };
+
+  virtual ~ReplayTarget() {}
+
+  virtual int getattr(const std::string &path) = 0;
+  virtual int list(const std::string &path) = 0;
+  virtual int mkdir(const std::string &path) = 0;
+  virtual int rmdir(const std::string &path) = 0;
+  virtual int unlink(const std::string &path) = 0;
+  virtual int rename(const std::string &from, const std::string &to) = 0;
+  virtual int link(const std::string &existing, const std::string &path) = 0;
+  virtual int truncate(const std::string &path, off_t size) = 0;
+  // null on failure, with result set
+  virtual std::unique_ptr<File> open(const std::string &path, bool create,
+                                     int *result) = 0;
+
+  // the files under the directory dir
+  static std::unique_ptr<ReplayTarget> directory(const std::string &dir);
+  // the files of the volume of root
+  static std::unique_ptr<ReplayTarget> volume(
+      const std::shared_ptr<DirNode> &root);
+};
+
+/*
+    Plays back a trace of --optrace (see OpRecorder), for encfsctl replay.
+
+    Each thread of the trace is played by a thread of its own, which makes
+    the calls of the original thread in order, either at the times they
+    were made or each as soon as the last one returned.  Since traces hold
+    no names, a directory becomes /d<hash> and a file <directory>/f<hash>,
+    after the hashes of the trace, where the file was first seen.  prepare()
+    first creates the directories, and the files which the trace uses
+    without creating them, as large as the reads of them need.
+
+    Calls without a counterpart in ReplayTarget (readlink, chmod, chown,
+    utime and the xattr calls) are played as getattr, and symlink as mknod;
+    statfs, ioctl, opendir and releasedir are left out.  A file in a renamed
+    directory has a new hash after the rename, so it is lost to the replay.
+*/
+class OpReplay {
+ public:
+  struct OpStats {
+    uint64_t calls;
+    uint64_t failed;          // failed where the recorded call didn't
+    uint64_t recordedMicros;  // as long as the calls took when recorded
+    uint64_t micros;          // as long as they took now
+    uint64_t maxMicros;
+  };
+
+  OpReplay(const std::vector<OpRecorder::Record> &records,
+           ReplayTarget *target);
+  ~OpReplay();
+
+  OpReplay(const OpReplay &src) = delete;
+  OpReplay &operator=(const OpReplay &src) = delete;
+
+  // Creates what the trace expects to find.  Returns 0 or -errno.
+  int prepare();
+
+  // Plays the trace, at the recorded pace unless fast, and returns how
+  // long it took in ns
+  uint64_t run(bool fast);
+
+  // by OpRecorder::Op
+  const OpStats &stats(int op) const { return _stats[op]; }
+  // threads of the trace
+  size_t threads() const { return _threads.size(); }
+
+  // where the replay keeps the file or directory name, in parent
+  std::string pathOf(uint64_t name, uint64_t parent) const;
+
+ private:
+  struct OpenFile {
+    std::shared_ptr<ReplayTarget::File> file;
+    int count;  // opens not yet released
+  };
+
+  int play(const OpRecorder::Record &rec, std::vector<unsigned char> *buf);
+  std::shared_ptr<ReplayTarget::File> fileOf(uint64_t name, int *result);
+  int acquire(uint64_t name, bool create);
+  void release(uint64_t name);
+  int fill(const std::string &path, off_t size);
+
+  ReplayTarget *_target;
+  std::vector<std::vector<OpRecorder::Record>> _threads;
+  std::unordered_set<uint64_t> _dirs;
+  // files, and where they are kept
+  std::unordered_map<uint64_t, std::string> _paths;
+  // what prepare() makes, with the sizes of files
+  std::vector<uint64_t> _initialDirs;
+  std::unordered_map<uint64_t, off_t> _initialFiles;
+
+  pthread_mutex_t _mutex;
+  std::unordered_map<uint64_t, OpenFile> _open;
+
+  std::vector<OpStats> _stats;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,432 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PathCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+static void wipe(std::string &str) { str.assign(str.length(), '\0'); }
+
+// frees the memory as well
+static void release(std::string &str) {
+  wipe(str);
+  std::string().swap(str);
+}
+
+// FNV-1a of the name, started from the parent
+static size_t hashOf(const void *parent, const char *name, size_t len) {
+  uint64_t h = 14695981039346656037ULL ^ (uint64_t)(uintptr_t)parent;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)name[i];
+    h *= 1099511628211ULL;
+  }
+  return (size_t)h;
+}
+
+PathCache::PathCache(size_t maxEntries)
+    : _capacity(maxEntries),
+      _limit(maxEntries),
+      _entries(0),
+      _root(),
+      _newest(nullptr),
+      _oldest(nullptr),
+      _probe() {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+PathCache::~PathCache() {
+  clear();
+  release(_probe.name);
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t PathCache::size() const {
+  Lock lock(_mutex);
+  return _entries;
+}
+
+size_t PathCache::nodes() const {
+  Lock lock(_mutex);
+  return _nodes.size();
+}
+
+PathCache::Node *PathCache::child(Node *parent, const char *name, size_t len,
+                                  bool create) {
+  _probe.parent = parent;
+  _probe.name.assign(name, len);
+  _probe.hash = hashOf(parent, name, len);
+  auto it = _nodes.find(&_probe);
+  wipe(_probe.name);
+  if (it != _nodes.end()) {
+    return *it;
+  }
+  if (!create) {
+    return nullptr;
+  }
+
+  Node *node = new Node();
+  node->parent = parent;
+  node->name.assign(name, len);
+  node->hash = _probe.hash;
+  node->next = parent->child;
+  if (parent->child != nullptr) {
+    parent->child->prev = node;
+  }
+  parent->child = node;
+  _nodes.insert(node);
+  return node;
+}
+
+PathCache::Node *PathCache::find(const char *path, size_t len) {
+  Node *node = &_root;
+  const char *end = path + len;
+  for (;;) {
+    const char *slash = (const char *)memchr(path, '/', end - path);
+    const char *stop = slash != nullptr ? slash : end;
+    node = child(node, path, stop - path, false);
+    if (node == nullptr || slash == nullptr) {
+      return node;
+    }
+    path = slash + 1;
+  }
+}
+
+bool PathCache::hasValue(const Node *node) const {
+  return node->cached || node->dependents > 0;
+}
+
+void PathCache::codedPath(const Node *node, std::string *out) const {
+  _chain.clear();
+  while (node->relative) {
+    _chain.push_back(node);
+    node = node->parent;
+  }
+  size_t len = node->coded.length();
+  for (const Node *n : _chain) {
+    len += 1 + n->coded.length();
+  }
+  out->reserve(len);
+  out->assign(node->coded);
+  for (auto it = _chain.rbegin(); it != _chain.rend(); ++it) {
+    out->push_back('/');
+    out->append((*it)->coded);
+  }
+}
+
+void PathCache::unlinkLRU(Node *node) {
+  if (node->older != nullptr) {
+    node->older->newer = node->newer;
+  } else {
+    _oldest = node->newer;
+  }
+  if (node->newer != nullptr) {
+    node->newer->older = node->older;
+  } else {
+    _newest = node->older;
+  }
+  node->older = node->newer = nullptr;
+}
+
+void PathCache::touch(Node *node) {
+  if (node->cached) {
+    if (node == _newest) {
+      return;
+    }
+    unlinkLRU(node);
+  } else {
+    node->cached = true;
+    ++_entries;
+  }
+  node->older = _newest;
+  if (_newest != nullptr) {
+    _newest->newer = node;
+  } else {
+    _oldest = node;
+  }
+  _newest = node;
+}
+
+// Makes the coded paths of the children of node whole, before the value of
+// node changes.
+void PathCache::detach(Node *node) {
+  if (node->dependents == 0) {
+    return;
+  }
+  std::string prefix;
+  codedPath(node, &prefix);
+  prefix += '/';
+  for (Node *c = node->child; c != nullptr; c = c->next) {
+    if (c->relative) {
+      std::string full = prefix + c->coded;
+      wipe(c->coded);
+      c->coded.swap(full);
+      wipe(full);
+      c->relative = false;
+    }
+  }
+  node->dependents = 0;
+  wipe(prefix);
+}
+
+// Forgets the value of a node which is neither cached nor needed.
+void PathCache::dropValue(Node *node) {
+  release(node->coded);
+  if (node->relative) {
+    node->relative = false;
+    unref(node->parent);
+  }
+}
+
+// One child less needs the value of node.
+void PathCache::unref(Node *node) {
+  if (--node->dependents == 0 && !node->cached) {
+    dropValue(node);
+  }
+}
+
+void PathCache::evict(Node *node) {
+  unlinkLRU(node);
+  node->cached = false;
+  --_entries;
+  if (node->dependents == 0) {
+    dropValue(node);
+  }
+  prune(node);
+}
+
+// Frees node and everything below it.
+void PathCache::freeTree(Node *node) {
+  Node *parent = node->parent;
+  if (node->prev != nullptr) {
+    node->prev->next = node->next;
+  } else {
+    parent->child = node->next;
+  }
+  if (node->next != nullptr) {
+    node->next->prev = node->prev;
+  }
+  if (node->relative) {
+    unref(parent);
+  }
+
+  std::vector<Node *> pending(1, node);
+  while (!pending.empty()) {
+    Node *n = pending.back();
+    pending.pop_back();
+    for (Node *c = n->child; c != nullptr; c = c->next) {
+      pending.push_back(c);
+    }
+    if (n->cached) {
+      unlinkLRU(n);
+      --_entries;
+    }
+    _nodes.erase(n);
+    wipe(n->name);
+    wipe(n->coded);
+    delete n;
+  }
+}
+
+// Frees node, and then its parents, while nothing needs them.
+void PathCache::prune(Node *node) {
+  while (node != &_root && !node->cached && node->child == nullptr) {
+    Node *parent = node->parent;
+    freeTree(node);
+    node = parent;
+  }
+}
+
+bool PathCache::get(const std::string &path, std::string *coded,
+                    uint64_t *iv) {
+  Lock lock(_mutex);
+
+  Node *node = find(path.data(), path.length());
+  if (node == nullptr || !node->cached) {
+    return false;
+  }
+
+  touch(node);
+  codedPath(node, coded);
+  if (iv != nullptr) {
+    *iv = node->iv;
+  }
+  return true;
+}
+
+int PathCache::get(const std::string &path, char *coded, size_t cap,
+                   uint64_t *iv) {
+  Lock lock(_mutex);
+
+  Node *node = find(path.data(), path.length());
+  if (node == nullptr || !node->cached) {
+    return -1;
+  }
+
+  _chain.clear();
+  const Node *base = node;
+  size_t len = 0;
+  while (base->relative) {
+    _chain.push_back(base);
+    len += 1 + base->coded.length();
+    base = base->parent;
+  }
+  len += base->coded.length();
+  if (len >= cap) {
+    return -1;
+  }
+
+  char *p = coded;
+  memcpy(p, base->coded.data(), base->coded.length());
+  p += base->coded.length();
+  for (auto it = _chain.rbegin(); it != _chain.rend(); ++it) {
+    *p++ = '/';
+    memcpy(p, (*it)->coded.data(), (*it)->coded.length());
+    p += (*it)->coded.length();
+  }
+  *p = '\0';
+
+  touch(node);
+  if (iv != nullptr) {
+    *iv = node->iv;
+  }
+  return (int)len;
+}
+
+void PathCache::put(const std::string &path, const std::string &coded,
+                    uint64_t iv) {
+  if (_capacity == 0) {
+    return;
+  }
+
+  Lock lock(_mutex);
+
+  Node *node = &_root;
+  const char *p = path.data();
+  const char *end = p + path.length();
+  for (;;) {
+    const char *slash = (const char *)memchr(p, '/', end - p);
+    const char *stop = slash != nullptr ? slash : end;
+    node = child(node, p, stop - p, true);
+    if (slash == nullptr) {
+      break;
+    }
+    p = slash + 1;
+  }
+
+  bool same = false;
+  if (hasValue(node)) {
+    std::string current;
+    codedPath(node, &current);
+    same = current == coded;
+    wipe(current);
+    if (!same) {
+      detach(node);
+    }
+  }
+
+  if (!same) {
+    bool wasRelative = node->relative;
+    node->relative = false;
+    wipe(node->coded);
+
+    Node *parent = node->parent;
+    if (parent != &_root && hasValue(parent)) {
+      std::string prefix;
+      codedPath(parent, &prefix);
+      if (coded.length() > prefix.length() &&
+          coded[prefix.length()] == '/' &&
+          coded.compare(0, prefix.length(), prefix) == 0) {
+        node->coded.assign(coded, prefix.length() + 1, std::string::npos);
+        node->relative = true;
+        if (!wasRelative) {
+          ++parent->dependents;
+        }
+      }
+      wipe(prefix);
+    }
+    if (!node->relative) {
+      node->coded = coded;
+      if (wasRelative) {
+        unref(parent);
+      }
+    }
+  }
+  node->iv = iv;
+  touch(node);
+
+  while (_entries > _limit) {
+    evict(_oldest);
+  }
+}
+
+void PathCache::setLimit(size_t limit) {
+  Lock lock(_mutex);
+  _limit = limit;
+  while (_entries > _limit) {
+    evict(_oldest);
+  }
+}
+
+std::vector<std::string> PathCache::recentCoded(size_t max) const {
+  Lock lock(_mutex);
+  std::vector<std::string> result;
+  result.reserve(std::min(max, _entries));
+  for (const Node *node = _newest; node != nullptr && result.size() < max;
+       node = node->older) {
+    result.emplace_back();
+    codedPath(node, &result.back());
+  }
+  return result;
+}
+
+void PathCache::invalidate(const std::string &path) {
+  Lock lock(_mutex);
+
+  size_t len = path.length();
+  if (len > 0 && path[len - 1] == '/') {
+    // everything below the directory, but not the directory
+    Node *node = find(path.data(), len - 1);
+    if (node != nullptr) {
+      while (node->child != nullptr) {
+        freeTree(node->child);
+      }
+      prune(node);
+    }
+    return;
+  }
+
+  Node *node = find(path.data(), len);
+  if (node != nullptr) {
+    Node *parent = node->parent;
+    freeTree(node);
+    prune(parent);
+  }
+}
+
+void PathCache::clear() {
+  Lock lock(_mutex);
+  while (_root.child != nullptr) {
+    freeTree(_root.child);
+  }
+}
+
+}  // namespace encfs
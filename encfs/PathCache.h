@@ -0,0 +1,136 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PathCache_incl_
+#define _PathCache_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Bounded LRU cache of coded paths, used by DirNode to avoid re-coding
+    every component of a path on each request.
+
+    The coded form of a path only depends on the path itself (and the key),
+    so entries never go stale.  They are still dropped when the file or
+    directory goes away, so that names of deleted files don't linger in
+    memory.  Keys and values are wiped before they are freed.
+
+    Paths are kept as a tree of their components, split at '/', so that a
+    directory's name is held once however many paths below it are cached.
+    Where the coded path of an entry is that of its parent, a '/' and one
+    more name, as DirNode's are, only that name is held, and the parent is
+    kept while such children need it, even once it has been evicted itself.
+    Memory so grows with the number of names rather than with the bytes of
+    the full paths.
+*/
+class PathCache {
+ public:
+  // maxEntries is the maximum number of paths held
+  explicit PathCache(size_t maxEntries);
+  ~PathCache();
+
+  PathCache(const PathCache &src) = delete;
+  PathCache &operator=(const PathCache &src) = delete;
+
+  // Returns true and fills in the coded path and its final name IV on a hit.
+  bool get(const std::string &path, std::string *coded, uint64_t *iv);
+  // Same, but copies the coded path into coded, which holds cap bytes.
+  // Returns its length, or -1 if it isn't cached or doesn't fit.
+  int get(const std::string &path, char *coded, size_t cap, uint64_t *iv);
+
+  void put(const std::string &path, const std::string &coded, uint64_t iv);
+
+  // drop path and everything below it
+  void invalidate(const std::string &path);
+  void clear();
+
+  // Hold at most limit paths from now on, dropping the oldest ones.  The
+  // capacity stays what the cache was made with (see DirNode::tune).
+  void setLimit(size_t limit);
+
+  // the coded paths of the max most recently used entries, most recent
+  // first (see WarmCache)
+  std::vector<std::string> recentCoded(size_t max) const;
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const;
+  // components held, those of entries and the parents kept for them
+  size_t nodes() const;
+
+ private:
+  // one component of one or more cached paths
+  struct Node {
+    Node *parent;
+    Node *child;  // first one
+    Node *prev;   // siblings
+    Node *next;
+    Node *older;  // LRU order of the cached nodes
+    Node *newer;
+    size_t hash;  // of parent and name
+    std::string name;
+    // the coded path, or if relative the part after the parent's and '/'
+    std::string coded;
+    uint64_t iv;
+    uint32_t dependents;  // children whose coded paths are relative
+    bool cached;          // the path of the node is an entry
+    bool relative;
+  };
+  struct NodeHash {
+    size_t operator()(const Node *node) const { return node->hash; }
+  };
+  struct NodeEqual {
+    bool operator()(const Node *a, const Node *b) const {
+      return a->parent == b->parent && a->name == b->name;
+    }
+  };
+
+  Node *find(const char *path, size_t len);
+  Node *child(Node *parent, const char *name, size_t len, bool create);
+  bool hasValue(const Node *node) const;
+  void codedPath(const Node *node, std::string *out) const;
+  void touch(Node *node);
+  void unlinkLRU(Node *node);
+  void evict(Node *node);
+  void detach(Node *node);
+  void dropValue(Node *node);
+  void unref(Node *node);
+  void freeTree(Node *node);
+  void prune(Node *node);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  size_t _limit;
+  size_t _entries;
+  Node _root;     // parent of the first component
+  Node *_newest;  // LRU list of cached nodes
+  Node *_oldest;
+  std::unordered_set<Node *, NodeHash, NodeEqual> _nodes;
+  Node _probe;  // key for lookups
+  mutable std::vector<const Node *> _chain;
+};
+
+}  // namespace encfs
+
+#endif
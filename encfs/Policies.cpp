@@ -0,0 +1,202 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Policies.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "Error.h"
+#include "FileUtils.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+namespace {
+
+enum Setting {
+  ReadAhead,
+  WriteBack,
+  Stream,
+  DirectIO,
+  DropBehind,
+  WriteBehind,
+  KeepCache,
+  AttrTimeout,
+  SettingCount
+};
+
+struct SettingInfo {
+  const char *name;
+  long min;
+  long max;
+};
+
+const SettingInfo Settings[SettingCount] = {
+    {"readahead", 0, 1L << 20}, {"writeback", 0, 1L << 20},
+    {"stream", -1, 1L << 30},   {"directio", 0, 1},
+    {"dropbehind", 0, 1},       {"writebehind", 0, 1L << 20},
+    {"keepcache", 0, 1},        {"attrtimeout", 0, 1L << 20}};
+
+// whether path is dir or below it
+bool within(const std::string &path, const std::string &dir) {
+  if (dir == "/") {
+    return true;
+  }
+  return path.compare(0, dir.length(), dir) == 0 &&
+         (path.length() == dir.length() || path[dir.length()] == '/');
+}
+
+}  // namespace
+
+Policies::Policies(const std::string &file) : _file(file) {
+  pthread_rwlock_init(&_lock, nullptr);
+}
+
+Policies::~Policies() { pthread_rwlock_destroy(&_lock); }
+
+int Policies::load() {
+  std::ifstream in(_file.c_str());
+  if (!in) {
+    int eno = errno;
+    RLOG(ERROR) << "unable to read " << _file << ": " << strerror(eno);
+    return -eno;
+  }
+
+  std::vector<Rule> rules;
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    std::istringstream words(line);
+    Rule rule;
+    if (!(words >> rule.path) || rule.path[0] == '#') {
+      continue;
+    }
+    while (rule.path.length() > 1 && rule.path.back() == '/') {
+      rule.path.pop_back();
+    }
+    if (rule.path[0] != '/') {
+      RLOG(ERROR) << _file << ":" << number << ": " << rule.path
+                  << " is not an absolute path";
+      return -EINVAL;
+    }
+
+    std::string item;
+    while (words >> item) {
+      size_t eq = item.find('=');
+      int index = 0;
+      while (index < SettingCount &&
+             item.compare(0, eq, Settings[index].name) != 0) {
+        ++index;
+      }
+      char *end = nullptr;
+      long value = 0;
+      if (eq != std::string::npos && eq + 1 < item.length()) {
+        value = strtol(item.c_str() + eq + 1, &end, 10);
+      }
+      if (index == SettingCount || end == nullptr || *end != '\0' ||
+          value < Settings[index].min || value > Settings[index].max) {
+        RLOG(ERROR) << _file << ":" << number << ": bad setting " << item;
+        return -EINVAL;
+      }
+      rule.settings.emplace_back(index, value);
+    }
+    rules.push_back(std::move(rule));
+  }
+  if (in.bad()) {
+    RLOG(ERROR) << "unable to read " << _file;
+    return -EIO;
+  }
+
+  // a subtree's path is longer than those of the subtrees it is in
+  std::stable_sort(rules.begin(), rules.end(),
+                   [](const Rule &a, const Rule &b) {
+                     return a.path.length() < b.path.length();
+                   });
+  WriteLock lock(_lock);
+  _rules.swap(rules);
+  return 0;
+}
+
+Policies::Policy Policies::lookup(const char *path,
+                                  const EncFS_Opts &opts) const {
+  Policy policy = of(nullptr, path, opts);
+  std::string plain(path);
+  ReadLock lock(_lock);
+  for (const Rule &rule : _rules) {
+    if (!within(plain, rule.path)) {
+      continue;
+    }
+    for (const auto &setting : rule.settings) {
+      int value = (int)setting.second;
+      switch (setting.first) {
+        case ReadAhead:
+          policy.readAhead = value;
+          break;
+        case WriteBack:
+          policy.writeBack = value;
+          break;
+        case Stream:
+          policy.streamSize = value;
+          break;
+        case DirectIO:
+          policy.directIO = value != 0;
+          break;
+        case DropBehind:
+          policy.dropBehind = value != 0;
+          break;
+        case WriteBehind:
+          policy.writeBehind = value;
+          break;
+        case KeepCache:
+          policy.keepCache = value != 0;
+          break;
+        case AttrTimeout:
+          policy.attrTimeout = value;
+          break;
+      }
+    }
+  }
+  return policy;
+}
+
+Policies::Policy Policies::of(const Policies *policies, const char *path,
+                              const EncFS_Opts &opts) {
+  if (policies != nullptr) {
+    return policies->lookup(path, opts);
+  }
+  Policy policy;
+  policy.readAhead = opts.readAheadSize;
+  policy.writeBack = opts.writeBackSize;
+  policy.streamSize = opts.streamSize;
+  policy.directIO = opts.directIO;
+  policy.dropBehind = opts.dropBehind;
+  policy.writeBehind = opts.writeBehind;
+  policy.keepCache = opts.keepCacheSize > 0;
+  policy.attrTimeout = -1;
+  return policy;
+}
+
+size_t Policies::size() const {
+  ReadLock lock(_lock);
+  return _rules.size();
+}
+
+}  // namespace encfs
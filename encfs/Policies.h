@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _Policies_incl_
+#define _Policies_incl_
+
+#include <pthread.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace encfs {
+
+struct EncFS_Opts;
+
+/*
+    Settings of the files of a subtree of a volume (--policy), so that one
+    mount can stream media, read a database at random and cache a build
+    tree hard.  The policy file has a line per subtree, with its plaintext
+    path and the settings it overrides:
+
+        # path      setting=value ...
+        /media      stream=0 readahead=8192 dropbehind=1
+        /db         stream=-1 keepcache=0 readahead=0
+        /tmp-build  attrtimeout=30 writeback=1024
+
+    The settings are those of the mount options of the same names, but for
+    attrtimeout, the seconds the attributes of its paths are cached for (see
+    --attrcache), and the flags take 0 or 1.  A subtree takes the settings
+    of the subtrees it is in, and of the mount, where it doesn't give its
+    own.  Blank lines and lines starting with # are ignored.
+
+    Files take the settings when they are opened, and attributes when they
+    are cached, so reloading the file applies to them from then on.
+*/
+class Policies {
+ public:
+  // the settings of one path
+  struct Policy {
+    int readAhead;    // KiB
+    int writeBack;    // KiB
+    int streamSize;   // MiB, -1 == off
+    bool directIO;
+    bool dropBehind;
+    int writeBehind;  // MiB
+    bool keepCache;
+    int attrTimeout;  // seconds, -1 == that of the cache
+  };
+
+  explicit Policies(const std::string &file);
+  ~Policies();
+
+  Policies(const Policies &src) = delete;
+  Policies &operator=(const Policies &src) = delete;
+
+  // (Re)reads the file.  Returns 0, or -errno having kept the subtrees as
+  // they were, -EINVAL for a malformed file (which is logged).
+  int load();
+
+  // The settings of plaintext path, starting from those of the mount
+  Policy lookup(const char *path, const EncFS_Opts &opts) const;
+  // the same for a mount which may have no policies
+  static Policy of(const Policies *policies, const char *path,
+                   const EncFS_Opts &opts);
+
+  size_t size() const;
+  const std::string &file() const { return _file; }
+
+ private:
+  struct Rule {
+    std::string path;
+    std::vector<std::pair<int, long>> settings;  // index, value
+  };
+
+  const std::string _file;
+
+  mutable pthread_rwlock_t _lock;
+  std::vector<Rule> _rules;  // parents before their subtrees
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,120 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RangeLock.h"
+
+#include <iterator>
+#include <limits>
+
+#include "Error.h"
+#include "Mutex.h"
+#include "Stats.h"
+
+namespace encfs {
+
+const off_t RangeLockManager::End = std::numeric_limits<off_t>::max();
+
+static bool overlaps(off_t first1, off_t last1, off_t first2, off_t last2) {
+  return first1 <= last2 && first2 <= last1;
+}
+
+RangeLockManager::RangeLockManager() {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_cond_init(&_cond, nullptr);
+}
+
+RangeLockManager::~RangeLockManager() {
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_mutex);
+}
+
+bool RangeLockManager::mustWait(const Range &range) const {
+  for (const Range &held : _held) {
+    if ((range.exclusive || held.exclusive) &&
+        overlaps(range.first, range.last, held.first, held.last)) {
+      return true;
+    }
+  }
+  if (!range.exclusive) {
+    for (const Range &waiting : _waitingExclusive) {
+      if (overlaps(range.first, range.last, waiting.first, waiting.last)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+std::list<RangeLockManager::Range>::iterator RangeLockManager::add(
+    std::list<Range> *list, const Range &range) {
+  if (_spare.empty()) {
+    return list->insert(list->end(), range);
+  }
+  _spare.front() = range;
+  list->splice(list->end(), _spare, _spare.begin());
+  return std::prev(list->end());
+}
+
+void RangeLockManager::lock(off_t first, off_t last, bool exclusive) {
+  CHECK(first <= last);
+  Range range = {first, last, exclusive};
+
+  Lock lock(_mutex);
+  if (mustWait(range)) {
+    Stats::Timer wait(Stats::FileNodeLock);
+    std::list<Range>::iterator waiting;
+    if (exclusive) {
+      waiting = add(&_waitingExclusive, range);
+    }
+    do {
+      pthread_cond_wait(&_cond, &_mutex);
+    } while (mustWait(range));
+    if (exclusive) {
+      _spare.splice(_spare.begin(), _waitingExclusive, waiting);
+    }
+  }
+  add(&_held, range);
+}
+
+void RangeLockManager::unlock(off_t first, off_t last, bool exclusive) {
+  Lock lock(_mutex);
+  for (auto it = _held.begin(); it != _held.end(); ++it) {
+    if (it->first == first && it->last == last &&
+        it->exclusive == exclusive) {
+      _spare.splice(_spare.begin(), _held, it);
+      break;
+    }
+  }
+  pthread_cond_broadcast(&_cond);
+}
+
+RangeLock::RangeLock(RangeLockManager &manager, off_t first, off_t last,
+                     bool exclusive)
+    : _manager(manager), _first(first), _last(last), _exclusive(exclusive) {
+  _manager.lock(_first, _last, _exclusive);
+  _held = lockTaken();
+}
+
+RangeLock::RangeLock(RangeLockManager &manager, bool exclusive)
+    : RangeLock(manager, 0, RangeLockManager::End, exclusive) {}
+
+RangeLock::~RangeLock() {
+  lockReleased(Stats::FileNodeLock, _held);
+  _manager.unlock(_first, _last, _exclusive);
+}
+
+}  // namespace encfs
@@ -0,0 +1,94 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RangeLock_incl_
+#define _RangeLock_incl_
+
+#include <cstdint>
+#include <list>
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace encfs {
+
+/*
+    Reader / writer locks over inclusive ranges of block numbers of one file.
+
+    Shared holders of overlapping ranges run concurrently, exclusive holders
+    exclude everybody overlapping their range.  A waiting exclusive request
+    blocks new shared requests which overlap it, so writers are not starved
+    by a stream of readers.
+
+    Each caller must hold at most one range of a manager at a time.
+*/
+class RangeLockManager {
+ public:
+  // last block number of a whole-file range
+  static const off_t End;
+
+  RangeLockManager();
+  ~RangeLockManager();
+
+  RangeLockManager(const RangeLockManager &src) = delete;
+  RangeLockManager &operator=(const RangeLockManager &src) = delete;
+
+  void lock(off_t first, off_t last, bool exclusive);
+  void unlock(off_t first, off_t last, bool exclusive);
+
+ private:
+  struct Range {
+    off_t first;
+    off_t last;
+    bool exclusive;
+  };
+
+  bool mustWait(const Range &range) const;
+  // range added to list, in a node of _spare if there is one
+  std::list<Range>::iterator add(std::list<Range> *list, const Range &range);
+
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond;
+  std::list<Range> _held;
+  std::list<Range> _waitingExclusive;
+  // nodes of released ranges, so that taking a range doesn't allocate
+  std::list<Range> _spare;
+};
+
+/*
+    Scoped lock on a range, or on the whole file.
+*/
+class RangeLock {
+ public:
+  RangeLock(RangeLockManager &manager, off_t first, off_t last,
+            bool exclusive);
+  RangeLock(RangeLockManager &manager, bool exclusive);
+  ~RangeLock();
+
+  RangeLock(const RangeLock &src) = delete;
+  RangeLock &operator=(const RangeLock &src) = delete;
+
+ private:
+  RangeLockManager &_manager;
+  off_t _first;
+  off_t _last;
+  bool _exclusive;
+  uint64_t _held;  // see Stats::FileNodeHold
+};
+
+}  // namespace encfs
+
+#endif
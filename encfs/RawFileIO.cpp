@@ -24,6 +24,8 @@
 #include "easylogging++.h"
 #include <cerrno>
 #include <cinttypes>
+#include <climits>
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -32,7 +34,11 @@
 
 #include "Error.h"
 #include "FileIO.h"
+#include "MemoryPool.h"
+#include "Mutex.h"
 #include "RawFileIO.h"
+#include "Stats.h"
+#include "Trace.h"
 
 using namespace std;
 
@@ -51,16 +57,56 @@ inline void swap(int &x, int &y) {
   y = tmp;
 }
 
+const size_t RawFileIO::DirectAlign;
+
 RawFileIO::RawFileIO()
-    : knownSize(false), fileSize(0), fd(-1), oldfd(-1), canWrite(false) {}
+    : device(0),
+      knownSize(false),
+      fileSize(0),
+      sparse(false),
+      fd(-1),
+      oldfd(-1),
+      canWrite(false),
+      directIO(false),
+      direct(false),
+      dropBehind(false),
+      relaxedStat(false),
+      hintStart(-1),
+      hintEnd(-1),
+      hintDropped(0),
+      hintStream(false),
+      writeBehind(0),
+      behindStart(-1),
+      behindEnd(-1) {
+  pthread_mutex_init(&sizeMutex, nullptr);
+  pthread_mutex_init(&hintMutex, nullptr);
+}
 
-RawFileIO::RawFileIO(std::string fileName)
+RawFileIO::RawFileIO(std::string fileName, bool directIO,
+                     std::shared_ptr<DirFdCache> dirFds)
     : name(std::move(fileName)),
+      dirFds(std::move(dirFds)),
+      device(0),
       knownSize(false),
       fileSize(0),
+      sparse(false),
       fd(-1),
       oldfd(-1),
-      canWrite(false) {}
+      canWrite(false),
+      directIO(directIO),
+      direct(false),
+      dropBehind(false),
+      relaxedStat(false),
+      hintStart(-1),
+      hintEnd(-1),
+      hintDropped(0),
+      hintStream(false),
+      writeBehind(0),
+      behindStart(-1),
+      behindEnd(-1) {
+  pthread_mutex_init(&sizeMutex, nullptr);
+  pthread_mutex_init(&hintMutex, nullptr);
+}
 
 RawFileIO::~RawFileIO() {
   int _fd = -1;
@@ -76,6 +122,8 @@ RawFileIO::~RawFileIO() {
   if (_fd != -1) {
     close(_fd);
   }
+  pthread_mutex_destroy(&hintMutex);
+  pthread_mutex_destroy(&sizeMutex);
 }
 
 Interface RawFileIO::interface() const { return RawFileIO_iface; }
@@ -116,12 +164,26 @@ static int open_readonly_workaround(const char *path, int flags) {
     -  Also keep the O_LARGEFILE flag, in case the underlying filesystem needs
        it..
 */
-int RawFileIO::open(int flags) {
+int RawFileIO::open(int flags) { return openFile(flags, false, 0); }
+
+/*
+    The new file is empty, so its size is known without a stat.
+*/
+int RawFileIO::create(mode_t mode) {
+  int res = openFile(O_RDWR, true, mode);
+  if (res >= 0) {
+    fileSize = 0;
+    knownSize = true;
+  }
+  return res;
+}
+
+int RawFileIO::openFile(int flags, bool create, mode_t mode) {
   bool requestWrite = (((flags & O_RDWR) != 0) || ((flags & O_WRONLY) != 0));
   VLOG(1) << "open call, requestWrite = " << requestWrite;
 
   // if we have a descriptor and it is writable, or we don't need writable..
-  if ((fd >= 0) && (canWrite || !requestWrite)) {
+  if (!create && (fd >= 0) && (canWrite || !requestWrite)) {
     VLOG(1) << "using existing file descriptor";
     return fd;  // success
   }
@@ -134,17 +196,48 @@ int RawFileIO::open(int flags) {
   }
 #else
 #warning O_LARGEFILE not supported
+#endif
+  if (create) {
+    finalFlags |= O_CREAT | O_EXCL;
+  }
+
+  bool useDirect = false;
+#if defined(O_DIRECT)
+  if (directIO) {
+    finalFlags |= O_DIRECT;
+    useDirect = true;
+  }
 #endif
 
+  AtPath at(dirFds.get(), name);
   int eno = 0;
-  int newFd = ::open(name.c_str(), finalFlags);
+  int newFd;
+  {
+    Stats::Timer timer(Stats::Syscall);
+    newFd = ::openat(at.dir(), at.name(), finalFlags, mode);
+  }
   if (newFd < 0) {
     eno = errno;
   }
+#if defined(O_DIRECT)
+  if (newFd < 0 && eno == EINVAL && useDirect) {
+    // the filesystem doesn't do O_DIRECT, e.g. tmpfs.  A new file has been
+    // created by then.
+    VLOG(1) << "O_DIRECT not supported for " << name;
+    finalFlags &= ~(O_DIRECT | O_EXCL);
+    useDirect = false;
+    eno = 0;
+    newFd = ::openat(at.dir(), at.name(), finalFlags, mode);
+    if (newFd < 0) {
+      eno = errno;
+    }
+  }
+#endif
+  ENCFS_TRACE2(raw__open, finalFlags, newFd);
 
   VLOG(1) << "open file with flags " << finalFlags << ", result = " << newFd;
 
-  if ((newFd == -1) && (eno == EACCES)) {
+  if ((newFd == -1) && (eno == EACCES) && !create) {
     VLOG(1) << "using readonly workaround for open";
     newFd = open_readonly_workaround(name.c_str(), finalFlags);
     eno = errno;
@@ -160,9 +253,22 @@ int RawFileIO::open(int flags) {
                 << ", newfd = " << newFd;
   }
 
+  // fewer blocks than bytes, the file has holes
+  struct stat stbuf;
+  if (create) {
+    sparse = false;
+    if (scheduler && fstat(newFd, &stbuf) == 0) {
+      device = stbuf.st_dev;
+    }
+  } else if (fstat(newFd, &stbuf) == 0) {
+    sparse = stbuf.st_blocks * 512 < stbuf.st_size;
+    device = stbuf.st_dev;
+  }
+
   // the old fd might still be in use, so just keep it around for
   // now.
   canWrite = requestWrite;
+  direct = useDirect;
   oldfd = fd;
   fd = newFd;
 
@@ -170,14 +276,21 @@ int RawFileIO::open(int flags) {
 }
 
 int RawFileIO::getAttr(struct stat *stbuf) const {
-  int res = lstat(name.c_str(), stbuf);
+  AtPath at(dirFds.get(), name);
+  int res = statAt(at, stbuf, relaxedStat);
   int eno = errno;
 
   if (res < 0) {
     RLOG(DEBUG) << "getAttr error on " << name << ": " << strerror(eno);
+    return -eno;
   }
 
-  return (res < 0) ? -eno : 0;
+  // a getSize of the same call needn't ask the server again
+  if (relaxedStat && !knownSize && S_ISREG(stbuf->st_mode)) {
+    const_cast<RawFileIO *>(this)->fileSize = stbuf->st_size;
+    const_cast<RawFileIO *>(this)->knownSize = true;
+  }
+  return 0;
 }
 
 void RawFileIO::setFileName(const char *fileName) { name = fileName; }
@@ -188,7 +301,8 @@ off_t RawFileIO::getSize() const {
   if (!knownSize) {
     struct stat stbuf;
     memset(&stbuf, 0, sizeof(struct stat));
-    int res = lstat(name.c_str(), &stbuf);
+    AtPath at(dirFds.get(), name);
+    int res = statAt(at, &stbuf, relaxedStat, true);
 
     if (res == 0) {
       const_cast<RawFileIO *>(this)->fileSize = stbuf.st_size;
@@ -205,70 +319,403 @@ off_t RawFileIO::getSize() const {
 ssize_t RawFileIO::read(const IORequest &req) const {
   rAssert(fd >= 0);
 
-  ssize_t readSize = pread(fd, req.data, req.dataLen, req.offset);
+  ssize_t holeSize = readHole(req);
+  if (holeSize >= 0) {
+    return holeSize;
+  }
+
+  if (direct) {
+    return directRead(req);
+  }
+  ssize_t readSize = readAt(req.data, req.dataLen, req.offset);
+  if (readSize > 0 && dropBehind) {
+    readHint(req.offset, readSize);
+  }
+  return readSize;
+}
+
+// Hints are given for this much of a stream at a time, in aligned chunks:
+// the page cache keeps large files in folios of up to 2 MiB, which are only
+// dropped if the range covers them whole.
+static const off_t HintChunk = 4 << 20;
+
+/*
+    Follows the reads of the file.  Once a read continues where the last one
+    ended (or repeats it), the kernel is told the file is read sequentially,
+    which widens its read ahead.  Each time the stream enters a new chunk,
+    the kernel is asked to drop the chunks it has left behind and to start
+    on the next one.  Pages with data not written back yet are left alone by
+    the kernel.  A read elsewhere ends the stream.
+*/
+void RawFileIO::readHint(off_t offset, size_t len) const {
+#if defined(POSIX_FADV_DONTNEED)
+  Lock lock(hintMutex);
+
+  // a read of the same place again (a retry) doesn't end the stream
+  bool continues = offset >= hintStart && offset <= hintEnd;
+  hintStart = offset;
+  hintEnd = offset + len;
+  off_t chunk = offset & ~(HintChunk - 1);
+  if (!continues) {
+    if (hintStream) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL);
+      hintStream = false;
+    }
+    hintDropped = chunk;
+    return;
+  }
+
+  if (!hintStream) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    hintStream = true;
+  }
+  if (chunk > hintDropped) {
+    posix_fadvise(fd, hintDropped, chunk - hintDropped, POSIX_FADV_DONTNEED);
+    posix_fadvise(fd, chunk + HintChunk, HintChunk, POSIX_FADV_WILLNEED);
+    hintDropped = chunk;
+  }
+#else
+  (void)offset;
+  (void)len;
+#endif
+}
+
+/*
+    Follows the writes of the file, which continue one another when they
+    start past the chunk writeback was last started at and not more than a
+    chunk past the end of the last one (FUSE threads may pass each other).
+    Each time the stream moves writeBehind past the end of a chunk, the
+    kernel is asked to start writing back the chunks behind, without
+    waiting for them, so that dirty pages don't build up until the kernel
+    writes them out in a burst, or fsync() has to.  A write elsewhere starts
+    a new stream.
+*/
+void RawFileIO::writeHint(off_t offset, size_t len) {
+#if defined(SYNC_FILE_RANGE_WRITE)
+  Lock lock(hintMutex);
+
+  off_t end = offset + len;
+  if (behindStart < 0 || offset < behindStart ||
+      offset > behindEnd + HintChunk) {
+    behindStart = offset & ~(HintChunk - 1);
+    behindEnd = end;
+    return;
+  }
+  behindEnd = std::max(behindEnd, end);
+
+  off_t upTo = (behindEnd - writeBehind) & ~(HintChunk - 1);
+  if (upTo > behindStart) {
+    // errors show up in the next fsync()
+    sync_file_range(fd, behindStart, upTo - behindStart,
+                    SYNC_FILE_RANGE_WRITE);
+    behindStart = upTo;
+  }
+#else
+  (void)offset;
+  (void)len;
+#endif
+}
+
+ssize_t RawFileIO::readAt(unsigned char *buf, size_t len, off_t offset) const {
+  ssize_t readSize;
+  {
+    Stats::Timer timer(Stats::Pread);
+    ENCFS_TRACE3(raw__pread__entry, fd, offset, len);
+    readSize = scheduler ? scheduler->read(fd, device, buf, len, offset)
+                         : pread(fd, buf, len, offset);
+    ENCFS_TRACE1(raw__pread__return, readSize);
+  }
 
   if (readSize < 0) {
     int eno = errno;
-    RLOG(WARNING) << "read failed at offset " << req.offset << " for "
-                  << req.dataLen << " bytes: " << strerror(eno);
+    RLOG(WARNING) << "read failed at offset " << offset << " for " << len
+                  << " bytes: " << strerror(eno);
     return -eno;
   }
 
+  Stats::add(Stats::BackingBytesRead, readSize);
   return readSize;
 }
 
+/*
+    Zero fills a read which lies entirely in a hole of the file.  Returns the
+    number of bytes, or -1 if the file has data in the range, or we don't
+    know.  A range with only some data is read as usual.
+*/
+ssize_t RawFileIO::readHole(const IORequest &req) const {
+#if defined(SEEK_DATA)
+  if (!sparse) {
+    return -1;
+  }
+  off_t size = getSize();
+  if (size <= req.offset) {
+    return -1;
+  }
+  off_t end = std::min(size, req.offset + (off_t)req.dataLen);
+
+  off_t data = ::lseek(fd, req.offset, SEEK_DATA);
+  if (data < 0 && errno == ENXIO) {
+    data = size;  // only a hole up to the end of file
+  }
+  if (data < end) {
+    return -1;
+  }
+
+  memset(req.data, 0, end - req.offset);
+  return end - req.offset;
+#else
+  (void)req;
+  return -1;
+#endif
+}
+
 ssize_t RawFileIO::write(const IORequest &req) {
   rAssert(fd >= 0);
   rAssert(canWrite);
 
-  // int retrys = 10;
-  void *buf = req.data;
-  ssize_t bytes = req.dataLen;
-  off_t offset = req.offset;
-
-  /*
-   * Let's write while pwrite() writes, to avoid writing only a part of the
-   * request,
-   * whereas it could have been fully written. This to avoid inconsistencies /
-   * corruption.
-   */
-  // while ((bytes != 0) && retrys > 0) {
+  if (direct) {
+    return directWrite(req);
+  }
+
+  if (!sparse && req.offset > getSize()) {
+    sparse = true;  // the gap is left as a hole
+  }
+
+  int res = writeAt(req.data, req.dataLen, req.offset);
+  if (res < 0) {
+    return res;
+  }
+  if (writeBehind > 0) {
+    writeHint(req.offset, req.dataLen);
+  }
+
+  if (knownSize) {
+    off_t last = req.offset + req.dataLen;
+    if (last > fileSize) {
+      fileSize = last;
+    }
+  }
+
+  return req.dataLen;
+}
+
+ssize_t RawFileIO::writeGather(off_t offset, const struct iovec *iov,
+                               int count) {
+  rAssert(fd >= 0);
+  rAssert(canWrite);
+
+  // direct writes need one aligned buffer, and the scheduler merges plain
+  // buffers itself
+  if (direct || scheduler || count > IOV_MAX) {
+    return FileIO::writeGather(offset, iov, count);
+  }
+
+  size_t len = 0;
+  for (int i = 0; i < count; ++i) {
+    len += iov[i].iov_len;
+  }
+  if (!sparse && offset > getSize()) {
+    sparse = true;
+  }
+
+  ssize_t writeSize;
+  {
+    Stats::Timer timer(Stats::Pwrite);
+    ENCFS_TRACE3(raw__pwrite__entry, fd, offset, len);
+    writeSize = ::pwritev(fd, iov, count, offset);
+    ENCFS_TRACE1(raw__pwrite__return, writeSize);
+  }
+  if (writeSize < 0) {
+    int eno = errno;
+    knownSize = false;
+    RLOG(WARNING) << "write failed at offset " << offset << " for " << len
+                  << " bytes: " << strerror(eno);
+    return -eno;
+  }
+  Stats::add(Stats::BackingBytesWritten, writeSize);
+
+  // what a short write left over goes through writeAt
+  size_t done = writeSize;
+  off_t pos = offset;
+  for (int i = 0; i < count; ++i) {
+    size_t skip = std::min(done, iov[i].iov_len);
+    done -= skip;
+    if (skip < iov[i].iov_len) {
+      int res = writeAt((const unsigned char *)iov[i].iov_base + skip,
+                        iov[i].iov_len - skip, pos + (off_t)skip);
+      if (res < 0) {
+        return res;
+      }
+    }
+    pos += iov[i].iov_len;
+  }
+
+  if (writeBehind > 0) {
+    writeHint(offset, len);
+  }
+  if (knownSize && offset + (off_t)len > fileSize) {
+    fileSize = offset + (off_t)len;
+  }
+  return len;
+}
+
+/*
+    Let's write while pwrite() writes, to avoid writing only a part of the
+    request, whereas it could have been fully written.  This to avoid
+    inconsistencies / corruption.
+    Returns 0, or -errno in case of failure.
+*/
+int RawFileIO::writeAt(const unsigned char *buf, size_t bytes, off_t offset) {
   while (bytes != 0) {
-    ssize_t writeSize = ::pwrite(fd, buf, bytes, offset);
+    ssize_t writeSize;
+    {
+      Stats::Timer timer(Stats::Pwrite);
+      ENCFS_TRACE3(raw__pwrite__entry, fd, offset, bytes);
+      writeSize = scheduler
+                      ? scheduler->write(fd, device, buf, bytes, offset)
+                      : ::pwrite(fd, buf, bytes, offset);
+      ENCFS_TRACE1(raw__pwrite__return, writeSize);
+    }
 
     if (writeSize < 0) {
       int eno = errno;
       knownSize = false;
       RLOG(WARNING) << "write failed at offset " << offset << " for " << bytes
                     << " bytes: " << strerror(eno);
-      // pwrite is not expected to return 0, so eno should always be set, but we
-      // never know...
       return -eno;
     }
+    // pwrite is not expected to return 0, but we never know...
     if (writeSize == 0) {
+      knownSize = false;
       return -EIO;
     }
 
+    Stats::add(Stats::BackingBytesWritten, writeSize);
     bytes -= writeSize;
     offset += writeSize;
-    buf = (void *)((char *)buf + writeSize);
+    buf += writeSize;
   }
+  return 0;
+}
 
-  // if (bytes != 0) {
-  //   RLOG(ERROR) << "Write error: wrote " << req.dataLen - bytes << " bytes of
-  //   "
-  //               << req.dataLen << ", max retries reached";
-  //   knownSize = false;
-  //   return (eno) ? -eno : -EIO;
-  // }
-  if (knownSize) {
-    off_t last = req.offset + req.dataLen;
-    if (last > fileSize) {
-      fileSize = last;
+/*
+    O_DIRECT transfers need their buffer, offset and length aligned, which
+    the requests from the coding layers seldom are: blocks are shifted by the
+    file header, and the last one is short.  Unless a request happens to be
+    aligned, it goes through an aligned bounce buffer covering it.
+*/
+static inline bool isAligned(off_t value) {
+  return (value & (RawFileIO::DirectAlign - 1)) == 0;
+}
+
+static inline off_t alignDown(off_t value) {
+  return value & ~(off_t)(RawFileIO::DirectAlign - 1);
+}
+
+static inline off_t alignUp(off_t value) {
+  return alignDown(value + RawFileIO::DirectAlign - 1);
+}
+
+ssize_t RawFileIO::directRead(const IORequest &req) const {
+  if (isAligned(req.offset) && isAligned(req.dataLen) &&
+      isAligned((uintptr_t)req.data)) {
+    return readAt(req.data, req.dataLen, req.offset);
+  }
+
+  off_t start = alignDown(req.offset);
+  size_t span = alignUp(req.offset + req.dataLen) - start;
+  MemBlock mb = MemoryPool::allocateAligned(span, DirectAlign);
+  ssize_t res = readAt(mb.data, span, start);
+  if (res > 0) {
+    off_t skip = req.offset - start;
+    res = (res > skip) ? std::min((size_t)(res - skip), req.dataLen) : 0;
+    memcpy(req.data, mb.data + skip, res);
+  }
+  MemoryPool::release(mb);
+  return res;
+}
+
+/*
+    The partial sectors at either end are read, merged with the request and
+    written back whole, under an exclusive lock on the sectors.  A write into
+    the last sector may extend the file to the end of the sector, so those
+    are serialized by sizeMutex, and the file is cut back to its real size.
+*/
+ssize_t RawFileIO::directWrite(const IORequest &req) {
+  off_t end = req.offset + req.dataLen;
+  off_t start = alignDown(req.offset);
+  off_t spanEnd = alignUp(end);
+  size_t span = spanEnd - start;
+
+  RangeLock lock(sectors, start / DirectAlign, spanEnd / DirectAlign - 1,
+                 true);
+
+  bool sizeLocked = false;
+  off_t size = getSize();
+  if (size < 0 || spanEnd > size) {
+    pthread_mutex_lock(&sizeMutex);
+    sizeLocked = true;
+    knownSize = false;
+    size = getSize();
+  }
+
+  int res = 0;
+  MemBlock mb;
+  const unsigned char *out = req.data;
+  if (size < 0) {
+    res = (int)size;
+  } else if (start != req.offset || spanEnd != end ||
+             !isAligned((uintptr_t)req.data)) {
+    mb = MemoryPool::allocateAligned(span, DirectAlign);
+    // the sectors the request only covers partly
+    off_t edges[2] = {start, spanEnd - (off_t)DirectAlign};
+    for (int i = 0; i < 2 && res == 0; ++i) {
+      off_t sector = edges[i];
+      bool partial = (i == 0) ? start != req.offset : spanEnd != end;
+      if (!partial || (i == 1 && sector == start && start != req.offset)) {
+        continue;  // nothing to merge, or already read as the first sector
+      }
+      unsigned char *buf = mb.data + (sector - start);
+      ssize_t got = 0;
+      if (sector < size) {
+        got = readAt(buf, DirectAlign, sector);
+      }
+      if (got < 0) {
+        res = (int)got;
+      } else {
+        memset(buf + got, 0, DirectAlign - got);
+      }
     }
+    memcpy(mb.data + (req.offset - start), req.data, req.dataLen);
+    out = mb.data;
   }
 
-  return req.dataLen;
+  if (res == 0) {
+    res = writeAt(out, span, start);
+  }
+  if (res == 0 && sizeLocked) {
+    off_t newSize = std::max(size, end);
+    if (spanEnd > newSize && ::ftruncate(fd, newSize) != 0) {
+      res = -errno;
+      knownSize = false;
+      RLOG(WARNING) << "truncate after write to " << newSize
+                    << " failed: " << strerror(-res);
+    } else {
+      if (start > size) {
+        sparse = true;  // the gap is left as a hole
+      }
+      fileSize = newSize;
+      knownSize = true;
+    }
+  }
+
+  if (sizeLocked) {
+    pthread_mutex_unlock(&sizeMutex);
+  }
+  if (mb.data != nullptr) {
+    MemoryPool::release(mb);
+  }
+  return (res < 0) ? res : (ssize_t)req.dataLen;
 }
 
 int RawFileIO::truncate(off_t size) {
@@ -279,6 +726,7 @@ int RawFileIO::truncate(off_t size) {
   } else {
     res = ::truncate(name.c_str(), size);
   }
+  ENCFS_TRACE2(raw__truncate, size, res);
 
   if (res < 0) {
     int eno = errno;
@@ -288,11 +736,15 @@ int RawFileIO::truncate(off_t size) {
     knownSize = false;
   } else {
     res = 0;
+    if (size > fileSize || !knownSize) {
+      sparse = true;  // extended with a hole
+    }
     fileSize = size;
     knownSize = true;
   }
 
   if (fd >= 0 && canWrite) {
+    ENCFS_TRACE1(raw__sync, fd);
 #if defined(HAVE_FDATASYNC)
     ::fdatasync(fd);
 #else
@@ -303,6 +755,120 @@ int RawFileIO::truncate(off_t size) {
   return res;
 }
 
+/*
+    Returns 0, or -errno in case of failure.
+*/
+int RawFileIO::punchHole(off_t offset, off_t length) {
+#if defined(FALLOC_FL_PUNCH_HOLE)
+  if (fd < 0 || !canWrite) {
+    return -EBADF;
+  }
+
+  off_t size = getSize();
+  if (size < 0) {
+    return (int)size;
+  }
+  if (offset + length > size) {
+    // Extend the file with its last byte, which the hole then frees again.
+    // Unlike ftruncate, this never cuts off a concurrent write further out.
+    unsigned char zero = 0;
+    IORequest req;
+    req.offset = offset + length - 1;
+    req.data = &zero;
+    req.dataLen = 1;
+    ssize_t res = write(req);
+    if (res < 0) {
+      return (int)res;
+    }
+  }
+
+  if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                  length) < 0) {
+    int eno = errno;
+    VLOG(1) << "punching a hole failed for " << name << " at offset "
+            << offset << " for " << length << " bytes: " << strerror(eno);
+    return -eno;
+  }
+  sparse = true;
+  return 0;
+#else
+  (void)offset;
+  (void)length;
+  return -EOPNOTSUPP;
+#endif
+}
+
+/*
+    Returns 0, or -errno in case of failure.
+*/
+int RawFileIO::allocate(off_t offset, off_t length) {
+#if defined(FALLOC_FL_KEEP_SIZE)
+  if (fd < 0 || !canWrite) {
+    return -EBADF;
+  }
+
+  // the size of the lower file is the plaintext size, it only changes by
+  // writing through the layers above
+  if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length) < 0) {
+    int eno = errno;
+    VLOG(1) << "allocate failed for " << name << " at offset " << offset
+            << " for " << length << " bytes: " << strerror(eno);
+    return -eno;
+  }
+  return 0;
+#else
+  (void)offset;
+  (void)length;
+  return -EOPNOTSUPP;
+#endif
+}
+
+/*
+    Asks the file system, through SEEK_DATA, for files which had holes when
+    opened or got them since.  Any other file has none.
+*/
+off_t RawFileIO::nextData(off_t offset) const {
+#if defined(SEEK_DATA)
+  if (!sparse || fd < 0) {
+    return offset;
+  }
+  off_t data = ::lseek(fd, offset, SEEK_DATA);
+  if (data < 0) {
+    if (errno != ENXIO) {
+      return offset;  // can't tell, as on file systems without holes
+    }
+    data = std::max(offset, getSize());  // only a hole up to the end
+  }
+  return data;
+#else
+  return offset;
+#endif
+}
+
+off_t RawFileIO::nextHole(off_t offset) const {
+#if defined(SEEK_HOLE)
+  if (sparse && fd >= 0) {
+    off_t hole = ::lseek(fd, offset, SEEK_HOLE);
+    if (hole >= 0) {
+      return hole;
+    }
+  }
+#endif
+  off_t size = getSize();
+  return size < 0 ? size : std::max(offset, size);
+}
+
 bool RawFileIO::isWritable() const { return canWrite; }
 
+void RawFileIO::invalidate() {
+  struct stat stbuf;
+  if (fd >= 0 && fstat(fd, &stbuf) == 0) {
+    fileSize = stbuf.st_size;
+    knownSize = true;
+    sparse = stbuf.st_blocks * 512 < stbuf.st_size;
+  } else {
+    knownSize = false;
+  }
+}
+
 }  // namespace encfs
@@ -21,18 +21,50 @@
 #ifndef _RawFileIO_incl_
 #define _RawFileIO_incl_
 
+#include <atomic>
+#include <memory>
+#include <pthread.h>
 #include <string>
 #include <sys/types.h>
 
+#include "DirFdCache.h"
 #include "FileIO.h"
+#include "IOScheduler.h"
 #include "Interface.h"
+#include "RangeLock.h"
 
 namespace encfs {
 
+/*
+    Reads and writes a backing file with pread / pwrite.
+
+    With directIO the file is opened with O_DIRECT, so that the ciphertext
+    doesn't take up the page cache next to the plaintext in FUSE's.
+    Requests which aren't aligned to DirectAlign are served through aligned
+    buffers, and writes merge partial sectors.  Filesystems which refuse
+    O_DIRECT are used without it.
+
+    Reads which lie in a hole of a sparse file are answered with zeros, found
+    with SEEK_DATA, without reading the file.
+
+    With a DirFdCache, the file is opened and looked up relative to the
+    cached descriptor of its directory.  With an IOScheduler, reads and
+    writes of the file go through it.
+
+    With drop behind (--dropbehind), reads which continue where the last one
+    ended are taken as a stream: the kernel is told to read ahead of it, and
+    to drop the ciphertext pages the stream has passed, whose plaintext is
+    cached above.  The page cache then holds each file once rather than
+    twice.
+*/
 class RawFileIO : public FileIO {
  public:
+  // alignment of O_DIRECT transfers
+  static const size_t DirectAlign = 4096;
+
   RawFileIO();
-  RawFileIO(std::string fileName);
+  RawFileIO(std::string fileName, bool directIO = false,
+            std::shared_ptr<DirFdCache> dirFds = nullptr);
   virtual ~RawFileIO();
 
   virtual Interface interface() const;
@@ -41,26 +73,88 @@ class RawFileIO : public FileIO {
   virtual const char *getFileName() const;
 
   virtual int open(int flags);
+  virtual int create(mode_t mode);
 
   virtual int getAttr(struct stat *stbuf) const;
   virtual off_t getSize() const;
 
   virtual ssize_t read(const IORequest &req) const;
   virtual ssize_t write(const IORequest &req);
+  virtual ssize_t writeGather(off_t offset, const struct iovec *iov,
+                              int count);
 
   virtual int truncate(off_t size);
+  virtual int punchHole(off_t offset, off_t length);
+  virtual int allocate(off_t offset, off_t length);
+  virtual off_t nextData(off_t offset) const;
+  virtual off_t nextHole(off_t offset) const;
 
   virtual bool isWritable() const;
+  virtual void invalidate();
+
+  // whether the open descriptor uses O_DIRECT
+  bool isDirect() const { return direct; }
+
+  void setDropBehind(bool on) { dropBehind = on; }
+  // start writing back what was written lag bytes ago, 0 == off
+  void setWriteBehind(off_t lag) { writeBehind = lag; }
+
+  // attributes may come from the cache of a network filesystem (--netfs)
+  void setRelaxedStat(bool on) { relaxedStat = on; }
+
+  // reads and writes go through scheduler (--iodepth), unless null
+  void setScheduler(std::shared_ptr<IOScheduler> scheduler) {
+    this->scheduler = std::move(scheduler);
+  }
 
  protected:
+  int openFile(int flags, bool create, mode_t mode);
+  ssize_t readAt(unsigned char *buf, size_t len, off_t offset) const;
+  ssize_t readHole(const IORequest &req) const;
+  int writeAt(const unsigned char *buf, size_t bytes, off_t offset);
+
+  ssize_t directRead(const IORequest &req) const;
+  ssize_t directWrite(const IORequest &req);
+
+  // page cache hints for a read of len bytes at offset, with drop behind
+  void readHint(off_t offset, size_t len) const;
+  // writeback of the stream a write of len bytes at offset belongs to
+  void writeHint(off_t offset, size_t len);
+
   std::string name;
+  std::shared_ptr<DirFdCache> dirFds;
+  std::shared_ptr<IOScheduler> scheduler;
+  dev_t device;  // of the open file, for the scheduler
 
-  bool knownSize;
-  off_t fileSize;
+  std::atomic<bool> knownSize;
+  std::atomic<off_t> fileSize;
+  // the file may have holes, so reads look for them first
+  std::atomic<bool> sparse;
 
   int fd;
   int oldfd;
   bool canWrite;
+
+  bool directIO;  // open with O_DIRECT if the filesystem supports it
+  bool direct;    // the descriptor uses O_DIRECT
+  // sectors being merged by direct writes, and extending direct writes
+  RangeLockManager sectors;
+  pthread_mutex_t sizeMutex;
+
+  bool dropBehind;
+  bool relaxedStat;
+  // the stream followed by readHint
+  mutable pthread_mutex_t hintMutex;
+  mutable off_t hintStart;    // the last read
+  mutable off_t hintEnd;
+  mutable off_t hintDropped;  // start of the chunks not dropped yet
+  mutable bool hintStream;    // the kernel was told to read ahead
+
+  off_t writeBehind;
+  // the stream followed by writeHint, of which writeback was started up to
+  // behindStart
+  off_t behindStart;
+  off_t behindEnd;
 };
 
 }  // namespace encfs
@@ -19,6 +19,9 @@
  */
 
 #include "easylogging++.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
@@ -26,18 +29,28 @@
 #include <openssl/hmac.h>
 #include <openssl/ossl_typ.h>
 #include <openssl/rand.h>
+#include <openssl/sha.h>
 #include <pthread.h>
 #include <string>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
+#include "Argon2.h"
+#include "ByteShuffle.h"
 #include "Cipher.h"
 #include "Error.h"
 #include "Interface.h"
+#include "KernelCipher.h"
+#include "MultiCBC.h"
 #include "Mutex.h"
 #include "Range.h"
 #include "SSL_Cipher.h"
+#include "SipHash.h"
 #include "SSL_Compat.h"
+#include "Stats.h"
 #include "intl/gettext.h"
 
 using namespace std;
@@ -152,6 +165,43 @@ int TimedPBKDF2(const char *pass, int passlen, const unsigned char *salt,
   }
 }
 
+/*
+    Like TimedPBKDF2, for Argon2id: params.passes is raised until the
+    derivation takes most of desiredPDFTime (in microseconds).  Returns the
+    number of passes used for out, or -1 on failure.
+*/
+int TimedArgon2(const char *pass, int passlen, const unsigned char *salt,
+                int saltlen, int keylen, unsigned char *out,
+                Argon2::Params params, long desiredPDFTime) {
+  params.passes = 1;
+  timeval start, end;
+
+  for (;;) {
+    gettimeofday(&start, nullptr);
+    if (!Argon2::derive(params, (const unsigned char *)pass, passlen, salt,
+                        saltlen, out, keylen)) {
+      return -1;
+    }
+
+    gettimeofday(&end, nullptr);
+
+    long delta = std::max(time_diff(end, start), 1L);
+    if (delta >= (5 * desiredPDFTime / 6)) {
+      return params.passes;
+    }
+    // the time is linear in the number of passes
+    double estimate =
+        (double)params.passes * (double)desiredPDFTime / (double)delta;
+    if (estimate > 1 << 20) {
+      estimate = 1 << 20;
+    }
+    if ((uint32_t)estimate <= params.passes) {
+      return params.passes;
+    }
+    params.passes = (uint32_t)estimate;
+  }
+}
+
 // - Version 1:0 used EVP_BytesToKey, which didn't do the right thing for
 // Blowfish key lengths > 128 bit.
 // - Version 2:0 uses BytesToKey.
@@ -159,14 +209,28 @@ int TimedPBKDF2(const char *pass, int passlen, const unsigned char *salt,
 // - Version 2:1 adds support for Message Digest function interface
 // - Version 2:2 adds PBKDF2 for password derivation
 // - Version 3:0 adds a new IV mechanism
-static Interface BlowfishInterface("ssl/blowfish", 3, 0, 2);
-static Interface AESInterface("ssl/aes", 3, 0, 2);
-static Interface CAMELLIAInterface("ssl/camellia", 3, 0, 2);
+// - Version 4:0 allows blocks larger than 4 KiB, up to 1 MiB.  Volumes with
+// smaller blocks are still recorded as 3:0, see volumeInterface().
+static Interface BlowfishInterface("ssl/blowfish", 4, 0, 3);
+static Interface AESInterface("ssl/aes", 4, 0, 3);
+static Interface CAMELLIAInterface("ssl/camellia", 4, 0, 3);
+// - Version 3:0 of ssl/aes-xts is ssl/aes 3:0 with XTS instead of CBC for
+// full blocks, 4:0 follows ssl/aes 4:0
+static Interface AESXTSInterface("ssl/aes-xts", 4, 0, 1);
+// - Version 3:0 of ssl/aes-ctr is ssl/aes 3:0 with file data in CTR mode,
+// 4:0 follows ssl/aes 4:0
+static Interface AESCTRInterface("ssl/aes-ctr", 4, 0, 1);
+// - Version 3:0 of ssl/chacha20 is ssl/aes 3:0 with file data sealed by
+// ChaCha20-Poly1305, 4:0 follows ssl/aes 4:0
+static Interface ChaChaInterface("ssl/chacha20", 4, 0, 1);
+
+// largest block of the 3:0 interfaces
+static const int V3MaxBlockSize = 4096;
 
 #ifndef OPENSSL_NO_CAMELLIA
 
 static Range CAMELLIAKeyRange(128, 256, 64);
-static Range CAMELLIABlockRange(64, 4096, 16);
+static Range CAMELLIABlockRange(64, 1 << 20, 16);
 
 static std::shared_ptr<Cipher> NewCAMELLIACipher(const Interface &iface,
                                                  int keyLen) {
@@ -208,7 +272,7 @@ static bool CAMELLIA_Cipher_registered =
 #ifndef OPENSSL_NO_BF
 
 static Range BFKeyRange(128, 256, 32);
-static Range BFBlockRange(64, 4096, 8);
+static Range BFBlockRange(64, 1 << 20, 8);
 
 static std::shared_ptr<Cipher> NewBFCipher(const Interface &iface, int keyLen) {
   if (keyLen <= 0) {
@@ -234,10 +298,10 @@ static bool BF_Cipher_registered =
 #ifndef OPENSSL_NO_AES
 
 static Range AESKeyRange(128, 256, 64);
-static Range AESBlockRange(64, 4096, 16);
+static Range AESBlockRange(64, 1 << 20, 16);
 
-static std::shared_ptr<Cipher> NewAESCipher(const Interface &iface,
-                                            int keyLen) {
+static std::shared_ptr<Cipher> newAES(const Interface &iface, int keyLen,
+                                      const char *kernelMode) {
   if (keyLen <= 0) {
     keyLen = 192;
   }
@@ -266,13 +330,349 @@ static std::shared_ptr<Cipher> NewAESCipher(const Interface &iface,
   }
 
   return std::shared_ptr<Cipher>(new SSL_Cipher(
-      iface, AESInterface, blockCipher, streamCipher, keyLen / 8));
+      iface, AESInterface, blockCipher, streamCipher, keyLen / 8, kernelMode));
+}
+
+static std::shared_ptr<Cipher> NewAESCipher(const Interface &iface,
+                                            int keyLen) {
+  return newAES(iface, keyLen, nullptr);
 }
 
 static bool AES_Cipher_registered =
     Cipher::Register("AES", "16 byte block cipher", AESInterface, AESKeyRange,
                      AESBlockRange, NewAESCipher);
+
+/*
+    ssl/aes with the CBC coding of full blocks done by the kernel crypto API
+    (AF_ALG), which hands it to an offload engine such as Intel QAT if the
+    machine has one.  The results are those of "AES", so it reads and writes
+    the same volumes; it is hidden, and chosen at mount time with
+    --kernelcrypto.
+*/
+static std::shared_ptr<Cipher> NewAESKernelCipher(const Interface &iface,
+                                                  int keyLen) {
+  return newAES(iface, keyLen, "cbc(aes)");
+}
+
+static bool AESKernel_Cipher_registered = Cipher::Register(
+    "AES-AFALG",
+    // xgroup(setup)
+    gettext_noop("16 byte block cipher, blocks coded by the kernel"),
+    AESInterface, AESKeyRange, AESBlockRange, NewAESKernelCipher, true);
+
+/*
+    AES with XTS for full blocks.  Unlike CBC, every 16 byte unit of a block
+    is encoded independently (given the tweak), so AES-NI can work on several
+    of them at once.  Partial blocks and names use the same CFB stream mode
+    as ssl/aes.  The second XTS key is derived from the volume key, so the key
+    format is that of ssl/aes.
+*/
+static Range AESXTSKeyRange(128, 256, 128);
+
+static std::shared_ptr<Cipher> NewAESXTSCipher(const Interface &iface,
+                                               int keyLen) {
+  if (keyLen <= 0) {
+    keyLen = 256;
+  }
+
+  keyLen = AESXTSKeyRange.closest(keyLen);
+
+  const EVP_CIPHER *blockCipher = nullptr;
+  const EVP_CIPHER *streamCipher = nullptr;
+
+  switch (keyLen) {
+    case 128:
+      blockCipher = EVP_aes_128_xts();
+      streamCipher = EVP_aes_128_cfb();
+      break;
+
+    case 256:
+    default:
+      blockCipher = EVP_aes_256_xts();
+      streamCipher = EVP_aes_256_cfb();
+      break;
+  }
+
+  return std::shared_ptr<Cipher>(new SSL_Cipher(
+      iface, AESXTSInterface, blockCipher, streamCipher, keyLen / 8));
+}
+
+static bool AESXTS_Cipher_registered = Cipher::Register(
+    "AES-XTS",
+    // xgroup(setup)
+    gettext_noop("16 byte block cipher, parallel (XTS) block mode"),
+    AESXTSInterface, AESXTSKeyRange, AESBlockRange, NewAESXTSCipher);
+
+/*
+    ssl/aes with file data in CTR mode, so that any part of a block can be
+    read or written on its own (see Cipher::rangeEncode).  Names, headers and
+    keys are coded as with ssl/aes.
+*/
+static std::shared_ptr<Cipher> NewAESCTRCipher(const Interface &iface,
+                                               int keyLen) {
+  if (keyLen <= 0) {
+    keyLen = 256;
+  }
+
+  keyLen = AESKeyRange.closest(keyLen);
+
+  const EVP_CIPHER *blockCipher = nullptr;
+  const EVP_CIPHER *streamCipher = nullptr;
+  const EVP_CIPHER *rangeCipher = nullptr;
+
+  switch (keyLen) {
+    case 128:
+      blockCipher = EVP_aes_128_cbc();
+      streamCipher = EVP_aes_128_cfb();
+      rangeCipher = EVP_aes_128_ctr();
+      break;
+
+    case 192:
+      blockCipher = EVP_aes_192_cbc();
+      streamCipher = EVP_aes_192_cfb();
+      rangeCipher = EVP_aes_192_ctr();
+      break;
+
+    case 256:
+    default:
+      blockCipher = EVP_aes_256_cbc();
+      streamCipher = EVP_aes_256_cfb();
+      rangeCipher = EVP_aes_256_ctr();
+      break;
+  }
+
+  return std::shared_ptr<Cipher>(
+      new SSL_Cipher(iface, AESCTRInterface, blockCipher, streamCipher,
+                     keyLen / 8, nullptr, rangeCipher));
+}
+
+static bool AESCTR_Cipher_registered = Cipher::Register(
+    "AES-CTR",
+    // xgroup(setup)
+    gettext_noop("16 byte block cipher, CTR file data, needs block MACs"),
+    AESCTRInterface, AESKeyRange, AESBlockRange, NewAESCTRCipher);
+
+#if !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+
+/*
+    File data sealed by ChaCha20-Poly1305 (see Cipher::sealEncode), whose
+    tags take the place of the MACs of MACFileIO.  Names need a deterministic
+    cipher, which a stream cipher can't be, so they are coded as with
+    ssl/aes, and so are headers and keys.
+*/
+static Range ChaChaKeyRange(256);
+
+static std::shared_ptr<Cipher> NewChaChaCipher(const Interface &iface,
+                                               int keyLen) {
+  (void)keyLen;
+  return std::shared_ptr<Cipher>(
+      new SSL_Cipher(iface, ChaChaInterface, EVP_aes_256_cbc(),
+                     EVP_aes_256_cfb(), 32, nullptr, nullptr,
+                     EVP_chacha20_poly1305()));
+}
+
+static bool ChaCha_Cipher_registered = Cipher::Register(
+    "ChaCha20",
+    // xgroup(setup)
+    gettext_noop("ChaCha20-Poly1305 file data, authenticated per block"),
+    ChaChaInterface, ChaChaKeyRange, AESBlockRange, NewChaChaCipher);
 #endif
+#endif
+
+/**
+    HMAC-SHA1 with the key schedule done once: the SHA-1 states after
+    hashing the inner and the outer padded key.  Every MAC starts from a copy
+    of them, made into a context each thread keeps, so that the key is not
+    hashed again and no context is created per MAC.
+*/
+struct HMACSha1 {
+  EVP_MD_CTX *inner;
+  EVP_MD_CTX *outer;
+
+  HMACSha1();
+  ~HMACSha1();
+
+  HMACSha1(const HMACSha1 &) = delete;
+  HMACSha1 &operator=(const HMACSha1 &) = delete;
+
+  bool setKey(const unsigned char *key, size_t len);
+
+  // MAC of data, followed by the extraLen bytes of extra if there are any,
+  // into the SHA_DIGEST_LENGTH bytes of md.
+  bool mac(const unsigned char *data, size_t dataLen,
+           const unsigned char *extra, size_t extraLen,
+           unsigned char *md) const;
+};
+
+/*
+    The context a thread computes its MACs in.  During thread exit, once it
+    has been destroyed, a MAC gets a context of its own.
+*/
+struct ThreadMAC {
+  EVP_MD_CTX *ctx = nullptr;
+
+  ~ThreadMAC();
+};
+
+static thread_local bool tMACGone = false;
+static thread_local ThreadMAC tMAC;
+
+ThreadMAC::~ThreadMAC() {
+  EVP_MD_CTX_free(ctx);
+  ctx = nullptr;
+  tMACGone = true;
+}
+
+HMACSha1::HMACSha1() : inner(EVP_MD_CTX_new()), outer(EVP_MD_CTX_new()) {}
+
+HMACSha1::~HMACSha1() {
+  // freeing cleanses the digest states
+  EVP_MD_CTX_free(inner);
+  EVP_MD_CTX_free(outer);
+}
+
+bool HMACSha1::setKey(const unsigned char *key, size_t len) {
+  if (inner == nullptr || outer == nullptr) {
+    return false;
+  }
+  unsigned char pad[SHA_CBLOCK];
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  if (len > SHA_CBLOCK) {
+    if (EVP_Digest(key, len, digest, nullptr, EVP_sha1(), nullptr) != 1) {
+      return false;
+    }
+    key = digest;
+    len = SHA_DIGEST_LENGTH;
+  }
+
+  memset(pad, 0x36, sizeof(pad));
+  for (size_t i = 0; i < len; ++i) {
+    pad[i] ^= key[i];
+  }
+  bool ok = EVP_DigestInit_ex(inner, EVP_sha1(), nullptr) == 1 &&
+            EVP_DigestUpdate(inner, pad, sizeof(pad)) == 1;
+
+  memset(pad, 0x5c, sizeof(pad));
+  for (size_t i = 0; i < len; ++i) {
+    pad[i] ^= key[i];
+  }
+  ok = ok && EVP_DigestInit_ex(outer, EVP_sha1(), nullptr) == 1 &&
+       EVP_DigestUpdate(outer, pad, sizeof(pad)) == 1;
+
+  OPENSSL_cleanse(pad, sizeof(pad));
+  OPENSSL_cleanse(digest, sizeof(digest));
+  return ok;
+}
+
+bool HMACSha1::mac(const unsigned char *data, size_t dataLen,
+                   const unsigned char *extra, size_t extraLen,
+                   unsigned char *md) const {
+  EVP_MD_CTX *ctx = tMACGone ? EVP_MD_CTX_new() : tMAC.ctx;
+  if (ctx == nullptr) {
+    ctx = tMAC.ctx = EVP_MD_CTX_new();
+    if (ctx == nullptr) {
+      return false;
+    }
+  }
+
+  unsigned int len = 0;
+  bool ok = EVP_MD_CTX_copy_ex(ctx, inner) == 1 &&
+            EVP_DigestUpdate(ctx, data, dataLen) == 1 &&
+            (extraLen == 0 || EVP_DigestUpdate(ctx, extra, extraLen) == 1) &&
+            EVP_DigestFinal_ex(ctx, md, &len) == 1 &&
+            EVP_MD_CTX_copy_ex(ctx, outer) == 1 &&
+            EVP_DigestUpdate(ctx, md, SHA_DIGEST_LENGTH) == 1 &&
+            EVP_DigestFinal_ex(ctx, md, &len) == 1;
+
+  if (tMACGone) {
+    EVP_MD_CTX_free(ctx);
+  } else {
+    EVP_MD_CTX_reset(ctx);
+  }
+  return ok;
+}
+
+/**
+    One set of cipher contexts.  The contexts carry per-operation state (the
+    IV), so a set may only be used by one thread at a time.
+*/
+struct SSLContext {
+  EVP_CIPHER_CTX *block_enc;
+  EVP_CIPHER_CTX *block_dec;
+  EVP_CIPHER_CTX *stream_enc;
+  EVP_CIPHER_CTX *stream_dec;
+  // counter mode of rangeEncode, null unless the cipher has one
+  EVP_CIPHER_CTX *range;
+  // AEAD of sealEncode, null unless the cipher has one
+  EVP_CIPHER_CTX *seal;
+
+  // Recently derived IVs, direct mapped by seed, so that rewriting a block
+  // or re-reading it doesn't cost another HMAC.  Valid as long as the
+  // context belongs to the same key, which it always does.
+  struct IVMemo {
+    uint64_t seed;
+    bool valid;
+    unsigned char ivec[EVP_MAX_IV_LENGTH];
+  };
+  static const int IVMemoSize = 64;
+  IVMemo ivMemo[IVMemoSize];
+
+  SSLContext();
+  ~SSLContext();
+
+  SSLContext(const SSLContext &src) = delete;
+  SSLContext &operator=(const SSLContext &other) = delete;
+
+  // make this set a copy of src, including the key schedule
+  bool copyFrom(const SSLContext &src);
+};
+
+SSLContext::SSLContext() {
+  block_enc = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(block_enc);
+  block_dec = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(block_dec);
+  stream_enc = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(stream_enc);
+  stream_dec = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(stream_dec);
+  range = nullptr;
+  seal = nullptr;
+  memset(ivMemo, 0, sizeof(ivMemo));
+}
+
+SSLContext::~SSLContext() {
+  OPENSSL_cleanse(ivMemo, sizeof(ivMemo));
+  EVP_CIPHER_CTX_free(block_enc);
+  EVP_CIPHER_CTX_free(block_dec);
+  EVP_CIPHER_CTX_free(stream_enc);
+  EVP_CIPHER_CTX_free(stream_dec);
+  EVP_CIPHER_CTX_free(range);
+  EVP_CIPHER_CTX_free(seal);
+}
+
+bool SSLContext::copyFrom(const SSLContext &src) {
+  if (src.range != nullptr) {
+    if (range == nullptr) {
+      range = EVP_CIPHER_CTX_new();
+    }
+    if (EVP_CIPHER_CTX_copy(range, src.range) != 1) {
+      return false;
+    }
+  }
+  if (src.seal != nullptr) {
+    if (seal == nullptr) {
+      seal = EVP_CIPHER_CTX_new();
+    }
+    if (EVP_CIPHER_CTX_copy(seal, src.seal) != 1) {
+      return false;
+    }
+  }
+  return EVP_CIPHER_CTX_copy(block_enc, src.block_enc) == 1 &&
+         EVP_CIPHER_CTX_copy(block_dec, src.block_dec) == 1 &&
+         EVP_CIPHER_CTX_copy(stream_enc, src.stream_enc) == 1 &&
+         EVP_CIPHER_CTX_copy(stream_dec, src.stream_dec) == 1;
+}
 
 class SSLKey : public AbstractCipherKey {
  public:
@@ -285,12 +685,21 @@ class SSLKey : public AbstractCipherKey {
   // followed by iv of _ivLength bytes,
   unsigned char *buffer;
 
-  EVP_CIPHER_CTX *block_enc;
-  EVP_CIPHER_CTX *block_dec;
-  EVP_CIPHER_CTX *stream_enc;
-  EVP_CIPHER_CTX *stream_dec;
+  // Contexts initialized by initKey.  These are never used for encoding, only
+  // as the source for the per-thread copies handed out by acquireContext.
+  SSLContext templateCtx;
+
+  // HMAC of the IVs and of MAC_64, keyed by initKey.  Read only after that,
+  // so all threads share it.
+  HMACSha1 hmac;
+
+  // full blocks go to the kernel when set, see SSL_Cipher's kernelMode
+  std::unique_ptr<KernelCipher> kernel;
+  // AES-CBC of several blocks at once, for blockEncodeMany, if the CPU can
+  std::unique_ptr<MultiCBC> multiCBC;
 
-  HMAC_CTX *mac_ctx;
+  // SipHash key of blockMAC_64
+  unsigned char macKey[16];
 
   SSLKey(int keySize, int ivLength);
 
@@ -301,33 +710,85 @@ class SSLKey : public AbstractCipherKey {
   SSLKey(SSLKey&& other) = delete; // move constructor
   SSLKey& operator=(const SSLKey& other) = delete; // copy assignment
   SSLKey& operator=(SSLKey&& other) = delete; // move assignment
+
+  // Check out a context set for the calling thread.  Each thread keeps the
+  // last set it used, so a thread which keeps using the same key takes no
+  // lock at all.  Otherwise the mutex is only held while popping the free
+  // list, so independent callers encode in parallel.
+  SSLContext *acquireContext();
+  void releaseContext(SSLContext *ctx);
+
+  // give a context set back from another thread's cache, if its key is
+  // still alive
+  static void returnContext(uint64_t serial, SSLContext *ctx);
+
+ private:
+  // unique for the life of the process, unlike the address
+  const uint64_t serial;
+
+  // idle context sets, protected by mutex
+  std::vector<SSLContext *> freeContexts;
+  // all context sets made for this key, including those checked out or
+  // cached by threads, protected by mutex
+  std::vector<SSLContext *> allContexts;
 };
 
-SSLKey::SSLKey(int keySize_, int ivLength_) {
+// live keys by serial, so that thread caches can give sets back.  Never
+// freed, as keys may outlive the other statics.
+static pthread_mutex_t gKeysMutex = PTHREAD_MUTEX_INITIALIZER;
+static auto *gKeys = new std::unordered_map<uint64_t, SSLKey *>();
+static std::atomic<uint64_t> gNextSerial(1);
+
+/*
+    The context set a thread used last, with the serial of its key.  A set
+    cached for a key which has been destroyed since is never touched again,
+    it was freed along with the key.
+*/
+struct ThreadContext {
+  uint64_t serial = 0;
+  SSLContext *ctx = nullptr;
+
+  ~ThreadContext();
+};
+
+// set once the cache of this thread has been destroyed, so late releases
+// during thread exit go straight to the free lists
+static thread_local bool tContextGone = false;
+static thread_local ThreadContext tContext;
+
+ThreadContext::~ThreadContext() {
+  if (ctx != nullptr) {
+    SSLKey::returnContext(serial, ctx);
+    ctx = nullptr;
+  }
+  tContextGone = true;
+}
+
+SSLKey::SSLKey(int keySize_, int ivLength_) : serial(gNextSerial++) {
   this->keySize = keySize_;
   this->ivLength = ivLength_;
   pthread_mutex_init(&mutex, nullptr);
   buffer = (unsigned char *)OPENSSL_malloc(keySize + ivLength);
   memset(buffer, 0, (size_t)keySize + (size_t)ivLength);
+  memset(macKey, 0, sizeof(macKey));
 
   // most likely fails unless we're running as root, or a user-page-lock
   // kernel patch is applied..
   mlock(buffer, (size_t)keySize + (size_t)ivLength);
 
-  block_enc = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(block_enc);
-  block_dec = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(block_dec);
-  stream_enc = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(stream_enc);
-  stream_dec = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(stream_dec);
-  mac_ctx = HMAC_CTX_new();
-  HMAC_CTX_reset(mac_ctx);
+  Lock lock(gKeysMutex, Stats::KeyLock);
+  (*gKeys)[serial] = this;
 }
 
 SSLKey::~SSLKey() {
+  {
+    // after this, no thread cache can give sets back any more
+    Lock lock(gKeysMutex, Stats::KeyLock);
+    gKeys->erase(serial);
+  }
+
   memset(buffer, 0, (size_t)keySize + (size_t)ivLength);
+  OPENSSL_cleanse(macKey, sizeof(macKey));
 
   OPENSSL_free(buffer);
   munlock(buffer, (size_t)keySize + (size_t)ivLength);
@@ -336,58 +797,250 @@ SSLKey::~SSLKey() {
   ivLength = 0;
   buffer = nullptr;
 
-  EVP_CIPHER_CTX_free(block_enc);
-  EVP_CIPHER_CTX_free(block_dec);
-  EVP_CIPHER_CTX_free(stream_enc);
-  EVP_CIPHER_CTX_free(stream_dec);
-  HMAC_CTX_free(mac_ctx);
+  for (SSLContext *ctx : allContexts) {
+    delete ctx;
+  }
+  allContexts.clear();
+  freeContexts.clear();
 
   pthread_mutex_destroy(&mutex);
 }
 
+SSLContext *SSLKey::acquireContext() {
+  if (!tContextGone && tContext.ctx != nullptr && tContext.serial == serial) {
+    SSLContext *ctx = tContext.ctx;
+    tContext.ctx = nullptr;
+    return ctx;
+  }
+
+  {
+    Lock lock(mutex, Stats::KeyLock);
+    if (!freeContexts.empty()) {
+      SSLContext *ctx = freeContexts.back();
+      freeContexts.pop_back();
+      return ctx;
+    }
+  }
+
+  // Pool is empty, so this thread gets a new set.  The template is read-only
+  // once initKey has run, so no lock is needed for the copy.
+  auto *ctx = new SSLContext();
+  if (!ctx->copyFrom(templateCtx)) {
+    delete ctx;
+    throw Error("failed to copy cipher context");
+  }
+  Lock lock(mutex, Stats::KeyLock);
+  allContexts.push_back(ctx);
+  return ctx;
+}
+
+void SSLKey::releaseContext(SSLContext *ctx) {
+  if (!tContextGone && (tContext.ctx == nullptr || tContext.serial != serial)) {
+    // keep it for the next call of this thread, in place of a set of
+    // another key
+    if (tContext.ctx != nullptr) {
+      returnContext(tContext.serial, tContext.ctx);
+    }
+    tContext.serial = serial;
+    tContext.ctx = ctx;
+    return;
+  }
+
+  Lock lock(mutex, Stats::KeyLock);
+  freeContexts.push_back(ctx);
+}
+
+void SSLKey::returnContext(uint64_t serial, SSLContext *ctx) {
+  Lock lock(gKeysMutex, Stats::KeyLock);
+  auto it = gKeys->find(serial);
+  if (it != gKeys->end()) {
+    Lock keyLock(it->second->mutex, Stats::KeyLock);
+    it->second->freeContexts.push_back(ctx);
+  }
+}
+
+/**
+    Scoped checkout of a context set from an SSLKey.
+*/
+class ContextLease {
+ public:
+  explicit ContextLease(SSLKey *key) : _key(key), _ctx(key->acquireContext()) {}
+  ~ContextLease() { _key->releaseContext(_ctx); }
+
+  ContextLease(const ContextLease &src) = delete;
+  ContextLease &operator=(const ContextLease &other) = delete;
+
+  SSLContext *get() const { return _ctx; }
+  SSLContext *operator->() const { return _ctx; }
+
+ private:
+  SSLKey *_key;
+  SSLContext *_ctx;
+};
+
 inline unsigned char *KeyData(const std::shared_ptr<SSLKey> &key) {
   return key->buffer;
 }
 inline unsigned char *IVData(const std::shared_ptr<SSLKey> &key) {
   return key->buffer + key->keySize;
 }
+inline unsigned char *IVData(const SSLKey *key) {
+  return key->buffer + key->keySize;
+}
+
+/*
+    Keys passed to a cipher were made by it, so the data path can skip the
+    checked dynamic_pointer_cast, which costs an RTTI walk and two atomic
+    reference count updates for every block.
+*/
+inline SSLKey *sslKey(const CipherKey &key) {
+  return static_cast<SSLKey *>(key.get());
+}
+
+/*
+    fetchCipher for each cipher once per process.  The fetched objects are
+    never freed, as ciphers may outlive the other statics.
+*/
+static const EVP_CIPHER *cachedCipher(const EVP_CIPHER *legacy) {
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  static auto *fetched =
+      new std::unordered_map<const EVP_CIPHER *, const EVP_CIPHER *>();
+  if (legacy == nullptr) {
+    return nullptr;
+  }
+  Lock lock(mutex, Stats::KeyLock);
+  const EVP_CIPHER *&cipher = (*fetched)[legacy];
+  if (cipher == nullptr) {
+    cipher = fetchCipher(legacy);
+  }
+  return cipher;
+}
+
+static bool isXTS(const EVP_CIPHER *cipher) {
+  return EVP_CIPHER_mode(cipher) == EVP_CIPH_XTS_MODE;
+}
+
+/**
+    Derive keySize bytes (at most 32) for a particular use from the volume
+    key, as an HMAC-SHA256 of label.
+*/
+static void deriveKey(const unsigned char *keyData, int keySize,
+                      const char *label, unsigned char *out) {
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int mdLen = EVP_MAX_MD_SIZE;
+
+  HMAC(EVP_sha256(), keyData, keySize, (const unsigned char *)label,
+       strlen(label), md, &mdLen);
+  rAssert((int)mdLen >= keySize);
+
+  memcpy(out, md, keySize);
+  OPENSSL_cleanse(md, sizeof(md));
+}
 
 void initKey(const std::shared_ptr<SSLKey> &key, const EVP_CIPHER *_blockCipher,
-             const EVP_CIPHER *_streamCipher, int _keySize) {
-  Lock lock(key->mutex);
+             const EVP_CIPHER *_streamCipher, int _keySize,
+             const char *kernelMode, const EVP_CIPHER *_rangeCipher,
+             const EVP_CIPHER *_sealCipher) {
+  Lock lock(key->mutex, Stats::KeyLock);
+  SSLContext &ctx = key->templateCtx;
   // initialize the cipher context once so that we don't have to do it for
-  // every block..
-  EVP_EncryptInit_ex(key->block_enc, _blockCipher, nullptr, nullptr, nullptr);
-  EVP_DecryptInit_ex(key->block_dec, _blockCipher, nullptr, nullptr, nullptr);
-  EVP_EncryptInit_ex(key->stream_enc, _streamCipher, nullptr, nullptr, nullptr);
-  EVP_DecryptInit_ex(key->stream_dec, _streamCipher, nullptr, nullptr, nullptr);
-
-  EVP_CIPHER_CTX_set_key_length(key->block_enc, _keySize);
-  EVP_CIPHER_CTX_set_key_length(key->block_dec, _keySize);
-  EVP_CIPHER_CTX_set_key_length(key->stream_enc, _keySize);
-  EVP_CIPHER_CTX_set_key_length(key->stream_dec, _keySize);
+  // every block..  Worker threads get copies of these, see acquireContext.
+  EVP_EncryptInit_ex(ctx.block_enc, _blockCipher, nullptr, nullptr, nullptr);
+  EVP_DecryptInit_ex(ctx.block_dec, _blockCipher, nullptr, nullptr, nullptr);
+  EVP_EncryptInit_ex(ctx.stream_enc, _streamCipher, nullptr, nullptr, nullptr);
+  EVP_DecryptInit_ex(ctx.stream_dec, _streamCipher, nullptr, nullptr, nullptr);
+
+  // XTS takes two keys of the cipher's size.  The first one is the volume
+  // key, the second one (which encrypts the tweak) is derived from it, so
+  // that the two differ.
+  unsigned char blockKey[2 * MAX_KEYLENGTH];
+  memcpy(blockKey, KeyData(key), _keySize);
+  if (isXTS(_blockCipher)) {
+    deriveKey(KeyData(key), _keySize, "encfs xts tweak key",
+              blockKey + _keySize);
+  } else {
+    EVP_CIPHER_CTX_set_key_length(ctx.block_enc, _keySize);
+    EVP_CIPHER_CTX_set_key_length(ctx.block_dec, _keySize);
+  }
+  EVP_CIPHER_CTX_set_key_length(ctx.stream_enc, _keySize);
+  EVP_CIPHER_CTX_set_key_length(ctx.stream_dec, _keySize);
+
+  // keys are at least 128 bits
+  unsigned char macKey[MAX_KEYLENGTH];
+  deriveKey(KeyData(key), _keySize, "encfs block mac key", macKey);
+  memcpy(key->macKey, macKey, sizeof(key->macKey));
+  OPENSSL_cleanse(macKey, sizeof(macKey));
+
+  EVP_CIPHER_CTX_set_padding(ctx.block_enc, 0);
+  EVP_CIPHER_CTX_set_padding(ctx.block_dec, 0);
+  EVP_CIPHER_CTX_set_padding(ctx.stream_enc, 0);
+  EVP_CIPHER_CTX_set_padding(ctx.stream_dec, 0);
+
+  EVP_EncryptInit_ex(ctx.block_enc, nullptr, nullptr, blockKey, nullptr);
+  EVP_DecryptInit_ex(ctx.block_dec, nullptr, nullptr, blockKey, nullptr);
+  EVP_EncryptInit_ex(ctx.stream_enc, nullptr, nullptr, KeyData(key), nullptr);
+  EVP_DecryptInit_ex(ctx.stream_dec, nullptr, nullptr, KeyData(key), nullptr);
+  OPENSSL_cleanse(blockKey, sizeof(blockKey));
+
+  rAssert(key->hmac.setKey(KeyData(key), _keySize));
+
+  // the counter mode gets a key of its own, so that its key stream has
+  // nothing to do with the block cipher's encryptions of names
+  if (_rangeCipher != nullptr) {
+    unsigned char rangeKey[MAX_KEYLENGTH];
+    deriveKey(KeyData(key), _keySize, "encfs ctr data key", rangeKey);
+    if (ctx.range == nullptr) {
+      ctx.range = EVP_CIPHER_CTX_new();
+    }
+    EVP_EncryptInit_ex(ctx.range, _rangeCipher, nullptr, rangeKey, nullptr);
+    OPENSSL_cleanse(rangeKey, sizeof(rangeKey));
+  }
 
-  EVP_CIPHER_CTX_set_padding(key->block_enc, 0);
-  EVP_CIPHER_CTX_set_padding(key->block_dec, 0);
-  EVP_CIPHER_CTX_set_padding(key->stream_enc, 0);
-  EVP_CIPHER_CTX_set_padding(key->stream_dec, 0);
+  // and so does the AEAD, whose nonces are random rather than derived
+  if (_sealCipher != nullptr) {
+    unsigned char sealKey[MAX_KEYLENGTH];
+    deriveKey(KeyData(key), _keySize, "encfs aead data key", sealKey);
+    if (ctx.seal == nullptr) {
+      ctx.seal = EVP_CIPHER_CTX_new();
+    }
+    EVP_EncryptInit_ex(ctx.seal, _sealCipher, nullptr, sealKey, nullptr);
+    OPENSSL_cleanse(sealKey, sizeof(sealKey));
+  }
 
-  EVP_EncryptInit_ex(key->block_enc, nullptr, nullptr, KeyData(key), nullptr);
-  EVP_DecryptInit_ex(key->block_dec, nullptr, nullptr, KeyData(key), nullptr);
-  EVP_EncryptInit_ex(key->stream_enc, nullptr, nullptr, KeyData(key), nullptr);
-  EVP_DecryptInit_ex(key->stream_dec, nullptr, nullptr, KeyData(key), nullptr);
+  switch (EVP_CIPHER_nid(_blockCipher)) {
+    case NID_aes_128_cbc:
+    case NID_aes_192_cbc:
+    case NID_aes_256_cbc:
+      key->multiCBC = MultiCBC::create(KeyData(key), _keySize);
+      break;
+    default:
+      break;
+  }
 
-  HMAC_Init_ex(key->mac_ctx, KeyData(key), _keySize, EVP_sha1(), nullptr);
+  if (kernelMode != nullptr) {
+    key->kernel = KernelCipher::open(kernelMode, KeyData(key), _keySize,
+                                     key->ivLength);
+    static std::atomic<bool> warned(false);
+    if (!key->kernel && !warned.exchange(true)) {
+      RLOG(WARNING) << "kernel cipher " << kernelMode
+                    << " not available, using OpenSSL";
+    }
+  }
 }
 
 SSL_Cipher::SSL_Cipher(const Interface &iface_, const Interface &realIface_,
                        const EVP_CIPHER *blockCipher,
-                       const EVP_CIPHER *streamCipher, int keySize_) {
+                       const EVP_CIPHER *streamCipher, int keySize_,
+                       const char *kernelMode, const EVP_CIPHER *rangeCipher,
+                       const EVP_CIPHER *sealCipher) {
   this->iface = iface_;
   this->realIface = realIface_;
-  this->_blockCipher = blockCipher;
-  this->_streamCipher = streamCipher;
+  this->_blockCipher = cachedCipher(blockCipher);
+  this->_streamCipher = cachedCipher(streamCipher);
   this->_keySize = keySize_;
+  this->_kernelMode = kernelMode;
+  this->_rangeCipher = cachedCipher(rangeCipher);
+  this->_sealCipher = cachedCipher(sealCipher);
   this->_ivLength = EVP_CIPHER_iv_length(_blockCipher);
 
   rAssert(_ivLength == 8 || _ivLength == 16);
@@ -408,6 +1061,13 @@ SSL_Cipher::~SSL_Cipher() = default;
 
 Interface SSL_Cipher::interface() const { return realIface; }
 
+Interface SSL_Cipher::volumeInterface(int blockSize) const {
+  if (blockSize <= V3MaxBlockSize && realIface.current() == 4) {
+    return Interface(realIface.name(), 3, 0, realIface.age() - 1);
+  }
+  return realIface;
+}
+
 /**
     create a key from the password.
     Use SHA to distribute entropy from the password into the key.
@@ -441,7 +1101,36 @@ CipherKey SSL_Cipher::newKey(const char *password, int passwdLength,
     }
   }
 
-  initKey(key, _blockCipher, _streamCipher, _keySize);
+  initKey(key, _blockCipher, _streamCipher, _keySize, _kernelMode,
+          _rangeCipher, _sealCipher);
+
+  return key;
+}
+
+CipherKey SSL_Cipher::newKey(const char *password, int passwdLength,
+                             Argon2::Params &params, long desiredDuration,
+                             const unsigned char *salt, int saltLen) {
+  std::shared_ptr<SSLKey> key(new SSLKey(_keySize, _ivLength));
+
+  if (params.passes == 0) {
+    // timed run, fills in the number of passes
+    int res = TimedArgon2(password, passwdLength, salt, saltLen,
+                          _keySize + _ivLength, KeyData(key), params,
+                          1000 * desiredDuration);
+    if (res <= 0) {
+      RLOG(WARNING) << "Argon2id key derivation failed";
+      return CipherKey();
+    }
+    params.passes = res;
+  } else if (!Argon2::derive(params, (const unsigned char *)password,
+                             passwdLength, salt, saltLen, KeyData(key),
+                             _keySize + _ivLength)) {
+    RLOG(WARNING) << "Argon2id key derivation failed";
+    return CipherKey();
+  }
+
+  initKey(key, _blockCipher, _streamCipher, _keySize, _kernelMode,
+          _rangeCipher, _sealCipher);
 
   return key;
 }
@@ -468,7 +1157,8 @@ CipherKey SSL_Cipher::newKey(const char *password, int passwdLength) {
                    passwdLength, 16, KeyData(key), IVData(key));
   }
 
-  initKey(key, _blockCipher, _streamCipher, _keySize);
+  initKey(key, _blockCipher, _streamCipher, _keySize, _kernelMode,
+          _rangeCipher, _sealCipher);
 
   return key;
 }
@@ -503,7 +1193,8 @@ CipherKey SSL_Cipher::newRandomKey() {
 
   OPENSSL_cleanse(tmpBuf, bufLen);
 
-  initKey(key, _blockCipher, _streamCipher, _keySize);
+  initKey(key, _blockCipher, _streamCipher, _keySize, _kernelMode,
+          _rangeCipher, _sealCipher);
 
   return key;
 }
@@ -514,28 +1205,22 @@ CipherKey SSL_Cipher::newRandomKey() {
 static uint64_t _checksum_64(SSLKey *key, const unsigned char *data,
                              int dataLen, const uint64_t *const chainedIV) {
   rAssert(dataLen > 0);
-  Lock lock(key->mutex);
 
-  unsigned char md[EVP_MAX_MD_SIZE];
-  unsigned int mdLen = EVP_MAX_MD_SIZE;
+  unsigned char md[SHA_DIGEST_LENGTH];
+  const unsigned int mdLen = SHA_DIGEST_LENGTH;
 
-  HMAC_Init_ex(key->mac_ctx, nullptr, 0, nullptr, nullptr);
-  HMAC_Update(key->mac_ctx, data, dataLen);
+  unsigned char chained[8];
   if (chainedIV != nullptr) {
     // toss in the chained IV as well
     uint64_t tmp = *chainedIV;
-    unsigned char h[8];
     for (unsigned int i = 0; i < 8; ++i) {
-      h[i] = tmp & 0xff;
+      chained[i] = tmp & 0xff;
       tmp >>= 8;
     }
-
-    HMAC_Update(key->mac_ctx, h, 8);
   }
 
-  HMAC_Final(key->mac_ctx, md, &mdLen);
-
-  rAssert(mdLen >= 8);
+  rAssert(key->hmac.mac(data, dataLen, chained,
+                        chainedIV != nullptr ? sizeof(chained) : 0, md));
 
   // chop this down to a 64bit value..
   unsigned char h[8] = {0, 0, 0, 0, 0, 0, 0, 0};
@@ -551,14 +1236,7 @@ static uint64_t _checksum_64(SSLKey *key, const unsigned char *data,
   return value;
 }
 
-/**
- * Write "len" bytes of random data into "buf"
- *
- * We ignore the @strongRandom parameter because OpenSSL
- * does not * offer a "weak" random generator
- */
-bool SSL_Cipher::randomize(unsigned char *buf, int len,
-                           bool /*strongRandom*/) const {
+static bool randBytes(unsigned char *buf, int len) {
   // to avoid warnings of uninitialized data from valgrind
   memset(buf, 0, len);
 
@@ -575,10 +1253,149 @@ bool SSL_Cipher::randomize(unsigned char *buf, int len,
   return true;
 }
 
+/*
+    A generator for the small random values asked for with strongRandom
+    false: the IVs of new files and the random bytes of each MAC block.
+    RAND_bytes locks and has a large cost per call, so each thread keeps an
+    AES-256-CTR key stream, seeded from RAND_bytes, and hands out a buffer
+    of it at a time.  The first bytes of every refill become the next key
+    and IV, so the state never holds anything which was handed out before.
+    It is seeded again after ReseedBytes, and in a child after fork.
+*/
+struct ThreadRandom {
+  static const int PoolSize = 4096;
+  static const int SeedSize = 48;  // key and IV
+  static const uint64_t ReseedBytes = 1 << 20;
+
+  EVP_CIPHER_CTX *ctx = nullptr;
+  unsigned char pool[PoolSize];
+  int avail = 0;  // at the end of pool
+  pid_t pid = 0;
+  uint64_t served = 0;
+
+  ~ThreadRandom();
+
+  bool get(unsigned char *buf, int len);
+
+ private:
+  bool seed(const unsigned char *seed);
+  bool refill();
+};
+
+static thread_local bool tRandomGone = false;
+static thread_local ThreadRandom tRandom;
+
+ThreadRandom::~ThreadRandom() {
+  OPENSSL_cleanse(pool, sizeof(pool));
+  if (ctx != nullptr) {
+    EVP_CIPHER_CTX_free(ctx);
+  }
+  tRandomGone = true;
+}
+
+bool ThreadRandom::seed(const unsigned char *seed) {
+  if (ctx == nullptr) {
+    ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr) {
+      return false;
+    }
+  }
+  return EVP_EncryptInit_ex(ctx, cachedCipher(EVP_aes_256_ctr()), nullptr,
+                            seed, seed + 32) == 1;
+}
+
+bool ThreadRandom::refill() {
+  unsigned char next[SeedSize];
+  if (pid != getpid() || served >= ReseedBytes) {
+    if (!randBytes(next, SeedSize) || !seed(next)) {
+      OPENSSL_cleanse(next, SeedSize);
+      return false;
+    }
+    pid = getpid();
+    served = 0;
+  }
+
+  // the key stream is the encryption of zeros
+  int len = 0;
+  memset(next, 0, SeedSize);
+  memset(pool, 0, PoolSize);
+  bool ok = EVP_EncryptUpdate(ctx, next, &len, next, SeedSize) == 1 &&
+            EVP_EncryptUpdate(ctx, pool, &len, pool, PoolSize) == 1 &&
+            seed(next);
+  OPENSSL_cleanse(next, SeedSize);
+  if (!ok) {
+    // seeded again on the next call
+    pid = 0;
+    return false;
+  }
+  avail = PoolSize;
+  return true;
+}
+
+bool ThreadRandom::get(unsigned char *buf, int len) {
+  if (pid != getpid()) {
+    // a forked child must not repeat the values of its parent
+    avail = 0;
+  }
+  while (len > 0) {
+    if (avail == 0 && !refill()) {
+      return false;
+    }
+    int n = std::min(len, avail);
+    unsigned char *from = pool + PoolSize - avail;
+    memcpy(buf, from, n);
+    OPENSSL_cleanse(from, n);
+    buf += n;
+    len -= n;
+    avail -= n;
+    served += n;
+  }
+  return true;
+}
+
+/**
+ * Write "len" bytes of random data into "buf"
+ *
+ * Strong requests, and large ones, come straight from RAND_bytes.  The
+ * others are served by the generator of the calling thread.
+ */
+bool SSL_Cipher::randomize(unsigned char *buf, int len,
+                           bool strongRandom) const {
+  if (strongRandom || tRandomGone || len > ThreadRandom::PoolSize / 16) {
+    return randBytes(buf, len);
+  }
+  if (tRandom.get(buf, len)) {
+    return true;
+  }
+  RLOG(WARNING) << "random generator failed, using RAND_bytes";
+  return randBytes(buf, len);
+}
+
+bool SSL_Cipher::exportKey(const CipherKey &key, const char *label,
+                           unsigned char *out, int len) const {
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int mdLen = EVP_MAX_MD_SIZE;
+  bool ok = HMAC(EVP_sha512(), sslKey(key)->buffer, _keySize,
+                 (const unsigned char *)label, strlen(label), md,
+                 &mdLen) != nullptr &&
+            len <= (int)mdLen;
+  if (ok) {
+    memcpy(out, md, len);
+  }
+  OPENSSL_cleanse(md, sizeof(md));
+  return ok;
+}
+
+uint64_t SSL_Cipher::blockMAC_64(const unsigned char *data, int len,
+                                 const CipherKey &key) const {
+  Stats::Timer timer(Stats::Mac64);
+  return SipHash24(sslKey(key)->macKey, data, len);
+}
+
 uint64_t SSL_Cipher::MAC_64(const unsigned char *data, int len,
                             const CipherKey &key, uint64_t *chainedIV) const {
-  std::shared_ptr<SSLKey> mk = dynamic_pointer_cast<SSLKey>(key);
-  uint64_t tmp = _checksum_64(mk.get(), data, len, chainedIV);
+  Stats::Timer timer(Stats::Mac64);
+  uint64_t tmp = _checksum_64(sslKey(key), data, len, chainedIV);
 
   if (chainedIV != nullptr) {
     *chainedIV = tmp;
@@ -618,7 +1435,8 @@ CipherKey SSL_Cipher::readKey(const unsigned char *data,
   memcpy(key->buffer, tmpBuf, (size_t)_keySize + (size_t)_ivLength);
   memset(tmpBuf, 0, sizeof(tmpBuf));
 
-  initKey(key, _blockCipher, _streamCipher, _keySize);
+  initKey(key, _blockCipher, _streamCipher, _keySize, _kernelMode,
+          _rangeCipher, _sealCipher);
 
   return key;
 }
@@ -669,6 +1487,11 @@ int SSL_Cipher::encodedKeySize() const {
 int SSL_Cipher::keySize() const { return _keySize; }
 
 int SSL_Cipher::cipherBlockSize() const {
+  // XTS reports 1, but needs at least one full AES block, so names and file
+  // blocks are still padded to that
+  if (isXTS(_blockCipher)) {
+    return 16;
+  }
   return EVP_CIPHER_block_size(_blockCipher);
 }
 
@@ -688,13 +1511,19 @@ int SSL_Cipher::cipherBlockSize() const {
  * As an HMAC is unpredictable as long as the key is secret, the only
  * requirement for "seed" is that is must be unique.
  */
-void SSL_Cipher::setIVec(unsigned char *ivec, uint64_t seed,
-                         const std::shared_ptr<SSLKey> &key) const {
+void SSL_Cipher::setIVec(unsigned char *ivec, uint64_t seed, SSLKey *key,
+                         SSLContext *ctx) const {
   if (iface.current() >= 3) {
+    SSLContext::IVMemo &memo = ctx->ivMemo[seed % SSLContext::IVMemoSize];
+    if (memo.valid && memo.seed == seed) {
+      memcpy(ivec, memo.ivec, _ivLength);
+      return;
+    }
+    uint64_t memoSeed = seed;
+
     memcpy(ivec, IVData(key), _ivLength);
 
-    unsigned char md[EVP_MAX_MD_SIZE];
-    unsigned int mdLen = EVP_MAX_MD_SIZE;
+    unsigned char md[SHA_DIGEST_LENGTH];
 
     for (int i = 0; i < 8; ++i) {
       md[i] = (unsigned char)(seed & 0xff);
@@ -702,13 +1531,14 @@ void SSL_Cipher::setIVec(unsigned char *ivec, uint64_t seed,
     }
 
     // combine ivec and seed with HMAC
-    HMAC_Init_ex(key->mac_ctx, nullptr, 0, nullptr, nullptr);
-    HMAC_Update(key->mac_ctx, ivec, _ivLength);
-    HMAC_Update(key->mac_ctx, md, 8);
-    HMAC_Final(key->mac_ctx, md, &mdLen);
-    rAssert(mdLen >= _ivLength);
+    rAssert(key->hmac.mac(ivec, _ivLength, md, 8, md));
+    rAssert(SHA_DIGEST_LENGTH >= _ivLength);
+    rAssert(_ivLength <= sizeof(memo.ivec));
 
     memcpy(ivec, md, _ivLength);
+    memcpy(memo.ivec, md, _ivLength);
+    memo.seed = memoSeed;
+    memo.valid = true;
   } else {
     setIVec_old(ivec, seed, key);
   }
@@ -721,7 +1551,7 @@ void SSL_Cipher::setIVec(unsigned char *ivec, uint64_t seed,
     decrypting the file).
   */
 void SSL_Cipher::setIVec_old(unsigned char *ivec, unsigned int seed,
-                             const std::shared_ptr<SSLKey> &key) const {
+                             SSLKey *key) const {
   /* These multiplication constants chosen as they represent (non optimal)
      Golumb rulers, the idea being to spread around the information in the
      seed.
@@ -755,70 +1585,38 @@ void SSL_Cipher::setIVec_old(unsigned char *ivec, unsigned int seed,
   }
 }
 
-static void flipBytes(unsigned char *buf, int size) {
-  unsigned char revBuf[64];
-
-  int bytesLeft = size;
-  while (bytesLeft != 0) {
-    int toFlip = MIN(sizeof(revBuf), bytesLeft);
-
-    for (int i = 0; i < toFlip; ++i) {
-      revBuf[i] = buf[toFlip - (i + 1)];
-    }
-
-    memcpy(buf, revBuf, toFlip);
-    bytesLeft -= toFlip;
-    buf += toFlip;
-  }
-  memset(revBuf, 0, sizeof(revBuf));
-}
-
-static void shuffleBytes(unsigned char *buf, int size) {
-  for (int i = 0; i < size - 1; ++i) {
-    buf[i + 1] ^= buf[i];
-  }
-}
-
-static void unshuffleBytes(unsigned char *buf, int size) {
-  for (int i = size - 1; i != 0; --i) {
-    buf[i] ^= buf[i - 1];
-  }
-}
-
 /** Partial blocks are encoded with a stream cipher.  We make multiple passes on
  the data to ensure that the ends of the data depend on each other.
 */
 bool SSL_Cipher::streamEncode(unsigned char *buf, int size, uint64_t iv64,
                               const CipherKey &ckey) const {
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = sslKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
-  Lock lock(key->mutex);
+  ContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
-  int dstLen = 0, tmpLen = 0;
+  int dstLen = 0;
 
+  // None of the modes pads, so there is never anything left for a Final
+  // call to write, and the contexts are simply given the next IV.
   shuffleBytes(buf, size);
 
-  setIVec(ivec, iv64, key);
-  EVP_EncryptInit_ex(key->stream_enc, nullptr, nullptr, nullptr, ivec);
-  EVP_EncryptUpdate(key->stream_enc, buf, &dstLen, buf, size);
-  EVP_EncryptFinal_ex(key->stream_enc, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64, key, ctx.get());
+  setCipherIV(ctx->stream_enc, ivec, 1);
+  EVP_EncryptUpdate(ctx->stream_enc, buf, &dstLen, buf, size);
 
   flipBytes(buf, size);
   shuffleBytes(buf, size);
 
-  setIVec(ivec, iv64 + 1, key);
-  EVP_EncryptInit_ex(key->stream_enc, nullptr, nullptr, nullptr, ivec);
-  EVP_EncryptUpdate(key->stream_enc, buf, &dstLen, buf, size);
-  EVP_EncryptFinal_ex(key->stream_enc, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64 + 1, key, ctx.get());
+  setCipherIV(ctx->stream_enc, ivec, 1);
+  EVP_EncryptUpdate(ctx->stream_enc, buf, &dstLen, buf, size);
 
-  dstLen += tmpLen;
   if (dstLen != size) {
-    RLOG(ERROR) << "encoding " << size << " bytes, got back " << dstLen << " ("
-                << tmpLen << " in final_ex)";
+    RLOG(ERROR) << "encoding " << size << " bytes, got back " << dstLen;
     return false;
   }
 
@@ -828,34 +1626,30 @@ bool SSL_Cipher::streamEncode(unsigned char *buf, int size, uint64_t iv64,
 bool SSL_Cipher::streamDecode(unsigned char *buf, int size, uint64_t iv64,
                               const CipherKey &ckey) const {
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = sslKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
-  Lock lock(key->mutex);
+  ContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
-  int dstLen = 0, tmpLen = 0;
+  int dstLen = 0;
 
-  setIVec(ivec, iv64 + 1, key);
-  EVP_DecryptInit_ex(key->stream_dec, nullptr, nullptr, nullptr, ivec);
-  EVP_DecryptUpdate(key->stream_dec, buf, &dstLen, buf, size);
-  EVP_DecryptFinal_ex(key->stream_dec, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64 + 1, key, ctx.get());
+  setCipherIV(ctx->stream_dec, ivec, 0);
+  EVP_DecryptUpdate(ctx->stream_dec, buf, &dstLen, buf, size);
 
   unshuffleBytes(buf, size);
   flipBytes(buf, size);
 
-  setIVec(ivec, iv64, key);
-  EVP_DecryptInit_ex(key->stream_dec, nullptr, nullptr, nullptr, ivec);
-  EVP_DecryptUpdate(key->stream_dec, buf, &dstLen, buf, size);
-  EVP_DecryptFinal_ex(key->stream_dec, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64, key, ctx.get());
+  setCipherIV(ctx->stream_dec, ivec, 0);
+  EVP_DecryptUpdate(ctx->stream_dec, buf, &dstLen, buf, size);
 
   unshuffleBytes(buf, size);
 
-  dstLen += tmpLen;
   if (dstLen != size) {
-    RLOG(ERROR) << "decoding " << size << " bytes, got back " << dstLen << " ("
-                << tmpLen << " in final_ex)";
+    RLOG(ERROR) << "decoding " << size << " bytes, got back " << dstLen;
     return false;
   }
 
@@ -864,33 +1658,38 @@ bool SSL_Cipher::streamDecode(unsigned char *buf, int size, uint64_t iv64,
 
 bool SSL_Cipher::blockEncode(unsigned char *buf, int size, uint64_t iv64,
                              const CipherKey &ckey) const {
+  Stats::Timer timer(Stats::BlockEncode);
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = sslKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
   // data must be integer number of blocks
-  const int blockMod = size % EVP_CIPHER_CTX_block_size(key->block_enc);
+  const int blockMod = size % cipherBlockSize();
   if (blockMod != 0) {
     RLOG(ERROR) << "Invalid data size, not multiple of block size";
     return false;
   }
 
-  Lock lock(key->mutex);
+  ContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
 
-  int dstLen = 0, tmpLen = 0;
-  setIVec(ivec, iv64, key);
+  int dstLen = 0;
+  setIVec(ivec, iv64, key, ctx.get());
 
-  EVP_EncryptInit_ex(key->block_enc, nullptr, nullptr, nullptr, ivec);
-  EVP_EncryptUpdate(key->block_enc, buf, &dstLen, buf, size);
-  EVP_EncryptFinal_ex(key->block_enc, buf + dstLen, &tmpLen);
-  dstLen += tmpLen;
+  if (key->kernel) {
+    // a failed request may have changed part of buf, so there is no falling
+    // back to OpenSSL here
+    return key->kernel->encrypt(buf, size, ivec);
+  }
+
+  // no padding, see streamEncode
+  setCipherIV(ctx->block_enc, ivec, 1);
+  EVP_EncryptUpdate(ctx->block_enc, buf, &dstLen, buf, size);
 
   if (dstLen != size) {
-    RLOG(ERROR) << "encoding " << size << " bytes, got back " << dstLen << " ("
-                << tmpLen << " in final_ex)";
+    RLOG(ERROR) << "encoding " << size << " bytes, got back " << dstLen;
     return false;
   }
 
@@ -899,39 +1698,212 @@ bool SSL_Cipher::blockEncode(unsigned char *buf, int size, uint64_t iv64,
 
 bool SSL_Cipher::blockDecode(unsigned char *buf, int size, uint64_t iv64,
                              const CipherKey &ckey) const {
+  Stats::Timer timer(Stats::BlockDecode);
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = sslKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
   // data must be integer number of blocks
-  const int blockMod = size % EVP_CIPHER_CTX_block_size(key->block_dec);
+  const int blockMod = size % cipherBlockSize();
   if (blockMod != 0) {
     RLOG(ERROR) << "Invalid data size, not multiple of block size";
     return false;
   }
 
-  Lock lock(key->mutex);
+  ContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
 
-  int dstLen = 0, tmpLen = 0;
-  setIVec(ivec, iv64, key);
+  int dstLen = 0;
+  setIVec(ivec, iv64, key, ctx.get());
 
-  EVP_DecryptInit_ex(key->block_dec, nullptr, nullptr, nullptr, ivec);
-  EVP_DecryptUpdate(key->block_dec, buf, &dstLen, buf, size);
-  EVP_DecryptFinal_ex(key->block_dec, buf + dstLen, &tmpLen);
-  dstLen += tmpLen;
+  if (key->kernel) {
+    // a failed request may have changed part of buf, so there is no falling
+    // back to OpenSSL here
+    return key->kernel->decrypt(buf, size, ivec);
+  }
+
+  // no padding, see streamEncode
+  setCipherIV(ctx->block_dec, ivec, 0);
+  EVP_DecryptUpdate(ctx->block_dec, buf, &dstLen, buf, size);
 
   if (dstLen != size) {
-    RLOG(ERROR) << "decoding " << size << " bytes, got back " << dstLen << " ("
-                << tmpLen << " in final_ex)";
+    RLOG(ERROR) << "decoding " << size << " bytes, got back " << dstLen;
     return false;
   }
 
   return true;
 }
 
+bool SSL_Cipher::blockEncodeMany(unsigned char *buf, int size,
+                                 const uint64_t *ivs, int count,
+                                 const CipherKey &ckey) const {
+  SSLKey *key = sslKey(ckey);
+  if (key->kernel || !key->multiCBC || count < 2 ||
+      size % cipherBlockSize() != 0 || _ivLength != 16) {
+    return Cipher::blockEncodeMany(buf, size, ivs, count, ckey);
+  }
+
+  Stats::Timer timer(Stats::BlockEncode);
+  ContextLease ctx(key);
+
+  unsigned char ivecs[MultiCBC::Lanes][16];
+  for (int first = 0; first < count; first += MultiCBC::Lanes) {
+    int n = std::min(count - first, MultiCBC::Lanes);
+    for (int i = 0; i < n; ++i) {
+      setIVec(ivecs[i], ivs[first + i], key, ctx.get());
+    }
+    key->multiCBC->encrypt(buf + (size_t)first * size, size, ivecs, n);
+  }
+  return true;
+}
+
+bool SSL_Cipher::randomAccess() const { return _rangeCipher != nullptr; }
+
+bool SSL_Cipher::rangeEncode(unsigned char *buf, int size, uint64_t iv64,
+                             int offset, const CipherKey &ckey) const {
+  Stats::Timer timer(Stats::BlockEncode);
+  return rangeCode(buf, size, iv64, offset, sslKey(ckey));
+}
+
+bool SSL_Cipher::rangeDecode(unsigned char *buf, int size, uint64_t iv64,
+                             int offset, const CipherKey &ckey) const {
+  Stats::Timer timer(Stats::BlockDecode);
+  return rangeCode(buf, size, iv64, offset, sslKey(ckey));
+}
+
+// big endian arithmetic mod 2^128, as OpenSSL counts in CTR mode
+static void addCounter(unsigned char *ctr, uint64_t n) {
+  for (int i = 15; i >= 0 && n != 0; --i) {
+    n += ctr[i];
+    ctr[i] = n & 0xff;
+    n >>= 8;
+  }
+}
+
+/**
+ * The key stream of a block starts at the counter given by its IV.  Data at
+ * offset starts offset / 16 counters later, a partial first counter block
+ * is skipped by coding as many bytes of padding first.
+ */
+bool SSL_Cipher::rangeCode(unsigned char *buf, int size, uint64_t iv64,
+                           int offset, SSLKey *key) const {
+  rAssert(size > 0 && offset >= 0);
+  rAssert(key->keySize == _keySize);
+  rAssert(key->ivLength == _ivLength);
+  if (_rangeCipher == nullptr) {
+    return false;
+  }
+
+  ContextLease ctx(key);
+
+  unsigned char ivec[MAX_IVLENGTH];
+  setIVec(ivec, iv64, key, ctx.get());
+  addCounter(ivec, (uint64_t)offset / 16);
+  setCipherIV(ctx->range, ivec, 1);
+
+  int dstLen = 0;
+  int skip = offset % 16;
+  if (skip != 0) {
+    unsigned char pad[16] = {0};
+    EVP_EncryptUpdate(ctx->range, pad, &dstLen, pad, skip);
+  }
+  EVP_EncryptUpdate(ctx->range, buf, &dstLen, buf, size);
+
+  if (dstLen != size) {
+    RLOG(ERROR) << "coding " << size << " bytes, got back " << dstLen;
+    return false;
+  }
+
+  return true;
+}
+
+bool SSL_Cipher::sealedBlocks() const { return _sealCipher != nullptr; }
+
+// the AEAD covers the block IV, in little endian order
+static void sealAAD(unsigned char *aad, uint64_t iv64) {
+  for (int i = 0; i < 8; ++i) {
+    aad[i] = (unsigned char)(iv64 & 0xff);
+    iv64 >>= 8;
+  }
+}
+
+bool SSL_Cipher::sealEncode(unsigned char *buf, int size, uint64_t iv64,
+                            const CipherKey &ckey) const {
+  Stats::Timer timer(Stats::BlockEncode);
+  rAssert(size >= 0);
+  SSLKey *key = sslKey(ckey);
+  rAssert(key->keySize == _keySize);
+  if (_sealCipher == nullptr || size < SealBytes) {
+    return false;
+  }
+
+  ContextLease ctx(key);
+  unsigned char aad[8];
+  sealAAD(aad, iv64);
+  return aeadSeal(ctx->seal, buf + SealTagBytes, aad, sizeof(aad),
+                  buf + SealBytes, size - SealBytes, buf);
+}
+
+bool SSL_Cipher::sealDecode(unsigned char *buf, int size, uint64_t iv64,
+                            const CipherKey &ckey) const {
+  Stats::Timer timer(Stats::BlockDecode);
+  rAssert(size >= 0);
+  SSLKey *key = sslKey(ckey);
+  rAssert(key->keySize == _keySize);
+  if (_sealCipher == nullptr || size < SealBytes) {
+    return false;
+  }
+
+  ContextLease ctx(key);
+  unsigned char aad[8];
+  sealAAD(aad, iv64);
+  return aeadOpen(ctx->seal, buf + SealTagBytes, aad, sizeof(aad),
+                  buf + SealBytes, size - SealBytes, buf);
+}
+
+bool SSL_Cipher::aeadSeal(EVP_CIPHER_CTX *ctx, const unsigned char *nonce,
+                          const unsigned char *aad, int aadLen,
+                          unsigned char *data, int len, unsigned char *tag) {
+  int dstLen = 0;
+  if (setCipherIV(ctx, nonce, 1) != 1 ||
+      (aadLen > 0 &&
+       EVP_EncryptUpdate(ctx, nullptr, &dstLen, aad, aadLen) != 1) ||
+      (len > 0 && EVP_EncryptUpdate(ctx, data, &dstLen, data, len) != 1)) {
+    return false;
+  }
+  if (len > 0 && dstLen != len) {
+    RLOG(ERROR) << "sealing " << len << " bytes, got back " << dstLen;
+    return false;
+  }
+  // a stream cipher, nothing is left for Final but the tag
+  return EVP_EncryptFinal_ex(ctx, data + len, &dstLen) == 1 &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, SealTagBytes,
+                             tag) == 1;
+}
+
+bool SSL_Cipher::aeadOpen(EVP_CIPHER_CTX *ctx, const unsigned char *nonce,
+                          const unsigned char *aad, int aadLen,
+                          unsigned char *data, int len,
+                          const unsigned char *tag) {
+  int dstLen = 0;
+  if (setCipherIV(ctx, nonce, 0) != 1 ||
+      EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, SealTagBytes,
+                          const_cast<unsigned char *>(tag)) != 1 ||
+      (aadLen > 0 &&
+       EVP_DecryptUpdate(ctx, nullptr, &dstLen, aad, aadLen) != 1) ||
+      (len > 0 && EVP_DecryptUpdate(ctx, data, &dstLen, data, len) != 1)) {
+    return false;
+  }
+  if (len > 0 && dstLen != len) {
+    RLOG(ERROR) << "opening " << len << " bytes, got back " << dstLen;
+    return false;
+  }
+  // fails if the tag doesn't match
+  return EVP_DecryptFinal_ex(ctx, data + len, &dstLen) == 1;
+}
+
 bool SSL_Cipher::Enabled() { return true; }
 
 }  // namespace encfs
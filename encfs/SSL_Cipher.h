@@ -33,10 +33,16 @@ struct evp_cipher_st;
 
 using EVP_CIPHER = struct evp_cipher_st;
 #endif
+#ifndef EVP_CIPHER_CTX
+struct evp_cipher_ctx_st;
+
+using EVP_CIPHER_CTX = struct evp_cipher_ctx_st;
+#endif
 
 namespace encfs {
 
 class SSLKey;
+struct SSLContext;
 
 /*
     Implements Cipher interface for OpenSSL's ciphers.
@@ -75,28 +81,50 @@ class SSLKey;
     although it is not necessary as they have checksum bytes which augment the
     initial value vector to randomize the output.  But it makes the code
     simpler to reuse the encryption algorithm as is.
+
+    With a range cipher (AES-CTR), file data is coded in counter mode, with a
+    key derived from the volume key and the block IV as the first counter.
+    Names, the file headers and the volume key are coded as with the block
+    cipher alone.
+
+    With a seal cipher (ChaCha20-Poly1305), file data is coded by sealEncode
+    instead, with a key of its own derived from the volume key, the random
+    nonce of the block and its IV as associated data.
 */
-class SSL_Cipher : public Cipher {
+class SSL_Cipher final : public Cipher {
   Interface iface;
   Interface realIface;
   const EVP_CIPHER *_blockCipher;
   const EVP_CIPHER *_streamCipher;
   unsigned int _keySize;  // in bytes
   unsigned int _ivLength;
+  const char *_kernelMode;  // KernelCipher algorithm for full blocks, or null
+  const EVP_CIPHER *_rangeCipher;  // counter mode for file data, or null
+  const EVP_CIPHER *_sealCipher;   // AEAD for file data, or null
 
  public:
+  // With kernelMode (such as "cbc(aes)", matching blockCipher), full blocks
+  // are coded by the kernel crypto API if it has the algorithm.  With
+  // rangeCipher (a counter mode), file data is coded by rangeEncode, with
+  // sealCipher (an AEAD) by sealEncode, see Cipher.h.
   SSL_Cipher(const Interface &iface, const Interface &realIface,
              const EVP_CIPHER *blockCipher, const EVP_CIPHER *streamCipher,
-             int keyLength);
+             int keyLength, const char *kernelMode = nullptr,
+             const EVP_CIPHER *rangeCipher = nullptr,
+             const EVP_CIPHER *sealCipher = nullptr);
   virtual ~SSL_Cipher();
 
   // returns the real interface, not the one we're emulating (if any)..
   virtual Interface interface() const;
+  virtual Interface volumeInterface(int blockSize) const;
 
   // create a new key based on a password
   virtual CipherKey newKey(const char *password, int passwdLength,
                            int &iterationCount, long desiredDuration,
                            const unsigned char *salt, int saltLen);
+  virtual CipherKey newKey(const char *password, int passwdLength,
+                           Argon2::Params &params, long desiredDuration,
+                           const unsigned char *salt, int saltLen);
   // deprecated - for backward compatibility
   virtual CipherKey newKey(const char *password, int passwdLength);
   // create a new random key
@@ -116,8 +144,14 @@ class SSL_Cipher : public Cipher {
 
   virtual bool randomize(unsigned char *buf, int len, bool strongRandom) const;
 
+  // an HMAC-SHA512 of label
+  virtual bool exportKey(const CipherKey &key, const char *label,
+                         unsigned char *out, int len) const;
+
   virtual uint64_t MAC_64(const unsigned char *src, int len,
                           const CipherKey &key, uint64_t *augment) const;
+  virtual uint64_t blockMAC_64(const unsigned char *src, int len,
+                               const CipherKey &key) const;
 
   // functional interfaces
   /*
@@ -137,17 +171,46 @@ class SSL_Cipher : public Cipher {
                            const CipherKey &key) const;
   virtual bool blockDecode(unsigned char *buf, int size, uint64_t iv64,
                            const CipherKey &key) const;
+  // several CBC chains at once with AES, see MultiCBC
+  virtual bool blockEncodeMany(unsigned char *buf, int size,
+                               const uint64_t *ivs, int count,
+                               const CipherKey &key) const;
+
+  virtual bool randomAccess() const;
+  virtual bool rangeEncode(unsigned char *buf, int size, uint64_t iv64,
+                           int offset, const CipherKey &key) const;
+  virtual bool rangeDecode(unsigned char *buf, int size, uint64_t iv64,
+                           int offset, const CipherKey &key) const;
+
+  virtual bool sealedBlocks() const;
+  virtual bool sealEncode(unsigned char *buf, int size, uint64_t iv64,
+                          const CipherKey &key) const;
+  virtual bool sealDecode(unsigned char *buf, int size, uint64_t iv64,
+                          const CipherKey &key) const;
+
+  // The AEAD of sealEncode / sealDecode, in place, with ctx keyed for it.
+  // The tag has SealTagBytes, the nonce SealNonceBytes.
+  static bool aeadSeal(EVP_CIPHER_CTX *ctx, const unsigned char *nonce,
+                       const unsigned char *aad, int aadLen,
+                       unsigned char *data, int len, unsigned char *tag);
+  static bool aeadOpen(EVP_CIPHER_CTX *ctx, const unsigned char *nonce,
+                       const unsigned char *aad, int aadLen,
+                       unsigned char *data, int len, const unsigned char *tag);
 
   // hack to help with static builds
   static bool Enabled();
 
  private:
-  void setIVec(unsigned char *ivec, uint64_t seed,
-               const std::shared_ptr<SSLKey> &key) const;
+  void setIVec(unsigned char *ivec, uint64_t seed, SSLKey *key,
+               SSLContext *ctx) const;
 
   // deprecated - for backward compatibility
   void setIVec_old(unsigned char *ivec, unsigned int seed,
-                   const std::shared_ptr<SSLKey> &key) const;
+                   SSLKey *key) const;
+
+  // counter mode coding of rangeEncode / rangeDecode
+  bool rangeCode(unsigned char *buf, int size, uint64_t iv64, int offset,
+                 SSLKey *key) const;
 };
 
 }  // namespace encfs
@@ -47,4 +47,31 @@ void HMAC_CTX_free(HMAC_CTX *ctx) {
 }
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+
+// The provider's implementation of a cipher.  OpenSSL 3 looks the legacy
+// EVP_CIPHER objects up again whenever a context is initialized with them.
+inline const EVP_CIPHER *fetchCipher(const EVP_CIPHER *legacy) {
+  EVP_CIPHER *fetched =
+      EVP_CIPHER_fetch(nullptr, EVP_CIPHER_get0_name(legacy), nullptr);
+  return fetched != nullptr ? fetched : legacy;
+}
+
+// Start a new message with iv, keeping the key schedule
+inline int setCipherIV(EVP_CIPHER_CTX *ctx, const unsigned char *iv, int enc) {
+  return EVP_CipherInit_ex2(ctx, nullptr, nullptr, iv, enc, nullptr);
+}
+
+#else
+
+inline const EVP_CIPHER *fetchCipher(const EVP_CIPHER *legacy) {
+  return legacy;
+}
+
+inline int setCipherIV(EVP_CIPHER_CTX *ctx, const unsigned char *iv, int enc) {
+  return EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, iv, enc);
+}
+
+#endif
+
 #endif
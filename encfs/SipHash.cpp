@@ -0,0 +1,90 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SipHash.h"
+
+namespace encfs {
+
+static inline uint64_t load64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static inline uint64_t rotl(uint64_t x, int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND           \
+  do {                     \
+    v0 += v1;              \
+    v1 = rotl(v1, 13);     \
+    v1 ^= v0;              \
+    v0 = rotl(v0, 32);     \
+    v2 += v3;              \
+    v3 = rotl(v3, 16);     \
+    v3 ^= v2;              \
+    v0 += v3;              \
+    v3 = rotl(v3, 21);     \
+    v3 ^= v0;              \
+    v2 += v1;              \
+    v1 = rotl(v1, 17);     \
+    v1 ^= v2;              \
+    v2 = rotl(v2, 32);     \
+  } while (0)
+
+uint64_t SipHash24(const unsigned char *key, const unsigned char *data,
+                   size_t len) {
+  uint64_t k0 = load64(key);
+  uint64_t k1 = load64(key + 8);
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+  const unsigned char *end = data + (len & ~(size_t)7);
+  for (; data != end; data += 8) {
+    uint64_t m = load64(data);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  // the last bytes, with the length in the top byte
+  uint64_t b = (uint64_t)len << 56;
+  for (int i = (int)(len & 7) - 1; i >= 0; --i) {
+    b |= (uint64_t)data[i] << (8 * i);
+  }
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+
+}  // namespace encfs
@@ -0,0 +1,37 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SipHash_incl_
+#define _SipHash_incl_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace encfs {
+
+/*
+    SipHash-2-4 (Aumasson and Bernstein), a keyed 64 bit PRF.
+
+    Used as the block MAC of MACFileIO 3, where it costs a fraction of the
+    HMAC which MAC_64 computes.  key is 16 bytes.
+*/
+uint64_t SipHash24(const unsigned char *key, const unsigned char *data,
+                   size_t len);
+
+}  // namespace encfs
+
+#endif
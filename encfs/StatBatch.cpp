@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StatBatch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "DirFdCache.h"
+#include "Stats.h"
+#include "UringRing.h"
+#include "config.h"
+
+#if defined(HAVE_IORING_OP_STATX) && defined(HAVE_STATX)
+#include <linux/io_uring.h>
+#define STATBATCH_URING
+#endif
+
+namespace encfs {
+
+#ifdef STATBATCH_URING
+// cleared once the kernel turned IORING_OP_STATX down
+static std::atomic<bool> ringStatx(true);
+#endif
+
+StatBatch::StatBatch(bool uring) : _uring(uring) {}
+
+void StatBatch::stat(int dir, const char *name, struct stat *st, int *res,
+                     bool relaxed) {
+  Call call = {dir, name, st, res, relaxed};
+  _calls.push_back(call);
+}
+
+void StatBatch::runOne(const Call &call) {
+  Stats::Timer timer(Stats::Syscall);
+#if defined(HAVE_STATX) && defined(AT_STATX_DONT_SYNC)
+  if (call.relaxed) {
+    struct statx stx;
+    if (::statx(call.dir, call.name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                STATX_BASIC_STATS, &stx) != 0) {
+      *call.res = -errno;
+      return;
+    }
+    statFromStatx(stx, call.st);
+    *call.res = 0;
+    return;
+  }
+#endif
+  int res = ::fstatat(call.dir, call.name, call.st, AT_SYMLINK_NOFOLLOW);
+  *call.res = res == 0 ? 0 : -errno;
+}
+
+void StatBatch::run() {
+  size_t done = 0;
+#ifdef STATBATCH_URING
+  // a single stat is as cheap by itself
+  if (_uring && _calls.size() > 1) {
+    while (done < _calls.size()) {
+      size_t count =
+          std::min<size_t>(_calls.size() - done, UringRing::DefaultEntries);
+      if (!runRing(done, count)) {
+        break;
+      }
+      done += count;
+    }
+  }
+#endif
+  for (; done < _calls.size(); ++done) {
+    runOne(_calls[done]);
+  }
+  _calls.clear();
+}
+
+bool StatBatch::runRing(size_t start, size_t count) {
+#ifdef STATBATCH_URING
+  UringRing *ring = ringStatx ? UringRing::forThread() : nullptr;
+  if (ring == nullptr) {
+    return false;
+  }
+
+  struct statx stx[UringRing::DefaultEntries];
+  int res[UringRing::DefaultEntries];
+  for (size_t i = 0; i < count; ++i) {
+    const Call &call = _calls[start + i];
+    struct io_uring_sqe *sqe = ring->queue(i);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = call.dir;
+    sqe->addr = (uintptr_t)call.name;
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uintptr_t)&stx[i];
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+#if defined(AT_STATX_DONT_SYNC)
+    if (call.relaxed) {
+      sqe->statx_flags |= AT_STATX_DONT_SYNC;
+    }
+#endif
+    res[i] = -EIO;
+  }
+  {
+    Stats::Timer timer(Stats::Syscall);
+    if (ring->run(count, [&res](uint64_t i, int r) { res[i] = r; }) < 0) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const Call &call = _calls[start + i];
+    if (res[i] == -EINVAL) {
+      // an unknown opcode to an older kernel, or a real EINVAL, which the
+      // system call gives again
+      ringStatx = false;
+      runOne(call);
+    } else if (res[i] < 0) {
+      *call.res = res[i];
+    } else {
+      statFromStatx(stx[i], call.st);
+      *call.res = 0;
+    }
+  }
+  return true;
+#else
+  (void)start;
+  (void)count;
+  return false;
+#endif
+}
+
+}  // namespace encfs
@@ -0,0 +1,72 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _StatBatch_incl_
+#define _StatBatch_incl_
+
+#include <cstddef>
+#include <sys/stat.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Stats of backing files which don't depend on each other, such as those
+    of all entries of a directory, queued and then made at once by run().
+
+    With io_uring, they go to the kernel as IORING_OP_STATX entries, a
+    ring's worth per system call, and on network filesystems their round
+    trips overlap.  Otherwise, or when the ring turns them down (kernels
+    before 5.6), they are made one after another.  Names are relative to a
+    directory descriptor, or absolute with AT_FDCWD, and have to stay valid
+    until run() returns.
+*/
+class StatBatch {
+ public:
+  // uring: try io_uring (see --uring)
+  explicit StatBatch(bool uring);
+
+  // fstatat(AT_SYMLINK_NOFOLLOW) of name in dir into st, and 0 or -errno
+  // into res.  relaxed as for statAt.
+  void stat(int dir, const char *name, struct stat *st, int *res,
+            bool relaxed = false);
+
+  size_t size() const { return _calls.size(); }
+
+  // Makes the queued calls and empties the batch.
+  void run();
+
+ private:
+  struct Call {
+    int dir;
+    const char *name;
+    struct stat *st;
+    int *res;
+    bool relaxed;
+  };
+
+  static void runOne(const Call &call);
+  // false if the ring can't make them, and nothing was done
+  bool runRing(size_t start, size_t count);
+
+  bool _uring;
+  std::vector<Call> _calls;
+};
+
+}  // namespace encfs
+
+#endif
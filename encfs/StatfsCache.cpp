@@ -0,0 +1,166 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StatfsCache.h"
+
+#include "easylogging++.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+static int64_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct StatfsCache::State {
+  std::vector<std::string> paths;
+  int64_t timeout;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t done;  // a refresh finished
+  bool have;            // result and st are set
+  bool refreshing;
+  int64_t stamp;  // of the result, nowMs()
+  int result;
+  struct statvfs st;
+
+  State(const std::vector<std::string> &p, int64_t t)
+      : paths(p),
+        timeout(t),
+        have(false),
+        refreshing(false),
+        stamp(0),
+        result(0) {
+    pthread_mutex_init(&mutex, nullptr);
+    pthread_cond_init(&done, nullptr);
+    memset(&st, 0, sizeof(st));
+  }
+  ~State() {
+    pthread_cond_destroy(&done);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  // mutex held
+  void store(int res, const struct statvfs &newSt) {
+    result = res;
+    st = newSt;
+    have = true;
+    stamp = nowMs();
+    refreshing = false;
+    pthread_cond_broadcast(&done);
+  }
+};
+
+StatfsCache::StatfsCache(const std::string &path, int64_t timeout)
+    : StatfsCache(std::vector<std::string>(1, path), timeout) {}
+
+StatfsCache::StatfsCache(const std::vector<std::string> &paths,
+                         int64_t timeout)
+    : _state(std::make_shared<State>(paths, timeout)) {}
+
+StatfsCache::~StatfsCache() = default;
+
+int StatfsCache::query(const std::string &path, struct statvfs *st) {
+  VLOG(1) << "doing statfs of " << path;
+  if (::statvfs(path.c_str(), st) != 0) {
+    return -errno;
+  }
+  // adjust maximum name length..
+  st->f_namemax = 6 * (st->f_namemax - 2) / 8;  // approx..
+  return 0;
+}
+
+int StatfsCache::query(const std::vector<std::string> &paths,
+                       struct statvfs *st) {
+  int res = query(paths[0], st);
+  for (size_t i = 1; i < paths.size() && res == 0; ++i) {
+    struct statvfs more;
+    res = query(paths[i], &more);
+    if (res != 0 || st->f_frsize == 0) {
+      break;
+    }
+    auto blocks = [&](fsblkcnt_t count) {
+      return (fsblkcnt_t)((unsigned __int128)count * more.f_frsize /
+                          st->f_frsize);
+    };
+    st->f_blocks += blocks(more.f_blocks);
+    st->f_bfree += blocks(more.f_bfree);
+    st->f_bavail += blocks(more.f_bavail);
+    st->f_files += more.f_files;
+    st->f_ffree += more.f_ffree;
+    st->f_favail += more.f_favail;
+    st->f_namemax = std::min(st->f_namemax, more.f_namemax);
+  }
+  return res;
+}
+
+void *StatfsCache::refresh(void *arg) {
+  std::shared_ptr<State> *state = static_cast<std::shared_ptr<State> *>(arg);
+  State &s = **state;
+
+  struct statvfs st;
+  memset(&st, 0, sizeof(st));
+  int res = query(s.paths, &st);
+  {
+    Lock lock(s.mutex);
+    s.store(res, st);
+  }
+
+  delete state;
+  return nullptr;
+}
+
+int StatfsCache::get(struct statvfs *st) {
+  State &s = *_state;
+  Lock lock(s.mutex);
+
+  if ((!s.have || nowMs() - s.stamp >= s.timeout) && !s.refreshing) {
+    s.refreshing = true;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    auto *arg = new std::shared_ptr<State>(_state);
+    int res = pthread_create(&thread, &attr, StatfsCache::refresh, arg);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+      // no thread to spare, ask here
+      delete arg;
+      struct statvfs newSt;
+      memset(&newSt, 0, sizeof(newSt));
+      s.store(query(s.paths, &newSt), newSt);
+    }
+  }
+
+  while (!s.have) {
+    pthread_cond_wait(&s.done, &s.mutex);
+  }
+  *st = s.st;
+  return s.result;
+}
+
+}  // namespace encfs
@@ -0,0 +1,70 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _StatfsCache_incl_
+#define _StatfsCache_incl_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/statvfs.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    The statvfs of the backing directory, as statfs reports it (see
+    --statfscache).
+
+    Tools like df and file managers ask for it all the time, and on a network
+    filesystem every call takes a round trip.  A result is served for
+    timeout milliseconds, after which the next call starts a refresh on a
+    thread of its own and is still answered with the old result.  So callers
+    only wait for the very first result, and an unreachable server stalls
+    the refresh instead of every caller.  Errors are kept like results.
+    A striped volume (--stripe) reports its backing directories added up.
+*/
+class StatfsCache {
+ public:
+  StatfsCache(const std::string &path, int64_t timeout);
+  StatfsCache(const std::vector<std::string> &paths, int64_t timeout);
+  ~StatfsCache();
+
+  StatfsCache(const StatfsCache &src) = delete;
+  StatfsCache &operator=(const StatfsCache &src) = delete;
+
+  // Returns 0 or -errno.  f_namemax is that of encoded names.
+  int get(struct statvfs *st);
+
+  // statvfs of path, with f_namemax adjusted, without a cache
+  static int query(const std::string &path, struct statvfs *st);
+  // the same for all of paths, in the blocks of the first
+  static int query(const std::vector<std::string> &paths,
+                   struct statvfs *st);
+
+ private:
+  // shared with a running refresh, which may outlive the cache
+  struct State;
+
+  static void *refresh(void *arg);
+
+  std::shared_ptr<State> _state;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,473 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <pthread.h>
+
+#include "easylogging++.h"
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+std::atomic<bool> Stats::_enabled(false);
+thread_local uint64_t *Stats::_traceSpent = nullptr;
+bool Stats::_allocHook = false;
+thread_local uint64_t Stats::_allocations = 0;
+
+namespace {
+
+// below this everything lands in the first bucket
+const int FirstBit = 6;
+
+struct alignas(64) Histogram {
+  std::atomic<uint64_t> buckets[Stats::BucketCount];
+  std::atomic<uint64_t> sum;
+};
+
+Histogram histograms[Stats::OpCount];
+
+// a cache line each, as hits and misses are counted from every reader
+struct alignas(64) Counter {
+  std::atomic<uint64_t> value;
+};
+
+Counter counters[Stats::CounterCount];
+
+struct alignas(64) Gauge {
+  std::atomic<int64_t> value;
+};
+
+Gauge gauges[Stats::GaugeCount];
+
+// ns, by Phase
+Counter phases[Stats::PhaseCount];
+
+const char *const phaseNames[Stats::PhaseCount] = {
+    "read_config", "password", "derive_key", "decode_key",
+    "volume",      "root_dir", "fuse_setup"};
+
+// the innermost PhaseTimer of the thread
+thread_local Stats::PhaseTimer *currentPhase = nullptr;
+
+// heap allocations made within the Timers of each op
+Counter allocationCounts[Stats::OpCount];
+
+struct CounterInfo {
+  const char *name;
+  const char *help;
+};
+
+const CounterInfo counterInfo[Stats::CounterCount] = {
+    {"encfs_block_cache_hits_total",
+     "Blocks served from the last block or the block cache."},
+    {"encfs_block_cache_misses_total",
+     "Blocks read from the layer below for a reader."},
+    {"encfs_block_cache_shared_misses_total",
+     "Misses which waited for another reader to load the same block."},
+    {"encfs_block_cache_evictions_total",
+     "Blocks evicted from the block cache to make room."},
+    {"encfs_block_cache_invalidations_total",
+     "Cached blocks dropped by writes and truncation."},
+    {"encfs_readahead_blocks_total", "Blocks read ahead."},
+    {"encfs_readahead_used_blocks_total",
+     "Blocks read ahead which were read later."},
+    {"encfs_readahead_wasted_blocks_total",
+     "Blocks read ahead which were dropped unread."},
+    {"encfs_decoded_bytes_total",
+     "Bytes decoded from backing files (encoded in reverse mode)."},
+    {"encfs_returned_bytes_total", "Bytes returned by reads."},
+    {"encfs_requested_bytes_total", "Bytes asked for by reads."},
+    {"encfs_written_bytes_total", "Bytes given to writes."},
+    {"encfs_encoded_bytes_total",
+     "Bytes encoded for backing files (decoded in reverse mode)."},
+    {"encfs_backing_read_bytes_total", "Bytes read from backing files."},
+    {"encfs_backing_written_bytes_total", "Bytes written to backing files."},
+    {"encfs_merged_blocks_total",
+     "Partial block writes which read the block to merge into it."},
+    {"encfs_padded_blocks_total",
+     "Blocks written to pad files up to a write or truncate past the end."},
+    {"encfs_header_reads_total", "File IV headers read."},
+    {"encfs_header_writes_total", "File IV headers written."},
+    {"encfs_lower_queued_total",
+     "Reads and writes of backing files which waited for the I/O depth."},
+    {"encfs_lower_merged_total",
+     "Reads and writes of backing files merged into an adjacent one."},
+    {"encfs_collapsed_calls_total",
+     "Metadata calls which took the result of the same call running."},
+    {"encfs_background_dropped_total",
+     "Background tasks dropped as over the CPU budget or backing off."},
+    {"encfs_background_deferred_total",
+     "Background tasks which waited for the CPU budget."},
+    {"encfs_background_cpu_microseconds_total",
+     "CPU time taken by background tasks under a CPU budget."},
+};
+
+const CounterInfo gaugeInfo[Stats::GaugeCount] = {
+    {"encfs_buffer_bytes", "Bytes of last-block buffers held by open files."},
+};
+
+struct Family {
+  const char *name;
+  const char *help;
+  const char *label;
+  Stats::Op first;
+  Stats::Op last;
+};
+
+const Family families[] = {
+    {"encfs_fuse_op_seconds", "Latency of FUSE operations.", "op",
+     Stats::Getattr, Stats::Fsync},
+    {"encfs_internal_op_seconds",
+     "Latency of coding and backing file operations.", "op",
+     Stats::BlockEncode, Stats::Syscall},
+    {"encfs_lock_wait_seconds", "Time spent waiting for contended locks.",
+     "lock", Stats::FileNodeLock, Stats::BlockCacheLock},
+    {"encfs_lock_hold_seconds", "Time locks were held, per acquisition.",
+     "lock", Stats::FileNodeHold, Stats::BlockCacheHold},
+};
+
+const char *const opNames[Stats::OpCount] = {
+    "getattr",      "opendir",      "readdir",     "open",
+    "read",         "write",        "flush",       "fsync",
+    "block_encode", "block_decode", "mac64",       "name_encode",
+    "name_decode",  "pread",        "pwrite",      "syscall",
+    "filenode",     "context",      "dirnode",     "key",
+    "blockcache",   "filenode",     "context",     "dirnode",
+    "key",          "blockcache"};
+
+std::atomic<uint64_t> slowThreshold(0);
+
+// the FUSE call a thread is tracing
+struct CallTrace {
+  const char *op;
+  std::string name;  // cipher name
+  uint64_t start;
+  uint64_t spent[Stats::OpCount];
+  uint64_t counted[Stats::CounterCount];
+};
+
+thread_local CallTrace callTrace;
+
+pthread_mutex_t slowMutex = PTHREAD_MUTEX_INITIALIZER;
+std::deque<std::string> slowCalls;  // oldest first
+
+// "name=1.234ms " for the time spent in op, if any
+void addStage(std::string *out, const char *prefix, Stats::Op op,
+              uint64_t spent) {
+  if (spent == 0) {
+    return;
+  }
+  char stage[64];
+  snprintf(stage, sizeof(stage), " %s%s=%.3fms", prefix, opNames[op],
+           spent / 1e6);
+  *out += stage;
+}
+
+}  // namespace
+
+int Stats::bucket(uint64_t nanoseconds) {
+  if (nanoseconds < ((uint64_t)1 << FirstBit)) {
+    return 0;
+  }
+  int msb = 63 - __builtin_clzll(nanoseconds);
+  int sub = (nanoseconds >> (msb - 1)) & 1;
+  int index = 1 + (msb - FirstBit) * 2 + sub;
+  return index < BucketCount ? index : BucketCount - 1;
+}
+
+uint64_t Stats::bucketLimit(int bucket) {
+  if (bucket == 0) {
+    return (uint64_t)1 << FirstBit;
+  }
+  if (bucket >= BucketCount - 1) {
+    return UINT64_MAX;  // overflow
+  }
+  int msb = FirstBit + (bucket - 1) / 2;
+  int sub = (bucket - 1) % 2;
+  return (uint64_t)(3 + sub) << (msb - 1);
+}
+
+void Stats::record(Op op, uint64_t nanoseconds) {
+  Histogram &h = histograms[op];
+  h.buckets[bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+  h.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+uint64_t Stats::count(Op op) {
+  uint64_t total = 0;
+  for (auto &b : histograms[op].buckets) {
+    total += b.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void Stats::addCounter(Counter counter, uint64_t n) {
+  if (enabled()) {
+    counters[counter].value.fetch_add(n, std::memory_order_relaxed);
+  }
+  if (_traceSpent != nullptr) {
+    callTrace.counted[counter] += n;
+  }
+}
+
+void Stats::recordAllocations(Op op, uint64_t n) {
+  allocationCounts[op].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Stats::allocations(Op op) {
+  return allocationCounts[op].value.load(std::memory_order_relaxed);
+}
+
+uint64_t Stats::value(Counter counter) {
+  return counters[counter].value.load(std::memory_order_relaxed);
+}
+
+void Stats::adjust(Gauge gauge, int64_t delta) {
+  gauges[gauge].value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+int64_t Stats::value(Gauge gauge) {
+  return gauges[gauge].value.load(std::memory_order_relaxed);
+}
+
+void Stats::recordPhase(Phase phase, uint64_t nanoseconds) {
+  phases[phase].value.store(nanoseconds, std::memory_order_relaxed);
+  VLOG(1) << "startup phase " << phaseNames[phase] << " took "
+          << nanoseconds / 1000000.0 << " ms";
+}
+
+uint64_t Stats::phase(Phase phase) {
+  return phases[phase].value.load(std::memory_order_relaxed);
+}
+
+const char *Stats::phaseName(Phase phase) { return phaseNames[phase]; }
+
+Stats::PhaseTimer::PhaseTimer(Phase phase)
+    : _phase(phase), _start(now()), _nested(0), _outer(currentPhase) {
+  currentPhase = this;
+}
+
+Stats::PhaseTimer::~PhaseTimer() {
+  uint64_t elapsed = now() - _start;
+  currentPhase = _outer;
+  if (_outer != nullptr) {
+    _outer->_nested += elapsed;
+  }
+  recordPhase(_phase, elapsed - std::min(_nested, elapsed));
+}
+
+void Stats::setSlowThreshold(uint64_t nanoseconds) {
+  slowThreshold = nanoseconds;
+}
+
+Stats::Trace::Trace(const char *opName, bool sample)
+    : _active(false), _traced(false) {
+  if (_traceSpent != nullptr ||
+      (!sample && slowThreshold.load(std::memory_order_relaxed) == 0)) {
+    return;
+  }
+  CallTrace &trace = callTrace;
+  trace.op = opName;
+  trace.name.clear();
+  memset(trace.spent, 0, sizeof(trace.spent));
+  memset(trace.counted, 0, sizeof(trace.counted));
+  trace.start = now();
+  _traceSpent = trace.spent;
+  _active = true;
+  _traced = true;
+}
+
+// the first name set is the one the call is about, later ones come from
+// the paths it touched on the way, such as the target of a rename
+void Stats::Trace::setName(const char *cipherName) {
+  if (_traceSpent != nullptr && callTrace.name.empty()) {
+    callTrace.name = cipherName;
+  }
+}
+
+std::string Stats::Trace::finish() {
+  if (!_active) {
+    return std::string();
+  }
+  _active = false;
+  _traceSpent = nullptr;
+
+  const CallTrace &trace = callTrace;
+  uint64_t elapsed = now() - trace.start;
+  uint64_t threshold = slowThreshold.load(std::memory_order_relaxed);
+  if (threshold == 0 || elapsed < threshold) {
+    return std::string();
+  }
+
+  char head[64];
+  snprintf(head, sizeof(head), "%s %.3fs ", trace.op, elapsed / 1e9);
+  std::string entry = head;
+  entry += trace.name.empty() ? "-" : trace.name;
+  uint64_t staged = 0;
+  for (int op = BlockEncode; op <= Syscall; ++op) {
+    addStage(&entry, "", Op(op), trace.spent[op]);
+    staged += trace.spent[op];
+  }
+  for (int op = FileNodeLock; op <= BlockCacheLock; ++op) {
+    addStage(&entry, "wait_", Op(op), trace.spent[op]);
+    staged += trace.spent[op];
+  }
+  // lock waits within coding are counted twice, then nothing is left
+  char other[64];
+  snprintf(other, sizeof(other), " other=%.3fms",
+           staged < elapsed ? (elapsed - staged) / 1e6 : 0.0);
+  entry += other;
+
+  time_t wall = time(nullptr);
+  struct tm tm;
+  char when[32];
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S ", localtime_r(&wall, &tm));
+  Lock lock(slowMutex);
+  slowCalls.push_back(when + entry);
+  if (slowCalls.size() > (size_t)SlowCount) {
+    slowCalls.pop_front();
+  }
+  return entry;
+}
+
+const std::string &Stats::Trace::name() const { return callTrace.name; }
+
+uint64_t Stats::Trace::spent(Op op) const {
+  return _traced ? callTrace.spent[op] : 0;
+}
+
+uint64_t Stats::Trace::counted(Counter counter) const {
+  return _traced ? callTrace.counted[counter] : 0;
+}
+
+std::string Stats::slowReport() {
+  std::string out;
+  Lock lock(slowMutex);
+  for (const std::string &entry : slowCalls) {
+    out += entry;
+    out += '\n';
+  }
+  return out;
+}
+
+void Stats::reset() {
+  {
+    Lock lock(slowMutex);
+    slowCalls.clear();
+  }
+  for (auto &c : counters) {
+    c.value = 0;
+  }
+  for (auto &c : allocationCounts) {
+    c.value = 0;
+  }
+  for (auto &h : histograms) {
+    for (auto &b : h.buckets) {
+      b = 0;
+    }
+    h.sum = 0;
+  }
+}
+
+std::string Stats::report() {
+  std::string out;
+  out.reserve(96 * 1024);
+  char line[256];
+  for (const Family &family : families) {
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n",
+             family.name, family.help, family.name);
+    out += line;
+    for (int op = family.first; op <= family.last; ++op) {
+      const Histogram &h = histograms[op];
+      // the last bucket only counts towards +Inf
+      uint64_t total = 0;
+      for (int b = 0; b < BucketCount; ++b) {
+        total += h.buckets[b].load(std::memory_order_relaxed);
+        if (b == BucketCount - 1) {
+          break;
+        }
+        snprintf(line, sizeof(line), "%s_bucket{%s=\"%s\",le=\"%.9g\"} %llu\n",
+                 family.name, family.label, opNames[op],
+                 bucketLimit(b) / 1e9, (unsigned long long)total);
+        out += line;
+      }
+      snprintf(line, sizeof(line),
+               "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n"
+               "%s_sum{%s=\"%s\"} %.9f\n"
+               "%s_count{%s=\"%s\"} %llu\n",
+               family.name, family.label, opNames[op],
+               (unsigned long long)total, family.name, family.label,
+               opNames[op], h.sum.load(std::memory_order_relaxed) / 1e9,
+               family.name, family.label, opNames[op],
+               (unsigned long long)total);
+      out += line;
+    }
+  }
+  for (int c = 0; c < CounterCount; ++c) {
+    const CounterInfo &info = counterInfo[c];
+    snprintf(line, sizeof(line),
+             "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", info.name,
+             info.help, info.name, info.name,
+             (unsigned long long)counters[c].value.load(
+                 std::memory_order_relaxed));
+    out += line;
+  }
+  if (countingAllocations()) {
+    out += "# HELP encfs_fuse_op_allocations_total Heap allocations made by "
+           "FUSE operations.\n# TYPE encfs_fuse_op_allocations_total "
+           "counter\n";
+    for (int op = Getattr; op <= Fsync; ++op) {
+      snprintf(line, sizeof(line),
+               "encfs_fuse_op_allocations_total{op=\"%s\"} %llu\n",
+               opNames[op], (unsigned long long)allocations(Op(op)));
+      out += line;
+    }
+  }
+  for (int g = 0; g < GaugeCount; ++g) {
+    const CounterInfo &info = gaugeInfo[g];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n",
+             info.name, info.help, info.name, info.name,
+             (long long)gauges[g].value.load(std::memory_order_relaxed));
+    out += line;
+  }
+  out += "# HELP encfs_startup_phase_seconds Time taken by each phase of "
+         "mounting.\n# TYPE encfs_startup_phase_seconds gauge\n";
+  for (int p = 0; p < PhaseCount; ++p) {
+    snprintf(line, sizeof(line), "encfs_startup_phase_seconds{phase=\"%s\"} "
+             "%.9f\n", phaseNames[p],
+             phases[p].value.load(std::memory_order_relaxed) / 1e9);
+    out += line;
+  }
+  // comments to a scraper
+  Lock lock(slowMutex);
+  for (const std::string &entry : slowCalls) {
+    out += "# slow ";
+    out += entry;
+    out += '\n';
+  }
+  return out;
+}
+
+}  // namespace encfs
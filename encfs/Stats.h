@@ -0,0 +1,317 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _Stats_incl_
+#define _Stats_incl_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+namespace encfs {
+
+/*
+    Operation counts and latency histograms for the whole process, kept
+    with relaxed atomics so that recording never takes a lock.
+
+    Histograms are log-linear, HDR style: two buckets per power of two from
+    64ns up to about a minute, so any latency is known to within ~40%.
+    Locks taken with a site (see Mutex.h) count the time they were waited
+    for and held.  Next to them are plain event counters, for the block
+    cache, read ahead and how much I/O the calls cause on backing files, and
+    gauges of memory in use.  Recording is off unless enabled (--stats),
+    then each Timer costs two clock reads.  report() formats everything in
+    the Prometheus text exposition format, served as the virtual file
+    /.encfs-stats.
+
+    Independently of that, the slow operation log (--slowlog) traces each
+    FUSE call within a Trace: the Timers and lock waits of its thread add
+    up what they took, and a call which takes longer than the threshold
+    is kept, with that breakdown, among the last SlowCount such calls.
+    Only the cipher name of the file the call was about is recorded.
+
+    Where the allocation hook of AllocHook.cpp is linked in (the encfs
+    binary built with ENABLE_ALLOC_STATS, and the unit tests), operator new
+    counts the heap allocations of each thread, and the Timers of the FUSE
+    calls add up how many each call made.
+
+    Mounting is timed by phase (see Phase), so that it can be told where
+    the seconds before the first call go.
+*/
+class Stats {
+ public:
+  enum Op {
+    // FUSE calls
+    Getattr,
+    Opendir,
+    Readdir,
+    Open,
+    Read,
+    Write,
+    Flush,
+    Fsync,
+    // internals
+    BlockEncode,
+    BlockDecode,
+    Mac64,
+    NameEncode,
+    NameDecode,
+    Pread,
+    Pwrite,
+    Syscall,  // other calls on backing files
+    // Lock sites: time spent waiting for a lock, only counted when it was
+    // taken, so the count is of contended acquisitions ...
+    FileNodeLock,
+    ContextLock,
+    DirNodeLock,
+    KeyLock,
+    BlockCacheLock,
+    // ... and the time it was then held, counted for every acquisition
+    FileNodeHold,
+    ContextHold,
+    DirNodeHold,
+    KeyHold,
+    BlockCacheHold,
+    OpCount
+  };
+
+  enum Counter {
+    // block lookups by the BlockFileIO layers: served from the last block or
+    // the block cache, or read from the layer below
+    CacheHits,
+    CacheMisses,
+    // misses which waited for another reader loading the same block
+    CacheSharedMisses,
+    // blocks pushed out of the block cache to make room, and blocks dropped
+    // because the file was written or truncated
+    CacheEvictions,
+    CacheInvalidations,
+    // blocks read ahead into the block cache, and what became of them: read
+    // later, or evicted, invalidated or discarded unread
+    ReadAheadBlocks,
+    ReadAheadUsed,
+    ReadAheadWasted,
+    // data decoded from backing files, and data returned by reads
+    BytesDecoded,
+    BytesReturned,
+    // What the I/O of the FUSE calls turned into, to work out its
+    // amplification: the bytes asked for by reads and given to writes,
+    // the data encoded, and the bytes read from and written to backing
+    // files, which include headers, MACs and padding ...
+    BytesRequested,
+    BytesWritten,
+    BytesEncoded,
+    BackingBytesRead,
+    BackingBytesWritten,
+    // ... partial block writes which read the block to merge into it,
+    // blocks written to pad a file up to a write or truncate beyond its
+    // end, and file IV headers read and written
+    MergedBlocks,
+    PaddedBlocks,
+    HeaderReads,
+    HeaderWrites,
+    // requests for backing files which waited for --iodepth, and which
+    // were merged into an adjacent one
+    LowerQueued,
+    LowerMerged,
+    // getattr, readlink and directory listing calls which took the result
+    // of the same call already running (see InFlight)
+    CollapsedCalls,
+    // background work left out for --bgcpu: optional work dropped, and
+    // work which waited for its turn, and the CPU time of what ran
+    BackgroundDropped,
+    BackgroundDeferred,
+    BackgroundCpuMicros,
+    CounterCount
+  };
+
+  // current amounts, kept up to date whether or not recording is enabled
+  enum Gauge {
+    // last-block buffers held by open files (see BufferBudget)
+    BufferBytes,
+    GaugeCount
+  };
+
+  // Phases of mounting, each timed once per mount (the last one, after a
+  // remount).  The time of a phase timed within another is left out of the
+  // other's.
+  enum Phase {
+    ReadConfig,  // finding and parsing the configuration file
+    Password,    // the password prompt, or the --extpass program
+    DeriveKey,   // PBKDF2 or Argon2 of the password
+    DecodeKey,   // decoding and checking the volume key
+    Volume,      // caches, workers, stripes and the like of the volume
+    RootDir,     // the root DirNode, and replaying the intent log
+    FuseSetup,   // from handing over to FUSE to its init call
+    PhaseCount
+  };
+
+  static const int BucketCount = 64;
+  static const int SlowCount = 64;
+
+  static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+  static void setEnabled(bool enable) { _enabled = enable; }
+
+  static void record(Op op, uint64_t nanoseconds);
+  // bucket a latency falls into, and the upper bound of a bucket
+  static int bucket(uint64_t nanoseconds);
+  static uint64_t bucketLimit(int bucket);
+
+  static uint64_t count(Op op);
+
+  // the hold histogram of a lock site
+  static Op holdOf(Op waitStat) {
+    return Op(waitStat + (FileNodeHold - FileNodeLock));
+  }
+
+  static void add(Counter counter, uint64_t n = 1) {
+    if (enabled() || tracing()) {
+      addCounter(counter, n);
+    }
+  }
+  static uint64_t value(Counter counter);
+
+  static void adjust(Gauge gauge, int64_t delta);
+  static int64_t value(Gauge gauge);
+
+  // Phase times are kept whether or not recording is enabled, and logged
+  // with -v.  reset() leaves them.
+  static void recordPhase(Phase phase, uint64_t nanoseconds);
+  static uint64_t phase(Phase phase);
+  static const char *phaseName(Phase phase);
+
+  static std::string report();
+  static void reset();
+
+  // whether the allocation hook is linked in
+  static bool countingAllocations() { return _allocHook; }
+  // allocations made by the thread so far, 0 without the hook
+  static uint64_t allocations() { return _allocations; }
+  // allocations made within the Timers of op, while recording was enabled
+  static uint64_t allocations(Op op);
+  // for the hook
+  static void hookAllocations() { _allocHook = true; }
+  static void allocated() { ++_allocations; }
+
+  // FUSE calls which take at least this long are logged, 0 == never
+  static void setSlowThreshold(uint64_t nanoseconds);
+  static bool tracing() { return _traceSpent != nullptr; }
+  // the slow calls kept, oldest first, one per line
+  static std::string slowReport();
+
+  // Traces the FUSE call of the thread until it goes out of scope, unless
+  // the thread is tracing one already.  With sample, also when the slow
+  // log is off.
+  class Trace {
+   public:
+    explicit Trace(const char *opName, bool sample = false);
+    ~Trace() { finish(); }
+
+    Trace(const Trace &src) = delete;
+    Trace &operator=(const Trace &src) = delete;
+
+    // the backing file or directory the traced call is about
+    static void setName(const char *cipherName);
+    static void setName(const std::string &cipherName) {
+      setName(cipherName.c_str());
+    }
+
+    // Ends the trace.  Returns the log entry if the call was slow, or an
+    // empty string.
+    std::string finish();
+
+    // After finish(), whether the call was traced, and its name, the time
+    // it spent in op and what it added to counter on its thread
+    bool traced() const { return _traced; }
+    const std::string &name() const;
+    uint64_t spent(Op op) const;
+    uint64_t counted(Counter counter) const;
+
+   private:
+    bool _active;
+    bool _traced;
+  };
+
+  static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  // records the time until it goes out of scope
+  class Timer {
+   public:
+    explicit Timer(Op op)
+        : _op(op),
+          _start(enabled() || tracing() ? now() : 0),
+          _allocations(Stats::_allocations) {}
+    ~Timer() {
+      if (_start != 0) {
+        uint64_t elapsed = now() - _start;
+        if (enabled()) {
+          record(_op, elapsed);
+          if (_allocHook) {
+            recordAllocations(_op, Stats::_allocations - _allocations);
+          }
+        }
+        if (_traceSpent != nullptr) {
+          _traceSpent[_op] += elapsed;
+        }
+      }
+    }
+
+    Timer(const Timer &src) = delete;
+    Timer &operator=(const Timer &src) = delete;
+
+   private:
+    Op _op;
+    uint64_t _start;
+    uint64_t _allocations;
+  };
+
+  // records a phase of mounting when it goes out of scope, less the time
+  // of phases timed within it on the same thread
+  class PhaseTimer {
+   public:
+    explicit PhaseTimer(Phase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer &src) = delete;
+    PhaseTimer &operator=(const PhaseTimer &src) = delete;
+
+   private:
+    Phase _phase;
+    uint64_t _start;
+    uint64_t _nested;
+    PhaseTimer *_outer;
+  };
+
+ private:
+  static void addCounter(Counter counter, uint64_t n);
+  static void recordAllocations(Op op, uint64_t n);
+
+  static std::atomic<bool> _enabled;
+  // time by op of the traced call of the thread, null if not tracing
+  static thread_local uint64_t *_traceSpent;
+  static bool _allocHook;
+  static thread_local uint64_t _allocations;
+};
+
+}  // namespace encfs
+
+#endif
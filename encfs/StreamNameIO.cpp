@@ -143,7 +143,7 @@ int StreamNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
     throw Error("Filename too small to decode");
   }
 
-  BUFFER_INIT(tmpBuf, 32, (unsigned int)length);
+  BUFFER_INIT(tmpBuf, 256, (unsigned int)length);
 
   // decode into tmpBuf, because this step produces more data then we can fit
   // into the result buffer..
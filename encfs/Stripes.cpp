@@ -0,0 +1,211 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Stripes.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Error.h"
+
+namespace encfs {
+
+const char Stripes::FileName[] = ".encfs6.stripe";
+
+// the marker holds "index count"
+static bool readMarker(const std::string &root, size_t *index,
+                       size_t *count) {
+  FILE *in = fopen((root + Stripes::FileName).c_str(), "r");
+  if (in == nullptr) {
+    return false;
+  }
+  unsigned long i = 0, n = 0;
+  bool ok = fscanf(in, "%lu %lu", &i, &n) == 2 && i < n;
+  fclose(in);
+  *index = i;
+  *count = n;
+  return ok;
+}
+
+static bool writeMarker(const std::string &root, size_t index, size_t count) {
+  FILE *out = fopen((root + Stripes::FileName).c_str(), "w");
+  if (out == nullptr) {
+    return false;
+  }
+  fprintf(out, "%lu %lu\n", (unsigned long)index, (unsigned long)count);
+  return fclose(out) == 0;
+}
+
+// Whether dir holds nothing but lost+found
+static bool isEmptyDir(const std::string &dir) {
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return false;
+  }
+  bool empty = true;
+  struct dirent *de;
+  while (empty && (de = readdir(d)) != nullptr) {
+    empty = strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+            strcmp(de->d_name, "lost+found") == 0;
+  }
+  closedir(d);
+  return empty;
+}
+
+// Make the directories below relative in from in each of to
+static bool mirrorDirs(const std::string &from, const std::string &relative,
+                       const std::vector<std::string> &to) {
+  DIR *d = opendir((from + relative).c_str());
+  if (d == nullptr) {
+    return false;
+  }
+  bool ok = true;
+  struct dirent *de;
+  while (ok && (de = readdir(d)) != nullptr) {
+    // our own files in the root, and . and ..
+    if (de->d_name[0] == '.' &&
+        (relative.empty() || de->d_name[1] == '\0' ||
+         strcmp(de->d_name, "..") == 0)) {
+      continue;
+    }
+    std::string path = relative + de->d_name;
+    struct stat st;
+    if (lstat((from + path).c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+      continue;
+    }
+    for (const std::string &root : to) {
+      if (mkdir((root + path).c_str(), (st.st_mode & 07777) | 0700) != 0 &&
+          errno != EEXIST) {
+        RLOG(ERROR) << "mkdir " << root + path << ": " << strerror(errno);
+        ok = false;
+      }
+    }
+    ok = ok && mirrorDirs(from, path + '/', to);
+  }
+  closedir(d);
+  return ok;
+}
+
+std::shared_ptr<Stripes> Stripes::open(const std::vector<std::string> &roots,
+                                       std::string *error) {
+  for (size_t i = 0; i < roots.size(); ++i) {
+    for (size_t j = 0; j < roots.size(); ++j) {
+      if (i != j && roots[j].compare(0, roots[i].size(), roots[i]) == 0) {
+        *error = roots[j] + " is within " + roots[i];
+        return std::shared_ptr<Stripes>();
+      }
+    }
+  }
+
+  size_t marked = 0;
+  for (size_t i = 0; i < roots.size(); ++i) {
+    size_t index, count;
+    if (!readMarker(roots[i], &index, &count)) {
+      continue;
+    }
+    ++marked;
+    if (index != i || count != roots.size()) {
+      *error = roots[i] + " is backing directory " + std::to_string(index + 1) +
+               " of " + std::to_string(count);
+      return std::shared_ptr<Stripes>();
+    }
+  }
+
+  if (marked == 0) {
+    // a new layout: the directories of the volume go everywhere
+    std::vector<std::string> others(roots.begin() + 1, roots.end());
+    for (const std::string &root : others) {
+      if (!isEmptyDir(root)) {
+        *error = root + " is not an empty directory";
+        return std::shared_ptr<Stripes>();
+      }
+    }
+    if (!mirrorDirs(roots[0], std::string(), others)) {
+      *error = "can't copy the directories of " + roots[0];
+      return std::shared_ptr<Stripes>();
+    }
+    for (size_t i = 0; i < roots.size(); ++i) {
+      if (!writeMarker(roots[i], i, roots.size())) {
+        *error = "can't write " + roots[i] + FileName + ": " + strerror(errno);
+        return std::shared_ptr<Stripes>();
+      }
+    }
+  } else if (marked != roots.size()) {
+    *error = "not all backing directories are marked as such";
+    return std::shared_ptr<Stripes>();
+  }
+
+  return std::make_shared<Stripes>(roots);
+}
+
+size_t Stripes::countOf(const std::string &rootDir) {
+  size_t index, count;
+  return readMarker(rootDir, &index, &count) ? count : 1;
+}
+
+Stripes::Stripes(const std::vector<std::string> &roots) : _roots(roots) {}
+
+// FNV-1a of the last component, which is all a new entry's place may
+// depend on
+size_t Stripes::home(const std::string &relative) const {
+  size_t start = relative.rfind('/');
+  start = (start == std::string::npos) ? 0 : start + 1;
+  if (start == relative.size()) {
+    return 0;  // the root
+  }
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = start; i < relative.size(); ++i) {
+    hash = (hash ^ (unsigned char)relative[i]) * 1099511628211ULL;
+  }
+  return hash % _roots.size();
+}
+
+std::string Stripes::locate(const std::string &relative) const {
+  size_t index = home(relative);
+  std::string path = _roots[index] + relative;
+  struct stat st;
+  if (_roots.size() == 1 || lstat(path.c_str(), &st) == 0 || errno != ENOENT) {
+    return path;
+  }
+  for (size_t i = 0; i < _roots.size(); ++i) {
+    if (i == index) {
+      continue;
+    }
+    std::string other = _roots[i] + relative;
+    if (lstat(other.c_str(), &st) == 0) {
+      return other;
+    }
+  }
+  return path;
+}
+
+size_t Stripes::rootOf(const std::string &path) const {
+  for (size_t i = 0; i < _roots.size(); ++i) {
+    if (path.compare(0, _roots[i].size(), _roots[i]) == 0) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+}  // namespace encfs
@@ -0,0 +1,84 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _Stripes_incl_
+#define _Stripes_incl_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace encfs {
+
+/*
+    The backing directories of a striped volume (--stripe).
+
+    A volume is limited by the IOPS and metadata locks of the file system
+    its backing directory is on.  A striped volume spreads its files over
+    several backing directories instead, each of which can be a disk or
+    file system of its own.  Every directory of the volume exists in all of
+    them, while each file, link or device lives in one: the one picked by a
+    hash of its encoded name when it was created.  A rename leaves a file
+    where it is, since files can't be renamed from one file system to
+    another, so a file which isn't where its name puts it is looked for in
+    the others.  Listings are merged, taking directories from the first
+    backing directory only.
+
+    Each backing directory holds a marker file with its position and the
+    number of them, so that a volume isn't mounted with one left out, or in
+    another order.  The first one is the volume's root directory, with its
+    configuration.
+*/
+class Stripes {
+ public:
+  // name of the marker file in each backing directory
+  static const char FileName[];
+
+  // roots end with a '/', the first is the root directory of the volume.
+  // The markers are written if none of the roots has one yet, and the
+  // directories of the first root made in the others.  Null, with
+  // *error set, if the markers don't fit.
+  static std::shared_ptr<Stripes> open(const std::vector<std::string> &roots,
+                                       std::string *error);
+
+  // The number of backing directories rootDir has according to its marker,
+  // 1 if it has none.
+  static size_t countOf(const std::string &rootDir);
+
+  explicit Stripes(const std::vector<std::string> &roots);
+
+  size_t count() const { return _roots.size(); }
+  const std::string &root(size_t index) const { return _roots[index]; }
+
+  // the backing directory an entry with the cipher path relative to the
+  // roots goes to when created
+  size_t home(const std::string &relative) const;
+
+  // The full path of an entry where it exists, or where it is created.
+  std::string locate(const std::string &relative) const;
+
+  // the backing directory of path, which starts with one of the roots
+  size_t rootOf(const std::string &path) const;
+
+ private:
+  std::vector<std::string> _roots;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,166 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SyncBatcher.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <map>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Mutex.h"
+#include "config.h"
+
+namespace encfs {
+
+SyncBatcher::SyncBatcher(int windowUs)
+    : _windowUs(windowUs), _flushing(false), _flushes(0), _requests(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_wake, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+SyncBatcher::~SyncBatcher() {
+  pthread_cond_destroy(&_wake);
+  pthread_mutex_destroy(&_mutex);
+}
+
+uint64_t SyncBatcher::flushes() const {
+  Lock lock(_mutex);
+  return _flushes;
+}
+
+uint64_t SyncBatcher::requests() const {
+  Lock lock(_mutex);
+  return _requests;
+}
+
+int SyncBatcher::sync(int fd, bool dataSync) {
+  Request request = {fd, dataSync, 0};
+
+  Lock lock(_mutex);
+  if (!_next) {
+    _next = std::make_shared<Batch>();
+  }
+  std::shared_ptr<Batch> batch = _next;
+  batch->requests.push_back(&request);
+
+  while (!batch->done) {
+    if (_flushing) {
+      pthread_cond_wait(&_wake, &_mutex);
+      continue;
+    }
+
+    // lead the flush of our batch
+    _flushing = true;
+    if (_windowUs > 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += _windowUs / 1000000;
+      deadline.tv_nsec += (long)(_windowUs % 1000000) * 1000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+      }
+      while (pthread_cond_timedwait(&_wake, &_mutex, &deadline) != ETIMEDOUT) {
+      }
+    }
+    _next.reset();
+
+    pthread_mutex_unlock(&_mutex);
+    flush(batch->requests);
+    pthread_mutex_lock(&_mutex);
+
+    _flushes += 1;
+    _requests += batch->requests.size();
+    batch->done = true;
+    _flushing = false;
+    pthread_cond_broadcast(&_wake);
+  }
+  return request.result;
+}
+
+static int syncOne(int fd, bool dataSync) {
+  int res;
+#if defined(HAVE_FDATASYNC)
+  res = dataSync ? fdatasync(fd) : fsync(fd);
+#else
+  (void)dataSync;
+  res = fsync(fd);
+#endif
+  return res == -1 ? -errno : 0;
+}
+
+void SyncBatcher::flush(const std::vector<Request *> &requests) {
+#if defined(HAVE_SYNCFS) && defined(HAVE_SYNC_FILE_RANGE)
+  // by backing filesystem
+  std::map<dev_t, std::vector<Request *>> devices;
+  for (Request *request : requests) {
+    struct stat st;
+    if (fstat(request->fd, &st) != 0) {
+      request->result = -errno;
+    } else {
+      devices[st.st_dev].push_back(request);
+    }
+  }
+
+  for (auto &device : devices) {
+    std::vector<Request *> &group = device.second;
+    if (group.size() == 1) {
+      group[0]->result = syncOne(group[0]->fd, group[0]->dataSync);
+      continue;
+    }
+
+    // start the writeback of all files before waiting for any
+    for (Request *request : group) {
+      sync_file_range(request->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+    std::vector<Request *> written;
+    for (Request *request : group) {
+      if (sync_file_range(request->fd, 0, 0,
+                          SYNC_FILE_RANGE_WAIT_BEFORE |
+                              SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER) == 0) {
+        written.push_back(request);
+      } else if (errno == EINVAL || errno == ESPIPE || errno == ENOSYS) {
+        request->result = syncOne(request->fd, request->dataSync);
+      } else {
+        request->result = -errno;
+      }
+    }
+
+    // metadata and the device cache
+    if (!written.empty()) {
+      int res = syncfs(written[0]->fd) == 0 ? 0 : -errno;
+      for (Request *request : written) {
+        request->result = res;
+      }
+    }
+  }
+#else
+  for (Request *request : requests) {
+    request->result = syncOne(request->fd, request->dataSync);
+  }
+#endif
+}
+
+}  // namespace encfs
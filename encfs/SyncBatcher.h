@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SyncBatcher_incl_
+#define _SyncBatcher_incl_
+
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Group commit of the fsync calls of a volume (see --groupsync).
+
+    Each fsync of a backing file ends in a cache flush of the device, which
+    is what makes it slow on many SSDs.  Callers syncing different files at
+    the same time queue up here instead.  The first one to arrive leads: it
+    waits up to the window for others to join, then flushes them all at
+    once, while the requests arriving in the meantime gather for the next
+    flush.  Every caller returns once its own file is durable.
+
+    A lone file is synced with fsync (or fdatasync) as before.  For several,
+    the writeback of all of them is started and waited for with
+    sync_file_range, which reports the errors of each file, and then one
+    syncfs per backing filesystem commits the metadata and flushes the
+    device.  Without those calls the files are synced one after another.
+*/
+class SyncBatcher {
+ public:
+  // windowUs is how long a flush waits for more requests, in microseconds.
+  // With 0 only the requests which arrive during the previous flush are
+  // batched.
+  explicit SyncBatcher(int windowUs);
+  ~SyncBatcher();
+
+  SyncBatcher(const SyncBatcher &src) = delete;
+  SyncBatcher &operator=(const SyncBatcher &src) = delete;
+
+  // Make what was written to fd durable, as fsync (fdatasync if dataSync)
+  // would.  Returns 0 or -errno.
+  int sync(int fd, bool dataSync);
+
+  // flushes done, and requests served by them
+  uint64_t flushes() const;
+  uint64_t requests() const;
+
+ private:
+  struct Request {
+    int fd;
+    bool dataSync;
+    int result;
+  };
+  struct Batch {
+    std::vector<Request *> requests;
+    bool done = false;
+  };
+
+  static void flush(const std::vector<Request *> &requests);
+
+  const int _windowUs;
+
+  mutable pthread_mutex_t _mutex;
+  pthread_cond_t _wake;
+  bool _flushing;
+  std::shared_ptr<Batch> _next;  // gathering requests
+  uint64_t _flushes;
+  uint64_t _requests;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,58 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _Trace_incl_
+#define _Trace_incl_
+
+#include "config.h"
+
+/*
+    Static tracepoints on the I/O path, for bpftrace, perf or SystemTap.
+
+    They are compiled in with -DENABLE_USDT=ON, which needs <sys/sdt.h>
+    (systemtap-sdt-dev), and are no more than a nop per probe while nothing
+    is attached.  Otherwise they expand to nothing.  All probes live in the
+    "encfs" provider; the list is in PERFORMANCE.md.  Probe arguments are
+    offsets, lengths and results only, never plaintext names or data.
+*/
+#ifdef ENCFS_USDT
+
+#include <sys/sdt.h>
+
+#define ENCFS_TRACE(name) DTRACE_PROBE(encfs, name)
+#define ENCFS_TRACE1(name, a) DTRACE_PROBE1(encfs, name, a)
+#define ENCFS_TRACE2(name, a, b) DTRACE_PROBE2(encfs, name, a, b)
+#define ENCFS_TRACE3(name, a, b, c) DTRACE_PROBE3(encfs, name, a, b, c)
+
+#else
+
+#define ENCFS_TRACE(name) \
+  do {                    \
+  } while (false)
+#define ENCFS_TRACE1(name, a) \
+  do {                        \
+  } while (false)
+#define ENCFS_TRACE2(name, a, b) \
+  do {                           \
+  } while (false)
+#define ENCFS_TRACE3(name, a, b, c) \
+  do {                              \
+  } while (false)
+
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TreeWalk.h"
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// listings whose subdirectories are remembered, and directories listed
+// ahead which aren't listed ahead again
+static const size_t RecentListings = 64;
+static const size_t RecentDone = 1024;
+
+static std::string parentOf(const std::string &dir) {
+  std::string::size_type slash = dir.rfind('/');
+  if (slash == std::string::npos || dir.length() <= 1) {
+    return std::string();
+  }
+  return slash == 0 ? std::string("/") : dir.substr(0, slash);
+}
+
+static std::string childOf(const std::string &dir, const std::string &name) {
+  return dir == "/" ? dir + name : dir + '/' + name;
+}
+
+TreeWalk::TreeWalk(size_t ahead) : _ahead(ahead), _stopped(false) {
+  pthread_mutex_init(&_mutex, nullptr);
+  pthread_cond_init(&_idle, nullptr);
+}
+
+TreeWalk::~TreeWalk() {
+  stop();
+  pthread_cond_destroy(&_idle);
+  pthread_mutex_destroy(&_mutex);
+}
+
+std::vector<std::string> TreeWalk::listed(
+    const std::string &dir, const std::vector<std::string> &subdirs) {
+  std::vector<std::string> ahead;
+  Lock lock(_mutex);
+  if (_stopped) {
+    return ahead;
+  }
+
+  // the parent's listing, as it was before this one
+  std::vector<std::string> siblings;
+  std::string parent = parentOf(dir);
+  auto it = _listed.find(parent);
+  if (it != _listed.end()) {
+    siblings = it->second;
+  }
+
+  if (_listed.find(dir) == _listed.end()) {
+    _listedOrder.push_back(dir);
+    if (_listedOrder.size() > RecentListings) {
+      _listed.erase(_listedOrder.front());
+      _listedOrder.pop_front();
+    }
+  }
+  _listed[dir] = subdirs;
+
+  std::string name = dir.substr(dir.rfind('/') + 1);
+  size_t next = 0;
+  while (next < siblings.size() && siblings[next] != name) {
+    ++next;
+  }
+  if (next == siblings.size()) {
+    return ahead;  // not a walk
+  }
+
+  auto take = [&](const std::string &path) {
+    if (_inFlight.size() >= _ahead || _inFlight.count(path) > 0 ||
+        _done.count(path) > 0 || _listed.count(path) > 0) {
+      return;
+    }
+    _inFlight.insert(path);
+    ahead.push_back(path);
+  };
+  for (const std::string &sub : subdirs) {
+    take(childOf(dir, sub));
+  }
+  for (++next; next < siblings.size(); ++next) {
+    take(childOf(parent, siblings[next]));
+  }
+  return ahead;
+}
+
+void TreeWalk::done(const std::string &dir) {
+  Lock lock(_mutex);
+  _inFlight.erase(dir);
+  if (_done.insert(dir).second) {
+    _doneOrder.push_back(dir);
+    if (_doneOrder.size() > RecentDone) {
+      _done.erase(_doneOrder.front());
+      _doneOrder.pop_front();
+    }
+  }
+  if (_inFlight.empty()) {
+    pthread_cond_broadcast(&_idle);
+  }
+}
+
+void TreeWalk::stop() {
+  Lock lock(_mutex);
+  _stopped = true;
+  while (!_inFlight.empty()) {
+    pthread_cond_wait(&_idle, &_mutex);
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,83 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TreeWalk_incl_
+#define _TreeWalk_incl_
+
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Spots a program walking a directory tree (--walkahead), as find, du,
+    rsync and backup tools do, so that the directories it will list next
+    can be listed ahead of it by the workers, and its readdir and getattr
+    calls find their names and attributes decoded in the caches.
+
+    A walk is a directory listed while its parent's listing, in which it
+    is a subdirectory, is one of the last few taken.  The walker then goes
+    on with the subdirectories of the directory, and after them with those
+    of the parent which come after it, so that is what is listed ahead, up
+    to ahead directories at a time.  Directories which were listed, or
+    listed ahead, a short while ago are left out.
+*/
+class TreeWalk {
+ public:
+  explicit TreeWalk(size_t ahead);
+  ~TreeWalk();
+
+  TreeWalk(const TreeWalk &src) = delete;
+  TreeWalk &operator=(const TreeWalk &src) = delete;
+
+  /*
+      The plaintext directory dir was listed, and has subdirectories
+      subdirs (names).  Returns the directories to list ahead now, which
+      are in flight until done() is called for each.
+  */
+  std::vector<std::string> listed(const std::string &dir,
+                                  const std::vector<std::string> &subdirs);
+  void done(const std::string &dir);
+
+  // Waits for the directories in flight; none are handed out from now on
+  void stop();
+
+  size_t ahead() const { return _ahead; }
+
+ private:
+  const size_t _ahead;
+
+  pthread_mutex_t _mutex;
+  pthread_cond_t _idle;
+  bool _stopped;
+
+  // the subdirectories of the last directories listed, oldest first
+  std::deque<std::string> _listedOrder;
+  std::unordered_map<std::string, std::vector<std::string>> _listed;
+  // listed ahead a short while ago, oldest first
+  std::deque<std::string> _doneOrder;
+  std::unordered_set<std::string> _done;
+  std::unordered_set<std::string> _inFlight;
+};
+
+}  // namespace encfs
+
+#endif
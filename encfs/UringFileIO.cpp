@@ -0,0 +1,427 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "UringFileIO.h"
+
+#include "easylogging++.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <pthread.h>
+#include <utility>
+#include <vector>
+
+#include "Error.h"
+#include "Mutex.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "UringRing.h"
+#include "config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
+
+namespace encfs {
+
+static Interface UringFileIO_iface("FileIO/Uring", 1, 0, 0);
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+namespace {
+
+// submission queue entries per ring, and the most data one of them carries
+const unsigned RingEntries = UringRing::DefaultEntries;
+const size_t ChunkSize = 128 * 1024;
+// entries of the ring shared by asynchronous reads
+const unsigned AsyncEntries = 128;
+
+struct Chunk {
+  struct iovec iov;
+  off_t offset;
+  int res;
+};
+
+// Queues the read or write of a chunk, tagged with data.
+void queueChunk(UringRing *ring, int fd, bool write, Chunk *chunk,
+                uint64_t data) {
+  struct io_uring_sqe *sqe = ring->queue(data);
+  sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->off = chunk->offset;
+  sqe->addr = (uintptr_t)&chunk->iov;
+  sqe->len = 1;
+}
+
+/*
+    Reads or writes len bytes at offset, in chunks which are all submitted
+    at once.  Reads stop at the end of the file, writes resubmit whatever
+    was written short.  Returns false if the ring failed, and the request
+    has to be served another way.
+*/
+bool transfer(UringRing *ring, int fd, bool write, unsigned char *data,
+              size_t len, off_t offset, ssize_t *result) {
+  Chunk chunks[RingEntries];
+  size_t done = 0;
+  while (done < len) {
+    unsigned count = 0;
+    for (size_t pos = done; pos < len && count < RingEntries;
+         pos += ChunkSize, ++count) {
+      Chunk &chunk = chunks[count];
+      chunk.iov.iov_base = data + pos;
+      chunk.iov.iov_len = std::min(ChunkSize, len - pos);
+      chunk.offset = offset + pos;
+      chunk.res = -EIO;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+      queueChunk(ring, fd, write, &chunks[i], i);
+    }
+    auto store = [&chunks](uint64_t i, int res) { chunks[i].res = res; };
+    if (ring->run(count, store) < 0) {
+      return false;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+      const Chunk &chunk = chunks[i];
+      if (chunk.res < 0) {
+        *result = chunk.res;
+        return true;
+      }
+      done += chunk.res;
+      if ((size_t)chunk.res < chunk.iov.iov_len) {
+        if (!write) {
+          *result = done;  // end of file
+          return true;
+        }
+        if (chunk.res == 0) {
+          *result = -EIO;
+          return true;
+        }
+        // the chunks after this one are written again
+        break;
+      }
+    }
+  }
+  *result = done;
+  return true;
+}
+
+/*
+    A ring shared by all threads for asynchronous reads.  Readers queue
+    their chunks under a lock and return, and a thread of its own waits for
+    the completions and calls back once all chunks of a read are done.  At
+    most AsyncEntries chunks are in flight, so the completion queue (twice
+    as large) can't overflow.  The thread is started on first use, which is
+    after fuse daemonized.
+*/
+class AsyncRing {
+ public:
+  // the shared ring, null if it can't be used
+  static AsyncRing *get();
+
+  // Start reading len bytes at offset, returns false if there's no room
+  // (or the ring failed), and the read has to be done another way.
+  bool read(int fd, unsigned char *data, size_t len, off_t offset,
+            IODone &done);
+
+ private:
+  struct Read;
+  struct Part {
+    Chunk chunk;
+    Read *read;
+  };
+  struct Read {
+    std::vector<Part> parts;
+    std::atomic<unsigned> pending;
+    IODone done;
+  };
+
+  AsyncRing();
+  static void *run(void *arg);
+  void loop();
+  static ssize_t result(const Read &read);
+
+  UringRing _ring;
+  pthread_mutex_t _mutex;  // for submitting
+  unsigned _inFlight;
+  bool _failed;
+};
+
+AsyncRing::AsyncRing()
+    : _ring(AsyncEntries), _inFlight(0), _failed(!_ring.ok()) {
+  pthread_mutex_init(&_mutex, nullptr);
+  if (_failed) {
+    return;
+  }
+  pthread_t thread;
+  if (pthread_create(&thread, nullptr, run, this) != 0) {
+    _failed = true;
+    return;
+  }
+  pthread_detach(thread);
+}
+
+AsyncRing *AsyncRing::get() {
+  // never destroyed, as its thread may still be waiting at exit
+  static AsyncRing *ring = new AsyncRing();
+  return ring->_failed ? nullptr : ring;
+}
+
+bool AsyncRing::read(int fd, unsigned char *data, size_t len, off_t offset,
+                     IODone &done) {
+  unsigned count = (unsigned)((len + ChunkSize - 1) / ChunkSize);
+  if (count == 0 || count > AsyncEntries) {
+    return false;
+  }
+  std::unique_ptr<Read> read(new Read());
+  read->parts.resize(count);
+  for (unsigned i = 0; i < count; ++i) {
+    Chunk &chunk = read->parts[i].chunk;
+    size_t pos = (size_t)i * ChunkSize;
+    chunk.iov.iov_base = data + pos;
+    chunk.iov.iov_len = std::min(ChunkSize, len - pos);
+    chunk.offset = offset + pos;
+    chunk.res = -EIO;
+    read->parts[i].read = read.get();
+  }
+  read->pending = count;
+
+  unsigned submitted = 0;
+  {
+    Lock lock(_mutex);
+    if (_failed || _inFlight + count > AsyncEntries) {
+      return false;
+    }
+    read->done = std::move(done);
+    for (Part &part : read->parts) {
+      queueChunk(&_ring, fd, false, &part.chunk, (uintptr_t)&part);
+    }
+    while (submitted < count) {
+      int res = _ring.enter(count - submitted, 0);
+      if (res >= 0) {
+        submitted += res;
+      } else if (res != -EINTR && res != -EAGAIN && res != -EBUSY) {
+        RLOG(WARNING) << "io_uring failed, reading synchronously: "
+                      << strerror(-res);
+        _failed = true;
+        break;
+      }
+    }
+    _inFlight += submitted;
+    if (submitted < count) {
+      _ring.unqueue(count - submitted);
+    }
+    if (submitted == 0) {
+      done = std::move(read->done);
+      return false;
+    }
+  }
+
+  Read *started = read.release();  // loop() completes it
+  if (submitted < count) {
+    // the chunks which didn't make it count as failed, and whoever sees the
+    // last chunk done calls back
+    unsigned missing = count - submitted;
+    if (started->pending.fetch_sub(missing) == missing) {
+      std::unique_ptr<Read> owned(started);
+      owned->done(result(*owned));
+    }
+  }
+  return true;
+}
+
+void *AsyncRing::run(void *arg) {
+  ((AsyncRing *)arg)->loop();
+  return nullptr;
+}
+
+ssize_t AsyncRing::result(const Read &read) {
+  ssize_t done = 0;
+  for (const Part &part : read.parts) {
+    if (part.chunk.res < 0) {
+      return part.chunk.res;
+    }
+    done += part.chunk.res;
+    if ((size_t)part.chunk.res < part.chunk.iov.iov_len) {
+      break;  // end of file
+    }
+  }
+  Stats::add(Stats::BackingBytesRead, done);
+  return done;
+}
+
+void AsyncRing::loop() {
+  std::vector<Read *> finished;
+  auto complete = [&finished](uint64_t data, int res) {
+    Part *part = (Part *)(uintptr_t)data;
+    part->chunk.res = res;
+    if (--part->read->pending == 0) {
+      finished.push_back(part->read);
+    }
+  };
+  for (;;) {
+    int res = _ring.enter(0, 1);
+    if (res < 0 && res != -EINTR && res != -EAGAIN && res != -EBUSY) {
+      RLOG(ERROR) << "io_uring wait failed: " << strerror(-res);
+    }
+    unsigned reaped = _ring.reap(complete);
+    if (reaped > 0) {
+      Lock lock(_mutex);
+      _inFlight -= reaped;
+    }
+    for (Read *read : finished) {
+      std::unique_ptr<Read> owned(read);
+      read->done(result(*read));
+    }
+    finished.clear();
+  }
+}
+
+}  // namespace
+
+#endif
+
+UringFileIO::UringFileIO() = default;
+
+UringFileIO::UringFileIO(std::string fileName, bool directIO,
+                         std::shared_ptr<DirFdCache> dirFds)
+    : RawFileIO(std::move(fileName), directIO, std::move(dirFds)) {}
+
+UringFileIO::~UringFileIO() = default;
+
+Interface UringFileIO::interface() const { return UringFileIO_iface; }
+
+bool UringFileIO::supported() {
+#ifdef HAVE_LINUX_IO_URING_H
+  static const bool ok = UringRing().ok();
+  return ok;
+#else
+  return false;
+#endif
+}
+
+ssize_t UringFileIO::read(const IORequest &req) const {
+#ifdef HAVE_LINUX_IO_URING_H
+  rAssert(fd >= 0);
+
+  ssize_t holeSize = readHole(req);
+  if (holeSize >= 0) {
+    return holeSize;
+  }
+
+  UringRing *ring = direct ? nullptr : UringRing::forThread();
+  if (ring != nullptr) {
+    ssize_t readSize = 0;
+    bool ok;
+    {
+      Stats::Timer timer(Stats::Pread);
+      ENCFS_TRACE3(raw__pread__entry, fd, req.offset, req.dataLen);
+      ok = transfer(ring, fd, false, req.data, req.dataLen, req.offset,
+                    &readSize);
+      ENCFS_TRACE1(raw__pread__return, readSize);
+    }
+    if (ok) {
+      if (readSize < 0) {
+        RLOG(WARNING) << "read failed at offset " << req.offset << " for "
+                      << req.dataLen << " bytes: " << strerror(-readSize);
+      } else {
+        Stats::add(Stats::BackingBytesRead, readSize);
+        if (readSize > 0 && dropBehind) {
+          readHint(req.offset, readSize);
+        }
+      }
+      return readSize;
+    }
+  }
+#endif
+  return RawFileIO::read(req);
+}
+
+void UringFileIO::readAsync(const IORequest &req, IODone done) const {
+#ifdef HAVE_LINUX_IO_URING_H
+  rAssert(fd >= 0);
+
+  ssize_t holeSize = readHole(req);
+  if (holeSize >= 0) {
+    done(holeSize);
+    return;
+  }
+
+  AsyncRing *ring = direct ? nullptr : AsyncRing::get();
+  if (ring != nullptr) {
+    // reads may complete out of order, the stream is followed as issued,
+    // and this may be gone once done was called
+    if (dropBehind) {
+      readHint(req.offset, req.dataLen);
+    }
+    if (ring->read(fd, req.data, req.dataLen, req.offset, done)) {
+      return;
+    }
+  }
+#endif
+  done(read(req));
+}
+
+ssize_t UringFileIO::write(const IORequest &req) {
+#ifdef HAVE_LINUX_IO_URING_H
+  rAssert(fd >= 0);
+  rAssert(canWrite);
+
+  UringRing *ring = direct ? nullptr : UringRing::forThread();
+  if (ring != nullptr) {
+    if (!sparse && req.offset > getSize()) {
+      sparse = true;
+    }
+
+    ssize_t writeSize = 0;
+    bool ok;
+    {
+      Stats::Timer timer(Stats::Pwrite);
+      ENCFS_TRACE3(raw__pwrite__entry, fd, req.offset, req.dataLen);
+      ok = transfer(ring, fd, true, req.data, req.dataLen, req.offset,
+                    &writeSize);
+      ENCFS_TRACE1(raw__pwrite__return, writeSize);
+    }
+    if (ok) {
+      if (writeSize < 0) {
+        knownSize = false;
+        RLOG(WARNING) << "write failed at offset " << req.offset << " for "
+                      << req.dataLen << " bytes: " << strerror(-writeSize);
+        return writeSize;
+      }
+      Stats::add(Stats::BackingBytesWritten, writeSize);
+      if (writeBehind > 0) {
+        writeHint(req.offset, req.dataLen);
+      }
+      if (knownSize) {
+        off_t last = req.offset + req.dataLen;
+        if (last > fileSize) {
+          fileSize = last;
+        }
+      }
+      return req.dataLen;
+    }
+  }
+#endif
+  return RawFileIO::write(req);
+}
+
+}  // namespace encfs
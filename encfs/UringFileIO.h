@@ -0,0 +1,61 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UringFileIO_incl_
+#define _UringFileIO_incl_
+
+#include <string>
+#include <sys/types.h>
+
+#include "FileIO.h"
+#include "Interface.h"
+#include "RawFileIO.h"
+
+namespace encfs {
+
+/*
+    RawFileIO which reads and writes through io_uring (--uring).
+
+    Large requests, like the runs of blocks from BlockFileIO::readBlocks and
+    read ahead, are split into chunks which are all in flight at once, and
+    short writes are resubmitted without a round trip through the caller.
+    Each thread submits to a small ring of its own, so no locks are taken.
+    readAsync() goes through a ring shared by all files instead, whose own
+    thread waits for the completions, so the caller doesn't wait at all.
+    Everything else is inherited from RawFileIO, which also serves a request
+    whenever a ring can't be set up, and all O_DIRECT requests.
+*/
+class UringFileIO : public RawFileIO {
+ public:
+  UringFileIO();
+  UringFileIO(std::string fileName, bool directIO = false,
+              std::shared_ptr<DirFdCache> dirFds = nullptr);
+  virtual ~UringFileIO();
+
+  virtual Interface interface() const;
+
+  virtual ssize_t read(const IORequest &req) const;
+  virtual ssize_t write(const IORequest &req);
+  virtual void readAsync(const IORequest &req, IODone done) const;
+
+  // true if the kernel supports io_uring, checked once
+  static bool supported();
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,189 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "UringRing.h"
+
+#include "easylogging++.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include "Error.h"
+#include "config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace encfs {
+
+const unsigned UringRing::DefaultEntries;
+
+UringRing::UringRing(unsigned entries)
+    : _fd(-1),
+      _sqRing(MAP_FAILED),
+      _sqRingSize(0),
+      _cqRing(MAP_FAILED),
+      _cqRingSize(0),
+      _sqes((struct io_uring_sqe *)MAP_FAILED),
+      _sqesSize(0) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0) {
+    VLOG(1) << "io_uring_setup failed: " << strerror(errno);
+    return;
+  }
+  _fd = fd;
+
+  _sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  _cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) {
+    _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+  }
+  _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (singleMap) {
+    _cqRing = _sqRing;
+  } else {
+    _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  _sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  _sqes = (struct io_uring_sqe *)mmap(nullptr, _sqesSize,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd,
+                                      IORING_OFF_SQES);
+  if (_sqRing == MAP_FAILED || _cqRing == MAP_FAILED ||
+      _sqes == MAP_FAILED) {
+    VLOG(1) << "io_uring mmap failed: " << strerror(errno);
+    destroy();
+    return;
+  }
+
+  char *sq = (char *)_sqRing;
+  _sqTail = (unsigned *)(sq + p.sq_off.tail);
+  _sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+  _sqArray = (unsigned *)(sq + p.sq_off.array);
+  char *cq = (char *)_cqRing;
+  _cqHead = (unsigned *)(cq + p.cq_off.head);
+  _cqTail = (unsigned *)(cq + p.cq_off.tail);
+  _cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+  _cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+void UringRing::destroy() {
+  if (_sqes != MAP_FAILED) {
+    munmap(_sqes, _sqesSize);
+  }
+  if (_cqRing != MAP_FAILED && _cqRing != _sqRing) {
+    munmap(_cqRing, _cqRingSize);
+  }
+  if (_sqRing != MAP_FAILED) {
+    munmap(_sqRing, _sqRingSize);
+  }
+  _sqes = (struct io_uring_sqe *)MAP_FAILED;
+  _sqRing = _cqRing = MAP_FAILED;
+  if (_fd >= 0) {
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+UringRing *UringRing::forThread() {
+  static thread_local std::unique_ptr<UringRing> ring;
+  if (!ring) {
+    ring.reset(new UringRing());
+  }
+  return ring->ok() ? ring.get() : nullptr;
+}
+
+unsigned UringRing::reap(const std::function<void(uint64_t, int)> &fn) {
+  unsigned head = *_cqHead;
+  unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+  unsigned reaped = 0;
+  for (; head != tail; ++head, ++reaped) {
+    const struct io_uring_cqe &cqe = _cqes[head & *_cqMask];
+    fn(cqe.user_data, cqe.res);
+  }
+  __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+  return reaped;
+}
+
+// The kernel only reads the entry in enter(), which is after the caller
+// filled it in.
+struct io_uring_sqe *UringRing::queue(uint64_t data) {
+  unsigned tail = *_sqTail;
+  unsigned index = tail & *_sqMask;
+  struct io_uring_sqe *sqe = &_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = data;
+  _sqArray[index] = index;
+  __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+void UringRing::unqueue(unsigned count) {
+  __atomic_store_n(_sqTail, *_sqTail - count, __ATOMIC_RELEASE);
+}
+
+int UringRing::enter(unsigned submit, unsigned wait) {
+  int res = (int)syscall(__NR_io_uring_enter, _fd, submit, wait,
+                         wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+  return res < 0 ? -errno : res;
+}
+
+int UringRing::run(unsigned count,
+                   const std::function<void(uint64_t, int)> &fn) {
+  unsigned submitted = 0;
+  unsigned completed = 0;
+  int err = 0;
+  while (completed < count) {
+    int res = enter(count - submitted, 1);
+    if (res >= 0) {
+      submitted += res;
+    } else if (res != -EINTR && res != -EAGAIN && res != -EBUSY) {
+      err = res;
+      break;
+    }
+    completed += reap(fn);
+  }
+
+  if (err != 0) {
+    // what the entries point to may not go away while the kernel still
+    // uses it
+    while (completed < submitted) {
+      int res = enter(0, 1);
+      if (res < 0 && res != -EINTR) {
+        break;
+      }
+      completed += reap(fn);
+    }
+    RLOG(WARNING) << "io_uring failed, falling back to system calls: "
+                  << strerror(-err);
+    destroy();
+  }
+  return err;
+}
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,92 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UringRing_incl_
+#define _UringRing_incl_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace encfs {
+
+/*
+    A minimal io_uring, set up with the raw system calls so that liburing
+    isn't needed.  Only built where <linux/io_uring.h> is found (see
+    HAVE_LINUX_IO_URING_H); UringFileIO and MetaBatch use it.
+
+    Entries are queued, filled in by the caller, and handed to the kernel
+    by enter().  run() does both for a ring used by one thread only.
+*/
+class UringRing {
+ public:
+  // submission queue entries of a ring of forThread()
+  static const unsigned DefaultEntries = 32;
+
+  explicit UringRing(unsigned entries = DefaultEntries);
+  ~UringRing() { destroy(); }
+
+  UringRing(const UringRing &src) = delete;
+  UringRing &operator=(const UringRing &src) = delete;
+
+  bool ok() const { return _fd >= 0; }
+
+  // the ring of the calling thread, null if there is none
+  static UringRing *forThread();
+
+  // Queue an entry tagged with data for the next enter(), and return it
+  // zeroed for the caller to fill in.  The caller makes sure there is room.
+  struct io_uring_sqe *queue(uint64_t data);
+  // Withdraw the last count entries queued, which enter() didn't take.
+  void unqueue(unsigned count);
+  // Hand up to submit queued entries to the kernel, and wait until at least
+  // wait have completed.  Returns the number submitted, or -errno.
+  int enter(unsigned submit, unsigned wait);
+  // Calls fn(data, res) for every completion, returns their number.
+  unsigned reap(const std::function<void(uint64_t, int)> &fn);
+
+  // Submits the count entries queued, and waits for all of them, calling
+  // fn as for reap().  Returns 0, or -errno if the ring failed, which is
+  // unusable afterwards.
+  int run(unsigned count, const std::function<void(uint64_t, int)> &fn);
+
+ private:
+  void destroy();
+
+  int _fd;
+  void *_sqRing;
+  size_t _sqRingSize;
+  void *_cqRing;
+  size_t _cqRingSize;
+  struct io_uring_sqe *_sqes;
+  size_t _sqesSize;
+
+  unsigned *_sqTail;
+  unsigned *_sqMask;
+  unsigned *_sqArray;
+  unsigned *_cqHead;
+  unsigned *_cqTail;
+  unsigned *_cqMask;
+  struct io_uring_cqe *_cqes;
+};
+
+}  // namespace encfs
+
+#endif
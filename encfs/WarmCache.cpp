@@ -0,0 +1,260 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WarmCache.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Cipher.h"
+#include "CpuBudget.h"
+#include "Error.h"
+
+namespace encfs {
+
+const char WarmCache::FileName[] = ".encfs6.warm";
+
+/*
+    The file is a magic string and a random nonce, followed by the length
+    (4 bytes) and the stream encoding, with the nonce as IV, of a MAC of the
+    body (8 bytes) and the body: the number of paths (4 bytes), then each
+    path as its length (2 bytes) and bytes.  All numbers are big endian.
+*/
+static const char WarmMagic[] = "EncFSWC1";
+static const size_t MagicSize = sizeof(WarmMagic) - 1;
+static const size_t MacSize = 8;
+
+// more would only be evicted again while warming
+static const size_t MaxPaths = 1 << 20;
+
+static void putNumber(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static bool getNumber(const std::string &in, size_t &pos, uint64_t *value,
+                      int bytes) {
+  if (in.size() - pos < (size_t)bytes) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i) {
+    v = (v << 8) | (unsigned char)in[pos++];
+  }
+  *value = v;
+  return true;
+}
+
+static void wipe(std::string &str) { str.assign(str.length(), '\0'); }
+
+WarmCache::WarmCache(const std::string &rootDir,
+                     const std::shared_ptr<Cipher> &cipher,
+                     const CipherKey &key)
+    : _path(rootDir + FileName),
+      _cipher(cipher),
+      _key(key),
+      _running(false),
+      _stop(false),
+      _warmed(0) {}
+
+WarmCache::~WarmCache() { stop(); }
+
+std::string WarmCache::seal(const std::string &body, uint64_t iv) const {
+  std::string record;
+  putNumber(record,
+            _cipher->MAC_64((const unsigned char *)body.data(),
+                            (int)body.size(), _key),
+            MacSize);
+  record.append(body);
+  if (!_cipher->streamEncode((unsigned char *)&record[0], (int)record.size(),
+                             iv, _key)) {
+    wipe(record);
+    return std::string();
+  }
+  return record;
+}
+
+// record is the encoded MAC and body, replaced by the body
+bool WarmCache::unseal(std::string *record, uint64_t iv) const {
+  if (record->size() < MacSize ||
+      !_cipher->streamDecode((unsigned char *)&(*record)[0],
+                             (int)record->size(), iv, _key)) {
+    return false;
+  }
+  size_t pos = 0;
+  uint64_t mac = 0;
+  getNumber(*record, pos, &mac, MacSize);
+  record->erase(0, MacSize);
+  return mac == _cipher->MAC_64((const unsigned char *)record->data(),
+                                (int)record->size(), _key);
+}
+
+std::vector<std::string> WarmCache::load() const {
+  std::vector<std::string> paths;
+  int fd = ::open(_path.c_str(), O_RDONLY | O_NOFOLLOW);
+  if (fd < 0) {
+    return paths;
+  }
+  std::string data;
+  char buf[65536];
+  ssize_t res;
+  while ((res = ::pread(fd, buf, sizeof(buf), data.size())) > 0) {
+    data.append(buf, res);
+  }
+  ::close(fd);
+
+  size_t pos = MagicSize;
+  uint64_t nonce = 0;
+  uint64_t len = 0;
+  if (data.size() < MagicSize ||
+      data.compare(0, MagicSize, WarmMagic) != 0 ||
+      !getNumber(data, pos, &nonce, 8) || !getNumber(data, pos, &len, 4) ||
+      data.size() - pos != len) {
+    RLOG(WARNING) << "ignoring damaged " << _path;
+    return paths;
+  }
+  std::string body = data.substr(pos);
+  uint64_t count = 0;
+  pos = 0;
+  bool ok = unseal(&body, nonce) && getNumber(body, pos, &count, 4) &&
+            count <= MaxPaths;
+  for (uint64_t i = 0; ok && i < count; ++i) {
+    uint64_t pathLen = 0;
+    ok = getNumber(body, pos, &pathLen, 2) && body.size() - pos >= pathLen;
+    if (ok) {
+      paths.push_back(body.substr(pos, pathLen));
+      pos += pathLen;
+    }
+  }
+  wipe(body);
+  if (!ok) {
+    RLOG(WARNING) << "ignoring damaged " << _path;
+    paths.clear();
+  }
+  return paths;
+}
+
+// a new file, renamed over the old one
+bool WarmCache::save(const std::vector<std::string> &cipherPaths) const {
+  unsigned char random[8];
+  if (!_cipher->randomize(random, sizeof(random), false)) {
+    return false;
+  }
+  uint64_t nonce = 0;
+  for (unsigned char byte : random) {
+    nonce = (nonce << 8) | byte;
+  }
+
+  std::string body;
+  size_t count = 0;
+  putNumber(body, 0, 4);
+  for (const std::string &path : cipherPaths) {
+    if (count == MaxPaths) {
+      break;
+    }
+    if (path.empty() || path.size() > 0xffff) {
+      continue;
+    }
+    putNumber(body, path.size(), 2);
+    body.append(path);
+    ++count;
+  }
+  std::string counted;
+  putNumber(counted, count, 4);
+  body.replace(0, 4, counted);
+
+  std::string record = seal(body, nonce);
+  wipe(body);
+  if (record.empty()) {
+    return false;
+  }
+  std::string data(WarmMagic, MagicSize);
+  putNumber(data, nonce, 8);
+  putNumber(data, record.size(), 4);
+  data.append(record);
+
+  std::string tmpPath = _path + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+                  S_IRUSR | S_IWUSR);
+  bool ok = fd >= 0;
+  for (size_t done = 0; ok && done < data.size();) {
+    ssize_t res = ::write(fd, data.data() + done, data.size() - done);
+    if (res < 0 && errno != EINTR) {
+      ok = false;
+    } else if (res > 0) {
+      done += res;
+    }
+  }
+  if (fd >= 0) {
+    ok = (::close(fd) == 0) && ok;
+  }
+  ok = ok && ::rename(tmpPath.c_str(), _path.c_str()) == 0;
+  if (!ok) {
+    RLOG(WARNING) << "unable to write " << _path << ": " << strerror(errno);
+    ::unlink(tmpPath.c_str());
+    return false;
+  }
+  VLOG(1) << "saved " << count << " warm paths";
+  return true;
+}
+
+bool WarmCache::start(Warmer warm) {
+  if (_running) {
+    return true;
+  }
+  _warm = std::move(warm);
+  _stop = false;
+  int res = pthread_create(&_thread, nullptr, WarmCache::run, this);
+  if (res != 0) {
+    RLOG(ERROR) << "error starting cache warming thread, res = " << res;
+    return false;
+  }
+  _running = true;
+  return true;
+}
+
+void WarmCache::stop() {
+  if (!_running) {
+    return;
+  }
+  _stop = true;
+  pthread_join(_thread, nullptr);
+  _running = false;
+}
+
+void *WarmCache::run(void *arg) {
+  auto *cache = static_cast<WarmCache *>(arg);
+  std::vector<std::string> paths = cache->load();
+  for (const std::string &path : paths) {
+    if (!CpuBudget::waitTurn(cache->_stop)) {
+      break;
+    }
+    CpuBudget::Work work;
+    cache->_warm(path);
+    ++cache->_warmed;
+  }
+  VLOG(1) << "warmed " << cache->_warmed << " of " << paths.size()
+          << " paths";
+  return nullptr;
+}
+
+}  // namespace encfs
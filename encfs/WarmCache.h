@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WarmCache_incl_
+#define _WarmCache_incl_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "CipherKey.h"
+
+namespace encfs {
+
+class Cipher;
+
+/*
+    The paths which were in use when the volume was last unmounted
+    (--warmcache), so that the next mount can fill its caches in the
+    background instead of starting cold.
+
+    Only ciphertext paths, relative to the root, are kept -- no plaintext
+    names and no data -- in the file FileName in the root of the backing
+    directory, encrypted and MACed with the volume key as DirIndex does, so
+    that it doesn't tell which files were in use either.  DirNode saves the
+    most recently used paths of its path cache when it goes away, and
+    start() hands them back, most recent first, to a thread of their own
+    which decodes them again and reads the listings and headers they lead
+    to.  A damaged or foreign file is ignored.
+*/
+class WarmCache {
+ public:
+  using Warmer = std::function<void(const std::string &cipherPath)>;
+
+  static const char FileName[];
+
+  // rootDir ends with a '/'
+  WarmCache(const std::string &rootDir, const std::shared_ptr<Cipher> &cipher,
+            const CipherKey &key);
+  ~WarmCache();
+
+  WarmCache(const WarmCache &src) = delete;
+  WarmCache &operator=(const WarmCache &src) = delete;
+
+  // the paths of the last save(), empty if there are none
+  std::vector<std::string> load() const;
+  // replace the saved paths, returns false if they couldn't be written
+  bool save(const std::vector<std::string> &cipherPaths) const;
+
+  // Call warm with each path of load() on a thread of its own, unless
+  // already started.  Returns false if the thread couldn't be started.
+  bool start(Warmer warm);
+  // wait for the thread, which skips the paths it hasn't reached yet
+  void stop();
+
+  // paths handed to the warmer so far
+  size_t warmed() const { return _warmed; }
+
+ private:
+  std::string seal(const std::string &body, uint64_t iv) const;
+  bool unseal(std::string *record, uint64_t iv) const;
+
+  static void *run(void *arg);
+
+  const std::string _path;
+  std::shared_ptr<Cipher> _cipher;
+  CipherKey _key;
+
+  Warmer _warm;
+  pthread_t _thread;
+  bool _running;
+  std::atomic<bool> _stop;
+  std::atomic<size_t> _warmed;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,408 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sched.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+#include "CpuBudget.h"
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+WorkerPool::WorkerPool(int threads, size_t maxQueued)
+    : _wanted(threads), _pid(0), _maxQueued(maxQueued) {
+  init(systemTopology());
+}
+
+WorkerPool::WorkerPool(int threads, size_t maxQueued, const Topology &nodes)
+    : _wanted(threads), _pid(0), _maxQueued(maxQueued) {
+  init(nodes);
+}
+
+void WorkerPool::init(const Topology &nodes) {
+  size_t cpuCount = 0;
+  for (const auto &cpus : nodes) {
+    cpuCount += cpus.size();
+  }
+  // one node, or too few threads to go round: a single unpinned lane
+  if (nodes.size() < 2 || _wanted < (int)nodes.size() || cpuCount == 0) {
+    _lanes.emplace_back(new Lane);
+  } else {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      std::unique_ptr<Lane> lane(new Lane);
+      lane->cpus = nodes[i];
+      for (int cpu : nodes[i]) {
+        if (cpu >= (int)_cpuLane.size()) {
+          _cpuLane.resize(cpu + 1, 0);
+        }
+        _cpuLane[cpu] = (int)i;
+      }
+      _lanes.push_back(std::move(lane));
+    }
+  }
+  std::vector<int> shares = split(_wanted);
+  for (size_t i = 0; i < _lanes.size(); ++i) {
+    _lanes[i]->wanted = shares[i];
+  }
+  for (auto &lane : _lanes) {
+    lane->retiring = 0;
+    lane->pid = 0;
+    lane->stop = false;
+    pthread_mutex_init(&lane->mutex, nullptr);
+    pthread_cond_init(&lane->wake, nullptr);
+  }
+}
+
+// threads of each lane, in proportion to its CPUs, leaving at least one for
+// each other lane
+std::vector<int> WorkerPool::split(int threads) const {
+  if (_lanes.size() == 1) {
+    return std::vector<int>(1, threads);
+  }
+  size_t cpuCount = 0;
+  for (const auto &lane : _lanes) {
+    cpuCount += lane->cpus.size();
+  }
+  std::vector<int> shares;
+  int left = threads;
+  for (size_t i = 0; i < _lanes.size(); ++i) {
+    int share = (int)(threads * _lanes[i]->cpus.size() / cpuCount);
+    int reserved = (int)(_lanes.size() - i - 1);
+    int wanted = i + 1 == _lanes.size()
+                     ? left
+                     : std::min(std::max(1, share), left - reserved);
+    left -= wanted;
+    shares.push_back(wanted);
+  }
+  return shares;
+}
+
+void WorkerPool::setThreads(int threads) {
+  threads = std::max(threads, (int)_lanes.size());
+  _wanted = threads;
+  std::vector<int> shares = split(threads);
+  for (size_t i = 0; i < _lanes.size(); ++i) {
+    Lane &lane = *_lanes[i];
+    Lock lock(lane.mutex);
+    lane.wanted = shares[i];
+    if (lane.pid != getpid()) {
+      continue;  // starts with the new number on first use
+    }
+    int running = (int)lane.threads.size() - lane.retiring;
+    if (running < lane.wanted) {
+      // call back threads which haven't left yet first
+      int back = std::min(lane.retiring, lane.wanted - running);
+      lane.retiring -= back;
+      spawn(lane, lane.wanted - running - back);
+    } else if (running > lane.wanted) {
+      lane.retiring += running - lane.wanted;
+      pthread_cond_broadcast(&lane.wake);
+    }
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  for (auto &lane : _lanes) {
+    Lock lock(lane->mutex);
+    if (lane->pid != getpid() && !lane->queue.empty()) {
+      start(*lane);  // tasks queued before a fork run here
+    }
+    lane->stop = true;
+    pthread_cond_broadcast(&lane->wake);
+  }
+  for (auto &lane : _lanes) {
+    if (lane->pid == getpid()) {
+      for (pthread_t thread : lane->threads) {
+        pthread_join(thread, nullptr);
+      }
+    }
+    pthread_cond_destroy(&lane->wake);
+    pthread_mutex_destroy(&lane->mutex);
+  }
+}
+
+bool WorkerPool::parseCpuList(const char *list, std::vector<int> *cpus) {
+  cpus->clear();
+  const char *p = list;
+  while (*p != '\0' && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p || first < 0) {
+      return false;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first) {
+        return false;
+      }
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back((int)cpu);
+    }
+    if (*p == ',') {
+      ++p;
+    } else if (*p != '\0' && *p != '\n') {
+      return false;
+    }
+  }
+  return true;
+}
+
+WorkerPool::Topology WorkerPool::systemTopology() {
+  Topology nodes;
+  for (int node = 0;; ++node) {
+    std::string path = "/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist";
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == nullptr) {
+      break;
+    }
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+    fclose(f);
+    std::vector<int> cpus;
+    if (!ok || !parseCpuList(buf, &cpus)) {
+      return Topology();
+    }
+    // memory-only nodes have no CPUs to run on
+    if (!cpus.empty()) {
+      nodes.push_back(cpus);
+    }
+  }
+  if (nodes.size() < 2) {
+    nodes.clear();
+  }
+  return nodes;
+}
+
+WorkerPool::Lane &WorkerPool::localLane() {
+#ifdef __linux__
+  if (_lanes.size() > 1) {
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < (int)_cpuLane.size()) {
+      return *_lanes[_cpuLane[cpu]];
+    }
+  }
+#endif
+  return *_lanes[0];
+}
+
+// called with lane.mutex held
+void WorkerPool::start(Lane &lane) {
+  // threads of a parent process don't exist in a forked child
+  lane.threads.clear();
+  lane.retiring = 0;
+  lane.pid = getpid();
+  spawn(lane, lane.wanted);
+}
+
+// start count more threads, called with lane.mutex held
+void WorkerPool::spawn(Lane &lane, int count) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+#ifdef __linux__
+  if (!lane.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : lane.cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+  }
+#endif
+  for (int i = 0; i < count; ++i) {
+    pthread_t thread;
+    int res = pthread_create(&thread, &attr, WorkerPool::run, &lane);
+    if (res != 0 && !lane.cpus.empty()) {
+      // CPUs may have gone offline, run anywhere instead
+      res = pthread_create(&thread, nullptr, WorkerPool::run, &lane);
+    }
+    if (res != 0) {
+      RLOG(WARNING) << "unable to start worker thread: " << res;
+      break;
+    }
+    lane.threads.push_back(thread);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+/*
+    First use in a process forked since the threads started: tasks queued
+    before the fork are waited for (as by BlockFileIO::stopReadAhead), so
+    the lanes holding any get their threads back now, not only the lane of
+    the caller.
+*/
+void WorkerPool::restartQueued(pid_t pid) {
+  for (auto &lane : _lanes) {
+    Lock lock(lane->mutex);
+    if (lane->pid != pid && !lane->queue.empty()) {
+      start(*lane);
+    }
+  }
+  _pid = pid;
+}
+
+bool WorkerPool::trySubmit(std::function<void()> task) {
+  if (CpuBudget::enabled()) {
+    if (!CpuBudget::admit()) {
+      return false;
+    }
+    std::function<void()> run = std::move(task);
+    task = [run]() {
+      CpuBudget::Work work;
+      run();
+    };
+  }
+  pid_t pid = getpid();
+  if (_pid != pid) {
+    restartQueued(pid);
+  }
+  Lane &lane = localLane();
+  Lock lock(lane.mutex);
+  if (lane.pid != pid) {
+    start(lane);
+  }
+  if (lane.threads.empty() || lane.queue.size() >= _maxQueued) {
+    return false;
+  }
+  lane.queue.push_back(std::move(task));
+  pthread_cond_signal(&lane.wake);
+  return true;
+}
+
+namespace {
+
+// shared by the caller of parallelFor and its helpers, which may only get to
+// run after the call has returned
+struct ParallelJob {
+  ParallelJob(size_t count_, const std::function<void(size_t)> *fn_)
+      : count(count_), fn(fn_), next(0), done(0) {
+    pthread_mutex_init(&mutex, nullptr);
+    pthread_cond_init(&finished, nullptr);
+  }
+  ~ParallelJob() {
+    pthread_cond_destroy(&finished);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  // returns false once all indices are taken.  fn is only called while the
+  // caller is still waiting.
+  bool runOne() {
+    size_t i = next++;
+    if (i >= count) {
+      return false;
+    }
+    (*fn)(i);
+    if (++done == count) {
+      Lock lock(mutex);
+      pthread_cond_broadcast(&finished);
+    }
+    return true;
+  }
+
+  const size_t count;
+  const std::function<void(size_t)> *fn;
+  std::atomic<size_t> next;
+  std::atomic<size_t> done;
+  pthread_mutex_t mutex;
+  pthread_cond_t finished;
+};
+
+}  // namespace
+
+void WorkerPool::parallelFor(size_t count,
+                             const std::function<void(size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+  auto job = std::make_shared<ParallelJob>(count, &fn);
+
+  // helpers come from the caller's node, which may have fewer threads
+  size_t helpers = count - 1;
+  size_t local = (size_t)localLane().wanted;
+  if (helpers > local) {
+    helpers = local;
+  }
+  for (size_t i = 0; i < helpers; ++i) {
+    if (!trySubmit([job]() {
+          while (job->runOne()) {
+          }
+        })) {
+      break;
+    }
+  }
+
+  while (job->runOne()) {
+  }
+
+  Lock lock(job->mutex);
+  while (job->done < count) {
+    pthread_cond_wait(&job->finished, &job->mutex);
+  }
+}
+
+void *WorkerPool::run(void *arg) {
+  loop(*static_cast<Lane *>(arg));
+  return nullptr;
+}
+
+void WorkerPool::loop(Lane &lane) {
+  pthread_mutex_lock(&lane.mutex);
+  for (;;) {
+    while (lane.queue.empty() && !lane.stop && lane.retiring == 0) {
+      pthread_cond_wait(&lane.wake, &lane.mutex);
+    }
+    if (lane.retiring > 0 && !lane.stop) {
+      // surplus after setThreads, nobody will join us
+      lane.retiring -= 1;
+      pthread_t self = pthread_self();
+      lane.threads.erase(std::find_if(
+          lane.threads.begin(), lane.threads.end(),
+          [self](pthread_t thread) { return pthread_equal(thread, self); }));
+      pthread_detach(pthread_self());
+      break;
+    }
+    if (lane.queue.empty()) {
+      break;  // stopped, and nothing left to do
+    }
+
+    std::function<void()> task = std::move(lane.queue.front());
+    lane.queue.pop_front();
+
+    pthread_mutex_unlock(&lane.mutex);
+    task();
+    pthread_mutex_lock(&lane.mutex);
+  }
+  pthread_mutex_unlock(&lane.mutex);
+}
+
+}  // namespace encfs
@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WorkerPool_incl_
+#define _WorkerPool_incl_
+
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Fixed set of background threads working off a bounded queue of tasks.
+
+    Used for work that must not hold up the FUSE thread which triggered it,
+    such as reading ahead of a sequential reader, and to spread work which
+    the FUSE thread waits for over several cores (parallelFor).  Tasks still
+    queued when the pool is destroyed are run before the threads exit, so
+    whoever submitted them may rely on them running exactly once.
+
+    On NUMA machines the threads are split over the nodes, in proportion to
+    their CPUs, and pinned to their node.  Each node has its own queue, and
+    work goes to the queue of the node the submitting thread runs on, so
+    that encoding and decoding happen next to the buffers the FUSE thread
+    allocated (memory is placed on first touch) instead of across the
+    interconnect.  With a single node there is one queue and no pinning.
+
+    The threads are only started on first use, and again if the process was
+    forked since (encfs sets up the file system before fuse daemonizes).
+    Tasks which were still queued at the fork run in the child.
+    setThreads() changes their number on the fly: new threads start at once,
+    and surplus ones exit as soon as they finish the task they are on.
+*/
+class WorkerPool {
+ public:
+  // the CPUs of each NUMA node, as the system reports them
+  using Topology = std::vector<std::vector<int>>;
+
+  WorkerPool(int threads, size_t maxQueued);
+  // with the given topology, for tests
+  WorkerPool(int threads, size_t maxQueued, const Topology &nodes);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &src) = delete;
+  WorkerPool &operator=(const WorkerPool &src) = delete;
+
+  // Queue a task.  Returns false, without taking the task, if the queue is
+  // full or the task is over the CpuBudget -- submitters are expected to
+  // treat the work as optional then.
+  bool trySubmit(std::function<void()> task);
+
+  // Call fn(0) .. fn(count - 1) and return once all calls are done.  The
+  // calling thread takes part, and the indices go to whichever thread asks
+  // next, so this completes even if all workers are busy (or there are
+  // none) -- it just runs serially then.  Safe to use from a worker.
+  void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+  // Run threads threads from now on, at least one per node
+  void setThreads(int threads);
+
+  int threads() const { return _wanted; }
+  int nodes() const { return (int)_lanes.size(); }
+
+  // NUMA nodes from /sys, empty if there is only one
+  static Topology systemTopology();
+  // parses a list like "0-3,8,10-11", returns false if malformed
+  static bool parseCpuList(const char *list, std::vector<int> *cpus);
+
+ private:
+  // the threads and queue of one node
+  struct Lane {
+    std::vector<int> cpus;  // empty: not pinned
+    std::atomic<int> wanted;
+    pid_t pid;  // process which started threads
+    std::vector<pthread_t> threads;
+    int retiring;  // threads asked to exit
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool stop;
+    std::deque<std::function<void()>> queue;
+  };
+
+  void init(const Topology &nodes);
+  std::vector<int> split(int threads) const;
+  Lane &localLane();
+  void start(Lane &lane);
+  void restartQueued(pid_t pid);
+  void spawn(Lane &lane, int count);
+  static void *run(void *arg);
+  static void loop(Lane &lane);
+
+  std::atomic<int> _wanted;
+  std::atomic<pid_t> _pid;  // process which last submitted
+  const size_t _maxQueued;
+  std::vector<std::unique_ptr<Lane>> _lanes;
+  std::vector<int> _cpuLane;  // lane of each CPU
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,161 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "XattrCache.h"
+
+#include <cstring>
+#include <ctime>
+#include <iterator>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+const char XattrCache::CapabilityName[] = "security.capability";
+
+// names a single path is found without, beyond which the oldest go
+static const size_t MaxNames = 8;
+
+static void wipe(std::string &str) { str.assign(str.length(), '\0'); }
+
+static uint64_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+XattrCache::XattrCache(size_t maxEntries)
+    : _capacity(maxEntries), _generation(0) {
+  pthread_mutex_init(&_mutex, nullptr);
+}
+
+XattrCache::~XattrCache() {
+  clear();
+  pthread_mutex_destroy(&_mutex);
+}
+
+size_t XattrCache::size() const {
+  Lock lock(_mutex);
+  return _index.size();
+}
+
+void XattrCache::drop(PathMap::iterator it) {
+  EntryList::iterator entry = it->second;
+  _index.erase(it);
+  wipe(entry->path);
+  _lru.erase(entry);
+}
+
+bool XattrCache::missing(const std::string &path, const char *name) {
+  Lock lock(_mutex);
+
+  auto it = _index.find(path);
+  if (it == _index.end()) {
+    return false;
+  }
+  std::vector<Name> &names = it->second->names;
+  for (auto n = names.begin(); n != names.end(); ++n) {
+    if (n->name != name) {
+      continue;
+    }
+    if (n->expires != 0 && n->expires <= nowMs()) {
+      names.erase(n);
+      if (names.empty()) {
+        drop(it);
+      }
+      return false;
+    }
+    _lru.splice(_lru.begin(), _lru, it->second);
+    return true;
+  }
+  return false;
+}
+
+uint64_t XattrCache::generation() const {
+  Lock lock(_mutex);
+  return _generation;
+}
+
+void XattrCache::put(const std::string &path, const char *name,
+                     uint64_t generation) {
+  if (_capacity == 0) {
+    return;
+  }
+
+  Lock lock(_mutex);
+  if (generation != _generation) {
+    return;
+  }
+
+  uint64_t expires =
+      strcmp(name, CapabilityName) == 0 ? 0 : nowMs() + Timeout * 1000;
+  auto it = _index.find(path);
+  if (it == _index.end()) {
+    _lru.push_front(Entry());
+    _lru.front().path = path;
+    it = _index.insert(std::make_pair(path, _lru.begin())).first;
+  } else {
+    _lru.splice(_lru.begin(), _lru, it->second);
+  }
+
+  std::vector<Name> &names = it->second->names;
+  for (Name &n : names) {
+    if (n.name == name) {
+      n.expires = expires;
+      return;
+    }
+  }
+  if (names.size() >= MaxNames) {
+    names.erase(names.begin());
+  }
+  names.push_back(Name{name, expires});
+
+  while (_index.size() > _capacity) {
+    drop(_index.find(std::prev(_lru.end())->path));
+  }
+}
+
+void XattrCache::invalidate(const std::string &path) {
+  Lock lock(_mutex);
+  ++_generation;
+
+  std::string prefix = path;
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/') {
+    prefix += '/';
+  }
+
+  auto it = _index.find(path);
+  if (it != _index.end()) {
+    drop(it);
+  }
+  // descendants sort right after the prefix
+  for (it = _index.lower_bound(prefix);
+       it != _index.end() && it->first.compare(0, prefix.length(), prefix) == 0;) {
+    drop(it++);
+  }
+  wipe(prefix);
+}
+
+void XattrCache::clear() {
+  Lock lock(_mutex);
+  ++_generation;
+  while (!_index.empty()) {
+    drop(_index.begin());
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _XattrCache_incl_
+#define _XattrCache_incl_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Bounded LRU cache of the extended attributes which plaintext paths were
+    recently found not to have, used by DirNode so that getxattr of a
+    missing name doesn't encode the path and ask the backing filesystem.
+
+    The kernel asks for security.capability before every write to a file,
+    to know whether the write has to drop it.  A file without capabilities
+    is remembered as such until an extended attribute is set or removed
+    through the mount, or the path is created, renamed or removed; other
+    names expire after a timeout, as the backing files may be changed
+    underneath.  The cache is keyed by path, as getxattr has nothing else,
+    and any change of an attribute clears it, so that hard links of the
+    file see the change too.  Like NegativeCache, put() only stores a miss
+    if nothing was invalidated since generation() was read before the
+    lookup.
+*/
+class XattrCache {
+ public:
+  // Timeout, in seconds, of names other than CapabilityName
+  static const int Timeout = 1;
+  static const char CapabilityName[];
+
+  explicit XattrCache(size_t maxEntries);
+  ~XattrCache();
+
+  XattrCache(const XattrCache &src) = delete;
+  XattrCache &operator=(const XattrCache &src) = delete;
+
+  // true if path is known not to have the attribute name
+  bool missing(const std::string &path, const char *name);
+
+  uint64_t generation() const;
+  void put(const std::string &path, const char *name, uint64_t generation);
+
+  // drop path and everything below it
+  void invalidate(const std::string &path);
+  void clear();
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const;
+
+ private:
+  struct Name {
+    std::string name;
+    uint64_t expires;  // monotonic ms, 0 == until invalidated
+  };
+  struct Entry {
+    std::string path;
+    std::vector<Name> names;
+  };
+  using EntryList = std::list<Entry>;
+  using PathMap = std::map<std::string, EntryList::iterator>;
+
+  void drop(PathMap::iterator it);
+
+  const size_t _capacity;
+
+  mutable pthread_mutex_t _mutex;
+  uint64_t _generation;
+  EntryList _lru;  // most recently used first
+  PathMap _index;
+};
+
+}  // namespace encfs
+
+#endif
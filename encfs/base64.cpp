@@ -20,10 +20,19 @@
 
 #include "base64.h"
 
-#include <cctype>  // for toupper
+#include <cctype>   // for toupper
+#include <cstring>  // for memcpy
 
 #include "Error.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENCFS_BASE64_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define ENCFS_BASE64_NEON
+#include <arm_neon.h>
+#endif
+
 namespace encfs {
 
 // change between two powers of two, stored as the low bits of the bytes in the
@@ -61,55 +70,56 @@ void changeBase2(unsigned char *src, int srcLen, int src2Pow,
     Same as changeBase2, except the output is written over the input data.  The
     output is assumed to be large enough to accept the data.
 
-    Uses the stack to store output values.  Recurse every time a new value is
-    to be written, then write the value at the tail end of the recursion.
+    The values are collected in a scratch buffer (on the stack for file name
+    sized inputs) and copied back, since the output may be longer than the
+    input.  Like the recursive version this replaced, a value is written
+    whenever input runs out, even if it holds fewer than dst2Pow bits.
 */
-static void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow,
-                              int dst2Pow, bool outputPartialLastByte,
-                              unsigned long work, int workBits,
-                              unsigned char *outLoc) {
+void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow, int dst2Pow,
+                       bool outputPartialLastByte) {
   const int mask = (1 << dst2Pow) - 1;
-  if (outLoc == nullptr) {
-    outLoc = src;
+  // enough for every value, partial ones included
+  const int maxOut = (srcLen * src2Pow + dst2Pow - 1) / dst2Pow + 1;
+
+  unsigned char stackBuf[512];
+  std::vector<unsigned char> heapBuf;
+  unsigned char *out = stackBuf;
+  if (maxOut > (int)sizeof(stackBuf)) {
+    heapBuf.resize(maxOut);
+    out = heapBuf.data();
   }
 
-  // copy the new bits onto the high bits of the stream.
-  // The bits that fall off the low end are the output bits.
-  while ((srcLen != 0) && workBits < dst2Pow) {
-    work |= ((unsigned long)(*src++)) << workBits;
-    workBits += src2Pow;
-    --srcLen;
-  }
+  const unsigned char *in = src;
+  unsigned long work = 0;
+  int workBits = 0;
+  int outLen = 0;
+  for (;;) {
+    // copy the new bits onto the high bits of the stream.
+    // The bits that fall off the low end are the output bits.
+    while ((srcLen != 0) && workBits < dst2Pow) {
+      work |= ((unsigned long)(*in++)) << workBits;
+      workBits += src2Pow;
+      --srcLen;
+    }
 
-  // we have at least one value that can be output
-  unsigned char outVal = work & mask;
-  work >>= dst2Pow;
-  workBits -= dst2Pow;
-
-  if (srcLen != 0) {
-    // more input left, so recurse
-    changeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte,
-                      work, workBits, outLoc + 1);
-    *outLoc = outVal;
-  } else {
-    // no input left, we can write remaining values directly
-    *outLoc++ = outVal;
-
-    // we could have a partial value left in the work buffer..
-    if (outputPartialLastByte) {
-      while (workBits > 0) {
-        *outLoc++ = work & mask;
-        work >>= dst2Pow;
-        workBits -= dst2Pow;
+    out[outLen++] = work & mask;
+    work >>= dst2Pow;
+    workBits -= dst2Pow;
+
+    if (srcLen == 0) {
+      // we could have a partial value left in the work buffer..
+      if (outputPartialLastByte) {
+        while (workBits > 0) {
+          out[outLen++] = work & mask;
+          work >>= dst2Pow;
+          workBits -= dst2Pow;
+        }
       }
+      break;
     }
   }
-}
 
-void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow, int dst2Pow,
-                       bool outputPartialLastByte) {
-  changeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte, 0, 0,
-                    nullptr);
+  memcpy(src, out, outLen);
 }
 
 // character set for ascii b64:
@@ -119,7 +129,7 @@ void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow, int dst2Pow,
 // '.' included in the encrypted names, so that it can be reserved for files
 // with special meaning.
 static const char B642AsciiTable[] = ",-0123456789";
-void B64ToAscii(unsigned char *in, int length) {
+void B64ToAsciiScalar(unsigned char *in, int length) {
   for (int offset = 0; offset < length; ++offset) {
     int ch = in[offset];
     if (ch > 11) {
@@ -140,11 +150,8 @@ static const unsigned char Ascii2B64Table[] =
     "                                            01  23456789:;       ";
 //  0123456789 123456789 123456789 123456789 123456789 123456789 1234
 //  0         1         2         3         4         5         6
-void AsciiToB64(unsigned char *in, int length) {
-  return AsciiToB64(in, in, length);
-}
-
-void AsciiToB64(unsigned char *out, const unsigned char *in, int length) {
+void AsciiToB64Scalar(unsigned char *out, const unsigned char *in,
+                      int length) {
   while ((length--) != 0) {
     unsigned char ch = *in++;
     if (ch >= 'A') {
@@ -160,7 +167,7 @@ void AsciiToB64(unsigned char *out, const unsigned char *in, int length) {
   }
 }
 
-void B32ToAscii(unsigned char *buf, int len) {
+void B32ToAsciiScalar(unsigned char *buf, int len) {
   for (int offset = 0; offset < len; ++offset) {
     int ch = buf[offset];
     if (ch >= 0 && ch < 26) {
@@ -173,11 +180,8 @@ void B32ToAscii(unsigned char *buf, int len) {
   }
 }
 
-void AsciiToB32(unsigned char *in, int length) {
-  return AsciiToB32(in, in, length);
-}
-
-void AsciiToB32(unsigned char *out, const unsigned char *in, int length) {
+void AsciiToB32Scalar(unsigned char *out, const unsigned char *in,
+                      int length) {
   while ((length--) != 0) {
     unsigned char ch = *in++;
     int lch = toupper(ch);
@@ -190,6 +194,279 @@ void AsciiToB32(unsigned char *out, const unsigned char *in, int length) {
   }
 }
 
+/*
+    Vector versions of the translations above.  Each lane computes the same
+    function of its byte as the scalar code, for all 256 byte values, so the
+    results are identical; the tail that doesn't fill a vector is left to the
+    scalar code.  AsciiToB32 upcases like toupper in the C locale.
+
+    Every mapping is a sum of constants selected by unsigned >= compares,
+    which SSE2 (always present on x86-64) and NEON have, AVX2 just does 32
+    bytes at a time.
+*/
+#if defined(ENCFS_BASE64_X86)
+
+static inline __m128i ge(__m128i x, unsigned char k) {
+  return _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8((char)k)), x);
+}
+
+static inline __m128i sel(__m128i mask, unsigned char k) {
+  return _mm_and_si128(mask, _mm_set1_epi8((char)k));
+}
+
+static void B64ToAsciiSSE2(unsigned char *buf, int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i off = _mm_set1_epi8(44);
+    off = _mm_add_epi8(off, sel(ge(x, 2), 2));
+    off = _mm_add_epi8(off, sel(ge(x, 12), 7));
+    off = _mm_add_epi8(off, sel(ge(x, 38), 6));
+    _mm_storeu_si128((__m128i *)(buf + i), _mm_add_epi8(x, off));
+  }
+  B64ToAsciiScalar(buf + i, length - i);
+}
+
+static void AsciiToB64SSE2(unsigned char *out, const unsigned char *in,
+                           int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i ge48 = ge(x, 48);
+    __m128i ge65 = ge(x, 65);
+    __m128i off = _mm_set1_epi8(44);
+    off = _mm_add_epi8(off, sel(ge48, 2));
+    off = _mm_add_epi8(off, sel(ge65, 7));
+    off = _mm_add_epi8(off, sel(ge(x, 97), 6));
+    // below 'A', only ",-0123456789" are valid
+    __m128i invalid = _mm_or_si128(
+        _mm_or_si128(_mm_andnot_si128(ge(x, 44), _mm_set1_epi8(-1)),
+                     _mm_andnot_si128(ge48, ge(x, 46))),
+        _mm_andnot_si128(ge65, ge(x, 58)));
+    __m128i r = _mm_sub_epi8(x, off);
+    r = _mm_or_si128(_mm_andnot_si128(invalid, r), sel(invalid, 240));
+    _mm_storeu_si128((__m128i *)(out + i), r);
+  }
+  AsciiToB64Scalar(out + i, in + i, length - i);
+}
+
+static void B32ToAsciiSSE2(unsigned char *buf, int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i off = _mm_set1_epi8(24 + 41);
+    off = _mm_sub_epi8(off, sel(ge(x, 26), 41));
+    _mm_storeu_si128((__m128i *)(buf + i), _mm_add_epi8(x, off));
+  }
+  B32ToAsciiScalar(buf + i, length - i);
+}
+
+static void AsciiToB32SSE2(unsigned char *out, const unsigned char *in,
+                           int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i lower = _mm_andnot_si128(ge(x, 'z' + 1), ge(x, 'a'));
+    __m128i u = _mm_sub_epi8(x, sel(lower, 32));
+    __m128i off = _mm_add_epi8(_mm_set1_epi8(24), sel(ge(u, 'A'), 41));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_sub_epi8(u, off));
+  }
+  AsciiToB32Scalar(out + i, in + i, length - i);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i ge(__m256i x, unsigned char k) {
+  return _mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8((char)k)), x);
+}
+
+AVX2 static inline __m256i sel(__m256i mask, unsigned char k) {
+  return _mm256_and_si256(mask, _mm256_set1_epi8((char)k));
+}
+
+AVX2 static void B64ToAsciiAVX2(unsigned char *buf, int length) {
+  int i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i off = _mm256_set1_epi8(44);
+    off = _mm256_add_epi8(off, sel(ge(x, 2), 2));
+    off = _mm256_add_epi8(off, sel(ge(x, 12), 7));
+    off = _mm256_add_epi8(off, sel(ge(x, 38), 6));
+    _mm256_storeu_si256((__m256i *)(buf + i), _mm256_add_epi8(x, off));
+  }
+  B64ToAsciiSSE2(buf + i, length - i);
+}
+
+AVX2 static void AsciiToB64AVX2(unsigned char *out, const unsigned char *in,
+                                int length) {
+  int i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i ge48 = ge(x, 48);
+    __m256i ge65 = ge(x, 65);
+    __m256i off = _mm256_set1_epi8(44);
+    off = _mm256_add_epi8(off, sel(ge48, 2));
+    off = _mm256_add_epi8(off, sel(ge65, 7));
+    off = _mm256_add_epi8(off, sel(ge(x, 97), 6));
+    __m256i invalid = _mm256_or_si256(
+        _mm256_or_si256(_mm256_andnot_si256(ge(x, 44), _mm256_set1_epi8(-1)),
+                        _mm256_andnot_si256(ge48, ge(x, 46))),
+        _mm256_andnot_si256(ge65, ge(x, 58)));
+    __m256i r = _mm256_sub_epi8(x, off);
+    r = _mm256_or_si256(_mm256_andnot_si256(invalid, r), sel(invalid, 240));
+    _mm256_storeu_si256((__m256i *)(out + i), r);
+  }
+  AsciiToB64SSE2(out + i, in + i, length - i);
+}
+
+AVX2 static void B32ToAsciiAVX2(unsigned char *buf, int length) {
+  int i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i off = _mm256_set1_epi8(24 + 41);
+    off = _mm256_sub_epi8(off, sel(ge(x, 26), 41));
+    _mm256_storeu_si256((__m256i *)(buf + i), _mm256_add_epi8(x, off));
+  }
+  B32ToAsciiSSE2(buf + i, length - i);
+}
+
+AVX2 static void AsciiToB32AVX2(unsigned char *out, const unsigned char *in,
+                                int length) {
+  int i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i lower = _mm256_andnot_si256(ge(x, 'z' + 1), ge(x, 'a'));
+    __m256i u = _mm256_sub_epi8(x, sel(lower, 32));
+    __m256i off = _mm256_add_epi8(_mm256_set1_epi8(24), sel(ge(u, 'A'), 41));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_sub_epi8(u, off));
+  }
+  AsciiToB32SSE2(out + i, in + i, length - i);
+}
+
+#undef AVX2
+
+#elif defined(ENCFS_BASE64_NEON)
+
+static inline uint8x16_t ge(uint8x16_t x, unsigned char k) {
+  return vcgeq_u8(x, vdupq_n_u8(k));
+}
+
+static inline uint8x16_t sel(uint8x16_t mask, unsigned char k) {
+  return vandq_u8(mask, vdupq_n_u8(k));
+}
+
+static void B64ToAsciiNEON(unsigned char *buf, int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t x = vld1q_u8(buf + i);
+    uint8x16_t off = vdupq_n_u8(44);
+    off = vaddq_u8(off, sel(ge(x, 2), 2));
+    off = vaddq_u8(off, sel(ge(x, 12), 7));
+    off = vaddq_u8(off, sel(ge(x, 38), 6));
+    vst1q_u8(buf + i, vaddq_u8(x, off));
+  }
+  B64ToAsciiScalar(buf + i, length - i);
+}
+
+static void AsciiToB64NEON(unsigned char *out, const unsigned char *in,
+                           int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t x = vld1q_u8(in + i);
+    uint8x16_t ge48 = ge(x, 48);
+    uint8x16_t ge65 = ge(x, 65);
+    uint8x16_t off = vdupq_n_u8(44);
+    off = vaddq_u8(off, sel(ge48, 2));
+    off = vaddq_u8(off, sel(ge65, 7));
+    off = vaddq_u8(off, sel(ge(x, 97), 6));
+    uint8x16_t invalid = vorrq_u8(vorrq_u8(vmvnq_u8(ge(x, 44)),
+                                           vbicq_u8(ge(x, 46), ge48)),
+                                  vbicq_u8(ge(x, 58), ge65));
+    uint8x16_t r = vsubq_u8(x, off);
+    vst1q_u8(out + i, vbslq_u8(invalid, vdupq_n_u8(240), r));
+  }
+  AsciiToB64Scalar(out + i, in + i, length - i);
+}
+
+static void B32ToAsciiNEON(unsigned char *buf, int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t x = vld1q_u8(buf + i);
+    uint8x16_t off = vsubq_u8(vdupq_n_u8(24 + 41), sel(ge(x, 26), 41));
+    vst1q_u8(buf + i, vaddq_u8(x, off));
+  }
+  B32ToAsciiScalar(buf + i, length - i);
+}
+
+static void AsciiToB32NEON(unsigned char *out, const unsigned char *in,
+                           int length) {
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t x = vld1q_u8(in + i);
+    uint8x16_t lower = vbicq_u8(ge(x, 'a'), ge(x, 'z' + 1));
+    uint8x16_t u = vsubq_u8(x, sel(lower, 32));
+    uint8x16_t off = vaddq_u8(vdupq_n_u8(24), sel(ge(u, 'A'), 41));
+    vst1q_u8(out + i, vsubq_u8(u, off));
+  }
+  AsciiToB32Scalar(out + i, in + i, length - i);
+}
+
+#endif
+
+namespace {
+
+struct Codecs {
+  void (*b64ToAscii)(unsigned char *buf, int length);
+  void (*asciiToB64)(unsigned char *out, const unsigned char *in, int length);
+  void (*b32ToAscii)(unsigned char *buf, int length);
+  void (*asciiToB32)(unsigned char *out, const unsigned char *in, int length);
+};
+
+// picked once, from what the CPU supports
+const Codecs &codecs() {
+  static const Codecs best = []() -> Codecs {
+#if defined(ENCFS_BASE64_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return {B64ToAsciiAVX2, AsciiToB64AVX2, B32ToAsciiAVX2, AsciiToB32AVX2};
+    }
+    return {B64ToAsciiSSE2, AsciiToB64SSE2, B32ToAsciiSSE2, AsciiToB32SSE2};
+#elif defined(ENCFS_BASE64_NEON)
+    return {B64ToAsciiNEON, AsciiToB64NEON, B32ToAsciiNEON, AsciiToB32NEON};
+#else
+    return {B64ToAsciiScalar, AsciiToB64Scalar, B32ToAsciiScalar,
+            AsciiToB32Scalar};
+#endif
+  }();
+  return best;
+}
+
+}  // namespace
+
+void B64ToAscii(unsigned char *buf, int length) {
+  codecs().b64ToAscii(buf, length);
+}
+
+void AsciiToB64(unsigned char *buf, int length) {
+  codecs().asciiToB64(buf, buf, length);
+}
+
+void AsciiToB64(unsigned char *out, const unsigned char *in, int length) {
+  codecs().asciiToB64(out, in, length);
+}
+
+void B32ToAscii(unsigned char *buf, int length) {
+  codecs().b32ToAscii(buf, length);
+}
+
+void AsciiToB32(unsigned char *buf, int length) {
+  codecs().asciiToB32(buf, buf, length);
+}
+
+void AsciiToB32(unsigned char *out, const unsigned char *in, int length) {
+  codecs().asciiToB32(out, in, length);
+}
+
 #define WHITESPACE 64
 #define EQUALS 65
 #define INVALID 66
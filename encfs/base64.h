@@ -67,6 +67,13 @@ void AsciiToB64(unsigned char *out, const unsigned char *in, int length);
 void AsciiToB32(unsigned char *buf, int length);
 void AsciiToB32(unsigned char *out, const unsigned char *in, int length);
 
+// Portable versions of the translations above.  The others use vector
+// instructions when the CPU has them, and must give the same results.
+void B64ToAsciiScalar(unsigned char *buf, int length);
+void B32ToAsciiScalar(unsigned char *buf, int length);
+void AsciiToB64Scalar(unsigned char *out, const unsigned char *in, int length);
+void AsciiToB32Scalar(unsigned char *out, const unsigned char *in, int length);
+
 // Decode standard B64 into the output array.
 // Used only to decode legacy Boost XML serialized config format.
 // The output size must be at least B64ToB256Bytes(inputLen).
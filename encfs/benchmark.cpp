@@ -0,0 +1,730 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    encfs-benchmark: mounts EncFS on a scratch directory, runs workloads on
+    it and prints the results as JSON, with latency percentiles, so that they
+    can be compared between builds.  With --plain the workloads run on the
+    scratch directory itself, as a baseline.
+
+    Caches aren't dropped between workloads, as that needs root; pass
+    --nocache or the like with --encfs-opts to measure without them.
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Params {
+  string encfs = "encfs";
+  string encfsOpts;
+  string output;
+  bool plain = false;
+  bool keep = false;
+  int sizeMiB = 256;      // of the files of the random I/O workloads
+  long ops = 20000;       // per random I/O and metadata workload
+  long files = 10000;     // created by the create storm
+  long entries = 1000000;  // of the listed directory
+  int threads = 4;
+  int mounts = 10;        // of the mount workload
+  vector<string> workloads;
+};
+
+const int IOSize = 4096;
+
+uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void fail(const string &what) {
+  cerr << "encfs-benchmark: " << what << ": " << strerror(errno) << "\n";
+  exit(EXIT_FAILURE);
+}
+
+// Latencies of the operations of a workload, from one or more threads
+struct Result {
+  string name;
+  vector<pair<string, long>> params;
+  vector<uint64_t> latencies;  // ns
+  uint64_t elapsed = 0;        // ns, wall clock
+  uint64_t bytes = 0;          // moved by the operations, if any
+  uint64_t items = 0;          // entries listed or files read, if any
+  // mean time of each phase of mounting, in us, as encfs reported them
+  vector<pair<string, double>> startup;
+
+  void merge(const vector<uint64_t> &l) {
+    latencies.insert(latencies.end(), l.begin(), l.end());
+  }
+};
+
+double percentile(const vector<uint64_t> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = (size_t)(p * sorted.size());
+  if (i >= sorted.size()) i = sorted.size() - 1;
+  return sorted[i] / 1000.0;
+}
+
+string jsonString(const string &s) {
+  string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+void writeJson(ostream &out, const Params &p, const string &target,
+               vector<Result> &results) {
+  out << "{\n  \"target\": " << jsonString(target) << ",\n";
+  out << "  \"encfs_opts\": " << jsonString(p.encfsOpts) << ",\n";
+  out << "  \"timestamp\": " << time(nullptr) << ",\n";
+  out << "  \"workloads\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    Result &r = results[i];
+    sort(r.latencies.begin(), r.latencies.end());
+    double seconds = r.elapsed / 1e9;
+    out << (i ? ",\n" : "\n") << "    {\n";
+    out << "      \"name\": " << jsonString(r.name) << ",\n";
+    out << "      \"params\": {";
+    for (size_t j = 0; j < r.params.size(); ++j) {
+      out << (j ? ", " : "") << jsonString(r.params[j].first) << ": "
+          << r.params[j].second;
+    }
+    out << "},\n";
+    out << "      \"ops\": " << r.latencies.size() << ",\n";
+    out << "      \"seconds\": " << seconds << ",\n";
+    out << "      \"ops_per_sec\": "
+        << (seconds > 0 ? r.latencies.size() / seconds : 0) << ",\n";
+    if (r.bytes) {
+      out << "      \"mib_per_sec\": "
+          << (seconds > 0 ? r.bytes / seconds / (1 << 20) : 0) << ",\n";
+    }
+    if (r.items) {
+      out << "      \"items_per_sec\": " << (seconds > 0 ? r.items / seconds : 0)
+          << ",\n";
+    }
+    out << "      \"latency_us\": {\"p50\": " << percentile(r.latencies, 0.5)
+        << ", \"p90\": " << percentile(r.latencies, 0.9)
+        << ", \"p99\": " << percentile(r.latencies, 0.99)
+        << ", \"p999\": " << percentile(r.latencies, 0.999)
+        << ", \"max\": " << percentile(r.latencies, 1) << "}"
+        << (r.startup.empty() ? "\n" : ",\n");
+    if (!r.startup.empty()) {
+      out << "      \"startup_us\": {";
+      for (size_t j = 0; j < r.startup.size(); ++j) {
+        out << (j ? ", " : "") << jsonString(r.startup[j].first) << ": "
+            << r.startup[j].second;
+      }
+      out << "}\n";
+    }
+    out << "    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// Runs body(thread) on n threads, and returns the wall clock time taken
+uint64_t onThreads(int n, const function<void(int)> &body) {
+  uint64_t start = nowNs();
+  vector<thread> threads;
+  for (int t = 0; t < n; ++t) {
+    threads.emplace_back(body, t);
+  }
+  for (thread &t : threads) {
+    t.join();
+  }
+  return nowNs() - start;
+}
+
+void makeFile(const string &path, off_t size) {
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) fail("create " + path);
+  vector<char> buf(1 << 17, 'x');
+  for (off_t done = 0; done < size;) {
+    size_t n = min((off_t)buf.size(), size - done);
+    if (write(fd, buf.data(), n) != (ssize_t)n) fail("write " + path);
+    done += n;
+  }
+  if (close(fd) != 0) fail("close " + path);
+}
+
+void removeTree(const string &path) {
+  string cmd = "rm -rf '" + path + "'";
+  if (system(cmd.c_str()) != 0) {
+    cerr << "encfs-benchmark: unable to remove " << path << "\n";
+  }
+}
+
+// random 4 KiB requests over a file of p.sizeMiB on threads threads, a
+// share of write of them writes
+Result randomIO(const Params &p, const string &dir, const string &name,
+                int threads, int writePercent) {
+  Result r;
+  r.name = name;
+  r.params = {{"size_mib", p.sizeMiB},
+              {"ops", p.ops},
+              {"threads", threads},
+              {"write_percent", writePercent}};
+
+  string path = dir + "/" + name;
+  off_t size = (off_t)p.sizeMiB << 20;
+  makeFile(path, size);
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) fail("open " + path);
+
+  vector<vector<uint64_t>> lat(threads);
+  r.elapsed = onThreads(threads, [&](int t) {
+    mt19937_64 rng(t + 1);
+    vector<char> buf(IOSize, 'y');
+    long n = p.ops / threads;
+    lat[t].reserve(n);
+    for (long i = 0; i < n; ++i) {
+      off_t offset = (off_t)(rng() % (size / IOSize)) * IOSize;
+      bool write = (long)(rng() % 100) < writePercent;
+      uint64_t start = nowNs();
+      ssize_t res = write ? pwrite(fd, buf.data(), IOSize, offset)
+                          : pread(fd, buf.data(), IOSize, offset);
+      lat[t].push_back(nowNs() - start);
+      if (res != IOSize) fail("random I/O on " + path);
+    }
+  });
+  for (auto &l : lat) r.merge(l);
+  r.bytes = r.latencies.size() * (uint64_t)IOSize;
+
+  close(fd);
+  unlink(path.c_str());
+  return r;
+}
+
+// threads writers of one file of p.sizeMiB, each writing its own part of
+// it from start to end in 128 KiB requests, as VM images and databases see
+Result parallelWrite(const Params &p, const string &dir, int threads) {
+  Result r;
+  r.name = "parallel-write";
+  r.params = {{"size_mib", p.sizeMiB}, {"threads", threads}};
+
+  string path = dir + "/parallel";
+  off_t size = (off_t)p.sizeMiB << 20;
+  makeFile(path, size);
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) fail("open " + path);
+
+  const size_t chunk = 128 << 10;
+  off_t part = size / threads / chunk * chunk;
+  if (part == 0) {
+    cerr << "encfs-benchmark: --size too small for " << threads
+         << " writers\n";
+    exit(EXIT_FAILURE);
+  }
+  vector<vector<uint64_t>> lat(threads);
+  r.elapsed = onThreads(threads, [&](int t) {
+    vector<char> buf(chunk, 'w');
+    for (off_t done = 0; done < part; done += chunk) {
+      uint64_t start = nowNs();
+      ssize_t res = pwrite(fd, buf.data(), chunk, t * part + done);
+      lat[t].push_back(nowNs() - start);
+      if (res != (ssize_t)chunk) fail("write " + path);
+    }
+  });
+  for (auto &l : lat) r.merge(l);
+  r.bytes = r.latencies.size() * (uint64_t)chunk;
+
+  close(fd);
+  unlink(path.c_str());
+  return r;
+}
+
+// stat, chmod, utimes and renames of p.ops random files of a set
+Result metadata(const Params &p, const string &dir) {
+  Result r;
+  r.name = "metadata";
+  const long count = 1000;
+  r.params = {{"files", count}, {"ops", p.ops}};
+
+  string base = dir + "/meta";
+  if (mkdir(base.c_str(), 0755) != 0) fail("mkdir " + base);
+  vector<string> names;
+  for (long i = 0; i < count; ++i) {
+    names.push_back(base + "/file" + to_string(i));
+    makeFile(names.back(), 0);
+  }
+
+  mt19937_64 rng(1);
+  r.latencies.reserve(p.ops);
+  uint64_t begin = nowNs();
+  for (long i = 0; i < p.ops; ++i) {
+    string &name = names[rng() % count];
+    unsigned kind = rng() % 10;
+    struct stat st;
+    uint64_t start = nowNs();
+    int res;
+    if (kind < 5) {
+      res = stat(name.c_str(), &st);
+    } else if (kind < 7) {
+      res = chmod(name.c_str(), (i & 1) ? 0600 : 0644);
+    } else if (kind < 9) {
+      res = utimes(name.c_str(), nullptr);
+    } else {
+      // back and forth between two names
+      string renamed = name.back() == 'r' ? name.substr(0, name.size() - 1)
+                                          : name + "r";
+      res = rename(name.c_str(), renamed.c_str());
+      if (res == 0) name = renamed;
+    }
+    r.latencies.push_back(nowNs() - start);
+    if (res != 0) fail("metadata operation on " + name);
+  }
+  r.elapsed = nowNs() - begin;
+
+  removeTree(base);
+  return r;
+}
+
+// p.files files of 4 KiB created in one directory by p.threads threads
+Result createStorm(const Params &p, const string &dir) {
+  Result r;
+  r.name = "create-storm";
+  r.params = {{"files", p.files}, {"threads", p.threads}};
+
+  string base = dir + "/storm";
+  if (mkdir(base.c_str(), 0755) != 0) fail("mkdir " + base);
+
+  vector<vector<uint64_t>> lat(p.threads);
+  r.elapsed = onThreads(p.threads, [&](int t) {
+    vector<char> buf(IOSize, 'z');
+    for (long i = t; i < p.files; i += p.threads) {
+      string path = base + "/f" + to_string(i);
+      uint64_t start = nowNs();
+      int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+      if (fd < 0) fail("create " + path);
+      if (write(fd, buf.data(), IOSize) != IOSize) fail("write " + path);
+      close(fd);
+      lat[t].push_back(nowNs() - start);
+    }
+  });
+  for (auto &l : lat) r.merge(l);
+  r.bytes = r.latencies.size() * (uint64_t)IOSize;
+
+  removeTree(base);
+  return r;
+}
+
+// listings of a directory of p.entries empty files
+Result listDir(const Params &p, const string &dir) {
+  Result r;
+  r.name = "list-dir";
+  const int listings = 3;
+  r.params = {{"entries", p.entries}, {"listings", listings}};
+
+  string base = dir + "/big";
+  if (mkdir(base.c_str(), 0755) != 0) fail("mkdir " + base);
+  onThreads(p.threads, [&](int t) {
+    for (long i = t; i < p.entries; i += p.threads) {
+      string path = base + "/entry" + to_string(i);
+      int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+      if (fd < 0) fail("create " + path);
+      close(fd);
+    }
+  });
+
+  uint64_t begin = nowNs();
+  for (int i = 0; i < listings; ++i) {
+    uint64_t start = nowNs();
+    DIR *d = opendir(base.c_str());
+    if (d == nullptr) fail("opendir " + base);
+    long seen = 0;
+    while (readdir(d) != nullptr) ++seen;
+    closedir(d);
+    r.latencies.push_back(nowNs() - start);
+    if (seen < p.entries) {
+      cerr << "encfs-benchmark: listed " << seen << " of " << p.entries
+           << " entries\n";
+      exit(EXIT_FAILURE);
+    }
+    r.items += seen;
+  }
+  r.elapsed = nowNs() - begin;
+
+  removeTree(base);
+  return r;
+}
+
+// reads every file of a tree, as a backup would, one operation per file
+Result backupRead(const string &tree) {
+  Result r;
+  r.name = "reverse-read";
+
+  vector<char> buf(1 << 17);
+  function<void(const string &)> walk = [&](const string &path) {
+    DIR *d = opendir(path.c_str());
+    if (d == nullptr) fail("opendir " + path);
+    while (struct dirent *de = readdir(d)) {
+      string name = de->d_name;
+      if (name == "." || name == "..") continue;
+      string child = path + "/" + name;
+      struct stat st;
+      if (lstat(child.c_str(), &st) != 0) fail("stat " + child);
+      if (S_ISDIR(st.st_mode)) {
+        walk(child);
+      } else if (S_ISREG(st.st_mode)) {
+        uint64_t start = nowNs();
+        int fd = open(child.c_str(), O_RDONLY);
+        if (fd < 0) fail("open " + child);
+        ssize_t n;
+        while ((n = read(fd, buf.data(), buf.size())) > 0) r.bytes += n;
+        if (n < 0) fail("read " + child);
+        close(fd);
+        r.latencies.push_back(nowNs() - start);
+        ++r.items;
+      }
+    }
+    closedir(d);
+  };
+
+  uint64_t begin = nowNs();
+  walk(tree);
+  r.elapsed = nowNs() - begin;
+  return r;
+}
+
+bool mounted(const string &dir) {
+  struct stat st, parent;
+  if (stat(dir.c_str(), &st) != 0 ||
+      stat((dir + "/..").c_str(), &parent) != 0) {
+    return false;
+  }
+  return st.st_dev != parent.st_dev;
+}
+
+void mountEncFS(const Params &p, const string &from, const string &to,
+                const string &extra) {
+  string cmd = p.encfs + " --extpass='echo benchmark' --standard " +
+               p.encfsOpts + " " + extra + " '" + from + "' '" + to +
+               "' > /dev/null";
+  if (system(cmd.c_str()) != 0) {
+    cerr << "encfs-benchmark: failed: " << cmd << "\n";
+    exit(EXIT_FAILURE);
+  }
+  // polled often, for the mount workload
+  for (int i = 0; i < 10000 && !mounted(to); ++i) {
+    usleep(1000);
+  }
+  if (!mounted(to)) {
+    cerr << "encfs-benchmark: " << to << " was not mounted\n";
+    exit(EXIT_FAILURE);
+  }
+}
+
+void unmountEncFS(const Params &p, const string &dir) {
+  string cmd = p.encfs + " -u '" + dir + "' > /dev/null";
+  for (int i = 0; i < 10; ++i) {
+    if (system(cmd.c_str()) == 0 || !mounted(dir)) return;
+    sleep(1);
+  }
+  cerr << "encfs-benchmark: unable to unmount " << dir << "\n";
+}
+
+// adds the phases of encfs_startup_phase_seconds in the stats file of a
+// mount to sums, in us
+void addStartupPhases(const string &dir, vector<pair<string, double>> *sums) {
+  ifstream in((dir + "/.encfs-stats").c_str());
+  const string prefix = "encfs_startup_phase_seconds{phase=\"";
+  string line;
+  while (getline(in, line)) {
+    if (line.compare(0, prefix.size(), prefix) != 0) continue;
+    size_t end = line.find('"', prefix.size());
+    if (end == string::npos) continue;
+    string phase = line.substr(prefix.size(), end - prefix.size());
+    double us = atof(line.c_str() + line.find(' ', end)) * 1e6;
+    auto it = find_if(sums->begin(), sums->end(),
+                      [&](const pair<string, double> &s) {
+                        return s.first == phase;
+                      });
+    if (it == sums->end()) {
+      sums->emplace_back(phase, us);
+    } else {
+      it->second += us;
+    }
+  }
+}
+
+// p.mounts mounts of a volume, each timed from starting encfs until a file
+// of it was opened, with the phases of mounting which encfs reported
+Result mountLatency(const Params &p, const string &work) {
+  Result r;
+  r.name = "mount";
+  r.params = {{"mounts", p.mounts}};
+
+  string c = work + "/mount-c";
+  string dir = work + "/mount-p";
+  if (mkdir(c.c_str(), 0700) != 0 || mkdir(dir.c_str(), 0700) != 0) {
+    fail("mkdir");
+  }
+  // the first mount creates the volume
+  mountEncFS(p, c, dir, "");
+  string probe = dir + "/probe";
+  makeFile(probe, IOSize);
+  unmountEncFS(p, dir);
+
+  for (int i = 0; i < p.mounts; ++i) {
+    uint64_t start = nowNs();
+    mountEncFS(p, c, dir, "--stats");
+    int fd = open(probe.c_str(), O_RDONLY);
+    if (fd < 0) fail("open " + probe);
+    close(fd);
+    uint64_t took = nowNs() - start;
+    r.latencies.push_back(took);
+    r.elapsed += took;
+    addStartupPhases(dir, &r.startup);
+    unmountEncFS(p, dir);
+  }
+  for (auto &phase : r.startup) {
+    phase.second /= p.mounts;
+  }
+  return r;
+}
+
+// plaintext tree of files for reverse-read: p.files / 10 small ones, spread
+// over directories, and one of p.sizeMiB
+void makeSourceTree(const Params &p, const string &tree) {
+  if (mkdir(tree.c_str(), 0755) != 0) fail("mkdir " + tree);
+  long small = max(p.files / 10, 1L);
+  for (long i = 0; i < small; ++i) {
+    string sub = tree + "/d" + to_string(i % 10);
+    if (i < 10 && mkdir(sub.c_str(), 0755) != 0) fail("mkdir " + sub);
+    makeFile(sub + "/f" + to_string(i), 16 * 1024);
+  }
+  makeFile(tree + "/large", (off_t)p.sizeMiB << 20);
+}
+
+bool wanted(const Params &p, const string &name) {
+  return p.workloads.empty() ||
+         find(p.workloads.begin(), p.workloads.end(), name) !=
+             p.workloads.end();
+}
+
+void usage(const char *name) {
+  cerr << "Usage: " << name << " [options] (scratch dir)\n"
+       << "\n"
+       << "Mounts EncFS on a directory created in the scratch dir, runs the\n"
+       << "workloads and prints the results as JSON.\n"
+       << "\n"
+       << "Workloads: random-read, random-write, metadata, create-storm,\n"
+       << "           list-dir, same-file, parallel-write, reverse-read,\n"
+       << "           mount\n"
+       << "\n"
+       << "Options:\n"
+       << "  --encfs=PATH\t\tencfs to run (default: encfs from PATH)\n"
+       << "  --encfs-opts=OPTS\tmore options for the mounts\n"
+       << "  --workloads=A,B,...\tworkloads to run (default: all)\n"
+       << "  --size=MiB\t\tfile size for random I/O and reverse-read"
+       << " (256)\n"
+       << "  --ops=N\t\toperations of random I/O and metadata (20000)\n"
+       << "  --files=N\t\tfiles of create-storm (10000)\n"
+       << "  --entries=N\t\tentries of list-dir (1000000)\n"
+       << "  --threads=N\t\tthreads of create-storm, same-file and"
+       << " parallel-write (4)\n"
+       << "  --mounts=N\t\tmounts of the mount workload (10)\n"
+       << "  --output=FILE\t\twrite the JSON to FILE instead of stdout\n"
+       << "  --plain\t\trun on the scratch dir, without EncFS\n"
+       << "  --keep\t\tleave the files behind\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Params p;
+
+  static struct option long_options[] = {
+      {"encfs", 1, nullptr, 'e'},    {"encfs-opts", 1, nullptr, 'o'},
+      {"workloads", 1, nullptr, 'w'}, {"size", 1, nullptr, 's'},
+      {"ops", 1, nullptr, 'n'},      {"files", 1, nullptr, 'f'},
+      {"entries", 1, nullptr, 'E'},  {"threads", 1, nullptr, 't'},
+      {"output", 1, nullptr, 'O'},   {"plain", 0, nullptr, 'p'},
+      {"keep", 0, nullptr, 'k'},     {"mounts", 1, nullptr, 'm'},
+      {"help", 0, nullptr, 'h'},     {nullptr, 0, nullptr, 0}};
+
+  while (true) {
+    int option_index = 0;
+    int res = getopt_long(argc, argv, "h", long_options, &option_index);
+    if (res == -1) break;
+
+    switch (res) {
+      case 'e':
+        p.encfs = optarg;
+        break;
+      case 'o':
+        p.encfsOpts = optarg;
+        break;
+      case 'w': {
+        stringstream ss(optarg);
+        string name;
+        while (getline(ss, name, ',')) p.workloads.push_back(name);
+        break;
+      }
+      case 's':
+        p.sizeMiB = atoi(optarg);
+        break;
+      case 'n':
+        p.ops = atol(optarg);
+        break;
+      case 'f':
+        p.files = atol(optarg);
+        break;
+      case 'E':
+        p.entries = atol(optarg);
+        break;
+      case 't':
+        p.threads = atoi(optarg);
+        break;
+      case 'm':
+        p.mounts = atoi(optarg);
+        break;
+      case 'O':
+        p.output = optarg;
+        break;
+      case 'p':
+        p.plain = true;
+        break;
+      case 'k':
+        p.keep = true;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc || p.sizeMiB < 1 || p.ops < 1 || p.files < 1 ||
+      p.entries < 1 || p.threads < 1 || p.mounts < 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  string work = string(argv[optind]) + "/encfs-benchmark-XXXXXX";
+  vector<char> tmpl(work.begin(), work.end());
+  tmpl.push_back('\0');
+  if (mkdtemp(tmpl.data()) == nullptr) fail("mkdtemp " + work);
+  work = tmpl.data();
+
+  // the forward mount: cipher text in c, the workloads in p
+  string dir = work;
+  if (!p.plain) {
+    string c = work + "/c";
+    dir = work + "/p";
+    if (mkdir(c.c_str(), 0700) != 0 || mkdir(dir.c_str(), 0700) != 0) {
+      fail("mkdir");
+    }
+    mountEncFS(p, c, dir, "");
+  } else {
+    dir = work + "/plain";
+    if (mkdir(dir.c_str(), 0700) != 0) fail("mkdir " + dir);
+  }
+
+  vector<Result> results;
+  if (wanted(p, "random-read")) {
+    results.push_back(randomIO(p, dir, "random-read", 1, 0));
+  }
+  if (wanted(p, "random-write")) {
+    results.push_back(randomIO(p, dir, "random-write", 1, 100));
+  }
+  if (wanted(p, "metadata")) {
+    results.push_back(metadata(p, dir));
+  }
+  if (wanted(p, "create-storm")) {
+    results.push_back(createStorm(p, dir));
+  }
+  if (wanted(p, "list-dir")) {
+    results.push_back(listDir(p, dir));
+  }
+  if (wanted(p, "same-file")) {
+    results.push_back(randomIO(p, dir, "same-file", p.threads, 50));
+  }
+  if (wanted(p, "parallel-write")) {
+    results.push_back(parallelWrite(p, dir, p.threads));
+  }
+  if (!p.plain) {
+    unmountEncFS(p, dir);
+  }
+
+  if (wanted(p, "reverse-read")) {
+    // a plaintext tree, read through a reverse mount of it
+    string tree = work + "/source";
+    makeSourceTree(p, tree);
+    string view = tree;
+    if (!p.plain) {
+      view = work + "/view";
+      if (mkdir(view.c_str(), 0700) != 0) fail("mkdir " + view);
+      mountEncFS(p, tree, view, "--reverse");
+    }
+    Result r = backupRead(view);
+    r.params = {{"files", (long)r.items}, {"size_mib", p.sizeMiB}};
+    results.push_back(r);
+    if (!p.plain) {
+      unmountEncFS(p, view);
+    }
+  }
+
+  if (!p.plain && wanted(p, "mount")) {
+    results.push_back(mountLatency(p, work));
+  }
+
+  if (!p.keep) {
+    removeTree(work);
+  }
+
+  string target = p.plain ? "plain" : "encfs";
+  if (p.output.empty()) {
+    writeJson(cout, p, target, results);
+  } else {
+    ofstream out(p.output.c_str());
+    writeJson(out, p, target, results);
+    if (!out) fail("write " + p.output);
+  }
+  return EXIT_SUCCESS;
+}
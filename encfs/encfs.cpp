@@ -19,14 +19,17 @@
 
 #include <cerrno>
 #include <cinttypes>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <fcntl.h>
 #include <limits>
 #include <memory>
+#include <sstream>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/time.h>
@@ -41,17 +44,33 @@
 #elif defined(HAVE_ATTR_XATTR_H)
 #include <attr/xattr.h>
 #endif
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
 
 #include "easylogging++.h"
 #include <functional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "ContentHash.h"
 #include "Context.h"
+#include "CpuBudget.h"
 #include "DirNode.h"
 #include "Error.h"
+#include "FairScheduler.h"
+#include "FileHints.h"
 #include "FileNode.h"
 #include "FileUtils.h"
+#include "HotFiles.h"
+#include "IntentLog.h"
+#include "KeepCache.h"
+#include "MemoryPool.h"
+#include "Mutex.h"
+#include "OpRecorder.h"
+#include "Stats.h"
+#include "Trace.h"
 #include "fuse.h"
 
 #ifndef MIN
@@ -61,7 +80,6 @@
 #define ESUCCESS 0
 
 using namespace std;
-using namespace std::placeholders;
 
 namespace encfs {
 
@@ -78,23 +96,90 @@ static EncFS_Context *context() {
  */
 static bool isReadOnly(EncFS_Context *ctx) { return ctx->opts->readOnly; }
 
-// helper function -- apply a functor to a cipher path, given the plain path
-static int withCipherPath(
-    const char *opName, const char *path,
-    const function<int(EncFS_Context *, const string &)> &op,
-    bool passReturnCode = false) {
+// one in HotFiles::Every calls of each thread is recorded for --hotfiles
+static bool sampleHot(EncFS_Context *ctx) {
+  static thread_local unsigned calls = 0;
+  return ctx->hotFiles && ++calls % HotFiles::Every == 0;
+}
+
+// the sampled call is counted HotFiles::Every times, by file and by user
+static void recordHot(EncFS_Context *ctx, const char *opName, int res,
+                      const Stats::Trace &trace) {
+  if (trace.name().empty()) {
+    return;
+  }
+  uint64_t bytes = res > 0 ? res : 0;
+  uint64_t readBytes = strcmp(opName, "read") == 0 ? bytes : 0;
+  uint64_t writtenBytes = strcmp(opName, "write") == 0 ? bytes : 0;
+  uint64_t cryptoNs = trace.spent(Stats::BlockEncode) +
+                      trace.spent(Stats::BlockDecode) +
+                      trace.spent(Stats::Mac64);
+  uint64_t backingRead = trace.counted(Stats::BackingBytesRead);
+  uint64_t backingWritten = trace.counted(Stats::BackingBytesWritten);
+  ctx->hotFiles->record(trace.name(), HotFiles::Every, readBytes,
+                        writtenBytes, cryptoNs, backingRead, backingWritten);
+  ctx->hotUsers->record(std::to_string(fuse_get_context()->uid),
+                        HotFiles::Every, readBytes, writtenBytes, cryptoNs,
+                        backingRead, backingWritten);
+}
+
+// fires the fuse__entry and fuse__return probes around an operation, res is
+// what it returns, logs it if it was slow (--slowlog), samples it for
+// --hotfiles and times it for the backoff of --bgcpu
+struct OpTrace {
+  OpTrace(const char *opName, const int &res)
+      : opName(opName), res(res), ctx(context()),
+        hot(sampleHot(ctx)), slow(opName, hot),
+        start(CpuBudget::enabled() ? Stats::now() : 0) {
+    ENCFS_TRACE1(fuse__entry, opName);
+  }
+  ~OpTrace() {
+    ENCFS_TRACE2(fuse__return, opName, res);
+    if (start != 0) {
+      CpuBudget::foreground(Stats::now() - start);
+    }
+    std::string entry = slow.finish();
+    if (!entry.empty()) {
+      RLOG(WARNING) << "slow " << entry << " res=" << res;
+    }
+    if (hot && slow.traced()) {
+      recordHot(ctx, opName, res, slow);
+    }
+  }
+
+  const char *opName;
+  const int &res;
+  EncFS_Context *ctx;
+  bool hot;
+  Stats::Trace slow;
+  uint64_t start;
+};
+
+// helper function -- apply a functor to a cipher path, given the plain path.
+// Op is called as int(EncFS_Context *, const char *cipherPath); it is a
+// template parameter so that the operation inlines into each FUSE callback.
+template <typename Op>
+static int withCipherPath(const char *opName, const char *path, const Op &op,
+                          bool passReturnCode = false) {
   EncFS_Context *ctx = context();
 
   int res = -EIO;
+  OpTrace trace(opName, res);
   std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
   if (!FSRoot) {
     return res;
   }
 
   try {
-    string cyName = FSRoot->cipherPath(path);
+    char cyName[PATH_MAX];
+    res = FSRoot->cipherPathInto(path, cyName, sizeof(cyName));
+    if (res < 0) {
+      return res;
+    }
     VLOG(1) << "op: " << opName << " : " << cyName;
+    Stats::Trace::setName(cyName);
 
+    Stats::Timer timer(Stats::Syscall);
     res = op(ctx, cyName);
 
     if (res == -1) {
@@ -111,15 +196,48 @@ static int withCipherPath(
   return res;
 }
 
-static void checkCanary(const std::shared_ptr<FileNode> &fnode) {
+// drop the cached attributes of path after it was changed
+static void attrChanged(const char *path) {
+  int res = 0;
+  std::shared_ptr<DirNode> FSRoot = context()->getRoot(&res, true);
+  if (FSRoot) {
+    FSRoot->attrChanged(path);
+  }
+}
+
+// Logged writes name their file by path and offset, so the intent log is
+// written out before a call changes what those refer to (see IntentLog).
+static int settleIntents(const std::shared_ptr<DirNode> &FSRoot) {
+  IntentLog *log = FSRoot ? FSRoot->config()->intentLog.get() : nullptr;
+  if (log != nullptr && !log->settle()) {
+    return -EIO;
+  }
+  return ESUCCESS;
+}
+
+static int settleIntents() {
+  int res = 0;
+  return settleIntents(context()->getRoot(&res, true));
+}
+
+#ifdef HAVE_XATTR
+// drop what is known of missing extended attributes, of all paths
+static void xattrChanged() {
+  int res = 0;
+  std::shared_ptr<DirNode> FSRoot = context()->getRoot(&res, true);
+  if (FSRoot) {
+    FSRoot->xattrChanged();
+  }
+}
+#endif
+
+static void checkCanary(const FileNode *fnode) {
   if (fnode->canary == CANARY_OK) {
     return;
   }
   if (fnode->canary == CANARY_RELEASED) {
-    // "fnode" may have been released after it was retrieved by
-    // lookupFuseFh. This is not an error. std::shared_ptr will release
-    // the memory only when all operations on the FileNode have been
-    // completed.
+    // "fnode" may have been released after a path lookup found it. This is
+    // not an error, the caller's std::shared_ptr keeps it alive.
     return;
   }
   if (fnode->canary == CANARY_DESTROYED) {
@@ -132,40 +250,38 @@ static void checkCanary(const std::shared_ptr<FileNode> &fnode) {
   throw Error("dead canary");
 }
 
-// helper function -- apply a functor to a node
+// helper function -- apply a functor to a node.  Op is called as
+// int(FileNode *), see withCipherPath.
+template <typename Op>
 static int withFileNode(const char *opName, const char *path,
-                        struct fuse_file_info *fi,
-                        const function<int(FileNode *)> &op) {
+                        struct fuse_file_info *fi, const Op &op) {
   EncFS_Context *ctx = context();
 
   int res = -EIO;
-  bool skipUsageCount = false;
-  if (strlen(path) == 1) {
-    skipUsageCount = true;
-  }
-  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res, skipUsageCount);
-  if (!FSRoot) {
-    return res;
-  }
-
+  OpTrace trace(opName, res);
   try {
 
-    auto do_op = [&FSRoot, opName, &op](std::shared_ptr<FileNode> fnode) {
+    auto do_op = [opName, &op](FileNode *fnode) {
       rAssert(fnode != nullptr);
       checkCanary(fnode);
       VLOG(1) << "op: " << opName << " : " << fnode->cipherName();
+      Stats::Trace::setName(fnode->cipherName());
 
       // check that we're not recursing into the mount point itself
-      if (FSRoot->touchesMountpoint(fnode->cipherName())) {
+      if (fnode->touchesMountpoint()) {
         VLOG(1) << "op: " << opName << " error: Tried to touch mountpoint: '"
                 << fnode->cipherName() << "'";
         return -EIO;
       }
-      return op(fnode.get());
+      return op(fnode);
     };
 
     if (fi != nullptr && fi->fh != 0) {
-      auto node = ctx->lookupFuseFh(fi->fh);
+      // The handle keeps the node alive until release, which the kernel
+      // doesn't send while requests with the handle are running, so reads
+      // and writes touch no shared reference count or lock here.
+      ctx->markUsed();
+      FileNode *node = ctx->borrowFuseFh(fi->fh);
       if (node == nullptr) {
 #ifdef __CYGWIN__
         if (strcmp(opName, "flush") == 0) {
@@ -174,12 +290,19 @@ static int withFileNode(const char *opName, const char *path,
           return 0;
         }
 #endif
-        auto msg = "fh=" + std::to_string(fi->fh) + " not found in fuseFhMap";
+        auto msg = "fh=" + std::to_string(fi->fh) +
+                   " not found in the file handle table";
         throw Error(msg.c_str());
       }
       res = do_op(node);
     } else {
-      res = do_op(FSRoot->lookupNode(path, opName));
+      // a single character path is "/"
+      bool skipUsageCount = path[0] != '\0' && path[1] == '\0';
+      std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res, skipUsageCount);
+      if (!FSRoot) {
+        return res;
+      }
+      res = do_op(FSRoot->lookupNode(path, opName).get());
     }
 
     if (res < 0) {
@@ -192,6 +315,216 @@ static int withFileNode(const char *opName, const char *path,
   return res;
 }
 
+/*
+    With --stats, /.encfs-stats is a read-only file of the counters and
+    latency histograms (see Stats), which is not listed and hides a file of
+    that name in the root.  Each open takes a snapshot of the report, which
+    reads return until release.
+*/
+static const char StatsPath[] = "/.encfs-stats";
+
+static pthread_mutex_t snapshotMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<uint64_t, std::shared_ptr<const std::string>>
+    snapshots;
+
+static bool isStatsFile(const char *path) {
+  return Stats::enabled() && strcmp(path, StatsPath) == 0;
+}
+
+// true if the caller is the user who mounted the volume, or root
+static bool callerOwnsMount() {
+  uid_t uid = fuse_get_context()->uid;
+  return uid == 0 || uid == getuid();
+}
+
+// the stats of the process, and the busiest files and users of the mount,
+// which only the owner of the mount gets to see
+static std::string statsReport(EncFS_Context *ctx) {
+  std::string report = Stats::report();
+  if (ctx->hotFiles && callerOwnsMount()) {
+    report += ctx->hotFiles->report("encfs_hot_file", "file");
+    report += ctx->hotUsers->report("encfs_hot_user", "uid");
+  }
+  return report;
+}
+
+static int statsGetattr(EncFS_Context *ctx, struct stat *stbuf) {
+  memset(stbuf, 0, sizeof(*stbuf));
+  stbuf->st_mode = S_IFREG | 0444;
+  stbuf->st_nlink = 1;
+  stbuf->st_uid = getuid();
+  stbuf->st_gid = getgid();
+  stbuf->st_size = statsReport(ctx).size();
+  stbuf->st_mtime = stbuf->st_ctime = stbuf->st_atime = time(nullptr);
+  return ESUCCESS;
+}
+
+static int statsOpen(EncFS_Context *ctx, struct fuse_file_info *file) {
+  if ((file->flags & O_ACCMODE) != O_RDONLY) {
+    return -EACCES;
+  }
+  // the size changes with every report
+  file->direct_io = 1;
+  file->fh = ctx->nextFuseFh();
+  auto report = std::make_shared<const std::string>(statsReport(ctx));
+  Lock lock(snapshotMutex);
+  snapshots[file->fh] = report;
+  return ESUCCESS;
+}
+
+// bytes of the snapshot at offset, up to size
+static int snapshotRead(struct fuse_file_info *file, char *buf, size_t size,
+                     off_t offset) {
+  std::shared_ptr<const std::string> report;
+  {
+    Lock lock(snapshotMutex);
+    auto it = snapshots.find(file->fh);
+    if (it == snapshots.end()) {
+      return -EBADF;
+    }
+    report = it->second;
+  }
+  if (offset >= (off_t)report->size()) {
+    return 0;
+  }
+  size_t len = MIN(size, report->size() - offset);
+  memcpy(buf, report->data() + offset, len);
+  return len;
+}
+
+static void snapshotRelease(struct fuse_file_info *file) {
+  Lock lock(snapshotMutex);
+  snapshots.erase(file->fh);
+}
+
+/*
+    With --control, /.encfs-control changes settings while mounted (see
+    DirNode::tune).  Reading it lists the settings, as a snapshot taken on
+    open like the stats file.  Each write holds one or more name=value
+    items, separated by white space, which are applied in turn, or
+    "reload", which reads the policy file again (see Policies); a write
+    with an item which can't be applied fails with EINVAL, after the items
+    before it took effect.  A write whose first line is "warm", or
+    "warm=MiB", instead holds plaintext paths, one per line, whose trees are
+    warmed before the write returns (see DirNode::warmTree), "/" if there
+    are none.  Only the user who mounted the volume, or root, may write to
+    it.
+*/
+static const char ControlPath[] = "/.encfs-control";
+
+static bool isControlFile(EncFS_Context *ctx, const char *path) {
+  return ctx->opts->control && strcmp(path, ControlPath) == 0;
+}
+
+static std::string controlReport(EncFS_Context *ctx) {
+  int res = 0;
+  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res, true);
+  return FSRoot ? FSRoot->tunables() : std::string();
+}
+
+static int controlGetattr(EncFS_Context *ctx, struct stat *stbuf) {
+  memset(stbuf, 0, sizeof(*stbuf));
+  stbuf->st_mode = S_IFREG | 0600;
+  stbuf->st_nlink = 1;
+  stbuf->st_uid = getuid();
+  stbuf->st_gid = getgid();
+  stbuf->st_size = controlReport(ctx).size();
+  stbuf->st_mtime = stbuf->st_ctime = stbuf->st_atime = time(nullptr);
+  return ESUCCESS;
+}
+
+static int controlOpen(EncFS_Context *ctx, struct fuse_file_info *file) {
+  if (!callerOwnsMount()) {
+    return -EACCES;
+  }
+  file->direct_io = 1;
+  file->fh = ctx->nextFuseFh();
+  auto report = std::make_shared<const std::string>(controlReport(ctx));
+  Lock lock(snapshotMutex);
+  snapshots[file->fh] = report;
+  return ESUCCESS;
+}
+
+// the "warm" write of the control file, header is its first line
+static int controlWarm(const std::shared_ptr<DirNode> &FSRoot,
+                       const std::string &header, std::istream &in) {
+  long mib = 0;
+  if (header.length() > 4) {
+    char *end = nullptr;
+    mib = strtol(header.c_str() + 5, &end, 10);
+    if (header[4] != '=' || *end != '\0' || mib < 0 || mib > (1L << 20)) {
+      RLOG(WARNING) << "control: malformed " << header;
+      return -EINVAL;
+    }
+  }
+  std::vector<std::string> paths;
+  std::string path;
+  while (std::getline(in, path)) {
+    if (path.empty()) {
+      continue;
+    }
+    if (path[0] != '/') {
+      path.insert(0, "/");
+    }
+    paths.push_back(path);
+  }
+  if (paths.empty()) {
+    paths.push_back("/");
+  }
+  size_t warmed = FSRoot->warmTree(paths, (size_t)mib << 20);
+  RLOG(INFO) << "control: warmed " << warmed << " paths";
+  return ESUCCESS;
+}
+
+static int controlWrite(EncFS_Context *ctx, const char *buf, size_t size) {
+  int res = -EIO;
+  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) {
+    return res;
+  }
+  std::istringstream in(std::string(buf, size));
+  std::string header;
+  if (size >= 4 && strncmp(buf, "warm", 4) == 0 &&
+      std::getline(in, header) &&
+      (header.length() == 4 || header[4] == '=')) {
+    res = controlWarm(FSRoot, header, in);
+    return res == ESUCCESS ? (int)size : res;
+  }
+  in.clear();
+  in.seekg(0);
+  std::string item;
+  while (in >> item) {
+    if (item == "reload") {
+      res = FSRoot->reloadPolicies();
+      if (res != ESUCCESS) {
+        RLOG(WARNING) << "control: can't reload the policies: "
+                      << strerror(-res);
+        return -EINVAL;
+      }
+      continue;
+    }
+    size_t eq = item.find('=');
+    char *end = nullptr;
+    long value = 0;
+    if (eq != std::string::npos && eq + 1 < item.size()) {
+      value = strtol(item.c_str() + eq + 1, &end, 10);
+    }
+    if (end == nullptr || *end != '\0') {
+      RLOG(WARNING) << "control: malformed setting " << item;
+      return -EINVAL;
+    }
+    std::string name = item.substr(0, eq);
+    res = FSRoot->tune(name, value);
+    if (res != ESUCCESS) {
+      RLOG(WARNING) << "control: can't set " << name << " to " << value
+                    << ": " << strerror(-res);
+      return -EINVAL;
+    }
+    RLOG(INFO) << "control: " << name << " set to " << value;
+  }
+  return size;
+}
+
 /*
     The log messages below always print encrypted filenames, not
     plaintext.  This avoids possibly leaking information to log files.
@@ -207,20 +540,12 @@ int _do_getattr(FileNode *fnode, struct stat *stbuf) {
     EncFS_Context *ctx = context();
     std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
     if (FSRoot) {
-      // determine plaintext link size..  Easiest to read and decrypt..
-      std::vector<char> buf(stbuf->st_size + 1, '\0');
-
-      res = ::readlink(fnode->cipherName(), buf.data(), stbuf->st_size);
-      if (res >= 0) {
-        // other functions expect c-strings to be null-terminated, which
-        // readlink doesn't provide
-        buf[res] = '\0';
-
-        stbuf->st_size = FSRoot->plainPath(buf.data()).length();
-
-        res = ESUCCESS;
-      } else {
-        res = -errno;
+      // determine plaintext link size..  Easiest to read and decrypt, which
+      // DirNode caches for us
+      string target;
+      res = FSRoot->readLink(fnode->cipherName(), *stbuf, &target);
+      if (res == ESUCCESS) {
+        stbuf->st_size = target.length();
       }
     }
   }
@@ -229,22 +554,72 @@ int _do_getattr(FileNode *fnode, struct stat *stbuf) {
 }
 
 int encfs_getattr(const char *path, struct stat *stbuf) {
-  return withFileNode("getattr", path, nullptr, bind(_do_getattr, _1, stbuf));
+  Stats::Timer timer(Stats::Getattr);
+  if (isStatsFile(path)) {
+    return statsGetattr(context(), stbuf);
+  }
+  if (isControlFile(context(), path)) {
+    return controlGetattr(context(), stbuf);
+  }
+  // paths which were just found missing are answered without encoding them
+  // and asking the backing filesystem again
+  int res = -EIO;
+  bool skipUsageCount = path[0] != '\0' && path[1] == '\0';
+  std::shared_ptr<DirNode> FSRoot = context()->getRoot(&res, skipUsageCount);
+  if (!FSRoot) {
+    return res;
+  }
+  if (FSRoot->knownMissing(path)) {
+    return -ENOENT;
+  }
+  // open files may be changing, they always go to the FileNode
+  EncFS_Context *ctx = context();
+  if (FSRoot->cachedAttr(path, stbuf) && !ctx->lookupNode(path)) {
+    return ESUCCESS;
+  }
+
+  uint64_t generation = FSRoot->missingGeneration();
+  uint64_t attrGeneration = FSRoot->attrGeneration();
+  if (ctx->lookupNode(path)) {
+    return withFileNode("getattr", path, nullptr, [=](FileNode *fnode) {
+      return _do_getattr(fnode, stbuf);
+    });
+  }
+
+  // FileNodes are only built for opens, the backing lstat is enough here
+  res = -EIO;
+  OpTrace trace("getattr", res);
+  try {
+    res = FSRoot->getAttr(path, stbuf);
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "error caught in getattr: " << err.what();
+    return res;
+  }
+  if (res == -ENOENT) {
+    FSRoot->noteMissing(path, generation);
+  } else if (res == ESUCCESS && !ctx->lookupNode(path)) {
+    FSRoot->storeAttr(path, *stbuf, attrGeneration);
+  }
+  return res;
 }
 
 int encfs_fgetattr(const char *path, struct stat *stbuf,
                    struct fuse_file_info *fi) {
-  return withFileNode("fgetattr", path, fi, bind(_do_getattr, _1, stbuf));
+  Stats::Timer timer(Stats::Getattr);
+  if (isStatsFile(path)) {
+    return statsGetattr(context(), stbuf);
+  }
+  if (isControlFile(context(), path)) {
+    return controlGetattr(context(), stbuf);
+  }
+  auto op = [=](FileNode *fnode) -> int { return _do_getattr(fnode, stbuf); };
+  return withFileNode("fgetattr", path, fi, op);
 }
 
-int encfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                  off_t offset, struct fuse_file_info *finfo) {
+int encfs_opendir(const char *path, struct fuse_file_info *fi) {
+  Stats::Timer timer(Stats::Opendir);
   EncFS_Context *ctx = context();
 
-  //unused parameters
-  (void)offset;
-  (void)finfo;
-
   int res = ESUCCESS;
   std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
   if (!FSRoot) {
@@ -252,31 +627,71 @@ int encfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
   }
 
   try {
+    std::shared_ptr<const DirListing> listing = FSRoot->listDir(path, &res);
+    if (!listing) {
+      VLOG(1) << "opendir error on " << FSRoot->cipherPath(path) << ": "
+              << strerror(-res);
+      return res;
+    }
+    fi->fh = ctx->putDirListing(listing);
+    return ESUCCESS;
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "Error caught in opendir";
+    return -EIO;
+  }
+}
+
+/*
+    The listing is taken in opendir() (and again when the kernel comes back
+    to offset 0 after a rewinddir()), and each entry is passed to the kernel with the offset of
+    the next one, so a listing which doesn't fit the kernel buffer is
+    continued where it stopped rather than decoded again from the start.
+*/
+int encfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                  off_t offset, struct fuse_file_info *finfo) {
+  Stats::Timer timer(Stats::Readdir);
+  EncFS_Context *ctx = context();
 
-    DirTraverse dt = FSRoot->openDir(path);
+  int res = ESUCCESS;
+  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) {
+    return res;
+  }
 
-    VLOG(1) << "readdir on " << FSRoot->cipherPath(path);
+  try {
+    std::shared_ptr<const DirListing> listing;
+    uint64_t fh = (finfo != nullptr) ? finfo->fh : 0;
+    if (fh != 0) {
+      bool unread = false;
+      listing = ctx->lookupDirListing(fh, &unread);
+      if (offset == 0 && !unread) {
+        listing.reset();  // rewinddir(), list again
+      }
+    }
+    if (!listing) {
+      listing = FSRoot->listDir(path);
+      if (fh != 0 && listing) {
+        ctx->replaceDirListing(fh, listing);
+      }
+    }
 
-    if (dt.valid()) {
-      int fileType = 0;
-      ino_t inode = 0;
+    VLOG(1) << "readdir on " << FSRoot->cipherPath(path) << " from " << offset;
 
-      std::string name = dt.nextPlaintextName(&fileType, &inode);
-      while (!name.empty()) {
+    if (listing) {
+      for (size_t i = (offset > 0) ? (size_t)offset : 0; i < listing->size();
+           ++i) {
+        const DirEntry &entry = (*listing)[i];
         struct stat st;
-        st.st_ino = inode;
-        st.st_mode = fileType << 12;
+        st.st_ino = entry.inode;
+        st.st_mode = entry.fileType << 12;
 
-// TODO: add offset support.
 #if defined(fuse_fill_dir_flags)
-        if (filler(buf, name.c_str(), &st, 0, 0)) break;
+        if (filler(buf, entry.name.c_str(), &st, i + 1, 0)) break;
 #else
-        if (filler(buf, name.c_str(), &st, 0) != 0) {
+        if (filler(buf, entry.name.c_str(), &st, i + 1) != 0) {
           break;
         }
 #endif
-
-        name = dt.nextPlaintextName(&fileType, &inode);
       }
     } else {
       VLOG(1) << "readdir request invalid, path: '" << path << "'";
@@ -289,6 +704,12 @@ int encfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
   }
 }
 
+int encfs_releasedir(const char *path, struct fuse_file_info *fi) {
+  (void)path;
+  context()->eraseDirListing(fi->fh);
+  return ESUCCESS;
+}
+
 int encfs_mknod(const char *path, mode_t mode, dev_t rdev) {
   EncFS_Context *ctx = context();
 
@@ -315,6 +736,8 @@ int encfs_mknod(const char *path, mode_t mode, dev_t rdev) {
       uid = context->uid;
       gid = context->gid;
     }
+    struct stat parent;
+    bool indexed = FSRoot->parentStamp(path, &parent);
     res = fnode->mknod(mode, rdev, uid, gid);
     // Is this error due to access problems?
     if (ctx->publicFilesystem && -res == EACCES) {
@@ -329,6 +752,9 @@ int encfs_mknod(const char *path, mode_t mode, dev_t rdev) {
         res = fnode->mknod(mode, rdev, uid, st.st_gid);
       }
     }
+    if (res == 0) {
+      FSRoot->created(path, indexed ? &parent : nullptr);
+    }
   } catch (encfs::Error &err) {
     RLOG(ERROR) << "error caught in mknod: " << err.what();
   }
@@ -387,6 +813,11 @@ int encfs_unlink(const char *path) {
     return res;
   }
 
+  res = settleIntents(FSRoot);
+  if (res != ESUCCESS) {
+    return res;
+  }
+
   try {
     // let DirNode handle it atomically so that it can handle race
     // conditions
@@ -397,40 +828,45 @@ int encfs_unlink(const char *path) {
   return res;
 }
 
-int _do_rmdir(EncFS_Context *, const string &cipherPath) {
-  return rmdir(cipherPath.c_str());
-}
-
 int encfs_rmdir(const char *path) {
   EncFS_Context *ctx = context();
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withCipherPath("rmdir", path, bind(_do_rmdir, _1, _2));
+
+  int res = -EIO;
+  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) {
+    return res;
+  }
+
+  try {
+    // DirNode also drops its cached names for the directory
+    res = FSRoot->rmdir(path);
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "error caught in rmdir: " << err.what();
+  }
+  return res;
 }
 
-int _do_readlink(EncFS_Context *ctx, const string &cyName, char *buf,
-                 size_t size) {
+int _do_readlink(EncFS_Context *ctx, const char *cyName, string *target) {
   int res = ESUCCESS;
   std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
   if (!FSRoot) {
     return res;
   }
 
-  res = ::readlink(cyName.c_str(), buf, size - 1);
-
-  if (res == -1) {
+  struct stat st;
+  if (::lstat(cyName, &st) == -1) {
     return -errno;
   }
 
-  buf[res] = '\0';  // ensure null termination
-  string decodedName;
-  decodedName = FSRoot->plainPath(buf);
-
-  if (!decodedName.empty()) {
-    strncpy(buf, decodedName.c_str(), size - 1);
-    buf[size - 1] = '\0';
+  res = FSRoot->readLink(cyName, st, target);
+  if (res != ESUCCESS) {
+    return res;
+  }
 
+  if (!target->empty()) {
     return ESUCCESS;
   }
   RLOG(WARNING) << "Error decoding link";
@@ -438,8 +874,27 @@ int _do_readlink(EncFS_Context *ctx, const string &cyName, char *buf,
 }
 
 int encfs_readlink(const char *path, char *buf, size_t size) {
-  return withCipherPath("readlink", path,
-                        bind(_do_readlink, _1, _2, buf, size));
+  int res = -EIO;
+  std::shared_ptr<DirNode> FSRoot = context()->getRoot(&res);
+  if (!FSRoot) {
+    return res;
+  }
+
+  // readlinks of the path running at once share one lstat and decode
+  InFlight::Result link;
+  res = FSRoot->inFlight().run(
+      InFlight::Link, path, &link, [path](InFlight::Result *out) {
+        auto op = [out](EncFS_Context *ctx, const char *cyName) {
+          return _do_readlink(ctx, cyName, &out->target);
+        };
+        out->res = withCipherPath("readlink", path, op);
+      });
+  if (res != ESUCCESS) {
+    return res;
+  }
+  strncpy(buf, link.target.c_str(), size - 1);
+  buf[size - 1] = '\0';
+  return ESUCCESS;
 }
 
 /**
@@ -484,6 +939,8 @@ int encfs_symlink(const char *to, const char *from) {
         return -EPERM;
       }
     }
+    struct stat parent;
+    bool indexed = FSRoot->parentStamp(from, &parent);
     res = ::symlink(toCName.c_str(), fromCName.c_str());
     if (olduid >= 0) {
       if(setfsuid(olduid) == -1) {
@@ -503,6 +960,7 @@ int encfs_symlink(const char *to, const char *from) {
     if (res == -1) {
       res = -errno;
     } else {
+      FSRoot->created(from, indexed ? &parent : nullptr);
       res = ESUCCESS;
     }
   } catch (encfs::Error &err) {
@@ -545,6 +1003,11 @@ int encfs_rename(const char *from, const char *to) {
     return res;
   }
 
+  res = settleIntents(FSRoot);
+  if (res != ESUCCESS) {
+    return res;
+  }
+
   try {
     res = FSRoot->rename(from, to);
   } catch (encfs::Error &err) {
@@ -553,8 +1016,8 @@ int encfs_rename(const char *from, const char *to) {
   return res;
 }
 
-int _do_chmod(EncFS_Context *, const string &cipherPath, mode_t mode) {
-  return chmod(cipherPath.c_str(), mode);
+int _do_chmod(EncFS_Context *, const char *cipherPath, mode_t mode) {
+  return chmod(cipherPath, mode);
 }
 
 int encfs_chmod(const char *path, mode_t mode) {
@@ -562,11 +1025,16 @@ int encfs_chmod(const char *path, mode_t mode) {
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withCipherPath("chmod", path, bind(_do_chmod, _1, _2, mode));
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_chmod(ctx, cyName, mode);
+  };
+  int res = withCipherPath("chmod", path, op);
+  attrChanged(path);
+  return res;
 }
 
-int _do_chown(EncFS_Context *, const string &cyName, uid_t u, gid_t g) {
-  int res = lchown(cyName.c_str(), u, g);
+int _do_chown(EncFS_Context *, const char *cyName, uid_t u, gid_t g) {
+  int res = lchown(cyName, u, g);
   return (res == -1) ? -errno : ESUCCESS;
 }
 
@@ -575,29 +1043,124 @@ int encfs_chown(const char *path, uid_t uid, gid_t gid) {
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withCipherPath("chown", path, bind(_do_chown, _1, _2, uid, gid));
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_chown(ctx, cyName, uid, gid);
+  };
+  int res = withCipherPath("chown", path, op);
+  attrChanged(path);
+  return res;
 }
 
 int _do_truncate(FileNode *fnode, off_t size) { return fnode->truncate(size); }
 
 int encfs_truncate(const char *path, off_t size) {
   EncFS_Context *ctx = context();
+  // echo name=value > .encfs-control truncates it first
+  if (isControlFile(ctx, path)) {
+    return ESUCCESS;
+  }
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withFileNode("truncate", path, nullptr, bind(_do_truncate, _1, size));
+  int res = settleIntents();
+  if (res != ESUCCESS) {
+    return res;
+  }
+  auto op = [=](FileNode *fnode) -> int { return _do_truncate(fnode, size); };
+  res = withFileNode("truncate", path, nullptr, op);
+  attrChanged(path);
+  return res;
 }
 
 int encfs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
   EncFS_Context *ctx = context();
+  // echo name=value > .encfs-control truncates it first
+  if (isControlFile(ctx, path)) {
+    return ESUCCESS;
+  }
+  if (isReadOnly(ctx)) {
+    return -EROFS;
+  }
+  int res = settleIntents();
+  if (res != ESUCCESS) {
+    return res;
+  }
+  auto op = [=](FileNode *fnode) -> int { return _do_truncate(fnode, size); };
+  res = withFileNode("ftruncate", path, fi, op);
+  attrChanged(path);
+  return res;
+}
+
+int encfs_fallocate(const char *path, int mode, off_t offset, off_t length,
+                    struct fuse_file_info *fi) {
+  EncFS_Context *ctx = context();
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withFileNode("ftruncate", path, fi, bind(_do_truncate, _1, size));
+  // punched holes, and whatever else a mode does
+  int res = mode != 0 ? settleIntents() : ESUCCESS;
+  if (res != ESUCCESS) {
+    return res;
+  }
+  auto op = [=](FileNode *fnode) -> int {
+    return fnode->allocate(mode, offset, length);
+  };
+  res = withFileNode("fallocate", path, fi, op);
+  attrChanged(path);
+  return res;
+}
+
+/*
+    lseek with SEEK_DATA or SEEK_HOLE on an open file, which libfuse 2 has
+    no operation for; the FUSE loop of main.cpp calls this for the requests
+    it answers itself, so there is no FUSE context.  Holes are those which
+    the layers of the file read back as zeros (see FileIO::nextHole), a
+    file of a volume without holes is all data.  Returns the offset found,
+    or -errno.
+*/
+off_t encfs_lseek(EncFS_Context *ctx, uint64_t fh, off_t offset,
+                  int whence) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+    return -EINVAL;
+  }
+  if (offset < 0) {
+    return -ENXIO;
+  }
+  try {
+    // kept alive by the handle, as in withFileNode
+    ctx->markUsed();
+    FileNode *fnode = ctx->borrowFuseFh(fh);
+    if (fnode == nullptr) {
+      return -EBADF;
+    }
+    checkCanary(fnode);
+    VLOG(1) << "op: lseek : " << fnode->cipherName();
+    off_t size = fnode->getSize();
+    if (size < 0 || offset >= size) {
+      return size < 0 ? size : -ENXIO;
+    }
+    if (whence == SEEK_HOLE) {
+      return fnode->nextHole(offset);
+    }
+    off_t data = fnode->nextData(offset);
+    // only a hole up to the end
+    return data >= size ? -ENXIO : data;
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "error caught in lseek: " << err.what();
+    return -EIO;
+  }
+#else
+  (void)ctx;
+  (void)fh;
+  (void)offset;
+  (void)whence;
+  return -ENOSYS;
+#endif
 }
 
-int _do_utime(EncFS_Context *, const string &cyName, struct utimbuf *buf) {
-  int res = utime(cyName.c_str(), buf);
+int _do_utime(EncFS_Context *, const char *cyName, struct utimbuf *buf) {
+  int res = utime(cyName, buf);
   return (res == -1) ? -errno : ESUCCESS;
 }
 
@@ -606,13 +1169,18 @@ int encfs_utime(const char *path, struct utimbuf *buf) {
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withCipherPath("utime", path, bind(_do_utime, _1, _2, buf));
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_utime(ctx, cyName, buf);
+  };
+  int res = withCipherPath("utime", path, op);
+  attrChanged(path);
+  return res;
 }
 
-int _do_utimens(EncFS_Context *, const string &cyName,
+int _do_utimens(EncFS_Context *, const char *cyName,
                 const struct timespec ts[2]) {
 #ifdef HAVE_UTIMENSAT
-  int res = utimensat(AT_FDCWD, cyName.c_str(), ts, AT_SYMLINK_NOFOLLOW);
+  int res = utimensat(AT_FDCWD, cyName, ts, AT_SYMLINK_NOFOLLOW);
 #else
   struct timeval tv[2];
   tv[0].tv_sec = ts[0].tv_sec;
@@ -620,7 +1188,7 @@ int _do_utimens(EncFS_Context *, const string &cyName,
   tv[1].tv_sec = ts[1].tv_sec;
   tv[1].tv_usec = ts[1].tv_nsec / 1000;
 
-  int res = lutimes(cyName.c_str(), tv);
+  int res = lutimes(cyName, tv);
 #endif
   return (res == -1) ? -errno : ESUCCESS;
 }
@@ -630,34 +1198,98 @@ int encfs_utimens(const char *path, const struct timespec ts[2]) {
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withCipherPath("utimens", path, bind(_do_utimens, _1, _2, ts));
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_utimens(ctx, cyName, ts);
+  };
+  int res = withCipherPath("utimens", path, op);
+  attrChanged(path);
+  return res;
+}
+
+// Whether the kernel may keep its pages of the file just opened
+static bool keepPages(EncFS_Context *ctx, const char *path, FileNode *fnode) {
+  if (!ctx->keepCache || !fnode->policy().keepCache) {
+    return false;
+  }
+  struct stat st;
+  return fnode->getAttr(&st) == 0 && S_ISREG(st.st_mode) &&
+         ctx->keepCache->opened(path, st);
+}
+
+// Whether the file just opened bypasses FUSE's page cache (--stream): files
+// of at least streamSize MiB (of the file's policy), and those opened with
+// O_DIRECT
+static bool streamed(int flags, FileNode *fnode) {
+  int minSize = fnode->policy().streamSize;
+  if (minSize < 0) {
+    return false;
+  }
+#if defined(O_DIRECT)
+  if ((flags & O_DIRECT) != 0) {
+    return true;
+  }
+#else
+  (void)flags;
+#endif
+  struct stat st;
+  return minSize == 0 || (fnode->getAttr(&st) == 0 && S_ISREG(st.st_mode) &&
+                          st.st_size >= ((off_t)minSize << 20));
+}
+
+// FileNode only locks the blocks a write touches, so a streamed file also
+// lets the kernel send writes to it in parallel, where libfuse (3.14 on)
+// has the flag.  Otherwise the kernel holds the inode lock for each.
+static void streamFile(struct fuse_file_info *file) {
+  file->direct_io = 1;
+#if defined(FUSE_MAKE_VERSION)
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 14)
+  file->parallel_direct_writes = 1;
+#endif
+#endif
 }
 
 int encfs_open(const char *path, struct fuse_file_info *file) {
+  Stats::Timer timer(Stats::Open);
   EncFS_Context *ctx = context();
 
+  // settings, not data, so also writable on a read-only volume
+  if (isControlFile(ctx, path)) {
+    return controlOpen(ctx, file);
+  }
   if (isReadOnly(ctx) &&
       (((file->flags & O_WRONLY) != 0) || ((file->flags & O_RDWR) != 0))) {
     return -EROFS;
   }
+  if (isStatsFile(path)) {
+    return statsOpen(ctx, file);
+  }
 
   int res = -EIO;
+  OpTrace trace("open", res);
   std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
   if (!FSRoot) {
     return res;
   }
 
   try {
+    // a node of the path released a moment ago may still be closing
+    ctx->waitRetired(path);
     std::shared_ptr<FileNode> fnode =
         FSRoot->openNode(path, "open", file->flags, &res);
 
     if (fnode) {
       VLOG(1) << "encfs_open for " << fnode->cipherName() << ", flags "
               << file->flags;
+      Stats::Trace::setName(fnode->cipherName());
 
       if (res >= 0) {
         ctx->putNode(path, fnode);
         file->fh = fnode->fuseFh;
+        if (streamed(file->flags, fnode.get())) {
+          streamFile(file);
+        } else {
+          file->keep_cache = keepPages(ctx, path, fnode.get());
+        }
         res = ESUCCESS;
       }
     }
@@ -668,21 +1300,86 @@ int encfs_open(const char *path, struct fuse_file_info *file) {
   return res;
 }
 
+/*
+    One lookup and one open(O_CREAT | O_EXCL) for both halves of mknod +
+    open, and the file header is written while the new file is known to be
+    empty.
+*/
 int encfs_create(const char *path, mode_t mode, struct fuse_file_info *file) {
-  int res = encfs_mknod(path, mode, 0);
-  if (res != 0) {
+  Stats::Timer timer(Stats::Open);
+  EncFS_Context *ctx = context();
+
+  if (isReadOnly(ctx)) {
+    return -EROFS;
+  }
+
+  int res = -EIO;
+  OpTrace trace("create", res);
+  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) {
     return res;
   }
 
-  return encfs_open(path, file);
+  try {
+    uid_t uid = 0;
+    gid_t gid = 0;
+    if (ctx->publicFilesystem) {
+      fuse_context *context = fuse_get_context();
+      uid = context->uid;
+      gid = context->gid;
+    }
+    ctx->waitRetired(path);
+    struct stat parent;
+    bool indexed = FSRoot->parentStamp(path, &parent);
+    std::shared_ptr<FileNode> fnode =
+        FSRoot->createNode(path, mode, uid, gid, &res);
+    // Is this error due to access problems?
+    if (!fnode && ctx->publicFilesystem && -res == EACCES) {
+      // try again using the parent dir's group, as for mknod
+      string parentDir = parentDirectory(path);
+      VLOG(1) << "trying public filesystem workaround for " << parentDir;
+      std::shared_ptr<FileNode> dnode =
+          FSRoot->lookupNode(parentDir.c_str(), "create");
+
+      struct stat st;
+      if (dnode->getAttr(&st) == 0) {
+        fnode = FSRoot->createNode(path, mode, uid, st.st_gid, &res);
+      }
+    }
+
+    if (fnode) {
+      VLOG(1) << "encfs_create for " << fnode->cipherName() << ", mode "
+              << mode;
+      Stats::Trace::setName(fnode->cipherName());
+      FSRoot->created(path, indexed ? &parent : nullptr);
+      ctx->putNode(path, fnode);
+      file->fh = fnode->fuseFh;
+      if (streamed(file->flags, fnode.get())) {
+        streamFile(file);
+      }
+      res = ESUCCESS;
+    }
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "error caught in create: " << err.what();
+  }
+
+  return res;
 }
 
 int _do_flush(FileNode *fnode) {
+  int res = fnode->flush();
+  if (res < 0) {
+    return res;
+  }
+
   /* Flush can be called multiple times for an open file, so it doesn't
      close the file.  However it is important to call close() for some
-     underlying filesystems (like NFS).
+     underlying filesystems (like NFS), after anything was written.
   */
-  int res = fnode->open(O_RDONLY);
+  if (!fnode->closeFlushNeeded()) {
+    return 0;
+  }
+  res = fnode->open(O_RDONLY);
   if (res >= 0) {
     int fh = res;
     int nfh = dup(fh);
@@ -700,20 +1397,55 @@ int _do_flush(FileNode *fnode) {
 
 // Called on each close() of a file descriptor
 int encfs_flush(const char *path, struct fuse_file_info *fi) {
-  return withFileNode("flush", path, fi, bind(_do_flush, _1));
+  Stats::Timer timer(Stats::Flush);
+  if (isStatsFile(path) || isControlFile(context(), path)) {
+    return ESUCCESS;
+  }
+  auto op = [=](FileNode *fnode) -> int { return _do_flush(fnode); };
+  return withFileNode("flush", path, fi, op);
 }
 
 /*
-Note: This is advisory -- it might benefit us to keep file nodes around for a
-bit after they are released just in case they are reopened soon.  But that
-requires a cache layer.
+    The node of the last handle of a file is kept for a moment, open, in case
+    the file is opened again soon (see FileNodePool).
  */
 int encfs_release(const char *path, struct fuse_file_info *finfo) {
   EncFS_Context *ctx = context();
+  if (isStatsFile(path) || isControlFile(ctx, path)) {
+    snapshotRelease(finfo);
+    return ESUCCESS;
+  }
 
   try {
     auto fnode = ctx->lookupFuseFh(finfo->fh);
-    ctx->eraseNode(path, fnode);
+    if (fnode) {
+      // flush normally came first, this only catches late writes
+      int res = fnode->flush();
+      if (res < 0) {
+        RLOG(WARNING) << "write back on release failed: " << strerror(-res);
+      }
+      // what was written went through the kernel's pages of the file
+      struct stat st;
+      if (ctx->keepCache && (finfo->flags & O_ACCMODE) != O_RDONLY &&
+          fnode->getAttr(&st) == 0) {
+        ctx->keepCache->written(path, st);
+      }
+    }
+    if (ctx->eraseNode(path, fnode)) {
+      int res = 0;
+      std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res, true);
+      if (FSRoot) {
+        FSRoot->released(path, fnode);
+      }
+      // Unless it was kept for the next open, closing the backing file is
+      // left to the reaper, as it may be slow on a network file system.
+      if (fnode && fnode.use_count() == 1) {
+        ctx->retireNode(path, fnode);
+      }
+    }
+    // the file may have been written to, its attributes weren't cached
+    // while it was open
+    attrChanged(path);
     return ESUCCESS;
   } catch (encfs::Error &err) {
     RLOG(ERROR) << "error caught in release: " << err.what();
@@ -722,18 +1454,31 @@ int encfs_release(const char *path, struct fuse_file_info *finfo) {
 }
 
 ssize_t _do_read(FileNode *fnode, unsigned char *ptr, size_t size, off_t off) {
-  return fnode->read(off, ptr, size);
+  Stats::add(Stats::BytesRequested, size);
+  ssize_t res = fnode->read(off, ptr, size);
+  if (res > 0) {
+    Stats::add(Stats::BytesReturned, res);
+  }
+  return res;
 }
 
 int encfs_read(const char *path, char *buf, size_t size, off_t offset,
                struct fuse_file_info *file) {
+  Stats::Timer timer(Stats::Read);
   // Unfortunately we have to convert from ssize_t (pread) to int (fuse), so
   // let's check this will be OK
   if (size > std::numeric_limits<int>::max()) {
     size = std::numeric_limits<int>::max();
   }
-  return withFileNode("read", path, file,
-                      bind(_do_read, _1, (unsigned char *)buf, size, offset));
+  if (isStatsFile(path) || isControlFile(context(), path)) {
+    return snapshotRead(file, buf, size, offset);
+  }
+  FairScheduler::Slot slot(context()->scheduler.get(),
+                           fuse_get_context()->uid, size);
+  auto op = [=](FileNode *fnode) -> int {
+    return _do_read(fnode, (unsigned char *)buf, size, offset);
+  };
+  return withFileNode("read", path, file, op);
 }
 
 int _do_fsync(FileNode *fnode, int dataSync) {
@@ -741,31 +1486,233 @@ int _do_fsync(FileNode *fnode, int dataSync) {
 }
 
 int encfs_fsync(const char *path, int dataSync, struct fuse_file_info *file) {
+  Stats::Timer timer(Stats::Fsync);
   EncFS_Context *ctx = context();
+  if (isStatsFile(path) || isControlFile(ctx, path)) {
+    return ESUCCESS;
+  }
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withFileNode("fsync", path, file, bind(_do_fsync, _1, dataSync));
+  auto op = [=](FileNode *fnode) -> int { return _do_fsync(fnode, dataSync); };
+  return withFileNode("fsync", path, file, op);
+}
+
+static_assert(FileIO::Normal == ENCFS_READAHEAD_NORMAL &&
+                  FileIO::Sequential == ENCFS_READAHEAD_SEQUENTIAL &&
+                  FileIO::Random == ENCFS_READAHEAD_RANDOM &&
+                  FileIO::Once == ENCFS_READAHEAD_ONCE,
+              "read ahead policies of FileHints.h");
+
+/*
+    The hints of FileHints.h, for the node of the open file.  Anyone who
+    can open the file may give them, like posix_fadvise(2).
+*/
+int encfs_ioctl(const char *path, int cmd, void *arg,
+                struct fuse_file_info *file, unsigned int flags, void *data) {
+  (void)arg;
+  EncFS_Context *ctx = context();
+  if ((flags & FUSE_IOCTL_DIR) != 0 || isStatsFile(path) ||
+      isControlFile(ctx, path)) {
+    return -ENOTTY;
+  }
+  FileIO::Advice advice;
+  off_t offset = 0;
+  off_t length = 0;
+  switch ((unsigned int)cmd) {
+    case ENCFS_IOC_PIN:
+      advice = FileIO::Pin;
+      break;
+    case ENCFS_IOC_UNPIN:
+      advice = FileIO::Unpin;
+      break;
+    case ENCFS_IOC_READAHEAD: {
+      uint32_t policy = *(const uint32_t *)data;
+      if (policy > ENCFS_READAHEAD_ONCE) {
+        return -EINVAL;
+      }
+      advice = (FileIO::Advice)policy;
+      break;
+    }
+    case ENCFS_IOC_PREFETCH: {
+      const struct encfs_range *range = (const struct encfs_range *)data;
+      if (range->offset > (uint64_t)std::numeric_limits<off_t>::max() ||
+          range->length > (uint64_t)std::numeric_limits<off_t>::max()) {
+        return -EINVAL;
+      }
+      advice = FileIO::WillNeed;
+      offset = (off_t)range->offset;
+      length = (off_t)range->length;
+      break;
+    }
+    default:
+      return -ENOTTY;
+  }
+  auto op = [=](FileNode *fnode) -> int {
+    return fnode->advise(advice, offset, length);
+  };
+  return withFileNode("ioctl", path, file, op);
 }
 
 ssize_t _do_write(FileNode *fnode, unsigned char *ptr, size_t size,
                   off_t offset) {
-  return fnode->write(offset, ptr, size);
+  ssize_t res = fnode->write(offset, ptr, size);
+  if (res > 0) {
+    Stats::add(Stats::BytesWritten, res);
+  }
+  return res;
 }
 
 int encfs_write(const char *path, const char *buf, size_t size, off_t offset,
                 struct fuse_file_info *file) {
+  Stats::Timer timer(Stats::Write);
   // Unfortunately we have to convert from ssize_t (pwrite) to int (fuse), so
   // let's check this will be OK
   if (size > std::numeric_limits<int>::max()) {
     size = std::numeric_limits<int>::max();
   }
   EncFS_Context *ctx = context();
+  if (isControlFile(ctx, path)) {
+    return controlWrite(ctx, buf, size);
+  }
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withFileNode("write", path, file,
-                      bind(_do_write, _1, (unsigned char *)buf, size, offset));
+  FairScheduler::Slot slot(ctx->scheduler.get(), fuse_get_context()->uid,
+                           size);
+  auto op = [=](FileNode *fnode) -> int {
+    return _do_write(fnode, (unsigned char *)buf, size, offset);
+  };
+  return withFileNode("write", path, file, op);
+}
+
+/*
+    Plain volumes hand the kernel a reference to the backing file, which
+    libfuse can splice from without the data passing through us.  Otherwise
+    the data is decoded into a buffer which libfuse frees.
+*/
+int encfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                   off_t offset, struct fuse_file_info *file) {
+  Stats::Timer timer(Stats::Read);
+  if (size > std::numeric_limits<int>::max()) {
+    size = std::numeric_limits<int>::max();
+  }
+
+  if (isStatsFile(path) || isControlFile(context(), path)) {
+    struct fuse_bufvec *bv = (struct fuse_bufvec *)malloc(sizeof(*bv));
+    void *mem = malloc(size);
+    if (bv == nullptr || mem == nullptr) {
+      free(bv);
+      free(mem);
+      return -ENOMEM;
+    }
+    int res = snapshotRead(file, (char *)mem, size, offset);
+    if (res < 0) {
+      free(bv);
+      free(mem);
+      return res;
+    }
+    *bv = FUSE_BUFVEC_INIT((size_t)res);
+    bv->buf[0].mem = mem;
+    *bufp = bv;
+    return 0;
+  }
+
+  FairScheduler::Slot slot(context()->scheduler.get(),
+                           fuse_get_context()->uid, size);
+  auto op = [bufp, size, offset](FileNode *fnode) -> int {
+    struct fuse_bufvec *bv = (struct fuse_bufvec *)malloc(sizeof(*bv));
+    if (bv == nullptr) {
+      return -ENOMEM;
+    }
+    *bv = FUSE_BUFVEC_INIT(size);
+
+    off_t dataOffset = 0;
+    int fd = fnode->plainFd(&dataOffset);
+    if (fd >= 0) {
+      bv->buf[0].flags =
+          (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+      bv->buf[0].fd = fd;
+      bv->buf[0].pos = offset + dataOffset;
+      *bufp = bv;
+      return 0;
+    }
+
+    void *mem = malloc(size);
+    if (mem == nullptr) {
+      free(bv);
+      return -ENOMEM;
+    }
+    Stats::add(Stats::BytesRequested, size);
+    ssize_t res = fnode->read(offset, (unsigned char *)mem, size);
+    if (res < 0) {
+      free(mem);
+      free(bv);
+      return res;
+    }
+    Stats::add(Stats::BytesReturned, res);
+    bv->buf[0].mem = mem;
+    bv->buf[0].size = res;
+    *bufp = bv;
+    return 0;
+  };
+  return withFileNode("read_buf", path, file, op);
+}
+
+/*
+    Data spliced in from the kernel is copied once into our own buffer, which
+    is then encoded in place.  Plain memory buffers are written as they are.
+*/
+int encfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                    struct fuse_file_info *file) {
+  Stats::Timer timer(Stats::Write);
+  EncFS_Context *ctx = context();
+  size_t size = fuse_buf_size(buf);
+  if (size > std::numeric_limits<int>::max()) {
+    size = std::numeric_limits<int>::max();
+  }
+
+  if (isControlFile(ctx, path)) {
+    std::string items(size, '\0');
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    dst.buf[0].mem = &items[0];
+    ssize_t res = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags)0);
+    if (res < 0) {
+      return res;
+    }
+    return controlWrite(ctx, items.data(), res);
+  }
+  if (isReadOnly(ctx)) {
+    return -EROFS;
+  }
+
+  FairScheduler::Slot slot(ctx->scheduler.get(), fuse_get_context()->uid,
+                           size);
+  if (buf->count == 1 && (buf->buf[0].flags & FUSE_BUF_IS_FD) == 0) {
+    unsigned char *data = (unsigned char *)buf->buf[0].mem + buf->off;
+    auto op = [=](FileNode *fnode) -> int {
+      return _do_write(fnode, data, size, offset);
+    };
+    return withFileNode("write_buf", path, file, op);
+  }
+
+  auto op = [buf, size, offset](FileNode *fnode) -> int {
+    MemBlock mb = MemoryPool::allocate(size);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    dst.buf[0].mem = mb.data;
+
+    ssize_t res = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags)0);
+    if (res > 0) {
+      const bool inPlace = true;
+      res = fnode->write(offset, mb.data, res, inPlace);
+      if (res > 0) {
+        Stats::add(Stats::BytesWritten, res);
+      }
+    }
+    MemoryPool::release(mb);
+    return res;
+  };
+  return withFileNode("write_buf", path, file, op);
 }
 
 // statfs works even if encfs is detached..
@@ -776,17 +1723,7 @@ int encfs_statfs(const char *path, struct statvfs *st) {
   try {
     (void)path;  // path should always be '/' for now..
     rAssert(st != nullptr);
-    string cyName = ctx->rootCipherDir;
-
-    VLOG(1) << "doing statfs of " << cyName;
-    res = statvfs(cyName.c_str(), st);
-    if (res == 0) {
-      // adjust maximum name length..
-      st->f_namemax = 6 * (st->f_namemax - 2) / 8;  // approx..
-    }
-    if (res == -1) {
-      res = -errno;
-    }
+    res = ctx->statfs(st);
   } catch (encfs::Error &err) {
     RLOG(ERROR) << "error caught in statfs: " << err.what();
   }
@@ -795,11 +1732,17 @@ int encfs_statfs(const char *path, struct statvfs *st) {
 
 #ifdef HAVE_XATTR
 
+// the attributes of ContentHash can't be set, its stored one isn't shown
+static bool reservedXattr(const char *name) {
+  return strcmp(name, ContentHash::AttrName) == 0 ||
+         strcmp(name, ContentHash::StoreName) == 0;
+}
+
 #ifdef XATTR_ADD_OPT
-int _do_setxattr(EncFS_Context *, const string &cyName, const char *name,
+int _do_setxattr(EncFS_Context *, const char *cyName, const char *name,
                  const char *value, size_t size, uint32_t pos) {
   int options = XATTR_NOFOLLOW;
-  return ::setxattr(cyName.c_str(), name, value, size, pos, options);
+  return ::setxattr(cyName, name, value, size, pos, options);
 }
 int encfs_setxattr(const char *path, const char *name, const char *value,
                    size_t size, int flags, uint32_t position) {
@@ -807,14 +1750,22 @@ int encfs_setxattr(const char *path, const char *name, const char *value,
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
+  if (reservedXattr(name)) {
+    return -EPERM;
+  }
   (void)flags;
-  return withCipherPath("setxattr", path, bind(_do_setxattr, _1, _2, name,
-                                               value, size, position));
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_setxattr(ctx, cyName, name, value, size, position);
+  };
+  int res = withCipherPath("setxattr", path, op);
+  attrChanged(path);
+  xattrChanged();
+  return res;
 }
 #else
-int _do_setxattr(EncFS_Context *, const string &cyName, const char *name,
+int _do_setxattr(EncFS_Context *, const char *cyName, const char *name,
                  const char *value, size_t size, int flags) {
-  return ::lsetxattr(cyName.c_str(), name, value, size, flags);
+  return ::lsetxattr(cyName, name, value, size, flags);
 }
 int encfs_setxattr(const char *path, const char *name, const char *value,
                    size_t size, int flags) {
@@ -822,58 +1773,164 @@ int encfs_setxattr(const char *path, const char *name, const char *value,
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
-  return withCipherPath("setxattr", path,
-                        bind(_do_setxattr, _1, _2, name, value, size, flags));
+  if (reservedXattr(name)) {
+    return -EPERM;
+  }
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_setxattr(ctx, cyName, name, value, size, flags);
+  };
+  int res = withCipherPath("setxattr", path, op);
+  attrChanged(path);
+  xattrChanged();
+  return res;
 }
 #endif
 
+// The hash of the plaintext of path, see ContentHash.  Open files are
+// flushed first, so that writes held back by them are in the hash.
+static int getContentHash(const char *path, char *value, size_t size) {
+  EncFS_Context *ctx = context();
+  int res = -EIO;
+  OpTrace trace("getxattr", res);
+  std::shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) {
+    return res;
+  }
+
+  try {
+    const FSConfigPtr &cfg = FSRoot->config();
+    if (cfg->reverseEncryption) {
+      return res = -ENOATTR;
+    }
+    std::shared_ptr<FileNode> fnode = ctx->lookupNode(path);
+    if (fnode) {
+      res = fnode->flush();
+      if (res < 0) {
+        return res;
+      }
+    } else {
+      fnode = FSRoot->openNode(path, "getxattr", O_RDONLY, &res);
+      if (!fnode) {
+        return res;
+      }
+    }
+
+    ContentHash hash(cfg->cipher, cfg->key, cfg->workers.get());
+    auto read = [&](off_t offset, unsigned char *buf, size_t len) {
+      return fnode->read(offset, buf, len);
+    };
+    std::string hex;
+    res = hash.get(fnode->cipherName(), read, !isReadOnly(ctx), &hex);
+    if (res == 0) {
+      if (size == 0) {
+        res = (int)hex.size();
+      } else if (size < hex.size()) {
+        res = -ERANGE;
+      } else {
+        memcpy(value, hex.data(), hex.size());
+        res = (int)hex.size();
+      }
+    }
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "getxattr: error caught: " << err.what();
+  }
+  return res;
+}
+
+// getxattr of a name which the path is known not to have is answered
+// without looking at the backing file, see XattrCache
+template <typename Op>
+static int getxattrCached(const char *path, const char *name, const Op &op) {
+  if (strcmp(name, ContentHash::StoreName) == 0) {
+    return -ENOATTR;
+  }
+  int res = 0;
+  std::shared_ptr<DirNode> FSRoot = context()->getRoot(&res, true);
+  uint64_t generation = 0;
+  if (FSRoot) {
+    if (FSRoot->knownNoXattr(path, name)) {
+      return -ENOATTR;
+    }
+    generation = FSRoot->xattrGeneration();
+  }
+  res = withCipherPath("getxattr", path, op, true);
+  if (res == -ENOATTR && FSRoot) {
+    FSRoot->noteNoXattr(path, name, generation);
+  }
+  return res;
+}
+
 #ifdef XATTR_ADD_OPT
-int _do_getxattr(EncFS_Context *, const string &cyName, const char *name,
+int _do_getxattr(EncFS_Context *, const char *cyName, const char *name,
                  void *value, size_t size, uint32_t pos) {
   int options = XATTR_NOFOLLOW;
-  return ::getxattr(cyName.c_str(), name, value, size, pos, options);
+  return ::getxattr(cyName, name, value, size, pos, options);
 }
 int encfs_getxattr(const char *path, const char *name, char *value, size_t size,
                    uint32_t position) {
-  return withCipherPath(
-      "getxattr", path,
-      bind(_do_getxattr, _1, _2, name, (void *)value, size, position), true);
+  if (strcmp(name, ContentHash::AttrName) == 0) {
+    return getContentHash(path, value, size);
+  }
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_getxattr(ctx, cyName, name, (void *)value, size, position);
+  };
+  return getxattrCached(path, name, op);
 }
 #else
-int _do_getxattr(EncFS_Context *, const string &cyName, const char *name,
+int _do_getxattr(EncFS_Context *, const char *cyName, const char *name,
                  void *value, size_t size) {
-  return ::lgetxattr(cyName.c_str(), name, value, size);
+  return ::lgetxattr(cyName, name, value, size);
 }
 int encfs_getxattr(const char *path, const char *name, char *value,
                    size_t size) {
-  return withCipherPath("getxattr", path,
-                        bind(_do_getxattr, _1, _2, name, (void *)value, size),
-                        true);
+  if (strcmp(name, ContentHash::AttrName) == 0) {
+    return getContentHash(path, value, size);
+  }
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_getxattr(ctx, cyName, name, (void *)value, size);
+  };
+  return getxattrCached(path, name, op);
 }
 #endif
 
-int _do_listxattr(EncFS_Context *, const string &cyName, char *list,
+int _do_listxattr(EncFS_Context *, const char *cyName, char *list,
                   size_t size) {
 #ifdef XATTR_ADD_OPT
   int options = XATTR_NOFOLLOW;
-  int res = ::listxattr(cyName.c_str(), list, size, options);
+  int res = ::listxattr(cyName, list, size, options);
 #else
-  int res = ::llistxattr(cyName.c_str(), list, size);
+  int res = ::llistxattr(cyName, list, size);
 #endif
-  return (res == -1) ? -errno : res;
+  if (res == -1) {
+    return -errno;
+  }
+  // a query of the size may overstate it, by the stored hash
+  if (list != nullptr && size != 0) {
+    size_t skip = strlen(ContentHash::StoreName) + 1;
+    for (char *name = list; name < list + res; name += strlen(name) + 1) {
+      if (strcmp(name, ContentHash::StoreName) == 0) {
+        memmove(name, name + skip, list + res - (name + skip));
+        res -= (int)skip;
+        break;
+      }
+    }
+  }
+  return res;
 }
 
 int encfs_listxattr(const char *path, char *list, size_t size) {
-  return withCipherPath("listxattr", path,
-                        bind(_do_listxattr, _1, _2, list, size), true);
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_listxattr(ctx, cyName, list, size);
+  };
+  return withCipherPath("listxattr", path, op, true);
 }
 
-int _do_removexattr(EncFS_Context *, const string &cyName, const char *name) {
+int _do_removexattr(EncFS_Context *, const char *cyName, const char *name) {
 #ifdef XATTR_ADD_OPT
   int options = XATTR_NOFOLLOW;
-  int res = ::removexattr(cyName.c_str(), name, options);
+  int res = ::removexattr(cyName, name, options);
 #else
-  int res = ::lremovexattr(cyName.c_str(), name);
+  int res = ::lremovexattr(cyName, name);
 #endif
   return (res == -1) ? -errno : res;
 }
@@ -883,11 +1940,183 @@ int encfs_removexattr(const char *path, const char *name) {
   if (isReadOnly(ctx)) {
     return -EROFS;
   }
+  if (reservedXattr(name)) {
+    return -EPERM;
+  }
 
-  return withCipherPath("removexattr", path,
-                        bind(_do_removexattr, _1, _2, name));
+  auto op = [=](EncFS_Context *ctx, const char *cyName) {
+    return _do_removexattr(ctx, cyName, name);
+  };
+  int res = withCipherPath("removexattr", path, op);
+  attrChanged(path);
+  xattrChanged();
+  return res;
 }
 
 #endif  // HAVE_XATTR
 
+/*
+    --optrace: the operations are replaced by ones which call them, and then
+    add the call to the trace of the recorder of the context.  Filesystems
+    mounted without the option don't pay for it.
+*/
+static fuse_operations recordedOps;
+
+static void recordOp(OpRecorder::Op op, const char *path, const char *path2,
+                     uint64_t offset, uint64_t size, int res,
+                     uint64_t start) {
+  const std::shared_ptr<OpRecorder> &recorder = context()->recorder;
+  if (recorder) {
+    recorder->record(op, path, path2, offset, size, res, start);
+  }
+}
+
+template <OpRecorder::Op op, typename Member, Member member>
+struct Recorded;
+
+// calls of which only the path is recorded
+template <OpRecorder::Op op, typename... Args,
+          int (*fuse_operations::*member)(const char *, Args...)>
+struct Recorded<op, int (*fuse_operations::*)(const char *, Args...),
+                member> {
+  static int call(const char *path, Args... args) {
+    uint64_t start = Stats::now();
+    int res = (recordedOps.*member)(path, args...);
+    recordOp(op, path, nullptr, 0, 0, res, start);
+    return res;
+  }
+};
+
+static int recordRead(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.read(path, buf, size, offset, fi);
+  recordOp(OpRecorder::Read, path, nullptr, offset, size, res, start);
+  return res;
+}
+
+static int recordReadBuf(const char *path, struct fuse_bufvec **bufp,
+                         size_t size, off_t offset, struct fuse_file_info *fi) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.read_buf(path, bufp, size, offset, fi);
+  // the bytes read, which the call itself doesn't return
+  int bytes = res == 0 && *bufp != nullptr ? (int)fuse_buf_size(*bufp) : res;
+  recordOp(OpRecorder::Read, path, nullptr, offset, size, bytes, start);
+  return res;
+}
+
+static int recordWrite(const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.write(path, buf, size, offset, fi);
+  recordOp(OpRecorder::Write, path, nullptr, offset, size, res, start);
+  return res;
+}
+
+static int recordWriteBuf(const char *path, struct fuse_bufvec *buf,
+                          off_t offset, struct fuse_file_info *fi) {
+  uint64_t start = Stats::now();
+  size_t size = fuse_buf_size(buf);
+  int res = recordedOps.write_buf(path, buf, offset, fi);
+  recordOp(OpRecorder::Write, path, nullptr, offset, size, res, start);
+  return res;
+}
+
+static int recordTruncate(const char *path, off_t size) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.truncate(path, size);
+  recordOp(OpRecorder::Truncate, path, nullptr, size, 0, res, start);
+  return res;
+}
+
+static int recordFtruncate(const char *path, off_t size,
+                           struct fuse_file_info *fi) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.ftruncate(path, size, fi);
+  recordOp(OpRecorder::Truncate, path, nullptr, size, 0, res, start);
+  return res;
+}
+
+static int recordFallocate(const char *path, int mode, off_t offset,
+                           off_t length, struct fuse_file_info *fi) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.fallocate(path, mode, offset, length, fi);
+  recordOp(OpRecorder::Fallocate, path, nullptr, offset, length, res, start);
+  return res;
+}
+
+// the target of a symlink isn't a path of the filesystem
+static int recordSymlink(const char *to, const char *from) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.symlink(to, from);
+  recordOp(OpRecorder::SymLink, from, nullptr, 0, 0, res, start);
+  return res;
+}
+
+static int recordRename(const char *from, const char *to) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.rename(from, to);
+  recordOp(OpRecorder::Rename, from, to, 0, 0, res, start);
+  return res;
+}
+
+static int recordLink(const char *to, const char *from) {
+  uint64_t start = Stats::now();
+  int res = recordedOps.link(to, from);
+  recordOp(OpRecorder::Link, to, from, 0, 0, res, start);
+  return res;
+}
+
+#define RECORD_PATH(op, name)                                        \
+  if (ops->name != nullptr) {                                        \
+    ops->name = &Recorded<OpRecorder::op, decltype(&fuse_operations::name), \
+                          &fuse_operations::name>::call;             \
+  }
+#define RECORD(name, with)       \
+  if (ops->name != nullptr) {    \
+    ops->name = with;            \
+  }
+
+void encfs_optrace(struct fuse_operations *ops) {
+  recordedOps = *ops;
+  RECORD_PATH(GetAttr, getattr);
+  RECORD_PATH(GetAttr, fgetattr);
+  RECORD_PATH(ReadLink, readlink);
+  RECORD_PATH(MkNod, mknod);
+  RECORD_PATH(MkDir, mkdir);
+  RECORD_PATH(Unlink, unlink);
+  RECORD_PATH(RmDir, rmdir);
+  RECORD_PATH(Chmod, chmod);
+  RECORD_PATH(Chown, chown);
+  RECORD_PATH(Utime, utime);
+  RECORD_PATH(Utime, utimens);
+  RECORD_PATH(Open, open);
+  RECORD_PATH(Create, create);
+  RECORD_PATH(StatFs, statfs);
+  RECORD_PATH(Flush, flush);
+  RECORD_PATH(Release, release);
+  RECORD_PATH(Fsync, fsync);
+  RECORD_PATH(SetXattr, setxattr);
+  RECORD_PATH(GetXattr, getxattr);
+  RECORD_PATH(ListXattr, listxattr);
+  RECORD_PATH(RemoveXattr, removexattr);
+  RECORD_PATH(OpenDir, opendir);
+  RECORD_PATH(ReadDir, readdir);
+  RECORD_PATH(ReleaseDir, releasedir);
+  RECORD_PATH(Ioctl, ioctl);
+  RECORD(read, recordRead);
+  RECORD(read_buf, recordReadBuf);
+  RECORD(write, recordWrite);
+  RECORD(write_buf, recordWriteBuf);
+  RECORD(truncate, recordTruncate);
+  RECORD(ftruncate, recordFtruncate);
+  RECORD(fallocate, recordFallocate);
+  RECORD(symlink, recordSymlink);
+  RECORD(rename, recordRename);
+  RECORD(link, recordLink);
+}
+
+#undef RECORD_PATH
+#undef RECORD
+
 }  // namespace encfs
@@ -30,6 +30,8 @@
 
 namespace encfs {
 
+class EncFS_Context;
+
 #if defined(HAVE_SYS_XATTR_H) | defined(HAVE_ATTR_XATTR_H)
 #define HAVE_XATTR
 #endif
@@ -62,8 +64,10 @@ int encfs_getattr(const char *path, struct stat *stbuf);
 int encfs_fgetattr(const char *path, struct stat *stbuf,
                    struct fuse_file_info *fi);
 int encfs_readlink(const char *path, char *buf, size_t size);
+int encfs_opendir(const char *path, struct fuse_file_info *fi);
 int encfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                   off_t offset, struct fuse_file_info *finfo);
+int encfs_releasedir(const char *path, struct fuse_file_info *fi);
 int encfs_mknod(const char *path, mode_t mode, dev_t rdev);
 int encfs_mkdir(const char *path, mode_t mode);
 int encfs_unlink(const char *path);
@@ -75,6 +79,10 @@ int encfs_chmod(const char *path, mode_t mode);
 int encfs_chown(const char *path, uid_t uid, gid_t gid);
 int encfs_truncate(const char *path, off_t size);
 int encfs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi);
+int encfs_fallocate(const char *path, int mode, off_t offset, off_t length,
+                    struct fuse_file_info *fi);
+off_t encfs_lseek(EncFS_Context *ctx, uint64_t fh, off_t offset,
+                  int whence);
 int encfs_utime(const char *path, struct utimbuf *buf);
 int encfs_open(const char *path, struct fuse_file_info *info);
 int encfs_create(const char *path, mode_t mode, struct fuse_file_info *info);
@@ -83,9 +91,15 @@ int encfs_read(const char *path, char *buf, size_t size, off_t offset,
                struct fuse_file_info *info);
 int encfs_write(const char *path, const char *buf, size_t size, off_t offset,
                 struct fuse_file_info *info);
+int encfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                   off_t offset, struct fuse_file_info *info);
+int encfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                    struct fuse_file_info *info);
 int encfs_statfs(const char *, struct statvfs *fst);
 int encfs_flush(const char *, struct fuse_file_info *info);
 int encfs_fsync(const char *path, int flags, struct fuse_file_info *info);
+int encfs_ioctl(const char *path, int cmd, void *arg,
+                struct fuse_file_info *info, unsigned int flags, void *data);
 
 #ifdef HAVE_XATTR
 
@@ -107,6 +121,9 @@ int encfs_removexattr(const char *path, const char *name);
 
 int encfs_utimens(const char *path, const struct timespec ts[2]);
 
+// Has the calls of ops added to the trace of the context (--optrace)
+void encfs_optrace(struct fuse_operations *ops);
+
 }  // namespace encfs
 
 #endif
@@ -15,11 +15,19 @@
  * more details.
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
 #include <fcntl.h>
+#include <functional>
 #include <getopt.h>
+#include <atomic>
 #include <iostream>
 #include <limits.h>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,14 +41,21 @@
 #include <openssl/ssl.h>
 
 #include "Cipher.h"
+#include "CipherBench.h"
 #include "CipherKey.h"
 #include "Context.h"
 #include "DirNode.h"
 #include "Error.h"
 #include "FSConfig.h"
+#include "FileHints.h"
+#include "FileIO.h"
 #include "FileNode.h"
 #include "FileUtils.h"
 #include "Interface.h"
+#include "OpRecorder.h"
+#include "OpReplay.h"
+#include "StatBatch.h"
+#include "WorkerPool.h"
 #include "autosprintf.h"
 #include "config.h"
 #include "i18n.h"
@@ -65,6 +80,16 @@ static int cmd_encode(int argc, char **argv);
 static int cmd_showcruft(int argc, char **argv);
 static int cmd_cat(int argc, char **argv);
 static int cmd_export(int argc, char **argv);
+static int cmd_import(int argc, char **argv);
+static int cmd_verify(int argc, char **argv);
+static int cmd_migrate(int argc, char **argv);
+static int cmd_cp(int argc, char **argv);
+static int cmd_bench(int argc, char **argv);
+static int cmd_tune(int argc, char **argv);
+static int cmd_replay(int argc, char **argv);
+static int cmd_top(int argc, char **argv);
+static int cmd_hint(int argc, char **argv);
+static int cmd_warm(int argc, char **argv);
 static int cmd_showKey(int argc, char **argv);
 
 struct CommandOpts {
@@ -81,10 +106,11 @@ struct CommandOpts {
     {"showKey", 1, 1, cmd_showKey, "(root dir)",
      // xgroup(usage)
      gettext_noop("  -- show key")},
-    {"passwd", 1, 1, chpasswd, "(root dir)",
+    {"passwd", 1, 2, chpasswd, "[--kdf=argon2id|pbkdf2] (root dir)",
      // xgroup(usage)
      gettext_noop("  -- change password for volume")},
-    {"autopasswd", 1, 1, chpasswdAutomaticly, "(root dir)",
+    {"autopasswd", 1, 2, chpasswdAutomaticly,
+     "[--kdf=argon2id|pbkdf2] (root dir)",
      // xgroup(usage)
      gettext_noop("  -- change password for volume, taking password"
                   " from standard input.\n\tNo prompts are issued.")},
@@ -100,16 +126,56 @@ struct CommandOpts {
      // xgroup(usage)
      gettext_noop("  -- decodes the file and cats it to standard out")},
     {"decode", 1, 100, cmd_decode,
-     "[--extpass=prog] (root dir) [encoded-name ...]",
+     "[--extpass=prog] [--stdin] (root dir) [encoded-name ...]",
      // xgroup(usage)
      gettext_noop("  -- decodes name and prints plaintext version")},
     {"encode", 1, 100, cmd_encode,
-     "[--extpass=prog] (root dir) [plaintext-name ...]",
+     "[--extpass=prog] [--stdin] (root dir) [plaintext-name ...]",
      // xgroup(usage)
      gettext_noop("  -- encodes a filename and print result")},
     {"export", 2, 2, cmd_export, "(root dir) path",
      // xgroup(usage)
      gettext_noop("  -- decrypts a volume and writes results to path")},
+    {"import", 2, 2, cmd_import, "(root dir) path",
+     // xgroup(usage)
+     gettext_noop("  -- encrypts the tree at path into the volume")},
+    {"verify", 1, 4, cmd_verify,
+     "[--extpass=prog] [--sample=percent] (root dir)",
+     // xgroup(usage)
+     gettext_noop("  -- checks the block MACs of every file in the volume")},
+    {"migrate", 2, 2, cmd_migrate, "(root dir) (new root dir)",
+     // xgroup(usage)
+     gettext_noop("  -- moves the files of a volume into a new volume,"
+                  " one at a time")},
+    {"cp", 3, 3, cmd_cp, "(root dir) path newpath",
+     // xgroup(usage)
+     gettext_noop("  -- copies a file within the volume without decoding it")},
+    {"bench", 0, 1, cmd_bench, "[root dir]",
+     // xgroup(usage)
+     gettext_noop("  -- measures the ciphers, and the file system of root dir,"
+                  " on this machine")},
+    {"replay", 2, 4, cmd_replay, "[--fast] [--volume] (trace) (directory)",
+     // xgroup(usage)
+     gettext_noop("  -- plays a trace of encfs --optrace back in directory,"
+                  " or in the volume at directory with --volume")},
+    {"tune", 1, 100, cmd_tune, "(mount point) [name=value ...]",
+     // xgroup(usage)
+     gettext_noop("  -- shows or changes the settings of a volume mounted"
+                  " with --control")},
+    {"top", 1, 2, cmd_top, "(mount point) [seconds]",
+     // xgroup(usage)
+     gettext_noop("  -- shows the busiest files and users of a volume mounted"
+                  " with --hotfiles")},
+    {"warm", 1, 100, cmd_warm, "[--blocks=MiB] (mount point) [path ...]",
+     // xgroup(usage)
+     gettext_noop("  -- fills the caches of a volume mounted with --control"
+                  " with the trees under the paths")},
+    {"hint", 2, 100, cmd_hint,
+     "[--hold] (file) pin|unpin|normal|sequential|random|once|"
+     "prefetch[=offset[:length]] ...",
+     // xgroup(usage)
+     gettext_noop("  -- tells a mounted volume how a file is going to be"
+                  " used")},
     {"--version", 0, 0, showVersion, "",
      // xgroup(usage)
      gettext_noop("  -- print version number and exit")},
@@ -216,13 +282,18 @@ static int showInfo(int argc, char **argv) {
   return EXIT_SUCCESS;
 }
 
-static RootPtr initRootInfo(int &argc, char **&argv) {
+// coded paths kept when translating a stream of them
+static const int StreamPathCache = 1 << 16;
+
+// readStdin, if given, is set by --stdin
+static RootPtr initRootInfo(int &argc, char **&argv,
+                            bool *readStdin = nullptr) {
   RootPtr result;
   std::shared_ptr<EncFS_Opts> opts(new EncFS_Opts());
   opts->createIfNotFound = false;
   opts->checkKey = false;
 
-  static struct option long_options[] = {{"extpass", 1, 0, 'p'}, {"reverse", 0, nullptr, 'r'}, {0, 0, 0, 0}};
+  static struct option long_options[] = {{"extpass", 1, 0, 'p'}, {"reverse", 0, nullptr, 'r'}, {"stdin", 0, nullptr, 's'}, {0, 0, 0, 0}};
 
   for (;;) {
     int option_index = 0;
@@ -237,6 +308,13 @@ static RootPtr initRootInfo(int &argc, char **&argv) {
       case 'r':
         opts->reverseEncryption = true;
         break;
+      case 's':
+        if (readStdin != nullptr) {
+          *readStdin = true;
+          opts->pathCacheSize = StreamPathCache;
+          break;
+        }
+        // fall through
       default:
         RLOG(WARNING) << "getopt error: " << res;
         break;
@@ -264,7 +342,8 @@ static RootPtr initRootInfo(int &argc, char **&argv) {
   return result;
 }
 
-static RootPtr initRootInfo(const char *crootDir) {
+static RootPtr initRootInfo(const char *crootDir,
+                            EncFS_Context *context = ctx.get()) {
   string rootDir(crootDir);
   RootPtr result;
 
@@ -274,8 +353,8 @@ static RootPtr initRootInfo(const char *crootDir) {
     opts->createIfNotFound = false;
     opts->checkKey = false;
 
-    ctx->publicFilesystem = opts->ownerCreate;
-    result = initFS(ctx.get(), opts);
+    context->publicFilesystem = opts->ownerCreate;
+    result = initFS(context, opts);
   }
 
   if (!result)
@@ -301,40 +380,198 @@ static int cmd_showKey(int argc, char **argv) {
   }
 }
 
-static int cmd_decode(int argc, char **argv) {
-  RootPtr rootInfo = initRootInfo(argc, argv);
-  if (!rootInfo) return EXIT_FAILURE;
+// runs fn for 0..count-1, on the volume's workers if it has them
+static void runParallel(const RootPtr &rootInfo, size_t count,
+                        const std::function<void(size_t)> &fn) {
+  if (rootInfo->workers) {
+    rootInfo->workers->parallelFor(count, fn);
+  } else {
+    for (size_t i = 0; i < count; ++i) fn(i);
+  }
+}
+
+// paths read from standard input and translated at a time
+static const size_t StreamBatch = 4096;
+
+/*
+    Prints translate() of each name given, then, with readStdin or without
+    names, of each line of standard input.  Lines are translated in batches
+    on the volume's workers, and printed in the order they were read.  The
+    parents of a path are usually in the path cache from the ones before,
+    so that only its last component is coded.
+*/
+static int translatePaths(
+    const RootPtr &rootInfo, int argc, char **argv, bool readStdin,
+    const std::function<string(const char *)> &translate) {
+  for (int i = 0; i < argc; ++i) {
+    cout << translate(argv[i]) << "\n";
+  }
+  if (argc > 0 && !readStdin) {
+    return EXIT_SUCCESS;
+  }
 
-  if (argc > 0) {
-    for (int i = 0; i < argc; ++i) {
-      string name = rootInfo->root->plainPath(argv[i]);
-      cout << name << "\n";
+  std::vector<string> lines(StreamBatch);
+  std::vector<string> results(StreamBatch);
+  for (;;) {
+    size_t count = 0;
+    while (count < StreamBatch && std::getline(cin, lines[count])) {
+      ++count;
     }
-  } else {
-    char buf[PATH_MAX + 1];
-    while (cin.getline(buf, PATH_MAX)) {
-      cout << rootInfo->root->plainPath(buf) << "\n";
+    runParallel(rootInfo, count,
+                [&](size_t i) { results[i] = translate(lines[i].c_str()); });
+    for (size_t i = 0; i < count; ++i) {
+      cout << results[i] << "\n";
+    }
+    if (count < StreamBatch) {
+      break;
     }
   }
-  return EXIT_SUCCESS;
+  cout.flush();
+  return cout ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int cmd_decode(int argc, char **argv) {
+  bool readStdin = false;
+  RootPtr rootInfo = initRootInfo(argc, argv, &readStdin);
+  if (!rootInfo) return EXIT_FAILURE;
+
+  const std::shared_ptr<DirNode> &root = rootInfo->root;
+  return translatePaths(
+      rootInfo, argc, argv, readStdin,
+      [&](const char *path) { return root->plainPath(path); });
 }
 
 static int cmd_encode(int argc, char **argv) {
-  RootPtr rootInfo = initRootInfo(argc, argv);
+  bool readStdin = false;
+  RootPtr rootInfo = initRootInfo(argc, argv, &readStdin);
   if (!rootInfo) return EXIT_FAILURE;
 
-  if (argc > 0) {
-    for (int i = 0; i < argc; ++i) {
-      string name = rootInfo->root->cipherPathWithoutRoot(argv[i]);
-      cout << name << "\n";
-    }
-  } else {
-    char buf[PATH_MAX + 1];
-    while (cin.getline(buf, PATH_MAX)) {
-      cout << rootInfo->root->cipherPathWithoutRoot(buf) << "\n";
+  const std::shared_ptr<DirNode> &root = rootInfo->root;
+  return translatePaths(
+      rootInfo, argc, argv, readStdin,
+      [&](const char *path) { return root->cipherPathWithoutRoot(path); });
+}
+
+// serializes output of the worker threads
+static std::mutex outputMutex;
+
+// an entry of the volume, found by listVolumeDir
+struct VolumeEntry {
+  string plainPath;
+  string cipherPath;
+  struct stat st;
+};
+
+/*
+    Appends the decodable entries of plainDir, whose backing directory is
+    cipherDir, to out.  Entries are stat'ed relative to the open directory,
+    so neither the plaintext nor the backing path is resolved again for each
+    entry, and all of them are stat'ed as one batch (see StatBatch).
+    Returns 0 or -errno.
+*/
+static int listVolumeDir(const RootPtr &rootInfo, const string &plainDir,
+                         const string &cipherDir,
+                         std::vector<VolumeEntry> *out) {
+  DirTraverse dt = rootInfo->root->openDir(plainDir.c_str());
+  int dirfd = ::open(cipherDir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (!dt.valid() || dirfd < 0) {
+    int eno = dirfd < 0 ? errno : EIO;
+    if (dirfd >= 0) ::close(dirfd);
+    return -eno;
+  }
+
+  DirListing listing;
+  while (dt.nextPlaintextNames(&listing, nullptr, true) > 0) {
+  }
+
+  string plainPrefix = plainDir;
+  if (plainPrefix.empty() || plainPrefix.back() != '/') plainPrefix += '/';
+  string cipherPrefix = cipherDir;
+  if (cipherPrefix.empty() || cipherPrefix.back() != '/') cipherPrefix += '/';
+
+  // stat'ed as one batch, through io_uring where the kernel has it
+  size_t first = out->size();
+  std::vector<const DirEntry *> entries;
+  for (const DirEntry &entry : listing) {
+    if (entry.name == "." || entry.name == "..") continue;
+    entries.push_back(&entry);
+  }
+  out->resize(first + entries.size());
+  std::vector<int> results(entries.size());
+  StatBatch batch(true);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    batch.stat(dirfd, entries[i]->coded.c_str(), &(*out)[first + i].st,
+               &results[i]);
+  }
+  batch.run();
+  ::close(dirfd);
+
+  size_t kept = first;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (results[i] != 0) continue;  // removed meanwhile
+    VolumeEntry &v = (*out)[kept++];
+    v.st = (*out)[first + i].st;
+    v.plainPath = plainPrefix + entries[i]->name;
+    v.cipherPath = cipherPrefix + entries[i]->coded;
+  }
+  out->resize(kept);
+  return 0;
+}
+
+typedef std::function<int(const VolumeEntry &entry)> VisitFunc;
+typedef std::function<void(const string &plainDir, const string &cipherDir)>
+    DirFunc;
+
+/*
+    Walks the whole volume a level of directories at a time.  The directories
+    of a level are listed, a group at a time, on the worker threads, then
+    visit is called for all their entries, again in parallel.  So at most a
+    group of listings is held, and a directory always has been visited
+    before any of its entries.  onDir, if set, is called on each directory as
+    it is listed.  Returns EXIT_SUCCESS, or the last failure of visit.
+*/
+static int walkVolume(const RootPtr &rootInfo, const VisitFunc &visit,
+                      const DirFunc &onDir = DirFunc()) {
+  static const size_t GroupSize = 64;
+
+  std::vector<std::pair<string, string>> level;  // (plain, cipher) dirs
+  level.emplace_back("/", rootInfo->root->cipherPath("/"));
+  std::atomic<int> result{EXIT_SUCCESS};
+
+  while (!level.empty()) {
+    std::vector<std::pair<string, string>> next;
+    for (size_t start = 0; start < level.size(); start += GroupSize) {
+      size_t n = std::min(GroupSize, level.size() - start);
+      std::vector<std::vector<VolumeEntry>> lists(n);
+      runParallel(rootInfo, n, [&](size_t i) {
+        const auto &dir = level[start + i];
+        if (onDir) onDir(dir.first, dir.second);
+        int res = listVolumeDir(rootInfo, dir.first, dir.second, &lists[i]);
+        if (res < 0) {
+          std::lock_guard<std::mutex> lock(outputMutex);
+          cerr << "unable to read directory " << dir.first << ": "
+               << strerror(-res) << "\n";
+          result = EXIT_FAILURE;
+        }
+      });
+
+      std::vector<const VolumeEntry *> entries;
+      for (const auto &list : lists) {
+        for (const VolumeEntry &entry : list) {
+          entries.push_back(&entry);
+          if (S_ISDIR(entry.st.st_mode)) {
+            next.emplace_back(entry.plainPath, entry.cipherPath);
+          }
+        }
+      }
+      runParallel(rootInfo, entries.size(), [&](size_t i) {
+        int res = visit(*entries[i]);
+        if (res != EXIT_SUCCESS) result = res;
+      });
     }
+    level.swap(next);
   }
-  return EXIT_SUCCESS;
+  return result;
 }
 
 static int cmd_ls(int argc, char **argv) {
@@ -345,33 +582,36 @@ static int cmd_ls(int argc, char **argv) {
   if (!rootInfo) return EXIT_FAILURE;
 
   // show files in directory
-  {
-    DirTraverse dt = rootInfo->root->openDir("/");
-    if (dt.valid()) {
-      for (string name = dt.nextPlaintextName(); !name.empty();
-           name = dt.nextPlaintextName()) {
-        std::shared_ptr<FileNode> fnode =
-            rootInfo->root->lookupNode(name.c_str(), "encfsctl-ls");
-        struct stat stbuf;
-        fnode->getAttr(&stbuf);
-
-        struct tm stm;
-        localtime_r(&stbuf.st_mtime, &stm);
-        stm.tm_year += 1900;
-        // TODO: when I add "%s" to the end and name.c_str(), I get a
-        // seg fault from within strlen.  Why ???
-        printf("%11i %4i-%02i-%02i %02i:%02i:%02i %s\n", int(stbuf.st_size),
-               int(stm.tm_year), int(stm.tm_mon), int(stm.tm_mday),
-               int(stm.tm_hour), int(stm.tm_min), int(stm.tm_sec),
-               name.c_str());
-      }
-    }
+  std::vector<VolumeEntry> entries;
+  listVolumeDir(rootInfo, "/", rootInfo->root->cipherPath("/"), &entries);
+
+  // the plaintext sizes come from the nodes, which may read file headers
+  runParallel(rootInfo, entries.size(), [&](size_t i) {
+    std::shared_ptr<FileNode> fnode = rootInfo->root->lookupNode(
+        entries[i].plainPath.c_str(), "encfsctl-ls");
+    fnode->getAttr(&entries[i].st);
+  });
+
+  for (const VolumeEntry &entry : entries) {
+    const struct stat &stbuf = entry.st;
+    struct tm stm;
+    localtime_r(&stbuf.st_mtime, &stm);
+    stm.tm_year += 1900;
+    printf("%11i %4i-%02i-%02i %02i:%02i:%02i %s\n", int(stbuf.st_size),
+           int(stm.tm_year), int(stm.tm_mon), int(stm.tm_mday),
+           int(stm.tm_hour), int(stm.tm_min), int(stm.tm_sec),
+           entry.plainPath.c_str() + 1);
   }
 
   return EXIT_SUCCESS;
 }
 
-// apply an operation to every block in the file
+// size of the reads of cat and export
+static const size_t CopyBufferSize = 1 << 20;
+
+// Apply an operation to every block in the file.  Holes of sparse files
+// aren't read, but passed to op.skip(), as are the zero blocks read between
+// them, and op.finish() is called at the end.
 template <typename T>
 int processContents(const std::shared_ptr<EncFS_Root> &rootInfo,
                     const char *path, T &op) {
@@ -399,27 +639,103 @@ int processContents(const std::shared_ptr<EncFS_Root> &rootInfo,
     cerr << "unable to open " << path << "\n";
     return errCode;
   } else {
-    unsigned char buf[512];
-    int blocks = (node->getSize() + sizeof(buf) - 1) / sizeof(buf);
-    // read all the data in blocks
-    for (int i = 0; i < blocks; ++i) {
-      int bytes = node->read(i * sizeof(buf), buf, sizeof(buf));
-      int res = op(buf, bytes);
-      if (res < 0) return res;
+    // large reads are decoded a run of blocks at a time, on several threads
+    std::vector<unsigned char> buf(CopyBufferSize);
+    size_t bs = node->blockSize();
+    // the file takes less space than its size, as files with holes do
+    struct stat st;
+    bool sparse = node->getAttr(&st) == 0 && st.st_blocks * 512 < st.st_size;
+    off_t offset = 0;
+    for (;;) {
+      off_t data = node->nextData(offset);
+      if (data < 0) return (int)data;
+      if (data > offset) {
+        int res = op.skip(data - offset);
+        if (res < 0) return res;
+        offset = data;
+        sparse = true;
+      }
+      ssize_t bytes = node->read(offset, buf.data(), buf.size());
+      if (bytes < 0) return (int)bytes;
+      if (bytes == 0) break;
+
+      // runs of data blocks and of zero blocks
+      size_t done = 0;
+      while (done < (size_t)bytes) {
+        bool zeros = false;
+        size_t end = bytes;
+        if (sparse) {
+          zeros = isZeroBlock(buf.data() + done,
+                              std::min(bs, (size_t)bytes - done));
+          end = done;
+          do {
+            end = std::min(end + bs, (size_t)bytes);
+          } while (end < (size_t)bytes &&
+                   isZeroBlock(buf.data() + end,
+                               std::min(bs, (size_t)bytes - end)) == zeros);
+        }
+        int res = zeros ? op.skip(end - done)
+                        : op(buf.data() + done, (int)(end - done));
+        if (res < 0) return res;
+        done = end;
+      }
+      offset += bytes;
     }
   }
-  return 0;
+  return op.finish();
 }
 
 class WriteOutput {
   int _fd;
+  bool _inHole = false;
 
  public:
   WriteOutput(int fd) { _fd = fd; }
   ~WriteOutput() { close(_fd); }
 
+  // writes all of buf, returns -errno on failure
   int operator()(const void *buf, int count) {
-    return (int)write(_fd, buf, count);
+    _inHole = false;
+    const char *data = (const char *)buf;
+    int done = 0;
+    while (done < count) {
+      ssize_t res = write(_fd, data + done, count - done);
+      if (res < 0) {
+        if (errno == EINTR) continue;
+        return -errno;
+      }
+      done += (int)res;
+    }
+    return done;
+  }
+
+  // Seeks over count bytes of zeros, which leaves a hole in a file.  Pipes,
+  // terminals and files opened for appending get the zeros written.
+  int skip(off_t count) {
+    int flags = fcntl(_fd, F_GETFL);
+    if (flags >= 0 && (flags & O_APPEND) == 0 &&
+        ::lseek(_fd, count, SEEK_CUR) >= 0) {
+      _inHole = true;
+      return 0;
+    }
+    std::vector<unsigned char> zeros(
+        (size_t)std::min(count, (off_t)CopyBufferSize));
+    while (count > 0) {
+      int len = (int)std::min(count, (off_t)zeros.size());
+      int res = (*this)(zeros.data(), len);
+      if (res < 0) return res;
+      count -= len;
+    }
+    return 0;
+  }
+
+  // a hole at the end only counts once the file is extended over it
+  int finish() {
+    if (_inHole) {
+      off_t end = ::lseek(_fd, 0, SEEK_CUR);
+      if (end < 0 || ::ftruncate(_fd, end) != 0) return -errno;
+    }
+    return 0;
   }
 };
 
@@ -490,9 +806,16 @@ static int copyContents(const std::shared_ptr<EncFS_Root> &rootInfo,
       }
     } else {
       int outfd = creat(targetName, st.st_mode);
+      if (outfd < 0) {
+        cerr << "unable to create " << targetName << "\n";
+        return EXIT_FAILURE;
+      }
 
       WriteOutput output(outfd);
-      processContents(rootInfo, encfsName, output);
+      if (processContents(rootInfo, encfsName, output) < 0) {
+        cerr << "unable to copy " << encfsName << "\n";
+        return EXIT_FAILURE;
+      }
     }
   }
   return EXIT_SUCCESS;
@@ -505,109 +828,1033 @@ static bool endsWith(const string &str, char ch) {
     return str[str.length() - 1] == ch;
 }
 
-static int traverseDirs(const std::shared_ptr<EncFS_Root> &rootInfo,
-                        string volumeDir, string destDir) {
-  if (!endsWith(volumeDir, '/')) volumeDir.append("/");
-  if (!endsWith(destDir, '/')) destDir.append("/");
+static int cmd_export(int argc, char **argv) {
+  (void)argc;
 
-  // Lookup directory node so we can create a destination directory
-  // with the same permissions
-  {
-    struct stat st;
-    std::shared_ptr<FileNode> dirNode =
-        rootInfo->root->lookupNode(volumeDir.c_str(), "encfsctl");
-    if (dirNode->getAttr(&st)) return EXIT_FAILURE;
+  RootPtr rootInfo = initRootInfo(argv[1]);
+
+  if (!rootInfo) return EXIT_FAILURE;
 
-    mkdir(destDir.c_str(), st.st_mode);
+  string destDir = argv[2];
+  // if the dir doesn't exist, then create it (with user permission)
+  if (!checkDir(destDir) && !userAllowMkdir(destDir.c_str(), 0700))
+    return EXIT_FAILURE;
+  while (destDir.length() > 1 && endsWith(destDir, '/')) destDir.pop_back();
+
+  // parents are created a level before their contents
+  return walkVolume(rootInfo, [&](const VolumeEntry &entry) {
+    string destName = destDir + entry.plainPath;
+    if (S_ISDIR(entry.st.st_mode)) {
+      if (::mkdir(destName.c_str(), entry.st.st_mode) != 0 && errno != EEXIST) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        cerr << "unable to create directory " << destName << "\n";
+        return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+    } else if (S_ISLNK(entry.st.st_mode)) {
+      return copyLink(entry.st, rootInfo, entry.cipherPath, destName);
+    }
+    return copyContents(rootInfo, entry.plainPath.c_str(), destName.c_str());
+  });
+}
+
+// encrypts the plaintext file "from" into the new volume file "to"
+static int importContents(const std::shared_ptr<EncFS_Root> &rootInfo,
+                          const char *from, const char *to) {
+  int infd = ::open(from, O_RDONLY);
+  if (infd < 0) {
+    cerr << "unable to open " << from << "\n";
+    return EXIT_FAILURE;
   }
 
-  // show files in directory
-  DirTraverse dt = rootInfo->root->openDir(volumeDir.c_str());
-  if (dt.valid()) {
-    for (string name = dt.nextPlaintextName(); !name.empty();
-         name = dt.nextPlaintextName()) {
-      // Recurse to subdirectories
-      if (name != "." && name != "..") {
-        string plainPath = volumeDir + name;
-        string cpath = rootInfo->root->cipherPath(plainPath.c_str());
-        string destName = destDir + name;
-
-        int r = EXIT_SUCCESS;
-        struct stat stBuf;
-        if (!lstat(cpath.c_str(), &stBuf)) {
-          if (S_ISDIR(stBuf.st_mode)) {
-            traverseDirs(rootInfo, (plainPath + '/').c_str(), destName + '/');
-          } else if (S_ISLNK(stBuf.st_mode)) {
-            r = copyLink(stBuf, rootInfo, cpath, destName);
-          } else {
-            r = copyContents(rootInfo, plainPath.c_str(), destName.c_str());
-          }
-        } else {
-          r = EXIT_FAILURE;
-        }
+  struct stat st;
+  int res = fstat(infd, &st);
+  std::shared_ptr<FileNode> node;
+  if (res == 0) {
+    node = rootInfo->root->lookupNode(to, "encfsctl");
+    res = node->mknod((st.st_mode & ~S_IFMT) | S_IFREG, 0);
+    if (res == 0) res = node->open(O_RDWR);
+    if (res >= 0) rootInfo->root->created(to);
+  }
 
-        if (r != EXIT_SUCCESS) return r;
+  if (res >= 0) {
+    // whole blocks per write, so no block is read back and re-encoded
+    size_t bs = node->blockSize();
+    std::vector<unsigned char> buf(std::max(CopyBufferSize / bs, (size_t)1) *
+                                   bs);
+    off_t offset = 0;
+    for (;;) {
+      ssize_t bytes = ::read(infd, buf.data(), buf.size());
+      if (bytes < 0 && errno == EINTR) continue;
+      if (bytes <= 0) {
+        if (bytes < 0) res = -errno;
+        break;
       }
+      // short reads of regular files only happen at the end
+      ssize_t written = node->write(offset, buf.data(), bytes);
+      if (written < 0) {
+        res = (int)written;
+        break;
+      }
+      offset += bytes;
     }
+    if (res >= 0) res = node->flush();
+  }
+  ::close(infd);
+
+  if (res < 0) {
+    cerr << "unable to import " << from << ": " << strerror(-res) << "\n";
+    return EXIT_FAILURE;
   }
   return EXIT_SUCCESS;
 }
 
-static int cmd_export(int argc, char **argv) {
+static int importLink(const std::shared_ptr<EncFS_Root> &rootInfo,
+                      const string &srcName, const string &plainPath) {
+  char buf[PATH_MAX];
+  ssize_t len = ::readlink(srcName.c_str(), buf, sizeof(buf) - 1);
+  if (len < 0) {
+    cerr << "unable to readlink of " << srcName << "\n";
+    return EXIT_FAILURE;
+  }
+  buf[len] = '\0';
+
+  string cpath = rootInfo->root->cipherPath(plainPath.c_str());
+  string target = rootInfo->root->relativeCipherPath(buf);
+  if (::symlink(target.c_str(), cpath.c_str()) == -1) {
+    cerr << "unable to create symlink for " << plainPath << "\n";
+    return EXIT_FAILURE;
+  }
+  rootInfo->root->created(plainPath.c_str());
+  return EXIT_SUCCESS;
+}
+
+// files found by import, copied in parallel
+struct FileBatch {
+  // copied once this many are queued
+  static const size_t BatchSize = 256;
+
+  std::vector<std::pair<string, string>> files;  // (source, volume path)
+  int result = EXIT_SUCCESS;
+};
+
+static int copyFiles(const std::shared_ptr<EncFS_Root> &rootInfo,
+                     FileBatch &pending) {
+  std::vector<int> results(pending.files.size(), EXIT_SUCCESS);
+  runParallel(rootInfo, pending.files.size(), [&](size_t i) {
+    results[i] = importContents(rootInfo, pending.files[i].first.c_str(),
+                                pending.files[i].second.c_str());
+  });
+  pending.files.clear();
+
+  for (int r : results) {
+    if (r != EXIT_SUCCESS) pending.result = r;
+  }
+  return pending.result;
+}
+
+static int importDirs(const std::shared_ptr<EncFS_Root> &rootInfo,
+                      string srcDir, string volumeDir, FileBatch &pending) {
+  if (!endsWith(srcDir, '/')) srcDir.append("/");
+  if (!endsWith(volumeDir, '/')) volumeDir.append("/");
+
+  DIR *dir = ::opendir(srcDir.c_str());
+  if (dir == nullptr) {
+    cerr << "unable to open " << srcDir << "\n";
+    return EXIT_FAILURE;
+  }
+
+  int r = EXIT_SUCCESS;
+  struct dirent *de;
+  while (r == EXIT_SUCCESS && (de = ::readdir(dir)) != nullptr) {
+    string name = de->d_name;
+    if (name == "." || name == "..") continue;
+
+    string srcName = srcDir + name;
+    string plainPath = volumeDir + name;
+
+    struct stat stBuf;
+    if (lstat(srcName.c_str(), &stBuf) != 0) {
+      r = EXIT_FAILURE;
+    } else if (S_ISDIR(stBuf.st_mode)) {
+      int res = rootInfo->root->mkdir(plainPath.c_str(),
+                                      stBuf.st_mode & ~S_IFMT);
+      if (res < 0 && res != -EEXIST) {
+        cerr << "unable to create directory " << plainPath << "\n";
+        r = EXIT_FAILURE;
+      } else {
+        r = importDirs(rootInfo, srcName, plainPath, pending);
+      }
+    } else if (S_ISLNK(stBuf.st_mode)) {
+      r = importLink(rootInfo, srcName, plainPath);
+    } else if (S_ISREG(stBuf.st_mode)) {
+      pending.files.emplace_back(srcName, plainPath);
+      if (pending.files.size() >= FileBatch::BatchSize) {
+        r = copyFiles(rootInfo, pending);
+      }
+    } else {
+      cerr << "skipping special file " << srcName << "\n";
+    }
+  }
+  ::closedir(dir);
+  return r;
+}
+
+/*
+    Writes a plaintext tree into a volume without going through a mount.
+    Files are encoded in parallel on the volume's worker threads.
+*/
+static int cmd_import(int argc, char **argv) {
   (void)argc;
 
   RootPtr rootInfo = initRootInfo(argv[1]);
 
   if (!rootInfo) return EXIT_FAILURE;
 
-  string destDir = argv[2];
-  // if the dir doesn't exist, then create it (with user permission)
-  if (!checkDir(destDir) && !userAllowMkdir(destDir.c_str(), 0700))
+  string srcDir = argv[2];
+  if (!checkDir(srcDir)) return EXIT_FAILURE;
+
+  FileBatch pending;
+  int r = importDirs(rootInfo, srcDir, "/", pending);
+  if (r == EXIT_SUCCESS) r = copyFiles(rootInfo, pending);
+  return r;
+}
+
+// state of a verify run, shared by the worker threads
+static struct VerifyState {
+  int samplePercent = 100;
+  std::atomic<long> files{0};
+  std::atomic<long> blocks{0};
+  std::atomic<long> corrupt{0};
+} verifyState;
+
+static void reportCorrupt(const char *path, off_t block) {
+  std::lock_guard<std::mutex> lock(outputMutex);
+  if (block < 0) {
+    cout << path << ": unreadable\n";
+  } else {
+    cout << path << ": corrupt block " << block << "\n";
+  }
+  ++verifyState.corrupt;
+}
+
+/*
+    Reads the file a run of blocks at a time, so the blocks are checked at
+    the speed of the disk.  Only a run which fails is read again one block at
+    a time, to find the bad blocks.  When sampling, each run is checked with
+    the sample probability.
+*/
+static int verifyContents(const std::shared_ptr<EncFS_Root> &rootInfo,
+                          const char *path) {
+  int res = 0;
+  std::shared_ptr<FileNode> node = rootInfo->root->lookupNode(path, "encfsctl");
+  if (node) res = node->open(O_RDONLY);
+  off_t size = (node && res >= 0) ? node->getSize() : -1;
+  if (size < 0) {
+    reportCorrupt(path, -1);
     return EXIT_FAILURE;
+  }
+  ++verifyState.files;
+
+  off_t bs = node->blockSize();
+  off_t runBlocks = std::max((off_t)(CopyBufferSize / bs), (off_t)1);
+  off_t blocks = (size + bs - 1) / bs;
+  std::vector<unsigned char> buf(runBlocks * bs);
 
-  return traverseDirs(rootInfo, "/", destDir);
+  std::minstd_rand rng(std::random_device{}());
+  std::uniform_int_distribution<int> percent(0, 99);
+
+  int result = EXIT_SUCCESS;
+  for (off_t first = 0; first < blocks; first += runBlocks) {
+    if (verifyState.samplePercent < 100 &&
+        percent(rng) >= verifyState.samplePercent) {
+      continue;
+    }
+    off_t n = std::min(runBlocks, blocks - first);
+    verifyState.blocks += n;
+    if (node->read(first * bs, buf.data(), n * bs) >= 0) continue;
+
+    for (off_t i = first; i < first + n; ++i) {
+      if (node->read(i * bs, buf.data(), bs) < 0) {
+        reportCorrupt(path, i);
+        result = EXIT_FAILURE;
+      }
+    }
+  }
+  return result;
 }
 
-int showcruft(const std::shared_ptr<EncFS_Root> &rootInfo,
-              const char *dirName) {
-  int found = 0;
-  DirTraverse dt = rootInfo->root->openDir(dirName);
-  if (dt.valid()) {
-    bool showedDir = false;
-    for (string name = dt.nextInvalid(); !name.empty();
-         name = dt.nextInvalid()) {
-      string cpath = rootInfo->root->cipherPath(dirName);
-      cpath += '/';
-      cpath += name;
+/*
+    Checks every block of every file in the volume, and lists the ones which
+    fail their MAC check.  Files are checked several at a time.
+*/
+static int cmd_verify(int argc, char **argv) {
+  // --sample is taken out before the options common to all commands
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--sample=", 9)) {
+      int pct = atoi(argv[i] + 9);
+      if (pct < 1 || pct > 100) {
+        cerr << "invalid sample percentage: " << argv[i] + 9 << "\n";
+        return EXIT_FAILURE;
+      }
+      verifyState.samplePercent = pct;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
 
-      if (!showedDir) {
-        // just before showing a list of files in a directory
-        cout << autosprintf(_("In directory %s: \n"), dirName);
-        showedDir = true;
+  RootPtr rootInfo = initRootInfo(argc, argv);
+
+  if (!rootInfo) return EXIT_FAILURE;
+
+  int r = walkVolume(rootInfo, [&](const VolumeEntry &entry) {
+    if (!S_ISREG(entry.st.st_mode)) return EXIT_SUCCESS;
+    return verifyContents(rootInfo, entry.plainPath.c_str());
+  });
+
+  cerr << verifyState.files << " files, " << verifyState.blocks
+       << " blocks checked, " << verifyState.corrupt << " errors found\n";
+  return r;
+}
+
+// writes what processContents reads into a file of another volume
+class NodeOutput {
+  std::shared_ptr<FileNode> _node;
+  off_t _offset = 0;
+  bool _inHole = false;
+
+ public:
+  NodeOutput(std::shared_ptr<FileNode> node) : _node(std::move(node)) {}
+
+  int operator()(unsigned char *buf, int count) {
+    // buf is refilled by the next read, so it may be encoded in place
+    ssize_t res = _node->write(_offset, buf, count, true);
+    if (res < 0) return (int)res;
+    _offset += count;
+    _inHole = false;
+    return count;
+  }
+
+  // holes are left as holes, and a hole at the end by extending the file
+  int skip(off_t count) {
+    _offset += count;
+    _inHole = true;
+    return 0;
+  }
+
+  int finish() {
+    if (!_inHole) return 0;
+    _inHole = false;
+    return _node->truncate(_offset);
+  }
+};
+
+// copies a file into the new volume, then removes it from the old one
+static int migrateFile(const RootPtr &from, const RootPtr &to,
+                       const VolumeEntry &entry) {
+  const char *path = entry.plainPath.c_str();
+  // a temporary name, so a file is never half written under its own name
+  string tmpPath = entry.plainPath + ".migrating";
+  to->root->unlink(tmpPath.c_str());  // left over from an interrupted run
+
+  std::shared_ptr<FileNode> node =
+      to->root->lookupNode(tmpPath.c_str(), "encfsctl");
+  int res = node->mknod(S_IFREG | S_IRUSR | S_IWUSR, 0);
+  if (res == 0) res = node->open(O_RDWR);
+  if (res >= 0) {
+    to->root->created(tmpPath.c_str());
+    NodeOutput output(node);
+    res = processContents(from, path, output);
+    if (res >= 0) res = node->sync(false);
+  }
+  node.reset();
+
+  if (res >= 0) res = to->root->rename(tmpPath.c_str(), path);
+  if (res >= 0) {
+    string cpath = to->root->cipherPath(path);
+    struct timespec times[2] = {entry.st.st_atim, entry.st.st_mtim};
+    if (::chmod(cpath.c_str(), entry.st.st_mode & 07777) != 0 ||
+        ::utimensat(AT_FDCWD, cpath.c_str(), times, 0) != 0) {
+      res = -errno;
+    }
+  }
+  if (res >= 0) res = from->root->unlink(path);
+
+  if (res < 0) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    cerr << "unable to migrate " << path << ": " << strerror(-res) << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int migrateLink(const RootPtr &from, const RootPtr &to,
+                       const VolumeEntry &entry) {
+  std::vector<char> buf(entry.st.st_size + 1, '\0');
+  ssize_t len = ::readlink(entry.cipherPath.c_str(), buf.data(),
+                           entry.st.st_size);
+  int res = 0;
+  if (len < 0) {
+    res = -errno;
+  } else {
+    buf[len] = '\0';
+    string target =
+        to->root->relativeCipherPath(from->root->plainPath(buf.data()).c_str());
+    string cpath = to->root->cipherPath(entry.plainPath.c_str());
+    if (::symlink(target.c_str(), cpath.c_str()) != 0 && errno != EEXIST) {
+      res = -errno;
+    } else {
+      to->root->created(entry.plainPath.c_str());
+      res = from->root->unlink(entry.plainPath.c_str());
+    }
+  }
+
+  if (res < 0) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    cerr << "unable to migrate " << entry.plainPath << ": " << strerror(-res)
+         << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/*
+    Moves the contents of a volume into another one, which may use a
+    different cipher, key or block size.  Files are re-encoded one at a time
+    (several on the worker threads), each removed from the old volume once
+    its copy is in place, so the extra space needed is about that of the
+    files in flight.  An interrupted migration is resumed by running it
+    again.  Neither volume may be mounted meanwhile.
+*/
+static int cmd_migrate(int argc, char **argv) {
+  (void)argc;
+
+  cerr << "Volume " << argv[1] << ":\n";
+  RootPtr from = initRootInfo(argv[1]);
+  if (!from) return EXIT_FAILURE;
+
+  // a volume of its own, as open nodes are tracked by path
+  auto destCtx = std::make_shared<EncFS_Context>();
+  cerr << "Volume " << argv[2] << ":\n";
+  RootPtr to = initRootInfo(argv[2], destCtx.get());
+  if (!to) return EXIT_FAILURE;
+
+  struct stat fromSt, toSt;
+  if (::stat(from->root->rootDirectory().c_str(), &fromSt) != 0 ||
+      ::stat(to->root->rootDirectory().c_str(), &toSt) != 0 ||
+      (fromSt.st_dev == toSt.st_dev && fromSt.st_ino == toSt.st_ino)) {
+    cerr << "the new volume must be in another directory\n";
+    return EXIT_FAILURE;
+  }
+
+  std::mutex dirsMutex;
+  std::vector<string> dirs;  // of the old volume, parents first
+  int r = walkVolume(from, [&](const VolumeEntry &entry) {
+    if (S_ISDIR(entry.st.st_mode)) {
+      {
+        std::lock_guard<std::mutex> lock(dirsMutex);
+        dirs.push_back(entry.plainPath);
       }
-      ++found;
-      cout << cpath << "\n";
+      int res = to->root->mkdir(entry.plainPath.c_str(),
+                                entry.st.st_mode & 07777);
+      if (res < 0 && res != -EEXIST) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        cerr << "unable to create directory " << entry.plainPath << ": "
+             << strerror(-res) << "\n";
+        return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+    } else if (S_ISLNK(entry.st.st_mode)) {
+      return migrateLink(from, to, entry);
+    } else if (S_ISREG(entry.st.st_mode)) {
+      return migrateFile(from, to, entry);
     }
+    std::lock_guard<std::mutex> lock(outputMutex);
+    cerr << "skipping special file " << entry.plainPath << "\n";
+    return EXIT_SUCCESS;
+  });
+
+  // the emptied directories go, deepest first; any left over hold
+  // something which couldn't be moved
+  std::sort(dirs.begin(), dirs.end(), [](const string &a, const string &b) {
+    return std::count(a.begin(), a.end(), '/') >
+           std::count(b.begin(), b.end(), '/');
+  });
+  for (const string &dir : dirs) {
+    from->root->rmdir(dir.c_str());
+  }
+  return r;
+}
 
-    // now go back and look for directories to recurse into..
-    dt = rootInfo->root->openDir(dirName);
-    if (dt.valid()) {
-      for (string name = dt.nextPlaintextName(); !name.empty();
-           name = dt.nextPlaintextName()) {
-        if (name == "." || name == "..") continue;
+/*
+    Copies a file within the volume.  The encrypted file is copied as it is
+    (cloned, where the file system can), which is only possible when its
+    contents don't depend on its name.  Otherwise it is decoded and encoded
+    again under the new name.
+*/
+static int cmd_cp(int argc, char **argv) {
+  (void)argc;
 
-        string plainPath = dirName;
-        plainPath += '/';
-        plainPath += name;
+  RootPtr rootInfo = initRootInfo(argv[1]);
+  if (!rootInfo) return EXIT_FAILURE;
 
-        string cpath = rootInfo->root->cipherPath(plainPath.c_str());
+  string from = argv[2];
+  string to = argv[3];
+  if (from[0] != '/') from.insert(0, "/");
+  if (to[0] != '/') to.insert(0, "/");
 
-        if (isDirectory(cpath.c_str()))
-          found += showcruft(rootInfo, plainPath.c_str());
+  int res = rootInfo->root->copyFile(from.c_str(), to.c_str());
+  if (res == -EXDEV) {
+    struct stat st;
+    res = rootInfo->root->lookupNode(from.c_str(), "encfsctl")->getAttr(&st);
+    std::shared_ptr<FileNode> node;
+    if (res == 0) {
+      node = rootInfo->root->lookupNode(to.c_str(), "encfsctl");
+      res = node->mknod(S_IFREG | (st.st_mode & 07777), 0);
+    }
+    if (res == 0) res = node->open(O_RDWR);
+    if (res >= 0) {
+      rootInfo->root->created(to.c_str());
+      NodeOutput output(node);
+      res = processContents(rootInfo, from.c_str(), output);
+      if (res >= 0) res = node->flush();
+      if (res < 0) rootInfo->root->unlink(to.c_str());
+    }
+  }
+
+  if (res < 0) {
+    cerr << "unable to copy " << from << ": " << strerror(-res) << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// how long every figure of encfsctl bench is measured for
+static const int BenchDurationMs = 50;
+
+static int cmd_bench(int argc, char **argv) {
+  string rootDir;
+  if (argc > 1) {
+    rootDir = argv[1];
+    if (!checkDir(rootDir)) return EXIT_FAILURE;
+  }
+
+  cout << _("Block coding and MACs, in MiB/s:") << "\n";
+  cout << autosprintf("%-10s %5s %6s %10s %10s %10s\n", "cipher", "key",
+                      "block", "encode", "decode", "MAC");
+  for (const Cipher::CipherAlgorithm &alg : Cipher::GetAlgorithmList()) {
+    for (int keySize = alg.keyLength.min(); keySize <= alg.keyLength.max();
+         keySize += std::max(alg.keyLength.inc(), 1)) {
+      std::shared_ptr<Cipher> cipher = Cipher::New(alg.name, keySize);
+      if (!cipher) continue;
+      for (int i = 0; i < BenchBlockSizeCount; ++i) {
+        CipherSpeed speed;
+        if (!alg.blockSize.allowed(BenchBlockSizes[i]) ||
+            !benchCipher(cipher, BenchBlockSizes[i], BenchDurationMs,
+                         &speed)) {
+          continue;
+        }
+        cout << autosprintf("%-10s %5i %6i %10.1f %10.1f %10.1f\n",
+                            alg.name.c_str(), speed.keySize, speed.blockSize,
+                            speed.encode, speed.decode, speed.mac);
       }
     }
   }
 
+  cout << "\n" << _("Block name coding, in names per second:") << "\n";
+  cout << autosprintf("%-10s %5s %10s %10s\n", "cipher", "key", "encode",
+                      "decode");
+  for (const Cipher::CipherAlgorithm &alg : Cipher::GetAlgorithmList()) {
+    std::shared_ptr<Cipher> cipher = Cipher::New(alg.name, -1);
+    NameSpeed speed;
+    if (!cipher || !benchNames(cipher, BenchDurationMs, &speed)) continue;
+    cout << autosprintf("%-10s %5i %10.0f %10.0f\n", alg.name.c_str(),
+                        speed.keySize, speed.encode, speed.decode);
+  }
+
+  if (rootDir.empty()) return EXIT_SUCCESS;
+
+  cout << "\n"
+       << autosprintf(_("Backing file system of %s, in MiB/s:"),
+                      rootDir.c_str())
+       << "\n";
+  cout << autosprintf("%6s %10s %10s\n", "block", "write", "read");
+  for (int i = 0; i < BenchBlockSizeCount; ++i) {
+    IOSpeed speed;
+    int res = benchBackingIO(rootDir, BenchBlockSizes[i], 16, &speed);
+    if (res != 0) {
+      cerr << "unable to write to " << rootDir << ": " << strerror(-res)
+           << "\n";
+      return EXIT_FAILURE;
+    }
+    cout << autosprintf("%6i %10.1f %10.1f\n", speed.blockSize, speed.write,
+                        speed.read);
+  }
+  return EXIT_SUCCESS;
+}
+
+/*
+    Plays back a trace of encfs --optrace, in a directory (which may be the
+    mount point of a volume) or through the library in a volume, and shows
+    how long the calls took then and now.
+*/
+static int cmd_replay(int argc, char **argv) {
+  bool fast = false;
+  bool volume = false;
+  int first = 1;
+  for (; first < argc && strncmp(argv[first], "--", 2) == 0; ++first) {
+    if (strcmp(argv[first], "--fast") == 0) {
+      fast = true;
+    } else if (strcmp(argv[first], "--volume") == 0) {
+      volume = true;
+    } else {
+      cerr << "unknown option " << argv[first] << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc - first != 2) {
+    cerr << "a trace and a directory are needed\n";
+    return EXIT_FAILURE;
+  }
+
+  std::vector<OpRecorder::Record> records;
+  if (!OpRecorder::read(argv[first], &records)) {
+    cerr << "unable to read the trace " << argv[first] << "\n";
+    return EXIT_FAILURE;
+  }
+  string dir = argv[first + 1];
+  if (!checkDir(dir)) return EXIT_FAILURE;
+
+  RootPtr rootInfo;
+  std::unique_ptr<ReplayTarget> target;
+  if (volume) {
+    rootInfo = initRootInfo(dir.c_str());
+    if (!rootInfo) return EXIT_FAILURE;
+    target = ReplayTarget::volume(rootInfo->root);
+  } else {
+    target = ReplayTarget::directory(dir);
+  }
+
+  OpReplay replay(records, target.get());
+  int res = replay.prepare();
+  if (res < 0) {
+    cerr << "unable to create the files of the trace: " << strerror(-res)
+         << "\n";
+    return EXIT_FAILURE;
+  }
+  uint64_t recorded = 0;
+  for (const OpRecorder::Record &rec : records) {
+    recorded = std::max<uint64_t>(recorded, rec.start + rec.micros * 1000ull);
+  }
+  uint64_t elapsed = replay.run(fast);
+
+  cout << autosprintf(_("%zu calls of %zu threads, recorded in %.3f s,"
+                        " replayed in %.3f s"),
+                      records.size(), replay.threads(), recorded / 1e9,
+                      elapsed / 1e9)
+       << "\n\n";
+  cout << autosprintf("%-12s %9s %7s %13s %13s %10s\n", "call", "count",
+                      "failed", "recorded us", "replayed us", "max us");
+  for (int op = 1; op < OpRecorder::OpCount; ++op) {
+    const OpReplay::OpStats &stats = replay.stats(op);
+    if (stats.calls == 0) continue;
+    cout << autosprintf("%-12s %9llu %7llu %13.1f %13.1f %10llu\n",
+                        OpRecorder::opName(op),
+                        (unsigned long long)stats.calls,
+                        (unsigned long long)stats.failed,
+                        (double)stats.recordedMicros / stats.calls,
+                        (double)stats.micros / stats.calls,
+                        (unsigned long long)stats.maxMicros);
+  }
+  return EXIT_SUCCESS;
+}
+
+/*
+    Shows or changes settings of a mounted volume, through the control file
+    of encfs --control.  Each setting is written on its own, so that the
+    error, if any, is reported for the one which failed.
+*/
+static int cmd_tune(int argc, char **argv) {
+  string path = argv[1];
+  if (path.empty() || path[path.length() - 1] != '/') path += '/';
+  path += ".encfs-control";
+
+  if (argc == 2) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      cerr << "unable to open " << path << ": " << strerror(errno) << "\n";
+      return EXIT_FAILURE;
+    }
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+      cout.write(buf, len);
+    }
+    close(fd);
+    return len < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  int fd = open(path.c_str(), O_WRONLY);
+  if (fd < 0) {
+    cerr << "unable to open " << path << ": " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  for (int i = 2; i < argc; ++i) {
+    string item = string(argv[i]) + "\n";
+    if (write(fd, item.data(), item.length()) != (ssize_t)item.length()) {
+      cerr << "unable to set " << argv[i] << ": " << strerror(errno) << "\n";
+      result = EXIT_FAILURE;
+    }
+  }
+  close(fd);
+  return result;
+}
+
+/*
+    Has the daemon of a volume mounted with --control walk the trees under
+    the paths, given relative to the mount point or below it, and fill its
+    caches, through "warm" writes to the control file (see encfs.cpp).
+    Paths go in batches, as FUSE splits large writes, and the blocks of the
+    busiest open files only with the first.  Returns once all is warm.
+*/
+static int cmd_warm(int argc, char **argv) {
+  int first = 1;
+  long mib = 0;
+  if (strncmp(argv[1], "--blocks=", 9) == 0) {
+    mib = atol(argv[1] + 9);
+    ++first;
+  }
+  if (first >= argc) {
+    cerr << "no mount point given\n";
+    return EXIT_FAILURE;
+  }
+  string mount = argv[first];
+  while (mount.length() > 1 && mount[mount.length() - 1] == '/') {
+    mount.erase(mount.length() - 1);
+  }
+  string control = mount + "/.encfs-control";
+
+  std::vector<string> paths;
+  for (int i = first + 1; i < argc; ++i) {
+    string path = argv[i];
+    if (path.find('\n') != string::npos) {
+      cerr << "unable to warm a path with a newline\n";
+      return EXIT_FAILURE;
+    }
+    if (path.compare(0, mount.length(), mount) == 0 &&
+        (path.length() == mount.length() || path[mount.length()] == '/')) {
+      path.erase(0, mount.length());
+    }
+    paths.push_back(path.empty() ? "/" : path);
+  }
+  if (paths.empty()) {
+    paths.push_back("/");
+  }
+
+  int fd = open(control.c_str(), O_WRONLY);
+  if (fd < 0) {
+    cerr << "unable to open " << control << ": " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+  const size_t batch = 64 * 1024;
+  size_t next = 0;
+  int result = EXIT_SUCCESS;
+  while (next < paths.size() && result == EXIT_SUCCESS) {
+    string msg = next == 0 && mib > 0
+                     ? "warm=" + std::to_string(mib) + "\n"
+                     : string("warm\n");
+    do {
+      msg += paths[next++] + "\n";
+    } while (next < paths.size() &&
+             msg.length() + paths[next].length() < batch);
+    if (write(fd, msg.data(), msg.length()) != (ssize_t)msg.length()) {
+      cerr << "unable to warm " << mount << ": " << strerror(errno) << "\n";
+      result = EXIT_FAILURE;
+    }
+  }
+  close(fd);
+  return result;
+}
+
+// the figures of a file or user in the stats file of encfs --hotfiles
+struct HotRow {
+  double ops;
+  double readBytes;
+  double writtenBytes;
+  double cryptoSeconds;
+  double backingBytes;  // read and written on the backing file
+};
+// by cipher name or uid
+using HotTable = std::map<string, HotRow>;
+
+// Reads the encfs_hot_file_* and encfs_hot_user_* gauges of the stats file
+static bool readHotTables(const string &path, HotTable *files,
+                          HotTable *users) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  string report;
+  char buf[4096];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0) {
+    report.append(buf, len);
+  }
+  close(fd);
+  if (len < 0) {
+    return false;
+  }
+
+  files->clear();
+  users->clear();
+  size_t pos = 0;
+  while (pos < report.length()) {
+    size_t end = report.find('\n', pos);
+    if (end == string::npos) end = report.length();
+    string line = report.substr(pos, end - pos);
+    pos = end + 1;
+
+    HotTable *table;
+    if (line.compare(0, 15, "encfs_hot_file_") == 0) {
+      table = files;
+    } else if (line.compare(0, 15, "encfs_hot_user_") == 0) {
+      table = users;
+    } else {
+      continue;
+    }
+    size_t brace = line.find('{');
+    size_t first = line.find("=\"", brace);
+    size_t last = line.find("\"} ", first);
+    if (brace == string::npos || first == string::npos ||
+        last == string::npos) {
+      continue;
+    }
+    string metric = line.substr(15, brace - 15);
+    HotRow &row = (*table)[line.substr(first + 2, last - first - 2)];
+    double value = strtod(line.c_str() + last + 3, nullptr);
+    if (metric == "ops") {
+      row.ops = value;
+    } else if (metric == "read_bytes") {
+      row.readBytes = value;
+    } else if (metric == "written_bytes") {
+      row.writtenBytes = value;
+    } else if (metric == "crypto_seconds") {
+      row.cryptoSeconds = value;
+    } else if (metric == "backing_read_bytes" ||
+               metric == "backing_written_bytes") {
+      row.backingBytes += value;
+    }
+  }
+  return true;
+}
+
+// prints the rows of now which changed most since before, per second
+static void printHotTable(const char *title, const HotTable &now,
+                          const HotTable &before, double seconds,
+                          size_t rows) {
+  std::vector<std::pair<string, HotRow>> changed;
+  for (const auto &it : now) {
+    HotRow row = it.second;
+    auto prev = before.find(it.first);
+    // a key which just took over an entry restarts from the entry's counts
+    if (prev != before.end() && prev->second.ops <= row.ops) {
+      row.ops -= prev->second.ops;
+      row.readBytes -= prev->second.readBytes;
+      row.writtenBytes -= prev->second.writtenBytes;
+      row.cryptoSeconds -= prev->second.cryptoSeconds;
+      row.backingBytes -= prev->second.backingBytes;
+    }
+    if (row.ops > 0) {
+      changed.push_back(std::make_pair(it.first, row));
+    }
+  }
+  std::sort(changed.begin(), changed.end(),
+            [](const std::pair<string, HotRow> &a,
+               const std::pair<string, HotRow> &b) {
+              return a.second.ops > b.second.ops;
+            });
+
+  // amp is the bytes moved on the backing file for each byte asked for
+  cout << autosprintf("%10s %10s %10s %8s %6s  %s\n", "ops/s", "read/s",
+                      "write/s", "crypto", "amp", title);
+  for (size_t i = 0; i < changed.size() && i < rows; ++i) {
+    const HotRow &row = changed[i].second;
+    double bytes = row.readBytes + row.writtenBytes;
+    cout << autosprintf("%10.0f %9.1fM %9.1fM %7.1f%% %6.2f  %s\n",
+                        row.ops / seconds, row.readBytes / seconds / 1e6,
+                        row.writtenBytes / seconds / 1e6,
+                        100 * row.cryptoSeconds / seconds,
+                        bytes > 0 ? row.backingBytes / bytes : 0.0,
+                        changed[i].first.c_str());
+  }
+}
+
+/*
+    A table of the busiest backing files and users of a volume mounted with
+    --hotfiles, of what they did in the last few seconds, refreshed until
+    interrupted.  Figures are estimates, from a sample of the calls (see
+    HotFiles).  When the output isn't a terminal, a single table is printed.
+*/
+static int cmd_top(int argc, char **argv) {
+  string path = argv[1];
+  if (path.empty() || path[path.length() - 1] != '/') path += '/';
+  path += ".encfs-stats";
+  int interval = argc > 2 ? atoi(argv[2]) : 2;
+  if (interval <= 0) interval = 2;
+  bool tty = isatty(STDOUT_FILENO) != 0;
+
+  HotTable files, users, lastFiles, lastUsers;
+  if (!readHotTables(path, &lastFiles, &lastUsers)) {
+    cerr << "unable to read " << path << ": " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+  struct timespec last;
+  clock_gettime(CLOCK_MONOTONIC, &last);
+  for (;;) {
+    sleep(interval);
+    if (!readHotTables(path, &files, &users)) {
+      cerr << "unable to read " << path << ": " << strerror(errno) << "\n";
+      return EXIT_FAILURE;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds =
+        (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+    last = now;
+
+    if (tty) {
+      cout << "\033[H\033[2J";
+    }
+    if (files.empty() && users.empty()) {
+      cout << path << ": nothing tracked, is the volume mounted with "
+           << "--hotfiles?\n";
+    }
+    printHotTable("file", files, lastFiles, seconds, 20);
+    cout << "\n";
+    printHotTable("uid", users, lastUsers, seconds, 10);
+    cout.flush();
+    if (!tty) {
+      return EXIT_SUCCESS;
+    }
+    lastFiles.swap(files);
+    lastUsers.swap(users);
+  }
+}
+
+// issues the ioctl of one hint of cmd_hint, false if the hint is unknown
+static bool sendHint(int fd, const string &hint, int *res) {
+  uint32_t policy;
+  if (hint == "pin") {
+    *res = ioctl(fd, ENCFS_IOC_PIN);
+  } else if (hint == "unpin") {
+    *res = ioctl(fd, ENCFS_IOC_UNPIN);
+  } else if (hint == "normal" || hint == "sequential" || hint == "random" ||
+             hint == "once") {
+    policy = hint == "normal"       ? ENCFS_READAHEAD_NORMAL
+             : hint == "sequential" ? ENCFS_READAHEAD_SEQUENTIAL
+             : hint == "random"     ? ENCFS_READAHEAD_RANDOM
+                                    : ENCFS_READAHEAD_ONCE;
+    *res = ioctl(fd, ENCFS_IOC_READAHEAD, &policy);
+  } else if (hint.compare(0, 8, "prefetch") == 0) {
+    struct encfs_range range = {0, 0};
+    if (hint.length() > 8) {
+      char *end = nullptr;
+      const char *arg = hint.c_str() + 9;
+      range.offset = strtoull(arg, &end, 10);
+      if (hint[8] != '=' || end == arg) {
+        return false;
+      }
+      if (*end == ':') {
+        arg = end + 1;
+        range.length = strtoull(arg, &end, 10);
+        if (end == arg) {
+          return false;
+        }
+      }
+      if (*end != '\0') {
+        return false;
+      }
+    }
+    *res = ioctl(fd, ENCFS_IOC_PREFETCH, &range);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*
+    Gives hints of FileHints.h to the volume a file is mounted from.  They
+    last while the file is open, through any handle, so with --hold the
+    file is kept open until interrupted; otherwise they are for programs
+    which have it open already.
+*/
+static int cmd_hint(int argc, char **argv) {
+  int first = 1;
+  bool hold = false;
+  if (strcmp(argv[1], "--hold") == 0) {
+    hold = true;
+    ++first;
+  }
+  if (argc - first < 2) {
+    cerr << "no file or no hint given\n";
+    return EXIT_FAILURE;
+  }
+  const char *path = argv[first];
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    cerr << "unable to open " << path << ": " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  for (int i = first + 1; i < argc; ++i) {
+    int res = 0;
+    if (!sendHint(fd, argv[i], &res)) {
+      cerr << "unknown hint " << argv[i] << "\n";
+      result = EXIT_FAILURE;
+    } else if (res != 0) {
+      cerr << "unable to give hint " << argv[i] << ": "
+           << (errno == ENOTTY ? "not a file of an encfs volume"
+                               : strerror(errno))
+           << "\n";
+      result = EXIT_FAILURE;
+    }
+  }
+  if (hold && result == EXIT_SUCCESS) {
+    pause();
+  }
+  close(fd);
+  return result;
+}
+
+// lists the undecodable names of a directory, returns how many were found
+static int showcruft(const std::shared_ptr<EncFS_Root> &rootInfo,
+                     const string &dirName, const string &cipherDir) {
+  int found = 0;
+  string out;
+  DirTraverse dt = rootInfo->root->openDir(dirName.c_str());
+  if (dt.valid()) {
+    for (string name = dt.nextInvalid(); !name.empty();
+         name = dt.nextInvalid()) {
+      if (found == 0) {
+        // just before showing a list of files in a directory
+        out += string(
+            autosprintf(_("In directory %s: \n"), dirName.c_str()));
+      }
+      ++found;
+      out += cipherDir;
+      if (!endsWith(cipherDir, '/')) out += '/';
+      out += name;
+      out += '\n';
+    }
+  }
+
+  if (found > 0) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    cout << out;
+  }
   return found;
 }
 
@@ -622,7 +1869,14 @@ static int cmd_showcruft(int argc, char **argv) {
 
   if (!rootInfo) return EXIT_FAILURE;
 
-  int filesFound = showcruft(rootInfo, "/");
+  // directories are searched several at a time
+  std::atomic<int> found{0};
+  walkVolume(
+      rootInfo, [](const VolumeEntry &) { return EXIT_SUCCESS; },
+      [&](const string &plainDir, const string &cipherDir) {
+        found += showcruft(rootInfo, plainDir, cipherDir);
+      });
+  int filesFound = found;
 
   // TODO: the singular version should say "Found an invalid file", but all the
   // translations
@@ -637,7 +1891,29 @@ static int cmd_showcruft(int argc, char **argv) {
 
 static int do_chpasswd(bool useStdin, bool annotate, bool checkOnly, int argc,
                        char **argv) {
-  (void)argc;
+  // --kdf is taken out before the root dir
+  const char *kdf = nullptr;
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--kdf=", 6)) {
+      kdf = argv[i] + 6;
+      if (strcmp(kdf, "argon2id") != 0 && strcmp(kdf, "pbkdf2") != 0) {
+        cerr << "invalid key derivation function: " << kdf << "\n";
+        return EXIT_FAILURE;
+      }
+      if (!strcmp(kdf, "argon2id") && !Argon2::supported()) {
+        cerr << _("Argon2id isn't supported by this build") << "\n";
+        return EXIT_FAILURE;
+      }
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  if (kept != 2) {
+    cerr << _("Incorrect number of arguments") << "\n";
+    return EXIT_FAILURE;
+  }
+
   string rootDir = argv[1];
   if (!checkDir(rootDir)) return EXIT_FAILURE;
 
@@ -683,6 +1959,13 @@ static int do_chpasswd(bool useStdin, bool annotate, bool checkOnly, int argc,
   cout << _("Enter new Encfs password\n");
   // reinitialize salt and iteration count
   config->kdfIterations = 0;  // generate new
+  if (kdf != nullptr) {
+    if (cfgType < Config_V6) {
+      cerr << _("Only version 6 volumes can change the key derivation") << "\n";
+      return EXIT_FAILURE;
+    }
+    config->selectKDF(!strcmp(kdf, "argon2id"));
+  }
 
   if (useStdin) {
     if (annotate) cerr << "$PROMPT$ new_passwd" << endl;
@@ -757,7 +2040,8 @@ int main(int argc, char **argv) {
     argv++;
   }
 
-  if (argc == 2 && !(*argv[1] == '-' && *(argv[1] + 1) == '-')) {
+  if (argc == 2 && !(*argv[1] == '-' && *(argv[1] + 1) == '-') &&
+      strcmp(argv[1], "bench") != 0) {
     // default command when only 1 argument given -- treat the argument as
     // a directory..
     return showInfo(argc, argv);
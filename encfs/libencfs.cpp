@@ -0,0 +1,241 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libencfs.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Context.h"
+#include "DirNode.h"
+#include "Error.h"
+#include "FileNode.h"
+#include "FileUtils.h"
+#include "openssl.h"
+
+using namespace encfs;
+
+struct encfs_volume {
+  std::shared_ptr<EncFS_Context> ctx;
+  RootPtr root;
+  bool readOnly;
+};
+
+struct encfs_file {
+  encfs_volume *volume;
+  std::string path;
+  std::shared_ptr<FileNode> node;
+  // the node is shared by all opens of the file, the kernel would check
+  // the access mode of each
+  bool writable;
+};
+
+namespace {
+
+std::once_flag initOnce;
+
+// what the FUSE wrappers of encfs.cpp do with errors they don't expect
+template <typename F>
+auto guarded(const char *op, F f) -> decltype(f()) {
+  try {
+    return f();
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "error caught in " << op << ": " << err.what();
+    return -EIO;
+  }
+}
+
+}  // namespace
+
+int encfs_volume_open(const char *root_dir, const char *password, int flags,
+                      encfs_volume **volume) {
+  std::call_once(initOnce, []() {
+    initLogging();
+    openssl_init(true);
+  });
+
+  std::string rootDir(root_dir);
+  if (!isDirectory(rootDir.c_str())) {
+    return -ENOENT;
+  }
+  if (rootDir.back() != '/') {
+    rootDir += '/';
+  }
+
+  std::shared_ptr<EncFS_Opts> opts(new EncFS_Opts());
+  opts->rootDir = rootDir;
+  opts->createIfNotFound = false;
+  opts->reverseEncryption = (flags & ENCFS_VOLUME_REVERSE) != 0;
+  opts->readOnly = (flags & ENCFS_VOLUME_READONLY) != 0;
+
+  return guarded("volume_open", [&]() -> int {
+    std::unique_ptr<encfs_volume> v(new encfs_volume);
+    v->ctx = std::make_shared<EncFS_Context>();
+    v->ctx->opts = opts;
+    v->ctx->publicFilesystem = false;
+    std::string pass(password);
+    v->root = initFS(v->ctx.get(), opts, &pass);
+    pass.assign(pass.length(), '\0');
+    if (!v->root || !v->root->root) {
+      return -EACCES;
+    }
+    // initFS turns reverse volumes with unique IVs read only
+    v->readOnly = opts->readOnly;
+    v->ctx->setRoot(v->root->root);
+    *volume = v.release();
+    return 0;
+  });
+}
+
+void encfs_volume_close(encfs_volume *volume) {
+  volume->ctx->setRoot(std::shared_ptr<DirNode>());
+  volume->root.reset();
+  delete volume;
+}
+
+int encfs_stat(encfs_volume *volume, const char *path, struct stat *st) {
+  return guarded("stat", [&]() -> int {
+    // open files may have writes which aren't on disk yet
+    std::shared_ptr<FileNode> node = volume->ctx->lookupNode(path);
+    if (node) {
+      return node->getAttr(st);
+    }
+    return volume->root->root->getAttr(path, st);
+  });
+}
+
+int encfs_readdir(encfs_volume *volume, const char *path,
+                  encfs_dir_filler filler, void *arg) {
+  return guarded("readdir", [&]() -> int {
+    int res = -EIO;
+    std::shared_ptr<const DirListing> listing =
+        volume->root->root->listDir(path, &res);
+    if (!listing) {
+      return res;
+    }
+    for (const DirEntry &entry : *listing) {
+      res = filler(arg, entry.name.c_str(), entry.fileType, entry.inode);
+      if (res != 0) {
+        return res;
+      }
+    }
+    return 0;
+  });
+}
+
+int encfs_file_open(encfs_volume *volume, const char *path, int flags,
+                    mode_t mode, encfs_file **file) {
+  bool writes = (flags & O_ACCMODE) != O_RDONLY ||
+                (flags & (O_CREAT | O_TRUNC)) != 0;
+  if (writes && volume->readOnly) {
+    return -EROFS;
+  }
+
+  return guarded("open", [&]() -> int {
+    const std::shared_ptr<DirNode> &root = volume->root->root;
+    int res = -EIO;
+    std::shared_ptr<FileNode> node;
+    bool created = false;
+    if ((flags & O_CREAT) != 0) {
+      struct stat parent;
+      bool indexed = root->parentStamp(path, &parent);
+      node = root->createNode(path, mode, 0, 0, &res);
+      if (node) {
+        root->created(path, indexed ? &parent : nullptr);
+        created = true;
+      } else if (res != -EEXIST || (flags & O_EXCL) != 0) {
+        return res;
+      }
+    }
+    if (!node) {
+      node = root->openNode(path, "libencfs",
+                            flags & ~(O_CREAT | O_EXCL | O_TRUNC), &res);
+      if (!node || res < 0) {
+        return res < 0 ? res : -EIO;
+      }
+    }
+
+    volume->ctx->putNode(path, node);
+    std::unique_ptr<encfs_file> f(new encfs_file);
+    f->volume = volume;
+    f->path = path;
+    f->node = node;
+    f->writable = (flags & O_ACCMODE) != O_RDONLY;
+    if ((flags & O_TRUNC) != 0 && !created) {
+      res = node->truncate(0);
+      if (res < 0) {
+        encfs_file_close(f.release());
+        return res;
+      }
+    }
+    *file = f.release();
+    return 0;
+  });
+}
+
+ssize_t encfs_pread(encfs_file *file, void *buf, size_t count, off_t offset) {
+  return guarded("read", [&]() -> ssize_t {
+    return file->node->read(offset, (unsigned char *)buf, count);
+  });
+}
+
+ssize_t encfs_pwrite(encfs_file *file, const void *buf, size_t count,
+                     off_t offset) {
+  if (!file->writable) {
+    return -EBADF;
+  }
+  // not inPlace, so the data is only read
+  return guarded("write", [&]() -> ssize_t {
+    return file->node->write(offset, (unsigned char *)buf, count);
+  });
+}
+
+int encfs_fstat(encfs_file *file, struct stat *st) {
+  return guarded("fstat", [&]() -> int { return file->node->getAttr(st); });
+}
+
+int encfs_ftruncate(encfs_file *file, off_t size) {
+  if (!file->writable) {
+    return -EBADF;
+  }
+  return guarded("truncate",
+                 [&]() -> int { return file->node->truncate(size); });
+}
+
+int encfs_fsync(encfs_file *file, int datasync) {
+  return guarded("fsync",
+                 [&]() -> int { return file->node->sync(datasync != 0); });
+}
+
+int encfs_file_close(encfs_file *file) {
+  int res = guarded("close", [&]() -> int {
+    int flushed = file->node->flush();
+    EncFS_Context *ctx = file->volume->ctx.get();
+    const std::shared_ptr<DirNode> &root = file->volume->root->root;
+    if (ctx->eraseNode(file->path.c_str(), file->node)) {
+      root->released(file->path.c_str(), file->node);
+    }
+    // attributes aren't cached while a file is open
+    root->attrChanged(file->path.c_str());
+    return flushed < 0 ? flushed : 0;
+  });
+  delete file;
+  return res;
+}
@@ -0,0 +1,83 @@
+/*****************************************************************************
+ * Copyright (c) 2026, the EncFS contributors
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _libencfs_incl_
+#define _libencfs_incl_
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    In-process access to an EncFS volume, without FUSE: the files are coded
+    by the same DirNode and FileNode as behind a mount, but the data goes
+    straight between the backing files and the caller's buffers, with no
+    kernel round trips and no second copy in the page cache.
+
+    Paths are plaintext paths within the volume, starting with '/'.  All
+    calls return 0 (or a byte count) on success and a negative errno on
+    failure.  A volume and its files may be used from many threads at once;
+    reads and writes of different blocks of one file run concurrently.  A
+    file must not be used after it is closed, nor a volume after it is
+    closed, and all files of a volume must be closed before it is.
+*/
+
+typedef struct encfs_volume encfs_volume;
+typedef struct encfs_file encfs_file;
+
+// flags of encfs_volume_open
+#define ENCFS_VOLUME_READONLY 0x1
+// the volume is the plaintext of a reverse mount (encfs --reverse)
+#define ENCFS_VOLUME_REVERSE 0x2
+
+// Open the volume in root_dir with its password.  The block cache and
+// worker threads are set up as for a mount with the default options.
+// Returns -EACCES if the password is wrong or the volume can't be used.
+int encfs_volume_open(const char *root_dir, const char *password, int flags,
+                      encfs_volume **volume);
+void encfs_volume_close(encfs_volume *volume);
+
+int encfs_stat(encfs_volume *volume, const char *path, struct stat *st);
+
+// Called for each entry of the directory, with its d_type (or 0) and inode.
+// A non-zero return stops the listing, and is returned by encfs_readdir.
+typedef int (*encfs_dir_filler)(void *arg, const char *name, int type,
+                                ino_t inode);
+int encfs_readdir(encfs_volume *volume, const char *path,
+                  encfs_dir_filler filler, void *arg);
+
+// flags as for open(2): the access mode, O_CREAT, O_EXCL and O_TRUNC
+int encfs_file_open(encfs_volume *volume, const char *path, int flags,
+                    mode_t mode, encfs_file **file);
+ssize_t encfs_pread(encfs_file *file, void *buf, size_t count, off_t offset);
+ssize_t encfs_pwrite(encfs_file *file, const void *buf, size_t count,
+                     off_t offset);
+int encfs_fstat(encfs_file *file, struct stat *st);
+int encfs_ftruncate(encfs_file *file, off_t size);
+int encfs_fsync(encfs_file *file, int datasync);
+// writes out buffered data, returning the first error
+int encfs_file_close(encfs_file *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
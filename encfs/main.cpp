@@ -16,33 +16,57 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <exception>
+#include <fcntl.h>
+#include <fstream>
 #include <getopt.h>
 #include <iostream>
 #include <memory>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <sstream>
 #include <string>
 #ifdef __CYGWIN__
 #include <sys/cygwin.h>
 #endif
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
+#include "BlockCache.h"
 #include "Context.h"
+#include "CpuBudget.h"
+#include "DataPool.h"
+#include "DirNode.h"
+#include "EntryTimeouts.h"
 #include "Error.h"
+#include "FairScheduler.h"
 #include "FileUtils.h"
+#include "HotFiles.h"
+#include "IdleMonitor.h"
+#include "KeepCache.h"
 #include "MemoryPool.h"
+#include "MemoryPressure.h"
+#include "NegativeCache.h"
+#include "OpRecorder.h"
+#include "Stats.h"
 #include "autosprintf.h"
 #include "config.h"
 #include "encfs.h"
 #include "fuse.h"
+#include "fuse_lowlevel.h"
 #include "i18n.h"
 #include "openssl.h"
 
@@ -54,6 +78,59 @@
 #define LONG_OPT_NOATTRCACHE 516
 #define LONG_OPT_REQUIRE_MAC 517
 #define LONG_OPT_INSECURE 518
+#define LONG_OPT_BLOCKCACHE 519
+#define LONG_OPT_PATHCACHE 520
+#define LONG_OPT_DIRCACHE 521
+#define LONG_OPT_READAHEAD 522
+#define LONG_OPT_WRITEBACK 523
+#define LONG_OPT_THREADS 524
+#define LONG_OPT_NEGCACHE 525
+#define LONG_OPT_ATTRCACHE 526
+#define LONG_OPT_IVJOURNAL 527
+#define LONG_OPT_STATS 528
+#define LONG_OPT_URING 529
+#define LONG_OPT_DIRECTIO 530
+#define LONG_OPT_DIRINDEX 531
+#define LONG_OPT_KEYRING 532
+#define LONG_OPT_SERVE 533
+#define LONG_OPT_FUSETHREADS 534
+#define LONG_OPT_WRITEBACKCACHE 535
+#define LONG_OPT_BUFFERMEM 536
+#define LONG_OPT_LOCKCACHE 537
+#define LONG_OPT_KERNELCRYPTO 538
+#define LONG_OPT_STATFSCACHE 539
+#define LONG_OPT_DIRFDS 540
+#define LONG_OPT_CACHEPOLICY 541
+#define LONG_OPT_WATCH 542
+#define LONG_OPT_AUTO 543
+#define LONG_OPT_GROUPSYNC 544
+#define LONG_OPT_FAIRSHARE 545
+#define LONG_OPT_FAIRWEIGHT 546
+#define LONG_OPT_NOPRESSURE 547
+#define LONG_OPT_CONTROL 548
+#define LONG_OPT_WARMCACHE 549
+#define LONG_OPT_KEEPCACHE 550
+#define LONG_OPT_DROPBEHIND 551
+#define LONG_OPT_STREAM 552
+#define LONG_OPT_XATTRCACHE 553
+#define LONG_OPT_SLOWLOG 554
+#define LONG_OPT_HOTFILES 555
+#define LONG_OPT_DISKCACHE 556
+#define LONG_OPT_DISKCACHESIZE 557
+#define LONG_OPT_STRIPE 558
+#define LONG_OPT_SHARED 559
+#define LONG_OPT_LOGRATE 560
+#define LONG_OPT_NETFS 561
+#define LONG_OPT_INTENTLOG 562
+#define LONG_OPT_OPTRACE 563
+#define LONG_OPT_ASYNCUNLOCK 564
+#define LONG_OPT_WALKAHEAD 565
+#define LONG_OPT_WRITEBEHIND 566
+#define LONG_OPT_POLICY 567
+#define LONG_OPT_DATATHREADS 568
+#define LONG_OPT_ADAPTIVETTL 569
+#define LONG_OPT_IODEPTH 570
+#define LONG_OPT_BGCPU 571
 
 using namespace std;
 using namespace encfs;
@@ -77,9 +154,19 @@ struct EncFS_Args {
   bool isThreaded;  // true == threaded
   bool isVerbose;   // false == only enable warning/error messages
   int idleTimeout;  // 0 == idle time in minutes to trigger unmount
+  int fuseThreads;  // 0 == libfuse's loop, else pinned FUSE threads
+  int dataThreads;  // 0 == any FUSE thread runs reads and writes
+  bool writebackCache;  // ask for the kernel's write-back cache
+  int adaptiveTtl;  // longest timeout of --adaptivettl, 0 == the mount's
+  unsigned streamRequest;  // FUSE request size for --stream, 0 == default
+  std::string maxReadArg;  // its max_read option, fuseArgv points into it
+  std::string sharedArg;   // the timeouts of --shared, likewise
+  std::string netfsArg;    // and those of --netfs
   const char *fuseArgv[MaxFuseArgs];
   int fuseArgc;
   std::string syslogTag;  // syslog tag to use when logging using syslog
+  int logRate;  // lines below warnings logged a second, 0 == no limit
+  std::string serveFile;  // --serve, lists the volumes to mount
 
   std::shared_ptr<EncFS_Opts> opts;
 
@@ -91,9 +178,24 @@ struct EncFS_Args {
     ostringstream ss;
     ss << (isDaemon ? "(daemon) " : "(fg) ");
     ss << (isThreaded ? "(threaded) " : "(UP) ");
+    if (!serveFile.empty()) {
+      ss << "(serve " << serveFile << ") ";
+    }
     if (idleTimeout > 0) {
       ss << "(timeout " << idleTimeout << ") ";
     }
+    if (fuseThreads > 0) {
+      ss << "(fuseThreads " << fuseThreads << ") ";
+    }
+    if (dataThreads > 0) {
+      ss << "(dataThreads " << dataThreads << ") ";
+    }
+    if (writebackCache) {
+      ss << "(writebackCache) ";
+    }
+    if (adaptiveTtl > 0) {
+      ss << "(adaptiveTtl " << adaptiveTtl << ") ";
+    }
     if (opts->checkKey) {
       ss << "(keyCheck) ";
     }
@@ -112,14 +214,135 @@ struct EncFS_Args {
     if (opts->reverseEncryption) {
       ss << "(reverseEncryption) ";
     }
+    if (opts->watchBacking) {
+      ss << "(watch) ";
+    }
     if (opts->mountOnDemand) {
       ss << "(mountOnDemand) ";
     }
+    if (opts->keyringTimeout > 0) {
+      ss << "(keyring " << opts->keyringTimeout << ") ";
+    }
     if (opts->delayMount) {
       ss << "(delayMount) ";
     }
+    if (opts->unlockTimeout > 0) {
+      ss << "(asyncUnlock " << opts->unlockTimeout << ") ";
+    }
+    if (opts->blockCacheSize > 0) {
+      ss << "(blockCache " << opts->blockCacheSize << ") ";
+      ss << "(readAhead " << opts->readAheadSize << ") ";
+      if (opts->lockBlockCache) {
+        ss << "(lockCache) ";
+      }
+      if (opts->blockCachePolicy == BlockCache::TwoQueue) {
+        ss << "(cachePolicy 2q) ";
+      }
+    }
+    if (opts->writeBackSize > 0) {
+      ss << "(writeBack " << opts->writeBackSize << ") ";
+    }
+    if (!opts->intentLogPath.empty()) {
+      ss << "(intentLog " << opts->intentLogPath << ") ";
+    }
+    ss << "(bufferMem " << opts->bufferMemSize << ") ";
+    if (opts->kernelCrypto) {
+      ss << "(kernelCrypto) ";
+    }
+    if (opts->workerThreads > 0) {
+      ss << "(threads " << opts->workerThreads << ") ";
+    }
+    ss << "(pathCache " << opts->pathCacheSize << ") ";
+    ss << "(dirCache " << opts->dirCacheSize << ") ";
+    if (opts->dirIndexSize > 0) {
+      ss << "(dirIndex " << opts->dirIndexSize << ") ";
+    }
+    ss << "(walkAhead " << opts->walkAhead << ") ";
+    ss << "(negCache " << opts->negativeCacheSize << ") ";
+    ss << "(attrCache " << opts->attrCacheSize << ") ";
+    ss << "(keepCache " << opts->keepCacheSize << ") ";
+    ss << "(xattrCache " << opts->xattrCacheSize << ") ";
+    ss << "(statfsCache " << opts->statfsTimeout << "ms) ";
+    ss << "(dirFds " << opts->dirFdCacheSize << ") ";
+    if (opts->groupSyncWindow >= 0) {
+      ss << "(groupSync " << opts->groupSyncWindow << "us) ";
+    }
+    if (!opts->watchPressure) {
+      ss << "(noPressure) ";
+    }
+    if (opts->warmCache) {
+      ss << "(warmCache) ";
+    }
+    if (opts->ioDepth > 0) {
+      ss << "(ioDepth " << opts->ioDepth;
+      if (opts->deviceIODepth > 0) {
+        ss << ":" << opts->deviceIODepth;
+      }
+      ss << ") ";
+    }
+    if (opts->bgCpu > 0) {
+      ss << "(bgCpu " << opts->bgCpu << ") ";
+    }
+    if (opts->fairShareSlots > 0) {
+      ss << "(fairShare " << opts->fairShareSlots;
+      for (const auto &weight : opts->fairWeights) {
+        ss << " " << weight.first << ":" << weight.second;
+      }
+      ss << ") ";
+    }
+    if (opts->ivJournal) {
+      ss << "(ivJournal) ";
+    }
+    if (opts->stats) {
+      ss << "(stats) ";
+    }
+    if (opts->slowLogMs > 0) {
+      ss << "(slowLog " << opts->slowLogMs << "ms) ";
+    }
+    if (opts->hotFilesSize > 0) {
+      ss << "(hotFiles " << opts->hotFilesSize << ") ";
+    }
+    if (!opts->opTracePath.empty()) {
+      ss << "(opTrace " << opts->opTracePath << ") ";
+    }
+    if (!opts->diskCacheDir.empty()) {
+      ss << "(diskCache " << opts->diskCacheDir << " " << opts->diskCacheSize
+         << "MiB) ";
+    }
+    if (!opts->stripeDirs.empty()) {
+      ss << "(stripes " << opts->stripeDirs.size() + 1 << ") ";
+    }
+    if (!opts->policyFile.empty()) {
+      ss << "(policy " << opts->policyFile << ") ";
+    }
+    if (opts->sharedTimeout > 0) {
+      ss << "(shared " << opts->sharedTimeout << "s) ";
+    }
+    if (opts->netfsTimeout > 0) {
+      ss << "(netfs " << opts->netfsTimeout << "s) ";
+    }
+    if (opts->control) {
+      ss << "(control) ";
+    }
+    if (opts->uring) {
+      ss << "(uring) ";
+    }
+    if (opts->directIO) {
+      ss << "(directIO) ";
+    }
+    if (opts->dropBehind) {
+      ss << "(dropBehind) ";
+    }
+    if (opts->writeBehind > 0) {
+      ss << "(writeBehind " << opts->writeBehind << "MiB) ";
+    }
+    if (opts->streamSize >= 0) {
+      ss << "(stream " << opts->streamSize << "MiB) ";
+    }
     for (int i = 0; i < fuseArgc; ++i) {
-      ss << fuseArgv[i] << ' ';
+      if (fuseArgv[i] != nullptr) {
+        ss << fuseArgv[i] << ' ';
+      }
     }
     return ss.str();
   }
@@ -129,6 +352,16 @@ struct EncFS_Args {
 
 static int oldStderr = STDERR_FILENO;
 
+// unmounts idle mounts, one thread for all mounts of the process
+static IdleMonitor idleMonitor;
+
+// derives the key of --asyncunlock, started by encfs_init
+static pthread_t unlockThread;
+static bool unlockStarted = false;
+
+// when the mount was handed over to FUSE, for the FuseSetup phase
+static std::atomic<uint64_t> fuseStarted(0);
+
 }  // namespace encfs
 
 static void usage(const char *name) {
@@ -164,14 +397,147 @@ static void usage(const char *name) {
        << _("  --public\t\t"
             "act as a typical multi-user filesystem\n"
             "\t\t\t(encfs must be run as root)\n")
+       << _("  --keyring=SECONDS\t"
+            "with --ondemand, keep the volume key in the kernel\n"
+            "\t\t\tkeyring for SECONDS after an idle unmount\n")
+       << _("  --asyncunlock=SEC	"
+            "mount at once and derive the key meanwhile, calls\n"
+            "\t\t\twait up to SEC seconds for it (needs --extpass)\n")
+       << _("  --auto\t\t"
+            "when creating a volume, pick the fastest cipher and\n"
+            "\t\t\tblock size for --standard (or --paranoia)\n")
        << _("  --reverse\t\t"
             "reverse encryption\n")
        << _("  --reversewrite\t\t"
             "reverse encryption with writes enabled\n")
+       << _("  --watch		"
+            "follow changes made to rootdir by others, so that\n"
+            "\t\t\tcaches can stay on in reverse mode\n")
+       << _("  --blockcache=MiB\t"
+            "cache up to MiB of decoded file blocks\n")
+       << _("  --lockcache\t\t"
+            "keep the block cache out of swap\n")
+       << _("  --cachepolicy=NAME\t"
+            "block cache eviction policy, lru (default) or 2q\n")
+       << _("  --readahead=KiB	"
+            "read up to KiB ahead of sequential reads into the\n"
+            "\t\t\tblock cache (0 to disable)\n")
+       << _("  --writeback=KiB	"
+            "buffer up to KiB of small writes per file until\n"
+            "\t\t\tclose or fsync (see the man page)\n")
+       << _("  --intentlog=FILE\t"
+            "log buffered writes to the local FILE, so that\n"
+            "\t\t\tthey survive a crash\n")
+       << _("  --buffermem=MiB\t"
+            "memory for the block buffers of open files\n"
+            "\t\t\t(default: 64, 0 for no limit)\n")
+       << _("  --kernelcrypto\t"
+            "code AES blocks with the kernel crypto API, which\n"
+            "\t\t\tmay use an offload engine\n")
+       << _("  --threads=N		"
+            "use N threads to encode and decode large requests\n"
+            "\t\t\t(default: one per core)\n")
+       << _("  --fusethreads=N\t"
+            "serve FUSE requests with N threads pinned to the\n"
+            "\t\t\tcores (default: threads started as needed)\n")
+       << _("  --datathreads=N\t"
+            "run reads and writes on no more than N FUSE\n"
+            "\t\t\tthreads, with N threads more for them\n")
+       << _("  --writebackcache\t"
+            "let the kernel cache writes and merge small ones\n")
+       << _("  --adaptivettl=SEC\t"
+            "let the kernel keep names and attributes for a\n"
+            "\t\t\ttenth of their age, up to SEC seconds\n")
+       << _("  --pathcache=N\t\t"
+            "cache up to N encoded paths (0 to disable)\n")
+       << _("  --dircache=N\t\t"
+            "cache up to N decoded directory listings (0 to disable)\n")
+       << _("  --dirindex=N\t\t"
+            "keep the listings of directories of N or more entries\n"
+            "\t\t\ton disk (default: 0, off)\n")
+       << _("  --walkahead=N\t\t"
+            "list up to N directories ahead of a tree walk\n"
+            "\t\t\t(default: 8, 0 to disable)\n")
+       << _("  --negcache=N\t\t"
+            "remember up to N paths found missing (0 to disable)\n")
+       << _("  --attrcache=N\t\t"
+            "cache the attributes of up to N paths (0 to disable)\n")
+       << _("  --keepcache=N\t\t"
+            "let the kernel keep the pages of up to N files\n"
+            "\t\t\tover opens while unchanged (0 to disable)\n")
+       << _("  --xattrcache=N\t\t"
+            "remember the missing xattrs of up to N paths (0 to disable)\n")
+       << _("  --statfscache=MS\t"
+            "serve statfs results for MS milliseconds, refreshed\n"
+            "\t\t\tin the background (default: 1000, 0 to disable)\n")
+       << _("  --dirfds=N\t\t"
+            "keep up to N backing directories open (0 to disable)\n")
+       << _("  --groupsync=USEC	"
+            "batch fsyncs arriving within USEC microseconds\n"
+            "\t\t\tinto one flush (default: off)\n")
+       << _("  --nopressure\t\t"
+            "keep the caches at full size under memory pressure\n")
+       << _("  --warmcache\t\t"
+            "refill the caches after mounting with the paths\n"
+            "\t\t\tin use when last unmounted\n")
+       << _("  --fairshare=N\t\t"
+            "run at most N reads and writes at once, shared\n"
+            "\t\t\tfairly between users (default: 0, off)\n")
+       << _("  --fairweight=UID:W\t"
+            "give user UID W shares under --fairshare\n")
+       << _("  --iodepth=N[:D]\t"
+            "read and write backing files N requests at a\n"
+            "\t\t\ttime, D on one device, merging the rest\n")
+       << _("  --bgcpu=N[%]\t\t"
+            "give background work N CPUs, or N% of them,\n"
+            "\t\t\tbacking off when calls slow down\n")
+       << _("  --ivjournal		"
+            "rewrite file headers after renames lazily\n")
+       << _("  --stats		"
+            "serve latency histograms in /.encfs-stats\n")
+       << _("  --slowlog=MS\t\t"
+            "log calls taking MS or longer, with where the time went\n")
+       << _("  --lograte=N\t\t"
+            "log at most N lines below warnings a second\n"
+            "\t\t\t(default: 1000, 0 for no limit)\n")
+       << _("  --hotfiles=N\t\t"
+            "track the N busiest files and users for encfsctl top\n")
+       << _("  --optrace=FILE\t"
+            "record every call, anonymized, in FILE for\n"
+            "\t\t\tencfsctl replay\n")
+       << _("  --control		"
+            "change cache sizes, read ahead and threads\n"
+            "\t\t\twhile mounted through /.encfs-control\n")
+       << _("  --uring		"
+            "read and write backing files through io_uring\n")
+       << _("  --directio		"
+            "bypass the page cache for the backing files\n")
+       << _("  --dropbehind\t\t"
+            "drop the pages of backing files read as a stream\n")
+       << _("  --writebehind=MiB\t"
+            "start writing back backing files MiB behind\n"
+            "\t\t\tthe writes to them (default: 0, off)\n")
+       << _("  --stream=MiB\t\t"
+            "files of at least MiB bypass FUSE's page cache\n")
+       << _("  --diskcache=DIR\t"
+            "keep encrypted data read in DIR on a local disk\n")
+       << _("  --diskcachesize=MiB\t"
+            "size of the --diskcache (default: 1024)\n")
+       << _("  --stripe=DIR\t\t"
+            "spread files over DIR too, may be repeated\n")
+       << _("  --policy=FILE		"
+            "settings of subtrees of the volume, from FILE\n")
+       << _("  --shared=SEC\t\t"
+            "rootdir is shared, see changes of others within SEC\n")
+       << _("  --netfs=SEC\t\t"
+            "rootdir is on NFS/SMB/CephFS, trust attributes for SEC\n")
        << _("  -c, --config=path\t\t"
             "specifies config file (overrides ENV variable)\n")
        << _("  -u, --unmount\t\t"
             "unmounts specified mountPoint\n")
+       << _("  --serve=FILE\t\t"
+            "mount all volumes listed in FILE from one process\n"
+            "\t\t\t(no rootDir and mountPoint are given then)\n")
 
        // xgroup(usage)
        << _("  --extpass=program\tUse external program for password prompt\n"
@@ -210,6 +576,23 @@ static string slashTerminate(const string &src) {
   return result;
 }
 
+// FUSE option for the kernel's negative entries, see NegativeCache
+static const char negativeTimeoutArg[] = "negative_timeout=1";
+static_assert(NegativeCache::Timeout == 1, "negativeTimeoutArg is out of date");
+
+// true if a FUSE option containing name was passed through
+static bool hasFuseOption(const std::shared_ptr<EncFS_Args> &args,
+                          const char *name) {
+  // the mount point's slot is empty until the arguments are parsed
+  for (int i = 0; i < args->fuseArgc; ++i) {
+    if (args->fuseArgv[i] != nullptr &&
+        strstr(args->fuseArgv[i], name) != nullptr) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static bool processArgs(int argc, char *argv[],
                         const std::shared_ptr<EncFS_Args> &out) {
   // set defaults
@@ -217,8 +600,14 @@ static bool processArgs(int argc, char *argv[],
   out->isThreaded = true;
   out->isVerbose = false;
   out->idleTimeout = 0;
+  out->fuseThreads = 0;
+  out->dataThreads = 0;
+  out->writebackCache = false;
+  out->adaptiveTtl = 0;
+  out->streamRequest = 0;
   out->fuseArgc = 0;
   out->syslogTag = "encfs";
+  out->logRate = 1000;
   out->opts->idleTracking = false;
   out->opts->checkKey = true;
   out->opts->forceDecode = false;
@@ -231,6 +620,7 @@ static bool processArgs(int argc, char *argv[],
   out->opts->unmount = false;
 
   bool useDefaultFlags = true;
+  bool noAttrCache = false;  // --nocache or --noattrcache
 
   // pass executable name through
   out->fuseArgv[0] = lastPathElement(argv[0]);
@@ -252,6 +642,8 @@ static bool processArgs(int argc, char *argv[],
       {"no-default-flags", 0, nullptr, 'N'},  // don't use default fuse flags
       {"ondemand", 0, nullptr, 'm'},          // mount on-demand
       {"delaymount", 0, nullptr, 'M'},        // delay initial mount until use
+      {"keyring", 1, nullptr, LONG_OPT_KEYRING},  // keep key over idle unmount
+      {"asyncunlock", 1, nullptr, LONG_OPT_ASYNCUNLOCK},  // key after mount
       {"public", 0, nullptr, 'P'},            // public mode
       {"extpass", 1, nullptr, 'p'},           // external password program
       // {"single-thread", 0, 0, 's'},  // single-threaded mode
@@ -262,16 +654,67 @@ static bool processArgs(int argc, char *argv[],
       {"nocache", 0, nullptr, LONG_OPT_NOCACHE},         // disable all caching
       {"nodatacache", 0, nullptr, LONG_OPT_NODATACACHE}, // disable data caching
       {"noattrcache", 0, nullptr, LONG_OPT_NOATTRCACHE}, // disable attr caching
+      {"blockcache", 1, nullptr, LONG_OPT_BLOCKCACHE},   // block cache size
+      {"lockcache", 0, nullptr, LONG_OPT_LOCKCACHE},     // mlock block cache
+      {"cachepolicy", 1, nullptr, LONG_OPT_CACHEPOLICY},  // eviction policy
+      {"readahead", 1, nullptr, LONG_OPT_READAHEAD},     // read ahead size
+      {"writeback", 1, nullptr, LONG_OPT_WRITEBACK},     // write-back buffer
+      {"intentlog", 1, nullptr, LONG_OPT_INTENTLOG},     // durable write-back
+      {"buffermem", 1, nullptr, LONG_OPT_BUFFERMEM},     // open file buffers
+      {"kernelcrypto", 0, nullptr, LONG_OPT_KERNELCRYPTO},  // AF_ALG blocks
+      {"threads", 1, nullptr, LONG_OPT_THREADS},         // worker threads
+      {"fusethreads", 1, nullptr, LONG_OPT_FUSETHREADS}, // FUSE threads
+      {"datathreads", 1, nullptr, LONG_OPT_DATATHREADS}, // of reads, writes
+      {"writebackcache", 0, nullptr, LONG_OPT_WRITEBACKCACHE},  // kernel cache
+      {"adaptivettl", 1, nullptr, LONG_OPT_ADAPTIVETTL},  // timeouts by age
+      {"pathcache", 1, nullptr, LONG_OPT_PATHCACHE},     // path cache size
+      {"dircache", 1, nullptr, LONG_OPT_DIRCACHE},       // listing cache size
+      {"dirindex", 1, nullptr, LONG_OPT_DIRINDEX},       // listings on disk
+      {"walkahead", 1, nullptr, LONG_OPT_WALKAHEAD},     // list ahead of walks
+      {"negcache", 1, nullptr, LONG_OPT_NEGCACHE},       // missing paths
+      {"attrcache", 1, nullptr, LONG_OPT_ATTRCACHE},     // attribute cache
+      {"keepcache", 1, nullptr, LONG_OPT_KEEPCACHE},     // kernel pages
+      {"xattrcache", 1, nullptr, LONG_OPT_XATTRCACHE},   // missing xattrs
+      {"statfscache", 1, nullptr, LONG_OPT_STATFSCACHE}, // statfs results
+      {"dirfds", 1, nullptr, LONG_OPT_DIRFDS},  // directory descriptors
+      {"groupsync", 1, nullptr, LONG_OPT_GROUPSYNC},     // batched fsyncs
+      {"nopressure", 0, nullptr, LONG_OPT_NOPRESSURE},   // fixed caches
+      {"warmcache", 0, nullptr, LONG_OPT_WARMCACHE},     // saved hot paths
+      {"fairshare", 1, nullptr, LONG_OPT_FAIRSHARE},     // per-user shares
+      {"fairweight", 1, nullptr, LONG_OPT_FAIRWEIGHT},   // weight of a user
+      {"iodepth", 1, nullptr, LONG_OPT_IODEPTH},         // lower requests
+      {"bgcpu", 1, nullptr, LONG_OPT_BGCPU},             // background CPU
+      {"ivjournal", 0, nullptr, LONG_OPT_IVJOURNAL},     // deferred headers
+      {"stats", 0, nullptr, LONG_OPT_STATS},             // latency stats
+      {"slowlog", 1, nullptr, LONG_OPT_SLOWLOG},         // slow calls
+      {"lograte", 1, nullptr, LONG_OPT_LOGRATE},         // log lines a second
+      {"hotfiles", 1, nullptr, LONG_OPT_HOTFILES},       // encfsctl top
+      {"optrace", 1, nullptr, LONG_OPT_OPTRACE},         // encfsctl replay
+      {"control", 0, nullptr, LONG_OPT_CONTROL},         // runtime tuning
+      {"uring", 0, nullptr, LONG_OPT_URING},             // io_uring
+      {"directio", 0, nullptr, LONG_OPT_DIRECTIO},       // O_DIRECT
+      {"dropbehind", 0, nullptr, LONG_OPT_DROPBEHIND},   // fadvise streams
+      {"writebehind", 1, nullptr, LONG_OPT_WRITEBEHIND},  // sync_file_range
+      {"stream", 1, nullptr, LONG_OPT_STREAM},           // FUSE direct_io
+      {"diskcache", 1, nullptr, LONG_OPT_DISKCACHE},     // local SSD cache
+      {"diskcachesize", 1, nullptr, LONG_OPT_DISKCACHESIZE},  // its size
+      {"stripe", 1, nullptr, LONG_OPT_STRIPE},           // more backing dirs
+      {"policy", 1, nullptr, LONG_OPT_POLICY},           // subtree settings
+      {"shared", 1, nullptr, LONG_OPT_SHARED},           // several clients
+      {"netfs", 1, nullptr, LONG_OPT_NETFS},             // relaxed attributes
       {"verbose", 0, nullptr, 'v'},               // verbose mode
       {"version", 0, nullptr, 'V'},               // version
       {"reverse", 0, nullptr, 'r'},               // reverse encryption
+      {"watch", 0, nullptr, LONG_OPT_WATCH},      // follow backing changes
       {"reversewrite", 0, nullptr, 'R'},          // reverse encryption with write enabled
       {"standard", 0, nullptr, '1'},              // standard configuration
       {"paranoia", 0, nullptr, '2'},              // standard configuration
+      {"auto", 0, nullptr, LONG_OPT_AUTO},        // fastest configuration
       {"require-macs", 0, nullptr, LONG_OPT_REQUIRE_MAC},  // require MACs
       {"insecure", 0, nullptr, LONG_OPT_INSECURE},// allows to use null data encryption
       {"config", 1, nullptr, 'c'},                // command-line-supplied config location
       {"unmount", 1, nullptr, 'u'},               // unmount
+      {"serve", 1, nullptr, LONG_OPT_SERVE},      // many volumes
       {nullptr, 0, nullptr, 0}};
 
   while (true) {
@@ -302,6 +745,9 @@ static bool processArgs(int argc, char *argv[],
       case '2':
         out->opts->configMode = Config_Paranoia;
         break;
+      case LONG_OPT_AUTO:
+        out->opts->autoConfig = true;
+        break;
       case 's':
         out->isThreaded = false;
         break;
@@ -389,6 +835,10 @@ static bool processArgs(int argc, char *argv[],
         /* Disable kernel dentry cache
          * Fallout unknown, disabling for safety */
         PUSHARG("-oentry_timeout=0");
+        noAttrCache = true;
+        out->opts->negativeCacheSize = 0;
+        out->opts->attrCacheSize = 0;
+        out->opts->xattrCacheSize = 0;
 #ifdef __CYGWIN__
         // Should be enforced due to attr_timeout=0, but does not seem to work correctly
         // https://github.com/billziss-gh/winfsp/issues/155
@@ -398,9 +848,213 @@ static bool processArgs(int argc, char *argv[],
       case LONG_OPT_NODATACACHE:
         out->opts->noCache = true;
         break;
+      case LONG_OPT_BLOCKCACHE:
+        out->opts->blockCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_LOCKCACHE:
+        out->opts->lockBlockCache = true;
+        break;
+      case LONG_OPT_WATCH:
+        out->opts->watchBacking = true;
+        break;
+      case LONG_OPT_CACHEPOLICY:
+        if (!BlockCache::policyByName(optarg,
+                                      &out->opts->blockCachePolicy)) {
+          cerr << autosprintf(_("Unknown cache policy %s, aborting."),
+                              optarg)
+               << endl;
+          return false;
+        }
+        break;
+      case LONG_OPT_READAHEAD:
+        out->opts->readAheadSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_WRITEBACK:
+        out->opts->writeBackSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_INTENTLOG:
+        out->opts->intentLogPath = optarg;
+        break;
+      case LONG_OPT_BUFFERMEM:
+        out->opts->bufferMemSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_KERNELCRYPTO:
+        out->opts->kernelCrypto = true;
+        break;
+      case LONG_OPT_THREADS:
+        out->opts->workerThreads = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_FUSETHREADS:
+        out->fuseThreads = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_DATATHREADS:
+        out->dataThreads = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_WRITEBACKCACHE:
+        out->writebackCache = true;
+        break;
+      case LONG_OPT_ADAPTIVETTL:
+        out->adaptiveTtl = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_PATHCACHE:
+        out->opts->pathCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_DIRCACHE:
+        out->opts->dirCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_DIRINDEX:
+        out->opts->dirIndexSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_WALKAHEAD:
+        out->opts->walkAhead = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_KEYRING:
+        out->opts->keyringTimeout = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_NEGCACHE:
+        out->opts->negativeCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_ATTRCACHE:
+        out->opts->attrCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_KEEPCACHE:
+        out->opts->keepCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_XATTRCACHE:
+        out->opts->xattrCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_STATFSCACHE:
+        out->opts->statfsTimeout = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_DIRFDS:
+        out->opts->dirFdCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_GROUPSYNC:
+        out->opts->groupSyncWindow = strtol(optarg, (char **)nullptr, 10);
+        if (out->opts->groupSyncWindow < 0) {
+          out->opts->groupSyncWindow = 0;
+        }
+        break;
+      case LONG_OPT_NOPRESSURE:
+        out->opts->watchPressure = false;
+        break;
+      case LONG_OPT_WARMCACHE:
+        out->opts->warmCache = true;
+        break;
+      case LONG_OPT_FAIRSHARE:
+        out->opts->fairShareSlots = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_FAIRWEIGHT: {
+        char *end = nullptr;
+        long uid = strtol(optarg, &end, 10);
+        long weight = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+        if (uid < 0 || weight <= 0 || *end != '\0') {
+          cerr << autosprintf(_("Invalid fair weight %s, aborting."), optarg)
+               << endl;
+          return false;
+        }
+        out->opts->fairWeights[(uid_t)uid] = (unsigned int)weight;
+        break;
+      }
+      case LONG_OPT_IODEPTH: {
+        char *end = nullptr;
+        long depth = strtol(optarg, &end, 10);
+        long device = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+        if (depth <= 0 || device < 0 || *end != '\0') {
+          cerr << autosprintf(_("Invalid I/O depth %s, aborting."), optarg)
+               << endl;
+          return false;
+        }
+        out->opts->ioDepth = (int)depth;
+        out->opts->deviceIODepth = (int)device;
+        break;
+      }
+      case LONG_OPT_BGCPU: {
+        char *end = nullptr;
+        double cpus = strtod(optarg, &end);
+        if (*end == '%') {
+          cpus = cpus / 100 * std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+          ++end;
+        }
+        if (!(cpus > 0) || *end != '\0') {
+          cerr << autosprintf(_("Invalid CPU budget %s, aborting."), optarg)
+               << endl;
+          return false;
+        }
+        out->opts->bgCpu = cpus;
+        break;
+      }
+      case LONG_OPT_IVJOURNAL:
+        out->opts->ivJournal = true;
+        break;
+      case LONG_OPT_STATS:
+        out->opts->stats = true;
+        break;
+      case LONG_OPT_SLOWLOG:
+        out->opts->slowLogMs = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_LOGRATE:
+        out->logRate = strtol(optarg, (char **)nullptr, 10);
+        if (out->logRate < 0) {
+          out->logRate = 0;
+        }
+        break;
+      case LONG_OPT_HOTFILES:
+        // served with the stats
+        out->opts->hotFilesSize = strtol(optarg, (char **)nullptr, 10);
+        out->opts->stats = out->opts->stats || out->opts->hotFilesSize > 0;
+        break;
+      case LONG_OPT_OPTRACE:
+        out->opts->opTracePath = optarg;
+        break;
+      case LONG_OPT_ASYNCUNLOCK:
+        out->opts->unlockTimeout = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_CONTROL:
+        out->opts->control = true;
+        break;
+      case LONG_OPT_URING:
+        out->opts->uring = true;
+        break;
+      case LONG_OPT_DIRECTIO:
+        out->opts->directIO = true;
+        break;
+      case LONG_OPT_DROPBEHIND:
+        out->opts->dropBehind = true;
+        break;
+      case LONG_OPT_WRITEBEHIND:
+        out->opts->writeBehind = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_STREAM:
+        out->opts->streamSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_DISKCACHE:
+        out->opts->diskCacheDir = optarg;
+        break;
+      case LONG_OPT_DISKCACHESIZE:
+        out->opts->diskCacheSize = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_STRIPE:
+        out->opts->stripeDirs.push_back(slashTerminate(optarg));
+        break;
+      case LONG_OPT_POLICY:
+        out->opts->policyFile = optarg;
+        break;
+      case LONG_OPT_SHARED:
+        out->opts->sharedTimeout = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_NETFS:
+        out->opts->netfsTimeout = strtol(optarg, (char **)nullptr, 10);
+        break;
+      case LONG_OPT_SERVE:
+        out->serveFile = optarg;
+        break;
       case LONG_OPT_NOATTRCACHE:
         PUSHARG("-oattr_timeout=0");
         PUSHARG("-oentry_timeout=0");
+        noAttrCache = true;
+        out->opts->negativeCacheSize = 0;
+        out->opts->attrCacheSize = 0;
 #ifdef __CYGWIN__
         PUSHARG("-oFileInfoTimeout=0");
 #endif
@@ -477,6 +1131,18 @@ static bool processArgs(int argc, char *argv[],
     return false;
   }
 
+  // with --serve, the volumes and their options are read from the file,
+  // the command line only sets up the process
+  if (!out->serveFile.empty()) {
+    if (optind != argc) {
+      cerr << _("No root directory or mount point is given with --serve, "
+                "aborting.")
+           << endl;
+      return false;
+    }
+    return true;
+  }
+
   // we should have at least 2 arguments left over - the source directory and
   // the mount point.
   if (optind + 2 <= argc) {
@@ -502,6 +1168,72 @@ static bool processArgs(int argc, char *argv[],
     }
   }
 
+  // Reverse mode serves files which change behind the kernel's back, and
+  // --nocache asks for no caching at all
+  if (out->writebackCache &&
+      (out->opts->reverseEncryption || out->opts->noCache)) {
+    cerr << _("--writebackcache can't be used with --reverse or --nocache")
+         << endl;
+    return false;
+  }
+
+  // with stable entries kept for long, timeouts of 0 wouldn't hold
+  if (out->adaptiveTtl > 0 && noAttrCache) {
+    cerr << _("--adaptivettl can't be used with --nocache or --noattrcache")
+         << endl;
+    return false;
+  }
+
+  // the log only covers what the write-back buffers hold
+  if (!out->opts->intentLogPath.empty() &&
+      (out->opts->writeBackSize <= 0 || out->opts->reverseEncryption)) {
+    cerr << _("--intentlog needs --writeback, and can't be used with --reverse")
+         << endl;
+    return false;
+  }
+
+  // Let the kernel remember missing names for as long as we do.  Creating
+  // a name through the mount replaces the kernel's negative entry.
+  if (out->opts->negativeCacheSize > 0 && !out->opts->noCache &&
+      !out->opts->reverseEncryption &&
+      !hasFuseOption(out, "negative_timeout")) {
+    PUSHARG("-o");
+    PUSHARG(negativeTimeoutArg);
+  }
+
+  // Our attribute cache keeps entries as long as the kernel does by default,
+  // it stays out of the way of an explicit attr_timeout.
+  if (hasFuseOption(out, "attr_timeout")) {
+    out->opts->attrCacheSize = 0;
+  }
+
+  // Other clients of a shared backing directory change it behind the
+  // kernel's back.  It may keep attributes and names for the window, and
+  // drops the pages of a file once it sees its times change.
+  if (out->opts->sharedTimeout > 0 && !out->opts->noCache) {
+    if (!hasFuseOption(out, "attr_timeout") &&
+        !hasFuseOption(out, "entry_timeout")) {
+      string timeout = std::to_string(out->opts->sharedTimeout);
+      out->sharedArg =
+          "attr_timeout=" + timeout + ",entry_timeout=" + timeout + ",";
+    }
+    out->sharedArg += "auto_inval_data";
+    PUSHARG("-o");
+    PUSHARG(out->sharedArg.c_str());
+  }
+
+  // A network rootDir may serve attributes from its own cache, so may we
+  // and the kernel, unless --shared asked for less.
+  if (out->opts->netfsTimeout > 0 && !out->opts->noCache &&
+      out->opts->sharedTimeout <= 0 &&
+      !hasFuseOption(out, "attr_timeout") &&
+      !hasFuseOption(out, "entry_timeout")) {
+    string timeout = std::to_string(out->opts->netfsTimeout);
+    out->netfsArg = "attr_timeout=" + timeout + ",entry_timeout=" + timeout;
+    PUSHARG("-o");
+    PUSHARG(out->netfsArg.c_str());
+  }
+
   // Add default flags unless --no-default-flags was passed
   if (useDefaultFlags) {
 
@@ -534,8 +1266,17 @@ static bool processArgs(int argc, char *argv[],
 #endif
 
   // sanity check
-  if (out->isDaemon && (!isAbsolutePath(out->opts->mountPoint.c_str()) ||
-                        !isAbsolutePath(out->opts->rootDir.c_str()))) {
+  bool relativeStripe = false;
+  for (const string &dir : out->opts->stripeDirs) {
+    relativeStripe |= !isAbsolutePath(dir.c_str());
+  }
+  if (out->isDaemon && (relativeStripe ||
+                        !isAbsolutePath(out->opts->mountPoint.c_str()) ||
+                        !isAbsolutePath(out->opts->rootDir.c_str()) ||
+                        (!out->opts->diskCacheDir.empty() &&
+                         !isAbsolutePath(out->opts->diskCacheDir.c_str())) ||
+                        (!out->opts->policyFile.empty() &&
+                         !isAbsolutePath(out->opts->policyFile.c_str())))) {
     cerr <<
         // xgroup(usage)
         _("When specifying daemon mode, you must use absolute paths "
@@ -566,6 +1307,13 @@ static bool processArgs(int argc, char *argv[],
     return false;
   }
 
+  if (out->opts->keyringTimeout > 0 && !out->opts->mountOnDemand) {
+    cerr <<
+        // xgroup(usage)
+        _("The keyring is only used with mount-on-demand") << endl;
+    return false;
+  }
+
   if (out->opts->mountOnDemand && out->opts->passwordProgram.empty()) {
     cerr <<
         // xgroup(usage)
@@ -573,6 +1321,13 @@ static bool processArgs(int argc, char *argv[],
     return false;
   }
 
+  if (out->opts->unlockTimeout > 0 && out->opts->passwordProgram.empty()) {
+    cerr <<
+        // xgroup(usage)
+        _("Must set password program when using --asyncunlock") << endl;
+    return false;
+  }
+
   // check that the directories exist, or that we can create them..
   if (!isDirectory(out->opts->rootDir.c_str()) &&
       !userAllowMkdir(out->opts->annotate ? 1 : 0, out->opts->rootDir.c_str(),
@@ -613,14 +1368,96 @@ static bool processArgs(int argc, char *argv[],
   return true;
 }
 
-static void *idleMonitor(void *);
+/*
+    Have the filesystem automatically unmounted if it stays idle too long.
+    Idle time is only checked if there are no open files, as I don't want to
+    risk problems by having the filesystem unmounted from underneath open
+    files!
+*/
+static void watchIdle(EncFS_Context *ctx) {
+  const int timeout = 60 * ctx->args->idleTimeout;
+
+  // We will notify when FS will be unmounted, so notify that it has just been
+  // mounted
+  RLOG(INFO) << "Filesystem mounted: " << ctx->opts->unmountPoint;
+
+  // the context counts in seconds, the monitor in milliseconds of the
+  // same clock
+  idleMonitor.add(ctx, [ctx, timeout]() -> int64_t {
+    int64_t next = ctx->unmountIfIdle(timeout);
+    return next < 0 ? -1 : next * 1000;
+  });
+}
+
+static void unwatchIdle(EncFS_Context *ctx) {
+  // If the monitor did not unmount the FS itself, let's notify (certainly
+  // due to a kill signal, a manual unmount...)
+  if (idleMonitor.remove(ctx)) {
+    RLOG(INFO) << "Filesystem unmounted: " << ctx->opts->unmountPoint;
+  }
+}
+
+// the memory pressure monitor of the root, after daemonizing, which its
+// thread wouldn't survive
+static void startMemoryPressure(EncFS_Context *ctx) {
+  int res = 0;
+  std::shared_ptr<DirNode> root = ctx->getRoot(&res, true);
+  if (root && root->config()->memoryPressure) {
+    root->config()->memoryPressure->start();
+  }
+}
+
+/*
+    --asyncunlock: runs the password program and derives the key while the
+    filesystem is mounted already.  Calls wait for it in getRoot().
+*/
+static void *asyncUnlock(void *arg) {
+  auto *ctx = (EncFS_Context *)arg;
+  int res = remountFS(ctx);
+  if (res == 0) {
+    // the rest is started by remountFS
+    startMemoryPressure(ctx);
+    RLOG(INFO) << "volume unlocked: " << ctx->opts->unmountPoint;
+  } else {
+    RLOG(ERROR) << "unable to unlock the volume, calls fail from now on: "
+                << ctx->opts->unmountPoint;
+  }
+  ctx->endUnlock(res);
+  return nullptr;
+}
 
 void *encfs_init(fuse_conn_info *conn) {
   auto *ctx = (EncFS_Context *)fuse_get_context()->private_data;
 
+  uint64_t started = fuseStarted.exchange(0);
+  if (started != 0) {
+    Stats::recordPhase(Stats::FuseSetup, Stats::now() - started);
+  }
+
+  // From here on log lines are written by a thread of their own, so that
+  // verbose logging doesn't hold up the requests.  Messages before, such as
+  // those of the password prompt, keep their order with what is printed.
+  encfs::startAsyncLogging(ctx->args->logRate);
+
   // set fuse connection options
   conn->async_read = 1u;
 
+#ifdef FUSE_CAP_SPLICE_WRITE
+  // Reads of plain data volumes come back as the backing file's descriptor
+  // (see encfs_read_buf), which libfuse only splices into the kernel's pipe
+  // when asked to, and otherwise reads into a buffer first.  Everything
+  // else is answered from memory as before.
+  conn->want |= (conn->capable & FUSE_CAP_SPLICE_WRITE);
+#endif
+
+  // whole blocks per write for --stream, rather than a page at a time
+  if (ctx->args->streamRequest != 0) {
+#ifdef FUSE_CAP_BIG_WRITES
+    conn->want |= (conn->capable & FUSE_CAP_BIG_WRITES);
+#endif
+    conn->max_write = ctx->args->streamRequest;
+  }
+
 #ifdef __CYGWIN__
   // WinFsp needs this to partially handle read-only FS
   // See https://github.com/billziss-gh/winfsp/issues/157 for details
@@ -629,18 +1466,34 @@ void *encfs_init(fuse_conn_info *conn) {
   }
 #endif
 
-  // if an idle timeout is specified, then setup a thread to monitor the
-  // filesystem.
+  // if an idle timeout is specified, then have the filesystem monitored
   if (ctx->args->idleTimeout > 0) {
-    VLOG(1) << "starting idle monitoring thread";
-    ctx->running = true;
+    VLOG(1) << "starting idle monitoring";
+    watchIdle(ctx);
+  }
 
-    int res =
-        pthread_create(&ctx->monitorThread, nullptr, idleMonitor, (void *)ctx);
-    if (res != 0) {
-      RLOG(ERROR) << "error starting idle monitor thread, "
-                     "res = "
-                  << res << ", " << strerror(res);
+  if (ctx->unlocking()) {
+    // the root is made after daemonizing as well, by a thread of its own
+    unlockStarted =
+        pthread_create(&unlockThread, nullptr, asyncUnlock, ctx) == 0;
+    if (!unlockStarted) {
+      RLOG(ERROR) << "unable to start the unlock of the volume";
+      ctx->endUnlock(-EACCES);
+    }
+  } else {
+    // after daemonizing, which the watcher's thread wouldn't survive.  A
+    // remount starts its own (see remountFS).
+    int res = 0;
+    std::shared_ptr<DirNode> root = ctx->getRoot(&res, true);
+    if (root && ctx->opts->watchBacking) {
+      root->watchBacking();
+    }
+    // the same goes for the memory pressure monitor
+    startMemoryPressure(ctx);
+    // and the threads warming the caches and checkpointing the intent log
+    if (root) {
+      root->warmUp();
+      root->startIntentLog();
     }
   }
 
@@ -653,6 +1506,809 @@ void *encfs_init(fuse_conn_info *conn) {
   return (void *)ctx;
 }
 
+// the ioctl of <linux/fuse.h>, for older headers
+#if defined(__linux__) && !defined(FUSE_DEV_IOC_CLONE)
+#define FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#endif
+
+// Bits of the kernel protocol which libfuse 2 doesn't export:
+// sizeof(struct fuse_in_header), the FUSE_INIT opcode, the offsets of the
+// minor version and of the flags in struct fuse_init_in and fuse_init_out,
+// FUSE_WRITEBACK_CACHE, and the FUSE_LSEEK opcode with the size of struct
+// fuse_lseek_in.  Each of them is only used once the protocol agreed on in
+// FUSE_INIT is known to have it: the write-back cache came with 7.23, and
+// lseek with 7.24.  Answers to lookups and getattr have had the layout
+// EntryTimeouts expects since 7.9.
+static const int FuseInHeaderSize = 40;
+static const int FuseOutHeaderSize = 16;
+static const uint32_t FuseInitOpcode = 26;
+static const int FuseInitMinorOffset = 4;
+static const int FuseInitFlagsOffset = 12;
+static const uint32_t FuseWritebackCache = 1u << 16;
+static const uint32_t FuseLseekOpcode = 46;
+static const int FuseLseekInSize = 24;
+static const uint32_t FuseMinorWritebackCache = 23;
+static const uint32_t FuseMinorLseek = 24;
+static const uint32_t FuseMinorTimeouts = 9;
+
+/*
+    The FUSE loop of --fusethreads: a fixed set of threads, each pinned to
+    a core, in place of libfuse's threads which come and go with the load.
+    Where the kernel can clone the FUSE device (Linux 4.2 and later), each
+    thread reads its requests from a device of its own and answers on it,
+    so that the threads don't all queue up on one file.  Cipher contexts
+    and memory pool blocks are cached per thread, so they stay warm on the
+    thread's core.
+
+    Requests still take a read and a write on the device each.  The io_uring
+    transport of Linux 6.14 has to be asked for in the answer to FUSE_INIT
+    (FUSE_OVER_IO_URING in flags2, protocol 7.42), which libfuse 2 builds
+    itself and can't be made to send.
+
+    The kernel's write-back cache (--writebackcache) is asked for the same
+    way, with a flag the loop sets in the answer as it goes out.  That is
+    only done where the protocol agreed on has the flag: libfuse 2 answers
+    with the minor version of its own headers, 7.19 for libfuse 2.9, so
+    the cache needs a libfuse which speaks 7.23 or later.
+
+    With --datathreads, reads and writes are only run by as many threads at
+    once as it gives, and the loop has that many more threads (DataPool).
+    With --adaptivettl, the timeouts of answers to lookups and getattr are
+    set by EntryTimeouts as they go out.  The answer to a metadata request
+    goes out on the thread which read the request, which remembers what it
+    was.
+
+    lseek with SEEK_DATA or SEEK_HOLE, which libfuse 2 has no operation for
+    and would answer with ENOSYS, is answered by the loop itself (see
+    encfs_lseek), so that sparse-aware programs can skip holes, again only
+    where the protocol agreed on has FUSE_LSEEK (7.24).
+
+    The minor version agreed on is the lower of the kernel's, in the
+    request, and libfuse's, in the answer.  Until the answer has gone out,
+    nothing is edited or answered by the loop.
+*/
+struct FuseWorkers {
+  fuse_session *session;
+  EncFS_Context *ctx;
+  fuse_chan *channel;     // of the mount
+  std::vector<int> cpus;  // the process may run on
+  sem_t finished;         // posted by each thread leaving the loop
+
+  bool writebackCache;
+  // unique of the FUSE_INIT request, until it is answered
+  std::atomic<uint64_t> initUnique;
+  std::atomic<uint32_t> kernelMinor;   // offered in FUSE_INIT
+  std::atomic<bool> kernelWriteback;   // the kernel offers the cache
+  // minor version of the protocol agreed on, 0 until FUSE_INIT is answered
+  std::atomic<uint32_t> minor;
+
+  std::unique_ptr<DataPool> data;  // of --datathreads
+  std::unique_ptr<EntryTimeouts> timeouts;  // of --adaptivettl
+};
+
+// the request of the thread whose answer has timeouts to set
+static thread_local uint64_t tTimedUnique = 0;
+static thread_local uint32_t tTimedOpcode = 0;
+
+struct FuseWorker {
+  FuseWorkers *workers;
+  int index;
+  fuse_chan *channel;  // a cloned device, or the mount's one wrapped
+  bool cloned;
+  pthread_t thread;
+};
+
+static uint32_t loadU32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t loadU64(const char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// fuse_chan_ops of the loop's channels, as libfuse's own for the mount
+static int deviceReceive(fuse_chan **chp, char *buf, size_t size) {
+  fuse_chan *ch = *chp;
+  auto *workers = (FuseWorkers *)fuse_chan_data(ch);
+  fuse_session *se = workers->session;
+  ssize_t res;
+  do {
+    res = read(fuse_chan_fd(ch), buf, size);
+    // ENOENT: the request was interrupted before it was read
+  } while (res < 0 && errno == ENOENT && !fuse_session_exited(se));
+  if (res < 0) {
+    int err = errno;
+    if (err == ENODEV) {
+      // unmounted
+      fuse_session_exit(se);
+      return 0;
+    }
+    if (err != EINTR && err != EAGAIN && !fuse_session_exited(se)) {
+      RLOG(ERROR) << "reading the FUSE device failed: " << strerror(err);
+    }
+    return -err;
+  }
+  if (res < FuseInHeaderSize) {
+    RLOG(ERROR) << "short read on the FUSE device";
+    return -EIO;
+  }
+
+  if (workers->timeouts) {
+    uint32_t opcode = loadU32(buf + 4);
+    bool timed = EntryTimeouts::answersEntry(opcode) ||
+                 EntryTimeouts::answersAttr(opcode);
+    tTimedOpcode = timed ? opcode : 0;
+    tTimedUnique = loadU64(buf + 8);
+  }
+
+  if (loadU32(buf + 4) == FuseInitOpcode &&
+      res >= FuseInHeaderSize + FuseInitFlagsOffset + 4) {
+    const char *in = buf + FuseInHeaderSize;
+    uint32_t flags = loadU32(in + FuseInitFlagsOffset);
+    workers->kernelMinor = loadU32(in + FuseInitMinorOffset);
+    workers->kernelWriteback = (flags & FuseWritebackCache) != 0;
+    workers->initUnique = loadU64(buf + 8);
+  }
+  return (int)res;
+}
+
+/*
+    Note the protocol agreed on from the answer to FUSE_INIT, and set
+    FUSE_WRITEBACK_CACHE in it where the protocol has the flag.
+*/
+static void answeringInit(FuseWorkers *workers, const iovec iov[],
+                          size_t count) {
+  uint64_t init = workers->initUnique;
+  if (init == 0 || count < 2 || iov[0].iov_len < (size_t)FuseOutHeaderSize ||
+      iov[1].iov_len < (size_t)FuseInitFlagsOffset + 4) {
+    return;
+  }
+  const char *header = (const char *)iov[0].iov_base;
+  if (loadU64(header + 8) != init || loadU32(header + 4) != 0 ||
+      !workers->initUnique.compare_exchange_strong(init, 0)) {
+    return;
+  }
+  // libfuse points the iovec at its own copy of the answer
+  char *out = (char *)iov[1].iov_base;
+  uint32_t minor = std::min(workers->kernelMinor.load(),
+                            loadU32(out + FuseInitMinorOffset));
+  VLOG(1) << "FUSE protocol 7." << minor;
+
+  if (workers->writebackCache) {
+    if (!workers->kernelWriteback) {
+      RLOG(WARNING) << "the kernel has no write-back cache for FUSE";
+    } else if (minor < FuseMinorWritebackCache) {
+      RLOG(WARNING) << "no write-back cache with FUSE protocol 7." << minor
+                    << ", it needs 7." << FuseMinorWritebackCache;
+    } else {
+      char *flags = out + FuseInitFlagsOffset;
+      uint32_t value = loadU32(flags) | FuseWritebackCache;
+      memcpy(flags, &value, sizeof(value));
+      VLOG(1) << "enabled the kernel's write-back cache";
+    }
+  }
+  workers->minor = minor;
+}
+
+// set the timeouts of an answer to a lookup or getattr of this thread
+static void setTimeouts(FuseWorkers *workers, const iovec iov[],
+                        size_t count) {
+  if (tTimedOpcode == 0 || count < 2 ||
+      iov[0].iov_len < (size_t)FuseOutHeaderSize ||
+      workers->minor < FuseMinorTimeouts) {
+    return;
+  }
+  const char *header = (const char *)iov[0].iov_base;
+  if (loadU64(header + 8) != tTimedUnique || loadU32(header + 4) != 0) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  workers->timeouts->adjust(
+      tTimedOpcode, (char *)iov[1].iov_base, iov[1].iov_len,
+      (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec);
+  tTimedOpcode = 0;
+}
+
+// answers a FUSE_LSEEK request
+static void answerLseek(FuseWorkers *workers, fuse_chan *ch, const char *req,
+                        int size) {
+  off_t result = -EINVAL;
+  if (workers->minor < FuseMinorLseek) {
+    // not in the protocol agreed on, the kernel stops asking
+    result = -ENOSYS;
+  } else if (size >= FuseInHeaderSize + FuseLseekInSize) {
+    const char *in = req + FuseInHeaderSize;
+    result = encfs_lseek(workers->ctx, loadU64(in), (off_t)loadU64(in + 8),
+                         (int)loadU32(in + 16));
+  }
+  // struct fuse_out_header, and struct fuse_lseek_out unless it failed
+  char header[FuseOutHeaderSize];
+  uint64_t offset = result < 0 ? 0 : (uint64_t)result;
+  uint32_t len = FuseOutHeaderSize + (result < 0 ? 0 : sizeof(offset));
+  int32_t error = result < 0 ? (int32_t)result : 0;
+  uint64_t unique = loadU64(req + 8);
+  memcpy(header, &len, sizeof(len));
+  memcpy(header + 4, &error, sizeof(error));
+  memcpy(header + 8, &unique, sizeof(unique));
+  iovec iov[2] = {{header, sizeof(header)}, {&offset, sizeof(offset)}};
+  fuse_chan_send(ch, iov, result < 0 ? 1 : 2);
+}
+
+static int deviceSend(fuse_chan *ch, const iovec iov[], size_t count) {
+  if (iov == nullptr) {
+    return 0;
+  }
+  auto *workers = (FuseWorkers *)fuse_chan_data(ch);
+  if (workers->initUnique != 0) {
+    answeringInit(workers, iov, count);
+  }
+  if (workers->timeouts) {
+    setTimeouts(workers, iov, count);
+  }
+  if (writev(fuse_chan_fd(ch), iov, (int)count) < 0) {
+    int err = errno;
+    // ENOENT: the request was interrupted, nobody waits for the answer
+    if (err != ENOENT && !fuse_session_exited(workers->session)) {
+      RLOG(WARNING) << "writing the FUSE device failed: " << strerror(err);
+    }
+    return -err;
+  }
+  return 0;
+}
+
+static void cloneDestroy(fuse_chan *ch) { close(fuse_chan_fd(ch)); }
+
+// the mount's device is closed by libfuse
+static void sharedDestroy(fuse_chan *) {}
+
+static fuse_chan *cloneChannel(FuseWorkers *workers) {
+#ifdef FUSE_DEV_IOC_CLONE
+  int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  uint32_t mountFd = fuse_chan_fd(workers->channel);
+  if (ioctl(fd, FUSE_DEV_IOC_CLONE, &mountFd) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  static fuse_chan_ops ops = {deviceReceive, deviceSend, cloneDestroy};
+  fuse_chan *ch =
+      fuse_chan_new(&ops, fd, fuse_chan_bufsize(workers->channel), workers);
+  if (ch == nullptr) {
+    close(fd);
+  }
+  return ch;
+#else
+  (void)workers;
+  return nullptr;
+#endif
+}
+
+static fuse_chan *sharedChannel(FuseWorkers *workers) {
+  static fuse_chan_ops ops = {deviceReceive, deviceSend, sharedDestroy};
+  return fuse_chan_new(&ops, fuse_chan_fd(workers->channel),
+                       fuse_chan_bufsize(workers->channel), workers);
+}
+
+static void *fuseWorker(void *arg) {
+  auto *worker = (FuseWorker *)arg;
+  FuseWorkers *workers = worker->workers;
+  fuse_session *se = workers->session;
+
+#ifdef __linux__
+  if (!workers->cpus.empty()) {
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(workers->cpus[worker->index % workers->cpus.size()], &cpu);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+  }
+#endif
+
+  fuse_chan *ch = worker->channel;
+  size_t bufSize = fuse_chan_bufsize(ch);
+  DataPool::Request req;
+  req.buf.resize(bufSize);
+  std::vector<char> &buf = req.buf;
+
+  // only the wait for a request may be cancelled, not its processing
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+  while (!fuse_session_exited(se)) {
+    fuse_chan *from = ch;
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+    int res = fuse_chan_recv(&from, buf.data(), buf.size());
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+    if (res == -EINTR || res == -EAGAIN) {
+      continue;
+    }
+    if (res <= 0) {
+      if (res < 0) {
+        fuse_session_exit(se);
+      }
+      break;
+    }
+
+    uint32_t opcode = loadU32(buf.data() + 4);
+    if (opcode == FuseLseekOpcode) {
+      answerLseek(workers, from, buf.data(), res);
+      continue;
+    }
+    DataPool *data = workers->data.get();
+    if (data == nullptr || !DataPool::isData(opcode)) {
+      fuse_session_process(se, buf.data(), res, from);
+      continue;
+    }
+    req.size = (size_t)res;
+    req.channel = from;
+    if (data->enter(&req)) {
+      do {
+        fuse_session_process(se, req.buf.data(), req.size,
+                             (fuse_chan *)req.channel);
+      } while (data->next(&req));
+    }
+    req.buf.resize(bufSize);
+  }
+
+  sem_post(&workers->finished);
+  return nullptr;
+}
+
+// fuse_loop_mt, with threads threads (0: one per core) for the whole life
+// of the mount, and dataThreads more if reads and writes are kept to them
+static int fuseLoopPinned(fuse *f, EncFS_Context *ctx, int threads,
+                          bool writebackCache, int dataThreads,
+                          int adaptiveTtl) {
+  FuseWorkers workers;
+  workers.session = fuse_get_session(f);
+  workers.ctx = ctx;
+  workers.channel = fuse_session_next_chan(workers.session, nullptr);
+  workers.writebackCache = writebackCache;
+  workers.initUnique = 0;
+  workers.kernelMinor = 0;
+  workers.kernelWriteback = false;
+  workers.minor = 0;
+  if (adaptiveTtl > 0) {
+    workers.timeouts.reset(new EntryTimeouts(adaptiveTtl));
+  }
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        workers.cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  if (threads <= 0) {
+    threads = std::max<int>(1, (int)workers.cpus.size());
+  }
+  if (dataThreads > 0) {
+    workers.data.reset(new DataPool(dataThreads));
+    threads += dataThreads;
+  }
+  if (fuse_start_cleanup_thread(f) != 0) {
+    return -1;
+  }
+  sem_init(&workers.finished, 0, 0);
+
+  // signals are left to the calling thread, as in libfuse
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  std::vector<FuseWorker> list(threads);
+  int cloned = 0;
+  int started = 0;
+  for (int i = 0; i < threads; ++i) {
+    FuseWorker &worker = list[i];
+    worker.workers = &workers;
+    worker.index = i;
+    worker.channel = cloneChannel(&workers);
+    worker.cloned = worker.channel != nullptr;
+    if (!worker.cloned) {
+      worker.channel = sharedChannel(&workers);
+    }
+    if (worker.channel == nullptr) {
+      RLOG(ERROR) << "unable to set up a FUSE channel";
+      break;
+    }
+    int res = pthread_create(&worker.thread, nullptr, fuseWorker, &worker);
+    if (res != 0) {
+      RLOG(ERROR) << "unable to start FUSE thread: " << strerror(res);
+      fuse_chan_destroy(worker.channel);
+      break;
+    }
+    if (worker.cloned) {
+      ++cloned;
+    }
+    ++started;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  VLOG(1) << "started " << started << " FUSE threads on "
+          << workers.cpus.size() << " cores, " << cloned
+          << " with devices of their own";
+
+  if (started > 0) {
+    while (!fuse_session_exited(workers.session)) {
+      sem_wait(&workers.finished);
+    }
+  }
+
+  for (int i = 0; i < started; ++i) {
+    pthread_cancel(list[i].thread);
+    pthread_join(list[i].thread, nullptr);
+    fuse_chan_destroy(list[i].channel);
+  }
+  sem_destroy(&workers.finished);
+  fuse_stop_cleanup_thread(f);
+  return started > 0 ? 0 : -1;
+}
+
+// the FUSE loop for a mount with args
+static int fuseLoop(fuse *f, EncFS_Context *ctx, const EncFS_Args &args,
+                    bool multithreaded) {
+  if (args.writebackCache || args.adaptiveTtl > 0) {
+    // the pinned loop edits the answers for these, even with a single thread
+    return fuseLoopPinned(f, ctx, multithreaded ? args.fuseThreads : 1,
+                          args.writebackCache,
+                          multithreaded ? args.dataThreads : 0,
+                          args.adaptiveTtl);
+  }
+  if (multithreaded && (args.fuseThreads > 0 || args.dataThreads > 0)) {
+    return fuseLoopPinned(f, ctx, args.fuseThreads, false, args.dataThreads,
+                          0);
+  }
+  return multithreaded ? fuse_loop_mt(f) : fuse_loop(f);
+}
+
+// fuse_main, with the loops of --fusethreads, --datathreads,
+// --writebackcache and --adaptivettl
+static int fuseMain(const std::shared_ptr<EncFS_Args> &args,
+                    const fuse_operations *oper, void *userData) {
+  if (args->fuseThreads <= 0 && args->dataThreads <= 0 &&
+      !args->writebackCache && args->adaptiveTtl <= 0) {
+    return fuse_main(args->fuseArgc, const_cast<char **>(args->fuseArgv),
+                     oper, userData);
+  }
+
+  char *mountPoint = nullptr;
+  int multithreaded = 0;
+  fuse *f = fuse_setup(args->fuseArgc, const_cast<char **>(args->fuseArgv),
+                       oper, sizeof(*oper), &mountPoint, &multithreaded,
+                       userData);
+  if (f == nullptr) {
+    return 1;
+  }
+  int res = fuseLoop(f, (EncFS_Context *)userData, *args, multithreaded != 0);
+  fuse_teardown(f, mountPoint);
+  return res == -1 ? 1 : 0;
+}
+
+/*
+    A volume mounted by encfs --serve.  Each has its own context and FUSE
+    session, and is served by a thread of its own (which starts the FUSE
+    threads of the volume), while the block cache, worker threads, memory
+    pool and idle monitor are shared by all volumes of the process.
+*/
+struct ServedVolume {
+  std::vector<std::string> words;  // the line, fuseArgv points into it
+  std::vector<char *> argv;
+  std::shared_ptr<EncFS_Args> args;
+  std::shared_ptr<EncFS_Context> ctx;
+  RootPtr rootInfo;
+
+  char *mountPoint = nullptr;  // as parsed by FUSE
+  int multithreaded = 1;
+  fuse_chan *channel = nullptr;
+  fuse *session = nullptr;
+  pthread_t thread;
+  bool running = false;
+};
+
+static std::atomic<int> servedCount(0);
+
+static void *serveVolume(void *arg) {
+  auto *volume = (ServedVolume *)arg;
+  fuseLoop(volume->session, volume->ctx.get(), *volume->args,
+           volume->multithreaded != 0);
+  RLOG(INFO) << "Volume unmounted: " << volume->args->opts->unmountPoint;
+
+  // the process ends with its last volume
+  if (--servedCount == 0) {
+    kill(getpid(), SIGTERM);
+  }
+  return nullptr;
+}
+
+// parse the lines of the volume list, "rootDir mountPoint [options]"
+static bool readVolumes(const std::string &file,
+                        std::vector<std::unique_ptr<ServedVolume>> *out) {
+  std::ifstream in(file);
+  if (!in) {
+    cerr << autosprintf(_("Unable to read volume list %s"), file.c_str())
+         << endl;
+    return false;
+  }
+
+  std::string line;
+  for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+    std::unique_ptr<ServedVolume> volume(new ServedVolume);
+    volume->words.push_back("encfs");
+    std::istringstream words(line);
+    for (std::string word; words >> word;) {
+      if (word[0] == '#') {
+        break;
+      }
+      volume->words.push_back(word);
+    }
+    if (volume->words.size() == 1) {
+      continue;
+    }
+    for (std::string &word : volume->words) {
+      volume->argv.push_back(&word[0]);
+    }
+    volume->argv.push_back(nullptr);
+
+    volume->args = std::make_shared<EncFS_Args>();
+    for (int i = 0; i < MaxFuseArgs; ++i) {
+      volume->args->fuseArgv[i] = nullptr;
+    }
+    optind = 0;  // start getopt over
+    if (!processArgs((int)volume->words.size(), volume->argv.data(),
+                     volume->args) ||
+        !volume->args->serveFile.empty() || volume->args->opts->unmount) {
+      cerr << autosprintf(_("Invalid volume on line %i of %s"), lineNo,
+                          file.c_str())
+           << endl;
+      return false;
+    }
+    out->push_back(std::move(volume));
+  }
+  return true;
+}
+
+static std::shared_ptr<FairScheduler> newScheduler(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->fairShareSlots <= 0) {
+    return std::shared_ptr<FairScheduler>();
+  }
+  return std::make_shared<FairScheduler>(opts->fairShareSlots,
+                                         opts->fairWeights);
+}
+
+static std::shared_ptr<KeepCache> newKeepCache(
+    const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->keepCacheSize <= 0 || opts->noCache) {
+    return std::shared_ptr<KeepCache>();
+  }
+  return std::make_shared<KeepCache>(opts->keepCacheSize);
+}
+
+// The kernel sends FUSE requests of up to 32 pages
+static const unsigned MaxFuseRequest = 128 << 10;
+
+// With --stream, reads and writes of streamed files reach us as the kernel
+// gets them, cut into requests of at most max_read and max_write bytes.
+// Both are set to a whole number of blocks, so that a stream which starts
+// at a block boundary is never split in the middle of a block and every
+// request goes to BlockFileIO's paths for runs of whole blocks.  Blocks are
+// counted in plain data, where the file header and the MACs of the blocks
+// take no room.
+static void setStreamRequests(const std::shared_ptr<EncFS_Args> &args,
+                              const RootPtr &rootInfo) {
+  if (args->opts->streamSize < 0) {
+    return;
+  }
+  std::shared_ptr<EncFSConfig> config;
+  if (rootInfo->root) {
+    config = rootInfo->root->config()->config;
+  } else {
+    // not unlocked yet (--asyncunlock), the block size is in the clear
+    config = std::make_shared<EncFSConfig>();
+    if (readConfig(args->opts->rootDir, config.get(), args->opts->config) ==
+        Config_None) {
+      return;
+    }
+  }
+  unsigned bs = config->blockSize;
+  if (!args->opts->reverseEncryption && !config->blockMACExtents) {
+    bs -= config->blockMACBytes + config->blockMACRandBytes;
+  }
+  args->streamRequest = std::max(MaxFuseRequest / bs, 1u) * bs;
+  if (!hasFuseOption(args, "max_read")) {
+    args->maxReadArg = "max_read=" + std::to_string(args->streamRequest);
+    rAssert(args->fuseArgc + 2 <= MaxFuseArgs);
+    args->fuseArgv[args->fuseArgc++] = "-o";
+    args->fuseArgv[args->fuseArgc++] = args->maxReadArg.c_str();
+  }
+}
+
+static void setHotFiles(EncFS_Context *ctx,
+                        const std::shared_ptr<EncFS_Opts> &opts) {
+  if (opts->hotFilesSize > 0) {
+    ctx->hotFiles = std::make_shared<HotFiles>(opts->hotFilesSize);
+    ctx->hotUsers = std::make_shared<HotFiles>(opts->hotFilesSize);
+  }
+}
+
+// Starts the trace of --optrace, returns false if it can't be created
+static bool setOpTrace(EncFS_Context *ctx,
+                       const std::shared_ptr<EncFS_Opts> &opts,
+                       fuse_operations *oper) {
+  if (opts->opTracePath.empty()) {
+    return true;
+  }
+  ctx->recorder = std::make_shared<OpRecorder>(opts->opTracePath);
+  if (!ctx->recorder->valid()) {
+    cerr << autosprintf(_("unable to create the trace %s"),
+                        opts->opTracePath.c_str())
+         << endl;
+    return false;
+  }
+  encfs_optrace(oper);
+  return true;
+}
+
+static bool mountVolume(ServedVolume *volume, const fuse_operations *oper) {
+  std::shared_ptr<EncFS_Opts> opts = volume->args->opts;
+  volume->ctx = std::make_shared<EncFS_Context>();
+  volume->ctx->publicFilesystem = opts->ownerCreate;
+  volume->rootInfo = initFS(volume->ctx.get(), opts);
+  if (!volume->rootInfo) {
+    return false;
+  }
+  opts->delayMount = false;
+  volume->ctx->setRoot(volume->rootInfo->root);
+  volume->ctx->args = volume->args;
+  volume->ctx->opts = opts;
+  volume->ctx->scheduler = newScheduler(opts);
+  volume->ctx->keepCache = newKeepCache(opts);
+  setHotFiles(volume->ctx.get(), opts);
+  setStreamRequests(volume->args, volume->rootInfo);
+  if (opts->stats) {
+    Stats::setEnabled(true);
+  }
+  if (opts->bgCpu > 0) {
+    CpuBudget::setLimit(opts->bgCpu);
+  }
+  if (opts->slowLogMs > 0) {
+    Stats::setSlowThreshold((uint64_t)opts->slowLogMs * 1000000);
+  }
+
+  // what fuse_main does, short of daemonizing and the signal handlers,
+  // which are the process' business
+  fuse_args fuseArgs = FUSE_ARGS_INIT(
+      volume->args->fuseArgc, const_cast<char **>(volume->args->fuseArgv));
+  bool ok = false;
+  if (fuse_parse_cmdline(&fuseArgs, &volume->mountPoint,
+                         &volume->multithreaded, nullptr) == 0 &&
+      volume->mountPoint != nullptr) {
+    volume->channel = fuse_mount(volume->mountPoint, &fuseArgs);
+    if (volume->channel != nullptr) {
+      volume->session = fuse_new(volume->channel, &fuseArgs, oper,
+                                 sizeof(*oper), volume->ctx.get());
+      if (volume->session == nullptr) {
+        fuse_unmount(volume->mountPoint, volume->channel);
+        volume->channel = nullptr;
+      } else {
+        ok = true;
+      }
+    }
+  }
+  fuse_opt_free_args(&fuseArgs);
+  if (!ok) {
+    cerr << autosprintf(_("Unable to mount %s"),
+                        opts->unmountPoint.c_str())
+         << endl;
+  }
+  return ok;
+}
+
+/*
+    encfs --serve: mount every volume listed in the file from this process.
+    The volumes are set up (asking for passwords as needed) and mounted
+    before the process goes to the background.  It ends when all volumes
+    are unmounted, or on SIGINT, SIGTERM or SIGHUP, which unmount them all.
+*/
+static int serveVolumes(const std::shared_ptr<EncFS_Args> &serverArgs,
+                        const fuse_operations *oper) {
+  std::vector<std::unique_ptr<ServedVolume>> volumes;
+  if (!readVolumes(serverArgs->serveFile, &volumes)) {
+    return EXIT_FAILURE;
+  }
+  if (volumes.empty()) {
+    cerr << _("No volumes to serve") << endl;
+    return EXIT_FAILURE;
+  }
+
+  // --blockcache is the budget of all volumes together
+  std::shared_ptr<BlockCache> blockCache = newBlockCache(serverArgs->opts);
+  std::shared_ptr<WorkerPool> workers = newWorkerPool(serverArgs->opts);
+
+  bool ok = true;
+  for (auto &volume : volumes) {
+    volume->args->opts->sharedBlockCache = blockCache;
+    volume->args->opts->sharedWorkers = workers;
+    if (!mountVolume(volume.get(), oper)) {
+      ok = false;
+      break;
+    }
+  }
+
+  // reset umask now, since we don't want it to interfere with the
+  // pass-thru calls..
+  umask(0);
+
+  // encfs_init must not close the process' stderr
+  oldStderr = -1;
+  if (ok && fuse_daemonize(serverArgs->isDaemon ? 0 : 1) != 0) {
+    ok = false;
+  }
+
+  // the signals are taken by this thread, the others inherit the mask
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (ok) {
+    servedCount = (int)volumes.size();
+    for (auto &volume : volumes) {
+      int res = pthread_create(&volume->thread, nullptr, serveVolume,
+                               volume.get());
+      if (res != 0) {
+        RLOG(ERROR) << "unable to start volume thread: " << strerror(res);
+        --servedCount;
+        continue;
+      }
+      volume->running = true;
+    }
+    RLOG(INFO) << "Serving " << volumes.size() << " volumes";
+
+    int sig = 0;
+    if (servedCount > 0) {
+      sigwait(&signals, &sig);
+    }
+    VLOG(1) << "stopping on signal " << sig;
+  }
+
+  // unmounting ends the FUSE loops.  Volumes which were already unmounted
+  // just fail to unmount again.
+  for (auto &volume : volumes) {
+    if (volume->session != nullptr) {
+      fuse_exit(volume->session);
+      unmountFS(volume->args->opts->unmountPoint.c_str());
+    }
+  }
+  for (auto &volume : volumes) {
+    if (volume->running) {
+      pthread_join(volume->thread, nullptr);
+    }
+    if (volume->ctx && volume->args->idleTimeout > 0) {
+      unwatchIdle(volume->ctx.get());
+    }
+    if (volume->session != nullptr) {
+      fuse_unmount(volume->mountPoint, volume->channel);
+      fuse_destroy(volume->session);
+    }
+    free(volume->mountPoint);
+    volume->rootInfo.reset();
+    if (volume->ctx) {
+      volume->ctx->setRoot(std::shared_ptr<DirNode>());
+    }
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char *argv[]) {
 #if defined(ENABLE_NLS) && defined(LOCALEDIR)
   setlocale(LC_ALL, "");
@@ -709,6 +2365,8 @@ int main(int argc, char *argv[]) {
   encfs_oper.open = encfs_open;
   encfs_oper.read = encfs_read;
   encfs_oper.write = encfs_write;
+  encfs_oper.read_buf = encfs_read_buf;
+  encfs_oper.write_buf = encfs_write_buf;
   encfs_oper.statfs = encfs_statfs;
   encfs_oper.flush = encfs_flush;
   encfs_oper.release = encfs_release;
@@ -719,29 +2377,46 @@ int main(int argc, char *argv[]) {
   encfs_oper.listxattr = encfs_listxattr;
   encfs_oper.removexattr = encfs_removexattr;
 #endif  // HAVE_XATTR
-  // encfs_oper.opendir = encfs_opendir;
-  // encfs_oper.readdir = encfs_readdir;
-  // encfs_oper.releasedir = encfs_releasedir;
+  encfs_oper.opendir = encfs_opendir;
+  encfs_oper.releasedir = encfs_releasedir;
   // encfs_oper.fsyncdir = encfs_fsyncdir;
   encfs_oper.init = encfs_init;
   // encfs_oper.access = encfs_access;
   encfs_oper.create = encfs_create;
   encfs_oper.ftruncate = encfs_ftruncate;
+  encfs_oper.fallocate = encfs_fallocate;
   encfs_oper.fgetattr = encfs_fgetattr;
   // encfs_oper.lock = encfs_lock;
   encfs_oper.utimens = encfs_utimens;
   // encfs_oper.bmap = encfs_bmap;
+  encfs_oper.ioctl = encfs_ioctl;
 
   openssl_init(encfsArgs->isThreaded);
 
+  if (!encfsArgs->serveFile.empty()) {
+    int returnCode = serveVolumes(encfsArgs, &encfs_oper);
+    MemoryPool::destroyAll();
+    openssl_shutdown(encfsArgs->isThreaded);
+    return returnCode;
+  }
+
   // context is not a smart pointer because it will live for the life of
   // the filesystem.
   auto ctx = std::make_shared<EncFS_Context>();
   ctx->publicFilesystem = encfsArgs->opts->ownerCreate;
+  // with --asyncunlock only the configuration is read before mounting
+  bool asyncUnlock = encfsArgs->opts->unlockTimeout > 0;
+  if (asyncUnlock) {
+    encfsArgs->opts->delayMount = true;
+  }
   RootPtr rootInfo = initFS(ctx.get(), encfsArgs->opts);
 
   int returnCode = EXIT_FAILURE;
 
+  if (rootInfo && !setOpTrace(ctx.get(), encfsArgs->opts, &encfs_oper)) {
+    rootInfo.reset();
+  }
+
   if (rootInfo) {
     // turn off delayMount, as our prior call to initFS has already
     // respected any delay, and we want future calls to actually
@@ -752,6 +2427,19 @@ int main(int argc, char *argv[]) {
     ctx->setRoot(rootInfo->root);
     ctx->args = encfsArgs;
     ctx->opts = encfsArgs->opts;
+    if (asyncUnlock) {
+      // statfs goes on while locked
+      ctx->rootCipherDirs.push_back(encfsArgs->opts->rootDir);
+      ctx->beginUnlock(encfsArgs->opts->unlockTimeout);
+    }
+    ctx->scheduler = newScheduler(encfsArgs->opts);
+    ctx->keepCache = newKeepCache(encfsArgs->opts);
+    setHotFiles(ctx.get(), encfsArgs->opts);
+    setStreamRequests(encfsArgs, rootInfo);
+    Stats::setEnabled(encfsArgs->opts->stats);
+    CpuBudget::setLimit(encfsArgs->opts->bgCpu);
+    Stats::setSlowThreshold((uint64_t)std::max(encfsArgs->opts->slowLogMs, 0) *
+                            1000000);
 
     if (!encfsArgs->isThreaded && encfsArgs->idleTimeout > 0) {
       // xgroup(usage)
@@ -783,11 +2471,14 @@ int main(int argc, char *argv[]) {
       // exit.  Only print information if fuse_main returned
       // immediately..
       time(&startTime);
+      fuseStarted = Stats::now();
 
       // fuse_main returns an error code in newer versions of fuse..
-      int res = fuse_main(encfsArgs->fuseArgc,
-                          const_cast<char **>(encfsArgs->fuseArgv), &encfs_oper,
-                          (void *)ctx.get());
+      int res = fuseMain(encfsArgs, &encfs_oper, (void *)ctx.get());
+      if (unlockStarted) {
+        pthread_join(unlockThread, nullptr);
+      }
+      encfs::stopAsyncLogging();
 
       time(&endTime);
 
@@ -819,15 +2510,11 @@ int main(int argc, char *argv[]) {
     }
 
     if (ctx->args->idleTimeout > 0) {
-      ctx->running = false;
-      // wake up the thread if it is waiting..
-      VLOG(1) << "waking up monitoring thread";
-      pthread_mutex_lock(&ctx->wakeupMutex);
-      pthread_cond_signal(&ctx->wakeupCond);
-      pthread_mutex_unlock(&ctx->wakeupMutex);
-      VLOG(1) << "joining with idle monitoring thread";
-      pthread_join(ctx->monitorThread, nullptr);
-      VLOG(1) << "join done";
+      VLOG(1) << "stopping idle monitoring";
+      unwatchIdle(ctx.get());
+    }
+    if (ctx->recorder && !ctx->recorder->close()) {
+      RLOG(WARNING) << "the trace of --optrace is incomplete";
     }
   }
 
@@ -840,53 +2527,3 @@ int main(int argc, char *argv[]) {
 
   return returnCode;
 }
-
-/*
-    Idle monitoring thread.  This is only used when idle monitoring is enabled.
-    It will cause the filesystem to be automatically unmounted (causing us to
-    commit suicide) if the filesystem stays idle too long.  Idle time is only
-    checked if there are no open files, as I don't want to risk problems by
-    having the filesystem unmounted from underneath open files!
-*/
-const int ActivityCheckInterval = 10;
-
-static void *idleMonitor(void *_arg) {
-  auto *ctx = (EncFS_Context *)_arg;
-  std::shared_ptr<EncFS_Args> arg = ctx->args;
-
-  const int timeoutCycles = 60 * arg->idleTimeout / ActivityCheckInterval;
-
-  bool unmountres = false;
-
-  // We will notify when FS will be unmounted, so notify that it has just been
-  // mounted
-  RLOG(INFO) << "Filesystem mounted: " << arg->opts->unmountPoint;
-
-  pthread_mutex_lock(&ctx->wakeupMutex);
-
-  while (ctx->running) {
-    unmountres = ctx->usageAndUnmount(timeoutCycles);
-    if (unmountres) {
-      break;
-    }
-
-    struct timeval currentTime;
-    gettimeofday(&currentTime, nullptr);
-    struct timespec wakeupTime;
-    wakeupTime.tv_sec = currentTime.tv_sec + ActivityCheckInterval;
-    wakeupTime.tv_nsec = currentTime.tv_usec * 1000;
-    pthread_cond_timedwait(&ctx->wakeupCond, &ctx->wakeupMutex, &wakeupTime);
-  }
-
-  pthread_mutex_unlock(&ctx->wakeupMutex);
-
-  // If we are here FS has been unmounted, so if the idleMonitor did not unmount itself,
-  // let's notify (certainly due to a kill signal, a manual unmount...)
-  if (!unmountres) {
-    RLOG(INFO) << "Filesystem unmounted: " << arg->opts->unmountPoint;
-  }
-
-  VLOG(1) << "Idle monitoring thread exiting";
-
-  return nullptr;
-}
@@ -2,7 +2,7 @@
 
 # Test EncFS normal and paranoid mode
 
-use Test::More tests => 136;
+use Test::More tests => 142;
 use File::Path;
 use File::Copy;
 use File::Temp;
@@ -91,6 +91,7 @@ sub runTests
     &grow;
     &umask0777;
     &create_unmount_remount;
+    &importTree;
     &checkReadError;
     &checkWriteError;
 
@@ -467,6 +468,40 @@ sub create_unmount_remount
     portable_unmount($mnt);
 }
 
+# Test encfsctl import
+# Encode a plaintext tree into a new volume offline, and read it back
+sub importTree
+{
+    my $crypt = "$workingDir/import.crypt";
+    my $mnt = "$workingDir/import.mnt";
+    my $src = "$workingDir/import.src";
+    if ($^O eq "cygwin")
+    {
+        $mnt = "/cygdrive/y";
+    }
+    mkdir($crypt) || BAIL_OUT($!);
+    if ($^O ne "cygwin")
+    {
+        mkdir($mnt)  || BAIL_OUT($!);
+    }
+    mkdir($src) || BAIL_OUT($!);
+    mkdir("$src/dir") || BAIL_OUT($!);
+
+    system("./build/encfs --standard --extpass=\"echo test\" $crypt $mnt 2>&1");
+    portable_unmount($mnt);
+
+    my $contents = "hello world\n";
+    open(OUT, "> $src/file") && print(OUT $contents) && close(OUT);
+    open(OUT, "> $src/dir/file") && print(OUT $contents x 1000) && close(OUT);
+
+    system("echo test | ./build/encfsctl import $crypt $src >/dev/null 2>&1");
+    ok( $? == 0, "encfsctl import returns 0");
+    is( qx(echo test | ./build/encfsctl cat $crypt file 2>/dev/null),
+        $contents, "imported file");
+    is( qx(echo test | ./build/encfsctl cat $crypt dir/file 2>/dev/null),
+        $contents x 1000, "imported file in a directory");
+}
+
 # Test that read errors are correctly thrown up to us
 sub checkReadError
 {
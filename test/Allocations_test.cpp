@@ -0,0 +1,165 @@
+#include "gtest/gtest.h"
+
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/BlockCache.h"
+#include "encfs/BlockNameIO.h"
+#include "encfs/Cipher.h"
+#include "encfs/DirNode.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileUtils.h"
+#include "encfs/NullNameIO.h"
+#include "encfs/Stats.h"
+
+using namespace encfs;
+
+namespace {
+
+// Upper bounds on the heap allocations of calls on hot paths, once they
+// are warmed up, so that new allocations there don't go unnoticed.  The
+// unit tests are linked with the allocation hook.
+
+FSConfigPtr newConfig() {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->opts->pathCacheSize = 64;
+  cfg->opts->attrCacheSize = 64;
+  cfg->nameCoding.reset(new BlockNameIO(BlockNameIO::CurrentInterface(),
+                                        cfg->cipher, cfg->key,
+                                        cfg->cipher->cipherBlockSize()));
+  cfg->nameCoding->setChainedNameIV(true);
+  return cfg;
+}
+
+// allocations made by the calls of fn, on this thread
+template <typename F>
+uint64_t allocationsOf(int calls, const F &fn) {
+  uint64_t before = Stats::allocations();
+  for (int i = 0; i < calls; ++i) {
+    fn();
+  }
+  return Stats::allocations() - before;
+}
+
+TEST(Allocations, Counted) {
+  ASSERT_TRUE(Stats::countingAllocations());
+  uint64_t n = allocationsOf(10, [] {
+    std::unique_ptr<std::string> s(new std::string(100, 'x'));
+    EXPECT_EQ(s->size(), 100u);
+  });
+  EXPECT_GE(n, 10u);
+
+  // and added up by the Timers of the FUSE calls
+  Stats::reset();
+  Stats::setEnabled(true);
+  {
+    Stats::Timer timer(Stats::Read);
+    std::vector<char> v(100);
+  }
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::allocations(Stats::Read), 1u);
+  EXPECT_NE(
+      Stats::report().find("encfs_fuse_op_allocations_total{op=\"read\"} 1"),
+      std::string::npos);
+  Stats::reset();
+}
+
+TEST(Allocations, CachedReads) {
+  FSConfigPtr cfg = newConfig();
+  cfg->blockCache = std::make_shared<BlockCache>(256 * 1024);
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  FileNode node(nullptr, cfg, "/plain", name.c_str(), 0);
+  ASSERT_GE(node.open(O_RDWR), 0);
+  std::vector<unsigned char> data(64 * 1024, 'x');
+  ASSERT_EQ(node.write(0, data.data(), data.size()), (ssize_t)data.size());
+  std::vector<unsigned char> buf(4096);
+  for (off_t offset = 0; offset < (off_t)data.size(); offset += 1000) {
+    ASSERT_EQ(node.read(offset, buf.data(), 100), 100);
+  }
+
+  // within a block and across two, from the block cache
+  off_t offset = 0;
+  uint64_t n = allocationsOf(100, [&] {
+    EXPECT_EQ(node.read(offset, buf.data(), 100), 100);
+    offset = (offset + 1000) % (data.size() - 1000);
+  });
+  EXPECT_EQ(n, 0u);
+
+  // a run of blocks from the backing file
+  n = allocationsOf(100, [&] {
+    EXPECT_EQ(node.read(offset / 1024 * 1024, buf.data(), buf.size()), 4096);
+    offset = (offset + 4096) % (data.size() - 4096);
+  });
+  // the parts of the run, and the stages of its pipeline
+  EXPECT_LE(n, 4u * 100);
+  unlink(name.c_str());
+}
+
+TEST(Allocations, CachedPaths) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig();
+  DirNode dir(nullptr, rootDir, cfg);
+  ASSERT_EQ(dir.mkdir("/d", 0700, 0, 0), 0);
+  int fd = ::creat(dir.cipherPath("/d/f").c_str(), 0600);
+  ASSERT_GE(fd, 0);
+  ::close(fd);
+
+  char cipher[PATH_MAX];
+  struct stat st;
+  ASSERT_GT(dir.cipherPathInto("/d/f", cipher, sizeof(cipher)), 0);
+  int res = 0;
+  ASSERT_TRUE(dir.listDir("/d", &res) != nullptr);
+  ASSERT_TRUE(dir.cachedAttr("/d/f", &st));
+
+  // what getattr takes from the path and attribute caches
+  uint64_t n = allocationsOf(100, [&] {
+    EXPECT_GT(dir.cipherPathInto("/d/f", cipher, sizeof(cipher)), 0);
+    EXPECT_TRUE(dir.cachedAttr("/d/f", &st));
+  });
+  EXPECT_EQ(n, 0u);
+
+  // and without the attribute cache, the cipher path as a string
+  n = allocationsOf(100, [&] { EXPECT_EQ(dir.getAttr("/d/f", &st), 0); });
+  EXPECT_LE(n, 3u * 100);
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(Allocations, NullNames) {
+  FSConfigPtr cfg = newConfig();
+  cfg->nameCoding.reset(new NullNameIO());
+  DirNode dir(nullptr, "/root/", cfg);
+
+  // names are copied, with or without a path cache to look them up in
+  char cipher[PATH_MAX];
+  char plain[PATH_MAX];
+  uint64_t n = allocationsOf(100, [&] {
+    EXPECT_GT(dir.cipherPathInto("/d/f", cipher, sizeof(cipher)), 0);
+    EXPECT_GT(cfg->nameCoding->decodePathInto("d/f", plain, sizeof(plain)),
+              0);
+  });
+  EXPECT_EQ(n, 0u);
+}
+
+}  // namespace
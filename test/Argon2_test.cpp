@@ -0,0 +1,78 @@
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <vector>
+
+#include "encfs/Argon2.h"
+
+using namespace encfs;
+
+namespace {
+
+const unsigned char Tag[32] = {
+    0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37,
+    0xa3, 0x4a, 0x8b, 0x53, 0xc9, 0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75,
+    0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59};
+
+// RFC 9106, 5.3
+TEST(Argon2Test, TestVector) {
+  if (!Argon2::supported()) {
+    return;
+  }
+  std::vector<unsigned char> password(32, 0x01);
+  std::vector<unsigned char> salt(16, 0x02);
+  std::vector<unsigned char> secret(8, 0x03);
+  std::vector<unsigned char> ad(12, 0x04);
+  unsigned char out[32];
+
+  Argon2::Params params = {3, 32, 4};
+  ASSERT_TRUE(Argon2::derive(params, password.data(), password.size(),
+                             salt.data(), salt.size(), out, sizeof(out),
+                             secret.data(), secret.size(), ad.data(),
+                             ad.size()));
+  EXPECT_EQ(memcmp(out, Tag, sizeof(Tag)), 0);
+}
+
+TEST(Argon2Test, LongOutput) {
+  if (!Argon2::supported()) {
+    return;
+  }
+  const unsigned char password[] = "password";
+  const unsigned char salt[] = "somesaltsomesalt";
+  Argon2::Params params = {1, 64, 2};
+
+  // the first bytes of a long tag differ from a short one, as the length is
+  // hashed in
+  unsigned char small[32], large[100];
+  ASSERT_TRUE(
+      Argon2::derive(params, password, 8, salt, 16, small, sizeof(small)));
+  ASSERT_TRUE(
+      Argon2::derive(params, password, 8, salt, 16, large, sizeof(large)));
+  EXPECT_NE(memcmp(small, large, sizeof(small)), 0);
+
+  unsigned char again[100];
+  ASSERT_TRUE(
+      Argon2::derive(params, password, 8, salt, 16, again, sizeof(again)));
+  EXPECT_EQ(memcmp(large, again, sizeof(large)), 0);
+}
+
+TEST(Argon2Test, InvalidParams) {
+  const unsigned char password[] = "password";
+  const unsigned char salt[] = "somesaltsomesalt";
+  unsigned char out[32];
+
+  Argon2::Params noPasses = {0, 64, 1};
+  EXPECT_FALSE(
+      Argon2::derive(noPasses, password, 8, salt, 16, out, sizeof(out)));
+  Argon2::Params noLanes = {1, 64, 0};
+  EXPECT_FALSE(
+      Argon2::derive(noLanes, password, 8, salt, 16, out, sizeof(out)));
+  Argon2::Params tooLittle = {1, 16, 4};
+  EXPECT_FALSE(
+      Argon2::derive(tooLittle, password, 8, salt, 16, out, sizeof(out)));
+  Argon2::Params ok = {1, 64, 1};
+  EXPECT_FALSE(Argon2::derive(ok, password, 8, salt, 7, out, sizeof(out)));
+  EXPECT_FALSE(Argon2::derive(ok, password, 8, salt, 16, out, 3));
+}
+
+}  // namespace
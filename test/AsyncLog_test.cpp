@@ -0,0 +1,134 @@
+#include "gtest/gtest.h"
+
+#include <mutex>
+#include <string>
+#include <syslog.h>
+#include <thread>
+#include <vector>
+
+#include "encfs/AsyncLog.h"
+
+using namespace encfs;
+
+namespace {
+
+struct Lines {
+  std::mutex mutex;
+  std::vector<std::string> lines;
+  std::vector<int> priorities;
+
+  AsyncLog::Sink sink() {
+    return [this](int channel, int priority, const char *line, size_t len) {
+      std::lock_guard<std::mutex> lock(mutex);
+      lines.push_back(std::to_string(channel) + ":" + std::string(line, len));
+      priorities.push_back(priority);
+    };
+  }
+};
+
+TEST(AsyncLogTest, WritesInOrder) {
+  Lines out;
+  AsyncLog log(16, 0, out.sink());
+  for (int i = 0; i < 100; ++i) {
+    std::string line = "line " + std::to_string(i);
+    log.write(i % 2, LOG_INFO, line.data(), line.size());
+    if (i % 10 == 0) {
+      log.flush();
+    }
+  }
+  log.flush();
+
+  ASSERT_LE(out.lines.size(), 101u);
+  size_t next = 0;
+  for (const std::string &line : out.lines) {
+    if (line.find("dropped") != std::string::npos) {
+      continue;
+    }
+    // anything dropped on a full ring is left out, the rest keep their order
+    size_t i = std::stoul(line.substr(line.find(' ') + 1));
+    EXPECT_GE(i, next);
+    EXPECT_EQ(line.substr(0, 2), std::to_string(i % 2) + ":");
+    next = i + 1;
+  }
+  EXPECT_EQ(next, 100u);
+}
+
+TEST(AsyncLogTest, LongLinesAreCut) {
+  Lines out;
+  {
+    AsyncLog log(4, 0, out.sink());
+    std::string line(AsyncLog::LineSize * 2, 'x');
+    EXPECT_TRUE(log.write(0, LOG_ERR, line.data(), line.size()));
+  }
+  ASSERT_EQ(out.lines.size(), 1u);
+  EXPECT_EQ(out.lines[0], "0:" + std::string(AsyncLog::LineSize, 'x'));
+}
+
+TEST(AsyncLogTest, RateLimitsInformation) {
+  Lines out;
+  {
+    AsyncLog log(1024, 10, out.sink());
+    int written = 0;
+    for (int i = 0; i < 100; ++i) {
+      written += log.write(0, LOG_DEBUG, "debug", 5) ? 1 : 0;
+    }
+    // a second may start during the loop
+    EXPECT_LE(written, 20);
+    EXPECT_GE(log.dropped(), 80u);
+
+    // warnings and errors aren't limited
+    for (int i = 0; i < 100; ++i) {
+      EXPECT_TRUE(log.write(0, LOG_WARNING, "warning", 7));
+    }
+  }
+  int reports = 0;
+  for (size_t i = 0; i < out.lines.size(); ++i) {
+    if (out.lines[i].find("0:dropped ") == 0) {
+      EXPECT_EQ(out.priorities[i], LOG_WARNING);
+      ++reports;
+    }
+  }
+  EXPECT_GE(reports, 1);
+}
+
+TEST(AsyncLogTest, ConcurrentWriters) {
+  const int Threads = 8;
+  const int Lines = 1000;
+  struct Lines out;
+  uint64_t dropped;
+  {
+    AsyncLog log(64, 0, out.sink());
+    std::vector<std::thread> threads;
+    for (int t = 0; t < Threads; ++t) {
+      threads.emplace_back([&log, t]() {
+        for (int i = 0; i < Lines; ++i) {
+          std::string line = std::to_string(t) + " " + std::to_string(i);
+          log.write(0, LOG_INFO, line.data(), line.size());
+        }
+      });
+    }
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    log.flush();
+    dropped = log.dropped();
+  }
+
+  // each line either arrived in its writer's order, or was counted dropped
+  std::vector<int> next(Threads, 0);
+  size_t arrived = 0;
+  for (const std::string &line : out.lines) {
+    if (line.find("dropped") != std::string::npos) {
+      continue;
+    }
+    size_t space = line.find(' ');
+    int t = std::stoi(line.substr(2, space - 2));
+    int i = std::stoi(line.substr(space + 1));
+    EXPECT_GE(i, next[t]);
+    next[t] = i + 1;
+    ++arrived;
+  }
+  EXPECT_EQ(arrived + dropped, (uint64_t)Threads * Lines);
+}
+
+}  // namespace
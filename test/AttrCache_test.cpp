@@ -0,0 +1,141 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "encfs/AttrCache.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat makeStat(ino_t inode, off_t size) {
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  st.st_ino = inode;
+  st.st_size = size;
+  return st;
+}
+
+TEST(AttrCache, PutGet) {
+  AttrCache cache(10);
+  cache.put("/a/b", makeStat(1, 42), cache.generation());
+
+  struct stat st;
+  ASSERT_TRUE(cache.get("/a/b", &st));
+  EXPECT_EQ(st.st_ino, 1u);
+  EXPECT_EQ(st.st_size, 42);
+  EXPECT_FALSE(cache.get("/a", &st));
+  EXPECT_FALSE(cache.get("/a/b/c", &st));
+}
+
+TEST(AttrCache, EvictsLeastRecentlyUsed) {
+  AttrCache cache(3);
+  struct stat st;
+  cache.put("/1", makeStat(1, 0), cache.generation());
+  cache.put("/2", makeStat(2, 0), cache.generation());
+  cache.put("/3", makeStat(3, 0), cache.generation());
+
+  // touch /1, so /2 is the oldest
+  EXPECT_TRUE(cache.get("/1", &st));
+  cache.put("/4", makeStat(4, 0), cache.generation());
+
+  EXPECT_EQ(cache.size(), 3u);
+  EXPECT_TRUE(cache.get("/1", &st));
+  EXPECT_FALSE(cache.get("/2", &st));
+  EXPECT_TRUE(cache.get("/4", &st));
+}
+
+TEST(AttrCache, PutReplaces) {
+  AttrCache cache(10);
+  cache.put("/x", makeStat(1, 10), cache.generation());
+  cache.put("/x", makeStat(1, 20), cache.generation());
+
+  struct stat st;
+  ASSERT_TRUE(cache.get("/x", &st));
+  EXPECT_EQ(st.st_size, 20);
+  EXPECT_EQ(cache.size(), 1u);
+}
+
+TEST(AttrCache, InvalidateHardLinks) {
+  AttrCache cache(10);
+  cache.put("/a", makeStat(7, 0), cache.generation());
+  cache.put("/dir/b", makeStat(7, 0), cache.generation());
+  cache.put("/c", makeStat(8, 0), cache.generation());
+
+  // a chmod through one name changes them all
+  cache.invalidate("/a", false);
+  struct stat st;
+  EXPECT_FALSE(cache.get("/a", &st));
+  EXPECT_FALSE(cache.get("/dir/b", &st));
+  EXPECT_TRUE(cache.get("/c", &st));
+}
+
+TEST(AttrCache, InvalidateSubtree) {
+  AttrCache cache(10);
+  ino_t inode = 1;
+  for (const char *path : {"/a", "/a/b", "/a/b/c", "/ab"}) {
+    cache.put(path, makeStat(inode++, 0), cache.generation());
+  }
+
+  struct stat st;
+  cache.invalidate("/a/b", false);
+  EXPECT_FALSE(cache.get("/a/b", &st));
+  EXPECT_TRUE(cache.get("/a/b/c", &st));
+
+  cache.invalidate("/a");
+  EXPECT_FALSE(cache.get("/a", &st));
+  EXPECT_FALSE(cache.get("/a/b/c", &st));
+  EXPECT_TRUE(cache.get("/ab", &st));
+}
+
+TEST(AttrCache, StaleGeneration) {
+  AttrCache cache(10);
+  struct stat st;
+
+  // a change which raced with the lookup wins
+  uint64_t generation = cache.generation();
+  cache.invalidate("/x");
+  cache.put("/x", makeStat(1, 0), generation);
+  EXPECT_FALSE(cache.get("/x", &st));
+
+  cache.put("/x", makeStat(1, 0), cache.generation());
+  EXPECT_TRUE(cache.get("/x", &st));
+}
+
+TEST(AttrCache, Expires) {
+  AttrCache cache(10);
+  struct stat st;
+  cache.put("/x", makeStat(1, 0), cache.generation());
+  EXPECT_TRUE(cache.get("/x", &st));
+
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(AttrCache::Timeout * 1000 + 50));
+  EXPECT_FALSE(cache.get("/x", &st));
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(AttrCache, LongerTimeout) {
+  // --netfs keeps entries for longer, changes through the mount still count
+  AttrCache cache(10, 60);
+  struct stat st;
+  cache.put("/x", makeStat(1, 0), cache.generation());
+
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(AttrCache::Timeout * 1000 + 50));
+  EXPECT_TRUE(cache.get("/x", &st));
+
+  cache.invalidate("/x");
+  EXPECT_FALSE(cache.get("/x", &st));
+}
+
+TEST(AttrCache, Disabled) {
+  AttrCache cache(0);
+  struct stat st;
+  cache.put("/x", makeStat(1, 0), cache.generation());
+  EXPECT_FALSE(cache.get("/x", &st));
+}
+
+}  // namespace
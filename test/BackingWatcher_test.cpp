@@ -0,0 +1,99 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encfs/BackingWatcher.h"
+
+using namespace encfs;
+
+namespace {
+
+class BackingWatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = std::string(root) + "/";
+  }
+
+  void TearDown() override {
+    watcher.reset();
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  void watch() {
+    watcher.reset(new BackingWatcher(rootDir, [this](const std::string &p) {
+      std::lock_guard<std::mutex> lock(mutex);
+      seen.insert(p);
+      cond.notify_all();
+    }));
+    ASSERT_TRUE(watcher->complete());
+  }
+
+  // true once path was reported, waiting a few seconds at most
+  bool reported(const std::string &path) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cond.wait_for(lock, std::chrono::seconds(5), [&] {
+      return seen.count(path) != 0;
+    });
+  }
+
+  void writeFile(const std::string &path, const char *data) {
+    int fd = ::open((rootDir + path).c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                    0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::write(fd, data, strlen(data)), (ssize_t)strlen(data));
+    ::close(fd);
+  }
+
+  std::string rootDir;
+  std::unique_ptr<BackingWatcher> watcher;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::set<std::string> seen;
+};
+
+TEST_F(BackingWatcherTest, ReportsChangedPaths) {
+  ASSERT_EQ(mkdir((rootDir + "old").c_str(), 0700), 0);
+  watch();
+
+  writeFile("f", "data");
+  EXPECT_TRUE(reported("f"));
+  writeFile("old/g", "data");
+  EXPECT_TRUE(reported("old/g"));
+  ASSERT_EQ(chmod((rootDir + "f").c_str(), 0640), 0);
+  ASSERT_EQ(rename((rootDir + "f").c_str(), (rootDir + "h").c_str()), 0);
+  EXPECT_TRUE(reported("h"));
+  ASSERT_EQ(unlink((rootDir + "old/g").c_str()), 0);
+  EXPECT_TRUE(reported("old/g"));
+}
+
+TEST_F(BackingWatcherTest, FollowsNewAndMovedDirectories) {
+  watch();
+
+  ASSERT_EQ(mkdir((rootDir + "d").c_str(), 0700), 0);
+  EXPECT_TRUE(reported("d"));
+  ASSERT_EQ(mkdir((rootDir + "d/e").c_str(), 0700), 0);
+  EXPECT_TRUE(reported("d/e"));
+  writeFile("d/e/f", "data");
+  EXPECT_TRUE(reported("d/e/f"));
+
+  // the watches moved along have their new paths
+  ASSERT_EQ(rename((rootDir + "d").c_str(), (rootDir + "m").c_str()), 0);
+  EXPECT_TRUE(reported("m"));
+  writeFile("m/e/f", "more");
+  EXPECT_TRUE(reported("m/e/f"));
+}
+
+}  // namespace
@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <vector>
+
+#include "encfs/BlockArena.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(BlockArena, SlotsAreReusedAndZeroed) {
+  BlockArena arena(64 * 1024, false);
+
+  unsigned char *a = arena.allocate(1000);
+  unsigned char *b = arena.allocate(1000);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(arena.mapped(), 2048u);
+  memset(a, 'a', 1000);
+
+  arena.release(a, 1000);
+  EXPECT_EQ(a[0], 0);
+  EXPECT_EQ(a[999], 0);
+
+  // same slot size: the freed slot comes back, the mapping doesn't grow
+  unsigned char *c = arena.allocate(990);
+  EXPECT_EQ(c, a);
+  EXPECT_EQ(arena.mapped(), 2048u);
+
+  arena.release(b, 1000);
+  arena.release(c, 990);
+}
+
+TEST(BlockArena, HeapOnceFull) {
+  BlockArena arena(4096, false);
+  std::vector<unsigned char *> blocks;
+  // more than the mapping holds
+  for (int i = 0; i < 4096; ++i) {
+    blocks.push_back(arena.allocate(1024));
+    memset(blocks.back(), 'x', 1024);
+  }
+  for (unsigned char *data : blocks) {
+    arena.release(data, 1024);
+  }
+}
+
+TEST(BlockArena, Locked) {
+  // locking may fail for lack of RLIMIT_MEMLOCK, the arena works anyway
+  BlockArena arena(1 << 20, true);
+  unsigned char *data = arena.allocate(4096);
+  memset(data, 'y', 4096);
+  arena.release(data, 4096);
+}
+
+TEST(BlockArena, TrimKeepsSlotsUsable) {
+  BlockArena arena(1 << 20, false);
+  std::vector<unsigned char *> blocks;
+  for (int i = 0; i < 64; ++i) {
+    blocks.push_back(arena.allocate(4096));
+    memset(blocks.back(), 'z', 4096);
+  }
+  // every other block is freed, then all of them
+  for (size_t i = 0; i < blocks.size(); i += 2) {
+    arena.release(blocks[i], 4096);
+  }
+  arena.trim();
+  EXPECT_EQ(blocks[1][0], 'z');
+  unsigned char *again = arena.allocate(4096);
+  EXPECT_EQ(again[0], 0);
+  EXPECT_EQ(again[4095], 0);
+  arena.release(again, 4096);
+
+  for (size_t i = 1; i < blocks.size(); i += 2) {
+    arena.release(blocks[i], 4096);
+  }
+  arena.trim();
+  EXPECT_EQ(arena.mapped(), 0u);
+  unsigned char *first = arena.allocate(4096);
+  EXPECT_EQ(first[0], 0);
+  arena.release(first, 4096);
+}
+
+}  // namespace
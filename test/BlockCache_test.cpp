@@ -0,0 +1,265 @@
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "encfs/BlockCache.h"
+#include "encfs/Stats.h"
+
+using namespace encfs;
+
+TEST(BlockCache, PutGet) {
+  BlockCache cache(4096);
+  uint64_t owner = cache.newOwner();
+
+  unsigned char in[100], out[100];
+  memset(in, 'a', sizeof(in));
+  cache.put(owner, 3, in, sizeof(in));
+
+  EXPECT_EQ(cache.get(owner, 3, out, sizeof(out)), (ssize_t)sizeof(in));
+  EXPECT_EQ(memcmp(in, out, sizeof(in)), 0);
+  EXPECT_EQ(cache.get(owner, 4, out, sizeof(out)), -1);
+  EXPECT_EQ(cache.get(cache.newOwner(), 3, out, sizeof(out)), -1);
+}
+
+TEST(BlockCache, EvictsLeastRecentlyUsed) {
+  BlockCache cache(3 * 1024);
+  uint64_t owner = cache.newOwner();
+
+  unsigned char buf[1024];
+  memset(buf, 0, sizeof(buf));
+  for (off_t block = 0; block < 3; ++block) {
+    cache.put(owner, block, buf, sizeof(buf));
+  }
+  // touch block 0, so block 1 is the oldest
+  EXPECT_GE(cache.get(owner, 0, buf, sizeof(buf)), 0);
+  cache.put(owner, 3, buf, sizeof(buf));
+
+  EXPECT_LE(cache.size(), cache.capacity());
+  EXPECT_GE(cache.get(owner, 0, buf, sizeof(buf)), 0);
+  EXPECT_EQ(cache.get(owner, 1, buf, sizeof(buf)), -1);
+  EXPECT_GE(cache.get(owner, 3, buf, sizeof(buf)), 0);
+}
+
+TEST(BlockCache, Limit) {
+  BlockCache cache(8 * 1024);
+  uint64_t owner = cache.newOwner();
+
+  unsigned char buf[1024];
+  memset(buf, 0, sizeof(buf));
+  for (off_t block = 0; block < 8; ++block) {
+    cache.put(owner, block, buf, sizeof(buf));
+  }
+  cache.setLimit(2 * 1024);
+  EXPECT_EQ(cache.size(), 2u * 1024);
+  EXPECT_EQ(cache.get(owner, 5, buf, sizeof(buf)), -1);
+  EXPECT_GE(cache.get(owner, 7, buf, sizeof(buf)), 0);
+  cache.put(owner, 8, buf, sizeof(buf));
+  EXPECT_EQ(cache.size(), 2u * 1024);
+
+  // grown back, and beyond
+  cache.setLimit(12 * 1024);
+  for (off_t block = 0; block < 16; ++block) {
+    cache.put(owner, block, buf, sizeof(buf));
+  }
+  EXPECT_EQ(cache.size(), 12u * 1024);
+}
+
+TEST(BlockCache, Invalidate) {
+  BlockCache cache(64 * 1024);
+  uint64_t owner = cache.newOwner();
+  uint64_t other = cache.newOwner();
+
+  unsigned char buf[512];
+  memset(buf, 0, sizeof(buf));
+  for (off_t block = 0; block < 8; ++block) {
+    cache.put(owner, block, buf, sizeof(buf));
+    cache.put(other, block, buf, sizeof(buf));
+  }
+
+  cache.invalidate(owner, 1);
+  EXPECT_EQ(cache.get(owner, 1, buf, sizeof(buf)), -1);
+
+  cache.invalidateFrom(owner, 5);
+  EXPECT_GE(cache.get(owner, 4, buf, sizeof(buf)), 0);
+  EXPECT_EQ(cache.get(owner, 5, buf, sizeof(buf)), -1);
+  EXPECT_EQ(cache.get(owner, 7, buf, sizeof(buf)), -1);
+
+  cache.invalidateOwner(owner);
+  EXPECT_EQ(cache.get(owner, 0, buf, sizeof(buf)), -1);
+  EXPECT_GE(cache.get(other, 7, buf, sizeof(buf)), 0);
+  EXPECT_EQ(cache.size(), 8 * sizeof(buf));
+}
+
+TEST(BlockCache, Counters) {
+  Stats::reset();
+  Stats::setEnabled(true);
+  BlockCache cache(2 * 1024);
+  uint64_t owner = cache.newOwner();
+
+  unsigned char buf[1024];
+  memset(buf, 0, sizeof(buf));
+  cache.put(owner, 0, buf, sizeof(buf), true);
+  cache.put(owner, 1, buf, sizeof(buf), true);
+  EXPECT_GE(cache.get(owner, 0, buf, sizeof(buf)), 0);
+  EXPECT_GE(cache.get(owner, 0, buf, sizeof(buf)), 0);
+
+  // pushes out block 1, which was never read
+  cache.put(owner, 2, buf, sizeof(buf));
+  cache.invalidate(owner, 2);
+  // a closing file doesn't invalidate anything
+  cache.invalidateOwner(owner);
+  Stats::setEnabled(false);
+
+  EXPECT_EQ(Stats::value(Stats::ReadAheadUsed), 1u);
+  EXPECT_EQ(Stats::value(Stats::ReadAheadWasted), 1u);
+  EXPECT_EQ(Stats::value(Stats::CacheEvictions), 1u);
+  EXPECT_EQ(Stats::value(Stats::CacheInvalidations), 1u);
+  EXPECT_NE(Stats::report().find("encfs_block_cache_evictions_total 1\n"),
+            std::string::npos);
+  Stats::reset();
+}
+
+TEST(BlockCache, ConcurrentMissesLoadOnce) {
+  BlockCache cache(4096);
+  uint64_t owner = cache.newOwner();
+  unsigned char buf[100];
+
+  bool claimed = false;
+  EXPECT_EQ(cache.getOrClaim(owner, 0, buf, sizeof(buf), &claimed), -1);
+  EXPECT_TRUE(claimed);
+
+  // another block, or owner, is claimed separately
+  bool other = false;
+  EXPECT_EQ(cache.getOrClaim(owner, 1, buf, sizeof(buf), &other), -1);
+  EXPECT_TRUE(other);
+  cache.loaded(owner, 1);
+
+  // a second reader waits for the first, and gets its block
+  ssize_t len = 0;
+  bool waiterClaimed = true;
+  std::thread waiter([&]() {
+    unsigned char out[100];
+    len = cache.getOrClaim(owner, 0, out, sizeof(out), &waiterClaimed);
+  });
+  unsigned char in[100];
+  memset(in, 'a', sizeof(in));
+  cache.put(owner, 0, in, sizeof(in));
+  cache.loaded(owner, 0);
+  waiter.join();
+  EXPECT_EQ(len, (ssize_t)sizeof(in));
+  EXPECT_FALSE(waiterClaimed);
+
+  // if the loader couldn't keep the block, the waiter loads it
+  EXPECT_EQ(cache.getOrClaim(owner, 2, buf, sizeof(buf), &claimed), -1);
+  EXPECT_TRUE(claimed);
+  std::thread next([&]() {
+    unsigned char out[100];
+    len = cache.getOrClaim(owner, 2, out, sizeof(out), &waiterClaimed);
+  });
+  cache.loaded(owner, 2);
+  next.join();
+  EXPECT_EQ(len, -1);
+  EXPECT_TRUE(waiterClaimed);
+  cache.loaded(owner, 2);
+}
+
+TEST(BlockCache, TwoQueueResistsScans) {
+  for (BlockCache::Policy policy : {BlockCache::Lru, BlockCache::TwoQueue}) {
+    BlockCache cache(8 * 1024, false, policy);
+    uint64_t hot = cache.newOwner();
+    uint64_t stream = cache.newOwner();
+
+    unsigned char buf[1024];
+    memset(buf, 0, sizeof(buf));
+    for (off_t block = 0; block < 4; ++block) {
+      cache.put(hot, block, buf, sizeof(buf));
+      EXPECT_GE(cache.get(hot, block, buf, sizeof(buf)), 0);
+    }
+
+    // a stream reads each block once, read ahead ones as they arrive
+    for (off_t block = 0; block < 32; ++block) {
+      cache.put(stream, block, buf, sizeof(buf), block % 2 == 0, true);
+      EXPECT_GE(cache.get(stream, block, buf, sizeof(buf)), 0);
+    }
+    EXPECT_LE(cache.size(), cache.capacity());
+
+    int kept = 0;
+    for (off_t block = 0; block < 4; ++block) {
+      if (cache.get(hot, block, buf, sizeof(buf)) >= 0) {
+        ++kept;
+      }
+    }
+    EXPECT_EQ(kept, policy == BlockCache::Lru ? 0 : 4);
+  }
+}
+
+TEST(BlockCache, TwoQueueRemembersEvicted) {
+  BlockCache cache(8 * 1024, false, BlockCache::TwoQueue);
+  uint64_t owner = cache.newOwner();
+
+  unsigned char buf[1024];
+  memset(buf, 0, sizeof(buf));
+  cache.put(owner, 0, buf, sizeof(buf));
+  for (off_t block = 100; block < 110; ++block) {
+    cache.put(owner, block, buf, sizeof(buf));
+  }
+  EXPECT_EQ(cache.get(owner, 0, buf, sizeof(buf)), -1);
+
+  // put again soon after, it skips probation
+  cache.put(owner, 0, buf, sizeof(buf));
+  for (off_t block = 200; block < 220; ++block) {
+    cache.put(owner, block, buf, sizeof(buf), false, true);
+  }
+  EXPECT_GE(cache.get(owner, 0, buf, sizeof(buf)), 0);
+
+  // streamed blocks aren't remembered
+  EXPECT_EQ(cache.get(owner, 200, buf, sizeof(buf)), -1);
+  cache.put(owner, 200, buf, sizeof(buf));
+  for (off_t block = 300; block < 320; ++block) {
+    cache.put(owner, block, buf, sizeof(buf));
+  }
+  EXPECT_EQ(cache.get(owner, 200, buf, sizeof(buf)), -1);
+
+  BlockCache::Policy policy;
+  EXPECT_TRUE(BlockCache::policyByName("2q", &policy));
+  EXPECT_EQ(policy, BlockCache::TwoQueue);
+  EXPECT_FALSE(BlockCache::policyByName("arc", &policy));
+}
+
+TEST(BlockCache, PinnedOutlastsOthers) {
+  BlockCache cache(8 * 1024, false, BlockCache::TwoQueue);
+  uint64_t hot = cache.newOwner();
+  uint64_t stream = cache.newOwner();
+
+  unsigned char buf[1024];
+  memset(buf, 0, sizeof(buf));
+  cache.put(hot, 0, buf, sizeof(buf));
+  cache.pin(hot, true);
+  cache.put(hot, 1, buf, sizeof(buf));
+  EXPECT_EQ(cache.pinnedSize(), 2 * sizeof(buf));
+
+  // a stream many times the size of the cache leaves the pinned blocks
+  for (off_t block = 0; block < 64; ++block) {
+    cache.put(stream, block, buf, sizeof(buf), false, true);
+  }
+  EXPECT_GE(cache.get(hot, 0, buf, sizeof(buf)), 0);
+  EXPECT_GE(cache.get(hot, 1, buf, sizeof(buf)), 0);
+  EXPECT_LE(cache.size(), cache.capacity());
+
+  // but only up to half of the cache
+  for (off_t block = 2; block < 8; ++block) {
+    cache.put(hot, block, buf, sizeof(buf));
+  }
+  EXPECT_EQ(cache.pinnedSize(), 4 * sizeof(buf));
+  EXPECT_EQ(cache.get(hot, 0, buf, sizeof(buf)), -1);
+  EXPECT_GE(cache.get(hot, 7, buf, sizeof(buf)), 0);
+
+  // unpinned blocks are kept as used ones
+  cache.pin(hot, false);
+  EXPECT_EQ(cache.pinnedSize(), 0u);
+  EXPECT_GE(cache.get(hot, 7, buf, sizeof(buf)), 0);
+  cache.invalidateOwner(hot);
+  EXPECT_EQ(cache.get(hot, 7, buf, sizeof(buf)), -1);
+}
@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/BufferBudget.h"
+#include "encfs/Cipher.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/Stats.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(BufferBudgetTest, Limit) {
+  int64_t before = Stats::value(Stats::BufferBytes);
+  {
+    BufferBudget budget(3000);
+    EXPECT_TRUE(budget.reserve(1024));
+    EXPECT_TRUE(budget.reserve(1024));
+    EXPECT_FALSE(budget.reserve(1024));
+    EXPECT_EQ(budget.used(), 2048u);
+    EXPECT_EQ(Stats::value(Stats::BufferBytes), before + 2048);
+    budget.release(1024);
+    EXPECT_TRUE(budget.reserve(1024));
+
+    BufferBudget unlimited(0);
+    EXPECT_TRUE(unlimited.reserve(1 << 30));
+  }
+  EXPECT_EQ(Stats::value(Stats::BufferBytes), before);
+}
+
+class BufferBudgetFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->config->uniqueIV = true;
+    cfg->opts.reset(new EncFS_Opts);
+    cfg->bufferBudget = std::make_shared<BufferBudget>(1024);
+  }
+
+  void TearDown() override {
+    for (auto &name : names) {
+      unlink(name.c_str());
+    }
+  }
+
+  std::shared_ptr<FileNode> openNode() {
+    std::string name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    EXPECT_GE(fd, 0);
+    close(fd);
+    names.push_back(name);
+    auto node = std::make_shared<FileNode>(nullptr, cfg, "/f", name.c_str(), 0);
+    EXPECT_GE(node->open(O_RDWR), 0);
+    return node;
+  }
+
+  FSConfigPtr cfg;
+  std::vector<std::string> names;
+};
+
+TEST_F(BufferBudgetFileTest, OnlyWithinBudget) {
+  std::vector<unsigned char> data(3000, 'x');
+  std::vector<unsigned char> buf(100);
+
+  auto a = openNode();
+  ASSERT_EQ(a->write(0, data.data(), data.size()), (ssize_t)data.size());
+  EXPECT_EQ(cfg->bufferBudget->used(), 1024u);
+
+  // no buffer left for b, which still works
+  auto b = openNode();
+  ASSERT_EQ(b->write(0, data.data(), data.size()), (ssize_t)data.size());
+  EXPECT_EQ(b->read(2900, buf.data(), buf.size()), 100);
+  EXPECT_EQ(buf[99], 'x');
+  EXPECT_EQ(cfg->bufferBudget->used(), 1024u);
+
+  // parking a gives its buffer back
+  ASSERT_TRUE(a->park());
+  EXPECT_EQ(cfg->bufferBudget->used(), 0u);
+  EXPECT_EQ(b->read(0, buf.data(), buf.size()), 100);
+  EXPECT_EQ(cfg->bufferBudget->used(), 1024u);
+
+  b.reset();
+  EXPECT_EQ(cfg->bufferBudget->used(), 0u);
+}
+
+}  // namespace
@@ -0,0 +1,76 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "encfs/ByteShuffle.h"
+
+using namespace encfs;
+
+namespace {
+
+std::vector<unsigned char> testData(int length, int seed) {
+  std::vector<unsigned char> data(length);
+  for (int i = 0; i < length; ++i) {
+    data[i] = (unsigned char)(i * 13 + seed * 7 + (i >> 3));
+  }
+  return data;
+}
+
+TEST(ByteShuffle, MatchesScalar) {
+  for (int length = 1; length <= 300; ++length) {
+    for (int seed = 0; seed < 5; ++seed) {
+      std::vector<unsigned char> in = testData(length, seed);
+
+      std::vector<unsigned char> expected = in;
+      std::vector<unsigned char> actual = in;
+      shuffleBytesScalar(expected.data(), length);
+      shuffleBytes(actual.data(), length);
+      EXPECT_EQ(actual, expected) << "shuffleBytes " << length;
+
+      expected = in;
+      actual = in;
+      unshuffleBytesScalar(expected.data(), length);
+      unshuffleBytes(actual.data(), length);
+      EXPECT_EQ(actual, expected) << "unshuffleBytes " << length;
+
+      expected = in;
+      actual = in;
+      flipBytesScalar(expected.data(), length);
+      flipBytes(actual.data(), length);
+      EXPECT_EQ(actual, expected) << "flipBytes " << length;
+    }
+  }
+}
+
+TEST(ByteShuffle, KnownValues) {
+  std::vector<unsigned char> buf = {1, 2, 4, 8, 16};
+  shuffleBytes(buf.data(), buf.size());
+  EXPECT_EQ(buf, std::vector<unsigned char>({1, 3, 7, 15, 31}));
+  unshuffleBytes(buf.data(), buf.size());
+  EXPECT_EQ(buf, std::vector<unsigned char>({1, 2, 4, 8, 16}));
+
+  // 64 byte chunks, and a short one at the end
+  buf.resize(70);
+  for (int i = 0; i < 70; ++i) {
+    buf[i] = i;
+  }
+  flipBytes(buf.data(), buf.size());
+  EXPECT_EQ(buf[0], 63);
+  EXPECT_EQ(buf[63], 0);
+  EXPECT_EQ(buf[64], 69);
+  EXPECT_EQ(buf[69], 64);
+}
+
+TEST(ByteShuffle, RoundTrip) {
+  for (int length = 1; length <= 300; length += 11) {
+    std::vector<unsigned char> in = testData(length, length);
+    std::vector<unsigned char> buf = in;
+    shuffleBytes(buf.data(), length);
+    flipBytes(buf.data(), length);
+    flipBytes(buf.data(), length);
+    unshuffleBytes(buf.data(), length);
+    EXPECT_EQ(buf, in) << length;
+  }
+}
+
+}  // namespace
@@ -0,0 +1,70 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherBench.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(CipherBench, MeasuresCipherAndNames) {
+  std::shared_ptr<Cipher> cipher = Cipher::New("AES", 192);
+  ASSERT_TRUE(cipher != nullptr);
+
+  CipherSpeed speed;
+  ASSERT_TRUE(benchCipher(cipher, 1024, 5, &speed));
+  EXPECT_EQ(speed.keySize, 192);
+  EXPECT_EQ(speed.blockSize, 1024);
+  EXPECT_GT(speed.encode, 0);
+  EXPECT_GT(speed.decode, 0);
+  EXPECT_GT(speed.mac, 0);
+
+  NameSpeed names;
+  ASSERT_TRUE(benchNames(cipher, 5, &names));
+  EXPECT_GT(names.encode, 0);
+  EXPECT_GT(names.decode, 0);
+}
+
+TEST(CipherBench, MeasuresBackingIO) {
+  char dir[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+
+  IOSpeed speed;
+  EXPECT_EQ(benchBackingIO(dir, 4096, 1, &speed), 0);
+  EXPECT_EQ(speed.blockSize, 4096);
+  EXPECT_GT(speed.write, 0);
+  EXPECT_GT(speed.read, 0);
+
+  // the scratch file is gone
+  EXPECT_EQ(rmdir(dir), 0);
+  EXPECT_EQ(benchBackingIO("/nonexistent", 4096, 1, &speed), -ENOENT);
+}
+
+TEST(CipherBench, FastestConfigMeetsProfile) {
+  BenchProfile profile;
+  profile.minKeySize = 256;
+  profile.blockMAC = true;
+  BenchChoice choice;
+  ASSERT_TRUE(fastestConfig(profile, std::string(), 2, &choice));
+
+  EXPECT_EQ(choice.keySize, 256);
+  EXPECT_TRUE(choice.alg.keyLength.allowed(choice.keySize));
+  EXPECT_TRUE(choice.blockSize == 1024 || choice.blockSize == 2048 ||
+              choice.blockSize == 4096);
+  EXPECT_GT(choice.speed, 0);
+
+  std::shared_ptr<Cipher> cipher = Cipher::New(choice.alg.name, 256);
+  ASSERT_TRUE(cipher != nullptr);
+  EXPECT_EQ(cipher->cipherBlockSize(), 16);
+  EXPECT_FALSE(cipher->randomAccess());
+
+  // nothing has a key this long
+  profile.minKeySize = 512;
+  EXPECT_FALSE(fastestConfig(profile, std::string(), 2, &choice));
+}
+
+}  // namespace
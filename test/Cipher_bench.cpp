@@ -0,0 +1,191 @@
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherKey.h"
+
+using namespace encfs;
+
+// AES key sizes by block sizes: the ends and middle of AESBlockRange
+static void KeyAndBlockSizes(benchmark::internal::Benchmark* b) {
+  for (int keySize : {128, 192, 256}) {
+    for (int blockSize : {64, 256, 1024, 4096}) {
+      b->Args({keySize, blockSize});
+    }
+  }
+  b->ArgNames({"key", "block"});
+}
+
+struct CipherSetup {
+  std::shared_ptr<Cipher> cipher;
+  CipherKey key;
+  std::vector<unsigned char> buf;
+
+  CipherSetup(int keySize, int size)
+      : cipher(Cipher::New("AES", keySize)), buf(size) {
+    key = cipher->newRandomKey();
+    cipher->randomize(buf.data(), size, false);
+  }
+};
+
+static void BM_BlockEncode(benchmark::State& state) {
+  CipherSetup s(state.range(0), state.range(1));
+  uint64_t iv = 0;
+  while (state.KeepRunning()) {
+    s.cipher->blockEncode(s.buf.data(), s.buf.size(), ++iv, s.key);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * s.buf.size());
+}
+BENCHMARK(BM_BlockEncode)->Apply(KeyAndBlockSizes);
+
+static void BM_BlockDecode(benchmark::State& state) {
+  CipherSetup s(state.range(0), state.range(1));
+  uint64_t iv = 0;
+  while (state.KeepRunning()) {
+    s.cipher->blockDecode(s.buf.data(), s.buf.size(), ++iv, s.key);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * s.buf.size());
+}
+BENCHMARK(BM_BlockDecode)->Apply(KeyAndBlockSizes);
+
+// 16 blocks of a write, against BM_BlockEncode one at a time
+static void BM_BlockEncodeMany(benchmark::State& state) {
+  const int count = 16;
+  CipherSetup s(state.range(0), state.range(1) * count);
+  uint64_t ivs[count];
+  uint64_t iv = 0;
+  while (state.KeepRunning()) {
+    for (int i = 0; i < count; ++i) {
+      ivs[i] = ++iv;
+    }
+    s.cipher->blockEncodeMany(s.buf.data(), state.range(1), ivs, count, s.key);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * s.buf.size());
+}
+BENCHMARK(BM_BlockEncodeMany)->Apply(KeyAndBlockSizes);
+
+// partial blocks at the end of a file, and file headers (8 bytes)
+static void BM_StreamEncode(benchmark::State& state) {
+  CipherSetup s(state.range(0), state.range(1));
+  uint64_t iv = 0;
+  while (state.KeepRunning()) {
+    s.cipher->streamEncode(s.buf.data(), s.buf.size(), ++iv, s.key);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * s.buf.size());
+}
+BENCHMARK(BM_StreamEncode)
+    ->Args({256, 8})
+    ->Args({256, 100})
+    ->Apply(KeyAndBlockSizes);
+
+static void BM_StreamDecode(benchmark::State& state) {
+  CipherSetup s(state.range(0), state.range(1));
+  uint64_t iv = 0;
+  while (state.KeepRunning()) {
+    s.cipher->streamDecode(s.buf.data(), s.buf.size(), ++iv, s.key);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * s.buf.size());
+}
+BENCHMARK(BM_StreamDecode)
+    ->Args({256, 8})
+    ->Args({256, 100})
+    ->Apply(KeyAndBlockSizes);
+
+// block MACs (MACFileIO) and name checksums
+static void BM_MAC64(benchmark::State& state) {
+  CipherSetup s(256, state.range(0));
+  uint64_t chainedIV = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        s.cipher->MAC_64(s.buf.data(), s.buf.size(), s.key, &chainedIV));
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * s.buf.size());
+}
+BENCHMARK(BM_MAC64)->RangeMultiplier(4)->Range(16, 4096);
+
+// one cipher block with a new IV each time, so that the HMAC deriving the
+// IV (setIVec) makes up most of the cost
+static void BM_IVDerivation(benchmark::State& state) {
+  CipherSetup s(256, 16);
+  uint64_t iv = 0;
+  while (state.KeepRunning()) {
+    s.cipher->blockEncode(s.buf.data(), s.buf.size(), iv, s.key);
+    iv += 1000;
+  }
+}
+BENCHMARK(BM_IVDerivation);
+
+// powers of two up to the number of cores
+static void CoreSweep(benchmark::internal::Benchmark* b) {
+  int cores = std::max(1, (int)std::thread::hardware_concurrency());
+  b->ThreadRange(1, cores)->UseRealTime();
+}
+
+/*
+    All threads code with one shared key, as the files of a mount do, so
+    that contention on the key (its context sets) shows as a throughput
+    curve that flattens.  range(1) == 0 gives each thread a key of its own,
+    the curve to compare with.
+*/
+enum class Op { Block, Stream, MAC };
+
+static void threadedCipher(benchmark::State& state, Op op) {
+  static CipherSetup* shared = nullptr;
+  if (state.thread_index == 0) {
+    shared = new CipherSetup(256, 1);
+  }
+  std::unique_ptr<CipherSetup> own;
+  std::vector<unsigned char> buf(state.range(0));
+  uint64_t iv = (uint64_t)state.thread_index << 32;
+  while (state.KeepRunning()) {
+    if (!own && state.range(1) == 0) {
+      own.reset(new CipherSetup(256, 1));
+    }
+    CipherSetup* s = own ? own.get() : shared;
+    switch (op) {
+      case Op::Block:
+        s->cipher->blockEncode(buf.data(), buf.size(), ++iv, s->key);
+        break;
+      case Op::Stream:
+        s->cipher->streamEncode(buf.data(), buf.size(), ++iv, s->key);
+        break;
+      case Op::MAC:
+        benchmark::DoNotOptimize(
+            s->cipher->MAC_64(buf.data(), buf.size(), s->key));
+        break;
+    }
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * buf.size());
+  if (state.thread_index == 0) {
+    delete shared;
+    shared = nullptr;
+  }
+}
+
+static void SharedKeyArgs(benchmark::internal::Benchmark* b) {
+  b->Args({4096, 1})->Args({4096, 0})->ArgNames({"size", "shared"});
+  CoreSweep(b);
+}
+
+static void BM_BlockEncodeThreads(benchmark::State& state) {
+  threadedCipher(state, Op::Block);
+}
+BENCHMARK(BM_BlockEncodeThreads)->Apply(SharedKeyArgs);
+
+static void BM_StreamEncodeThreads(benchmark::State& state) {
+  threadedCipher(state, Op::Stream);
+}
+BENCHMARK(BM_StreamEncodeThreads)
+    ->Args({100, 1})
+    ->Args({100, 0})
+    ->ArgNames({"size", "shared"})
+    ->Apply(CoreSweep);
+
+static void BM_MAC64Threads(benchmark::State& state) {
+  threadedCipher(state, Op::MAC);
+}
+BENCHMARK(BM_MAC64Threads)->Apply(SharedKeyArgs);
@@ -1,11 +1,24 @@
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <openssl/evp.h>
+#include <set>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
 #include "encfs/BlockNameIO.h"
 #include "encfs/Cipher.h"
 #include "encfs/CipherKey.h"
 #include "encfs/DirNode.h"
 #include "encfs/FSConfig.h"
 #include "encfs/FileUtils.h"
+#include "encfs/SSL_Cipher.h"
 #include "encfs/StreamNameIO.h"
 
 using namespace encfs;
@@ -155,6 +168,7 @@ TEST_P(CipherTest, ConfigLoadStore) {
   cfg.cipherIface = cipher->interface();
   cfg.keySize = 8 * cipher->keySize();
   cfg.blockSize = FSBlockSize;
+  cfg.kernelContent = true;
   cfg.assignKeyData(keyBuf, encodedKeySize);
 
   // save config
@@ -183,6 +197,7 @@ TEST_P(CipherTest, ConfigLoadStore) {
   EXPECT_TRUE(cfg.cipherIface.implements(cfg2.cipherIface));
   EXPECT_EQ(cfg.keySize, cfg2.keySize);
   EXPECT_EQ(cfg.blockSize, cfg2.blockSize);
+  EXPECT_TRUE(cfg2.kernelContent);
 
   // try decoding key..
 
@@ -191,5 +206,359 @@ TEST_P(CipherTest, ConfigLoadStore) {
   EXPECT_TRUE(cipher->compareKey(key, key2));
 }
 
+TEST_P(CipherTest, ConcurrentBlockCoding) {
+  auto key = cipher->newRandomKey();
+
+  const int dataLen = 4 * cipher->cipherBlockSize();
+  std::vector<unsigned char> plain(dataLen);
+  ASSERT_TRUE(cipher->randomize(plain.data(), dataLen, false));
+
+  std::vector<unsigned char> blockRef(plain);
+  std::vector<unsigned char> streamRef(plain);
+  ASSERT_TRUE(cipher->blockEncode(blockRef.data(), dataLen, 42, key));
+  ASSERT_TRUE(cipher->streamEncode(streamRef.data(), dataLen - 1, 42, key));
+
+  // every thread must get the same result as the single-threaded reference
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&]() {
+      std::vector<unsigned char> buf(dataLen);
+      for (int i = 0; i < 200; ++i) {
+        buf = plain;
+        if (!cipher->blockEncode(buf.data(), dataLen, 42, key) ||
+            buf != blockRef ||
+            !cipher->blockDecode(buf.data(), dataLen, 42, key) ||
+            buf != plain) {
+          ++failures;
+        }
+
+        buf = plain;
+        if (!cipher->streamEncode(buf.data(), dataLen - 1, 42, key) ||
+            buf != streamRef ||
+            !cipher->streamDecode(buf.data(), dataLen - 1, 42, key) ||
+            buf != plain) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(failures.load(), 0);
+}
+
+TEST_P(CipherTest, ThreadCacheOutlivesKey) {
+  auto key = cipher->newRandomKey();
+  auto other = cipher->newRandomKey();
+
+  const int dataLen = 4 * cipher->cipherBlockSize();
+  std::vector<unsigned char> plain(dataLen);
+  ASSERT_TRUE(cipher->randomize(plain.data(), dataLen, false));
+  std::vector<unsigned char> ref(plain);
+  ASSERT_TRUE(cipher->blockEncode(ref.data(), dataLen, 7, other));
+
+  // the thread keeps a context set of key after key is gone, and then
+  // switches to the other key
+  std::promise<void> used, dropped;
+  bool ok = false;
+  std::thread thread([&]() {
+    std::vector<unsigned char> buf(plain);
+    cipher->blockEncode(buf.data(), dataLen, 7, key);
+    used.set_value();
+    dropped.get_future().wait();
+
+    buf = plain;
+    ok = cipher->blockEncode(buf.data(), dataLen, 7, other) && buf == ref &&
+         cipher->blockDecode(buf.data(), dataLen, 7, other) && buf == plain;
+  });
+  used.get_future().wait();
+  key.reset();
+  dropped.set_value();
+  thread.join();
+
+  EXPECT_TRUE(ok);
+}
+
+TEST_P(CipherTest, RepeatedSeeds) {
+  auto key = cipher->newRandomKey();
+
+  const int dataLen = 4 * cipher->cipherBlockSize();
+  std::vector<unsigned char> plain(dataLen);
+  ASSERT_TRUE(cipher->randomize(plain.data(), dataLen, false));
+
+  // seeds which share a slot of the IV memo, and neighbours
+  const uint64_t seeds[] = {7, 7 + 64, 8, 7 + 128, 0x1234567800000007ULL};
+  std::vector<std::vector<unsigned char>> refs;
+  for (uint64_t seed : seeds) {
+    std::vector<unsigned char> buf(plain);
+    ASSERT_TRUE(cipher->blockEncode(buf.data(), dataLen, seed, key));
+    for (auto &ref : refs) {
+      EXPECT_NE(ref, buf);
+    }
+    refs.push_back(buf);
+  }
+
+  for (int round = 0; round < 3; ++round) {
+    for (size_t i = 0; i < refs.size(); ++i) {
+      std::vector<unsigned char> buf(plain);
+      ASSERT_TRUE(cipher->blockEncode(buf.data(), dataLen, seeds[i], key));
+      EXPECT_EQ(buf, refs[i]);
+      ASSERT_TRUE(cipher->blockDecode(buf.data(), dataLen, seeds[i], key));
+      EXPECT_EQ(buf, plain);
+    }
+  }
+}
+
 INSTANTIATE_TEST_CASE_P(CipherKey, CipherTest,
                         ValuesIn(Cipher::GetAlgorithmList()));
+
+// blocks over 4 KiB need interface 4:0, smaller ones are still recorded as 3:0
+TEST(CipherInterfaceTest, LargeBlocksNeedVersion4) {
+  auto cipher = Cipher::New("AES", 256);
+  ASSERT_TRUE(cipher != nullptr);
+
+  Interface small = cipher->volumeInterface(4096);
+  EXPECT_EQ(small.current(), 3);
+  EXPECT_EQ(small.age(), 2);
+  EXPECT_EQ(cipher->volumeInterface(1 << 20).current(), 4);
+
+  // volumes of either version can be opened
+  EXPECT_TRUE(Cipher::New(small, 256) != nullptr);
+  EXPECT_TRUE(Cipher::New(cipher->volumeInterface(1 << 20), 256) != nullptr);
+
+  for (const auto &alg : Cipher::GetAlgorithmList()) {
+    if (alg.name == "AES") {
+      EXPECT_EQ(alg.blockSize.max(), 1 << 20);
+    }
+  }
+}
+
+// AES-CTR codes any part of a block as the whole block would
+TEST(RangeTest, PartsMatchWholeBlock) {
+  auto cipher = Cipher::New("AES-CTR", 256);
+  ASSERT_TRUE(cipher != nullptr);
+  ASSERT_TRUE(cipher->randomAccess());
+  EXPECT_FALSE(Cipher::New("AES", 256)->randomAccess());
+  auto key = cipher->newRandomKey();
+
+  const int dataLen = 1024;
+  std::vector<unsigned char> plain(dataLen);
+  ASSERT_TRUE(cipher->randomize(plain.data(), dataLen, false));
+  std::vector<unsigned char> enc(plain);
+  ASSERT_TRUE(cipher->rangeEncode(enc.data(), dataLen, 42, 0, key));
+  EXPECT_NE(enc, plain);
+
+  for (int offset : {0, 1, 15, 16, 17, 500, 1000}) {
+    for (int len : {1, 7, 16, 24}) {
+      std::vector<unsigned char> part(plain.begin() + offset,
+                                      plain.begin() + offset + len);
+      ASSERT_TRUE(cipher->rangeEncode(part.data(), len, 42, offset, key));
+      EXPECT_TRUE(std::equal(part.begin(), part.end(), enc.begin() + offset))
+          << offset << " " << len;
+      ASSERT_TRUE(cipher->rangeDecode(part.data(), len, 42, offset, key));
+      EXPECT_TRUE(std::equal(part.begin(), part.end(), plain.begin() + offset));
+    }
+  }
+
+  // other blocks get other key streams
+  std::vector<unsigned char> other(plain);
+  ASSERT_TRUE(cipher->rangeEncode(other.data(), dataLen, 43, 0, key));
+  EXPECT_NE(other, enc);
+}
+
+static std::vector<unsigned char> fromHex(const char *hex) {
+  std::vector<unsigned char> out;
+  for (; hex[0] != 0 && hex[1] != 0; hex += 2) {
+    unsigned int byte;
+    sscanf(hex, "%2x", &byte);
+    out.push_back((unsigned char)byte);
+  }
+  return out;
+}
+
+// the AEAD of ChaCha20 is that of RFC 8439, section 2.8.2 and appendix A.5
+TEST(SealTest, RFC8439Vectors) {
+  struct Vector {
+    const char *key, *nonce, *aad, *plain, *cipher, *tag;
+  };
+  const Vector vectors[] = {
+      {"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f",
+       "070000004041424344454647", "50515253c0c1c2c3c4c5c6c7",
+       "4c616469657320616e642047656e746c656d656e206f662074686520636c6173"
+       "73206f66202739393a204966204920636f756c64206f6666657220796f75206f"
+       "6e6c79206f6e652074697020666f7220746865206675747572652c2073756e73"
+       "637265656e20776f756c642062652069742e",
+       "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+       "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+       "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+       "3ff4def08e4b7a9de576d26586cec64b6116",
+       "1ae10b594f09e26a7e902ecbd0600691"},
+      {"1c9240a5eb55d38af333888604f6b5f0473917c1402b80099dca5cbc207075c0",
+       "000000000102030405060708", "f33388860000000000004e91",
+       "496e7465726e65742d4472616674732061726520647261667420646f63756d65"
+       "6e74732076616c696420666f722061206d6178696d756d206f6620736978206d"
+       "6f6e74687320616e64206d617920626520757064617465642c207265706c6163"
+       "65642c206f72206f62736f6c65746564206279206f7468657220646f63756d65"
+       "6e747320617420616e792074696d652e20497420697320696e617070726f7072"
+       "6961746520746f2075736520496e7465726e65742d4472616674732061732072"
+       "65666572656e6365206d6174657269616c206f7220746f206369746520746865"
+       "6d206f74686572207468616e206173202fe2809c776f726b20696e2070726f67"
+       "726573732e2fe2809d",
+       "64a0861575861af460f062c79be643bd5e805cfd345cf389f108670ac76c8cb2"
+       "4c6cfc18755d43eea09ee94e382d26b0bdb7b73c321b0100d4f03b7f355894cf"
+       "332f830e710b97ce98c8a84abd0b948114ad176e008d33bd60f982b1ff37c855"
+       "9797a06ef4f0ef61c186324e2b3506383606907b6a7c02b0f9f6157b53c867e4"
+       "b9166c767b804d46a59b5216cde7a4e99040c5a40433225ee282a1b0a06c523e"
+       "af4534d7f83fa1155b0047718cbc546a0d072b04b3564eea1b422273f548271a"
+       "0bb2316053fa76991955ebd63159434ecebb4e466dae5a1073a6727627097a10"
+       "49e617d91d361094fa68f0ff77987130305beaba2eda04df997b714d6c6f2c29"
+       "a6ad5cb4022b02709b",
+       "eead9d67890cbb22392336fea1851f38"}};
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  for (const Vector &v : vectors) {
+    auto key = fromHex(v.key);
+    auto nonce = fromHex(v.nonce);
+    auto aad = fromHex(v.aad);
+    auto plain = fromHex(v.plain);
+    ASSERT_EQ(EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr,
+                                 key.data(), nullptr),
+              1);
+
+    std::vector<unsigned char> data(plain);
+    unsigned char tag[Cipher::SealTagBytes];
+    ASSERT_TRUE(SSL_Cipher::aeadSeal(ctx, nonce.data(), aad.data(),
+                                     (int)aad.size(), data.data(),
+                                     (int)data.size(), tag));
+    EXPECT_EQ(data, fromHex(v.cipher));
+    EXPECT_EQ(std::vector<unsigned char>(tag, tag + sizeof(tag)),
+              fromHex(v.tag));
+
+    ASSERT_TRUE(SSL_Cipher::aeadOpen(ctx, nonce.data(), aad.data(),
+                                     (int)aad.size(), data.data(),
+                                     (int)data.size(), tag));
+    EXPECT_EQ(data, plain);
+
+    // any other associated data fails to open
+    data = fromHex(v.cipher);
+    aad[0] ^= 1;
+    EXPECT_FALSE(SSL_Cipher::aeadOpen(ctx, nonce.data(), aad.data(),
+                                      (int)aad.size(), data.data(),
+                                      (int)data.size(), tag));
+  }
+  EVP_CIPHER_CTX_free(ctx);
+}
+
+// sealed blocks open at their own IV only, and not after a change
+TEST(SealTest, Blocks) {
+  auto cipher = Cipher::New("ChaCha20", 256);
+  ASSERT_TRUE(cipher != nullptr);
+  ASSERT_TRUE(cipher->sealedBlocks());
+  EXPECT_FALSE(Cipher::New("AES", 256)->sealedBlocks());
+  auto key = cipher->newRandomKey();
+
+  const int dataLen = 1024;
+  std::vector<unsigned char> plain(dataLen);
+  ASSERT_TRUE(cipher->randomize(plain.data(), dataLen, false));
+  memset(plain.data(), 0, Cipher::SealTagBytes);
+
+  std::vector<unsigned char> sealed(plain);
+  ASSERT_TRUE(cipher->sealEncode(sealed.data(), dataLen, 42, key));
+  EXPECT_FALSE(std::equal(sealed.begin() + Cipher::SealBytes, sealed.end(),
+                          plain.begin() + Cipher::SealBytes));
+  // the nonce stays as it is
+  EXPECT_TRUE(std::equal(plain.begin() + Cipher::SealTagBytes,
+                         plain.begin() + Cipher::SealBytes,
+                         sealed.begin() + Cipher::SealTagBytes));
+
+  std::vector<unsigned char> buf(sealed);
+  ASSERT_TRUE(cipher->sealDecode(buf.data(), dataLen, 42, key));
+  EXPECT_TRUE(std::equal(buf.begin() + Cipher::SealBytes, buf.end(),
+                         plain.begin() + Cipher::SealBytes));
+
+  buf = sealed;
+  EXPECT_FALSE(cipher->sealDecode(buf.data(), dataLen, 43, key));
+  buf = sealed;
+  buf[500] ^= 1;
+  EXPECT_FALSE(cipher->sealDecode(buf.data(), dataLen, 42, key));
+  buf = sealed;
+  buf[Cipher::SealTagBytes] ^= 1;
+  EXPECT_FALSE(cipher->sealDecode(buf.data(), dataLen, 42, key));
+  buf = sealed;
+  EXPECT_FALSE(
+      cipher->sealDecode(buf.data(), dataLen, 42, cipher->newRandomKey()));
+
+  // another nonce, another key stream
+  buf = plain;
+  buf[Cipher::SealTagBytes] ^= 1;
+  ASSERT_TRUE(cipher->sealEncode(buf.data(), dataLen, 42, key));
+  EXPECT_NE(memcmp(buf.data() + Cipher::SealBytes,
+                   sealed.data() + Cipher::SealBytes,
+                   dataLen - Cipher::SealBytes),
+            0);
+
+  // a block of only the header seals too, shorter ones don't
+  buf = plain;
+  ASSERT_TRUE(cipher->sealEncode(buf.data(), Cipher::SealBytes, 7, key));
+  EXPECT_TRUE(cipher->sealDecode(buf.data(), Cipher::SealBytes, 7, key));
+  EXPECT_FALSE(
+      cipher->sealEncode(buf.data(), Cipher::SealBytes - 1, 7, key));
+}
+
+// keys for fscrypt and the like follow from the volume key and the label
+TEST(ExportKeyTest, ByKeyAndLabel) {
+  auto cipher = Cipher::New("AES", 256);
+  auto key = cipher->newRandomKey();
+  unsigned char a[64], b[64], c[64];
+  ASSERT_TRUE(cipher->exportKey(key, "encfs fscrypt key", a, sizeof(a)));
+  ASSERT_TRUE(cipher->exportKey(key, "encfs fscrypt key", b, sizeof(b)));
+  EXPECT_EQ(memcmp(a, b, sizeof(a)), 0);
+  ASSERT_TRUE(cipher->exportKey(key, "other", c, sizeof(c)));
+  EXPECT_NE(memcmp(a, c, sizeof(a)), 0);
+  ASSERT_TRUE(cipher->exportKey(cipher->newRandomKey(), "encfs fscrypt key",
+                                c, sizeof(c)));
+  EXPECT_NE(memcmp(a, c, sizeof(a)), 0);
+  unsigned char big[65];
+  EXPECT_FALSE(cipher->exportKey(key, "encfs fscrypt key", big, sizeof(big)));
+}
+
+// weak random values come from a generator per thread, which must not repeat
+// itself, across threads or in a forked child
+TEST(RandomizeTest, WeakValuesDiffer) {
+  auto cipher = Cipher::New("AES", 256);
+  std::set<uint64_t> seen;
+  for (int i = 0; i < 2000; ++i) {
+    uint64_t value = 0;
+    ASSERT_TRUE(cipher->randomize((unsigned char *)&value, 8, false));
+    EXPECT_TRUE(seen.insert(value).second);
+  }
+
+  uint64_t other = 0;
+  std::thread([&] {
+    ASSERT_TRUE(cipher->randomize((unsigned char *)&other, 8, false));
+  }).join();
+  EXPECT_TRUE(seen.insert(other).second);
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    uint64_t value = 0;
+    cipher->randomize((unsigned char *)&value, 8, false);
+    _exit(write(fds[1], &value, sizeof(value)) == sizeof(value) ? 0 : 1);
+  }
+  uint64_t child = 0;
+  ASSERT_EQ(read(fds[0], &child, sizeof(child)), (ssize_t)sizeof(child));
+  waitpid(pid, nullptr, 0);
+  close(fds[0]);
+  close(fds[1]);
+
+  uint64_t parent = 0;
+  ASSERT_TRUE(cipher->randomize((unsigned char *)&parent, 8, false));
+  EXPECT_NE(child, parent);
+  EXPECT_TRUE(seen.insert(child).second);
+}
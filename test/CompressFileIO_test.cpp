@@ -0,0 +1,193 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherFileIO.h"
+#include "encfs/CompressFileIO.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileIO.h"
+#include "encfs/FileUtils.h"
+#include "encfs/MACFileIO.h"
+#include "encfs/RawFileIO.h"
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+using namespace testing;
+
+namespace {
+
+const off_t Extent = CompressFileIO::ExtentSize;
+
+// blockMACBytes
+class CompressFileIOTest : public TestWithParam<int> {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->config->uniqueIV = true;
+    cfg->config->blockMACBytes = GetParam();
+    cfg->config->allowHoles = true;
+    cfg->config->compression = CompressFileIO::ZlibCompression;
+    cfg->opts.reset(new EncFS_Opts);
+    cfg->workers = std::make_shared<WorkerPool>(3, 16);
+
+    name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    io = open();
+  }
+
+  void TearDown() override {
+    io.reset();
+    unlink(name.c_str());
+  }
+
+  std::shared_ptr<FileIO> open() {
+    std::shared_ptr<FileIO> stack(new RawFileIO(name));
+    stack.reset(new CipherFileIO(stack, cfg));
+    if (cfg->config->blockMACBytes != 0) {
+      stack.reset(new MACFileIO(stack, cfg));
+    }
+    stack.reset(new CompressFileIO(stack, cfg));
+    EXPECT_GE(stack->open(O_RDWR), 0);
+    return stack;
+  }
+
+  // log lines, which compress well, or random bytes, which don't
+  void write(off_t offset, size_t len, bool text) {
+    std::vector<unsigned char> buf(len);
+    for (size_t i = 0; i < len; ++i) {
+      buf[i] = text ? "2024-01-01 GET /index.html 200\n"[(offset + i) % 31]
+                    : rng() & 0xff;
+    }
+    if (expected.size() < offset + len) {
+      expected.resize(offset + len);
+    }
+    std::copy(buf.begin(), buf.end(), expected.begin() + offset);
+
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = len;
+    ASSERT_EQ(io->write(req), (ssize_t)len);
+  }
+
+  void truncate(off_t size) {
+    expected.resize(size);
+    ASSERT_EQ(io->truncate(size), 0);
+  }
+
+  void check(const std::shared_ptr<FileIO> &file, off_t offset, size_t len) {
+    std::vector<unsigned char> buf(len);
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = len;
+
+    size_t avail = 0;
+    if ((size_t)offset < expected.size()) {
+      avail = std::min(len, expected.size() - offset);
+    }
+    ASSERT_EQ(file->read(req), (ssize_t)avail)
+        << "offset " << offset << ", len " << len;
+    ASSERT_TRUE(std::equal(buf.begin(), buf.begin() + avail,
+                           expected.begin() + offset))
+        << "offset " << offset << ", len " << len;
+  }
+
+  void checkAll(const std::shared_ptr<FileIO> &file) {
+    ASSERT_EQ(file->getSize(), (off_t)expected.size());
+    struct stat st;
+    ASSERT_EQ(file->getAttr(&st), 0);
+    ASSERT_EQ(st.st_size, (off_t)expected.size());
+
+    check(file, 0, expected.size() + 100);
+    const size_t sizes[] = {1, 1000, 70000};
+    for (size_t len : sizes) {
+      for (off_t offset = 0; offset < (off_t)expected.size() + 1024;
+           offset += 9337) {
+        check(file, offset, len);
+      }
+    }
+  }
+
+  FSConfigPtr cfg;
+  std::string name;
+  std::shared_ptr<FileIO> io;
+  std::vector<unsigned char> expected;
+  std::mt19937 rng;
+};
+
+TEST_P(CompressFileIOTest, SequentialWriteRead) {
+  for (off_t offset = 0; offset < 20 * Extent; offset += 10000) {
+    write(offset, 10000, true);
+  }
+  checkAll(io);
+  checkAll(open());
+
+  // the text takes a fraction of the space, without zlib it is stored as it
+  // is
+  if (!CompressFileIO::supported(CompressFileIO::ZlibCompression)) {
+    return;
+  }
+  struct stat st;
+  ASSERT_EQ(stat(name.c_str(), &st), 0);
+  EXPECT_LT(st.st_blocks * 512, (off_t)expected.size() / 4);
+}
+
+TEST_P(CompressFileIOTest, RandomWrites) {
+  std::uniform_int_distribution<off_t> offsets(0, 6 * Extent);
+  std::uniform_int_distribution<size_t> lens(1, 2 * Extent);
+  for (int i = 0; i < 60; ++i) {
+    write(offsets(rng), lens(rng), i % 3 != 0);
+  }
+  checkAll(io);
+  checkAll(open());
+}
+
+TEST_P(CompressFileIOTest, Truncate) {
+  write(0, 5 * Extent + 123, true);
+  write(Extent, 1000, false);
+
+  truncate(3 * Extent + 77);
+  checkAll(io);
+  truncate(8 * Extent);  // zeros
+  checkAll(io);
+  truncate(2 * Extent);
+  checkAll(open());
+  truncate(0);
+  checkAll(io);
+  write(100, 5000, true);
+  checkAll(open());
+}
+
+// past the first group of extents, and its index
+TEST_P(CompressFileIOTest, LaterGroups) {
+  const off_t group = CompressFileIO::GroupExtents * Extent;
+  write(0, 1000, true);
+  write(group - 500, 2000, false);
+  write(2 * group + 5, Extent, true);
+  checkAll(open());
+
+  truncate(group + 10);
+  checkAll(open());
+  write(group + 10, Extent, true);
+  checkAll(open());
+}
+
+INSTANTIATE_TEST_CASE_P(CompressFileIO, CompressFileIOTest, Values(0, 8));
+
+}  // namespace
@@ -0,0 +1,146 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/ContentHash.h"
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+
+namespace {
+
+class ContentHashTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    cipher = Cipher::New("AES", 256);
+    key = cipher->newRandomKey();
+    setContents(std::string(3 << 20, 'x') + "tail");
+  }
+
+  void TearDown() override { unlink(name.c_str()); }
+
+  // the plaintext, which the backing file mirrors in size
+  void setContents(const std::string &data) {
+    contents = data;
+    ASSERT_EQ(truncate(name.c_str(), (off_t)data.size()), 0);
+    // a time in the past, which may be whole seconds
+    struct timespec times[2] = {{1000000, 0}, {1000000, 0}};
+    times[1].tv_sec += ++changes;
+    ASSERT_EQ(utimensat(AT_FDCWD, name.c_str(), times, 0), 0);
+  }
+
+  ContentHash::Reader reader() {
+    return [this](off_t offset, unsigned char *buf, size_t len) -> ssize_t {
+      ++reads;
+      if (offset >= (off_t)contents.size()) {
+        return 0;
+      }
+      len = std::min(len, contents.size() - offset);
+      memcpy(buf, contents.data() + offset, len);
+      return len;
+    };
+  }
+
+  std::string get(ContentHash &hash) {
+    std::string hex;
+    EXPECT_EQ(hash.get(name.c_str(), reader(), true, &hex), 0);
+    return hex;
+  }
+
+  bool canStore() {
+    return lsetxattr(name.c_str(), "user.encfs.probe", "", 0, 0) == 0;
+  }
+
+  std::string name;
+  std::shared_ptr<Cipher> cipher;
+  CipherKey key;
+  std::string contents;
+  int changes = 0;
+  int reads = 0;
+};
+
+TEST_F(ContentHashTest, HashOfPlaintext) {
+  WorkerPool workers(2, 16);
+  ContentHash hash(cipher, key, &workers);
+  setContents("abc");
+  EXPECT_EQ(get(hash),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+  setContents("");
+  ContentHash serial(cipher, key, nullptr);
+  EXPECT_EQ(get(serial),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+}
+
+TEST_F(ContentHashTest, StoredUntilChanged) {
+  if (!canStore()) {
+    return;  // no user attributes here
+  }
+  WorkerPool workers(2, 16);
+  ContentHash hash(cipher, key, &workers);
+  std::string first = get(hash);
+  EXPECT_EQ(first.size(), ContentHash::HexSize);
+  EXPECT_GT(reads, 3);
+
+  // served from the stored attribute
+  reads = 0;
+  EXPECT_EQ(get(hash), first);
+  EXPECT_EQ(reads, 0);
+
+  // the same size, with another mtime
+  contents[10] = 'y';
+  setContents(contents);
+  std::string second = get(hash);
+  EXPECT_NE(second, first);
+  EXPECT_GT(reads, 0);
+
+  // another key doesn't take it
+  reads = 0;
+  ContentHash other(cipher, cipher->newRandomKey(), nullptr);
+  EXPECT_EQ(get(other), second);
+  EXPECT_GT(reads, 0);
+}
+
+TEST_F(ContentHashTest, DamagedValueIgnored) {
+  if (!canStore()) {
+    return;
+  }
+  ContentHash hash(cipher, key, nullptr);
+  std::string first = get(hash);
+
+  unsigned char value[100];
+  ssize_t len =
+      lgetxattr(name.c_str(), ContentHash::StoreName, value, sizeof(value));
+  ASSERT_GT(len, 20);
+  value[20] ^= 1;
+  ASSERT_EQ(lsetxattr(name.c_str(), ContentHash::StoreName, value, len, 0),
+            0);
+  reads = 0;
+  EXPECT_EQ(get(hash), first);
+  EXPECT_GT(reads, 0);
+}
+
+TEST_F(ContentHashTest, ReadErrorsReturned) {
+  ContentHash hash(cipher, key, nullptr);
+  std::string hex;
+  auto failing = [](off_t, unsigned char *, size_t) -> ssize_t {
+    return -EIO;
+  };
+  EXPECT_EQ(hash.get(name.c_str(), failing, true, &hex), -EIO);
+  EXPECT_EQ(hash.get("/nonexistent", reader(), true, &hex), -ENOENT);
+}
+
+}  // namespace
@@ -0,0 +1,128 @@
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/Context.h"
+#include "encfs/DirNode.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileUtils.h"
+
+using namespace encfs;
+
+namespace {
+
+const int OpenFiles = 1000;
+
+// An EncFS_Context with a root and OpenFiles open nodes, shared by all
+// benchmarks, as FUSE threads share the one of a mount.
+struct Mount {
+  FSConfigPtr cfg;
+  EncFS_Context ctx;
+  std::vector<std::string> paths;
+
+  Mount() : cfg(new FSConfig) {
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->opts.reset(new EncFS_Opts);
+    ctx.setRoot(std::make_shared<DirNode>(&ctx, "/nonexistent/", cfg));
+
+    for (int i = 0; i < OpenFiles; ++i) {
+      paths.push_back("/dir" + std::to_string(i % 10) + "/file" +
+                      std::to_string(i));
+      ctx.putNode(paths.back().c_str(), newNode(paths.back()));
+    }
+  }
+
+  std::shared_ptr<FileNode> newNode(const std::string &path) {
+    return std::make_shared<FileNode>(nullptr, cfg, path.c_str(),
+                                      "/nonexistent", 0);
+  }
+};
+
+Mount &mount() {
+  static Mount *m = new Mount;
+  return *m;
+}
+
+// powers of two up to the number of cores
+void CoreSweep(benchmark::internal::Benchmark *b) {
+  int cores = std::max(1, (int)std::thread::hardware_concurrency());
+  b->ThreadRange(1, cores)->UseRealTime();
+}
+
+}  // namespace
+
+// getattr, open and friends on files which are open already
+static void BM_ContextLookupNode(benchmark::State &state) {
+  Mount &m = mount();
+  size_t i = state.thread_index * 37;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        m.ctx.lookupNode(m.paths[i++ % m.paths.size()].c_str()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContextLookupNode)->Apply(CoreSweep);
+
+// misses, the common case for getattr
+static void BM_ContextLookupMissing(benchmark::State &state) {
+  Mount &m = mount();
+  std::string path = "/missing" + std::to_string(state.thread_index);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(m.ctx.lookupNode(path.c_str()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContextLookupMissing)->Apply(CoreSweep);
+
+// open() and release() of a file per thread
+static void BM_ContextPutEraseNode(benchmark::State &state) {
+  Mount &m = mount();
+  std::string path = "/thread" + std::to_string(state.thread_index);
+  std::shared_ptr<FileNode> node = m.newNode(path);
+  while (state.KeepRunning()) {
+    m.ctx.putNode(path.c_str(), node);
+    m.ctx.eraseNode(path.c_str(), node);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContextPutEraseNode)->Apply(CoreSweep);
+
+// open() and release() of a file which is held open many times already,
+// as a log file or shared library is
+static void BM_ContextPutEraseBusyNode(benchmark::State &state) {
+  Mount &m = mount();
+  std::string path = "/busy" + std::to_string(state.thread_index);
+  std::shared_ptr<FileNode> node = m.newNode(path);
+  for (int i = 0; i < 1000; ++i) {
+    m.ctx.putNode(path.c_str(), node);
+  }
+  while (state.KeepRunning()) {
+    m.ctx.putNode(path.c_str(), node);
+    m.ctx.eraseNode(path.c_str(), node);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    m.ctx.eraseNode(path.c_str(), node);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContextPutEraseBusyNode)->Apply(CoreSweep);
+
+// every FUSE call starts with this
+static void BM_ContextGetRoot(benchmark::State &state) {
+  Mount &m = mount();
+  int err = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(m.ctx.getRoot(&err));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ContextGetRoot)->Apply(CoreSweep);
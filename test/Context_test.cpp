@@ -0,0 +1,214 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/Context.h"
+#include "encfs/DirNode.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileUtils.h"
+
+using namespace encfs;
+
+namespace {
+
+class ContextTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->opts.reset(new EncFS_Opts);
+  }
+
+  std::shared_ptr<FileNode> newNode(const std::string &path) {
+    return std::make_shared<FileNode>(nullptr, cfg, path.c_str(),
+                                      "/nonexistent", 0);
+  }
+
+  FSConfigPtr cfg;
+  EncFS_Context ctx;
+};
+
+TEST_F(ContextTest, PutLookupErase) {
+  std::vector<std::shared_ptr<FileNode>> nodes;
+  for (int i = 0; i < 100; ++i) {
+    std::string path = "/file" + std::to_string(i);
+    nodes.push_back(newNode(path));
+    ctx.putNode(path.c_str(), nodes.back());
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    std::string path = "/file" + std::to_string(i);
+    EXPECT_EQ(ctx.lookupNode(path.c_str()), nodes[i]);
+    EXPECT_EQ(ctx.lookupFuseFh(nodes[i]->fuseFh), nodes[i]);
+  }
+  EXPECT_EQ(ctx.lookupNode("/other"), nullptr);
+
+  for (int i = 0; i < 100; ++i) {
+    std::string path = "/file" + std::to_string(i);
+    ctx.eraseNode(path.c_str(), nodes[i]);
+    EXPECT_EQ(ctx.lookupNode(path.c_str()), nullptr);
+    EXPECT_EQ(ctx.lookupFuseFh(nodes[i]->fuseFh), nullptr);
+    EXPECT_EQ(nodes[i]->canary, (std::uint32_t)CANARY_RELEASED);
+  }
+
+  // the slots are reused, but the old handles stay dead
+  auto node = newNode("/new");
+  ctx.putNode("/new", node);
+  EXPECT_NE(node->fuseFh, 0u);
+  for (auto &old : nodes) {
+    EXPECT_NE(old->fuseFh, node->fuseFh);
+    EXPECT_EQ(ctx.lookupFuseFh(old->fuseFh), nullptr);
+  }
+  EXPECT_EQ(ctx.lookupFuseFh(node->fuseFh), node);
+  ctx.eraseNode("/new", node);
+}
+
+TEST_F(ContextTest, OpenTwice) {
+  auto node = newNode("/a");
+  ctx.putNode("/a", node);
+  ctx.putNode("/a", node);
+
+  ctx.eraseNode("/a", node);
+  EXPECT_EQ(ctx.lookupNode("/a"), node);
+  EXPECT_EQ(ctx.lookupFuseFh(node->fuseFh), node);
+
+  ctx.eraseNode("/a", node);
+  EXPECT_EQ(ctx.lookupNode("/a"), nullptr);
+  EXPECT_EQ(ctx.lookupFuseFh(node->fuseFh), nullptr);
+}
+
+TEST_F(ContextTest, TwoNodesOnePath) {
+  // an open racing with a rename may register a second node under a path
+  auto first = newNode("/a");
+  auto second = newNode("/a");
+  for (int i = 0; i < 3; ++i) {
+    ctx.putNode("/a", first);
+  }
+  ctx.putNode("/a", second);
+  EXPECT_EQ(ctx.lookupNode("/a"), second);
+  EXPECT_NE(first->fuseFh, second->fuseFh);
+
+  EXPECT_TRUE(ctx.eraseNode("/a", second));
+  EXPECT_EQ(ctx.lookupNode("/a"), first);
+  EXPECT_EQ(ctx.lookupFuseFh(second->fuseFh), nullptr);
+  EXPECT_EQ(ctx.lookupFuseFh(first->fuseFh), first);
+
+  EXPECT_FALSE(ctx.eraseNode("/a", first));
+  EXPECT_FALSE(ctx.eraseNode("/a", first));
+  EXPECT_TRUE(ctx.eraseNode("/a", first));
+  EXPECT_EQ(ctx.lookupNode("/a"), nullptr);
+  EXPECT_EQ(first->canary, (std::uint32_t)CANARY_RELEASED);
+}
+
+TEST_F(ContextTest, Rename) {
+  // enough renames that some cross shards and some don't
+  auto node = newNode("/name0");
+  ctx.putNode("/name0", node);
+  for (int i = 1; i < 50; ++i) {
+    std::string from = "/name" + std::to_string(i - 1);
+    std::string to = "/name" + std::to_string(i);
+    ctx.renameNode(from.c_str(), to.c_str());
+    EXPECT_EQ(ctx.lookupNode(from.c_str()), nullptr);
+    EXPECT_EQ(ctx.lookupNode(to.c_str()), node);
+  }
+  ctx.eraseNode("/name49", node);
+  EXPECT_EQ(ctx.lookupNode("/name49"), nullptr);
+}
+
+TEST_F(ContextTest, ConcurrentOpenClose) {
+  const int Threads = 4;
+  std::vector<std::thread> threads;
+  std::vector<int> failures(Threads, 0);
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 200; ++i) {
+        std::string path = "/t" + std::to_string(t) + "/" + std::to_string(i);
+        auto node = newNode(path);
+        ctx.putNode(path.c_str(), node);
+        if (ctx.lookupNode(path.c_str()) != node ||
+            ctx.lookupFuseFh(node->fuseFh) != node) {
+          ++failures[t];
+        }
+        ctx.eraseNode(path.c_str(), node);
+        if (ctx.lookupNode(path.c_str()) != nullptr) {
+          ++failures[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < Threads; ++t) {
+    EXPECT_EQ(failures[t], 0) << "thread " << t;
+  }
+}
+
+TEST_F(ContextTest, UnmountIfIdle) {
+  // on demand, an idle unmount only detaches the root
+  cfg->opts->mountOnDemand = true;
+  ctx.opts = cfg->opts;
+  ctx.setRoot(std::make_shared<DirNode>(&ctx, "/nonexistent/", cfg));
+
+  int err = 0;
+  ASSERT_TRUE(ctx.getRoot(&err) != nullptr);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  // not idle long enough: check again when it would be
+  int64_t next = ctx.unmountIfIdle(100);
+  EXPECT_GE(next, ts.tv_sec + 99);
+  EXPECT_LE(next, ts.tv_sec + 100);
+  EXPECT_TRUE(ctx.getRoot(&err, true) != nullptr);
+
+  // open files keep it mounted
+  auto node = newNode("/open");
+  ctx.putNode("/open", node);
+  EXPECT_GE(ctx.unmountIfIdle(0), ts.tv_sec);
+  EXPECT_TRUE(ctx.getRoot(&err, true) != nullptr);
+  ctx.eraseNode("/open", node);
+
+  EXPECT_GE(ctx.unmountIfIdle(0), ts.tv_sec);
+  ctx.setRoot(nullptr);
+}
+
+TEST_F(ContextTest, AsyncUnlock) {
+  ctx.beginUnlock(10);
+  EXPECT_TRUE(ctx.unlocking());
+  auto root = std::make_shared<DirNode>(&ctx, "/nonexistent/", cfg);
+  std::thread unlocker([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ctx.setRoot(root);
+    ctx.endUnlock(0);
+  });
+  // waits for the root rather than mounting
+  int err = 0;
+  EXPECT_EQ(ctx.getRoot(&err), root);
+  EXPECT_EQ(err, 0);
+  unlocker.join();
+  EXPECT_FALSE(ctx.unlocking());
+  ctx.setRoot(nullptr);
+
+  // too slow
+  ctx.beginUnlock(1);
+  EXPECT_EQ(ctx.getRoot(&err), nullptr);
+  EXPECT_EQ(err, -EAGAIN);
+
+  // and failed
+  ctx.endUnlock(-EACCES);
+  EXPECT_FALSE(ctx.unlocking());
+  EXPECT_EQ(ctx.getRoot(&err), nullptr);
+  EXPECT_EQ(err, -EACCES);
+}
+
+}  // namespace
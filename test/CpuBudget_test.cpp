@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+
+#include "encfs/CpuBudget.h"
+#include "encfs/Stats.h"
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(CpuBudget, SpentBudgetDropsWork) {
+  Stats::reset();
+  Stats::setEnabled(true);
+  // a thousandth of a CPU saves up 100us
+  CpuBudget::setLimit(0.001);
+  EXPECT_TRUE(CpuBudget::enabled());
+  EXPECT_TRUE(CpuBudget::admit());
+
+  CpuBudget::charge(10000000);
+  EXPECT_FALSE(CpuBudget::admit());
+  EXPECT_EQ(Stats::value(Stats::BackgroundDropped), 1u);
+  EXPECT_EQ(Stats::value(Stats::BackgroundCpuMicros), 10000u);
+
+  // and the worker pool takes no optional work
+  WorkerPool pool(1, 10);
+  EXPECT_FALSE(pool.trySubmit([]() {}));
+  EXPECT_EQ(Stats::value(Stats::BackgroundDropped), 2u);
+
+  // waiting work gives up when asked to stop
+  std::atomic<bool> stop(true);
+  EXPECT_FALSE(CpuBudget::waitTurn(stop));
+  EXPECT_EQ(Stats::value(Stats::BackgroundDeferred), 1u);
+
+  CpuBudget::setLimit(0);
+  EXPECT_FALSE(CpuBudget::enabled());
+  EXPECT_TRUE(CpuBudget::admit());
+  EXPECT_TRUE(pool.trySubmit([]() {}));
+  Stats::setEnabled(false);
+  Stats::reset();
+}
+
+TEST(CpuBudget, ChargesWorkers) {
+  Stats::reset();
+  Stats::setEnabled(true);
+  CpuBudget::setLimit(1);
+  {
+    WorkerPool pool(1, 10);
+    ASSERT_TRUE(pool.trySubmit([]() {
+      uint64_t start = CpuBudget::threadCpu();
+      while (CpuBudget::threadCpu() - start < 2000000) {
+      }
+    }));
+  }
+  EXPECT_GE(Stats::value(Stats::BackgroundCpuMicros), 2000u);
+  CpuBudget::setLimit(0);
+  Stats::setEnabled(false);
+  Stats::reset();
+}
+
+TEST(CpuBudget, BacksOffWhenCallsSlowDown) {
+  CpuBudget::setLimit(4);
+  for (int i = 0; i < 1000; ++i) {
+    CpuBudget::foreground(50000);
+  }
+  EXPECT_FALSE(CpuBudget::congested());
+  EXPECT_TRUE(CpuBudget::admit());
+
+  for (int i = 0; i < 20; ++i) {
+    CpuBudget::foreground(5000000);
+  }
+  EXPECT_TRUE(CpuBudget::congested());
+  EXPECT_FALSE(CpuBudget::admit());
+
+  // until they are fast again
+  for (int i = 0; i < 100; ++i) {
+    CpuBudget::foreground(50000);
+  }
+  EXPECT_FALSE(CpuBudget::congested());
+  CpuBudget::setLimit(0);
+}
+
+}  // namespace
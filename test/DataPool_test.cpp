@@ -0,0 +1,114 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encfs/DataPool.h"
+
+using namespace encfs;
+
+namespace {
+
+DataPool::Request request(const std::string &text) {
+  DataPool::Request req;
+  req.buf.assign(text.begin(), text.end());
+  req.size = text.size();
+  req.channel = nullptr;
+  return req;
+}
+
+std::string textOf(const DataPool::Request &req) {
+  return std::string(req.buf.data(), req.size);
+}
+
+TEST(DataPoolTest, DataOpcodes) {
+  for (uint32_t op : {15u, 16u, 20u, 25u, 43u}) {
+    EXPECT_TRUE(DataPool::isData(op)) << op;
+  }
+  // lookup, getattr, open, readdir, statfs
+  for (uint32_t op : {1u, 3u, 14u, 28u, 17u}) {
+    EXPECT_FALSE(DataPool::isData(op)) << op;
+  }
+}
+
+TEST(DataPoolTest, QueuesBeyondThreads) {
+  DataPool pool(2);
+  DataPool::Request a = request("a");
+  DataPool::Request b = request("b");
+  EXPECT_TRUE(pool.enter(&a));
+  EXPECT_TRUE(pool.enter(&b));
+  EXPECT_EQ(pool.running(), 2);
+
+  // taken by the queue, the thread goes back to the device
+  DataPool::Request c = request("c");
+  EXPECT_FALSE(pool.enter(&c));
+  EXPECT_TRUE(c.buf.empty());
+  EXPECT_EQ(pool.queued(), 1u);
+
+  // run by a thread done with its own, which leaves its buffer behind
+  EXPECT_TRUE(pool.next(&a));
+  EXPECT_EQ(textOf(a), "c");
+  EXPECT_EQ(pool.queued(), 0u);
+  DataPool::Request d = request("dd");
+  EXPECT_FALSE(pool.enter(&d));
+  EXPECT_EQ(d.buf.size(), 1u);
+
+  EXPECT_TRUE(pool.next(&b));
+  EXPECT_EQ(textOf(b), "dd");
+  EXPECT_FALSE(pool.next(&a));
+  EXPECT_EQ(pool.running(), 1);
+  EXPECT_FALSE(pool.next(&b));
+  EXPECT_EQ(pool.running(), 0);
+}
+
+TEST(DataPoolTest, BoundsRunningThreads) {
+  const int Threads = 8;
+  const int Requests = 2000;
+  DataPool pool(2);
+  std::atomic<int> running(0);
+  std::atomic<int> most(0);
+  std::atomic<int> done(0);
+  std::vector<std::atomic<int>> runs(Threads * Requests);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      DataPool::Request req;
+      for (int i = 0; i < Requests; ++i) {
+        req.buf.resize(sizeof(int));
+        int id = t * Requests + i;
+        memcpy(req.buf.data(), &id, sizeof(id));
+        req.size = sizeof(id);
+        if (!pool.enter(&req)) {
+          continue;
+        }
+        do {
+          int now = ++running;
+          int seen = most;
+          while (now > seen && !most.compare_exchange_weak(seen, now)) {
+          }
+          memcpy(&id, req.buf.data(), sizeof(id));
+          ++runs[id];
+          ++done;
+          --running;
+        } while (pool.next(&req));
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  EXPECT_LE(most, 2);
+  EXPECT_EQ(done, Threads * Requests);
+  EXPECT_EQ(pool.running(), 0);
+  EXPECT_EQ(pool.queued(), 0u);
+  for (int id = 0; id < Threads * Requests; ++id) {
+    ASSERT_EQ(runs[id], 1) << id;
+  }
+}
+
+}  // namespace
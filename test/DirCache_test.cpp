@@ -0,0 +1,80 @@
+#include "gtest/gtest.h"
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#include "encfs/DirCache.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat dirStat(ino_t ino, time_t mtime) {
+  struct stat st = {};
+  st.st_ino = ino;
+  st.st_mtime = mtime;
+  st.st_ctime = mtime;
+  return st;
+}
+
+std::shared_ptr<const DirListing> listing(const std::string &name) {
+  std::shared_ptr<DirListing> l = std::make_shared<DirListing>();
+  DirEntry entry;
+  entry.name = name;
+  l->push_back(entry);
+  return l;
+}
+
+TEST(DirCache, ValidatedByStat) {
+  DirCache cache(10);
+  time_t past = time(nullptr) - 10;
+  cache.put("/a", dirStat(5, past), listing("x"));
+
+  auto l = cache.get("/a", dirStat(5, past));
+  ASSERT_TRUE(l != nullptr);
+  EXPECT_EQ(l->front().name, "x");
+
+  // directory changed behind our back
+  EXPECT_TRUE(cache.get("/a", dirStat(5, past + 1)) == nullptr);
+  EXPECT_EQ(cache.size(), 0u);
+
+  cache.put("/a", dirStat(5, past), listing("x"));
+  EXPECT_TRUE(cache.get("/a", dirStat(6, past)) == nullptr);
+}
+
+TEST(DirCache, RejectsRecentlyChanged) {
+  DirCache cache(10);
+  time_t now = time(nullptr);
+  cache.put("/a", dirStat(5, now), listing("x"));
+  EXPECT_TRUE(cache.get("/a", dirStat(5, now)) == nullptr);
+}
+
+TEST(DirCache, InvalidateSubtree) {
+  DirCache cache(10);
+  time_t past = time(nullptr) - 10;
+  cache.put("/a", dirStat(1, past), listing("x"));
+  cache.put("/a/b", dirStat(2, past), listing("y"));
+  cache.put("/ab", dirStat(3, past), listing("z"));
+
+  cache.invalidate("/a");
+  EXPECT_TRUE(cache.get("/a", dirStat(1, past)) == nullptr);
+  EXPECT_TRUE(cache.get("/a/b", dirStat(2, past)) == nullptr);
+  EXPECT_TRUE(cache.get("/ab", dirStat(3, past)) != nullptr);
+}
+
+TEST(DirCache, EvictsLeastRecentlyUsed) {
+  DirCache cache(2);
+  time_t past = time(nullptr) - 10;
+  cache.put("/1", dirStat(1, past), listing("1"));
+  cache.put("/2", dirStat(2, past), listing("2"));
+  EXPECT_TRUE(cache.get("/1", dirStat(1, past)) != nullptr);
+  cache.put("/3", dirStat(3, past), listing("3"));
+
+  EXPECT_EQ(cache.size(), 2u);
+  EXPECT_TRUE(cache.get("/1", dirStat(1, past)) != nullptr);
+  EXPECT_TRUE(cache.get("/2", dirStat(2, past)) == nullptr);
+}
+
+}  // namespace
@@ -0,0 +1,128 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encfs/DirFdCache.h"
+
+using namespace encfs;
+
+namespace {
+
+class DirFdCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = root;
+    ASSERT_EQ(mkdir((rootDir + "/a").c_str(), 0700), 0);
+    ASSERT_EQ(mkdir((rootDir + "/a/b").c_str(), 0700), 0);
+    ASSERT_EQ(mkdir((rootDir + "/ab").c_str(), 0700), 0);
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::string rootDir;
+};
+
+TEST_F(DirFdCacheTest, RelativeToDirectory) {
+  DirFdCache cache(8);
+  std::string path = rootDir + "/a/b/file";
+  {
+    AtPath at(&cache, path);
+    EXPECT_NE(at.dir(), AT_FDCWD);
+    EXPECT_STREQ(at.name(), "file");
+    int fd = openat(at.dir(), at.name(), O_CREAT | O_WRONLY, 0600);
+    ASSERT_GE(fd, 0);
+    close(fd);
+  }
+  struct stat st;
+  EXPECT_EQ(lstat(path.c_str(), &st), 0);
+  EXPECT_EQ(cache.size(), 1u);
+
+  // the same descriptor serves the next call
+  AtPath first(&cache, path);
+  AtPath second(&cache, rootDir + "/a/b/other");
+  EXPECT_EQ(first.dir(), second.dir());
+
+  // without a cache, or a directory to open, the path is used as it is
+  AtPath none(nullptr, path);
+  EXPECT_EQ(none.dir(), AT_FDCWD);
+  EXPECT_EQ(none.name(), path.c_str());
+  std::string missing = rootDir + "/missing/file";
+  AtPath failed(&cache, missing);
+  EXPECT_EQ(failed.dir(), AT_FDCWD);
+  EXPECT_EQ(failed.name(), missing.c_str());
+}
+
+TEST_F(DirFdCacheTest, InvalidateSubtree) {
+  DirFdCache cache(8);
+  EXPECT_TRUE(cache.get(rootDir + "/a") != nullptr);
+  EXPECT_TRUE(cache.get(rootDir + "/a/b") != nullptr);
+  EXPECT_TRUE(cache.get(rootDir + "/ab") != nullptr);
+  EXPECT_EQ(cache.size(), 3u);
+
+  // a sibling sharing the prefix stays
+  cache.invalidate(rootDir + "/a");
+  EXPECT_EQ(cache.size(), 1u);
+
+  // a moved directory isn't found under its old name any more
+  ASSERT_EQ(rename((rootDir + "/ab").c_str(), (rootDir + "/c").c_str()), 0);
+  cache.invalidate(rootDir + "/ab");
+  EXPECT_TRUE(cache.get(rootDir + "/ab") == nullptr);
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST_F(DirFdCacheTest, HeldWhileDropped) {
+  DirFdCache cache(1);
+  std::shared_ptr<const DirFdCache::Dir> a = cache.get(rootDir + "/a");
+  ASSERT_TRUE(a != nullptr);
+  EXPECT_TRUE(cache.get(rootDir + "/ab") != nullptr);
+  EXPECT_EQ(cache.size(), 1u);
+
+  // evicted, but still open for its user
+  struct stat st;
+  EXPECT_EQ(fstatat(a->fd(), "b", &st, AT_SYMLINK_NOFOLLOW), 0);
+  EXPECT_TRUE(S_ISDIR(st.st_mode));
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0u);
+  EXPECT_EQ(fstatat(a->fd(), "b", &st, AT_SYMLINK_NOFOLLOW), 0);
+}
+
+TEST_F(DirFdCacheTest, RelaxedStat) {
+  DirFdCache cache(8);
+  std::string path = rootDir + "/a/file";
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, "12345", 5), 5);
+  close(fd);
+
+  // the same attributes whichever way they are asked for
+  struct stat st, relaxed, size;
+  AtPath at(&cache, path);
+  ASSERT_EQ(statAt(at, &st, false), 0);
+  ASSERT_EQ(statAt(at, &relaxed, true), 0);
+  EXPECT_EQ(relaxed.st_ino, st.st_ino);
+  EXPECT_EQ(relaxed.st_dev, st.st_dev);
+  EXPECT_EQ(relaxed.st_mode, st.st_mode);
+  EXPECT_EQ(relaxed.st_nlink, st.st_nlink);
+  EXPECT_EQ(relaxed.st_mtim.tv_sec, st.st_mtim.tv_sec);
+  EXPECT_EQ(relaxed.st_mtim.tv_nsec, st.st_mtim.tv_nsec);
+  ASSERT_EQ(statAt(at, &size, true, true), 0);
+  EXPECT_EQ(size.st_size, 5);
+
+  AtPath missing(&cache, rootDir + "/a/missing");
+  EXPECT_EQ(statAt(missing, &st, true), -1);
+  EXPECT_EQ(errno, ENOENT);
+}
+
+}  // namespace
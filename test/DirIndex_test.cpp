@@ -0,0 +1,175 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/DirIndex.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat dirStat(ino_t ino, time_t sec, long nsec) {
+  struct stat st = {};
+  st.st_ino = ino;
+  st.st_mtim.tv_sec = st.st_ctim.tv_sec = sec;
+  st.st_mtim.tv_nsec = st.st_ctim.tv_nsec = nsec;
+  return st;
+}
+
+DirListing listing(size_t count) {
+  DirListing l;
+  for (size_t i = 0; i < count; ++i) {
+    DirEntry entry;
+    entry.name = "file" + std::to_string(i);
+    entry.inode = 100 + i;
+    entry.fileType = 8;
+    l.push_back(entry);
+  }
+  return l;
+}
+
+std::set<std::string> names(const DirListing &l) {
+  std::set<std::string> result;
+  for (const DirEntry &entry : l) {
+    result.insert(entry.name);
+  }
+  return result;
+}
+
+class DirIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = std::string(root) + "/";
+    cipher = Cipher::New("AES", 256);
+    key = cipher->newRandomKey();
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::unique_ptr<DirIndex> open(size_t minEntries = 10) {
+    return std::unique_ptr<DirIndex>(
+        new DirIndex(rootDir, cipher, key, minEntries));
+  }
+
+  std::string rootDir;
+  std::shared_ptr<Cipher> cipher;
+  CipherKey key;
+};
+
+TEST_F(DirIndexTest, ServedWhileStampMatches) {
+  time_t past = time(nullptr) - 10;
+  {
+    std::unique_ptr<DirIndex> index = open();
+    index->put(dirStat(5, past, 1), listing(20));
+    EXPECT_TRUE(index->known(dirStat(5, past, 1)));
+  }
+
+  // a later mount
+  std::unique_ptr<DirIndex> index = open();
+  auto l = index->get(dirStat(5, past, 1));
+  ASSERT_TRUE(l != nullptr);
+  EXPECT_EQ(names(*l), names(listing(20)));
+  EXPECT_EQ(l->front().name, "file0");
+  EXPECT_EQ(l->front().inode, 100u);
+  EXPECT_EQ(l->front().fileType, 8);
+
+  // changed behind our back: the stale index is dropped
+  EXPECT_TRUE(index->get(dirStat(5, past, 2)) == nullptr);
+  EXPECT_FALSE(index->known(dirStat(5, past, 2)));
+  EXPECT_TRUE(index->get(dirStat(5, past, 1)) == nullptr);
+}
+
+TEST_F(DirIndexTest, OnlyLargeSettledDirectories) {
+  std::unique_ptr<DirIndex> index = open();
+  time_t past = time(nullptr) - 10;
+  index->put(dirStat(5, past, 1), listing(5));
+  EXPECT_TRUE(index->get(dirStat(5, past, 1)) == nullptr);
+
+  // whole second times of the current second may still change
+  time_t now = time(nullptr);
+  index->put(dirStat(6, now, 0), listing(20));
+  EXPECT_TRUE(index->get(dirStat(6, now, 0)) == nullptr);
+  index->put(dirStat(6, past, 0), listing(20));
+  EXPECT_TRUE(index->get(dirStat(6, past, 0)) != nullptr);
+}
+
+TEST_F(DirIndexTest, ChangesAreAppended) {
+  time_t past = time(nullptr) - 10;
+  {
+    std::unique_ptr<DirIndex> index = open();
+    index->put(dirStat(5, past, 1), listing(20));
+
+    DirEntry added;
+    added.name = "new";
+    added.inode = 7;
+    added.fileType = 4;
+    index->changed(dirStat(5, past, 1), dirStat(5, past, 2), {"new"}, &added);
+    index->changed(dirStat(5, past, 2), dirStat(5, past, 3), {"file3"},
+                   nullptr);
+  }
+
+  std::unique_ptr<DirIndex> index = open();
+  auto l = index->get(dirStat(5, past, 3));
+  ASSERT_TRUE(l != nullptr);
+  std::set<std::string> expected = names(listing(20));
+  expected.erase("file3");
+  expected.insert("new");
+  EXPECT_EQ(names(*l), expected);
+
+  // a change to an index which wasn't current drops it
+  index->changed(dirStat(5, past, 2), dirStat(5, past, 4), {"file4"},
+                 nullptr);
+  EXPECT_TRUE(index->get(dirStat(5, past, 4)) == nullptr);
+}
+
+TEST_F(DirIndexTest, ManyChangesRewriteSnapshot) {
+  time_t past = time(nullptr) - 10;
+  std::unique_ptr<DirIndex> index = open();
+  index->put(dirStat(5, past, 1), listing(20));
+  long nsec = 1;
+  for (int i = 0; i < 100; ++i, ++nsec) {
+    DirEntry added;
+    added.name = "n" + std::to_string(i);
+    index->changed(dirStat(5, past, nsec), dirStat(5, past, nsec + 1),
+                   {added.name}, &added);
+  }
+  auto l = index->get(dirStat(5, past, nsec));
+  ASSERT_TRUE(l != nullptr);
+  EXPECT_EQ(l->size(), 120u);
+
+  // the snapshot written by get() holds the changes
+  index = open();
+  l = index->get(dirStat(5, past, nsec));
+  ASSERT_TRUE(l != nullptr);
+  EXPECT_EQ(l->size(), 120u);
+}
+
+TEST_F(DirIndexTest, DamagedIndexIgnored) {
+  time_t past = time(nullptr) - 10;
+  std::unique_ptr<DirIndex> index = open();
+  index->put(dirStat(5, past, 1), listing(20));
+
+  std::string dir = rootDir + DirIndex::DirName;
+  std::string cmd = "for f in " + dir + "/*; do printf 'XXXX' | " +
+                    "dd of=$f bs=1 seek=40 conv=notrunc 2>/dev/null; done";
+  ASSERT_EQ(system(cmd.c_str()), 0);
+
+  index = open();
+  EXPECT_TRUE(index->get(dirStat(5, past, 1)) == nullptr);
+}
+
+}  // namespace
@@ -0,0 +1,252 @@
+#include "benchmark/benchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/BlockNameIO.h"
+#include "encfs/Cipher.h"
+#include "encfs/Context.h"
+#include "encfs/DirNode.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileUtils.h"
+#include "encfs/NullNameIO.h"
+#include "encfs/StreamNameIO.h"
+
+using namespace encfs;
+
+namespace {
+
+// name codings, as selectNameCoding offers them
+enum Codec { Block, Block32, Stream, Null };
+
+/*
+    A DirNode over a cipher directory on tmpfs (if /dev/shm is there), with
+    chained name IVs as new volumes have, and /d holding entries files with
+    names of len characters.  The metadata paths of DirNode are then timed
+    without the disk, as testNameCoding in encfs/test.cpp codes names
+    without one.
+*/
+struct Volume {
+  FSConfigPtr cfg;
+  EncFS_Context ctx;
+  std::string root;
+  std::unique_ptr<DirNode> dir;
+
+  Volume(int codec, int len, int entries) : cfg(new FSConfig) {
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->opts.reset(new EncFS_Opts);
+    switch (codec) {
+      case Block:
+      case Block32:
+        cfg->nameCoding.reset(new BlockNameIO(
+            BlockNameIO::CurrentInterface(codec == Block32), cfg->cipher,
+            cfg->key, cfg->cipher->cipherBlockSize(), codec == Block32));
+        break;
+      case Stream:
+        cfg->nameCoding.reset(new StreamNameIO(
+            StreamNameIO::CurrentInterface(), cfg->cipher, cfg->key));
+        break;
+      default:
+        cfg->nameCoding.reset(new NullNameIO());
+        break;
+    }
+    cfg->nameCoding->setChainedNameIV(true);
+
+    root = access("/dev/shm", W_OK) == 0 ? "/dev/shm/encfsbenchXXXXXX"
+                                          : "/tmp/encfsbenchXXXXXX";
+    if (mkdtemp(&root[0]) == nullptr) {
+      abort();
+    }
+    root += "/";
+    dir.reset(new DirNode(&ctx, root, cfg));
+
+    dir->mkdir("/d", 0700);
+    for (int i = 0; i < entries; ++i) {
+      std::string path = "/d/" + name(len, i);
+      int fd = ::creat(dir->cipherPath(path.c_str()).c_str(), 0600);
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  ~Volume() {
+    dir.reset();
+    std::string cmd = "rm -rf " + root;
+    if (system(cmd.c_str()) != 0) {
+      abort();
+    }
+  }
+
+  // the i'th name of len characters
+  static std::string name(int len, int i) {
+    std::string n = std::to_string(i);
+    n.resize(std::max<size_t>(len, n.size()), 'n');
+    return n;
+  }
+};
+
+// (codec, name length)
+void Codecs(benchmark::internal::Benchmark *b) {
+  for (int codec : {Block, Block32, Stream, Null}) {
+    for (int len : {8, 64}) {
+      b->Args({codec, len});
+    }
+  }
+  b->ArgNames({"codec", "len"});
+}
+
+// (codec, name length, directory entries)
+void CodecsAndSizes(benchmark::internal::Benchmark *b) {
+  for (int codec : {Block, Block32, Stream, Null}) {
+    for (int len : {8, 64}) {
+      for (int entries : {100, 10000}) {
+        b->Args({codec, len, entries});
+      }
+    }
+  }
+  b->ArgNames({"codec", "len", "entries"});
+}
+
+}  // namespace
+
+// mkdir of a new directory, then rmdir of it
+static void BM_DirMkdirRmdir(benchmark::State &state) {
+  Volume vol(state.range(0), state.range(1), 0);
+  std::string path = "/d/" + Volume::name(state.range(1), 0);
+  while (state.KeepRunning()) {
+    if (vol.dir->mkdir(path.c_str(), 0700) != 0 ||
+        vol.dir->rmdir(path.c_str()) != 0) {
+      state.SkipWithError("mkdir or rmdir failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DirMkdirRmdir)->Apply(Codecs);
+
+// mknod of a new file through its FileNode, then unlink of it
+static void BM_DirMknodUnlink(benchmark::State &state) {
+  Volume vol(state.range(0), state.range(1), 0);
+  std::string path = "/d/" + Volume::name(state.range(1), 0);
+  while (state.KeepRunning()) {
+    std::shared_ptr<FileNode> node =
+        vol.dir->lookupNode(path.c_str(), "bench");
+    if (node->mknod(S_IFREG | 0600, 0) != 0 ||
+        vol.dir->unlink(path.c_str()) != 0) {
+      state.SkipWithError("mknod or unlink failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DirMknodUnlink)->Apply(Codecs);
+
+// recursive delete of a tree of 8 directories of 256 files each, as the
+// delete test of PERFORMANCE.md does, by (threads) threads at once
+static void BM_DirDeleteTree(benchmark::State &state) {
+  Volume vol(Block, 16, 0);
+  const int dirs = 8;
+  const int files = 256;
+  int threads = state.range(0);
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    for (int d = 0; d < dirs; ++d) {
+      std::string dir = "/d/" + Volume::name(16, d);
+      vol.dir->mkdir(dir.c_str(), 0700);
+      for (int i = 0; i < files; ++i) {
+        std::string path = dir + "/" + Volume::name(16, i);
+        int fd = ::creat(vol.dir->cipherPath(path.c_str()).c_str(), 0600);
+        if (fd >= 0) {
+          ::close(fd);
+        }
+      }
+    }
+    state.ResumeTiming();
+
+    std::atomic<int> failed(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t]() {
+        for (int d = t; d < dirs; d += threads) {
+          std::string dir = "/d/" + Volume::name(16, d);
+          for (int i = 0; i < files; ++i) {
+            std::string path = dir + "/" + Volume::name(16, i);
+            failed += vol.dir->unlink(path.c_str()) != 0;
+          }
+          failed += vol.dir->rmdir(dir.c_str()) != 0;
+        }
+      });
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    if (failed != 0) {
+      state.SkipWithError("unlink or rmdir failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * dirs * (files + 1));
+}
+BENCHMARK(BM_DirDeleteTree)->Arg(1)->Arg(4)->ArgName("threads")->UseRealTime();
+
+// rename of a directory of entries files back and forth; with chained name
+// IVs every entry is renamed too (genRenameList)
+static void BM_DirRename(benchmark::State &state) {
+  Volume vol(state.range(0), state.range(1), state.range(2));
+  std::string other = "/" + Volume::name(state.range(1), 1);
+  bool there = false;
+  while (state.KeepRunning()) {
+    int res = there ? vol.dir->rename(other.c_str(), "/d")
+                    : vol.dir->rename("/d", other.c_str());
+    if (res != 0) {
+      state.SkipWithError("rename failed");
+      break;
+    }
+    there = !there;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DirRename)->Apply(CodecsAndSizes);
+
+// lookupNode of the entries in turn, past the path cache for large
+// directories
+static void BM_DirLookup(benchmark::State &state) {
+  Volume vol(state.range(0), state.range(1), state.range(2));
+  std::vector<std::string> paths;
+  for (int i = 0; i < state.range(2); ++i) {
+    paths.push_back("/d/" + Volume::name(state.range(1), i));
+  }
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        vol.dir->lookupNode(paths[i++ % paths.size()].c_str(), "bench"));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DirLookup)->Apply(CodecsAndSizes);
+
+// openDir, and nextPlaintextName through all of it
+static void BM_DirList(benchmark::State &state) {
+  Volume vol(state.range(0), state.range(1), state.range(2));
+  int64_t names = 0;
+  while (state.KeepRunning()) {
+    DirTraverse dt = vol.dir->openDir("/d");
+    while (!dt.nextPlaintextName().empty()) {
+      ++names;
+    }
+  }
+  state.SetItemsProcessed(names);
+}
+BENCHMARK(BM_DirList)->Apply(CodecsAndSizes);
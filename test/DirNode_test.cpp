@@ -0,0 +1,943 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <set>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/BlockNameIO.h"
+#include "encfs/Cipher.h"
+#include "encfs/Context.h"
+#include "encfs/DirNode.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileUtils.h"
+#include "encfs/NullNameIO.h"
+#include "encfs/Policies.h"
+#include "encfs/Stats.h"
+#include "encfs/StreamNameIO.h"
+#include "encfs/Stripes.h"
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+
+namespace {
+
+FSConfigPtr newConfig(bool chainedIV, bool stream, int pathCacheSize) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->opts->pathCacheSize = pathCacheSize;
+  if (stream) {
+    cfg->nameCoding.reset(new StreamNameIO(StreamNameIO::CurrentInterface(),
+                                           cfg->cipher, cfg->key));
+  } else {
+    cfg->nameCoding.reset(new BlockNameIO(BlockNameIO::CurrentInterface(),
+                                          cfg->cipher, cfg->key,
+                                          cfg->cipher->cipherBlockSize()));
+  }
+  cfg->nameCoding->setChainedNameIV(chainedIV);
+  return cfg;
+}
+
+const std::vector<std::string> &paths() {
+  static const std::vector<std::string> list = {
+      "/",           "/a",        "/a/b",          "/a/b/c",
+      "/a/b/c/d",    "/a/./b",    "/a/b/..",       "/a/b/.",
+      "/x//y",       "/x/y/",     "/node_modules", "/node_modules/p/lib",
+      "/a/b/cde.txt"};
+  return list;
+}
+
+TEST(DirNode, CachedCipherPathMatchesNameIO) {
+  for (bool chained : {false, true}) {
+    for (bool stream : {false, true}) {
+      FSConfigPtr cfg = newConfig(chained, stream, 64);
+      DirNode dir(nullptr, "/root/", cfg);
+
+      // twice, so the second round is served from the cache
+      for (int round = 0; round < 2; ++round) {
+        for (const std::string &path : paths()) {
+          EXPECT_EQ(dir.cipherPathWithoutRoot(path.c_str()),
+                    cfg->nameCoding->encodePath(path.c_str()))
+              << path << " chained " << chained << " stream " << stream;
+        }
+      }
+    }
+  }
+}
+
+TEST(DirNode, CachedPlainPathMatchesNameIO) {
+  for (bool chained : {false, true}) {
+    for (bool stream : {false, true}) {
+      FSConfigPtr cfg = newConfig(chained, stream, 64);
+      const NameIO &naming = *cfg->nameCoding;
+
+      // parents come first in paths(), so most are decoded from their
+      // parent's cached IV; then with the cache primed by encoding
+      for (bool prime : {false, true}) {
+        DirNode dir(nullptr, "/root/", cfg);
+        for (const std::string &path : paths()) {
+          std::string cipher = naming.encodePath(path.c_str());
+          if (prime) {
+            EXPECT_EQ(dir.cipherPathWithoutRoot(path.c_str()), cipher);
+          }
+          EXPECT_EQ(dir.plainPath(cipher.c_str()),
+                    naming.decodePath(cipher.c_str()))
+              << path << " chained " << chained << " stream " << stream;
+        }
+      }
+    }
+  }
+}
+
+TEST(DirNode, CipherPathIntoMatchesCipherPath) {
+  for (bool chained : {false, true}) {
+    for (int cacheSize : {0, 64}) {
+      FSConfigPtr cfg = newConfig(chained, false, cacheSize);
+      DirNode dir(nullptr, "/root/", cfg);
+
+      for (int round = 0; round < 2; ++round) {
+        for (const std::string &path : paths()) {
+          char buf[PATH_MAX];
+          int len = dir.cipherPathInto(path.c_str(), buf, sizeof(buf));
+          std::string expected = dir.cipherPath(path.c_str());
+          ASSERT_EQ(len, (int)expected.length()) << path;
+          EXPECT_EQ(std::string(buf), expected) << path;
+        }
+      }
+
+      // too small for the result
+      char small[12];
+      EXPECT_EQ(dir.cipherPathInto("/a/b/c", small, sizeof(small)),
+                -ENAMETOOLONG);
+    }
+  }
+}
+
+TEST(DirNode, NullNamesPassThrough) {
+  for (int cacheSize : {0, 64}) {
+    FSConfigPtr cfg = newConfig(false, false, cacheSize);
+    cfg->nameCoding.reset(new NullNameIO());
+    DirNode dir(nullptr, "/root/", cfg);
+
+    for (const std::string &path : paths()) {
+      // as recodePath would have it, without the leading slash
+      std::string name = path.substr(1);
+      EXPECT_EQ(dir.cipherPathWithoutRoot(path.c_str()), name) << path;
+      EXPECT_EQ(dir.cipherPath(path.c_str()), "/root/" + name) << path;
+      char buf[PATH_MAX];
+      int len = dir.cipherPathInto(path.c_str(), buf, sizeof(buf));
+      ASSERT_EQ(len, (int)name.length() + 6) << path;
+      EXPECT_EQ(std::string(buf), "/root/" + name) << path;
+      EXPECT_EQ(dir.plainPath(name.c_str()), name) << path;
+    }
+    EXPECT_EQ(cfg->nameCoding->encodePath("//a/b"), "a/b");
+
+    char small[8];
+    EXPECT_EQ(dir.cipherPathInto("/a/b", small, sizeof(small)),
+              -ENAMETOOLONG);
+  }
+}
+
+TEST(DirNode, DecodePathIntoRoundTrip) {
+  for (bool stream : {false, true}) {
+    FSConfigPtr cfg = newConfig(true, stream, 0);
+    const NameIO &naming = *cfg->nameCoding;
+
+    char cipher[PATH_MAX];
+    char plain[PATH_MAX];
+    int len = naming.encodePathInto("/a/b/cde.txt", cipher, sizeof(cipher));
+    EXPECT_EQ(std::string(cipher, len), naming.encodePath("/a/b/cde.txt"));
+    len = naming.decodePathInto(cipher, plain, sizeof(plain));
+    EXPECT_EQ(std::string(plain, len), "a/b/cde.txt");
+  }
+}
+
+TEST(DirNode, PlainPathRoundTrip) {
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  DirNode dir(nullptr, "/root/", cfg);
+
+  for (int round = 0; round < 2; ++round) {
+    for (const char *path : {"/a", "/a/b/c", "/node_modules/p/lib"}) {
+      std::string cipher = dir.cipherPathWithoutRoot(path);
+      // coded paths are relative, so is the decoded one
+      EXPECT_EQ(dir.plainPath(cipher.c_str()), std::string(path + 1));
+    }
+  }
+}
+
+TEST(DirNode, ListDirDecodesBatches) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 0);
+  cfg->opts->dirCacheSize = 0;
+  DirNode dir(nullptr, rootDir, cfg);
+
+  // more than one batch, and an undecodable name
+  std::set<std::string> expected = {".", ".."};
+  for (size_t i = 0; i < DirTraverse::BatchSize + 10; ++i) {
+    std::string name = "/file" + std::to_string(i);
+    int fd = ::creat(dir.cipherPath(name.c_str()).c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    expected.insert(name.substr(1));
+  }
+  int fd = ::creat((rootDir + "not-encoded").c_str(), 0600);
+  ASSERT_GE(fd, 0);
+  ::close(fd);
+
+  for (bool parallel : {false, true}) {
+    if (parallel) {
+      cfg->workers = std::make_shared<WorkerPool>(4, 64);
+    }
+
+    int res = 0;
+    std::shared_ptr<const DirListing> listing = dir.listDir("/", &res);
+    ASSERT_TRUE(listing != nullptr);
+    std::set<std::string> names;
+    for (const DirEntry &entry : *listing) {
+      names.insert(entry.name);
+    }
+    EXPECT_EQ(listing->size(), expected.size()) << parallel;
+    EXPECT_EQ(names, expected) << parallel;
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, ListingPrimesPaths) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  for (bool chained : {false, true}) {
+    FSConfigPtr cfg = newConfig(chained, false, 64);
+    {
+      DirNode dir(nullptr, rootDir, cfg);
+      ASSERT_EQ(dir.mkdir("/sub", 0700), 0);
+      for (const char *name : {"/sub/a", "/sub/b", "/sub/c"}) {
+        int fd = ::creat(dir.cipherPath(name).c_str(), 0600);
+        ASSERT_GE(fd, 0);
+        ::close(fd);
+      }
+    }
+
+    // a fresh cache, filled by the listing
+    DirNode dir(nullptr, rootDir, cfg);
+    std::shared_ptr<const DirListing> listing = dir.listDir("/sub");
+    ASSERT_TRUE(listing != nullptr);
+
+    Stats::reset();
+    Stats::setEnabled(true);
+    size_t files = 0;
+    for (const DirEntry &entry : *listing) {
+      if (entry.name == "." || entry.name == "..") {
+        continue;
+      }
+      std::string path = "/sub/" + entry.name;
+      struct stat st;
+      EXPECT_EQ(dir.getAttr(path.c_str(), &st), 0) << path;
+      std::string backing = dir.cipherPathWithoutRoot(path.c_str());
+      EXPECT_EQ(dir.plainPath(backing.c_str()), path.substr(1)) << path;
+      ++files;
+    }
+    Stats::setEnabled(false);
+    EXPECT_EQ(files, 3u);
+    // neither way coded again
+    EXPECT_EQ(Stats::count(Stats::NameEncode), 0u) << "chained " << chained;
+    EXPECT_EQ(Stats::count(Stats::NameDecode), 0u) << "chained " << chained;
+    Stats::reset();
+
+    // and what the listing put there is what coding the paths gives
+    for (const char *path : {"/sub/a", "/sub/b", "/sub/c"}) {
+      EXPECT_EQ(dir.cipherPathWithoutRoot(path),
+                cfg->nameCoding->encodePath(path))
+          << path << " chained " << chained;
+    }
+
+    std::string cmd = std::string("rm -rf ") + rootDir + "*";
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, ReverseListingPrimesPaths) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+  ASSERT_EQ(::mkdir((rootDir + "sub").c_str(), 0700), 0);
+  for (const char *name : {"x", "sub/a", "sub/b"}) {
+    int fd = ::creat((rootDir + name).c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+  }
+
+  for (bool chained : {false, true}) {
+    FSConfigPtr cfg = newConfig(chained, false, 64);
+    cfg->reverseEncryption = true;
+    cfg->nameCoding->setReverseEncryption(true);
+    DirNode dir(nullptr, rootDir, cfg);
+
+    // the backing paths of the listed names, from the primed cache
+    std::set<std::string> found;
+    std::vector<std::string> dirs = {"/"};
+    for (size_t i = 0; i < dirs.size(); ++i) {
+      std::shared_ptr<const DirListing> listing = dir.listDir(dirs[i].c_str());
+      ASSERT_TRUE(listing != nullptr);
+      for (const DirEntry &entry : *listing) {
+        if (entry.name == "." || entry.name == "..") {
+          continue;
+        }
+        std::string path =
+            (dirs[i] == "/" ? std::string() : dirs[i]) + "/" + entry.name;
+        std::string backing = dir.cipherPathWithoutRoot(path.c_str());
+        EXPECT_EQ(backing, cfg->nameCoding->encodePath(path.c_str()))
+            << path << " chained " << chained;
+        found.insert(backing);
+        if (entry.fileType == DT_DIR) {
+          dirs.push_back(path);
+        }
+      }
+    }
+    std::set<std::string> expected = {"x", "sub", "sub/a", "sub/b"};
+    EXPECT_EQ(found, expected) << "chained " << chained;
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, RecursiveRenameChainedIV) {
+  for (bool parallel : {false, true}) {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    std::string rootDir = std::string(root) + "/";
+
+    FSConfigPtr cfg = newConfig(true, false, 64);
+    cfg->opts->dirCacheSize = 0;
+    if (parallel) {
+      cfg->workers = std::make_shared<WorkerPool>(4, 64);
+    }
+    DirNode dir(nullptr, rootDir, cfg);
+    ASSERT_TRUE(dir.hasDirectoryNameDependency());
+
+    // a few levels, with files at each
+    std::vector<std::string> files;
+    for (const char *sub : {"/a", "/a/b", "/a/b/c", "/a/d"}) {
+      ASSERT_EQ(dir.mkdir(sub, 0700, 0, 0), 0);
+      for (int i = 0; i < 20; ++i) {
+        std::string name = std::string(sub) + "/f" + std::to_string(i);
+        int fd = ::creat(dir.cipherPath(name.c_str()).c_str(), 0600);
+        ASSERT_GE(fd, 0);
+        ::close(fd);
+        files.push_back(name.substr(2));
+      }
+    }
+
+    ASSERT_EQ(dir.rename("/a", "/z"), 0);
+
+    for (const std::string &file : files) {
+      std::string moved = "/z" + file;
+      struct stat st;
+      EXPECT_EQ(::stat(dir.cipherPath(moved.c_str()).c_str(), &st), 0)
+          << moved << " parallel " << parallel;
+    }
+    int res = 0;
+    std::shared_ptr<const DirListing> listing = dir.listDir("/z/b/c", &res);
+    ASSERT_TRUE(listing != nullptr);
+    EXPECT_EQ(listing->size(), 22u);  // with . and ..
+
+    std::string cmd = std::string("rm -rf ") + root;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+}
+
+TEST(DirNode, StripedVolume) {
+  std::vector<std::string> roots;
+  for (int i = 0; i < 3; ++i) {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    roots.push_back(std::string(root) + "/");
+  }
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  std::string error;
+  cfg->stripes = Stripes::open(roots, &error);
+  ASSERT_TRUE(cfg->stripes != nullptr) << error;
+  DirNode dir(nullptr, roots[0], cfg);
+
+  // files go to every root, directories are in all of them
+  ASSERT_EQ(dir.mkdir("/a", 0700, 0, 0), 0);
+  ASSERT_EQ(dir.mkdir("/a/b", 0700, 0, 0), 0);
+  std::vector<int> used(roots.size());
+  for (int i = 0; i < 30; ++i) {
+    std::string name = "/a/b/f" + std::to_string(i);
+    std::string path = dir.cipherPath(name.c_str());
+    int fd = ::creat(path.c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    ++used[cfg->stripes->rootOf(path)];
+  }
+  for (int count : used) {
+    EXPECT_GT(count, 0);
+  }
+
+  // a recursive rename keeps every file where it is
+  ASSERT_EQ(dir.rename("/a", "/z"), 0);
+  for (int i = 0; i < 30; ++i) {
+    std::string name = "/z/b/f" + std::to_string(i);
+    struct stat st;
+    EXPECT_EQ(::stat(dir.cipherPath(name.c_str()).c_str(), &st), 0) << name;
+  }
+  int res = 0;
+  std::shared_ptr<const DirListing> listing = dir.listDir("/z/b", &res);
+  ASSERT_TRUE(listing != nullptr);
+  EXPECT_EQ(listing->size(), 32u);  // with . and ..
+  listing = dir.listDir("/z", &res);
+  ASSERT_TRUE(listing != nullptr);
+  EXPECT_EQ(listing->size(), 3u);  // b only once
+
+  // a file renamed over one in another root replaces it
+  ASSERT_EQ(dir.rename("/z/b/f0", "/z/b/f1"), 0);
+  listing = dir.listDir("/z/b", &res);
+  ASSERT_TRUE(listing != nullptr);
+  EXPECT_EQ(listing->size(), 31u);
+
+  EXPECT_EQ(dir.rmdir("/z/b"), -ENOTEMPTY);
+  for (int i = 1; i < 30; ++i) {
+    std::string name = "/z/b/f" + std::to_string(i);
+    ASSERT_EQ(dir.unlink(name.c_str()), 0) << name;
+  }
+  EXPECT_EQ(dir.rmdir("/z/b"), 0);
+  EXPECT_EQ(dir.rmdir("/z"), 0);
+  for (const std::string &root : roots) {
+    DIR *d = ::opendir(root.c_str());
+    ASSERT_TRUE(d != nullptr);
+    int entries = 0;
+    while (::readdir(d) != nullptr) {
+      ++entries;
+    }
+    ::closedir(d);
+    EXPECT_EQ(entries, 3) << root;  // ., .. and the marker
+    std::string cmd = "rm -rf " + root;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+}
+
+TEST(DirNode, CopyFileKeepsCiphertext) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  for (bool chainedIV : {false, true}) {
+    FSConfigPtr cfg = newConfig(true, false, 64);
+    cfg->config->externalIVChaining = chainedIV;
+    DirNode dir(nullptr, rootDir, cfg);
+
+    std::string data(200000, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = static_cast<char>(i * 7);
+    }
+    int fd = ::open(dir.cipherPath("/src").c_str(), O_WRONLY | O_CREAT, 0640);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::write(fd, data.data(), data.size()),
+              static_cast<ssize_t>(data.size()));
+    ::close(fd);
+
+    if (chainedIV) {
+      // the contents depend on the name
+      EXPECT_EQ(dir.copyFile("/src", "/dst"), -EXDEV);
+    } else {
+      ASSERT_EQ(dir.copyFile("/src", "/dst"), 0);
+      std::string copy(data.size() + 1, '\0');
+      fd = ::open(dir.cipherPath("/dst").c_str(), O_RDONLY);
+      ASSERT_GE(fd, 0);
+      EXPECT_EQ(::read(fd, &copy[0], copy.size()),
+                static_cast<ssize_t>(data.size()));
+      ::close(fd);
+      copy.resize(data.size());
+      EXPECT_EQ(copy, data);
+
+      struct stat st;
+      ASSERT_EQ(::stat(dir.cipherPath("/dst").c_str(), &st), 0);
+      EXPECT_EQ(st.st_mode & 07777, 0640u);
+
+      // never over an existing file
+      EXPECT_EQ(dir.copyFile("/src", "/dst"), -EEXIST);
+      ASSERT_EQ(dir.unlink("/dst"), 0);
+    }
+    ASSERT_EQ(dir.unlink("/src"), 0);
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, IndexFollowsChanges) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->opts->dirCacheSize = 0;
+  cfg->opts->dirIndexSize = 10;
+
+  std::set<std::string> expected = {".", ".."};
+  {
+    DirNode dir(nullptr, rootDir, cfg);
+    ASSERT_EQ(dir.mkdir("/d", 0700, 0, 0), 0);
+    for (int i = 0; i < 20; ++i) {
+      std::string name = "/d/f" + std::to_string(i);
+      int fd = ::creat(dir.cipherPath(name.c_str()).c_str(), 0600);
+      ASSERT_GE(fd, 0);
+      ::close(fd);
+      expected.insert(name.substr(3));
+    }
+    int res = 0;
+    ASSERT_TRUE(dir.listDir("/d", &res) != nullptr);
+
+    // changes through DirNode are added to the index
+    ASSERT_EQ(dir.mkdir("/d/sub", 0700, 0, 0), 0);
+    ASSERT_EQ(dir.unlink("/d/f0"), 0);
+    ASSERT_EQ(dir.rename("/d/f1", "/d/renamed"), 0);
+    ASSERT_EQ(dir.rename("/d/f2", "/moved"), 0);
+    expected.insert("sub");
+    expected.insert("renamed");
+    for (const char *gone : {"f0", "f1", "f2"}) {
+      expected.erase(gone);
+    }
+  }
+
+  // a later mount
+  DirNode dir(nullptr, rootDir, cfg);
+  int res = 0;
+  std::shared_ptr<const DirListing> listing = dir.listDir("/d", &res);
+  ASSERT_TRUE(listing != nullptr);
+  std::set<std::string> names;
+  for (const DirEntry &entry : *listing) {
+    names.insert(entry.name);
+  }
+  EXPECT_EQ(names, expected);
+
+  // the index itself is hidden
+  listing = dir.listDir("/", &res);
+  ASSERT_TRUE(listing != nullptr);
+  names.clear();
+  for (const DirEntry &entry : *listing) {
+    names.insert(entry.name);
+  }
+  EXPECT_EQ(names, std::set<std::string>({".", "..", "d", "moved"}));
+  struct stat st;
+  EXPECT_EQ(::stat((rootDir + DirIndex::DirName).c_str(), &st), 0);
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, ListingPrimesAttributes) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->config->uniqueIV = true;
+  cfg->opts->attrCacheSize = 64;
+  DirNode dir(nullptr, rootDir, cfg);
+  ASSERT_EQ(dir.mkdir("/d", 0700, 0, 0), 0);
+  ASSERT_EQ(dir.mkdir("/d/sub", 0700, 0, 0), 0);
+  // a header and 100 bytes
+  std::string data(108, 'x');
+  int fd = ::creat(dir.cipherPath("/d/f").c_str(), 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(::write(fd, data.data(), data.size()), (ssize_t)data.size());
+  ::close(fd);
+
+  struct stat st;
+  EXPECT_FALSE(dir.cachedAttr("/d/f", &st));
+  int res = 0;
+  ASSERT_TRUE(dir.listDir("/d", &res) != nullptr);
+
+  // getattr would find the same, without asking the backing filesystem
+  ASSERT_TRUE(dir.cachedAttr("/d/f", &st));
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+  EXPECT_EQ(st.st_size, 100);
+  ASSERT_TRUE(dir.cachedAttr("/d/sub", &st));
+  EXPECT_TRUE(S_ISDIR(st.st_mode));
+
+  ASSERT_EQ(dir.unlink("/d/f"), 0);
+  EXPECT_FALSE(dir.cachedAttr("/d/f", &st));
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, WatchDropsChangedPaths) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->config->uniqueIV = true;
+  cfg->opts->attrCacheSize = 64;
+  DirNode dir(nullptr, rootDir, cfg);
+  ASSERT_EQ(dir.mkdir("/d", 0700, 0, 0), 0);
+  std::string data(108, 'x');
+  std::string cipher = dir.cipherPath("/d/f");
+  int fd = ::creat(cipher.c_str(), 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(::write(fd, data.data(), data.size()), (ssize_t)data.size());
+  ::close(fd);
+  ASSERT_TRUE(dir.watchBacking());
+
+  int res = 0;
+  ASSERT_TRUE(dir.listDir("/d", &res) != nullptr);
+  struct stat st;
+  ASSERT_TRUE(dir.cachedAttr("/d/f", &st));
+
+  // grown by someone else
+  fd = ::open(cipher.c_str(), O_WRONLY | O_APPEND);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(::write(fd, data.data(), 8), 8);
+  ::close(fd);
+  bool dropped = false;
+  for (int i = 0; i < 500 && !dropped; ++i) {
+    dropped = !dir.cachedAttr("/d/f", &st);
+    if (!dropped) usleep(10000);
+  }
+  EXPECT_TRUE(dropped);
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, GetAttrMatchesFileNode) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  for (int variant = 0; variant < 5; ++variant) {
+    FSConfigPtr cfg = newConfig(false, false, 64);
+    cfg->opts->attrCacheSize = 0;
+    cfg->config->uniqueIV = variant != 0;
+    cfg->config->alignedBlocks = variant == 2;
+    if (variant >= 3) {
+      cfg->config->blockMACBytes = 8;
+      cfg->config->blockMACRandBytes = 0;
+    }
+    cfg->config->compression = variant == 4 ? 1 : 0;
+    DirNode dir(nullptr, rootDir, cfg);
+
+    for (size_t size : {0, 8, 100, 1033, 70000, 200000}) {
+      std::string cipher = dir.cipherPath("/f");
+      int fd = ::open(cipher.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(::ftruncate(fd, size), 0);
+      ::close(fd);
+
+      struct stat expected;
+      FileNode node(&dir, cfg, "/f", cipher.c_str(), 0);
+      ASSERT_EQ(node.getAttr(&expected), 0);
+      struct stat st;
+      ASSERT_EQ(dir.getAttr("/f", &st), 0);
+      EXPECT_EQ(st.st_size, expected.st_size)
+          << "variant " << variant << " size " << size;
+      EXPECT_EQ(st.st_ino, expected.st_ino);
+      EXPECT_EQ(st.st_mode, expected.st_mode);
+    }
+    ASSERT_EQ(dir.unlink("/f"), 0);
+    struct stat st;
+    EXPECT_EQ(dir.getAttr("/f", &st), -ENOENT);
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, OpensDuringRenames) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  // chained names, so that renaming the directory renames the file too
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->opts->attrCacheSize = 0;
+  EncFS_Context ctx;
+  DirNode dir(&ctx, rootDir, cfg);
+  ASSERT_EQ(dir.mkdir("/d", 0700, 0, 0), 0);
+  {
+    int res = 0;
+    std::shared_ptr<FileNode> node =
+        dir.createNode("/d/f", 0600, 0, 0, &res);
+    ASSERT_TRUE(node != nullptr);
+    unsigned char data[] = "hello";
+    ASSERT_EQ(node->write(0, data, 5), 5);
+  }
+
+  std::atomic<bool> done(false);
+  std::atomic<int> opened(0);
+  std::vector<std::thread> openers;
+  for (int t = 0; t < 4; ++t) {
+    openers.emplace_back([&]() {
+      while (!done) {
+        for (const char *path : {"/d/f", "/e/f"}) {
+          int res = 0;
+          std::shared_ptr<FileNode> node =
+              dir.openNode(path, "test", O_RDONLY, &res);
+          if (!node) {
+            EXPECT_EQ(res, -ENOENT) << path;
+            continue;
+          }
+          EXPECT_STREQ(node->plaintextName(), path);
+          unsigned char buf[8] = {0};
+          EXPECT_EQ(node->read(0, buf, sizeof(buf)), 5);
+          EXPECT_EQ(std::string((char *)buf, 5), "hello");
+          ++opened;
+        }
+      }
+    });
+  }
+  while (opened == 0) {
+    std::this_thread::yield();
+  }
+  for (int i = 0; i < 50; ++i) {
+    EXPECT_EQ(dir.rename((i % 2) ? "/e" : "/d", (i % 2) ? "/d" : "/e"), 0);
+  }
+  done = true;
+  for (std::thread &t : openers) {
+    t.join();
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, FileNodeTouchesMountpoint) {
+  FSConfigPtr cfg = newConfig(false, false, 64);
+  cfg->opts->mountPoint = "/root/mnt/";
+  DirNode dir(nullptr, "/root/", cfg);
+
+  FileNode inside(&dir, cfg, "/m", "/root/mnt/x", 0);
+  FileNode exact(&dir, cfg, "/m", "/root/mnt", 0);
+  FileNode beside(&dir, cfg, "/m", "/root/mnt2", 0);
+  EXPECT_TRUE(inside.touchesMountpoint());
+  EXPECT_TRUE(exact.touchesMountpoint());
+  EXPECT_FALSE(beside.touchesMountpoint());
+
+  // follows renames
+  ASSERT_TRUE(beside.setName("/n", "/root/mnt/y", 0));
+  EXPECT_TRUE(beside.touchesMountpoint());
+  ASSERT_TRUE(inside.setName("/n", "/root/other", 0));
+  EXPECT_FALSE(inside.touchesMountpoint());
+}
+
+TEST(DirNode, WarmCacheRefillsCaches) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->config->uniqueIV = true;
+  cfg->opts->attrCacheSize = 64;
+  cfg->opts->warmCache = true;
+  {
+    DirNode dir(nullptr, rootDir, cfg);
+    ASSERT_EQ(dir.mkdir("/d", 0700, 0, 0), 0);
+    ASSERT_EQ(dir.mkdir("/d/sub", 0700, 0, 0), 0);
+    dir.cipherPath("/d/sub");
+  }
+  struct stat st;
+  ASSERT_EQ(lstat((rootDir + WarmCache::FileName).c_str(), &st), 0);
+
+  // the next mount
+  DirNode dir(nullptr, rootDir, cfg);
+  EXPECT_FALSE(dir.cachedAttr("/d/sub", &st));
+  dir.warmUp();
+  for (int i = 0; i < 5000 && !dir.cachedAttr("/d/sub", &st); ++i) {
+    usleep(1000);
+  }
+  ASSERT_TRUE(dir.cachedAttr("/d/sub", &st));
+  EXPECT_TRUE(S_ISDIR(st.st_mode));
+
+  // not part of the volume
+  int res = 0;
+  auto listing = dir.listDir("/", &res);
+  ASSERT_TRUE(listing != nullptr);
+  for (const DirEntry &entry : *listing) {
+    EXPECT_NE(entry.name, WarmCache::FileName);
+  }
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, WarmTreeFillsCaches) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->opts->attrCacheSize = 64;
+  cfg->workers.reset(new WorkerPool(2, 16));
+  std::vector<std::string> dirs = {"/d", "/d/a", "/d/b", "/d/a/deep", "/e"};
+  {
+    DirNode dir(nullptr, rootDir, cfg);
+    for (const std::string &d : dirs) {
+      ASSERT_EQ(dir.mkdir(d.c_str(), 0700, 0, 0), 0);
+    }
+    int fd = ::open(dir.cipherPath("/d/b/f").c_str(), O_WRONLY | O_CREAT,
+                    0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+  }
+
+  DirNode dir(nullptr, rootDir, cfg);
+  struct stat st;
+  EXPECT_FALSE(dir.cachedAttr("/d/a/deep", &st));
+  // /d, its four entries below, and the file
+  EXPECT_EQ(dir.warmTree({"/d"}, 0), 5u);
+  EXPECT_TRUE(dir.cachedAttr("/d/a/deep", &st));
+  EXPECT_TRUE(S_ISDIR(st.st_mode));
+  EXPECT_TRUE(dir.cachedAttr("/d/b/f", &st));
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+  EXPECT_FALSE(dir.cachedAttr("/e", &st));
+
+  // a file on its own, and what isn't there
+  EXPECT_EQ(dir.warmTree({"/d/b/f", "/nosuch"}, 0), 1u);
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, WalkAheadFillsCaches) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->opts->attrCacheSize = 64;
+  cfg->workers.reset(new WorkerPool(2, 16));
+  DirNode dir(nullptr, rootDir, cfg);
+  for (const char *d : {"/d", "/d/a", "/d/a/x", "/d/b", "/d/b/x"}) {
+    ASSERT_EQ(dir.mkdir(d, 0700, 0, 0), 0);
+  }
+  for (const char *f : {"/d/a/f", "/d/a/x/f", "/d/b/f", "/d/b/x/f"}) {
+    int fd = ::creat(dir.cipherPath(f).c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+  }
+
+  // the walker goes into the subdirectories in the order they are listed
+  std::shared_ptr<const DirListing> listing = dir.listDir("/d");
+  ASSERT_TRUE(listing != nullptr);
+  std::vector<std::string> order;
+  for (const DirEntry &entry : *listing) {
+    if (entry.name == "a" || entry.name == "b") {
+      order.push_back("/d/" + entry.name);
+    }
+  }
+  ASSERT_EQ(order.size(), 2u);
+  struct stat st;
+  EXPECT_FALSE(dir.cachedAttr((order[1] + "/f").c_str(), &st));
+
+  // going into the first lists its subdirectory and the second ahead
+  ASSERT_TRUE(dir.listDir(order[0].c_str()) != nullptr);
+  std::string deep = order[0] + "/x/f";
+  std::string next = order[1] + "/f";
+  for (int i = 0; i < 500 && !(dir.cachedAttr(deep.c_str(), &st) &&
+                               dir.cachedAttr(next.c_str(), &st));
+       ++i) {
+    usleep(1000);
+  }
+  EXPECT_TRUE(dir.cachedAttr(deep.c_str(), &st));
+  ASSERT_TRUE(dir.cachedAttr(next.c_str(), &st));
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, PolicyOfSubtree) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+  std::string file = rootDir + "policy";
+  FILE *f = fopen(file.c_str(), "w");
+  ASSERT_NE(f, nullptr);
+  fputs("/quick attrtimeout=0 stream=0 writeback=256\n", f);
+  fclose(f);
+
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->opts->attrCacheSize = 64;
+  cfg->policies = std::make_shared<Policies>(file);
+  ASSERT_EQ(cfg->policies->load(), 0);
+  EncFS_Context ctx;
+  DirNode dir(&ctx, rootDir, cfg);
+  ASSERT_EQ(dir.mkdir("/quick", 0700, 0, 0), 0);
+  ASSERT_EQ(dir.mkdir("/slow", 0700, 0, 0), 0);
+
+  // attributes in /quick aren't kept
+  struct stat st;
+  for (const char *path : {"/quick", "/slow"}) {
+    uint64_t generation = dir.attrGeneration();
+    ASSERT_EQ(dir.getAttr(path, &st), 0);
+    dir.storeAttr(path, st, generation);
+  }
+  EXPECT_FALSE(dir.cachedAttr("/quick", &st));
+  EXPECT_TRUE(dir.cachedAttr("/slow", &st));
+
+  // files take the settings when opened
+  int res = 0;
+  std::shared_ptr<FileNode> node =
+      dir.createNode("/quick/f", 0600, 0, 0, &res);
+  ASSERT_TRUE(node != nullptr);
+  EXPECT_EQ(node->policy().streamSize, 0);
+  EXPECT_EQ(node->policy().writeBack, 256);
+  node = dir.createNode("/slow/f", 0600, 0, 0, &res);
+  ASSERT_TRUE(node != nullptr);
+  EXPECT_EQ(node->policy().streamSize, -1);
+
+  EXPECT_EQ(dir.reloadPolicies(), 0);
+  std::string cmd = std::string("rm -rf ") + root;
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+TEST(DirNode, Tune) {
+  FSConfigPtr cfg = newConfig(true, false, 64);
+  cfg->workers.reset(new WorkerPool(2, 16));
+  DirNode dir(nullptr, "/root/", cfg);
+
+  EXPECT_EQ(dir.tune("pathcache", 128), 0);
+  EXPECT_EQ(dir.tune("readahead", 256), 0);
+  EXPECT_EQ(cfg->opts->readAheadSize, 256);
+  EXPECT_EQ(dir.tune("threads", 3), 0);
+  EXPECT_EQ(cfg->workers->threads(), 3);
+  std::string values = dir.tunables();
+  EXPECT_NE(values.find("pathcache 128\n"), std::string::npos) << values;
+  EXPECT_NE(values.find("threads 3\n"), std::string::npos) << values;
+
+  EXPECT_EQ(dir.tune("pathcache", 0), -EINVAL);
+  EXPECT_EQ(dir.tune("readahead", -1), -EINVAL);
+  EXPECT_EQ(dir.tune("nosuch", 1), -EINVAL);
+  // disabled when mounting
+  EXPECT_EQ(dir.tune("blockcache", 64), -ENOENT);
+  EXPECT_EQ(values.find("blockcache"), std::string::npos);
+}
+
+}  // namespace
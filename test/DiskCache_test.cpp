@@ -0,0 +1,201 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/CachedFileIO.h"
+#include "encfs/DiskCache.h"
+#include "encfs/RawFileIO.h"
+
+using namespace encfs;
+
+namespace {
+
+const size_t Chunk = DiskCache::ChunkSize;
+
+struct stat fileStat(off_t size, long nsec) {
+  struct stat st = {};
+  st.st_size = size;
+  st.st_mtim.tv_sec = st.st_ctim.tv_sec = time(nullptr) - 10;
+  st.st_mtim.tv_nsec = st.st_ctim.tv_nsec = nsec;
+  return st;
+}
+
+std::vector<unsigned char> pattern(size_t len, int seed) {
+  std::vector<unsigned char> data(len);
+  for (size_t i = 0; i < len; ++i) {
+    data[i] = (unsigned char)(i * 7 + seed);
+  }
+  return data;
+}
+
+class DiskCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = std::string(root) + "/";
+    key.dev = 1;
+    key.ino = 42;
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::string cacheDir() const { return rootDir + "cache/"; }
+
+  std::string rootDir;
+  DiskCache::Key key;
+};
+
+TEST_F(DiskCacheTest, KeptAcrossMounts) {
+  auto data = pattern(Chunk + 100, 1);
+  struct stat st = fileStat(data.size(), 5);
+  {
+    DiskCache cache(cacheDir(), 16 << 20);
+    ASSERT_TRUE(cache.validate(key, st));
+    cache.put(key, 0, data.data(), Chunk, cache.generation(key));
+    cache.put(key, 1, data.data() + Chunk, 100, cache.generation(key));
+    EXPECT_EQ(cache.size(), Chunk + 100);
+  }
+
+  DiskCache cache(cacheDir(), 16 << 20);
+  EXPECT_EQ(cache.size(), Chunk + 100);
+  ASSERT_TRUE(cache.validate(key, st));
+  std::vector<unsigned char> buf(200);
+  EXPECT_EQ(cache.get(key, 0, 1000, buf.data(), 200), 200);
+  EXPECT_EQ(memcmp(buf.data(), data.data() + 1000, 200), 0);
+  // the last chunk ends the file
+  EXPECT_EQ(cache.get(key, 1, 50, buf.data(), 200), 50);
+  EXPECT_EQ(memcmp(buf.data(), data.data() + Chunk + 50, 50), 0);
+  EXPECT_EQ(cache.get(key, 2, 0, buf.data(), 200), -1);
+
+  // changed behind our back
+  EXPECT_TRUE(cache.validate(key, fileStat(data.size(), 6)));
+  EXPECT_EQ(cache.get(key, 0, 0, buf.data(), 200), -1);
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST_F(DiskCacheTest, DropDuringFillIsNotKept) {
+  DiskCache cache(cacheDir(), 16 << 20);
+  auto data = pattern(Chunk, 2);
+  ASSERT_TRUE(cache.validate(key, fileStat(4 * Chunk, 5)));
+
+  uint64_t generation = cache.generation(key);
+  cache.drop(key, 3, 3);
+  cache.put(key, 0, data.data(), Chunk, generation);
+  std::vector<unsigned char> buf(10);
+  EXPECT_EQ(cache.get(key, 0, 0, buf.data(), 10), -1);
+
+  cache.put(key, 0, data.data(), Chunk, cache.generation(key));
+  cache.put(key, 1, data.data(), Chunk, cache.generation(key));
+  cache.drop(key, 1, 5);
+  EXPECT_EQ(cache.get(key, 0, 0, buf.data(), 10), 10);
+  EXPECT_EQ(cache.get(key, 1, 0, buf.data(), 10), -1);
+}
+
+TEST_F(DiskCacheTest, UnsettledFileNotCached) {
+  DiskCache cache(cacheDir(), 16 << 20);
+  struct stat st = fileStat(Chunk, 0);
+  st.st_mtime = st.st_ctime = time(nullptr) + 1;
+  EXPECT_FALSE(cache.validate(key, st));
+  auto data = pattern(Chunk, 3);
+  cache.put(key, 0, data.data(), Chunk, cache.generation(key));
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST_F(DiskCacheTest, LeastRecentlyUsedEvicted) {
+  DiskCache cache(cacheDir(), 2 * Chunk);
+  auto data = pattern(Chunk, 4);
+  ASSERT_TRUE(cache.validate(key, fileStat(4 * Chunk, 5)));
+  std::vector<unsigned char> buf(10);
+  cache.put(key, 0, data.data(), Chunk, cache.generation(key));
+  cache.put(key, 1, data.data(), Chunk, cache.generation(key));
+  EXPECT_EQ(cache.get(key, 0, 0, buf.data(), 10), 10);
+  cache.put(key, 2, data.data(), Chunk, cache.generation(key));
+
+  EXPECT_EQ(cache.size(), 2 * Chunk);
+  EXPECT_EQ(cache.get(key, 0, 0, buf.data(), 10), 10);
+  EXPECT_EQ(cache.get(key, 1, 0, buf.data(), 10), -1);
+  EXPECT_EQ(cache.get(key, 2, 0, buf.data(), 10), 10);
+}
+
+TEST_F(DiskCacheTest, SharedWithinProcess) {
+  auto cache = DiskCache::open(cacheDir(), 16 << 20);
+  ASSERT_TRUE(cache != nullptr);
+  EXPECT_EQ(DiskCache::open(cacheDir().substr(0, cacheDir().size() - 1),
+                            16 << 20),
+            cache);
+}
+
+TEST_F(DiskCacheTest, CachedFileIO) {
+  std::string name = rootDir + "file";
+  auto data = pattern(3 * Chunk - 50, 5);
+  {
+    RawFileIO raw(name);
+    ASSERT_GE(raw.create(0600), 0);
+    IORequest req;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(raw.write(req), (ssize_t)data.size());
+  }
+
+  auto cache = DiskCache::open(cacheDir(), 16 << 20);
+  ASSERT_TRUE(cache != nullptr);
+  auto read = [&](off_t offset, size_t len) {
+    CachedFileIO io(std::make_shared<RawFileIO>(name), cache);
+    EXPECT_GE(io.open(O_RDONLY), 0);
+    std::vector<unsigned char> buf(len);
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = len;
+    buf.resize(std::max(io.read(req), (ssize_t)0));
+    return buf;
+  };
+
+  auto got = read(Chunk - 100, 200);
+  EXPECT_EQ(got, std::vector<unsigned char>(data.begin() + Chunk - 100,
+                                            data.begin() + Chunk + 100));
+  EXPECT_EQ(cache->size(), 2 * Chunk);
+  // served from the cache, and short at the end of the file
+  got = read(data.size() - 10, 100);
+  EXPECT_EQ(got, std::vector<unsigned char>(data.end() - 10, data.end()));
+  EXPECT_EQ(cache->size(), 3 * Chunk - 50);
+
+  {
+    CachedFileIO io(std::make_shared<RawFileIO>(name), cache);
+    ASSERT_GE(io.open(O_RDWR), 0);
+    auto update = pattern(10, 9);
+    IORequest req;
+    req.offset = Chunk + 5;
+    req.data = update.data();
+    req.dataLen = update.size();
+    ASSERT_EQ(io.write(req), 10);
+    std::copy(update.begin(), update.end(), data.begin() + Chunk + 5);
+    EXPECT_EQ(cache->size(), 2 * Chunk - 50);
+
+    // past the end: the chunk which ended the file is dropped
+    std::vector<unsigned char> tail(10, 1);
+    req.offset = 4 * Chunk;
+    req.data = tail.data();
+    ASSERT_EQ(io.write(req), 10);
+    EXPECT_EQ(cache->size(), Chunk);
+    data.resize(4 * Chunk, 0);
+    data.insert(data.end(), tail.begin(), tail.end());
+  }
+
+  got = read(0, data.size() + 10);
+  EXPECT_EQ(got, data);
+  EXPECT_EQ(cache->size(), 4 * Chunk + 10);
+}
+
+}  // namespace
@@ -0,0 +1,103 @@
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "encfs/EntryTimeouts.h"
+
+using namespace encfs;
+
+namespace {
+
+const uint64_t Sec = 1000000000;
+const uint64_t Now = 1700000000 * Sec;
+
+template <typename T>
+void put(std::vector<char> *buf, size_t offset, T v) {
+  memcpy(buf->data() + offset, &v, sizeof(v));
+}
+
+template <typename T>
+T get(const std::vector<char> &buf, size_t offset) {
+  T v;
+  memcpy(&v, buf.data() + offset, sizeof(v));
+  return v;
+}
+
+// a fuse_attr at offset, with the given times
+void putAttr(std::vector<char> *buf, size_t offset, uint64_t mtime,
+             uint64_t ctime) {
+  put<uint64_t>(buf, offset + 32, mtime / Sec);
+  put<uint64_t>(buf, offset + 40, ctime / Sec);
+  put<uint32_t>(buf, offset + 52, (uint32_t)(mtime % Sec));
+  put<uint32_t>(buf, offset + 56, (uint32_t)(ctime % Sec));
+}
+
+// fuse_entry_out, with the mount's timeouts of one second
+std::vector<char> entryOut(uint64_t nodeid, uint64_t mtime, uint64_t ctime) {
+  std::vector<char> buf(128);
+  put<uint64_t>(&buf, 0, nodeid);
+  put<uint64_t>(&buf, 16, 1);
+  put<uint64_t>(&buf, 24, 1);
+  putAttr(&buf, 40, mtime, ctime);
+  return buf;
+}
+
+TEST(EntryTimeoutsTest, TenthOfAge) {
+  EntryTimeouts timeouts(600);
+  // changed just now: the mount's timeout
+  EXPECT_EQ(timeouts.timeout(Now, Now, Sec), Sec);
+  EXPECT_EQ(timeouts.timeout(Now + Sec, Now, Sec), Sec);
+  EXPECT_EQ(timeouts.timeout(Now - 5 * Sec, Now, 0), Sec / 2);
+  EXPECT_EQ(timeouts.timeout(Now - 100 * Sec, Now, Sec), 10 * Sec);
+  // up to the maximum
+  EXPECT_EQ(timeouts.timeout(Now - 100000 * Sec, Now, Sec), 600 * Sec);
+}
+
+TEST(EntryTimeoutsTest, Opcodes) {
+  for (uint32_t op : {1u, 6u, 8u, 9u, 13u, 35u}) {
+    EXPECT_TRUE(EntryTimeouts::answersEntry(op)) << op;
+    EXPECT_FALSE(EntryTimeouts::answersAttr(op)) << op;
+  }
+  EXPECT_TRUE(EntryTimeouts::answersAttr(3));
+  EXPECT_TRUE(EntryTimeouts::answersAttr(4));
+  // read, readdir
+  EXPECT_FALSE(EntryTimeouts::answersEntry(15));
+  EXPECT_FALSE(EntryTimeouts::answersAttr(28));
+}
+
+TEST(EntryTimeoutsTest, AdjustsAnswers) {
+  EntryTimeouts timeouts(600);
+
+  // a lookup of a file changed 25s ago, by its change time
+  std::vector<char> entry = entryOut(7, Now - 3600 * Sec, Now - 25 * Sec);
+  timeouts.adjust(1, entry.data(), entry.size(), Now);
+  EXPECT_EQ(get<uint64_t>(entry, 16), 2u);
+  EXPECT_EQ(get<uint32_t>(entry, 32), Sec / 2);
+  EXPECT_EQ(get<uint64_t>(entry, 24), 2u);
+  EXPECT_EQ(get<uint32_t>(entry, 36), Sec / 2);
+
+  // missing names and short answers are left alone
+  std::vector<char> missing = entryOut(0, 0, 0);
+  timeouts.adjust(1, missing.data(), missing.size(), Now);
+  EXPECT_EQ(get<uint64_t>(missing, 16), 1u);
+  std::vector<char> compat = entryOut(7, 0, 0);
+  timeouts.adjust(1, compat.data(), 60, Now);
+  EXPECT_EQ(get<uint64_t>(compat, 16), 1u);
+
+  // a getattr of a directory untouched for a day
+  std::vector<char> attr(104);
+  put<uint64_t>(&attr, 0, 1);
+  putAttr(&attr, 16, Now - 86400 * Sec, Now - 86400 * Sec);
+  timeouts.adjust(3, attr.data(), attr.size(), Now);
+  EXPECT_EQ(get<uint64_t>(attr, 0), 600u);
+  EXPECT_EQ(get<uint32_t>(attr, 8), 0u);
+
+  // other answers aren't touched
+  std::vector<char> other = attr;
+  timeouts.adjust(15, other.data(), other.size(), Now);
+  EXPECT_EQ(other, attr);
+}
+
+}  // namespace
@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/FairScheduler.h"
+
+using namespace encfs;
+
+namespace {
+
+void waitFor(const FairScheduler &scheduler, size_t waiting) {
+  while (scheduler.waiting() < waiting) {
+    usleep(1000);
+  }
+}
+
+// Queues one request of each uid, in order, behind a held slot, then lets
+// them through and returns the order in which they got their slot.
+std::string admissionOrder(FairScheduler *scheduler,
+                           const std::vector<uid_t> &uids) {
+  std::mutex mutex;
+  std::string order;
+  std::vector<std::thread> threads;
+
+  scheduler->acquire(99, FairScheduler::MinCost);
+  for (size_t i = 0; i < uids.size(); ++i) {
+    uid_t uid = uids[i];
+    threads.emplace_back([&, uid]() {
+      FairScheduler::Slot slot(scheduler, uid, FairScheduler::MinCost);
+      std::lock_guard<std::mutex> lock(mutex);
+      order += (char)('A' + uid);
+    });
+    waitFor(*scheduler, i + 1);
+  }
+  scheduler->release();
+
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  return order;
+}
+
+TEST(FairSchedulerTest, SlotsBoundRequests) {
+  FairScheduler scheduler(2, FairScheduler::Weights());
+  scheduler.acquire(1, 100);
+  scheduler.acquire(1, 100);
+  EXPECT_EQ(scheduler.running(), 2);
+
+  std::thread third([&]() {
+    FairScheduler::Slot slot(&scheduler, 2, 100);
+  });
+  waitFor(scheduler, 1);
+  EXPECT_EQ(scheduler.running(), 2);
+
+  scheduler.release();
+  third.join();
+  EXPECT_EQ(scheduler.waiting(), 0u);
+  EXPECT_EQ(scheduler.running(), 1);
+  scheduler.release();
+  EXPECT_EQ(scheduler.running(), 0);
+
+  // a null scheduler lets everything through
+  FairScheduler::Slot slot(nullptr, 1, 100);
+}
+
+TEST(FairSchedulerTest, UsersTakeTurns) {
+  FairScheduler scheduler(1, FairScheduler::Weights());
+  // A queued four requests before B arrived, B still goes second
+  EXPECT_EQ(admissionOrder(&scheduler, {0, 0, 0, 0, 1, 1}), "ABABAA");
+}
+
+TEST(FairSchedulerTest, SharesFollowWeights) {
+  FairScheduler::Weights weights;
+  weights[0] = 2;
+  FairScheduler scheduler(1, weights);
+  EXPECT_EQ(admissionOrder(&scheduler, {0, 0, 0, 0, 1, 1}), "ABAABA");
+}
+
+}  // namespace
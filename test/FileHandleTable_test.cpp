@@ -0,0 +1,108 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileHandleTable.h"
+#include "encfs/FileNode.h"
+
+using namespace encfs;
+
+namespace {
+
+std::shared_ptr<FileNode> newNode() {
+  static FSConfigPtr cfg;
+  if (!cfg) {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->opts.reset(new EncFS_Opts);
+  }
+  return std::make_shared<FileNode>(nullptr, cfg, "/plain", "/nonexistent", 0);
+}
+
+TEST(FileHandleTableTest, InsertLookupErase) {
+  FileHandleTable table;
+  std::vector<std::shared_ptr<FileNode>> nodes;
+  std::vector<uint64_t> handles;
+  std::set<uint64_t> unique;
+  for (int i = 0; i < 3000; ++i) {
+    nodes.push_back(newNode());
+    handles.push_back(table.insert(nodes.back()));
+    EXPECT_NE(handles.back(), 0u);
+    unique.insert(handles.back());
+  }
+  EXPECT_EQ(unique.size(), handles.size());
+  EXPECT_EQ(table.size(), handles.size());
+
+  for (size_t i = 0; i < handles.size(); ++i) {
+    EXPECT_EQ(table.lookup(handles[i]), nodes[i]);
+    EXPECT_EQ(table.borrow(handles[i]), nodes[i].get());
+  }
+  EXPECT_EQ(nodes[0].use_count(), 2);
+  EXPECT_EQ(table.lookup(0), nullptr);
+  EXPECT_EQ(table.lookup(~0ULL), nullptr);
+  EXPECT_EQ(table.borrow(0), nullptr);
+
+  for (size_t i = 0; i < handles.size(); i += 2) {
+    table.erase(handles[i]);
+    EXPECT_EQ(table.lookup(handles[i]), nullptr);
+    EXPECT_EQ(table.borrow(handles[i]), nullptr);
+    EXPECT_EQ(nodes[i].use_count(), 1);
+  }
+  // erasing twice is harmless
+  table.erase(handles[0]);
+  EXPECT_EQ(table.size(), handles.size() / 2);
+
+  // reused slots get new handles
+  for (size_t i = 0; i < handles.size(); i += 2) {
+    uint64_t fh = table.insert(nodes[i]);
+    EXPECT_EQ(unique.count(fh), 0u);
+    EXPECT_EQ(table.lookup(fh), nodes[i]);
+    EXPECT_EQ(table.lookup(handles[i]), nullptr);
+  }
+  for (size_t i = 1; i < handles.size(); i += 2) {
+    EXPECT_EQ(table.lookup(handles[i]), nodes[i]);
+  }
+}
+
+TEST(FileHandleTableTest, ConcurrentUse) {
+  FileHandleTable table;
+  const int Threads = 4;
+  std::vector<std::shared_ptr<FileNode>> nodes;
+  std::vector<std::thread> threads;
+  std::vector<int> failures(Threads, 0);
+  for (int t = 0; t < Threads; ++t) {
+    nodes.push_back(newNode());
+  }
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      auto node = nodes[t];
+      for (int i = 0; i < 2000; ++i) {
+        uint64_t fh = table.insert(node);
+        if (table.lookup(fh) != node) {
+          ++failures[t];
+        }
+        table.erase(fh);
+        if (table.lookup(fh) != nullptr) {
+          ++failures[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < Threads; ++t) {
+    EXPECT_EQ(failures[t], 0) << "thread " << t;
+  }
+  EXPECT_EQ(table.size(), 0u);
+}
+
+}  // namespace
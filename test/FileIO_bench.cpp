@@ -0,0 +1,273 @@
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherFileIO.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileIO.h"
+#include "encfs/FileUtils.h"
+#include "encfs/MACFileIO.h"
+#include "encfs/MemFileIO.h"
+#include "encfs/RawFileIO.h"
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+
+namespace {
+
+const int FSBlockSize = 1024;
+const size_t FileSize = 16 << 20;
+
+/*
+    A RawFileIO -> CipherFileIO [-> MACFileIO] stack over a file on tmpfs
+    (if /dev/shm is there), so that the numbers are for the coding and not
+    the disk.  Shared by the threads of a benchmark, as the stack of a
+    FileNode is by the FUSE threads.
+*/
+struct Stack {
+  FSConfigPtr cfg;
+  std::string name;
+  std::shared_ptr<FileIO> io;
+
+  explicit Stack(int macBytes) : cfg(new FSConfig) {
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = FSBlockSize;
+    cfg->config->uniqueIV = true;
+    cfg->config->blockMACBytes = macBytes;
+    cfg->opts.reset(new EncFS_Opts);
+    cfg->workers = std::make_shared<WorkerPool>(4, 64);
+
+    name = access("/dev/shm", W_OK) == 0 ? "/dev/shm/encfsbenchXXXXXX"
+                                          : "/tmp/encfsbenchXXXXXX";
+    int fd = mkstemp(&name[0]);
+    if (fd >= 0) {
+      close(fd);
+    }
+
+    io.reset(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    if (macBytes != 0) {
+      io.reset(new MACFileIO(io, cfg));
+    }
+    io->open(O_RDWR);
+
+    std::vector<unsigned char> buf(1 << 20, 0x5a);
+    IORequest req;
+    req.data = buf.data();
+    req.dataLen = buf.size();
+    for (req.offset = 0; req.offset < (off_t)FileSize;
+         req.offset += buf.size()) {
+      io->write(req);
+    }
+  }
+
+  ~Stack() {
+    io.reset();
+    unlink(name.c_str());
+  }
+};
+
+Stack *shared = nullptr;
+
+// (request size, offset within a block, MAC bytes)
+void Requests(benchmark::internal::Benchmark *b) {
+  for (int mac : {0, 8}) {
+    for (int size : {512, 4096, 65536, 1 << 20}) {
+      for (int misalign : {0, 100}) {
+        b->Args({size, misalign, mac});
+      }
+    }
+  }
+  b->ArgNames({"size", "offset", "mac"});
+  b->ThreadRange(1, 8)->UseRealTime();
+}
+
+// Each thread walks through its own part of the file.
+void run(benchmark::State &state, bool write) {
+  if (state.thread_index == 0) {
+    shared = new Stack(state.range(2));
+  }
+  size_t size = state.range(0);
+  off_t misalign = state.range(1);
+  size_t region = FileSize / state.threads;
+  size_t steps = std::max<size_t>(1, (region - size - misalign) / size);
+  std::vector<unsigned char> buf(size, 0xa5);
+
+  IORequest req;
+  req.data = buf.data();
+  req.dataLen = size;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    req.offset = state.thread_index * region + (i++ % steps) * size + misalign;
+    ssize_t res = write ? shared->io->write(req) : shared->io->read(req);
+    if (res != (ssize_t)size) {
+      state.SkipWithError("short read or write");
+      break;
+    }
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * size);
+
+  if (state.thread_index == 0) {
+    delete shared;
+    shared = nullptr;
+  }
+}
+
+/*
+    The layers alone, over a MemFileIO: 0 is the MemFileIO by itself, 1 adds
+    CipherFileIO and 2 MACFileIO, so the cost of each layer is the
+    difference to the one below, without the kernel or the page cache in the
+    numbers.
+*/
+void layers(benchmark::State &state, bool write) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->config->blockMACBytes = 8;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::shared_ptr<FileIO> io(new MemFileIO("bench"));
+  if (state.range(2) > 0) {
+    io.reset(new CipherFileIO(io, cfg));
+  }
+  if (state.range(2) > 1) {
+    io.reset(new MACFileIO(io, cfg));
+  }
+  io->open(O_RDWR);
+
+  size_t size = state.range(0);
+  off_t misalign = state.range(1);
+  std::vector<unsigned char> buf(1 << 20, 0x5a);
+  IORequest req;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  for (req.offset = 0; req.offset < (off_t)FileSize;
+       req.offset += buf.size()) {
+    io->write(req);
+  }
+
+  size_t steps = std::max<size_t>(1, (FileSize - size - misalign) / size);
+  req.dataLen = size;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    req.offset = (i++ % steps) * size + misalign;
+    ssize_t res = write ? io->write(req) : io->read(req);
+    if (res != (ssize_t)size) {
+      state.SkipWithError("short read or write");
+      break;
+    }
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * size);
+}
+
+// (request size, offset within a block, layers)
+void LayerRequests(benchmark::internal::Benchmark *b) {
+  for (int layers : {0, 1, 2}) {
+    for (int size : {512, 4096, 65536}) {
+      for (int misalign : {0, 100}) {
+        b->Args({size, misalign, layers});
+      }
+    }
+  }
+  b->ArgNames({"size", "offset", "layers"});
+}
+
+/*
+    Reverse mode: a CipherFileIO over a plaintext file on tmpfs, encrypting
+    what it reads.  With uniqueIV the ciphertext starts with the file
+    header, generated from the inode, so reads at offset 0 splice it in
+    front of the first block and every other read is shifted by its 8
+    bytes against the plaintext blocks.
+*/
+void reverse(benchmark::State &state) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = state.range(2) != 0;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->reverseEncryption = true;
+
+  std::string name = access("/dev/shm", W_OK) == 0
+                         ? "/dev/shm/encfsbenchXXXXXX"
+                         : "/tmp/encfsbenchXXXXXX";
+  int fd = mkstemp(&name[0]);
+  if (fd < 0) {
+    state.SkipWithError("unable to create the plaintext");
+    return;
+  }
+  std::vector<unsigned char> buf(1 << 20, 0x5a);
+  for (size_t done = 0; done < FileSize; done += buf.size()) {
+    if (::write(fd, buf.data(), buf.size()) != (ssize_t)buf.size()) {
+      break;
+    }
+  }
+  close(fd);
+
+  std::shared_ptr<FileIO> io(new RawFileIO(name));
+  io.reset(new CipherFileIO(io, cfg));
+  io->open(O_RDONLY);
+  io->setIV(1234);
+
+  size_t size = state.range(0);
+  off_t offset = state.range(1);
+  // offset 0 stays at the start of the file, with the header
+  size_t steps = offset == 0 ? 1 : (FileSize - size - offset) / size;
+  IORequest req;
+  req.data = buf.data();
+  req.dataLen = size;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    req.offset = (i++ % steps) * size + offset;
+    if (io->read(req) != (ssize_t)size) {
+      state.SkipWithError("short read");
+      break;
+    }
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * size);
+
+  io.reset();
+  unlink(name.c_str());
+}
+
+// (request size, offset, uniqueIV); 8 is the block size past the header
+void ReverseRequests(benchmark::internal::Benchmark *b) {
+  for (int uniqueIV : {0, 1}) {
+    for (int size : {512, 4096, 65536, 1 << 20}) {
+      for (int offset : {0, 8, 100}) {
+        b->Args({size, offset, uniqueIV});
+      }
+    }
+  }
+  b->ArgNames({"size", "offset", "uniqueIV"});
+}
+
+}  // namespace
+
+static void BM_LayerRead(benchmark::State &state) { layers(state, false); }
+BENCHMARK(BM_LayerRead)->Apply(LayerRequests);
+
+static void BM_LayerWrite(benchmark::State &state) { layers(state, true); }
+BENCHMARK(BM_LayerWrite)->Apply(LayerRequests);
+
+static void BM_StackRead(benchmark::State &state) { run(state, false); }
+BENCHMARK(BM_StackRead)->Apply(Requests);
+
+static void BM_StackWrite(benchmark::State &state) { run(state, true); }
+BENCHMARK(BM_StackWrite)->Apply(Requests);
+
+static void BM_ReverseRead(benchmark::State &state) { reverse(state); }
+BENCHMARK(BM_ReverseRead)->Apply(ReverseRequests);
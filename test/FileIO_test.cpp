@@ -0,0 +1,1708 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "encfs/BlockCache.h"
+#include "encfs/Cipher.h"
+#include "encfs/CipherFileIO.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileIO.h"
+#include "encfs/FileUtils.h"
+#include "encfs/MACFileIO.h"
+#include "encfs/MemFileIO.h"
+#include "encfs/RawFileIO.h"
+#include "encfs/Stats.h"
+#include "encfs/UringFileIO.h"
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+using namespace testing;
+
+namespace {
+
+const int FSBlockSize = 1024;
+
+// backing file access
+enum Backend { Raw, Uring, Direct, Mem };
+
+// (uniqueIV, blockMACBytes, blockCache, backend, cipher)
+using FileIOParam = std::tuple<bool, int, bool, int, const char *>;
+
+class FileIOTest : public TestWithParam<FileIOParam> {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New(std::get<4>(GetParam()), 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = FSBlockSize;
+    cfg->config->uniqueIV = std::get<0>(GetParam());
+    cfg->config->blockMACBytes = std::get<1>(GetParam());
+    cfg->opts.reset(new EncFS_Opts);
+    if (std::get<2>(GetParam())) {
+      cfg->blockCache = std::make_shared<BlockCache>(64 * FSBlockSize);
+    }
+    cfg->workers = std::make_shared<WorkerPool>(3, 16);
+    cfg->uring = std::get<3>(GetParam()) == Uring && UringFileIO::supported();
+    cfg->opts->directIO = std::get<3>(GetParam()) == Direct;
+
+    name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    memContents = std::make_shared<MemFileIO::Contents>();
+
+    io = newStack();
+    ASSERT_GE(io->open(O_RDWR), 0);
+  }
+
+  void TearDown() override {
+    io.reset();
+    unlink(name.c_str());
+  }
+
+  std::shared_ptr<FileIO> newStack() {
+    std::shared_ptr<FileIO> stack;
+    if (std::get<3>(GetParam()) == Mem) {
+      stack.reset(new MemFileIO(name, memContents));
+    } else if (cfg->uring) {
+      stack.reset(new UringFileIO(name));
+    } else {
+      stack.reset(new RawFileIO(name, cfg->opts->directIO));
+    }
+    stack.reset(new CipherFileIO(stack, cfg));
+    if (cfg->config->blockMACBytes != 0) {
+      stack.reset(new MACFileIO(stack, cfg));
+    }
+    return stack;
+  }
+
+  // flip a bit of the lower file, behind the stack's back
+  void corrupt(off_t pos) {
+    if (std::get<3>(GetParam()) == Mem) {
+      MemFileIO lower(name, memContents);
+      ASSERT_EQ(lower.open(O_RDWR), 0);
+      unsigned char c;
+      IORequest req;
+      req.offset = pos;
+      req.data = &c;
+      req.dataLen = 1;
+      ASSERT_EQ(lower.read(req), 1);
+      c ^= 0x10;
+      ASSERT_EQ(lower.write(req), 1);
+      return;
+    }
+    int fd = ::open(name.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    unsigned char c;
+    ASSERT_EQ(pread(fd, &c, 1, pos), 1);
+    c ^= 0x10;
+    ASSERT_EQ(pwrite(fd, &c, 1, pos), 1);
+    close(fd);
+  }
+
+  // bytes the lower file takes up
+  off_t allocated() {
+    struct stat st;
+    if (std::get<3>(GetParam()) == Mem) {
+      MemFileIO(name, memContents).getAttr(&st);
+    } else if (stat(name.c_str(), &st) != 0) {
+      return -1;
+    }
+    return st.st_blocks * 512;
+  }
+
+  void write(off_t offset, size_t len) {
+    std::vector<unsigned char> buf(len);
+    for (auto &c : buf) {
+      c = rng() & 0xff;
+    }
+    if (expected.size() < offset + len) {
+      expected.resize(offset + len);
+    }
+    std::copy(buf.begin(), buf.end(), expected.begin() + offset);
+
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = len;
+    ASSERT_EQ(io->write(req), (ssize_t)len);
+  }
+
+  void check(const std::shared_ptr<FileIO> &file, off_t offset, size_t len) {
+    std::vector<unsigned char> buf(len);
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = len;
+
+    size_t avail = 0;
+    if ((size_t)offset < expected.size()) {
+      avail = std::min(len, expected.size() - offset);
+    }
+    ASSERT_EQ(file->read(req), (ssize_t)avail)
+        << "offset " << offset << ", len " << len;
+    ASSERT_TRUE(std::equal(buf.begin(), buf.begin() + avail,
+                           expected.begin() + offset))
+        << "offset " << offset << ", len " << len;
+  }
+
+  void checkAll(const std::shared_ptr<FileIO> &file) {
+    ASSERT_EQ(file->getSize(), (off_t)expected.size());
+    const size_t sizes[] = {1, 100, 1024, 1025, 3000, 8192, 20000, 70000};
+    for (size_t len : sizes) {
+      for (off_t offset = 0; offset < (off_t)expected.size() + 1024;
+           offset += 937) {
+        check(file, offset, len);
+      }
+    }
+  }
+
+  FSConfigPtr cfg;
+  std::string name;
+  std::shared_ptr<MemFileIO::Contents> memContents;  // of the Mem backend
+  std::shared_ptr<FileIO> io;
+  std::vector<unsigned char> expected;
+  std::mt19937 rng;
+};
+
+TEST_P(FileIOTest, SequentialWriteRead) {
+  for (off_t offset = 0; offset < 64 * 1024; offset += 4096) {
+    write(offset, 4096);
+  }
+  write(expected.size(), 123);
+  checkAll(io);
+
+  // and again through a fresh stack, so nothing comes from a cache
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  checkAll(other);
+}
+
+TEST_P(FileIOTest, RandomWriteRead) {
+  std::uniform_int_distribution<int> offsets(0, 40000);
+  std::uniform_int_distribution<int> sizes(1, 9000);
+  for (int i = 0; i < 60; ++i) {
+    write(offsets(rng), sizes(rng));
+  }
+  checkAll(io);
+
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  checkAll(other);
+}
+
+TEST_P(FileIOTest, LargeWrite) {
+  // larger than one write batch, starting in the middle of a block
+  write(100, 3 * 1024 * 1024 + 7);
+  write(expected.size() - 5000, 20000);
+
+  const off_t offsets[] = {0, 100, 1024, 1024 * 1024 - 3, 3 * 1024 * 1024};
+  for (off_t offset : offsets) {
+    check(io, offset, 1024 * 1024 + 17);
+  }
+
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  for (off_t offset : offsets) {
+    check(other, offset, 1024 * 1024 + 17);
+  }
+}
+
+TEST_P(FileIOTest, InPlaceWrite) {
+  write(0, 10000);
+
+  // aligned full blocks, a merged partial block and an extension, all from
+  // scratch buffers which the stack may clobber
+  const std::pair<off_t, size_t> writes[] = {
+      {0, 4096}, {1024, 1024}, {3000, 100}, {9000, 6000}};
+  for (const auto &w : writes) {
+    std::vector<unsigned char> buf(w.second);
+    for (auto &c : buf) {
+      c = rng() & 0xff;
+    }
+    if (expected.size() < w.first + w.second) {
+      expected.resize(w.first + w.second);
+    }
+    std::copy(buf.begin(), buf.end(), expected.begin() + w.first);
+
+    IORequest req;
+    req.offset = w.first;
+    req.data = buf.data();
+    req.dataLen = w.second;
+    ASSERT_EQ(io->writeInPlace(req), (ssize_t)w.second);
+  }
+  checkAll(io);
+
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  checkAll(other);
+}
+
+TEST_P(FileIOTest, Truncate) {
+  write(0, 20000);
+  ASSERT_EQ(io->truncate(5000), 0);
+  expected.resize(5000);
+  checkAll(io);
+
+  ASSERT_EQ(io->truncate(3072), 0);
+  expected.resize(3072);
+  checkAll(io);
+
+  // growing pads with zeros
+  ASSERT_EQ(io->truncate(9000), 0);
+  expected.resize(9000);
+  checkAll(io);
+
+  write(12000, 10);
+  checkAll(io);
+}
+
+// open(O_TRUNC) and rewrite
+TEST_P(FileIOTest, TruncateToZero) {
+  // the header of an empty file is only made by the first write
+  ASSERT_EQ(io->truncate(0), 0);
+  EXPECT_EQ(io->getSize(), 0);
+  write(0, 20000);
+  // another node of the file, as a hard link has, which knows its IV
+  auto linked = newStack();
+  ASSERT_GE(linked->open(O_RDONLY), 0);
+  checkAll(linked);
+
+  ASSERT_EQ(io->truncate(0), 0);
+  expected.clear();
+  checkAll(io);
+  write(0, 5000);
+  checkAll(io);
+
+  linked->invalidate();
+  checkAll(linked);
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  checkAll(other);
+}
+
+TEST_P(FileIOTest, SequentialReadAfterChange) {
+  write(0, 40 * FSBlockSize);
+
+  // small sequential reads get the read ahead going, and must see every
+  // change made in between, even if a prefetch was in flight
+  for (int round = 0; round < 3; ++round) {
+    for (off_t offset = 0; offset < (off_t)expected.size(); offset += 700) {
+      check(io, offset, 700);
+    }
+    write(round * 5000 + 123, 9000);
+    ASSERT_EQ(io->truncate(expected.size() - 3000), 0);
+    expected.resize(expected.size() - 3000);
+  }
+  checkAll(io);
+}
+
+TEST_P(FileIOTest, ConcurrentDisjointBlocks) {
+  // a fresh stack, so the threads also race to read the file header
+  auto shared = newStack();
+  ASSERT_GE(shared->open(O_RDWR), 0);
+
+  // disjoint in the blocks of the top layer, which are smaller with MACs
+  const int Threads = 4;
+  const size_t Region = 8 * shared->blockSize();
+  write(0, Threads * Region);
+
+  std::vector<std::thread> threads;
+  std::vector<int> failures(Threads, 0);
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<unsigned char> buf(Region), out(Region);
+      for (int i = 0; i < 20; ++i) {
+        for (size_t j = 0; j < Region; ++j) {
+          buf[j] = (unsigned char)(t * 31 + i * 7 + j);
+        }
+        // one partial block and a run of full ones
+        IORequest req;
+        req.offset = t * Region + 100;
+        req.data = buf.data();
+        req.dataLen = Region - 100;
+        if (shared->write(req) != (ssize_t)req.dataLen) {
+          ++failures[t];
+        }
+
+        req.data = out.data();
+        if (shared->read(req) != (ssize_t)req.dataLen ||
+            !std::equal(buf.begin(), buf.begin() + req.dataLen, out.begin())) {
+          ++failures[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < Threads; ++t) {
+    EXPECT_EQ(failures[t], 0) << "thread " << t;
+  }
+}
+
+TEST_P(FileIOTest, CorruptBlockInRun) {
+  if (cfg->config->blockMACBytes == 0) {
+    return;
+  }
+  write(0, 300 * FSBlockSize);
+
+  // flip a bit in the middle of a block far into the run
+  corrupt(8 + 200 * FSBlockSize + 500);
+
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  std::vector<unsigned char> buf(expected.size());
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  EXPECT_EQ(other->read(req), -EBADMSG);
+
+  // the blocks before it are still fine
+  check(other, 0, 150 * (FSBlockSize - 8));
+}
+
+TEST_P(FileIOTest, ZeroBlocksAreHoles) {
+  cfg->config->allowHoles = true;
+  io = newStack();
+  ASSERT_GE(io->open(O_RDWR), 0);
+  const off_t bs = io->blockSize();
+
+  // zero runs, written one block and many blocks at a time, among data
+  write(0, 3000);
+  std::vector<unsigned char> zeros(256 * bs);
+  expected.resize(bs * 300);
+  for (off_t offset : {(off_t)8 * bs, (off_t)9 * bs}) {
+    IORequest req;
+    req.offset = offset;
+    req.data = zeros.data();
+    req.dataLen = offset == 8 * bs ? bs : zeros.size();
+    ASSERT_EQ(io->write(req), (ssize_t)req.dataLen);
+  }
+  write(bs * 300, 100);
+
+  // and over existing data
+  write(bs * 300 + 100, 4 * bs);
+  {
+    IORequest req;
+    req.offset = bs * 301;
+    req.data = zeros.data();
+    req.dataLen = 2 * bs;
+    ASSERT_EQ(io->write(req), (ssize_t)req.dataLen);
+    std::fill(expected.begin() + req.offset,
+              expected.begin() + req.offset + req.dataLen, 0);
+  }
+
+  checkAll(io);
+  auto other = newStack();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  checkAll(other);
+
+  // most of the file doesn't take any space
+  off_t used = allocated();
+  ASSERT_GE(used, 0);
+  EXPECT_LT(used, 64 * bs);
+
+  // and the holes are found again, only where the file reads as zeros
+  for (off_t offset = 0; offset <= (off_t)expected.size(); offset += 937) {
+    off_t data = other->nextData(offset);
+    ASSERT_GE(data, offset);
+    ASSERT_LE(data, (off_t)expected.size());
+    ASSERT_TRUE(std::all_of(expected.begin() + offset,
+                            expected.begin() + data,
+                            [](unsigned char c) { return c == 0; }))
+        << "offset " << offset << ", data " << data;
+  }
+  EXPECT_GE(other->nextData(20 * bs), 250 * bs);
+
+  // holes start where whole blocks read as zeros
+  for (off_t offset = 0; offset < (off_t)expected.size(); offset += 937) {
+    off_t hole = other->nextHole(offset);
+    ASSERT_GE(hole, offset);
+    ASSERT_LE(hole, (off_t)expected.size());
+    off_t end = std::min((hole / bs + 1) * bs, (off_t)expected.size());
+    ASSERT_TRUE(std::all_of(expected.begin() + hole, expected.begin() + end,
+                            [](unsigned char c) { return c == 0; }))
+        << "offset " << offset << ", hole " << hole;
+  }
+  EXPECT_EQ(other->nextHole(20 * bs), 20 * bs);
+  EXPECT_LE(other->nextHole(0), 10 * bs);
+  EXPECT_EQ(other->nextHole(bs * 300), (off_t)expected.size());
+}
+
+TEST(CipherFileIO, AlignedBlocks) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->config->uniqueIV = true;
+  cfg->config->alignedBlocks = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  std::vector<unsigned char> data(3000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 13);
+  }
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+
+  {
+    auto io = open();
+    EXPECT_EQ(io->getSize(), 0);
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io->write(req), (ssize_t)data.size());
+  }
+
+  // the blocks start at 4096
+  struct stat st;
+  ASSERT_EQ(stat(name.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, (off_t)(4096 + data.size()));
+
+  auto io = open();
+  EXPECT_EQ(io->getSize(), (off_t)data.size());
+  std::vector<unsigned char> buf(data.size());
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  ASSERT_EQ(io->read(req), (ssize_t)data.size());
+  EXPECT_TRUE(buf == data);
+
+  ASSERT_EQ(io->truncate(100), 0);
+  EXPECT_EQ(io->getSize(), 100);
+  ASSERT_EQ(stat(name.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, 4096 + 100);
+  unlink(name.c_str());
+}
+
+TEST(CipherFileIO, LargeBlockFiles) {
+  for (const char *alg : {"AES", "AES-CTR"}) {
+    FSConfigPtr cfg(new FSConfig);
+    cfg->cipher = Cipher::New(alg, 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->config->uniqueIV = true;
+    cfg->config->largeBlockSize = 65536;
+    cfg->opts.reset(new EncFS_Opts);
+    cfg->blockCache = std::make_shared<BlockCache>(1 << 20);
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 4; ++i) {
+      std::string name = "/tmp/encfstestXXXXXX";
+      int fd = mkstemp(&name[0]);
+      ASSERT_GE(fd, 0);
+      close(fd);
+      names.push_back(name);
+    }
+    auto open = [&](const std::string &name) {
+      std::shared_ptr<FileIO> io(new RawFileIO(name));
+      io.reset(new CipherFileIO(io, cfg));
+      EXPECT_GE(io->open(O_RDWR), 0);
+      return io;
+    };
+    std::vector<unsigned char> data(200000);
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = (unsigned char)(i * 13 + i / 1000);
+    }
+    auto write = [&](const std::shared_ptr<FileIO> &io, off_t offset,
+                     size_t len) {
+      IORequest req;
+      req.offset = offset;
+      req.data = &data[offset];
+      req.dataLen = len;
+      ASSERT_EQ(io->write(req), (ssize_t)len);
+    };
+    auto check = [&](const std::shared_ptr<FileIO> &io, size_t len) {
+      std::vector<unsigned char> buf(len + 10);
+      IORequest req;
+      req.offset = 0;
+      req.data = buf.data();
+      req.dataLen = buf.size();
+      ASSERT_EQ(io->read(req), (ssize_t)len) << alg;
+      buf.resize(len);
+      EXPECT_TRUE(std::equal(buf.begin(), buf.end(), data.begin())) << alg;
+    };
+
+    // a large first write picks large blocks, which the header keeps
+    {
+      auto io = open(names[0]);
+      write(io, 0, 150000);
+      EXPECT_EQ(io->blockSize(), 65536u);
+      write(io, 150000, 50000);
+      check(io, 200000);
+    }
+    {
+      auto io = open(names[0]);
+      EXPECT_EQ(io->blockSize(), 65536u);
+      check(io, 200000);
+      data[70000] ^= 0xff;
+      write(io, 70000, 1);
+      check(io, 200000);
+      // sizes don't depend on the block size
+      struct stat st;
+      ASSERT_EQ(stat(names[0].c_str(), &st), 0);
+      EXPECT_EQ(st.st_size, 200000 + 8);
+    }
+
+    // a small one keeps the volume's block size
+    {
+      auto io = open(names[1]);
+      write(io, 0, 3000);
+      EXPECT_EQ(io->blockSize(), 1024u);
+      write(io, 3000, 100000);
+      EXPECT_EQ(io->blockSize(), 1024u);
+    }
+    {
+      auto io = open(names[1]);
+      EXPECT_EQ(io->blockSize(), 1024u);
+      check(io, 103000);
+    }
+
+    // allocating and truncating an empty file are hints as well
+    {
+      auto io = open(names[2]);
+      io->allocate(0, 100000);
+      EXPECT_EQ(io->blockSize(), 65536u);
+      auto other = open(names[3]);
+      ASSERT_EQ(other->truncate(100000), 0);
+      EXPECT_EQ(other->blockSize(), 65536u);
+      write(other, 0, 1000);
+    }
+    {
+      auto io = open(names[3]);
+      EXPECT_EQ(io->blockSize(), 65536u);
+      std::vector<unsigned char> buf(100000);
+      IORequest req;
+      req.offset = 0;
+      req.data = buf.data();
+      req.dataLen = buf.size();
+      ASSERT_EQ(io->read(req), 100000);
+      EXPECT_TRUE(std::equal(buf.begin(), buf.begin() + 1000, data.begin()));
+      EXPECT_EQ(buf[1000], 0);
+      EXPECT_EQ(buf[99999], 0);
+    }
+
+    for (const std::string &name : names) {
+      unlink(name.c_str());
+    }
+  }
+}
+
+// with a random access cipher, a small write within a file only changes the
+// bytes written
+TEST(CipherFileIO, RandomAccessWrite) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES-CTR", 256);
+  ASSERT_TRUE(cfg->cipher->randomAccess());
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  std::vector<unsigned char> data(3000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 13);
+  }
+  std::shared_ptr<FileIO> io(new RawFileIO(name));
+  io.reset(new CipherFileIO(io, cfg));
+  ASSERT_GE(io->open(O_RDWR), 0);
+  IORequest req;
+  req.offset = 0;
+  req.data = data.data();
+  req.dataLen = data.size();
+  ASSERT_EQ(io->write(req), (ssize_t)data.size());
+
+  auto readRaw = [&]() {
+    std::vector<unsigned char> raw(8 + data.size());
+    int fd = ::open(name.c_str(), O_RDONLY);
+    EXPECT_EQ(pread(fd, raw.data(), raw.size(), 0), (ssize_t)raw.size());
+    close(fd);
+    return raw;
+  };
+  std::vector<unsigned char> before = readRaw();
+
+  unsigned char patch[3] = {1, 2, 3};
+  req.offset = 1500;
+  req.data = patch;
+  req.dataLen = sizeof(patch);
+  ASSERT_EQ(io->write(req), (ssize_t)sizeof(patch));
+  memcpy(&data[1500], patch, sizeof(patch));
+
+  std::vector<unsigned char> after = readRaw();
+  for (size_t i = 0; i < before.size(); ++i) {
+    bool patched = i >= 8 + 1500 && i < 8 + 1500 + sizeof(patch);
+    if (!patched) {
+      EXPECT_EQ(before[i], after[i]) << i;
+    }
+  }
+
+  // read back in parts and whole, through a fresh stack
+  io.reset(new CipherFileIO(std::make_shared<RawFileIO>(name), cfg));
+  ASSERT_GE(io->open(O_RDONLY), 0);
+  std::vector<unsigned char> buf(data.size());
+  req.offset = 1499;
+  req.data = buf.data();
+  req.dataLen = 5;
+  ASSERT_EQ(io->read(req), 5);
+  EXPECT_TRUE(std::equal(buf.begin(), buf.begin() + 5, data.begin() + 1499));
+  req.offset = 0;
+  req.dataLen = buf.size();
+  ASSERT_EQ(io->read(req), (ssize_t)data.size());
+  EXPECT_TRUE(buf == data);
+  unlink(name.c_str());
+}
+
+TEST(MACFileIO, LargeBlocks) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1 << 20;
+  cfg->config->uniqueIV = true;
+  cfg->config->blockMACBytes = 8;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->blockCache = std::make_shared<BlockCache>(4 << 20);
+  cfg->workers = std::make_shared<WorkerPool>(3, 16);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  std::vector<unsigned char> data((5 << 20) / 2);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 13 + i / 4096);
+  }
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    io.reset(new MACFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+
+  {
+    auto io = open();
+    EXPECT_EQ(io->blockSize(), (1u << 20) - 8);
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io->write(req), (ssize_t)data.size());
+
+    // a small change inside a block
+    unsigned char patch[100];
+    memset(patch, 7, sizeof(patch));
+    memcpy(&data[1500000], patch, sizeof(patch));
+    req.offset = 1500000;
+    req.data = patch;
+    req.dataLen = sizeof(patch);
+    ASSERT_EQ(io->write(req), (ssize_t)sizeof(patch));
+  }
+
+  auto io = open();
+  EXPECT_EQ(io->getSize(), (off_t)data.size());
+  std::vector<unsigned char> buf(data.size());
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  ASSERT_EQ(io->read(req), (ssize_t)data.size());
+  EXPECT_TRUE(buf == data);
+
+  // and a small read from the middle of a block
+  req.offset = 1499990;
+  req.dataLen = 200;
+  ASSERT_EQ(io->read(req), 200);
+  EXPECT_EQ(memcmp(buf.data(), &data[1499990], 200), 0);
+  unlink(name.c_str());
+}
+
+// version 3 MACs are checked with SipHash, which version 2 doesn't know
+TEST(MACFileIO, SipHashVersion) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->blockMACBytes = 8;
+  cfg->config->blockMACVersion = 3;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    io.reset(new MACFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+
+  std::vector<unsigned char> data(5 * FSBlockSize);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7 + 1);
+  }
+  IORequest req;
+  req.offset = 0;
+  req.data = data.data();
+  req.dataLen = data.size();
+  ASSERT_EQ(open()->write(req), (ssize_t)data.size());
+
+  std::vector<unsigned char> buf(data.size());
+  req.data = buf.data();
+  EXPECT_EQ(open()->read(req), (ssize_t)data.size());
+  EXPECT_TRUE(buf == data);
+
+  cfg->config->blockMACVersion = 2;
+  EXPECT_EQ(open()->read(req), -EBADMSG);
+  unlink(name.c_str());
+}
+
+// a sealing cipher checks the blocks, whose headers get a new nonce on every
+// write
+TEST(MACFileIO, SealedBlocks) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("ChaCha20", 256);
+  ASSERT_TRUE(cfg->cipher != nullptr);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->config->blockMACBytes = Cipher::SealTagBytes;
+  cfg->config->blockMACRandBytes = Cipher::SealNonceBytes;
+  cfg->config->blockMACVersion = 4;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    io.reset(new MACFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+  auto readRaw = [&]() {
+    struct stat st;
+    EXPECT_EQ(stat(name.c_str(), &st), 0);
+    std::vector<unsigned char> raw(st.st_size);
+    int fd = ::open(name.c_str(), O_RDONLY);
+    EXPECT_EQ(pread(fd, raw.data(), raw.size(), 0), (ssize_t)raw.size());
+    close(fd);
+    return raw;
+  };
+  auto writeRaw = [&](const std::vector<unsigned char> &raw) {
+    int fd = ::open(name.c_str(), O_WRONLY);
+    EXPECT_EQ(pwrite(fd, raw.data(), raw.size(), 0), (ssize_t)raw.size());
+    close(fd);
+  };
+
+  const int userBs = FSBlockSize - Cipher::SealBytes;
+  std::vector<unsigned char> data(5 * userBs + 100);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 11 + 3);
+  }
+  IORequest req;
+  req.offset = 0;
+  req.data = data.data();
+  req.dataLen = data.size();
+  ASSERT_EQ(open()->write(req), (ssize_t)data.size());
+  std::vector<unsigned char> first = readRaw();
+  // the file header, and a header in front of every block
+  EXPECT_EQ(first.size(), 8 + data.size() + 6 * Cipher::SealBytes);
+
+  std::vector<unsigned char> buf(data.size());
+  req.data = buf.data();
+  ASSERT_EQ(open()->read(req), (ssize_t)data.size());
+  EXPECT_TRUE(buf == data);
+
+  // the same data again, with other nonces and so other ciphertext
+  req.data = data.data();
+  ASSERT_EQ(open()->write(req), (ssize_t)data.size());
+  std::vector<unsigned char> second = readRaw();
+  ASSERT_EQ(second.size(), first.size());
+  for (int block = 0; block < 5; ++block) {
+    size_t at = 8 + (size_t)block * FSBlockSize + Cipher::SealBytes;
+    EXPECT_NE(memcmp(&first[at], &second[at], userBs), 0) << block;
+  }
+
+  // a changed byte, or blocks swapped, don't read back
+  req.data = buf.data();
+  std::vector<unsigned char> raw(second);
+  raw[8 + FSBlockSize + 100] ^= 1;
+  writeRaw(raw);
+  EXPECT_EQ(open()->read(req), -EBADMSG);
+
+  raw = second;
+  std::swap_ranges(raw.begin() + 8, raw.begin() + 8 + FSBlockSize,
+                   raw.begin() + 8 + FSBlockSize);
+  writeRaw(raw);
+  EXPECT_EQ(open()->read(req), -EBADMSG);
+
+  // unless forced to
+  cfg->opts->forceDecode = true;
+  EXPECT_EQ(open()->read(req), (ssize_t)data.size());
+  unlink(name.c_str());
+}
+
+// with tag extents, blocks are whole and their MACs are kept in between
+TEST(MACFileIO, TagExtents) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->blockMACBytes = 8;
+  cfg->config->blockMACVersion = 3;
+  cfg->config->blockMACExtents = true;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->blockCache = std::make_shared<BlockCache>(64 * FSBlockSize);
+  cfg->workers = std::make_shared<WorkerPool>(3, 16);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    io.reset(new MACFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+  auto lowerSize = [&]() {
+    struct stat st;
+    EXPECT_EQ(stat(name.c_str(), &st), 0);
+    return (off_t)st.st_size;
+  };
+  // 1024 blocks after 8 blocks of their tags
+  const off_t group = (8 + 1024) * FSBlockSize;
+
+  // three groups and a bit, in large and small writes
+  std::vector<unsigned char> data(3 * 1024 * FSBlockSize + 5000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7 + i / 1000);
+  }
+  {
+    auto io = open();
+    EXPECT_EQ(io->blockSize(), (unsigned)FSBlockSize);
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = 1536 * FSBlockSize + 100;
+    ASSERT_EQ(io->write(req), (ssize_t)req.dataLen);
+    for (off_t offset = req.dataLen; offset < (off_t)data.size();
+         offset += 3000) {
+      req.offset = offset;
+      req.data = &data[offset];
+      req.dataLen = std::min<size_t>(3000, data.size() - offset);
+      ASSERT_EQ(io->write(req), (ssize_t)req.dataLen);
+    }
+  }
+  EXPECT_EQ(lowerSize(), 3 * group + 8 * FSBlockSize + 5000);
+  EXPECT_EQ(MACFileIO::upperSize(cfg, lowerSize()), (off_t)data.size());
+
+  auto io = open();
+  EXPECT_EQ(io->getSize(), (off_t)data.size());
+  std::vector<unsigned char> buf(data.size());
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  ASSERT_EQ(io->read(req), (ssize_t)data.size());
+  EXPECT_TRUE(buf == data);
+  for (off_t offset : {(off_t)0, (off_t)1023 * FSBlockSize + 5,
+                       (off_t)data.size() - 100}) {
+    req.offset = offset;
+    req.dataLen = 3000;
+    ssize_t len = std::min<ssize_t>(3000, data.size() - offset);
+    ASSERT_EQ(io->read(req), len);
+    EXPECT_EQ(memcmp(buf.data(), &data[offset], len), 0);
+  }
+
+  // shrinking keeps the tags of the last group
+  ASSERT_EQ(io->truncate(1024 * FSBlockSize + 10), 0);
+  data.resize(1024 * FSBlockSize + 10);
+  EXPECT_EQ(lowerSize(), group + 8 * FSBlockSize + 10);
+  io = open();
+  req.offset = 0;
+  req.dataLen = buf.size();
+  ASSERT_EQ(io->read(req), (ssize_t)data.size());
+  EXPECT_EQ(memcmp(buf.data(), data.data(), data.size()), 0);
+
+  // a changed data block, or a changed tag, is caught
+  for (off_t pos : {(off_t)8 * FSBlockSize + 3 * FSBlockSize + 10,
+                    (off_t)5 * 8 + 2}) {
+    int fd = ::open(name.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    unsigned char c;
+    ASSERT_EQ(pread(fd, &c, 1, pos), 1);
+    c ^= 0x10;
+    ASSERT_EQ(pwrite(fd, &c, 1, pos), 1);
+    io = open();
+    req.offset = 0;
+    req.dataLen = 8 * FSBlockSize;
+    EXPECT_EQ(io->read(req), -EBADMSG) << "pos " << pos;
+    c ^= 0x10;
+    ASSERT_EQ(pwrite(fd, &c, 1, pos), 1);
+    close(fd);
+  }
+  unlink(name.c_str());
+}
+
+TEST(CipherFileIO, ReverseHeader) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->reverseEncryption = true;
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  std::vector<unsigned char> data(5000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7);
+  }
+  ASSERT_EQ(::write(fd, data.data(), data.size()), (ssize_t)data.size());
+  close(fd);
+
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDONLY), 0);
+    io->setIV(1234);
+    return io;
+  };
+  auto read = [](const std::shared_ptr<FileIO> &io, off_t offset,
+                 size_t len) {
+    std::vector<unsigned char> buf(len);
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = len;
+    EXPECT_EQ(io->read(req), (ssize_t)len);
+    return buf;
+  };
+
+  // the header and the file in one read
+  const size_t size = data.size() + 8;
+  auto whole = read(open(), 0, size);
+
+  // blocks past the header first, then the header again, then blocks
+  auto io = open();
+  auto tail = read(io, 2048 + 8, size - 2048 - 8);
+  EXPECT_TRUE(std::equal(tail.begin(), tail.end(), whole.begin() + 2048 + 8));
+  for (int i = 0; i < 2; ++i) {
+    auto head = read(io, 0, 1024 + 8);
+    EXPECT_TRUE(std::equal(head.begin(), head.end(), whole.begin()));
+  }
+  auto middle = read(io, 1024 + 8, 1024);
+  EXPECT_TRUE(
+      std::equal(middle.begin(), middle.end(), whole.begin() + 1024 + 8));
+  unlink(name.c_str());
+}
+
+TEST(CipherFileIO, ReverseCacheFollowsSource) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->reverseEncryption = true;
+  cfg->blockCache = std::make_shared<BlockCache>(64 * 1024);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  auto source = [&](unsigned char c) {
+    std::vector<unsigned char> data(4000, c);
+    int fd = ::open(name.c_str(), O_WRONLY);
+    ASSERT_EQ(::write(fd, data.data(), data.size()), (ssize_t)data.size());
+    close(fd);
+  };
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDONLY), 0);
+    return io;
+  };
+  auto read = [](const std::shared_ptr<FileIO> &io) {
+    std::vector<unsigned char> buf(4000);
+    IORequest req;
+    req.offset = 0;
+    req.data = buf.data();
+    req.dataLen = 1500;
+    EXPECT_EQ(io->read(req), 1500);
+    return buf;
+  };
+
+  Stats::reset();
+  Stats::setEnabled(true);
+  source('a');
+  auto io = open();
+  auto first = read(io);
+  EXPECT_TRUE(read(io) == first);
+
+  // a changed source is read again
+  source('b');
+  auto second = read(io);
+  EXPECT_FALSE(second == first);
+  EXPECT_TRUE(second == read(open()));
+
+  // and cached once it is older than a second
+  sleep(1);
+  EXPECT_TRUE(read(io) == second);
+  EXPECT_TRUE(read(io) == second);
+  EXPECT_GT(Stats::value(Stats::CacheHits), 0u);
+  Stats::setEnabled(false);
+  unlink(name.c_str());
+}
+
+TEST(UringFileIO, ManyChunks) {
+  if (!UringFileIO::supported()) {
+    return;
+  }
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  // more chunks than a ring has entries, and a short tail
+  std::vector<unsigned char> data(5 * 1024 * 1024 + 123);
+  std::mt19937 rng(7);
+  for (auto &c : data) {
+    c = rng() & 0xff;
+  }
+  {
+    UringFileIO io(name);
+    ASSERT_GE(io.open(O_RDWR), 0);
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    EXPECT_EQ(io.write(req), (ssize_t)data.size());
+    EXPECT_EQ(io.getSize(), (off_t)data.size());
+  }
+
+  UringFileIO io(name);
+  ASSERT_GE(io.open(O_RDONLY), 0);
+  std::vector<unsigned char> buf(data.size() + 4096);
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  ASSERT_EQ(io.read(req), (ssize_t)data.size());
+  buf.resize(data.size());
+  EXPECT_TRUE(buf == data);
+
+  req.offset = data.size() + 10;
+  EXPECT_EQ(io.read(req), 0);
+  unlink(name.c_str());
+}
+
+// reads which complete on the ring's thread, for files without io_uring too
+TEST(UringFileIO, ReadAsync) {
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  std::vector<unsigned char> data(1024 * 1024 + 77);
+  std::mt19937 rng(9);
+  for (auto &c : data) {
+    c = rng() & 0xff;
+  }
+  ASSERT_EQ(::write(fd, data.data(), data.size()), (ssize_t)data.size());
+  close(fd);
+
+  std::vector<std::shared_ptr<FileIO>> files;
+  files.emplace_back(new UringFileIO(name));
+  files.emplace_back(new RawFileIO(name));
+  for (auto &io : files) {
+    ASSERT_GE(io->open(O_RDONLY), 0);
+
+    // several reads in flight at once, the last one past the end
+    const int reads = 8;
+    std::vector<std::vector<unsigned char>> bufs(
+        reads, std::vector<unsigned char>(200 * 1024));
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<ssize_t> results(reads, -1);
+    int finished = 0;
+    for (int i = 0; i < reads; ++i) {
+      IORequest req;
+      req.offset = (off_t)i * 130 * 1024;
+      req.data = bufs[i].data();
+      req.dataLen = bufs[i].size();
+      io->readAsync(req, [&, i](ssize_t res) {
+        std::lock_guard<std::mutex> lock(mutex);
+        results[i] = res;
+        ++finished;
+        cond.notify_all();
+      });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]() { return finished == reads; });
+
+    for (int i = 0; i < reads; ++i) {
+      size_t offset = (size_t)i * 130 * 1024;
+      size_t expected = std::min(bufs[i].size(), data.size() - offset);
+      ASSERT_EQ(results[i], (ssize_t)expected) << i;
+      EXPECT_EQ(memcmp(bufs[i].data(), &data[offset], expected), 0) << i;
+    }
+  }
+  unlink(name.c_str());
+}
+
+TEST(RawFileIO, DirectUnaligned) {
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  RawFileIO io(name, true);
+  ASSERT_GE(io.open(O_RDWR), 0);
+  if (!io.isDirect()) {
+    unlink(name.c_str());
+    return;  // no O_DIRECT on /tmp
+  }
+
+  // threads writing odd pieces which share sectors, each extending the file
+  const int Threads = 4;
+  const size_t Piece = 1000;
+  const int Rounds = 50;
+  std::vector<unsigned char> expected(Threads * Rounds * Piece);
+  std::vector<std::thread> threads;
+  std::vector<int> failures(Threads, 0);
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < Rounds; ++i) {
+        size_t offset = (i * Threads + t) * Piece;
+        unsigned char *data = &expected[offset];
+        memset(data, 'a' + t, Piece);
+        IORequest req;
+        req.offset = offset + 8;
+        req.data = data;
+        req.dataLen = Piece;
+        if (io.write(req) != (ssize_t)Piece) {
+          ++failures[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < Threads; ++t) {
+    EXPECT_EQ(failures[t], 0) << "thread " << t;
+  }
+
+  struct stat st;
+  ASSERT_EQ(stat(name.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, (off_t)(expected.size() + 8));
+
+  std::vector<unsigned char> buf(expected.size() + 100);
+  IORequest req;
+  req.offset = 8;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  ASSERT_EQ(io.read(req), (ssize_t)expected.size());
+  buf.resize(expected.size());
+  EXPECT_TRUE(buf == expected);
+  unlink(name.c_str());
+}
+
+// pages of the first len bytes of the file in the page cache
+static size_t residentPages(int fd, size_t len) {
+  void *map = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  std::vector<unsigned char> vec((len + pageSize - 1) / pageSize);
+  size_t count = 0;
+  if (mincore(map, len, vec.data()) == 0) {
+    for (unsigned char v : vec) {
+      count += v & 1;
+    }
+  }
+  munmap(map, len);
+  return count;
+}
+
+TEST(RawFileIO, DropBehind) {
+  const size_t Size = 16 << 20;
+  const size_t Chunk = 128 << 10;
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  std::vector<unsigned char> data(Size, 'x');
+  ASSERT_EQ(write(fd, data.data(), Size), (ssize_t)Size);
+  ASSERT_EQ(fsync(fd), 0);
+
+  auto stream = [&](bool dropBehind) {
+    RawFileIO io(name);
+    io.setDropBehind(dropBehind);
+    ASSERT_GE(io.open(O_RDONLY), 0);
+    for (size_t offset = 0; offset < Size; offset += Chunk) {
+      IORequest req;
+      req.offset = offset;
+      req.data = data.data();
+      req.dataLen = Chunk;
+      ASSERT_EQ(io.read(req), (ssize_t)Chunk);
+    }
+  };
+
+  stream(false);
+  size_t cached = residentPages(fd, Size / 2);
+  if (cached == 0) {
+    // no page cache to speak of here
+    close(fd);
+    unlink(name.c_str());
+    return;
+  }
+  stream(true);
+  // what the stream passed is gone, but for the last 4 MiB or so
+  EXPECT_EQ(residentPages(fd, Size / 2), 0u);
+  close(fd);
+  unlink(name.c_str());
+}
+
+// writeback is only started, so the writes and what is read back are the
+// same with it, however the file is written
+TEST(RawFileIO, WriteBehind) {
+  const size_t Size = 16 << 20;
+  const size_t Chunk = 128 << 10;
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  std::vector<unsigned char> data(Size);
+  for (size_t i = 0; i < Size; ++i) {
+    data[i] = (unsigned char)(i * 7 + (i >> 12));
+  }
+  RawFileIO io(name);
+  io.setWriteBehind(4 << 20);
+  ASSERT_GE(io.open(O_RDWR), 0);
+  auto write = [&](size_t offset, size_t len) {
+    IORequest req;
+    req.offset = offset;
+    req.data = &data[offset];
+    req.dataLen = len;
+    ASSERT_EQ(io.write(req), (ssize_t)len);
+  };
+  // a stream, a write behind it and one far ahead, which start new ones
+  for (size_t offset = 0; offset < Size / 2; offset += Chunk) {
+    write(offset, Chunk);
+  }
+  write(Chunk, Chunk);
+  write(Size - Chunk, Chunk);
+  for (size_t offset = Size / 2; offset < Size - Chunk; offset += Chunk) {
+    write(offset, Chunk);
+  }
+
+  std::vector<unsigned char> back(Size);
+  IORequest req;
+  req.offset = 0;
+  req.data = back.data();
+  req.dataLen = Size;
+  ASSERT_EQ(io.read(req), (ssize_t)Size);
+  EXPECT_TRUE(back == data);
+  unlink(name.c_str());
+}
+
+// a stream reading whole blocks gets them decoded into its own buffer, and
+// they aren't copied into the last-block buffer
+TEST(CipherFileIO, StreamSkipsLastBlockCopy) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  std::vector<unsigned char> data(8 * FSBlockSize);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7 + i / 1000);
+  }
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+  {
+    auto io = open();
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io->write(req), (ssize_t)data.size());
+  }
+
+  auto io = open();
+  std::vector<unsigned char> buf(FSBlockSize);
+  IORequest req;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  for (int block = 0; block < 8; ++block) {
+    req.offset = block * FSBlockSize;
+    ASSERT_EQ(io->read(req), FSBlockSize);
+    EXPECT_EQ(memcmp(buf.data(), &data[req.offset], FSBlockSize), 0);
+  }
+
+  // the last block is read from below again
+  Stats::reset();
+  Stats::setEnabled(true);
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::value(Stats::CacheMisses), 1u);
+  EXPECT_EQ(Stats::value(Stats::CacheHits), 0u);
+  EXPECT_EQ(memcmp(buf.data(), &data[req.offset], FSBlockSize), 0);
+  Stats::reset();
+
+  // while a random reader keeps it
+  req.offset = 2 * FSBlockSize;
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::setEnabled(true);
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::value(Stats::CacheHits), 1u);
+  Stats::reset();
+  unlink(name.c_str());
+}
+
+TEST(CipherFileIO, FirstReadTakesHeader) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  std::vector<unsigned char> data(3 * FSBlockSize);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 13 + i / 777);
+  }
+  auto open = [&]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+  {
+    auto io = open();
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io->write(req), (ssize_t)data.size());
+  }
+
+  // a whole block, and the start of one
+  for (size_t len : {(size_t)FSBlockSize, (size_t)10}) {
+    auto io = open();
+    std::vector<unsigned char> buf(len);
+    IORequest req;
+    req.offset = 0;
+    req.data = buf.data();
+    req.dataLen = len;
+    Stats::reset();
+    Stats::setEnabled(true);
+    ASSERT_EQ(io->read(req), (ssize_t)len);
+    Stats::setEnabled(false);
+    EXPECT_EQ(memcmp(buf.data(), data.data(), len), 0);
+    // with the header in the same read of the backing file
+    EXPECT_EQ(Stats::value(Stats::HeaderReads), 1u);
+    EXPECT_EQ(Stats::value(Stats::BackingBytesRead), 8u + FSBlockSize);
+    Stats::reset();
+
+    // the file IV taken from it codes the rest
+    req.offset = FSBlockSize;
+    req.data = &data[FSBlockSize];
+    req.dataLen = FSBlockSize;
+    ASSERT_EQ(io->write(req), FSBlockSize);
+  }
+
+  auto io = open();
+  std::vector<unsigned char> buf(data.size());
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  ASSERT_EQ(io->read(req), (ssize_t)data.size());
+  EXPECT_EQ(buf, data);
+  unlink(name.c_str());
+}
+
+// a file of count blocks, and a function opening a stack on it
+static std::function<std::shared_ptr<FileIO>()> blocksFile(
+    const FSConfigPtr &cfg, const std::string &name, int count) {
+  auto open = [cfg, name]() {
+    std::shared_ptr<FileIO> io(new RawFileIO(name));
+    io.reset(new CipherFileIO(io, cfg));
+    EXPECT_GE(io->open(O_RDWR), 0);
+    return io;
+  };
+  std::vector<unsigned char> data(count * FSBlockSize, 0x5a);
+  IORequest req;
+  req.offset = 0;
+  req.data = data.data();
+  req.dataLen = data.size();
+  EXPECT_EQ(open()->write(req), (ssize_t)data.size());
+  return open;
+}
+
+TEST(CipherFileIO, AdviseOnceAndRandom) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  auto io = blocksFile(cfg, name, 4)();
+
+  std::vector<unsigned char> buf(FSBlockSize);
+  IORequest req;
+  req.offset = 2 * FSBlockSize;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+
+  // read once: even a block read at random isn't kept
+  ASSERT_EQ(io->advise(FileIO::Once, 0, 0), 0);
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::reset();
+  Stats::setEnabled(true);
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::value(Stats::CacheMisses), 1u);
+  Stats::reset();
+
+  // random: even a block read again in order is
+  ASSERT_EQ(io->advise(FileIO::Random, 0, 0), 0);
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::setEnabled(true);
+  ASSERT_EQ(io->read(req), FSBlockSize);
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::value(Stats::CacheHits), 1u);
+  Stats::reset();
+
+  // nothing to pin or prefetch into without a block cache
+  EXPECT_EQ(io->advise(FileIO::Pin, 0, 0), -EOPNOTSUPP);
+  EXPECT_EQ(io->advise(FileIO::WillNeed, 0, 0), -EOPNOTSUPP);
+  unlink(name.c_str());
+}
+
+TEST(CipherFileIO, AdviseWillNeedAndPin) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->blockCache = std::make_shared<BlockCache>(64 * FSBlockSize);
+  cfg->workers = std::make_shared<WorkerPool>(3, 16);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  auto io = blocksFile(cfg, name, 16)();
+  EXPECT_EQ(cfg->blockCache->size(), 0u);
+
+  // the whole file, in the background
+  ASSERT_EQ(io->advise(FileIO::WillNeed, 0, 0), 0);
+  for (int i = 0; i < 200 && cfg->blockCache->size() < 16 * FSBlockSize;
+       ++i) {
+    usleep(10 * 1000);
+  }
+  EXPECT_EQ(cfg->blockCache->size(), 16u * FSBlockSize);
+
+  ASSERT_EQ(io->advise(FileIO::Pin, 0, 0), 0);
+  EXPECT_EQ(cfg->blockCache->pinnedSize(), 16u * FSBlockSize);
+  std::vector<unsigned char> buf(16 * FSBlockSize);
+  IORequest req;
+  req.offset = 0;
+  req.data = buf.data();
+  req.dataLen = buf.size();
+  Stats::reset();
+  Stats::setEnabled(true);
+  ASSERT_EQ(io->read(req), (ssize_t)buf.size());
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::value(Stats::CacheMisses), 0u);
+  EXPECT_EQ(buf[0], 0x5a);
+  EXPECT_EQ(buf[buf.size() - 1], 0x5a);
+  Stats::reset();
+
+  // gone with the file
+  io.reset();
+  EXPECT_EQ(cfg->blockCache->pinnedSize(), 0u);
+  EXPECT_EQ(cfg->blockCache->size(), 0u);
+  unlink(name.c_str());
+}
+
+TEST(FileIO, IsZeroBlock) {
+  std::vector<unsigned char> buf(300);
+  for (size_t len = 0; len < 200; ++len) {
+    EXPECT_TRUE(isZeroBlock(buf.data() + 3, len)) << len;
+    for (size_t i = 0; i < len; ++i) {
+      buf[3 + i] = 0x80;
+      EXPECT_FALSE(isZeroBlock(buf.data() + 3, len)) << len << " " << i;
+      buf[3 + i] = 0;
+    }
+  }
+}
+
+TEST(RawFileIO, ReadHole) {
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  // data, a hole, and data again
+  const off_t HoleEnd = 4 * 1024 * 1024;
+  std::vector<unsigned char> data(8192, 'x');
+  RawFileIO io(name);
+  ASSERT_GE(io.open(O_RDWR), 0);
+  for (off_t offset : {(off_t)0, HoleEnd}) {
+    IORequest req;
+    req.offset = offset;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io.write(req), (ssize_t)data.size());
+  }
+
+  std::vector<unsigned char> buf(3 * 8192);
+  for (off_t offset : {(off_t)4096, (off_t)1024 * 1024, HoleEnd - 16384}) {
+    std::fill(buf.begin(), buf.end(), 0xff);
+    IORequest req;
+    req.offset = offset;
+    req.data = buf.data();
+    req.dataLen = buf.size();
+    ASSERT_EQ(io.read(req), (ssize_t)buf.size());
+    for (size_t i = 0; i < buf.size(); ++i) {
+      off_t pos = offset + i;
+      bool isData = pos < (off_t)data.size() ||
+                    (pos >= HoleEnd && pos < HoleEnd + (off_t)data.size());
+      ASSERT_EQ(buf[i], isData ? 'x' : 0) << "at " << pos;
+    }
+  }
+  unlink(name.c_str());
+}
+
+// the buffers land one after the other, with a single pwritev, and direct
+// files take the copying fallback
+TEST(RawFileIO, WriteGather) {
+  for (bool directIO : {false, true}) {
+    std::string name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    std::vector<unsigned char> a(8, 'a'), b(100, 'b'), c(5000, 'c');
+    struct iovec iov[3] = {{a.data(), a.size()},
+                           {b.data(), b.size()},
+                           {c.data(), c.size()}};
+    const size_t len = a.size() + b.size() + c.size();
+
+    RawFileIO io(name, directIO);
+    ASSERT_GE(io.open(O_RDWR), 0);
+    Stats::reset();
+    Stats::setEnabled(true);
+    ASSERT_EQ(io.writeGather(16, iov, 3), (ssize_t)len);
+    Stats::setEnabled(false);
+    if (!directIO) {
+      EXPECT_EQ(Stats::count(Stats::Pwrite), 1u);
+    }
+    Stats::reset();
+    EXPECT_EQ(io.getSize(), (off_t)(16 + len));
+
+    std::vector<unsigned char> buf(len);
+    IORequest req;
+    req.offset = 16;
+    req.data = buf.data();
+    req.dataLen = buf.size();
+    ASSERT_EQ(io.read(req), (ssize_t)len);
+    std::vector<unsigned char> expected(a);
+    expected.insert(expected.end(), b.begin(), b.end());
+    expected.insert(expected.end(), c.begin(), c.end());
+    EXPECT_EQ(buf, expected) << directIO;
+    unlink(name.c_str());
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(FileIO, FileIOTest,
+                        Combine(Bool(), Values(0, 8), Bool(),
+                                Values(Raw, Uring, Direct, Mem),
+                                Values("AES", "AES-CTR")));
+
+}  // namespace
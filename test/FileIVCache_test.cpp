@@ -0,0 +1,62 @@
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <ctime>
+#include <sys/stat.h>
+
+#include "encfs/FileIVCache.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat fileStat(ino_t ino, time_t ctime, long nsec) {
+  struct stat st = {};
+  st.st_ino = ino;
+  st.st_ctim.tv_sec = ctime;
+  st.st_ctim.tv_nsec = nsec;
+  return st;
+}
+
+TEST(FileIVCache, ValidatedByStat) {
+  FileIVCache cache(10);
+  time_t past = time(nullptr) - 10;
+  cache.put(fileStat(7, past, 5), 1234);
+
+  uint64_t iv = 0;
+  ASSERT_TRUE(cache.get(fileStat(7, past, 5), &iv));
+  EXPECT_EQ(iv, 1234u);
+
+  // the header may have been rewritten
+  EXPECT_FALSE(cache.get(fileStat(7, past, 6), &iv));
+  EXPECT_EQ(cache.size(), 0u);
+  cache.put(fileStat(7, past, 5), 1234);
+  struct stat other = fileStat(7, past, 5);
+  other.st_dev = 3;
+  EXPECT_FALSE(cache.get(other, &iv));
+}
+
+TEST(FileIVCache, RejectsRecentlyChanged) {
+  FileIVCache cache(10);
+  time_t now = time(nullptr);
+  cache.put(fileStat(7, now, 0), 1234);
+
+  uint64_t iv = 0;
+  EXPECT_FALSE(cache.get(fileStat(7, now, 0), &iv));
+}
+
+TEST(FileIVCache, Bounded) {
+  FileIVCache cache(2);
+  time_t past = time(nullptr) - 10;
+  for (ino_t ino = 1; ino <= 5; ++ino) {
+    cache.put(fileStat(ino, past, 0), ino);
+  }
+  EXPECT_EQ(cache.size(), 2u);
+
+  uint64_t iv = 0;
+  EXPECT_TRUE(cache.get(fileStat(5, past, 0), &iv));
+  EXPECT_EQ(iv, 5u);
+  EXPECT_FALSE(cache.get(fileStat(1, past, 0), &iv));
+}
+
+}  // namespace
@@ -0,0 +1,109 @@
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileNodePool.h"
+
+using namespace encfs;
+
+namespace {
+
+class FileNodePoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->config->uniqueIV = true;
+    cfg->opts.reset(new EncFS_Opts);
+
+    name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    close(fd);
+  }
+
+  void TearDown() override { unlink(name.c_str()); }
+
+  std::shared_ptr<FileNode> openNode() {
+    auto node = std::make_shared<FileNode>(nullptr, cfg, "/f", name.c_str(), 0);
+    EXPECT_GE(node->open(O_RDWR), 0);
+    return node;
+  }
+
+  void fill(const std::shared_ptr<FileNode> &node, unsigned char c) {
+    std::vector<unsigned char> buf(3000, c);
+    ASSERT_EQ(node->write(0, buf.data(), buf.size()), (ssize_t)buf.size());
+  }
+
+  unsigned char first(const std::shared_ptr<FileNode> &node) {
+    unsigned char c = 0;
+    EXPECT_EQ(node->read(0, &c, 1), 1);
+    return c;
+  }
+
+  FSConfigPtr cfg;
+  std::string name;
+};
+
+TEST_F(FileNodePoolTest, ReusedOnce) {
+  FileNodePool pool(4, 60000);
+  auto node = openNode();
+  fill(node, 'a');
+  pool.put("/f", node);
+  EXPECT_EQ(pool.size(), 1u);
+
+  EXPECT_TRUE(pool.take("/g") == nullptr);
+  EXPECT_EQ(pool.take("/f"), node);
+  EXPECT_TRUE(pool.take("/f") == nullptr);
+  EXPECT_EQ(first(node), 'a');
+}
+
+TEST_F(FileNodePoolTest, ChangedFileIsReadAgain) {
+  FileNodePool pool(4, 60000);
+  auto node = openNode();
+  fill(node, 'a');
+  EXPECT_EQ(first(node), 'a');  // cached
+  pool.put("/f", node);
+
+  // written through another node meanwhile
+  fill(openNode(), 'b');
+
+  auto reused = pool.take("/f");
+  ASSERT_EQ(reused, node);
+  EXPECT_EQ(first(reused), 'b');
+}
+
+TEST_F(FileNodePoolTest, RemovedFileIsNotReused) {
+  FileNodePool pool(4, 60000);
+  pool.put("/f", openNode());
+  unlink(name.c_str());
+  EXPECT_TRUE(pool.take("/f") == nullptr);
+}
+
+TEST_F(FileNodePoolTest, BoundedAndDropped) {
+  FileNodePool pool(2, 60000);
+  pool.put("/a", openNode());
+  pool.put("/d/b", openNode());
+  pool.put("/d/c", openNode());
+  EXPECT_EQ(pool.size(), 2u);
+  EXPECT_TRUE(pool.take("/a") == nullptr);
+
+  pool.drop("/d");
+  EXPECT_EQ(pool.size(), 0u);
+
+  FileNodePool expiring(2, 0);
+  expiring.put("/a", openNode());
+  EXPECT_TRUE(expiring.take("/a") == nullptr);
+}
+
+}  // namespace
@@ -0,0 +1,441 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/Context.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileUtils.h"
+#include "encfs/Stats.h"
+#include "encfs/encfs.h"
+
+using namespace encfs;
+using namespace testing;
+
+namespace {
+
+const int FSBlockSize = 1024;
+
+// (blockMACBytes, writeBackSize)
+class FileNodeTest : public TestWithParam<std::tuple<int, int>> {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = FSBlockSize;
+    cfg->config->uniqueIV = true;
+    cfg->config->blockMACBytes = std::get<0>(GetParam());
+    cfg->opts.reset(new EncFS_Opts);
+    cfg->opts->writeBackSize = std::get<1>(GetParam());
+
+    name = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    node = newNode();
+    ASSERT_GE(node->open(O_RDWR), 0);
+  }
+
+  void TearDown() override {
+    node.reset();
+    unlink(name.c_str());
+  }
+
+  std::unique_ptr<FileNode> newNode() {
+    return std::unique_ptr<FileNode>(
+        new FileNode(nullptr, cfg, "/plain", name.c_str(), 0));
+  }
+
+  void append(size_t len) {
+    std::vector<unsigned char> buf(len);
+    for (auto &c : buf) {
+      c = (unsigned char)(expected.size() * 7 + len);
+      expected.push_back(c);
+    }
+    ASSERT_EQ(node->write(expected.size() - len, buf.data(), len),
+              (ssize_t)len);
+  }
+
+  void check(const std::unique_ptr<FileNode> &file) {
+    ASSERT_EQ(file->getSize(), (off_t)expected.size());
+    std::vector<unsigned char> buf(expected.size() + 100);
+    ASSERT_EQ(file->read(0, buf.data(), buf.size()),
+              (ssize_t)expected.size());
+    buf.resize(expected.size());
+    ASSERT_EQ(buf, expected);
+  }
+
+  FSConfigPtr cfg;
+  std::string name;
+  std::unique_ptr<FileNode> node;
+  std::vector<unsigned char> expected;
+};
+
+TEST_P(FileNodeTest, SmallAppends) {
+  for (int i = 0; i < 300; ++i) {
+    append(1 + (i * 37) % 200);
+  }
+
+  struct stat st;
+  ASSERT_EQ(node->getAttr(&st), 0);
+  EXPECT_EQ(st.st_size, (off_t)expected.size());
+  check(node);
+
+  ASSERT_EQ(node->flush(), 0);
+  auto other = newNode();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  check(other);
+}
+
+TEST_P(FileNodeTest, OverwriteAndTruncate) {
+  for (int i = 0; i < 50; ++i) {
+    append(100);
+  }
+
+  // rewrite inside the buffered range and before it, then cut the file
+  unsigned char data[300];
+  memset(data, 0xaa, sizeof(data));
+  ASSERT_EQ(node->write(4900, data, sizeof(data)), (ssize_t)sizeof(data));
+  memset(&expected[4900], 0xaa, 100);
+  expected.resize(5200, 0xaa);
+  ASSERT_EQ(node->write(10, data, 20), 20);
+  memset(&expected[10], 0xaa, 20);
+  check(node);
+
+  append(50);
+  ASSERT_EQ(node->truncate(3000), 0);
+  expected.resize(3000);
+  check(node);
+
+  // a hole behind the end of the file is filled with zeros
+  append(10);
+  ASSERT_EQ(node->write(5000, data, 1), 1);
+  expected.resize(5000, 0);
+  expected.push_back(0xaa);
+  check(node);
+
+  ASSERT_EQ(node->sync(false), 0);
+  auto other = newNode();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  check(other);
+}
+
+TEST_P(FileNodeTest, CloseFlushOnlyAfterWrites) {
+  // written since the node was made
+  append(10);
+  EXPECT_TRUE(node->closeFlushNeeded());
+  EXPECT_FALSE(node->closeFlushNeeded());
+  ASSERT_EQ(node->truncate(5), 0);
+  EXPECT_TRUE(node->closeFlushNeeded());
+
+  // not where the backing filesystem doesn't need it
+  cfg->closeFlush = false;
+  append(10);
+  EXPECT_FALSE(node->closeFlushNeeded());
+}
+
+TEST_P(FileNodeTest, SyncWhileWriting) {
+  std::atomic<bool> done(false);
+  std::thread syncer([&] {
+    while (!done) {
+      EXPECT_EQ(node->sync(true), 0);
+    }
+  });
+  for (int i = 0; i < 200; ++i) {
+    append(1 + (i * 37) % 200);
+  }
+  done = true;
+  syncer.join();
+
+  ASSERT_EQ(node->sync(false), 0);
+  auto other = newNode();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  check(other);
+}
+
+TEST_P(FileNodeTest, CreateLeavesHeaderToFirstWrite) {
+  std::string created = name + ".new";
+  std::unique_ptr<FileNode> file(
+      new FileNode(nullptr, cfg, "/new", created.c_str(), 0));
+  ASSERT_GE(file->create(S_IFREG | 0640), 0);
+
+  struct stat st;
+  ASSERT_EQ(::stat(created.c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 07777, 0640u);
+  EXPECT_EQ(st.st_size, 0);  // no header before the first write
+  EXPECT_EQ(file->getSize(), 0);
+
+  node = std::move(file);
+  Stats::reset();
+  Stats::setEnabled(true);
+  append(100);
+  ASSERT_EQ(node->flush(), 0);
+  Stats::setEnabled(false);
+  // the header and the first block in one write
+  EXPECT_EQ(Stats::count(Stats::Pwrite), 1u);
+  Stats::reset();
+  for (int i = 1; i < 20; ++i) {
+    append(100);
+  }
+  ASSERT_EQ(node->flush(), 0);
+  auto other = std::unique_ptr<FileNode>(
+      new FileNode(nullptr, cfg, "/new", created.c_str(), 0));
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  check(other);
+
+  // never over an existing file
+  EXPECT_EQ(other->create(S_IFREG | 0640), -EEXIST);
+  unlink(created.c_str());
+}
+
+TEST_P(FileNodeTest, AllocateAndPunch) {
+  cfg->config->allowHoles = true;
+  node = newNode();
+  ASSERT_GE(node->open(O_RDWR), 0);
+  append(5000);
+
+  // extending reads back zeros
+  ASSERT_EQ(node->allocate(0, 3000, 17000), 0);
+  expected.resize(20000, 0);
+  check(node);
+
+  // space past the end, without changing the size
+  struct stat before, after;
+  ASSERT_EQ(::stat(name.c_str(), &before), 0);
+  ASSERT_EQ(node->allocate(FALLOC_FL_KEEP_SIZE, 20000, 100000), 0);
+  ASSERT_EQ(::stat(name.c_str(), &after), 0);
+  EXPECT_EQ(after.st_size, before.st_size);
+  EXPECT_GT(after.st_blocks, before.st_blocks);
+  check(node);
+
+  // partial blocks at either end, whole ones in between
+  ASSERT_EQ(node->allocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 100,
+                           4500),
+            0);
+  memset(&expected[100], 0, 4500);
+  check(node);
+  ASSERT_EQ(node->allocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 19990,
+                           100),
+            0);
+  memset(&expected[19990], 0, 10);
+  check(node);
+
+  // only KEEP_SIZE and PUNCH_HOLE are known
+  EXPECT_EQ(node->allocate(FALLOC_FL_PUNCH_HOLE, 0, 10), -EOPNOTSUPP);
+
+  ASSERT_EQ(node->sync(false), 0);
+  auto other = newNode();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+  check(other);
+}
+
+// lseek of the mount, on an open handle
+TEST_P(FileNodeTest, SeekDataAndHoles) {
+  cfg->config->allowHoles = true;
+  auto file =
+      std::make_shared<FileNode>(nullptr, cfg, "/plain", name.c_str(), 0);
+  ASSERT_GE(file->open(O_RDWR), 0);
+  std::vector<unsigned char> data(3000, 'x');
+  ASSERT_EQ(file->write(0, data.data(), data.size()), 3000);
+  ASSERT_EQ(file->write(100 * FSBlockSize, data.data(), data.size()), 3000);
+  ASSERT_EQ(file->allocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 4000,
+                           90000),
+            0);
+  off_t size = 100 * FSBlockSize + 3000;
+
+  EncFS_Context ctx;
+  ctx.putNode("/plain", file);
+  uint64_t fh = file->fuseFh;
+  EXPECT_EQ(encfs_lseek(&ctx, fh, 0, SEEK_DATA), 0);
+  off_t hole = encfs_lseek(&ctx, fh, 0, SEEK_HOLE);
+  EXPECT_GE(hole, 3000);
+  EXPECT_LE(hole, 6 * FSBlockSize);
+  EXPECT_EQ(encfs_lseek(&ctx, fh, hole + 10, SEEK_HOLE), hole + 10);
+  off_t next = encfs_lseek(&ctx, fh, hole, SEEK_DATA);
+  EXPECT_GE(next, 88 * FSBlockSize);
+  EXPECT_LE(next, 100 * FSBlockSize);
+  EXPECT_EQ(encfs_lseek(&ctx, fh, size - 1, SEEK_HOLE), size);
+
+  EXPECT_EQ(encfs_lseek(&ctx, fh, size, SEEK_DATA), -ENXIO);
+  EXPECT_EQ(encfs_lseek(&ctx, fh, size, SEEK_HOLE), -ENXIO);
+  EXPECT_EQ(encfs_lseek(&ctx, fh, 0, SEEK_SET), -EINVAL);
+  EXPECT_EQ(encfs_lseek(&ctx, fh + 1, 0, SEEK_DATA), -EBADF);
+  ctx.eraseNode("/plain", file);
+}
+
+TEST_P(FileNodeTest, ReadOnlyConcurrentReads) {
+  for (int i = 0; i < 100; ++i) {
+    append(1000);
+  }
+  ASSERT_EQ(node->flush(), 0);
+
+  cfg->opts->readOnly = true;
+  auto other = newNode();
+  ASSERT_GE(other->open(O_RDONLY), 0);
+
+  // the first reads race for the header, then overlapping ranges
+  std::vector<std::thread> threads;
+  std::atomic<int> mismatches(0);
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t] {
+      std::vector<unsigned char> buf(3000);
+      for (int i = 0; i < 50; ++i) {
+        off_t offset = ((t * 50 + i) * 997) % (expected.size() - buf.size());
+        if (other->read(offset, buf.data(), buf.size()) !=
+                (ssize_t)buf.size() ||
+            memcmp(buf.data(), &expected[offset], buf.size()) != 0) {
+          ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+  check(other);
+}
+
+TEST(FileNode, SharedSeesOtherWriters) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->uniqueIV = true;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->opts->sharedTimeout = 1;
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  // another client, and this one
+  FileNode other(nullptr, cfg, "/plain", name.c_str(), 0);
+  FileNode node(nullptr, cfg, "/plain", name.c_str(), 0);
+  ASSERT_GE(other.open(O_RDWR), 0);
+  std::vector<unsigned char> data(5000, 1);
+  ASSERT_EQ(other.write(0, data.data(), data.size()), (ssize_t)data.size());
+  ASSERT_GE(node.open(O_RDONLY), 0);
+  std::vector<unsigned char> buf(10000);
+  ASSERT_EQ(node.read(0, buf.data(), buf.size()), 5000);
+  ASSERT_EQ(node.read(0, buf.data(), 100), 100);
+
+  // changed and appended to by the other client
+  std::vector<unsigned char> more(3000, 2);
+  ASSERT_EQ(other.write(0, more.data(), 100), 100);
+  ASSERT_EQ(other.write(4000, more.data(), more.size()), 3000);
+  ASSERT_EQ(other.sync(false), 0);
+
+  // seen once the window is over
+  usleep(1100 * 1000);
+  ASSERT_EQ(node.read(0, buf.data(), 100), 100);
+  EXPECT_EQ(buf[0], 2);
+  EXPECT_EQ(node.getSize(), 7000);
+  ASSERT_EQ(node.read(0, buf.data(), buf.size()), 7000);
+  EXPECT_EQ(buf[0], 2);
+  EXPECT_EQ(buf[100], 1);
+  EXPECT_EQ(buf[3999], 1);
+  EXPECT_EQ(buf[4000], 2);
+  EXPECT_EQ(buf[6999], 2);
+
+  unlink(name.c_str());
+}
+
+// the lower file system encrypts the data of kernelContent volumes, so the
+// backing file holds what was written and reads can be spliced from it
+TEST(FileNode, KernelContentPassesThrough) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->kernelContent = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  FileNode node(nullptr, cfg, "/plain", name.c_str(), 0);
+  ASSERT_GE(node.open(O_RDWR), 0);
+  std::vector<unsigned char> data(3000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7);
+  }
+  ASSERT_EQ(node.write(0, data.data(), data.size()), (ssize_t)data.size());
+  ASSERT_EQ(node.flush(), 0);
+
+  std::vector<unsigned char> buf(data.size());
+  fd = ::open(name.c_str(), O_RDONLY);
+  ASSERT_EQ(::read(fd, buf.data(), buf.size()), (ssize_t)buf.size());
+  ::close(fd);
+  EXPECT_EQ(buf, data);
+  EXPECT_EQ(node.getSize(), (off_t)data.size());
+
+  off_t dataOffset = -1;
+  EXPECT_GE(node.plainFd(&dataOffset), 0);
+  EXPECT_EQ(dataOffset, 0);
+  unlink(name.c_str());
+}
+
+// plainData volumes without IV headers keep no more than the data either,
+// and the file is read and written as it is, not in blocks
+TEST(FileNode, PlainDataPassesThrough) {
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("Null", 0);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = FSBlockSize;
+  cfg->config->plainData = true;
+  cfg->opts.reset(new EncFS_Opts);
+
+  std::string name = "/tmp/encfstestXXXXXX";
+  int fd = mkstemp(&name[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  FileNode node(nullptr, cfg, "/plain", name.c_str(), 0);
+  ASSERT_GE(node.open(O_RDWR), 0);
+  EXPECT_EQ(node.blockSize(), 1u);
+  std::vector<unsigned char> data(3000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7);
+  }
+  ASSERT_EQ(node.write(0, data.data(), data.size()), (ssize_t)data.size());
+  ASSERT_EQ(node.write(1000, data.data(), 100), 100);
+  memcpy(&data[1000], &data[0], 100);
+  ASSERT_EQ(node.flush(), 0);
+
+  std::vector<unsigned char> buf(data.size());
+  fd = ::open(name.c_str(), O_RDONLY);
+  ASSERT_EQ(::read(fd, buf.data(), buf.size()), (ssize_t)buf.size());
+  ::close(fd);
+  EXPECT_EQ(buf, data);
+  ASSERT_EQ(node.truncate(1500), 0);
+  EXPECT_EQ(node.getSize(), 1500);
+  ASSERT_EQ(node.read(1400, buf.data(), 200), 100);
+  EXPECT_EQ(memcmp(buf.data(), &data[1400], 100), 0);
+  unlink(name.c_str());
+}
+
+INSTANTIATE_TEST_CASE_P(FileNode, FileNodeTest,
+                        Combine(Values(0, 8), Values(0, 4, 64)));
+
+}  // namespace
@@ -0,0 +1,79 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileNode.h"
+#include "encfs/FileReaper.h"
+#include "encfs/FileUtils.h"
+
+using namespace encfs;
+
+namespace {
+
+class FileReaperTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->opts.reset(new EncFS_Opts);
+  }
+
+  std::shared_ptr<FileNode> newNode(const std::string &path) {
+    return std::make_shared<FileNode>(nullptr, cfg, path.c_str(),
+                                      "/nonexistent", 0);
+  }
+
+  FSConfigPtr cfg;
+};
+
+TEST_F(FileReaperTest, WaitForPath) {
+  FileReaper reaper(16);
+  std::vector<std::weak_ptr<FileNode>> nodes;
+  for (int i = 0; i < 10; ++i) {
+    std::string path = "/file" + std::to_string(i % 3);
+    auto node = newNode(path);
+    nodes.push_back(node);
+    ASSERT_TRUE(reaper.put(path, node));
+    EXPECT_EQ(node, nullptr);
+  }
+
+  reaper.wait("/file1");
+  for (int i = 1; i < 10; i += 3) {
+    EXPECT_TRUE(nodes[i].expired());
+  }
+  reaper.wait("/other");
+
+  reaper.drain();
+  EXPECT_EQ(reaper.pending(), 0u);
+  for (auto &node : nodes) {
+    EXPECT_TRUE(node.expired());
+  }
+}
+
+TEST_F(FileReaperTest, FullQueue) {
+  FileReaper reaper(0);
+  auto node = newNode("/a");
+  EXPECT_FALSE(reaper.put("/a", node));
+  EXPECT_NE(node, nullptr);
+  EXPECT_EQ(reaper.pending(), 0u);
+}
+
+TEST_F(FileReaperTest, DestroyedWithQueue) {
+  std::weak_ptr<FileNode> weak;
+  {
+    FileReaper reaper(16);
+    auto node = newNode("/a");
+    weak = node;
+    ASSERT_TRUE(reaper.put("/a", node));
+  }
+  EXPECT_TRUE(weak.expired());
+}
+
+}  // namespace
@@ -0,0 +1,67 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encfs/Fscrypt.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(Fscrypt, MissingDirectory) {
+  EXPECT_FALSE(Fscrypt::supported("/nonexistent/encfs"));
+  unsigned char key[Fscrypt::KeySize] = {0};
+  int res = 0;
+  EXPECT_EQ(Fscrypt::unlock("/nonexistent/encfs/", key, &res), nullptr);
+  EXPECT_LT(res, 0);
+}
+
+// only where /tmp is on a file system with encryption enabled
+TEST(Fscrypt, EncryptsDirectory) {
+  char root[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(root), nullptr);
+  std::string rootDir = std::string(root) + "/";
+  std::string dataDir = rootDir + Fscrypt::DataDir;
+
+  unsigned char key[Fscrypt::KeySize];
+  for (int i = 0; i < Fscrypt::KeySize; ++i) {
+    key[i] = (unsigned char)(i * 13 + 7);
+  }
+  int res = 0;
+  std::shared_ptr<Fscrypt> fscrypt;
+  if (Fscrypt::supported(rootDir)) {
+    fscrypt = Fscrypt::unlock(rootDir, key, &res);
+  }
+  if (fscrypt) {
+    // held once per root
+    EXPECT_EQ(Fscrypt::unlock(rootDir, key, &res), fscrypt);
+
+    ASSERT_EQ(mkdir(dataDir.c_str(), 0700), 0);
+    ASSERT_EQ(fscrypt->protect(dataDir), 0);
+    std::string file = dataDir + "/file";
+    int fd = open(file.c_str(), O_CREAT | O_WRONLY, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, "secret", 6), 6);
+    close(fd);
+    fd = open(file.c_str(), O_RDONLY);
+    char buf[6];
+    ASSERT_EQ(read(fd, buf, sizeof(buf)), 6);
+    close(fd);
+    EXPECT_EQ(memcmp(buf, "secret", 6), 0);
+
+    // without the key, the name is not there as it was
+    fscrypt.reset();
+    struct stat st;
+    EXPECT_NE(stat(file.c_str(), &st), 0);
+  }
+
+  std::string cmd = "rm -rf " + std::string(root);
+  ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+}  // namespace
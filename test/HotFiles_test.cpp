@@ -0,0 +1,72 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "encfs/HotFiles.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(HotFiles, CountsPerKey) {
+  HotFiles hot(4);
+  hot.record("a", 1, 4096, 0, 10);
+  hot.record("a", 1, 0, 100, 20);
+  hot.record("b", 2, 0, 0, 0);
+
+  std::vector<HotFiles::Entry> top = hot.top();
+  ASSERT_EQ(top.size(), 2u);
+  EXPECT_EQ(top[0].key, "a");
+  EXPECT_EQ(top[0].ops, 2u);
+  EXPECT_EQ(top[0].bytesRead, 4096u);
+  EXPECT_EQ(top[0].bytesWritten, 100u);
+  EXPECT_EQ(top[0].cryptoNs, 30u);
+  EXPECT_EQ(top[0].error, 0u);
+  EXPECT_EQ(top[1].key, "b");
+  EXPECT_EQ(top[1].ops, 2u);
+}
+
+TEST(HotFiles, HeavyHittersStay) {
+  HotFiles hot(3);
+  // two busy files among a crowd which is seen once each
+  for (int i = 0; i < 100; ++i) {
+    hot.record("busy", 1, 0, 0, 0);
+    hot.record("big", 1, 1 << 20, 0, 0);
+    hot.record("once" + std::to_string(i), 1, 0, 0, 0);
+  }
+  std::vector<HotFiles::Entry> top = hot.top();
+  ASSERT_EQ(top.size(), 3u);
+  // big weighs 17 per call, busy 1
+  EXPECT_EQ(top[0].key, "big");
+  EXPECT_EQ(top[0].weight, 1700u);
+  EXPECT_EQ(top[1].key, "busy");
+  EXPECT_EQ(top[1].ops, 100u);
+  // the newcomer took over the last slot, with its weight as the error
+  EXPECT_EQ(top[2].key, "once99");
+  EXPECT_EQ(top[2].ops, 1u);
+  EXPECT_EQ(top[2].weight, top[2].error + 1);
+}
+
+TEST(HotFiles, Report) {
+  HotFiles hot(2);
+  hot.record("ABC", 16, 10, 0, 1000, 4096, 0);
+  std::string report = hot.report("encfs_hot_file", "file");
+  EXPECT_NE(report.find("# TYPE encfs_hot_file_ops gauge\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("encfs_hot_file_ops{file=\"ABC\"} 16\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("encfs_hot_file_read_bytes{file=\"ABC\"} 160\n"),
+            std::string::npos);
+  EXPECT_NE(
+      report.find("encfs_hot_file_crypto_seconds{file=\"ABC\"} 0.000016000\n"),
+      std::string::npos);
+  EXPECT_NE(
+      report.find("encfs_hot_file_backing_read_bytes{file=\"ABC\"} 65536\n"),
+      std::string::npos);
+  EXPECT_NE(
+      report.find("encfs_hot_file_backing_written_bytes{file=\"ABC\"} 0\n"),
+      std::string::npos);
+}
+
+}  // namespace
@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/IOScheduler.h"
+
+using namespace encfs;
+
+namespace {
+
+class IOSchedulerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    name = "/tmp/encfstestXXXXXX";
+    fd = mkstemp(&name[0]);
+    ASSERT_GE(fd, 0);
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    dev = st.st_dev;
+  }
+
+  void TearDown() override {
+    close(fd);
+    unlink(name.c_str());
+  }
+
+  std::string name;
+  int fd;
+  dev_t dev;
+};
+
+TEST_F(IOSchedulerTest, ReadsAndWrites) {
+  IOScheduler scheduler(2, 0);
+  std::vector<char> data(5000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (char)(i * 13);
+  }
+  ASSERT_EQ(scheduler.write(fd, dev, data.data(), data.size(), 100),
+            (ssize_t)data.size());
+  std::vector<char> buf(data.size());
+  ASSERT_EQ(scheduler.read(fd, dev, buf.data(), buf.size(), 100),
+            (ssize_t)buf.size());
+  EXPECT_EQ(buf, data);
+  // at the end of the file
+  EXPECT_EQ(scheduler.read(fd, dev, buf.data(), buf.size(), 5000), 100);
+  EXPECT_EQ(scheduler.read(fd, dev, buf.data(), buf.size(), 9000), 0);
+
+  errno = 0;
+  EXPECT_EQ(scheduler.read(-1, dev, buf.data(), buf.size(), 0), -1);
+  EXPECT_EQ(errno, EBADF);
+  EXPECT_EQ(scheduler.running(), 0);
+  EXPECT_EQ(scheduler.queued(), 0u);
+}
+
+// Many threads read and write adjacent 4 KiB blocks through a scheduler of
+// depth one, so that most of them queue up and are merged.
+TEST_F(IOSchedulerTest, MergesQueuedRequests) {
+  const int Threads = 16;
+  const int Rounds = 50;
+  const size_t Block = 4096;
+  IOScheduler scheduler(1, 0);
+  std::atomic<int> failures(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      IOScheduler::BackgroundScope background;
+      std::vector<char> block(Block, (char)('a' + t));
+      for (int r = 0; r < Rounds; ++r) {
+        off_t offset = ((off_t)r * Threads + t) * Block;
+        if (scheduler.write(fd, dev, block.data(), Block, offset) !=
+            (ssize_t)Block) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  threads.clear();
+  EXPECT_EQ(failures, 0);
+
+  for (int t = 0; t < Threads; ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<char> block(Block);
+      for (int r = 0; r < Rounds; ++r) {
+        off_t offset = ((off_t)r * Threads + t) * Block;
+        if (scheduler.read(fd, dev, block.data(), Block, offset) !=
+                (ssize_t)Block ||
+            block != std::vector<char>(Block, (char)('a' + t))) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(failures, 0);
+  EXPECT_EQ(scheduler.running(), 0);
+  EXPECT_EQ(scheduler.queued(), 0u);
+
+  struct stat st;
+  ASSERT_EQ(fstat(fd, &st), 0);
+  EXPECT_EQ(st.st_size, (off_t)(Threads * Rounds * Block));
+}
+
+// A merged read which runs into the end of the file ends each request
+// where the file does.
+TEST_F(IOSchedulerTest, MergedReadAtEnd) {
+  const size_t Block = 4096;
+  std::vector<char> data(Block * 2 + 100, 'x');
+  ASSERT_EQ(pwrite(fd, data.data(), data.size(), 0), (ssize_t)data.size());
+
+  IOScheduler scheduler(1, 0);
+  std::vector<ssize_t> results(4, -2);
+  std::vector<std::vector<char>> bufs(4, std::vector<char>(Block));
+  for (int round = 0; round < 20; ++round) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&, i]() {
+        results[i] =
+            scheduler.read(fd, dev, bufs[i].data(), Block, (off_t)i * Block);
+      });
+    }
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    EXPECT_EQ(results[0], (ssize_t)Block);
+    EXPECT_EQ(results[1], (ssize_t)Block);
+    EXPECT_EQ(results[2], 100);
+    EXPECT_EQ(results[3], 0);
+  }
+}
+
+}  // namespace
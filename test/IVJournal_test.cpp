@@ -0,0 +1,341 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherFileIO.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileIO.h"
+#include "encfs/FileUtils.h"
+#include "encfs/IVJournal.h"
+#include "encfs/Mutex.h"
+#include "encfs/RawFileIO.h"
+
+using namespace encfs;
+
+namespace {
+
+class IVJournalTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = std::string(root) + "/";
+
+    cfg.reset(new FSConfig);
+    cfg->cipher = Cipher::New("AES", 256);
+    cfg->key = cfg->cipher->newRandomKey();
+    cfg->config.reset(new EncFSConfig);
+    cfg->config->blockSize = 1024;
+    cfg->config->uniqueIV = true;
+    cfg->config->externalIVChaining = true;
+    cfg->opts.reset(new EncFS_Opts);
+  }
+
+  void TearDown() override {
+    cfg->ivJournal.reset();
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::shared_ptr<IVJournal> open(bool defer = true) {
+    return std::make_shared<IVJournal>(rootDir, cfg->cipher, cfg->key, defer);
+  }
+
+  std::shared_ptr<FileIO> file(const std::string &path, uint64_t iv,
+                               int flags) {
+    std::shared_ptr<FileIO> io(new RawFileIO(path));
+    io.reset(new CipherFileIO(io, cfg));
+    io->setIV(iv);
+    EXPECT_GE(io->open(flags), 0);
+    return io;
+  }
+
+  std::vector<unsigned char> read(const std::string &path, uint64_t iv) {
+    std::shared_ptr<FileIO> io = file(path, iv, O_RDONLY);
+    std::vector<unsigned char> buf(io->getSize());
+    IORequest req;
+    req.offset = 0;
+    req.data = buf.data();
+    req.dataLen = buf.size();
+    EXPECT_EQ(io->read(req), (ssize_t)buf.size());
+    return buf;
+  }
+
+  // a file as the journal knows it
+  static struct stat fileId(ino_t inode) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_dev = 1;
+    st.st_ino = inode;
+    return st;
+  }
+
+  struct stat create(const std::string &name) {
+    std::string path = rootDir + name;
+    int fd = ::creat(path.c_str(), 0600);
+    EXPECT_GE(fd, 0);
+    ::close(fd);
+    struct stat st;
+    EXPECT_EQ(::lstat(path.c_str(), &st), 0);
+    return st;
+  }
+
+  std::string readLog() {
+    std::string log;
+    int fd = ::open((rootDir + IVJournal::FileName).c_str(), O_RDONLY);
+    char buf[4096];
+    ssize_t res;
+    while (fd >= 0 && (res = ::read(fd, buf, sizeof(buf))) > 0) {
+      log.append(buf, res);
+    }
+    ::close(fd);
+    return log;
+  }
+
+  void writeLog(const std::string &log) {
+    int fd = ::open((rootDir + IVJournal::FileName).c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::write(fd, log.data(), log.size()), (ssize_t)log.size());
+    ::close(fd);
+  }
+
+  std::string rootDir;
+  FSConfigPtr cfg;
+};
+
+TEST_F(IVJournalTest, RecordFindRemove) {
+  std::shared_ptr<IVJournal> journal = open();
+  EXPECT_TRUE(journal->empty());
+
+  Lock lock(journal->mutex());
+  uint64_t headerIV = 0;
+  EXPECT_FALSE(journal->find(fileId(7), &headerIV));
+  EXPECT_TRUE(journal->record(fileId(7), 11, 12, rootDir + "x"));
+  EXPECT_FALSE(journal->empty());
+  EXPECT_TRUE(journal->find(fileId(7), &headerIV));
+  EXPECT_EQ(headerIV, 11u);
+
+  // the same inode on another device is another file
+  struct stat other = fileId(7);
+  other.st_dev = 2;
+  EXPECT_FALSE(journal->find(other, &headerIV));
+
+  // renamed back
+  EXPECT_TRUE(journal->record(fileId(7), 11, 11, rootDir + "x"));
+  EXPECT_FALSE(journal->find(fileId(7), &headerIV));
+
+  EXPECT_TRUE(journal->record(fileId(8), 21, 22, rootDir + "y"));
+  journal->remove(fileId(8));
+  EXPECT_TRUE(journal->empty());
+}
+
+TEST_F(IVJournalTest, ReplaysLog) {
+  ASSERT_EQ(::mkdir((rootDir + "d").c_str(), 0700), 0);
+  ASSERT_EQ(::mkdir((rootDir + "d/e").c_str(), 0700), 0);
+  ASSERT_EQ(::mkdir((rootDir + "dd").c_str(), 0700), 0);
+  struct stat a = create("d/a");
+  struct stat b = create("d/e/b");
+  struct stat c = create("dd/c");
+  struct stat x = create("x");
+  struct stat gone = create("gone");
+  struct stat replaced = create("replaced");
+
+  std::string log;
+  {
+    std::shared_ptr<IVJournal> journal = open();
+    {
+      Lock lock(journal->mutex());
+      journal->record(a, 100, 101, rootDir + "d/a");
+      journal->record(b, 200, 201, rootDir + "d/e/b");
+      journal->record(c, 300, 301, rootDir + "dd/c");
+      journal->record(x, 400, 401, rootDir + "x");
+      journal->remove(x);
+      journal->record(gone, 500, 501, rootDir + "gone");
+      journal->record(replaced, 600, 601, rootDir + "replaced");
+    }
+    journal->moved(rootDir + "d", rootDir + "n");
+    ASSERT_TRUE(journal->sync());
+    ASSERT_EQ(::rename((rootDir + "d").c_str(), (rootDir + "n").c_str()), 0);
+
+    // a crash before the headers are rewritten
+    log = readLog();
+  }
+  writeLog(log + "R\1\2");  // and in the middle of a record
+
+  // files deleted, or replaced by another one, while it wasn't mounted
+  ASSERT_EQ(::unlink((rootDir + "gone").c_str()), 0);
+  create("replaced.new");
+  ASSERT_EQ(::rename((rootDir + "replaced.new").c_str(),
+                     (rootDir + "replaced").c_str()),
+            0);
+
+  std::shared_ptr<IVJournal> journal = open();
+  EXPECT_EQ(journal->size(), 3u);
+  Lock lock(journal->mutex());
+  uint64_t headerIV = 0;
+  EXPECT_TRUE(journal->find(a, &headerIV));
+  EXPECT_EQ(headerIV, 100u);
+  EXPECT_TRUE(journal->find(b, &headerIV));
+  EXPECT_EQ(headerIV, 200u);
+  EXPECT_FALSE(journal->find(x, &headerIV));
+  EXPECT_FALSE(journal->find(gone, &headerIV));
+  EXPECT_FALSE(journal->find(replaced, &headerIV));
+  struct stat now;
+  ASSERT_EQ(::lstat((rootDir + "replaced").c_str(), &now), 0);
+  EXPECT_FALSE(journal->find(now, &headerIV));
+}
+
+TEST_F(IVJournalTest, ReplaysFirstVersion) {
+  // records without a device, for a file which is there and one whose
+  // inode is another one's now
+  struct stat a = create("a");
+  struct stat b = create("b");
+  std::string log = "EncFSIV1";
+  for (const struct stat *st : {&a, &b}) {
+    log.push_back('R');
+    uint64_t ino = st == &a ? st->st_ino : st->st_ino + 1000;
+    for (int i = 7; i >= 0; --i) {
+      log.push_back((char)(ino >> (8 * i)));
+    }
+    log.append(std::string(7, '\0') + "\x01" + std::string(7, '\0') + "\x02");
+    log.append(std::string(1, '\0') + "\x01");
+    log.append(st == &a ? "a" : "b");
+  }
+  writeLog(log);
+
+  std::shared_ptr<IVJournal> journal = open();
+  EXPECT_EQ(journal->size(), 1u);
+  {
+    Lock lock(journal->mutex());
+    uint64_t headerIV = 0;
+    EXPECT_TRUE(journal->find(a, &headerIV));
+    EXPECT_EQ(headerIV, 1u);
+    EXPECT_FALSE(journal->find(b, &headerIV));
+  }
+  // and written out in the current format
+  EXPECT_EQ(readLog().compare(0, 8, "EncFSIV2"), 0);
+}
+
+TEST_F(IVJournalTest, MovedKeepsSiblings) {
+  // compact() finds files by their current path, and checks the inode
+  struct stat file[2];
+  int n = 0;
+  for (const char *name : {"n/a", "d-x/b"}) {
+    std::string path = rootDir + name;
+    ASSERT_EQ(::mkdir(path.substr(0, path.rfind('/')).c_str(), 0700), 0);
+    int fd = ::creat(path.c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    ASSERT_EQ(::stat(path.c_str(), &file[n++]), 0);
+  }
+
+  std::shared_ptr<IVJournal> journal = open();
+  {
+    Lock lock(journal->mutex());
+    journal->record(file[0], 100, 101, rootDir + "d/a");
+    journal->record(file[1], 200, 201, rootDir + "d-x/b");
+  }
+  journal->moved(rootDir + "d", rootDir + "n");
+  EXPECT_EQ(journal->compact(), 0u);
+}
+
+TEST_F(IVJournalTest, DeferredHeaderRewrite) {
+  std::string path = rootDir + "f";
+  const uint64_t oldIV = 0x1234, newIV = 0x5678;
+  std::vector<unsigned char> data(3000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7);
+  }
+  {
+    int fd = ::creat(path.c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    std::shared_ptr<FileIO> io = file(path, oldIV, O_RDWR);
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io->write(req), (ssize_t)data.size());
+  }
+
+  unsigned char before[8], after[8];
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    ASSERT_EQ(::pread(fd, before, 8, 0), 8);
+    ::close(fd);
+  }
+
+  cfg->ivJournal = open();
+  {
+    // a rename: the header stays as it is
+    std::shared_ptr<FileIO> io = file(path, oldIV, O_RDONLY);
+    ASSERT_TRUE(io->setIV(newIV));
+  }
+  EXPECT_EQ(cfg->ivJournal->size(), 1u);
+  int fd = ::open(path.c_str(), O_RDONLY);
+  ASSERT_EQ(::pread(fd, after, 8, 0), 8);
+  ::close(fd);
+  EXPECT_EQ(memcmp(before, after, 8), 0);
+
+  // readable with the new IV, both before and after compaction
+  EXPECT_EQ(read(path, newIV), data);
+  EXPECT_EQ(cfg->ivJournal->compact(), 0u);
+  cfg->ivJournal.reset();
+  EXPECT_EQ(read(path, newIV), data);
+
+  // and the empty log is gone
+  struct stat st;
+  EXPECT_NE(lstat((rootDir + IVJournal::FileName).c_str(), &st), 0);
+}
+
+TEST_F(IVJournalTest, WritableOpenRewritesHeader) {
+  std::string path = rootDir + "f";
+  const uint64_t oldIV = 0x1234, newIV = 0x5678;
+  std::vector<unsigned char> data(100, 'x');
+  {
+    int fd = ::creat(path.c_str(), 0600);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    std::shared_ptr<FileIO> io = file(path, oldIV, O_RDWR);
+    IORequest req;
+    req.offset = 0;
+    req.data = data.data();
+    req.dataLen = data.size();
+    ASSERT_EQ(io->write(req), (ssize_t)data.size());
+  }
+
+  cfg->ivJournal = open();
+  ASSERT_TRUE(file(path, oldIV, O_RDONLY)->setIV(newIV));
+  ASSERT_FALSE(cfg->ivJournal->empty());
+
+  // opening read-only leaves it pending
+  EXPECT_EQ(read(path, newIV), data);
+  EXPECT_FALSE(cfg->ivJournal->empty());
+
+  {
+    std::shared_ptr<FileIO> io = file(path, newIV, O_RDWR);
+    EXPECT_EQ(io->getSize(), (off_t)data.size());
+    unsigned char c = 0;
+    IORequest req;
+    req.offset = 0;
+    req.data = &c;
+    req.dataLen = 1;
+    ASSERT_EQ(io->read(req), 1);
+    EXPECT_EQ(c, 'x');
+  }
+  EXPECT_TRUE(cfg->ivJournal->empty());
+
+  cfg->ivJournal.reset();
+  EXPECT_EQ(read(path, newIV), data);
+}
+
+}  // namespace
@@ -0,0 +1,97 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <unistd.h>
+
+#include "encfs/IdleMonitor.h"
+
+using namespace encfs;
+
+namespace {
+
+// wait up to a second for cond
+template <typename Cond>
+bool eventually(Cond cond) {
+  for (int i = 0; i < 100 && !cond(); ++i) {
+    usleep(10000);
+  }
+  return cond();
+}
+
+TEST(IdleMonitorTest, ChecksEveryMount) {
+  std::atomic<int> a(0), b(0), c(0);
+  IdleMonitor monitor;
+  auto every20ms = [](std::atomic<int> *count) {
+    return [count]() -> int64_t {
+      ++*count;
+      return IdleMonitor::now() + 20;
+    };
+  };
+  monitor.add(&a, every20ms(&a));
+  monitor.add(&b, every20ms(&b));
+  monitor.add(&c, every20ms(&c));
+  EXPECT_EQ(monitor.size(), 3u);
+
+  EXPECT_TRUE(eventually([&]() { return a >= 3 && b >= 3 && c >= 3; }));
+  EXPECT_TRUE(monitor.remove(&b));
+  int seen = b;
+  usleep(100000);
+  EXPECT_EQ(b, seen);
+  EXPECT_GT(a, seen);
+}
+
+TEST(IdleMonitorTest, SleepsUntilDeadline) {
+  std::atomic<int64_t> first(0), second(0);
+  IdleMonitor monitor;
+  monitor.add(&first, [&]() -> int64_t {
+    if (first == 0) {
+      first = IdleMonitor::now();
+      return first + 200;
+    }
+    second = IdleMonitor::now();
+    return -1;
+  });
+
+  // a later mount with an earlier deadline isn't held up
+  std::atomic<bool> other(false);
+  usleep(20000);
+  monitor.add(&other, [&]() -> int64_t {
+    other = true;
+    return -1;
+  });
+  EXPECT_TRUE(eventually([&]() { return other.load(); }));
+  EXPECT_EQ(second, 0);
+
+  ASSERT_TRUE(eventually([&]() { return second != 0; }));
+  EXPECT_GE(second - first, 200);
+  EXPECT_LT(second - first, 400);
+}
+
+TEST(IdleMonitorTest, GoneMountsDropped) {
+  std::atomic<int> calls(0);
+  IdleMonitor monitor;
+  monitor.add(&calls, [&calls]() -> int64_t {
+    return ++calls == 2 ? -1 : IdleMonitor::now() + 10;
+  });
+
+  EXPECT_TRUE(eventually([&]() { return monitor.size() == 0; }));
+  EXPECT_EQ(calls, 2);
+  EXPECT_FALSE(monitor.remove(&calls));
+}
+
+TEST(IdleMonitorTest, RemoveWaitsForCheck) {
+  std::atomic<bool> running(false), done(false);
+  IdleMonitor monitor;
+  monitor.add(&done, [&]() -> int64_t {
+    running = true;
+    usleep(100000);
+    done = true;
+    return IdleMonitor::now() + 10;
+  });
+
+  ASSERT_TRUE(eventually([&]() { return running.load(); }));
+  monitor.remove(&done);
+  EXPECT_TRUE(done);
+}
+
+}  // namespace
@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "encfs/InFlight.h"
+#include "encfs/Stats.h"
+
+using namespace encfs;
+
+namespace {
+
+// until n calls joined one running
+static void waitForWaiters(uint64_t n) {
+  while (Stats::value(Stats::CollapsedCalls) < n) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+TEST(InFlight, JoinsCallRunning) {
+  InFlight flights;
+  std::atomic<int> calls(0);
+  std::atomic<bool> release(false);
+  auto slow = [&](InFlight::Result *out) {
+    ++calls;
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    out->res = 0;
+    out->target = "target";
+  };
+
+  InFlight::Result first;
+  std::thread leader(
+      [&]() { flights.run(InFlight::Link, "/a", &first, slow); });
+  while (calls == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // the same call waits, another kind or path runs by itself
+  InFlight::Result other;
+  auto missing = [](InFlight::Result *out) { out->res = -ENOENT; };
+  EXPECT_EQ(flights.run(InFlight::Attr, "/a", &other, missing), -ENOENT);
+  EXPECT_EQ(flights.run(InFlight::Link, "/b", &other, missing), -ENOENT);
+
+  Stats::reset();
+  Stats::setEnabled(true);
+  const int Waiters = 4;
+  std::vector<InFlight::Result> results(Waiters);
+  std::vector<std::thread> waiters;
+  for (int i = 0; i < Waiters; ++i) {
+    waiters.emplace_back(
+        [&, i]() { flights.run(InFlight::Link, "/a", &results[i], slow); });
+  }
+  waitForWaiters(Waiters);
+  release = true;
+  leader.join();
+  for (auto &t : waiters) {
+    t.join();
+  }
+  Stats::setEnabled(false);
+
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(first.target, "target");
+  for (const auto &result : results) {
+    EXPECT_EQ(result.res, 0);
+    EXPECT_EQ(result.target, "target");
+  }
+  EXPECT_EQ(Stats::value(Stats::CollapsedCalls), (uint64_t)Waiters);
+  Stats::reset();
+}
+
+TEST(InFlight, ChangeStartsNewCall) {
+  InFlight flights;
+  std::atomic<int> calls(0);
+  std::atomic<bool> release(false);
+  auto slow = [&](InFlight::Result *out) {
+    int call = ++calls;
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    out->res = 0;
+    out->st.st_size = call;
+  };
+
+  InFlight::Result before;
+  std::thread leader(
+      [&]() { flights.run(InFlight::Attr, "/a", &before, slow); });
+  while (calls == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // what the running call finds may be from before the change
+  flights.changed();
+  InFlight::Result after;
+  std::thread second(
+      [&]() { flights.run(InFlight::Attr, "/a", &after, slow); });
+  while (calls < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  release = true;
+  leader.join();
+  second.join();
+  EXPECT_EQ(calls, 2);
+  EXPECT_EQ(before.st.st_size, 1);
+  EXPECT_EQ(after.st.st_size, 2);
+}
+
+TEST(InFlight, ThrowFailsWaiters) {
+  InFlight flights;
+  std::atomic<bool> started(false);
+  std::atomic<bool> release(false);
+
+  std::thread leader([&]() {
+    InFlight::Result result;
+    EXPECT_THROW(flights.run(InFlight::Listing, "/d", &result,
+                             [&](InFlight::Result *) {
+                               started = true;
+                               while (!release) {
+                                 std::this_thread::sleep_for(
+                                     std::chrono::milliseconds(1));
+                               }
+                               throw std::runtime_error("failed");
+                             }),
+                 std::runtime_error);
+  });
+  while (!started) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  Stats::reset();
+  Stats::setEnabled(true);
+  InFlight::Result result;
+  std::thread waiter([&]() {
+    flights.run(InFlight::Listing, "/d", &result,
+                [](InFlight::Result *out) { out->res = 0; });
+  });
+  waitForWaiters(1);
+  release = true;
+  leader.join();
+  waiter.join();
+  Stats::setEnabled(false);
+  Stats::reset();
+  EXPECT_EQ(result.res, -EIO);
+}
+
+}  // namespace
@@ -0,0 +1,165 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/IntentLog.h"
+
+using namespace encfs;
+
+namespace {
+
+struct Write {
+  std::string path;
+  off_t offset;
+  std::string data;
+};
+
+class IntentLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = root;
+    logPath = rootDir + "/intent.log";
+    cipher = Cipher::New("AES", 256);
+    key = cipher->newRandomKey();
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::unique_ptr<IntentLog> open() {
+    std::unique_ptr<IntentLog> log(new IntentLog(logPath, cipher, key));
+    EXPECT_EQ(log->replay(collect()), 0);
+    EXPECT_TRUE(log->clear());
+    return log;
+  }
+
+  void append(IntentLog *log, const std::string &path, off_t offset,
+              const std::string &data) {
+    uint64_t seq = log->append(path, offset, (const unsigned char *)data.data(),
+                               data.size());
+    ASSERT_NE(seq, 0u);
+    EXPECT_EQ(log->commit(seq), 0);
+  }
+
+  IntentLog::Apply collect() {
+    return [this](const std::string &path, off_t offset,
+                  const unsigned char *data, size_t size) {
+      replayed.push_back({path, offset, std::string((const char *)data, size)});
+      return true;
+    };
+  }
+
+  // what a mount after a crash finds
+  int replay(const CipherKey &withKey) {
+    replayed.clear();
+    IntentLog log(logPath, cipher, withKey);
+    return log.replay(collect());
+  }
+
+  std::string rootDir;
+  std::string logPath;
+  std::shared_ptr<Cipher> cipher;
+  CipherKey key;
+  std::vector<Write> replayed;
+};
+
+TEST_F(IntentLogTest, ReplaysAfterCrash) {
+  {
+    std::unique_ptr<IntentLog> log = open();
+    append(log.get(), "/a", 10, "hello");
+    append(log.get(), "/dir/b", 0, std::string(3000, 'x'));
+    append(log.get(), "/a", 12, "LL");
+    EXPECT_FALSE(log->empty());
+    // gone without a checkpoint
+  }
+
+  ASSERT_EQ(replay(key), 3);
+  EXPECT_EQ(replayed[0].path, "/a");
+  EXPECT_EQ(replayed[0].offset, 10);
+  EXPECT_EQ(replayed[0].data, "hello");
+  EXPECT_EQ(replayed[1].path, "/dir/b");
+  EXPECT_EQ(replayed[1].data, std::string(3000, 'x'));
+  EXPECT_EQ(replayed[2].offset, 12);
+  EXPECT_EQ(replayed[2].data, "LL");
+
+  // encrypted: neither the path nor the data is in the file
+  std::string raw;
+  FILE *f = fopen(logPath.c_str(), "rb");
+  ASSERT_NE(f, nullptr);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    raw.append(buf, n);
+  }
+  fclose(f);
+  EXPECT_EQ(raw.find("hello"), std::string::npos);
+  EXPECT_EQ(raw.find("/dir/b"), std::string::npos);
+
+  // nothing of it under another key
+  EXPECT_EQ(replay(cipher->newRandomKey()), 0);
+}
+
+TEST_F(IntentLogTest, TornRecord) {
+  {
+    std::unique_ptr<IntentLog> log = open();
+    append(log.get(), "/a", 0, "first");
+    append(log.get(), "/a", 5, "second");
+  }
+  struct stat st;
+  ASSERT_EQ(stat(logPath.c_str(), &st), 0);
+  ASSERT_EQ(truncate(logPath.c_str(), st.st_size - 3), 0);
+
+  ASSERT_EQ(replay(key), 1);
+  EXPECT_EQ(replayed[0].data, "first");
+}
+
+TEST_F(IntentLogTest, Checkpoint) {
+  std::unique_ptr<IntentLog> log = open();
+  bool flushOk = false;
+  int flushes = 0;
+  log->start([&]() {
+    ++flushes;
+    return flushOk;
+  });
+
+  // a failed flush keeps the records, in the old log
+  append(log.get(), "/a", 0, "one");
+  EXPECT_FALSE(log->checkpoint());
+  EXPECT_EQ(flushes, 1);
+  append(log.get(), "/a", 3, "two");
+  ASSERT_EQ(replay(key), 2);
+  EXPECT_EQ(replayed[0].data, "one");
+  EXPECT_EQ(replayed[1].data, "two");
+
+  // the old log is flushed first, then the current one
+  flushOk = true;
+  EXPECT_TRUE(log->settle());
+  EXPECT_EQ(flushes, 3);
+  EXPECT_TRUE(log->empty());
+  EXPECT_EQ(replay(key), 0);
+
+  // nothing to do
+  EXPECT_TRUE(log->settle());
+  EXPECT_EQ(flushes, 3);
+
+  // a clean stop leaves no log behind
+  append(log.get(), "/a", 6, "three");
+  log->stop();
+  EXPECT_EQ(flushes, 4);
+  log.reset();
+  struct stat st;
+  EXPECT_NE(stat(logPath.c_str(), &st), 0);
+}
+
+}  // namespace
@@ -0,0 +1,76 @@
+#include "gtest/gtest.h"
+
+#include <ctime>
+#include <string>
+#include <sys/stat.h>
+
+#include "encfs/KeepCache.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat fileStat(ino_t ino, off_t size, time_t sec, long nsec) {
+  struct stat st = {};
+  st.st_ino = ino;
+  st.st_size = size;
+  st.st_mtim.tv_sec = st.st_ctim.tv_sec = sec;
+  st.st_mtim.tv_nsec = st.st_ctim.tv_nsec = nsec;
+  return st;
+}
+
+TEST(KeepCache, UnchangedFilesKeepPages) {
+  KeepCache cache(10);
+  time_t past = time(nullptr) - 10;
+  EXPECT_FALSE(cache.opened("/a", fileStat(5, 100, past, 1)));
+  EXPECT_TRUE(cache.opened("/a", fileStat(5, 100, past, 1)));
+  EXPECT_TRUE(cache.opened("/a", fileStat(5, 100, past, 1)));
+
+  // changed behind our back
+  EXPECT_FALSE(cache.opened("/a", fileStat(5, 100, past, 2)));
+  EXPECT_TRUE(cache.opened("/a", fileStat(5, 100, past, 2)));
+  EXPECT_FALSE(cache.opened("/a", fileStat(5, 200, past, 2)));
+  // replaced by another file
+  EXPECT_FALSE(cache.opened("/a", fileStat(6, 200, past, 2)));
+
+  // another hard link of the file
+  EXPECT_FALSE(cache.opened("/b", fileStat(6, 200, past, 2)));
+  EXPECT_TRUE(cache.opened("/a", fileStat(6, 200, past, 2)));
+}
+
+TEST(KeepCache, WrittenThroughMount) {
+  KeepCache cache(10);
+  time_t past = time(nullptr) - 10;
+  EXPECT_FALSE(cache.opened("/a", fileStat(5, 100, past, 1)));
+  EXPECT_FALSE(cache.opened("/b", fileStat(5, 100, past, 1)));
+  cache.written("/a", fileStat(5, 300, past, 3));
+  EXPECT_TRUE(cache.opened("/a", fileStat(5, 300, past, 3)));
+  // the pages of the other link weren't written
+  EXPECT_FALSE(cache.opened("/b", fileStat(5, 300, past, 3)));
+}
+
+TEST(KeepCache, RecentChangesNotTrusted) {
+  KeepCache cache(10);
+  time_t now = time(nullptr);
+  EXPECT_FALSE(cache.opened("/a", fileStat(5, 100, now, 0)));
+  EXPECT_FALSE(cache.opened("/a", fileStat(5, 100, now, 0)));
+  cache.written("/a", fileStat(5, 100, now, 0));
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(KeepCache, Bounded) {
+  KeepCache cache(10);
+  time_t past = time(nullptr) - 10;
+  for (int i = 0; i < 20; ++i) {
+    cache.opened("/f" + std::to_string(i), fileStat(i, 100, past, 1));
+  }
+  EXPECT_EQ(cache.size(), 10u);
+  EXPECT_FALSE(cache.opened("/f0", fileStat(0, 100, past, 1)));
+  EXPECT_TRUE(cache.opened("/f19", fileStat(19, 100, past, 1)));
+
+  KeepCache off(0);
+  off.opened("/a", fileStat(5, 100, past, 1));
+  EXPECT_FALSE(off.opened("/a", fileStat(5, 100, past, 1)));
+}
+
+}  // namespace
@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <openssl/evp.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherKey.h"
+#include "encfs/KernelCipher.h"
+
+using namespace encfs;
+
+namespace {
+
+std::vector<unsigned char> testData(size_t len) {
+  std::vector<unsigned char> data(len);
+  for (size_t i = 0; i < len; ++i) {
+    data[i] = (unsigned char)(i * 31 + (i >> 8));
+  }
+  return data;
+}
+
+// the kernel gives the results of OpenSSL's CBC, also across the chunks a
+// large block is sent in
+TEST(KernelCipher, MatchesOpenSSL) {
+  unsigned char key[32];
+  unsigned char iv[16];
+  for (int i = 0; i < 32; ++i) {
+    key[i] = i * 3;
+  }
+  memset(iv, 0x5a, sizeof(iv));
+
+  auto kernel = KernelCipher::open("cbc(aes)", key, 32, 16);
+  if (!kernel) {
+    // no AF_ALG here
+    return;
+  }
+
+  for (size_t len : {16, 4096, 200000}) {
+    std::vector<unsigned char> expected = testData(len);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int outLen = 0;
+    EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key, iv);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_EncryptUpdate(ctx, expected.data(), &outLen, expected.data(), len);
+    EVP_CIPHER_CTX_free(ctx);
+
+    std::vector<unsigned char> buf = testData(len);
+    ASSERT_TRUE(kernel->encrypt(buf.data(), len, iv));
+    EXPECT_TRUE(buf == expected) << len;
+    ASSERT_TRUE(kernel->decrypt(buf.data(), len, iv));
+    EXPECT_TRUE(buf == testData(len)) << len;
+  }
+}
+
+// AES-AFALG reads and writes the data of AES volumes, whether the kernel
+// does the work or it falls back to OpenSSL
+TEST(KernelCipher, SameAsAES) {
+  auto aes = Cipher::New("AES", 256);
+  auto kernel = Cipher::New("AES-AFALG", aes->interface(), 256);
+  ASSERT_TRUE(kernel != nullptr);
+  EXPECT_TRUE(Cipher::New("AES-AFALG", Interface("ssl/blowfish", 3, 0, 0),
+                          256) == nullptr);
+
+  CipherKey key = aes->newRandomKey();
+  CipherKey encodingKey = aes->newRandomKey();
+  std::vector<unsigned char> keyBuf(aes->encodedKeySize());
+  aes->writeKey(key, keyBuf.data(), encodingKey);
+  CipherKey kernelKey = kernel->readKey(keyBuf.data(), encodingKey, true);
+  ASSERT_TRUE(kernelKey != nullptr);
+
+  for (int len : {1024, 4096}) {
+    std::vector<unsigned char> a = testData(len);
+    std::vector<unsigned char> b = a;
+    ASSERT_TRUE(aes->blockEncode(a.data(), len, 42, key));
+    ASSERT_TRUE(kernel->blockEncode(b.data(), len, 42, kernelKey));
+    EXPECT_TRUE(a == b) << len;
+    ASSERT_TRUE(kernel->blockDecode(b.data(), len, 42, kernelKey));
+    EXPECT_TRUE(b == testData(len)) << len;
+  }
+}
+
+}  // namespace
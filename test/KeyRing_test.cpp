@@ -0,0 +1,29 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/KeyRing.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(KeyRing, TakenOnce) {
+  std::string name = "encfs-test:" + std::to_string(getpid());
+  std::vector<unsigned char> secret = {1, 2, 3, 4, 5, 6, 7, 8};
+  if (!KeyRing::store(name, secret, 60)) {
+    return;  // no keyring here, e.g. in a container which filters it out
+  }
+
+  std::vector<unsigned char> data;
+  ASSERT_TRUE(KeyRing::take(name, &data));
+  EXPECT_EQ(data, secret);
+
+  // it was revoked
+  EXPECT_FALSE(KeyRing::take(name, &data));
+  EXPECT_FALSE(KeyRing::take(name + "-other", &data));
+}
+
+}  // namespace
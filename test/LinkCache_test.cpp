@@ -0,0 +1,60 @@
+#include "gtest/gtest.h"
+
+#include <ctime>
+#include <string>
+#include <sys/stat.h>
+
+#include "encfs/LinkCache.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat linkStat(ino_t ino, time_t mtime, off_t size) {
+  struct stat st = {};
+  st.st_ino = ino;
+  st.st_mtime = mtime;
+  st.st_ctime = mtime;
+  st.st_size = size;
+  return st;
+}
+
+TEST(LinkCache, ValidatedByStat) {
+  LinkCache cache(10);
+  time_t past = time(nullptr) - 10;
+  cache.put(linkStat(7, past, 40), "target");
+
+  std::string target;
+  ASSERT_TRUE(cache.get(linkStat(7, past, 40), &target));
+  EXPECT_EQ(target, "target");
+
+  // same inode, but a different link
+  EXPECT_FALSE(cache.get(linkStat(7, past, 41), &target));
+  EXPECT_EQ(cache.size(), 0u);
+  cache.put(linkStat(7, past, 40), "target");
+  EXPECT_FALSE(cache.get(linkStat(7, past + 1, 40), &target));
+}
+
+TEST(LinkCache, RejectsRecentlyChanged) {
+  LinkCache cache(10);
+  time_t now = time(nullptr);
+  cache.put(linkStat(7, now, 40), "target");
+
+  std::string target;
+  EXPECT_FALSE(cache.get(linkStat(7, now, 40), &target));
+}
+
+TEST(LinkCache, Bounded) {
+  LinkCache cache(2);
+  time_t past = time(nullptr) - 10;
+  for (ino_t ino = 1; ino <= 5; ++ino) {
+    cache.put(linkStat(ino, past, 10), "t");
+  }
+  EXPECT_EQ(cache.size(), 2u);
+
+  std::string target;
+  EXPECT_TRUE(cache.get(linkStat(5, past, 10), &target));
+  EXPECT_FALSE(cache.get(linkStat(1, past, 10), &target));
+}
+
+}  // namespace
@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "encfs/MemFileIO.h"
+
+using namespace encfs;
+
+namespace {
+
+ssize_t writeAt(FileIO &io, off_t offset, const std::string &data) {
+  IORequest req;
+  req.offset = offset;
+  req.data = (unsigned char *)&data[0];
+  req.dataLen = data.size();
+  return io.write(req);
+}
+
+std::string readAt(const FileIO &io, off_t offset, size_t len) {
+  std::string data(len, '?');
+  IORequest req;
+  req.offset = offset;
+  req.data = (unsigned char *)&data[0];
+  req.dataLen = len;
+  ssize_t res = io.read(req);
+  return res < 0 ? std::string() : data.substr(0, res);
+}
+
+TEST(MemFileIO, SparseReadsBackZeros) {
+  MemFileIO io("file");
+  ASSERT_EQ(io.open(O_RDWR), 0);
+  EXPECT_EQ(io.getSize(), 0);
+
+  // across a chunk boundary, far out
+  const off_t far = 100 * MemFileIO::ChunkSize - 2;
+  EXPECT_EQ(writeAt(io, far, "abcd"), 4);
+  EXPECT_EQ(io.getSize(), far + 4);
+  EXPECT_EQ(readAt(io, far - 2, 10), std::string("\0\0abcd", 6));
+  EXPECT_EQ(readAt(io, 0, 3), std::string(3, '\0'));
+  EXPECT_EQ(readAt(io, far + 4, 10), "");
+  EXPECT_EQ(io.allocated(), 2 * MemFileIO::ChunkSize);
+
+  struct stat st;
+  ASSERT_EQ(io.getAttr(&st), 0);
+  EXPECT_EQ(st.st_size, far + 4);
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+}
+
+TEST(MemFileIO, TruncateAndPunchHole) {
+  MemFileIO io("file");
+  ASSERT_EQ(io.open(O_RDWR), 0);
+  std::string data(3 * MemFileIO::ChunkSize, 'x');
+  ASSERT_EQ(writeAt(io, 0, data), (ssize_t)data.size());
+
+  // a shrunk file grows back with zeros
+  ASSERT_EQ(io.truncate(10), 0);
+  ASSERT_EQ(io.truncate(20), 0);
+  EXPECT_EQ(readAt(io, 0, 30), std::string(10, 'x') + std::string(10, '\0'));
+  EXPECT_EQ(io.allocated(), MemFileIO::ChunkSize);
+
+  ASSERT_EQ(writeAt(io, 0, data), (ssize_t)data.size());
+  const off_t cs = MemFileIO::ChunkSize;
+  ASSERT_EQ(io.punchHole(cs - 1, cs + 2), 0);
+  EXPECT_EQ(io.getSize(), 3 * cs);
+  EXPECT_EQ(readAt(io, cs - 2, cs + 4),
+            "x" + std::string(cs + 2, '\0') + "x");
+  EXPECT_EQ(io.allocated(), 2 * MemFileIO::ChunkSize);
+}
+
+TEST(MemFileIO, SharedContents) {
+  MemFileIO writer("file");
+  ASSERT_EQ(writer.open(O_RDWR), 0);
+  ASSERT_EQ(writeAt(writer, 5, "hello"), 5);
+
+  MemFileIO reader("file", writer.contents());
+  ASSERT_EQ(reader.open(O_RDONLY), 0);
+  EXPECT_FALSE(reader.isWritable());
+  EXPECT_EQ(readAt(reader, 5, 5), "hello");
+  EXPECT_EQ(writeAt(reader, 0, "x"), -EBADF);
+
+  MemFileIO closed("file", writer.contents());
+  EXPECT_EQ(readAt(closed, 5, 5), "");
+}
+
+}  // namespace
@@ -12,3 +12,19 @@ static void BM_MemPoolAllocate(benchmark::State& state) {
 }
 // Register the function as a benchmark
 BENCHMARK(BM_MemPoolAllocate);
+BENCHMARK(BM_MemPoolAllocate)->ThreadRange(2, 16);
+
+// Sizes as used by the IO layers: name buffers, MAC blocks, staging buffers.
+static void BM_MemPoolMixedSizes(benchmark::State& state) {
+  const int sizes[] = {64, 1024 + 16, 4096 + 16, 300, 64 * 1024};
+  const int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+  int i = 0;
+  while (state.KeepRunning()) {
+    auto a = MemoryPool::allocate(sizes[i % numSizes]);
+    auto b = MemoryPool::allocate(sizes[(i + 1) % numSizes]);
+    MemoryPool::release(a);
+    MemoryPool::release(b);
+    ++i;
+  }
+}
+BENCHMARK(BM_MemPoolMixedSizes)->ThreadRange(1, 16);
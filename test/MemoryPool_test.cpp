@@ -1,5 +1,9 @@
 #include "gtest/gtest.h"
 
+#include <cstring>
+#include <thread>
+#include <vector>
+
 #include "encfs/MemoryPool.h"
 
 using namespace encfs;
@@ -9,4 +13,74 @@ TEST(MemoryPool, Allocate) {
   ASSERT_TRUE(block.data != nullptr);
   ASSERT_TRUE(block.internalData != nullptr);
   MemoryPool::release(block);
-}
\ No newline at end of file
+}
+
+TEST(MemoryPool, ReleaseZeroes) {
+  auto block = MemoryPool::allocate(1000);
+  memset(block.data, 0xaa, 1000);
+  MemoryPool::release(block);
+
+  // the same thread gets its own cached block back first
+  auto again = MemoryPool::allocate(1000);
+  EXPECT_EQ(again.data, block.data);
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(again.data[i], 0);
+  }
+  MemoryPool::release(again);
+}
+
+TEST(MemoryPool, LargeAndMixedSizes) {
+  const int sizes[] = {1, 255, 256, 257, 4096, 70000, 4 * 1024 * 1024};
+  std::vector<MemBlock> blocks;
+  for (int size : sizes) {
+    auto block = MemoryPool::allocate(size);
+    memset(block.data, 1, size);
+    blocks.push_back(block);
+  }
+  for (auto &block : blocks) {
+    MemoryPool::release(block);
+  }
+  MemoryPool::destroyAll();
+}
+
+// a 1 MiB cipher block with its MAC header is still pooled
+TEST(MemoryPool, LargeBlocksPooled) {
+  const int size = (1 << 20) + 16;
+  auto block = MemoryPool::allocate(size);
+  memset(block.data, 0xaa, size);
+  MemoryPool::release(block);
+
+  auto again = MemoryPool::allocate(size);
+  EXPECT_EQ(again.data, block.data);
+  for (int i = 0; i < size; ++i) {
+    ASSERT_EQ(again.data[i], 0);
+  }
+  MemoryPool::release(again);
+}
+
+TEST(MemoryPool, Threads) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([t]() {
+      std::vector<MemBlock> held;
+      for (int i = 0; i < 2000; ++i) {
+        int size = 100 + ((i * 37 + t) % 5000);
+        auto block = MemoryPool::allocate(size);
+        memset(block.data, t, size);
+        held.push_back(block);
+        if (held.size() > 20) {
+          for (auto &b : held) {
+            MemoryPool::release(b);
+          }
+          held.clear();
+        }
+      }
+      for (auto &b : held) {
+        MemoryPool::release(b);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <vector>
+
+#include "encfs/MemoryPressure.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(MemoryPressure, ShareHalvesAndRecovers) {
+  MemoryPressure monitor;
+  std::vector<double> seen;
+  std::shared_ptr<void> watch =
+      monitor.watch([&seen](double share) { seen.push_back(share); });
+  EXPECT_EQ(monitor.share(), 1.0);
+
+  for (int i = 0; i < 6; ++i) {
+    monitor.pressure();
+  }
+  EXPECT_EQ(monitor.share(), MemoryPressure::MinShare);
+  // no news once at the floor
+  EXPECT_EQ(seen, std::vector<double>({0.5, 0.25, 0.125, 0.0625}));
+
+  seen.clear();
+  for (int i = 0; i < 6; ++i) {
+    monitor.relax();
+  }
+  EXPECT_EQ(monitor.share(), 1.0);
+  EXPECT_EQ(seen, std::vector<double>({0.125, 0.25, 0.5, 1.0}));
+
+  watch.reset();
+  monitor.pressure();
+  EXPECT_EQ(seen.size(), 4u);
+}
+
+TEST(MemoryPressure, LateWatcherLearnsShare) {
+  MemoryPressure monitor;
+  monitor.pressure();
+  double share = 1;
+  std::shared_ptr<void> watch =
+      monitor.watch([&share](double s) { share = s; });
+  EXPECT_EQ(share, 0.5);
+}
+
+TEST(MemoryPressure, Shared) {
+  std::shared_ptr<MemoryPressure> monitor = MemoryPressure::shared();
+  EXPECT_EQ(MemoryPressure::shared(), monitor);
+  // there may be no pressure information here, either way it stops cleanly
+  bool watching = monitor->start();
+  EXPECT_EQ(monitor->start(), watching);
+}
+
+}  // namespace
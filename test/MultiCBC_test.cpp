@@ -0,0 +1,100 @@
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <openssl/evp.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/CipherKey.h"
+#include "encfs/MultiCBC.h"
+
+using namespace encfs;
+
+namespace {
+
+std::vector<unsigned char> testData(size_t len) {
+  std::vector<unsigned char> data(len);
+  for (size_t i = 0; i < len; ++i) {
+    data[i] = (unsigned char)(i * 31 + (i >> 8));
+  }
+  return data;
+}
+
+const EVP_CIPHER *cbcOf(int keyLen) {
+  switch (keyLen) {
+    case 16:
+      return EVP_aes_128_cbc();
+    case 24:
+      return EVP_aes_192_cbc();
+    default:
+      return EVP_aes_256_cbc();
+  }
+}
+
+// every chain comes out as OpenSSL's CBC would have it, with any number of
+// chains and key size
+TEST(MultiCBC, MatchesOpenSSL) {
+  unsigned char key[32];
+  for (int i = 0; i < 32; ++i) {
+    key[i] = i * 7 + 1;
+  }
+  unsigned char ivs[MultiCBC::Lanes][16];
+  for (int l = 0; l < MultiCBC::Lanes; ++l) {
+    memset(ivs[l], 0x11 * l, sizeof(ivs[l]));
+  }
+
+  for (int keyLen : {16, 24, 32}) {
+    auto cbc = MultiCBC::create(key, keyLen);
+    if (!cbc) {
+      // no AES instructions here
+      return;
+    }
+    const int size = 1024;
+    for (int count = 1; count <= MultiCBC::Lanes; ++count) {
+      std::vector<unsigned char> expected = testData(size * count);
+      for (int l = 0; l < count; ++l) {
+        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+        int outLen = 0;
+        EVP_EncryptInit_ex(ctx, cbcOf(keyLen), nullptr, key, ivs[l]);
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+        unsigned char *chain = expected.data() + l * size;
+        EVP_EncryptUpdate(ctx, chain, &outLen, chain, size);
+        EVP_CIPHER_CTX_free(ctx);
+      }
+
+      std::vector<unsigned char> buf = testData(size * count);
+      cbc->encrypt(buf.data(), size, ivs, count);
+      EXPECT_TRUE(buf == expected) << keyLen << " " << count;
+    }
+  }
+}
+
+// blockEncodeMany gives what blockEncode does on each block, and decodes
+TEST(MultiCBC, SameAsBlockEncode) {
+  for (int keySize : {128, 192, 256}) {
+    auto aes = Cipher::New("AES", keySize);
+    CipherKey key = aes->newRandomKey();
+    const int size = 4096;
+    const int count = 19;
+    uint64_t ivs[count];
+    for (int i = 0; i < count; ++i) {
+      ivs[i] = (i + 100) ^ 0x123456789abcdefULL;
+    }
+
+    std::vector<unsigned char> expected = testData(size * count);
+    for (int i = 0; i < count; ++i) {
+      ASSERT_TRUE(aes->blockEncode(expected.data() + i * size, size, ivs[i],
+                                   key));
+    }
+    std::vector<unsigned char> buf = testData(size * count);
+    ASSERT_TRUE(aes->blockEncodeMany(buf.data(), size, ivs, count, key));
+    EXPECT_TRUE(buf == expected) << keySize;
+
+    for (int i = 0; i < count; ++i) {
+      ASSERT_TRUE(aes->blockDecode(buf.data() + i * size, size, ivs[i], key));
+    }
+    EXPECT_TRUE(buf == testData(size * count)) << keySize;
+  }
+}
+
+}  // namespace
@@ -0,0 +1,105 @@
+#include "benchmark/benchmark.h"
+
+#include <climits>
+#include <memory>
+#include <string>
+
+#include "encfs/BlockNameIO.h"
+#include "encfs/Cipher.h"
+#include "encfs/NameIO.h"
+#include "encfs/StreamNameIO.h"
+
+using namespace encfs;
+
+// chained IVs, as new filesystems use by default
+static std::shared_ptr<NameIO> newNameIO(bool stream, bool reverse = false) {
+  std::shared_ptr<Cipher> cipher = Cipher::New("AES", 256);
+  CipherKey key = cipher->newRandomKey();
+  std::shared_ptr<NameIO> io;
+  if (stream) {
+    io.reset(new StreamNameIO(StreamNameIO::CurrentInterface(), cipher, key));
+  } else {
+    io.reset(new BlockNameIO(BlockNameIO::CurrentInterface(), cipher, key,
+                             cipher->cipherBlockSize()));
+  }
+  // reverse volumes are made without chained IVs
+  io->setChainedNameIV(!reverse);
+  io->setReverseEncryption(reverse);
+  return io;
+}
+
+// (stream, name length)
+static void NameSizes(benchmark::internal::Benchmark* b) {
+  for (int stream : {0, 1}) {
+    for (int len : {8, 32, 128}) {
+      b->Args({stream, len});
+    }
+  }
+  b->ArgNames({"stream", "len"});
+}
+
+static std::string pathOf(int len) {
+  return "/projects/src/" + std::string(len, 'n');
+}
+
+static void BM_NameEncode(benchmark::State& state) {
+  std::shared_ptr<NameIO> io = newNameIO(state.range(0) != 0);
+  std::string path = pathOf(state.range(1));
+  char out[PATH_MAX];
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        io->encodePathInto(path.c_str(), out, sizeof(out)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NameEncode)->Apply(NameSizes);
+
+static void BM_NameDecode(benchmark::State& state) {
+  std::shared_ptr<NameIO> io = newNameIO(state.range(0) != 0);
+  std::string coded = io->encodePath(pathOf(state.range(1)).c_str());
+  char out[PATH_MAX];
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        io->decodePathInto(coded.c_str(), out, sizeof(out)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NameDecode)->Apply(NameSizes);
+
+// the std::string interface, as used by most of DirNode
+static void BM_NameEncodeString(benchmark::State& state) {
+  std::shared_ptr<NameIO> io = newNameIO(state.range(0) != 0);
+  std::string path = pathOf(state.range(1));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(io->encodePath(path.c_str()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NameEncodeString)->Apply(NameSizes);
+
+/*
+    Reverse mode, where the backing names are the plaintext: a listing
+    encrypts each name it returns (decodeName), and a lookup decrypts the
+    path asked for (encodePath).
+*/
+static void BM_ReverseNameList(benchmark::State& state) {
+  std::shared_ptr<NameIO> io = newNameIO(state.range(0) != 0, true);
+  std::string name(state.range(1), 'n');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(io->decodeName(name.c_str(), name.size()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ReverseNameList)->Apply(NameSizes);
+
+static void BM_ReverseNameLookup(benchmark::State& state) {
+  std::shared_ptr<NameIO> io = newNameIO(state.range(0) != 0, true);
+  std::string coded = io->decodePath(pathOf(state.range(1)).c_str());
+  char out[PATH_MAX];
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        io->encodePathInto(coded.c_str(), out, sizeof(out)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ReverseNameLookup)->Apply(NameSizes);
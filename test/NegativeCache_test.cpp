@@ -0,0 +1,81 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "encfs/NegativeCache.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(NegativeCache, PutContains) {
+  NegativeCache cache(10);
+  cache.put("/a/b", cache.generation());
+
+  EXPECT_TRUE(cache.contains("/a/b"));
+  EXPECT_FALSE(cache.contains("/a"));
+  EXPECT_FALSE(cache.contains("/a/b/c"));
+}
+
+TEST(NegativeCache, EvictsLeastRecentlyUsed) {
+  NegativeCache cache(3);
+  cache.put("/1", cache.generation());
+  cache.put("/2", cache.generation());
+  cache.put("/3", cache.generation());
+
+  // touch /1, so /2 is the oldest
+  EXPECT_TRUE(cache.contains("/1"));
+  cache.put("/4", cache.generation());
+
+  EXPECT_EQ(cache.size(), 3u);
+  EXPECT_TRUE(cache.contains("/1"));
+  EXPECT_FALSE(cache.contains("/2"));
+  EXPECT_TRUE(cache.contains("/4"));
+}
+
+TEST(NegativeCache, InvalidateSubtree) {
+  NegativeCache cache(10);
+  for (const char *path : {"/a", "/a/b", "/a/b/c", "/ab"}) {
+    cache.put(path, cache.generation());
+  }
+
+  cache.invalidate("/a");
+  EXPECT_FALSE(cache.contains("/a"));
+  EXPECT_FALSE(cache.contains("/a/b"));
+  EXPECT_FALSE(cache.contains("/a/b/c"));
+  EXPECT_TRUE(cache.contains("/ab"));
+}
+
+TEST(NegativeCache, StaleGeneration) {
+  NegativeCache cache(10);
+
+  // a create which raced with the lookup wins
+  uint64_t generation = cache.generation();
+  cache.invalidate("/x");
+  cache.put("/x", generation);
+  EXPECT_FALSE(cache.contains("/x"));
+
+  cache.put("/x", cache.generation());
+  EXPECT_TRUE(cache.contains("/x"));
+}
+
+TEST(NegativeCache, Expires) {
+  NegativeCache cache(10);
+  cache.put("/x", cache.generation());
+  EXPECT_TRUE(cache.contains("/x"));
+
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(NegativeCache::Timeout * 1000 + 50));
+  EXPECT_FALSE(cache.contains("/x"));
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(NegativeCache, Disabled) {
+  NegativeCache cache(0);
+  cache.put("/x", cache.generation());
+  EXPECT_FALSE(cache.contains("/x"));
+}
+
+}  // namespace
@@ -0,0 +1,184 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/BlockNameIO.h"
+#include "encfs/Cipher.h"
+#include "encfs/Context.h"
+#include "encfs/DirNode.h"
+#include "encfs/FSConfig.h"
+#include "encfs/FileUtils.h"
+#include "encfs/OpRecorder.h"
+#include "encfs/OpReplay.h"
+#include "encfs/Stats.h"
+
+using namespace encfs;
+
+namespace {
+
+class OpRecorderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = root;
+    tracePath = rootDir + "/trace";
+    replayDir = rootDir + "/replay";
+    ASSERT_EQ(mkdir(replayDir.c_str(), 0700), 0);
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  // what a mount would record for a small workload
+  void recordWorkload() {
+    OpRecorder recorder(tracePath);
+    ASSERT_TRUE(recorder.valid());
+    uint64_t t = Stats::now();
+    recorder.record(OpRecorder::GetAttr, "/", nullptr, 0, 0, 0, t);
+    recorder.record(OpRecorder::MkDir, "/src", nullptr, 0, 0, 0, t);
+    recorder.record(OpRecorder::Create, "/src/new", nullptr, 0, 0, 0, t);
+    recorder.record(OpRecorder::Write, "/src/new", nullptr, 0, 5000, 5000, t);
+    recorder.record(OpRecorder::Release, "/src/new", nullptr, 0, 0, 0, t);
+    // there before the trace began
+    recorder.record(OpRecorder::Open, "/data/old", nullptr, 0, 0, 0, t);
+    recorder.record(OpRecorder::Read, "/data/old", nullptr, 8192, 4096, 4096,
+                    t);
+    recorder.record(OpRecorder::Release, "/data/old", nullptr, 0, 0, 0, t);
+    recorder.record(OpRecorder::Rename, "/src/new", "/data/moved", 0, 0, 0, t);
+    recorder.record(OpRecorder::ReadDir, "/data", nullptr, 0, 0, 0, t);
+    recorder.record(OpRecorder::Unlink, "/data/old", nullptr, 0, 0, 0, t);
+    EXPECT_TRUE(recorder.close());
+  }
+
+  std::string rootDir;
+  std::string tracePath;
+  std::string replayDir;
+};
+
+TEST_F(OpRecorderTest, RecordsAnonymously) {
+  recordWorkload();
+
+  std::vector<OpRecorder::Record> records;
+  ASSERT_TRUE(OpRecorder::read(tracePath, &records));
+  ASSERT_EQ(records.size(), 11u);
+  EXPECT_EQ(records[0].op, OpRecorder::GetAttr);
+  // the root is its own directory
+  EXPECT_EQ(records[0].name, records[0].parent);
+  // a path, and the directory of the paths in it
+  EXPECT_EQ(records[1].parent, records[0].name);
+  EXPECT_EQ(records[2].parent, records[1].name);
+  EXPECT_EQ(records[3].name, records[2].name);
+  EXPECT_EQ(records[3].size, 5000u);
+  EXPECT_EQ(records[6].offset, 8192u);
+  EXPECT_EQ(records[6].result, 4096);
+  EXPECT_NE(records[0].thread, 0);
+  // the new path of a rename, in its directory
+  EXPECT_EQ(records[8].name, records[2].name);
+  EXPECT_EQ(records[8].parent, records[5].parent);
+  EXPECT_NE(records[8].offset, records[5].name);
+  EXPECT_STREQ(OpRecorder::opName(records[8].op), "rename");
+
+  std::string raw;
+  FILE *f = fopen(tracePath.c_str(), "rb");
+  ASSERT_NE(f, nullptr);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    raw.append(buf, n);
+  }
+  fclose(f);
+  EXPECT_EQ(raw.find("src"), std::string::npos);
+  EXPECT_EQ(raw.find("data"), std::string::npos);
+
+  // a partial record is left out
+  ASSERT_EQ(truncate(tracePath.c_str(), raw.size() - 10), 0);
+  ASSERT_TRUE(OpRecorder::read(tracePath, &records));
+  EXPECT_EQ(records.size(), 10u);
+
+  // under a new key, the same path hashes differently
+  recordWorkload();
+  std::vector<OpRecorder::Record> again;
+  ASSERT_TRUE(OpRecorder::read(tracePath, &again));
+  EXPECT_NE(again[0].name, records[0].name);
+}
+
+TEST_F(OpRecorderTest, ReplaysInDirectory) {
+  recordWorkload();
+  std::vector<OpRecorder::Record> records;
+  ASSERT_TRUE(OpRecorder::read(tracePath, &records));
+
+  std::unique_ptr<ReplayTarget> target = ReplayTarget::directory(replayDir);
+  OpReplay replay(records, target.get());
+  ASSERT_EQ(replay.prepare(), 0);
+
+  // the file read by the trace is there, as large as the read needs
+  const OpRecorder::Record &read = records[6];
+  struct stat st;
+  std::string old = replayDir + replay.pathOf(read.name, read.parent);
+  ASSERT_EQ(stat(old.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, 8192 + 4096);
+  // the one created by the trace isn't
+  const OpRecorder::Record &create = records[2];
+  std::string created = replayDir + replay.pathOf(create.name, create.parent);
+  EXPECT_NE(stat(created.c_str(), &st), 0);
+
+  replay.run(true);
+  EXPECT_EQ(replay.threads(), 1u);
+  for (int op = 1; op < OpRecorder::OpCount; ++op) {
+    EXPECT_EQ(replay.stats(op).failed, 0u) << OpRecorder::opName(op);
+  }
+  EXPECT_EQ(replay.stats(OpRecorder::Release).calls, 2u);
+  EXPECT_EQ(replay.stats(OpRecorder::Write).calls, 1u);
+
+  // renamed into place, and the old file gone
+  const OpRecorder::Record &rename = records[8];
+  std::string moved = replayDir + replay.pathOf(rename.offset, rename.parent);
+  ASSERT_EQ(stat(moved.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, 5000);
+  EXPECT_NE(stat(created.c_str(), &st), 0);
+  EXPECT_NE(stat(old.c_str(), &st), 0);
+}
+
+TEST_F(OpRecorderTest, ReplaysInVolume) {
+  recordWorkload();
+  std::vector<OpRecorder::Record> records;
+  ASSERT_TRUE(OpRecorder::read(tracePath, &records));
+
+  FSConfigPtr cfg(new FSConfig);
+  cfg->cipher = Cipher::New("AES", 256);
+  cfg->key = cfg->cipher->newRandomKey();
+  cfg->config.reset(new EncFSConfig);
+  cfg->config->blockSize = 1024;
+  cfg->opts.reset(new EncFS_Opts);
+  cfg->nameCoding.reset(new BlockNameIO(BlockNameIO::CurrentInterface(),
+                                        cfg->cipher, cfg->key,
+                                        cfg->cipher->cipherBlockSize()));
+  EncFS_Context ctx;
+  auto root = std::make_shared<DirNode>(&ctx, replayDir + "/", cfg);
+
+  std::unique_ptr<ReplayTarget> target = ReplayTarget::volume(root);
+  OpReplay replay(records, target.get());
+  ASSERT_EQ(replay.prepare(), 0);
+  replay.run(true);
+  for (int op = 1; op < OpRecorder::OpCount; ++op) {
+    EXPECT_EQ(replay.stats(op).failed, 0u) << OpRecorder::opName(op);
+  }
+
+  const OpRecorder::Record &rename = records[8];
+  struct stat st;
+  ASSERT_EQ(root->getAttr(replay.pathOf(rename.offset, rename.parent).c_str(),
+                          &st),
+            0);
+  EXPECT_EQ(st.st_size, 5000);
+}
+
+}  // namespace
@@ -0,0 +1,171 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "encfs/PathCache.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(PathCache, PutGet) {
+  PathCache cache(10);
+  cache.put("/a/b", "X/Y", 42);
+
+  std::string coded;
+  uint64_t iv = 0;
+  ASSERT_TRUE(cache.get("/a/b", &coded, &iv));
+  EXPECT_EQ(coded, "X/Y");
+  EXPECT_EQ(iv, 42u);
+  EXPECT_FALSE(cache.get("/a", &coded, &iv));
+}
+
+TEST(PathCache, EvictsLeastRecentlyUsed) {
+  PathCache cache(3);
+  cache.put("/1", "1", 0);
+  cache.put("/2", "2", 0);
+  cache.put("/3", "3", 0);
+
+  std::string coded;
+  // touch /1, so /2 is the oldest
+  EXPECT_TRUE(cache.get("/1", &coded, nullptr));
+  cache.put("/4", "4", 0);
+
+  EXPECT_EQ(cache.size(), 3u);
+  EXPECT_TRUE(cache.get("/1", &coded, nullptr));
+  EXPECT_FALSE(cache.get("/2", &coded, nullptr));
+  EXPECT_TRUE(cache.get("/4", &coded, nullptr));
+}
+
+TEST(PathCache, InvalidateSubtree) {
+  PathCache cache(10);
+  cache.put("/a", "A", 0);
+  cache.put("/a/b", "A/B", 0);
+  cache.put("/a/b/c", "A/B/C", 0);
+  cache.put("/ab", "AB", 0);
+
+  cache.invalidate("/a");
+
+  std::string coded;
+  EXPECT_FALSE(cache.get("/a", &coded, nullptr));
+  EXPECT_FALSE(cache.get("/a/b", &coded, nullptr));
+  EXPECT_FALSE(cache.get("/a/b/c", &coded, nullptr));
+  EXPECT_TRUE(cache.get("/ab", &coded, nullptr));
+
+  cache.invalidate("/");
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(PathCache, Disabled) {
+  PathCache cache(0);
+  cache.put("/a", "A", 0);
+
+  std::string coded;
+  EXPECT_FALSE(cache.get("/a", &coded, nullptr));
+}
+
+TEST(PathCache, Limit) {
+  PathCache cache(4);
+  for (int i = 0; i < 4; ++i) {
+    cache.put("/" + std::to_string(i), "c", 0);
+  }
+  cache.setLimit(2);
+  EXPECT_EQ(cache.size(), 2u);
+  std::string coded;
+  EXPECT_FALSE(cache.get("/1", &coded, nullptr));
+  EXPECT_TRUE(cache.get("/3", &coded, nullptr));
+  cache.put("/4", "c", 0);
+  EXPECT_EQ(cache.size(), 2u);
+
+  // grown beyond what it was made with
+  cache.setLimit(8);
+  for (int i = 0; i < 10; ++i) {
+    cache.put("/" + std::to_string(i), "c", 0);
+  }
+  EXPECT_EQ(cache.size(), 8u);
+  EXPECT_EQ(cache.capacity(), 4u);
+}
+
+TEST(PathCache, RecentCoded) {
+  PathCache cache(8);
+  cache.put("/a", "A", 0);
+  cache.put("/b", "B", 0);
+  cache.put("/c", "C", 0);
+  std::string coded;
+  ASSERT_TRUE(cache.get("/a", &coded, nullptr));
+
+  EXPECT_EQ(cache.recentCoded(8), std::vector<std::string>({"A", "C", "B"}));
+  EXPECT_EQ(cache.recentCoded(2), std::vector<std::string>({"A", "C"}));
+}
+
+TEST(PathCache, SharesComponents) {
+  PathCache cache(100);
+  cache.put("/a", "A", 1);
+  cache.put("/a/b", "A/B", 2);
+  for (int i = 0; i < 10; ++i) {
+    std::string n = std::to_string(i);
+    cache.put("/a/b/" + n, "A/B/C" + n, 3);
+  }
+  // "", a, b and the ten names
+  EXPECT_EQ(cache.size(), 12u);
+  EXPECT_EQ(cache.nodes(), 13u);
+
+  std::string coded;
+  uint64_t iv = 0;
+  ASSERT_TRUE(cache.get("/a/b/7", &coded, &iv));
+  EXPECT_EQ(coded, "A/B/C7");
+  EXPECT_EQ(iv, 3u);
+  char buf[7];
+  EXPECT_EQ(cache.get("/a/b/7", buf, sizeof(buf), nullptr), 6);
+  EXPECT_STREQ(buf, "A/B/C7");
+  EXPECT_EQ(cache.get("/a/b/7", buf, 6, nullptr), -1);
+
+  // a parent recoded under its children
+  cache.put("/a/b", "A/Z", 4);
+  ASSERT_TRUE(cache.get("/a/b/7", &coded, nullptr));
+  EXPECT_EQ(coded, "A/B/C7");
+  ASSERT_TRUE(cache.get("/a/b", &coded, nullptr));
+  EXPECT_EQ(coded, "A/Z");
+  cache.put("/a/b", "A/B", 2);
+
+  // not coded below its parent
+  cache.put("/a/x", "Q", 5);
+  ASSERT_TRUE(cache.get("/a/x", &coded, nullptr));
+  EXPECT_EQ(coded, "Q");
+
+  cache.invalidate("/a/b/");
+  EXPECT_TRUE(cache.get("/a/b", &coded, nullptr));
+  EXPECT_FALSE(cache.get("/a/b/7", &coded, nullptr));
+  EXPECT_EQ(cache.size(), 3u);
+  EXPECT_EQ(cache.nodes(), 4u);
+
+  cache.clear();
+  EXPECT_EQ(cache.nodes(), 0u);
+}
+
+TEST(PathCache, KeepsEvictedParents) {
+  PathCache cache(3);
+  cache.put("/a", "A", 0);
+  cache.put("/a/b", "A/B", 0);
+  cache.put("/a/b/c", "A/B/C", 0);
+  cache.put("/d", "D", 0);
+
+  // /a is gone, but still holds the start of the others
+  std::string coded;
+  EXPECT_FALSE(cache.get("/a", &coded, nullptr));
+  ASSERT_TRUE(cache.get("/a/b/c", &coded, nullptr));
+  EXPECT_EQ(coded, "A/B/C");
+  EXPECT_EQ(cache.size(), 3u);
+
+  // and goes once nothing below it is left
+  cache.setLimit(1);
+  ASSERT_TRUE(cache.get("/a/b/c", &coded, nullptr));
+  EXPECT_EQ(coded, "A/B/C");
+  cache.put("/e", "E", 0);
+  EXPECT_EQ(cache.size(), 1u);
+  EXPECT_EQ(cache.nodes(), 2u);
+  EXPECT_EQ(cache.recentCoded(4), std::vector<std::string>({"E"}));
+}
+
+}  // namespace
@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include "encfs/FileUtils.h"
+#include "encfs/Policies.h"
+
+using namespace encfs;
+
+namespace {
+
+class PoliciesTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char name[] = "/tmp/encfstestXXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    file = name;
+    opts.readAheadSize = 1024;
+    opts.streamSize = -1;
+    opts.keepCacheSize = 4096;
+  }
+
+  void TearDown() override { unlink(file.c_str()); }
+
+  void write(const std::string &text) {
+    FILE *f = fopen(file.c_str(), "w");
+    ASSERT_NE(f, nullptr);
+    fputs(text.c_str(), f);
+    fclose(f);
+  }
+
+  std::string file;
+  EncFS_Opts opts;
+};
+
+TEST_F(PoliciesTest, SubtreesOverrideMount) {
+  write(
+      "# media streams\n"
+      "/media  stream=0 readahead=8192 dropbehind=1\n"
+      "\n"
+      "/media/small/  stream=-1\n"
+      "/db keepcache=0 readahead=0 directio=1\n"
+      "/build attrtimeout=30 writeback=512 writebehind=16\n");
+  Policies policies(file);
+  ASSERT_EQ(policies.load(), 0);
+  EXPECT_EQ(policies.size(), 4u);
+
+  Policies::Policy p = policies.lookup("/media/film.mkv", opts);
+  EXPECT_EQ(p.streamSize, 0);
+  EXPECT_EQ(p.readAhead, 8192);
+  EXPECT_TRUE(p.dropBehind);
+  EXPECT_TRUE(p.keepCache);
+  EXPECT_EQ(p.attrTimeout, -1);
+
+  // a subtree in a subtree takes what it doesn't set from the outer one
+  p = policies.lookup("/media/small/a", opts);
+  EXPECT_EQ(p.streamSize, -1);
+  EXPECT_EQ(p.readAhead, 8192);
+
+  p = policies.lookup("/db", opts);
+  EXPECT_FALSE(p.keepCache);
+  EXPECT_EQ(p.readAhead, 0);
+  EXPECT_TRUE(p.directIO);
+
+  p = policies.lookup("/build/obj/x.o", opts);
+  EXPECT_EQ(p.attrTimeout, 30);
+  EXPECT_EQ(p.writeBack, 512);
+  EXPECT_EQ(p.writeBehind, 16);
+
+  // only whole names match, and the rest is as mounted
+  p = policies.lookup("/mediafiles/a", opts);
+  EXPECT_EQ(p.streamSize, -1);
+  EXPECT_EQ(p.readAhead, 1024);
+  EXPECT_FALSE(p.dropBehind);
+  EXPECT_FALSE(p.directIO);
+  EXPECT_EQ(p.writeBack, opts.writeBackSize);
+
+  Policies::Policy none = Policies::of(nullptr, "/media/a", opts);
+  EXPECT_EQ(none.readAhead, 1024);
+  EXPECT_EQ(none.attrTimeout, -1);
+}
+
+TEST_F(PoliciesTest, ReloadKeepsOldOnError) {
+  write("/ readahead=64\n");
+  Policies policies(file);
+  ASSERT_EQ(policies.load(), 0);
+  EXPECT_EQ(policies.lookup("/a", opts).readAhead, 64);
+
+  for (const char *bad :
+       {"media stream=0\n", "/media stream\n", "/media stream=x\n",
+        "/media nosuch=1\n", "/media directio=2\n", "/media stream=-2\n"}) {
+    write(bad);
+    EXPECT_EQ(policies.load(), -EINVAL) << bad;
+    EXPECT_EQ(policies.lookup("/a", opts).readAhead, 64) << bad;
+  }
+
+  write("/a readahead=128\n");
+  ASSERT_EQ(policies.load(), 0);
+  EXPECT_EQ(policies.lookup("/a/b", opts).readAhead, 128);
+  EXPECT_EQ(policies.lookup("/b", opts).readAhead, 1024);
+
+  unlink(file.c_str());
+  EXPECT_EQ(policies.load(), -ENOENT);
+  EXPECT_EQ(policies.lookup("/a/b", opts).readAhead, 128);
+}
+
+}  // namespace
@@ -0,0 +1,110 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "encfs/RangeLock.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(RangeLock, SharedRangesOverlap) {
+  RangeLockManager manager;
+  std::atomic<int> inside(0);
+  std::atomic<int> maxInside(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      RangeLock lock(manager, 0, 10, false);
+      int now = ++inside;
+      while (maxInside < 4 && now > maxInside) {
+        maxInside = now;
+      }
+      // wait until all readers are inside at once
+      while (maxInside < 4) {
+        std::this_thread::yield();
+      }
+      --inside;
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(maxInside, 4);
+}
+
+TEST(RangeLock, DisjointExclusiveRangesOverlap) {
+  RangeLockManager manager;
+  std::atomic<int> inside(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      RangeLock lock(manager, t * 10, t * 10 + 9, true);
+      ++inside;
+      while (inside < 4) {
+        std::this_thread::yield();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(inside, 4);
+}
+
+TEST(RangeLock, OverlappingExclusiveRangesSerialize) {
+  RangeLockManager manager;
+  std::atomic<int> inside(0);
+  std::atomic<int> collisions(0);
+  long counter = 0;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 2000; ++i) {
+        // every range overlaps block 5, some cover the whole file
+        if (i % 10 == 0) {
+          RangeLock lock(manager, true);
+          collisions += (++inside != 1);
+          ++counter;
+          --inside;
+        } else {
+          RangeLock lock(manager, t, 5 + t, true);
+          collisions += (++inside != 1);
+          ++counter;
+          --inside;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(collisions, 0);
+  EXPECT_EQ(counter, 4 * 2000);
+}
+
+TEST(RangeLock, ExclusiveExcludesShared) {
+  RangeLockManager manager;
+  std::atomic<bool> readerDone(false);
+
+  std::thread reader;
+  {
+    RangeLock lock(manager, 0, 3, true);
+    reader = std::thread([&]() {
+      RangeLock shared(manager, 3, 8, false);
+      readerDone = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(readerDone);
+  }
+  reader.join();
+  EXPECT_TRUE(readerDone);
+}
+
+}  // namespace
@@ -0,0 +1,39 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "encfs/SipHash.h"
+
+using namespace encfs;
+
+namespace {
+
+// key 00 01 .. 0f, and messages 00 01 .. of each length, from the reference
+// implementation
+TEST(SipHashTest, TestVectors) {
+  unsigned char key[16];
+  for (int i = 0; i < 16; ++i) {
+    key[i] = i;
+  }
+  std::vector<unsigned char> msg;
+  for (int i = 0; i < 64; ++i) {
+    msg.push_back(i);
+  }
+
+  EXPECT_EQ(SipHash24(key, msg.data(), 0), 0x726fdb47dd0e0e31ULL);
+  EXPECT_EQ(SipHash24(key, msg.data(), 1), 0x74f839c593dc67fdULL);
+  EXPECT_EQ(SipHash24(key, msg.data(), 7), 0xab0200f58b01d137ULL);
+  EXPECT_EQ(SipHash24(key, msg.data(), 8), 0x93f5f5799a932462ULL);
+  EXPECT_EQ(SipHash24(key, msg.data(), 15), 0xa129ca6149be45e5ULL);
+  EXPECT_EQ(SipHash24(key, msg.data(), 63), 0x958a324ceb064572ULL);
+}
+
+TEST(SipHashTest, KeyMatters) {
+  unsigned char key[16] = {};
+  const unsigned char msg[] = "block";
+  uint64_t a = SipHash24(key, msg, 5);
+  key[15] = 1;
+  EXPECT_NE(SipHash24(key, msg, 5), a);
+}
+
+}  // namespace
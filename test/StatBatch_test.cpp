@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/StatBatch.h"
+
+using namespace encfs;
+
+namespace {
+
+class StatBatchTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    dir = root;
+    // more than a ring holds at once
+    for (int i = 0; i < 70; ++i) {
+      names.push_back("f" + std::to_string(i));
+      std::string path = dir + "/" + names.back();
+      int fd = ::open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(::write(fd, path.data(), i), i);
+      ::close(fd);
+    }
+    names.push_back("link");
+    ASSERT_EQ(symlink("f1", (dir + "/link").c_str()), 0);
+    names.push_back("missing");
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + dir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::string dir;
+  std::vector<std::string> names;
+};
+
+TEST_P(StatBatchTest, MatchesLstat) {
+  int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  ASSERT_GE(dirFd, 0);
+
+  std::vector<struct stat> stats(names.size());
+  std::vector<int> results(names.size(), 1);
+  StatBatch batch(GetParam());
+  for (size_t i = 0; i < names.size(); ++i) {
+    batch.stat(dirFd, names[i].c_str(), &stats[i], &results[i]);
+  }
+  // and an absolute name
+  std::string absolute = dir + "/f3";
+  struct stat absStat;
+  int absResult = 1;
+  batch.stat(AT_FDCWD, absolute.c_str(), &absStat, &absResult, true);
+  EXPECT_EQ(batch.size(), names.size() + 1);
+  batch.run();
+  EXPECT_EQ(batch.size(), 0u);
+  ::close(dirFd);
+
+  for (size_t i = 0; i + 1 < names.size(); ++i) {
+    struct stat st;
+    ASSERT_EQ(lstat((dir + "/" + names[i]).c_str(), &st), 0);
+    ASSERT_EQ(results[i], 0) << names[i];
+    EXPECT_EQ(stats[i].st_ino, st.st_ino);
+    EXPECT_EQ(stats[i].st_mode, st.st_mode);
+    EXPECT_EQ(stats[i].st_size, st.st_size);
+    EXPECT_EQ(stats[i].st_mtim.tv_nsec, st.st_mtim.tv_nsec);
+  }
+  EXPECT_TRUE(S_ISLNK(stats[names.size() - 2].st_mode));
+  EXPECT_EQ(results.back(), -ENOENT);
+  EXPECT_EQ(absResult, 0);
+  EXPECT_EQ(absStat.st_size, 3);
+}
+
+INSTANTIATE_TEST_CASE_P(StatBatch, StatBatchTest, ::testing::Bool());
+
+}  // namespace
@@ -0,0 +1,51 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "encfs/StatfsCache.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(StatfsCache, AdjustsNameLength) {
+  struct statvfs raw;
+  ASSERT_EQ(statvfs("/tmp", &raw), 0);
+
+  StatfsCache cache("/tmp", 1000);
+  struct statvfs st;
+  ASSERT_EQ(cache.get(&st), 0);
+  EXPECT_EQ(st.f_namemax, 6 * (raw.f_namemax - 2) / 8);
+  EXPECT_EQ(st.f_blocks, raw.f_blocks);
+}
+
+TEST(StatfsCache, ServedUntilRefreshed) {
+  char dir[] = "/tmp/encfstestXXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+
+  StatfsCache cache(dir, 3600 * 1000);
+  struct statvfs st;
+  ASSERT_EQ(cache.get(&st), 0);
+  ASSERT_EQ(rmdir(dir), 0);
+  EXPECT_EQ(cache.get(&st), 0);  // still fresh
+
+  // an expired result is still served while the refresh runs
+  StatfsCache expiring(dir, 0);
+  EXPECT_EQ(expiring.get(&st), -ENOENT);
+  ASSERT_EQ(mkdir(dir, 0700), 0);
+  int res = -ENOENT;
+  for (int i = 0; i < 200 && res != 0; ++i) {
+    res = expiring.get(&st);
+    if (res != 0) {
+      usleep(10000);
+    }
+  }
+  EXPECT_EQ(res, 0);
+  rmdir(dir);
+}
+
+}  // namespace
@@ -0,0 +1,216 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encfs/Mutex.h"
+#include "encfs/Stats.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(Stats, BucketsCoverTheirLimits) {
+  EXPECT_EQ(Stats::bucket(0), 0);
+  EXPECT_EQ(Stats::bucket(63), 0);
+  uint64_t last = 0;
+  for (int b = 0; b + 1 < Stats::BucketCount; ++b) {
+    uint64_t limit = Stats::bucketLimit(b);
+    ASSERT_GT(limit, last);
+    EXPECT_EQ(Stats::bucket(limit - 1), b) << limit;
+    EXPECT_EQ(Stats::bucket(limit), b + 1) << limit;
+    // at most sqrt(2) between limits, past the first doubling
+    if (b > 2) {
+      EXPECT_LE(limit * 2, last * 3) << b;
+    }
+    last = limit;
+  }
+  EXPECT_EQ(Stats::bucket(UINT64_MAX), Stats::BucketCount - 1);
+}
+
+TEST(Stats, TimerOnlyWhenEnabled) {
+  Stats::reset();
+  Stats::setEnabled(false);
+  { Stats::Timer t(Stats::Read); }
+  EXPECT_EQ(Stats::count(Stats::Read), 0u);
+
+  Stats::setEnabled(true);
+  { Stats::Timer t(Stats::Read); }
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::count(Stats::Read), 1u);
+}
+
+TEST(Stats, LockSitesCountContention) {
+  Stats::reset();
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  { Lock lock(mutex, Stats::DirNodeLock); }
+  EXPECT_EQ(Stats::count(Stats::DirNodeHold), 0u);
+
+  Stats::setEnabled(true);
+  { Lock lock(mutex, Stats::DirNodeLock); }
+  pthread_mutex_lock(&mutex);
+  std::thread other([&]() { Lock wait(mutex, Stats::DirNodeLock); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  pthread_mutex_unlock(&mutex);
+  other.join();
+  Stats::setEnabled(false);
+  // one hold per acquisition, one wait per contended one
+  EXPECT_EQ(Stats::count(Stats::DirNodeHold), 2u);
+  EXPECT_EQ(Stats::count(Stats::DirNodeLock), 1u);
+  EXPECT_NE(Stats::report().find(
+                "encfs_lock_hold_seconds_count{lock=\"dirnode\"} 2\n"),
+            std::string::npos);
+  Stats::reset();
+}
+
+TEST(Stats, ConcurrentRecords) {
+  Stats::reset();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < 10000; ++i) {
+        Stats::record(Stats::BlockDecode, (uint64_t)(t + 1) * i);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(Stats::count(Stats::BlockDecode), 40000u);
+}
+
+TEST(Stats, PrometheusReport) {
+  Stats::reset();
+  Stats::record(Stats::Getattr, 1000);       // 1us
+  Stats::record(Stats::Getattr, 3000000);    // 3ms
+  Stats::record(Stats::ContextLock, 100);
+
+  std::string report = Stats::report();
+  EXPECT_NE(report.find("# TYPE encfs_fuse_op_seconds histogram\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("encfs_fuse_op_seconds_count{op=\"getattr\"} 2\n"),
+            std::string::npos);
+  EXPECT_NE(
+      report.find("encfs_fuse_op_seconds_bucket{op=\"getattr\",le=\"+Inf\"} 2"),
+      std::string::npos);
+  EXPECT_NE(report.find("encfs_fuse_op_seconds_sum{op=\"getattr\"} 0.003001"),
+            std::string::npos);
+  EXPECT_NE(report.find("encfs_lock_wait_seconds_count{lock=\"context\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("encfs_internal_op_seconds_count{op=\"pread\"} 0\n"),
+            std::string::npos);
+
+  // cumulative: one sample up to 1.5us, both by 4ms
+  EXPECT_NE(report.find("{op=\"getattr\",le=\"1.536e-06\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("{op=\"getattr\",le=\"0.004194304\"} 2\n"),
+            std::string::npos);
+  Stats::reset();
+}
+
+TEST(Stats, SlowCallsBrokenDown) {
+  Stats::reset();
+  Stats::setEnabled(false);
+  {
+    // off: nothing is traced
+    Stats::Trace trace("open");
+    EXPECT_FALSE(Stats::tracing());
+    EXPECT_EQ(trace.finish(), "");
+  }
+
+  Stats::setSlowThreshold(5 * 1000000);
+  {
+    Stats::Trace fast("getattr");
+    EXPECT_TRUE(Stats::tracing());
+    EXPECT_EQ(fast.finish(), "");
+  }
+  std::string entry;
+  {
+    Stats::Trace trace("open");
+    Stats::Trace nested("read");  // part of the outer call
+    Stats::Trace::setName("CIPHERNAME");
+    Stats::Trace::setName("OTHER");
+    {
+      Stats::Timer t(Stats::NameEncode);
+      std::this_thread::sleep_for(std::chrono::milliseconds(6));
+    }
+    EXPECT_EQ(nested.finish(), "");
+    entry = trace.finish();
+  }
+  Stats::setSlowThreshold(0);
+  EXPECT_FALSE(Stats::tracing());
+
+  EXPECT_EQ(entry.find("open "), 0u) << entry;
+  EXPECT_NE(entry.find(" CIPHERNAME name_encode="), std::string::npos) << entry;
+  EXPECT_NE(entry.find(" other="), std::string::npos) << entry;
+  EXPECT_EQ(entry.find("OTHER"), std::string::npos) << entry;
+  // histograms stay off
+  EXPECT_EQ(Stats::count(Stats::NameEncode), 0u);
+
+  std::string report = Stats::slowReport();
+  EXPECT_NE(report.find(entry + "\n"), std::string::npos) << report;
+  EXPECT_NE(Stats::report().find("# slow "), std::string::npos);
+  Stats::reset();
+  EXPECT_EQ(Stats::slowReport(), "");
+}
+
+TEST(Stats, CountersFollowTheCall) {
+  Stats::reset();
+  Stats::setEnabled(false);
+  Stats::add(Stats::BackingBytesRead, 100);
+  EXPECT_EQ(Stats::value(Stats::BackingBytesRead), 0u);
+
+  // counted for a sampled call, without --stats
+  {
+    Stats::Trace trace("read", true);
+    Stats::add(Stats::BackingBytesRead, 4096);
+    Stats::add(Stats::HeaderReads);
+    trace.finish();
+    EXPECT_EQ(trace.counted(Stats::BackingBytesRead), 4096u);
+    EXPECT_EQ(trace.counted(Stats::HeaderReads), 1u);
+    EXPECT_EQ(trace.counted(Stats::BackingBytesWritten), 0u);
+  }
+  EXPECT_EQ(Stats::value(Stats::BackingBytesRead), 0u);
+
+  Stats::setEnabled(true);
+  {
+    Stats::Trace trace("write", true);
+    Stats::add(Stats::BackingBytesWritten, 10);
+    trace.finish();
+    EXPECT_EQ(trace.counted(Stats::BackingBytesWritten), 10u);
+    EXPECT_EQ(trace.counted(Stats::BackingBytesRead), 0u);
+  }
+  Stats::add(Stats::BackingBytesWritten, 5);
+  Stats::setEnabled(false);
+  EXPECT_EQ(Stats::value(Stats::BackingBytesWritten), 15u);
+  Stats::reset();
+}
+
+TEST(Stats, PhasesLeaveOutNestedPhases) {
+  {
+    Stats::PhaseTimer password(Stats::Password);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    {
+      Stats::PhaseTimer derive(Stats::DeriveKey);
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+  // kept without --stats
+  EXPECT_GE(Stats::phase(Stats::DeriveKey), 50000000u);
+  EXPECT_GE(Stats::phase(Stats::Password), 5000000u);
+  EXPECT_LT(Stats::phase(Stats::Password), 50000000u);
+
+  Stats::recordPhase(Stats::FuseSetup, 1500000);
+  Stats::reset();
+  EXPECT_EQ(Stats::phase(Stats::FuseSetup), 1500000u);
+  std::string report = Stats::report();
+  EXPECT_NE(report.find("encfs_startup_phase_seconds{phase=\"fuse_setup\"} "
+                        "0.001500000\n"),
+            std::string::npos);
+  EXPECT_STREQ(Stats::phaseName(Stats::ReadConfig), "read_config");
+}
+
+}  // namespace
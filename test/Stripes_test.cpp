@@ -0,0 +1,125 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Stripes.h"
+
+using namespace encfs;
+
+namespace {
+
+class StripesTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (int i = 0; i < 3; ++i) {
+      char root[] = "/tmp/encfstestXXXXXX";
+      ASSERT_NE(mkdtemp(root), nullptr);
+      roots.push_back(std::string(root) + "/");
+    }
+  }
+
+  void TearDown() override {
+    for (const std::string &root : roots) {
+      std::string cmd = "rm -rf " + root;
+      ASSERT_EQ(system(cmd.c_str()), 0);
+    }
+  }
+
+  static bool exists(const std::string &path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+  }
+
+  static void touch(const std::string &path) {
+    int fd = ::open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+    ASSERT_GE(fd, 0);
+    close(fd);
+  }
+
+  std::vector<std::string> roots;
+};
+
+TEST_F(StripesTest, NewLayoutCopiesDirectories) {
+  ASSERT_EQ(mkdir((roots[0] + "a").c_str(), 0755), 0);
+  ASSERT_EQ(mkdir((roots[0] + "a/b").c_str(), 0755), 0);
+  touch(roots[0] + "a/file");
+  touch(roots[0] + ".encfs6.xml");
+
+  std::string error;
+  auto stripes = Stripes::open(roots, &error);
+  ASSERT_TRUE(stripes != nullptr) << error;
+  EXPECT_EQ(stripes->count(), 3u);
+  for (size_t i = 1; i < roots.size(); ++i) {
+    EXPECT_TRUE(exists(roots[i] + "a/b"));
+    EXPECT_FALSE(exists(roots[i] + "a/file"));
+    EXPECT_FALSE(exists(roots[i] + ".encfs6.xml"));
+  }
+  EXPECT_EQ(Stripes::countOf(roots[0]), 3u);
+  EXPECT_EQ(Stripes::countOf(roots[2]), 3u);
+
+  // mounted again
+  EXPECT_TRUE(Stripes::open(roots, &error) != nullptr) << error;
+}
+
+TEST_F(StripesTest, MarkersMustMatch) {
+  std::string error;
+  ASSERT_TRUE(Stripes::open(roots, &error) != nullptr) << error;
+
+  // left out
+  std::vector<std::string> two(roots.begin(), roots.begin() + 2);
+  EXPECT_TRUE(Stripes::open(two, &error) == nullptr);
+  EXPECT_FALSE(error.empty());
+
+  // in another order
+  std::vector<std::string> swapped = {roots[0], roots[2], roots[1]};
+  EXPECT_TRUE(Stripes::open(swapped, &error) == nullptr);
+
+  // no marker
+  EXPECT_EQ(Stripes::countOf("/nonexistent/"), 1u);
+}
+
+TEST_F(StripesTest, OthersMustBeEmpty) {
+  touch(roots[1] + "stray");
+  std::string error;
+  EXPECT_TRUE(Stripes::open(roots, &error) == nullptr);
+  EXPECT_FALSE(exists(roots[0] + Stripes::FileName));
+
+  std::vector<std::string> nested = {roots[0], roots[0] + "sub/"};
+  EXPECT_TRUE(Stripes::open(nested, &error) == nullptr);
+}
+
+TEST_F(StripesTest, LocateProbesOtherRoots) {
+  Stripes stripes(roots);
+  EXPECT_EQ(stripes.home(""), 0u);
+
+  // names spread over all roots
+  std::vector<int> used(roots.size());
+  for (int i = 0; i < 100; ++i) {
+    size_t home = stripes.home("dir/name" + std::to_string(i));
+    ASSERT_LT(home, roots.size());
+    ++used[home];
+    // only the last component counts
+    EXPECT_EQ(home, stripes.home("other/name" + std::to_string(i)));
+  }
+  for (int count : used) {
+    EXPECT_GT(count, 0);
+  }
+
+  std::string name = "name0";
+  size_t home = stripes.home(name);
+  EXPECT_EQ(stripes.locate(name), roots[home] + name);
+
+  // a renamed file stays in its root
+  size_t other = (home + 1) % roots.size();
+  touch(roots[other] + name);
+  EXPECT_EQ(stripes.locate(name), roots[other] + name);
+  EXPECT_EQ(stripes.rootOf(stripes.locate(name)), other);
+}
+
+}  // namespace
@@ -0,0 +1,86 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/SyncBatcher.h"
+
+using namespace encfs;
+
+namespace {
+
+class SyncBatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = root;
+  }
+
+  void TearDown() override {
+    for (int fd : fds) {
+      close(fd);
+    }
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  int create(int i) {
+    std::string path = rootDir + "/f" + std::to_string(i);
+    int fd = open(path.c_str(), O_CREAT | O_RDWR, 0600);
+    EXPECT_GE(fd, 0);
+    std::string data(10000, (char)i);
+    EXPECT_EQ(write(fd, data.data(), data.size()), (ssize_t)data.size());
+    fds.push_back(fd);
+    return fd;
+  }
+
+  std::string rootDir;
+  std::vector<int> fds;
+};
+
+TEST_F(SyncBatcherTest, LoneSync) {
+  SyncBatcher batcher(0);
+  EXPECT_EQ(batcher.sync(create(0), false), 0);
+  EXPECT_EQ(batcher.sync(create(1), true), 0);
+  EXPECT_EQ(batcher.sync(-1, false), -EBADF);
+  EXPECT_EQ(batcher.flushes(), 3u);
+  EXPECT_EQ(batcher.requests(), 3u);
+}
+
+TEST_F(SyncBatcherTest, ConcurrentSyncsShareFlushes) {
+  const int Threads = 16;
+  SyncBatcher batcher(20000);
+  std::vector<int> files;
+  for (int i = 0; i < Threads; ++i) {
+    files.push_back(create(i));
+  }
+  // a bad descriptor fails alone
+  files.push_back(-1);
+
+  std::vector<int> results(files.size(), 1);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < files.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      results[i] = batcher.sync(files[i], (i % 2) != 0);
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  for (int i = 0; i < Threads; ++i) {
+    EXPECT_EQ(results[i], 0) << i;
+  }
+  EXPECT_EQ(results.back(), -EBADF);
+  EXPECT_EQ(batcher.requests(), files.size());
+  EXPECT_LT(batcher.flushes(), files.size());
+}
+
+}  // namespace
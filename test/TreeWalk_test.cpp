@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "encfs/TreeWalk.h"
+
+using namespace encfs;
+
+namespace {
+
+using Dirs = std::vector<std::string>;
+
+TEST(TreeWalk, ListsAheadOfWalk) {
+  TreeWalk walk(8);
+  // a directory on its own isn't a walk
+  EXPECT_TRUE(walk.listed("/", {"a", "b", "c"}).empty());
+  EXPECT_TRUE(walk.listed("/elsewhere", {"x"}).empty());
+
+  // going into a subdirectory is: its own, then the next of its parent
+  Dirs ahead = walk.listed("/a", {"x", "y"});
+  EXPECT_EQ(ahead, Dirs({"/a/x", "/a/y", "/b", "/c"}));
+  // not again while in flight
+  EXPECT_TRUE(walk.listed("/a", {"x", "y"}).empty());
+
+  for (const std::string &dir : ahead) {
+    walk.done(dir);
+  }
+  // nor once listed ahead
+  EXPECT_EQ(walk.listed("/a/x", {"deep"}), Dirs({"/a/x/deep"}));
+  walk.done("/a/x/deep");
+  EXPECT_TRUE(walk.listed("/b", {}).empty());
+  walk.stop();
+}
+
+TEST(TreeWalk, Bounded) {
+  TreeWalk walk(2);
+  walk.listed("/", {"a", "b", "c", "d"});
+  EXPECT_EQ(walk.listed("/a", {}), Dirs({"/b", "/c"}));
+  EXPECT_TRUE(walk.listed("/b", {}).empty());
+  walk.done("/b");
+  // /c is still in flight
+  EXPECT_EQ(walk.listed("/b", {}), Dirs({"/d"}));
+  walk.done("/c");
+  walk.done("/d");
+
+  // nothing is handed out once stopped
+  walk.stop();
+  EXPECT_TRUE(walk.listed("/x", {"y"}).empty());
+  EXPECT_TRUE(walk.listed("/x/y", {"z"}).empty());
+}
+
+}  // namespace
@@ -0,0 +1,80 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/Cipher.h"
+#include "encfs/WarmCache.h"
+
+using namespace encfs;
+
+namespace {
+
+class WarmCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = std::string(root) + "/";
+    cipher = Cipher::New("AES", 256);
+    key = cipher->newRandomKey();
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+  }
+
+  std::string rootDir;
+  std::shared_ptr<Cipher> cipher;
+  CipherKey key;
+};
+
+TEST_F(WarmCacheTest, SavedPathsComeBack) {
+  std::vector<std::string> paths = {"abc", "abc/def", "x/y/z"};
+  {
+    WarmCache cache(rootDir, cipher, key);
+    EXPECT_TRUE(cache.load().empty());
+    ASSERT_TRUE(cache.save(paths));
+  }
+  WarmCache cache(rootDir, cipher, key);
+  EXPECT_EQ(cache.load(), paths);
+
+  // only the volume key opens them
+  WarmCache other(rootDir, cipher, cipher->newRandomKey());
+  EXPECT_TRUE(other.load().empty());
+}
+
+TEST_F(WarmCacheTest, DamagedFileIgnored) {
+  WarmCache cache(rootDir, cipher, key);
+  ASSERT_TRUE(cache.save({"abc", "def"}));
+  std::string cmd = "printf 'XXXX' | dd of=" + rootDir +
+                    WarmCache::FileName +
+                    " bs=1 seek=24 conv=notrunc 2>/dev/null";
+  ASSERT_EQ(system(cmd.c_str()), 0);
+  EXPECT_TRUE(cache.load().empty());
+}
+
+TEST_F(WarmCacheTest, WarmsInOrder) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < 100; ++i) {
+    paths.push_back("p" + std::to_string(i));
+  }
+  WarmCache cache(rootDir, cipher, key);
+  ASSERT_TRUE(cache.save(paths));
+
+  std::vector<std::string> warmed;
+  ASSERT_TRUE(cache.start(
+      [&warmed](const std::string &path) { warmed.push_back(path); }));
+  for (int i = 0; i < 5000 && cache.warmed() < paths.size(); ++i) {
+    usleep(1000);
+  }
+  cache.stop();
+  EXPECT_EQ(warmed, paths);
+  EXPECT_EQ(cache.warmed(), paths.size());
+}
+
+}  // namespace
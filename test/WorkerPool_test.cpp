@@ -0,0 +1,196 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <memory>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encfs/WorkerPool.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(WorkerPoolTest, RunsEveryTask) {
+  std::atomic<int> count(0);
+  {
+    WorkerPool pool(3, 1000);
+    EXPECT_EQ(pool.threads(), 3);
+    for (int i = 0; i < 500; ++i) {
+      ASSERT_TRUE(pool.trySubmit([&count]() { ++count; }));
+    }
+  }
+  // queued tasks are run before the pool goes away
+  EXPECT_EQ(count, 500);
+}
+
+TEST(WorkerPoolTest, BoundedQueue) {
+  std::atomic<bool> release(false);
+  std::atomic<int> count(0);
+  {
+    WorkerPool pool(1, 2);
+    auto task = [&]() {
+      while (!release) {
+      }
+      ++count;
+    };
+
+    // the first task may or may not have been taken off the queue yet
+    int accepted = 0;
+    for (int i = 0; i < 10; ++i) {
+      if (pool.trySubmit(task)) {
+        ++accepted;
+      }
+    }
+    EXPECT_GE(accepted, 2);
+    EXPECT_LE(accepted, 3);
+
+    release = true;
+    while (count != accepted) {
+    }
+    EXPECT_TRUE(pool.trySubmit(task));
+  }
+  EXPECT_GE(count, 3);
+}
+
+TEST(WorkerPoolTest, NoThreads) {
+  WorkerPool pool(0, 10);
+  EXPECT_EQ(pool.threads(), 0);
+  EXPECT_FALSE(pool.trySubmit([]() {}));
+
+  int sum = 0;
+  pool.parallelFor(10, [&sum](size_t i) { sum += i; });
+  EXPECT_EQ(sum, 45);
+}
+
+TEST(WorkerPoolTest, ParallelFor) {
+  WorkerPool pool(4, 8);
+  for (size_t count : {0, 1, 2, 7, 1000}) {
+    std::vector<std::atomic<int>> calls(count);
+    pool.parallelFor(count, [&calls](size_t i) { ++calls[i]; });
+    for (auto &c : calls) {
+      EXPECT_EQ(c, 1);
+    }
+  }
+
+  // nested use from a worker, with the queue filling up
+  std::atomic<int> total(0);
+  pool.parallelFor(20, [&](size_t) {
+    pool.parallelFor(20, [&total](size_t) { ++total; });
+  });
+  EXPECT_EQ(total, 400);
+}
+
+TEST(WorkerPoolTest, CpuList) {
+  std::vector<int> cpus;
+  ASSERT_TRUE(WorkerPool::parseCpuList("0-3,8,10-11\n", &cpus));
+  EXPECT_EQ(cpus, std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  ASSERT_TRUE(WorkerPool::parseCpuList("\n", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(WorkerPool::parseCpuList("3-1", &cpus));
+  EXPECT_FALSE(WorkerPool::parseCpuList("a", &cpus));
+}
+
+TEST(WorkerPoolTest, PerNodeQueues) {
+  // two nodes on the CPU we run on, so the threads can be pinned anywhere
+  int cpu = sched_getcpu();
+  ASSERT_GE(cpu, 0);
+  WorkerPool::Topology nodes = {{cpu}, {cpu}};
+
+  std::atomic<int> count(0);
+  {
+    WorkerPool pool(3, 1000, nodes);
+    EXPECT_EQ(pool.nodes(), 2);
+    for (int i = 0; i < 200; ++i) {
+      ASSERT_TRUE(pool.trySubmit([&count]() { ++count; }));
+    }
+    std::vector<int> done(100, 0);
+    pool.parallelFor(done.size(), [&](size_t i) { ++done[i]; });
+    EXPECT_EQ(done, std::vector<int>(100, 1));
+  }
+  EXPECT_EQ(count, 200);
+
+  // fewer threads than nodes: one queue
+  WorkerPool small(1, 10, nodes);
+  EXPECT_EQ(small.nodes(), 1);
+}
+
+TEST(WorkerPoolTest, SetThreads) {
+  std::atomic<int> running(0);
+  std::atomic<int> count(0);
+  // each task waits until all of them run at once, or gives up after a while
+  auto task = [&]() {
+    ++running;
+    for (int i = 0; i < 2000 && running < 4; ++i) {
+      usleep(1000);
+    }
+    if (running >= 4) {
+      ++count;
+    }
+  };
+  {
+    WorkerPool pool(1, 100);
+    ASSERT_TRUE(pool.trySubmit([]() {}));  // start the threads
+
+    pool.setThreads(4);
+    EXPECT_EQ(pool.threads(), 4);
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_TRUE(pool.trySubmit(task));
+    }
+    for (int i = 0; i < 5000 && count < 4; ++i) {
+      usleep(1000);
+    }
+    EXPECT_EQ(count, 4);
+
+    // the surplus threads leave, the rest keep working
+    pool.setThreads(0);
+    EXPECT_EQ(pool.threads(), 1);
+    count = 0;
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(pool.trySubmit([&count]() { ++count; }));
+    }
+  }
+  EXPECT_EQ(count, 100);
+}
+
+// Tasks queued when the process forks run in the child, whether it uses the
+// pool again or only destroys it.
+TEST(WorkerPoolTest, QueuedAcrossFork) {
+  for (bool submit : {true, false}) {
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    std::atomic<int> count(0);
+    std::unique_ptr<WorkerPool> pool(new WorkerPool(1, 10));
+    ASSERT_TRUE(pool->trySubmit([&]() {
+      started = true;
+      while (!release) {
+      }
+    }));
+    while (!started) {
+    }
+    ASSERT_TRUE(pool->trySubmit([&count]() { ++count; }));
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      int wanted = 1;
+      if (submit) {
+        wanted = pool->trySubmit([&count]() { ++count; }) ? 2 : -1;
+        for (int i = 0; i < 5000 && count < wanted; ++i) {
+          usleep(1000);
+        }
+      } else {
+        pool.reset();
+      }
+      _exit(count == wanted ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << submit;
+    release = true;
+  }
+}
+
+}  // namespace
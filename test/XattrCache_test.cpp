@@ -0,0 +1,75 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "encfs/XattrCache.h"
+
+using namespace encfs;
+
+namespace {
+
+const char *Caps = XattrCache::CapabilityName;
+
+TEST(XattrCache, PutMissing) {
+  XattrCache cache(10);
+  cache.put("/a", Caps, cache.generation());
+  cache.put("/a", "user.x", cache.generation());
+
+  EXPECT_TRUE(cache.missing("/a", Caps));
+  EXPECT_TRUE(cache.missing("/a", "user.x"));
+  EXPECT_FALSE(cache.missing("/a", "user.y"));
+  EXPECT_FALSE(cache.missing("/b", Caps));
+  EXPECT_EQ(cache.size(), 1u);
+}
+
+TEST(XattrCache, CapabilityOutlivesTimeout) {
+  XattrCache cache(10);
+  cache.put("/a", Caps, cache.generation());
+  cache.put("/a", "user.x", cache.generation());
+
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(XattrCache::Timeout * 1000 + 50));
+  EXPECT_TRUE(cache.missing("/a", Caps));
+  EXPECT_FALSE(cache.missing("/a", "user.x"));
+
+  cache.put("/b", "user.x", cache.generation());
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(XattrCache::Timeout * 1000 + 50));
+  EXPECT_FALSE(cache.missing("/b", "user.x"));
+  EXPECT_EQ(cache.size(), 1u);
+}
+
+TEST(XattrCache, InvalidateAndClear) {
+  XattrCache cache(10);
+  for (const char *path : {"/a", "/a/b", "/ab"}) {
+    cache.put(path, Caps, cache.generation());
+  }
+
+  cache.invalidate("/a");
+  EXPECT_FALSE(cache.missing("/a", Caps));
+  EXPECT_FALSE(cache.missing("/a/b", Caps));
+  EXPECT_TRUE(cache.missing("/ab", Caps));
+
+  // a setxattr which raced with the lookup wins
+  uint64_t generation = cache.generation();
+  cache.clear();
+  cache.put("/ab", Caps, generation);
+  EXPECT_FALSE(cache.missing("/ab", Caps));
+}
+
+TEST(XattrCache, EvictsLeastRecentlyUsed) {
+  XattrCache cache(2);
+  cache.put("/1", Caps, cache.generation());
+  cache.put("/2", Caps, cache.generation());
+  EXPECT_TRUE(cache.missing("/1", Caps));
+  cache.put("/3", Caps, cache.generation());
+
+  EXPECT_EQ(cache.size(), 2u);
+  EXPECT_TRUE(cache.missing("/1", Caps));
+  EXPECT_FALSE(cache.missing("/2", Caps));
+  EXPECT_TRUE(cache.missing("/3", Caps));
+}
+
+}  // namespace
@@ -0,0 +1,105 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include "encfs/base64.h"
+
+using namespace encfs;
+
+namespace {
+
+// every byte value, at every position of a vector, and lengths around the
+// vector widths
+std::vector<unsigned char> testData(int length, int seed) {
+  std::vector<unsigned char> data(length);
+  for (int i = 0; i < length; ++i) {
+    data[i] = (unsigned char)(i * 7 + seed);
+  }
+  return data;
+}
+
+TEST(Base64, TranslationsMatchScalar) {
+  for (int length = 0; length <= 300; ++length) {
+    for (int seed = 0; seed < 256; seed += 37) {
+      std::vector<unsigned char> in = testData(length, seed);
+
+      std::vector<unsigned char> expected = in;
+      std::vector<unsigned char> actual = in;
+      B64ToAsciiScalar(expected.data(), length);
+      B64ToAscii(actual.data(), length);
+      EXPECT_EQ(actual, expected) << "B64ToAscii " << length;
+
+      expected = in;
+      actual = in;
+      B32ToAsciiScalar(expected.data(), length);
+      B32ToAscii(actual.data(), length);
+      EXPECT_EQ(actual, expected) << "B32ToAscii " << length;
+
+      AsciiToB64Scalar(expected.data(), in.data(), length);
+      AsciiToB64(actual.data(), in.data(), length);
+      EXPECT_EQ(actual, expected) << "AsciiToB64 " << length;
+
+      AsciiToB32Scalar(expected.data(), in.data(), length);
+      AsciiToB32(actual.data(), in.data(), length);
+      EXPECT_EQ(actual, expected) << "AsciiToB32 " << length;
+
+      // in place
+      actual = in;
+      AsciiToB64(actual.data(), length);
+      AsciiToB64Scalar(expected.data(), in.data(), length);
+      EXPECT_EQ(actual, expected) << "AsciiToB64 inplace " << length;
+    }
+  }
+}
+
+TEST(Base64, AsciiRoundTrip) {
+  std::vector<unsigned char> values(64);
+  for (int i = 0; i < 64; ++i) {
+    values[i] = i;
+  }
+
+  std::vector<unsigned char> buf = values;
+  B64ToAscii(buf.data(), 64);
+  EXPECT_EQ(std::string(buf.begin(), buf.end()),
+            ",-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+            "abcdefghijklmnopqrstuvwxyz");
+  AsciiToB64(buf.data(), 64);
+  EXPECT_EQ(buf, values);
+
+  buf.assign(values.begin(), values.begin() + 32);
+  B32ToAscii(buf.data(), 32);
+  EXPECT_EQ(std::string(buf.begin(), buf.end()),
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567");
+  // base32 names are case insensitive
+  for (unsigned char &ch : buf) {
+    ch = tolower(ch);
+  }
+  AsciiToB32(buf.data(), 32);
+  EXPECT_EQ(buf, std::vector<unsigned char>(values.begin(), values.begin() + 32));
+}
+
+TEST(Base64, ChangeBase2InlineMatchesChangeBase2) {
+  for (int pow : {5, 6}) {
+    for (int length = 1; length <= 600; length += 7) {
+      std::vector<unsigned char> in = testData(length, length);
+
+      int outLen = (length * 8 + pow - 1) / pow;
+      std::vector<unsigned char> expected(outLen);
+      changeBase2(in.data(), length, 8, expected.data(), outLen, pow);
+
+      std::vector<unsigned char> buf = in;
+      buf.resize(outLen + 1);
+      changeBase2Inline(buf.data(), length, 8, pow, true);
+      buf.resize(outLen);
+      EXPECT_EQ(buf, expected) << pow << " " << length;
+
+      // and back again
+      changeBase2Inline(buf.data(), outLen, pow, 8, false);
+      buf.resize(length);
+      EXPECT_EQ(buf, in) << pow << " " << length;
+    }
+  }
+}
+
+}  // namespace
@@ -0,0 +1,136 @@
+#include "gtest/gtest.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encfs/Context.h"
+#include "encfs/FileUtils.h"
+#include "encfs/libencfs.h"
+
+using namespace encfs;
+
+namespace {
+
+class LibEncfsTest : public ::testing::Test {
+ protected:
+  // one volume for all tests, as deriving its key takes a while
+  static void SetUpTestCase() {
+    char root[] = "/tmp/encfstestXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    rootDir = new std::string(std::string(root) + "/");
+
+    std::shared_ptr<EncFS_Opts> opts(new EncFS_Opts());
+    opts->rootDir = *rootDir;
+    opts->configMode = Config_Standard;
+    opts->passwordProgram = "echo secret";
+    EncFS_Context ctx;
+    ASSERT_TRUE(createV6Config(&ctx, opts) != nullptr);
+  }
+
+  static void TearDownTestCase() {
+    std::string cmd = "rm -rf " + *rootDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+    delete rootDir;
+  }
+
+  void SetUp() override {
+    ASSERT_EQ(encfs_volume_open(rootDir->c_str(), "secret", 0, &volume), 0);
+  }
+
+  void TearDown() override { encfs_volume_close(volume); }
+
+  static std::string *rootDir;
+  encfs_volume *volume;
+};
+
+std::string *LibEncfsTest::rootDir;
+
+int collect(void *arg, const char *name, int, ino_t) {
+  static_cast<std::set<std::string> *>(arg)->insert(name);
+  return 0;
+}
+
+TEST_F(LibEncfsTest, WrongPassword) {
+  encfs_volume *other = nullptr;
+  EXPECT_EQ(encfs_volume_open(rootDir->c_str(), "wrong", 0, &other), -EACCES);
+  EXPECT_EQ(encfs_volume_open("/nonexistent/dir", "secret", 0, &other),
+            -ENOENT);
+}
+
+TEST_F(LibEncfsTest, WriteReadBack) {
+  encfs_file *file = nullptr;
+  ASSERT_EQ(encfs_file_open(volume, "/data", O_RDWR | O_CREAT | O_EXCL, 0600,
+                            &file),
+            0);
+  // large and unaligned
+  std::vector<unsigned char> data(3 * 1024 * 1024 + 77);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (unsigned char)(i * 7 + i / 4096);
+  }
+  ASSERT_EQ(encfs_pwrite(file, data.data(), data.size(), 0),
+            (ssize_t)data.size());
+  struct stat st;
+  ASSERT_EQ(encfs_fstat(file, &st), 0);
+  EXPECT_EQ(st.st_size, (off_t)data.size());
+  EXPECT_EQ(encfs_file_close(file), 0);
+
+  EXPECT_EQ(encfs_file_open(volume, "/data", O_RDWR | O_CREAT | O_EXCL, 0600,
+                            &file),
+            -EEXIST);
+  ASSERT_EQ(encfs_stat(volume, "/data", &st), 0);
+  EXPECT_EQ(st.st_size, (off_t)data.size());
+  std::set<std::string> names;
+  ASSERT_EQ(encfs_readdir(volume, "/", collect, &names), 0);
+  EXPECT_EQ(names.count("data"), 1u);
+
+  // read from many threads at once
+  ASSERT_EQ(encfs_file_open(volume, "/data", O_RDONLY, 0, &file), 0);
+  std::vector<std::thread> threads;
+  std::vector<int> bad(4, 0);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<unsigned char> buf(256 * 1024);
+      for (off_t off = t * 1000; off < (off_t)data.size();
+           off += buf.size() * 4) {
+        ssize_t len = encfs_pread(file, buf.data(), buf.size(), off);
+        size_t expected = std::min(buf.size(), data.size() - (size_t)off);
+        if (len != (ssize_t)expected ||
+            memcmp(buf.data(), data.data() + off, expected) != 0) {
+          ++bad[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(bad, std::vector<int>(4, 0));
+  EXPECT_EQ(encfs_pwrite(file, data.data(), 1, 0), -EBADF);
+  EXPECT_EQ(encfs_file_close(file), 0);
+
+  ASSERT_EQ(encfs_file_open(volume, "/data", O_WRONLY | O_TRUNC, 0, &file),
+            0);
+  ASSERT_EQ(encfs_fstat(file, &st), 0);
+  EXPECT_EQ(st.st_size, 0);
+  EXPECT_EQ(encfs_file_close(file), 0);
+}
+
+TEST_F(LibEncfsTest, ReadOnlyVolume) {
+  encfs_volume *ro = nullptr;
+  ASSERT_EQ(encfs_volume_open(rootDir->c_str(), "secret",
+                              ENCFS_VOLUME_READONLY, &ro),
+            0);
+  encfs_file *file = nullptr;
+  EXPECT_EQ(encfs_file_open(ro, "/new", O_RDWR | O_CREAT, 0600, &file),
+            -EROFS);
+  EXPECT_EQ(encfs_file_open(ro, "/missing", O_RDONLY, 0, &file), -ENOENT);
+  encfs_volume_close(ro);
+}
+
+}  // namespace